@@ -12,17 +12,34 @@ interface ListenOptions {
   idleTimeout?: number | string,
   congestionLimit?: number | string,
   bufferLimit?: number | string,
+  zeroCopyThreshold?: number | string,
+  receiveBufferSize?: number | string,
+  sendBufferSize?: number | string,
+  notSentLowat?: number | string,
+  congestionControl?: string,
+  busyPoll?: number | string,
+  incomingCpu?: number,
+  fastOpen?: boolean,
   keepAlive?: boolean,
   noDelay?: boolean,
   transparent?: boolean,
+  originalDestinationMap?: number,
   masquerade?: boolean,
   peerStats?: boolean,
+  steering?: 'hash' | 'cpu',
+  acceptBatch?: number,
+  acceptRate?: number,
 }
 
 interface MuxSessionOptions {
   maxIdle?: number | string,
   maxQueue?: number,
   maxMessages?: number,
+  minIdle?: number,
+  maxConnections?: number,
+  priority?: number | (() => number),
+  queueTarget?: number | string,
+  queueInterval?: number | string,
 }
 
 interface MuxOptions extends MuxSessionOptions {
@@ -32,6 +49,7 @@ interface MuxOptions extends MuxSessionOptions {
 interface MuxHTTPOptions extends MuxOptions {
   bufferSize?: number | string,
   maxHeaderSize?: number | string,
+  maxPipeline?: number,
   version?: number | string | (() => number | string),
 }
 
@@ -48,6 +66,7 @@ interface ProxyProtocolHeader {
   targetAddress?: string,
   sourcePort?: number,
   targetPort?: number,
+  tlv?: (type: number) => Data | undefined,
 }
 
 /**
@@ -97,6 +116,10 @@ interface Configuration {
    *   - _transparent_ - Set to _true_ to enable [transparent proxy](https://en.wikipedia.org/wiki/Proxy_server#Transparent_proxy) mode,
    *       where the original destination address and port can be found through `__inbound.destinationAddress` and `__inbound.destinationPort` properties.
    *       This is only available on Linux by using NAT or TPROXY.
+   *   - _originalDestinationMap_ - ID of a BPF map where an eBPF redirect program records original destinations
+   *       in transparent mode. Keys and values are both 8 bytes: an IPv4 address and a port in network byte order
+   *       followed by 2 bytes of padding, the key being the client address and the value the original destination.
+   *       Connections not found in the map fall back to `SO_ORIGINAL_DST`.
    *   - _masquerade_ - Set to _true_ to change the source address of responding UDP packets to the original destination.
    * @returns The same _Configuration_ object.
    */
@@ -205,7 +228,10 @@ interface Configuration {
    * - **SUB-INPUT** - _Data_ stream received from the client with the Proxy Protocol header removed.
    * - **SUB-OUTPUT** - _Data_ stream to send back to the client.
    *
-   * @param handler A function that receives the Proxy Protocol header and returns a boolean determining whether the connection should be accepted.
+   * Addresses from a header with command `"PROXY"` replace _remoteAddress_, _remotePort_, _destinationAddress_
+   * and _destinationPort_ of the inbound, so the handler can be left out when only those are needed.
+   *
+   * @param handler An optional function that receives the Proxy Protocol header and returns a boolean determining whether the connection should be accepted.
    *   The received header includes the following fields:
    *   - _version_ - Could be 1 or 2
    *   - _command_ - Could be `"PROXY"` or `"LOCAL"` for version 2 only
@@ -214,9 +240,11 @@ interface Configuration {
    *   - _sourcePort_ - Source port
    *   - _targetAddress_ - Destination IP address
    *   - _targetPort_ - Destination port
+   *   - _tlv(type)_ - A method returning the value of the first TLV of the given type as _Data_, for version 2 only,
+   *     e.g. `tlv(0xea)` for the AWS VPC endpoint ID with a leading subtype byte
    * @returns The same _Configuration_ object.
    */
-  acceptProxyProtocol(handler: (header: ProxyProtocolHeader) => boolean): Configuration;
+  acceptProxyProtocol(handler?: (header: ProxyProtocolHeader) => boolean): Configuration;
 
   /**
    * Appends an _acceptSOCKS_ filter to the current pipeline layout.
@@ -229,7 +257,10 @@ interface Configuration {
    * - **SUB-OUTPUT** - _Data_ stream to send to the client via SOCKS.
    *
    * @param handler A function that receives _host_, _port_ and _username_ of the SOCKS request and
-   *   returns _true_ to accept the connection or _false_ to refuse it
+   *   returns _true_ to accept the connection or _false_ to refuse it.
+   *   For a SOCKS5 UDP ASSOCIATE, _command_ of the request is _"associate"_ and the handler can return
+   *   the _"host:port"_ of the UDP relay where the client should send datagrams, usually a UDP listener
+   *   running _decodeSOCKSDatagram_ and _encodeSOCKSDatagram_
    * @returns The same _Configuration_ object.
    */
   acceptSOCKS(handler: (host, port, id) => boolean): Configuration;
@@ -257,6 +288,8 @@ interface Configuration {
    *   - _alpn_ - (optional) An array of allowed protocol names, or a function that receives an array of client-preferred protocol names
    *       and returns the index of the server-chosen protocol in that array.
    *   - _handshake_ - (optional) A callback function that receives the negotiated protocol name after handshake.
+   *   - _dynamicRecordSize_ - (optional) If true, TLS records start at about 1400 bytes and grow to 16K after about 1MB is sent,
+   *       shrinking back after 1 second of idle. Defaults to false.
    * @returns The same _Configuration_ object.
    */
   acceptTLS(
@@ -266,6 +299,73 @@ interface Configuration {
       verify?: (ok: boolean, cert: Certificate) => boolean,
       alpn?: string[] | ((protocolNames: string[]) => number),
       handshake?: (protocolName: string | undefined) => void,
+      dynamicRecordSize?: boolean,
+    }
+  ): Configuration;
+
+  /**
+   * Appends an _adaptiveConcurrency_ filter to the current pipeline layout.
+   *
+   * An _adaptiveConcurrency_ filter limits the number of streams concurrently going through its sub-pipeline,
+   * adjusting the limit continuously from the round-trip time measured between a request entering
+   * the sub-pipeline and its response coming out. Streams over the limit wait in a queue, or get
+   * rejected with a _StreamEnd_ of error `"Overloaded"` when the queue is full.
+   * The current limit is published as metric _pipy_adaptive_concurrency_limit_.
+   *
+   * - **INPUT** - Any types of _Events_ to stream into the sub-pipeline.
+   * - **OUTPUT** - _Events_ streaming out from the sub-pipeline.
+   * - **SUB-INPUT** - _Events_ streaming into the _adaptiveConcurrency_ filter.
+   * - **SUB-OUTPUT** - Any types of _Events_.
+   *
+   * @param options Options including:
+   *   - _algorithm_ - (optional) Either `"gradient2"` (default) or `"vegas"`.
+   *   - _initialLimit_ - (optional) Limit to start with. Defaults to 20.
+   *   - _minLimit_ - (optional) Lower bound of the limit. Defaults to 1.
+   *   - _maxLimit_ - (optional) Upper bound of the limit. Defaults to 1000.
+   *   - _maxQueue_ - (optional) Maximum number of streams waiting for admission. Defaults to 0.
+   *   - _tolerance_ - (optional) RTT increase tolerated by Gradient2 before backing off. Defaults to 1.5.
+   *   - _smoothing_ - (optional) Weight of new limit estimates by Gradient2. Defaults to 0.2.
+   *   - _name_ - (optional) Label of the limit in the metrics.
+   * @returns The same _Configuration_ object.
+   */
+  adaptiveConcurrency(
+    options?: {
+      algorithm?: 'gradient2' | 'vegas',
+      initialLimit?: number,
+      minLimit?: number,
+      maxLimit?: number,
+      maxQueue?: number,
+      tolerance?: number,
+      smoothing?: number,
+      name?: string,
+    }
+  ): Configuration;
+
+  /**
+   * Appends an _aggregateKafkaProduce_ filter to the current pipeline layout.
+   *
+   * An _aggregateKafkaProduce_ filter coalesces Kafka ProduceRequests into fewer and larger ones before they go to its sub-pipeline,
+   * merging the records for each partition into one record batch, and splits the ProduceResponses coming back
+   * into responses to the original requests, in the order they came in.
+   * Only uncompressed, non-transactional and non-idempotent batches of ProduceRequest v3 to v8 are merged.
+   * Any other requests go through unchanged. Put it under a _mux_ filter to aggregate requests from many clients.
+   *
+   * - **INPUT** - Kafka request _Messages_ as decoded by _decodeKafka_.
+   * - **OUTPUT** - Kafka response _Messages_ for the input requests.
+   * - **SUB-INPUT** - Kafka request _Messages_ with ProduceRequests merged.
+   * - **SUB-OUTPUT** - Kafka response _Messages_ as decoded by _decodeKafka({ isResponse: true })_.
+   *
+   * @param options Options including:
+   *   - _maxDelay_ - (optional) Longest time a ProduceRequest waits for others to merge with. Defaults to 5ms.
+   *   - _maxSize_ - (optional) Size of the merged ProduceRequest to send it off at. Defaults to 1MB.
+   *   - _maxRequests_ - (optional) Number of merged ProduceRequests to send them off at. Defaults to 100.
+   * @returns The same _Configuration_ object.
+   */
+  aggregateKafkaProduce(
+    options?: {
+      maxDelay?: number | string,
+      maxSize?: number | string,
+      maxRequests?: number,
     }
   ): Configuration;
 
@@ -315,6 +415,74 @@ interface Configuration {
     ...restBranches: (((msg: Message) => boolean)|string|((pipelineConfigurator: Configuration) => void))[]
   ): Configuration;
 
+  /**
+   * Appends a _cacheDNS_ filter to the current pipeline layout.
+   *
+   * A _cacheDNS_ filter answers DNS queries from a response cache shared by all worker threads.
+   * Each _Data_ event is taken as one DNS message, as it comes from a UDP listener.
+   * Hits are answered with the ID and TTLs of the cached response patched in place, without running any script.
+   * Misses go to the sub-pipeline and NOERROR or NXDOMAIN responses coming back are stored.
+   *
+   * - **INPUT** - _Data_ as DNS queries.
+   * - **OUTPUT** - _Data_ as DNS responses, either from the cache or from the sub-pipeline.
+   * - **SUB-INPUT** - _Data_ as DNS queries that missed the cache.
+   * - **SUB-OUTPUT** - _Data_ as DNS responses.
+   *
+   * @param options Options including:
+   *   - _name_ - Name of the cache. Filters using the same name share the same cache. Default is `""`.
+   *   - _size_ - Total size of responses kept in memory. Default is `"16m"`.
+   *   - _minTTL_ - Lower bound of how long a positive answer is kept. Default is 0.
+   *   - _maxTTL_ - Upper bound of how long a positive answer is kept. Default is `"1d"`.
+   *   - _negativeTTL_ - Upper bound of how long a negative answer is kept. Default is `"5m"`.
+   * @returns The same _Configuration_ object.
+   */
+  cacheDNS(
+    options?: {
+      name?: string,
+      size?: number | string,
+      minTTL?: number | string,
+      maxTTL?: number | string,
+      negativeTTL?: number | string,
+    }
+  ): Configuration;
+
+  /**
+   * Appends a _cacheHTTP_ filter to the current pipeline layout.
+   *
+   * A _cacheHTTP_ filter answers HTTP GET requests from a response cache shared by all worker threads.
+   * Cache misses go to the sub-pipeline and cacheable responses coming back are stored.
+   * Concurrent misses on the same key wait for the first one to finish rather than all going upstream.
+   *
+   * - **INPUT** - HTTP _Messages_ as requests.
+   * - **OUTPUT** - HTTP _Messages_ as responses, either from the cache or from the sub-pipeline.
+   * - **SUB-INPUT** - HTTP _Messages_ as requests that missed the cache.
+   * - **SUB-OUTPUT** - HTTP _Messages_ as responses.
+   *
+   * @param options Options including:
+   *   - _name_ - Name of the cache. Filters using the same name share the same cache. Default is `""`.
+   *   - _size_ - Total size of objects kept in memory. Default is `"64m"`.
+   *   - _maxObjectSize_ - Maximum size of a response body to be cached. Default is `"1m"`.
+   *   - _ttl_ - Freshness lifetime for responses with no explicit expiration. Default is 0 for none.
+   *   - _lockTimeout_ - Maximum time to wait for another request fetching the same key. Default is `5`.
+   *   - _diskPath_ - Directory to keep objects evicted from memory. Default is none.
+   *   - _diskSize_ - Total size of objects kept on disk. Default is 0.
+   *   - _key_ - A function that receives the request head and returns the cache key,
+   *       or `undefined` to bypass the cache. Default is the host and path of the request.
+   * @returns The same _Configuration_ object.
+   */
+  cacheHTTP(
+    options?: {
+      name?: string,
+      size?: number | string,
+      maxObjectSize?: number | string,
+      ttl?: number | string,
+      lockTimeout?: number | string,
+      diskPath?: string,
+      diskSize?: number | string,
+      key?: (head: HttpRequestHead) => string,
+    }
+  ): Configuration;
+
   /**
    * Appends a _chain_ filter to the current pipeline layout.
    *
@@ -334,6 +502,35 @@ interface Configuration {
    */
   chain(modules?: string[]): Configuration;
 
+  /**
+   * Appends a _coalesce_ filter to the current pipeline layout.
+   *
+   * A _coalesce_ filter sends only one of the concurrent requests with the same key to the sub-pipeline.
+   * The others, from any worker thread, wait for its response and get a copy of it without going upstream.
+   *
+   * - **INPUT** - _Messages_ as requests.
+   * - **OUTPUT** - _Messages_ as responses, either from the sub-pipeline or shared from another request.
+   * - **SUB-INPUT** - _Messages_ as requests that lead for their keys.
+   * - **SUB-OUTPUT** - _Messages_ as responses.
+   *
+   * @param key A function that receives the request head and returns the key,
+   *   or `undefined` to send the request to the sub-pipeline on its own.
+   * @param options Options including:
+   *   - _name_ - Name of the group. Filters using the same name coalesce with each other. Default is `""`.
+   *   - _maxSize_ - Maximum size of a response body to be shared.
+   *       Waiters on a larger response go to the sub-pipeline on their own. Default is `"1m"`.
+   *   - _timeout_ - Maximum time to wait for the leading request. Default is `5`.
+   * @returns The same _Configuration_ object.
+   */
+  coalesce(
+    key: (head: object) => any,
+    options?: {
+      name?: string,
+      maxSize?: number | string,
+      timeout?: number | string,
+    }
+  ): Configuration;
+
   /**
    * Appends a _compress_ filter to the current pipeline layout.
    *
@@ -344,9 +541,11 @@ interface Configuration {
    *
    * @param algorithm Compression algorithm or a function that returns the compression algorithm.
    *       Available compression algorithms are `"deflate"`, `"gzip"`.
+   * @param options Options including:
+   *   - dictionary - Preset dictionary for `"deflate"`, shared with the decompressing side.
    * @returns The same _Configuration_ object.
    */
-  compress(algorithm: string | (() => string)): Configuration;
+  compress(algorithm: string | (() => string), options?: { dictionary?: Data | string }): Configuration;
 
   /**
    * Appends a _compressHTTP_ filter to the current pipeline layout.
@@ -363,12 +562,19 @@ interface Configuration {
    *   - level - Compression level or a function that returns the compression level.
    *       Available compression levels are `"default"`, `"speed"` and `"best"`.
    *       Default is `"default"`.
+   *   - cacheSize - Total size of compressed bodies kept for reuse when the same content
+   *       is sent again. Only bodies with a known content-length are cached.
+   *       Default is 0 for no caching.
+   *   - parallelThreshold - Minimum content-length of a body to be compressed in blocks
+   *       on a thread pool. Default is 0 for never.
    * @returns The same _Configuration_ object.
    */
   compressHTTP(
     options?: {
       method?: '' | 'deflate' | 'gzip' | (() => (''|'deflate'|'gzip')),
       level?: 'default' | 'speed' | 'best' | (() => ('default'|'speed'|'best')),
+      cacheSize?: number | string,
+      parallelThreshold?: number | string,
     }
   ): Configuration;
 
@@ -388,6 +594,9 @@ interface Configuration {
    *       Can be a number in bytes or a string with a unit suffix such as `'k'`, `'m'`, `'g'` and `'t'`.
    *   - _bufferLimit_ - Maximum size of data allowed to stay in output buffer as a result of insufficient outbound bandwidth.
    *       Can be a number in bytes or a string with a unit suffix such as `'k'`, `'m'`, `'g'` and `'t'`.
+   *   - _zeroCopyThreshold_ - Size of output backlog from which writes are sent with `MSG_ZEROCOPY` instead of being copied.
+   *       Can be a number in bytes or a string with a unit suffix such as `'k'`, `'m'`, `'g'` and `'t'`.
+   *       Linux only. Defaults to 0 for never.
    *   - _retryCount_ - How many times it should retry connection after a failure, or -1 for the infinite retries. Defaults to 0.
    *   - _retryDelay_ - Time duration to wait between connection retries. Defaults to 0.
    *   - _connectTimeout_ - Timeout while connecting.
@@ -404,6 +613,19 @@ interface Configuration {
    *       Defaults to 1 minute.
    *   - _keepAlive_ - Enable sending of keep-alive messages on TCP connections. Defaults to true.
    *   - _noDelay_ - If set, disable the Nagle algorithm. Defaults to true.
+   *   - _receiveBufferSize_ - Size of the kernel receive buffer (`SO_RCVBUF`). Defaults to the system setting.
+   *   - _sendBufferSize_ - Size of the kernel send buffer (`SO_SNDBUF`). Defaults to the system setting.
+   *   - _notSentLowat_ - Amount of unsent data in the kernel above which the socket stops being writable
+   *       (`TCP_NOTSENT_LOWAT`), keeping the rest queued in Pipy instead. Defaults to the system setting.
+   *   - _congestionControl_ - Name of the congestion control algorithm, such as `"bbr"` or `"cubic"`.
+   *       The algorithm must be available in the kernel. Defaults to the system setting.
+   *   - _busyPoll_ - Duration to busy poll the device queue for received data (`SO_BUSY_POLL`).
+   *       Can be a number in seconds or a string with one of the time unit suffixes. Defaults to no busy polling.
+   *   - _incomingCpu_ - CPU that the socket is associated with for receive processing (`SO_INCOMING_CPU`).
+   *   - _fastOpen_ - If set, send the first data with the SYN using TCP Fast Open. Linux only. Defaults to false.
+   *   - _splice_ - If set, relay data between the inbound and outbound TCP connections inside the kernel
+   *       whenever nothing is buffered for the receiving side. Only use it when the rest of the data path
+   *       does not inspect or change the data. Linux only. Defaults to false.
    * @returns The same _Configuration_ object.
    */
   connect(
@@ -413,6 +635,7 @@ interface Configuration {
       bind?: string | (() => string),
       congestionLimit?: number | string,
       bufferLimit?: number | string,
+      zeroCopyThreshold?: number | string,
       retryCount?: number,
       retryDelay?: number | string,
       connectTimeout?: number | string,
@@ -421,6 +644,14 @@ interface Configuration {
       idleTimeout?: number | string,
       keepAlive?: boolean,
       noDelay?: boolean,
+      receiveBufferSize?: number | string,
+      sendBufferSize?: number | string,
+      notSentLowat?: number | string,
+      congestionControl?: string,
+      busyPoll?: number | string,
+      incomingCpu?: number,
+      fastOpen?: boolean,
+      splice?: boolean,
       onState?: (inbound: Inbound) => void,
     }
   ): Configuration;
@@ -499,6 +730,8 @@ interface Configuration {
    *   - _sni_ - (optional) SNI server name or a function that returns it
    *   - _alpn_ - (optional) Requested protocol name or an array of preferred protocol names
    *   - _handshake_ - (optional) A callback function that receives the negotiated protocol name after handshake.
+   *   - _dynamicRecordSize_ - (optional) If true, TLS records start at about 1400 bytes and grow to 16K after about 1MB is sent,
+   *       shrinking back after 1 second of idle. Defaults to false.
    * @returns The same _Configuration_ object.
    */
   connectTLS(
@@ -509,6 +742,7 @@ interface Configuration {
       alpn?: string | string[],
       sni?: string | (() => string),
       handshake?: (protocolName: string | undefined) => void,
+      dynamicRecordSize?: boolean,
     }
   ): Configuration;
 
@@ -531,9 +765,33 @@ interface Configuration {
    * - **INPUT** - _Data_ stream to decode Dubbo messages from.
    * - **OUTPUT** - Dubbo _Messages_ decoded from the input _Data_ stream.
    *
+   * With _peekService_ set, the Dubbo version, service name, service version and method name
+   * are read from the start of Hessian2 request bodies into the message head. Bodies are not decoded.
+   *
+   * @param options Options including:
+   *   - _peekService_ - A boolean to fill in _serviceName_ and _methodName_ of request heads. Default is _false_.
+   * @returns The same _Configuration_ object.
+   */
+  decodeDubbo(
+    options?: {
+      peekService?: boolean,
+    }
+  ): Configuration;
+
+  /**
+   * Appends a _decodeGRPC_ filter to the current pipeline layout.
+   *
+   * A _decodeGRPC_ filter splits the bodies of HTTP messages into length-prefixed [gRPC](https://grpc.io/) messages.
+   * Each gRPC message head has _compressed_ and the enclosing HTTP message head as _head_.
+   * The tail of the last gRPC message in an HTTP message has _end_ set and the HTTP trailers as _trailers_.
+   * An HTTP message with no gRPC messages in it comes out as one with _trailersOnly_ set in the head.
+   *
+   * - **INPUT** - HTTP _Messages_ carrying gRPC messages in their bodies.
+   * - **OUTPUT** - gRPC _Messages_ with their bodies sharing the input _Data_ chunks.
+   *
    * @returns The same _Configuration_ object.
    */
-  decodeDubbo(): Configuration;
+  decodeGRPC(): Configuration;
 
   /**
    * Appends a _decodeHTTPRequest_ filter to the current pipeline layout.
@@ -559,6 +817,22 @@ interface Configuration {
    */
   decodeHTTPResponse(handler?: (evt: MessageStart) => MessageStart): Configuration;
 
+  /**
+   * Appends a _decodeKafka_ filter to the current pipeline layout.
+   *
+   * A _decodeKafka_ filter decodes [Kafka](https://kafka.apache.org/protocol) requests or responses from a raw byte stream.
+   * A request head has _apiKey_, _apiVersion_, _correlationId_ and _clientId_, and a response head has _correlationId_.
+   * Header tagged fields of flexible versions are left at the start of the body.
+   *
+   * - **INPUT** - _Data_ stream to decode Kafka messages from.
+   * - **OUTPUT** - Kafka _Messages_ decoded from the input _Data_ stream.
+   *
+   * @param options Options including:
+   *   - _isResponse_ - (optional) Decode responses instead of requests. Defaults to false.
+   * @returns The same _Configuration_ object.
+   */
+  decodeKafka(options?: { isResponse?: boolean }): Configuration;
+
   /**
    * Appends a _decodeMQTT_ filter to the current pipeline layout.
    *
@@ -590,6 +864,19 @@ interface Configuration {
    */
   decodeRESP(): Configuration;
 
+  /**
+   * Appends a _decodeSOCKSDatagram_ filter to the current pipeline layout.
+   *
+   * A _decodeSOCKSDatagram_ filter decodes datagrams relayed for a SOCKS5 UDP ASSOCIATE.
+   * Fragmented datagrams are dropped.
+   *
+   * - **INPUT** - _Data_ events, each being one UDP datagram with a SOCKS5 UDP request header.
+   * - **OUTPUT** - _Messages_ with heads of _{ ip, domain, port }_ for the destination and bodies of the payload.
+   *
+   * @returns The same _Configuration_ object.
+   */
+  decodeSOCKSDatagram(): Configuration;
+
   /**
    * Appends a _decodeThrift_ filter to the current pipeline layout.
    *
@@ -598,9 +885,18 @@ interface Configuration {
    * - **INPUT** - _Data_ stream to decode Thrift messages from.
    * - **OUTPUT** - Thrift _Messages_ decoded from the input _Data_ stream.
    *
+   * With _headersOnly_ set, only the message head is decoded. Field values are skipped over
+   * and the message body is left undecoded, which is cheaper when only routing by method name.
+   *
+   * @param options Options including:
+   *   - _headersOnly_ - A boolean to skip building field values. Default is _false_.
    * @returns The same _Configuration_ object.
    */
-  decodeThrift(): Configuration;
+  decodeThrift(
+    options?: {
+      headersOnly?: boolean,
+    }
+  ): Configuration;
 
   /**
    * Appends a _decodeWebSocket_ filter to the current pipeline layout.
@@ -610,9 +906,13 @@ interface Configuration {
    * - **INPUT** - _Data_ stream to decode WebSocket messages from.
    * - **OUTPUT** - WebSocket _Messages_ decoded from the input _Data_ stream.
    *
+   * @param options Options including:
+   *   - _permessageDeflate_ - Inflates messages compressed with the
+   *       [permessage-deflate](https://datatracker.ietf.org/doc/html/rfc7692) extension
+   *       agreed on in the handshake. Default is _false_.
    * @returns The same _Configuration_ object.
    */
-  decodeWebSocket(): Configuration;
+  decodeWebSocket(options?: { permessageDeflate?: boolean }): Configuration;
 
   /**
    * Appends a _decompress_ filter to the current pipeline layout.
@@ -625,9 +925,11 @@ interface Configuration {
    * @param algorithm Algorithm used in decompression.
    *   Available algorithms include `"inflate"`, `"brotli"`.
    *   Can be one of these strings or a function that returns one of them.
+   * @param options Options including:
+   *   - dictionary - Preset dictionary for `"inflate"` streams that require one.
    * @returns The same _Configuration_ object.
    */
-  decompress(algorithm: string | (() => 'inflate' | 'brotli')): Configuration;
+  decompress(algorithm: string | (() => 'inflate' | 'brotli'), options?: { dictionary?: Data | string }): Configuration;
 
   /**
    * Appends a _decompressHTTP_ filter to the current pipeline layout.
@@ -637,9 +939,11 @@ interface Configuration {
    * - **INPUT** - HTTP _Messages_ to decompress.
    * - **OUTPUT** - Decompressed HTTP _Messages_.
    *
+   * @param options Options including:
+   *   - dictionary - Preset dictionary for `deflate` bodies that require one.
    * @returns The same _Configuration_ object.
    */
-  decompressHTTP(): Configuration;
+  decompressHTTP(options?: { dictionary?: Data | string }): Configuration;
 
   /**
    * Appends a _deframe_ filter to the current pipeline layout.
@@ -696,12 +1000,13 @@ interface Configuration {
    * Appends a _detectProtocol_ filter to the current pipeline layout.
    *
    * A _detectProtocol_ filter calls a user function to notify what protocol the input _Data_ stream is.
+   * All signatures are matched in a single pass and the function is called as soon as the first bytes decide.
    *
    * - **INPUT** - _Data_ stream to detect protocol for.
    * - **OUTPUT** - The same _Data_ stream as input.
    *
    * @param handler A function that receives the detected protocol.
-   *   Its parameter can be `"TLS"` or `"HTTP"`.
+   *   Its parameter can be `"TLS"`, `"HTTP"`, `"HTTP2"`, `"MQTT"`, `"Redis"` or `"Dubbo"`.
    *   When no known protocols can be detected, it receives `""`.
    * @returns The same _Configuration_ object.
    */
@@ -755,6 +1060,20 @@ interface Configuration {
    */
   encodeDubbo(): Configuration;
 
+  /**
+   * Appends an _encodeGRPC_ filter to the current pipeline layout.
+   *
+   * An _encodeGRPC_ filter puts [gRPC](https://grpc.io/) messages into HTTP messages with a length prefix on each.
+   * An HTTP message starts with the _head_ of the first gRPC message head,
+   * and ends after a gRPC message whose tail has _end_ or _trailers_ set, with _trailers_ as the HTTP trailers.
+   *
+   * - **INPUT** - gRPC _Messages_ to encode.
+   * - **OUTPUT** - HTTP _Messages_ carrying the gRPC messages in their bodies.
+   *
+   * @returns The same _Configuration_ object.
+   */
+  encodeGRPC(): Configuration;
+
   /**
    * Appends an _encodeHTTPRequest_ filter to the current pipeline layout.
    *
@@ -793,6 +1112,19 @@ interface Configuration {
     bufferSize?: number | string,
   }): Configuration;
 
+  /**
+   * Appends an _encodeKafka_ filter to the current pipeline layout.
+   *
+   * An _encodeKafka_ filter encodes [Kafka](https://kafka.apache.org/protocol) messages into a raw byte stream.
+   * A message is encoded as a request when _isRequest_ is set in its head, or as a response otherwise.
+   *
+   * - **INPUT** - Kafka _Messages_ to encode.
+   * - **OUTPUT** - Encoded _Data_ stream from the input Kafka messages.
+   *
+   * @returns The same _Configuration_ object.
+   */
+  encodeKafka(): Configuration;
+
   /**
    * Appends an _encodeMQTT_ filter to the current pipeline layout.
    *
@@ -812,6 +1144,16 @@ interface Configuration {
    */
   encodeRESP(): Configuration;
 
+  /**
+   * Appends an _encodeSOCKSDatagram_ filter to the current pipeline layout.
+   *
+   * - **INPUT** - _Messages_ with heads of _{ ip, domain, port }_ for the source and bodies of the payload.
+   * - **OUTPUT** - _Data_ events, each being one UDP datagram with a SOCKS5 UDP request header.
+   *
+   * @returns The same _Configuration_ object.
+   */
+  encodeSOCKSDatagram(): Configuration;
+
   /**
    * Appends an _encodeThrift_ filter to the current pipeline layout.
    *
@@ -832,22 +1174,70 @@ interface Configuration {
    * - **INPUT** - WebSocket _Messages_ to encode.
    * - **OUTPUT** - Encoded _Data_ stream from the input WebSocket messages.
    *
+   * @param options Options including:
+   *   - _permessageDeflate_ - Compresses text and binary messages with the
+   *       [permessage-deflate](https://datatracker.ietf.org/doc/html/rfc7692) extension
+   *       agreed on in the handshake. Default is _false_.
+   *   - _noContextTakeover_ - Starts every message with an empty window. Default is _false_.
+   *   - _maxWindowBits_ - Size of the compression window as a power of 2, from 8 to 15. Default is _15_.
    * @returns The same _Configuration_ object.
    */
-  encodeWebSocket(): Configuration;
+  encodeWebSocket(options?: {
+    permessageDeflate?: boolean,
+    noContextTakeover?: boolean,
+    maxWindowBits?: number,
+  }): Configuration;
 
   /**
    * Appends an _exec_ filter to the current pipeline layout.
    *
    * An _exec_ filter starts a child process and links to its standard input and output.
    *
-   * - **INPUT** - The child process's standard input _Data_ stream.
-   * - **OUTPUT** - The child process's standard output _Data_ stream.
+   * With _options.pool_, child processes are not started per stream but kept running in a pool
+   * shared by all _exec_ filters on the same thread with the same command.
+   * Each message, or all _Data_ up to _StreamEnd_ without message boundaries, makes one request,
+   * written to a worker's standard input as a 4-byte big-endian length followed by the payload.
+   * The worker answers on its standard output with a frame of the same format.
+   * A worker handles one request at a time, and requests wait while all workers are busy.
+   * Workers inherit the standard error of Pipy and should exit when their standard input is closed.
+   *
+   * - **INPUT** - The child process's standard input _Data_ stream, or requests in pool mode.
+   * - **OUTPUT** - The child process's standard output _Data_ stream, or responses in pool mode.
    *
    * @param command A string or a function that returns a string containing the shell command to execute.
+   * @param options Options including:
+   *   - _stderr_ - Outputs standard error along with standard output. Default is _false_.
+   *   - _pty_ - Runs the child process in a pseudo-terminal. Default is _false_.
+   *   - _pool_ - Maximum number of worker processes per thread. Default is _0_, starting a new process for every stream.
+   *   - _onStart_ - Callback when the child process starts, receiving its PID.
+   *   - _onExit_ - Callback when the child process exits, receiving its exit code and standard error output.
+   * @returns The same _Configuration_ object.
+   */
+  exec(command: string | (() => string), options?: {
+    stderr?: boolean,
+    pty?: boolean,
+    pool?: number,
+    onStart?: (pid: number) => void,
+    onExit?: (code: number, stderr?: Data) => void | Event | Message | (Event | Message)[],
+  }): Configuration;
+
+  /**
+   * Appends a _fanoutMQTT_ filter to the current pipeline layout.
+   *
+   * A _fanoutMQTT_ filter keeps the subscriptions of an MQTT client in a topic trie shared by all threads,
+   * and delivers each PUBLISH to every client subscribed to a matching topic filter, with `+` and `#` wildcards.
+   * The payload of one PUBLISH is shared by all deliveries without copying.
+   * It answers PUBLISH, PUBREL, SUBSCRIBE and UNSUBSCRIBE by itself and takes in PUBACK, PUBREC and PUBCOMP,
+   * while all other packets such as CONNECT and PINGREQ pass through.
+   * Retained messages and resending of unacknowledged deliveries are not supported.
+   *
+   * - **INPUT** - MQTT _Messages_ from a client, as decoded by _decodeMQTT_.
+   * - **OUTPUT** - MQTT _Messages_ to the client, including deliveries, to be encoded by _encodeMQTT_.
+   *
+   * @param trie Name of the topic trie, or a function that returns it. Filters with the same name share one trie.
    * @returns The same _Configuration_ object.
    */
-  exec(command: string | (() => string)): Configuration;
+  fanoutMQTT(trie: string | (() => string)): Configuration;
 
   /**
    * Appends a _fork_ filter to the current pipeline layout.
@@ -862,9 +1252,15 @@ interface Configuration {
    * @param startupValues An array of _startup values_, or a function that returns that.
    *   Each startup value will be given to a newly created sub-pipeline via the
    *   parameter to its `onStart()` callback.
+   * @param options Options including:
+   *   - _bufferLimit_ - Bytes each sub-pipeline can have waiting while it's congested.
+   *     When given, a slow sub-pipeline stops slowing down the others and the input.
+   *     Instead it gets a _StreamEnd_ with a buffer overflow once over the limit.
+   *     Can be a number or a string with a unit suffix such as 'k', 'm' or 'g'.
+   *     Default is 0, where congestion in any sub-pipeline throttles the input.
    * @returns The same _Configuration_ object.
    */
-  fork(startupValues?: any[] | (() => any[])): Configuration;
+  fork(startupValues?: any[] | (() => any[]), options?: { bufferLimit?: number | string }): Configuration;
 
   /**
    * Appends a _handleData_ filter to the current pipeline layout.
@@ -1002,6 +1398,30 @@ interface Configuration {
    */
   loop(pipelineLayout: (config: Configuration) => void): Configuration;
 
+  /**
+   * Appends a _mirror_ filter to the current pipeline layout.
+   *
+   * A _mirror_ filter sends a copy of its input to a named pipeline layout on another worker thread.
+   * Whatever that pipeline outputs is discarded. The input passes through without waiting for the shadow.
+   *
+   * - **INPUT** - Any types of _Events_.
+   * - **OUTPUT** - Same _Events_ as input.
+   *
+   * @param pipelineLayoutName The name of the pipeline layout to mirror to, or a function that returns that.
+   * @param options Options including:
+   *   - _percentage_ - Percentage of streams to mirror, from 0 to 100. Default is 100.
+   *   - _bufferLimit_ - Bytes a shadow stream can fall behind before it's dropped.
+   *     Can be a number or a string with a unit suffix such as 'k', 'm' or 'g'. Default is 1MB.
+   * @returns The same _Configuration_ object.
+   */
+  mirror(
+    pipelineLayoutName: string | (() => string),
+    options?: {
+      percentage?: number,
+      bufferLimit?: number | string,
+    }
+  ): Configuration;
+
   /**
    * Appends a _mux_ filter to the current pipeline layout.
    *
@@ -1019,6 +1439,15 @@ interface Configuration {
    *       Defaults is _60 seconds_.
    *   - _maxQueue_ - Maximum number of messages allowed to run concurrently in one sub-pipeline.
    *   - _maxMessages_ - Maximum number of messages allowed to run accumulatively in one sub-pipeline.
+   *   - _minIdle_ - Number of idle sub-pipelines to keep open ahead of demand. Default is 0.
+   *   - _maxConnections_ - Maximum number of sub-pipelines per session key,
+   *       beyond which messages wait for one to become available. Default is 0 for unlimited.
+   *   - _priority_ - Priority of the stream when waiting for a sub-pipeline, or a function that returns it.
+   *       Higher priorities are admitted first. Default is 0.
+   *   - _queueTarget_ - Target queueing delay. Once exceeded for a whole _queueInterval_,
+   *       waiting streams are shed lowest priority first with a StreamEnd of error `"Overloaded"`.
+   *       Default is 0 for no shedding.
+   *   - _queueInterval_ - Interval over which _queueTarget_ is enforced. Default is _100 milliseconds_.
    * @returns The same _Configuration_ object.
    */
   mux(
@@ -1036,6 +1465,15 @@ interface Configuration {
    *       Defaults is _60 seconds_.
    *   - _maxQueue_ - Maximum number of messages allowed to run concurrently in one sub-pipeline.
    *   - _maxMessages_ - Maximum number of messages allowed to run accumulatively in one sub-pipeline.
+   *   - _minIdle_ - Number of idle sub-pipelines to keep open ahead of demand. Default is 0.
+   *   - _maxConnections_ - Maximum number of sub-pipelines per session key,
+   *       beyond which messages wait for one to become available. Default is 0 for unlimited.
+   *   - _priority_ - Priority of the stream when waiting for a sub-pipeline, or a function that returns it.
+   *       Higher priorities are admitted first. Default is 0.
+   *   - _queueTarget_ - Target queueing delay. Once exceeded for a whole _queueInterval_,
+   *       waiting streams are shed lowest priority first with a StreamEnd of error `"Overloaded"`.
+   *       Default is 0 for no shedding.
+   *   - _queueInterval_ - Interval over which _queueTarget_ is enforced. Default is _100 milliseconds_.
    * @returns The same _Configuration_ object.
    */
   mux(
@@ -1059,9 +1497,21 @@ interface Configuration {
    *       Defaults is `60` seconds.
    *   - _maxQueue_ - Maximum number of messages allowed to run concurrently in one sub-pipeline.
    *   - _maxMessages_ - Maximum number of messages allowed to run accumulatively in one sub-pipeline.
+   *   - _minIdle_ - Number of idle sub-pipelines to keep open ahead of demand. Default is 0.
+   *   - _maxConnections_ - Maximum number of sub-pipelines per session key,
+   *       beyond which messages wait for one to become available. Default is 0 for unlimited.
+   *   - _priority_ - Priority of the stream when waiting for a sub-pipeline, or a function that returns it.
+   *       Higher priorities are admitted first. Default is 0.
+   *   - _queueTarget_ - Target queueing delay. Once exceeded for a whole _queueInterval_,
+   *       waiting streams are shed lowest priority first with a StreamEnd of error `"Overloaded"`.
+   *       Default is 0 for no shedding.
+   *   - _queueInterval_ - Interval over which _queueTarget_ is enforced. Default is _100 milliseconds_.
    *   - _bufferSize_ - Maximum body size above which a message should be transferred in chunks.
    *       Can be a number in bytes or a string with a unit suffix such as `'k'`, `'m'`, `'g'` and `'t'`.
    *       Default is _16KB_.
+   *   - _maxPipeline_ - Maximum number of requests in flight on one HTTP/1 connection.
+   *       Only idempotent requests are pipelined and the pool falls back to one request at a time
+   *       if the server closes the connection on pipelined requests. Default is 0 for no limit.
    *   - _version_ - Number `1` for HTTP/1 or number `2` for HTTP/2. Can also be a function that returns `1` or `2`.
    * @returns The same _Configuration_ object.
    */
@@ -1080,9 +1530,21 @@ interface Configuration {
    *       Defaults is `60` seconds.
    *   - _maxQueue_ - Maximum number of messages allowed to run concurrently in one sub-pipeline.
    *   - _maxMessages_ - Maximum number of messages allowed to run accumulatively in one sub-pipeline.
+   *   - _minIdle_ - Number of idle sub-pipelines to keep open ahead of demand. Default is 0.
+   *   - _maxConnections_ - Maximum number of sub-pipelines per session key,
+   *       beyond which messages wait for one to become available. Default is 0 for unlimited.
+   *   - _priority_ - Priority of the stream when waiting for a sub-pipeline, or a function that returns it.
+   *       Higher priorities are admitted first. Default is 0.
+   *   - _queueTarget_ - Target queueing delay. Once exceeded for a whole _queueInterval_,
+   *       waiting streams are shed lowest priority first with a StreamEnd of error `"Overloaded"`.
+   *       Default is 0 for no shedding.
+   *   - _queueInterval_ - Interval over which _queueTarget_ is enforced. Default is _100 milliseconds_.
    *   - _bufferSize_ - Maximum body size above which a message should be transferred in chunks.
    *       Can be a number in bytes or a string with a unit suffix such as `'k'`, `'m'`, `'g'` and `'t'`.
    *       Default is _16KB_.
+   *   - _maxPipeline_ - Maximum number of requests in flight on one HTTP/1 connection.
+   *       Only idempotent requests are pipelined and the pool falls back to one request at a time
+   *       if the server closes the connection on pipelined requests. Default is 0 for no limit.
    *   - _version_ - Number `1` for HTTP/1 or number `2` for HTTP/2. Can also be a function that returns `1` or `2`.
    * @returns The same _Configuration_ object.
    */
@@ -1104,6 +1566,10 @@ interface Configuration {
    *   - _interval_ - Maximum time to wait before outputting a batch even if the number of messages is not enough.
    *       Can be a number in seconds or a string with one of the time unit suffixes such as `s`, `m` or `h`.
    *       Default is _5 seconds_.
+   *   - _timeout_ - Maximum time to wait after the last message before outputting an incomplete batch.
+   *       Can be a number in seconds or a string with one of the time unit suffixes such as `s`, `m` or `h`.
+   *       Default is _5 seconds_.
+   *   - _adaptive_ - If true, the timeout is cut to about twice the average gap between incoming messages. Default is `false`.
    * @returns The same _Configuration_ object.
    */
   pack(
@@ -1111,6 +1577,8 @@ interface Configuration {
     options?: {
       vacancy?: number,
       interval?: number | string,
+      timeout?: number | string,
+      adaptive?: boolean,
     }
   ): Configuration;
 
@@ -1189,6 +1657,21 @@ interface Configuration {
    */
   replaceMessageBody(handler?: (data: Data) => Event | Message | (Event|Message)[] | void): Configuration;
 
+  /**
+   * Appends a _replaceBodyText_ filter to the current pipeline layout.
+   *
+   * A _replaceBodyText_ filter replaces every occurrence of a pattern in message bodies as they stream through.
+   * It holds back only the bytes of a partial match, so nothing waits for the whole body.
+   *
+   * - **INPUT** - Any types of _Events_.
+   * - **OUTPUT** - Same _Events_ with message bodies rewritten.
+   *
+   * @param pattern A string or _Data_ to look for, up to 1KB.
+   * @param replacement A string or _Data_ to put in its place. Default is to remove the pattern.
+   * @returns The same _Configuration_ object.
+   */
+  replaceBodyText(pattern: string | Data, replacement?: string | Data): Configuration;
+
   /**
    * Appends a _replaceMessageEnd_ filter to the current pipeline layout.
    *
@@ -1260,9 +1743,86 @@ interface Configuration {
    *   - _delay_ - Time interval to wait before each replay.
    *       Can be a number in seconds, or a string with a time unit suffix like `'s'`, `'m'` or `'h'`,
    *       or a function that returns that.
+   *   - _spillThreshold_ - Bytes of input _Data_ kept in memory for replaying.
+   *       Any more goes to an anonymous temporary file and is read back on each replay.
+   *       Can be a number or a string with a unit suffix such as 'k', 'm' or 'g'.
+   *       Default is 0, where everything stays in memory.
+   * @returns The same _Configuration_ object.
+   */
+  replay(options?: { delay?: number | string | (() => number | string), spillThreshold?: number | string }): Configuration;
+
+  /**
+   * Appends a _respondStatic_ filter to the current pipeline layout.
+   *
+   * A _respondStatic_ filter answers HTTP requests with responses prepared when the filter is created,
+   * without calling back user scripts for each request. Every response carries an _etag_ made from its body
+   * and a _date_ header. A GET or HEAD request with a matching _if-none-match_ header gets a 304 response.
+   *
+   * - **INPUT** - _Data_ stream containing HTTP requests received from the client.
+   * - **OUTPUT** - _Data_ stream containing HTTP responses to send to the client.
+   *
+   * @param responses A _Message_ to respond to all requests with, or an object that maps
+   *   request paths (without query strings) to response _Messages_. Requests to other paths get a 404 response.
+   * @param options Options including _bufferSize_, _maxHeaderSize_ and _maxMessages_.
    * @returns The same _Configuration_ object.
    */
-  replay(options?: { delay?: number | string | (() => number | string) }): Configuration;
+  respondStatic(
+    responses: Message | { [path: string]: Message },
+    options?: {
+      bufferSize?: number | string,
+      maxHeaderSize?: number | string,
+      maxMessages?: number,
+    }
+  ): Configuration;
+
+  /**
+   * Appends a _retry_ filter to the current pipeline layout.
+   *
+   * A _retry_ filter sends each request to a new sub-pipeline and starts over with another one
+   * when the request fails, which is when the sub-pipeline outputs a StreamEnd event
+   * or a response with status 502, 503 or 504 before anything else.
+   * Every attempt gets a fresh sub-pipeline, so a load balancer in it picks a new target each time.
+   * The filter is meant to handle one request per stream, so it usually goes after _demuxHTTP_.
+   *
+   * - **INPUT** - Any types of _Events_ to stream into the sub-pipelines.
+   * - **OUTPUT** - _Events_ streaming out from the winning sub-pipeline.
+   * - **SUB-INPUT** - _Events_ streaming into the _retry_ filter.
+   * - **SUB-OUTPUT** - Any types of _Events_.
+   *
+   * @param options Options including:
+   *   - _maxRetries_ - Maximum number of retries for one request. Default is 2.
+   *   - _backoff_ - Base delay before the first retry, doubled for every retry after that.
+   *       The actual delay is picked at random between zero and that value.
+   *       Can be a number in seconds or a string with a time unit suffix. Default is 25ms.
+   *   - _maxBackoff_ - Upper limit of the backoff delay. Default is 1s.
+   *   - _budget_ - Percentage of requests in flight that are allowed to be retrying at the same time.
+   *       Default is 20.
+   *   - _minRetries_ - Number of concurrent retries always allowed regardless of the budget. Default is 3.
+   *   - _retryOn_ - A function that receives the response head, or the StreamEnd event when there is no response,
+   *       and returns true if the request should be retried. Replaces the default 502/503/504 rule.
+   *   - _retryNonIdempotent_ - When true, requests with methods other than GET, HEAD, OPTIONS, TRACE, PUT and DELETE
+   *       are retried and hedged as well. Default is false.
+   *   - _hedge_ - When true, a second attempt is started if no response has arrived within _hedgeDelay_
+   *       after the request ends, and the first one to respond wins. Hedges count against the budget.
+   *   - _hedgeDelay_ - Time to wait before hedging. Default is 0, which means
+   *       the 95th percentile of recent response times. No hedging is done until 20 samples are collected.
+   *   - _name_ - Name of the retry budget, used as the metric label.
+   *       Metrics are _pipy_retry_active_, _pipy_retry_retrying_, _pipy_retry_requests_, _pipy_retry_retries_,
+   *       _pipy_retry_budget_exhausted_, _pipy_retry_hedges_ and _pipy_retry_hedge_wins_.
+   * @returns The same _Configuration_ object.
+   */
+  retry(options?: {
+    maxRetries?: number,
+    backoff?: number | string,
+    maxBackoff?: number | string,
+    budget?: number,
+    minRetries?: number,
+    retryOn?: (result: object | StreamEnd) => boolean,
+    retryNonIdempotent?: boolean,
+    hedge?: boolean,
+    hedgeDelay?: number | string,
+    name?: string,
+  }): Configuration;
 
   /**
    * Appends a _serveHTTP_ filter to the current pipeline layout.
@@ -1342,6 +1902,74 @@ interface Configuration {
    */
   throttleMessageRate(quota: Quota | (() => Quota)): Configuration;
 
+  /**
+   * Appends a _transformBody_ filter to the current pipeline layout.
+   *
+   * A _transformBody_ filter calls back user scripts on each chunk of a message body as it streams through.
+   *
+   * - **INPUT** - Any types of _Events_.
+   * - **OUTPUT** - Same _Events_ with message bodies transformed.
+   *
+   * @param handler A callback function that receives a chunk of body and the bytes that follow it.
+   *   The second argument is null for the last chunk of a body.
+   *   It returns the chunk's replacement, undefined to keep it as is or null to remove it.
+   * @param options Options including:
+   *   - _lookahead_ - Bytes held back after each chunk and passed to the callback as the second argument.
+   *     Those bytes come again at the start of the next chunk.
+   *     Can be a number or a string with a unit suffix such as 'k', 'm' or 'g'. Default is 0.
+   * @returns The same _Configuration_ object.
+   */
+  transformBody(
+    handler: (chunk: Data, lookahead: Data | null) => Data | string | null | void,
+    options?: { lookahead?: number | string }
+  ): Configuration;
+
+  /**
+   * Appends a _trace_ filter to the current pipeline layout.
+   *
+   * A _trace_ filter records an OpenTelemetry span for every HTTP request going through its sub-pipeline.
+   * It continues the W3C trace context from the incoming _traceparent_ header or starts a new trace,
+   * and passes its span on to the sub-pipeline in a rewritten _traceparent_ header.
+   * Spans are exported in batches to an OTLP/HTTP collector in protobuf.
+   *
+   * - **INPUT** - HTTP _Messages_ as requests.
+   * - **OUTPUT** - HTTP _Messages_ as responses from the sub-pipeline.
+   * - **SUB-INPUT** - HTTP _Messages_ as requests with trace context.
+   * - **SUB-OUTPUT** - HTTP _Messages_ as responses.
+   *
+   * @param options Options including:
+   *   - _endpoint_ - URL of the OTLP/HTTP traces endpoint, such as `"http://localhost:4318/v1/traces"`.
+   *       Spans are not exported when absent.
+   *   - _serviceName_ - Value of the `service.name` resource attribute. Default is `"pipy"`.
+   *   - _kind_ - Span kind, either `"server"` or `"client"`. Default is `"server"`.
+   *   - _sampleRate_ - Ratio of new traces to sample, between 0 and 1. Default is 1.
+   *       Traces coming with a _traceparent_ follow its sampled flag.
+   *   - _tailSampling_ - Conditions to export spans not sampled at the start:
+   *       _errors_ to keep failed spans and 5xx responses, default is `true`,
+   *       and _slowerThan_ to keep spans taking longer than this duration.
+   *   - _batchSize_ - Maximum number of spans in one export request. Default is 512.
+   *   - _batchInterval_ - Maximum time a span waits before being exported. Default is 1 second.
+   *   - _headers_ - Extra headers of export requests.
+   *   - _tls_ - TLS options for an `https` endpoint.
+   * @returns The same _Configuration_ object.
+   */
+  trace(
+    options?: {
+      endpoint?: string,
+      serviceName?: string,
+      kind?: 'server' | 'client',
+      sampleRate?: number,
+      tailSampling?: {
+        errors?: boolean,
+        slowerThan?: number | string,
+      },
+      batchSize?: number,
+      batchInterval?: number | string,
+      headers?: { [name: string]: string },
+      tls?: object,
+    }
+  ): Configuration;
+
   /**
    * Appends a _use_ filter to the current pipeline layout.
    *
@@ -82,6 +82,7 @@ interface StreamEnd extends Event {
    *   - `"BufferOverflow"`
    *   - `"ProtocolError"`
    *   - `"Unauthorized"`
+   *   - `"Overloaded"`
    */
   error: ''
     | 'Replay'
@@ -98,7 +99,8 @@ interface StreamEnd extends Event {
     | 'IdleTimeout'
     | 'BufferOverflow'
     | 'ProtocolError'
-    | 'Unauthorized';
+    | 'Unauthorized'
+    | 'Overloaded';
 
 }
 
@@ -124,6 +126,7 @@ interface StreamEndConstructor extends StreamEnd {
    *   - `"BufferOverflow"`
    *   - `"ProtocolError"`
    *   - `"Unauthorized"`
+   *   - `"Overloaded"`
    * @returns A _StreamEnd_ object with the specified error if any.
    */
   new(error?: ''
@@ -142,6 +145,7 @@ interface StreamEndConstructor extends StreamEnd {
     | 'BufferOverflow'
     | 'ProtocolError'
     | 'Unauthorized'
+    | 'Overloaded'
     ): StreamEnd;
 }
 
@@ -187,6 +191,74 @@ interface Data extends Event {
    */
   shiftWhile(callback: (byte: number) => boolean): Data;
 
+  /**
+   * Finds the first occurrence of a byte sequence without flattening the chunks.
+   *
+   * @param pattern A _Data_ object or a string containing UTF-8 bytes to look for.
+   * @param from Byte position to start searching at. Defaults to 0.
+   * @returns Byte position of the first occurrence, or -1 if not found.
+   */
+  indexOf(pattern: Data | string, from?: number): number;
+
+  /**
+   * Extracts a range of bytes sharing the underlying chunks.
+   *
+   * @param start Byte position where the range starts. Negative values count from the end.
+   * @param end Byte position where the range ends, exclusive. Negative values count from the end.
+   * @returns A new _Data_ object containing the bytes in the range.
+   */
+  slice(start?: number, end?: number): Data;
+
+  /**
+   * Compares bytes with another _Data_ object in lexicographic order.
+   *
+   * @param other A _Data_ object to compare with.
+   * @returns -1, 0 or 1 when less than, equal to or greater than _other_.
+   */
+  compare(other: Data): number;
+
+  /**
+   * Computes a 32-bit FNV-1a hash of the bytes.
+   *
+   * @returns The hash as an unsigned 32-bit integer.
+   */
+  hash(): number;
+
+  /**
+   * Reads a number at a byte offset like _DataView_ does, without copying the chunks.
+   * Available as _getUint8_, _getInt8_, _getUint16_, _getInt16_, _getUint32_, _getInt32_,
+   * _getFloat32_ and _getFloat64_.
+   *
+   * @param offset Byte position of the number.
+   * @param littleEndian Whether the number is little-endian. Defaults to _false_.
+   * @returns The number read. Throws if it does not fit in the data.
+   */
+  getUint8(offset: number): number;
+  getInt8(offset: number): number;
+  getUint16(offset: number, littleEndian?: boolean): number;
+  getInt16(offset: number, littleEndian?: boolean): number;
+  getUint32(offset: number, littleEndian?: boolean): number;
+  getInt32(offset: number, littleEndian?: boolean): number;
+  getFloat32(offset: number, littleEndian?: boolean): number;
+  getFloat64(offset: number, littleEndian?: boolean): number;
+
+  /**
+   * Searches for a match of a regular expression directly on the chunks.
+   *
+   * @param pattern A _RegExp_ to match against the bytes.
+   * @returns Byte position of the first match, or -1 if not found.
+   */
+  search(pattern: RegExp): number;
+
+  /**
+   * Matches a regular expression directly on the chunks.
+   *
+   * @param pattern A _RegExp_ to match against the bytes.
+   * @returns An array of _Data_ objects for the whole match and each capture group,
+   *   with _undefined_ for groups that did not participate, or _null_ if not found.
+   */
+  match(pattern: RegExp): Data[] | null;
+
   /**
    * Converts to an array of bytes.
    *
@@ -217,12 +289,15 @@ interface DataConstructor {
   new(): Data;
 
   /**
-   * Creates an instance of _Data_ from an array of bytes.
+   * Creates an instance of _Data_ from an array of bytes, strings and _Data_ objects.
+   *
+   * Strings are written in UTF-8 and _Data_ objects are appended without copying,
+   * so a large body can be assembled in one go rather than by concatenating strings.
    *
-   * @param bytes - An array of numbers representing the bytes.
-   * @returns A _Data_ object containing the bytes from the array.
+   * @param parts - An array of numbers representing bytes, strings or _Data_ objects.
+   * @returns A _Data_ object containing all parts in order.
    */
-  new(bytes: number[]): Data;
+  new(parts: (number | string | Data)[]): Data;
 
   /**
    * Creates an instance of _Data_ from a string.
@@ -245,6 +320,14 @@ interface DataConstructor {
    */
   new(data: Data): Data;
 
+  /**
+   * Creates an instance of _Data_ from the bytes of a typed array.
+   *
+   * @param bytes A _Uint8Array_ to copy from.
+   * @returns A _Data_ object containing the bytes.
+   */
+  new(bytes: Uint8Array): Data;
+
   /**
    * Converts a string to an instance of _Data_.
    *
@@ -45,6 +45,18 @@ interface JSON {
     reviver?: (key: string, value: any, container: Object) => any
   ): any;
 
+  /**
+   * Deserializes only the value found at a path in JSON data.
+   *
+   * Nothing outside the path is built and parsing stops right after the value,
+   * so picking a field near the start of a large document reads only that far.
+   *
+   * @param data A _Data_ object containing JSON data.
+   * @param path Keys of objects and indexes of arrays leading to the value, e.g. `['user', 'id']`.
+   * @returns The value at the path, or `undefined` if it does not exist.
+   */
+  pick(data: Data, path: (string | number)[]): any;
+
   /**
    * Serializes a values in JSON format.
    * @param value A value of any type to serialize in JSON format.
@@ -31,6 +31,21 @@ interface Cache {
    * Deletes all entries.
    */
   clear(): void;
+
+  /**
+   * Number of lookups that found an entry.
+   */
+  readonly hits: number;
+
+  /**
+   * Number of lookups that found no entry or an expired one.
+   */
+  readonly misses: number;
+
+  /**
+   * Number of entries dropped for lack of room or for outliving their TTL.
+   */
+  readonly evictions: number;
 }
 
 interface CacheConstructor {
@@ -46,6 +61,11 @@ interface CacheConstructor {
    *   - _size_ - Maximum number of entries allowed in the cache.
    *   - _ttl_ - Time-to-live for the entries in the cache.
    *       Can be a number in seconds or a string with one of the time unit suffixes such as `'s'`, `'m'` and `'h'`.
+   *   - _policy_ - Can be `'lru'` or `'tinylfu'`. Defaults to `'lru'`.
+   *       With `'tinylfu'` and a _size_, new entries are only kept over existing ones
+   *       if they are accessed more often, so that bursts of one-off keys do not flush the cache.
+   *   - _onEvict_ - A function to be called when an entry is dropped for lack of room or for outliving its TTL.
+   *       It receives 2 parameters: the key and the value of the entry being dropped.
    * @returns An empty _Cache_ object.
    */
   new(
@@ -54,6 +74,8 @@ interface CacheConstructor {
     options?: {
       size?: number,
       ttl?: number | string,
+      policy?: 'lru' | 'tinylfu',
+      onEvict?: (key: any, value: any) => void,
     }
   ): Cache;
 }
@@ -104,6 +126,11 @@ interface QuotaConstructor {
    *   - _produce_ - Number by which the quota increases each time it recovers.
    *   - _per_ - Time interval by which the quota recovers automatically.
    *       Can be a number in seconds or a string with one of the time unit suffixes such as `'s'`, `'m'` and `'h'`.
+   *   - _quantum_ - When set, streams waiting for the quota take turns by deficit round robin,
+   *       each getting up to this much per turn. Can be a number or a string with a size unit suffix such as `'k'`.
+   *   - _key_ - Quotas with the same key share one counter across all worker threads.
+   *   - _cluster_ - When true, the keyed counter is also shared with the peers given to _Quota.join()_,
+   *       so that the quota applies to the whole cluster. Requires _key_.
    * @returns A _Quota_ object with the specified initial quota.
    */
   new(
@@ -111,8 +138,31 @@ interface QuotaConstructor {
     options?: {
       produce?: number,
       per?: number | string,
+      quantum?: number | string,
+      key?: string,
+      cluster?: boolean,
     }
   ): Quota;
+
+  /**
+   * Starts sharing quotas created with the _cluster_ option with other pipy instances.
+   *
+   * Each instance counts what it consumes locally and sends its counts to all peers over UDP every _interval_.
+   * What peers consume is taken from the local quota as it is heard of, so decisions never wait on the network,
+   * at the cost of overshooting the limit by up to what the rest of the cluster consumes in one _interval_.
+   * Calling it again with the same options has no effect.
+   *
+   * @param options Options including:
+   *   - _listen_ - Local UDP address and port to receive counts on, such as `'0.0.0.0:7946'`.
+   *   - _peers_ - Array of addresses and ports of all other instances, such as `['10.0.0.2:7946']`.
+   *   - _interval_ - Time between two rounds of sending counts. Defaults to 100ms.
+   *       Can be a number in seconds or a string with one of the time unit suffixes such as `'s'`, `'m'` and `'h'`.
+   */
+  join(options: {
+    listen: string,
+    peers?: string[],
+    interval?: number | string,
+  }): void;
 }
 
 /**
@@ -148,6 +198,73 @@ interface URLRouterConstructor {
   new(routes: { [path: string]: any }): URLRouter;
 }
 
+interface Route {
+
+  /**
+   * Host to match, exact or as `*.domain` for any subdomain. Omitted or `*` matches any host.
+   */
+  host?: string;
+
+  /**
+   * Path pattern in the same syntax as _URLRouter_. Defaults to `/*`.
+   */
+  path?: string;
+
+  /**
+   * Request method to match.
+   */
+  method?: string;
+
+  /**
+   * Header values to match, either exactly or with a _RegExp_.
+   */
+  headers?: { [name: string]: string | RegExp };
+
+  /**
+   * Custom predicate called with the request head, only after everything else has matched.
+   */
+  when?: (head: object) => boolean;
+
+  /**
+   * Upstream targets, picked by smooth weighted round-robin when given as an object of weights.
+   */
+  upstreams?: string | string[] | { [target: string]: number };
+
+  /**
+   * Pipeline, or name of a pipeline, that `route()` pipes the matched stream to.
+   */
+  pipeline?: string | object;
+}
+
+interface RouteTable {
+
+  /**
+   * Replaces all routes at once. The old table stays in use if the new one fails to compile.
+   *
+   * @param routes An array of routes to be checked in order.
+   */
+  update(routes: Route[]): void;
+
+  /**
+   * Finds the route for a request.
+   *
+   * @param head A request head.
+   * @returns An object containing the matched _route_, the picked _upstream_ and path _params_, or `null` if none matched.
+   */
+  find(head: object): { route: Route, upstream?: string, params?: { [name: string]: string } } | null;
+}
+
+interface RouteTableConstructor {
+
+  /**
+   * Creates an instance of _RouteTable_.
+   *
+   * @param routes An array of routes to be checked in order.
+   * @returns A _RouteTable_ object compiled from the routes.
+   */
+  new(routes: Route[]): RouteTable;
+}
+
 /**
  * Load-balancer base class.
  */
@@ -164,6 +281,214 @@ interface LoadBalancerBase {
    * @returns A resource object containing a field named `id` for the allocated target.
    */
   next(borrower?: any, tag?: any, unhealthy?: Cache): { id: string } | undefined;
+
+  /**
+   * Reports the latency of a single request to a target, such as one made over a borrowed resource.
+   * Used by _PeakEwmaLoadBalancer_ and ignored by other load-balancers.
+   *
+   * @param target A string representing the target the request went to.
+   * @param latency Time taken by the request in milliseconds.
+   */
+  observe(target: string, latency: number): void;
+
+  /**
+   * Excludes targets found unhealthy by a _HealthCheck_.
+   *
+   * @param healthCheck A _HealthCheck_ object, or _null_ to stop using one.
+   * @returns The same load-balancer object.
+   */
+  healthCheck(healthCheck: HealthCheck | null): LoadBalancerBase;
+
+  /**
+   * Excludes targets whose circuit is open, and counts trial requests to half-open ones.
+   *
+   * @param circuitBreaker A _CircuitBreaker_ object, or _null_ to stop using one.
+   * @returns The same load-balancer object.
+   */
+  circuitBreaker(circuitBreaker: CircuitBreaker | null): LoadBalancerBase;
+
+  /**
+   * Keeps sending the same target key to the same target across all workers.
+   *
+   * When a target key is given to _borrow()_ or _select()_ and found in the table,
+   * the target bound to it is used as long as this load-balancer still has it and it is healthy.
+   * Otherwise a target is selected as usual and the key is bound to it.
+   *
+   * @param affinityTable An _AffinityTable_ object, or _null_ to stop using one.
+   * @returns The same load-balancer object.
+   */
+  affinity(affinityTable: AffinityTable | null): LoadBalancerBase;
+}
+
+/**
+ * Native health checks shared by all workers.
+ * Targets are strings in the form of _"host:port"_ and get probed from the moment they are first asked about.
+ */
+interface HealthCheck {
+
+  /**
+   * Tells if a target is currently healthy.
+   *
+   * @param target A string in the form of _"host:port"_.
+   * @returns A boolean that is _false_ if the target failed its probes or is ejected as an outlier.
+   */
+  isHealthy(target: string): boolean;
+
+  /**
+   * Reports the outcome of a request to a target for outlier detection.
+   *
+   * @param target A string in the form of _"host:port"_.
+   * @param ok A boolean that should be _false_ on a connection error or a 5xx response.
+   */
+  report(target: string, ok: boolean): void;
+}
+
+interface HealthCheckConstructor {
+
+  /**
+   * Creates an instance of _HealthCheck_. Instances created with equal options share the same probes.
+   *
+   * @param options Options including:
+   *   - _type_ - Can be `'tcp'`, `'http'`, `'grpc'` or `'none'` for passive checks only. Default is `'tcp'`.
+   *   - _interval_ - Time between probes, in seconds or a string with a time unit. Default is _5 seconds_.
+   *   - _timeout_ - Time a probe can take before it fails. Default is _2 seconds_.
+   *   - _healthyThreshold_ - Number of successful probes in a row to become healthy. Default is _2_.
+   *   - _unhealthyThreshold_ - Number of failed probes in a row to become unhealthy. Default is _3_.
+   *   - _path_ - Path for HTTP probes, where a status of 2xx or 3xx means healthy. Default is `'/'`.
+   *   - _host_ - Host header or authority for HTTP and gRPC probes. Defaults to the target.
+   *   - _service_ - Service name in gRPC health check requests. Default is empty.
+   *   - _consecutiveErrors_ - Number of failures reported in a row before ejection. Default is _5_.
+   *       Zero disables outlier detection.
+   *   - _baseEjectionTime_ - Ejection time, multiplied by the number of recent ejections. Default is _30 seconds_.
+   *   - _maxEjectionTime_ - Upper limit of ejection time. Default is _300 seconds_.
+   *   - _maxEjectionPercent_ - Upper limit of targets ejected at a time, in percent. Default is _10_.
+   * @returns A _HealthCheck_ object.
+   */
+  new(options?: {
+    type?: 'tcp' | 'http' | 'grpc' | 'none',
+    interval?: number | string,
+    timeout?: number | string,
+    healthyThreshold?: number,
+    unhealthyThreshold?: number,
+    path?: string,
+    host?: string,
+    service?: string,
+    consecutiveErrors?: number,
+    baseEjectionTime?: number | string,
+    maxEjectionTime?: number | string,
+    maxEjectionPercent?: number,
+  }): HealthCheck;
+}
+
+/**
+ * Circuit breakers shared by all workers.
+ * A target's circuit opens on too many failures and stays open for a while,
+ * then goes half-open, letting a few trial requests decide whether it closes again.
+ */
+interface CircuitBreaker {
+
+  /**
+   * Tells if a target can take a request now.
+   * While the circuit is half-open, each _true_ takes up one of the trial requests.
+   *
+   * @param target A string identifying the target.
+   * @returns A boolean that is _false_ if the circuit is open or the half-open trials are used up.
+   */
+  allow(target: string): boolean;
+
+  /**
+   * Reports the outcome of a request to a target.
+   *
+   * @param target A string identifying the target.
+   * @param ok A boolean that should be _false_ on a connection error or a 5xx response.
+   */
+  report(target: string, ok: boolean): void;
+
+  /**
+   * Gets the state of a target's circuit.
+   *
+   * @param target A string identifying the target.
+   * @returns One of `'closed'`, `'open'` or `'half-open'`.
+   */
+  state(target: string): 'closed' | 'open' | 'half-open';
+}
+
+interface CircuitBreakerConstructor {
+
+  /**
+   * Creates an instance of _CircuitBreaker_. Instances created with equal options share the same state.
+   *
+   * @param options Options including:
+   *   - _window_ - Time span of the sliding window for error rates. Default is _10 seconds_.
+   *   - _buckets_ - Number of slices the window is divided into. Default is _10_.
+   *   - _errorRate_ - Ratio of failures in the window that opens the circuit. Default is _0.5_.
+   *   - _minRequests_ - Minimum number of requests in the window before the error rate counts. Default is _20_.
+   *   - _consecutiveFailures_ - Number of failures in a row that opens the circuit. Default is _5_.
+   *       Zero leaves it to the error rate alone.
+   *   - _openTime_ - Time a circuit stays open before going half-open. Default is _30 seconds_.
+   *   - _halfOpenRequests_ - Number of trial requests let through while half-open,
+   *       all of which must succeed to close the circuit. Default is _3_.
+   * @returns A _CircuitBreaker_ object.
+   */
+  new(options?: {
+    window?: number | string,
+    buckets?: number,
+    errorRate?: number,
+    minRequests?: number,
+    consecutiveFailures?: number,
+    openTime?: number | string,
+    halfOpenRequests?: number,
+  }): CircuitBreaker;
+}
+
+/**
+ * Sticky-session table shared by all workers.
+ * Keys such as cookies or client addresses are bound to targets until not seen for a while.
+ */
+interface AffinityTable {
+
+  /**
+   * Looks up the target bound to a key.
+   *
+   * @param key A string or a number, such as a session cookie or a client address.
+   * @returns The target string, or _undefined_ if the key is not bound or has expired.
+   */
+  find(key: string | number): string | undefined;
+
+  /**
+   * Binds a key to a target, restarting its time to live.
+   *
+   * @param key A string or a number, such as a session cookie or a client address.
+   * @param target A string identifying the target.
+   */
+  bind(key: string | number, target: string): void;
+
+  /**
+   * Removes the binding of a key.
+   *
+   * @param key A string or a number, such as a session cookie or a client address.
+   */
+  unbind(key: string | number): void;
+}
+
+interface AffinityTableConstructor {
+
+  /**
+   * Creates an instance of _AffinityTable_. Instances created with the same name share the same table,
+   * sized by the options given where the name is first used.
+   *
+   * @param name A string that names the table.
+   * @param options Options including:
+   *   - _ttl_ - Time a binding lasts without being looked up. Default is _10 minutes_.
+   *       Can be a number in seconds or a string with one of the time unit suffixes such as `'s'`, `'m'` and `'h'`.
+   *   - _size_ - Maximum number of bindings, taking 16 bytes each, all allocated up front. Default is _65536_.
+   *       When the table is full, bindings about to expire are the first to go.
+   * @returns An _AffinityTable_ object.
+   */
+  new(name: string, options?: {
+    ttl?: number | string,
+    size?: number,
+  }): AffinityTable;
 }
 
 /**
@@ -245,6 +570,114 @@ interface LeastWorkLoadBalancerConstructor {
   new(targets: string[] | { [id: string]: number }, unhealthy?: Cache): LeastWorkLoadBalancer;
 }
 
+/**
+ * Load-balancer that picks the faster of two random targets,
+ * scored by peak-EWMA latency times outstanding requests.
+ * Latencies are reported per request with _observe()_ or _deselect()_.
+ */
+interface PeakEwmaLoadBalancer extends LoadBalancerBase {
+
+  /**
+   * Sets weight of a target.
+   *
+   * @param target A string representing the target to add or set weight for.
+   * @param weight A number as the weight of the target.
+   */
+  set(target: string, weight: number): void;
+}
+
+interface PeakEwmaLoadBalancerConstructor {
+
+  /**
+   * Creates an instance of _PeakEwmaLoadBalancer_.
+   *
+   * @param targets An array of strings representing the targets, or an object of key-value pairs
+   *   where keys are the targets and values are the weights.
+   * @param unhealthy A _Cache_ object storing _unhealthy_ targets.
+   * @param options Options including:
+   *   - _decayTime_ - Time for past latencies to fade out, in seconds or a string with a time unit.
+   *       Default is _10 seconds_.
+   * @returns A _PeakEwmaLoadBalancer_ object with the specified targets.
+   */
+  new(
+    targets: string[] | { [id: string]: number },
+    unhealthy?: Cache,
+    options?: { decayTime?: number | string },
+  ): PeakEwmaLoadBalancer;
+}
+
+/**
+ * Load-balancer that maps keys to targets through a Maglev lookup table,
+ * with bounded loads.
+ */
+interface MaglevLoadBalancer extends LoadBalancerBase {
+
+  /**
+   * Sets weight of a target.
+   *
+   * @param target A string representing the target to add or set weight for.
+   * @param weight A number as the weight of the target.
+   */
+  set(target: string, weight: number): void;
+}
+
+interface MaglevLoadBalancerConstructor {
+
+  /**
+   * Creates an instance of _MaglevLoadBalancer_.
+   *
+   * @param targets An array of strings representing the targets, or an object of key-value pairs
+   *   where keys are the targets and values are the weights.
+   * @param unhealthy A _Cache_ object storing _unhealthy_ targets.
+   * @param options Options including:
+   *   - _loadFactor_ - How far a target may go over its weighted share of outstanding selections
+   *       before keys overflow to the next target. Default is _1.25_. Zero or less disables the bound.
+   *   - _tableSize_ - Size of the lookup table, rounded up to a prime. Default is _65537_.
+   * @returns A _MaglevLoadBalancer_ object with the specified targets.
+   */
+  new(
+    targets: string[] | { [id: string]: number },
+    unhealthy?: Cache,
+    options?: { loadFactor?: number, tableSize?: number },
+  ): MaglevLoadBalancer;
+}
+
+/**
+ * Load-balancer that maps keys to targets on a consistent hash ring,
+ * with bounded loads.
+ */
+interface RingHashLoadBalancer extends LoadBalancerBase {
+
+  /**
+   * Sets weight of a target.
+   *
+   * @param target A string representing the target to add or set weight for.
+   * @param weight A number as the weight of the target.
+   */
+  set(target: string, weight: number): void;
+}
+
+interface RingHashLoadBalancerConstructor {
+
+  /**
+   * Creates an instance of _RingHashLoadBalancer_.
+   *
+   * @param targets An array of strings representing the targets, or an object of key-value pairs
+   *   where keys are the targets and values are the weights.
+   * @param unhealthy A _Cache_ object storing _unhealthy_ targets.
+   * @param options Options including:
+   *   - _loadFactor_ - How far a target may go over its weighted share of outstanding selections
+   *       before keys overflow to the next target. Default is _1.25_. Zero or less disables the bound.
+   *   - _replicas_ - Number of points on the ring per unit of weight. Default is _100_.
+   * @returns A _RingHashLoadBalancer_ object with the specified targets.
+   */
+  new(
+    targets: string[] | { [id: string]: number },
+    unhealthy?: Cache,
+    options?: { loadFactor?: number, replicas?: number },
+  ): RingHashLoadBalancer;
+}
+
 /**
  * Provides load balancing and resource pooling functionalities.
  */
@@ -321,14 +754,164 @@ interface LoadBalancerResource {
   free(): void;
 }
 
+/**
+ * Matches many literal patterns at once in a single pass over the input.
+ */
+interface PatternSet {
+
+  /**
+   * Number of patterns.
+   */
+  size: number;
+
+  /**
+   * Scans one complete input.
+   *
+   * @param input A _Data_ object or a string to scan.
+   * @returns An array of indices into the pattern list, one for each pattern found,
+   *   in the order they were first found.
+   */
+  scan(input: Data | string): number[];
+
+  /**
+   * Creates a scanner for a stream of inputs.
+   *
+   * @returns A _PatternSetScanner_ that finds matches spanning across the inputs.
+   */
+  scanner(): PatternSetScanner;
+}
+
+interface PatternSetScanner {
+
+  /**
+   * Scans the next input in a stream.
+   *
+   * @param input A _Data_ object or a string to scan.
+   * @returns An array of indices of patterns found for the first time since creation or the last reset.
+   */
+  scan(input: Data | string): number[];
+
+  /**
+   * Forgets the stream scanned so far.
+   */
+  reset(): void;
+}
+
+interface PatternSetConstructor {
+
+  /**
+   * Creates an instance of _PatternSet_.
+   *
+   * @param patterns An array of strings or _Data_ objects as the literal patterns.
+   * @param options Options including:
+   *   - _ignoreCase_ - Matches ASCII letters regardless of case. Default is _false_.
+   * @returns A _PatternSet_ object with all patterns compiled into one automaton.
+   */
+  new(patterns: (string | Data)[], options?: { ignoreCase?: boolean }): PatternSet;
+}
+
+/**
+ * Generates load at a fixed arrival rate by starting pipeline instances on schedule,
+ * whether or not earlier ones have completed.
+ */
+interface LoadGen {
+
+  /**
+   * Starts generating load.
+   *
+   * @returns A _Promise_ resolved with a report as returned by _report()_
+   *   after all scheduled requests have completed.
+   */
+  start(): Promise<LoadGenReport>;
+
+  /**
+   * Stops scheduling more requests. Requests in flight are waited for.
+   */
+  stop(): void;
+
+  /**
+   * Gets the statistics so far.
+   */
+  report(): LoadGenReport;
+}
+
+interface LoadGenReport {
+  duration: number;
+  scheduled: number;
+  started: number;
+  completed: number;
+  errors: number;
+  inFlight: number;
+
+  /**
+   * Maximum delay in milliseconds between a request being due and being scheduled by the event loop.
+   */
+  maxLag: number;
+
+  /**
+   * Completed requests per second.
+   */
+  rate: number;
+
+  /**
+   * The _algo.Percentile_ or _stats.Histogram_ that latencies in milliseconds were observed into.
+   */
+  latency: object;
+}
+
+interface LoadGenConstructor {
+
+  /**
+   * Creates an instance of _LoadGen_.
+   *
+   * Each request is a new instance of the given pipeline layout, which usually ends in
+   * _muxHTTP_ or _connect_ so that connections are shared as they would be for real clients.
+   * A request completes when the pipeline outputs a _MessageEnd_ or a _StreamEnd_,
+   * and fails if the _StreamEnd_ carries an error.
+   *
+   * Latency is measured from the time a request was due rather than when it got started,
+   * so delays in the event loop or from _maxInFlight_ are accounted for
+   * instead of being hidden as coordinated omission.
+   * Every thread runs its own _LoadGen_, so the
+   * total rate is the per-thread rate times the number of threads. Pass a _stats.Histogram_
+   * as _latency_ to sum up latencies over all threads with _stats.sum()_.
+   *
+   * @param layout A pipeline layout created by _pipeline()_.
+   * @param options Options including:
+   *   - _rate_ - Requests started per second on this thread. Default is _100_.
+   *   - _duration_ - Time to generate load for, in seconds or as a string, such as `"30s"`. Default is _10_.
+   *   - _maxInFlight_ - Maximum outstanding requests. Requests due beyond that wait and keep their due time. Default is _0_ for no limit.
+   *   - _request_ - Events to input to every request, or a function that receives the request index and returns them.
+   *   - _latency_ - An _algo.Percentile_ or a _stats.Histogram_ to observe latencies into.
+   *     Default is a log-linear _algo.Percentile_ in the layout of HDR histograms.
+   * @returns A _LoadGen_ object.
+   */
+  new(layout: object, options?: {
+    rate?: number,
+    duration?: number | string,
+    maxInFlight?: number,
+    request?: Message | Event | (Message | Event)[] | ((i: number) => Message | Event | (Message | Event)[]),
+    latency?: object,
+  }): LoadGen;
+}
+
 interface Algo {
   Cache: CacheConstructor;
   Quota: QuotaConstructor;
   URLRouter: URLRouterConstructor;
+  RouteTable: RouteTableConstructor;
   HashingLoadBalancer: HashingLoadBalancerConstructor;
   RoundRobinLoadBalancer: RoundRobinLoadBalancerConstructor;
   LeastWorkLoadBalancer: LeastWorkLoadBalancerConstructor;
+  PeakEwmaLoadBalancer: PeakEwmaLoadBalancerConstructor;
+  MaglevLoadBalancer: MaglevLoadBalancerConstructor;
+  RingHashLoadBalancer: RingHashLoadBalancerConstructor;
+  HealthCheck: HealthCheckConstructor;
+  CircuitBreaker: CircuitBreakerConstructor;
+  AffinityTable: AffinityTableConstructor;
   LoadBalancer: LoadBalancerConstructor;
+  PatternSet: PatternSetConstructor;
+  LoadGen: LoadGenConstructor;
 
   /**
    * Gets the hash of a value of any type.
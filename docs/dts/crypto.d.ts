@@ -82,6 +82,47 @@ interface CertificateChainConstructor {
   new(pem: string | Data): CertificateChain;
 }
 
+/**
+ * Shared store of certificates looked up by SNI host name.
+ */
+interface CertificateStore {
+
+  /**
+   * Adds or replaces a certificate.
+   *
+   * @param name Host name the certificate is for. Can be a wildcard like `*.example.com`, or `*` for the default.
+   * @param cert A string or a _Data_ object in PEM format, or a _Certificate_ object.
+   * @param key A string or a _Data_ object in PEM format, or a _PrivateKey_ object.
+   */
+  add(name: string, cert: string | Data | Certificate, key: string | Data | PrivateKey): void;
+
+  /**
+   * Removes a certificate.
+   *
+   * @param name Host name the certificate was added for.
+   */
+  remove(name: string): void;
+}
+
+interface CertificateStoreConstructor {
+
+  /**
+   * Creates an instance of _CertificateStore_.
+   *
+   * Stores with the same _name_ or _dir_ are shared across all worker threads.
+   * Certificates are parsed on first use and only up to _capacity_ are kept in memory.
+   *
+   * @param options Options including _name_, _dir_, _capacity_ and _load_.
+   * @returns A _CertificateStore_ object.
+   */
+  new(options?: {
+    name?: string,
+    dir?: string,
+    capacity?: number,
+    load?: (name: string) => { cert: string | Data | Certificate, key: string | Data | PrivateKey } | undefined,
+  }): CertificateStore;
+}
+
 /**
  * Encryption operation.
  */
@@ -352,11 +393,61 @@ interface JWTConstructor {
   new(token: string): JWT;
 }
 
+/**
+ * JSON Web Key Set fetched from an HTTP endpoint.
+ */
+interface JWKS {
+
+  /**
+   * Looks up a key by its ID.
+   *
+   * @param kid A string containing the key ID.
+   * @returns A _JWK_ object, or `null` if the key is not in the set.
+   */
+  key(kid: string): JWK | null;
+
+  /**
+   * Verifies a token with the key named by its `kid` header.
+   *
+   * An unknown key ID makes the set refetch, at most once per _minFetchInterval_.
+   * Signatures are checked on a shared thread pool.
+   *
+   * @param token A _JWT_ object or a string containing the token.
+   * @returns A promise resolving to whether the token is verified successfully.
+   */
+  verify(token: JWT | string): Promise<boolean>;
+
+  /**
+   * Fetches the key set again without waiting for the next refresh.
+   */
+  refresh(): void;
+}
+
+interface JWKSConstructor {
+
+  /**
+   * Creates an instance of _JWKS_ and starts fetching the key set.
+   *
+   * @param url A string containing the URL of the JWKS endpoint.
+   * @param options Options including:
+   *   - _refreshInterval_ - Time between refetches. Default is `"5m"`.
+   *   - _minFetchInterval_ - Minimum time between fetches caused by unknown key IDs. Default is `10`.
+   *   - _timeout_ - Time limit of each fetch. Default is `10`.
+   * @returns A _JWKS_ object.
+   */
+  new(url: string, options?: {
+    refreshInterval?: number | string,
+    minFetchInterval?: number | string,
+    timeout?: number | string,
+  }): JWKS;
+}
+
 interface Crypto {
   PublicKey: PublicKeyConstructor,
   PrivateKey: PrivateKeyConstructor,
   Certificate: CertificateConstructor,
   CertificateChain: CertificateChainConstructor,
+  CertificateStore: CertificateStoreConstructor,
   Cipher: CipherConstructor,
   Decipher: DecipherConstructor,
   Hash: HashConstructor,
@@ -365,6 +456,7 @@ interface Crypto {
   Verify: VerifyConstructor,
   JWK: JWKConstructor,
   JWT: JWTConstructor,
+  JWKS: JWKSConstructor,
 }
 
 declare var crypto: Crypto;
@@ -94,6 +94,10 @@ interface HttpDirectory {
   /**
    * Generates a response for a static file request.
    *
+   * Responses carry _etag_ and, for files on disk, _last-modified_ headers.
+   * Conditional requests get a 304 and single byte ranges a 206.
+   * Files on disk are checked for changes at most once a second.
+   *
    * @param request A _Message_ object requesting a static file.
    * @returns A _Message_ object containing the HTTP response for the static file.
    */
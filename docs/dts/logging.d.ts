@@ -20,10 +20,23 @@ interface Logger {
   /**
    * Adds output to a file.
    *
+   * Lines are written by a dedicated thread. Lines dropped because that
+   * thread couldn't keep up are counted in metric _pipy_log_dropped_.
+   *
    * @param filename Pathname of the file to write to.
+   * @param options Options including:
+   *   - _overflow_ - What to do when too many lines are pending. Can be one of:
+   *       - `"drop"` - Drop new lines (Default)
+   *       - `"block"` - Wait until there is room
+   *       - `"sample"` - Keep only 1 in 8 lines once half full, drop when full
    * @returns The same logger object.
    */
-  toFile(filename: string): Logger;
+  toFile(
+    filename: string,
+    options?: {
+      overflow?: 'drop' | 'block' | 'sample',
+    }
+  ): Logger;
 
   /**
    * Adds output to the [Syslog](https://en.wikipedia.org/wiki/Syslog).
@@ -157,10 +170,55 @@ interface JSONLoggerConstructor {
   new(name: string): JSONLogger;
 }
 
+/**
+ * Log records in blocks of deflate-compressed columns.
+ *
+ * Files written by a _ColumnarLogger_ can be turned back into JSON lines
+ * with `pipy --decode-log=<filename>`.
+ */
+interface ColumnarLogger extends Logger {
+
+  /**
+   * Writes out the rows gathered so far as a block.
+   *
+   * @returns The same logger object.
+   */
+  flush(): ColumnarLogger;
+}
+
+interface ColumnarLoggerConstructor {
+
+  /**
+   * Creates an instance of _ColumnarLogger_.
+   *
+   * @param name Name of the logger.
+   * @param schema An object mapping each field name to its column type. Can be one of:
+   *   - `"string"` - Dictionary encoded strings
+   *   - `"int"` - Integers
+   *   - `"number"` - Floating point numbers
+   *   - `"time"` - Milliseconds since epoch, delta encoded
+   * @param options Options including:
+   *   - _blockSize_ - Maximum number of rows in a block. Default is `4096`.
+   *   - _interval_ - Maximum time to hold rows before writing out a block.
+   *       Can be a number in seconds or a string with one of the time unit suffixes such as `s`, `m` or `h`.
+   *       Default is _1 second_.
+   * @returns A _ColumnarLogger_ object with the specified name.
+   */
+  new(
+    name: string,
+    schema: { [field: string]: 'string' | 'int' | 'number' | 'time' },
+    options?: {
+      blockSize?: number,
+      interval?: number | string,
+    }
+  ): ColumnarLogger;
+}
+
 interface Logging {
   BinaryLogger: BinaryLoggerConstructor,
   TextLogger: TextLoggerConstructor,
   JSONLogger: JSONLoggerConstructor,
+  ColumnarLogger: ColumnarLoggerConstructor,
 }
 
 declare var logging: Logging;
@@ -45,6 +45,16 @@ interface OS {
    */
   readFile(filename: string): Data;
 
+  /**
+   * Read the entire content of a file without blocking the current thread.
+   *
+   * Small files are cached per thread and only read again after their size or modification time changes.
+   *
+   * @param filename Pathname of the file to read.
+   * @returns A _Promise_ resolving to a _Data_ object containing the entire content of the file, or _null_ if it cannot be read.
+   */
+  readFileAsync(filename: string): Promise<Data | null>;
+
   /**
    * Write the entire content of a file.
    *
@@ -53,6 +63,15 @@ interface OS {
    */
   writeFile(filename: string, content: Data | string): void;
 
+  /**
+   * Write the entire content of a file without blocking the current thread.
+   *
+   * @param filename Pathname of the file to write.
+   * @param content A string or a _Data_ object containing the entire content of the file.
+   * @returns A _Promise_ resolving when the file has been written.
+   */
+  writeFileAsync(filename: string, content: Data | string): Promise<void>;
+
   /**
    * Retrieves information about a file.
    *
@@ -10,6 +10,28 @@ interface Metric {
    * @returns A sub-metric labeled with the specified values.
    */
   withLabels(...labels: string[]): Metric;
+
+  /**
+   * Retrieves a sub-metric by the value of the next label.
+   *
+   * The returned sub-metric can be kept and updated directly
+   * so that no label lookups are needed on every update.
+   *
+   * @param label Value of the next label.
+   * @returns A sub-metric labeled with the specified value.
+   */
+  bind(label: string): Metric;
+
+  /**
+   * Limits the number of sub-metrics under each level of this metric.
+   *
+   * When a new label exceeds the limit, the least updated sub-metric is removed
+   * and its values are folded into a sub-metric labeled `"__other__"`.
+   *
+   * @param limit Maximum number of sub-metrics per level, or 0 for no limit.
+   * @returns The same _Metric_ object.
+   */
+  limitCardinality(limit: number): Metric;
 }
 
 /**
@@ -117,10 +139,19 @@ interface HistogramConstructor {
    * Creates an instance of _Histogram_.
    *
    * @param name Name of the histogram metric.
+   * @param buckets An array of bucket upper bounds in ascending order,
+   *   or options for log-linear buckets where every power of two is split into 2^precision sub-buckets:
+   *   - _lowest_ - Upper bound of the first bucket. Default is `0.001`.
+   *   - _highest_ - Maximum value to be tracked before the final `Inf` bucket. Default is `3600000`.
+   *   - _precision_ - Number of bits for sub-buckets, between 1 and 10. Default is `3`.
    * @param labelNames An array of label names.
    * @returns A _Histogram_ object with the specified name and labels.
    */
-  new(name: string, buckets: number[], labelNames?: string[]): Histogram;
+  new(
+    name: string,
+    buckets: number[] | { lowest?: number, highest?: number, precision?: number },
+    labelNames?: string[]
+  ): Histogram;
 }
 
 interface Stats {
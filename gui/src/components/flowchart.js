@@ -52,17 +52,35 @@ const useStyles = makeStyles(theme => ({
     borderBottomLeftRadius: 6,
     borderBottomRightRadius: 6,
   },
+  liveStats: {
+    marginLeft: 12,
+    fontSize: '0.85em',
+    fontWeight: 'normal',
+    opacity: 0.7,
+  },
 }));
 
-function Flowchart({ nodes, root }) {
+// Fields of a stats entry as sent in status.modules[].stats
+const STATS_ACTIVE = 0;
+const STATS_STARTED = 1;
+const STATS_EVENTS = 2;
+const STATS_BUFFERED = 4;
+
+function Flowchart({ nodes, stats, root }) {
   const classes = useStyles();
 
   const graphEl = React.useRef();
+  const boxesRef = React.useRef([]);
+  const lastStatsRef = React.useRef(null);
+
+  // Status is polled every second, so only redraw when the graph changes
+  const graphKey = React.useMemo(() => JSON.stringify(nodes || null), [nodes]);
 
   React.useEffect(() => {
     const div = graphEl.current;
     if (div && nodes) {
-      drawPipeline(div, nodes, root, classes);
+      boxesRef.current = drawPipeline(div, nodes, root, classes);
+      lastStatsRef.current = null;
     }
     return () => {
       if (div) {
@@ -71,15 +89,71 @@ function Flowchart({ nodes, root }) {
         }
       }
     }
-  }, [nodes, root, classes]);
+  // eslint-disable-next-line react-hooks/exhaustive-deps
+  }, [graphKey, root, classes]);
+
+  React.useEffect(() => {
+    if (!stats) return;
+    const now = Date.now();
+    const last = lastStatsRef.current;
+    lastStatsRef.current = { time: now, stats };
+    if (!last || last.stats.length !== stats.length) return;
+    drawStats(boxesRef.current, last.stats, stats, (now - last.time) / 1000, classes);
+  }, [stats, graphKey, classes]);
 
   if (!nodes) return null;
 
   return <div ref={graphEl} className={classes.flowchartContainer}/>;
 }
 
+function formatRate(n) {
+  if (n >= 1e6) return (n / 1e6).toFixed(1) + 'M/s';
+  if (n >= 1e3) return (n / 1e3).toFixed(1) + 'k/s';
+  return n.toFixed(0) + '/s';
+}
+
+function formatSize(n) {
+  if (n >= 1 << 20) return (n / (1 << 20)).toFixed(1) + ' MB';
+  if (n >= 1 << 10) return (n / (1 << 10)).toFixed(1) + ' KB';
+  return n + ' B';
+}
+
+//
+// Shades filters by their share of the busiest filter's event rate
+// and labels pipelines with their active counts and start rates.
+//
+
+function drawStats(boxes, before, after, seconds, classes) {
+  if (!(seconds > 0)) return;
+
+  const rates = after.map((s, i) => Math.max(0, s[STATS_EVENTS] - before[i][STATS_EVENTS]) / seconds);
+  const maxRate = Math.max(1, ...rates);
+
+  boxes.forEach((div, i) => {
+    const s = after[i];
+    if (!div || !s) return;
+    let label = div.liveLabel;
+    if (!label) {
+      label = div.liveLabel = document.createElement('span');
+      label.className = classes.liveStats;
+      div.appendChild(label);
+    }
+    if (div.isPipeline) {
+      const starts = Math.max(0, s[STATS_STARTED] - before[i][STATS_STARTED]) / seconds;
+      label.textContent = `${s[STATS_ACTIVE]} active, ${formatRate(starts)}`;
+    } else {
+      const parts = [];
+      if (s[STATS_EVENTS] > 0) parts.push(formatRate(rates[i]));
+      if (s[STATS_BUFFERED] > 0) parts.push(formatSize(s[STATS_BUFFERED]));
+      label.textContent = parts.join(', ');
+      const heat = rates[i] / maxRate;
+      div.style.background = heat > 0 ? `hsl(${60 - 60 * heat}, 100%, ${95 - 35 * heat}%)` : '';
+    }
+  });
+}
+
 function drawPipeline(container, graph, root, classes) {
-  if (!graph[root]) return;
+  if (!graph[root]) return [];
 
   const boxes = [];
   const calls = {};
@@ -255,6 +329,7 @@ function drawPipeline(container, graph, root, classes) {
     if (isOutput) drawGutter();
 
     div.classList.add(isPipeline ? classes.boxPipeline : classes.boxFilter);
+    div.isPipeline = isPipeline;
     if (isInput) div.classList.add(classes.boxInput);
     if (isOutput) div.classList.add(classes.boxOutput);
   }
@@ -438,6 +513,8 @@ function drawPipeline(container, graph, root, classes) {
     }
     drawArrow(x2, y2);
   }
+
+  return boxes;
 }
 
 export default Flowchart;
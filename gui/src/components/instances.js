@@ -40,6 +40,9 @@ function Instances({ root }) {
       } else {
         return null;
       }
+    },
+    {
+      refetchInterval: 1000,
     }
   );
 
@@ -134,7 +134,11 @@ function Status({ root }) {
               <Nothing text="No running pipelines"/>
             ) : (
               (moduleMap[currentModule] && (
-                <Flowchart nodes={moduleMap[currentModule].graph.nodes} root={currentPipeline}/>
+                <Flowchart
+                  nodes={moduleMap[currentModule].graph.nodes}
+                  stats={moduleMap[currentModule].stats}
+                  root={currentPipeline}
+                />
               )) || (
                 <Nothing text="No pipeline selected"/>
               )
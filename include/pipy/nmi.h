@@ -113,6 +113,8 @@ typedef void (*fn_pipy_module_init)();
 typedef void (*fn_pipeline_init   )(pipy_pipeline ppl, void **user_ptr);
 typedef void (*fn_pipeline_free   )(pipy_pipeline ppl, void  *user_ptr);
 typedef void (*fn_pipeline_process)(pipy_pipeline ppl, void  *user_ptr, pjs_value evt);
+typedef void (*fn_pipeline_process_batch)(pipy_pipeline ppl, void *user_ptr, pjs_value evts[], int count);
+typedef int  (*fn_data_chunk)(const char *ptr, int len, void *user_ptr);
 
 NMI_EXPORT int       pipy_is_Data(pjs_value obj);
 NMI_EXPORT int       pipy_is_MessageStart(pjs_value obj);
@@ -124,6 +126,11 @@ NMI_EXPORT pjs_value pipy_Data_pop(pjs_value obj, int len);
 NMI_EXPORT pjs_value pipy_Data_shift(pjs_value obj, int len);
 NMI_EXPORT int       pipy_Data_get_size(pjs_value obj);
 NMI_EXPORT int       pipy_Data_get_data(pjs_value obj, char *buf, int len);
+NMI_EXPORT int       pipy_Data_iterate(pjs_value obj, fn_data_chunk cb, void *user_ptr);
+NMI_EXPORT pjs_value pipy_Data_Builder_new();
+NMI_EXPORT char*     pipy_Data_Builder_reserve(pjs_value builder, int *len);
+NMI_EXPORT void      pipy_Data_Builder_commit(pjs_value builder, int len);
+NMI_EXPORT pjs_value pipy_Data_Builder_flush(pjs_value builder);
 NMI_EXPORT pjs_value pipy_MessageStart_new(pjs_value head);
 NMI_EXPORT pjs_value pipy_MessageStart_get_head(pjs_value obj);
 NMI_EXPORT pjs_value pipy_MessageEnd_new(pjs_value tail, pjs_value payload);
@@ -134,12 +141,14 @@ NMI_EXPORT pjs_value pipy_StreamEnd_get_error(pjs_value obj);
 
 NMI_EXPORT int  pipy_define_variable(int id, const char *name, const char *ns, pjs_value value);
 NMI_EXPORT void pipy_define_pipeline(const char *name, fn_pipeline_init init, fn_pipeline_free free, fn_pipeline_process process);
+NMI_EXPORT void pipy_define_pipeline_batch(const char *name, fn_pipeline_init init, fn_pipeline_free free, fn_pipeline_process_batch process);
 NMI_EXPORT void pipy_hold(pipy_pipeline ppl);
 NMI_EXPORT void pipy_free(pipy_pipeline ppl);
 NMI_EXPORT void pipy_output_event(pipy_pipeline ppl, pjs_value evt);
 NMI_EXPORT void pipy_get_variable(pipy_pipeline ppl, int id, pjs_value value);
 NMI_EXPORT void pipy_set_variable(pipy_pipeline ppl, int id, pjs_value value);
 NMI_EXPORT void pipy_schedule(pipy_pipeline ppl, double timeout, void (*fn)(void *), void *user_ptr);
+NMI_EXPORT void pipy_submit_work(pipy_pipeline ppl, void (*work)(void *), void (*done)(void *), void *user_ptr);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -7,6 +7,7 @@ var options = parseOptions({
     '--connections': 10,
     '--duration': 10,
     '--payload': 0,
+    '--rate': 0,
   },
   shorthands: {
     '-X': '--method',
@@ -14,6 +15,7 @@ var options = parseOptions({
     '-c': '--connections',
     '-d': '--duration',
     '-p': '--payload',
+    '-r': '--rate',
   },
 })
 
@@ -76,6 +78,7 @@ if (options.args.length !== 2) {
   println('  -X, --method      <string>  HTTP request method such as GET, POST, ...')
   println('  -H, --header      <string>  Add an HTTP request header')
   println('  -p, --payload     <number>  Request payload size in bytes')
+  println('  -r, --rate        <number>  Requests per second per thread, sent regardless of responses')
   return
 }
 
@@ -112,11 +115,16 @@ var request = new Message(
 
 var connections = options['--connections']
 var duration = options['--duration']
+var rate = options['--rate']
 var endTime = Date.now() + duration * 1000
 
 if (pipy.thread.id === 0) {
   println('Stress testing', url.href)
-  println(`Running ${pipy.thread.concurrency} threads for ${duration} seconds with ${connections} connections each`)
+  if (rate > 0) {
+    println(`Running ${pipy.thread.concurrency} threads for ${duration} seconds at ${rate} requests per second each over up to ${connections} connections`)
+  } else {
+    println(`Running ${pipy.thread.concurrency} threads for ${duration} seconds with ${connections} connections each`)
+  }
 }
 
 var counts = new stats.Counter('counts', ['status'])
@@ -144,60 +152,79 @@ var tls = pipeline($=>$
   .connectTLS({ sni: url.host }).to(tcp)
 )
 
-pipeline($=>$
-  .onStart(request)
-  .forkJoin(Array(connections)).to($=>$
-    .onStart((_, i) => void ($conn = i))
-    .encodeHTTPRequest()
-    .repeat(() => Date.now() < endTime).to($=>$
-      .handleMessageStart(() => void ($time = pipy.now()))
-      .mux(() => $conn).to($=>$
-        .insert(() => stopPromise.then(new StreamEnd))
+if (rate > 0) {
+  new algo.LoadGen(
+    pipeline($=>$
+      .muxHTTP({ maxQueue: 1, maxConnections: connections }).to($=>$
         .pipe(url.protocol === 'https:' ? tls : tcp)
-        .decodeHTTPResponse()
       )
       .handleMessageStart(
         function (res) {
-          latency.observe(pipy.now() - $time)
           counts.increase()
           counts.withLabels(res.head.status).increase()
         }
       )
-      .replaceMessage(new StreamEnd)
-    )
-  )
-  .replaceStreamStart(() => {
-    stopAll()
-    return new StreamEnd
-  })
-
-).spawn().then(
-  function () {
-    if (pipy.thread.id === 0) {
-      stats.sum(['counts', 'latency', 'pipy_outbound_in']).then(
-        function ({ counts, latency, pipy_outbound_in }) {
-          var total = counts.value
-          println(`Completed ${total} requests in ${duration} seconds, ${formatSize(pipy_outbound_in.value)} read`)
-          println('  Responses')
-          counts.submetrics().forEach(
-            m => {
-              println('   ', formatPercentage(m.value / total).padEnd(5), 'Status', m.label)
-            }
-          )
-          var p = latency.percentile
-          println('  Latency')
-          println('    50% ', formatTime(p.calculate(50)))
-          println('    75% ', formatTime(p.calculate(75)))
-          println('    90% ', formatTime(p.calculate(90)))
-          println('    95% ', formatTime(p.calculate(95)))
-          println('    99% ', formatTime(p.calculate(99)))
-          println('Requests per second:', Math.round(total / duration))
-          println('Transfer per second:', formatSize(pipy_outbound_in.value / duration))
-        }
-      )
+    ), {
+      rate, duration, request,
+      latency,
     }
+  ).start().then(report)
+} else {
+  pipeline($=>$
+    .onStart(request)
+    .forkJoin(Array(connections)).to($=>$
+      .onStart((_, i) => void ($conn = i))
+      .encodeHTTPRequest()
+      .repeat(() => Date.now() < endTime).to($=>$
+        .handleMessageStart(() => void ($time = pipy.now()))
+        .mux(() => $conn).to($=>$
+          .insert(() => stopPromise.then(new StreamEnd))
+          .pipe(url.protocol === 'https:' ? tls : tcp)
+          .decodeHTTPResponse()
+        )
+        .handleMessageStart(
+          function (res) {
+            latency.observe(pipy.now() - $time)
+            counts.increase()
+            counts.withLabels(res.head.status).increase()
+          }
+        )
+        .replaceMessage(new StreamEnd)
+      )
+    )
+    .replaceStreamStart(() => {
+      stopAll()
+      return new StreamEnd
+    })
+
+  ).spawn().then(report)
+}
+
+function report() {
+  if (pipy.thread.id === 0) {
+    stats.sum(['counts', 'latency', 'pipy_outbound_in']).then(
+      function ({ counts, latency, pipy_outbound_in }) {
+        var total = counts.value
+        println(`Completed ${total} requests in ${duration} seconds, ${formatSize(pipy_outbound_in.value)} read`)
+        println('  Responses')
+        counts.submetrics().forEach(
+          m => {
+            println('   ', formatPercentage(m.value / total).padEnd(5), 'Status', m.label)
+          }
+        )
+        var p = latency.percentile
+        println('  Latency')
+        println('    50% ', formatTime(p.calculate(50)))
+        println('    75% ', formatTime(p.calculate(75)))
+        println('    90% ', formatTime(p.calculate(90)))
+        println('    95% ', formatTime(p.calculate(95)))
+        println('    99% ', formatTime(p.calculate(99)))
+        println('Requests per second:', Math.round(total / duration))
+        println('Transfer per second:', formatSize(pipy_outbound_in.value / duration))
+      }
+    )
   }
-)
+}
 
 function formatPercentage(n) {
   return (n * 100).toFixed(0) + '%'
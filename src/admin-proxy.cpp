@@ -217,7 +217,7 @@ auto AdminProxy::handle(http::RequestHead *head) -> Message* {
       }
 #endif
       if (f) {
-        auto headers = head->headers.get();
+        auto headers = head->headers();
         pjs::Value v;
         if (headers) headers->ht_get("accept-encoding", v);
         return f->to_message(v.is_string() ? v.s() : pjs::Str::empty.get());
@@ -256,7 +256,7 @@ auto AdminProxy::response_head(int status) -> http::ResponseHead* {
   auto head = http::ResponseHead::make();
   auto headers_obj = pjs::Object::make();
   headers_obj->ht_set("server", s_server_name);
-  head->headers = headers_obj;
+  head->headers(headers_obj);
   head->status = status;
   return head;
 }
@@ -266,7 +266,7 @@ auto AdminProxy::response_head(
   const std::map<std::string, std::string> &headers
 ) -> http::ResponseHead* {
   auto head = response_head(status);
-  auto headers_obj = head->headers.get();
+  auto headers_obj = head->headers();
   for (const auto &i : headers) headers_obj->ht_set(i.first, i.second);
   return head;
 }
@@ -43,9 +43,14 @@
 #include "compressor.hpp"
 #include "fs.hpp"
 #include "log.hpp"
+#include "profiler.hpp"
+#include "flight-recorder.hpp"
+#include "thread-pool.hpp"
 #include "utils.hpp"
 
+#include <condition_variable>
 #include <limits>
+#include <mutex>
 
 namespace pipy {
 
@@ -53,6 +58,9 @@ static Data::Producer s_dp("Codebase Service");
 
 static std::string s_server_name("pipy-repo");
 
+// Metric reports arriving within this long are merged in one go
+static const double METRICS_MERGE_DELAY = 0.5;
+
 //
 // AdminService
 //
@@ -92,7 +100,7 @@ AdminService::AdminService(
     headers->ht_set("server", s_server_name);
     headers->ht_set("content-type", content_type);
     if (gzip) headers->ht_set("content-encoding", "gzip");
-    head->headers = headers;
+    head->headers(headers);
     return head;
   };
 
@@ -100,7 +108,7 @@ AdminService::AdminService(
     auto head = http::ResponseHead::make();
     auto headers = pjs::Object::make();
     headers->ht_set("server", s_server_name);
-    head->headers = headers;
+    head->headers(headers);
     head->status = status;
     return Message::make(head, nullptr);
   };
@@ -109,6 +117,7 @@ AdminService::AdminService(
   m_response_head_json = create_response_head("application/json", false);
   m_response_head_text_gzip = create_response_head("text/plain", true);
   m_response_head_json_gzip = create_response_head("application/json", true);
+  m_response_head_binary = create_response_head("application/octet-stream", false);
   m_response_ok = create_response(200);
   m_response_created = create_response(201);
   m_response_deleted = create_response(204);
@@ -219,6 +228,7 @@ void AdminService::close() {
   }
   m_module->shutdown();
   m_metrics_history_timer.cancel();
+  m_metrics_merge_timer.cancel();
 }
 
 void AdminService::start(const std::string &codebase, const std::vector<std::string> &argv) {
@@ -244,6 +254,12 @@ auto AdminService::handle(Context *ctx, Message *req) -> pjs::Object* {
   static const std::string prefix_api_v1_files("/api/v1/files/");
   static const std::string prefix_api_v1_metrics("/api/v1/metrics/");
   static const std::string prefix_api_v1_log("/api/v1/log/");
+  static const std::string path_api_v1_profile("/api/v1/profile");
+  static const std::string prefix_api_v1_profile("/api/v1/profile?");
+  static const std::string path_api_v1_heap("/api/v1/heap");
+  static const std::string prefix_api_v1_heap("/api/v1/heap?");
+  static const std::string path_api_v1_flight("/api/v1/flight");
+  static const std::string prefix_api_v1_flight("/api/v1/flight?");
   static const std::string prefix_admin("/admin/");
   static const std::string text_html("text/html");
 
@@ -258,7 +274,7 @@ auto AdminService::handle(Context *ctx, Message *req) -> pjs::Object* {
   auto body = req->body();
   auto method = head->method->str();
   auto path = utils::decode_uri(head->path->str());
-  auto headers = head->headers.get();
+  auto headers = head->headers();
 
   pjs::Value accept, upgrade;
   headers->get(s_accept, accept);
@@ -273,7 +289,7 @@ auto AdminService::handle(Context *ctx, Message *req) -> pjs::Object* {
       auto headers = pjs::Object::make();
       auto head = http::ResponseHead::make();
       head->status = 101;
-      head->headers = headers;
+      head->headers(headers);
       pjs::Ref<crypto::Hash> hash = crypto::Hash::make("sha1");
       hash->update(sec_key.s()->str() + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
       headers->set(s_sec_websocket_accept, hash->digest(Data::Encoding::base64));
@@ -515,6 +531,33 @@ auto AdminService::handle(Context *ctx, Message *req) -> pjs::Object* {
       }
     }
 
+    // GET /api/v1/profile?seconds=[n]&frequency=[hz]&format=[folded|pprof]
+    if (path == path_api_v1_profile || utils::starts_with(path, prefix_api_v1_profile)) {
+      if (method == "GET") {
+        return api_v1_profile_GET(path.substr(path_api_v1_profile.length()));
+      } else {
+        return m_response_method_not_allowed;
+      }
+    }
+
+    // GET /api/v1/heap?seconds=[n]
+    if (path == path_api_v1_heap || utils::starts_with(path, prefix_api_v1_heap)) {
+      if (method == "GET") {
+        return api_v1_heap_GET(path.substr(path_api_v1_heap.length()));
+      } else {
+        return m_response_method_not_allowed;
+      }
+    }
+
+    // GET /api/v1/flight?min=[ms]
+    if (path == path_api_v1_flight || utils::starts_with(path, prefix_api_v1_flight)) {
+      if (method == "GET") {
+        return api_v1_flight_GET(path.substr(path_api_v1_flight.length()));
+      } else {
+        return m_response_method_not_allowed;
+      }
+    }
+
     // Custom administration functionality
     if (utils::starts_with(path, prefix_admin)) {
       auto promise = pjs::Promise::make();
@@ -558,7 +601,7 @@ auto AdminService::handle(Context *ctx, Message *req) -> pjs::Object* {
       }
 #endif
       if (f) {
-        auto headers = req->head()->as<http::RequestHead>()->headers.get();
+        auto headers = req->head()->as<http::RequestHead>()->headers();
         pjs::Value v;
         if (headers) headers->ht_get("accept-encoding", v);
         return f->to_message(v.is_string() ? v.s() : pjs::Str::empty.get());
@@ -608,6 +651,8 @@ Message* AdminService::dump_GET(const std::string &path) {
         status.dump_objects(db);
       } else if (item == "chunks") {
         status.dump_chunks(db);
+      } else if (item == "retainers") {
+        status.dump_retainers(db);
       } else if (item == "buffers") {
         status.dump_buffers(db);
       } else if (item == "pipelines") {
@@ -616,6 +661,10 @@ Message* AdminService::dump_GET(const std::string &path) {
         status.dump_inbound(db);
       } else if (item == "outbound") {
         status.dump_outbound(db);
+      } else if (item == "loops") {
+        status.dump_loops(db);
+      } else if (item == "memory") {
+        status.dump_memory(db);
       } else {
         db.push("Unknown dump item: ");
         db.push(item);
@@ -650,77 +699,44 @@ Message* AdminService::metrics_GET(pjs::Object *headers) {
   headers->get(s_accept_encoding, v);
   auto use_gzip = (v.is_string() && v.s()->str().find(s_gzip) != std::string::npos);
 
-  Data data;
-  Data::Builder db(data, &s_dp);
-  auto db_input = [&](Data &data) {
-    db.push(std::move(data));
-  };
-
-  Compressor *compressor = nullptr;
-  if (use_gzip) compressor = Compressor::gzip(db_input);
+  // Scrapes before the next collection step get the same output
+  if (!m_metrics_text) {
+    Data data;
+    Data::Builder db(data, &s_dp);
 
-  char buf[DATA_CHUNK_SIZE];
-  size_t buf_ptr = 0;
+    auto &stats = WorkerManager::get().stats();
+    stats.to_prometheus(db);
 
-  auto output = [&](const void *data, size_t size) {
-    if (compressor) {
-      if (size == 1) {
-        buf[buf_ptr++] = *(const char *)data;
-        if (buf_ptr >= sizeof(buf)) {
-          Data data(buf, buf_ptr, &s_dp);
-          compressor->input(data, false);
-          buf_ptr = 0;
-        }
+    for (const auto &p : m_instances) {
+      auto inst = p.second;
+      std::string inst_label("instance=\"");
+      if (inst->status.name.empty()) {
+        inst_label += std::to_string(inst->index);
       } else {
-        size_t p = 0;
-        while (p < size) {
-          auto n = std::min(sizeof(buf) - buf_ptr, size - p);
-          std::memcpy(buf + buf_ptr, (const char *)data + p, n);
-          p += n;
-          buf_ptr += n;
-          if (buf_ptr >= sizeof(buf)) {
-            Data data(buf, buf_ptr, &s_dp);
-            compressor->input(data, false);
-            buf_ptr = 0;
-          }
-        }
-      }
-    } else {
-      if (size == 1) {
-        db.push(*(const char *)data);
-      } else {
-        db.push((const char *)data, size);
+        inst_label += inst->status.name;
       }
+      inst_label += '"';
+      inst->metric_data.to_prometheus(inst_label, db);
     }
-  };
-
-  auto &stats = WorkerManager::get().stats();
-  stats.to_prometheus(output);
 
-  for (const auto &p : m_instances) {
-    auto inst = p.second;
-    std::string inst_label("instance=\"");
-    if (inst->status.name.empty()) {
-      inst_label += std::to_string(inst->index);
-    } else {
-      inst_label += inst->status.name;
-    }
-    inst_label += '"';
-    inst->metric_data.to_prometheus(inst_label, output);
+    db.flush();
+    m_metrics_text = Message::make(m_response_head_text, Data::make(std::move(data)));
   }
 
-  if (compressor) {
-    Data data(buf, buf_ptr, &s_dp);
-    compressor->input(data, true);
+  if (!use_gzip) return m_metrics_text;
+
+  if (!m_metrics_text_gzip) {
+    Data data;
+    Data::Builder db(data, &s_dp);
+    auto compressor = Compressor::gzip([&](Data &data) { db.push(std::move(data)); });
+    compressor->input(*m_metrics_text->body(), false);
+    compressor->flush();
     compressor->finalize();
+    db.flush();
+    m_metrics_text_gzip = Message::make(m_response_head_text_gzip, Data::make(std::move(data)));
   }
 
-  db.flush();
-
-  return Message::make(
-    use_gzip ? m_response_head_text_gzip : m_response_head_text,
-    Data::make(std::move(data))
-  );
+  return m_metrics_text_gzip;
 }
 
 Message* AdminService::options_GET() {
@@ -800,10 +816,16 @@ Message* AdminService::repo_POST(Context *ctx, const std::string &path, Data *da
       inst->timestamp = utils::now();
       inst->ip = ctx->inbound()->remote_address()->str();
       if (!metrics.empty()) {
-        if (inst->metric_data.deserialize(metrics)) {
-          inst->metric_history.step(inst->metric_data);
-          return m_response_partial;
+        if (m_metric_report_instances.empty()) {
+          m_metrics_merge_timer.schedule(
+            METRICS_MERGE_DELAY, [this]() { metrics_merge_step(); }
+          );
         }
+        inst->metric_reports.push_back(std::move(metrics));
+        m_metric_report_instances.insert(inst->index);
+
+        // A report that failed to merge makes the next one go in full
+        if (!inst->metric_reports_failed) return m_response_partial;
       }
       return m_response_created;
     }
@@ -1214,8 +1236,13 @@ Message* AdminService::api_v1_status_GET() {
   );
 }
 
+//
+// Responses are kept until the history they come from takes another step
+//
+
 Message* AdminService::api_v1_metrics_GET(const std::string &path) {
   stats::MetricHistory *mh = nullptr;
+  std::map<std::string, pjs::Ref<Message>> *snapshots = nullptr;
   std::string uuid, name;
   if (!path.empty()) {
     auto i = path.find('/');
@@ -1228,11 +1255,18 @@ Message* AdminService::api_v1_metrics_GET(const std::string &path) {
   }
   if (uuid.empty()) {
     mh = &m_local_metric_history;
+    snapshots = &m_local_metric_snapshots;
   } else {
     auto i = m_instance_map.find(uuid);
-    if (i != m_instance_map.end()) mh = &get_instance(i->second)->metric_history;
+    if (i != m_instance_map.end()) {
+      auto inst = get_instance(i->second);
+      mh = &inst->metric_history;
+      snapshots = &inst->metric_snapshots;
+    }
   }
   if (!mh) return m_response_not_found;
+  auto &snapshot = (*snapshots)[name];
+  if (snapshot) return snapshot;
   Data payload;
   Data::Builder db(payload, &s_dp);
   static const std::string s_time("\"time\":");
@@ -1250,10 +1284,11 @@ Message* AdminService::api_v1_metrics_GET(const std::string &path) {
   }
   db.push('}');
   db.flush();
-  return Message::make(
+  snapshot = Message::make(
     m_response_head_json,
     Data::make(payload)
   );
+  return snapshot;
 }
 
 Message* AdminService::api_v1_graph_POST(Data *data) {
@@ -1271,6 +1306,175 @@ Message* AdminService::api_v1_graph_POST(Data *data) {
   );
 }
 
+//
+// Samples every thread of the process for the requested number of
+// seconds before responding. Only one profile can be taken at a time.
+//
+
+auto AdminService::api_v1_profile_GET(const std::string &query) -> pjs::Object* {
+  double seconds = 30;
+  int frequency = 99;
+  bool is_pprof = false;
+
+  if (!query.empty()) {
+    for (const auto &kv : utils::split(query.substr(1), '&')) {
+      auto i = kv.find('=');
+      auto k = kv.substr(0, i);
+      auto v = (i == std::string::npos ? std::string() : kv.substr(i + 1));
+      if (k == "seconds") {
+        seconds = std::atof(v.c_str());
+        if (seconds <= 0 || seconds > 600) return response(400, "seconds out of range (0, 600]");
+      } else if (k == "frequency") {
+        frequency = std::atoi(v.c_str());
+        if (frequency < 1 || frequency > 1000) return response(400, "frequency out of range [1, 1000]");
+      } else if (k == "format") {
+        if (v == "pprof") is_pprof = true;
+        else if (v != "folded") return response(400, "format must be folded or pprof");
+      }
+    }
+  }
+
+  if (!Profiler::start(frequency)) {
+    return response(409, "profiler is not available or already running");
+  }
+
+  auto promise = pjs::Promise::make();
+  auto settler = pjs::Promise::Settler::make(promise);
+  settler->retain();
+
+  m_profile_timer.schedule(
+    seconds,
+    [=]() {
+      InputContext ic;
+      Profiler::stop();
+      std::map<std::string, size_t> stacks;
+      Profiler::collect(stacks);
+      Data buf;
+      if (is_pprof) {
+        Profiler::pprof(stacks, frequency, seconds, buf);
+        settler->resolve(Message::make(m_response_head_binary, Data::make(std::move(buf))));
+      } else {
+        Profiler::folded(stacks, buf);
+        settler->resolve(response(buf));
+      }
+      settler->release();
+    }
+  );
+
+  return promise;
+}
+
+//
+// Samples chunk allocations for the requested number of seconds, then
+// responds with allocation rates per pool and per data producer over that
+// period and the filters retaining the most sampled bytes. Sampling is
+// left on afterwards if it was already on from --trace-chunks.
+//
+
+auto AdminService::api_v1_heap_GET(const std::string &query) -> pjs::Object* {
+  double seconds = 10;
+
+  if (!query.empty()) {
+    for (const auto &kv : utils::split(query.substr(1), '&')) {
+      auto i = kv.find('=');
+      auto k = kv.substr(0, i);
+      auto v = (i == std::string::npos ? std::string() : kv.substr(i + 1));
+      if (k == "seconds") {
+        seconds = std::atof(v.c_str());
+        if (seconds <= 0 || seconds > 600) return response(400, "seconds out of range (0, 600]");
+      }
+    }
+  }
+
+  if (m_heap_sampling) {
+    return response(409, "heap sampling already in progress");
+  }
+
+  m_heap_sampling = true;
+  auto was_running = Data::Sampler::running();
+  Data::Sampler::start();
+
+  auto before = std::make_shared<Status>(WorkerManager::get().status());
+  auto promise = pjs::Promise::make();
+  auto settler = pjs::Promise::Settler::make(promise);
+  settler->retain();
+
+  m_heap_timer.schedule(
+    seconds,
+    [=]() {
+      InputContext ic;
+      auto &after = WorkerManager::get().status();
+      if (!was_running) Data::Sampler::stop();
+      m_heap_sampling = false;
+      Data buf;
+      Data::Builder db(buf, &s_dp);
+      after.dump_heap(*before, seconds, db);
+      db.flush();
+      settler->resolve(response(buf));
+      settler->release();
+    }
+  );
+
+  return promise;
+}
+
+//
+// Lists connections kept by the flight recorder as slower than the 99th
+// percentile of their worker, latest first, with the time in milliseconds
+// at which each stage was first reached.
+//
+
+Message* AdminService::api_v1_flight_GET(const std::string &query) {
+  double min_time = 0;
+
+  if (!query.empty()) {
+    for (const auto &kv : utils::split(query.substr(1), '&')) {
+      auto i = kv.find('=');
+      auto k = kv.substr(0, i);
+      auto v = (i == std::string::npos ? std::string() : kv.substr(i + 1));
+      if (k == "min") {
+        min_time = std::atof(v.c_str()) / 1000;
+      }
+    }
+  }
+
+  Data buf;
+  Data::Builder db(buf, &s_dp);
+  bool first = true;
+  db.push('[');
+  FlightRecorder::collect(
+    min_time,
+    [&](const FlightRecorder::Record &rec) {
+      char str[100];
+      if (first) first = false; else db.push(',');
+      db.push("{\"id\":");
+      db.push(std::to_string(rec.id));
+      db.push(",\"start\":");
+      db.push(std::to_string((uint64_t)rec.start));
+      db.push(",\"worker\":");
+      db.push(std::to_string(rec.worker));
+      db.push(",\"remoteAddress\":\"");
+      db.push(utils::escape(rec.address));
+      db.push("\",\"remotePort\":");
+      db.push(std::to_string(rec.port));
+      db.push(",\"stages\":{");
+      bool first_stage = true;
+      for (int i = 0; i < FlightRecorder::STAGE_COUNT; i++) {
+        if (auto t = rec.times[i]) {
+          auto stage = FlightRecorder::Stage(i);
+          auto len = std::snprintf(str, sizeof(str), "\"%s\":%.3f", FlightRecorder::stage_name(stage), (t - 1) / 1000.0);
+          if (first_stage) first_stage = false; else db.push(',');
+          db.push(str, len);
+        }
+      }
+      db.push("}}");
+    }
+  );
+  db.push(']');
+  db.flush();
+  return Message::make(m_response_head_json, Data::make(std::move(buf)));
+}
+
 Message* AdminService::response(const std::set<std::string> &lines) {
   std::string str;
   for (const auto &line : lines) {
@@ -1353,7 +1557,7 @@ auto AdminService::response_head(
   auto headers_obj = pjs::Object::make();
   headers_obj->ht_set("server", s_server_name);
   for (const auto &i : headers) headers_obj->ht_set(i.first, i.second);
-  head->headers = headers_obj;
+  head->headers(headers_obj);
   head->status = status;
   return head;
 }
@@ -1428,7 +1632,7 @@ void AdminService::change_program(const std::string &path, bool reload) {
   }
 
   if (reload) {
-    WorkerManager::get().reload();
+    WorkerManager::get().reload(true);
     return;
   }
 
@@ -1479,11 +1683,77 @@ void AdminService::metrics_history_step() {
   auto &sum = WorkerManager::get().stats();
   m_local_metric_history.step(sum);
   m_metrics_timestamp = std::chrono::steady_clock::now();
+
+  // All responses carry the new timestamp from now on
+  m_local_metric_snapshots.clear();
+  for (const auto &p : m_instances) p.second->metric_snapshots.clear();
+  m_metrics_text = nullptr;
+  m_metrics_text_gzip = nullptr;
+
   m_metrics_history_timer.schedule(
     5, [this]() { metrics_history_step(); }
   );
 }
 
+//
+// Reports queued since the last merge are parsed on the shared thread
+// pool, one task per instance applying its reports in order, while this
+// thread waits. Each instance's history then steps once here, since the
+// history keeps strings that belong to this thread.
+//
+
+void AdminService::metrics_merge_step() {
+  std::vector<Instance*> instances;
+  for (auto index : m_metric_report_instances) {
+    if (auto inst = get_instance(index)) {
+      instances.push_back(inst);
+    }
+  }
+  m_metric_report_instances.clear();
+
+  if (auto n = instances.size()) {
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<bool> merged(n);
+
+    for (size_t i = 0; i < instances.size(); i++) {
+      auto inst = instances[i];
+      ThreadPool::shared().run(
+        [&, i, inst]() {
+          bool ok = false, failed = false;
+          for (const auto &report : inst->metric_reports) {
+            if (inst->metric_data.deserialize(report)) {
+              ok = true;
+              failed = false;
+            } else {
+              failed = true;
+            }
+          }
+          std::lock_guard<std::mutex> lock(m);
+          merged[i] = ok;
+          inst->metric_reports_failed = failed;
+          n--;
+          cv.notify_one();
+        }
+      );
+    }
+
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [&]{ return n == 0; });
+
+    for (size_t i = 0; i < instances.size(); i++) {
+      auto inst = instances[i];
+      inst->metric_reports.clear();
+      if (merged[i]) {
+        inst->metric_history.step(inst->metric_data);
+        inst->metric_snapshots.clear();
+        m_metrics_text = nullptr;
+        m_metrics_text_gzip = nullptr;
+      }
+    }
+  }
+}
+
 void AdminService::inactive_instance_removal_step() {
   auto now = utils::now();
   std::set<int> inactive;
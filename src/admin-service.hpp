@@ -163,6 +163,9 @@ private:
     Status status;
     stats::MetricData metric_data;
     stats::MetricHistory metric_history;
+    std::vector<Data> metric_reports;
+    bool metric_reports_failed = false;
+    std::map<std::string, pjs::Ref<Message>> metric_snapshots;
     WebSocketHandler* admin_link = nullptr;
     std::map<std::string, std::set<LogWatcher*>> log_watchers;
     Instance() : metric_history(METRIC_HISTORY_SIZE) {}
@@ -181,8 +184,16 @@ private:
   std::map<std::string, std::set<int>> m_codebase_instances;
   std::map<std::string, std::set<LogWatcher*>> m_local_log_watchers;
   stats::MetricHistory m_local_metric_history;
+  std::map<std::string, pjs::Ref<Message>> m_local_metric_snapshots;
+  pjs::Ref<Message> m_metrics_text;
+  pjs::Ref<Message> m_metrics_text_gzip;
+  std::set<int> m_metric_report_instances;
   Timer m_metrics_history_timer;
+  Timer m_metrics_merge_timer;
   Timer m_inactive_instance_removal_timer;
+  Timer m_profile_timer;
+  Timer m_heap_timer;
+  bool m_heap_sampling = false;
   std::chrono::time_point<std::chrono::steady_clock> m_metrics_timestamp;
   pjs::Ref<logging::Logger> m_logger;
 
@@ -194,6 +205,7 @@ private:
   pjs::Ref<http::ResponseHead> m_response_head_json;
   pjs::Ref<http::ResponseHead> m_response_head_text_gzip;
   pjs::Ref<http::ResponseHead> m_response_head_json_gzip;
+  pjs::Ref<http::ResponseHead> m_response_head_binary;
   pjs::Ref<Message> m_response_ok;
   pjs::Ref<Message> m_response_created;
   pjs::Ref<Message> m_response_deleted;
@@ -243,6 +255,10 @@ private:
 
   Message* api_v1_graph_POST(Data *data);
 
+  auto api_v1_profile_GET(const std::string &query) -> pjs::Object*;
+  auto api_v1_heap_GET(const std::string &query) -> pjs::Object*;
+  Message* api_v1_flight_GET(const std::string &query);
+
   Message* response(const Data &text);
   Message* response(const std::string &text);
   Message* response(const std::set<std::string> &list);
@@ -265,6 +281,7 @@ private:
   void change_program(const std::string &path, bool reload);
   void update_options(const std::string &opts);
   void metrics_history_step();
+  void metrics_merge_step();
   void inactive_instance_removal_step();
 };
 
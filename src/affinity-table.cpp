@@ -0,0 +1,181 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "affinity-table.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+
+namespace pipy {
+
+//
+// AffinityTable::Options
+//
+
+AffinityTable::Options::Options(pjs::Object *options) {
+  Value(options, "ttl")
+    .get_seconds(ttl)
+    .check_nullable();
+  Value(options, "size")
+    .get(size)
+    .check_nullable();
+  if (ttl < 1) throw std::runtime_error("options.ttl must be at least 1 second");
+  if (size < 1) throw std::runtime_error("options.size must be at least 1");
+}
+
+//
+// AffinityTable
+//
+
+std::mutex AffinityTable::s_mutex;
+std::map<std::string, std::weak_ptr<AffinityTable>> AffinityTable::s_tables;
+
+//
+// The first worker to ask for a name decides the size and ttl,
+// later ones get the same table whatever options they give.
+//
+
+auto AffinityTable::get(const std::string &name, const Options &options) -> std::shared_ptr<AffinityTable> {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto &p = s_tables[name];
+  if (auto table = p.lock()) return table;
+  std::shared_ptr<AffinityTable> table(new AffinityTable(name, options));
+  p = table;
+  return table;
+}
+
+AffinityTable::AffinityTable(const std::string &name, const Options &options)
+  : m_name(name)
+  , m_options(options)
+  , m_size(options.size)
+  , m_slots(new Slot[options.size])
+  , m_epoch(utils::now())
+  , m_ttl(uint32_t(options.ttl))
+{
+}
+
+AffinityTable::~AffinityTable() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto i = s_tables.find(m_name);
+  if (i != s_tables.end() && i->second.expired()) {
+    s_tables.erase(i);
+  }
+}
+
+auto AffinityTable::find(uint64_t key) -> int {
+  if (!key) key = 1;
+  auto t = now();
+  for (int i = 0; i < MAX_PROBES; i++) {
+    auto &s = m_slots[(key + i) % m_size];
+    if (s.key.load(std::memory_order_acquire) != key) continue;
+    auto v = s.value.load(std::memory_order_acquire);
+
+    // Taken over by another key between the two loads
+    if (s.key.load(std::memory_order_acquire) != key) continue;
+
+    auto target = int(v >> 32) - 1;
+    auto expiry = uint32_t(v);
+    if (target < 0 || expiry <= t) return -1;
+
+    // Only write back when less than half the ttl is left, so that
+    // busy keys do not keep bouncing the cache line between workers
+    if (expiry - t < m_ttl / 2) {
+      auto refreshed = (v & ~uint64_t(0xffffffff)) | (t + m_ttl);
+      s.value.compare_exchange_strong(v, refreshed, std::memory_order_acq_rel);
+    }
+    return target;
+  }
+  return -1;
+}
+
+void AffinityTable::bind(uint64_t key, int target) {
+  if (!key) key = 1;
+  auto t = now();
+  auto value = (uint64_t(target + 1) << 32) | (t + m_ttl);
+
+  // Retried once when losing a race for the same slot
+  for (int attempt = 0; attempt < 2; attempt++) {
+    Slot *victim = nullptr;
+    uint64_t victim_value = 0;
+    uint32_t victim_expiry = 0;
+    bool raced = false;
+    for (int i = 0; i < MAX_PROBES; i++) {
+      auto &s = m_slots[(key + i) % m_size];
+      auto v = s.value.load(std::memory_order_acquire);
+      if (v == BUSY) continue;
+      if (s.key.load(std::memory_order_acquire) == key) {
+        if (s.value.compare_exchange_strong(v, value, std::memory_order_acq_rel)) return;
+        raced = true;
+        break;
+      }
+      auto expiry = v ? uint32_t(v) : 0;
+      if (!victim || expiry < victim_expiry) {
+        victim = &s;
+        victim_value = v;
+        victim_expiry = expiry;
+      }
+    }
+    if (raced || !victim) continue;
+    if (victim->value.compare_exchange_strong(victim_value, BUSY, std::memory_order_acq_rel)) {
+      victim->key.store(key, std::memory_order_release);
+      victim->value.store(value, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+void AffinityTable::unbind(uint64_t key) {
+  if (!key) key = 1;
+  for (int i = 0; i < MAX_PROBES; i++) {
+    auto &s = m_slots[(key + i) % m_size];
+    if (s.key.load(std::memory_order_acquire) != key) continue;
+    auto v = s.value.load(std::memory_order_acquire);
+    if (v != BUSY) s.value.compare_exchange_strong(v, 0, std::memory_order_acq_rel);
+  }
+}
+
+auto AffinityTable::intern(const std::string &target) -> int {
+  std::lock_guard<std::mutex> lock(m_targets_mutex);
+  auto i = m_target_map.find(target);
+  if (i != m_target_map.end()) return i->second;
+  if (m_targets.size() >= MAX_TARGETS) return -1;
+  int index = m_targets.size();
+  m_targets.push_back(target);
+  m_target_map[target] = index;
+  return index;
+}
+
+auto AffinityTable::target(int index) -> std::string {
+  std::lock_guard<std::mutex> lock(m_targets_mutex);
+  if (index < 0 || index >= int(m_targets.size())) return std::string();
+  return m_targets[index];
+}
+
+auto AffinityTable::now() const -> uint32_t {
+  return uint32_t((utils::now() - m_epoch) / 1000) + 1;
+}
+
+} // namespace pipy
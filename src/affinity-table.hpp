@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AFFINITY_TABLE_HPP
+#define AFFINITY_TABLE_HPP
+
+#include "options.hpp"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pipy {
+
+//
+// AffinityTable
+//
+// Remembers which target a session key (a cookie, a client address or
+// a header hash) was sent to, so that every worker sends it to the same
+// target again until it has not been seen for ttl. Workers asking for
+// the same name share one table.
+//
+// The table is a fixed array of slots allocated up front, 16 bytes each,
+// holding a key hash and a target index with an expiry time packed into
+// two atomic words. Lookups and updates are plain loads and CAS on those
+// words, so there are no locks and nothing to reclaim: an expired slot is
+// simply taken over by the next key that probes it. When all slots a key
+// can probe are live, the one expiring first is evicted.
+//
+
+class AffinityTable {
+public:
+  struct Options : public pipy::Options {
+    double ttl = 600;
+    int size = 64 * 1024;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  static auto get(const std::string &name, const Options &options) -> std::shared_ptr<AffinityTable>;
+
+  ~AffinityTable();
+
+  auto name() const -> const std::string& { return m_name; }
+  auto options() const -> const Options& { return m_options; }
+
+  // Target index bound to a key, or -1
+  auto find(uint64_t key) -> int;
+
+  // Binds a key to a target index and restarts its ttl
+  void bind(uint64_t key, int target);
+
+  void unbind(uint64_t key);
+
+  // Index of a target name, or -1 when too many names are known
+  auto intern(const std::string &target) -> int;
+  auto target(int index) -> std::string;
+
+private:
+  static const int MAX_PROBES = 8;
+  static const int MAX_TARGETS = 0xffff;
+
+  //
+  // Slot values pack (target + 1) in the upper 32 bits and the expiry
+  // time in seconds since the table was created in the lower 32 bits.
+  // Zero is an empty slot and BUSY marks one being taken over.
+  //
+
+  static const uint64_t BUSY = 1;
+
+  struct Slot {
+    std::atomic<uint64_t> key{0};
+    std::atomic<uint64_t> value{0};
+  };
+
+  AffinityTable(const std::string &name, const Options &options);
+
+  std::string m_name;
+  Options m_options;
+  size_t m_size;
+  std::unique_ptr<Slot[]> m_slots;
+  double m_epoch;
+  uint32_t m_ttl;
+  std::mutex m_targets_mutex;
+  std::vector<std::string> m_targets;
+  std::map<std::string, int> m_target_map;
+
+  auto now() const -> uint32_t;
+
+  static std::mutex s_mutex;
+  static std::map<std::string, std::weak_ptr<AffinityTable>> s_tables;
+};
+
+} // namespace pipy
+
+#endif // AFFINITY_TABLE_HPP
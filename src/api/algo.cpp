@@ -24,12 +24,21 @@
  */
 
 #include "algo.hpp"
+#include "api/pipeline-api.hpp"
+#include "api/stats.hpp"
 #include "context.hpp"
+#include "input.hpp"
+#include "message.hpp"
+#include "pipeline.hpp"
 #include "utils.hpp"
 #include "log.hpp"
+#include "worker-thread.hpp"
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <limits>
+#include <random>
 
 namespace pipy {
 namespace algo {
@@ -55,6 +64,246 @@ Cache::Options::Options(pjs::Object *options) {
   Value(options, "ttl")
     .get_seconds(ttl)
     .check_nullable();
+  Value(options, "policy")
+    .get_enum(policy)
+    .check_nullable();
+  Value(options, "onEvict")
+    .get(on_evict)
+    .check_nullable();
+}
+
+//
+// Cache::TinyLFU
+//
+// W-TinyLFU keeps new entries in a small LRU window in front of a
+// segmented LRU split into probation and protected. An entry falling
+// out of the window only makes it into the main space if it has been
+// asked for more often than the entry it would push out, going by a
+// count-min sketch of recent access frequencies. A burst of one-off
+// keys, as from a crawler, then churns through the window alone and
+// leaves the frequently used entries in place.
+//
+
+class Cache::TinyLFU {
+public:
+  TinyLFU(size_t capacity);
+  ~TinyLFU() { clear(); }
+
+  bool get(const pjs::Value &k, Entry &e);
+  bool use(const pjs::Value &k, Entry &e);
+  void set(const pjs::Value &k, const Entry &e, std::vector<std::pair<pjs::Value, Entry>> &evicted);
+  bool erase(const pjs::Value &k);
+  void clear();
+  void iterate(const std::function<bool(const pjs::Value &, const Entry &)> &cb);
+
+private:
+  enum Segment {
+    WINDOW,
+    PROBATION,
+    PROTECTED,
+  };
+
+  struct Node : public pjs::Pooled<Node>, public List<Node>::Item {
+    pjs::Value k;
+    Entry e;
+    Segment segment;
+  };
+
+  size_t m_window_capacity;
+  size_t m_main_capacity;
+  size_t m_protected_capacity;
+  std::unordered_map<pjs::Value, Node*> m_nodes;
+  List<Node> m_window;
+  List<Node> m_probation;
+  List<Node> m_protected;
+  std::vector<uint8_t> m_sketch;
+  size_t m_sketch_width;
+  size_t m_sample_size;
+  size_t m_additions = 0;
+
+  auto list(Segment segment) -> List<Node>& {
+    switch (segment) {
+      case WINDOW: return m_window;
+      case PROBATION: return m_probation;
+      default: return m_protected;
+    }
+  }
+
+  void hit(Node *node);
+  void record(size_t hash);
+  auto frequency(size_t hash) -> int;
+};
+
+static auto sketch_hash(const pjs::Value &k) -> uint64_t {
+  uint64_t h = std::hash<pjs::Value>()(k);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+Cache::TinyLFU::TinyLFU(size_t capacity) {
+  m_window_capacity = std::max(size_t(1), capacity / 100);
+  m_main_capacity = capacity > m_window_capacity ? capacity - m_window_capacity : 0;
+  m_protected_capacity = m_main_capacity * 8 / 10;
+  size_t width = 16;
+  while (width < capacity) width <<= 1;
+  m_sketch_width = width;
+  m_sketch.resize(width * 4);
+  m_sample_size = capacity * 10;
+}
+
+bool Cache::TinyLFU::get(const pjs::Value &k, Entry &e) {
+  auto i = m_nodes.find(k);
+  if (i == m_nodes.end()) return false;
+  e = i->second->e;
+  return true;
+}
+
+bool Cache::TinyLFU::use(const pjs::Value &k, Entry &e) {
+  record(sketch_hash(k));
+  auto i = m_nodes.find(k);
+  if (i == m_nodes.end()) return false;
+  auto node = i->second;
+  e = node->e;
+  hit(node);
+  return true;
+}
+
+void Cache::TinyLFU::set(const pjs::Value &k, const Entry &e, std::vector<std::pair<pjs::Value, Entry>> &evicted) {
+  auto &node = m_nodes[k];
+  if (node) {
+    node->e = e;
+    return;
+  }
+
+  node = new Node;
+  node->k = k;
+  node->e = e;
+  node->segment = WINDOW;
+  m_window.push(node);
+
+  if (m_window.size() <= m_window_capacity) return;
+
+  auto candidate = m_window.head();
+  m_window.remove(candidate);
+
+  if (m_probation.size() + m_protected.size() < m_main_capacity) {
+    candidate->segment = PROBATION;
+    m_probation.push(candidate);
+    return;
+  }
+
+  auto victim = m_probation.head();
+  if (!victim) victim = m_protected.head();
+
+  auto loser = candidate;
+  if (victim && frequency(sketch_hash(candidate->k)) > frequency(sketch_hash(victim->k))) {
+    list(victim->segment).remove(victim);
+    candidate->segment = PROBATION;
+    m_probation.push(candidate);
+    loser = victim;
+  }
+
+  evicted.emplace_back(loser->k, loser->e);
+  m_nodes.erase(loser->k);
+  delete loser;
+}
+
+bool Cache::TinyLFU::erase(const pjs::Value &k) {
+  auto i = m_nodes.find(k);
+  if (i == m_nodes.end()) return false;
+  auto node = i->second;
+  list(node->segment).remove(node);
+  m_nodes.erase(i);
+  delete node;
+  return true;
+}
+
+void Cache::TinyLFU::clear() {
+  for (const auto &i : m_nodes) delete i.second;
+  m_nodes.clear();
+  m_window.clear();
+  m_probation.clear();
+  m_protected.clear();
+}
+
+void Cache::TinyLFU::iterate(const std::function<bool(const pjs::Value &, const Entry &)> &cb) {
+  for (auto *l : { &m_window, &m_probation, &m_protected }) {
+    for (auto n = l->head(); n; n = n->next()) {
+      if (!cb(n->k, n->e)) return;
+    }
+  }
+}
+
+void Cache::TinyLFU::hit(Node *node) {
+  switch (node->segment) {
+    case WINDOW:
+      if (node != m_window.tail()) {
+        m_window.remove(node);
+        m_window.push(node);
+      }
+      break;
+    case PROBATION:
+      m_probation.remove(node);
+      node->segment = PROTECTED;
+      m_protected.push(node);
+      if (m_protected.size() > m_protected_capacity) {
+        auto demoted = m_protected.head();
+        m_protected.remove(demoted);
+        demoted->segment = PROBATION;
+        m_probation.push(demoted);
+      }
+      break;
+    case PROTECTED:
+      if (node != m_protected.tail()) {
+        m_protected.remove(node);
+        m_protected.push(node);
+      }
+      break;
+  }
+}
+
+//
+// The sketch has 4 rows of saturating 4-bit counters. Only the smallest
+// of a key's counters are bumped, which keeps overestimates down, and
+// all counters are halved every 10 times the capacity in additions so
+// that old popularity fades away.
+//
+
+void Cache::TinyLFU::record(size_t hash) {
+  auto mask = m_sketch_width - 1;
+  auto h1 = hash;
+  auto h2 = (hash >> 32) | 1;
+  uint8_t *counters[4];
+  uint8_t min = 15;
+  for (int i = 0; i < 4; i++) {
+    auto c = &m_sketch[i * m_sketch_width + ((h1 + i * h2) & mask)];
+    counters[i] = c;
+    if (*c < min) min = *c;
+  }
+  if (min >= 15) return;
+  for (int i = 0; i < 4; i++) {
+    if (*counters[i] == min) (*counters[i])++;
+  }
+  if (++m_additions >= m_sample_size) {
+    for (auto &c : m_sketch) c >>= 1;
+    m_additions /= 2;
+  }
+}
+
+auto Cache::TinyLFU::frequency(size_t hash) -> int {
+  auto mask = m_sketch_width - 1;
+  auto h1 = hash;
+  auto h2 = (hash >> 32) | 1;
+  int min = 15;
+  for (int i = 0; i < 4; i++) {
+    int c = m_sketch[i * m_sketch_width + ((h1 + i * h2) & mask)];
+    if (c < min) min = c;
+  }
+  return min;
 }
 
 //
@@ -68,6 +317,9 @@ Cache::Cache(const Options &options, pjs::Function *allocate, pjs::Function *fre
   , m_cache(pjs::OrderedHash<pjs::Value, Entry>::make())
 {
   m_options.ttl *= 1000;
+  if (m_options.policy == Policy::TINYLFU && m_options.size > 0) {
+    m_lfu.reset(new TinyLFU(m_options.size));
+  }
 }
 
 Cache::~Cache()
@@ -82,26 +334,17 @@ bool Cache::get(pjs::Context &ctx, const pjs::Value &key, pjs::Value &value) {
       pjs::Value arg(key);
       (*m_allocate)(ctx, 1, &arg, value);
       return ctx.ok();
-    }
+    },
+    evict_function(ctx)
   );
 }
 
 void Cache::set(pjs::Context &ctx, const pjs::Value &key, const pjs::Value &value) {
-  set(
-    key, value,
-    [&](const pjs::Value &key, const pjs::Value &value) {
-      if (!m_free) return true;
-      pjs::Value argv[2], ret;
-      argv[0] = key;
-      argv[1] = value;
-      (*m_free)(ctx, 2, argv, ret);
-      return ctx.ok();
-    }
-  );
+  set(key, value, evict_function(ctx));
 }
 
 bool Cache::get(const pjs::Value &key, pjs::Value &value) {
-  return get(key, value, nullptr);
+  return get(key, value, nullptr, nullptr);
 }
 
 void Cache::set(const pjs::Value &key, const pjs::Value &value) {
@@ -115,81 +358,109 @@ bool Cache::has(const pjs::Value &key) {
 
 bool Cache::find(const pjs::Value &key, pjs::Value &value) {
   Entry entry;
-  bool found = m_cache->use(key, entry);
-  if (!found) return false;
+  bool found = lookup(key, entry);
+  if (!found) {
+    m_misses++;
+    return false;
+  }
   if (m_options.ttl > 0) {
-    auto now = utils::now();
+    auto now = utils::now_coarse();
     if (now >= entry.ttl) {
-      m_cache->erase(key);
+      erase(key);
+      m_evictions++;
+      m_misses++;
       return false;
     }
   }
+  m_hits++;
   value = entry.value;
   return true;
 }
 
 bool Cache::remove(const pjs::Value &key) {
-  return m_cache->erase(key);
+  return erase(key);
 }
 
 bool Cache::remove(pjs::Context &ctx, const pjs::Value &key) {
   if (m_free) {
     Entry entry;
-    auto found = m_cache->get(key, entry);
+    auto found = peek(key, entry);
     if (found) {
       if (m_options.ttl > 0) {
-        auto now = utils::now();
+        auto now = utils::now_coarse();
         if (now >= entry.ttl) found = false;
       }
       pjs::Value argv[2], ret;
       argv[0] = key;
       argv[1] = entry.value;
       (*m_free)(ctx, 2, argv, ret);
-      m_cache->erase(key);
+      erase(key);
     }
     return found;
   } else {
-    return m_cache->erase(key);
+    return erase(key);
   }
 }
 
 bool Cache::clear(pjs::Context &ctx) {
   if (m_free) {
-    pjs::OrderedHash<pjs::Value, Entry>::Iterator it(m_cache);
-    while (auto *p = it.next()) {
+    auto free = [&](const pjs::Value &key, const pjs::Value &value) {
       pjs::Value argv[2], ret;
-      argv[0] = p->k;
-      argv[1] = p->v.value;
+      argv[0] = key;
+      argv[1] = value;
       (*m_free)(ctx, 2, argv, ret);
+      return ctx.ok();
+    };
+    if (m_lfu) {
+      m_lfu->iterate(
+        [&](const pjs::Value &k, const Entry &e) {
+          return free(k, e.value);
+        }
+      );
       if (!ctx.ok()) return false;
+    } else {
+      pjs::OrderedHash<pjs::Value, Entry>::Iterator it(m_cache);
+      while (auto *p = it.next()) {
+        if (!free(p->k, p->v.value)) return false;
+      }
     }
   }
-  m_cache->clear();
+  if (m_lfu) m_lfu->clear(); else m_cache->clear();
   return true;
 }
 
 bool Cache::get(
   const pjs::Value &key, pjs::Value &value,
-  const std::function<bool(pjs::Value &)> &allocate
+  const std::function<bool(pjs::Value &)> &allocate,
+  const Evict &evict
 ) {
-  auto now = (m_options.ttl > 0 ? utils::now() : 0);
+  auto now = (m_options.ttl > 0 ? utils::now_coarse() : 0);
   Entry entry;
-  bool found = m_cache->use(key, entry);
+  bool found = lookup(key, entry);
   if (found) {
     if (m_options.ttl > 0) {
       if (now >= entry.ttl) {
         found = false;
+        erase(key);
+        m_evictions++;
+        if (evict && !evict(key, entry.value, true)) return false;
       }
     }
   }
   if (!found) {
+    m_misses++;
     if (!allocate) return false;
     if (!allocate(value)) return false;
     entry.value = value;
     entry.ttl = now + m_options.ttl;
-    m_cache->set(key, entry);
+    if (m_lfu) {
+      insert(key, entry, evict);
+    } else {
+      m_cache->set(key, entry);
+    }
     return true;
   } else {
+    m_hits++;
     value = entry.value;
     return true;
   }
@@ -197,27 +468,30 @@ bool Cache::get(
 
 void Cache::set(
   const pjs::Value &key, const pjs::Value &value,
-  const std::function<bool(const pjs::Value &, const pjs::Value &)> &free
+  const Evict &evict
 ) {
-  auto now = (m_options.ttl > 0 ? utils::now() : 0);
+  auto now = (m_options.ttl > 0 ? utils::now_coarse() : 0);
   Entry entry;
   entry.value = value;
   entry.ttl = now + m_options.ttl;
-  if (m_cache->set(key, entry)) {
+  if (m_lfu) {
+    insert(key, entry, evict);
+  } else if (m_cache->set(key, entry)) {
     if (m_options.size > 0 && m_cache->size() > m_options.size) {
       int n = m_cache->size() - m_options.size;
       pjs::OrderedHash<pjs::Value, Entry>::Iterator it(m_cache);
-      if (free) {
-        pjs::Value argv[2], ret;
+      if (evict) {
         while (auto *p = it.next()) {
-          if (!free(p->k, p->v.value)) break;
+          if (!evict(p->k, p->v.value, false)) break;
           m_cache->erase(p->k);
+          m_evictions++;
           if (!--n) break;
         }
       }
       if (n > 0) {
         while (auto *p = it.next()) {
           m_cache->erase(p->k);
+          m_evictions++;
           if (!--n) break;
         }
       }
@@ -225,6 +499,46 @@ void Cache::set(
   }
 }
 
+bool Cache::lookup(const pjs::Value &key, Entry &entry) {
+  return m_lfu ? m_lfu->use(key, entry) : m_cache->use(key, entry);
+}
+
+bool Cache::peek(const pjs::Value &key, Entry &entry) {
+  return m_lfu ? m_lfu->get(key, entry) : m_cache->get(key, entry);
+}
+
+bool Cache::erase(const pjs::Value &key) {
+  return m_lfu ? m_lfu->erase(key) : m_cache->erase(key);
+}
+
+void Cache::insert(const pjs::Value &key, const Entry &entry, const Evict &evict) {
+  std::vector<std::pair<pjs::Value, Entry>> evicted;
+  m_lfu->set(key, entry, evicted);
+  bool ok = true;
+  for (const auto &p : evicted) {
+    m_evictions++;
+    if (ok && evict) ok = evict(p.first, p.second.value, false);
+  }
+}
+
+auto Cache::evict_function(pjs::Context &ctx) -> Evict {
+  if (!m_free && !m_options.on_evict) return nullptr;
+  return [this, &ctx](const pjs::Value &key, const pjs::Value &value, bool expired) {
+    pjs::Value argv[2], ret;
+    argv[0] = key;
+    argv[1] = value;
+    if (m_free && !expired) {
+      (*m_free)(ctx, 2, argv, ret);
+      if (!ctx.ok()) return false;
+    }
+    if (m_options.on_evict) {
+      (*m_options.on_evict)(ctx, 2, argv, ret);
+      if (!ctx.ok()) return false;
+    }
+    return true;
+  };
+}
+
 //
 // Quota
 //
@@ -242,6 +556,24 @@ Quota::Options::Options(pjs::Object *options) {
   Value(options, "produce")
     .get(produce)
     .check_nullable();
+  Value(options, "distributed")
+    .get(distributed)
+    .check_nullable();
+  Value(options, "cluster")
+    .get(cluster)
+    .check_nullable();
+  Value(options, "accuracy")
+    .get(accuracy)
+    .check_nullable();
+  Value(options, "quantum")
+    .get_binary_size(quantum)
+    .check_nullable();
+  if (accuracy < 0 || accuracy > 1) {
+    throw std::runtime_error("options.accuracy expects a number between 0 and 1");
+  }
+  if (cluster && !key) {
+    throw std::runtime_error("options.cluster requires options.key");
+  }
 }
 
 Quota::Quota(double initial_value, const Options &options)
@@ -256,7 +588,9 @@ Quota::Quota(double initial_value, const Options &options)
       initial_value,
       options.max,
       options.produce,
-      options.per
+      options.per,
+      options.distributed ? options.accuracy : 0,
+      options.cluster
     );
   }
 }
@@ -295,11 +629,18 @@ void Quota::produce_async(double value) {
 }
 
 auto Quota::consume(double value) -> double {
-  if (m_counter) return m_counter->consume(value);
-  if (value <= 0) return 0;
-  if (value > m_current_value) value = m_current_value;
-  m_current_value -= value;
-  schedule_producing();
+  if (auto c = m_granted) {
+    if (value > c->m_deficit) value = c->m_deficit;
+  }
+  if (m_counter) {
+    value = m_counter->consume(value);
+  } else {
+    if (value <= 0) return 0;
+    if (value > m_current_value) value = m_current_value;
+    m_current_value -= value;
+    schedule_producing();
+  }
+  if (auto c = m_granted) c->m_deficit -= value;
   return value;
 }
 
@@ -321,7 +662,36 @@ void Quota::schedule_producing() {
   m_is_producing_scheduled = true;
 }
 
+//
+// With a quantum, waiting consumers are served by deficit round robin:
+// each turn a consumer is granted one more quantum on top of what it
+// left unused, can consume no more than that, and goes to the back of
+// the queue if it still has more to consume. A consumer that stops
+// short of its grant has run out of quota, which ends the round.
+//
+
 void Quota::on_produce() {
+  if (m_options.quantum > 0) {
+    retain();
+    while (auto c = m_consumers.head()) {
+      m_consumers.remove(c);
+      c->m_quota = nullptr;
+      c->m_deficit += m_options.quantum;
+      m_granted = c;
+      auto done = c->on_consume(this);
+      m_granted = nullptr;
+      if (done) {
+        c->m_deficit = 0;
+      } else {
+        c->m_quota = this;
+        m_consumers.push(c);
+        if (c->m_deficit >= 1) break;
+      }
+    }
+    release();
+    return;
+  }
+
   retain();
   while (auto c = m_consumers.head()) {
     m_consumers.remove(c);
@@ -357,6 +727,7 @@ void Quota::dequeue(Consumer *consumer) {
   if (consumer->m_quota == this) {
     m_consumers.remove(consumer);
     consumer->m_quota = nullptr;
+    consumer->m_deficit = 0;
     if (m_counter && m_consumers.empty()) m_counter->dequeue(this);
   }
 }
@@ -373,7 +744,9 @@ Quota::Counter::Counter(
   double initial_value,
   double maximum_value,
   double produce_value,
-  double produce_cycle
+  double produce_cycle,
+  double accuracy,
+  bool clustered
 )
   : m_net(Net::current())
   , m_key(key)
@@ -382,7 +755,11 @@ Quota::Counter::Counter(
   , m_produce_value(produce_value)
   , m_produce_cycle(produce_cycle)
   , m_current_value(initial_value)
+  , m_accuracy(accuracy)
+  , m_clustered(clustered)
+  , m_consumed(0)
   , m_is_producing_scheduled(false)
+  , m_slices(std::max(1, WorkerManager::get().concurrency()))
 {
   m_counter_map[key] = this;
 }
@@ -397,31 +774,37 @@ auto Quota::Counter::get(
   double initial_value,
   double maximum_value,
   double produce_value,
-  double produce_cycle
+  double produce_cycle,
+  double accuracy,
+  bool clustered
 ) -> Counter* {
   std::lock_guard<std::mutex> lk(m_counter_map_mutex);
   auto i = m_counter_map.find(key);
   if (i != m_counter_map.end()) {
     auto p = i->second;
     if (p->ref_count() > 0) {
-      p->init(initial_value, maximum_value, produce_value, produce_cycle);
+      p->init(initial_value, maximum_value, produce_value, produce_cycle, accuracy, clustered);
       return p;
     }
   }
-  return new Counter(key, initial_value, maximum_value, produce_value, produce_cycle);
+  return new Counter(key, initial_value, maximum_value, produce_value, produce_cycle, accuracy, clustered);
 }
 
 void Quota::Counter::init(
   double initial_value,
   double maximum_value,
   double produce_value,
-  double produce_cycle
+  double produce_cycle,
+  double accuracy,
+  bool clustered
 ) {
   auto old_initial_value = m_initial_value.load();
   m_initial_value = initial_value;
   m_maximum_value = maximum_value;
   m_produce_value = produce_value;
   m_produce_cycle = produce_cycle;
+  m_accuracy = accuracy;
+  m_clustered = clustered;
   auto old = m_current_value.load();
   for (;;) {
     auto val = old;
@@ -446,14 +829,61 @@ void Quota::Counter::produce(double value) {
   on_produce();
 }
 
+auto Quota::Counter::current() const -> double {
+  auto n = m_current_value.load();
+  for (const auto &s : m_slices) n += s.tokens.load(std::memory_order_relaxed);
+  return n;
+}
+
+//
+// In distributed mode a thread consumes from its own slice and only
+// goes to the shared bucket to borrow another batch when the slice
+// runs dry. A batch is the accuracy share of the initial value split
+// across worker threads, so no more than accuracy * initial tokens
+// can be parked in slices when the bucket is refilled.
+//
+
 auto Quota::Counter::consume(double value) -> double {
   if (value <= 0) return 0;
+  if (auto slice = local_slice()) {
+    auto tokens = slice->tokens.load(std::memory_order_relaxed);
+    if (tokens < value) {
+      auto batch = std::ceil(m_accuracy * m_initial_value / m_slices.size());
+      tokens += take(std::max(value - tokens, batch));
+    }
+    auto dec = std::min(value, tokens);
+    slice->tokens.store(tokens - dec, std::memory_order_relaxed);
+    return dec;
+  }
+  return take(value);
+}
+
+auto Quota::Counter::local_slice() -> Slice* {
+  if (m_accuracy.load(std::memory_order_relaxed) <= 0) return nullptr;
+  auto wt = WorkerThread::current();
+  if (!wt) return nullptr;
+  auto i = wt->index();
+  if (i < 0 || i >= int(m_slices.size())) return nullptr;
+  return &m_slices[i];
+}
+
+//
+// What is taken for local consumers counts towards this instance's
+// G-counter entry in cluster mode. What peers have consumed is taken
+// as remote and does not.
+//
+
+auto Quota::Counter::take(double value, bool remote) -> double {
   auto old = m_current_value.load();
   auto dec = value;
   for (;;) {
     dec = std::min(value, old);
     if (m_current_value.compare_exchange_weak(old, old - dec)) break;
   }
+  if (!remote && dec > 0 && m_clustered.load(std::memory_order_relaxed)) {
+    auto n = m_consumed.load(std::memory_order_relaxed);
+    while (!m_consumed.compare_exchange_weak(n, n + dec, std::memory_order_relaxed));
+  }
   schedule_producing();
   return dec;
 }
@@ -507,6 +937,258 @@ void Quota::Counter::finalize() {
   });
 }
 
+//
+// Quota::Cluster
+//
+// Datagram layout, integers in network byte order:
+//
+//   magic    u32  'PQGC'
+//   node     u64  random ID of the sending instance, new on each start
+//   count    u16  number of entries
+//   entries       u16 key length, key bytes, u64 total (IEEE 754 bits)
+//
+
+static const uint32_t QUOTA_CLUSTER_MAGIC = 0x50514743;
+
+Quota::Cluster* Quota::Cluster::s_cluster = nullptr;
+
+Quota::Cluster::Options::Options(pjs::Object *options) {
+  Value(options, "listen")
+    .get(listen)
+    .check();
+  pjs::Ref<pjs::Array> peers;
+  Value(options, "peers")
+    .get(peers)
+    .check_nullable();
+  Value(options, "interval")
+    .get_seconds(interval)
+    .check_nullable();
+  if (peers) {
+    peers->iterate_all([this](pjs::Value &v, int) {
+      auto s = v.to_string();
+      this->peers.push_back(s->str());
+      s->release();
+    });
+  }
+  if (interval <= 0) {
+    throw std::runtime_error("options.interval expects a positive number");
+  }
+}
+
+Quota::Cluster::Cluster()
+  : m_socket(Net::context())
+{
+  std::random_device rd;
+  m_node_id = (uint64_t(rd()) << 32) | rd();
+}
+
+auto Quota::Cluster::get() -> Cluster* {
+  if (!s_cluster) s_cluster = new Cluster;
+  return s_cluster;
+}
+
+//
+// Every worker calls join() when its script loads, so the configuration
+// is applied on the main thread and only when it has changed.
+//
+
+void Quota::Cluster::join(const Options &options) {
+  std::string ip;
+  int port;
+  if (!utils::get_host_port(options.listen, ip, port)) {
+    throw std::runtime_error("invalid listen address: " + options.listen);
+  }
+  for (const auto &p : options.peers) {
+    if (!utils::get_host_port(p, ip, port)) {
+      throw std::runtime_error("invalid peer address: " + p);
+    }
+  }
+  Net::main().post(
+    [=]() {
+      get()->configure(options);
+    }
+  );
+}
+
+void Quota::Cluster::configure(const Options &options) {
+  if (options.listen == m_listen && options.peers == m_peer_names && options.interval == m_interval) return;
+
+  std::error_code ec;
+  if (options.listen != m_listen) {
+    std::string ip;
+    int port;
+    utils::get_host_port(options.listen, ip, port);
+    asio::ip::udp::endpoint ep(asio::ip::make_address(ip.empty() ? "0.0.0.0" : ip, ec), port);
+    if (ec) {
+      Log::error("[quota] invalid listen address %s", options.listen.c_str());
+      return;
+    }
+    if (m_socket.is_open()) m_socket.close(ec);
+    m_socket.open(ep.protocol(), ec);
+    if (!ec) m_socket.bind(ep, ec);
+    if (ec) {
+      Log::error("[quota] cannot listen on %s: %s", options.listen.c_str(), ec.message().c_str());
+      m_socket.close(ec);
+      m_listen.clear();
+      return;
+    }
+    m_listen = options.listen;
+    receive();
+    Log::info("[quota] cluster listening on %s", m_listen.c_str());
+  }
+
+  m_peer_names = options.peers;
+  m_peers.clear();
+  asio::ip::udp::resolver resolver(Net::context());
+  for (const auto &p : m_peer_names) {
+    std::string host;
+    int port;
+    utils::get_host_port(p, host, port);
+    auto results = resolver.resolve(host, std::to_string(port), ec);
+    if (ec || results.empty()) {
+      Log::error("[quota] cannot resolve peer %s", p.c_str());
+      continue;
+    }
+    m_peers.push_back(*results.begin());
+  }
+
+  m_interval = options.interval;
+  m_timer.cancel();
+  gossip();
+}
+
+void Quota::Cluster::receive() {
+  m_socket.async_receive_from(
+    asio::buffer(m_buffer), m_from,
+    [this](const std::error_code &ec, std::size_t n) {
+      if (ec == asio::error::operation_aborted) return;
+      if (!ec) on_receive(n);
+      if (m_socket.is_open()) receive();
+    }
+  );
+}
+
+void Quota::Cluster::on_receive(size_t size) {
+  auto p = m_buffer, end = m_buffer + size;
+  auto read = [&](int n) -> uint64_t {
+    uint64_t v = 0;
+    while (n-- > 0) v = (v << 8) | *p++;
+    return v;
+  };
+
+  if (size < 14 || read(4) != QUOTA_CLUSTER_MAGIC) return;
+  auto node_id = read(8);
+  if (node_id == m_node_id) return;
+  auto count = read(2);
+
+  auto &peer = m_remote[node_id];
+  auto is_new_peer = (peer.last_seen == 0);
+  peer.last_seen = utils::now();
+
+  std::lock_guard<std::mutex> lock(Counter::m_counter_map_mutex);
+  for (uint64_t i = 0; i < count; i++) {
+    if (end - p < 2) return;
+    auto len = read(2);
+    if (end - p < int(len + 8)) return;
+    std::string key((const char *)p, len); p += len;
+    auto bits = read(8);
+    double total;
+    std::memcpy(&total, &bits, sizeof(total));
+
+    // Max-merge, where the first round from a peer is only a baseline
+    auto &old = peer.totals[key];
+    if (total <= old) continue;
+    auto delta = total - old;
+    old = total;
+    if (is_new_peer) continue;
+    auto c = Counter::m_counter_map.find(key);
+    if (c != Counter::m_counter_map.end()) {
+      auto counter = c->second;
+      if (counter->ref_count() > 0 && counter->m_clustered.load(std::memory_order_relaxed)) {
+        counter->take(delta, true);
+      }
+    }
+  }
+}
+
+void Quota::Cluster::gossip() {
+  auto full = (m_round++ % FULL_ROUND_INTERVALS == 0);
+  auto now = utils::now();
+
+  for (auto i = m_remote.begin(); i != m_remote.end(); ) {
+    if (now - i->second.last_seen > PEER_TIMEOUT_INTERVALS * m_interval * 1000) {
+      i = m_remote.erase(i);
+    } else {
+      i++;
+    }
+  }
+
+  std::vector<std::pair<std::string, double>> entries;
+  if (full) m_sent.clear();
+  {
+    std::lock_guard<std::mutex> lock(Counter::m_counter_map_mutex);
+    for (const auto &p : Counter::m_counter_map) {
+      auto counter = p.second;
+      if (counter->ref_count() <= 0) continue;
+      if (!counter->m_clustered.load(std::memory_order_relaxed)) continue;
+      auto total = counter->m_consumed.load(std::memory_order_relaxed);
+      if (total <= 0) continue;
+      auto &sent = m_sent[p.first];
+      if (!full && total == sent) continue;
+      sent = total;
+      entries.emplace_back(p.first, total);
+    }
+  }
+
+  // Send at least one datagram each round, so that peers see us before any counts
+  if (!m_peers.empty() && m_socket.is_open()) {
+    auto send = [this](std::shared_ptr<std::vector<uint8_t>> buf) {
+      for (const auto &ep : m_peers) {
+        m_socket.async_send_to(
+          asio::buffer(*buf), ep,
+          [buf](const std::error_code &, std::size_t) {}
+        );
+      }
+    };
+
+    std::shared_ptr<std::vector<uint8_t>> buf;
+    size_t count_pos = 0;
+    int count = 0;
+    auto write = [&](uint64_t v, int n) {
+      while (n-- > 0) buf->push_back(v >> (n * 8));
+    };
+    auto start = [&]() {
+      buf = std::make_shared<std::vector<uint8_t>>();
+      write(QUOTA_CLUSTER_MAGIC, 4);
+      write(m_node_id, 8);
+      count_pos = buf->size();
+      write(0, 2);
+      count = 0;
+    };
+    start();
+    for (const auto &e : entries) {
+      auto len = std::min(e.first.length(), size_t(0xffff));
+      if (count > 0 && buf->size() + 2 + len + 8 > MAX_DATAGRAM_SIZE) {
+        (*buf)[count_pos] = count >> 8;
+        (*buf)[count_pos + 1] = count;
+        send(buf);
+        start();
+      }
+      uint64_t bits;
+      std::memcpy(&bits, &e.second, sizeof(bits));
+      write(len, 2);
+      buf->insert(buf->end(), e.first.c_str(), e.first.c_str() + len);
+      write(bits, 8);
+      count++;
+    }
+    (*buf)[count_pos] = count >> 8;
+    (*buf)[count_pos + 1] = count;
+    send(buf);
+  }
+
+  m_timer.schedule(m_interval, [this]() { gossip(); });
+}
+
 //
 // SharedMap
 //
@@ -533,18 +1215,11 @@ bool SharedMap::has(pjs::Str *key) {
 }
 
 bool SharedMap::get(pjs::Str *key, pjs::Value &value) {
-  pjs::SharedValue sv;
-  if (m_map->get(key->data(), sv)) {
-    sv.to_value(value);
-    return true;
-  } else {
-    return false;
-  }
+  return m_map->get(key->data(), value);
 }
 
 void SharedMap::set(pjs::Str *key, const pjs::Value &value) {
-  pjs::SharedValue sv(value);
-  m_map->set(key->data(), sv);
+  m_map->set(key->data(), value);
 }
 
 auto SharedMap::add(pjs::Str *key, double value) -> double {
@@ -552,7 +1227,7 @@ auto SharedMap::add(pjs::Str *key, double value) -> double {
 }
 
 auto SharedMap::sub(pjs::Str *key, double value) -> double {
-  return m_map->sub(key->data(), value);
+  return m_map->add(key->data(), -value);
 }
 
 //
@@ -572,78 +1247,159 @@ auto SharedMap::Map::get(const std::string &name) -> Map* {
   return p;
 }
 
+auto SharedMap::Map::key_of(pjs::Str::CharData *data) -> Key {
+  Key k;
+  k.data = data;
+  k.hash = data->hash();
+  return k;
+}
+
 auto SharedMap::Map::size() -> size_t {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  return m_map.size();
+  size_t n = 0;
+  for (auto &s : m_shards) {
+    s.lock.lock_shared();
+    n += s.map.size();
+    s.lock.unlock_shared();
+  }
+  return n;
 }
 
 void SharedMap::Map::clear() {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  m_map.clear();
+  for (auto &s : m_shards) {
+    std::lock_guard<Lock> lock(s.lock);
+    s.map.clear();
+  }
 }
 
 bool SharedMap::Map::erase(pjs::Str::CharData *key) {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  auto i = m_map.find(key);
-  if (i == m_map.end()) return false;
-  m_map.erase(i);
-  return true;
+  auto k = key_of(key);
+  auto &s = shard_of(k);
+  std::lock_guard<Lock> lock(s.lock);
+  return s.map.erase(k) > 0;
 }
 
 bool SharedMap::Map::has(pjs::Str::CharData *key) {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  auto i = m_map.find(key);
-  return i != m_map.end();
+  auto k = key_of(key);
+  auto &s = shard_of(k);
+  s.lock.lock_shared();
+  auto found = (s.map.find(k) != s.map.end());
+  s.lock.unlock_shared();
+  return found;
 }
 
-bool SharedMap::Map::get(pjs::Str::CharData *key, pjs::SharedValue &value) {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  auto i = m_map.find(key);
-  if (i == m_map.end()) return false;
-  value = i->second;
+bool SharedMap::Map::get(pjs::Str::CharData *key, pjs::Value &value) {
+  auto k = key_of(key);
+  auto &s = shard_of(k);
+  pjs::SharedValue sv;
+  s.lock.lock_shared();
+  auto i = s.map.find(k);
+  if (i == s.map.end()) {
+    s.lock.unlock_shared();
+    return false;
+  }
+  auto &e = i->second;
+  if (e.is_number) {
+    value.set(e.number.load(std::memory_order_relaxed));
+    s.lock.unlock_shared();
+    return true;
+  }
+  sv = e.value;
+  s.lock.unlock_shared();
+  sv.to_value(value);
   return true;
 }
 
-void SharedMap::Map::set(pjs::Str::CharData *key, const pjs::SharedValue &value) {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  m_map[key] = value;
+void SharedMap::Map::set(pjs::Str::CharData *key, const pjs::Value &value) {
+  auto k = key_of(key);
+  auto &s = shard_of(k);
+  if (value.is_number()) {
+    std::lock_guard<Lock> lock(s.lock);
+    auto &e = s.map[k];
+    e.value = pjs::SharedValue();
+    e.number.store(value.n(), std::memory_order_relaxed);
+    e.is_number = true;
+  } else {
+    pjs::SharedValue sv(value);
+    std::lock_guard<Lock> lock(s.lock);
+    auto &e = s.map[k];
+    e.value = sv;
+    e.is_number = false;
+  }
 }
 
 auto SharedMap::Map::add(pjs::Str::CharData *key, double value) -> double {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  auto i = m_map.find(key);
-  if (i == m_map.end()) return std::numeric_limits<double>::quiet_NaN();
-  pjs::Value v;
-  i->second.to_value(v);
-  if (!v.is_number()) return std::numeric_limits<double>::quiet_NaN();
-  v.set(v.n() + value);
-  i->second = v;
-  return v.n();
+  auto k = key_of(key);
+  auto &s = shard_of(k);
+  auto result = std::numeric_limits<double>::quiet_NaN();
+  s.lock.lock_shared();
+  auto i = s.map.find(k);
+  if (i != s.map.end() && i->second.is_number) {
+    auto &n = i->second.number;
+    auto old = n.load(std::memory_order_relaxed);
+    while (!n.compare_exchange_weak(old, old + value, std::memory_order_relaxed)) {}
+    result = old + value;
+  }
+  s.lock.unlock_shared();
+  return result;
 }
 
-auto SharedMap::Map::sub(pjs::Str::CharData *key, double value) -> double {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  auto i = m_map.find(key);
-  if (i == m_map.end()) return std::numeric_limits<double>::quiet_NaN();
-  pjs::Value v;
-  i->second.to_value(v);
-  if (!v.is_number()) return std::numeric_limits<double>::quiet_NaN();
-  v.set(v.n() - value);
-  i->second = v;
-  return v.n();
+//
+// SharedMap::Map::Lock
+//
+
+void SharedMap::Map::Lock::lock_shared() {
+  for (;;) {
+    auto n = m_state.load(std::memory_order_relaxed);
+    if (!(n & (WRITER_WAITING | WRITER_LOCKED))) {
+      if (m_state.compare_exchange_weak(n, n + 1, std::memory_order_acquire)) return;
+    }
+    std::this_thread::yield();
+  }
+}
+
+//
+// The waiting flag is cleared by whichever writer gets the lock, so the
+// other writers still waiting set it again on their next round.
+//
+
+void SharedMap::Map::Lock::lock() {
+  for (;;) {
+    auto n = m_state.load(std::memory_order_relaxed);
+    if (!(n & ~WRITER_WAITING)) {
+      if (m_state.compare_exchange_weak(n, WRITER_LOCKED, std::memory_order_acquire)) return;
+    } else if (!(n & WRITER_WAITING)) {
+      m_state.fetch_or(WRITER_WAITING, std::memory_order_relaxed);
+    }
+    std::this_thread::yield();
+  }
 }
 
 //
 // URLRouter
 //
 
-URLRouter::URLRouter()
-  : m_root(new Node())
+auto URLRouter::Match::params() const -> pjs::Object* {
+  auto obj = pjs::Object::make();
+  for (int i = 0; i < count; i++) {
+    const auto &c = captures[i];
+    obj->ht_set(c.name, pjs::Str::make(c.str, c.len));
+  }
+  return obj;
+}
+
+URLRouter::Options::Options(pjs::Object *options) {
+  Value(options, "params")
+    .get(params)
+    .check_nullable();
+}
+
+URLRouter::URLRouter(const Options &options)
+  : m_options(options)
 {
 }
 
-URLRouter::URLRouter(pjs::Object *rules)
-  : URLRouter()
+URLRouter::URLRouter(pjs::Object *rules, const Options &options)
+  : URLRouter(options)
 {
   if (rules) {
     rules->iterate_all(
@@ -655,120 +1411,495 @@ URLRouter::URLRouter(pjs::Object *rules)
 }
 
 URLRouter::~URLRouter() {
-  delete m_root;
 }
 
 void URLRouter::add(const std::string &url, const pjs::Value &value) {
-  auto segs = utils::split(url, '/');
-  auto domain = segs.front();
-  segs.pop_front();
-
-  if (segs.empty() || domain.find_first_of(':') != std::string::npos) {
+  auto path_start = url.find_first_of('/');
+  if (path_start == std::string::npos) {
     throw std::runtime_error("invalid URL pattern");
   }
 
-  auto node = m_root;
+  auto domain = url.substr(0, path_start);
+  if (domain.find_first_of(':') != std::string::npos) {
+    throw std::runtime_error("invalid URL pattern");
+  }
+
+  Node *routes = &m_paths;
+  if (!domain.empty() && (domain != "*" || !m_options.params)) {
+    auto wildcard = (domain.length() > 2 && domain[0] == '*' && domain[1] == '.');
+    if (m_options.params && domain.find_first_of('*', wildcard ? 2 : 0) != std::string::npos) {
+      throw std::runtime_error("invalid URL pattern");
+    }
+    auto host = (wildcard
+      ? insert(&m_wildcard_hosts, domain.c_str() + 2, domain.length() - 2)
+      : insert(&m_hosts, domain.c_str(), domain.length())
+    );
+    host->has_value = true;
+    if (!host->routes) host->routes = new Node;
+    routes = host->routes;
+  }
+
+  auto node = insert_path(routes, url.substr(path_start));
+  node->value = value;
+  node->has_value = true;
+}
 
-  if (!domain.empty()) {
-    auto segs = utils::split(domain, '.');
-    for (const auto &seg : segs) {
-      node = node->new_child(seg);
+bool URLRouter::find(const std::string &url, pjs::Value &value) {
+  return find(url.c_str(), url.length(), value);
+}
+
+bool URLRouter::find(const char *url, size_t len, pjs::Value &value, Match *match) {
+  auto path_start = (const char *)std::memchr(url, '/', len);
+  if (!path_start) return false;
+
+  auto path_end = (const char *)std::memchr(path_start, '?', url + len - path_start);
+  if (!path_end) path_end = url + len;
+
+  auto domain_end = path_start;
+  for (auto p = path_start; p > url; p--) {
+    if (p[-1] == ':') {
+      domain_end = p - 1;
+      break;
     }
   }
 
-  node = node->new_child("/");
+  auto path = path_start;
+  auto path_len = path_end - path_start;
 
-  if (segs.back() == "*") {
-    for (const auto &seg : segs) {
-      if (!seg.empty()) {
-        node = node->new_child(seg);
+  Match m;
+  Node *node = nullptr;
+
+  if (domain_end > url) {
+    auto host_len = domain_end - url;
+    node = lookup_routes(lookup(&m_hosts, url, host_len), path, path_len, m);
+    if (!node) {
+      if (auto dot = (const char *)std::memchr(url, '.', host_len)) {
+        auto n = lookup(&m_wildcard_hosts, dot + 1, domain_end - dot - 1);
+        node = lookup_routes(n, path, path_len, m);
       }
     }
-    node->value = value;
-  } else {
-    auto i = url.find_first_of('/');
-    node->new_child(url.substr(i))->value = value;
   }
+
+  if (!node) {
+    m.count = 0;
+    node = lookup_path(&m_paths, path, path_len, m);
+  }
+  if (!node) return false;
+
+  value = node->value;
+  if (match) *match = m;
+  return true;
 }
 
-bool URLRouter::find(const std::string &url, pjs::Value &value) {
-  static const std::string s_slash("/");
-  static const std::string s_asterisk("*");
+auto URLRouter::insert(Node *node, const char *str, size_t len) -> Node* {
+  while (len > 0) {
+    auto i = node->indices.find(str[0]);
+    if (i == std::string::npos) {
+      auto c = new Node;
+      c->prefix.assign(str, len);
+      node->indices.push_back(str[0]);
+      node->children.push_back(c);
+      return c;
+    }
 
-  auto path_start = url.find_first_of('/');
-  if (path_start == std::string::npos) return false;
-
-  auto path_end = url.find_first_of('?', path_start);
-  if (path_end == std::string::npos) path_end = url.length();
-
-  auto domain_end = url.find_last_of(':', path_start);
-  if (domain_end == std::string::npos) domain_end = path_start;
-
-  std::function<Node*(Node*, int)> find_host, find_path;
-
-  find_host = [&](Node *node, int p) -> Node* {
-    auto i = p;
-    while (i < domain_end && url[i] != '.') i++;
-    auto s = url.substr(p, i - p);
-    node = node->child(s);
-    if (!node) return nullptr;
-    p = i + 1;
-    if (p <= domain_end) return find_host(node, p);
-    node = node->child(s_slash);
-    if (!node) return nullptr;
-    if (auto exact = node->child(url.substr(path_start, path_end - path_start))) {
-      return exact;
-    }
-    return find_path(node, path_start + 1);
+    auto c = node->children[i];
+    auto &prefix = c->prefix;
+    size_t n = 0;
+    while (n < prefix.length() && n < len && prefix[n] == str[n]) n++;
+
+    // Split the edge where the new key diverges from it
+    if (n < prefix.length()) {
+      auto m = new Node;
+      m->prefix = prefix.substr(0, n);
+      prefix.erase(0, n);
+      m->indices.push_back(prefix[0]);
+      m->children.push_back(c);
+      node->children[i] = m;
+      c = m;
+    }
+
+    node = c;
+    str += n;
+    len -= n;
+  }
+  return node;
+}
+
+auto URLRouter::insert_path(Node *node, const std::string &path) -> Node* {
+  auto is_capture = [&](size_t j) {
+    if (path[j-1] != '/') return false;
+    if (path[j] == '*') return m_options.params || j + 1 == path.length();
+    return path[j] == ':' && m_options.params;
   };
 
-  find_path = [&](Node *node, int p) -> Node* {
-    auto i = p;
-    while (i < path_end && url[i] != '/') i++;
-    auto s = url.substr(p, i - p);
-    if (auto c = node->child(s)) {
-      p = i + 1;
-      c = p >= path_end ? c->child(s_asterisk) : find_path(c, p);
-      if (c) return c;
-    }
-    if (auto c = node->child(s_asterisk)) return c;
-    return nullptr;
+  int captures = 0;
+  size_t i = 0, n = path.length();
+  while (i < n) {
+    auto j = i;
+    while (j < n && !(j > 0 && is_capture(j))) j++;
+    node = insert(node, path.c_str() + i, j - i);
+    if (j == n) break;
+
+    if (++captures > MAX_CAPTURES) {
+      throw std::runtime_error("too many captures in URL pattern");
+    }
+
+    if (path[j] == '*') {
+      if (j + 1 != n) throw std::runtime_error("wildcard must be at the end of URL pattern");
+      if (!node->wildcard) {
+        node->wildcard = new Node;
+        node->wildcard->param_name = pjs::Str::make("*");
+      }
+      return node->wildcard;
+    }
+
+    auto k = path.find_first_of('/', j);
+    if (k == std::string::npos) k = n;
+    if (k == j + 1) throw std::runtime_error("missing parameter name in URL pattern");
+    std::string name(path, j + 1, k - j - 1);
+    if (!node->param) {
+      node->param = new Node;
+      node->param_name = pjs::Str::make(name);
+    } else if (node->param_name->str() != name) {
+      throw std::runtime_error("conflicting parameter names in URL pattern");
+    }
+    node = node->param;
+    i = k;
+  }
+  return node;
+}
+
+auto URLRouter::lookup(Node *node, const char *str, size_t len) -> Node* {
+  while (len > 0) {
+    auto &indices = node->indices;
+    auto p = (const char *)std::memchr(indices.c_str(), str[0], indices.length());
+    if (!p) return nullptr;
+    auto c = node->children[p - indices.c_str()];
+    auto &prefix = c->prefix;
+    if (prefix.length() > len) return nullptr;
+    if (std::memcmp(prefix.c_str(), str, prefix.length())) return nullptr;
+    node = c;
+    str += prefix.length();
+    len -= prefix.length();
+  }
+  return node->has_value ? node : nullptr;
+}
+
+auto URLRouter::lookup_routes(Node *host, const char *str, size_t len, Match &match) -> Node* {
+  if (!host || !host->routes) return nullptr;
+  match.count = 0;
+  return lookup_path(host->routes, str, len, match);
+}
+
+//
+// Static edges are tried before a parameter, and a parameter before
+// a wildcard, backtracking when a more specific branch leads nowhere.
+// A trailing `/*` also matches the path without its last slash.
+//
+
+auto URLRouter::lookup_path(Node *node, const char *str, size_t len, Match &match) -> Node* {
+  auto capture_empty = [&](Node *n) -> Node* {
+    auto &c = match.captures[match.count++];
+    c.name = n->param_name;
+    c.str = "";
+    c.len = 0;
+    return n;
   };
 
-  auto node = find_host(m_root, 0);
-  if (!node) {
-    auto i = 0;
-    while (i < domain_end && url[i] != '.') i++;
-    if (i < domain_end) {
-      if (auto c = m_root->child(s_asterisk)) {
-        node = find_host(c, i + 1);
+  if (!len) {
+    if (node->has_value) return node;
+    if (node->wildcard && node->wildcard->has_value) return capture_empty(node->wildcard);
+  }
+
+  auto &indices = node->indices;
+  auto ch = len > 0 ? str[0] : '/';
+  if (auto p = (const char *)std::memchr(indices.c_str(), ch, indices.length())) {
+    auto c = node->children[p - indices.c_str()];
+    auto &prefix = c->prefix;
+    auto n = prefix.length();
+    if (n <= len && !std::memcmp(prefix.c_str(), str, n)) {
+      auto count = match.count;
+      if (auto r = lookup_path(c, str + n, len - n, match)) return r;
+      match.count = count;
+    } else if (n == len + 1 && prefix[len] == '/' && !std::memcmp(prefix.c_str(), str, len)) {
+      if (c->wildcard && c->wildcard->has_value) return capture_empty(c->wildcard);
+    }
+  }
+
+  if (!len) return nullptr;
+
+  if (node->param && str[0] != '/') {
+    auto end = (const char *)std::memchr(str, '/', len);
+    auto n = end ? end - str : len;
+    auto count = match.count;
+    auto &c = match.captures[match.count++];
+    c.name = node->param_name;
+    c.str = str;
+    c.len = n;
+    if (auto r = lookup_path(node->param, str + n, len - n, match)) return r;
+    match.count = count;
+  }
+
+  if (node->wildcard && node->wildcard->has_value) {
+    auto &c = match.captures[match.count++];
+    c.name = node->wildcard->param_name;
+    c.str = str;
+    c.len = len;
+    return node->wildcard;
+  }
+
+  return nullptr;
+}
+
+void URLRouter::dump(Node *node, int level) {
+  for (auto *c : node->children) {
+    std::cout << std::string(level * 2, ' ');
+    std::cout << c->prefix << std::endl;
+    dump(c, level + 1);
+  }
+  if (node->param) {
+    std::cout << std::string(level * 2, ' ');
+    std::cout << ':' << node->param_name->str() << std::endl;
+    dump(node->param, level + 1);
+  }
+  if (node->wildcard) {
+    std::cout << std::string(level * 2, ' ');
+    std::cout << '*' << std::endl;
+  }
+}
+
+//
+// RouteTable
+//
+
+RouteTable::RouteTable(pjs::Object *routes)
+  : m_table(compile(routes))
+{
+}
+
+RouteTable::~RouteTable() {
+}
+
+void RouteTable::update(pjs::Object *routes) {
+  m_table.reset(compile(routes));
+}
+
+bool RouteTable::find(pjs::Context &ctx, pjs::Object *head, Result &result) {
+  thread_local static pjs::ConstStr s_method("method");
+  thread_local static pjs::ConstStr s_path("path");
+  thread_local static pjs::ConstStr s_headers("headers");
+  thread_local static pjs::ConstStr s_host("host");
+
+  // Hold on to the table in case a predicate updates it
+  auto table = m_table;
+  if (!table || !head) return false;
+
+  pjs::Value method, path, headers, host;
+  head->get(s_path, path);
+  if (!path.is_string()) return false;
+  head->get(s_method, method);
+  head->get(s_headers, headers);
+
+  auto *hdrs = headers.is_object() ? headers.o() : nullptr;
+  if (hdrs) hdrs->get(s_host, host);
+
+  std::string url;
+  if (host.is_string()) url = host.s()->str();
+  url += path.s()->str();
+
+  for (int tier = 0; tier < 3; tier++) {
+    URLRouter::Match m;
+    pjs::Value g;
+    if (!table->routers[tier]->find(url.c_str(), url.length(), g, &m)) continue;
+    for (auto i : table->groups[int(g.n())]) {
+      auto &route = table->routes[i];
+      if (match(ctx, route, head, method.is_string() ? method.s() : nullptr, hdrs)) {
+        result.route = route.config;
+        result.upstream = pick(route);
+        result.params = m.count > 0 ? m.params() : nullptr;
+        return true;
       }
+      if (!ctx.ok()) return false;
     }
   }
-  if (!node) {
-    if (auto c = m_root->child(s_slash)) {
-      if (auto exact = c->child(url.substr(path_start, path_end - path_start))) {
-        node = exact;
+
+  return false;
+}
+
+auto RouteTable::compile(pjs::Object *routes) -> Table* {
+  thread_local static pjs::ConstStr s_upstreams("upstreams");
+
+  if (!routes || !routes->is<pjs::Array>()) {
+    throw std::runtime_error("routes must be an array");
+  }
+
+  std::unique_ptr<Table> table(new Table);
+  URLRouter::Options options;
+  options.params = true;
+  for (auto &r : table->routers) r = URLRouter::make(options);
+
+  auto *array = routes->as<pjs::Array>();
+  std::map<std::string, int> groups;
+  table->routes.resize(array->length());
+
+  array->iterate_all(
+    [&](pjs::Value &v, int i) {
+      if (!v.is_object() || !v.o()) {
+        throw std::runtime_error("route #" + std::to_string(i) + " is not an object");
+      }
+
+      auto *obj = v.o();
+      auto &route = table->routes[i];
+      std::string host, path, method;
+      pjs::Ref<pjs::Object> headers;
+      pjs::Value upstreams;
+
+      Options::Value(obj, "host", "route").get(host).check_nullable();
+      Options::Value(obj, "path", "route").get(path).check_nullable();
+      Options::Value(obj, "method", "route").get(method).check_nullable();
+      Options::Value(obj, "headers", "route").get(headers).check_nullable();
+      Options::Value(obj, "when", "route").get(route.when).check_nullable();
+      obj->get(s_upstreams, upstreams);
+
+      route.config = obj;
+
+      if (!method.empty()) {
+        std::transform(method.begin(), method.end(), method.begin(), ::toupper);
+        route.method = pjs::Str::make(method);
+      }
+
+      if (headers) {
+        headers->iterate_all(
+          [&](pjs::Str *k, pjs::Value &v) {
+            auto name = k->str();
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            Header h;
+            h.name = pjs::Str::make(name);
+            if (v.is<pjs::RegExp>()) {
+              h.pattern = v.as<pjs::RegExp>();
+            } else if (v.is_string()) {
+              h.value = v.s();
+            } else {
+              throw std::runtime_error("header matcher for '" + name + "' is not a string or a RegExp");
+            }
+            route.headers.push_back(h);
+          }
+        );
+      }
+
+      auto add_upstream = [&](pjs::Str *target, double weight) {
+        if (weight < 0) throw std::runtime_error("negative weight for upstream " + target->str());
+        if (weight > 0) {
+          Upstream u;
+          u.target = target;
+          u.weight = int(weight);
+          u.current = 0;
+          route.upstreams.push_back(u);
+          route.total_weight += u.weight;
+        }
+      };
+
+      if (upstreams.is_string()) {
+        add_upstream(upstreams.s(), 1);
+      } else if (upstreams.is_array()) {
+        upstreams.as<pjs::Array>()->iterate_all(
+          [&](pjs::Value &v, int) {
+            auto s = v.to_string();
+            add_upstream(s, 1);
+            s->release();
+          }
+        );
+      } else if (upstreams.is_object() && upstreams.o()) {
+        upstreams.o()->iterate_all(
+          [&](pjs::Str *k, pjs::Value &v) {
+            if (!v.is_number()) throw std::runtime_error("weight for upstream " + k->str() + " is not a number");
+            add_upstream(k, v.n());
+          }
+        );
+      } else if (!upstreams.is_nullish()) {
+        throw std::runtime_error("upstreams of route #" + std::to_string(i) + " is not a string, an array or an object");
+      }
+
+      if (path.empty()) path = "/*";
+      std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+
+      int tier = 2;
+      if (!host.empty() && host != "*") {
+        tier = (host[0] == '*' ? 1 : 0);
       } else {
-        node = find_path(c, path_start + 1);
+        host.clear();
       }
+
+      auto url = host + path;
+      auto key = std::to_string(tier) + url;
+      auto it = groups.find(key);
+      if (it == groups.end()) {
+        auto g = int(table->groups.size());
+        table->routers[tier]->add(url, g);
+        table->groups.emplace_back();
+        it = groups.emplace(key, g).first;
+      }
+      table->groups[it->second].push_back(i);
+    }
+  );
+
+  // URLRouter only finds the most specific pattern, so routes under a
+  // covering 'prefix*' pattern of the same tier are added to the groups
+  // it covers, keeping them all in the order they were given
+  std::vector<std::vector<int>> merged(table->groups);
+  for (const auto &a : groups) {
+    for (const auto &b : groups) {
+      const auto &p = b.first;
+      if (&a == &b || p.back() != '*') continue;
+      if (a.first.compare(0, p.length() - 1, p, 0, p.length() - 1)) continue;
+      auto &v = merged[a.second];
+      const auto &w = table->groups[b.second];
+      v.insert(v.end(), w.begin(), w.end());
     }
   }
+  for (auto &v : merged) std::sort(v.begin(), v.end());
+  table->groups.swap(merged);
 
-  if (node) {
-    value = node->value;
-    return true;
+  return table.release();
+}
+
+bool RouteTable::match(pjs::Context &ctx, Route &route, pjs::Object *head, pjs::Str *method, pjs::Object *headers) {
+  if (route.method && route.method != method) return false;
+
+  for (const auto &h : route.headers) {
+    pjs::Value v;
+    if (!headers || !headers->get(h.name, v) || !v.is_string()) return false;
+    if (h.value) {
+      if (v.s() != h.value) return false;
+    } else if (!h.pattern->test(v.s())) {
+      return false;
+    }
   }
 
-  return false;
+  if (auto f = route.when.get()) {
+    pjs::Value arg(head), ret;
+    (*f)(ctx, 1, &arg, ret);
+    if (!ctx.ok()) return false;
+    if (!ret.to_boolean()) return false;
+  }
+
+  return true;
 }
 
-void URLRouter::dump(Node *node, int level) {
-  for (auto &i : node->children) {
-    std::cout << std::string(level * 2, ' ');
-    std::cout << i.first << std::endl;
-    dump(i.second, level + 1);
+//
+// Smooth weighted round-robin, which spreads picks for a heavier
+// upstream evenly instead of in bursts
+//
+
+auto RouteTable::pick(Route &route) -> pjs::Str* {
+  Upstream *best = nullptr;
+  for (auto &u : route.upstreams) {
+    u.current += u.weight;
+    if (!best || u.current > best->current) best = &u;
   }
+  if (!best) return nullptr;
+  best->current -= route.total_weight;
+  return best->target;
 }
 
 //
@@ -1022,6 +2153,143 @@ void LoadBalancer::Resource::increase_load() {
   }
 }
 
+//
+// HealthCheck
+//
+// The per-worker face of a shared HealthChecker. Targets are watched the
+// first time they are asked about and stay watched for as long as this
+// object lives.
+//
+
+HealthCheck::HealthCheck(const HealthChecker::Options &options)
+  : m_checker(HealthChecker::get(options))
+{
+}
+
+HealthCheck::~HealthCheck() {
+  for (const auto &i : m_targets) {
+    m_checker->unwatch(i.second.target.get());
+  }
+}
+
+bool HealthCheck::is_healthy(pjs::Str *target) {
+  return get(target)->healthy();
+}
+
+void HealthCheck::report(pjs::Str *target, bool ok) {
+  get(target)->report(ok);
+}
+
+auto HealthCheck::get(pjs::Str *target) -> HealthChecker::Target* {
+  auto &e = m_targets[target];
+  if (!e.target) {
+    e.name = target;
+    e.target = m_checker->watch(target->str());
+  }
+  return e.target.get();
+}
+
+//
+// CircuitBreaker
+//
+// The per-worker face of a shared breaker, caching targets the same way
+// as HealthCheck does.
+//
+
+CircuitBreaker::CircuitBreaker(const pipy::CircuitBreaker::Options &options)
+  : m_breaker(pipy::CircuitBreaker::get(options))
+{
+}
+
+CircuitBreaker::~CircuitBreaker() {
+  for (const auto &i : m_targets) {
+    m_breaker->unwatch(i.second.target.get());
+  }
+}
+
+bool CircuitBreaker::allow(pjs::Str *target) {
+  return get(target)->allow();
+}
+
+void CircuitBreaker::select(pjs::Str *target) {
+  get(target)->select();
+}
+
+void CircuitBreaker::report(pjs::Str *target, bool ok) {
+  get(target)->report(ok);
+}
+
+auto CircuitBreaker::state(pjs::Str *target) -> pipy::CircuitBreaker::State {
+  return get(target)->state();
+}
+
+auto CircuitBreaker::get(pjs::Str *target) -> pipy::CircuitBreaker::Target* {
+  auto &e = m_targets[target];
+  if (!e.target) {
+    e.name = target;
+    e.target = m_breaker->watch(target->str());
+  }
+  return e.target.get();
+}
+
+//
+// AffinityTable
+//
+// Target names are interned into small indices by the shared table, so
+// slots stay two words wide. Each worker keeps its own mapping between
+// those indices and its interned strings, filled in on first use.
+//
+
+AffinityTable::AffinityTable(pjs::Str *name, const pipy::AffinityTable::Options &options)
+  : m_table(pipy::AffinityTable::get(name->str(), options))
+{
+}
+
+auto AffinityTable::find(const pjs::Value &key) -> pjs::Str* {
+  auto i = m_table->find(hash(key));
+  if (i < 0) return nullptr;
+  if (i >= int(m_targets.size())) m_targets.resize(i + 1);
+  auto &s = m_targets[i];
+  if (!s) {
+    s = pjs::Str::make(m_table->target(i));
+    m_target_indices[s] = i;
+  }
+  return s;
+}
+
+void AffinityTable::bind(const pjs::Value &key, pjs::Str *target) {
+  int i;
+  auto p = m_target_indices.find(target);
+  if (p != m_target_indices.end()) {
+    i = p->second;
+  } else {
+    i = m_table->intern(target->str());
+    if (i < 0) return;
+    if (i >= int(m_targets.size())) m_targets.resize(i + 1);
+    m_targets[i] = target;
+    m_target_indices[target] = i;
+  }
+  m_table->bind(hash(key), i);
+}
+
+void AffinityTable::unbind(const pjs::Value &key) {
+  m_table->unbind(hash(key));
+}
+
+//
+// Strings hash by content and numbers by value, so every worker gets the
+// same hash for the same key. Anything else is hashed as its string form.
+//
+
+auto AffinityTable::hash(const pjs::Value &key) -> uint64_t {
+  if (key.is_string()) return key.s()->hash();
+  if (key.is_number()) return std::hash<double>()(key.n());
+  auto s = key.to_string();
+  auto h = s->hash();
+  s->release();
+  return h;
+}
+
 //
 // LoadBalancerBase
 //
@@ -1044,8 +2312,9 @@ LoadBalancerBase::~LoadBalancerBase() {
 
 auto LoadBalancerBase::borrow(pjs::Object *borrower, const pjs::Value &target_key, Cache *unhealthy) -> Resource* {
   if (!borrower) {
-    auto id = select(target_key, unhealthy);
+    auto id = select_target(target_key, unhealthy);
     if (!id) return nullptr;
+    if (m_circuit_breaker) m_circuit_breaker->select(id);
     return Resource::make(id);
   }
 
@@ -1063,8 +2332,9 @@ auto LoadBalancerBase::borrow(pjs::Object *borrower, const pjs::Value &target_ke
 
   if (res) return res;
 
-  auto id = select(target_key, unhealthy);
+  auto id = select_target(target_key, unhealthy);
   if (!id) return nullptr;
+  if (m_circuit_breaker) m_circuit_breaker->select(id);
 
   auto &target = m_targets[id];
   if (!target) {
@@ -1084,8 +2354,26 @@ auto LoadBalancerBase::borrow(pjs::Object *borrower, const pjs::Value &target_ke
   return res;
 }
 
+//
+// A key found in the affinity table goes to the same target as before as
+// long as this balancer still has it and it is healthy. Otherwise a new
+// target is selected as usual and the key is bound to it.
+//
+
+auto LoadBalancerBase::select_target(const pjs::Value &key, Cache *unhealthy) -> pjs::Str* {
+  if (!m_affinity || key.is_undefined()) return select(key, unhealthy);
+  if (auto target = m_affinity->find(key)) {
+    if (auto id = pick(target, unhealthy)) return id;
+  }
+  auto id = select(key, unhealthy);
+  if (id) m_affinity->bind(key, id);
+  return id;
+}
+
 bool LoadBalancerBase::is_healthy(pjs::Str *target, Cache *unhealthy) {
   pjs::Value v;
+  if (m_health_check && !m_health_check->is_healthy(target)) return false;
+  if (m_circuit_breaker && !m_circuit_breaker->allow(target)) return false;
   if (!unhealthy && !m_unhealthy) return true;
   if (m_unhealthy && m_unhealthy->find(target, v) && v.to_boolean()) return false;
   if (unhealthy && unhealthy->find(target, v) && v.to_boolean()) return false;
@@ -1166,6 +2454,15 @@ auto HashingLoadBalancer::select(const pjs::Value &key, Cache *unhealthy) -> pjs
   return s;
 }
 
+auto HashingLoadBalancer::pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* {
+  for (const auto &t : m_targets) {
+    if (t == target) {
+      return is_healthy(t, unhealthy) ? t.get() : nullptr;
+    }
+  }
+  return nullptr;
+}
+
 //
 // RoundRobinLoadBalancer
 //
@@ -1335,6 +2632,16 @@ auto RoundRobinLoadBalancer::select(const pjs::Value &key, Cache *unhealthy) ->
   return p->id;
 }
 
+auto RoundRobinLoadBalancer::pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* {
+  auto i = m_target_map.find(target);
+  if (i == m_target_map.end()) return nullptr;
+  auto t = i->second;
+  if (!t->weight || !is_healthy(t->id, unhealthy)) return nullptr;
+  t->hits++;
+  t->usage = double(t->hits) / t->weight;
+  return t->id;
+}
+
 //
 // LeastWorkLoadBalancer
 //
@@ -1460,7 +2767,17 @@ auto LeastWorkLoadBalancer::select(const pjs::Value &key, Cache *unhealthy) -> p
   return p->first;
 }
 
-void LeastWorkLoadBalancer::deselect(pjs::Str *target) {
+auto LeastWorkLoadBalancer::pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* {
+  auto i = m_targets.find(target);
+  if (i == m_targets.end()) return nullptr;
+  auto &t = i->second;
+  if (t.weight <= 0 || !is_healthy(i->first, unhealthy)) return nullptr;
+  t.hits++;
+  t.usage = double(t.hits) / t.weight;
+  return i->first;
+}
+
+void LeastWorkLoadBalancer::deselect(pjs::Str *target, double latency) {
   if (target) {
     auto i = m_targets.find(target);
     if (i != m_targets.end()) {
@@ -1474,44 +2791,592 @@ void LeastWorkLoadBalancer::deselect(pjs::Str *target) {
 }
 
 //
-// ResourcePool
+// PeakEwmaLoadBalancer
+//
+// Two targets are picked at random and the one with the lower cost wins.
+// The cost is the peak-EWMA of the latencies reported back on deselect
+// or observe, decaying towards zero over decayTime since the last report,
+// scaled by the number of outstanding selections plus one and divided by
+// weight. A target with no latency on record yet costs nothing while idle
+// and a large penalty while busy, so that new targets get probed one at
+// a time rather than flooded.
+//
+// A borrowed resource is often held for a whole connection carrying many
+// requests, so giving it back reports no latency. Callers observe() each
+// request instead.
 //
 
-void ResourcePool::allocate(pjs::Context &ctx, const pjs::Value &tag, pjs::Value &resource) {
-  auto &p = m_pools[tag];
-  if (p.empty()) {
-    pjs::Value arg(tag);
-    (*m_allocator)(ctx, 1, &arg, resource);
-    if (!ctx.ok()) return;
-  } else {
-    resource = p.front();
-    p.pop_front();
-  }
+static const double PEAK_EWMA_PENALTY = 1e9;
 
-  m_allocated[resource].tag = tag;
+PeakEwmaLoadBalancer::PeakEwmaLoadBalancer(pjs::Object *targets, Cache *unhealthy, double decay_time)
+  : pjs::ObjectTemplate<PeakEwmaLoadBalancer, LoadBalancerBase>(unhealthy)
+  , m_decay_time(decay_time * 1000)
+  , m_random(uint32_t(utils::now()) | 1)
+{
+  set(targets);
 }
 
-void ResourcePool::free(const pjs::Value &resource) {
-  auto i = m_allocated.find(resource);
-  if (i == m_allocated.end()) return;
-  auto &a = i->second;
-  m_pools[a.tag].push_back(resource);
-  m_allocated.erase(i);
+PeakEwmaLoadBalancer::~PeakEwmaLoadBalancer()
+{
 }
 
-//
-// Percentile
-//
+void PeakEwmaLoadBalancer::set(pjs::Object *targets) {
+  if (!targets) return;
+  for (auto &t : m_targets) t->removed = true;
 
-Percentile::Percentile(pjs::Array *buckets)
-  : m_counts(buckets->length())
-  , m_buckets(buckets->length())
-{
-  double last = std::numeric_limits<double>::min();
-  buckets->iterate_all(
-    [&](pjs::Value &v, int i) {
-      auto limit = v.to_number();
-      if (limit <= last) {
+  if (targets->is_array()) {
+    targets->as<pjs::Array>()->iterate_all(
+      [this](pjs::Value &v, int) {
+        auto s = v.to_string();
+        set(s, 1);
+        s->release();
+      }
+    );
+  } else {
+    targets->iterate_all(
+      [this](pjs::Str *k, pjs::Value &v) {
+        set(k, v.to_number());
+      }
+    );
+  }
+
+  for (auto i = m_targets.begin(); i != m_targets.end(); ) {
+    if ((*i)->removed) {
+      m_target_map.erase((*i)->id);
+      i = m_targets.erase(i);
+    } else {
+      i++;
+    }
+  }
+}
+
+void PeakEwmaLoadBalancer::set(pjs::Str *target, double weight) {
+  if (weight < 0) weight = 0;
+
+  auto i = m_target_map.find(target);
+  if (i == m_target_map.end()) {
+    auto t = new Target;
+    t->id = target;
+    t->weight = weight;
+    t->ewma = 0;
+    t->stamp = utils::now();
+    t->pending = 0;
+    t->removed = false;
+    m_targets.emplace_back(t);
+    m_target_map[target] = t;
+  } else {
+    auto t = i->second;
+    t->weight = weight;
+    t->removed = false;
+  }
+}
+
+auto PeakEwmaLoadBalancer::select(const pjs::Value &key, Cache *unhealthy) -> pjs::Str* {
+  if (!key.is_undefined()) {
+    if (!m_target_cache) {
+      Cache::Options options;
+      m_target_cache = Cache::make(options);
+    }
+    pjs::Value target;
+    if (m_target_cache->get(key, target)) {
+      auto i = m_target_map.find(target.s());
+      if (i != m_target_map.end()) {
+        i->second->pending++;
+        return target.s();
+      }
+      m_target_cache->remove(key);
+    }
+  }
+
+  auto n = m_targets.size();
+  if (!n) return nullptr;
+
+  auto is_eligible = [&](Target *t) {
+    return t->weight > 0 && is_healthy(t->id, unhealthy);
+  };
+
+  auto now = utils::now();
+  Target *p = nullptr;
+
+  if (n == 1) {
+    auto t = m_targets[0].get();
+    if (is_eligible(t)) p = t;
+  } else {
+    auto i = random() % n;
+    auto j = random() % (n - 1);
+    if (j >= i) j++;
+    auto a = m_targets[i].get();
+    auto b = m_targets[j].get();
+    if (!is_eligible(a)) a = nullptr;
+    if (!is_eligible(b)) b = nullptr;
+    if (a && b) {
+      p = cost(a, now) <= cost(b, now) ? a : b;
+    } else if (a || b) {
+      p = a ? a : b;
+    } else {
+      double min = 0;
+      for (const auto &t : m_targets) {
+        if (!is_eligible(t.get())) continue;
+        auto c = cost(t.get(), now);
+        if (!p || c < min) {
+          min = c;
+          p = t.get();
+        }
+      }
+    }
+  }
+
+  if (!p) return nullptr;
+
+  p->pending++;
+
+  if (!key.is_undefined()) {
+    m_target_cache->set(key, p->id.get());
+  }
+
+  return p->id;
+}
+
+auto PeakEwmaLoadBalancer::pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* {
+  auto i = m_target_map.find(target);
+  if (i == m_target_map.end()) return nullptr;
+  auto t = i->second;
+  if (t->weight <= 0 || !is_healthy(t->id, unhealthy)) return nullptr;
+  t->pending++;
+  return t->id;
+}
+
+void PeakEwmaLoadBalancer::deselect(pjs::Str *target, double latency) {
+  if (!target) return;
+  auto i = m_target_map.find(target);
+  if (i == m_target_map.end()) return;
+  auto t = i->second;
+  if (t->pending > 0) t->pending--;
+  if (latency >= 0) record(t, latency);
+}
+
+void PeakEwmaLoadBalancer::observe(pjs::Str *target, double latency) {
+  if (!target || latency < 0) return;
+  auto i = m_target_map.find(target);
+  if (i == m_target_map.end()) return;
+  record(i->second, latency);
+}
+
+void PeakEwmaLoadBalancer::record(Target *t, double latency) {
+  auto now = utils::now();
+  if (latency > t->ewma) {
+    t->ewma = latency;
+  } else {
+    auto w = std::exp(-std::max(0.0, now - t->stamp) / m_decay_time);
+    t->ewma = t->ewma * w + latency * (1 - w);
+  }
+  t->stamp = now;
+}
+
+auto PeakEwmaLoadBalancer::random() -> uint32_t {
+  auto x = m_random;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return m_random = x;
+}
+
+auto PeakEwmaLoadBalancer::cost(Target *t, double now) -> double {
+  auto ewma = t->ewma * std::exp(-std::max(0.0, now - t->stamp) / m_decay_time);
+  if (ewma <= 0 && t->pending > 0) return (PEAK_EWMA_PENALTY + t->pending) / t->weight;
+  return ewma * (t->pending + 1) / t->weight;
+}
+
+//
+// ConsistentHashingLoadBalancer
+//
+// Keys are hashed onto a lookup structure built from the targets. With a
+// positive loadFactor, a target whose outstanding selections would exceed
+// loadFactor times its weighted share of the total is passed over, and the
+// lookup goes on in probing order until one with spare capacity is found.
+// Unhealthy targets are skipped the same way. Health is rescanned at most
+// once a second, or right after a probe finds a target's state changed.
+//
+
+static const double CONSISTENT_HASHING_HEALTH_CHECK_INTERVAL = 1000;
+
+ConsistentHashingLoadBalancer::Options::Options(pjs::Object *options) {
+  Value(options, "loadFactor")
+    .get(load_factor)
+    .check_nullable();
+  Value(options, "tableSize")
+    .get(table_size)
+    .check_nullable();
+  Value(options, "replicas")
+    .get(replicas)
+    .check_nullable();
+  if (table_size < 1) throw std::runtime_error("options.tableSize expects a positive number");
+  if (replicas < 1) throw std::runtime_error("options.replicas expects a positive number");
+}
+
+auto ConsistentHashingLoadBalancer::mix(uint64_t h) -> uint64_t {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+void ConsistentHashingLoadBalancer::set(pjs::Object *targets) {
+  if (!targets) return;
+  for (auto &t : m_targets) t->removed = true;
+
+  if (targets->is_array()) {
+    targets->as<pjs::Array>()->iterate_all(
+      [this](pjs::Value &v, int) {
+        auto s = v.to_string();
+        set(s, 1);
+        s->release();
+      }
+    );
+  } else {
+    targets->iterate_all(
+      [this](pjs::Str *k, pjs::Value &v) {
+        set(k, v.to_number());
+      }
+    );
+  }
+
+  for (auto i = m_targets.begin(); i != m_targets.end(); ) {
+    auto t = i->get();
+    if (t->removed) {
+      on_remove(t);
+      m_total_load -= t->load;
+      m_target_map.erase(t->id);
+      i = m_targets.erase(i);
+    } else {
+      i++;
+    }
+  }
+
+  update_weight();
+}
+
+void ConsistentHashingLoadBalancer::set(pjs::Str *target, double weight) {
+  if (weight < 0) weight = 0;
+
+  auto i = m_target_map.find(target);
+  if (i == m_target_map.end()) {
+    auto t = new Target;
+    t->id = target;
+    t->hash = mix(target->hash());
+    t->weight = weight;
+    t->load = 0;
+    t->visit = 0;
+    t->healthy = true;
+    t->removed = false;
+    m_targets.emplace_back(t);
+    m_target_map[target] = t;
+    on_add(t);
+  } else {
+    auto t = i->second;
+    t->removed = false;
+    if (weight != t->weight) {
+      on_remove(t);
+      t->weight = weight;
+      on_add(t);
+    }
+  }
+
+  update_weight();
+}
+
+auto ConsistentHashingLoadBalancer::select(const pjs::Value &key, Cache *unhealthy) -> pjs::Str* {
+  auto n = m_targets.size();
+  if (!n) return nullptr;
+
+  auto now = utils::now();
+  if (now - m_health_check_time >= CONSISTENT_HASHING_HEALTH_CHECK_INTERVAL) {
+    m_health_check_time = now;
+    check_health(unhealthy);
+  }
+
+  auto load_factor = m_options.load_factor;
+  auto total_load = m_total_load + 1;
+  auto healthy_weight = m_healthy_weight;
+
+  Target *first = nullptr;
+  Target *p = nullptr;
+  size_t visited = 0;
+
+  if (++m_visit == 0) {
+    for (auto &t : m_targets) t->visit = 0;
+    m_visit = 1;
+  }
+
+  lookup(
+    mix(std::hash<pjs::Value>()(key)),
+    [&](Target *t) -> bool {
+      if (t->visit == m_visit) return true;
+      t->visit = m_visit;
+      if (t->weight > 0 && is_healthy(t->id, unhealthy)) {
+        if (!t->healthy) m_health_check_time = 0;
+        if (!first) first = t;
+        if (load_factor <= 0 || healthy_weight <= 0 ||
+          t->load < std::ceil(load_factor * total_load * t->weight / healthy_weight)
+        ) {
+          p = t;
+          return false;
+        }
+      } else if (t->healthy) {
+        m_health_check_time = 0;
+      }
+      return ++visited < n;
+    }
+  );
+
+  if (!p) p = first;
+  if (!p) return nullptr;
+
+  p->load++;
+  m_total_load++;
+  return p->id;
+}
+
+auto ConsistentHashingLoadBalancer::pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* {
+  auto i = m_target_map.find(target);
+  if (i == m_target_map.end()) return nullptr;
+  auto t = i->second;
+  if (t->weight <= 0 || !is_healthy(t->id, unhealthy)) return nullptr;
+  t->load++;
+  m_total_load++;
+  return t->id;
+}
+
+void ConsistentHashingLoadBalancer::deselect(pjs::Str *target, double latency) {
+  if (!target) return;
+  auto i = m_target_map.find(target);
+  if (i == m_target_map.end()) return;
+  auto t = i->second;
+  if (t->load > 0) {
+    t->load--;
+    m_total_load--;
+  }
+}
+
+void ConsistentHashingLoadBalancer::check_health(Cache *unhealthy) {
+  bool changed = false;
+  for (auto &t : m_targets) {
+    auto healthy = is_healthy(t->id, unhealthy);
+    if (healthy != t->healthy) {
+      t->healthy = healthy;
+      changed = true;
+    }
+  }
+  if (changed) {
+    update_weight();
+    on_health_change();
+  }
+}
+
+void ConsistentHashingLoadBalancer::update_weight() {
+  double sum = 0;
+  for (auto &t : m_targets) {
+    if (t->healthy) sum += t->weight;
+  }
+  m_healthy_weight = sum;
+}
+
+//
+// MaglevLoadBalancer
+//
+// The lookup table is rebuilt lazily on the first selection after the
+// set of healthy targets changes. Each target fills the table following
+// its own permutation, taking turns in proportion to its weight, which
+// keeps most slots on the same target as before when one joins or leaves.
+// Targets are filled in the order of their hashes so that the table only
+// depends on the target set and not on the order it was given in.
+//
+
+static auto next_prime(uint64_t n) -> uint64_t {
+  if (n <= 2) return 2;
+  if (!(n & 1)) n++;
+  for (;; n += 2) {
+    bool prime = true;
+    for (uint64_t i = 3; i * i <= n; i += 2) {
+      if (n % i == 0) {
+        prime = false;
+        break;
+      }
+    }
+    if (prime) return n;
+  }
+}
+
+MaglevLoadBalancer::MaglevLoadBalancer(pjs::Object *targets, Cache *unhealthy, const Options &options)
+  : pjs::ObjectTemplate<MaglevLoadBalancer, ConsistentHashingLoadBalancer>(unhealthy, options)
+{
+  m_options.table_size = next_prime(m_options.table_size);
+  set(targets);
+}
+
+void MaglevLoadBalancer::lookup(uint64_t hash, const std::function<bool(Target*)> &cb) {
+  if (m_dirty) build();
+  if (m_table.empty()) {
+    for (auto &t : m_targets) if (!cb(t.get())) return;
+    return;
+  }
+  auto size = m_table.size();
+  auto start = hash % size;
+  for (size_t i = 0; i < size; i++) {
+    if (!cb(m_table[(start + i) % size])) return;
+  }
+}
+
+void MaglevLoadBalancer::build() {
+  m_dirty = false;
+  m_table.clear();
+
+  struct Entry {
+    Target *target;
+    uint64_t offset;
+    uint64_t skip;
+    uint64_t next;
+    double credit;
+  };
+
+  uint64_t size = m_options.table_size;
+  std::vector<Entry> entries;
+  double max_weight = 0;
+
+  for (auto &t : m_targets) {
+    if (!t->healthy || t->weight <= 0) continue;
+    Entry e;
+    e.target = t.get();
+    e.offset = t->hash % size;
+    e.skip = size > 1 ? mix(t->hash ^ 0x9e3779b97f4a7c15ull) % (size - 1) + 1 : 1;
+    e.next = 0;
+    e.credit = 0;
+    entries.push_back(e);
+    max_weight = std::max(max_weight, t->weight);
+  }
+
+  if (entries.empty()) return;
+
+  std::sort(
+    entries.begin(), entries.end(),
+    [](const Entry &a, const Entry &b) {
+      return a.target->hash < b.target->hash;
+    }
+  );
+
+  m_table.assign(size, nullptr);
+
+  uint64_t filled = 0;
+  while (filled < size) {
+    for (auto &e : entries) {
+      e.credit += e.target->weight / max_weight;
+      if (e.credit < 1) continue;
+      e.credit -= 1;
+      uint64_t c;
+      do {
+        c = (e.offset + e.next * e.skip) % size;
+        e.next++;
+      } while (m_table[c]);
+      m_table[c] = e.target;
+      if (++filled == size) break;
+    }
+  }
+}
+
+//
+// RingHashLoadBalancer
+//
+// Each target is placed on the ring at a number of points proportional to
+// its weight. Adding or removing a target only merges in or erases its own
+// points. Health changes need no rebuild since the walk along the ring
+// skips unhealthy targets on its own.
+//
+
+RingHashLoadBalancer::RingHashLoadBalancer(pjs::Object *targets, Cache *unhealthy, const Options &options)
+  : pjs::ObjectTemplate<RingHashLoadBalancer, ConsistentHashingLoadBalancer>(unhealthy, options)
+{
+  set(targets);
+}
+
+void RingHashLoadBalancer::on_add(Target *t) {
+  if (t->weight <= 0) return;
+  auto n = std::max(1, int(std::round(m_options.replicas * t->weight)));
+  auto mid = m_ring.size();
+  for (int i = 0; i < n; i++) {
+    m_ring.emplace_back(mix(t->hash + uint64_t(i) * 0x9e3779b97f4a7c15ull), t);
+  }
+  std::sort(m_ring.begin() + mid, m_ring.end());
+  std::inplace_merge(m_ring.begin(), m_ring.begin() + mid, m_ring.end());
+}
+
+void RingHashLoadBalancer::on_remove(Target *t) {
+  m_ring.erase(
+    std::remove_if(
+      m_ring.begin(), m_ring.end(),
+      [=](const std::pair<uint64_t, Target*> &p) {
+        return p.second == t;
+      }
+    ),
+    m_ring.end()
+  );
+}
+
+void RingHashLoadBalancer::lookup(uint64_t hash, const std::function<bool(Target*)> &cb) {
+  auto size = m_ring.size();
+  if (!size) return;
+  auto i = std::lower_bound(
+    m_ring.begin(), m_ring.end(), hash,
+    [](const std::pair<uint64_t, Target*> &p, uint64_t h) {
+      return p.first < h;
+    }
+  );
+  auto start = size_t(i - m_ring.begin());
+  for (size_t n = 0; n < size; n++) {
+    if (!cb(m_ring[(start + n) % size].second)) return;
+  }
+}
+
+//
+// ResourcePool
+//
+
+void ResourcePool::allocate(pjs::Context &ctx, const pjs::Value &tag, pjs::Value &resource) {
+  auto &p = m_pools[tag];
+  if (p.empty()) {
+    pjs::Value arg(tag);
+    (*m_allocator)(ctx, 1, &arg, resource);
+    if (!ctx.ok()) return;
+  } else {
+    resource = p.front();
+    p.pop_front();
+  }
+
+  m_allocated[resource].tag = tag;
+}
+
+void ResourcePool::free(const pjs::Value &resource) {
+  auto i = m_allocated.find(resource);
+  if (i == m_allocated.end()) return;
+  auto &a = i->second;
+  m_pools[a.tag].push_back(resource);
+  m_allocated.erase(i);
+}
+
+//
+// Percentile
+//
+
+Percentile::Percentile(pjs::Array *buckets)
+  : m_counts(buckets->length())
+  , m_buckets(buckets->length())
+{
+  double last = std::numeric_limits<double>::min();
+  buckets->iterate_all(
+    [&](pjs::Value &v, int i) {
+      auto limit = v.to_number();
+      if (limit <= last) {
         Log::warn(
           "buckets are not in ascending order: changed from %f to %f at #%d",
           last, limit, i
@@ -1525,6 +3390,50 @@ Percentile::Percentile(pjs::Array *buckets)
   reset();
 }
 
+Percentile::LogLinear::LogLinear(pjs::Object *options) {
+  Value(options, "lowest")
+    .get(lowest)
+    .check_nullable();
+  Value(options, "highest")
+    .get(highest)
+    .check_nullable();
+  Value(options, "precision")
+    .get(precision)
+    .check_nullable();
+  if (!(lowest > 0)) throw std::runtime_error("options.lowest must be greater than 0");
+  if (!(highest > lowest)) throw std::runtime_error("options.highest must be greater than options.lowest");
+  if (precision < 1 || precision > 10) throw std::runtime_error("options.precision must be between 1 and 10");
+}
+
+Percentile::Percentile(const LogLinear &layout)
+  : m_lowest(layout.lowest)
+  , m_precision(layout.precision)
+{
+  static const size_t MAX_BUCKETS = 8192;
+  auto sub_count = 1 << m_precision;
+  m_buckets.push_back(m_lowest);
+  for (double base = m_lowest; m_buckets.back() < layout.highest; base *= 2) {
+    for (int i = 1; i <= sub_count; i++) {
+      m_buckets.push_back(base + base * i / sub_count);
+    }
+    if (m_buckets.size() > MAX_BUCKETS) {
+      throw std::runtime_error("too many buckets for log-linear histogram");
+    }
+  }
+  m_buckets.push_back(std::numeric_limits<double>::infinity());
+  m_counts.resize(m_buckets.size());
+  reset();
+}
+
+Percentile::Percentile(Percentile *layout)
+  : m_counts(layout->m_counts.size())
+  , m_buckets(layout->m_buckets)
+  , m_lowest(layout->m_lowest)
+  , m_precision(layout->m_precision)
+{
+  reset();
+}
+
 void Percentile::reset() {
   for (auto &n : m_counts) n = 0;
   m_sample_count = 0;
@@ -1547,19 +3456,46 @@ void Percentile::set(int bucket, size_t count) {
   }
 }
 
-void Percentile::observe(double sample) {
-  for (size_t i = 0, n = m_counts.size(); i < n; i++) {
-    if (sample <= m_buckets[i]) {
-      m_counts[i]++;
-      m_sample_count++;
-      break;
-    }
+auto Percentile::observe(double sample) -> int {
+  auto i = locate(sample);
+  if (i >= 0) {
+    m_counts[i]++;
+    m_sample_count++;
   }
+  return i;
 }
 
-auto Percentile::calculate(int percentage) -> double {
+//
+// Finds the first bucket whose upper bound is no less than the sample.
+// With a log-linear layout the index is computed from the exponent and
+// the mantissa of sample/lowest and only nudged for rounding errors.
+//
+
+auto Percentile::locate(double sample) const -> int {
+  int n = m_buckets.size();
+  if (!n || !(sample <= m_buckets.back())) return -1;
+
+  if (m_precision > 0) {
+    if (sample <= m_lowest) return 0;
+    int exp;
+    auto sub_count = 1 << m_precision;
+    auto m = std::frexp(sample / m_lowest, &exp) * 2;
+    auto s = int(std::ceil((m - 1) * sub_count)) - 1;
+    int i = 1 + (exp - 1) * sub_count + s;
+    if (i < 0) i = 0;
+    if (i >= n) i = n - 1;
+    while (i > 0 && sample <= m_buckets[i-1]) i--;
+    while (i < n - 1 && sample > m_buckets[i]) i++;
+    return i;
+  }
+
+  auto p = std::lower_bound(m_buckets.begin(), m_buckets.end(), sample);
+  return p - m_buckets.begin();
+}
+
+auto Percentile::calculate(double percentage) -> double {
   if (percentage <= 0) return 0;
-  size_t total = m_sample_count * percentage / 100;
+  size_t total = std::ceil(m_sample_count * percentage / 100);
   size_t count = 0;
   for (size_t i = 0, n = m_buckets.size(); i < n; i++) {
     count += m_counts[i];
@@ -1571,6 +3507,14 @@ auto Percentile::calculate(int percentage) -> double {
   return std::numeric_limits<double>::infinity();
 }
 
+auto Percentile::buckets() const -> pjs::Array* {
+  auto a = pjs::Array::make(m_buckets.size());
+  for (size_t i = 0; i < m_buckets.size(); i++) {
+    a->set(i, m_buckets[i]);
+  }
+  return a;
+}
+
 void Percentile::dump(const std::function<void(double, size_t)> &cb) {
   size_t sum = 0;
   for (size_t i = 0; i < m_buckets.size(); i++) {
@@ -1579,6 +3523,407 @@ void Percentile::dump(const std::function<void(double, size_t)> &cb) {
   }
 }
 
+//
+// LoadGen::Options
+//
+
+LoadGen::Options::Options(pjs::Object *options) {
+  Value(options, "rate")
+    .get(rate)
+    .check_nullable();
+  Value(options, "duration")
+    .get_seconds(duration)
+    .check_nullable();
+  Value(options, "maxInFlight")
+    .get(max_in_flight)
+    .check_nullable();
+  Value(options, "request")
+    .get(request)
+    .check_nullable();
+  Value(options, "latency")
+    .get(latency)
+    .check_nullable();
+  if (!(rate > 0)) throw std::runtime_error("options.rate must be greater than 0");
+  if (!(duration > 0)) throw std::runtime_error("options.duration must be greater than 0");
+  if (latency && !latency->is<Percentile>() && !latency->is<stats::Histogram>()) {
+    throw std::runtime_error("options.latency requires an algo.Percentile or a stats.Histogram");
+  }
+}
+
+//
+// LoadGen
+//
+
+LoadGen::LoadGen(PipelineLayout *layout, const Options &options)
+  : m_layout(layout)
+  , m_options(options)
+  , m_latency(options.latency)
+{
+  if (!m_latency) m_latency = Percentile::make(Percentile::LogLinear());
+}
+
+LoadGen::~LoadGen() {
+  while (auto req = m_requests.head()) {
+    m_requests.remove(req);
+    req->abort();
+    delete req;
+  }
+}
+
+auto LoadGen::clock() -> double {
+  return std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+auto LoadGen::start() -> pjs::Promise* {
+  auto promise = pjs::Promise::make();
+  if (m_running) {
+    pjs::Ref<pjs::Promise::Settler> settler(pjs::Promise::Settler::make(promise));
+    settler->reject(pjs::Str::make("load generator is already running"));
+    return promise;
+  }
+  m_settler = pjs::Promise::Settler::make(promise);
+  m_running = true;
+  m_start_time = clock();
+  m_end_time = 0;
+  m_total = uint64_t(std::ceil(m_options.rate * m_options.duration));
+  m_scheduled = 0;
+  m_started = 0;
+  m_completed = 0;
+  m_errors = 0;
+  m_max_lag = 0;
+  m_backlog.clear();
+  retain();
+  tick();
+  return promise;
+}
+
+void LoadGen::stop() {
+  if (!m_running) return;
+  m_timer.cancel();
+  m_total = m_scheduled;
+  m_backlog.clear();
+  check_ending();
+}
+
+auto LoadGen::report() -> pjs::Object* {
+  static const pjs::ConstStr s_duration("duration");
+  static const pjs::ConstStr s_scheduled("scheduled");
+  static const pjs::ConstStr s_started("started");
+  static const pjs::ConstStr s_completed("completed");
+  static const pjs::ConstStr s_errors("errors");
+  static const pjs::ConstStr s_inFlight("inFlight");
+  static const pjs::ConstStr s_maxLag("maxLag");
+  static const pjs::ConstStr s_rate("rate");
+  static const pjs::ConstStr s_latency("latency");
+  auto end = m_end_time > 0 ? m_end_time : clock();
+  auto duration = m_start_time > 0 ? (end - m_start_time) / 1000 : 0;
+  auto obj = pjs::Object::make();
+  obj->set(s_duration, duration);
+  obj->set(s_scheduled, double(m_scheduled));
+  obj->set(s_started, double(m_started));
+  obj->set(s_completed, double(m_completed));
+  obj->set(s_errors, double(m_errors));
+  obj->set(s_inFlight, int(m_requests.size()));
+  obj->set(s_maxLag, m_max_lag);
+  obj->set(s_rate, duration > 0 ? m_completed / duration : 0);
+  obj->set(s_latency, m_latency.get());
+  return obj;
+}
+
+//
+// All requests due by now are issued in one go, each keeping the time
+// it was due at. The next round is timed for the next due request, or
+// the next millisecond at high rates.
+//
+
+void LoadGen::tick() {
+  if (!m_running) return;
+
+  auto now = clock();
+  auto interval = 1000 / m_options.rate;
+  auto due = std::min(m_total, uint64_t((now - m_start_time) / interval) + 1);
+
+  InputContext ic;
+  while (m_scheduled < due) {
+    auto t = m_start_time + m_scheduled * interval;
+    m_scheduled++;
+    m_max_lag = std::max(m_max_lag, now - t);
+    if (m_options.max_in_flight > 0 && m_requests.size() >= m_options.max_in_flight) {
+      m_backlog.push_back(t);
+    } else {
+      send(t);
+    }
+  }
+
+  if (m_scheduled < m_total) {
+    auto next = m_start_time + m_scheduled * interval;
+    pjs::Ref<LoadGen> ref(this);
+    m_timer.schedule(
+      std::max(next - clock(), 1.0) / 1000,
+      [=]() { ref->tick(); }
+    );
+  } else {
+    check_ending();
+  }
+}
+
+void LoadGen::send(double due) {
+  auto req = new Request(this, due);
+  m_requests.push(req);
+  req->start(m_started++);
+}
+
+void LoadGen::observe(double latency) {
+  if (auto p = m_latency->as<Percentile>()) {
+    p->observe(latency);
+  } else if (auto h = m_latency->as<stats::Histogram>()) {
+    h->observe(latency);
+  }
+}
+
+void LoadGen::on_complete(Request *req, bool ok) {
+  m_requests.remove(req);
+  m_completed++;
+  if (!ok) m_errors++;
+  if (!m_backlog.empty()) {
+    auto t = m_backlog.front();
+    m_backlog.pop_front();
+    send(t);
+  }
+  check_ending();
+}
+
+void LoadGen::check_ending() {
+  if (m_running && m_scheduled >= m_total && m_backlog.empty() && m_requests.empty()) {
+    m_running = false;
+    m_end_time = clock();
+    m_timer.cancel();
+    if (auto s = m_settler.get()) {
+      m_settler = nullptr;
+      pjs::Value ret(report());
+      s->resolve(ret);
+    }
+    release();
+  }
+}
+
+//
+// LoadGen::Request
+//
+
+LoadGen::Request::Request(LoadGen *lg, double due)
+  : m_load_gen(lg)
+  , m_due(due)
+{
+}
+
+LoadGen::Request::~Request() {
+}
+
+void LoadGen::Request::start(uint64_t index) {
+  auto lg = m_load_gen;
+  auto layout = lg->m_layout.get();
+  auto p = Pipeline::make(layout, layout->new_context());
+  p->chain(EventSource::reply());
+  m_pipeline = p;
+  Pipeline::auto_release(p);
+  p->start();
+
+  auto request = lg->m_options.request.get();
+  pjs::Value events;
+  if (!request) {
+    // the pipeline starts on its own with an onStart()
+  } else if (request->is_function()) {
+    auto ctx = p->context();
+    pjs::Value arg((double)index);
+    (*request->as<pjs::Function>())(*ctx, 1, &arg, events);
+    if (!ctx->ok()) {
+      Log::pjs_error(ctx->error());
+      ctx->reset();
+    }
+  } else {
+    events.set(request);
+  }
+
+  if (!events.is_undefined()) {
+    auto input = p->input();
+    Message::to_events(
+      events, [&](Event *evt) {
+        input->input(evt);
+        return true;
+      }
+    );
+  }
+}
+
+void LoadGen::Request::abort() {
+  EventSource::close();
+  m_pipeline = nullptr;
+}
+
+void LoadGen::Request::on_reply(Event *evt) {
+  bool ok = true;
+  if (auto eos = evt->as<StreamEnd>()) {
+    ok = (eos->error_code() == StreamEnd::NO_ERROR);
+  } else if (!evt->is<MessageEnd>()) {
+    return;
+  }
+  Pipeline::auto_release(m_pipeline);
+  auto lg = m_load_gen;
+  pjs::Ref<LoadGen> ref(lg);
+  lg->observe(LoadGen::clock() - m_due);
+  EventSource::close();
+  lg->on_complete(this, ok);
+  delete this;
+}
+
+//
+// PatternSet::Options
+//
+
+PatternSet::Options::Options(pjs::Object *options) {
+  Value(options, "ignoreCase")
+    .get(ignore_case)
+    .check_nullable();
+}
+
+//
+// PatternSet
+//
+
+PatternSet::PatternSet(pjs::Array *patterns, const Options &options)
+  : m_options(options)
+{
+  std::vector<std::string> strs;
+  patterns->iterate_all(
+    [&](pjs::Value &v, int) {
+      if (v.is<Data>()) {
+        strs.push_back(v.as<Data>()->to_string());
+      } else if (v.is_string()) {
+        strs.push_back(v.s()->str());
+      } else {
+        throw std::runtime_error("patterns must be strings or Data objects");
+      }
+      if (strs.back().empty()) throw std::runtime_error("empty pattern");
+      m_patterns.push_back(v);
+    }
+  );
+  build(strs);
+}
+
+//
+// States are numbered in the order they are created with the root as 0.
+// Outputs of a state and of all the states along its failure chain are
+// linked through next_output, which is 0 at the end of the chain since
+// the root never has an output.
+//
+
+void PatternSet::build(const std::vector<std::string> &patterns) {
+  m_nodes.resize(1);
+  m_table.assign(256, 0);
+  m_duplicates.assign(patterns.size(), -1);
+
+  auto fold = [this](uint8_t c) -> uint8_t {
+    return m_options.ignore_case ? std::tolower(c) : c;
+  };
+
+  for (size_t i = 0; i < patterns.size(); i++) {
+    int s = 0;
+    for (auto c : patterns[i]) {
+      auto b = fold(c);
+      auto t = m_table[s * 256 + b];
+      if (!t) {
+        t = m_nodes.size();
+        m_nodes.emplace_back();
+        m_table.resize(m_table.size() + 256, 0);
+        m_table[s * 256 + b] = t;
+      }
+      s = t;
+    }
+    auto &node = m_nodes[s];
+    if (node.output < 0) {
+      node.output = i;
+    } else {
+      auto j = node.output;
+      while (m_duplicates[j] >= 0) j = m_duplicates[j];
+      m_duplicates[j] = i;
+    }
+  }
+
+  std::vector<int> queue;
+  for (int b = 0; b < 256; b++) {
+    if (auto t = m_table[b]) queue.push_back(t);
+  }
+
+  for (size_t i = 0; i < queue.size(); i++) {
+    auto s = queue[i];
+    auto &node = m_nodes[s];
+    auto f = node.fail;
+    node.next_output = m_nodes[f].output >= 0 ? f : m_nodes[f].next_output;
+    for (int b = 0; b < 256; b++) {
+      auto &t = m_table[s * 256 + b];
+      if (t) {
+        m_nodes[t].fail = m_table[f * 256 + b];
+        queue.push_back(t);
+      } else {
+        t = m_table[f * 256 + b];
+      }
+    }
+  }
+
+  if (m_options.ignore_case) {
+    for (size_t s = 0; s < m_nodes.size(); s++) {
+      for (int b = 'A'; b <= 'Z'; b++) {
+        m_table[s * 256 + b] = m_table[s * 256 + b - 'A' + 'a'];
+      }
+    }
+  }
+}
+
+//
+// PatternSet::Scanner
+//
+
+auto PatternSet::Scanner::scan(const Data &data) -> pjs::Array* {
+  auto out = pjs::Array::make();
+  for (const auto c : data.chunks()) {
+    feed((const uint8_t *)std::get<0>(c), std::get<1>(c), out);
+  }
+  return out;
+}
+
+auto PatternSet::Scanner::scan(const char *str, size_t len) -> pjs::Array* {
+  auto out = pjs::Array::make();
+  feed((const uint8_t *)str, len, out);
+  return out;
+}
+
+void PatternSet::Scanner::reset() {
+  m_state = 0;
+  m_seen.assign(m_seen.size(), false);
+}
+
+void PatternSet::Scanner::feed(const uint8_t *p, size_t n, pjs::Array *out) {
+  const auto *table = m_set->m_table.data();
+  const auto &nodes = m_set->m_nodes;
+  const auto &duplicates = m_set->m_duplicates;
+  auto s = m_state;
+  for (size_t i = 0; i < n; i++) {
+    s = table[s * 256 + p[i]];
+    for (auto o = s; o; o = nodes[o].next_output) {
+      for (auto id = nodes[o].output; id >= 0; id = duplicates[id]) {
+        if (!m_seen[id]) {
+          m_seen[id] = true;
+          out->push(id);
+        }
+      }
+    }
+  }
+  m_state = s;
+}
+
 } // namespace algo
 } // namespace pipy
 
@@ -1591,6 +3936,11 @@ using namespace pipy::algo;
 // Cache
 //
 
+template<> void EnumDef<Cache::Policy>::init() {
+  define(Cache::Policy::LRU, "lru");
+  define(Cache::Policy::TINYLFU, "tinylfu");
+}
+
 template<> void ClassDef<Cache>::init() {
   ctor([](Context &ctx) -> Object* {
     Function *allocate = nullptr, *free = nullptr;
@@ -1600,7 +3950,12 @@ template<> void ClassDef<Cache>::init() {
       ctx.try_arguments(1, &allocate, &options) ||
       ctx.try_arguments(0, &options)
     ) {
-      return Cache::make(options, allocate, free);
+      try {
+        return Cache::make(options, allocate, free);
+      } catch (std::runtime_error &err) {
+        ctx.error(err);
+        return nullptr;
+      }
     } else {
       ctx.error_argument_type(0, "a function or an object");
       return nullptr;
@@ -1640,6 +3995,10 @@ template<> void ClassDef<Cache>::init() {
   method("clear", [](Context &ctx, Object *obj, Value &ret) {
     obj->as<Cache>()->clear(ctx);
   });
+
+  accessor("hits", [](Object *obj, Value &ret) { ret.set(double(obj->as<Cache>()->hits())); });
+  accessor("misses", [](Object *obj, Value &ret) { ret.set(double(obj->as<Cache>()->misses())); });
+  accessor("evictions", [](Object *obj, Value &ret) { ret.set(double(obj->as<Cache>()->evictions())); });
 }
 
 template<> void ClassDef<Constructor<Cache>>::init() {
@@ -1687,6 +4046,16 @@ template<> void ClassDef<Quota>::init() {
 template<> void ClassDef<Constructor<Quota>>::init() {
   super<Function>();
   ctor();
+
+  method("join", [](Context &ctx, Object *obj, Value &ret) {
+    Object *options;
+    if (!ctx.arguments(1, &options)) return;
+    try {
+      Quota::Cluster::join(options);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
 }
 
 //
@@ -1758,9 +4127,10 @@ template<> void ClassDef<Constructor<SharedMap>>::init() {
 template<> void ClassDef<URLRouter>::init() {
   ctor([](Context &ctx) -> Object* {
     Object *rules = nullptr;
-    if (!ctx.arguments(0, &rules)) return nullptr;
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &rules, &options)) return nullptr;
     try {
-      return URLRouter::make(rules);
+      return URLRouter::make(rules, URLRouter::Options(options));
     } catch (std::runtime_error &err) {
       ctx.error(err);
       return nullptr;
@@ -1772,31 +4142,105 @@ template<> void ClassDef<URLRouter>::init() {
     Value value;
     if (!ctx.arguments(2, &url, &value)) return;
     try {
-      obj->as<URLRouter>()->add(url, value);
+      obj->as<URLRouter>()->add(url, value);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
+  auto find = [](Context &ctx, Object *obj, Value &ret, URLRouter::Match *match) -> bool {
+    auto router = obj->as<URLRouter>();
+    if (ctx.argc() == 1 && ctx.arg(0).is_string()) {
+      auto s = ctx.arg(0).s();
+      return router->find(s->c_str(), s->size(), ret, match);
+    }
+    std::string url;
+    for (int i = 0; i < ctx.argc(); i++) {
+      const auto &seg = ctx.arg(i);
+      if (!seg.is_nullish()) {
+        auto s = seg.to_string();
+        if (url.empty()) {
+          url = s->str();
+        } else {
+          url = pipy::utils::path_join(url, s->str());
+        }
+        s->release();
+      }
+    }
+    return router->find(url.c_str(), url.length(), ret, match);
+  };
+
+  method("find", [=](Context &ctx, Object *obj, Value &ret) {
+    find(ctx, obj, ret, nullptr);
+  });
+
+  method("match", [=](Context &ctx, Object *obj, Value &ret) {
+    thread_local static ConstStr s_value("value");
+    thread_local static ConstStr s_params("params");
+    URLRouter::Match match;
+    Value value;
+    if (find(ctx, obj, value, &match)) {
+      auto result = Object::make();
+      result->set(s_value, value);
+      result->set(s_params, match.params());
+      ret.set(result);
+    } else {
+      ret = Value::null;
+    }
+  });
+}
+
+template<> void ClassDef<Constructor<URLRouter>>::init() {
+  super<Function>();
+  ctor();
+}
+
+//
+// RouteTable
+//
+
+template<> void ClassDef<RouteTable>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Array *routes;
+    if (!ctx.arguments(1, &routes)) return nullptr;
+    try {
+      return RouteTable::make(routes);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  method("update", [](Context &ctx, Object *obj, Value &ret) {
+    Array *routes;
+    if (!ctx.arguments(1, &routes)) return;
+    try {
+      obj->as<RouteTable>()->update(routes);
     } catch (std::runtime_error &err) {
       ctx.error(err);
     }
   });
 
   method("find", [](Context &ctx, Object *obj, Value &ret) {
-    std::string url;
-    for (int i = 0; i < ctx.argc(); i++) {
-      const auto &seg = ctx.arg(i);
-      if (!seg.is_nullish()) {
-        auto s = seg.to_string();
-        if (url.empty()) {
-          url = s->str();
-        } else {
-          url = pipy::utils::path_join(url, s->str());
-        }
-        s->release();
-      }
+    thread_local static ConstStr s_route("route");
+    thread_local static ConstStr s_upstream("upstream");
+    thread_local static ConstStr s_params("params");
+    Object *head;
+    if (!ctx.arguments(1, &head)) return;
+    RouteTable::Result r;
+    if (obj->as<RouteTable>()->find(ctx, head, r)) {
+      auto result = Object::make();
+      result->set(s_route, r.route.get());
+      if (r.upstream) result->set(s_upstream, r.upstream.get());
+      if (r.params) result->set(s_params, r.params.get());
+      ret.set(result);
+    } else if (ctx.ok()) {
+      ret = Value::null;
     }
-    obj->as<URLRouter>()->find(url, ret);
   });
 }
 
-template<> void ClassDef<Constructor<URLRouter>>::init() {
+template<> void ClassDef<Constructor<RouteTable>>::init() {
   super<Function>();
   ctor();
 }
@@ -1856,6 +4300,127 @@ template<> void ClassDef<Constructor<LoadBalancer>>::init() {
   ctor();
 }
 
+//
+// HealthCheck
+//
+
+template<> void ClassDef<HealthCheck>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return nullptr;
+    try {
+      return HealthCheck::make(HealthChecker::Options(options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  method("isHealthy", [](Context &ctx, Object *obj, Value &ret) {
+    Str *target;
+    if (!ctx.arguments(1, &target)) return;
+    ret.set(obj->as<HealthCheck>()->is_healthy(target));
+  });
+
+  method("report", [](Context &ctx, Object *obj, Value &ret) {
+    Str *target;
+    bool ok;
+    if (!ctx.arguments(2, &target, &ok)) return;
+    obj->as<HealthCheck>()->report(target, ok);
+  });
+}
+
+template<> void ClassDef<Constructor<HealthCheck>>::init() {
+  super<Function>();
+  ctor();
+}
+
+//
+// CircuitBreaker
+//
+
+template<> void ClassDef<algo::CircuitBreaker>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return nullptr;
+    try {
+      return algo::CircuitBreaker::make(pipy::CircuitBreaker::Options(options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  method("allow", [](Context &ctx, Object *obj, Value &ret) {
+    Str *target;
+    if (!ctx.arguments(1, &target)) return;
+    auto cb = obj->as<algo::CircuitBreaker>();
+    auto allowed = cb->allow(target);
+    if (allowed) cb->select(target);
+    ret.set(allowed);
+  });
+
+  method("report", [](Context &ctx, Object *obj, Value &ret) {
+    Str *target;
+    bool ok;
+    if (!ctx.arguments(2, &target, &ok)) return;
+    obj->as<algo::CircuitBreaker>()->report(target, ok);
+  });
+
+  method("state", [](Context &ctx, Object *obj, Value &ret) {
+    Str *target;
+    if (!ctx.arguments(1, &target)) return;
+    ret.set(EnumDef<pipy::CircuitBreaker::State>::name(obj->as<algo::CircuitBreaker>()->state(target)));
+  });
+}
+
+template<> void ClassDef<Constructor<algo::CircuitBreaker>>::init() {
+  super<Function>();
+  ctor();
+}
+
+//
+// AffinityTable
+//
+
+template<> void ClassDef<algo::AffinityTable>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Str *name;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &name, &options)) return nullptr;
+    try {
+      return algo::AffinityTable::make(name, pipy::AffinityTable::Options(options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  method("find", [](Context &ctx, Object *obj, Value &ret) {
+    Value key;
+    if (!ctx.arguments(1, &key)) return;
+    if (auto target = obj->as<algo::AffinityTable>()->find(key)) ret.set(target);
+  });
+
+  method("bind", [](Context &ctx, Object *obj, Value &ret) {
+    Value key;
+    Str *target;
+    if (!ctx.arguments(2, &key, &target)) return;
+    obj->as<algo::AffinityTable>()->bind(key, target);
+  });
+
+  method("unbind", [](Context &ctx, Object *obj, Value &ret) {
+    Value key;
+    if (!ctx.arguments(1, &key)) return;
+    obj->as<algo::AffinityTable>()->unbind(key);
+  });
+}
+
+template<> void ClassDef<Constructor<algo::AffinityTable>>::init() {
+  super<Function>();
+  ctor();
+}
+
 //
 // LoadBalancerBase
 //
@@ -1883,15 +4448,44 @@ template<> void ClassDef<LoadBalancerBase>::init() {
     pjs::Value key;
     Cache *unhealthy = nullptr;
     if (!ctx.arguments(0, &key, &unhealthy)) return;
-    if (auto target = obj->as<LoadBalancerBase>()->select(key, unhealthy)) {
+    if (auto target = obj->as<LoadBalancerBase>()->select_target(key, unhealthy)) {
       ret.set(target);
     }
   });
 
   method("deselect", [](Context &ctx, Object *obj, Value &ret) {
     Str *target = nullptr;
-    if (!ctx.arguments(0, &target)) return;
-    obj->as<LoadBalancerBase>()->deselect(target);
+    double latency = -1;
+    if (!ctx.arguments(0, &target, &latency)) return;
+    obj->as<LoadBalancerBase>()->deselect(target, latency);
+  });
+
+  method("observe", [](Context &ctx, Object *obj, Value &ret) {
+    Str *target;
+    double latency;
+    if (!ctx.arguments(2, &target, &latency)) return;
+    obj->as<LoadBalancerBase>()->observe(target, latency);
+  });
+
+  method("healthCheck", [](Context &ctx, Object *obj, Value &ret) {
+    HealthCheck *hc = nullptr;
+    if (!ctx.arguments(0, &hc)) return;
+    obj->as<LoadBalancerBase>()->health_check(hc);
+    ret.set(obj);
+  });
+
+  method("circuitBreaker", [](Context &ctx, Object *obj, Value &ret) {
+    algo::CircuitBreaker *cb = nullptr;
+    if (!ctx.arguments(0, &cb)) return;
+    obj->as<LoadBalancerBase>()->circuit_breaker(cb);
+    ret.set(obj);
+  });
+
+  method("affinity", [](Context &ctx, Object *obj, Value &ret) {
+    algo::AffinityTable *at = nullptr;
+    if (!ctx.arguments(0, &at)) return;
+    obj->as<LoadBalancerBase>()->affinity(at);
+    ret.set(obj);
   });
 }
 
@@ -2003,6 +4597,124 @@ template<> void ClassDef<Constructor<LeastWorkLoadBalancer>>::init() {
   ctor();
 }
 
+//
+// PeakEwmaLoadBalancer
+//
+
+template<> void ClassDef<PeakEwmaLoadBalancer>::init() {
+  super<LoadBalancerBase>();
+
+  ctor([](Context &ctx) -> Object* {
+    Object *targets = nullptr;
+    Cache *unhealthy = nullptr;
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &targets, &unhealthy, &options)) return nullptr;
+    double decay_time = 10;
+    try {
+      pipy::Options::Value(options, "decayTime")
+        .get_seconds(decay_time)
+        .check_nullable();
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+    return PeakEwmaLoadBalancer::make(targets, unhealthy, decay_time);
+  });
+
+  method("set", [](Context &ctx, Object *obj, Value &ret) {
+    Object *targets;
+    Str *target;
+    double weight;
+    if (ctx.get(0, targets)) {
+      obj->as<PeakEwmaLoadBalancer>()->set(targets);
+    } else if (ctx.get(0, target)) {
+      if (!ctx.check(1, weight)) return;
+      obj->as<PeakEwmaLoadBalancer>()->set(target, weight);
+    } else {
+      ctx.error_argument_type(0, "a string or an object");
+    }
+  });
+}
+
+template<> void ClassDef<Constructor<PeakEwmaLoadBalancer>>::init() {
+  super<Function>();
+  ctor();
+}
+
+//
+// ConsistentHashingLoadBalancer
+//
+
+template<> void ClassDef<ConsistentHashingLoadBalancer>::init() {
+  super<LoadBalancerBase>();
+
+  method("set", [](Context &ctx, Object *obj, Value &ret) {
+    Object *targets;
+    Str *target;
+    double weight;
+    if (ctx.get(0, targets)) {
+      obj->as<ConsistentHashingLoadBalancer>()->set(targets);
+    } else if (ctx.get(0, target)) {
+      if (!ctx.check(1, weight)) return;
+      obj->as<ConsistentHashingLoadBalancer>()->set(target, weight);
+    } else {
+      ctx.error_argument_type(0, "a string or an object");
+    }
+  });
+}
+
+//
+// MaglevLoadBalancer
+//
+
+template<> void ClassDef<MaglevLoadBalancer>::init() {
+  super<ConsistentHashingLoadBalancer>();
+
+  ctor([](Context &ctx) -> Object* {
+    Object *targets = nullptr;
+    Cache *unhealthy = nullptr;
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &targets, &unhealthy, &options)) return nullptr;
+    try {
+      return MaglevLoadBalancer::make(targets, unhealthy, ConsistentHashingLoadBalancer::Options(options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+}
+
+template<> void ClassDef<Constructor<MaglevLoadBalancer>>::init() {
+  super<Function>();
+  ctor();
+}
+
+//
+// RingHashLoadBalancer
+//
+
+template<> void ClassDef<RingHashLoadBalancer>::init() {
+  super<ConsistentHashingLoadBalancer>();
+
+  ctor([](Context &ctx) -> Object* {
+    Object *targets = nullptr;
+    Cache *unhealthy = nullptr;
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &targets, &unhealthy, &options)) return nullptr;
+    try {
+      return RingHashLoadBalancer::make(targets, unhealthy, ConsistentHashingLoadBalancer::Options(options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+}
+
+template<> void ClassDef<Constructor<RingHashLoadBalancer>>::init() {
+  super<Function>();
+  ctor();
+}
+
 //
 // ResourcePool
 //
@@ -2038,10 +4750,13 @@ template<> void ClassDef<Constructor<ResourcePool>>::init() {
 
 template<> void ClassDef<Percentile>::init() {
   ctor([](Context &ctx) -> Object* {
-    Array *buckets;
+    Object *buckets;
     if (!ctx.check(0, buckets)) return nullptr;
     try {
-      return Percentile::make(buckets);
+      if (!buckets || !buckets->is_array()) {
+        return Percentile::make(Percentile::LogLinear(buckets));
+      }
+      return Percentile::make(buckets->as<Array>());
     } catch (std::runtime_error &err) {
       ctx.error(err);
       return nullptr;
@@ -2059,7 +4774,7 @@ template<> void ClassDef<Percentile>::init() {
   });
 
   method("calculate", [](Context &ctx, Object *obj, Value &ret) {
-    int percentage;
+    double percentage;
     if (!ctx.arguments(1, &percentage)) return;
     ret.set(obj->as<Percentile>()->calculate(percentage));
   });
@@ -2070,6 +4785,107 @@ template<> void ClassDef<Constructor<Percentile>>::init() {
   ctor();
 }
 
+//
+// LoadGen
+//
+
+template<> void ClassDef<LoadGen>::init() {
+  ctor([](Context &ctx) -> Object* {
+    pipy::PipelineLayoutWrapper *layout;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &layout, &options)) return nullptr;
+    if (!layout) {
+      ctx.error_argument_type(0, "a pipeline layout");
+      return nullptr;
+    }
+    try {
+      return LoadGen::make(layout->get(), LoadGen::Options(options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  method("start", [](Context &ctx, Object *obj, Value &ret) {
+    ret.set(obj->as<LoadGen>()->start());
+  });
+
+  method("stop", [](Context &ctx, Object *obj, Value &ret) {
+    obj->as<LoadGen>()->stop();
+  });
+
+  method("report", [](Context &ctx, Object *obj, Value &ret) {
+    ret.set(obj->as<LoadGen>()->report());
+  });
+}
+
+template<> void ClassDef<Constructor<LoadGen>>::init() {
+  super<Function>();
+  ctor();
+}
+
+//
+// PatternSet
+//
+
+template<> void ClassDef<PatternSet>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Array *patterns;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &patterns, &options)) return nullptr;
+    try {
+      return PatternSet::make(patterns, PatternSet::Options(options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  accessor("size", [](Object *obj, Value &ret) { ret.set(int(obj->as<PatternSet>()->size())); });
+
+  method("scan", [](Context &ctx, Object *obj, Value &ret) {
+    pipy::Data *data;
+    Str *str;
+    auto scanner = obj->as<PatternSet>()->scanner();
+    pjs::Ref<PatternSet::Scanner> ref(scanner);
+    if (ctx.try_arguments(1, &data) && data) {
+      ret.set(scanner->scan(*data));
+    } else if (ctx.try_arguments(1, &str)) {
+      ret.set(scanner->scan(str->c_str(), str->size()));
+    } else {
+      ctx.error_argument_type(0, "a Data or a string");
+    }
+  });
+
+  method("scanner", [](Context &ctx, Object *obj, Value &ret) {
+    ret.set(obj->as<PatternSet>()->scanner());
+  });
+}
+
+template<> void ClassDef<PatternSet::Scanner>::init() {
+  method("scan", [](Context &ctx, Object *obj, Value &ret) {
+    pipy::Data *data;
+    Str *str;
+    auto scanner = obj->as<PatternSet::Scanner>();
+    if (ctx.try_arguments(1, &data) && data) {
+      ret.set(scanner->scan(*data));
+    } else if (ctx.try_arguments(1, &str)) {
+      ret.set(scanner->scan(str->c_str(), str->size()));
+    } else {
+      ctx.error_argument_type(0, "a Data or a string");
+    }
+  });
+
+  method("reset", [](Context &ctx, Object *obj, Value &ret) {
+    obj->as<PatternSet::Scanner>()->reset();
+  });
+}
+
+template<> void ClassDef<Constructor<PatternSet>>::init() {
+  super<Function>();
+  ctor();
+}
+
 //
 // Algo
 //
@@ -2080,12 +4896,21 @@ template<> void ClassDef<Algo>::init() {
   variable("Quota", class_of<Constructor<Quota>>());
   variable("SharedMap", class_of<Constructor<SharedMap>>());
   variable("URLRouter", class_of<Constructor<URLRouter>>());
+  variable("RouteTable", class_of<Constructor<RouteTable>>());
   variable("LoadBalancer", class_of<Constructor<LoadBalancer>>());
   variable("HashingLoadBalancer", class_of<Constructor<HashingLoadBalancer>>());
   variable("RoundRobinLoadBalancer", class_of<Constructor<RoundRobinLoadBalancer>>());
   variable("LeastWorkLoadBalancer", class_of<Constructor<LeastWorkLoadBalancer>>());
+  variable("PeakEwmaLoadBalancer", class_of<Constructor<PeakEwmaLoadBalancer>>());
+  variable("MaglevLoadBalancer", class_of<Constructor<MaglevLoadBalancer>>());
+  variable("RingHashLoadBalancer", class_of<Constructor<RingHashLoadBalancer>>());
+  variable("HealthCheck", class_of<Constructor<HealthCheck>>());
+  variable("CircuitBreaker", class_of<Constructor<algo::CircuitBreaker>>());
+  variable("AffinityTable", class_of<Constructor<algo::AffinityTable>>());
   variable("ResourcePool", class_of<Constructor<ResourcePool>>());
   variable("Percentile", class_of<Constructor<Percentile>>());
+  variable("LoadGen", class_of<Constructor<LoadGen>>());
+  variable("PatternSet", class_of<Constructor<PatternSet>>());
 
   method("hash", [](Context &ctx, Object *obj, Value &ret) {
     Value value;
@@ -27,19 +27,32 @@
 #define ALGO_HPP
 
 #include "pjs/pjs.hpp"
+#include "event.hpp"
 #include "list.hpp"
 #include "net.hpp"
 #include "timer.hpp"
 #include "options.hpp"
+#include "health-check.hpp"
+#include "circuit-breaker.hpp"
+#include "affinity-table.hpp"
 
 #include <atomic>
+#include <deque>
+#include <functional>
 #include <limits>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace pipy {
+
+class Pipeline;
+class PipelineLayout;
+
 namespace algo {
 
 //
@@ -48,9 +61,16 @@ namespace algo {
 
 class Cache : public pjs::ObjectTemplate<Cache> {
 public:
+  enum class Policy {
+    LRU,
+    TINYLFU,
+  };
+
   struct Options : public pipy::Options {
     int size = 0;
     double ttl = 0;
+    Policy policy = Policy::LRU;
+    pjs::Ref<pjs::Function> on_evict;
 
     Options() {}
     Options(pjs::Object *options);
@@ -66,6 +86,10 @@ public:
   bool remove(pjs::Context &ctx, const pjs::Value &key);
   bool clear(pjs::Context &ctx);
 
+  auto hits() const -> uint64_t { return m_hits; }
+  auto misses() const -> uint64_t { return m_misses; }
+  auto evictions() const -> uint64_t { return m_evictions; }
+
 private:
   Cache(const Options &options, pjs::Function *allocate = nullptr, pjs::Function *free = nullptr);
   ~Cache();
@@ -75,21 +99,39 @@ private:
     double ttl;
   };
 
+  class TinyLFU;
+
+  // Called for entries dropped by the cache itself, with expired
+  // telling apart those that outlived their TTL from those that
+  // made room for others
+  typedef std::function<bool(const pjs::Value &, const pjs::Value &, bool expired)> Evict;
+
   Options m_options;
   pjs::Ref<pjs::Function> m_allocate;
   pjs::Ref<pjs::Function> m_free;
   pjs::Ref<pjs::OrderedHash<pjs::Value, Entry>> m_cache;
+  std::unique_ptr<TinyLFU> m_lfu;
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+  uint64_t m_evictions = 0;
 
   bool get(
     const pjs::Value &key, pjs::Value &value,
-    const std::function<bool(pjs::Value &)> &allocate
+    const std::function<bool(pjs::Value &)> &allocate,
+    const Evict &evict
   );
 
   void set(
     const pjs::Value &key, const pjs::Value &value,
-    const std::function<bool(const pjs::Value &, const pjs::Value &)> &free
+    const Evict &evict
   );
 
+  bool lookup(const pjs::Value &key, Entry &entry);
+  bool peek(const pjs::Value &key, Entry &entry);
+  bool erase(const pjs::Value &key);
+  void insert(const pjs::Value &key, const Entry &entry, const Evict &evict);
+  auto evict_function(pjs::Context &ctx) -> Evict;
+
   friend class pjs::ObjectTemplate<Cache>;
 };
 
@@ -104,10 +146,75 @@ public:
     double max = std::numeric_limits<double>::infinity();
     double per = 0;
     double produce = 0;
+    bool distributed = false;
+    bool cluster = false;
+    double accuracy = 0.01;
+    size_t quantum = 0;
     Options() {}
     Options(pjs::Object *options);
   };
 
+  //
+  // Quota::Cluster
+  //
+  // Keeps keyed counters of the cluster option in step across pipy
+  // instances. Every instance owns one entry of a G-counter per key: the
+  // total it has ever consumed from its own bucket. Totals are sent to
+  // all peers over UDP every interval, changed ones only except for a
+  // full round every FULL_ROUND_INTERVALS, and merged by taking the max.
+  // Whatever a peer's total has grown by is taken from the local bucket,
+  // so each bucket drains at the rate of the whole cluster while every
+  // decision stays local. An instance can overshoot the global limit by
+  // no more than what the rest of the cluster consumes in one interval.
+  //
+
+  class Cluster {
+  public:
+    struct Options : public pipy::Options {
+      std::string listen;
+      std::vector<std::string> peers;
+      double interval = 0.1;
+      Options() {}
+      Options(pjs::Object *options);
+    };
+
+    static void join(const Options &options);
+
+  private:
+    static const int FULL_ROUND_INTERVALS = 10;
+    static const int PEER_TIMEOUT_INTERVALS = 50;
+    static const size_t MAX_DATAGRAM_SIZE = 1400;
+
+    struct Peer {
+      std::unordered_map<std::string, double> totals;
+      double last_seen = 0;
+    };
+
+    Cluster();
+
+    std::string m_listen;
+    std::vector<std::string> m_peer_names;
+    std::vector<asio::ip::udp::endpoint> m_peers;
+    double m_interval = 0.1;
+    uint64_t m_node_id;
+    asio::ip::udp::socket m_socket;
+    asio::ip::udp::endpoint m_from;
+    uint8_t m_buffer[64 * 1024];
+    std::unordered_map<uint64_t, Peer> m_remote;
+    std::unordered_map<std::string, double> m_sent;
+    int m_round = 0;
+    Timer m_timer;
+
+    static auto get() -> Cluster*;
+
+    void configure(const Options &options);
+    void receive();
+    void on_receive(size_t size);
+    void gossip();
+
+    static Cluster* s_cluster;
+  };
+
   //
   // Quota::Counter
   //
@@ -119,18 +226,22 @@ public:
       double initial_value,
       double maximum_value,
       double produce_value,
-      double produce_cycle
+      double produce_cycle,
+      double accuracy,
+      bool clustered = false
     ) -> Counter*;
 
     void init(
       double initial_value,
       double maximum_value,
       double produce_value,
-      double produce_cycle
+      double produce_cycle,
+      double accuracy,
+      bool clustered = false
     );
 
     auto initial() const -> double { return m_initial_value; }
-    auto current() const -> double { return m_current_value.load(); }
+    auto current() const -> double;
     void produce(double value);
     auto consume(double value) -> double;
     void enqueue(Quota *quota);
@@ -142,10 +253,25 @@ public:
       double initial_value,
       double maximum_value,
       double produce_value,
-      double produce_cycle
+      double produce_cycle,
+      double accuracy,
+      bool clustered
     );
     ~Counter();
 
+    //
+    // Quota::Counter::Slice
+    //
+    // Tokens borrowed from the shared bucket by one worker thread in
+    // distributed mode. Only the owning thread changes it.
+    //
+
+    struct Slice {
+      std::atomic<double> tokens;
+      char padding[64 - sizeof(std::atomic<double>)];
+      Slice() : tokens(0) {}
+    };
+
     Net& m_net;
     std::string m_key;
     std::atomic<double> m_initial_value;
@@ -153,11 +279,17 @@ public:
     std::atomic<double> m_produce_value;
     std::atomic<double> m_produce_cycle;
     std::atomic<double> m_current_value;
+    std::atomic<double> m_accuracy;
+    std::atomic<bool> m_clustered;
+    std::atomic<double> m_consumed;
     std::atomic<bool> m_is_producing_scheduled;
+    std::vector<Slice> m_slices;
     std::set<Quota*> m_quotas;
     std::mutex m_quotas_mutex;
     Timer m_timer;
 
+    auto local_slice() -> Slice*;
+    auto take(double value, bool remote = false) -> double;
     void schedule_producing();
     void on_produce();
     void finalize();
@@ -166,6 +298,7 @@ public:
     static std::mutex m_counter_map_mutex;
 
     friend class pjs::RefCountMT<Counter>;
+    friend class Cluster;
   };
 
   //
@@ -184,6 +317,7 @@ public:
     }
 
     pjs::Ref<Quota> m_quota;
+    double m_deficit = 0;
 
     friend class Quota;
   };
@@ -208,6 +342,7 @@ private:
   double m_current_value;
   bool m_is_producing_scheduled = false;
   List<Consumer> m_consumers;
+  Consumer* m_granted = nullptr;
   Timer m_timer;
 
   void schedule_producing();
@@ -248,29 +383,81 @@ private:
     void clear();
     bool erase(pjs::Str::CharData *key);
     bool has(pjs::Str::CharData *key);
-    bool get(pjs::Str::CharData *key, pjs::SharedValue &value);
-    void set(pjs::Str::CharData *key, const pjs::SharedValue &value);
+    bool get(pjs::Str::CharData *key, pjs::Value &value);
+    void set(pjs::Str::CharData *key, const pjs::Value &value);
     auto add(pjs::Str::CharData *key, double value) -> double;
-    auto sub(pjs::Str::CharData *key, double value) -> double;
 
   private:
-    typedef pjs::Ref<pjs::Str::CharData> Key;
+    enum { SHARD_COUNT = 64 };
+
+    //
+    // SharedMap::Map::Lock
+    //
+    // Readers only bump a shared count so that they never block one
+    // another. A writer waits for the count to drop to zero, and flags
+    // itself as waiting so that no new readers get in meanwhile.
+    //
+
+    class Lock {
+    public:
+      void lock_shared();
+      void unlock_shared() { m_state.fetch_sub(1, std::memory_order_release); }
+      void lock();
+      void unlock() { m_state.fetch_and(~WRITER_LOCKED, std::memory_order_release); }
+
+    private:
+      enum {
+        WRITER_WAITING = 1 << 29,
+        WRITER_LOCKED = 1 << 30,
+      };
+
+      std::atomic<int> m_state;
+
+    public:
+      Lock() : m_state(0) {}
+    };
+
+    struct Key {
+      pjs::Ref<pjs::Str::CharData> data;
+      size_t hash;
+    };
 
     struct Hash {
       size_t operator()(const Key &k) const {
-        std::hash<std::string> h;
-        return h(k->str());
+        return k.hash;
       }
     };
 
     struct EqualTo {
       bool operator()(const Key &a, const Key &b) const {
-        return a->str() == b->str();
+        return a.hash == b.hash && a.data->str() == b.data->str();
       }
     };
 
-    std::unordered_map<Key, pjs::SharedValue, Hash, EqualTo> m_map;
-    std::mutex m_mutex;
+    //
+    // Numbers are kept apart from other values so that add() and
+    // sub() can update them with a CAS under the shared lock.
+    //
+
+    struct Entry {
+      pjs::SharedValue value;
+      std::atomic<double> number;
+      bool is_number = false;
+      Entry() : number(0) {}
+    };
+
+    struct Shard {
+      Lock lock;
+      char padding[64 - sizeof(Lock)];
+      std::unordered_map<Key, Entry, Hash, EqualTo> map;
+    };
+
+    Shard m_shards[SHARD_COUNT];
+
+    static auto key_of(pjs::Str::CharData *data) -> Key;
+    auto shard_of(const Key &key) -> Shard& {
+      return m_shards[(key.hash ^ (key.hash >> 16)) % SHARD_COUNT];
+    }
 
     static std::map<std::string, Map*> m_maps;
     static std::mutex m_maps_mutex;
@@ -311,43 +498,163 @@ private:
 
 class URLRouter : public pjs::ObjectTemplate<URLRouter> {
 public:
+  enum { MAX_CAPTURES = 16 };
+
+  //
+  // URLRouter::Options
+  //
+  // With `params` off, patterns keep their original meaning: `:` and
+  // any `*` other than a trailing `/*` are plain characters, and a `*`
+  // domain is a literal host name. With `params` on, `:name` segments
+  // capture a path segment, a `*` anywhere but at the end is rejected
+  // and a `*` domain matches any host, including none.
+  //
+
+  struct Options : public pipy::Options {
+    bool params = false;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  //
+  // URLRouter::Match
+  //
+
+  struct Match {
+    struct Capture {
+      pjs::Str* name;
+      const char* str;
+      size_t len;
+    };
+
+    Capture captures[MAX_CAPTURES];
+    int count = 0;
+
+    auto params() const -> pjs::Object*;
+  };
+
   void add(const std::string &url, const pjs::Value &value);
   bool find(const std::string &url, pjs::Value &value);
+  bool find(const char *url, size_t len, pjs::Value &value, Match *match = nullptr);
 
 private:
-  URLRouter();
-  URLRouter(pjs::Object *rules);
+  URLRouter(const Options &options = Options());
+  URLRouter(pjs::Object *rules, const Options &options = Options());
   ~URLRouter();
 
+  //
+  // URLRouter::Node
+  //
+  // A node in a compressed radix trie. Static edges carry the bytes
+  // they consume in `prefix` and are kept in a contiguous array looked
+  // up by their first byte in `indices`. A `:name` segment and a
+  // trailing `*` hang off a node as separate children so that static
+  // edges are always tried first. Without the `params` option, only
+  // the trailing `*` is ever used.
+  //
+
   struct Node {
-    std::map<std::string, Node*> children;
+    std::string prefix;
+    std::string indices;
+    std::vector<Node*> children;
+    Node* param = nullptr;
+    Node* wildcard = nullptr;
+    Node* routes = nullptr;
+    pjs::Ref<pjs::Str> param_name;
     pjs::Value value;
-
-    auto child(const std::string &name) -> Node* {
-      auto i = children.find(name);
-      return i == children.end() ? nullptr : i->second;
-    }
-
-    auto new_child(const std::string &name) -> Node* {
-      auto i = children.find(name);
-      if (i != children.end()) return i->second;
-      return children[name] = new Node;
-    }
+    bool has_value = false;
 
     ~Node() {
-      for (auto &i : children) {
-        delete i.second;
-      }
+      for (auto *c : children) delete c;
+      delete param;
+      delete wildcard;
+      delete routes;
     }
   };
 
-  Node* m_root;
+  Options m_options;
+  Node m_hosts;
+  Node m_wildcard_hosts;
+  Node m_paths;
+
+  static auto insert(Node *node, const char *str, size_t len) -> Node*;
+  auto insert_path(Node *node, const std::string &path) -> Node*;
+  static auto lookup(Node *node, const char *str, size_t len) -> Node*;
+  static auto lookup_path(Node *node, const char *str, size_t len, Match &match) -> Node*;
+  static auto lookup_routes(Node *node, const char *str, size_t len, Match &match) -> Node*;
 
   void dump(Node *node, int level);
 
   friend class pjs::ObjectTemplate<URLRouter>;
 };
 
+//
+// RouteTable
+//
+// Routes given as host/path patterns, header matchers and weighted
+// upstreams, compiled into one decision structure. A URLRouter lookup
+// per host tier (exact, wildcard, any) narrows a request down to the
+// few routes sharing its pattern, which are then checked in order.
+// Only custom predicates call back into script. An update compiles a
+// new table and swaps it in as a whole.
+//
+
+class RouteTable : public pjs::ObjectTemplate<RouteTable> {
+public:
+
+  //
+  // RouteTable::Result
+  //
+
+  struct Result {
+    pjs::Ref<pjs::Object> route;
+    pjs::Ref<pjs::Str> upstream;
+    pjs::Ref<pjs::Object> params;
+  };
+
+  void update(pjs::Object *routes);
+  bool find(pjs::Context &ctx, pjs::Object *head, Result &result);
+
+private:
+  RouteTable(pjs::Object *routes);
+  ~RouteTable();
+
+  struct Header {
+    pjs::Ref<pjs::Str> name;
+    pjs::Ref<pjs::Str> value;
+    pjs::Ref<pjs::RegExp> pattern;
+  };
+
+  struct Upstream {
+    pjs::Ref<pjs::Str> target;
+    int weight;
+    int current;
+  };
+
+  struct Route {
+    pjs::Ref<pjs::Object> config;
+    pjs::Ref<pjs::Str> method;
+    pjs::Ref<pjs::Function> when;
+    std::vector<Header> headers;
+    std::vector<Upstream> upstreams;
+    int total_weight = 0;
+  };
+
+  struct Table {
+    pjs::Ref<URLRouter> routers[3];
+    std::vector<Route> routes;
+    std::vector<std::vector<int>> groups;
+  };
+
+  std::shared_ptr<Table> m_table;
+
+  static auto compile(pjs::Object *routes) -> Table*;
+  static bool match(pjs::Context &ctx, Route &route, pjs::Object *head, pjs::Str *method, pjs::Object *headers);
+  static auto pick(Route &route) -> pjs::Str*;
+
+  friend class pjs::ObjectTemplate<RouteTable>;
+};
+
 //
 // LoadBalancer
 //
@@ -459,6 +766,82 @@ private:
   friend class pjs::ObjectTemplate<LoadBalancer>;
 };
 
+//
+// HealthCheck
+//
+
+class HealthCheck : public pjs::ObjectTemplate<HealthCheck> {
+public:
+  bool is_healthy(pjs::Str *target);
+  void report(pjs::Str *target, bool ok);
+
+private:
+  HealthCheck(const HealthChecker::Options &options);
+  ~HealthCheck();
+
+  struct Entry {
+    pjs::Ref<pjs::Str> name;
+    std::shared_ptr<HealthChecker::Target> target;
+  };
+
+  std::shared_ptr<HealthChecker> m_checker;
+  std::map<pjs::Str*, Entry> m_targets;
+
+  auto get(pjs::Str *target) -> HealthChecker::Target*;
+
+  friend class pjs::ObjectTemplate<HealthCheck>;
+};
+
+//
+// CircuitBreaker
+//
+
+class CircuitBreaker : public pjs::ObjectTemplate<CircuitBreaker> {
+public:
+  bool allow(pjs::Str *target);
+  void select(pjs::Str *target);
+  void report(pjs::Str *target, bool ok);
+  auto state(pjs::Str *target) -> pipy::CircuitBreaker::State;
+
+private:
+  CircuitBreaker(const pipy::CircuitBreaker::Options &options);
+  ~CircuitBreaker();
+
+  struct Entry {
+    pjs::Ref<pjs::Str> name;
+    std::shared_ptr<pipy::CircuitBreaker::Target> target;
+  };
+
+  std::shared_ptr<pipy::CircuitBreaker> m_breaker;
+  std::map<pjs::Str*, Entry> m_targets;
+
+  auto get(pjs::Str *target) -> pipy::CircuitBreaker::Target*;
+
+  friend class pjs::ObjectTemplate<CircuitBreaker>;
+};
+
+//
+// AffinityTable
+//
+
+class AffinityTable : public pjs::ObjectTemplate<AffinityTable> {
+public:
+  auto find(const pjs::Value &key) -> pjs::Str*;
+  void bind(const pjs::Value &key, pjs::Str *target);
+  void unbind(const pjs::Value &key);
+
+private:
+  AffinityTable(pjs::Str *name, const pipy::AffinityTable::Options &options);
+
+  std::shared_ptr<pipy::AffinityTable> m_table;
+  std::vector<pjs::Ref<pjs::Str>> m_targets;
+  std::map<pjs::Ref<pjs::Str>, int> m_target_indices;
+
+  static auto hash(const pjs::Value &key) -> uint64_t;
+
+  friend class pjs::ObjectTemplate<AffinityTable>;
+};
+
 //
 // LoadBalancerBase
 //
@@ -488,7 +871,24 @@ public:
   auto borrow(pjs::Object *borrower, const pjs::Value &target_key = pjs::Value::undefined, Cache *unhealthy = nullptr) -> Resource*;
 
   virtual auto select(const pjs::Value &key, Cache *unhealthy) -> pjs::Str* = 0;
-  virtual void deselect(pjs::Str *id) = 0;
+
+  // A negative latency means none was measured
+  virtual void deselect(pjs::Str *id, double latency = -1) = 0;
+
+  // Reports the latency of one request to a target without deselecting it,
+  // for when a borrowed resource serves many requests
+  virtual void observe(pjs::Str *id, double latency) {}
+
+  // Selects a given target if it is still in the set and can be used,
+  // counting it the same way as select() does
+  virtual auto pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* = 0;
+
+  // Goes through the affinity table when there is one and a key is given
+  auto select_target(const pjs::Value &key, Cache *unhealthy) -> pjs::Str*;
+
+  void health_check(HealthCheck *hc) { m_health_check = hc; }
+  void circuit_breaker(CircuitBreaker *cb) { m_circuit_breaker = cb; }
+  void affinity(AffinityTable *at) { m_affinity = at; }
 
 protected:
   LoadBalancerBase(Cache *unhealthy) : m_unhealthy(unhealthy) {}
@@ -532,6 +932,9 @@ private:
   std::map<pjs::WeakRef<pjs::Object>, Session*> m_sessions;
   std::map<pjs::Ref<pjs::Str>, Target*> m_targets;
   pjs::Ref<Cache> m_unhealthy;
+  pjs::Ref<HealthCheck> m_health_check;
+  pjs::Ref<CircuitBreaker> m_circuit_breaker;
+  pjs::Ref<AffinityTable> m_affinity;
 
   void close_session(Session *session);
 
@@ -548,7 +951,8 @@ public:
   void add(pjs::Str *target);
 
   virtual auto select(const pjs::Value &key, Cache *unhealthy) -> pjs::Str* override;
-  virtual void deselect(pjs::Str *target) override {}
+  virtual void deselect(pjs::Str *target, double latency) override {}
+  virtual auto pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* override;
 
 private:
   HashingLoadBalancer(pjs::Object *targets, Cache *unhealthy = nullptr);
@@ -569,7 +973,8 @@ public:
   void set(pjs::Str *target, int weight);
 
   virtual auto select(const pjs::Value &key, Cache *unhealthy) -> pjs::Str* override;
-  virtual void deselect(pjs::Str *target) override {}
+  virtual void deselect(pjs::Str *target, double latency) override {}
+  virtual auto pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* override;
 
 private:
   RoundRobinLoadBalancer(pjs::Object *targets, Cache *unhealthy = nullptr);
@@ -601,7 +1006,8 @@ public:
   void set(pjs::Str *target, double weight);
 
   virtual auto select(const pjs::Value &key, Cache *unhealthy) -> pjs::Str* override;
-  virtual void deselect(pjs::Str *target) override;
+  virtual void deselect(pjs::Str *target, double latency) override;
+  virtual auto pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* override;
 
 private:
   LeastWorkLoadBalancer(pjs::Object *targets, Cache *unhealthy = nullptr);
@@ -620,30 +1026,348 @@ private:
   friend class pjs::ObjectTemplate<LeastWorkLoadBalancer, LoadBalancerBase>;
 };
 
+//
+// ConsistentHashingLoadBalancer
+//
+
+class ConsistentHashingLoadBalancer : public pjs::ObjectTemplate<ConsistentHashingLoadBalancer, LoadBalancerBase> {
+public:
+  struct Options : public pipy::Options {
+    double load_factor = 1.25;
+    int table_size = 65537;
+    int replicas = 100;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  void set(pjs::Object *targets);
+  void set(pjs::Str *target, double weight);
+
+  virtual auto select(const pjs::Value &key, Cache *unhealthy) -> pjs::Str* override;
+  virtual void deselect(pjs::Str *target, double latency) override;
+  virtual auto pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* override;
+
+protected:
+  struct Target {
+    pjs::Ref<pjs::Str> id;
+    uint64_t hash;
+    double weight;
+    int load;
+    int visit;
+    bool healthy;
+    bool removed;
+  };
+
+  ConsistentHashingLoadBalancer(Cache *unhealthy, const Options &options)
+    : pjs::ObjectTemplate<ConsistentHashingLoadBalancer, LoadBalancerBase>(unhealthy)
+    , m_options(options) {}
+
+  static auto mix(uint64_t h) -> uint64_t;
+
+  Options m_options;
+  std::vector<std::unique_ptr<Target>> m_targets;
+
+  virtual void on_add(Target *t) = 0;
+  virtual void on_remove(Target *t) = 0;
+  virtual void on_health_change() = 0;
+
+  // Visits targets in probing order until the callback returns false
+  virtual void lookup(uint64_t hash, const std::function<bool(Target*)> &cb) = 0;
+
+private:
+  std::map<pjs::Str*, Target*> m_target_map;
+  double m_healthy_weight = 0;
+  double m_health_check_time = 0;
+  int m_total_load = 0;
+  int m_visit = 0;
+
+  void check_health(Cache *unhealthy);
+  void update_weight();
+
+  friend class pjs::ObjectTemplate<ConsistentHashingLoadBalancer, LoadBalancerBase>;
+};
+
+//
+// MaglevLoadBalancer
+//
+
+class MaglevLoadBalancer : public pjs::ObjectTemplate<MaglevLoadBalancer, ConsistentHashingLoadBalancer> {
+private:
+  MaglevLoadBalancer(pjs::Object *targets, Cache *unhealthy = nullptr, const Options &options = Options());
+  ~MaglevLoadBalancer() {}
+
+  std::vector<Target*> m_table;
+  bool m_dirty = true;
+
+  virtual void on_add(Target *t) override { m_dirty = true; }
+  virtual void on_remove(Target *t) override { m_dirty = true; }
+  virtual void on_health_change() override { m_dirty = true; }
+  virtual void lookup(uint64_t hash, const std::function<bool(Target*)> &cb) override;
+
+  void build();
+
+  friend class pjs::ObjectTemplate<MaglevLoadBalancer, ConsistentHashingLoadBalancer>;
+};
+
+//
+// RingHashLoadBalancer
+//
+
+class RingHashLoadBalancer : public pjs::ObjectTemplate<RingHashLoadBalancer, ConsistentHashingLoadBalancer> {
+private:
+  RingHashLoadBalancer(pjs::Object *targets, Cache *unhealthy = nullptr, const Options &options = Options());
+  ~RingHashLoadBalancer() {}
+
+  std::vector<std::pair<uint64_t, Target*>> m_ring;
+
+  virtual void on_add(Target *t) override;
+  virtual void on_remove(Target *t) override;
+  virtual void on_health_change() override {}
+  virtual void lookup(uint64_t hash, const std::function<bool(Target*)> &cb) override;
+
+  friend class pjs::ObjectTemplate<RingHashLoadBalancer, ConsistentHashingLoadBalancer>;
+};
+
+//
+// PeakEwmaLoadBalancer
+//
+
+class PeakEwmaLoadBalancer : public pjs::ObjectTemplate<PeakEwmaLoadBalancer, LoadBalancerBase> {
+public:
+  void set(pjs::Object *targets);
+  void set(pjs::Str *target, double weight);
+
+  virtual auto select(const pjs::Value &key, Cache *unhealthy) -> pjs::Str* override;
+  virtual void deselect(pjs::Str *target, double latency) override;
+  virtual void observe(pjs::Str *target, double latency) override;
+  virtual auto pick(pjs::Str *target, Cache *unhealthy) -> pjs::Str* override;
+
+private:
+  PeakEwmaLoadBalancer(pjs::Object *targets, Cache *unhealthy = nullptr, double decay_time = 10);
+  ~PeakEwmaLoadBalancer();
+
+  struct Target {
+    pjs::Ref<pjs::Str> id;
+    double weight;
+    double ewma;
+    double stamp;
+    int pending;
+    bool removed;
+  };
+
+  std::vector<std::unique_ptr<Target>> m_targets;
+  std::map<pjs::Str*, Target*> m_target_map;
+  pjs::Ref<Cache> m_target_cache;
+  double m_decay_time;
+  uint32_t m_random;
+
+  auto random() -> uint32_t;
+  auto cost(Target *t, double now) -> double;
+  void record(Target *t, double latency);
+
+  friend class pjs::ObjectTemplate<PeakEwmaLoadBalancer, LoadBalancerBase>;
+};
+
 //
 // Percentile
 //
 
 class Percentile : public pjs::ObjectTemplate<Percentile> {
 public:
+
+  //
+  // Percentile::LogLinear
+  //
+  // Bucket layout in the style of HDR histograms: every power of two
+  // above the lowest value is split into 2^precision equal sub-buckets,
+  // so the relative error stays below 1/2^precision across the range.
+  // Samples are placed with a frexp() rather than a search.
+  //
+
+  struct LogLinear : public pipy::Options {
+    double lowest = 0.001;
+    double highest = 3600 * 1000;
+    int precision = 3;
+    LogLinear() {}
+    LogLinear(pjs::Object *options);
+  };
+
   void reset();
   auto size() const -> size_t { return m_buckets.size(); }
   auto get(int bucket) -> size_t;
   void set(int bucket, size_t count);
-  void observe(double sample);
-  auto calculate(int percentage) -> double;
+  auto observe(double sample) -> int;
+  auto calculate(double percentage) -> double;
   void dump(const std::function<void(double, size_t)> &cb);
+  auto buckets() const -> pjs::Array*;
 
 private:
   Percentile(pjs::Array *buckets);
+  Percentile(const LogLinear &layout);
+  Percentile(Percentile *layout);
 
   std::vector<size_t> m_counts;
   std::vector<double> m_buckets;
   size_t m_sample_count;
+  double m_lowest = 0;
+  int m_precision = 0;
+
+  auto locate(double sample) const -> int;
 
   friend class pjs::ObjectTemplate<Percentile>;
 };
 
+//
+// LoadGen
+//
+// Starts pipeline instances at a fixed arrival rate regardless of how
+// fast earlier ones complete. Latency is measured from the time a request
+// was due rather than when it actually got started, so that stalls of
+// the event loop or the in-flight limit do not hide behind fewer samples,
+// which is the coordinated omission of closed-loop load generators.
+//
+
+class LoadGen : public pjs::ObjectTemplate<LoadGen> {
+public:
+  struct Options : public pipy::Options {
+    double rate = 100;
+    double duration = 10;
+    int max_in_flight = 0;
+    pjs::Ref<pjs::Object> request;
+    pjs::Ref<pjs::Object> latency;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  auto start() -> pjs::Promise*;
+  void stop();
+  auto report() -> pjs::Object*;
+
+private:
+  LoadGen(PipelineLayout *layout, const Options &options);
+  ~LoadGen();
+
+  //
+  // LoadGen::Request
+  //
+
+  class Request :
+    public pjs::Pooled<Request>,
+    public List<Request>::Item,
+    public EventSource
+  {
+  public:
+    Request(LoadGen *lg, double due);
+    ~Request();
+    void start(uint64_t index);
+    void abort();
+  private:
+    LoadGen* m_load_gen;
+    double m_due;
+    pjs::Ref<Pipeline> m_pipeline;
+    virtual void on_reply(Event *evt) override;
+  };
+
+  pjs::Ref<PipelineLayout> m_layout;
+  Options m_options;
+  pjs::Ref<pjs::Object> m_latency;
+  pjs::Ref<pjs::Promise::Settler> m_settler;
+  Timer m_timer;
+  List<Request> m_requests;
+  std::deque<double> m_backlog;
+  double m_start_time = 0;
+  double m_end_time = 0;
+  uint64_t m_total = 0;
+  uint64_t m_scheduled = 0;
+  uint64_t m_started = 0;
+  uint64_t m_completed = 0;
+  uint64_t m_errors = 0;
+  double m_max_lag = 0;
+  bool m_running = false;
+
+  void tick();
+  void send(double due);
+  void observe(double latency);
+  void on_complete(Request *req, bool ok);
+  void check_ending();
+
+  static auto clock() -> double;
+
+  friend class pjs::ObjectTemplate<LoadGen>;
+};
+
+//
+// PatternSet
+//
+// Literal patterns compiled into one Aho-Corasick automaton with the
+// failure links folded into a full byte transition table, so that a scan
+// costs one table lookup per byte no matter how many patterns there are.
+//
+
+class PatternSet : public pjs::ObjectTemplate<PatternSet> {
+public:
+
+  //
+  // PatternSet::Options
+  //
+
+  struct Options : public pipy::Options {
+    bool ignore_case = false;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  //
+  // PatternSet::Scanner
+  //
+  // Keeps the automaton state between calls to scan() so that matches
+  // spanning chunk boundaries in a stream are found. Each pattern ID is
+  // reported at most once until reset().
+  //
+
+  class Scanner : public pjs::ObjectTemplate<Scanner> {
+  public:
+    auto scan(const Data &data) -> pjs::Array*;
+    auto scan(const char *str, size_t len) -> pjs::Array*;
+    void reset();
+
+  private:
+    Scanner(PatternSet *set)
+      : m_set(set), m_seen(set->m_patterns.size(), false) {}
+
+    pjs::Ref<PatternSet> m_set;
+    std::vector<bool> m_seen;
+    int m_state = 0;
+
+    void feed(const uint8_t *p, size_t n, pjs::Array *out);
+
+    friend class pjs::ObjectTemplate<Scanner>;
+  };
+
+  auto size() const -> size_t { return m_patterns.size(); }
+  auto scanner() -> Scanner* { return Scanner::make(this); }
+
+private:
+  PatternSet(pjs::Array *patterns, const Options &options = Options());
+  ~PatternSet() {}
+
+  struct Node {
+    int fail = 0;
+    int output = -1;
+    int next_output = 0;
+  };
+
+  Options m_options;
+  std::vector<pjs::Value> m_patterns;
+  std::vector<Node> m_nodes;
+  std::vector<int> m_table;
+  std::vector<int> m_duplicates;
+
+  void build(const std::vector<std::string> &patterns);
+
+  friend class pjs::ObjectTemplate<PatternSet>;
+};
+
 //
 // Algo
 //
@@ -27,6 +27,7 @@
 #include "api/ip.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <functional>
 
@@ -385,6 +386,403 @@ void BGP::encode(pjs::Object *payload, bool enable_as4, Data &data) {
   data.push(std::move(payload_buffer));
 }
 
+//
+// BGP::RIB
+//
+
+static const size_t RIB_MAX_MESSAGE_SIZE = 4096;
+static const size_t RIB_HEADER_SIZE = 19;
+
+static auto rib_key(uint32_t addr, int len) -> uint64_t {
+  if (len < 32) addr &= len ? ~(0xffffffffu >> len) : 0;
+  return (uint64_t(addr) << 8) | len;
+}
+
+static void rib_write_prefix(std::vector<uint8_t> &buf, uint64_t key) {
+  auto len = int(key & 0xff);
+  auto addr = uint32_t(key >> 8);
+  buf.push_back(len);
+  for (int i = 0; i < (len + 7) / 8; i++) buf.push_back(addr >> (24 - i * 8));
+}
+
+static void rib_write_header(std::vector<uint8_t> &buf) {
+  buf.assign(16, 0xff);
+  buf.push_back(0);
+  buf.push_back(0);
+  buf.push_back(uint8_t(BGP::MessageType::UPDATE));
+}
+
+BGP::RIB::Options::Options(pjs::Object *options) {
+  Value(options, "enableAS4")
+    .get(enable_as4)
+    .check_nullable();
+}
+
+BGP::RIB::PeerOptions::PeerOptions(pjs::Object *options) {
+  Value(options, "routerId")
+    .get(router_id)
+    .check_nullable();
+  Value(options, "ebgp")
+    .get(ebgp)
+    .check_nullable();
+}
+
+BGP::RIB::RIB(const Options &options)
+  : m_options(options)
+{
+}
+
+BGP::RIB::~RIB() {
+  for (const auto &p : m_attrs) delete p.second;
+}
+
+void BGP::RIB::add_peer(pjs::Str *name, const PeerOptions &options) {
+  auto &peer = m_peers[peer_id(name)];
+  uint8_t ip[4];
+  if (options.router_id && utils::get_ip_v4(options.router_id->str(), ip)) {
+    peer.router_id = (uint32_t(ip[0]) << 24) | (uint32_t(ip[1]) << 16) | (uint32_t(ip[2]) << 8) | ip[3];
+  } else {
+    peer.router_id = 0;
+  }
+  peer.ebgp = options.ebgp;
+}
+
+void BGP::RIB::remove_peer(pjs::Str *name) {
+  auto i = m_peer_ids.find(name->str());
+  if (i == m_peer_ids.end()) return;
+  auto id = i->second;
+  if (!m_peers[id].active) return;
+  m_peers[id].active = false;
+  for (auto i = m_dests.begin(); i != m_dests.end(); ) {
+    if (drop(i->first, i->second, id)) {
+      i = m_dests.erase(i);
+    } else {
+      i++;
+    }
+  }
+}
+
+//
+// Takes one or more complete BGP messages as received from the peer.
+// Anything other than UPDATE is ignored.
+//
+
+void BGP::RIB::update(pjs::Str *peer, const Data &data) {
+  auto id = peer_id(peer);
+  m_peers[id].active = true;
+
+  std::vector<uint8_t> buf(data.size());
+  data.to_bytes(buf.data());
+
+  size_t i = 0;
+  while (i < buf.size()) {
+    if (buf.size() - i < RIB_HEADER_SIZE) throw std::runtime_error("incomplete BGP message");
+    size_t size = (size_t(buf[i+16]) << 8) | buf[i+17];
+    if (size < RIB_HEADER_SIZE || i + size > buf.size()) throw std::runtime_error("invalid BGP message length");
+    if (buf[i+18] == uint8_t(MessageType::UPDATE)) {
+      apply_update(id, &buf[i + RIB_HEADER_SIZE], size - RIB_HEADER_SIZE);
+    }
+    i += size;
+  }
+}
+
+auto BGP::RIB::best(pjs::Str *cidr) -> pjs::Object* {
+  const auto &s = cidr->str();
+  auto p = s.find('/');
+  uint8_t ip[4];
+  if (!utils::get_ip_v4(s.substr(0, p), ip)) throw std::runtime_error("invalid IPv4 prefix");
+  int len = (p == std::string::npos ? 32 : std::atoi(s.c_str() + p + 1));
+  if (len < 0 || len > 32) throw std::runtime_error("prefix length out of range");
+
+  auto key = rib_key((uint32_t(ip[0]) << 24) | (uint32_t(ip[1]) << 16) | (uint32_t(ip[2]) << 8) | ip[3], len);
+  auto i = m_dests.find(key);
+  if (i == m_dests.end() || i->second.best < 0) return nullptr;
+
+  const auto &path = i->second.paths[i->second.best];
+  Data data;
+  pack({ { key, path.attrs } }, data);
+  pjs::Ref<pjs::Array> msgs = BGP::decode(data, m_options.enable_as4);
+  pjs::Value msg;
+  msgs->get(0, msg);
+  if (!msg.is<Message>()) return nullptr;
+  auto body = msg.as<Message>()->body.get();
+  if (!body || !body->is<MessageUpdate>()) return nullptr;
+
+  auto obj = pjs::Object::make();
+  obj->set("peer", pjs::Str::make(m_peers[path.peer].name));
+  obj->set("pathAttributes", body->as<MessageUpdate>()->pathAttributes.get());
+  return obj;
+}
+
+void BGP::RIB::flush(Data &out) {
+  std::vector<std::pair<Key, Attrs*>> routes;
+  for (auto key : m_changed) {
+    auto i = m_dests.find(key);
+    if (i == m_dests.end()) continue;
+    auto &dest = i->second;
+    auto attrs = (dest.best >= 0 ? dest.paths[dest.best].attrs : nullptr);
+    if (attrs == dest.advertised) continue;
+    routes.push_back({ key, attrs });
+    if (attrs) attrs->refs++;
+    if (dest.advertised) unref(dest.advertised);
+    dest.advertised = attrs;
+    if (dest.paths.empty()) m_dests.erase(i);
+  }
+  m_changed.clear();
+  pack(routes, out);
+}
+
+void BGP::RIB::dump(Data &out) {
+  std::vector<std::pair<Key, Attrs*>> routes;
+  routes.reserve(m_dests.size());
+  for (const auto &p : m_dests) {
+    const auto &dest = p.second;
+    if (dest.best >= 0) routes.push_back({ p.first, dest.paths[dest.best].attrs });
+  }
+  pack(routes, out);
+}
+
+auto BGP::RIB::peer_id(pjs::Str *name) -> uint16_t {
+  auto i = m_peer_ids.find(name->str());
+  if (i != m_peer_ids.end()) return i->second;
+  if (m_peers.size() > 0xffff) throw std::runtime_error("too many BGP peers");
+  auto id = uint16_t(m_peers.size());
+  m_peers.emplace_back();
+  m_peers.back().name = name->str();
+  m_peer_ids[name->str()] = id;
+  return id;
+}
+
+//
+// Only what the decision process needs is parsed out of the attributes.
+// The raw bytes are what gets advertised and what identifies the set.
+//
+
+auto BGP::RIB::intern(const std::string &raw) -> Attrs* {
+  auto &a = m_attrs[raw];
+  if (a) return a;
+  a = new Attrs;
+  a->raw = raw;
+
+  auto p = (const uint8_t *)raw.data();
+  auto n = raw.size();
+  auto as_size = (m_options.enable_as4 ? 4 : 2);
+
+  for (size_t i = 0; i + 3 <= n; ) {
+    auto flags = p[i];
+    auto type = p[i+1];
+    size_t len;
+    if (flags & 0x10) {
+      if (i + 4 > n) break;
+      len = (size_t(p[i+2]) << 8) | p[i+3];
+      i += 4;
+    } else {
+      len = p[i+2];
+      i += 3;
+    }
+    if (i + len > n) break;
+    auto v = p + i;
+    switch (PathAttribute::TypeCode(type)) {
+      case PathAttribute::TypeCode::ORIGIN:
+        if (len >= 1) a->origin = v[0];
+        break;
+      case PathAttribute::TypeCode::AS_PATH:
+        for (size_t j = 0; j + 2 <= len; ) {
+          auto seg_type = v[j];
+          auto count = v[j+1];
+          j += 2;
+          if (j + count * as_size > len) break;
+          if (seg_type == 2) {
+            if (j == 2 && count > 0) {
+              a->neighbor_as = 0;
+              for (int k = 0; k < as_size; k++) a->neighbor_as = (a->neighbor_as << 8) | v[j+k];
+            }
+            a->as_path_length += count;
+          } else {
+            a->as_path_length += 1;
+          }
+          j += count * as_size;
+        }
+        break;
+      case PathAttribute::TypeCode::MULTI_EXIT_DISC:
+        if (len == 4) a->med = (uint32_t(v[0]) << 24) | (uint32_t(v[1]) << 16) | (uint32_t(v[2]) << 8) | v[3];
+        break;
+      case PathAttribute::TypeCode::LOCAL_PREF:
+        if (len == 4) a->local_pref = (uint32_t(v[0]) << 24) | (uint32_t(v[1]) << 16) | (uint32_t(v[2]) << 8) | v[3];
+        break;
+      default: break;
+    }
+    i += len;
+  }
+
+  return a;
+}
+
+void BGP::RIB::unref(Attrs *attrs) {
+  if (!--attrs->refs) {
+    m_attrs.erase(attrs->raw);
+    delete attrs;
+  }
+}
+
+void BGP::RIB::announce(Key key, uint16_t peer, Attrs *attrs) {
+  auto &dest = m_dests[key];
+  for (auto &p : dest.paths) {
+    if (p.peer == peer) {
+      if (p.attrs == attrs) return;
+      attrs->refs++;
+      unref(p.attrs);
+      p.attrs = attrs;
+      select(key, dest);
+      return;
+    }
+  }
+  attrs->refs++;
+  dest.paths.push_back({ attrs, peer });
+  select(key, dest);
+}
+
+void BGP::RIB::withdraw(Key key, uint16_t peer) {
+  auto i = m_dests.find(key);
+  if (i == m_dests.end()) return;
+  if (drop(key, i->second, peer)) m_dests.erase(i);
+}
+
+// Returns true when nothing is left of the destination
+bool BGP::RIB::drop(Key key, Dest &dest, uint16_t peer) {
+  auto &paths = dest.paths;
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (paths[i].peer == peer) {
+      unref(paths[i].attrs);
+      paths[i] = paths.back();
+      paths.pop_back();
+      select(key, dest);
+      break;
+    }
+  }
+  return paths.empty() && !dest.advertised;
+}
+
+void BGP::RIB::select(Key key, Dest &dest) {
+  int best = -1;
+  for (int i = 0; i < int(dest.paths.size()); i++) {
+    if (best < 0 || better(dest.paths[i], dest.paths[best])) best = i;
+  }
+  dest.best = best;
+  auto attrs = (best >= 0 ? dest.paths[best].attrs : nullptr);
+  if (attrs != dest.advertised) m_changed.insert(key);
+}
+
+//
+// RFC 4271 section 9.1.2.2, minus the IGP cost to the next hop which
+// is not known here. MEDs are only compared between paths from the same
+// neighboring AS, and a missing MED counts as zero.
+//
+
+bool BGP::RIB::better(const Path &a, const Path &b) const {
+  const auto &x = *a.attrs;
+  const auto &y = *b.attrs;
+  if (x.local_pref != y.local_pref) return x.local_pref > y.local_pref;
+  if (x.as_path_length != y.as_path_length) return x.as_path_length < y.as_path_length;
+  if (x.origin != y.origin) return x.origin < y.origin;
+  if (x.neighbor_as == y.neighbor_as && x.med != y.med) return x.med < y.med;
+  const auto &p = m_peers[a.peer];
+  const auto &q = m_peers[b.peer];
+  if (p.ebgp != q.ebgp) return p.ebgp;
+  if (p.router_id != q.router_id) return p.router_id < q.router_id;
+  return p.name < q.name;
+}
+
+void BGP::RIB::apply_update(uint16_t peer, const uint8_t *p, size_t size) {
+  auto read_prefixes = [](const uint8_t *p, size_t n, const std::function<void(Key)> &cb) {
+    for (size_t i = 0; i < n; ) {
+      int len = p[i++];
+      if (len > 32) throw std::runtime_error("invalid prefix length in BGP UPDATE");
+      int bytes = (len + 7) / 8;
+      if (i + bytes > n) throw std::runtime_error("truncated prefix in BGP UPDATE");
+      uint32_t addr = 0;
+      for (int j = 0; j < 4; j++) addr = (addr << 8) | (j < bytes ? p[i+j] : 0);
+      i += bytes;
+      cb(rib_key(addr, len));
+    }
+  };
+
+  if (size < 4) throw std::runtime_error("truncated BGP UPDATE");
+  size_t withdrawn_size = (size_t(p[0]) << 8) | p[1];
+  if (2 + withdrawn_size + 2 > size) throw std::runtime_error("truncated BGP UPDATE");
+  auto attrs_p = p + 2 + withdrawn_size + 2;
+  size_t attrs_size = (size_t(attrs_p[-2]) << 8) | attrs_p[-1];
+  if (attrs_p + attrs_size > p + size) throw std::runtime_error("truncated BGP UPDATE");
+  auto nlri_p = attrs_p + attrs_size;
+  size_t nlri_size = p + size - nlri_p;
+
+  read_prefixes(p + 2, withdrawn_size, [&](Key key) { withdraw(key, peer); });
+
+  if (nlri_size > 0) {
+    auto attrs = intern(std::string((const char *)attrs_p, attrs_size));
+    attrs->refs++;
+    read_prefixes(nlri_p, nlri_size, [&](Key key) { announce(key, peer, attrs); });
+    unref(attrs);
+  }
+}
+
+//
+// Withdrawals go first, then one run of UPDATE messages per attribute set,
+// each filled with prefixes up to the 4096-byte message limit.
+//
+
+void BGP::RIB::pack(const std::vector<std::pair<Key, Attrs*>> &routes, Data &out) {
+  std::vector<std::pair<Key, Attrs*>> sorted(routes);
+  std::sort(
+    sorted.begin(), sorted.end(),
+    [](const std::pair<Key, Attrs*> &a, const std::pair<Key, Attrs*> &b) {
+      if (a.second != b.second) return std::less<Attrs*>()(a.second, b.second);
+      return a.first < b.first;
+    }
+  );
+
+  std::vector<uint8_t> buf;
+  Attrs *current = nullptr;
+  bool started = false;
+
+  auto finish = [&]() {
+    if (!started) return;
+    if (!current) {
+      // Withdrawn routes are followed by an empty attribute list
+      auto n = buf.size() - RIB_HEADER_SIZE - 2;
+      buf[RIB_HEADER_SIZE + 0] = n >> 8;
+      buf[RIB_HEADER_SIZE + 1] = n >> 0;
+      buf.push_back(0);
+      buf.push_back(0);
+    }
+    buf[16] = buf.size() >> 8;
+    buf[17] = buf.size() >> 0;
+    out.push(buf.data(), buf.size(), &s_dp);
+    started = false;
+  };
+
+  for (const auto &r : sorted) {
+    auto attrs = r.second;
+    if (attrs && attrs->raw.size() > RIB_MAX_MESSAGE_SIZE - RIB_HEADER_SIZE - 9) continue;
+    if (started && (attrs != current || buf.size() + 5 + 2 > RIB_MAX_MESSAGE_SIZE)) finish();
+    if (!started) {
+      current = attrs;
+      started = true;
+      rib_write_header(buf);
+      buf.push_back(0);
+      buf.push_back(0);
+      if (attrs) {
+        buf.push_back(attrs->raw.size() >> 8);
+        buf.push_back(attrs->raw.size() >> 0);
+        buf.insert(buf.end(), attrs->raw.begin(), attrs->raw.end());
+      }
+    }
+    rib_write_prefix(buf, r.first);
+  }
+
+  finish();
+}
+
 //
 // BGP::Parser
 //
@@ -834,6 +1232,89 @@ template<> void ClassDef<BGP>::init() {
     BGP::encode(payload, enable_as4, *data);
     ret.set(data);
   });
+
+  variable("RIB", class_of<Constructor<BGP::RIB>>());
+}
+
+//
+// BGP::RIB
+//
+
+template<> void ClassDef<BGP::RIB>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return nullptr;
+    try {
+      return BGP::RIB::make(BGP::RIB::Options(options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  accessor("size", [](Object *obj, Value &ret) { ret.set(int(obj->as<BGP::RIB>()->size())); });
+
+  method("addPeer", [](Context &ctx, Object *obj, Value &ret) {
+    Str *name;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &name, &options)) return;
+    try {
+      obj->as<BGP::RIB>()->add_peer(name, BGP::RIB::PeerOptions(options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
+  method("removePeer", [](Context &ctx, Object *obj, Value &ret) {
+    Str *name;
+    if (!ctx.arguments(1, &name)) return;
+    obj->as<BGP::RIB>()->remove_peer(name);
+  });
+
+  method("update", [](Context &ctx, Object *obj, Value &ret) {
+    Str *peer;
+    Object *msg;
+    if (!ctx.arguments(2, &peer, &msg)) return;
+    try {
+      auto rib = obj->as<BGP::RIB>();
+      if (msg && msg->is<pipy::Data>()) {
+        rib->update(peer, *msg->as<pipy::Data>());
+      } else if (msg) {
+        pipy::Data data;
+        BGP::encode(msg, rib->enable_as4(), data);
+        rib->update(peer, data);
+      }
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
+  method("best", [](Context &ctx, Object *obj, Value &ret) {
+    Str *cidr;
+    if (!ctx.arguments(1, &cidr)) return;
+    try {
+      ret.set(obj->as<BGP::RIB>()->best(cidr));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
+  method("flush", [](Context &ctx, Object *obj, Value &ret) {
+    auto *data = pipy::Data::make();
+    ret.set(data);
+    obj->as<BGP::RIB>()->flush(*data);
+  });
+
+  method("dump", [](Context &ctx, Object *obj, Value &ret) {
+    auto *data = pipy::Data::make();
+    ret.set(data);
+    obj->as<BGP::RIB>()->dump(*data);
+  });
+}
+
+template<> void ClassDef<Constructor<BGP::RIB>>::init() {
+  super<Function>();
+  ctor();
 }
 
 //
@@ -29,6 +29,12 @@
 #include "pjs/pjs.hpp"
 #include "data.hpp"
 #include "deframer.hpp"
+#include "options.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace pipy {
 
@@ -234,6 +240,106 @@ public:
   private:
     std::function<void(pjs::Object *)> m_cb;
   };
+
+  //
+  // BGP::RIB
+  //
+  // A native Adj-RIB-In plus Loc-RIB for IPv4 unicast. Identical path
+  // attribute blobs are interned and shared by every route carrying them.
+  // The best path of a prefix is only reselected when one of its paths
+  // changes, and the prefixes whose best path has moved since the last
+  // flush() are packed into as few UPDATE messages as possible by grouping
+  // those with the same attributes.
+  //
+
+  class RIB : public pjs::ObjectTemplate<RIB> {
+  public:
+
+    //
+    // BGP::RIB::Options
+    //
+
+    struct Options : public pipy::Options {
+      bool enable_as4 = false;
+      Options() {}
+      Options(pjs::Object *options);
+    };
+
+    //
+    // BGP::RIB::PeerOptions
+    //
+
+    struct PeerOptions : public pipy::Options {
+      pjs::Ref<pjs::Str> router_id;
+      bool ebgp = false;
+      PeerOptions() {}
+      PeerOptions(pjs::Object *options);
+    };
+
+    auto size() const -> size_t { return m_dests.size(); }
+    bool enable_as4() const { return m_options.enable_as4; }
+    void add_peer(pjs::Str *name, const PeerOptions &options);
+    void remove_peer(pjs::Str *name);
+    void update(pjs::Str *peer, const Data &data);
+    auto best(pjs::Str *cidr) -> pjs::Object*;
+    void flush(Data &out);
+    void dump(Data &out);
+
+  private:
+    RIB(const Options &options = Options());
+    ~RIB();
+
+    struct Attrs {
+      std::string raw;
+      uint32_t local_pref = 100;
+      uint32_t med = 0;
+      uint32_t neighbor_as = 0;
+      uint16_t as_path_length = 0;
+      uint8_t origin = 0;
+      int refs = 0;
+    };
+
+    struct Peer {
+      std::string name;
+      uint32_t router_id = 0;
+      bool ebgp = false;
+      bool active = false;
+    };
+
+    struct Path {
+      Attrs *attrs;
+      uint16_t peer;
+    };
+
+    struct Dest {
+      std::vector<Path> paths;
+      Attrs *advertised = nullptr;
+      int best = -1;
+    };
+
+    // Prefixes are keyed by (address << 8) | length
+    typedef uint64_t Key;
+
+    Options m_options;
+    std::vector<Peer> m_peers;
+    std::unordered_map<std::string, uint16_t> m_peer_ids;
+    std::unordered_map<std::string, Attrs*> m_attrs;
+    std::unordered_map<Key, Dest> m_dests;
+    std::unordered_set<Key> m_changed;
+
+    auto peer_id(pjs::Str *name) -> uint16_t;
+    auto intern(const std::string &raw) -> Attrs*;
+    void unref(Attrs *attrs);
+    void announce(Key key, uint16_t peer, Attrs *attrs);
+    void withdraw(Key key, uint16_t peer);
+    bool drop(Key key, Dest &dest, uint16_t peer);
+    void select(Key key, Dest &dest);
+    bool better(const Path &a, const Path &b) const;
+    void apply_update(uint16_t peer, const uint8_t *p, size_t size);
+    void pack(const std::vector<std::pair<Key, Attrs*>> &routes, Data &out);
+
+    friend class pjs::ObjectTemplate<RIB>;
+  };
 };
 
 } // namespace pipy
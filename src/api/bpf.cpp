@@ -26,6 +26,8 @@
 #include "api/bpf.hpp"
 #include "elf.hpp"
 #include "log.hpp"
+#include "input.hpp"
+#include "worker.hpp"
 
 #include <cstring>
 
@@ -34,6 +36,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <elf.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 
 #include "api/linux/bpf.h"
@@ -69,6 +72,18 @@ static void syscall_error(const char *name) {
   throw std::runtime_error(std::string(msg) + std::strerror(errno));
 }
 
+//
+// Batched map commands arrived in 5.6 and are still not implemented
+// for every map type, in which case the kernel answers with EINVAL or
+// its internal ENOTSUPP (524) and we go back to one syscall per element
+//
+
+static const size_t BATCH_SIZE = 256;
+
+static bool batch_unsupported(int err) {
+  return err == EINVAL || err == EOPNOTSUPP || err == 524;
+}
+
 #define MAKE_ENTRY(value) { #value, value }
 
 static struct {
@@ -653,12 +668,7 @@ auto Map::keys() -> pjs::Array* {
       attr.next_key = (uintptr_t)k;
     }
   )) {
-    Data data(k, m_key_size, &s_dp);
-    if (m_key_type) {
-      a->push(m_key_type->decode(data));
-    } else {
-      a->push(Data::make(std::move(data)));
-    }
+    a->push(decode_key(k));
     p = k;
   }
 
@@ -674,13 +684,26 @@ auto Map::keys() -> pjs::Array* {
 auto Map::entries() -> pjs::Array* {
   if (!m_fd) return nullptr;
 
+  auto a = pjs::Array::make();
+
+  if (auto values = mmap_values()) {
+    auto stride = (m_value_size + 7) & ~7;
+    for (uint32_t i = 0; i < m_max_entries; i++) {
+      auto ent = pjs::Array::make(2);
+      a->push(ent);
+      ent->set(0, decode_key(&i));
+      ent->set(1, decode_value(values + i * stride));
+    }
+    return a;
+  }
+
   uint8_t k[m_key_size];
   uint8_t v[m_value_size];
-
-  auto a = pjs::Array::make();
   uint8_t *p = nullptr;
 
   try {
+    if (lookup_batch(a)) return a;
+
     union bpf_attr attr;
     while (!syscall_bpf(
       BPF_MAP_GET_NEXT_KEY, &attr, attr_size(next_key),
@@ -699,23 +722,10 @@ auto Map::entries() -> pjs::Array* {
         }
       )) syscall_error("BPF_MAP_LOOKUP_ELEM");
 
-      Data data_k(k, m_key_size, &s_dp);
-      Data data_v(v, m_value_size, &s_dp);
       auto ent = pjs::Array::make(2);
       a->push(ent);
-
-      if (m_key_type) {
-        ent->set(0, m_key_type->decode(data_k));
-      } else {
-        ent->set(0, Data::make(std::move(data_k)));
-      }
-
-      if (m_value_type) {
-        ent->set(1, m_value_type->decode(data_v));
-      } else {
-        ent->set(1, Data::make(std::move(data_v)));
-      }
-
+      ent->set(0, decode_key(k));
+      ent->set(1, decode_value(v));
       p = k;
     }
 
@@ -732,15 +742,9 @@ auto Map::entries() -> pjs::Array* {
 
 auto Map::lookup(pjs::Object *key) -> pjs::Object* {
   if (!key) return nullptr;
-
-  pjs::Ref<Data> value;
-  if (key->is<Data>()) {
-    value = lookup_raw(key->as<Data>());
-  } else if (m_key_type) {
-    pjs::Ref<Data> raw_key = m_key_type->encode(key);
-    value = lookup_raw(raw_key);
-  }
-
+  pjs::Ref<Data> k = encode_key(key);
+  if (!k) return nullptr;
+  pjs::Ref<Data> value = lookup_raw(k);
   if (!value) return nullptr;
   if (m_value_type) {
     return m_value_type->decode(*value);
@@ -751,41 +755,251 @@ auto Map::lookup(pjs::Object *key) -> pjs::Object* {
 
 void Map::update(pjs::Object *key, pjs::Object *value) {
   if (!key || !value) return;
+  pjs::Ref<Data> k = encode_key(key);
+  pjs::Ref<Data> v = encode_value(value);
+  update_raw(k, v);
+}
 
-  pjs::Ref<Data> k, v;
+//
+// Writes all [key, value] pairs with as few BPF_MAP_UPDATE_BATCH calls as
+// possible. Whatever the kernel has not taken when it turns out not to
+// support batching is written one element at a time.
+//
 
-  if (key->is<Data>()) {
-    k = key->as<Data>();
-  } else if (m_key_type) {
-    k = m_key_type->encode(key);
-  }
+void Map::update_entries(pjs::Array *entries) {
+  if (!m_fd || !entries) return;
+
+  std::vector<pjs::Ref<Data>> keys, values;
+  entries->iterate_all(
+    [&](pjs::Value &v, int) {
+      if (!v.is_array()) return;
+      auto ent = v.as<pjs::Array>();
+      pjs::Value k, v2;
+      ent->get(0, k);
+      ent->get(1, v2);
+      if (!k.is_object() || !v2.is_object()) return;
+      pjs::Ref<Data> raw_k = encode_key(k.o());
+      pjs::Ref<Data> raw_v = encode_value(v2.o());
+      if (!raw_k || !raw_v) return;
+      keys.push_back(raw_k);
+      values.push_back(raw_v);
+    }
+  );
 
-  if (value->is<Data>()) {
-    v = value->as<Data>();
-  } else if (m_value_type) {
-    v = m_value_type->encode(value);
+  if (auto mem = mmap_values()) {
+    auto stride = (m_value_size + 7) & ~7;
+    for (size_t i = 0; i < keys.size(); i++) {
+      uint32_t index = 0;
+      keys[i]->to_bytes((uint8_t *)&index, sizeof(index));
+      if (index >= m_max_entries) throw std::runtime_error("array index out of range");
+      auto p = mem + index * stride;
+      std::memset(p, 0, m_value_size);
+      values[i]->to_bytes(p, m_value_size);
+    }
+    return;
   }
 
-  update_raw(k, v);
+  std::vector<uint8_t> k(BATCH_SIZE * m_key_size);
+  std::vector<uint8_t> v(BATCH_SIZE * m_value_size);
+
+  for (size_t i = 0; i < keys.size(); i += BATCH_SIZE) {
+    auto n = std::min(BATCH_SIZE, keys.size() - i);
+    std::memset(k.data(), 0, k.size());
+    std::memset(v.data(), 0, v.size());
+    for (size_t j = 0; j < n; j++) {
+      keys[i+j]->to_bytes(&k[j * m_key_size], m_key_size);
+      values[i+j]->to_bytes(&v[j * m_value_size], m_value_size);
+    }
+
+    union bpf_attr attr;
+    if (syscall_bpf(
+      BPF_MAP_UPDATE_BATCH, &attr, attr_size(batch),
+      [&](union bpf_attr &attr) {
+        attr.batch.map_fd = m_fd;
+        attr.batch.keys = (uintptr_t)k.data();
+        attr.batch.values = (uintptr_t)v.data();
+        attr.batch.count = n;
+      }
+    )) {
+      if (!batch_unsupported(errno)) syscall_error("BPF_MAP_UPDATE_BATCH");
+      for (size_t j = i + attr.batch.count; j < keys.size(); j++) {
+        update_raw(keys[j], values[j]);
+      }
+      return;
+    }
+  }
 }
 
 void Map::remove(pjs::Object *key) {
   if (!key) return;
-  if (key->is<Data>()) {
-    delete_raw(key->as<Data>());
-  } else if (m_key_type) {
-    pjs::Ref<Data> k = m_key_type->encode(key);
-    delete_raw(k);
+  pjs::Ref<Data> k = encode_key(key);
+  if (k) delete_raw(k);
+}
+
+void Map::remove_keys(pjs::Array *keys) {
+  if (!m_fd || !keys) return;
+
+  std::vector<pjs::Ref<Data>> raw_keys;
+  keys->iterate_all(
+    [&](pjs::Value &v, int) {
+      if (!v.is_object()) return;
+      pjs::Ref<Data> k = encode_key(v.o());
+      if (k) raw_keys.push_back(k);
+    }
+  );
+
+  std::vector<uint8_t> k(BATCH_SIZE * m_key_size);
+
+  for (size_t i = 0; i < raw_keys.size(); i += BATCH_SIZE) {
+    auto n = std::min(BATCH_SIZE, raw_keys.size() - i);
+    std::memset(k.data(), 0, k.size());
+    for (size_t j = 0; j < n; j++) {
+      raw_keys[i+j]->to_bytes(&k[j * m_key_size], m_key_size);
+    }
+
+    union bpf_attr attr;
+    if (syscall_bpf(
+      BPF_MAP_DELETE_BATCH, &attr, attr_size(batch),
+      [&](union bpf_attr &attr) {
+        attr.batch.map_fd = m_fd;
+        attr.batch.keys = (uintptr_t)k.data();
+        attr.batch.count = n;
+      }
+    )) {
+      if (!batch_unsupported(errno)) syscall_error("BPF_MAP_DELETE_BATCH");
+      for (size_t j = i + attr.batch.count; j < raw_keys.size(); j++) {
+        delete_raw(raw_keys[j]);
+      }
+      return;
+    }
   }
 }
 
 void Map::close() {
+  if (m_mmap) {
+    munmap(m_mmap, m_mmap_size);
+    m_mmap = nullptr;
+  }
   ::close(m_fd);
   m_fd = 0;
 }
 
+Map::~Map() {
+  if (m_mmap) munmap(m_mmap, m_mmap_size);
+}
+
+auto Map::encode_key(pjs::Object *key) -> Data* {
+  if (key->is<Data>()) return key->as<Data>();
+  if (m_key_type) return m_key_type->encode(key);
+  return nullptr;
+}
+
+auto Map::encode_value(pjs::Object *value) -> Data* {
+  if (value->is<Data>()) return value->as<Data>();
+  if (m_value_type) return m_value_type->encode(value);
+  return nullptr;
+}
+
+auto Map::decode_key(const Data &data) -> pjs::Object* {
+  if (m_key_type) return m_key_type->decode(data);
+  return Data::make(data);
+}
+
+auto Map::decode_value(const Data &data) -> pjs::Object* {
+  if (m_value_type) return m_value_type->decode(data);
+  return Data::make(data);
+}
+
+auto Map::decode_key(const void *key) -> pjs::Object* {
+  if (m_key_type) return m_key_type->decode(key, m_key_size);
+  return s_dp.make(key, m_key_size);
+}
+
+auto Map::decode_value(const void *value) -> pjs::Object* {
+  if (m_value_type) return m_value_type->decode(value, m_value_size);
+  return s_dp.make(value, m_value_size);
+}
+
+//
+// Reads the whole map with BPF_MAP_LOOKUP_BATCH. Returns false without
+// touching the array when the map type has no batch support, so that the
+// caller can walk the keys itself.
+//
+
+bool Map::lookup_batch(pjs::Array *entries) {
+  auto count = std::min(BATCH_SIZE, (size_t)m_max_entries);
+  if (!count) return true;
+
+  auto batch_size = std::max(m_key_size, 8);
+  std::vector<uint8_t> k(count * m_key_size);
+  std::vector<uint8_t> v(count * m_value_size);
+  std::vector<uint8_t> in(batch_size), out(batch_size);
+  bool first = true;
+
+  for (;;) {
+    union bpf_attr attr;
+    int err = 0;
+    if (syscall_bpf(
+      BPF_MAP_LOOKUP_BATCH, &attr, attr_size(batch),
+      [&](union bpf_attr &attr) {
+        attr.batch.in_batch = first ? 0 : (uintptr_t)in.data();
+        attr.batch.out_batch = (uintptr_t)out.data();
+        attr.batch.keys = (uintptr_t)k.data();
+        attr.batch.values = (uintptr_t)v.data();
+        attr.batch.count = count;
+        attr.batch.map_fd = m_fd;
+      }
+    )) {
+      err = errno;
+      if (err != ENOENT) {
+        if (first && batch_unsupported(err)) return false;
+        syscall_error("BPF_MAP_LOOKUP_BATCH");
+      }
+    }
+
+    for (size_t i = 0; i < attr.batch.count; i++) {
+      auto ent = pjs::Array::make(2);
+      entries->push(ent);
+      ent->set(0, decode_key(&k[i * m_key_size]));
+      ent->set(1, decode_value(&v[i * m_value_size]));
+    }
+
+    if (err == ENOENT) return true;
+    std::swap(in, out);
+    first = false;
+  }
+}
+
+//
+// Arrays created with BPF_F_MMAPABLE are mapped the first time they are
+// accessed (values are laid out at 8-byte strides, as in the kernel) so that
+// lookups and updates become plain memory accesses. A failed mapping, for
+// instance on a frozen map, quietly leaves us with the syscall path.
+//
+
+auto Map::mmap_values() -> uint8_t* {
+  if (m_mmap) return m_mmap;
+  if (m_mmap_tried || !m_fd) return nullptr;
+  if (m_type != BPF_MAP_TYPE_ARRAY || !(m_flags & BPF_F_MMAPABLE)) return nullptr;
+  m_mmap_tried = true;
+  auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+  auto stride = (size_t)((m_value_size + 7) & ~7);
+  auto size = (stride * m_max_entries + page_size - 1) & ~(page_size - 1);
+  auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (p == MAP_FAILED) return nullptr;
+  m_mmap = (uint8_t *)p;
+  m_mmap_size = size;
+  return m_mmap;
+}
+
 auto Map::lookup_raw(Data *key) -> Data* {
   if (!m_fd) return nullptr;
+  if (auto values = mmap_values()) {
+    uint32_t index = 0;
+    key->to_bytes((uint8_t *)&index, sizeof(index));
+    if (index >= m_max_entries) throw std::runtime_error("array index out of range");
+    return Data::make(values + index * ((m_value_size + 7) & ~7), m_value_size, &s_dp);
+  }
   uint8_t k[m_key_size];
   uint8_t v[m_value_size];
   std::memset(k, 0, m_key_size);
@@ -806,6 +1020,15 @@ auto Map::lookup_raw(Data *key) -> Data* {
 
 void Map::update_raw(Data *key, Data *value) {
   if (!m_fd) return;
+  if (auto values = mmap_values()) {
+    uint32_t index = 0;
+    key->to_bytes((uint8_t *)&index, sizeof(index));
+    if (index >= m_max_entries) throw std::runtime_error("array index out of range");
+    auto p = values + index * ((m_value_size + 7) & ~7);
+    std::memset(p, 0, m_value_size);
+    value->to_bytes(p, m_value_size);
+    return;
+  }
   uint8_t k[m_key_size];
   uint8_t v[m_value_size];
   std::memset(k, 0, m_key_size);
@@ -840,6 +1063,115 @@ void Map::delete_raw(Data *key) {
   )) syscall_error("BPF_MAP_DELETE_ELEM");
 }
 
+//
+// RingBuffer
+//
+
+RingBuffer::RingBuffer(Map *map, pjs::Function *callback, CStructBase *layout)
+  : m_map(map)
+  , m_callback(callback)
+  , m_layout(layout)
+{
+  if (map->type() != BPF_MAP_TYPE_RINGBUF) throw std::runtime_error("map is not a BPF_MAP_TYPE_RINGBUF");
+  if (!map->fd()) throw std::runtime_error("map is not created");
+
+  // The consumer position page is the only writable part. The data pages
+  // come right after the producer position page and are mapped twice in
+  // a row by the kernel so that a wrapping sample is still contiguous.
+  m_page_size = sysconf(_SC_PAGESIZE);
+  m_data_size = map->max_entries();
+
+  auto consumer = mmap(nullptr, m_page_size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd(), 0);
+  if (consumer == MAP_FAILED) syscall_error("mmap");
+
+  auto producer = mmap(nullptr, m_page_size + 2 * m_data_size, PROT_READ, MAP_SHARED, map->fd(), m_page_size);
+  if (producer == MAP_FAILED) {
+    munmap(consumer, m_page_size);
+    syscall_error("mmap");
+  }
+
+  int fd = dup(map->fd());
+  if (fd < 0) {
+    munmap(producer, m_page_size + 2 * m_data_size);
+    munmap(consumer, m_page_size);
+    syscall_error("dup");
+  }
+
+  m_consumer = (uint8_t *)consumer;
+  m_producer = (uint8_t *)producer;
+  m_stream.reset(new asio::posix::stream_descriptor(Net::context(), fd));
+  retain();
+  wait();
+}
+
+RingBuffer::~RingBuffer() {
+  if (m_producer) munmap(m_producer, m_page_size + 2 * m_data_size);
+  if (m_consumer) munmap(m_consumer, m_page_size);
+}
+
+void RingBuffer::close() {
+  if (m_stream) {
+    std::error_code ec;
+    m_stream->close(ec);
+    m_stream.reset();
+    release();
+  }
+}
+
+void RingBuffer::wait() {
+  m_stream->async_wait(
+    asio::posix::stream_descriptor::wait_read,
+    [this](const std::error_code &ec) {
+      if (ec || !m_stream) return;
+      consume();
+      if (m_stream) wait();
+    }
+  );
+}
+
+//
+// Same protocol as libbpf's ringbuf_process_ring(): stop at the first
+// sample still being written, skip discarded ones, and publish the new
+// consumer position after each record so the producer can reuse space.
+//
+
+void RingBuffer::consume() {
+  auto consumer_pos = (unsigned long *)m_consumer;
+  auto producer_pos = (unsigned long *)m_producer;
+  auto data = m_producer + m_page_size;
+  auto mask = m_data_size - 1;
+  auto cons = __atomic_load_n(consumer_pos, __ATOMIC_ACQUIRE);
+
+  pjs::Ref<RingBuffer> hold(this);
+  InputContext ic;
+  pjs::Context ctx(Worker::current());
+
+  while (m_stream && cons < __atomic_load_n(producer_pos, __ATOMIC_ACQUIRE)) {
+    auto hdr = data + (cons & mask);
+    auto len = __atomic_load_n((uint32_t *)hdr, __ATOMIC_ACQUIRE);
+    if (len & BPF_RINGBUF_BUSY_BIT) break;
+
+    auto size = len & ~(BPF_RINGBUF_BUSY_BIT | BPF_RINGBUF_DISCARD_BIT);
+    cons += (size + BPF_RINGBUF_HDR_SZ + 7) & ~7;
+
+    if (!(len & BPF_RINGBUF_DISCARD_BIT)) {
+      pjs::Value arg, ret;
+      if (m_layout) {
+        arg.set(m_layout->decode(hdr + BPF_RINGBUF_HDR_SZ, size));
+      } else {
+        arg.set(s_dp.make(hdr + BPF_RINGBUF_HDR_SZ, size));
+      }
+      (*m_callback)(ctx, 1, &arg, ret);
+      if (!ctx.ok()) {
+        Log::pjs_error(ctx.error());
+        ctx.reset();
+      }
+    }
+
+    __atomic_store_n(consumer_pos, cons, __ATOMIC_RELEASE);
+  }
+}
+
 //
 // BPF
 //
@@ -999,14 +1331,35 @@ void Map::update(pjs::Object *key, pjs::Object *value) {
   unsupported();
 }
 
+void Map::update_entries(pjs::Array *entries) {
+  unsupported();
+}
+
 void Map::remove(pjs::Object *key) {
   unsupported();
 }
 
+void Map::remove_keys(pjs::Array *keys) {
+  unsupported();
+}
+
 void Map::close() {
   unsupported();
 }
 
+Map::~Map() {
+}
+
+RingBuffer::RingBuffer(Map *map, pjs::Function *callback, CStructBase *layout) {
+  unsupported();
+}
+
+RingBuffer::~RingBuffer() {
+}
+
+void RingBuffer::close() {
+}
+
 void BPF::pin(const std::string &pathname, int fd) {
   unsupported();
 }
@@ -1181,6 +1534,16 @@ template<> void ClassDef<bpf::Map>::init() {
     }
   });
 
+  method("updateEntries", [](Context &ctx, Object *obj, Value &ret) {
+    Array *entries;
+    if (!ctx.arguments(1, &entries)) return;
+    try {
+      obj->as<bpf::Map>()->update_entries(entries);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   method("delete", [](Context &ctx, Object *obj, Value &ret) {
     Object *key;
     if (!ctx.arguments(1, &key)) return;
@@ -1190,6 +1553,16 @@ template<> void ClassDef<bpf::Map>::init() {
       ctx.error(err);
     }
   });
+
+  method("deleteKeys", [](Context &ctx, Object *obj, Value &ret) {
+    Array *keys;
+    if (!ctx.arguments(1, &keys)) return;
+    try {
+      obj->as<bpf::Map>()->remove_keys(keys);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
 }
 
 template<> void ClassDef<Constructor<bpf::Map>>::init() {
@@ -1217,6 +1590,32 @@ template<> void ClassDef<Constructor<bpf::Map>>::init() {
   });
 }
 
+//
+// RingBuffer
+//
+
+template<> void ClassDef<RingBuffer>::init() {
+  method("close", [](Context &ctx, Object *obj, Value &ret) {
+    obj->as<RingBuffer>()->close();
+  });
+}
+
+template<> void ClassDef<Constructor<RingBuffer>>::init() {
+  super<Function>();
+  ctor([](Context &ctx) -> Object* {
+    bpf::Map *map;
+    Function *callback;
+    CStructBase *layout = nullptr;
+    if (!ctx.arguments(2, &map, &callback, &layout)) return nullptr;
+    try {
+      return RingBuffer::make(map, callback, layout);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+}
+
 template<> void ClassDef<BPF>::init() {
   ctor();
 
@@ -1318,6 +1717,7 @@ template<> void ClassDef<BPF>::init() {
 
   variable("Program", class_of<Constructor<Program>>());
   variable("Map", class_of<Constructor<bpf::Map>>());
+  variable("RingBuffer", class_of<Constructor<RingBuffer>>());
 }
 
 //
@@ -30,12 +30,16 @@
 #include "api/c-struct.hpp"
 #include "elf.hpp"
 #include "data.hpp"
+#include "net.hpp"
+
+#include <memory>
 
 namespace pipy {
 namespace bpf {
 
 class Program;
 class Map;
+class RingBuffer;
 
 //
 // ObjectFile
@@ -136,17 +140,28 @@ public:
   auto entries() -> pjs::Array*;
   auto lookup(pjs::Object *key) -> pjs::Object*;
   void update(pjs::Object *key, pjs::Object *value);
+  void update_entries(pjs::Array *entries);
   void remove(pjs::Object *key);
+  void remove_keys(pjs::Array *keys);
   void close();
 
 private:
   Map(const std::string &name, int type, int flags, int max_entries, int key_size, int value_size);
   Map(const std::string &name, int type, int flags, int max_entries, CStructBase *key_type = nullptr, CStructBase *value_type = nullptr);
   Map(int fd, CStructBase *key_type = nullptr, CStructBase *value_type = nullptr);
-
+  ~Map();
+
+  auto encode_key(pjs::Object *key) -> Data*;
+  auto encode_value(pjs::Object *value) -> Data*;
+  auto decode_key(const Data &data) -> pjs::Object*;
+  auto decode_value(const Data &data) -> pjs::Object*;
+  auto decode_key(const void *key) -> pjs::Object*;
+  auto decode_value(const void *value) -> pjs::Object*;
   auto lookup_raw(Data *key) -> Data*;
   void update_raw(Data *key, Data *value);
   void delete_raw(Data *key);
+  bool lookup_batch(pjs::Array *entries);
+  auto mmap_values() -> uint8_t*;
 
   pjs::Ref<pjs::Str> m_name;
   int m_fd;
@@ -158,8 +173,45 @@ private:
   int m_value_size;
   pjs::Ref<CStructBase> m_key_type;
   pjs::Ref<CStructBase> m_value_type;
+  uint8_t* m_mmap = nullptr;
+  size_t m_mmap_size = 0;
+  bool m_mmap_tried = false;
 
   friend class pjs::ObjectTemplate<Map>;
+  friend class RingBuffer;
+};
+
+//
+// RingBuffer
+//
+// Consumer side of a BPF_MAP_TYPE_RINGBUF map. The ring is mapped into
+// our address space and drained whenever epoll reports the map readable,
+// so samples reach the callback without any syscall per record.
+//
+
+class RingBuffer : public pjs::ObjectTemplate<RingBuffer> {
+public:
+  void close();
+
+private:
+  RingBuffer(Map *map, pjs::Function *callback, CStructBase *layout = nullptr);
+  ~RingBuffer();
+
+  pjs::Ref<Map> m_map;
+  pjs::Ref<pjs::Function> m_callback;
+  pjs::Ref<CStructBase> m_layout;
+#ifdef PIPY_USE_BPF
+  void wait();
+  void consume();
+
+  uint8_t* m_consumer = nullptr;
+  uint8_t* m_producer = nullptr;
+  size_t m_page_size = 0;
+  size_t m_data_size = 0;
+  std::unique_ptr<asio::posix::stream_descriptor> m_stream;
+#endif
+
+  friend class pjs::ObjectTemplate<RingBuffer>;
 };
 
 //
@@ -26,6 +26,9 @@
 #include "api/c-struct.hpp"
 
 #include <cctype>
+#include <cstring>
+#include <list>
+#include <set>
 
 namespace pipy {
 
@@ -151,12 +154,13 @@ void CStructBase::add_field(pjs::Str *name, const char *type) {
   }
 
   m_fields.push_back(f);
+  changed();
 }
 
 void CStructBase::add_field(pjs::Str *name, CStructBase *type) {
   if (name) {
     Field f;
-    f.offset = align(m_size, align_size(type->m_size));
+    f.offset = m_is_union ? 0 : align(m_size, align_size(type->m_size));
     f.size = type->m_size;
     f.count = 1;
     f.is_array = false;
@@ -166,28 +170,59 @@ void CStructBase::add_field(pjs::Str *name, CStructBase *type) {
     f.layout = type;
     f.name = name;
     m_fields.push_back(f);
-    m_size = f.offset + align(f.size, 4);
+    if (m_is_union) {
+      m_size = std::max(m_size, align(f.size, 4));
+    } else {
+      m_size = f.offset + align(f.size, 4);
+    }
   } else {
     if (!type->m_is_union) throw std::runtime_error("struct field name expected");
-    auto offset = align(m_size, align_size(type->m_size));
+    auto offset = m_is_union ? 0 : align(m_size, align_size(type->m_size));
     for (const auto &f : type->m_fields) {
       m_fields.push_back(f);
-      m_fields.back().offset = offset;
+      m_fields.back().offset = offset + f.offset;
+    }
+    if (m_is_union) {
+      m_size = std::max(m_size, type->m_size);
+    } else {
+      m_size = offset + type->m_size;
     }
   }
+  changed();
 }
 
 auto CStructBase::encode(pjs::Object *obj) -> Data* {
-  Data buf;
-  Data::Builder db(buf, &s_dp);
-  encode(db, obj, this);
-  db.flush();
-  return Data::make(std::move(buf));
+  pjs::vl_array<uint8_t, 1000> buf(m_size);
+  encode(obj, buf.data());
+  return s_dp.make(buf.data(), m_size);
+}
+
+void CStructBase::encode(pjs::Object *obj, void *buf) {
+  std::memset(buf, 0, m_size);
+  encode((uint8_t *)buf, obj, this);
 }
 
 auto CStructBase::decode(const Data &data) -> pjs::Object* {
-  Data::Reader dr(data);
-  return decode(dr, this);
+  pjs::vl_array<uint8_t, 1000> buf(m_size);
+  auto n = std::min(m_size, (size_t)data.size());
+  data.to_bytes(buf.data(), n);
+  if (n < m_size) std::memset(buf.data() + n, 0, m_size - n);
+  return decode(buf.data(), this);
+}
+
+auto CStructBase::decode(const void *buf, size_t size) -> pjs::Object* {
+  if (size >= m_size) return decode((const uint8_t *)buf, this);
+  pjs::vl_array<uint8_t, 1000> tmp(m_size);
+  std::memcpy(tmp.data(), buf, size);
+  std::memset(tmp.data() + size, 0, m_size - size);
+  return decode(tmp.data(), this);
+}
+
+auto CStructBase::view(Data *data, size_t offset) -> CStructView* {
+  compile();
+  auto v = new CStructView(this, data, offset);
+  m_view_class->init(v);
+  return v;
 }
 
 auto CStructBase::reflect() -> pjs::Object* {
@@ -205,6 +240,47 @@ auto CStructBase::reflect() -> pjs::Object* {
   return obj;
 }
 
+//
+// Decoded objects get a class of their own with one slot per field so
+// that decoding fills slots by index rather than going through a hash
+// table. Views get a class of accessors reading from the buffer. Fields
+// by the same name, as can come from anonymous unions, share a slot.
+//
+
+void CStructBase::compile() {
+  if (m_class) return;
+
+  std::list<pjs::Field*> vars, accessors;
+  std::set<std::string> names;
+  for (size_t i = 0; i < m_fields.size(); i++) {
+    auto &f = m_fields[i];
+    if (!names.insert(f.name->str()).second) continue;
+    vars.push_back(pjs::Variable::make(f.name->str(), pjs::Field::Enumerable | pjs::Field::Writable));
+    accessors.push_back(
+      pjs::Accessor::make(
+        f.name->str(),
+        [this, i](pjs::Object *obj, pjs::Value &ret) {
+          obj->as<CStructView>()->get(m_fields[i], ret);
+        },
+        nullptr,
+        pjs::Field::Enumerable
+      )
+    );
+  }
+
+  m_class = pjs::Class::make("", pjs::class_of<pjs::Object>(), vars);
+  m_view_class = pjs::Class::make("", pjs::class_of<CStructView>(), accessors);
+
+  for (auto &f : m_fields) {
+    f.slot = static_cast<pjs::Variable*>(m_class->field(m_class->find_field(f.name)))->index();
+  }
+}
+
+void CStructBase::changed() {
+  m_class = nullptr;
+  m_view_class = nullptr;
+}
+
 auto CStructBase::align(size_t offset, size_t alignment) -> size_t {
   return (offset + alignment - 1) / alignment * alignment;
 }
@@ -216,151 +292,154 @@ auto CStructBase::align_size(size_t size) -> size_t {
   return 8;
 }
 
-void CStructBase::zero(Data::Builder &db, size_t count) {
-  if (count > 0) {
-    db.push(0, count);
-  }
-}
+//
+// Encoding and decoding work on a flat buffer of the struct's full size,
+// already zeroed for encoding, so every field is a plain access at its
+// offset and a whole struct costs one copy in or out of a Data.
+//
 
-void CStructBase::encode(Data::Builder &db, pjs::Object *values, CStructBase *layout) {
-  auto start = db.size();
-  bool found = false;
+void CStructBase::encode(uint8_t *buf, pjs::Object *values, CStructBase *layout) {
   for (const auto &f : layout->m_fields) {
     pjs::Value v;
     values->get(f.name, v);
-    if (layout->m_is_union && v.is_undefined()) continue; else found = true;
-    auto offset = db.size() - start;
-    if (offset < f.offset) zero(db, f.offset - offset);
+    if (v.is_undefined()) continue;
+    auto p = buf + f.offset;
     if (auto layout = f.layout.get()) {
       if (v.is_object() && v.o()) {
-        encode(db, v.o(), layout);
-      } else {
-        zero(db, f.size * f.count);
+        encode(p, v.o(), layout);
       }
     } else if (f.type == pjs::Value::Type::String) {
       if (v.is_string()) {
         auto l = v.s()->size();
         auto n = f.size * f.count;
-        db.push(v.s()->c_str(), std::min(l, n));
-        if (l < n) db.push(0, n - l);
-      } else {
-        zero(db, f.size * f.count);
+        std::memcpy(p, v.s()->c_str(), std::min(l, n));
       }
     } else if (f.is_array) {
       if (v.is_array()) {
         auto a = v.as<pjs::Array>();
         for (int i = 0; i < f.count; i++) {
           a->get(i, v);
-          encode(db, f.size, f.is_integral, f.is_unsigned, v);
+          encode(p + i * f.size, f.size, f.is_integral, f.is_unsigned, v);
         }
-      } else {
-        zero(db, f.size * f.count);
       }
     } else {
-      encode(db, f.size, f.is_integral, f.is_unsigned, v);
+      encode(p, f.size, f.is_integral, f.is_unsigned, v);
     }
   }
-  if (layout->m_is_union && !found) {
-    zero(db, layout->m_size);
-  }
 }
 
-void CStructBase::encode(Data::Builder &db, int size, bool is_integral, bool is_unsigned, const pjs::Value &value) {
-  char buf[8];
+void CStructBase::encode(uint8_t *buf, int size, bool is_integral, bool is_unsigned, const pjs::Value &value) {
   if (!is_integral) {
     if (size == 4) {
-      *(float*)buf = value.to_number();
+      float f = value.to_number();
+      std::memcpy(buf, &f, 4);
     } else {
-      *(double*)buf = value.to_number();
-    }
-  } else if (is_unsigned) {
-    switch (size) {
-      case 1: *(int8_t*)buf = value.to_int32(); break;
-      case 2: *(int16_t*)buf = value.to_int32(); break;
-      case 4: *(int32_t*)buf = value.to_int32(); break;
-      case 8: *(int64_t*)buf = value.to_int64(); break;
+      double f = value.to_number();
+      std::memcpy(buf, &f, 8);
     }
   } else {
     switch (size) {
-      case 1: *(uint8_t*)buf = value.to_int32(); break;
-      case 2: *(uint16_t*)buf = value.to_int32(); break;
-      case 4: *(uint32_t*)buf = value.to_int32(); break;
-      case 8: *(uint64_t*)buf = value.to_int64(); break;
+      case 1: { uint8_t i = value.to_int32(); std::memcpy(buf, &i, 1); break; }
+      case 2: { uint16_t i = value.to_int32(); std::memcpy(buf, &i, 2); break; }
+      case 4: { uint32_t i = value.to_int32(); std::memcpy(buf, &i, 4); break; }
+      case 8: { uint64_t i = value.to_int64(); std::memcpy(buf, &i, 8); break; }
     }
   }
-  db.push(buf, size);
 }
 
-auto CStructBase::decode(Data::Reader &dr, CStructBase *layout) -> pjs::Object* {
-  auto values = pjs::Object::make();
-  if (layout->m_is_union) {
-    Data buf;
-    dr.read(layout->m_size, buf);
-    for (const auto &f : layout->m_fields) {
-      Data::Reader dr(buf);
-      decode(dr, f, values);
-    }
-  } else {
-    auto start = dr.position();
-    for (const auto &f : layout->m_fields) {
-      auto offset = dr.position() - start;
-      if (offset < f.offset) dr.skip(f.offset - offset);
-      decode(dr, f, values);
-    }
+auto CStructBase::decode(const uint8_t *buf, CStructBase *layout) -> pjs::Object* {
+  layout->compile();
+  auto values = pjs::Object::make(layout->m_class);
+  auto slots = values->data();
+  for (const auto &f : layout->m_fields) {
+    decode(buf + f.offset, f, slots->at(f.slot));
   }
   return values;
 }
 
-void CStructBase::decode(Data::Reader &dr, const Field &field, pjs::Object *values) {
+void CStructBase::decode(const uint8_t *buf, const Field &field, pjs::Value &value) {
   if (auto layout = field.layout.get()) {
-    values->set(field.name, decode(dr, layout));
+    value.set(decode(buf, layout));
   } else if (field.type == pjs::Value::Type::String) {
     auto n = field.size * field.count;
-    pjs::vl_array<char> s(n + 1);
-    s[dr.read(n, s)] = 0;
-    values->set(field.name, pjs::Str::make(s));
+    auto s = (const char *)buf;
+    value.set(pjs::Str::make(s, strnlen(s, n)));
   } else if (field.is_array) {
     auto a = pjs::Array::make(field.count);
     for (int i = 0; i < field.count; i++) {
       pjs::Value v;
-      decode(dr, field.size, field.is_integral, field.is_unsigned, v);
+      decode(buf + i * field.size, field.size, field.is_integral, field.is_unsigned, v);
       a->set(i, v);
     }
-    values->set(field.name, a);
+    value.set(a);
   } else {
-    pjs::Value v;
-    decode(dr, field.size, field.is_integral, field.is_unsigned, v);
-    values->set(field.name, v);
+    decode(buf, field.size, field.is_integral, field.is_unsigned, value);
   }
 }
 
-void CStructBase::decode(Data::Reader &dr, int size, bool is_integral, bool is_unsigned, pjs::Value &value) {
-  pjs::vl_array<char> buf(size);
-  auto len = dr.read(size, buf);
-  if (len < size) std::memset(buf + len, 0, size - len);
+void CStructBase::decode(const uint8_t *buf, int size, bool is_integral, bool is_unsigned, pjs::Value &value) {
+  union {
+    uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+    int8_t i8; int16_t i16; int32_t i32; int64_t i64;
+    float f; double d;
+  } v;
+  std::memcpy(&v, buf, size);
   if (!is_integral) {
     if (size == 4) {
-      value.set(*(float*)buf.data());
+      value.set(v.f);
     } else {
-      value.set(*(double*)buf.data());
+      value.set(v.d);
     }
   } else if (is_unsigned) {
     switch (size) {
-      case 1: value.set(*(uint8_t*)buf.data()); break;
-      case 2: value.set(*(uint16_t*)buf.data()); break;
-      case 4: value.set(*(uint32_t*)buf.data()); break;
-      case 8: value.set(*(uint64_t*)buf.data()); break;
+      case 1: value.set(v.u8); break;
+      case 2: value.set(v.u16); break;
+      case 4: value.set(v.u32); break;
+      case 8: value.set(v.u64); break;
     }
   } else {
     switch (size) {
-      case 1: value.set(*(int8_t*)buf.data()); break;
-      case 2: value.set(*(int16_t*)buf.data()); break;
-      case 4: value.set(*(int32_t*)buf.data()); break;
-      case 8: value.set(*(int64_t*)buf.data()); break;
+      case 1: value.set(v.i8); break;
+      case 2: value.set(v.i16); break;
+      case 4: value.set(v.i32); break;
+      case 8: value.set(v.i64); break;
     }
   }
 }
 
+//
+// CStructView
+//
+
+void CStructView::get(const CStructBase::Field &field, pjs::Value &value) {
+  if (auto layout = field.layout.get()) {
+    value.set(layout->view(m_data, m_offset + field.offset));
+    return;
+  }
+
+  auto size = field.size * field.count;
+  pjs::vl_array<uint8_t, 256> buf(size);
+  std::memset(buf.data(), 0, size);
+
+  // Copy just the bytes of this field out of whichever chunks hold them
+  size_t start = m_offset + field.offset;
+  size_t pos = 0;
+  for (const auto c : m_data->chunks()) {
+    auto ptr = std::get<0>(c);
+    size_t len = std::get<1>(c);
+    if (pos + len > start) {
+      auto skip = start > pos ? start - pos : 0;
+      auto copied = pos + skip - start;
+      auto n = std::min(len - skip, size - copied);
+      std::memcpy(buf.data() + copied, ptr + skip, n);
+      if (copied + n >= size) break;
+    }
+    pos += len;
+  }
+
+  CStructBase::decode(buf.data(), field, value);
+}
+
 } // namespace pipy
 
 namespace pjs {
@@ -386,11 +465,21 @@ template<> void ClassDef<CStructBase>::init() {
     ret.set(obj->as<CStructBase>()->decode(*data));
   });
 
+  method("view", [](Context &ctx, Object *obj, Value &ret) {
+    pipy::Data *data;
+    if (!ctx.arguments(1, &data)) return;
+    if (!data) { ret = Value::null; return; }
+    ret.set(obj->as<CStructBase>()->view(data));
+  });
+
   method("reflect", [](Context &ctx, Object *obj, Value &ret) {
     ret.set(obj->as<CStructBase>()->reflect());
   });
 }
 
+template<> void ClassDef<CStructView>::init() {
+}
+
 template<> void ClassDef<CStruct>::init() {
   super<CStructBase>();
   ctor([](Context &ctx) -> Object* {
@@ -30,8 +30,12 @@
 #include "data.hpp"
 #include "options.hpp"
 
+#include <vector>
+
 namespace pipy {
 
+class CStructView;
+
 //
 // CStructBase
 //
@@ -43,7 +47,10 @@ public:
   void add_field(pjs::Str *name, const char *type);
   void add_field(pjs::Str *name, CStructBase *type);
   auto encode(pjs::Object *values) -> Data*;
+  void encode(pjs::Object *values, void *buf);
   auto decode(const Data &data) -> pjs::Object*;
+  auto decode(const void *buf, size_t size) -> pjs::Object*;
+  auto view(Data *data, size_t offset = 0) -> CStructView*;
   auto reflect() -> pjs::Object*;
 
   class FieldReflection : public pjs::ObjectTemplate<FieldReflection> {
@@ -71,22 +78,58 @@ private:
     pjs::Value::Type type;
     pjs::Ref<CStructBase> layout;
     pjs::Ref<pjs::Str> name;
+    int slot = -1;
   };
 
   bool m_is_union;
-  std::list<Field> m_fields;
+  std::vector<Field> m_fields;
   size_t m_size = 0;
 
+  // Built on first use and dropped whenever a field is added
+  pjs::Ref<pjs::Class> m_class;
+  pjs::Ref<pjs::Class> m_view_class;
+
+  void compile();
+  void changed();
+
   static auto align(size_t offset, size_t alignment) -> size_t;
   static auto align_size(size_t size) -> size_t;
-  static void zero(Data::Builder &db, size_t count);
-  static void encode(Data::Builder &db, pjs::Object *values, CStructBase *layout);
-  static void encode(Data::Builder &db, int size, bool is_integral, bool is_unsigned, const pjs::Value &value);
-  static auto decode(Data::Reader &dr, CStructBase *layout) -> pjs::Object*;
-  static void decode(Data::Reader &dr, const Field &field, pjs::Object *values);
-  static void decode(Data::Reader &dr, int size, bool is_integral, bool is_unsigned, pjs::Value &value);
+  static void encode(uint8_t *buf, pjs::Object *values, CStructBase *layout);
+  static void encode(uint8_t *buf, int size, bool is_integral, bool is_unsigned, const pjs::Value &value);
+  static auto decode(const uint8_t *buf, CStructBase *layout) -> pjs::Object*;
+  static void decode(const uint8_t *buf, const Field &field, pjs::Value &value);
+  static void decode(const uint8_t *buf, int size, bool is_integral, bool is_unsigned, pjs::Value &value);
 
   friend class pjs::ObjectTemplate<CStructBase>;
+  friend class CStructView;
+};
+
+//
+// CStructView
+//
+// Reads the fields of a struct straight out of a Data buffer each time
+// they are accessed instead of decoding all of them up front.
+//
+
+class CStructView : public pjs::ObjectTemplate<CStructView> {
+public:
+  auto layout() const -> CStructBase* { return m_layout; }
+  auto data() const -> Data* { return m_data; }
+
+private:
+  CStructView(CStructBase *layout, Data *data, size_t offset)
+    : m_layout(layout)
+    , m_data(data)
+    , m_offset(offset) {}
+
+  pjs::Ref<CStructBase> m_layout;
+  pjs::Ref<Data> m_data;
+  size_t m_offset;
+
+  void get(const CStructBase::Field &field, pjs::Value &value);
+
+  friend class pjs::ObjectTemplate<CStructView>;
+  friend class CStructBase;
 };
 
 //
@@ -36,9 +36,12 @@
 #include "log.hpp"
 
 // all filters
+#include "filters/adaptive-concurrency.hpp"
 #include "filters/bgp.hpp"
 #include "filters/branch.hpp"
+#include "filters/cache.hpp"
 #include "filters/chain.hpp"
+#include "filters/coalesce.hpp"
 #include "filters/connect.hpp"
 #include "filters/compress.hpp"
 #include "filters/decompress.hpp"
@@ -52,12 +55,15 @@
 #include "filters/exec.hpp"
 #include "filters/fcgi.hpp"
 #include "filters/fork.hpp"
+#include "filters/grpc.hpp"
 #include "filters/http.hpp"
 #include "filters/insert.hpp"
+#include "filters/kafka.hpp"
 #include "filters/link.hpp"
 #include "filters/link-async.hpp"
 #include "filters/loop.hpp"
 #include "filters/mime.hpp"
+#include "filters/mirror.hpp"
 #include "filters/mqtt.hpp"
 #include "filters/mux.hpp"
 #include "filters/netlink.hpp"
@@ -76,12 +82,15 @@
 #include "filters/replace-start.hpp"
 #include "filters/replay.hpp"
 #include "filters/resp.hpp"
+#include "filters/retry.hpp"
 #include "filters/socks.hpp"
 #include "filters/split.hpp"
 #include "filters/tee.hpp"
 #include "filters/thrift.hpp"
 #include "filters/throttle.hpp"
 #include "filters/tls.hpp"
+#include "filters/trace.hpp"
+#include "filters/transform-body.hpp"
 #include "filters/use.hpp"
 #include "filters/wait.hpp"
 #include "filters/websocket.hpp"
@@ -126,6 +135,14 @@ void FilterConfigurator::accept_tls(pjs::Object *options) {
   require_sub_pipeline(append_filter(new tls::Server(options)));
 }
 
+void FilterConfigurator::adaptive_concurrency(pjs::Object *options) {
+  require_sub_pipeline(append_filter(new AdaptiveConcurrency(options)));
+}
+
+void FilterConfigurator::aggregate_kafka_produce(pjs::Object *options) {
+  require_sub_pipeline(append_filter(new kafka::ProduceAggregator(options)));
+}
+
 void FilterConfigurator::branch(int count, pjs::Function **conds, const pjs::Value *layouts) {
   append_filter(new Branch(count, conds, layouts));
 }
@@ -138,6 +155,14 @@ void FilterConfigurator::branch_message(int count, pjs::Function **conds, const
   append_filter(new BranchMessage(count, conds, layouts));
 }
 
+void FilterConfigurator::cache_dns(pjs::Object *options) {
+  require_sub_pipeline(append_filter(new CacheDNS(options)));
+}
+
+void FilterConfigurator::cache_http(pjs::Object *options) {
+  require_sub_pipeline(append_filter(new CacheHTTP(options)));
+}
+
 void FilterConfigurator::chain(const std::list<JSModule*> modules) {
   append_filter(new Chain(modules));
 }
@@ -146,12 +171,16 @@ void FilterConfigurator::chain_next() {
   append_filter(new ChainNext());
 }
 
-void FilterConfigurator::compress(const pjs::Value &algorithm) {
-  append_filter(new Compress(algorithm));
+void FilterConfigurator::coalesce(pjs::Function *key, pjs::Object *options) {
+  require_sub_pipeline(append_filter(new Coalesce(key, options)));
+}
+
+void FilterConfigurator::compress(const pjs::Value &algorithm, pjs::Object *options) {
+  append_filter(new Compress(algorithm, options));
 }
 
-void FilterConfigurator::compress_http(const pjs::Value &algorithm) {
-  append_filter(new CompressHTTP(algorithm));
+void FilterConfigurator::compress_http(const pjs::Value &algorithm, pjs::Object *options) {
+  append_filter(new CompressHTTP(algorithm, options));
 }
 
 void FilterConfigurator::connect(const pjs::Value &target, pjs::Object *options) {
@@ -182,8 +211,12 @@ void FilterConfigurator::decode_bgp(pjs::Object *options) {
   append_filter(new bgp::Decoder(options));
 }
 
-void FilterConfigurator::decode_dubbo() {
-  append_filter(new dubbo::Decoder());
+void FilterConfigurator::decode_dubbo(pjs::Object *options) {
+  append_filter(new dubbo::Decoder(options));
+}
+
+void FilterConfigurator::decode_grpc() {
+  append_filter(new grpc::Decoder());
 }
 
 void FilterConfigurator::decode_http_request(pjs::Function *handler) {
@@ -194,6 +227,10 @@ void FilterConfigurator::decode_http_response(pjs::Function *handler) {
   append_filter(new http::ResponseDecoder(handler));
 }
 
+void FilterConfigurator::decode_kafka(pjs::Object *options) {
+  append_filter(new kafka::Decoder(options));
+}
+
 void FilterConfigurator::decode_mqtt() {
   append_filter(new mqtt::Decoder());
 }
@@ -210,20 +247,24 @@ void FilterConfigurator::decode_resp() {
   append_filter(new resp::Decoder());
 }
 
-void FilterConfigurator::decode_thrift() {
-  append_filter(new thrift::Decoder());
+void FilterConfigurator::decode_socks_datagram() {
+  append_filter(new socks::DatagramDecoder());
 }
 
-void FilterConfigurator::decode_websocket() {
-  append_filter(new websocket::Decoder());
+void FilterConfigurator::decode_thrift(pjs::Object *options) {
+  append_filter(new thrift::Decoder(options));
 }
 
-void FilterConfigurator::decompress(const pjs::Value &algorithm) {
-  append_filter(new Decompress(algorithm));
+void FilterConfigurator::decode_websocket(pjs::Object *options) {
+  append_filter(new websocket::Decoder(options));
 }
 
-void FilterConfigurator::decompress_http() {
-  append_filter(new DecompressHTTP());
+void FilterConfigurator::decompress(const pjs::Value &algorithm, pjs::Object *options) {
+  append_filter(new Decompress(algorithm, options));
+}
+
+void FilterConfigurator::decompress_http(pjs::Object *options) {
+  append_filter(new DecompressHTTP(options));
 }
 
 void FilterConfigurator::deframe(pjs::Object *states) {
@@ -266,6 +307,10 @@ void FilterConfigurator::encode_dubbo() {
   append_filter(new dubbo::Encoder());
 }
 
+void FilterConfigurator::encode_grpc() {
+  append_filter(new grpc::Encoder());
+}
+
 void FilterConfigurator::encode_http_request(pjs::Object *options, pjs::Function *handler) {
   append_filter(new http::RequestEncoder(options, handler));
 }
@@ -274,6 +319,10 @@ void FilterConfigurator::encode_http_response(pjs::Object *options, pjs::Functio
   append_filter(new http::ResponseEncoder(options, handler));
 }
 
+void FilterConfigurator::encode_kafka() {
+  append_filter(new kafka::Encoder());
+}
+
 void FilterConfigurator::encode_mqtt() {
   append_filter(new mqtt::Encoder());
 }
@@ -286,20 +335,28 @@ void FilterConfigurator::encode_resp() {
   append_filter(new resp::Encoder());
 }
 
+void FilterConfigurator::encode_socks_datagram() {
+  append_filter(new socks::DatagramEncoder());
+}
+
 void FilterConfigurator::encode_thrift() {
   append_filter(new thrift::Encoder());
 }
 
-void FilterConfigurator::encode_websocket() {
-  append_filter(new websocket::Encoder());
+void FilterConfigurator::encode_websocket(pjs::Object *options) {
+  append_filter(new websocket::Encoder(options));
 }
 
 void FilterConfigurator::exec(const pjs::Value &command, pjs::Object *options) {
   append_filter(new Exec(command, options));
 }
 
-void FilterConfigurator::fork(const pjs::Value &init_arg) {
-  require_sub_pipeline(append_filter(new Fork(init_arg)));
+void FilterConfigurator::fanout_mqtt(const pjs::Value &trie) {
+  append_filter(new mqtt::Fanout(trie));
+}
+
+void FilterConfigurator::fork(const pjs::Value &init_arg, pjs::Object *options) {
+  require_sub_pipeline(append_filter(new Fork(init_arg, options)));
 }
 
 void FilterConfigurator::handle_body(pjs::Function *callback, pjs::Object *options) {
@@ -346,6 +403,10 @@ void FilterConfigurator::loop() {
   require_sub_pipeline(append_filter(new Loop()));
 }
 
+void FilterConfigurator::mirror(const pjs::Value &name, pjs::Object *options) {
+  append_filter(new Mirror(name, options));
+}
+
 void FilterConfigurator::mux(pjs::Function *session_selector, pjs::Object *options) {
   if (options && options->is_function()) {
     require_sub_pipeline(append_filter(new Mux(session_selector, options->as<pjs::Function>())));
@@ -390,6 +451,10 @@ void FilterConfigurator::replace_body(pjs::Object *replacement, pjs::Object *opt
   append_filter(new ReplaceBody(replacement, options));
 }
 
+void FilterConfigurator::replace_body_text(const pjs::Value &pattern, const pjs::Value &replacement) {
+  append_filter(new TransformBody(pattern, replacement));
+}
+
 void FilterConfigurator::replace_event(Event::Type type, pjs::Object *replacement) {
   append_filter(new ReplaceEvent(type, replacement));
 }
@@ -406,6 +471,10 @@ void FilterConfigurator::replay(pjs::Object *options) {
   require_sub_pipeline(append_filter(new Replay(options)));
 }
 
+void FilterConfigurator::retry(pjs::Object *options) {
+  require_sub_pipeline(append_filter(new Retry(options)));
+}
+
 void FilterConfigurator::serve_http(pjs::Object *handler, pjs::Object *options) {
   append_filter(new http::Server(handler, options));
 }
@@ -430,6 +499,14 @@ void FilterConfigurator::throttle_message_rate(pjs::Object *quota, pjs::Object *
   append_filter(new ThrottleMessageRate(quota, options));
 }
 
+void FilterConfigurator::trace(pjs::Object *options) {
+  require_sub_pipeline(append_filter(new Trace(options)));
+}
+
+void FilterConfigurator::transform_body(pjs::Function *callback, pjs::Object *options) {
+  append_filter(new TransformBody(callback, options));
+}
+
 void FilterConfigurator::use(JSModule *module, pjs::Str *pipeline) {
   append_filter(new Use(module, pipeline));
 }
@@ -1019,8 +1096,8 @@ template<> void ClassDef<FilterConfigurator>::init() {
   method("acceptProxyProtocol", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
     try {
-      Function *handler;
-      if (!ctx.arguments(1, &handler)) return;
+      Function *handler = nullptr;
+      if (!ctx.arguments(0, &handler)) return;
       config->accept_proxy_protocol(handler);
       result.set(thiz);
     } catch (std::runtime_error &err) {
@@ -1064,6 +1141,42 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.adaptiveConcurrency
+  method("adaptiveConcurrency", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    try {
+      Str *layout;
+      Object *options = nullptr;
+      if (ctx.try_arguments(1, &layout, &options)) {
+        config->adaptive_concurrency(options);
+        config->to(layout);
+      } else if (ctx.arguments(0, &options)) {
+        config->adaptive_concurrency(options);
+      }
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
+  // FilterConfigurator.aggregateKafkaProduce
+  method("aggregateKafkaProduce", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    try {
+      Str *layout;
+      Object *options = nullptr;
+      if (ctx.try_arguments(1, &layout, &options)) {
+        config->aggregate_kafka_produce(options);
+        config->to(layout);
+      } else if (ctx.arguments(0, &options)) {
+        config->aggregate_kafka_produce(options);
+      }
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.branch
   method("branch", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
@@ -1159,6 +1272,32 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.cacheDNS
+  method("cacheDNS", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    try {
+      config->cache_dns(options);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
+  // FilterConfigurator.cacheHTTP
+  method("cacheHTTP", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    try {
+      config->cache_http(options);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.chain
   method("chain", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
@@ -1202,13 +1341,28 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.coalesce
+  method("coalesce", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Function *key;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &key, &options)) return;
+    try {
+      config->coalesce(key, options);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.compress
   method("compress", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
     Value algorithm;
-    if (!ctx.arguments(1, &algorithm)) return;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &algorithm, &options)) return;
     try {
-      config->compress(algorithm);
+      config->compress(algorithm, options);
       result.set(thiz);
     } catch (std::runtime_error &err) {
       ctx.error(err);
@@ -1219,9 +1373,10 @@ template<> void ClassDef<FilterConfigurator>::init() {
   method("compressHTTP", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
     Value algorithm;
-    if (!ctx.arguments(1, &algorithm)) return;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &algorithm, &options)) return;
     try {
-      config->compress_http(algorithm);
+      config->compress_http(algorithm, options);
       result.set(thiz);
     } catch (std::runtime_error &err) {
       ctx.error(err);
@@ -1326,8 +1481,21 @@ template<> void ClassDef<FilterConfigurator>::init() {
   // FilterConfigurator.decodeDubbo
   method("decodeDubbo", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
     try {
-      config->decode_dubbo();
+      config->decode_dubbo(options);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
+  // FilterConfigurator.decodeGRPC
+  method("decodeGRPC", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    try {
+      config->decode_grpc();
       result.set(thiz);
     } catch (std::runtime_error &err) {
       ctx.error(err);
@@ -1360,6 +1528,19 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.decodeKafka
+  method("decodeKafka", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    try {
+      config->decode_kafka(options);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.decodeMQTT
   method("decodeMQTT", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
@@ -1404,11 +1585,24 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.decodeSOCKSDatagram
+  method("decodeSOCKSDatagram", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    try {
+      config->decode_socks_datagram();
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.decodeThrift
   method("decodeThrift", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
     try {
-      config->decode_thrift();
+      config->decode_thrift(options);
       result.set(thiz);
     } catch (std::runtime_error &err) {
       ctx.error(err);
@@ -1418,8 +1612,10 @@ template<> void ClassDef<FilterConfigurator>::init() {
   // FilterConfigurator.decodeWebSocket
   method("decodeWebSocket", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
     try {
-      config->decode_websocket();
+      config->decode_websocket(options);
       result.set(thiz);
     } catch (std::runtime_error &err) {
       ctx.error(err);
@@ -1430,9 +1626,10 @@ template<> void ClassDef<FilterConfigurator>::init() {
   method("decompress", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
     Value algorithm;
-    if (!ctx.arguments(1, &algorithm)) return;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &algorithm, &options)) return;
     try {
-      config->decompress(algorithm);
+      config->decompress(algorithm, options);
       result.set(thiz);
     } catch (std::runtime_error &err) {
       ctx.error(err);
@@ -1442,8 +1639,10 @@ template<> void ClassDef<FilterConfigurator>::init() {
   // FilterConfigurator.decompressHTTP
   method("decompressHTTP", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
     try {
-      config->decompress_http();
+      config->decompress_http(options);
       result.set(thiz);
     } catch (std::runtime_error &err) {
       ctx.error(err);
@@ -1603,6 +1802,17 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.encodeGRPC
+  method("encodeGRPC", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    try {
+      config->encode_grpc();
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.encodeHTTPRequest
   method("encodeHTTPRequest", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
@@ -1639,6 +1849,17 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.encodeKafka
+  method("encodeKafka", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    try {
+      config->encode_kafka();
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.encodeMQTT
   method("encodeMQTT", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
@@ -1672,6 +1893,17 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.encodeSOCKSDatagram
+  method("encodeSOCKSDatagram", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    try {
+      config->encode_socks_datagram();
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.encodeThrift
   method("encodeThrift", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
@@ -1686,8 +1918,10 @@ template<> void ClassDef<FilterConfigurator>::init() {
   // FilterConfigurator.encodeWebSocket
   method("encodeWebSocket", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
     try {
-      config->encode_websocket();
+      config->encode_websocket(options);
       result.set(thiz);
     } catch (std::runtime_error &err) {
       ctx.error(err);
@@ -1708,17 +1942,31 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.fanoutMQTT
+  method("fanoutMQTT", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Value trie;
+    if (!ctx.arguments(1, &trie)) return;
+    try {
+      config->fanout_mqtt(trie);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.fork
   method("fork", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
     try {
       Str *layout;
       Value init_arg;
-      if (ctx.try_arguments(1, &layout, &init_arg)) {
-        config->fork(init_arg);
+      Object *options = nullptr;
+      if (ctx.try_arguments(1, &layout, &init_arg, &options)) {
+        config->fork(init_arg, options);
         config->to(layout);
-      } else if (ctx.arguments(0, &init_arg)) {
-        config->fork(init_arg);
+      } else if (ctx.arguments(0, &init_arg, &options)) {
+        config->fork(init_arg, options);
       }
       result.set(thiz);
     } catch (std::runtime_error &err) {
@@ -1918,6 +2166,26 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.mirror
+  method("mirror", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Str *name = nullptr;
+    Function *name_f = nullptr;
+    Object *options = nullptr;
+    if (ctx.get(0, name) || ctx.get(0, name_f)) {
+      ctx.get(1, options);
+    } else {
+      ctx.error_argument_type(0, "a string or a function");
+      return;
+    }
+    try {
+      config->mirror(name ? Value(name) : Value(name_f), options);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.mux
   method("mux", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
@@ -2144,6 +2412,19 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.replaceBodyText
+  method("replaceBodyText", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Value pattern, replacement;
+    if (!ctx.arguments(1, &pattern, &replacement)) return;
+    try {
+      config->replace_body_text(pattern, replacement);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.replaceMessageEnd
   method("replaceMessageEnd", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
@@ -2209,6 +2490,19 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.retry
+  method("retry", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    try {
+      config->retry(options);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.serveHTTP
   method("serveHTTP", [](Context &ctx, Object *thiz, Value &result) {
     auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
@@ -2292,6 +2586,33 @@ template<> void ClassDef<FilterConfigurator>::init() {
     }
   });
 
+  // FilterConfigurator.transformBody
+  method("transformBody", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Function *callback;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &callback, &options)) return;
+    try {
+      config->transform_body(callback, options);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
+  // FilterConfigurator.trace
+  method("trace", [](Context &ctx, Object *thiz, Value &result) {
+    auto config = thiz->as<FilterConfigurator>()->trace_location(ctx);
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    try {
+      config->trace(options);
+      result.set(thiz);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   // FilterConfigurator.use
   method("use", [](Context &ctx, Object *thiz, Value &result) {
     static const std::string s_dot_so(".so");
@@ -58,30 +58,38 @@ public:
   void accept_proxy_protocol(pjs::Function *handler);
   void accept_socks(pjs::Function *on_connect);
   void accept_tls(pjs::Object *options);
+  void adaptive_concurrency(pjs::Object *options);
+  void aggregate_kafka_produce(pjs::Object *options);
   void branch(int count, pjs::Function **conds, const pjs::Value *layouts);
   void branch_message_start(int count, pjs::Function **conds, const pjs::Value *layouts);
   void branch_message(int count, pjs::Function **conds, const pjs::Value *layouts);
+  void cache_dns(pjs::Object *options);
+  void cache_http(pjs::Object *options);
   void chain(const std::list<JSModule*> modules);
   void chain_next();
-  void compress(const pjs::Value &algorithm);
-  void compress_http(const pjs::Value &algorithm);
+  void coalesce(pjs::Function *key, pjs::Object *options);
+  void compress(const pjs::Value &algorithm, pjs::Object *options);
+  void compress_http(const pjs::Value &algorithm, pjs::Object *options);
   void connect(const pjs::Value &target, pjs::Object *options);
   void connect_http_tunnel(pjs::Object *handshake);
   void connect_proxy_protocol(const pjs::Value &address);
   void connect_socks(const pjs::Value &address);
   void connect_tls(pjs::Object *options);
   void decode_bgp(pjs::Object *options);
-  void decode_dubbo();
+  void decode_dubbo(pjs::Object *options);
+  void decode_grpc();
   void decode_http_request(pjs::Function *handler);
   void decode_http_response(pjs::Function *handler);
+  void decode_kafka(pjs::Object *options);
   void decode_mqtt();
   void decode_multipart();
   void decode_netlink();
   void decode_resp();
-  void decode_thrift();
-  void decode_websocket();
-  void decompress(const pjs::Value &algorithm);
-  void decompress_http();
+  void decode_socks_datagram();
+  void decode_thrift(pjs::Object *options);
+  void decode_websocket(pjs::Object *options);
+  void decompress(const pjs::Value &algorithm, pjs::Object *options);
+  void decompress_http(pjs::Object *options);
   void deframe(pjs::Object *states);
   void demux(pjs::Object *options);
   void demux_fcgi();
@@ -92,15 +100,19 @@ public:
   void dump(const pjs::Value &tag);
   void encode_bgp(pjs::Object *options);
   void encode_dubbo();
+  void encode_grpc();
   void encode_http_request(pjs::Object *options, pjs::Function *handler);
   void encode_http_response(pjs::Object *options, pjs::Function *handler);
+  void encode_kafka();
   void encode_mqtt();
   void encode_netlink();
   void encode_resp();
+  void encode_socks_datagram();
   void encode_thrift();
-  void encode_websocket();
+  void encode_websocket(pjs::Object *options);
   void exec(const pjs::Value &command, pjs::Object *options);
-  void fork(const pjs::Value &init_arg);
+  void fanout_mqtt(const pjs::Value &trie);
+  void fork(const pjs::Value &init_arg, pjs::Object *options = nullptr);
   void handle_body(pjs::Function *callback, pjs::Object *options);
   void handle_event(Event::Type type, pjs::Function *callback);
   void handle_message(pjs::Function *callback, pjs::Object *options);
@@ -110,6 +122,7 @@ public:
   void link(pjs::Function *name = nullptr);
   void link_async(pjs::Function *name = nullptr);
   void loop();
+  void mirror(const pjs::Value &name, pjs::Object *options);
   void mux(pjs::Function *session_selector, pjs::Object *options);
   void mux_fcgi(pjs::Function *session_selector, pjs::Object *options);
   void mux_http(pjs::Function *session_selector, pjs::Object *options);
@@ -118,16 +131,20 @@ public:
   void produce(const pjs::Value &producer);
   void read(const pjs::Value &pathname, pjs::Object *options);
   void replace_body(pjs::Object *replacement, pjs::Object *options);
+  void replace_body_text(const pjs::Value &pattern, const pjs::Value &replacement);
   void replace_event(Event::Type type, pjs::Object *replacement);
   void replace_message(pjs::Object *replacement, pjs::Object *options);
   void replace_start(pjs::Object *replacement);
   void replay(pjs::Object *options);
+  void retry(pjs::Object *options);
   void serve_http(pjs::Object *handler, pjs::Object *options);
   void split(const pjs::Value &separator);
   void tee(const pjs::Value &filename, pjs::Object *options);
   void throttle_concurrency(pjs::Object *quota, pjs::Object *options);
   void throttle_data_rate(pjs::Object *quota, pjs::Object *options);
   void throttle_message_rate(pjs::Object *quota, pjs::Object *options);
+  void trace(pjs::Object *options);
+  void transform_body(pjs::Function *callback, pjs::Object *options);
   void use(JSModule *module, pjs::Str *pipeline);
   void use(nmi::NativeModule *module, pjs::Str *pipeline);
   void use(const std::list<JSModule*> modules, pjs::Str *pipeline, pjs::Function *when);
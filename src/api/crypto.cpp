@@ -24,9 +24,18 @@
  */
 
 #include "crypto.hpp"
+#include "crypto-offload.hpp"
+#include "fetch.hpp"
+#include "fs.hpp"
+#include "input.hpp"
+#include "list.hpp"
+#include "log.hpp"
+#include "net.hpp"
 #include "options.hpp"
+#include "thread-pool.hpp"
 #include "utils.hpp"
 #include "api/json.hpp"
+#include "api/url.hpp"
 
 #include <openssl/bio.h>
 #include <openssl/bn.h>
@@ -36,10 +45,14 @@
 #include <openssl/hmac.h>
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
+#include <openssl/ssl.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
 
+#include <algorithm>
+#include <set>
 #include <stdexcept>
+#include <unordered_map>
 
 namespace pipy {
 namespace crypto {
@@ -278,9 +291,24 @@ PrivateKey::PrivateKey(const GenerateOptions &options) {
 }
 
 PrivateKey::~PrivateKey() {
+  if (m_offload_pkey) EVP_PKEY_free(m_offload_pkey);
   if (m_pkey) EVP_PKEY_free(m_pkey);
 }
 
+//
+// A copy of the key whose private operations run on the crypto offload
+// threads when used inside an async TLS handshake. Returns nullptr for
+// key types that cannot be offloaded.
+//
+
+auto PrivateKey::offload_pkey() -> EVP_PKEY* {
+  if (!m_offload_checked) {
+    m_offload_checked = true;
+    m_offload_pkey = CryptoOffload::wrap(m_pkey);
+  }
+  return m_offload_pkey;
+}
+
 auto PrivateKey::to_pem() const -> Data* {
   auto bio = BIO_new(BIO_s_mem());
   PEM_write_bio_PrivateKey(bio, m_pkey, nullptr, nullptr, 0, nullptr, nullptr);
@@ -593,6 +621,286 @@ auto CertificateChain::read_pem(const void *data, size_t size) -> X509* {
   return x509;
 }
 
+//
+// CertificateStore
+//
+
+std::mutex CertificateStore::Store::s_stores_mutex;
+std::map<std::string, CertificateStore::Store*> CertificateStore::Store::s_stores;
+
+CertificateStore::Options::Options(pjs::Object *options) {
+  Value(options, "name")
+    .get(name)
+    .check_nullable();
+  Value(options, "dir")
+    .get(dir)
+    .check_nullable();
+  Value(options, "capacity")
+    .get(capacity)
+    .check_nullable();
+  Value(options, "load")
+    .get(load)
+    .check_nullable();
+}
+
+CertificateStore::CertificateStore(const Options &options)
+  : m_name(options.name.empty() ? options.dir : options.name)
+  , m_load(options.load)
+{
+  if (m_name.empty()) {
+    m_store = new Store(options.capacity);
+  } else {
+    m_store = Store::get(m_name, options.capacity);
+  }
+  if (!options.dir.empty()) {
+    m_store->scan(options.dir);
+  }
+}
+
+CertificateStore::~CertificateStore() {
+}
+
+void CertificateStore::add(const std::string &name, const pjs::Value &cert, const pjs::Value &key) {
+  auto to_pem = [](const pjs::Value &v) -> std::string {
+    if (v.is_string()) return v.s()->str();
+    if (v.is<pipy::Data>()) return v.as<pipy::Data>()->to_string();
+    pjs::Ref<pipy::Data> pem;
+    if (v.is<Certificate>()) pem = v.as<Certificate>()->to_pem();
+    else if (v.is<PrivateKey>()) pem = v.as<PrivateKey>()->to_pem();
+    return pem ? pem->to_string() : std::string();
+  };
+  m_store->add(name, to_pem(cert), to_pem(key), false);
+}
+
+bool CertificateStore::remove(const std::string &name) {
+  return m_store->remove(name);
+}
+
+bool CertificateStore::use(pjs::Context &ctx, SSL *ssl, pjs::Str *sni) {
+  thread_local static pjs::ConstStr s_cert("cert");
+  thread_local static pjs::ConstStr s_key("key");
+
+  Keys keys;
+  auto name = sni ? sni->str() : std::string();
+  if (!m_store->find(name, keys)) {
+    if (!m_load || !sni) return false;
+
+    pjs::Value arg(sni), ret;
+    (*m_load)(ctx, 1, &arg, ret);
+    if (!ctx.ok() || !ret.is_object() || !ret.o()) return false;
+
+    pjs::Value cert, key;
+    ret.o()->get(s_cert, cert);
+    ret.o()->get(s_key, key);
+    add(name, cert, key);
+    if (!m_store->find(name, keys)) return false;
+  }
+
+  SSL_use_PrivateKey(ssl, keys.pkey);
+  SSL_use_certificate(ssl, keys.chain[0]);
+  for (size_t i = 1; i < keys.chain.size(); i++) {
+    SSL_add1_chain_cert(ssl, keys.chain[i]);
+  }
+  return true;
+}
+
+CertificateStore::Keys::~Keys() {
+  for (auto *x509 : chain) X509_free(x509);
+  if (pkey) EVP_PKEY_free(pkey);
+}
+
+//
+// CertificateStore::Store
+//
+
+static void split_labels(const std::string &name, std::vector<std::string> &labels) {
+  size_t end = name.length();
+  while (end > 0) {
+    auto dot = name.rfind('.', end - 1);
+    auto start = (dot == std::string::npos ? 0 : dot + 1);
+    auto label = name.substr(start, end - start);
+    std::transform(label.begin(), label.end(), label.begin(), ::tolower);
+    labels.push_back(std::move(label));
+    if (dot == std::string::npos) break;
+    end = dot;
+  }
+}
+
+auto CertificateStore::Store::get(const std::string &name, size_t capacity) -> Store* {
+  std::lock_guard<std::mutex> lock(s_stores_mutex);
+  auto &p = s_stores[name];
+  if (!p) {
+    p = new Store(capacity);
+    p->retain();
+  }
+  return p;
+}
+
+//
+// Expects pairs of '<domain>.crt' and '<domain>.key' files, with
+// wildcard domains spelled '_.example.com' as well as '*.example.com'.
+// Only the names are read here, the files are read when needed.
+//
+
+void CertificateStore::Store::scan(const std::string &dir) {
+  std::list<std::string> names;
+  if (!fs::read_dir(dir, names)) {
+    throw std::runtime_error("cannot read certificate directory " + dir);
+  }
+
+  std::set<std::string> files(names.begin(), names.end());
+  for (const auto &f : names) {
+    if (f.length() <= 4 || f.compare(f.length() - 4, 4, ".crt")) continue;
+    auto base = f.substr(0, f.length() - 4);
+    if (!files.count(base + ".key")) continue;
+    auto name = base;
+    if (name.length() > 2 && name[0] == '_' && name[1] == '.') name[0] = '*';
+    add(name, utils::path_join(dir, f), utils::path_join(dir, base + ".key"), true);
+  }
+}
+
+void CertificateStore::Store::add(const std::string &name, const std::string &cert, const std::string &key, bool from_file) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto &p = *slot(name, true);
+  if (p) drop(p.get());
+  p.reset(new Entry);
+  p->cert = cert;
+  p->key = key;
+  p->from_file = from_file;
+}
+
+bool CertificateStore::Store::remove(const std::string &name) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto p = slot(name, false);
+  if (!p || !*p) return false;
+  drop(p->get());
+  p->reset();
+  return true;
+}
+
+bool CertificateStore::Store::find(const std::string &name, Keys &keys) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto e = lookup(name);
+  if (!e) return false;
+  if (!e->pkey && !load(e)) return false;
+  touch(e);
+  for (auto *x509 : e->chain) {
+    X509_up_ref(x509);
+    keys.chain.push_back(x509);
+  }
+  EVP_PKEY_up_ref(e->pkey);
+  keys.pkey = e->pkey;
+  return true;
+}
+
+auto CertificateStore::Store::lookup(const std::string &name) -> Entry* {
+  std::vector<std::string> labels;
+  split_labels(name, labels);
+  auto n = labels.size();
+  auto node = &m_root;
+  Entry *wildcard = nullptr;
+  for (size_t i = 0; i < n; i++) {
+    auto it = node->children.find(labels[i]);
+    if (it == node->children.end()) break;
+    node = it->second.get();
+    if (i + 2 == n && node->wildcard) wildcard = node->wildcard.get();
+    if (i + 1 == n && node->exact) return node->exact.get();
+  }
+  return wildcard ? wildcard : m_root.wildcard.get();
+}
+
+auto CertificateStore::Store::slot(const std::string &name, bool create) -> std::unique_ptr<Entry>* {
+  if (name == "*") return &m_root.wildcard;
+  std::vector<std::string> labels;
+  split_labels(name, labels);
+  bool wildcard = (!labels.empty() && labels.back() == "*");
+  if (wildcard) labels.pop_back();
+  if (labels.empty()) throw std::runtime_error("invalid domain name: " + name);
+  auto node = &m_root;
+  for (const auto &l : labels) {
+    auto &child = node->children[l];
+    if (!child) {
+      if (!create) return nullptr;
+      child.reset(new Node);
+    }
+    node = child.get();
+  }
+  return wildcard ? &node->wildcard : &node->exact;
+}
+
+bool CertificateStore::Store::load(Entry *e) {
+  std::string cert, key;
+  if (e->from_file) {
+    std::vector<uint8_t> buf;
+    if (!fs::read_file(e->cert, buf)) {
+      Log::error("[crypto] cannot read certificate file %s", e->cert.c_str());
+      return false;
+    }
+    cert.assign((const char *)buf.data(), buf.size());
+    buf.clear();
+    if (!fs::read_file(e->key, buf)) {
+      Log::error("[crypto] cannot read private key file %s", e->key.c_str());
+      return false;
+    }
+    key.assign((const char *)buf.data(), buf.size());
+  } else {
+    cert = e->cert;
+    key = e->key;
+  }
+
+  auto bio = BIO_new_mem_buf(cert.c_str(), cert.length());
+  while (auto x509 = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) {
+    e->chain.push_back(x509);
+  }
+  BIO_free(bio);
+  ERR_clear_error();
+
+  bio = BIO_new_mem_buf(key.c_str(), key.length());
+  e->pkey = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
+  BIO_free(bio);
+
+  if (e->chain.empty() || !e->pkey) {
+    ERR_clear_error();
+    Log::error("[crypto] invalid certificate or private key in %s", e->from_file ? e->cert.c_str() : "store");
+    e->unload();
+    return false;
+  }
+
+  return true;
+}
+
+void CertificateStore::Store::touch(Entry *e) {
+  if (e->in_lru) {
+    m_lru.remove(e);
+  } else {
+    e->in_lru = true;
+    m_loaded++;
+  }
+  m_lru.push(e);
+  while (m_loaded > m_capacity) {
+    auto *old = m_lru.head();
+    drop(old);
+    old->unload();
+  }
+}
+
+void CertificateStore::Store::drop(Entry *e) {
+  if (e->in_lru) {
+    m_lru.remove(e);
+    e->in_lru = false;
+    m_loaded--;
+  }
+}
+
+void CertificateStore::Store::Entry::unload() {
+  for (auto *x509 : chain) X509_free(x509);
+  chain.clear();
+  if (pkey) {
+    EVP_PKEY_free(pkey);
+    pkey = nullptr;
+  }
+}
+
 //
 // Cipher
 //
@@ -1085,6 +1393,102 @@ JWK::~JWK() {
   }
 }
 
+//
+// JWT key and signature caches
+//
+// PEM keys given as strings are parsed once per thread and kept by their
+// text. Tokens verified successfully against a key are remembered with a
+// reference to that key, so seeing the same token again skips the public
+// key operation. Both caches drop their least recently used entries.
+//
+
+static const size_t JWT_KEY_CACHE_SIZE = 64;
+static const size_t JWT_TOKEN_CACHE_SIZE = 4096;
+
+class JWTCache {
+public:
+  static auto key(const char *pem, int len) -> EVP_PKEY*;
+  static bool verified(const std::string &token, EVP_PKEY *pkey);
+  static void set_verified(const std::string &token, EVP_PKEY *pkey);
+
+private:
+  struct Entry : public List<Entry>::Item {
+    std::string key;
+    EVP_PKEY *pkey;
+    ~Entry() { EVP_PKEY_free(pkey); }
+  };
+
+  struct LRU {
+    std::unordered_map<std::string, Entry*> map;
+    List<Entry> list;
+    ~LRU() { while (auto e = list.head()) { list.remove(e); delete e; } }
+    auto get(const std::string &key) -> Entry*;
+    void set(const std::string &key, EVP_PKEY *pkey, size_t limit);
+  };
+
+  static auto keys() -> LRU& { thread_local static LRU s_lru; return s_lru; }
+  static auto tokens() -> LRU& { thread_local static LRU s_lru; return s_lru; }
+};
+
+auto JWTCache::LRU::get(const std::string &key) -> Entry* {
+  auto i = map.find(key);
+  if (i == map.end()) return nullptr;
+  auto e = i->second;
+  if (e != list.tail()) {
+    list.remove(e);
+    list.push(e);
+  }
+  return e;
+}
+
+void JWTCache::LRU::set(const std::string &key, EVP_PKEY *pkey, size_t limit) {
+  auto &e = map[key];
+  if (e) {
+    EVP_PKEY_free(e->pkey);
+    list.remove(e);
+  } else {
+    e = new Entry;
+    e->key = key;
+  }
+  EVP_PKEY_up_ref(pkey);
+  e->pkey = pkey;
+  list.push(e);
+  while (list.size() > limit) {
+    auto head = list.head();
+    list.remove(head);
+    map.erase(head->key);
+    delete head;
+  }
+}
+
+auto JWTCache::key(const char *pem, int len) -> EVP_PKEY* {
+  std::string text(pem, len);
+  auto &lru = keys();
+  if (auto e = lru.get(text)) return e->pkey;
+
+  auto bio = BIO_new_mem_buf(pem, len);
+  auto pkey = PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr);
+  if (!pkey) {
+    BIO_reset(bio);
+    pkey = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
+  }
+  BIO_free(bio);
+  if (!pkey) throw_error();
+
+  lru.set(text, pkey, JWT_KEY_CACHE_SIZE);
+  EVP_PKEY_free(pkey);
+  return pkey;
+}
+
+bool JWTCache::verified(const std::string &token, EVP_PKEY *pkey) {
+  auto e = tokens().get(token);
+  return e && e->pkey == pkey;
+}
+
+void JWTCache::set_verified(const std::string &token, EVP_PKEY *pkey) {
+  tokens().set(token, pkey, JWT_TOKEN_CACHE_SIZE);
+}
+
 //
 // JWT
 //
@@ -1119,6 +1523,10 @@ JWT::JWT(pjs::Str *token) {
   if (int(algorithm) < 0) return;
   m_algorithm = algorithm;
 
+  pjs::Value kid;
+  m_header.o()->get("kid", kid);
+  if (kid.is_string()) m_key_id = kid.s()->str();
+
   switch (algorithm) {
     case Algorithm::ES256:
     case Algorithm::ES384:
@@ -1203,33 +1611,22 @@ bool JWT::verify(const char *key, int key_len) {
     return std::memcmp(m_signature.c_str(), hash, hash_size) == 0;
 
   } else {
-    auto bio = BIO_new_mem_buf(key, key_len);
-    auto pkey = PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr);
-    if (!pkey) {
-      BIO_reset(bio);
-      pkey = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
-    }
-    BIO_free(bio);
-    if (!pkey) throw_error();
-
-    auto result = verify(pkey);
-    EVP_PKEY_free(pkey);
-    return result;
+    return verify(JWTCache::key(key, key_len));
   }
 }
 
-bool JWT::verify(EVP_PKEY *pkey) {
-  auto md = get_md();
-  if (!md) return false;
-
+// Safe to call from any thread
+static bool verify_jwt_signature(
+  const EVP_MD *md, EVP_PKEY *pkey,
+  const char *input, size_t input_len,
+  const std::string &signature
+) {
   unsigned char hash[EVP_MAX_MD_SIZE];
   unsigned int hash_size;
 
   auto mdctx = EVP_MD_CTX_new();
   EVP_DigestInit_ex(mdctx, md, nullptr);
-  EVP_DigestUpdate(mdctx, m_header_str.c_str(), m_header_str.length());
-  EVP_DigestUpdate(mdctx, ".", 1);
-  EVP_DigestUpdate(mdctx, m_payload_str.c_str(), m_payload_str.length());
+  EVP_DigestUpdate(mdctx, input, input_len);
   EVP_DigestFinal_ex(mdctx, hash, &hash_size);
 
   auto pctx = EVP_PKEY_CTX_new(pkey, nullptr);
@@ -1239,8 +1636,8 @@ bool JWT::verify(EVP_PKEY *pkey) {
 
   auto result = EVP_PKEY_verify(
     pctx,
-    (unsigned char *)m_signature.c_str(),
-    m_signature.length(),
+    (unsigned char *)signature.c_str(),
+    signature.length(),
     hash, hash_size);
 
   EVP_PKEY_CTX_free(pctx);
@@ -1249,6 +1646,88 @@ bool JWT::verify(EVP_PKEY *pkey) {
   return result == 1;
 }
 
+auto JWT::token() const -> std::string {
+  std::string token;
+  token.reserve(m_header_str.length() + m_payload_str.length() + m_signature_str.length() + 2);
+  token += m_header_str;
+  token += '.';
+  token += m_payload_str;
+  token += '.';
+  token += m_signature_str;
+  return token;
+}
+
+bool JWT::verify(EVP_PKEY *pkey) {
+  auto md = get_md();
+  if (!md) return false;
+
+  auto token = this->token();
+  if (JWTCache::verified(token, pkey)) return true;
+
+  auto input_len = m_header_str.length() + 1 + m_payload_str.length();
+  if (!verify_jwt_signature(md, pkey, token.c_str(), input_len, m_signature)) return false;
+  JWTCache::set_verified(token, pkey);
+  return true;
+}
+
+void JWT::verify_async(EVP_PKEY *pkey, const std::function<void(bool)> &cb) {
+  auto md = get_md();
+  if (!m_is_valid || !md || !pkey ||
+      m_algorithm == Algorithm::HS256 ||
+      m_algorithm == Algorithm::HS384 ||
+      m_algorithm == Algorithm::HS512
+  ) {
+    cb(false);
+    return;
+  }
+
+  auto token = this->token();
+  if (JWTCache::verified(token, pkey)) {
+    cb(true);
+    return;
+  }
+
+  // Only the task itself crosses threads, and the callback is
+  // moved out of it before it could be freed on the pool thread
+  struct Task {
+    std::string token;
+    std::string signature;
+    size_t input_len;
+    const EVP_MD *md;
+    EVP_PKEY *pkey;
+    bool result = false;
+    std::function<void(bool)> cb;
+    ~Task() { EVP_PKEY_free(pkey); }
+  };
+
+  EVP_PKEY_up_ref(pkey);
+  auto task = std::make_shared<Task>();
+  task->input_len = m_header_str.length() + 1 + m_payload_str.length();
+  task->token = std::move(token);
+  task->signature = m_signature;
+  task->md = md;
+  task->pkey = pkey;
+  task->cb = cb;
+
+  auto net = &Net::current();
+  ThreadPool::shared().run(
+    [=]() {
+      task->result = verify_jwt_signature(
+        task->md, task->pkey,
+        task->token.c_str(), task->input_len,
+        task->signature
+      );
+      net->post(
+        [=]() {
+          auto cb = std::move(task->cb);
+          if (task->result) JWTCache::set_verified(task->token, task->pkey);
+          cb(task->result);
+        }
+      );
+    }
+  );
+}
+
 int JWT::jose2der(char *out, const char *inp, int len) {
   auto width = len >> 1;
   int zero_r = 0; while (zero_r < width && !inp[zero_r]) zero_r++;
@@ -1290,6 +1769,170 @@ int JWT::jose2der(char *out, const char *inp, int len) {
   return i;
 }
 
+//
+// JWKS
+//
+
+JWKS::Options::Options(pjs::Object *options) {
+  Value(options, "refreshInterval")
+    .get_seconds(refresh_interval)
+    .check_nullable();
+  Value(options, "minFetchInterval")
+    .get_seconds(min_fetch_interval)
+    .check_nullable();
+  Value(options, "timeout")
+    .get_seconds(timeout)
+    .check_nullable();
+}
+
+JWKS::JWKS(pjs::Str *url, const Options &options)
+  : m_options(options)
+  , m_url(URL::make(url))
+{
+  auto protocol = m_url->protocol()->str();
+  if (protocol != "http:" && protocol != "https:") {
+    throw std::runtime_error("JWKS URL must be http or https");
+  }
+  Fetch::Options fetch_options;
+  fetch_options.tls = (protocol == "https:");
+  m_fetch = new Fetch(m_url->hostname()->str() + ':' + m_url->port()->str(), fetch_options);
+  fetch();
+}
+
+JWKS::~JWKS() {
+  m_fetch->close();
+  delete m_fetch;
+}
+
+auto JWKS::key(const std::string &kid) -> JWK* {
+  auto i = m_keys.find(kid);
+  if (i != m_keys.end()) return i->second;
+  if (kid.empty() && m_keys.size() == 1) return m_keys.begin()->second;
+  return nullptr;
+}
+
+auto JWKS::verify(JWT *jwt) -> pjs::Promise* {
+  auto promise = pjs::Promise::make();
+  pjs::Ref<pjs::Promise::Settler> settler(pjs::Promise::Settler::make(promise));
+  if (!jwt->is_valid()) {
+    settler->resolve(false);
+  } else if (key(jwt->key_id())) {
+    verify(jwt, settler);
+  } else if (m_fetching || utils::now() - m_last_fetch >= m_options.min_fetch_interval * 1000) {
+    m_waiters.push_back({ jwt, settler });
+    fetch();
+  } else {
+    settler->resolve(false);
+  }
+  return promise;
+}
+
+void JWKS::refresh() {
+  fetch();
+}
+
+void JWKS::verify(JWT *jwt, pjs::Promise::Settler *settler) {
+  auto jwk = key(jwt->key_id());
+  if (!jwk || !jwk->is_valid()) {
+    settler->resolve(false);
+    return;
+  }
+  pjs::Ref<pjs::Promise::Settler> s(settler);
+  jwt->verify_async(
+    jwk->pkey(),
+    [=](bool result) {
+      InputContext ic;
+      s->resolve(result);
+    }
+  );
+}
+
+//
+// Only one fetch is in flight at a time. The object is retained until
+// it completes or times out so that waiting tokens always get settled.
+//
+
+void JWKS::fetch() {
+  if (m_fetching) return;
+  m_fetching = true;
+  m_last_fetch = utils::now();
+  m_refresh_timer.cancel();
+  retain();
+
+  m_timeout_timer.schedule(
+    m_options.timeout,
+    [this]() {
+      Log::warn("[jwks] timed out fetching %s", m_url->href()->c_str());
+      m_fetch->close();
+      fetched(nullptr);
+    }
+  );
+
+  (*m_fetch)(
+    Fetch::GET, m_url->path(), nullptr, nullptr,
+    [this](http::ResponseHead *head, Data *body) {
+      if (head && head->status == 200) {
+        fetched(body);
+      } else {
+        Log::warn("[jwks] failed fetching %s: status %d", m_url->href()->c_str(), head ? head->status : 0);
+        fetched(nullptr);
+      }
+    }
+  );
+}
+
+void JWKS::fetched(Data *body) {
+  if (!m_fetching) return;
+  m_fetching = false;
+  m_timeout_timer.cancel();
+
+  if (body) {
+    pjs::Value json, keys;
+    if (JSON::parse(body->to_string(), nullptr, json) && json.is_object() && json.o()) {
+      json.o()->get("keys", keys);
+    }
+    if (keys.is_array()) {
+      std::map<std::string, pjs::Ref<JWK>> key_set;
+      keys.as<pjs::Array>()->iterate_all(
+        [&](pjs::Value &v, int) {
+          if (!v.is_object() || !v.o()) return;
+          pjs::Value kid;
+          v.o()->get("kid", kid);
+          try {
+            pjs::Ref<JWK> jwk(JWK::make(v.o()));
+            if (jwk->is_valid()) {
+              key_set[kid.is_string() ? kid.s()->str() : std::string()] = jwk;
+            }
+          } catch (std::runtime_error &) {
+            // Key types not supported are skipped
+          }
+        }
+      );
+      m_keys.swap(key_set);
+    } else {
+      Log::warn("[jwks] invalid key set from %s", m_url->href()->c_str());
+    }
+  }
+
+  std::list<Waiter> waiters(std::move(m_waiters));
+  m_waiters.clear();
+  for (auto &w : waiters) {
+    if (key(w.jwt->key_id())) {
+      verify(w.jwt, w.settler);
+    } else {
+      InputContext ic;
+      w.settler->resolve(false);
+    }
+  }
+
+  m_refresh_timer.schedule(
+    m_options.refresh_interval,
+    [this]() { fetch(); }
+  );
+
+  release();
+}
+
 } // namespace crypto
 } // namespace pipy
 
@@ -1447,6 +2090,49 @@ template<> void ClassDef<Constructor<CertificateChain>>::init() {
   ctor();
 }
 
+//
+// CertificateStore
+//
+
+template<> void ClassDef<CertificateStore>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return nullptr;
+    try {
+      return CertificateStore::make(CertificateStore::Options(options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  method("add", [](Context &ctx, Object *obj, Value &ret) {
+    std::string name;
+    Value cert, key;
+    if (!ctx.arguments(3, &name, &cert, &key)) return;
+    try {
+      obj->as<CertificateStore>()->add(name, cert, key);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
+  method("remove", [](Context &ctx, Object *obj, Value &ret) {
+    std::string name;
+    if (!ctx.arguments(1, &name)) return;
+    try {
+      ret.set(obj->as<CertificateStore>()->remove(name));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+}
+
+template<> void ClassDef<Constructor<CertificateStore>>::init() {
+  super<Function>();
+  ctor();
+}
+
 //
 // Cipher
 //
@@ -1887,12 +2573,59 @@ template<> void ClassDef<Constructor<JWT>>::init() {
 // Crypto
 //
 
+//
+// JWKS
+//
+
+template<> void ClassDef<JWKS>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Str *url;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &url, &options)) return nullptr;
+    try {
+      return JWKS::make(url, options);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  method("key", [](Context &ctx, Object *obj, Value &ret) {
+    Str *kid;
+    if (!ctx.arguments(1, &kid)) return;
+    ret.set(obj->as<JWKS>()->key(kid->str()));
+  });
+
+  method("verify", [](Context &ctx, Object *obj, Value &ret) {
+    Str *token = nullptr;
+    JWT *jwt = nullptr;
+    if (ctx.try_arguments(1, &token)) {
+      jwt = JWT::make(token);
+    } else if (!ctx.arguments(1, &jwt) || !jwt) {
+      ctx.error_argument_type(0, "a JWT object or a string");
+      return;
+    }
+    pjs::Ref<JWT> hold(jwt);
+    ret.set(obj->as<JWKS>()->verify(jwt));
+  });
+
+  method("refresh", [](Context &ctx, Object *obj, Value &ret) {
+    obj->as<JWKS>()->refresh();
+  });
+}
+
+template<> void ClassDef<Constructor<JWKS>>::init() {
+  super<Function>();
+  ctor();
+}
+
 template<> void ClassDef<Crypto>::init() {
   ctor();
   variable("PublicKey", class_of<Constructor<PublicKey>>());
   variable("PrivateKey", class_of<Constructor<PrivateKey>>());
   variable("Certificate", class_of<Constructor<Certificate>>());
   variable("CertificateChain", class_of<Constructor<CertificateChain>>());
+  variable("CertificateStore", class_of<Constructor<CertificateStore>>());
   variable("Cipher", class_of<Constructor<Cipher>>());
   variable("Decipher", class_of<Constructor<Decipher>>());
   variable("Hash", class_of<Constructor<Hash>>());
@@ -1901,6 +2634,7 @@ template<> void ClassDef<Crypto>::init() {
   variable("Verify", class_of<Constructor<Verify>>());
   variable("JWT", class_of<Constructor<JWT>>());
   variable("JWK", class_of<Constructor<JWK>>());
+  variable("JWKS", class_of<Constructor<JWKS>>());
 }
 
 } // namespace pjs
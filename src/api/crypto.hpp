@@ -28,11 +28,25 @@
 
 #include "pjs/pjs.hpp"
 #include "data.hpp"
+#include "list.hpp"
 #include "options.hpp"
+#include "timer.hpp"
 
 #include <openssl/evp.h>
 
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 namespace pipy {
+
+class Fetch;
+class URL;
+
 namespace crypto {
 
 //
@@ -83,6 +97,7 @@ public:
   };
 
   auto pkey() const -> EVP_PKEY* { return m_pkey; }
+  auto offload_pkey() -> EVP_PKEY*;
   auto to_pem() const -> Data*;
 
 private:
@@ -92,6 +107,8 @@ private:
   ~PrivateKey();
 
   EVP_PKEY* m_pkey = nullptr;
+  EVP_PKEY* m_offload_pkey = nullptr;
+  bool m_offload_checked = false;
 
   static auto read_pem(const void *data, size_t size) -> EVP_PKEY*;
   static auto load_by_engine(const std::string &id) -> EVP_PKEY*;
@@ -116,6 +133,8 @@ private:
   ~PublicKey();
 
   EVP_PKEY* m_pkey = nullptr;
+  EVP_PKEY* m_offload_pkey = nullptr;
+  bool m_offload_checked = false;
 
   static auto read_pem(const void *data, size_t size) -> EVP_PKEY*;
   static auto load_by_engine(const std::string &id) -> EVP_PKEY*;
@@ -191,6 +210,105 @@ private:
   friend class pjs::ObjectTemplate<CertificateChain>;
 };
 
+//
+// CertificateStore
+//
+// Certificates for a large number of domains, shared by all worker
+// threads under one name. Only the domain names are known up front. A
+// certificate is parsed from PEM the first time a handshake asks for
+// it, and only the most recently used ones are kept parsed. Names live
+// in a trie of reversed labels, where '*.example.com' matches any one
+// label in front of 'example.com' and '*' matches anything.
+//
+
+class CertificateStore : public pjs::ObjectTemplate<CertificateStore> {
+public:
+  struct Options : public pipy::Options {
+    std::string name;
+    std::string dir;
+    size_t capacity = 10000;
+    pjs::Ref<pjs::Function> load;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  auto name() const -> const std::string& { return m_name; }
+  void add(const std::string &name, const pjs::Value &cert, const pjs::Value &key);
+  bool remove(const std::string &name);
+  bool use(pjs::Context &ctx, SSL *ssl, pjs::Str *sni);
+
+private:
+  CertificateStore(const Options &options);
+  ~CertificateStore();
+
+  //
+  // CertificateStore::Keys
+  //
+
+  struct Keys {
+    std::vector<X509*> chain;
+    EVP_PKEY* pkey = nullptr;
+    ~Keys();
+  };
+
+  //
+  // CertificateStore::Store
+  //
+
+  class Store : public pjs::RefCountMT<Store> {
+  public:
+    static auto get(const std::string &name, size_t capacity) -> Store*;
+
+    Store(size_t capacity) : m_capacity(capacity > 0 ? capacity : 1) {}
+
+    void scan(const std::string &dir);
+    void add(const std::string &name, const std::string &cert, const std::string &key, bool from_file);
+    bool remove(const std::string &name);
+    bool find(const std::string &name, Keys &keys);
+
+  private:
+    struct Entry : public List<Entry>::Item {
+      std::string cert; // PEM text or file name
+      std::string key;
+      std::vector<X509*> chain;
+      EVP_PKEY* pkey = nullptr;
+      bool from_file = false;
+      bool in_lru = false;
+      void unload();
+      ~Entry() { unload(); }
+    };
+
+    struct Node {
+      std::unordered_map<std::string, std::unique_ptr<Node>> children;
+      std::unique_ptr<Entry> exact;
+      std::unique_ptr<Entry> wildcard;
+    };
+
+    std::mutex m_mutex;
+    Node m_root;
+    List<Entry> m_lru;
+    size_t m_loaded = 0;
+    size_t m_capacity;
+
+    auto lookup(const std::string &name) -> Entry*;
+    auto slot(const std::string &name, bool create) -> std::unique_ptr<Entry>*;
+    bool load(Entry *e);
+    void touch(Entry *e);
+    void drop(Entry *e);
+
+    static std::mutex s_stores_mutex;
+    static std::map<std::string, Store*> s_stores;
+
+    friend class pjs::RefCountMT<Store>;
+  };
+
+  std::string m_name;
+  pjs::Ref<Store> m_store;
+  pjs::Ref<pjs::Function> m_load;
+
+  friend class pjs::ObjectTemplate<CertificateStore>;
+};
+
 //
 // Cipher
 //
@@ -355,6 +473,8 @@ public:
   };
 
   bool is_valid() const { return m_is_valid; }
+  auto algorithm() const -> Algorithm { return m_algorithm; }
+  auto key_id() const -> const std::string& { return m_key_id; }
   auto header() const -> const pjs::Value& { return m_header; }
   auto payload() const -> const pjs::Value& { return m_payload; }
   void sign(pjs::Str *key);
@@ -363,6 +483,10 @@ public:
   bool verify(JWK *key);
   bool verify(PublicKey *key);
 
+  // Checks the signature on the shared thread pool and calls back on the
+  // current thread. Only for algorithms based on public keys.
+  void verify_async(EVP_PKEY *pkey, const std::function<void(bool)> &cb);
+
 private:
   JWT(pjs::Str *token);
   ~JWT();
@@ -375,8 +499,10 @@ private:
   std::string m_payload_str;
   std::string m_signature_str;
   std::string m_signature;
+  std::string m_key_id;
 
   auto get_md() -> const EVP_MD*;
+  auto token() const -> std::string;
   bool verify(const char *key, int key_len);
   bool verify(EVP_PKEY *pkey);
   int jose2der(char *out, const char *inp, int len);
@@ -384,6 +510,55 @@ private:
   friend class pjs::ObjectTemplate<JWT>;
 };
 
+//
+// JWKS
+//
+// Keys fetched from a JWKS endpoint and refreshed periodically. Tokens
+// with an unknown key ID make the set refetch, with fetches coalesced
+// and rate limited. Verification runs on the shared thread pool and the
+// result comes back as a promise.
+//
+
+class JWKS : public pjs::ObjectTemplate<JWKS> {
+public:
+  struct Options : public pipy::Options {
+    double refresh_interval = 300;
+    double min_fetch_interval = 10;
+    double timeout = 10;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  auto key(const std::string &kid) -> JWK*;
+  auto verify(JWT *jwt) -> pjs::Promise*;
+  void refresh();
+
+private:
+  JWKS(pjs::Str *url, const Options &options);
+  ~JWKS();
+
+  struct Waiter {
+    pjs::Ref<JWT> jwt;
+    pjs::Ref<pjs::Promise::Settler> settler;
+  };
+
+  Options m_options;
+  pjs::Ref<URL> m_url;
+  Fetch* m_fetch = nullptr;
+  std::map<std::string, pjs::Ref<JWK>> m_keys;
+  std::list<Waiter> m_waiters;
+  Timer m_refresh_timer;
+  Timer m_timeout_timer;
+  double m_last_fetch = 0;
+  bool m_fetching = false;
+
+  void fetch();
+  void fetched(Data *body);
+  void verify(JWT *jwt, pjs::Promise::Settler *settler);
+
+  friend class pjs::ObjectTemplate<JWKS>;
+};
+
 //
 // Crypto
 //
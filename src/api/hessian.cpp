@@ -821,8 +821,8 @@ auto Hessian::Parser::push(const pjs::Value &value, CollectionState state, int l
   pjs::Value v(value);
 
   if (m_is_ref) {
-    if (!v.is_number()) return ERROR;
-    auto obj = m_obj_refs.get(v.n());
+    if (!v.is_number_like()) return ERROR;
+    auto obj = m_obj_refs.get(v.to_int32());
     if (!obj) return ERROR;
     v.set(obj);
   }
@@ -906,7 +906,9 @@ auto Hessian::Parser::push(const pjs::Value &value, CollectionState state, int l
             if (auto d = m_def_refs.get(v.to_int32())) {
               c->type = d->type;
               l->class_def = d;
-              l->state = CollectionState::LENGTH;
+              l->length = d->elements->as<pjs::Array>()->length();
+              l->state = CollectionState::VALUE;
+              if (!l->length) pop();
               return START;
             }
           }
@@ -931,7 +933,7 @@ auto Hessian::Parser::push(const pjs::Value &value, CollectionState state, int l
     l->class_def = class_def;
     m_stack = l;
     if (c->kind == Collection::Kind::class_def) {
-      m_def_refs.add(c);
+      l->def_index = m_def_refs.add(c);
     } else {
       m_obj_refs.add(c);
     }
@@ -945,12 +947,41 @@ void Hessian::Parser::pop() {
   auto *l = m_stack;
   while (l && l->length == l->count) {
     auto *level = l; l = l->back;
+    if (level->collection->kind == Collection::Kind::class_def) intern_class_def(level);
     delete level;
   }
   m_stack = l;
   if (!l) Deframer::need_flush();
 }
 
+void Hessian::Parser::intern_class_def(Level *level) {
+  auto *c = level->collection.get();
+  if (!c->elements) c->elements = pjs::Array::make();
+  auto *t = c->type.get();
+  if (!t) return;
+
+  auto i = m_class_defs.find(t);
+  if (i != m_class_defs.end()) {
+    auto *d = i->second.get();
+    auto *a = c->elements->as<pjs::Array>();
+    auto *b = d->elements->as<pjs::Array>();
+    auto n = a->length();
+    if (n == b->length()) {
+      auto *x = a->elements();
+      auto *y = b->elements();
+      int j = 0; while (j < n && x->at(j).s() == y->at(j).s()) j++;
+      if (j == n) {
+        m_def_refs.set(level->def_index, d);
+        return;
+      }
+    }
+    i->second = c;
+  } else {
+    if (m_class_defs.size() >= MAX_CLASS_DEFS) m_class_defs.clear();
+    m_class_defs[t] = c;
+  }
+}
+
 void Hessian::Parser::start() {
   if (!m_stack && m_root.is_undefined()) {
     on_message_start();
@@ -964,6 +995,23 @@ void Hessian::Parser::end() {
   }
 }
 
+//
+// Hessian::Decoder
+//
+
+auto Hessian::Decoder::decode(const Data &data) -> pjs::Array* {
+  auto *a = pjs::Array::make();
+  m_values = a;
+  Data buf(data);
+  parse(buf);
+  m_values = nullptr;
+  return a;
+}
+
+void Hessian::Decoder::on_message_end(const pjs::Value &value) {
+  if (m_values) m_values->push(value);
+}
+
 } // namespace pipy
 
 namespace pjs {
@@ -991,6 +1039,32 @@ template<> void ClassDef<Hessian>::init() {
     Hessian::encode(val, *data);
     ret.set(data);
   });
+
+  variable("Decoder", class_of<Constructor<Hessian::Decoder>>());
+}
+
+//
+// Hessian::Decoder
+//
+
+template<> void ClassDef<Hessian::Decoder>::init() {
+  ctor();
+
+  method("decode", [](Context &ctx, Object *obj, Value &ret) {
+    pipy::Data *data;
+    if (!ctx.arguments(1, &data)) return;
+    if (!data) { ret = Value::null; return; }
+    ret.set(obj->as<Hessian::Decoder>()->decode(*data));
+  });
+
+  method("reset", [](Context &ctx, Object *obj, Value &ret) {
+    obj->as<Hessian::Decoder>()->reset();
+  });
+}
+
+template<> void ClassDef<Constructor<Hessian::Decoder>>::init() {
+  super<Function>();
+  ctor();
 }
 
 //
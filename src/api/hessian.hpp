@@ -30,6 +30,8 @@
 #include "data.hpp"
 #include "deframer.hpp"
 
+#include <unordered_map>
+
 namespace pipy {
 
 class Data;
@@ -92,6 +94,11 @@ public:
       return nullptr;
     }
 
+    void set(int i, T *obj) {
+      if (0 <= i && i < m_size) m_refs[i] = obj;
+      else if (S <= i && i < S + m_excessive.size()) m_excessive[i-S] = obj;
+    }
+
     auto find(T *obj) -> int {
       for (int i = 0; i < m_size; i++) if (m_refs[i] == obj) return i;
       for (int i = 0; i < m_excessive.size(); i++) if (m_excessive[i] == obj) return i + S;
@@ -101,6 +108,7 @@ public:
     void clear() {
       for (int i = 0; i < S; i++) m_refs[i] = nullptr;
       m_excessive.clear();
+      m_size = 0;
     }
 
   private:
@@ -161,8 +169,20 @@ public:
       CollectionState state;
       int length;
       int count = 0;
+      int def_index = -1;
     };
 
+    //
+    // Class definitions seen by this parser keyed by type name. A later
+    // definition with the same fields is replaced by the earlier one, so
+    // objects of one class decoded from many messages share a definition.
+    // Unlike the reference maps, it survives reset().
+    //
+
+    enum { MAX_CLASS_DEFS = 1000 };
+
+    std::unordered_map<pjs::Str*, pjs::Ref<Collection>> m_class_defs;
+
     Level* m_stack = nullptr;
     pjs::Value m_root;
     pjs::Ref<Data> m_read_data;
@@ -185,6 +205,7 @@ public:
       Collection *class_def = nullptr
     ) -> State;
     void pop();
+    void intern_class_def(Level *level);
     void start();
     void end();
   };
@@ -205,6 +226,28 @@ public:
   private:
     std::function<void(const pjs::Value &)> m_cb;
   };
+
+  //
+  // Hessian::Decoder
+  //
+  // Decodes a Hessian stream fed in chunks, such as the bodies on one
+  // connection, keeping partly decoded values and the class definitions
+  // between calls.
+  //
+
+  class Decoder : public pjs::ObjectTemplate<Decoder>, public Parser {
+  public:
+    auto decode(const Data &data) -> pjs::Array*;
+
+  private:
+    Decoder() {}
+
+    pjs::Array* m_values = nullptr;
+
+    virtual void on_message_end(const pjs::Value &value) override;
+
+    friend class pjs::ObjectTemplate<Decoder>;
+  };
 };
 
 } // namespace pipy
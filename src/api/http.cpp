@@ -28,6 +28,7 @@
 #include "filters/http.hpp"
 #include "filters/tls.hpp"
 #include "codebase.hpp"
+#include "header-names.hpp"
 #include "fs.hpp"
 #include "compressor.hpp"
 #include "utils.hpp"
@@ -44,6 +45,8 @@ thread_local static const pjs::ConstStr s_CONNECT("CONNECT");
 thread_local static const pjs::ConstStr s_connection("connection");
 thread_local static const pjs::ConstStr s_upgrade("upgrade");
 thread_local static const pjs::ConstStr s_close("close");
+thread_local static const pjs::ConstStr s_cookie("cookie");
+thread_local static const pjs::ConstStr s_set_cookie("set-cookie");
 thread_local static const pjs::ConstStr s_http_1_0("HTTP/1.0");
 thread_local static const pjs::ConstStr s_websocket("websocket");
 thread_local static const pjs::ConstStr s_h2c("h2c");
@@ -56,12 +59,22 @@ thread_local static const pjs::ConstStr s_unauthorized("Unauthorized");
 thread_local static const pjs::ConstStr s_read_error("Read Error");
 thread_local static const pjs::ConstStr s_write_error("Write Error");
 thread_local static const pjs::ConstStr s_gateway_timeout("Gateway Timeout");
+thread_local static const pjs::ConstStr s_service_unavailable("Service Unavailable");
 thread_local static const pjs::ConstStr s_accept_encoding("accept-encoding");
 thread_local static const pjs::ConstStr s_content_encoding("content-encoding");
 thread_local static const pjs::ConstStr s_content_type("content-type");
 thread_local static const pjs::ConstStr s_application_octet_stream("application/octet-stream");
 thread_local static const pjs::ConstStr s_gzip("gzip");
 thread_local static const pjs::ConstStr s_br("br");
+thread_local static const pjs::ConstStr s_etag("etag");
+thread_local static const pjs::ConstStr s_last_modified("last-modified");
+thread_local static const pjs::ConstStr s_if_none_match("if-none-match");
+thread_local static const pjs::ConstStr s_if_modified_since("if-modified-since");
+thread_local static const pjs::ConstStr s_if_range("if-range");
+thread_local static const pjs::ConstStr s_range("range");
+thread_local static const pjs::ConstStr s_accept_ranges("accept-ranges");
+thread_local static const pjs::ConstStr s_content_range("content-range");
+thread_local static const pjs::ConstStr s_bytes("bytes");
 
 static const std::map<std::string, std::string> s_default_content_types = {
   { "html"  , "text/html" },
@@ -81,6 +94,7 @@ static const std::map<std::string, std::string> s_default_content_types = {
 
 bool MessageHead::is_final() const {
   pjs::Value v;
+  auto headers = this->headers();
   if (headers && headers->get(s_connection, v)) {
     return v.is_string() && v.s() == s_close;
   } else {
@@ -96,9 +110,81 @@ bool MessageHead::is_final(pjs::Str *header_connection) const {
   }
 }
 
+//
+// Header lines get here only after the decoder has checked them, so
+// every line has a non-empty name followed by a colon and ends in CRLF.
+//
+
+void MessageHead::materialize() const {
+  std::unique_ptr<RawHeaders> raw(std::move(m_raw_headers));
+  auto headers = pjs::Object::make();
+  auto names = pjs::Object::make();
+  m_headers = headers;
+  m_header_names = names;
+
+  std::string line, name, lower;
+
+  auto add_header = [&]() {
+    auto p = line.find(':');
+    if (p == std::string::npos) return;
+    auto i = line.find_first_not_of(' ');
+    if (i >= p) return;
+    auto j = line.find('\r', p + 1);
+    if (j == std::string::npos) j = line.length();
+    auto k = std::min(line.find_first_not_of(' ', p + 1), j);
+    name.assign(line, i, p - i);
+    lower = name;
+    for (auto &c : lower) c = std::tolower(c);
+    pjs::Ref<pjs::Str> key(HeaderNames::get(lower));
+    pjs::Ref<pjs::Str> val(k < j ? pjs::Str::make(line.c_str() + k, j - k) : pjs::Str::empty.get());
+    if (key == s_cookie || key == s_set_cookie) {
+      pjs::Value old;
+      headers->get(key, old);
+      if (old.is_array()) {
+        old.as<pjs::Array>()->push(val.get());
+      } else if (old.is_string()) {
+        auto a = pjs::Array::make(2);
+        a->set(0, old.s());
+        a->set(1, val.get());
+        headers->set(key, a);
+      } else {
+        headers->set(key, val.get());
+      }
+    } else if (key != s_connection) {
+      headers->set(key, val.get());
+    }
+    if (name != lower) {
+      names->set(key, pjs::Str::make(name));
+    }
+  };
+
+  auto next_line = [&](Data::Reader &r) {
+    line.clear();
+    for (int c; (c = r.get()) >= 0; ) {
+      if (c == '\n') return true;
+      line += char(c);
+    }
+    return false;
+  };
+
+  // Framing lines are put back in between where they were received
+  Data::Reader lines(raw->lines);
+  Data::Reader framing(raw->framing);
+  size_t offset = 0;
+  for (auto framing_offset : raw->framing_offsets) {
+    while (offset < framing_offset && next_line(lines)) {
+      offset += line.length() + 1;
+      add_header();
+    }
+    if (next_line(framing)) add_header();
+  }
+  while (next_line(lines)) add_header();
+}
+
 auto RequestHead::tunnel_type() const -> TunnelType {
   if (method == s_CONNECT) return TunnelType::CONNECT;
   pjs::Value v;
+  auto headers = this->headers();
   if (headers && headers->get(s_upgrade, v) && v.is_string()) {
     if (v.s() == s_websocket) return TunnelType::WEBSOCKET;
     if (v.s() == s_h2c) return TunnelType::HTTP2;
@@ -151,6 +237,9 @@ auto ResponseHead::error_to_status(StreamEnd::Error err, int &status) -> pjs::St
   case StreamEnd::WRITE_TIMEOUT:
     status = 504;
     return s_gateway_timeout;
+  case StreamEnd::OVERLOADED:
+    status = 503;
+    return s_service_unavailable;
   default:
     status = 502;
     return s_bad_gateway;
@@ -287,22 +376,59 @@ Agent::Agent(pjs::Str *host, pjs::Object *options)
     target = host->str() + (tls ? ":443" : ":80");
   }
 
-  auto pl_connect = PipelineLayout::make(m_module);
-  pl_connect->append(new Connect(target, options));
+  // Agents with the same target and options share connections
+  // no matter how many of them are made, e.g. one per tenant
+  Connect::Options connect_options(options);
+  tls::Client::Options tls_options(tls.get());
+  http::Mux::Options mux_options(options);
+
+  Upstream::Key key("agent");
+  key.add(target);
+  key.add((const Outbound::Options &)connect_options);
+  key.add(connect_options.bind.get());
+  key.add((const void *)connect_options.bind_f.get());
+  key.add((const void *)connect_options.on_state_f.get());
+  key.add(double(bool(tls)));
+  if (tls) key.add(tls_options);
+  key.add((const MuxSession::Options &)mux_options);
+  key.add((const void *)mux_options.priority_f.get());
+  key.add(double(mux_options.version));
+  key.add(mux_options.version_s.get());
+  key.add((const void *)mux_options.version_f.get());
+  key.add((const void *)mux_options.ping_f.get());
+  key.add(double(mux_options.max_pipeline));
+  key.add(double(mux_options.buffer_size));
+  key.add(double(mux_options.max_header_size));
+  key.add(double(mux_options.connection_window_size));
+  key.add(double(mux_options.stream_window_size));
+  key.add(double(mux_options.max_window_size));
+  key.add(double(mux_options.window_auto_tuning));
+  key.add(double(mux_options.write_batching));
+
+  m_upstream = Upstream::get(
+    key, mux_options.max_idle,
+    [&](Upstream *upstream) {
+      auto *mod = upstream->module();
+      auto pl_connect = PipelineLayout::make(mod);
+      pl_connect->append(new Connect(target, connect_options));
+
+      if (tls) {
+        auto pl_tls = PipelineLayout::make(mod);
+        pl_tls->append(new tls::Client(tls_options))->add_sub_pipeline(pl_connect);
+        pl_connect = pl_tls;
+      }
 
-  if (tls) {
-    auto pl_tls = PipelineLayout::make(m_module);
-    pl_tls->append(new tls::Client(tls.get()))->add_sub_pipeline(pl_connect);
-    pl_connect = pl_tls;
-  }
+      return pl_connect;
+    }
+  );
 
   m_pipeline_layout = PipelineLayout::make(m_module);
-  m_pipeline_layout->append(new http::Mux(nullptr, options))->add_sub_pipeline(pl_connect);
+  m_pipeline_layout->append(m_upstream->join(new http::Mux(m_upstream->selector(), mux_options)));
 }
 
 auto Agent::request(Message *req) -> pjs::Promise* {
   pjs::Ref<RequestHead> head(pjs::coerce<RequestHead>(req->head()));
-  return request(head->method, head->path, head->headers, req->body());
+  return request(head->method, head->path, head->headers(), req->body());
 }
 
 auto Agent::request(pjs::Str *method, pjs::Str *path, pjs::Object *headers, Data *body) -> pjs::Promise* {
@@ -320,7 +446,7 @@ auto Agent::request(pjs::Str *method, pjs::Str *path, pjs::Object *headers, Data
   auto head = RequestHead::make();
   head->method = method;
   head->path = path;
-  head->headers = headers;
+  head->headers(headers);
 
   auto r = new Request(this);
   return r->start(head, body);
@@ -482,6 +608,21 @@ auto Directory::serve(pjs::Context &ctx, Message *request) -> Message* {
 
   auto k = path;
   auto i = m_cache.find(k);
+
+  // Files on disk are revalidated against their modification time
+  // at most once a second so that edits show up without a restart
+  if (i != m_cache.end() && m_options.fs && !m_options.tarball) {
+    auto &f = i->second;
+    auto now = utils::now();
+    if (now - f.checked >= 1000) {
+      f.checked = now;
+      if (m_loader->mtime(f.pathname->str()) != f.mtime) {
+        m_cache.erase(i);
+        i = m_cache.end();
+      }
+    }
+  }
+
   if (i == m_cache.end()) {
     Data raw, gz, br;
     if (!m_loader->load_file(path, raw)) {
@@ -505,6 +646,9 @@ auto Directory::serve(pjs::Context &ctx, Message *request) -> Message* {
     f.raw = std::move(raw);
     f.gz = std::move(gz);
     f.br = std::move(br);
+    f.mtime = m_loader->mtime(path);
+    f.checked = utils::now();
+    set_validators(f);
 
     std::string ext;
     auto p = path.find('.', path.rfind('/'));
@@ -554,13 +698,95 @@ void Directory::set_content_types(pjs::Object *obj) {
   }
 }
 
+//
+// Strong validators: size and modification time for files on disk as
+// nginx does, or a hash of the content when there's no time to go by.
+// Compressed variants get their own tags since their bodies differ.
+//
+
+void Directory::set_validators(File &file) {
+  char buf[100];
+  if (file.mtime > 0) {
+    std::snprintf(buf, sizeof(buf), "%x-%llx", (unsigned)file.raw.size(), (unsigned long long)file.mtime);
+    auto t = std::time_t(file.mtime);
+    std::tm tm;
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    char date[40];
+    auto len = std::strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    file.last_modified = pjs::Str::make(date, len);
+  } else {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const auto c : file.raw.chunks()) {
+      auto p = std::get<0>(c);
+      auto n = std::get<1>(c);
+      for (int i = 0; i < n; i++) h = (h ^ (uint8_t)p[i]) * 0x100000001b3ull;
+    }
+    std::snprintf(buf, sizeof(buf), "%x-%llx", (unsigned)file.raw.size(), (unsigned long long)h);
+    file.last_modified = nullptr;
+  }
+  std::string tag(buf);
+  file.etag = pjs::Str::make('"' + tag + '"');
+  file.etag_gz = pjs::Str::make('"' + tag + "-gz\"");
+  file.etag_br = pjs::Str::make('"' + tag + "-br\"");
+}
+
+static bool etag_matches(const std::string &list, const std::string &etag) {
+  for (const auto &s : utils::split(list, ',')) {
+    auto tag = utils::trim(s);
+    if (tag == "*") return true;
+    if (utils::starts_with(tag, "W/")) tag = tag.substr(2);
+    if (tag == etag) return true;
+  }
+  return false;
+}
+
+// Parses a single "bytes=first-last" range, returning false for ones that
+// should be ignored, and sets size to 0 for ones that can't be satisfied
+static bool parse_range(const std::string &str, size_t total, size_t &offset, size_t &size) {
+  if (!utils::starts_with(str, "bytes=")) return false;
+  auto spec = utils::trim(str.substr(6));
+  if (spec.find(',') != std::string::npos) return false;
+  auto p = spec.find('-');
+  if (p == std::string::npos) return false;
+  auto a = utils::trim(spec.substr(0, p));
+  auto b = utils::trim(spec.substr(p + 1));
+  for (auto c : a) if (!std::isdigit(c)) return false;
+  for (auto c : b) if (!std::isdigit(c)) return false;
+  if (a.empty()) {
+    if (b.empty()) return false;
+    auto n = std::strtoull(b.c_str(), nullptr, 10);
+    if (n > total) n = total;
+    offset = total - n;
+    size = n;
+  } else {
+    auto first = std::strtoull(a.c_str(), nullptr, 10);
+    auto last = b.empty() ? total - 1 : std::strtoull(b.c_str(), nullptr, 10);
+    if (last >= total) last = total - 1;
+    if (first >= total || first > last) {
+      offset = size = 0;
+    } else {
+      offset = first;
+      size = last - first + 1;
+    }
+  }
+  return true;
+}
+
 auto Directory::get_encoded_response(pjs::Context &ctx, File &file, RequestHead *request) -> Message* {
   bool has_gz = false;
   bool has_br = false;
 
-  pjs::Value accept_encoding;
-  if (auto headers = request->headers.get()) {
+  pjs::Value accept_encoding, if_none_match, if_modified_since, if_range, range;
+  if (auto headers = request->headers()) {
     headers->get(s_accept_encoding.get(), accept_encoding);
+    headers->get(s_if_none_match.get(), if_none_match);
+    headers->get(s_if_modified_since.get(), if_modified_since);
+    headers->get(s_if_range.get(), if_range);
+    headers->get(s_range.get(), range);
   }
   if (accept_encoding.is_string()) {
     auto &s = accept_encoding.s()->str();
@@ -576,24 +802,28 @@ auto Directory::get_encoded_response(pjs::Context &ctx, File &file, RequestHead
     }
   }
 
-  Message *response = nullptr;
   auto head = ResponseHead::make();
   auto headers = Object::make();
-  head->headers = headers;
+  head->headers(headers);
   headers->set(s_content_type.get(), file.content_type.get());
 
+  const Data *body = nullptr;
+  pjs::Str *etag = file.etag;
+
   if (has_br && !file.br.empty()) {
     headers->set(s_content_encoding.get(), s_br.get());
-    response = Message::make(head, Data::make(file.br));
+    body = &file.br;
+    etag = file.etag_br;
 
   } else if (has_gz && !file.gz.empty()) {
     headers->set(s_content_encoding.get(), s_gzip.get());
-    response = Message::make(head, Data::make(file.gz));
+    body = &file.gz;
+    etag = file.etag_gz;
 
   } else {
-    Data *body = nullptr;
+    Data *compressed = nullptr;
     Compressor *compressor = nullptr;
-    auto output = [&](const Data &data) { body->push(data); };
+    auto output = [&](const Data &data) { compressed->push(data); };
 
     if ((has_gz || has_br) && m_options.compression_f) {
       auto accept_encoding = pjs::Object::make();
@@ -613,7 +843,7 @@ auto Directory::get_encoded_response(pjs::Context &ctx, File &file, RequestHead
         }
         if (ret.s() == s_gzip) {
           compressor = Compressor::gzip(output);
-          body = &file.gz;
+          compressed = &file.gz;
           headers->set(s_content_encoding.get(), s_gzip.get());
         } else {
           ctx.error("callback returned an unsupported compression algorithm");
@@ -625,13 +855,63 @@ auto Directory::get_encoded_response(pjs::Context &ctx, File &file, RequestHead
     if (compressor) {
       compressor->input(file.raw, true);
       compressor->finalize();
-      response = Message::make(head, Data::make(*body));
+      body = compressed;
+      etag = file.etag_gz;
     } else {
-      response = Message::make(head, Data::make(file.raw));
+      body = &file.raw;
     }
   }
 
-  return response;
+  headers->set(s_etag.get(), etag);
+  if (file.last_modified) headers->set(s_last_modified.get(), file.last_modified.get());
+
+  bool not_modified = false;
+  if (if_none_match.is_string()) {
+    not_modified = etag_matches(if_none_match.s()->str(), etag->str());
+  } else if (if_modified_since.is_string() && file.last_modified) {
+    not_modified = (if_modified_since.s()->str() == file.last_modified->str());
+  }
+
+  if (not_modified) {
+    head->status = 304;
+    return Message::make(head, nullptr);
+  }
+
+  // Ranges are served only on the identity encoding, as slices sharing
+  // the chunks of the cached body
+  if (body == &file.raw) {
+    headers->set(s_accept_ranges.get(), s_bytes.get());
+    if (range.is_string() && (
+      !if_range.is_string() ||
+      if_range.s()->str() == etag->str() ||
+      (file.last_modified && if_range.s()->str() == file.last_modified->str())
+    )) {
+      size_t total = body->size(), offset, size;
+      if (parse_range(range.s()->str(), total, offset, size)) {
+        char buf[100];
+        if (!size) {
+          std::snprintf(buf, sizeof(buf), "bytes */%llu", (unsigned long long)total);
+          headers->set(s_content_range.get(), pjs::Str::make(buf));
+          head->status = 416;
+          return Message::make(head, nullptr);
+        }
+        std::snprintf(
+          buf, sizeof(buf), "bytes %llu-%llu/%llu",
+          (unsigned long long)offset,
+          (unsigned long long)(offset + size - 1),
+          (unsigned long long)total
+        );
+        headers->set(s_content_range.get(), pjs::Str::make(buf));
+        head->status = 206;
+        auto slice = Data::make(*body);
+        slice->shift(offset);
+        slice->pop(slice->size() - size);
+        return Message::make(head, slice);
+      }
+    }
+  }
+
+  return Message::make(head, Data::make(*body));
 }
 
 //
@@ -675,6 +955,12 @@ bool Directory::FileSystemLoader::load_file(const std::string &path, Data &data)
   return false;
 }
 
+auto Directory::FileSystemLoader::mtime(const std::string &path) -> double {
+  fs::Stat st;
+  if (!fs::stat(utils::path_join(m_root_path, path), st)) return 0;
+  return st.mtime;
+}
+
 //
 // TarballLoader
 //
@@ -805,7 +1091,7 @@ auto File::to_message(pjs::Str *accept_encoding) -> pipy::Message* {
     if (!m_message_br) {
       auto head = ResponseHead::make();
       auto headers = Object::make();
-      head->headers = headers;
+      head->headers(headers);
       headers->set(
         pjs::EnumDef<StringConstants>::name(CONTENT_TYPE),
         m_content_type.get()
@@ -822,7 +1108,7 @@ auto File::to_message(pjs::Str *accept_encoding) -> pipy::Message* {
     if (!m_message_gz) {
       auto head = ResponseHead::make();
       auto headers = Object::make();
-      head->headers = headers;
+      head->headers(headers);
       headers->set(
         pjs::EnumDef<StringConstants>::name(CONTENT_TYPE),
         m_content_type.get()
@@ -845,7 +1131,7 @@ auto File::to_message(pjs::Str *accept_encoding) -> pipy::Message* {
       } else {
         auto head = ResponseHead::make();
         auto headers = Object::make();
-        head->headers = headers;
+        head->headers(headers);
         headers->set(pjs::EnumDef<StringConstants>::name(CONTENT_TYPE), m_content_type.get());
         m_message = Message::make(head, m_data);
       }
@@ -886,8 +1172,18 @@ template<> void EnumDef<StringConstants>::init() {
 
 template<> void ClassDef<MessageHead>::init() {
   field<Ref<Str>>("protocol", [](MessageHead *obj) { return &obj->protocol; });
-  field<Ref<Object>>("headers", [](MessageHead *obj) { return &obj->headers; });
-  field<Ref<Object>>("headerNames", [](MessageHead *obj) { return &obj->headerNames; });
+  accessor(
+    "headers",
+    [](Object *obj, Value &ret) { ret.set(obj->as<MessageHead>()->headers()); },
+    [](Object *obj, const Value &val) { Ref<Object> o; val.to(o); obj->as<MessageHead>()->headers(o); },
+    Field::Enumerable
+  );
+  accessor(
+    "headerNames",
+    [](Object *obj, Value &ret) { ret.set(obj->as<MessageHead>()->headerNames()); },
+    [](Object *obj, const Value &val) { Ref<Object> o; val.to(o); obj->as<MessageHead>()->headerNames(o); },
+    Field::Enumerable
+  );
 }
 
 template<> void ClassDef<MessageTail>::init() {
@@ -32,8 +32,10 @@
 #include "message.hpp"
 #include "tar.hpp"
 #include "options.hpp"
+#include "upstream.hpp"
 
 #include <string>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 
@@ -52,12 +54,40 @@ enum class TunnelType {
 
 class MessageHead : public pjs::ObjectTemplate<MessageHead> {
 public:
+
+  //
+  // MessageHead::RawHeaders
+  //
+  // Header lines as received by the decoder. The objects for headers and
+  // headerNames are only built out of them when either is first accessed.
+  // Until then, an encoder can copy the lines over as they are.
+  //
+
+  struct RawHeaders {
+    Data lines; // everything an encoder would output as is
+    Data framing; // transfer-encoding, content-length, keep-alive and connection
+    std::vector<size_t> framing_offsets; // size of lines when each framing line came
+    pjs::Ref<pjs::Str> upgrade;
+  };
+
   pjs::Ref<pjs::Str> protocol;
-  pjs::Ref<pjs::Object> headers;
-  pjs::Ref<pjs::Object> headerNames;
+
+  auto headers() const -> pjs::Object* { if (m_raw_headers) materialize(); return m_headers; }
+  auto headerNames() const -> pjs::Object* { if (m_raw_headers) materialize(); return m_header_names; }
+  void headers(pjs::Object *obj) { if (m_raw_headers) materialize(); m_headers = obj; }
+  void headerNames(pjs::Object *obj) { if (m_raw_headers) materialize(); m_header_names = obj; }
+  auto raw_headers() const -> const RawHeaders* { return m_raw_headers.get(); }
+  void raw_headers(RawHeaders *raw) { m_raw_headers.reset(raw); m_headers = nullptr; m_header_names = nullptr; }
 
   bool is_final() const;
   bool is_final(pjs::Str *header_connection) const;
+
+private:
+  mutable pjs::Ref<pjs::Object> m_headers;
+  mutable pjs::Ref<pjs::Object> m_header_names;
+  mutable std::unique_ptr<RawHeaders> m_raw_headers;
+
+  void materialize() const;
 };
 
 class MessageTail : public pjs::ObjectTemplate<MessageTail> {
@@ -158,6 +188,7 @@ private:
     virtual void on_reply(Event *evt) override;
   };
 
+  pjs::Ref<Upstream> m_upstream;
   pjs::Ref<Module> m_module;
   pjs::Ref<PipelineLayout> m_pipeline_layout;
   pjs::Ref<pjs::Str> m_host;
@@ -197,6 +228,12 @@ private:
   struct File {
     pjs::Ref<pjs::Str> pathname;
     pjs::Ref<pjs::Str> content_type;
+    pjs::Ref<pjs::Str> etag;
+    pjs::Ref<pjs::Str> etag_gz;
+    pjs::Ref<pjs::Str> etag_br;
+    pjs::Ref<pjs::Str> last_modified;
+    double mtime = 0;
+    double checked = 0;
     Data raw, gz, br;
   };
 
@@ -204,6 +241,9 @@ private:
   public:
     virtual ~Loader() {}
     virtual bool load_file(const std::string &path, Data &data) = 0;
+
+    // Modification time in seconds, or 0 if the source has none
+    virtual auto mtime(const std::string &path) -> double { return 0; }
   };
 
   class CodebaseLoader : public Loader {
@@ -217,6 +257,7 @@ private:
   public:
     FileSystemLoader(const std::string &path);
     virtual bool load_file(const std::string &path, Data &data) override;
+    virtual auto mtime(const std::string &path) -> double override;
     std::string m_root_path;
   };
 
@@ -234,6 +275,7 @@ private:
   std::map<std::string, pjs::Ref<pjs::Str>> m_content_types;
   pjs::Ref<pjs::Str> m_default_content_type;
 
+  void set_validators(File &file);
   auto get_encoded_response(pjs::Context &ctx, File &file, RequestHead *request) -> Message*;
 
   static Data::Producer s_dp;
@@ -26,7 +26,9 @@
 #include "ip.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 
 namespace pipy {
 
@@ -467,6 +469,257 @@ IPEndpoint::IPEndpoint(const std::string &addr, int p, Protocol proto)
   ip = IP::make(addr);
 }
 
+//
+// IPMap
+//
+
+std::map<std::string, pjs::Ref<IPMap::Table>> IPMap::s_shared;
+std::mutex IPMap::s_shared_mutex;
+
+auto IPMap::shared(pjs::Str *name) -> IPMap* {
+  std::lock_guard<std::mutex> lock(s_shared_mutex);
+  auto i = s_shared.find(name->str());
+  if (i == s_shared.end()) return nullptr;
+  return IPMap::make(i->second.get());
+}
+
+auto IPMap::shared(pjs::Str *name, const pjs::Value &entries) -> IPMap* {
+  std::lock_guard<std::mutex> lock(s_shared_mutex);
+  auto &t = s_shared[name->str()];
+  if (!t) {
+    try {
+      t = new Table(entries.is_object() ? entries.o() : nullptr);
+    } catch (std::runtime_error &) {
+      s_shared.erase(name->str());
+      throw;
+    }
+  }
+  return IPMap::make(t.get());
+}
+
+bool IPMap::lookup(const IPAddressData &addr, pjs::Value &value) {
+  uint8_t buf[16];
+  auto len = addr.to_bytes(buf);
+  auto i = m_table->lookup(buf, len);
+  if (!i--) return false;
+  if (!m_converted[i]) {
+    m_table->value(i).to_value(m_values[i]);
+    m_converted[i] = true;
+  }
+  value = m_values[i];
+  return true;
+}
+
+//
+// IPMap::Table
+//
+
+static const uint32_t IPMAP_NODE = 0x80000000;
+
+static auto ipmap_key(const uint8_t *addr) -> std::pair<uint64_t, uint64_t> {
+  uint64_t hi = 0, lo = 0;
+  for (int i = 0; i < 8; i++) hi = (hi << 8) | addr[i];
+  for (int i = 8; i < 16; i++) lo = (lo << 8) | addr[i];
+  return { hi, lo };
+}
+
+IPMap::Table::Table(pjs::Object *entries) {
+  std::vector<Prefix> v4, v6;
+
+  if (!entries) {
+  } else if (entries->is_array()) {
+    entries->as<pjs::Array>()->iterate_all(
+      [&](pjs::Value &v, int) {
+        if (v.is_string()) {
+          add(v.s()->str(), true, v4, v6);
+        } else if (v.is_array()) {
+          pjs::Value k, val;
+          v.as<pjs::Array>()->get(0, k);
+          v.as<pjs::Array>()->get(1, val);
+          if (!k.is_string()) throw std::runtime_error("CIDR string expected");
+          add(k.s()->str(), val, v4, v6);
+        } else {
+          throw std::runtime_error("CIDR string or [CIDR, value] pair expected");
+        }
+      }
+    );
+  } else {
+    entries->iterate_all(
+      [&](pjs::Str *k, pjs::Value &v) {
+        add(k->str(), v, v4, v6);
+      }
+    );
+  }
+
+  build_v4(v4);
+  build_v6(v6);
+}
+
+void IPMap::Table::add(const std::string &cidr, const pjs::Value &value, std::vector<Prefix> &v4, std::vector<Prefix> &v6) {
+  Prefix p;
+  std::memset(p.addr, 0, sizeof(p.addr));
+
+  auto i = cidr.find('/');
+  auto ip = cidr.substr(0, i);
+  bool is_v6 = false;
+
+  if (utils::get_ip_v4(ip, p.addr)) {
+    p.length = 32;
+  } else if (utils::get_ip_v6(ip, p.addr)) {
+    p.length = 128;
+    is_v6 = true;
+  } else {
+    throw std::runtime_error("invalid CIDR notation: " + cidr);
+  }
+
+  if (i != std::string::npos) {
+    auto max = p.length;
+    p.length = std::atoi(cidr.c_str() + i + 1);
+    if (p.length < 0 || p.length > max) throw std::runtime_error("CIDR mask out of range: " + cidr);
+  }
+
+  for (int b = 0; b < 16; b++) {
+    auto n = p.length - b * 8;
+    if (n <= 0) p.addr[b] = 0; else if (n < 8) p.addr[b] &= 0xff << (8 - n);
+  }
+
+  m_values.push_back(value);
+  p.value = m_values.size();
+  (is_v6 ? v6 : v4).push_back(p);
+}
+
+//
+// Prefixes are expanded from the shortest to the longest, so a longer
+// prefix always lands on top of the shorter ones it overlaps with, and
+// a range being filled can never contain a pointer to a deeper node.
+//
+
+void IPMap::Table::build_v4(std::vector<Prefix> &prefixes) {
+  if (prefixes.empty()) return;
+
+  std::stable_sort(
+    prefixes.begin(), prefixes.end(),
+    [](const Prefix &a, const Prefix &b) { return a.length < b.length; }
+  );
+
+  m_v4_root.assign(1 << 16, 0);
+
+  for (const auto &p : prefixes) {
+    const auto *a = p.addr;
+    size_t slot = (a[0] << 8) | a[1];
+    if (p.length <= 16) {
+      std::fill_n(m_v4_root.begin() + slot, 1 << (16 - p.length), p.value);
+      continue;
+    }
+
+    bool in_root = true;
+    for (int bits = 16, b = 2;; bits += 8, b++) {
+      auto e = in_root ? m_v4_root[slot] : m_v4_nodes[slot];
+      uint32_t node;
+      if (e & IPMAP_NODE) {
+        node = e & ~IPMAP_NODE;
+      } else {
+        node = m_v4_nodes.size();
+        m_v4_nodes.resize(node + 256, e);
+        (in_root ? m_v4_root[slot] : m_v4_nodes[slot]) = node | IPMAP_NODE;
+      }
+      auto rest = p.length - bits;
+      if (rest <= 8) {
+        std::fill_n(m_v4_nodes.begin() + node + a[b], 1 << (8 - rest), p.value);
+        break;
+      }
+      in_root = false;
+      slot = node + a[b];
+    }
+  }
+}
+
+//
+// Nested prefixes are turned into a flat list of range starts with the
+// value in effect from each start up to the next one. Walking prefixes in
+// address order with the enclosing ones on a stack, the value of the
+// enclosing prefix resumes right after the end of each nested one.
+//
+
+void IPMap::Table::build_v6(std::vector<Prefix> &prefixes) {
+  if (prefixes.empty()) return;
+
+  struct Range {
+    std::pair<uint64_t, uint64_t> start, end;
+    uint32_t value;
+  };
+
+  std::vector<Range> ranges;
+  ranges.reserve(prefixes.size());
+  for (const auto &p : prefixes) {
+    uint8_t end[16];
+    for (int b = 0; b < 16; b++) {
+      auto n = p.length - b * 8;
+      end[b] = n >= 8 ? p.addr[b] : (p.addr[b] | (n <= 0 ? 0xff : (0xff >> n)));
+    }
+    ranges.push_back({ ipmap_key(p.addr), ipmap_key(end), p.value });
+  }
+
+  std::stable_sort(
+    ranges.begin(), ranges.end(),
+    [](const Range &a, const Range &b) {
+      if (a.start != b.start) return a.start < b.start;
+      return a.end > b.end;
+    }
+  );
+
+  auto emit = [this](const std::pair<uint64_t, uint64_t> &start, uint32_t value) {
+    if (!m_v6_starts.empty() && m_v6_starts.back() == start) {
+      m_v6_values.back() = value;
+    } else if (m_v6_values.empty() ? value != 0 : m_v6_values.back() != value) {
+      m_v6_starts.push_back(start);
+      m_v6_values.push_back(value);
+    }
+  };
+
+  std::vector<const Range*> stack;
+
+  auto pop = [&]() {
+    auto r = stack.back();
+    stack.pop_back();
+    auto next = r->end;
+    if (!~next.first && !~next.second) return;
+    if (!++next.second) next.first++;
+    emit(next, stack.empty() ? 0 : stack.back()->value);
+  };
+
+  for (const auto &r : ranges) {
+    while (!stack.empty() && stack.back()->end < r.start) pop();
+    stack.push_back(&r);
+    emit(r.start, r.value);
+  }
+
+  while (!stack.empty()) pop();
+}
+
+auto IPMap::Table::lookup(const uint8_t *addr, size_t len) const -> uint32_t {
+  return len == 4 ? lookup_v4(addr) : lookup_v6(addr);
+}
+
+auto IPMap::Table::lookup_v4(const uint8_t *a) const -> uint32_t {
+  if (m_v4_root.empty()) return 0;
+  auto e = m_v4_root[(a[0] << 8) | a[1]];
+  if (e & IPMAP_NODE) {
+    e = m_v4_nodes[(e & ~IPMAP_NODE) + a[2]];
+    if (e & IPMAP_NODE) {
+      e = m_v4_nodes[(e & ~IPMAP_NODE) + a[3]];
+    }
+  }
+  return e;
+}
+
+auto IPMap::Table::lookup_v6(const uint8_t *a) const -> uint32_t {
+  auto k = ipmap_key(a);
+  auto i = std::upper_bound(m_v6_starts.begin(), m_v6_starts.end(), k);
+  if (i == m_v6_starts.begin()) return 0;
+  return m_v6_values[i - m_v6_starts.begin() - 1];
+}
+
 } // namespace pipy
 
 namespace pjs {
@@ -649,4 +902,90 @@ template<> void ClassDef<Constructor<IPEndpoint>>::init() {
   ctor();
 }
 
+//
+// IPMap
+//
+
+static bool ipmap_address(Context &ctx, IPAddressData &addr) {
+  Str *str;
+  IP *ip;
+  if (ctx.get(0, ip) && ip) {
+    addr = ip->data();
+    return true;
+  }
+  if (!ctx.get(0, str)) {
+    ctx.error_argument_type(0, "a string or an IP");
+    return false;
+  }
+  uint8_t ipv4[4];
+  uint16_t ipv6[8];
+  if (utils::get_ip_v4(str->str(), ipv4)) {
+    addr.set_v4(ipv4);
+  } else if (utils::get_ip_v6(str->str(), ipv6)) {
+    addr.set_v6(ipv6);
+  } else {
+    ctx.error("invalid IP address");
+    return false;
+  }
+  return true;
+}
+
+template<> void ClassDef<IPMap>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Object *entries;
+    if (!ctx.arguments(1, &entries)) return nullptr;
+    try {
+      return IPMap::make(entries);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  accessor("size", [](Object *obj, Value &ret) { ret.set(int(obj->as<IPMap>()->size())); });
+
+  method("lookup", [](Context &ctx, Object *obj, Value &ret) {
+    IPAddressData addr;
+    if (!ipmap_address(ctx, addr)) return;
+    obj->as<IPMap>()->lookup(addr, ret);
+  });
+
+  method("has", [](Context &ctx, Object *obj, Value &ret) {
+    IPAddressData addr;
+    Value v;
+    if (!ipmap_address(ctx, addr)) return;
+    ret.set(obj->as<IPMap>()->lookup(addr, v));
+  });
+}
+
+template<> void ClassDef<Constructor<IPMap>>::init() {
+  super<Function>();
+  ctor();
+
+  method("shared", [](Context &ctx, Object *obj, Value &ret) {
+    Str *name;
+    Object *entries = nullptr;
+    if (!ctx.arguments(1, &name, &entries)) return;
+    try {
+      if (!entries) {
+        ret.set(IPMap::shared(name));
+      } else if (entries->is_function()) {
+        // Only the first worker asking for the table gets to build it
+        if (auto m = IPMap::shared(name)) {
+          ret.set(m);
+        } else {
+          Value v;
+          (*entries->as<Function>())(ctx, 0, nullptr, v);
+          if (!ctx.ok()) return;
+          ret.set(IPMap::shared(name, v));
+        }
+      } else {
+        ret.set(IPMap::shared(name, entries));
+      }
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+}
+
 } // namespace pjs
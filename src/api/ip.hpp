@@ -28,6 +28,11 @@
 
 #include "pjs/pjs.hpp"
 
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
 namespace pipy {
 
 //
@@ -163,6 +168,74 @@ private:
   friend class pjs::ObjectTemplate<IPEndpoint>;
 };
 
+//
+// IPMap
+//
+// Longest-prefix match over a fixed set of CIDR blocks. IPv4 goes through
+// a 16-8-8 multibit trie so that a lookup costs no more than three
+// dependent loads. IPv6 prefixes are flattened into sorted disjoint ranges
+// and found by binary search, keeping memory linear in the number of
+// prefixes. Tables never change once built, so a named one is built by
+// the first worker asking for it and then shared by all the others.
+//
+
+class IPMap : public pjs::ObjectTemplate<IPMap> {
+public:
+  static auto shared(pjs::Str *name) -> IPMap*;
+  static auto shared(pjs::Str *name, const pjs::Value &entries) -> IPMap*;
+
+  auto size() const -> size_t { return m_table->size(); }
+  bool lookup(const IPAddressData &addr, pjs::Value &value);
+
+private:
+
+  //
+  // IPMap::Table
+  //
+
+  class Table : public pjs::RefCountMT<Table> {
+  public:
+    Table(pjs::Object *entries);
+
+    auto size() const -> size_t { return m_values.size(); }
+    auto value(uint32_t i) const -> const pjs::SharedValue& { return m_values[i]; }
+
+    // Returns the index of the value plus one, or zero if nothing matches
+    auto lookup(const uint8_t *addr, size_t len) const -> uint32_t;
+
+  private:
+    struct Prefix {
+      uint8_t addr[16];
+      int length;
+      uint32_t value;
+    };
+
+    std::vector<uint32_t> m_v4_root;
+    std::vector<uint32_t> m_v4_nodes;
+    std::vector<std::pair<uint64_t, uint64_t>> m_v6_starts;
+    std::vector<uint32_t> m_v6_values;
+    std::vector<pjs::SharedValue> m_values;
+
+    void add(const std::string &cidr, const pjs::Value &value, std::vector<Prefix> &v4, std::vector<Prefix> &v6);
+    void build_v4(std::vector<Prefix> &prefixes);
+    void build_v6(std::vector<Prefix> &prefixes);
+    auto lookup_v4(const uint8_t *addr) const -> uint32_t;
+    auto lookup_v6(const uint8_t *addr) const -> uint32_t;
+  };
+
+  IPMap(pjs::Object *entries) : IPMap(new Table(entries)) {}
+  IPMap(Table *table) : m_table(table), m_values(table->size()), m_converted(table->size()) {}
+
+  pjs::Ref<Table> m_table;
+  std::vector<pjs::Value> m_values;
+  std::vector<bool> m_converted;
+
+  static std::map<std::string, pjs::Ref<Table>> s_shared;
+  static std::mutex s_shared_mutex;
+
+  friend class pjs::ObjectTemplate<IPMap>;
+};
+
 } // namespace pipy
 
 #endif // NETMASK_HPP
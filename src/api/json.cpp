@@ -107,6 +107,19 @@ template<> void ClassDef<JSON>::init() {
     }
   });
 
+  method("pick", [](Context &ctx, Object *obj, Value &ret) {
+    pipy::Data *data;
+    Array *path;
+    if (!ctx.arguments(2, &data, &path)) return;
+    std::vector<Value> keys(path->length());
+    for (int i = 0; i < path->length(); i++) path->get(i, keys[i]);
+    std::string err;
+    if (!data || !JSON::pick(*data, keys, ret, err)) {
+      ctx.error(err);
+      ret = Value::undefined;
+    }
+  });
+
   method("encode", [](Context &ctx, Object *obj, Value &ret) {
     Value val;
     Function *replacer = nullptr;
@@ -145,13 +158,15 @@ static Data::Producer s_dp("JSON");
 
 class JSONVisitor {
 public:
-  JSONVisitor(JSON::Visitor *visitor) : m_parser(yajl_alloc(&s_callbacks, nullptr, visitor)) {}
+  JSONVisitor(JSON::Visitor *visitor)
+    : m_visitor(visitor)
+    , m_parser(yajl_alloc(&s_callbacks, nullptr, visitor)) {}
   ~JSONVisitor() { yajl_free(m_parser); }
 
   bool visit(const std::string &str, std::string &err) {
-    if (yajl_status_ok == yajl_parse(m_parser, (const unsigned char*)str.c_str(), str.length()) &&
-        yajl_status_ok == yajl_complete_parse(m_parser)
-    ) return true;
+    auto ret = yajl_parse(m_parser, (const unsigned char*)str.c_str(), str.length());
+    if (ret == yajl_status_client_canceled && m_visitor->stopped()) return true;
+    if (ret == yajl_status_ok && yajl_status_ok == yajl_complete_parse(m_parser)) return true;
     get_error(0, err);
     return false;
   }
@@ -162,6 +177,7 @@ public:
       auto ptr = std::get<0>(c);
       auto len = std::get<1>(c);
       auto ret = yajl_parse(m_parser, (const unsigned char*)ptr, len);
+      if (ret == yajl_status_client_canceled && m_visitor->stopped()) return true;
       if (ret != yajl_status_ok) {
         get_error(pos, err);
         return false;
@@ -176,6 +192,7 @@ public:
   }
 
 private:
+  JSON::Visitor* m_visitor;
   yajl_handle m_parser;
 
   void get_error(size_t base_position, std::string &err) {
@@ -193,16 +210,16 @@ private:
 
   static yajl_callbacks s_callbacks;
 
-  static int yajl_null(void *ctx) { static_cast<JSON::Visitor*>(ctx)->null(); return 1; }
-  static int yajl_boolean(void *ctx, int val) { static_cast<JSON::Visitor*>(ctx)->boolean(val); return 1; }
-  static int yajl_integer(void *ctx, long long val) { static_cast<JSON::Visitor*>(ctx)->integer(val); return 1; }
-  static int yajl_double(void *ctx, double val) { static_cast<JSON::Visitor*>(ctx)->number(val); return 1; }
-  static int yajl_string(void *ctx, const unsigned char *val, size_t len) { static_cast<JSON::Visitor*>(ctx)->string((const char *)val, len); return 1; }
-  static int yajl_start_map(void *ctx) { static_cast<JSON::Visitor*>(ctx)->map_start(); return 1; }
-  static int yajl_map_key(void *ctx, const unsigned char *key, size_t len) { static_cast<JSON::Visitor*>(ctx)->map_key((const char *)key, len); return 1; }
-  static int yajl_end_map(void *ctx) { static_cast<JSON::Visitor*>(ctx)->map_end(); return 1; }
-  static int yajl_start_array(void *ctx) { static_cast<JSON::Visitor*>(ctx)->array_start(); return 1; }
-  static int yajl_end_array(void *ctx) { static_cast<JSON::Visitor*>(ctx)->array_end(); return 1; }
+  static int yajl_null(void *ctx) { auto v = static_cast<JSON::Visitor*>(ctx); v->null(); return !v->stopped(); }
+  static int yajl_boolean(void *ctx, int val) { auto v = static_cast<JSON::Visitor*>(ctx); v->boolean(val); return !v->stopped(); }
+  static int yajl_integer(void *ctx, long long val) { auto v = static_cast<JSON::Visitor*>(ctx); v->integer(val); return !v->stopped(); }
+  static int yajl_double(void *ctx, double val) { auto v = static_cast<JSON::Visitor*>(ctx); v->number(val); return !v->stopped(); }
+  static int yajl_string(void *ctx, const unsigned char *val, size_t len) { auto v = static_cast<JSON::Visitor*>(ctx); v->string((const char *)val, len); return !v->stopped(); }
+  static int yajl_start_map(void *ctx) { auto v = static_cast<JSON::Visitor*>(ctx); v->map_start(); return !v->stopped(); }
+  static int yajl_map_key(void *ctx, const unsigned char *key, size_t len) { auto v = static_cast<JSON::Visitor*>(ctx); v->map_key((const char *)key, len); return !v->stopped(); }
+  static int yajl_end_map(void *ctx) { auto v = static_cast<JSON::Visitor*>(ctx); v->map_end(); return !v->stopped(); }
+  static int yajl_start_array(void *ctx) { auto v = static_cast<JSON::Visitor*>(ctx); v->array_start(); return !v->stopped(); }
+  static int yajl_end_array(void *ctx) { auto v = static_cast<JSON::Visitor*>(ctx); v->array_end(); return !v->stopped(); }
 };
 
 yajl_callbacks JSONVisitor::s_callbacks = {
@@ -223,11 +240,10 @@ yajl_callbacks JSONVisitor::s_callbacks = {
 // JSONParser
 //
 
-class JSONParser : public JSONVisitor, public JSON::Visitor {
+class JSONParser : public JSON::Visitor {
 public:
   JSONParser(const std::function<bool(pjs::Object*, const pjs::Value&, pjs::Value&)> &reviver)
-    : JSONVisitor(this)
-    , m_reviver(reviver) {}
+    : m_reviver(reviver) {}
 
   ~JSONParser() {
     auto *l = m_stack;
@@ -237,14 +253,18 @@ public:
     }
   }
 
+  auto result() const -> const pjs::Value& { return m_root; }
+
   bool parse(const std::string &str, pjs::Value &val, std::string &err) {
-    if (!visit(str, err)) return false;
+    JSONVisitor v(this);
+    if (!v.visit(str, err)) return false;
     val = m_root;
     return true;
   }
 
   bool parse(const Data &data, pjs::Value &val, std::string &err) {
-    if (!visit(data, err)) return false;
+    JSONVisitor v(this);
+    if (!v.visit(data, err)) return false;
     val = m_root;
     return true;
   }
@@ -343,6 +363,112 @@ private:
   }
 };
 
+//
+// JSONPicker
+//
+// Walks down a path of keys and indexes. Only the value found at the end
+// of the path is built, by handing its events over to a JSONParser, and
+// parsing stops right after it, or as soon as the path turns out missing.
+//
+
+class JSONPicker : public JSON::Visitor {
+public:
+  JSONPicker(const std::vector<pjs::Value> &path)
+    : m_path(path)
+    , m_parser(m_no_reviver) {}
+
+  auto result() const -> const pjs::Value& { return m_parser.result(); }
+
+private:
+  struct Frame {
+    int level;
+    bool is_array;
+    int index;
+    std::string key;
+  };
+
+  const std::vector<pjs::Value> &m_path;
+  const std::function<bool(pjs::Object*, const pjs::Value&, pjs::Value&)> m_no_reviver;
+  JSONParser m_parser;
+  std::vector<Frame> m_frames;
+  int m_capturing = 0;
+  bool m_stopped = false;
+
+  virtual bool stopped() const override { return m_stopped; }
+
+  virtual void null() override { if (scalar()) target()->null(); }
+  virtual void boolean(bool b) override { if (scalar()) target()->boolean(b); }
+  virtual void integer(int64_t i) override { if (scalar()) target()->integer(i); }
+  virtual void number(double n) override { if (scalar()) target()->number(n); }
+  virtual void string(const char *s, size_t len) override { if (scalar()) target()->string(s, len); }
+  virtual void map_start() override { if (container(false)) target()->map_start(); }
+  virtual void array_start() override { if (container(true)) target()->array_start(); }
+  virtual void map_end() override { if (end()) target()->map_end(); }
+  virtual void array_end() override { if (end()) target()->array_end(); }
+
+  virtual void map_key(const char *s, size_t len) override {
+    if (m_capturing) {
+      target()->map_key(s, len);
+    } else if (!m_frames.empty() && m_frames.back().level >= 0) {
+      m_frames.back().key.assign(s, len);
+    }
+  }
+
+  auto target() -> JSON::Visitor* { return &m_parser; }
+
+  // Tells which level of the path a value starting here is at, or -1
+  int locate() {
+    if (m_frames.empty()) return 0;
+    auto &f = m_frames.back();
+    auto index = f.index++;
+    if (f.level < 0) return -1;
+    const auto &k = m_path[f.level];
+    if (f.is_array) {
+      if (!k.is_number() || int(k.n()) != index) return -1;
+    } else {
+      if (!k.is_string() || k.s()->str() != f.key) return -1;
+    }
+    return f.level + 1;
+  }
+
+  bool scalar() {
+    if (m_capturing) return true;
+    auto level = locate();
+    if (level == int(m_path.size())) {
+      m_stopped = true;
+      return true;
+    }
+    if (level >= 0) m_stopped = true;
+    return false;
+  }
+
+  bool container(bool is_array) {
+    if (m_capturing) {
+      m_capturing++;
+      return true;
+    }
+    auto level = locate();
+    if (level == int(m_path.size())) {
+      m_capturing = 1;
+      return true;
+    }
+    m_frames.push_back({ level, is_array, 0, std::string() });
+    return false;
+  }
+
+  bool end() {
+    if (m_capturing) {
+      if (!--m_capturing) m_stopped = true;
+      return true;
+    }
+    if (!m_frames.empty()) {
+      if (m_frames.back().level >= 0) m_stopped = true;
+      m_frames.pop_back();
+    }
+    return false;
+  }
+};
+
 bool JSON::visit(const std::string &str, Visitor *visitor) {
   std::string err;
   JSONVisitor v(visitor);
@@ -415,6 +541,19 @@ bool JSON::decode(
   return parser.parse(data, val, err);
 }
 
+bool JSON::pick(
+  const Data &data,
+  const std::vector<pjs::Value> &path,
+  pjs::Value &val,
+  std::string &err
+) {
+  JSONPicker picker(path);
+  JSONVisitor v(&picker);
+  if (!v.visit(data, err)) return false;
+  val = picker.result();
+  return true;
+}
+
 bool JSON::encode(
   const pjs::Value &val,
   const std::function<bool(pjs::Object*, const pjs::Value&, pjs::Value&)> &replacer,
@@ -30,6 +30,7 @@
 #include "data.hpp"
 
 #include <functional>
+#include <vector>
 
 namespace pipy {
 
@@ -57,6 +58,7 @@ public:
     virtual void array_start() {}
     virtual void array_end() {}
     virtual void error(const std::string &err) {}
+    virtual bool stopped() const { return false; }
   };
 
   static bool visit(const std::string &str, Visitor *visitor);
@@ -96,6 +98,13 @@ public:
     std::string &err
   );
 
+  static bool pick(
+    const Data &data,
+    const std::vector<pjs::Value> &path,
+    pjs::Value &val,
+    std::string &err
+  );
+
   static bool encode(
     const pjs::Value &val,
     const std::function<bool(pjs::Object*, const pjs::Value&, pjs::Value&)> &replacer,
@@ -33,7 +33,9 @@
 #include "fstream.hpp"
 #include "admin-service.hpp"
 #include "admin-link.hpp"
+#include "compressor.hpp"
 #include "api/json.hpp"
+#include "api/stats.hpp"
 #include "api/url.hpp"
 #include "filters/tee.hpp"
 #include "filters/pack.hpp"
@@ -41,6 +43,10 @@
 #include "filters/http.hpp"
 #include "filters/connect.hpp"
 
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
 #ifndef _WIN32
 #include <unistd.h>
 #include <syslog.h>
@@ -304,68 +310,236 @@ void Logger::StdoutTarget::write(const Data &msg) {
 //
 // Logger::FileTarget
 //
+// Workers never write files themselves. Each line is pushed into a
+// per-thread ring that is drained by a single spooler thread, so a slow
+// disk stalls neither the workers nor the main event loop. When a ring
+// is full, the overflow policy decides whether the line is dropped, the
+// worker waits for room, or only a sample of lines are let through.
+//
+
+static const unsigned FILE_TARGET_SAMPLE_RATE = 8;
+static const double FILE_TARGET_RETRY_INTERVAL = 5000;
+
+thread_local std::map<Logger::FileTarget::Writer*, double> Logger::FileTarget::s_dropped;
+
+Logger::FileTarget::Options::Options(pjs::Object *options) {
+  Value(options, "overflow")
+    .get_enum(overflow)
+    .check_nullable();
+}
 
 void Logger::FileTarget::close_all_writers() {
-  s_all_writers.clear();
+  Spooler::get().stop();
+}
+
+void Logger::FileTarget::init_metrics() {
+  pjs::Ref<pjs::Array> label_names = pjs::Array::make();
+  label_names->length(1);
+  label_names->set(0, "file");
+
+  stats::Counter::make(
+    pjs::Str::make("pipy_log_dropped"),
+    label_names,
+    [](stats::Counter *counter) {
+      for (auto &i : s_dropped) {
+        auto n = i.second;
+        if (n > 0) {
+          pjs::Str *name = pjs::Str::make(i.first->filename())->retain();
+          counter->with_labels(&name, 1)->increase(n);
+          counter->increase(n);
+          name->release();
+          i.second = 0;
+        }
+      }
+    }
+  );
 }
 
-Logger::FileTarget::FileTarget(pjs::Str *filename)
-  : m_filename(pjs::Str::make(fs::abs_path(filename->str())))
+Logger::FileTarget::FileTarget(pjs::Str *filename, const Options &options)
+  : m_writer(Spooler::get().writer(fs::abs_path(filename->str())))
+  , m_overflow(options.overflow)
 {
 }
 
 void Logger::FileTarget::write(const Data &msg) {
-  auto name = m_filename->data()->retain();
-  auto sd = SharedData::make(msg)->retain();
-  Net::main().post(
-    [=]() {
-      Writer *writer = nullptr;
-      const auto &filename = name->str();
-      auto i = s_all_writers.find(filename);
-      if (i != s_all_writers.end()) {
-        writer = i->second.get();
-      } else {
-        writer = new Writer(filename);
-        s_all_writers[filename].reset(writer);
-      }
-      InputContext ic;
-      Data data;
-      sd->to_data(data);
-      writer->write(data);
-      name->release();
-      sd->release();
+  auto &spooler = Spooler::get();
+  auto *ring = spooler.ring();
+  auto tail = ring->tail.load(std::memory_order_relaxed);
+  auto used = tail - ring->head.load(std::memory_order_acquire);
+
+  if (m_overflow == Overflow::SAMPLE && used >= Ring::SIZE / 2) {
+    if (++m_sample_counter % FILE_TARGET_SAMPLE_RATE) {
+      s_dropped[m_writer]++;
+      return;
     }
-  );
+  }
+
+  while (used >= Ring::SIZE) {
+    if (m_overflow != Overflow::BLOCK || spooler.stopped()) {
+      s_dropped[m_writer]++;
+      return;
+    }
+    spooler.wake();
+    std::this_thread::yield();
+    used = tail - ring->head.load(std::memory_order_acquire);
+  }
+
+  auto &e = ring->entries[tail % Ring::SIZE];
+  e.writer = m_writer;
+  e.data = SharedData::make(msg)->retain();
+  ring->tail.store(tail + 1, std::memory_order_release);
+  spooler.wake();
 }
 
 //
 // Logger::FileTarget::Writer
 //
 
-std::map<std::string, std::unique_ptr<Logger::FileTarget::Writer>> Logger::FileTarget::s_all_writers;
+Logger::FileTarget::Writer::~Writer() {
+  if (m_file) std::fclose(m_file);
+}
 
-Logger::FileTarget::Writer::Writer(const std::string &filename)
-  : m_module(new Module)
+void Logger::FileTarget::Writer::write(const Data &msg) {
+  if (!m_file) {
+    auto now = utils::now();
+    if (now < m_retry_time) return;
+    m_file = std::fopen(m_filename.c_str(), "ab");
+    if (!m_file) {
+      m_retry_time = now + FILE_TARGET_RETRY_INTERVAL;
+      return;
+    }
+  }
+  for (const auto c : msg.chunks()) {
+    std::fwrite(std::get<0>(c), 1, std::get<1>(c), m_file);
+  }
+  std::fputc('\n', m_file);
+  m_dirty = true;
+}
+
+void Logger::FileTarget::Writer::flush() {
+  if (m_dirty) {
+    std::fflush(m_file);
+    m_dirty = false;
+  }
+}
+
+//
+// Logger::FileTarget::Spooler
+//
+
+auto Logger::FileTarget::Spooler::get() -> Spooler& {
+  static Spooler *s_spooler = new Spooler();
+  return *s_spooler;
+}
+
+Logger::FileTarget::Spooler::Spooler()
+  : m_rings(nullptr)
+  , m_sleeping(false)
+  , m_stopping(false)
 {
-  PipelineLayout *ppl = PipelineLayout::make();
-  Tee::Options options;
-  options.append = true;
-  ppl->append(new Tee(filename, options));
+}
 
-  m_pipeline_layout = ppl;
-  m_pipeline = Pipeline::make(ppl, Context::make());
+auto Logger::FileTarget::Spooler::writer(const std::string &filename) -> Writer* {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto &w = m_writers[filename];
+  if (!w) w.reset(new Writer(filename));
+  if (!m_started && !m_stopping) {
+    m_started = true;
+    m_thread = std::thread([this]() { main(); });
+  }
+  return w.get();
 }
 
-void Logger::FileTarget::Writer::write(const Data &msg) {
-  Data *buf = Data::make();
-  s_dp.push(buf, &msg);
-  s_dp.push(buf, '\n');
-  m_pipeline->input()->input(buf);
+//
+// A ring outlives the thread that created it. When that thread exits,
+// the ring is handed over to the next thread asking for one, which simply
+// carries on from where the previous producer left off.
+//
+
+auto Logger::FileTarget::Spooler::ring() -> Ring* {
+  struct Owner {
+    Ring *ring = nullptr;
+    ~Owner() { if (ring) ring->owned.store(false); }
+  };
+
+  thread_local static Owner s_owner;
+
+  if (!s_owner.ring) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto *r = m_rings.load(); r; r = r->next) {
+      if (!r->owned.load()) {
+        r->owned.store(true);
+        s_owner.ring = r;
+        break;
+      }
+    }
+    if (!s_owner.ring) {
+      auto *r = new Ring;
+      r->next = m_rings.load();
+      m_rings.store(r, std::memory_order_release);
+      s_owner.ring = r;
+    }
+  }
+
+  return s_owner.ring;
 }
 
-void Logger::FileTarget::Writer::shutdown() {
-  m_module->shutdown();
-  m_pipeline = nullptr;
+//
+// Wake-ups are sent without taking the lock. One might get lost in a
+// race with the spooler falling asleep, but the spooler never sleeps
+// longer than a few milliseconds anyway.
+//
+
+void Logger::FileTarget::Spooler::wake() {
+  if (m_sleeping.load(std::memory_order_relaxed)) {
+    m_cv.notify_one();
+  }
+}
+
+void Logger::FileTarget::Spooler::stop() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_stopping) return;
+  m_stopping = true;
+  if (!m_started) return;
+  lock.unlock();
+  m_cv.notify_one();
+  m_thread.join();
+  m_started = false;
+}
+
+void Logger::FileTarget::Spooler::main() {
+  for (;;) {
+    if (drain() > 0) continue;
+    if (m_stopping) break;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_sleeping.store(true);
+    m_cv.wait_for(lock, std::chrono::milliseconds(10));
+    m_sleeping.store(false);
+  }
+  drain();
+}
+
+auto Logger::FileTarget::Spooler::drain() -> size_t {
+  size_t count = 0;
+  for (auto *r = m_rings.load(std::memory_order_acquire); r; r = r->next) {
+    auto head = r->head.load(std::memory_order_relaxed);
+    auto tail = r->tail.load(std::memory_order_acquire);
+    while (head != tail) {
+      auto &e = r->entries[head % Ring::SIZE];
+      auto *w = e.writer;
+      auto was_dirty = w->dirty();
+      Data data;
+      e.data->to_data(data);
+      w->write(data);
+      if (!was_dirty && w->dirty()) m_dirty_writers.push_back(w);
+      e.data->release();
+      r->head.store(++head, std::memory_order_release);
+      count++;
+    }
+  }
+  for (auto *w : m_dirty_writers) w->flush();
+  m_dirty_writers.clear();
+  return count;
 }
 
 //
@@ -427,6 +601,11 @@ Logger::HTTPTarget::Options::Options(pjs::Object *options) {
     .check_nullable();
 }
 
+//
+// Targets posting the same requests to the same place share an Upstream
+// and so the batches going into its connection as well
+//
+
 Logger::HTTPTarget::HTTPTarget(pjs::Str *url, const Options &options)
   : m_module(new Module)
 {
@@ -436,34 +615,60 @@ Logger::HTTPTarget::HTTPTarget(pjs::Str *url, const Options &options)
   pjs::Ref<URL> url_obj = URL::make(url);
   bool is_tls = url_obj->protocol()->str() == "https:";
 
-  m_mux_grouper = pjs::Method::make(
-    "", [](pjs::Context &, pjs::Object *, pjs::Value &ret) {
-      ret.set(pjs::Str::empty);
-    }
-  );
-
-  PipelineLayout *ppl = PipelineLayout::make(m_module);
-  PipelineLayout *ppl_pack = PipelineLayout::make(m_module);
-
   Mux::Options mux_opts;
   mux_opts.output_count = 0;
-  ppl->append(new Mux(pjs::Function::make(m_mux_grouper), mux_opts))->add_sub_pipeline(ppl_pack);
-  ppl_pack->append(new Pack(options.batch_size, options.batch));
-  ppl_pack->append(new http::RequestEncoder(http::RequestEncoder::Options()));
-
-  if (is_tls) {
-    PipelineLayout *ppl_connect = PipelineLayout::make(m_module);
-    ppl_pack->append(new tls::Client(options.tls))->add_sub_pipeline(ppl_connect);
-    ppl_pack = ppl_connect;
-  }
 
   Connect::Options conn_opts;
   conn_opts.buffer_limit = options.buffer_limit;
   conn_opts.retry_delay = 5;
   conn_opts.retry_count = -1;
-  ppl_pack->append(new Connect(url_obj->host(), conn_opts));
 
-  m_ppl = ppl;
+  Upstream::Key key("log");
+  key.add(url);
+  key.add(options.method.get());
+  if (options.headers) {
+    options.headers->iterate_all(
+      [&](pjs::Str *k, pjs::Value &v) {
+        pjs::Ref<pjs::Str> s(v.to_string());
+        key.add(k);
+        key.add(s.get());
+      }
+    );
+  }
+  key.add(double(options.batch_size));
+  key.add(options.batch.timeout);
+  key.add(options.batch.vacancy);
+  key.add(options.batch.interval);
+  key.add(double(options.batch.adaptive));
+  key.add(options.batch.prefix.get());
+  key.add(options.batch.postfix.get());
+  key.add(options.batch.separator.get());
+  key.add((const Outbound::Options &)conn_opts);
+  if (is_tls) key.add(options.tls);
+  key.add((const MuxSession::Options &)mux_opts);
+
+  m_upstream = Upstream::get(
+    key, mux_opts.max_idle,
+    [&](Upstream *upstream) {
+      auto *mod = upstream->module();
+      PipelineLayout *ppl_pack = PipelineLayout::make(mod);
+      PipelineLayout *ppl = ppl_pack;
+      ppl->append(new Pack(options.batch_size, options.batch));
+      ppl->append(new http::RequestEncoder(http::RequestEncoder::Options()));
+
+      if (is_tls) {
+        PipelineLayout *ppl_connect = PipelineLayout::make(mod);
+        ppl->append(new tls::Client(options.tls))->add_sub_pipeline(ppl_connect);
+        ppl = ppl_connect;
+      }
+
+      ppl->append(new Connect(url_obj->host(), conn_opts));
+      return ppl_pack;
+    }
+  );
+
+  m_ppl = PipelineLayout::make(m_module);
+  m_ppl->append(m_upstream->join(new Mux(m_upstream->selector(), mux_opts)));
 
   auto *headers = pjs::Object::make();
   bool has_host = false;
@@ -480,7 +685,7 @@ Logger::HTTPTarget::HTTPTarget(pjs::Str *url, const Options &options)
   auto *head = http::RequestHead::make();
   head->method = options.method ? options.method.get() : s_POST.get();
   head->path = url_obj->path();
-  head->headers = headers;
+  head->headers(headers);
   m_message_start = MessageStart::make(head);
 }
 
@@ -566,6 +771,395 @@ void JSONLogger::log(int argc, const pjs::Value *args) {
   write(data);
 }
 
+//
+// ColumnarLogger
+//
+
+static Data::Producer s_dp_columnar("ColumnarLogger");
+
+static const char s_columnar_magic[] = { 'P', 'L', 'C', 'B' };
+
+static void push_varint(Data::Builder &db, uint64_t n) {
+  while (n >= 0x80) {
+    db.push(char(n | 0x80));
+    n >>= 7;
+  }
+  db.push(char(n));
+}
+
+static void push_zigzag(Data::Builder &db, int64_t n) {
+  push_varint(db, (uint64_t(n) << 1) ^ uint64_t(n >> 63));
+}
+
+static void push_string(Data::Builder &db, const std::string &s) {
+  push_varint(db, s.length());
+  db.push(s.c_str(), s.length());
+}
+
+ColumnarLogger::Options::Options(pjs::Object *options) {
+  Value(options, "blockSize")
+    .get(block_size)
+    .check_nullable();
+  Value(options, "interval")
+    .get_seconds(interval)
+    .check_nullable();
+  if (block_size < 1) throw std::runtime_error("options.blockSize expects a positive number");
+}
+
+ColumnarLogger::ColumnarLogger(pjs::Str *name, pjs::Object *schema, const Options &options)
+  : pjs::ObjectTemplate<ColumnarLogger, Logger>(name)
+  , m_options(options)
+{
+  if (schema) {
+    schema->iterate_all(
+      [&](pjs::Str *k, pjs::Value &) {
+        Type type = Type::STRING;
+        Options::Value(schema, k, "schema")
+          .get_enum(type)
+          .check();
+        m_columns.emplace_back();
+        auto &col = m_columns.back();
+        col.name = k;
+        col.type = type;
+      }
+    );
+  }
+}
+
+ColumnarLogger::~ColumnarLogger() {
+  flush();
+}
+
+void ColumnarLogger::log(int argc, const pjs::Value *args) {
+  pjs::Object *record = (argc > 0 && args[0].is_object() ? args[0].o() : nullptr);
+  if (!record) return;
+
+  for (auto &col : m_columns) {
+    pjs::Value v;
+    record->get(col.name, v);
+    if (v.is_undefined() || v.is_null()) {
+      col.present.push_back(false);
+      continue;
+    }
+    col.present.push_back(true);
+    if (col.type == Type::STRING) {
+      auto *s = v.to_string();
+      auto r = col.dictionary_map.emplace(s->str(), col.dictionary.size());
+      if (r.second) col.dictionary.push_back(s->str());
+      col.indices.push_back(r.first->second);
+      s->release();
+    } else {
+      col.numbers.push_back(v.to_number());
+    }
+  }
+
+  if (++m_rows >= m_options.block_size) {
+    flush();
+  } else if (!m_timer_scheduled && m_options.interval > 0) {
+    m_timer_scheduled = true;
+    m_timer.schedule(
+      m_options.interval,
+      [this]() {
+        InputContext ic;
+        m_timer_scheduled = false;
+        flush();
+      }
+    );
+  }
+}
+
+void ColumnarLogger::flush() {
+  if (!m_rows) return;
+
+  Data payload;
+  Data::Builder db(payload, &s_dp_columnar);
+  push_varint(db, m_rows);
+  push_varint(db, m_columns.size());
+  for (const auto &col : m_columns) {
+    push_string(db, col.name->str());
+    db.push(char(col.type));
+  }
+
+  for (auto &col : m_columns) {
+    for (int i = 0; i < m_rows; i += 8) {
+      uint8_t bits = 0;
+      for (int j = 0; j < 8 && i + j < m_rows; j++) {
+        if (col.present[i + j]) bits |= (1 << j);
+      }
+      db.push(char(bits));
+    }
+    switch (col.type) {
+      case Type::STRING:
+        push_varint(db, col.dictionary.size());
+        for (const auto &s : col.dictionary) push_string(db, s);
+        for (auto i : col.indices) push_varint(db, i);
+        break;
+      case Type::INT:
+        for (auto n : col.numbers) push_zigzag(db, int64_t(n));
+        break;
+      case Type::NUMBER:
+        for (auto n : col.numbers) {
+          uint64_t bits;
+          std::memcpy(&bits, &n, sizeof(bits));
+          for (int i = 0; i < 8; i++) db.push(char(bits >> (i * 8)));
+        }
+        break;
+      case Type::TIME: {
+        int64_t last = 0;
+        for (auto n : col.numbers) {
+          auto t = int64_t(n);
+          push_zigzag(db, t - last);
+          last = t;
+        }
+        break;
+      }
+    }
+    col.present.clear();
+    col.numbers.clear();
+    col.indices.clear();
+    col.dictionary.clear();
+    col.dictionary_map.clear();
+  }
+  db.flush();
+  m_rows = 0;
+
+  Data compressed;
+  auto *compressor = Compressor::deflate(
+    [&](Data &out) { compressed.push(out); }
+  );
+  compressor->input(payload, false);
+  compressor->flush();
+  compressor->finalize();
+
+  Data block;
+  Data::Builder db_block(block, &s_dp_columnar);
+  auto len = compressed.size();
+  db_block.push(s_columnar_magic, sizeof(s_columnar_magic));
+  for (int i = 0; i < 4; i++) db_block.push(char(len >> (i * 8)));
+  db_block.push(std::move(compressed));
+  db_block.flush();
+
+  InputContext ic;
+  write_targets(block);
+}
+
+//
+// ColumnarLogger decoder
+//
+
+class ColumnarReader {
+public:
+  ColumnarReader(const uint8_t *p, size_t n) : m_p(p), m_end(p + n) {}
+
+  bool ok() const { return m_ok; }
+
+  auto byte() -> uint8_t {
+    if (m_p >= m_end) { m_ok = false; return 0; }
+    return *m_p++;
+  }
+
+  auto varint() -> uint64_t {
+    uint64_t n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      auto b = byte();
+      n |= uint64_t(b & 0x7f) << shift;
+      if (!(b & 0x80)) return n;
+    }
+    m_ok = false;
+    return 0;
+  }
+
+  auto zigzag() -> int64_t {
+    auto n = varint();
+    return int64_t(n >> 1) ^ -int64_t(n & 1);
+  }
+
+  auto fixed64() -> uint64_t {
+    uint64_t n = 0;
+    for (int i = 0; i < 8; i++) n |= uint64_t(byte()) << (i * 8);
+    return n;
+  }
+
+  auto string() -> std::string {
+    auto len = varint();
+    if (len > size_t(m_end - m_p)) { m_ok = false; return std::string(); }
+    std::string s((const char *)m_p, len);
+    m_p += len;
+    return s;
+  }
+
+private:
+  const uint8_t* m_p;
+  const uint8_t* m_end;
+  bool m_ok = true;
+};
+
+static void write_json_string(std::ostream &out, const std::string &s) {
+  static const char hex[] = "0123456789abcdef";
+  out.put('"');
+  for (auto c : s) {
+    switch (c) {
+      case '"': out << "\\\""; break;
+      case '\\': out << "\\\\"; break;
+      case '\n': out << "\\n"; break;
+      case '\r': out << "\\r"; break;
+      case '\t': out << "\\t"; break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          out << "\\u00" << hex[(c >> 4) & 15] << hex[c & 15];
+        } else {
+          out.put(c);
+        }
+        break;
+    }
+  }
+  out.put('"');
+}
+
+static bool decode_columnar_block(const Data &payload, std::ostream &out) {
+  struct Column {
+    std::string name;
+    ColumnarLogger::Type type;
+    std::vector<bool> present;
+    std::vector<std::string> strings;
+    std::vector<int64_t> integers;
+    std::vector<double> numbers;
+  };
+
+  auto bytes = payload.to_bytes();
+  ColumnarReader r(bytes.data(), bytes.size());
+
+  auto rows = r.varint();
+  auto cols = r.varint();
+  if (!r.ok() || rows > bytes.size() * 8 || cols > bytes.size()) return false;
+
+  std::vector<Column> columns(cols);
+  for (auto &col : columns) {
+    col.name = r.string();
+    col.type = ColumnarLogger::Type(r.byte());
+  }
+
+  for (auto &col : columns) {
+    size_t count = 0;
+    col.present.resize(rows);
+    for (size_t i = 0; i < rows; i += 8) {
+      auto bits = r.byte();
+      for (size_t j = 0; j < 8 && i + j < rows; j++) {
+        if (bits & (1 << j)) { col.present[i + j] = true; count++; }
+      }
+    }
+    switch (col.type) {
+      case ColumnarLogger::Type::STRING: {
+        std::vector<std::string> dictionary(r.varint());
+        if (dictionary.size() > bytes.size()) return false;
+        for (auto &s : dictionary) s = r.string();
+        for (size_t i = 0; i < count; i++) {
+          auto index = r.varint();
+          if (index >= dictionary.size()) return false;
+          col.strings.push_back(dictionary[index]);
+        }
+        break;
+      }
+      case ColumnarLogger::Type::INT:
+        for (size_t i = 0; i < count; i++) col.integers.push_back(r.zigzag());
+        break;
+      case ColumnarLogger::Type::NUMBER:
+        for (size_t i = 0; i < count; i++) {
+          auto bits = r.fixed64();
+          double n;
+          std::memcpy(&n, &bits, sizeof(n));
+          col.numbers.push_back(n);
+        }
+        break;
+      case ColumnarLogger::Type::TIME: {
+        int64_t last = 0;
+        for (size_t i = 0; i < count; i++) {
+          last += r.zigzag();
+          col.integers.push_back(last);
+        }
+        break;
+      }
+      default: return false;
+    }
+    if (!r.ok()) return false;
+  }
+
+  std::vector<size_t> cursors(cols);
+  for (size_t row = 0; row < rows; row++) {
+    bool first = true;
+    out.put('{');
+    for (size_t i = 0; i < cols; i++) {
+      auto &col = columns[i];
+      if (!col.present[row]) continue;
+      if (!first) out.put(',');
+      first = false;
+      write_json_string(out, col.name);
+      out.put(':');
+      auto k = cursors[i]++;
+      switch (col.type) {
+        case ColumnarLogger::Type::STRING:
+          write_json_string(out, col.strings[k]);
+          break;
+        case ColumnarLogger::Type::NUMBER: {
+          auto n = col.numbers[k];
+          if (std::isfinite(n)) {
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "%.17g", n);
+            out << buf;
+          } else {
+            out << "null";
+          }
+          break;
+        }
+        default:
+          out << col.integers[k];
+          break;
+      }
+    }
+    out << "}\n";
+  }
+
+  return true;
+}
+
+bool ColumnarLogger::decode(const std::string &filename, std::ostream &out) {
+  std::vector<uint8_t> bytes;
+  if (!fs::read_file(filename, bytes)) {
+    std::cerr << "cannot read from file " << filename << std::endl;
+    return false;
+  }
+
+  size_t p = 0;
+  while (p < bytes.size()) {
+    if (bytes[p] == '\n') { p++; continue; }
+    if (bytes.size() - p < 8 || std::memcmp(&bytes[p], s_columnar_magic, sizeof(s_columnar_magic))) {
+      std::cerr << "invalid block at offset " << p << std::endl;
+      return false;
+    }
+    size_t len = 0;
+    for (int i = 0; i < 4; i++) len |= size_t(bytes[p + 4 + i]) << (i * 8);
+    p += 8;
+    if (len > bytes.size() - p) {
+      std::cerr << "truncated block at offset " << p - 8 << std::endl;
+      return false;
+    }
+
+    Data payload;
+    auto *decompressor = Decompressor::inflate(
+      [&](Data &out) { payload.push(out); }
+    );
+    auto ok = decompressor->input(Data(&bytes[p], len, &s_dp_columnar));
+    decompressor->finalize();
+    if (!ok || !decode_columnar_block(payload, out)) {
+      std::cerr << "corrupted block at offset " << p - 8 << std::endl;
+      return false;
+    }
+    p += len;
+  }
+
+  return true;
+}
+
 } // namespace logging
 } // namespace pipy
 
@@ -588,6 +1182,12 @@ template<> void EnumDef<Logger::SyslogTarget::Priority>::init() {
   define(Logger::SyslogTarget::Priority::DEBUG, "DEBUG");
 }
 
+template<> void EnumDef<Logger::FileTarget::Overflow>::init() {
+  define(Logger::FileTarget::Overflow::DROP, "drop");
+  define(Logger::FileTarget::Overflow::BLOCK, "block");
+  define(Logger::FileTarget::Overflow::SAMPLE, "sample");
+}
+
 template<> void ClassDef<Logger>::init() {
   method("log", [](Context &ctx, Object *obj, Value &ret) {
     obj->as<Logger>()->log(ctx.argc(), &ctx.arg(0));
@@ -605,8 +1205,14 @@ template<> void ClassDef<Logger>::init() {
 
   method("toFile", [](Context &ctx, Object *obj, Value &ret) {
     pjs::Str *filename;
-    if (!ctx.arguments(1, &filename)) return;
-    obj->as<Logger>()->add_target(new Logger::FileTarget(filename));
+    pjs::Object *options = nullptr;
+    if (!ctx.arguments(1, &filename, &options)) return;
+    try {
+      obj->as<Logger>()->add_target(new Logger::FileTarget(filename, options));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return;
+    }
     ret.set(obj);
   });
 
@@ -683,6 +1289,44 @@ template<> void ClassDef<Constructor<JSONLogger>>::init() {
   ctor();
 }
 
+//
+// ColumnarLogger
+//
+
+template<> void EnumDef<ColumnarLogger::Type>::init() {
+  define(ColumnarLogger::Type::STRING, "string");
+  define(ColumnarLogger::Type::INT, "int");
+  define(ColumnarLogger::Type::NUMBER, "number");
+  define(ColumnarLogger::Type::TIME, "time");
+}
+
+template<> void ClassDef<ColumnarLogger>::init() {
+  super<Logger>();
+
+  ctor([](Context &ctx) -> Object* {
+    pjs::Str *name;
+    pjs::Object *schema;
+    pjs::Object *options = nullptr;
+    if (!ctx.arguments(2, &name, &schema, &options)) return nullptr;
+    try {
+      return ColumnarLogger::make(name, schema, options);
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  method("flush", [](Context &ctx, Object *obj, Value &ret) {
+    obj->as<ColumnarLogger>()->flush();
+    ret.set(obj);
+  });
+}
+
+template<> void ClassDef<Constructor<ColumnarLogger>>::init() {
+  super<Function>();
+  ctor();
+}
+
 //
 // Logging
 //
@@ -692,6 +1336,7 @@ template<> void ClassDef<Logging>::init() {
   variable("BinaryLogger", class_of<Constructor<BinaryLogger>>());
   variable("TextLogger", class_of<Constructor<TextLogger>>());
   variable("JSONLogger", class_of<Constructor<JSONLogger>>());
+  variable("ColumnarLogger", class_of<Constructor<ColumnarLogger>>());
 }
 
 } // namespace pjs
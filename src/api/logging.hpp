@@ -32,18 +32,29 @@
 #include "fstream.hpp"
 #include "filters/pack.hpp"
 #include "filters/tls.hpp"
+#include "timer.hpp"
+#include "upstream.hpp"
 
 #include <atomic>
+#include <condition_variable>
+#include <cstdio>
 #include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <functional>
+#include <ostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace pipy {
 
 class AdminService;
 class AdminLink;
 class Data;
+class SharedData;
 class Pipeline;
 class PipelineLayout;
 class MessageStart;
@@ -97,43 +108,112 @@ public:
 
   class FileTarget : public Target {
   public:
+    enum class Overflow {
+      DROP,
+      BLOCK,
+      SAMPLE,
+    };
+
+    struct Options : public pipy::Options {
+      Overflow overflow = Overflow::DROP;
+      Options() {}
+      Options(pjs::Object *options);
+    };
+
     static void close_all_writers();
+    static void init_metrics();
 
-    FileTarget(pjs::Str *filename);
+    FileTarget(pjs::Str *filename, const Options &options = Options());
 
   private:
     virtual void write(const Data &msg) override;
 
     //
-    // Logger::FileTarget::Module
+    // Logger::FileTarget::Writer
+    //
+    // Owned by the spooler thread once created. Workers only hold a pointer
+    // and never touch the file itself.
     //
 
-    class Module : public ModuleBase {
+    class Writer {
     public:
-      Module() : ModuleBase("Logger::FileTarget") {}
-      virtual auto new_context(pipy::Context *base) -> pipy::Context* override {
-        return Context::make();
-      }
+      Writer(const std::string &filename) : m_filename(filename) {}
+      ~Writer();
+
+      auto filename() const -> const std::string& { return m_filename; }
+      bool dirty() const { return m_dirty; }
+
+      void write(const Data &msg);
+      void flush();
+
+    private:
+      std::string m_filename;
+      std::FILE* m_file = nullptr;
+      double m_retry_time = 0;
+      bool m_dirty = false;
     };
 
     //
-    // Logger::FileTarget::Writer
+    // Logger::FileTarget::Ring
+    //
+    // Single-producer single-consumer queue owned by one worker thread and
+    // drained by the spooler thread.
     //
 
-    class Writer {
+    struct Ring {
+      struct Entry {
+        Writer* writer;
+        SharedData* data;
+      };
+
+      static const size_t SIZE = 4096;
+
+      Entry entries[SIZE];
+      std::atomic<size_t> head;
+      char padding[64];
+      std::atomic<size_t> tail;
+      std::atomic<bool> owned;
+      Ring* next = nullptr;
+
+      Ring() : head(0), tail(0), owned(true) {}
+    };
+
+    //
+    // Logger::FileTarget::Spooler
+    //
+
+    class Spooler {
     public:
-      Writer(const std::string &filename);
-      void write(const Data &msg);
-      void shutdown();
+      static auto get() -> Spooler&;
+
+      auto writer(const std::string &filename) -> Writer*;
+      auto ring() -> Ring*;
+      bool stopped() const { return m_stopping.load(std::memory_order_relaxed); }
+      void wake();
+      void stop();
+
     private:
-      pjs::Ref<Module> m_module;
-      pjs::Ref<PipelineLayout> m_pipeline_layout;
-      pjs::Ref<Pipeline> m_pipeline;
+      Spooler();
+
+      std::mutex m_mutex;
+      std::condition_variable m_cv;
+      std::thread m_thread;
+      std::atomic<Ring*> m_rings;
+      std::atomic<bool> m_sleeping;
+      std::atomic<bool> m_stopping;
+      std::map<std::string, std::unique_ptr<Writer>> m_writers;
+      std::vector<Writer*> m_dirty_writers;
+      bool m_started = false;
+
+      void main();
+      auto drain() -> size_t;
     };
 
-    pjs::Ref<pjs::Str> m_filename;
+    Writer* m_writer;
+    Overflow m_overflow;
+    unsigned m_sample_counter = 0;
 
-    static std::map<std::string, std::unique_ptr<Writer>> s_all_writers;
+    thread_local static std::map<Writer*, double> s_dropped;
   };
 
   //
@@ -195,8 +275,8 @@ public:
       }
     };
 
+    pjs::Ref<Upstream> m_upstream;
     pjs::Ref<Module> m_module;
-    pjs::Ref<pjs::Method> m_mux_grouper;
     pjs::Ref<PipelineLayout> m_ppl;
     pjs::Ref<Pipeline> m_pipeline;
     pjs::Ref<MessageStart> m_message_start;
@@ -219,6 +299,8 @@ protected:
   Logger(pjs::Str *name);
   virtual ~Logger();
 
+  void write_targets(const Data &msg);
+
 private:
 
   //
@@ -263,8 +345,6 @@ private:
   pjs::Ref<pjs::Str> m_name;
   std::list<std::unique_ptr<Target>> m_targets;
 
-  void write_targets(const Data &msg);
-
   static AdminService* s_admin_service;
   static AdminLink* s_admin_link;
   static std::atomic<size_t> s_history_size;
@@ -315,6 +395,62 @@ private:
   friend class pjs::ObjectTemplate<JSONLogger, Logger>;
 };
 
+//
+// ColumnarLogger
+//
+// Rows are gathered column by column and written out in blocks. Each
+// block is framed as "PLCB", a 32-bit little-endian length and a deflate
+// stream carrying the schema, a presence bitmap per column, dictionary
+// encoded strings and delta encoded timestamps. Blocks decode on their
+// own, so files can be appended to after restarts.
+//
+
+class ColumnarLogger : public pjs::ObjectTemplate<ColumnarLogger, Logger> {
+public:
+  enum class Type {
+    STRING,
+    INT,
+    NUMBER,
+    TIME,
+  };
+
+  struct Options : public pipy::Options {
+    int block_size = 4096;
+    double interval = 1;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  // Turns a file of blocks back into JSON lines
+  static bool decode(const std::string &filename, std::ostream &out);
+
+  void flush();
+
+private:
+  ColumnarLogger(pjs::Str *name, pjs::Object *schema, const Options &options);
+  ~ColumnarLogger();
+
+  virtual void log(int argc, const pjs::Value *args) override;
+
+  struct Column {
+    pjs::Ref<pjs::Str> name;
+    Type type;
+    std::vector<bool> present;
+    std::vector<double> numbers;
+    std::vector<uint32_t> indices;
+    std::vector<std::string> dictionary;
+    std::unordered_map<std::string, uint32_t> dictionary_map;
+  };
+
+  Options m_options;
+  std::vector<Column> m_columns;
+  int m_rows = 0;
+  Timer m_timer;
+  bool m_timer_scheduled = false;
+
+  friend class pjs::ObjectTemplate<ColumnarLogger, Logger>;
+};
+
 //
 // Logging
 //
@@ -0,0 +1,552 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "netlink.hpp"
+#include "api/ip.hpp"
+#include "net.hpp"
+#include "log.hpp"
+
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace pipy {
+namespace netlink {
+
+// Same as RT_TABLE_MAIN
+static const int MAIN_TABLE = 254;
+
+static auto mask_addr(const RouteTable::Addr &addr, int prefix_len) -> RouteTable::Addr {
+  RouteTable::Addr masked(addr);
+  for (int i = 0; i < (int)masked.size(); i++) {
+    int bits = prefix_len - i * 8;
+    if (bits >= 8) continue;
+    masked[i] &= bits <= 0 ? 0 : (char)(0xff << (8 - bits));
+  }
+  return masked;
+}
+
+//
+// RouteTable
+//
+
+auto RouteTable::get() -> RouteTable& {
+  static RouteTable *s_table = new RouteTable();
+  s_table->start();
+  return *s_table;
+}
+
+RouteTable::RouteTable() {
+}
+
+auto RouteTable::generation() -> uint64_t {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_generation;
+}
+
+bool RouteTable::route(const Addr &addr, int table, RouteEntry &entry) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto i = m_state.routes.find({ (int)addr.size(), table });
+  if (i == m_state.routes.end()) return false;
+  for (const auto &p : i->second) {
+    auto dst = mask_addr(addr, p.first);
+    auto j = p.second.lower_bound({ dst, 0 });
+    if (j != p.second.end() && j->first.first == dst) {
+      entry = j->second;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool RouteTable::neighbor(const Addr &addr, int ifindex, NeighborEntry &entry) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto i = m_state.neighbors.lower_bound({ addr, ifindex });
+  if (i == m_state.neighbors.end() || i->first.first != addr) return false;
+  if (ifindex && i->first.second != ifindex) return false;
+  entry = i->second;
+  return true;
+}
+
+void RouteTable::routes(int table, const std::function<void(const RouteEntry&)> &cb) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const auto &t : m_state.routes) {
+    if (table && t.first.second != table) continue;
+    for (const auto &p : t.second) {
+      for (const auto &r : p.second) {
+        cb(r.second);
+      }
+    }
+  }
+}
+
+void RouteTable::neighbors(const std::function<void(const NeighborEntry&)> &cb) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const auto &n : m_state.neighbors) cb(n.second);
+}
+
+void RouteTable::addresses(const std::function<void(const AddressEntry&)> &cb) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const auto &a : m_state.addresses) cb(a.second);
+}
+
+#ifdef __linux__
+
+void RouteTable::start() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_started) return;
+  m_started = true;
+  m_thread = std::thread([this]() { main(); });
+  m_thread.detach();
+}
+
+//
+// The multicast socket is bound before dumping so that no change can
+// slip in between the dump and the subscription. Notifications queued
+// during the dump are then replayed on top of it, which is harmless as
+// every one of them is idempotent.
+//
+
+void RouteTable::main() {
+  static const int RECV_BUFFER_SIZE = 4 * 1024 * 1024;
+
+  std::vector<char> buf(64 * 1024);
+
+  for (;;) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+      Log::error("[netlink] cannot open rtnetlink socket: %s", std::strerror(errno));
+      return;
+    }
+
+    int size = RECV_BUFFER_SIZE;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    struct sockaddr_nl sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = (
+      RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE | RTMGRP_NEIGH |
+      RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR
+    );
+
+    State state;
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || !dump(state)) {
+      Log::error("[netlink] cannot load rtnetlink tables: %s", std::strerror(errno));
+      ::close(fd);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::swap(m_state, state);
+      m_generation++;
+    }
+
+    for (;;) {
+      int n = recv(fd, buf.data(), buf.size(), 0);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        if (errno == ENOBUFS) {
+          Log::warn("[netlink] rtnetlink notifications dropped, resyncing");
+        } else {
+          Log::error("[netlink] rtnetlink recv() failed: %s", std::strerror(errno));
+        }
+        break;
+      }
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for (
+        auto h = (struct nlmsghdr *)buf.data();
+        NLMSG_OK(h, n);
+        h = NLMSG_NEXT(h, n)
+      ) apply(m_state, h);
+      m_generation++;
+    }
+
+    ::close(fd);
+  }
+}
+
+bool RouteTable::dump(State &state) {
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) return false;
+
+  std::vector<char> buf(64 * 1024);
+  static const int types[] = { RTM_GETADDR, RTM_GETROUTE, RTM_GETNEIGH };
+
+  for (int i = 0; i < 3; i++) {
+    struct {
+      struct nlmsghdr h;
+      struct rtgenmsg g;
+    } req;
+
+    std::memset(&req, 0, sizeof(req));
+    req.h.nlmsg_len = NLMSG_LENGTH(sizeof(req.g));
+    req.h.nlmsg_type = types[i];
+    req.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.h.nlmsg_seq = i + 1;
+    req.g.rtgen_family = AF_UNSPEC;
+
+    if (send(fd, &req, req.h.nlmsg_len, 0) < 0) {
+      ::close(fd);
+      return false;
+    }
+
+    for (bool done = false; !done; ) {
+      int n = recv(fd, buf.data(), buf.size(), 0);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        ::close(fd);
+        return false;
+      }
+      for (
+        auto h = (struct nlmsghdr *)buf.data();
+        NLMSG_OK(h, n);
+        h = NLMSG_NEXT(h, n)
+      ) {
+        if (h->nlmsg_type == NLMSG_DONE) { done = true; break; }
+        if (h->nlmsg_type == NLMSG_ERROR) {
+          auto err = (struct nlmsgerr *)NLMSG_DATA(h);
+          errno = -err->error;
+          ::close(fd);
+          return false;
+        }
+        apply(state, h);
+      }
+    }
+  }
+
+  ::close(fd);
+  return true;
+}
+
+void RouteTable::apply(State &state, const void *msg) {
+  auto h = (const struct nlmsghdr *)msg;
+  switch (h->nlmsg_type) {
+    case RTM_NEWROUTE:
+    case RTM_DELROUTE: {
+      auto rtm = (struct rtmsg *)NLMSG_DATA(h);
+      if (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6) break;
+      int addr_len = (rtm->rtm_family == AF_INET ? 4 : 16);
+      RouteEntry r;
+      r.prefix_len = rtm->rtm_dst_len;
+      r.table = rtm->rtm_table;
+      r.protocol = rtm->rtm_protocol;
+      r.scope = rtm->rtm_scope;
+      r.type = rtm->rtm_type;
+      r.dst.assign(addr_len, 0);
+      int len = RTM_PAYLOAD(h);
+      for (auto a = RTM_RTA(rtm); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+        auto data = (const char *)RTA_DATA(a);
+        auto size = RTA_PAYLOAD(a);
+        switch (a->rta_type) {
+          case RTA_DST: if (size == addr_len) r.dst.assign(data, size); break;
+          case RTA_GATEWAY: if (size == addr_len) r.gateway.assign(data, size); break;
+          case RTA_PREFSRC: if (size == addr_len) r.prefsrc.assign(data, size); break;
+          case RTA_OIF: if (size == 4) r.oif = *(const int *)data; break;
+          case RTA_PRIORITY: if (size == 4) r.priority = *(const int *)data; break;
+          case RTA_TABLE: if (size == 4) r.table = *(const int *)data; break;
+          case RTA_MULTIPATH: {
+            // Only the first nexthop of a multipath route is kept
+            auto nh = (const struct rtnexthop *)data;
+            if (r.oif || size < sizeof(*nh) || nh->rtnh_len > size) break;
+            r.oif = nh->rtnh_ifindex;
+            int nh_len = nh->rtnh_len - RTNH_LENGTH(0);
+            for (auto b = RTNH_DATA(nh); RTA_OK(b, nh_len); b = RTA_NEXT(b, nh_len)) {
+              if (b->rta_type == RTA_GATEWAY && RTA_PAYLOAD(b) == addr_len) {
+                r.gateway.assign((const char *)RTA_DATA(b), addr_len);
+              }
+            }
+            break;
+          }
+        }
+      }
+      r.dst = mask_addr(r.dst, r.prefix_len);
+      auto &prefixes = state.routes[{ addr_len, r.table }][r.prefix_len];
+      if (h->nlmsg_type == RTM_NEWROUTE) {
+        prefixes[{ r.dst, r.priority }] = r;
+      } else {
+        prefixes.erase({ r.dst, r.priority });
+      }
+      break;
+    }
+    case RTM_NEWNEIGH:
+    case RTM_DELNEIGH: {
+      auto ndm = (struct ndmsg *)NLMSG_DATA(h);
+      if (ndm->ndm_family != AF_INET && ndm->ndm_family != AF_INET6) break;
+      int addr_len = (ndm->ndm_family == AF_INET ? 4 : 16);
+      NeighborEntry n;
+      n.ifindex = ndm->ndm_ifindex;
+      n.state = ndm->ndm_state;
+      n.flags = ndm->ndm_flags;
+      int len = h->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+      for (
+        auto a = (struct rtattr *)((char *)ndm + NLMSG_ALIGN(sizeof(*ndm)));
+        RTA_OK(a, len); a = RTA_NEXT(a, len)
+      ) {
+        auto data = (const char *)RTA_DATA(a);
+        auto size = RTA_PAYLOAD(a);
+        switch (a->rta_type) {
+          case NDA_DST: if (size == addr_len) n.addr.assign(data, size); break;
+          case NDA_LLADDR: n.lladdr.assign(data, size); break;
+        }
+      }
+      if (n.addr.empty()) break;
+      if (h->nlmsg_type == RTM_NEWNEIGH) {
+        state.neighbors[{ n.addr, n.ifindex }] = n;
+      } else {
+        state.neighbors.erase({ n.addr, n.ifindex });
+      }
+      break;
+    }
+    case RTM_NEWADDR:
+    case RTM_DELADDR: {
+      auto ifa = (struct ifaddrmsg *)NLMSG_DATA(h);
+      if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6) break;
+      int addr_len = (ifa->ifa_family == AF_INET ? 4 : 16);
+      AddressEntry e;
+      e.prefix_len = ifa->ifa_prefixlen;
+      e.ifindex = ifa->ifa_index;
+      e.scope = ifa->ifa_scope;
+      Addr address;
+      int len = IFA_PAYLOAD(h);
+      for (auto a = IFA_RTA(ifa); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+        auto data = (const char *)RTA_DATA(a);
+        auto size = RTA_PAYLOAD(a);
+        switch (a->rta_type) {
+          case IFA_LOCAL: if (size == addr_len) e.addr.assign(data, size); break;
+          case IFA_ADDRESS: if (size == addr_len) address.assign(data, size); break;
+          case IFA_LABEL: e.label.assign(data, strnlen(data, size)); break;
+        }
+      }
+      // IFA_LOCAL is our side of a point-to-point link and is missing on IPv6
+      if (e.addr.empty()) e.addr = address;
+      if (e.addr.empty()) break;
+      if (h->nlmsg_type == RTM_NEWADDR) {
+        state.addresses[{ e.ifindex, e.addr }] = e;
+      } else {
+        state.addresses.erase({ e.ifindex, e.addr });
+      }
+      break;
+    }
+  }
+}
+
+#else // !__linux__
+
+void RouteTable::start() {
+}
+
+#endif // __linux__
+
+} // namespace netlink
+} // namespace pipy
+
+namespace pjs {
+
+using namespace pipy;
+using namespace pipy::netlink;
+
+static bool get_addr(Context &ctx, int i, RouteTable::Addr &addr) {
+  Str *s;
+  pipy::IP *ip;
+  uint8_t buf[16];
+  if (ctx.get(i, ip) && ip) {
+    auto n = ip->data().to_bytes(buf);
+    addr.assign((const char *)buf, n);
+    return true;
+  }
+  if (ctx.get(i, s)) {
+    std::error_code ec;
+    auto a = asio::ip::make_address(s->str(), ec);
+    if (ec) {
+      ctx.error("invalid IP address");
+      return false;
+    }
+    if (a.is_v4()) {
+      auto bytes = a.to_v4().to_bytes();
+      addr.assign((const char *)bytes.data(), bytes.size());
+    } else {
+      auto bytes = a.to_v6().to_bytes();
+      addr.assign((const char *)bytes.data(), bytes.size());
+    }
+    return true;
+  }
+  ctx.error_argument_type(i, "a string or an IP");
+  return false;
+}
+
+static auto addr_to_string(const RouteTable::Addr &addr) -> std::string {
+  if (addr.size() == 4) {
+    asio::ip::address_v4::bytes_type bytes;
+    std::memcpy(bytes.data(), addr.data(), 4);
+    return asio::ip::address_v4(bytes).to_string();
+  } else {
+    asio::ip::address_v6::bytes_type bytes;
+    std::memcpy(bytes.data(), addr.data(), 16);
+    return asio::ip::address_v6(bytes).to_string();
+  }
+}
+
+static auto addr_to_str(const RouteTable::Addr &addr) -> Str* {
+  if (addr.empty()) return nullptr;
+  return Str::make(addr_to_string(addr));
+}
+
+static auto lladdr_to_str(const std::string &lladdr) -> Str* {
+  if (lladdr.empty()) return nullptr;
+  std::string str;
+  char hex[4];
+  for (size_t i = 0; i < lladdr.size(); i++) {
+    std::snprintf(hex, sizeof(hex), i ? ":%02x" : "%02x", (uint8_t)lladdr[i]);
+    str += hex;
+  }
+  return Str::make(str);
+}
+
+static auto make_route(const RouteTable::RouteEntry &e) -> Route* {
+  auto r = Route::make();
+  r->destination = Str::make(addr_to_string(e.dst) + '/' + std::to_string(e.prefix_len));
+  r->gateway = addr_to_str(e.gateway);
+  r->source = addr_to_str(e.prefsrc);
+  r->table = e.table;
+  r->ifindex = e.oif;
+  r->priority = e.priority;
+  r->protocol = e.protocol;
+  r->scope = e.scope;
+  r->type = e.type;
+  return r;
+}
+
+static auto make_neighbor(const RouteTable::NeighborEntry &e) -> Neighbor* {
+  auto n = Neighbor::make();
+  n->ip = addr_to_str(e.addr);
+  n->lladdr = lladdr_to_str(e.lladdr);
+  n->ifindex = e.ifindex;
+  n->state = e.state;
+  n->flags = e.flags;
+  return n;
+}
+
+static auto make_address(const RouteTable::AddressEntry &e) -> Address* {
+  auto a = Address::make();
+  a->ip = addr_to_str(e.addr);
+  if (!e.label.empty()) a->label = Str::make(e.label);
+  a->prefixLength = e.prefix_len;
+  a->ifindex = e.ifindex;
+  a->scope = e.scope;
+  return a;
+}
+
+template<> void ClassDef<Route>::init() {
+  field<Ref<Str>>("destination", [](Route *obj) { return &obj->destination; });
+  field<Ref<Str>>("gateway", [](Route *obj) { return &obj->gateway; });
+  field<Ref<Str>>("source", [](Route *obj) { return &obj->source; });
+  field<int>("table", [](Route *obj) { return &obj->table; });
+  field<int>("ifindex", [](Route *obj) { return &obj->ifindex; });
+  field<int>("priority", [](Route *obj) { return &obj->priority; });
+  field<int>("protocol", [](Route *obj) { return &obj->protocol; });
+  field<int>("scope", [](Route *obj) { return &obj->scope; });
+  field<int>("type", [](Route *obj) { return &obj->type; });
+}
+
+template<> void ClassDef<Neighbor>::init() {
+  field<Ref<Str>>("ip", [](Neighbor *obj) { return &obj->ip; });
+  field<Ref<Str>>("lladdr", [](Neighbor *obj) { return &obj->lladdr; });
+  field<int>("ifindex", [](Neighbor *obj) { return &obj->ifindex; });
+  field<int>("state", [](Neighbor *obj) { return &obj->state; });
+  field<int>("flags", [](Neighbor *obj) { return &obj->flags; });
+}
+
+template<> void ClassDef<Address>::init() {
+  field<Ref<Str>>("ip", [](Address *obj) { return &obj->ip; });
+  field<Ref<Str>>("label", [](Address *obj) { return &obj->label; });
+  field<int>("prefixLength", [](Address *obj) { return &obj->prefixLength; });
+  field<int>("ifindex", [](Address *obj) { return &obj->ifindex; });
+  field<int>("scope", [](Address *obj) { return &obj->scope; });
+}
+
+template<> void ClassDef<Netlink>::init() {
+  ctor();
+
+  accessor("generation", [](Object *obj, Value &ret) {
+    ret.set(double(RouteTable::get().generation()));
+  });
+
+  method("route", [](Context &ctx, Object *obj, Value &ret) {
+    RouteTable::Addr addr;
+    int table = MAIN_TABLE;
+    if (!get_addr(ctx, 0, addr)) return;
+    if (ctx.argc() > 1 && !ctx.check(1, table)) return;
+    RouteTable::RouteEntry e;
+    if (RouteTable::get().route(addr, table, e)) {
+      ret.set(make_route(e));
+    } else {
+      ret = Value::null;
+    }
+  });
+
+  method("neighbor", [](Context &ctx, Object *obj, Value &ret) {
+    RouteTable::Addr addr;
+    int ifindex = 0;
+    if (!get_addr(ctx, 0, addr)) return;
+    if (ctx.argc() > 1 && !ctx.check(1, ifindex)) return;
+    RouteTable::NeighborEntry e;
+    if (RouteTable::get().neighbor(addr, ifindex, e)) {
+      ret.set(make_neighbor(e));
+    } else {
+      ret = Value::null;
+    }
+  });
+
+  method("routes", [](Context &ctx, Object *obj, Value &ret) {
+    int table = 0;
+    if (!ctx.arguments(0, &table)) return;
+    auto a = Array::make();
+    RouteTable::get().routes(table, [&](const RouteTable::RouteEntry &e) { a->push(make_route(e)); });
+    ret.set(a);
+  });
+
+  method("neighbors", [](Context &ctx, Object *obj, Value &ret) {
+    auto a = Array::make();
+    RouteTable::get().neighbors([&](const RouteTable::NeighborEntry &e) { a->push(make_neighbor(e)); });
+    ret.set(a);
+  });
+
+  method("addresses", [](Context &ctx, Object *obj, Value &ret) {
+    auto a = Array::make();
+    RouteTable::get().addresses([&](const RouteTable::AddressEntry &e) { a->push(make_address(e)); });
+    ret.set(a);
+  });
+}
+
+} // namespace pjs
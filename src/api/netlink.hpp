@@ -0,0 +1,175 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef API_NETLINK_HPP
+#define API_NETLINK_HPP
+
+#include "pjs/pjs.hpp"
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace pipy {
+namespace netlink {
+
+//
+// Route
+//
+
+class Route : public pjs::ObjectTemplate<Route> {
+public:
+  pjs::Ref<pjs::Str> destination;
+  pjs::Ref<pjs::Str> gateway;
+  pjs::Ref<pjs::Str> source;
+  int table = 0;
+  int ifindex = 0;
+  int priority = 0;
+  int protocol = 0;
+  int scope = 0;
+  int type = 0;
+};
+
+//
+// Neighbor
+//
+
+class Neighbor : public pjs::ObjectTemplate<Neighbor> {
+public:
+  pjs::Ref<pjs::Str> ip;
+  pjs::Ref<pjs::Str> lladdr;
+  int ifindex = 0;
+  int state = 0;
+  int flags = 0;
+};
+
+//
+// Address
+//
+
+class Address : public pjs::ObjectTemplate<Address> {
+public:
+  pjs::Ref<pjs::Str> ip;
+  pjs::Ref<pjs::Str> label;
+  int prefixLength = 0;
+  int ifindex = 0;
+  int scope = 0;
+};
+
+//
+// RouteTable
+//
+// A process-wide mirror of the kernel routing, neighbor and address
+// tables. A background thread dumps all three once and then follows the
+// rtnetlink multicast groups, resyncing from scratch whenever the kernel
+// reports that notifications were dropped. Lookups from any worker thread
+// only take a mutex and never go to the kernel.
+//
+
+class RouteTable {
+public:
+  static auto get() -> RouteTable&;
+
+  // Address bytes are 4 or 16 long in network order
+  typedef std::string Addr;
+
+  struct RouteEntry {
+    Addr dst;
+    Addr gateway;
+    Addr prefsrc;
+    int prefix_len = 0;
+    int table = 0;
+    int oif = 0;
+    int priority = 0;
+    int protocol = 0;
+    int scope = 0;
+    int type = 0;
+  };
+
+  struct NeighborEntry {
+    Addr addr;
+    std::string lladdr;
+    int ifindex = 0;
+    int state = 0;
+    int flags = 0;
+  };
+
+  struct AddressEntry {
+    Addr addr;
+    std::string label;
+    int prefix_len = 0;
+    int ifindex = 0;
+    int scope = 0;
+  };
+
+  auto generation() -> uint64_t;
+  bool route(const Addr &addr, int table, RouteEntry &entry);
+  bool neighbor(const Addr &addr, int ifindex, NeighborEntry &entry);
+  void routes(int table, const std::function<void(const RouteEntry&)> &cb);
+  void neighbors(const std::function<void(const NeighborEntry&)> &cb);
+  void addresses(const std::function<void(const AddressEntry&)> &cb);
+
+private:
+  RouteTable();
+
+  // Routes of one family in one table, longest prefixes first and then
+  // ordered by destination and metric, so that the best route for a
+  // given prefix is the first one found at its lower bound
+  typedef std::map<std::pair<Addr, int>, RouteEntry> Prefixes;
+  typedef std::map<int, Prefixes, std::greater<int>> Routes;
+
+  struct State {
+    std::map<std::pair<int, int>, Routes> routes; // by address size and table
+    std::map<std::pair<Addr, int>, NeighborEntry> neighbors;
+    std::map<std::pair<int, Addr>, AddressEntry> addresses;
+  };
+
+  State m_state;
+  uint64_t m_generation = 0;
+  std::mutex m_mutex;
+  std::thread m_thread;
+  bool m_started = false;
+
+  void start();
+  void main();
+  bool dump(State &state);
+
+  static void apply(State &state, const void *msg);
+};
+
+//
+// Netlink
+//
+
+class Netlink : public pjs::ObjectTemplate<Netlink> {
+};
+
+} // namespace netlink
+} // namespace pipy
+
+#endif // API_NETLINK_HPP
@@ -27,14 +27,95 @@
 #include "os-platform.hpp"
 #include "fs.hpp"
 #include "data.hpp"
+#include "input.hpp"
+#include "net.hpp"
+#include "thread-pool.hpp"
 #include "log.hpp"
 
 #include <fstream>
+#include <unordered_map>
 
 extern "C" char **environ;
 
 namespace pipy {
 
+static Data::Producer s_dp("os.read()");
+
+//
+// Files read or written asynchronously are done on these threads,
+// so at most this many of them can be blocked on the disk at a time.
+//
+
+static const int FILE_IO_THREADS = 4;
+
+static auto file_io_threads() -> ThreadPool& {
+  static auto *s_threads = new ThreadPool(FILE_IO_THREADS);
+  return *s_threads;
+}
+
+//
+// ReadCache
+//
+// Small files read over and over, such as per-tenant policies, are kept
+// on each thread and handed out again for as long as stat() shows the
+// same size, mtime and ctime. Entries are keyed by the pathname as given.
+//
+
+class ReadCache {
+public:
+  static const int MAX_FILE_SIZE = 64 * 1024;
+  static const size_t MAX_ENTRIES = 256;
+
+  static bool cacheable(const fs::Stat &st) {
+    return st.is_file() && st.size <= MAX_FILE_SIZE;
+  }
+
+  static bool find(const std::string &pathname, fs::Stat &st) {
+    auto i = s_entries.find(pathname);
+    if (i == s_entries.end()) return false;
+    st = i->second.stat;
+    return true;
+  }
+
+  static auto get(const std::string &pathname, const fs::Stat &st) -> Data* {
+    auto i = s_entries.find(pathname);
+    if (i == s_entries.end()) return nullptr;
+    auto &e = i->second;
+    if (!same(e.stat, st)) {
+      s_entries.erase(i);
+      return nullptr;
+    }
+    return Data::make(e.data);
+  }
+
+  static void set(const std::string &pathname, const fs::Stat &st, const Data &data) {
+    if (s_entries.size() >= MAX_ENTRIES && !s_entries.count(pathname)) {
+      s_entries.erase(s_entries.begin());
+    }
+    auto &e = s_entries[pathname];
+    e.stat = st;
+    e.data = data;
+  }
+
+  static void erase(const std::string &pathname) {
+    s_entries.erase(pathname);
+  }
+
+  static bool same(const fs::Stat &a, const fs::Stat &b) {
+    return a.size == b.size && a.mtime == b.mtime && a.ctime == b.ctime;
+  }
+
+private:
+  struct Entry {
+    fs::Stat stat;
+    Data data;
+  };
+
+  thread_local static std::unordered_map<std::string, Entry> s_entries;
+};
+
+thread_local std::unordered_map<std::string, ReadCache::Entry> ReadCache::s_entries;
+
 //
 // OS
 //
@@ -91,7 +172,13 @@ auto OS::list(const std::string &pathname) -> pjs::Array* {
 }
 
 auto OS::read(const std::string &pathname) -> Data* {
-  static Data::Producer s_dp("os.read()");
+  fs::Stat st;
+  auto cacheable = fs::stat(pathname, st) && ReadCache::cacheable(st);
+  if (cacheable) {
+    if (auto data = ReadCache::get(pathname, st)) {
+      return data;
+    }
+  }
   std::ifstream fs(pathname, std::ios::in|std::ios::binary);
   if (!fs.is_open()) {
     throw std::runtime_error("cannot open file: " + pathname);
@@ -104,10 +191,83 @@ auto OS::read(const std::string &pathname) -> Data* {
     db.push(buf, fs.gcount());
   }
   db.flush();
+  if (cacheable && data.size() == st.size) {
+    ReadCache::set(pathname, st, data);
+  }
   return Data::make(std::move(data));
 }
 
+//
+// The stat() and the reading are both done on an I/O thread. A file
+// found in the read cache is only read again when stat() says it changed.
+// Like os.readFile(), failures are logged and resolve to null.
+//
+
+auto OS::read_async(const std::string &pathname) -> pjs::Promise* {
+  struct Task {
+    std::string pathname;
+    fs::Stat cached;
+    fs::Stat stat;
+    bool has_cached = false;
+    bool has_stat = false;
+    bool unchanged = false;
+    bool ok = false;
+    std::vector<uint8_t> bytes;
+  };
+
+  auto task = std::make_shared<Task>();
+  task->pathname = pathname;
+  task->has_cached = ReadCache::find(pathname, task->cached);
+
+  // The settler is only touched on this thread, the I/O thread just carries the pointer
+  auto promise = pjs::Promise::make();
+  auto settler = pjs::Promise::Settler::make(promise);
+  settler->retain();
+
+  auto net = &Net::current();
+  file_io_threads().run(
+    [=]() {
+      task->has_stat = fs::stat(task->pathname, task->stat);
+      if (task->has_stat && task->has_cached && ReadCache::same(task->stat, task->cached)) {
+        task->unchanged = true;
+        task->ok = true;
+      } else {
+        task->ok = fs::read_file(task->pathname, task->bytes);
+      }
+      net->post(
+        [=]() {
+          InputContext ic;
+          pjs::Ref<Data> data;
+          if (task->unchanged) {
+            data = ReadCache::get(task->pathname, task->stat);
+            if (!data) {
+              // Evicted meanwhile, rare enough to just read it here
+              try { data = OS::read(task->pathname); } catch (std::runtime_error &) {}
+            }
+          } else if (task->ok) {
+            auto &bytes = task->bytes;
+            data = bytes.empty() ? Data::make() : s_dp.make(&bytes[0], bytes.size());
+            if (task->has_stat && ReadCache::cacheable(task->stat) && data->size() == task->stat.size) {
+              ReadCache::set(task->pathname, task->stat, *data);
+            }
+          }
+          if (data) {
+            settler->resolve(data.get());
+          } else {
+            Log::error("cannot open file: %s", task->pathname.c_str());
+            settler->resolve(pjs::Value::null);
+          }
+          settler->release();
+        }
+      );
+    }
+  );
+
+  return promise;
+}
+
 void OS::write(const std::string &pathname, Data *data) {
+  ReadCache::erase(pathname);
   std::ofstream fs(pathname, std::ios::out|std::ios::binary|std::ios::trunc);
   if (!fs.is_open()) {
     throw std::runtime_error("cannot open file: " + pathname);
@@ -120,6 +280,7 @@ void OS::write(const std::string &pathname, Data *data) {
 }
 
 void OS::write(const std::string &pathname, const std::string &data) {
+  ReadCache::erase(pathname);
   std::ofstream fs(pathname, std::ios::out|std::ios::binary|std::ios::trunc);
   if (!fs.is_open()) {
     throw std::runtime_error("cannot open file: " + pathname);
@@ -127,6 +288,56 @@ void OS::write(const std::string &pathname, const std::string &data) {
   fs.write(data.c_str(), data.length());
 }
 
+auto OS::write_async(const std::string &pathname, Data *data) -> pjs::Promise* {
+  std::string bytes;
+  if (data) bytes = data->to_string();
+  return write_async(pathname, bytes);
+}
+
+//
+// The content is copied out for the I/O thread to write. Like
+// os.writeFile(), failures are logged and the promise still resolves.
+//
+
+auto OS::write_async(const std::string &pathname, const std::string &data) -> pjs::Promise* {
+  struct Task {
+    std::string pathname;
+    std::string data;
+    bool ok = false;
+  };
+
+  auto task = std::make_shared<Task>();
+  task->pathname = pathname;
+  task->data = data;
+  ReadCache::erase(pathname);
+
+  auto promise = pjs::Promise::make();
+  auto settler = pjs::Promise::Settler::make(promise);
+  settler->retain();
+
+  auto net = &Net::current();
+  file_io_threads().run(
+    [=]() {
+      std::ofstream fs(task->pathname, std::ios::out|std::ios::binary|std::ios::trunc);
+      if (fs.is_open()) {
+        fs.write(task->data.c_str(), task->data.length());
+        task->ok = fs.good();
+      }
+      net->post(
+        [=]() {
+          InputContext ic;
+          ReadCache::erase(task->pathname);
+          if (!task->ok) Log::error("cannot write file: %s", task->pathname.c_str());
+          settler->resolve(pjs::Value::undefined);
+          settler->release();
+        }
+      );
+    }
+  );
+
+  return promise;
+}
+
 void OS::rename(const std::string &old_name, const std::string &new_name) {
   if (!fs::rename(old_name, new_name)) {
     throw std::runtime_error("cannot rename file: " + old_name + " -> " + new_name);
@@ -439,6 +650,13 @@ template<> void ClassDef<OS>::init() {
     }
   });
 
+  // os.readFileAsync
+  method("readFileAsync", [](Context &ctx, Object*, Value &ret) {
+    Str *filename;
+    if (!ctx.arguments(1, &filename)) return;
+    ret.set(OS::read_async(filename->str()));
+  });
+
   // os.writeFile
   method("writeFile", [](Context &ctx, Object*, Value &ret) {
     Str *filename;
@@ -457,6 +675,20 @@ template<> void ClassDef<OS>::init() {
     }
   });
 
+  // os.writeFileAsync
+  method("writeFileAsync", [](Context &ctx, Object*, Value &ret) {
+    Str *filename;
+    Str *str = nullptr;
+    pipy::Data *data = nullptr;
+    if (!ctx.check(0, filename)) return;
+    if (!ctx.get(1, data) && !ctx.get(1, str)) return ctx.error_argument_type(1, "a Data or string");
+    if (str) {
+      ret.set(OS::write_async(filename->str(), str->str()));
+    } else {
+      ret.set(OS::write_async(filename->str(), data));
+    }
+  });
+
   // os.kill
   method("kill", [](Context &ctx, Object*, Value &ret) {
     int pid, sig = 0;
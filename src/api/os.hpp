@@ -78,8 +78,11 @@ public:
   static auto stat(const std::string &pathname) -> Stats*;
   static auto list(const std::string &pathname) -> pjs::Array*;
   static auto read(const std::string &pathname) -> Data*;
+  static auto read_async(const std::string &pathname) -> pjs::Promise*;
   static void write(const std::string &pathname, Data *data);
   static void write(const std::string &pathname, const std::string &data);
+  static auto write_async(const std::string &pathname, Data *data) -> pjs::Promise*;
+  static auto write_async(const std::string &pathname, const std::string &data) -> pjs::Promise*;
   static void rename(const std::string &old_name, const std::string &new_name);
   static bool unlink(const std::string &pathname);
   static void mkdir(const std::string &pathname, const MkdirOptions &options = MkdirOptions());
@@ -29,7 +29,10 @@
 #include "worker.hpp"
 
 // all filters
+#include "filters/adaptive-concurrency.hpp"
 #include "filters/bgp.hpp"
+#include "filters/cache.hpp"
+#include "filters/coalesce.hpp"
 #include "filters/connect.hpp"
 #include "filters/compress.hpp"
 #include "filters/decompress.hpp"
@@ -42,8 +45,10 @@
 #include "filters/exec.hpp"
 #include "filters/fcgi.hpp"
 #include "filters/fork.hpp"
+#include "filters/grpc.hpp"
 #include "filters/http.hpp"
 #include "filters/insert.hpp"
+#include "filters/kafka.hpp"
 #include "filters/loop.hpp"
 #include "filters/mime.hpp"
 #include "filters/mqtt.hpp"
@@ -63,6 +68,8 @@
 #include "filters/replace-message.hpp"
 #include "filters/replace-start.hpp"
 #include "filters/resp.hpp"
+#include "filters/retry.hpp"
+#include "filters/route.hpp"
 #include "filters/socks.hpp"
 #include "filters/split.hpp"
 #include "filters/swap.hpp"
@@ -158,12 +165,28 @@ void PipelineDesigner::accept_tls(pjs::Object *options) {
   require_sub_pipeline(append_filter(new tls::Server(options)));
 }
 
-void PipelineDesigner::compress(const pjs::Value &algorithm) {
-  append_filter(new Compress(algorithm));
+void PipelineDesigner::adaptive_concurrency(pjs::Object *options) {
+  require_sub_pipeline(append_filter(new AdaptiveConcurrency(options)));
 }
 
-void PipelineDesigner::compress_http(const pjs::Value &algorithm) {
-  append_filter(new CompressHTTP(algorithm));
+void PipelineDesigner::aggregate_kafka_produce(pjs::Object *options) {
+  require_sub_pipeline(append_filter(new kafka::ProduceAggregator(options)));
+}
+
+void PipelineDesigner::cache_http(pjs::Object *options) {
+  require_sub_pipeline(append_filter(new CacheHTTP(options)));
+}
+
+void PipelineDesigner::coalesce(pjs::Function *key, pjs::Object *options) {
+  require_sub_pipeline(append_filter(new Coalesce(key, options)));
+}
+
+void PipelineDesigner::compress(const pjs::Value &algorithm, pjs::Object *options) {
+  append_filter(new Compress(algorithm, options));
+}
+
+void PipelineDesigner::compress_http(const pjs::Value &algorithm, pjs::Object *options) {
+  append_filter(new CompressHTTP(algorithm, options));
 }
 
 void PipelineDesigner::connect(const pjs::Value &target, pjs::Object *options) {
@@ -194,8 +217,12 @@ void PipelineDesigner::decode_bgp(pjs::Object *options) {
   append_filter(new bgp::Decoder(options));
 }
 
-void PipelineDesigner::decode_dubbo() {
-  append_filter(new dubbo::Decoder());
+void PipelineDesigner::decode_dubbo(pjs::Object *options) {
+  append_filter(new dubbo::Decoder(options));
+}
+
+void PipelineDesigner::decode_grpc() {
+  append_filter(new grpc::Decoder());
 }
 
 void PipelineDesigner::decode_http_request(pjs::Function *handler) {
@@ -206,6 +233,10 @@ void PipelineDesigner::decode_http_response(pjs::Function *handler) {
   append_filter(new http::ResponseDecoder(handler));
 }
 
+void PipelineDesigner::decode_kafka(pjs::Object *options) {
+  append_filter(new kafka::Decoder(options));
+}
+
 void PipelineDesigner::decode_mqtt() {
   append_filter(new mqtt::Decoder());
 }
@@ -222,20 +253,24 @@ void PipelineDesigner::decode_resp() {
   append_filter(new resp::Decoder());
 }
 
-void PipelineDesigner::decode_thrift() {
-  append_filter(new thrift::Decoder());
+void PipelineDesigner::decode_socks_datagram() {
+  append_filter(new socks::DatagramDecoder());
 }
 
-void PipelineDesigner::decode_websocket() {
-  append_filter(new websocket::Decoder());
+void PipelineDesigner::decode_thrift(pjs::Object *options) {
+  append_filter(new thrift::Decoder(options));
 }
 
-void PipelineDesigner::decompress(const pjs::Value &algorithm) {
-  append_filter(new Decompress(algorithm));
+void PipelineDesigner::decode_websocket(pjs::Object *options) {
+  append_filter(new websocket::Decoder(options));
 }
 
-void PipelineDesigner::decompress_http() {
-  append_filter(new DecompressHTTP());
+void PipelineDesigner::decompress(const pjs::Value &algorithm, pjs::Object *options) {
+  append_filter(new Decompress(algorithm, options));
+}
+
+void PipelineDesigner::decompress_http(pjs::Object *options) {
+  append_filter(new DecompressHTTP(options));
 }
 
 void PipelineDesigner::deframe(pjs::Object *states) {
@@ -274,6 +309,10 @@ void PipelineDesigner::encode_dubbo() {
   append_filter(new dubbo::Encoder());
 }
 
+void PipelineDesigner::encode_grpc() {
+  append_filter(new grpc::Encoder());
+}
+
 void PipelineDesigner::encode_http_request(pjs::Object *options, pjs::Function *handler) {
   append_filter(new http::RequestEncoder(options, handler));
 }
@@ -282,6 +321,10 @@ void PipelineDesigner::encode_http_response(pjs::Object *options, pjs::Function
   append_filter(new http::ResponseEncoder(options, handler));
 }
 
+void PipelineDesigner::encode_kafka() {
+  append_filter(new kafka::Encoder());
+}
+
 void PipelineDesigner::encode_mqtt() {
   append_filter(new mqtt::Encoder());
 }
@@ -294,18 +337,26 @@ void PipelineDesigner::encode_resp() {
   append_filter(new resp::Encoder());
 }
 
+void PipelineDesigner::encode_socks_datagram() {
+  append_filter(new socks::DatagramEncoder());
+}
+
 void PipelineDesigner::encode_thrift() {
   append_filter(new thrift::Encoder());
 }
 
-void PipelineDesigner::encode_websocket() {
-  append_filter(new websocket::Encoder());
+void PipelineDesigner::encode_websocket(pjs::Object *options) {
+  append_filter(new websocket::Encoder(options));
 }
 
 void PipelineDesigner::exec(const pjs::Value &command, pjs::Object *options) {
   append_filter(new Exec(command, options));
 }
 
+void PipelineDesigner::fanout_mqtt(const pjs::Value &trie) {
+  append_filter(new mqtt::Fanout(trie));
+}
+
 void PipelineDesigner::fork(const pjs::Value &init_args) {
   require_sub_pipeline(append_filter(new Fork(init_args)));
 }
@@ -406,6 +457,18 @@ void PipelineDesigner::print() {
   append_filter(new Print());
 }
 
+void PipelineDesigner::respond_static(pjs::Object *responses, pjs::Object *options) {
+  append_filter(new http::StaticServer(responses, options));
+}
+
+void PipelineDesigner::retry(pjs::Object *options) {
+  require_sub_pipeline(append_filter(new Retry(options)));
+}
+
+void PipelineDesigner::route(algo::RouteTable *table, pjs::Object *pipelines) {
+  append_filter(new Route(table, pipelines));
+}
+
 void PipelineDesigner::serve_http(pjs::Object *handler, pjs::Object *options) {
   append_filter(new http::Server(handler, options));
 }
@@ -517,7 +580,7 @@ auto PipelineWrapper::process(pjs::Object *events) -> pjs::Promise* {
         }
       }
     );
-    events->as<pjs::Promise>()->then(ctx, cb->resolved(), cb->rejected());
+    events->as<pjs::Promise>()->then(cb);
     m_events_callback = cb;
   } else if (events->is<Hub>()) {
     // TODO
@@ -543,7 +606,7 @@ void PipelineWrapper::generate() {
           }
         }
       );
-      events.as<pjs::Promise>()->then(ctx, cb->resolved(), cb->rejected());
+      events.as<pjs::Promise>()->then(cb);
       m_events_callback = cb;
       break;
     }
@@ -706,8 +769,8 @@ template<> void ClassDef<PipelineDesigner>::init() {
 
   // PipelineDesigner.acceptProxyProtocol
   filter("acceptProxyProtocol", [](Context &ctx, PipelineDesigner *obj) {
-    Function *handler;
-    if (!ctx.arguments(1, &handler)) return;
+    Function *handler = nullptr;
+    if (!ctx.arguments(0, &handler)) return;
     obj->accept_proxy_protocol(handler);
   });
 
@@ -725,18 +788,49 @@ template<> void ClassDef<PipelineDesigner>::init() {
     obj->accept_tls(options);
   });
 
+  // PipelineDesigner.adaptiveConcurrency
+  filter("adaptiveConcurrency", [](Context &ctx, PipelineDesigner *obj) {
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    obj->adaptive_concurrency(options);
+  });
+
+  // PipelineDesigner.aggregateKafkaProduce
+  filter("aggregateKafkaProduce", [](Context &ctx, PipelineDesigner *obj) {
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    obj->aggregate_kafka_produce(options);
+  });
+
+  // PipelineDesigner.cacheHTTP
+  filter("cacheHTTP", [](Context &ctx, PipelineDesigner *obj) {
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    obj->cache_http(options);
+  });
+
+  // PipelineDesigner.coalesce
+  filter("coalesce", [](Context &ctx, PipelineDesigner *obj) {
+    Function *key;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &key, &options)) return;
+    obj->coalesce(key, options);
+  });
+
   // PipelineDesigner.compress
   filter("compress", [](Context &ctx, PipelineDesigner *obj) {
     Value algorithm;
-    if (!ctx.arguments(1, &algorithm)) return;
-    obj->compress(algorithm);
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &algorithm, &options)) return;
+    obj->compress(algorithm, options);
   });
 
   // PipelineDesigner.compressHTTP
   filter("compressHTTP", [](Context &ctx, PipelineDesigner *obj) {
     Value algorithm;
-    if (!ctx.arguments(1, &algorithm)) return;
-    obj->compress_http(algorithm);
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &algorithm, &options)) return;
+    obj->compress_http(algorithm, options);
   });
 
   // PipelineDesigner.connect
@@ -784,7 +878,14 @@ template<> void ClassDef<PipelineDesigner>::init() {
 
   // PipelineDesigner.decodeDubbo
   filter("decodeDubbo", [](Context &ctx, PipelineDesigner *obj) {
-    obj->decode_dubbo();
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    obj->decode_dubbo(options);
+  });
+
+  // PipelineDesigner.decodeGRPC
+  filter("decodeGRPC", [](Context &ctx, PipelineDesigner *obj) {
+    obj->decode_grpc();
   });
 
   // PipelineDesigner.decodeHTTPRequest
@@ -801,6 +902,13 @@ template<> void ClassDef<PipelineDesigner>::init() {
     obj->decode_http_response(handler);
   });
 
+  // PipelineDesigner.decodeKafka
+  filter("decodeKafka", [](Context &ctx, PipelineDesigner *obj) {
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    obj->decode_kafka(options);
+  });
+
   // PipelineDesigner.decodeMQTT
   filter("decodeMQTT", [](Context &ctx, PipelineDesigner *obj) {
     obj->decode_mqtt();
@@ -821,26 +929,38 @@ template<> void ClassDef<PipelineDesigner>::init() {
     obj->decode_resp();
   });
 
+  // PipelineDesigner.decodeSOCKSDatagram
+  filter("decodeSOCKSDatagram", [](Context &ctx, PipelineDesigner *obj) {
+    obj->decode_socks_datagram();
+  });
+
   // PipelineDesigner.decodeThrift
   filter("decodeThrift", [](Context &ctx, PipelineDesigner *obj) {
-    obj->decode_thrift();
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    obj->decode_thrift(options);
   });
 
   // PipelineDesigner.decodeWebSocket
   filter("decodeWebSocket", [](Context &ctx, PipelineDesigner *obj) {
-    obj->decode_websocket();
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    obj->decode_websocket(options);
   });
 
   // PipelineDesigner.decompress
   filter("decompress", [](Context &ctx, PipelineDesigner *obj) {
     Value algorithm;
-    if (!ctx.arguments(1, &algorithm)) return;
-    obj->decompress(algorithm);
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &algorithm, &options)) return;
+    obj->decompress(algorithm, options);
   });
 
   // PipelineDesigner.decompressHTTP
   filter("decompressHTTP", [](Context &ctx, PipelineDesigner *obj) {
-    obj->decompress_http();
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    obj->decompress_http(options);
   });
 
   // PipelineDesigner.deframe
@@ -900,6 +1020,11 @@ template<> void ClassDef<PipelineDesigner>::init() {
     obj->encode_dubbo();
   });
 
+  // PipelineDesigner.encodeGRPC
+  filter("encodeGRPC", [](Context &ctx, PipelineDesigner *obj) {
+    obj->encode_grpc();
+  });
+
   // PipelineDesigner.encodeHTTPRequest
   filter("encodeHTTPRequest", [](Context &ctx, PipelineDesigner *obj) {
     Object *options = nullptr;
@@ -924,6 +1049,11 @@ template<> void ClassDef<PipelineDesigner>::init() {
     obj->encode_http_response(options, handler);
   });
 
+  // PipelineDesigner.encodeKafka
+  filter("encodeKafka", [](Context &ctx, PipelineDesigner *obj) {
+    obj->encode_kafka();
+  });
+
   // PipelineDesigner.encodeMQTT
   filter("encodeMQTT", [](Context &ctx, PipelineDesigner *obj) {
     obj->encode_mqtt();
@@ -939,6 +1069,11 @@ template<> void ClassDef<PipelineDesigner>::init() {
     obj->encode_resp();
   });
 
+  // PipelineDesigner.encodeSOCKSDatagram
+  filter("encodeSOCKSDatagram", [](Context &ctx, PipelineDesigner *obj) {
+    obj->encode_socks_datagram();
+  });
+
   // PipelineDesigner.encodeThrift
   filter("encodeThrift", [](Context &ctx, PipelineDesigner *obj) {
     obj->encode_thrift();
@@ -946,7 +1081,9 @@ template<> void ClassDef<PipelineDesigner>::init() {
 
   // PipelineDesigner.encodeWebSocket
   filter("encodeWebSocket", [](Context &ctx, PipelineDesigner *obj) {
-    obj->encode_websocket();
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    obj->encode_websocket(options);
   });
 
   // PipelineDesigner.exec
@@ -957,6 +1094,13 @@ template<> void ClassDef<PipelineDesigner>::init() {
     obj->exec(command, options);
   });
 
+  // PipelineDesigner.fanoutMQTT
+  filter("fanoutMQTT", [](Context &ctx, PipelineDesigner *obj) {
+    Value trie;
+    if (!ctx.arguments(1, &trie)) return;
+    obj->fanout_mqtt(trie);
+  });
+
   // PipelineDesigner.fork
   filter("fork", [](Context &ctx, PipelineDesigner *obj) {
     Value init_args;
@@ -1224,6 +1368,45 @@ template<> void ClassDef<PipelineDesigner>::init() {
     obj->replace_start(replacement);
   });
 
+  // PipelineDesigner.respondStatic
+  filter("respondStatic", [](Context &ctx, PipelineDesigner *obj) {
+    Object *responses;
+    Object *options = nullptr;
+    if (!ctx.arguments(1, &responses, &options)) return;
+    obj->respond_static(responses, options);
+  });
+
+  // PipelineDesigner.retry
+  filter("retry", [](Context &ctx, PipelineDesigner *obj) {
+    Object *options = nullptr;
+    if (!ctx.arguments(0, &options)) return;
+    obj->retry(options);
+  });
+
+  // PipelineDesigner.route
+  filter("route", [](Context &ctx, PipelineDesigner *obj) {
+    algo::RouteTable *table;
+    Object *pipelines = nullptr;
+    if (!ctx.arguments(1, &table, &pipelines)) return;
+    if (pipelines) {
+      pipelines->iterate_while(
+        [&](Str *k, Value &v) {
+          if (v.is<PipelineLayoutWrapper>()) return true;
+          if (v.is_function()) {
+            auto pl = PipelineDesigner::make_pipeline_layout(ctx, v.f());
+            if (!pl) return false;
+            v.set(PipelineLayoutWrapper::make(pl));
+            return true;
+          }
+          ctx.error("map entry '" + k->str() + "' doesn't contain a valid pipeline");
+          return false;
+        }
+      );
+      if (!ctx.ok()) return;
+    }
+    obj->route(table, pipelines);
+  });
+
   // PipelineDesigner.serveHTTP
   filter("serveHTTP", [](Context &ctx, PipelineDesigner *obj) {
     Object *handler;
@@ -35,6 +35,10 @@
 
 namespace pipy {
 
+namespace algo {
+  class RouteTable;
+}
+
 //
 // PipelineDesigner
 //
@@ -60,25 +64,32 @@ public:
   void accept_proxy_protocol(pjs::Function *handler);
   void accept_socks(pjs::Function *handler);
   void accept_tls(pjs::Object *options);
-  void compress(const pjs::Value &algorithm);
-  void compress_http(const pjs::Value &algorithm);
+  void adaptive_concurrency(pjs::Object *options);
+  void aggregate_kafka_produce(pjs::Object *options);
+  void cache_http(pjs::Object *options);
+  void coalesce(pjs::Function *key, pjs::Object *options);
+  void compress(const pjs::Value &algorithm, pjs::Object *options);
+  void compress_http(const pjs::Value &algorithm, pjs::Object *options);
   void connect(const pjs::Value &target, pjs::Object *options);
   void connect_http_tunnel(pjs::Object *handshake);
   void connect_proxy_protocol(const pjs::Value &address);
   void connect_socks(const pjs::Value &address);
   void connect_tls(pjs::Object *options);
   void decode_bgp(pjs::Object *options);
-  void decode_dubbo();
+  void decode_dubbo(pjs::Object *options);
+  void decode_grpc();
   void decode_http_request(pjs::Function *handler);
   void decode_http_response(pjs::Function *handler);
+  void decode_kafka(pjs::Object *options);
   void decode_mqtt();
   void decode_multipart();
   void decode_netlink();
   void decode_resp();
-  void decode_thrift();
-  void decode_websocket();
-  void decompress(const pjs::Value &algorithm);
-  void decompress_http();
+  void decode_socks_datagram();
+  void decode_thrift(pjs::Object *options);
+  void decode_websocket(pjs::Object *options);
+  void decompress(const pjs::Value &algorithm, pjs::Object *options);
+  void decompress_http(pjs::Object *options);
   void deframe(pjs::Object *states);
   void demux(pjs::Object *options);
   void demux_fcgi();
@@ -88,14 +99,18 @@ public:
   void dump(const pjs::Value &tag);
   void encode_bgp(pjs::Object *options);
   void encode_dubbo();
+  void encode_grpc();
   void encode_http_request(pjs::Object *options, pjs::Function *handler);
   void encode_http_response(pjs::Object *options, pjs::Function *handler);
+  void encode_kafka();
   void encode_mqtt();
   void encode_netlink();
   void encode_resp();
+  void encode_socks_datagram();
   void encode_thrift();
-  void encode_websocket();
+  void encode_websocket(pjs::Object *options);
   void exec(const pjs::Value &command, pjs::Object *options);
+  void fanout_mqtt(const pjs::Value &trie);
   void fork(const pjs::Value &init_args);
   void fork_join(const pjs::Value &init_args);
   void fork_race(const pjs::Value &init_args);
@@ -118,6 +133,9 @@ public:
   void replace_body(pjs::Object *replacement, pjs::Object *options);
   void replace_message(pjs::Object *replacement, pjs::Object *options);
   void replace_start(pjs::Object *replacement);
+  void respond_static(pjs::Object *responses, pjs::Object *options);
+  void retry(pjs::Object *options);
+  void route(algo::RouteTable *table, pjs::Object *pipelines);
   void serve_http(pjs::Object *handler, pjs::Object *options);
   void split(const pjs::Value &separator);
   void swap(const pjs::Value &hub);
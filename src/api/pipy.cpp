@@ -508,7 +508,7 @@ bool Pipy::start_exiting(pjs::Context &ctx, const std::function<void()> &on_done
           }
         }
       );
-      ret.as<pjs::Promise>()->then(&ctx, pcb->resolved(), pcb->rejected());
+      ret.as<pjs::Promise>()->then(pcb);
       s_exit_callbacks_counter++;
     }
   }
@@ -710,6 +710,18 @@ template<> void ClassDef<Pipy>::init() {
     ret.set(utils::now_since(Status::LocalInstance::since));
   });
 
+  method("httpDate", [](Context &ctx, Object*, Value &ret) {
+    char buf[32];
+    auto len = utils::format_http_date(buf);
+    ret.set(Str::make(buf, len));
+  });
+
+  method("isoDate", [](Context &ctx, Object*, Value &ret) {
+    char buf[32];
+    auto len = utils::format_iso_date(buf);
+    ret.set(Str::make(buf, len));
+  });
+
   method("fork", [](Context &ctx, Object*, Value &ret) {
     Function *func;
     if (!ctx.arguments(1, &func)) return;
@@ -818,7 +830,7 @@ template<> void ClassDef<Pipy>::init() {
         Codebase::current()->sync(
           true, [](bool ok) {
             if (ok) {
-              WorkerManager::get().reload();
+              WorkerManager::get().reload(true);
             }
           }
         );
@@ -568,6 +568,42 @@ bool Protobuf::Message::read_uint64(Data::Reader &r, uint64_t &n) {
   return true;
 }
 
+//
+// Protobuf::Writer
+//
+
+Protobuf::Writer::Writer(Data &data)
+  : m_db(data, &s_dp)
+{
+}
+
+void Protobuf::Writer::varint(int field, uint64_t value) {
+  Message::write_varint(m_db, (uint64_t)field << 3);
+  Message::write_varint(m_db, value);
+}
+
+void Protobuf::Writer::fixed32(int field, uint32_t value) {
+  Message::write_varint(m_db, ((uint64_t)field << 3) | 5);
+  Message::write_uint32(m_db, value);
+}
+
+void Protobuf::Writer::fixed64(int field, uint64_t value) {
+  Message::write_varint(m_db, ((uint64_t)field << 3) | 1);
+  Message::write_uint64(m_db, value);
+}
+
+void Protobuf::Writer::bytes(int field, const void *p, size_t n) {
+  Message::write_varint(m_db, ((uint64_t)field << 3) | 2);
+  Message::write_varint(m_db, n);
+  m_db.push(p, n);
+}
+
+void Protobuf::Writer::bytes(int field, const Data &data) {
+  Message::write_varint(m_db, ((uint64_t)field << 3) | 2);
+  Message::write_varint(m_db, data.size());
+  m_db.push(data);
+}
+
 void Protobuf::Message::write_varint(Data::Builder &db, uint64_t n) {
   do {
     char c = n & 0x7f;
@@ -610,6 +646,646 @@ auto Protobuf::Message::encode_sint(int64_t n) -> uint64_t {
   return (n << 1) ^ (n >> 63);
 }
 
+//
+// Protobuf::Schema::Parser
+//
+// Reads just enough of the .proto grammar to get message types and
+// their fields. Options, services, extensions and enum values are
+// skipped since none of them changes how a field goes on the wire,
+// with the exception of [packed=...].
+//
+
+class Protobuf::Schema::Parser {
+public:
+  Parser(Schema *schema, const std::string &source)
+    : m_schema(schema), m_source(source) {}
+
+  void parse() {
+    for (;;) {
+      auto t = next();
+      if (t.empty()) break;
+      if (t == ";") continue;
+      if (t == "syntax") {
+        expect("=");
+        auto s = next();
+        m_schema->m_proto3 = (s == "\"proto3\"" || s == "'proto3'");
+        expect(";");
+      } else if (t == "package") {
+        m_schema->m_package = next();
+        expect(";");
+      } else if (t == "import" || t == "option") {
+        skip_statement();
+      } else if (t == "message") {
+        parse_message(m_schema->m_package);
+      } else if (t == "enum") {
+        parse_enum(m_schema->m_package);
+      } else if (t == "service" || t == "extend") {
+        skip_block();
+      } else {
+        error("unexpected '" + t + "'");
+      }
+    }
+  }
+
+private:
+  Schema* m_schema;
+  const std::string& m_source;
+  size_t m_ptr = 0;
+  int m_line = 1;
+  std::string m_peek;
+  bool m_has_peek = false;
+
+  void parse_message(const std::string &scope) {
+    auto name = next();
+    auto full = scope.empty() ? name : scope + '.' + name;
+    auto type = new MessageType;
+    type->name = full;
+    m_schema->m_types[full].reset(type);
+    expect("{");
+    for (;;) {
+      auto t = next();
+      if (t == "}") break;
+      if (t.empty()) error("unexpected end of file");
+      if (t == ";") continue;
+      if (t == "message") {
+        parse_message(full);
+      } else if (t == "enum") {
+        parse_enum(full);
+      } else if (t == "oneof") {
+        next();
+        expect("{");
+        for (;;) {
+          auto t = next();
+          if (t == "}") break;
+          if (t == "option") { skip_statement(); continue; }
+          parse_field(type, t, false);
+        }
+      } else if (t == "option" || t == "reserved" || t == "extensions") {
+        skip_statement();
+      } else if (t == "extend") {
+        skip_block();
+      } else if (t == "map") {
+        parse_map(type, full);
+      } else if (t == "repeated") {
+        parse_field(type, next(), true);
+      } else if (t == "optional" || t == "required") {
+        parse_field(type, next(), false);
+      } else {
+        parse_field(type, t, false);
+      }
+    }
+  }
+
+  void parse_field(MessageType *type, const std::string &type_name, bool repeated) {
+    Field f;
+    f.repeated = repeated;
+    f.type_name = type_name;
+    f.name = pjs::Str::make(next());
+    expect("=");
+    f.number = number();
+    f.packed = repeated && m_schema->m_proto3;
+    if (peek() == "[") {
+      next();
+      for (;;) {
+        auto t = next();
+        if (t == "]") break;
+        if (t.empty()) error("unexpected end of file");
+        if (t == "packed") {
+          expect("=");
+          f.packed = (next() == "true");
+        }
+      }
+    }
+    expect(";");
+    type->fields.push_back(f);
+  }
+
+  //
+  // A map field is a repeated entry message with the key as field 1 and
+  // the value as field 2, which is what goes on the wire.
+  //
+
+  void parse_map(MessageType *type, const std::string &scope) {
+    expect("<");
+    auto key_type = next();
+    expect(",");
+    auto value_type = next();
+    expect(">");
+    auto name = next();
+    auto entry = new MessageType;
+    entry->name = scope + '.' + name + "$Entry";
+    Field k, v;
+    k.name = pjs::Str::make("key");
+    k.number = 1;
+    k.type_name = key_type;
+    v.name = pjs::Str::make("value");
+    v.number = 2;
+    v.type_name = value_type;
+    entry->fields.push_back(k);
+    entry->fields.push_back(v);
+    m_schema->m_types[entry->name].reset(entry);
+    Field f;
+    f.name = pjs::Str::make(name);
+    f.repeated = true;
+    f.map = true;
+    f.type_name = entry->name;
+    expect("=");
+    f.number = number();
+    skip_statement();
+    type->fields.push_back(f);
+  }
+
+  void parse_enum(const std::string &scope) {
+    auto name = next();
+    m_schema->m_enums.insert(scope.empty() ? name : scope + '.' + name);
+    expect("{");
+    skip_to_close();
+  }
+
+  void skip_statement() {
+    for (;;) {
+      auto t = next();
+      if (t.empty() || t == ";") break;
+      if (t == "{") skip_to_close();
+    }
+  }
+
+  void skip_block() {
+    for (;;) {
+      auto t = next();
+      if (t.empty()) error("unexpected end of file");
+      if (t == "{") break;
+    }
+    skip_to_close();
+  }
+
+  void skip_to_close() {
+    for (int level = 1; level > 0; ) {
+      auto t = next();
+      if (t.empty()) error("unexpected end of file");
+      if (t == "{") level++;
+      else if (t == "}") level--;
+    }
+  }
+
+  auto number() -> int {
+    auto t = next();
+    char *end = nullptr;
+    auto n = std::strtol(t.c_str(), &end, 0);
+    if (t.empty() || *end || n <= 0 || n > (1 << 29) - 1) error("invalid field number '" + t + "'");
+    return n;
+  }
+
+  void expect(const char *s) {
+    auto t = next();
+    if (t != s) error(std::string("expected '") + s + "' but got '" + t + "'");
+  }
+
+  void error(const std::string &msg) {
+    throw std::runtime_error("proto syntax error at line " + std::to_string(m_line) + ": " + msg);
+  }
+
+  auto peek() -> const std::string& {
+    if (!m_has_peek) {
+      m_peek = read();
+      m_has_peek = true;
+    }
+    return m_peek;
+  }
+
+  auto next() -> std::string {
+    if (m_has_peek) {
+      m_has_peek = false;
+      return std::move(m_peek);
+    }
+    return read();
+  }
+
+  auto read() -> std::string {
+    const auto &s = m_source;
+    auto &i = m_ptr;
+    auto n = s.length();
+    for (;;) {
+      while (i < n && std::isspace(s[i])) {
+        if (s[i] == '\n') m_line++;
+        i++;
+      }
+      if (i + 1 < n && s[i] == '/' && s[i+1] == '/') {
+        while (i < n && s[i] != '\n') i++;
+      } else if (i + 1 < n && s[i] == '/' && s[i+1] == '*') {
+        i += 2;
+        while (i + 1 < n && !(s[i] == '*' && s[i+1] == '/')) {
+          if (s[i] == '\n') m_line++;
+          i++;
+        }
+        i += 2;
+      } else {
+        break;
+      }
+    }
+    if (i >= n) return std::string();
+    auto start = i;
+    auto c = s[i];
+    if (std::isalnum(c) || c == '_' || c == '.' || c == '-' || c == '+') {
+      while (i < n && (std::isalnum(s[i]) || s[i] == '_' || s[i] == '.' || s[i] == '-' || s[i] == '+')) i++;
+    } else if (c == '"' || c == '\'') {
+      i++;
+      while (i < n && s[i] != c) {
+        if (s[i] == '\\') i++;
+        i++;
+      }
+      i++;
+    } else {
+      i++;
+    }
+    return s.substr(start, i - start);
+  }
+};
+
+//
+// Protobuf::Schema
+//
+
+Protobuf::Schema::Schema(const std::string &source) {
+  Parser(this, source).parse();
+  resolve();
+}
+
+auto Protobuf::Schema::MessageType::find(int number) const -> const Field* {
+  if (number < (int)numbers.size()) {
+    auto i = numbers[number];
+    return i >= 0 ? &fields[i] : nullptr;
+  }
+  auto i = sparse_numbers.find(number);
+  if (i == sparse_numbers.end()) return nullptr;
+  return &fields[i->second];
+}
+
+auto Protobuf::Schema::find(const std::string &name) const -> MessageType* {
+  auto i = m_types.find(name);
+  if (i == m_types.end() && !m_package.empty()) i = m_types.find(m_package + '.' + name);
+  if (i == m_types.end()) return nullptr;
+  return i->second.get();
+}
+
+//
+// Type names are looked up from the innermost scope outwards like protoc
+// does, then every type gets a class with a slot for each of its fields.
+// Numbers up to DENSE_NUMBERS are indexed by a plain array.
+//
+
+void Protobuf::Schema::resolve() {
+  static const std::map<std::string, Type> scalars = {
+    { "double", Type::DOUBLE },
+    { "float", Type::FLOAT },
+    { "int32", Type::INT32 },
+    { "int64", Type::INT64 },
+    { "uint32", Type::UINT32 },
+    { "uint64", Type::UINT64 },
+    { "sint32", Type::SINT32 },
+    { "sint64", Type::SINT64 },
+    { "fixed32", Type::FIXED32 },
+    { "fixed64", Type::FIXED64 },
+    { "sfixed32", Type::SFIXED32 },
+    { "sfixed64", Type::SFIXED64 },
+    { "bool", Type::BOOL },
+    { "string", Type::STRING },
+    { "bytes", Type::BYTES },
+  };
+
+  static const int DENSE_NUMBERS = 1024;
+
+  for (auto &p : m_types) {
+    auto type = p.second.get();
+    auto scope = type->name;
+
+    for (auto &f : type->fields) {
+      auto i = scalars.find(f.type_name);
+      if (i != scalars.end()) {
+        f.type = i->second;
+        if (f.type == Type::STRING || f.type == Type::BYTES) f.packed = false;
+        continue;
+      }
+
+      auto name = f.type_name;
+      std::string found;
+      if (name[0] == '.') {
+        found = name.substr(1);
+      } else {
+        for (auto s = scope; ; ) {
+          auto full = s.empty() ? name : s + '.' + name;
+          if (m_types.count(full) || m_enums.count(full)) { found = full; break; }
+          if (s.empty()) break;
+          auto dot = s.rfind('.');
+          s = (dot == std::string::npos ? std::string() : s.substr(0, dot));
+        }
+      }
+
+      if (m_enums.count(found)) {
+        f.type = Type::ENUM;
+      } else {
+        auto t = m_types.find(found);
+        if (t == m_types.end()) {
+          throw std::runtime_error("unknown type '" + name + "' in message " + type->name);
+        }
+        f.type = Type::MESSAGE;
+        f.message = t->second.get();
+        f.packed = false;
+      }
+    }
+
+    std::list<pjs::Field*> fields;
+    for (const auto &f : type->fields) {
+      pjs::Value init;
+      if (!f.repeated) {
+        switch (f.type) {
+          case Type::BOOL: init.set(false); break;
+          case Type::STRING: init.set(pjs::Str::empty); break;
+          case Type::BYTES: case Type::MESSAGE: break;
+          default: init.set(0); break;
+        }
+      }
+      fields.push_back(pjs::Variable::make(f.name->str(), init, pjs::Field::Enumerable | pjs::Field::Writable));
+    }
+
+    type->cls = pjs::Class::make(type->name, pjs::class_of<pjs::Object>(), fields);
+
+    for (size_t i = 0; i < type->fields.size(); i++) {
+      auto &f = type->fields[i];
+      f.slot = static_cast<pjs::Variable*>(type->cls->field(type->cls->find_field(f.name)))->index();
+      if (f.number < DENSE_NUMBERS) {
+        if (f.number >= (int)type->numbers.size()) type->numbers.resize(f.number + 1, -1);
+        type->numbers[f.number] = i;
+      } else {
+        type->sparse_numbers[f.number] = i;
+      }
+    }
+  }
+}
+
+auto Protobuf::Schema::decode(MessageType *type, const Data &data) -> pjs::Object* {
+  Data::Reader r(data);
+  pjs::Ref<pjs::Object> obj = pjs::Object::make(type->cls);
+  if (!decode(type, r, obj)) return nullptr;
+  return obj.release();
+}
+
+bool Protobuf::Schema::decode(MessageType *type, Data::Reader &r, pjs::Object *obj) {
+  while (!r.eof()) {
+    uint64_t tag;
+    if (!Message::read_varint(r, tag)) return false;
+    auto wire_type = int(tag & 7);
+    if (auto f = type->find(tag >> 3)) {
+      if (!decode_field(*f, wire_type, r, obj)) return false;
+    } else {
+      switch (wire_type) {
+        case 0: {
+          uint64_t n;
+          if (!Message::read_varint(r, n)) return false;
+          break;
+        }
+        case 1: if (r.skip(8) < 8) return false; break;
+        case 5: if (r.skip(4) < 4) return false; break;
+        case 2: {
+          uint64_t n;
+          if (!Message::read_varint(r, n)) return false;
+          if (r.skip(n) < (int)n) return false;
+          break;
+        }
+        default: return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Protobuf::Schema::decode_field(const Field &f, int wire_type, Data::Reader &r, pjs::Object *obj) {
+  auto &slot = obj->data()->at(f.slot);
+
+  auto add = [&](const pjs::Value &v) {
+    if (!f.repeated) {
+      slot = v;
+    } else {
+      if (!slot.is_array()) slot.set(pjs::Array::make());
+      slot.as<pjs::Array>()->push(v);
+    }
+  };
+
+  auto read_scalar = [&](Data::Reader &r, int wt, pjs::Value &v) -> bool {
+    uint64_t bits;
+    switch (wt) {
+      case 0: if (!Message::read_varint(r, bits)) return false; break;
+      case 1: if (!Message::read_uint64(r, bits)) return false; break;
+      case 5: {
+        uint32_t n;
+        if (!Message::read_uint32(r, n)) return false;
+        bits = n;
+        break;
+      }
+      default: return false;
+    }
+    v = to_value(f.type, bits);
+    return true;
+  };
+
+  auto expected = wire_type_of(f.type);
+
+  if (wire_type == expected && expected != 2) {
+    pjs::Value v;
+    if (!read_scalar(r, wire_type, v)) return false;
+    add(v);
+    return true;
+  }
+
+  if (wire_type != 2) {
+    uint64_t n;
+    switch (wire_type) {
+      case 0: return Message::read_varint(r, n);
+      case 1: return r.skip(8) == 8;
+      case 5: return r.skip(4) == 4;
+      default: return false;
+    }
+  }
+
+  uint64_t length;
+  if (!Message::read_varint(r, length)) return false;
+  Data data;
+  if (r.read(length, data) < (int)length) return false;
+
+  if (expected != 2) {
+    if (!f.repeated) return true;
+    Data::Reader pr(data);
+    while (!pr.eof()) {
+      pjs::Value v;
+      if (!read_scalar(pr, expected, v)) return false;
+      add(v);
+    }
+    return true;
+  }
+
+  switch (f.type) {
+    case Type::STRING:
+      add(pjs::Str::make(data.to_string()));
+      break;
+    case Type::BYTES:
+      add(Data::make(std::move(data)));
+      break;
+    case Type::MESSAGE: {
+      Data::Reader mr(data);
+      pjs::Ref<pjs::Object> msg = pjs::Object::make(f.message->cls);
+      if (!decode(f.message, mr, msg)) return false;
+      if (f.map) {
+        auto entry = msg->data();
+        auto &k = entry->at(f.message->fields[0].slot);
+        auto &v = entry->at(f.message->fields[1].slot);
+        if (!slot.is_object() || slot.is_array() || !slot.o()) slot.set(pjs::Object::make());
+        auto s = k.to_string();
+        slot.o()->set(s, v);
+        s->release();
+      } else {
+        add(msg.get());
+      }
+      break;
+    }
+    default: break;
+  }
+  return true;
+}
+
+void Protobuf::Schema::encode(MessageType *type, pjs::Object *obj, Data &data) {
+  Writer w(data);
+  for (const auto &f : type->fields) {
+    pjs::Value v;
+    obj->get(f.name, v);
+    if (v.is_nullish()) continue;
+
+    if (f.map) {
+      if (!v.is_object()) continue;
+      auto &kf = f.message->fields[0];
+      auto &vf = f.message->fields[1];
+      v.o()->iterate_all(
+        [&](pjs::Str *key, pjs::Value &val) {
+          Data entry;
+          Writer ew(entry);
+          pjs::Value k(key);
+          if (kf.type != Type::STRING) k.set(key->parse_float());
+          encode_field(kf, k, ew);
+          encode_field(vf, val, ew);
+          ew.flush();
+          w.message(f.number, entry);
+        }
+      );
+
+    } else if (f.repeated) {
+      if (!v.is_array()) continue;
+      auto a = v.as<pjs::Array>();
+      if (f.packed) {
+        Data packed;
+        Data::Builder db(packed, &s_dp);
+        auto wt = wire_type_of(f.type);
+        a->iterate_all(
+          [&](pjs::Value &e, int) {
+            auto bits = to_bits(f.type, e);
+            switch (wt) {
+              case 0: Message::write_varint(db, bits); break;
+              case 1: Message::write_uint64(db, bits); break;
+              case 5: Message::write_uint32(db, bits); break;
+            }
+          }
+        );
+        db.flush();
+        if (!packed.empty()) w.bytes(f.number, packed);
+      } else {
+        a->iterate_all([&](pjs::Value &e, int) { encode_field(f, e, w); });
+      }
+
+    } else if (!m_proto3 || !is_default(v)) {
+      encode_field(f, v, w);
+    }
+  }
+  w.flush();
+}
+
+void Protobuf::Schema::encode_field(const Field &f, const pjs::Value &v, Writer &w) {
+  switch (f.type) {
+    case Type::STRING: {
+      auto s = v.to_string();
+      w.bytes(f.number, s->c_str(), s->size());
+      s->release();
+      break;
+    }
+    case Type::BYTES:
+      if (v.is<Data>()) {
+        w.bytes(f.number, *v.as<Data>());
+      } else {
+        auto s = v.to_string();
+        w.bytes(f.number, s->c_str(), s->size());
+        s->release();
+      }
+      break;
+    case Type::MESSAGE:
+      if (v.is_object() && v.o()) {
+        Data sub;
+        encode(f.message, v.o(), sub);
+        w.message(f.number, sub);
+      }
+      break;
+    default:
+      switch (wire_type_of(f.type)) {
+        case 0: w.varint(f.number, to_bits(f.type, v)); break;
+        case 1: w.fixed64(f.number, to_bits(f.type, v)); break;
+        case 5: w.fixed32(f.number, to_bits(f.type, v)); break;
+      }
+      break;
+  }
+}
+
+auto Protobuf::Schema::to_bits(Type type, const pjs::Value &v) -> uint64_t {
+  switch (type) {
+    case Type::DOUBLE: { double d = v.to_number(); uint64_t n; std::memcpy(&n, &d, 8); return n; }
+    case Type::FLOAT: { float f = v.to_number(); uint32_t n; std::memcpy(&n, &f, 4); return n; }
+    case Type::INT32: case Type::ENUM: case Type::SFIXED32: return (uint64_t)(int64_t)v.to_int32();
+    case Type::INT64: case Type::SFIXED64: return (uint64_t)(int64_t)v.to_number();
+    case Type::UINT32: case Type::FIXED32: return (uint32_t)v.to_number();
+    case Type::UINT64: case Type::FIXED64: return (uint64_t)v.to_number();
+    case Type::SINT32: return Message::encode_sint((int32_t)v.to_int32());
+    case Type::SINT64: return Message::encode_sint((int64_t)v.to_number());
+    case Type::BOOL: return v.to_boolean() ? 1 : 0;
+    default: return 0;
+  }
+}
+
+auto Protobuf::Schema::to_value(Type type, uint64_t bits) -> pjs::Value {
+  switch (type) {
+    case Type::DOUBLE: { double d; std::memcpy(&d, &bits, 8); return d; }
+    case Type::FLOAT: { uint32_t n = bits; float f; std::memcpy(&f, &n, 4); return f; }
+    case Type::INT32: case Type::ENUM: case Type::SFIXED32: return (int32_t)bits;
+    case Type::INT64: case Type::SFIXED64: return (double)(int64_t)bits;
+    case Type::UINT32: case Type::FIXED32: return (double)(uint32_t)bits;
+    case Type::UINT64: case Type::FIXED64: return (double)bits;
+    case Type::SINT32: return Message::decode_sint((uint32_t)bits);
+    case Type::SINT64: return (double)Message::decode_sint((uint64_t)bits);
+    case Type::BOOL: return bits != 0;
+    default: return pjs::Value::undefined;
+  }
+}
+
+auto Protobuf::Schema::wire_type_of(Type type) -> int {
+  switch (type) {
+    case Type::DOUBLE: case Type::FIXED64: case Type::SFIXED64: return 1;
+    case Type::FLOAT: case Type::FIXED32: case Type::SFIXED32: return 5;
+    case Type::STRING: case Type::BYTES: case Type::MESSAGE: return 2;
+    default: return 0;
+  }
+}
+
+bool Protobuf::Schema::is_default(const pjs::Value &v) {
+  if (v.is_number()) return v.n() == 0;
+  if (v.is_boolean()) return !v.b();
+  if (v.is_string()) return v.s()->size() == 0;
+  return false;
+}
+
 } // namespace pipy
 
 namespace pjs {
@@ -624,6 +1300,7 @@ template<> void ClassDef<Protobuf>::init() {
   ctor();
 
   variable("Message", class_of<Constructor<Protobuf::Message>>());
+  variable("Schema", class_of<Constructor<Protobuf::Schema>>());
 
   method("decode", [](Context &ctx, Object *obj, Value &ret) {
     pipy::Data *data;
@@ -1098,4 +1775,51 @@ template<> void ClassDef<Constructor<Protobuf::Message>>::init() {
   ctor();
 }
 
+//
+// Protobuf::Schema
+//
+
+template<> void ClassDef<Protobuf::Schema>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Str *source;
+    if (!ctx.arguments(1, &source)) return nullptr;
+    try {
+      return Protobuf::Schema::make(source->str());
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+      return nullptr;
+    }
+  });
+
+  method("decode", [](Context &ctx, Object *obj, Value &ret) {
+    Str *name;
+    pipy::Data *data;
+    if (!ctx.arguments(2, &name, &data)) return;
+    auto schema = obj->as<Protobuf::Schema>();
+    auto type = schema->find(name->str());
+    if (!type) return ctx.error("unknown message type: " + name->str());
+    if (!data) { ret = Value::null; return; }
+    auto msg = schema->decode(type, *data);
+    if (msg) ret.set(msg); else ret = Value::null;
+  });
+
+  method("encode", [](Context &ctx, Object *obj, Value &ret) {
+    Str *name;
+    Object *msg;
+    if (!ctx.arguments(2, &name, &msg)) return;
+    auto schema = obj->as<Protobuf::Schema>();
+    auto type = schema->find(name->str());
+    if (!type) return ctx.error("unknown message type: " + name->str());
+    if (!msg) { ret = Value::null; return; }
+    pipy::Data data;
+    schema->encode(type, msg, data);
+    ret.set(pipy::Data::make(std::move(data)));
+  });
+}
+
+template<> void ClassDef<Constructor<Protobuf::Schema>>::init() {
+  super<Function>();
+  ctor();
+}
+
 } // namespace pjs
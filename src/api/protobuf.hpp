@@ -28,6 +28,11 @@
 
 #include "data.hpp"
 
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
 namespace pipy {
 
 //
@@ -36,6 +41,9 @@ namespace pipy {
 
 class Protobuf : public pjs::ObjectTemplate<Protobuf> {
 public:
+  class Writer;
+  class Schema;
+
   enum class WireType {
     NONE,
     VARINT,
@@ -286,6 +294,114 @@ public:
 
     friend class pjs::ObjectTemplate<Message>;
     friend class Protobuf;
+    friend class Writer;
+    friend class Schema;
+  };
+
+  //
+  // Protobuf::Writer
+  //
+  // Encodes fields straight into a Data in the order they are written,
+  // for native code that has no need of a Message object in between.
+  //
+
+  class Writer {
+  public:
+    Writer(Data &data);
+
+    void varint(int field, uint64_t value);
+    void fixed32(int field, uint32_t value);
+    void fixed64(int field, uint64_t value);
+    void bytes(int field, const void *p, size_t n);
+    void bytes(int field, const Data &data);
+    void string(int field, const std::string &s) { bytes(field, s.c_str(), s.length()); }
+    void message(int field, const Data &data) { bytes(field, data); }
+    void flush() { m_db.flush(); }
+
+  private:
+    Data::Builder m_db;
+  };
+
+  //
+  // Protobuf::Schema
+  //
+  // Message types from a .proto source compiled into field tables. Each
+  // type gets its own class with one slot per field, so decoding goes
+  // from the wire straight into those slots without building a Message,
+  // and encoding reads the fields of any object straight into a Writer.
+  // Fields not in the schema are skipped over when decoding.
+  //
+
+  class Schema : public pjs::ObjectTemplate<Schema> {
+  public:
+    enum class Type {
+      DOUBLE,
+      FLOAT,
+      INT32,
+      INT64,
+      UINT32,
+      UINT64,
+      SINT32,
+      SINT64,
+      FIXED32,
+      FIXED64,
+      SFIXED32,
+      SFIXED64,
+      BOOL,
+      ENUM,
+      STRING,
+      BYTES,
+      MESSAGE,
+    };
+
+    struct MessageType;
+
+    struct Field {
+      pjs::Ref<pjs::Str> name;
+      int number;
+      int slot = 0;
+      Type type;
+      bool repeated = false;
+      bool packed = false;
+      bool map = false;
+      std::string type_name;
+      MessageType* message = nullptr;
+    };
+
+    struct MessageType {
+      std::string name;
+      std::vector<Field> fields;
+      std::vector<int> numbers;
+      std::map<int, int> sparse_numbers;
+      pjs::Ref<pjs::Class> cls;
+      auto find(int number) const -> const Field*;
+    };
+
+    auto find(const std::string &name) const -> MessageType*;
+    auto decode(MessageType *type, const Data &data) -> pjs::Object*;
+    void encode(MessageType *type, pjs::Object *obj, Data &data);
+
+  private:
+    Schema(const std::string &source);
+
+    std::string m_package;
+    bool m_proto3 = false;
+    std::map<std::string, std::unique_ptr<MessageType>> m_types;
+    std::set<std::string> m_enums;
+
+    class Parser;
+
+    bool decode(MessageType *type, Data::Reader &r, pjs::Object *obj);
+    bool decode_field(const Field &f, int wire_type, Data::Reader &r, pjs::Object *obj);
+    void encode_field(const Field &f, const pjs::Value &v, Writer &w);
+    void resolve();
+
+    static auto to_bits(Type type, const pjs::Value &v) -> uint64_t;
+    static auto to_value(Type type, uint64_t bits) -> pjs::Value;
+    static auto wire_type_of(Type type) -> int;
+    static bool is_default(const pjs::Value &v);
+
+    friend class pjs::ObjectTemplate<Schema>;
   };
 
   static auto decode(const Data &data) -> Message*;
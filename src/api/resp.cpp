@@ -24,9 +24,12 @@
  */
 
 #include "resp.hpp"
+#include "utils.hpp"
 
+#include <algorithm>
 #include <cstdio>
 #include <functional>
+#include <set>
 
 namespace pipy {
 
@@ -313,6 +316,260 @@ void RESP::Parser::message_end() {
   }
 }
 
+//
+// CRC16-CCITT (XModem) as specified for Redis Cluster key slots
+//
+
+static const uint16_t s_crc16_table[256] = {
+  0x0000,0x1021,0x2042,0x3063,0x4084,0x50a5,0x60c6,0x70e7,
+  0x8108,0x9129,0xa14a,0xb16b,0xc18c,0xd1ad,0xe1ce,0xf1ef,
+  0x1231,0x0210,0x3273,0x2252,0x52b5,0x4294,0x72f7,0x62d6,
+  0x9339,0x8318,0xb37b,0xa35a,0xd3bd,0xc39c,0xf3ff,0xe3de,
+  0x2462,0x3443,0x0420,0x1401,0x64e6,0x74c7,0x44a4,0x5485,
+  0xa56a,0xb54b,0x8528,0x9509,0xe5ee,0xf5cf,0xc5ac,0xd58d,
+  0x3653,0x2672,0x1611,0x0630,0x76d7,0x66f6,0x5695,0x46b4,
+  0xb75b,0xa77a,0x9719,0x8738,0xf7df,0xe7fe,0xd79d,0xc7bc,
+  0x48c4,0x58e5,0x6886,0x78a7,0x0840,0x1861,0x2802,0x3823,
+  0xc9cc,0xd9ed,0xe98e,0xf9af,0x8948,0x9969,0xa90a,0xb92b,
+  0x5af5,0x4ad4,0x7ab7,0x6a96,0x1a71,0x0a50,0x3a33,0x2a12,
+  0xdbfd,0xcbdc,0xfbbf,0xeb9e,0x9b79,0x8b58,0xbb3b,0xab1a,
+  0x6ca6,0x7c87,0x4ce4,0x5cc5,0x2c22,0x3c03,0x0c60,0x1c41,
+  0xedae,0xfd8f,0xcdec,0xddcd,0xad2a,0xbd0b,0x8d68,0x9d49,
+  0x7e97,0x6eb6,0x5ed5,0x4ef4,0x3e13,0x2e32,0x1e51,0x0e70,
+  0xff9f,0xefbe,0xdfdd,0xcffc,0xbf1b,0xaf3a,0x9f59,0x8f78,
+  0x9188,0x81a9,0xb1ca,0xa1eb,0xd10c,0xc12d,0xf14e,0xe16f,
+  0x1080,0x00a1,0x30c2,0x20e3,0x5004,0x4025,0x7046,0x6067,
+  0x83b9,0x9398,0xa3fb,0xb3da,0xc33d,0xd31c,0xe37f,0xf35e,
+  0x02b1,0x1290,0x22f3,0x32d2,0x4235,0x5214,0x6277,0x7256,
+  0xb5ea,0xa5cb,0x95a8,0x8589,0xf56e,0xe54f,0xd52c,0xc50d,
+  0x34e2,0x24c3,0x14a0,0x0481,0x7466,0x6447,0x5424,0x4405,
+  0xa7db,0xb7fa,0x8799,0x97b8,0xe75f,0xf77e,0xc71d,0xd73c,
+  0x26d3,0x36f2,0x0691,0x16b0,0x6657,0x7676,0x4615,0x5634,
+  0xd94c,0xc96d,0xf90e,0xe92f,0x99c8,0x89e9,0xb98a,0xa9ab,
+  0x5844,0x4865,0x7806,0x6827,0x18c0,0x08e1,0x3882,0x28a3,
+  0xcb7d,0xdb5c,0xeb3f,0xfb1e,0x8bf9,0x9bd8,0xabbb,0xbb9a,
+  0x4a75,0x5a54,0x6a37,0x7a16,0x0af1,0x1ad0,0x2ab3,0x3a92,
+  0xfd2e,0xed0f,0xdd6c,0xcd4d,0xbdaa,0xad8b,0x9de8,0x8dc9,
+  0x7c26,0x6c07,0x5c64,0x4c45,0x3ca2,0x2c83,0x1ce0,0x0cc1,
+  0xef1f,0xff3e,0xcf5d,0xdf7c,0xaf9b,0xbfba,0x8fd9,0x9ff8,
+  0x6e17,0x7e36,0x4e55,0x5e74,0x2e93,0x3eb2,0x0ed1,0x1ef0,
+};
+
+auto RESP::slot(const char *key, size_t len) -> int {
+  for (size_t i = 0; i < len; i++) {
+    if (key[i] == '{') {
+      for (size_t j = i + 1; j < len; j++) {
+        if (key[j] == '}') {
+          if (j > i + 1) {
+            key += i + 1;
+            len = j - i - 1;
+          }
+          break;
+        }
+      }
+      break;
+    }
+  }
+  uint16_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    crc = (crc << 8) ^ s_crc16_table[((crc >> 8) ^ (uint8_t)key[i]) & 0xff];
+  }
+  return crc & (Cluster::SLOTS - 1);
+}
+
+auto RESP::slot(const pjs::Value &key) -> int {
+  if (key.is_string()) {
+    auto s = key.s();
+    return slot(s->c_str(), s->size());
+  } else if (key.is<Data>()) {
+    auto data = key.as<Data>();
+    if (data->size() <= 256) {
+      char buf[256];
+      data->to_bytes((uint8_t *)buf);
+      return slot(buf, data->size());
+    }
+    auto s = data->to_string();
+    return slot(s.c_str(), s.length());
+  } else {
+    auto s = key.to_string();
+    auto n = slot(s->c_str(), s->size());
+    s->release();
+    return n;
+  }
+}
+
+//
+// RESP::Cluster
+//
+
+static auto value_to_string(const pjs::Value &v) -> std::string {
+  if (v.is_string()) return v.s()->str();
+  if (v.is<Data>()) return v.as<Data>()->to_string();
+  auto s = v.to_string();
+  std::string str(s->str());
+  s->release();
+  return str;
+}
+
+RESP::Cluster::Cluster(pjs::Array *seeds)
+  : m_slots(SLOTS, 0xffff)
+{
+  if (seeds) {
+    seeds->iterate_all(
+      [this](pjs::Value &v, int) {
+        auto s = v.to_string();
+        node_of(s);
+        s->release();
+      }
+    );
+  }
+  m_seed_count = m_nodes.size();
+}
+
+auto RESP::Cluster::targets() const -> pjs::Array* {
+  auto a = pjs::Array::make(m_nodes.size());
+  for (size_t i = 0; i < m_nodes.size(); i++) a->set(i, m_nodes[i].get());
+  return a;
+}
+
+//
+// Commands without a key, or with a slot not yet known, go to the seed
+// nodes in turn so that CLUSTER SLOTS and the like spread out.
+//
+
+auto RESP::Cluster::route(const pjs::Value &command) -> pjs::Str* {
+  pjs::Value key;
+  if (command.is_array() && key_of(command.as<pjs::Array>(), key)) {
+    auto i = m_slots[slot(key)];
+    if (i < m_nodes.size()) return m_nodes[i];
+  }
+  if (m_seed_count > 0) return m_nodes[m_next_seed++ % m_seed_count];
+  if (!m_nodes.empty()) return m_nodes[0];
+  return nullptr;
+}
+
+//
+// Returns { slot, target, ask } for a MOVED or ASK error, or null for
+// any other reply. Only MOVED changes the map since ASK is a one-off
+// redirection while a slot is being migrated.
+//
+
+auto RESP::Cluster::redirect(const pjs::Value &reply) -> pjs::Object* {
+  thread_local static pjs::ConstStr s_slot("slot");
+  thread_local static pjs::ConstStr s_target("target");
+  thread_local static pjs::ConstStr s_ask("ask");
+
+  if (!reply.is<pjs::Error>()) return nullptr;
+  const auto &msg = reply.as<pjs::Error>()->message()->str();
+
+  bool ask;
+  size_t p;
+  if (utils::starts_with(msg, "MOVED ")) { ask = false; p = 6; }
+  else if (utils::starts_with(msg, "ASK ")) { ask = true; p = 4; }
+  else return nullptr;
+
+  auto sp = msg.find(' ', p);
+  if (sp == std::string::npos) return nullptr;
+  auto n = std::atoi(msg.c_str() + p);
+  if (n < 0 || n >= SLOTS) return nullptr;
+  auto target = pjs::Str::make(msg.substr(sp + 1));
+  auto i = node_of(target);
+  if (!ask) m_slots[n] = i;
+
+  auto obj = pjs::Object::make();
+  obj->set(s_slot, n);
+  obj->set(s_target, target);
+  obj->set(s_ask, ask);
+  return obj;
+}
+
+//
+// Takes the reply of CLUSTER SLOTS, where each entry goes as
+// [start, end, [host, port, ...], ...replicas], and maps every range to
+// its primary.
+//
+
+void RESP::Cluster::load(pjs::Array *slots) {
+  slots->iterate_all(
+    [this](pjs::Value &v, int) {
+      if (!v.is_array()) return;
+      auto e = v.as<pjs::Array>();
+      if (e->length() < 3) return;
+      pjs::Value start, end, node;
+      e->get(0, start);
+      e->get(1, end);
+      e->get(2, node);
+      if (!start.is_number() || !end.is_number() || !node.is_array()) return;
+      auto a = node.as<pjs::Array>();
+      if (a->length() < 2) return;
+      pjs::Value host, port;
+      a->get(0, host);
+      a->get(1, port);
+      auto target = value_to_string(host) + ':' + std::to_string(int(port.to_number()));
+      auto i = node_of(pjs::Str::make(target));
+      auto lo = std::max(0, int(start.n()));
+      auto hi = std::min(SLOTS - 1, int(end.n()));
+      for (auto s = lo; s <= hi; s++) m_slots[s] = i;
+    }
+  );
+}
+
+auto RESP::Cluster::node_of(pjs::Str *target) -> int {
+  for (size_t i = 0; i < m_nodes.size(); i++) {
+    if (m_nodes[i] == target) return i;
+  }
+  m_nodes.push_back(target);
+  return m_nodes.size() - 1;
+}
+
+//
+// Keyless commands return false. Scripts and functions carry their keys
+// after a count, and streams after the STREAMS keyword. Everything else
+// has its first key as the first argument.
+//
+
+bool RESP::Cluster::key_of(pjs::Array *command, pjs::Value &key) {
+  if (command->length() < 2) return false;
+  pjs::Value name;
+  command->get(0, name);
+  auto cmd = value_to_string(name);
+  for (auto &c : cmd) c = std::toupper(c);
+
+  static const std::set<std::string> keyless = {
+    "ASKING", "AUTH", "CLIENT", "CLUSTER", "COMMAND", "CONFIG", "DBSIZE",
+    "DISCARD", "ECHO", "EXEC", "FLUSHALL", "FLUSHDB", "FUNCTION", "HELLO",
+    "INFO", "MULTI", "PING", "PUBLISH", "QUIT", "READONLY", "READWRITE",
+    "SCAN", "SCRIPT", "SELECT", "SUBSCRIBE", "TIME", "UNSUBSCRIBE", "UNWATCH",
+  };
+
+  if (keyless.count(cmd)) return false;
+
+  if (cmd == "EVAL" || cmd == "EVALSHA" || cmd == "EVAL_RO" || cmd == "EVALSHA_RO" || cmd == "FCALL" || cmd == "FCALL_RO") {
+    pjs::Value n;
+    command->get(2, n);
+    if (std::atoi(value_to_string(n).c_str()) < 1 || command->length() < 4) return false;
+    command->get(3, key);
+    return true;
+  }
+
+  if (cmd == "XREAD" || cmd == "XREADGROUP") {
+    for (int i = 1; i + 1 < command->length(); i++) {
+      pjs::Value v;
+      command->get(i, v);
+      auto s = value_to_string(v);
+      for (auto &c : s) c = std::toupper(c);
+      if (s == "STREAMS") {
+        command->get(i + 1, key);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  command->get(1, key);
+  return true;
+}
+
 } // namespace pipy
 
 namespace pjs {
@@ -326,6 +583,14 @@ using namespace pipy;
 template<> void ClassDef<RESP>::init() {
   ctor();
 
+  variable("Cluster", class_of<Constructor<RESP::Cluster>>());
+
+  method("slot", [](Context &ctx, Object *obj, Value &ret) {
+    Value key;
+    if (!ctx.arguments(1, &key)) return;
+    ret.set(RESP::slot(key));
+  });
+
   method("decode", [](Context &ctx, Object *obj, Value &ret) {
     pipy::Data *data;
     if (!ctx.arguments(1, &data)) return;
@@ -342,4 +607,42 @@ template<> void ClassDef<RESP>::init() {
   });
 }
 
+//
+// RESP::Cluster
+//
+
+template<> void ClassDef<RESP::Cluster>::init() {
+  ctor([](Context &ctx) -> Object* {
+    Array *seeds = nullptr;
+    if (!ctx.arguments(0, &seeds)) return nullptr;
+    return RESP::Cluster::make(seeds);
+  });
+
+  accessor("targets", [](Object *obj, Value &ret) { ret.set(obj->as<RESP::Cluster>()->targets()); });
+
+  method("route", [](Context &ctx, Object *obj, Value &ret) {
+    Value command;
+    if (!ctx.arguments(1, &command)) return;
+    ret.set(obj->as<RESP::Cluster>()->route(command));
+  });
+
+  method("redirect", [](Context &ctx, Object *obj, Value &ret) {
+    Value reply;
+    if (!ctx.arguments(1, &reply)) return;
+    auto r = obj->as<RESP::Cluster>()->redirect(reply);
+    if (r) ret.set(r); else ret = Value::null;
+  });
+
+  method("load", [](Context &ctx, Object *obj, Value &ret) {
+    Array *slots;
+    if (!ctx.arguments(1, &slots)) return;
+    obj->as<RESP::Cluster>()->load(slots);
+  });
+}
+
+template<> void ClassDef<Constructor<RESP::Cluster>>::init() {
+  super<Function>();
+  ctor();
+}
+
 } // namespace pjs
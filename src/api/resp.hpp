@@ -30,6 +30,8 @@
 #include "data.hpp"
 #include "deframer.hpp"
 
+#include <vector>
+
 namespace pipy {
 
 //
@@ -42,6 +44,43 @@ public:
   static void encode(const pjs::Value &value, Data &data);
   static void encode(const pjs::Value &value, Data::Builder &db);
 
+  // Cluster hash slot of a key, honoring {hash tags}
+  static auto slot(const char *key, size_t len) -> int;
+  static auto slot(const pjs::Value &key) -> int;
+
+  //
+  // RESP::Cluster
+  //
+  // Maps the 16384 hash slots of a Redis Cluster to node addresses, so
+  // that a mux() session selector or a connect() target can pick the
+  // node for a command natively. The map is filled from CLUSTER SLOTS
+  // and kept up to date from MOVED redirections.
+  //
+
+  class Cluster : public pjs::ObjectTemplate<Cluster> {
+  public:
+    enum { SLOTS = 16384 };
+
+    auto targets() const -> pjs::Array*;
+    auto route(const pjs::Value &command) -> pjs::Str*;
+    auto redirect(const pjs::Value &reply) -> pjs::Object*;
+    void load(pjs::Array *slots);
+
+  private:
+    Cluster(pjs::Array *seeds);
+
+    std::vector<pjs::Ref<pjs::Str>> m_nodes;
+    std::vector<uint16_t> m_slots;
+    size_t m_seed_count = 0;
+    uint32_t m_next_seed = 0;
+
+    auto node_of(pjs::Str *target) -> int;
+
+    static bool key_of(pjs::Array *command, pjs::Value &key);
+
+    friend class pjs::ObjectTemplate<Cluster>;
+  };
+
   //
   // RESP::Parser
   //
@@ -25,7 +25,16 @@
 
 #include "sqlite.hpp"
 #include "data.hpp"
+#include "input.hpp"
+#include "net.hpp"
 #include "os-platform.hpp"
+#include "thread-pool.hpp"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace pipy {
 namespace sqlite {
@@ -109,6 +118,270 @@ static void throw_error(sqlite3 *db) {
   throw std::runtime_error(msg);
 }
 
+//
+// Cell
+//
+// A column or parameter value in a form that can cross threads.
+//
+
+struct Cell {
+  int type = SQLITE_NULL;
+  int64_t i = 0;
+  double f = 0;
+  std::string s;
+
+  void set(const pjs::Value &v);
+  void get(pjs::Value &v) const;
+};
+
+void Cell::set(const pjs::Value &v) {
+  switch (v.type()) {
+    case pjs::Value::Type::Boolean: type = SQLITE_INTEGER; i = v.b(); break;
+    case pjs::Value::Type::Number: type = SQLITE_FLOAT; f = v.n(); break;
+    case pjs::Value::Type::String: type = SQLITE_TEXT; s = v.s()->str(); break;
+    case pjs::Value::Type::Object:
+      if (auto o = v.o()) {
+        if (o->is<pjs::Int>()) {
+          type = SQLITE_INTEGER;
+          i = o->as<pjs::Int>()->value();
+        } else if (o->is<Data>()) {
+          type = SQLITE_BLOB;
+          s = o->as<Data>()->to_string();
+        } else {
+          type = SQLITE_TEXT;
+          s = o->to_string();
+        }
+      }
+      break;
+    default: break;
+  }
+}
+
+void Cell::get(pjs::Value &v) const {
+  switch (type) {
+    case SQLITE_INTEGER:
+      if (i >> 32) {
+        v.set(int64_t(i));
+      } else {
+        v.set(double(i));
+      }
+      break;
+    case SQLITE_FLOAT: v.set(f); break;
+    case SQLITE_BLOB: v.set(s_dp.make(s)); break;
+    case SQLITE_TEXT: v.set(pjs::Str::make(s)); break;
+    default: v = pjs::Value::null; break;
+  }
+}
+
+//
+// Query
+//
+
+struct Query {
+  std::string sql;
+  std::vector<Cell> params;
+  std::vector<std::string> columns;
+  std::vector<std::vector<Cell>> rows;
+  std::string error;
+};
+
+//
+// Pool
+//
+// Connections to one database file shared by all workers. Queries run on
+// a dedicated set of I/O threads so that a slow one never holds up an
+// event loop. Connections are put in WAL mode, which lets any number of
+// readers go on alongside a writer, and each keeps its own cache of
+// prepared statements.
+//
+
+static const int POOL_SIZE = 4;
+static const int IO_THREADS = 8;
+static const size_t STATEMENT_CACHE_SIZE = 64;
+static const int BUSY_TIMEOUT = 5000;
+
+static auto io_threads() -> ThreadPool& {
+  static ThreadPool *s_pool = new ThreadPool(IO_THREADS);
+  return *s_pool;
+}
+
+class Pool {
+public:
+  static auto get(const std::string &filename, int flags) -> std::shared_ptr<Pool>;
+
+  ~Pool();
+
+  // Runs on an I/O thread
+  void run(Query &query);
+
+private:
+  struct Connection {
+    sqlite3 *db = nullptr;
+    std::unordered_map<std::string, sqlite3_stmt*> statements;
+    ~Connection();
+    auto prepare(const std::string &sql) -> sqlite3_stmt*;
+  };
+
+  Pool(const std::string &filename, int flags)
+    : m_filename(filename)
+    , m_flags(flags) {}
+
+  std::string m_filename;
+  int m_flags;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::vector<Connection*> m_idle;
+  int m_count = 0;
+
+  auto acquire(std::string &error) -> Connection*;
+  void release(Connection *conn);
+
+  static std::mutex s_mutex;
+  static std::map<std::string, std::weak_ptr<Pool>> s_pools;
+};
+
+std::mutex Pool::s_mutex;
+std::map<std::string, std::weak_ptr<Pool>> Pool::s_pools;
+
+auto Pool::get(const std::string &filename, int flags) -> std::shared_ptr<Pool> {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto &p = s_pools[filename + '#' + std::to_string(flags)];
+  if (auto pool = p.lock()) return pool;
+  std::shared_ptr<Pool> pool(new Pool(filename, flags));
+  p = pool;
+  return pool;
+}
+
+Pool::~Pool() {
+  for (auto *conn : m_idle) delete conn;
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto i = s_pools.find(m_filename + '#' + std::to_string(m_flags));
+  if (i != s_pools.end() && i->second.expired()) {
+    s_pools.erase(i);
+  }
+}
+
+Pool::Connection::~Connection() {
+  for (const auto &i : statements) sqlite3_finalize(i.second);
+  sqlite3_close_v2(db);
+}
+
+auto Pool::Connection::prepare(const std::string &sql) -> sqlite3_stmt* {
+  auto i = statements.find(sql);
+  if (i != statements.end()) return i->second;
+  sqlite3_stmt *stmt = nullptr;
+  if (SQLITE_OK != sqlite3_prepare_v2(db, sql.c_str(), sql.length(), &stmt, nullptr)) {
+    return nullptr;
+  }
+  if (statements.size() >= STATEMENT_CACHE_SIZE) {
+    for (const auto &i : statements) sqlite3_finalize(i.second);
+    statements.clear();
+  }
+  statements[sql] = stmt;
+  return stmt;
+}
+
+auto Pool::acquire(std::string &error) -> Connection* {
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return !m_idle.empty() || m_count < POOL_SIZE; });
+    if (!m_idle.empty()) {
+      auto conn = m_idle.back();
+      m_idle.pop_back();
+      return conn;
+    }
+    m_count++;
+  }
+
+  auto flags = m_flags ? m_flags : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+  auto conn = new Connection;
+  if (sqlite3_open_v2(m_filename.c_str(), &conn->db, flags | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+    error = "SQLite error: ";
+    error += conn->db ? sqlite3_errmsg(conn->db) : "out of memory";
+    delete conn;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_count--;
+    m_cv.notify_one();
+    return nullptr;
+  }
+
+  sqlite3_busy_timeout(conn->db, BUSY_TIMEOUT);
+  if (!(flags & SQLITE_OPEN_READONLY)) {
+    sqlite3_exec(conn->db, "PRAGMA journal_mode=WAL", nullptr, nullptr, nullptr);
+  }
+  return conn;
+}
+
+void Pool::release(Connection *conn) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_idle.push_back(conn);
+  }
+  m_cv.notify_one();
+}
+
+void Pool::run(Query &query) {
+  auto conn = acquire(query.error);
+  if (!conn) return;
+
+  auto stmt = conn->prepare(query.sql);
+  if (!stmt) {
+    query.error = "SQLite error: ";
+    query.error += sqlite3_errmsg(conn->db);
+    release(conn);
+    return;
+  }
+
+  for (size_t i = 0; i < query.params.size(); i++) {
+    const auto &p = query.params[i];
+    auto n = int(i + 1);
+    switch (p.type) {
+      case SQLITE_INTEGER: sqlite3_bind_int64(stmt, n, p.i); break;
+      case SQLITE_FLOAT: sqlite3_bind_double(stmt, n, p.f); break;
+      case SQLITE_TEXT: sqlite3_bind_text(stmt, n, p.s.c_str(), p.s.length(), SQLITE_STATIC); break;
+      case SQLITE_BLOB: sqlite3_bind_blob64(stmt, n, p.s.c_str(), p.s.length(), SQLITE_STATIC); break;
+      default: sqlite3_bind_null(stmt, n); break;
+    }
+  }
+
+  auto n = sqlite3_column_count(stmt);
+  for (int i = 0; i < n; i++) {
+    query.columns.push_back(sqlite3_column_name(stmt, i));
+  }
+
+  for (;;) {
+    auto rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+      query.rows.emplace_back(n);
+      auto &row = query.rows.back();
+      for (int i = 0; i < n; i++) {
+        auto &c = row[i];
+        c.type = sqlite3_column_type(stmt, i);
+        switch (c.type) {
+          case SQLITE_INTEGER: c.i = sqlite3_column_int64(stmt, i); break;
+          case SQLITE_FLOAT: c.f = sqlite3_column_double(stmt, i); break;
+          case SQLITE_TEXT:
+          case SQLITE_BLOB: {
+            auto p = (const char *)(c.type == SQLITE_TEXT ? sqlite3_column_text(stmt, i) : sqlite3_column_blob(stmt, i));
+            c.s.assign(p ? p : "", sqlite3_column_bytes(stmt, i));
+            break;
+          }
+        }
+      }
+    } else {
+      if (rc != SQLITE_DONE) {
+        query.error = "SQLite error: ";
+        query.error += sqlite3_errmsg(conn->db);
+      }
+      break;
+    }
+  }
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  release(conn);
+}
+
 //
 // Database
 //
@@ -119,6 +392,8 @@ Database::Database(pjs::Str *filename, int flags) {
 #else
   const auto &path = filename->str();
 #endif
+  m_filename = path;
+  m_flags = flags;
   if (!flags) {
     if (sqlite3_open(path.c_str(), &m_db) != SQLITE_OK) {
       throw_error(m_db);
@@ -160,6 +435,57 @@ auto Database::exec(pjs::Str *sql) -> pjs::Array* {
   return rows;
 }
 
+auto Database::query(pjs::Str *sql, pjs::Array *params) -> pjs::Promise* {
+  if (!m_db) throw std::runtime_error("Database is closed");
+  if (!m_pool) m_pool = Pool::get(m_filename, m_flags);
+
+  auto q = std::make_shared<Query>();
+  q->sql = sql->str();
+  if (params) {
+    q->params.resize(params->length());
+    params->iterate_all([&](pjs::Value &v, int i) { q->params[i].set(v); });
+  }
+
+  // The settler is only touched on this thread, the I/O thread just carries the pointer
+  auto promise = pjs::Promise::make();
+  auto settler = pjs::Promise::Settler::make(promise);
+  settler->retain();
+
+  auto pool = m_pool;
+  auto net = &Net::current();
+  io_threads().run(
+    [=]() {
+      pool->run(*q);
+      net->post(
+        [=]() {
+          InputContext ic;
+          if (!q->error.empty()) {
+            settler->reject(pjs::Error::make(pjs::Str::make(q->error)));
+          } else {
+            auto rows = pjs::Array::make(q->rows.size());
+            std::vector<pjs::Ref<pjs::Str>> names;
+            for (const auto &c : q->columns) names.push_back(pjs::Str::make(c));
+            for (size_t i = 0; i < q->rows.size(); i++) {
+              auto row = pjs::Object::make();
+              const auto &cells = q->rows[i];
+              for (size_t j = 0; j < cells.size(); j++) {
+                pjs::Value v;
+                cells[j].get(v);
+                row->ht_set(names[j], v);
+              }
+              rows->set(i, row);
+            }
+            settler->resolve(rows);
+          }
+          settler->release();
+        }
+      );
+    }
+  );
+
+  return promise;
+}
+
 void Database::close() {
   if (m_db) {
     sqlite3_close_v2(m_db);
@@ -294,6 +620,17 @@ template<> void ClassDef<Database>::init() {
     }
   });
 
+  method("query", [](Context &ctx, Object *obj, Value &ret) {
+    Str *sql;
+    Array *params = nullptr;
+    if (!ctx.arguments(1, &sql, &params)) return;
+    try {
+      ret.set(static_cast<Database*>(obj)->query(sql, params));
+    } catch (std::runtime_error &err) {
+      ctx.error(err);
+    }
+  });
+
   method("close", [](Context &ctx, Object *obj, Value &ret) {
     static_cast<Database*>(obj)->close();
   });
@@ -30,10 +30,14 @@
 
 #include <sqlite3.h>
 
+#include <memory>
+#include <string>
+
 namespace pipy {
 namespace sqlite {
 
 class Statement;
+class Pool;
 
 //
 // Database
@@ -43,6 +47,7 @@ class Database : public pjs::ObjectTemplate<Database> {
 public:
   auto sql(pjs::Str *sql) -> Statement*;
   auto exec(pjs::Str *sql) -> pjs::Array*;
+  auto query(pjs::Str *sql, pjs::Array *params) -> pjs::Promise*;
   void close();
 
 private:
@@ -50,6 +55,9 @@ private:
   ~Database();
 
   sqlite3* m_db;
+  std::string m_filename;
+  int m_flags;
+  std::shared_ptr<Pool> m_pool;
 
   friend class pjs::ObjectTemplate<Database>;
   friend class Statement;
@@ -121,6 +121,7 @@ Metric::Metric(Metric *parent, pjs::Str **labels)
   , m_name(parent->m_name)
   , m_label(labels[parent->m_label_index + 1])
   , m_label_index(parent->m_label_index + 1)
+  , m_limit(parent->m_limit)
   , m_label_names(parent->m_label_names)
 {
   parent->m_subs.emplace_back();
@@ -128,6 +129,10 @@ Metric::Metric(Metric *parent, pjs::Str **labels)
   parent->m_sub_map[m_label] = this;
 }
 
+Metric::~Metric() {
+  detach_cell();
+}
+
 auto Metric::submetrics() -> pjs::Array* {
   auto a = pjs::Array::make(m_subs.size());
   for (size_t i = 0, n = m_subs.size(); i < n; i++) {
@@ -168,14 +173,45 @@ auto Metric::type() -> pjs::Str* {
 void Metric::clear() {
   for (const auto &i : m_subs) {
     i->clear();
+    i->detach_cell();
   }
   m_subs.clear();
   m_sub_map.clear();
+  m_other = nullptr;
   m_has_value = false;
+  if (m_slot) MetricCells::store_has_value(m_slot, false);
+}
+
+void Metric::limit_cardinality(int limit) {
+  m_limit = limit > 0 ? limit : 0;
+  for (const auto &i : m_subs) {
+    i->limit_cardinality(limit);
+  }
 }
 
 void Metric::create_value() {
-  m_has_value = true;
+  m_hits++;
+  if (!m_has_value) {
+    m_has_value = true;
+    if (m_slot) MetricCells::store_has_value(m_slot, true);
+  }
+}
+
+void Metric::attach_cell(Metric *parent) {
+  if (!MetricCells::enabled()) return;
+  if (parent && !parent->m_slot) return;
+  m_slot = MetricCells::global().acquire(this, parent ? parent->m_slot->cell : nullptr);
+  if (m_has_value) MetricCells::store_has_value(m_slot, true);
+  for (int i = 0, n = m_slot->cell->dimensions; i < n; i++) {
+    MetricCells::store(m_slot, i, get_value(i));
+  }
+}
+
+void Metric::detach_cell() {
+  if (m_slot) {
+    MetricCells::global().release(m_slot);
+    m_slot = nullptr;
+  }
 }
 
 void Metric::zero_all() {
@@ -189,9 +225,70 @@ auto Metric::get_sub(pjs::Str **labels) -> Metric* {
   auto k = labels[m_label_index + 1];
   auto i = m_sub_map.find(k);
   if (i != m_sub_map.end()) return i->second;
+  if (m_limit > 0 && m_subs.size() >= m_limit + (m_other ? 1 : 0)) {
+    auto hits = evict_sub();
+    auto sub = create_new(this, labels);
+    sub->m_hits = hits;
+    return sub;
+  }
   return create_new(this, labels);
 }
 
+auto Metric::get_sub(pjs::Str *label) -> Metric* {
+  pjs::vl_array<pjs::Str*> labels(m_label_index + 2);
+  labels[m_label_index + 1] = label;
+  return get_sub(labels);
+}
+
+//
+// Cardinality is bounded in the way of the Space-Saving algorithm:
+// a new label takes the place of the least updated one, whose values
+// are folded into a sub-metric labeled "__other__", and inherits its
+// update count so that the labels updated most stay put over time.
+//
+
+auto Metric::evict_sub() -> size_t {
+  thread_local static pjs::ConstStr s_other("__other__");
+
+  Metric *min = nullptr;
+  size_t min_index = 0;
+  for (size_t i = 0; i < m_subs.size(); i++) {
+    auto *sub = m_subs[i].get();
+    if (sub == m_other) continue;
+    if (!min || sub->m_hits < min->m_hits) {
+      min = sub;
+      min_index = i;
+    }
+  }
+  if (!min) return 0;
+
+  if (!m_other) {
+    pjs::vl_array<pjs::Str*> labels(m_label_index + 2);
+    labels[m_label_index + 1] = s_other.get();
+    m_other = create_new(this, labels);
+  }
+
+  min->fold_into(m_other);
+
+  pjs::Ref<Metric> evicted(min);
+  m_sub_map.erase(min->m_label);
+  m_subs.erase(m_subs.begin() + min_index);
+  evicted->clear();
+  evicted->detach_cell();
+  return evicted->m_hits;
+}
+
+void Metric::fold_into(Metric *other) {
+  if (m_has_value) {
+    for (int i = 0, n = get_dim(); i < n; i++) {
+      other->set_value(i, other->get_value(i) + get_value(i));
+    }
+  }
+  for (const auto &sub : m_subs) {
+    sub->fold_into(other->get_sub(sub->m_label.get()));
+  }
+}
+
 auto Metric::get_sub(int i) -> Metric* {
   if (0 <= i && i < m_subs.size()) {
     return m_subs[i].get();
@@ -240,39 +337,168 @@ void MetricSet::collect() {
   }
 }
 
+//
+// MetricCells
+//
+
+thread_local bool MetricCells::s_enabled = false;
+
+auto MetricCells::global() -> MetricCells& {
+  static MetricCells s_global;
+  return s_global;
+}
+
+auto MetricCells::acquire(Metric *metric, Cell *parent) -> Slot* {
+  std::string key;
+  if (parent) {
+    key = parent->key;
+    key += '\0';
+    key += metric->label()->str();
+  } else {
+    key = metric->name()->str();
+    key += '\0';
+    key += metric->type()->str();
+    key += '\0';
+    key += metric->shape()->str();
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  auto &cell = m_cell_map[key];
+  if (!cell) {
+    cell = new Cell;
+    cell->key = key;
+    cell->parent = parent;
+    if (parent) {
+      cell->name = parent->name;
+      cell->type = parent->type;
+      cell->shape = parent->shape;
+      cell->label = metric->label()->str();
+      cell->dimensions = parent->dimensions;
+    } else {
+      cell->name = metric->name()->str();
+      cell->type = metric->type()->str();
+      cell->shape = metric->shape()->str();
+      cell->dimensions = metric->dimensions();
+    }
+    m_cells.push_back(cell);
+  }
+
+  for (auto *slot = cell->slots; slot; slot = slot->next) {
+    if (!slot->in_use.load(std::memory_order_relaxed)) {
+      slot->in_use.store(true, std::memory_order_relaxed);
+      return slot;
+    }
+  }
+
+  // Round up to whole cache lines so that no two threads share one
+  static const size_t CACHE_LINE = 64;
+  auto dim = std::max(cell->dimensions, 1);
+  auto len = sizeof(Slot) + (dim - 1) * sizeof(std::atomic<double>);
+  len = (len + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  auto mem = (char *)std::malloc(len + CACHE_LINE - 1);
+  auto ptr = (char *)(((uintptr_t)mem + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+  auto slot = new (ptr) Slot;
+  slot->cell = cell;
+  slot->next = cell->slots;
+  slot->in_use.store(true, std::memory_order_relaxed);
+  slot->has_value.store(false, std::memory_order_relaxed);
+  for (int i = 0; i < dim; i++) new (&slot->values[i]) std::atomic<double>(0);
+  cell->slots = slot;
+  return slot;
+}
+
+void MetricCells::release(Slot *slot) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (int i = 0, n = slot->cell->dimensions; i < n; i++) store(slot, i, 0);
+  slot->has_value.store(false, std::memory_order_relaxed);
+  slot->in_use.store(false, std::memory_order_relaxed);
+}
+
+void MetricCells::for_each(const std::function<void(const Cell *, const double *, bool)> &cb) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::vector<double> values;
+  for (const auto *cell : m_cells) {
+    auto dim = cell->dimensions;
+    bool in_use = false;
+    bool has_value = false;
+    values.assign(dim, 0);
+    for (auto *slot = cell->slots; slot; slot = slot->next) {
+      if (!slot->in_use.load(std::memory_order_relaxed)) continue;
+      in_use = true;
+      has_value |= slot->has_value.load(std::memory_order_relaxed);
+      for (int i = 0; i < dim; i++) {
+        values[i] += slot->values[i].load(std::memory_order_relaxed);
+      }
+    }
+    if (in_use) cb(cell, values.data(), has_value);
+  }
+}
+
 //
 // Prometheus
 //
 
+//
+// Each node keeps the label string of its series from the last scrape,
+// which is reused as long as its key and those of its parents stay the same
+//
+
 template<class Node>
 class Prometheus {
 public:
   Prometheus(
+    Data::Builder &db,
     const std::string &name,
-    const std::string &extra_labels,
     const std::vector<std::string> &label_names,
-    pjs::Str::CharData *label_values[],
-    const char *le_str,
-    const std::function<void(const void *, size_t)> &out
-  ) : m_name(name)
-    , m_extra_labels(extra_labels)
+    const char *le_str
+  ) : m_db(db)
+    , m_name(name)
     , m_label_names(label_names)
-    , m_label_values(label_values)
-    , m_le_str(le_str)
-    , m_out(out) {}
+    , m_le_str(le_str) {}
 
-  void output(Node *node, int level) {
+  void output(Node *node, const std::string &extra_labels) {
+    bool rebuild = (!node->prom_cached || node->prom_labels != extra_labels);
+    if (rebuild) {
+      node->prom_labels = extra_labels;
+      node->prom_cached = true;
+    }
+    output(node, nullptr, 0, rebuild);
+  }
+
+private:
+  Data::Builder& m_db;
+  const std::string &m_name;
+  const std::vector<std::string> &m_label_names;
+  const char *m_le_str;
+
+  void output(Node *node, Node *parent, int level, bool rebuild) {
     static const std::string s_bucket("_bucket");
     static const std::string s_sum("_sum");
     static const std::string s_count("_count");
+    static const std::string s_empty;
 
     if (level > m_label_names.size()) return;
 
     if (level > 0) {
-      m_label_values[level-1] = node->get_key();
+      auto key = node->get_key();
+      if (rebuild || !node->prom_cached || node->prom_key != key) {
+        auto &s = node->prom_labels;
+        s = parent->prom_labels;
+        if (!s.empty()) s += ',';
+        s += m_label_names[level-1];
+        s += '=';
+        s += '"';
+        s += key->str();
+        s += '"';
+        node->prom_key = key;
+        node->prom_cached = true;
+        rebuild = true;
+      }
     }
 
     if (node->has_value) {
+      const auto &labels = node->prom_labels;
       if (m_le_str) {
         auto le = 0;
         auto *p = m_le_str;
@@ -284,75 +510,53 @@ public:
             p++; n--;
             if (n > 1 && *(q-1) == '"') n--;
           }
-          output(m_name);
-          output(s_bucket);
-          output(level, node->values[le++], p, n);
+          output_line(s_bucket, labels, node->values[le++], p, n);
           p = (*q == ',' ? q+1 : nullptr);
         }
-        output(m_name);
-        output(s_count);
-        output(level, node->values[le++]);
-        output(m_name);
-        output(s_sum);
-        output(level, node->values[le++]);
+        output_line(s_count, labels, node->values[le++]);
+        output_line(s_sum, labels, node->values[le++]);
 
       } else {
-        output(m_name);
-        output(level, node->values[0]);
+        output_line(s_empty, labels, node->values[0]);
       }
     }
 
     node->for_subs([=](Node *sub) {
-      output(sub, level + 1);
+      output(sub, node, level + 1, rebuild);
     });
   }
 
-private:
-  const std::string &m_name;
-  const std::string &m_extra_labels;
-  const std::vector<std::string> &m_label_names;
-  pjs::Str::CharData **m_label_values;
-  const char *m_le_str;
-  const std::function<void(const void *, size_t)> &m_out;
-
-  void output(char c) { m_out(&c, 1); }
-  void output(const std::string &s) { m_out(s.c_str(), s.length()); }
-  void output(const void *data, size_t size) { m_out(data, size); }
-
-  void output(
-    int level, double num,
+  void output_line(
+    const std::string &suffix,
+    const std::string &labels, double num,
     const char *le = nullptr, int le_len = 0
   ) {
     static const std::string s_le("le=");
-    if (level > 0 || !m_extra_labels.empty() || le) {
-      bool first = true;
-      output('{');
-      if (!m_extra_labels.empty()) {
-        output(m_extra_labels);
-        first = false;
-      }
-      for (int i = 0, n = (le ? level+1 : level); i < n; i++) {
-        if (first) first = false; else output(',');
-        if (i == level) {
-          output(s_le);
-          output('"');
-          output(le, le_len);
-          output('"');
-        } else {
-          output(m_label_names[i]);
-          output('=');
-          output('"');
-          output(m_label_values[i]->str());
-          output('"');
-        }
+    m_db.push(m_name);
+    m_db.push(suffix);
+    if (!labels.empty() || le) {
+      m_db.push('{');
+      m_db.push(labels);
+      if (le) {
+        if (!labels.empty()) m_db.push(',');
+        m_db.push(s_le);
+        m_db.push('"');
+        m_db.push(le, le_len);
+        m_db.push('"');
       }
-      output('}');
+      m_db.push('}');
     }
-    output(' ');
-    char buf[100];
-    auto len = pjs::Number::to_string(buf, sizeof(buf), num);
-    output(buf, len);
-    output('\n');
+    m_db.push(' ');
+    int n;
+    auto p = m_db.reserve(n);
+    if (n >= 100) {
+      m_db.commit(pjs::Number::to_string(p, n, num));
+    } else {
+      char buf[100];
+      auto len = pjs::Number::to_string(buf, sizeof(buf), num);
+      m_db.push(buf, len);
+    }
+    m_db.push('\n');
   }
 };
 
@@ -443,27 +647,25 @@ bool MetricData::deserialize(const Data &in) {
   }
 }
 
-void MetricData::to_prometheus(const std::string &extra_labels, const std::function<void(const void *, size_t)> &out) const {
+void MetricData::to_prometheus(const std::string &extra_labels, Data::Builder &db) const {
   static const std::string s_prefix_TYPE("# TYPE ");
   static const std::string s_type_counter(" counter\n");
   static const std::string s_type_gauge(" gauge\n");
   static const std::string s_type_histogram(" histogram\n");
-  auto print = [&](const std::string &str) { out(str.c_str(), str.length()); };
   for (auto *ent = m_entries; ent; ent = ent->next) {
     if (auto root = ent->root.get()) {
-      print(s_prefix_TYPE);
-      print(ent->name->str());
+      db.push(s_prefix_TYPE);
+      db.push(ent->name->str());
       const char *le_str = nullptr;
-      auto *name = ent->name.get();
       auto *type = ent->type.get();
       auto *shape = ent->shape.get();
       if (utils::starts_with(type->str(), s_prefix_histogram)) {
         le_str = type->c_str() + s_prefix_histogram.length();
-        print(s_type_histogram);
+        db.push(s_type_histogram);
       } else if (ent->type->str() == "Gauge") {
-        print(s_type_gauge);
+        db.push(s_type_gauge);
       } else {
-        print(s_type_counter);
+        db.push(s_type_counter);
       }
       if (shape->size() > 0 && ent->labels.empty()) {
         auto labels = utils::split(shape->str(), '/');
@@ -471,9 +673,8 @@ void MetricData::to_prometheus(const std::string &extra_labels, const std::funct
         int i = 0;
         for (auto &s : labels) { ent->labels[i++] = std::move(s); }
       }
-      pjs::vl_array<pjs::Str::CharData*> label_values(ent->labels.size());
-      Prometheus<Node> prom(name->str(), extra_labels, ent->labels, label_values, le_str, out);
-      prom.output(root, 0);
+      Prometheus<Node> prom(db, ent->name->str(), ent->labels, le_str);
+      prom.output(root, extra_labels);
     }
   }
 }
@@ -560,7 +761,33 @@ void MetricData::Deserializer::null() {
   }
 }
 
+//
+// A 'true' in place of a node or a value leaves it as it was
+//
+
 void MetricData::Deserializer::boolean(bool b) {
+  if (!m_has_error && b) {
+    if (auto level = m_current_level) {
+      switch (level->kind) {
+        case Level::Kind::ENTRIES: {
+          if (auto ent = m_entries.next()) {
+            m_current_entry = ent;
+            if (ent->root) return;
+          }
+          break;
+        }
+        case Level::Kind::SUBS: {
+          if (level->subs.next()) return;
+          break;
+        }
+        case Level::Kind::METRIC: {
+          if (level->node && level->field == Level::Field::VALUE) return;
+          break;
+        }
+        default: break;
+      }
+    }
+  }
   error();
 }
 
@@ -861,6 +1088,76 @@ void MetricDataSum::sum(MetricData &data, bool initial) {
   }
 }
 
+void MetricDataSum::update(MetricCells &cells) {
+  for (auto *e = m_entries.head(); e; e = e->next()) {
+    e->root->zero(e->dimensions);
+  }
+
+  std::unordered_map<const MetricCells::Cell*, Node*> nodes;
+  std::unordered_map<Entry*, const MetricCells::Cell*> roots;
+
+  cells.for_each(
+    [&](const MetricCells::Cell *cell, const double *values, bool has_value) {
+      Node *node = nullptr;
+      int dimensions = cell->dimensions;
+
+      if (auto parent = cell->parent) {
+        auto i = nodes.find(parent);
+        if (i == nodes.end()) return;
+        auto *key = pjs::Str::make(cell->label)->retain();
+        auto &submap = i->second->submap;
+        auto j = submap.find(key);
+        if (j == submap.end()) {
+          submap[key] = node = Node::make(dimensions);
+          node->key = key;
+          i->second->subs.push(node);
+        } else {
+          node = j->second;
+        }
+        key->release();
+
+      } else {
+        pjs::Ref<pjs::Str> name(pjs::Str::make(cell->name));
+        pjs::Ref<pjs::Str> type(pjs::Str::make(cell->type));
+        pjs::Ref<pjs::Str> shape(pjs::Str::make(cell->shape));
+        auto &ent = m_entry_map[name];
+        if (!ent || ent->type != type || ent->shape != shape || ent->dimensions != dimensions) {
+
+          // Two live metrics of the same name but different kinds,
+          // as during a reload, take the first one found
+          if (ent && roots.count(ent)) return;
+          if (!ent) {
+            ent = new Entry;
+            m_entries.push(ent);
+          }
+          ent->name = name;
+          ent->type = type;
+          ent->shape = shape;
+          ent->dimensions = dimensions;
+          ent->labels.clear();
+          ent->root.reset(Node::make(dimensions));
+        }
+        roots[ent] = cell;
+        node = ent->root.get();
+      }
+
+      node->has_value |= has_value;
+      for (int i = 0; i < dimensions; i++) {
+        node->values[i] += values[i];
+      }
+      nodes[cell] = node;
+    }
+  );
+}
+
+//
+// An initial report carries every node with its key. Later reports carry
+// keys only for nodes added since, and give the rest by their positions.
+// A node whose value and subnodes are all the same as in the last report
+// is written as a single 'true', and so is the value of a node whose own
+// value is unchanged while some of its subnodes have changed.
+//
+
 void MetricDataSum::serialize(Data::Builder &db, bool initial) {
   static const std::string s_version("\"version\":"); // version
   static const std::string s_last("\"last\":"); // last
@@ -871,6 +1168,7 @@ void MetricDataSum::serialize(Data::Builder &db, bool initial) {
   static const std::string s_l("\"l\":"); // label
   static const std::string s_s("\"s\":"); // sub
   static const std::string s_null("null");
+  static const std::string s_true("true");
 
   auto last_version = m_version;
 
@@ -880,10 +1178,32 @@ void MetricDataSum::serialize(Data::Builder &db, bool initial) {
     m_version = utils::now();
   }
 
+  // Marks nodes whose own values changed, returns whether any in the subtree did
+  std::function<bool(int, Node*)> find_changes;
+  find_changes = [&](int dim, Node *node) -> bool {
+    node->changed = (
+      initial || !node->serialized ||
+      node->has_value != node->sent_has_value ||
+      std::memcmp(node->values, node->sent(dim), sizeof(double) * dim)
+    );
+    auto changed = node->changed;
+    node->subtree_changed = false;
+    for (auto *s = node->subs.head(); s; s = s->next()) {
+      if (find_changes(dim, s)) node->subtree_changed = true;
+    }
+    return changed || node->subtree_changed;
+  };
+
   std::function<void(int, Entry*, Node*)> write_node;
   write_node = [&](int level, Entry *ent, Node *node) {
     bool keyed = (initial || !node->serialized);
     bool value_only = (!keyed && node->subs.empty());
+    int dim = ent->dimensions;
+
+    if (!node->changed && !node->subtree_changed) {
+      db.push(s_true);
+      return;
+    }
 
     if (!value_only) {
       db.push('{');
@@ -913,8 +1233,10 @@ void MetricDataSum::serialize(Data::Builder &db, bool initial) {
       db.push(s_v);
     }
 
-    if (node->has_value) {
-      int dim = ent->dimensions;
+    if (!node->changed) {
+      db.push(s_true);
+
+    } else if (node->has_value) {
       if (dim > 1) db.push('[');
 
       for (int d = 0; d < dim; d++) {
@@ -944,6 +1266,8 @@ void MetricDataSum::serialize(Data::Builder &db, bool initial) {
 
     if (!value_only) db.push('}');
     node->serialized = true;
+    node->sent_has_value = node->has_value;
+    std::memcpy(node->sent(dim), node->values, sizeof(double) * dim);
   };
 
   db.push('{');
@@ -960,6 +1284,7 @@ void MetricDataSum::serialize(Data::Builder &db, bool initial) {
   for (auto *e = m_entries.head(); e; e = e->next()) {
     auto *root = e->root.get();
     if (e->back()) db.push(',');
+    find_changes(e->dimensions, root);
     write_node(0, e, root);
   }
   db.push(']');
@@ -1009,25 +1334,25 @@ void MetricDataSum::create_metrics(Entry *ent, Node *node, Metric *metric) {
   );
 }
 
-void MetricDataSum::to_prometheus(const std::function<void(const void *, size_t)> &out) const {
+void MetricDataSum::to_prometheus(Data::Builder &db) const {
   static const std::string s_prefix_TYPE("# TYPE ");
   static const std::string s_type_counter(" counter\n");
   static const std::string s_type_gauge(" gauge\n");
   static const std::string s_type_histogram(" histogram\n");
-  auto print = [&](const std::string &str) { out(str.c_str(), str.length()); };
+  static const std::string s_empty;
   for (const auto &p : m_entry_map) {
     auto ent = p.second;
     if (auto root = ent->root.get()) {
-      print(s_prefix_TYPE);
-      print(ent->name->str());
+      db.push(s_prefix_TYPE);
+      db.push(ent->name->str());
       const char *le_str = nullptr;
       if (utils::starts_with(ent->type->str(), s_prefix_histogram)) {
         le_str = ent->type->c_str() + s_prefix_histogram.length();
-        print(s_type_histogram);
+        db.push(s_type_histogram);
       } else if (ent->type->str() == "Gauge") {
-        print(s_type_gauge);
+        db.push(s_type_gauge);
       } else {
-        print(s_type_counter);
+        db.push(s_type_counter);
       }
       if (ent->shape->size() > 0 && ent->labels.empty()) {
         auto labels = utils::split(ent->shape->str(), '/');
@@ -1035,10 +1360,8 @@ void MetricDataSum::to_prometheus(const std::function<void(const void *, size_t)
         int i = 0;
         for (auto &s : labels) { ent->labels[i++] = std::move(s); }
       }
-      pjs::vl_array<pjs::Str::CharData*> label_values(ent->labels.size());
-      std::string empty;
-      Prometheus<Node> prom(ent->name->str(), empty, ent->labels, label_values, le_str, out);
-      prom.output(root, 0);
+      Prometheus<Node> prom(db, ent->name->str(), ent->labels, le_str);
+      prom.output(root, s_empty);
     }
   }
 }
@@ -1048,7 +1371,7 @@ void MetricDataSum::to_prometheus(const std::function<void(const void *, size_t)
 //
 
 auto MetricDataSum::Node::make(int dimensions) -> Node* {
-  auto len = sizeof(Node) + (dimensions - 1) * sizeof(double);
+  auto len = sizeof(Node) + (dimensions * 2 - 1) * sizeof(double);
   auto ptr = (Node *)std::calloc(len, 1);
   new (ptr) Node;
   return ptr;
@@ -1332,11 +1655,13 @@ Counter::Counter(pjs::Str *name, pjs::Array *label_names, const std::function<vo
   : MetricTemplate<Counter>(name, label_names, set)
   , m_on_collect(on_collect)
 {
+  if (!set) attach_cell(nullptr);
 }
 
 Counter::Counter(Metric *parent, pjs::Str **labels)
   : MetricTemplate<Counter>(parent, labels)
 {
+  attach_cell(parent);
 }
 
 auto Counter::get_type() -> pjs::Str* {
@@ -1346,11 +1671,13 @@ auto Counter::get_type() -> pjs::Str* {
 void Counter::zero() {
   create_value();
   m_value = 0;
+  publish(0, m_value);
 }
 
 void Counter::increase(double n) {
   create_value();
   m_value += n;
+  publish(0, m_value);
 }
 
 //
@@ -1361,11 +1688,13 @@ Gauge::Gauge(pjs::Str *name, pjs::Array *label_names, const std::function<void(G
   : MetricTemplate<Gauge>(name, label_names, set)
   , m_on_collect(on_collect)
 {
+  if (!set) attach_cell(nullptr);
 }
 
 Gauge::Gauge(Metric *parent, pjs::Str **labels)
   : MetricTemplate<Gauge>(parent, labels)
 {
+  attach_cell(parent);
 }
 
 auto Gauge::get_type() -> pjs::Str* {
@@ -1375,21 +1704,25 @@ auto Gauge::get_type() -> pjs::Str* {
 void Gauge::zero() {
   create_value();
   m_value = 0;
+  publish(0, m_value);
 }
 
 void Gauge::set(double n) {
   create_value();
   m_value = n;
+  publish(0, m_value);
 }
 
 void Gauge::increase(double n) {
   create_value();
   m_value += n;
+  publish(0, m_value);
 }
 
 void Gauge::decrease(double n) {
   create_value();
   m_value -= n;
+  publish(0, m_value);
 }
 
 //
@@ -1401,13 +1734,17 @@ Histogram::Histogram(pjs::Str *name, pjs::Array *buckets, pjs::Array *label_name
 {
   m_buckets = buckets;
   m_percentile = algo::Percentile::make(buckets);
-  m_labels.resize(buckets->length());
-  int i = 0;
-  m_percentile->dump(
-    [&](double bucket, double) {
-      m_labels[i++] = pjs::Str::make(bucket);
-    }
-  );
+  init_labels();
+  if (!set) attach_cell(nullptr);
+}
+
+Histogram::Histogram(pjs::Str *name, const algo::Percentile::LogLinear &layout, pjs::Array *label_names, MetricSet *set)
+  : MetricTemplate<Histogram>(name, label_names, set)
+{
+  m_percentile = algo::Percentile::make(layout);
+  m_buckets = m_percentile->buckets();
+  init_labels();
+  if (!set) attach_cell(nullptr);
 }
 
 Histogram::Histogram(Metric *parent, pjs::Str **labels)
@@ -1416,7 +1753,18 @@ Histogram::Histogram(Metric *parent, pjs::Str **labels)
   auto root = static_cast<Histogram*>(parent);
   if (auto *r = root->m_root.get()) root = r;
   m_root = root;
-  m_percentile = algo::Percentile::make(root->m_buckets);
+  m_percentile = algo::Percentile::make(root->m_percentile.get());
+  attach_cell(parent);
+}
+
+void Histogram::init_labels() {
+  m_labels.resize(m_percentile->size());
+  int i = 0;
+  m_percentile->dump(
+    [&](double bucket, double) {
+      m_labels[i++] = pjs::Str::make(bucket);
+    }
+  );
 }
 
 auto Histogram::encode_type(pjs::Array *buckets) -> std::string {
@@ -1466,13 +1814,18 @@ void Histogram::zero() {
   m_count = 0;
   m_percentile->reset();
   create_value();
+  for (int i = 0, n = get_dim(); i < n; i++) publish(i, 0);
 }
 
 void Histogram::observe(double n) {
   m_sum += n;
   m_count++;
-  m_percentile->observe(n);
+  auto bucket = m_percentile->observe(n);
   create_value();
+  auto size = m_percentile->size();
+  if (bucket >= 0) publish(bucket, m_percentile->get(bucket));
+  publish(size + 0, m_count);
+  publish(size + 1, m_sum);
 }
 
 void Histogram::value_of(pjs::Value &out) {
@@ -1510,13 +1863,14 @@ auto Histogram::get_value(int dim) -> double {
 void Histogram::set_value(int dim, double value) {
   int size = m_percentile->size();
   if (0 <= dim && dim < size) {
-    m_percentile->set(dim - 1, value);
+    m_percentile->set(dim, value);
   }
   switch (dim - size) {
     case 0: m_count = value; break;
     case 1: m_sum = value; break;
   }
   create_value();
+  publish(dim, get_value(dim));
 }
 
 } // namespace stats
@@ -1576,6 +1930,19 @@ template<> void ClassDef<Metric>::init() {
     ret.set(metric);
   });
 
+  method("bind", [](Context &ctx, Object *obj, Value &ret) {
+    Str *label;
+    if (!ctx.arguments(1, &label)) return;
+    ret.set(obj->as<Metric>()->with_labels(&label, 1));
+  });
+
+  method("limitCardinality", [](Context &ctx, Object *obj, Value &ret) {
+    int limit;
+    if (!ctx.arguments(1, &limit)) return;
+    obj->as<Metric>()->limit_cardinality(limit);
+    ret.set(obj);
+  });
+
   method("clear", [](Context &ctx, Object *obj, Value &ret) {
     obj->as<Metric>()->clear();
   });
@@ -1675,13 +2042,16 @@ template<> void ClassDef<Histogram>::init() {
 
   ctor([](Context &ctx) -> Object* {
     Str *name;
-    Array *buckets;
+    Object *buckets;
     Array *labels = nullptr;
     if (!ctx.check(0, name)) return nullptr;
     if (!ctx.check(1, buckets)) return nullptr;
     if (!ctx.check(2, labels, labels)) return nullptr;
     try {
-      return Histogram::make(name, buckets, labels);
+      if (!buckets || !buckets->is_array()) {
+        return Histogram::make(name, algo::Percentile::LogLinear(buckets), labels);
+      }
+      return Histogram::make(name, buckets->as<Array>(), labels);
     } catch (std::runtime_error &err) {
       ctx.error(err);
       return nullptr;
@@ -32,8 +32,10 @@
 #include "data.hpp"
 #include "signal.hpp"
 
+#include <atomic>
 #include <chrono>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -41,11 +43,73 @@
 namespace pipy {
 namespace stats {
 
+class Metric;
 class MetricData;
 class MetricDataSum;
 class MetricHistory;
 class MetricSet;
 
+//
+// MetricCells
+//
+// Process-wide registry of metric values from worker threads. Each
+// metric on a worker owns a slot padded to whole cache lines and stores
+// its current values there as it updates them. Scrapers sum the slots
+// for the same name and labels directly instead of asking every thread
+// for a copy of its metric tree. Cells and slots are never freed but
+// reused by later metrics with the same name and labels.
+//
+
+class MetricCells {
+public:
+  struct Cell;
+
+  struct Slot {
+    Cell* cell;
+    Slot* next;
+    std::atomic<bool> in_use;
+    std::atomic<bool> has_value;
+    std::atomic<double> values[1];
+  };
+
+  struct Cell {
+    std::string key;
+    std::string name;
+    std::string type;
+    std::string shape;
+    std::string label;
+    Cell* parent;
+    int dimensions;
+    Slot* slots = nullptr;
+  };
+
+  static auto global() -> MetricCells&;
+
+  // Only metrics created on threads with cells enabled get a slot
+  static void enable(bool b) { s_enabled = b; }
+  static bool enabled() { return s_enabled; }
+
+  auto acquire(Metric *metric, Cell *parent) -> Slot*;
+  void release(Slot *slot);
+
+  void for_each(const std::function<void(const Cell *, const double *, bool)> &cb);
+
+  static void store(Slot *slot, int dim, double value) {
+    slot->values[dim].store(value, std::memory_order_relaxed);
+  }
+
+  static void store_has_value(Slot *slot, bool b) {
+    slot->has_value.store(b, std::memory_order_relaxed);
+  }
+
+private:
+  std::mutex m_mutex;
+  std::vector<Cell*> m_cells;
+  std::unordered_map<std::string, Cell*> m_cell_map;
+
+  thread_local static bool s_enabled;
+};
+
 //
 // Metric
 //
@@ -63,6 +127,7 @@ public:
   auto value(int dim) -> double { return get_value(dim); }
   auto submetrics() -> pjs::Array*;
   auto with_labels(pjs::Str *const *labels, int count) -> Metric*;
+  void limit_cardinality(int limit);
   void zero_all();
   void clear();
 
@@ -72,10 +137,16 @@ public:
 protected:
   Metric(pjs::Str *name, pjs::Array *label_names, MetricSet *set = nullptr);
   Metric(Metric *parent, pjs::Str **labels);
-  virtual ~Metric() {}
+  virtual ~Metric();
 
   bool has_value() const { return m_has_value; }
   void create_value();
+  void attach_cell(Metric *parent);
+  void detach_cell();
+
+  void publish(int dim, double value) {
+    if (m_slot) MetricCells::store(m_slot, dim, value);
+  }
   void serialize(Data::Builder &db, bool initial, bool recursive, bool history);
 
   virtual auto create_new(Metric *parent, pjs::Str **labels) -> Metric* = 0;
@@ -87,6 +158,9 @@ protected:
 private:
   auto get_sub(pjs::Str **labels) -> Metric*;
   auto get_sub(int i) -> Metric*;
+  auto get_sub(pjs::Str *label) -> Metric*;
+  auto evict_sub() -> size_t;
+  void fold_into(Metric *other);
   void truncate(int i);
 
   Metric* m_root;
@@ -96,6 +170,10 @@ private:
   pjs::Ref<pjs::Str> m_label;
   int m_label_index;
   bool m_has_value = false;
+  int m_limit = 0;
+  size_t m_hits = 0;
+  Metric* m_other = nullptr;
+  MetricCells::Slot* m_slot = nullptr;
   std::shared_ptr<std::vector<pjs::Ref<pjs::Str>>> m_label_names;
   std::vector<pjs::Ref<Metric>> m_subs;
   std::unordered_map<pjs::Ref<pjs::Str>, Metric*> m_sub_map;
@@ -137,7 +215,7 @@ public:
 
   void update(MetricSet &metrics);
   bool deserialize(const Data &in);
-  void to_prometheus(const std::string &inst, const std::function<void(const void *, size_t)> &out) const;
+  void to_prometheus(const std::string &inst, Data::Builder &db) const;
 
 private:
 
@@ -150,6 +228,9 @@ private:
     Node* subs = nullptr;
     Node* next = nullptr;
     bool has_value = false;
+    bool prom_cached = false;
+    pjs::Ref<pjs::Str::CharData> prom_key;
+    std::string prom_labels;
     double values[1];
     static auto make(int dimensions) -> Node*;
     ~Node();
@@ -286,9 +367,10 @@ public:
   ~MetricDataSum();
 
   void sum(MetricData &data, bool initial);
+  void update(MetricCells &cells);
   void serialize(Data::Builder &db, bool initial);
   auto to_object() -> pjs::Object*;
-  void to_prometheus(const std::function<void(const void *, size_t)> &out) const;
+  void to_prometheus(Data::Builder &db) const;
 
 private:
 
@@ -296,16 +378,28 @@ private:
   // MetricDataSum::Node
   //
 
+  //
+  // Values are followed by as many more keeping what was last serialized,
+  // so that later reports can leave out what has not changed since.
+  //
+
   struct Node : public List<Node>::Item {
     pjs::Ref<pjs::Str> key;
     std::map<pjs::Str*, Node*> submap;
     List<Node> subs;
     bool serialized = false;
     bool has_value = false;
+    bool sent_has_value = false;
+    bool changed = false;
+    bool subtree_changed = false;
+    bool prom_cached = false;
+    pjs::Ref<pjs::Str::CharData> prom_key;
+    std::string prom_labels;
     double values[1];
     static auto make(int dimensions) -> Node*;
     ~Node();
     void zero(int dimensions);
+    auto sent(int dimensions) -> double* { return values + dimensions; }
     auto get_key() -> pjs::Str::CharData* { return key->data(); }
     void for_subs(const std::function<void(Node*)> &cb) {
       for (const auto &p : submap) {
@@ -458,6 +552,7 @@ private:
   virtual void set_value(int dim, double value) override {
     m_value = value;
     create_value();
+    publish(0, m_value);
   }
 
   virtual void collect() override {
@@ -502,6 +597,7 @@ private:
   virtual void set_value(int dim, double value) override {
     m_value = value;
     create_value();
+    publish(0, m_value);
   }
 
   virtual void collect() override {
@@ -532,8 +628,11 @@ public:
 
 private:
   Histogram(pjs::Str *name, pjs::Array *buckets, pjs::Array *label_names, MetricSet *set = nullptr);
+  Histogram(pjs::Str *name, const algo::Percentile::LogLinear &layout, pjs::Array *label_names, MetricSet *set = nullptr);
   Histogram(Metric *parent, pjs::Str **labels);
 
+  void init_labels();
+
   virtual void value_of(pjs::Value &out) override;
   virtual auto get_type() -> pjs::Str* override;
   virtual auto get_dim() -> int override;
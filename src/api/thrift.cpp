@@ -460,8 +460,9 @@ void Thrift::encode(pjs::Object *msg, Data::Builder &db) {
 // Thrift::Parser
 //
 
-Thrift::Parser::Parser()
+Thrift::Parser::Parser(bool headers_only)
   : m_read_data(Data::make())
+  , m_headers_only(headers_only)
 {
 }
 
@@ -474,6 +475,7 @@ void Thrift::Parser::reset() {
   }
   m_stack = nullptr;
   m_read_data->clear();
+  m_var_int_shift = 0;
 }
 
 void Thrift::Parser::parse(Data &data) {
@@ -649,7 +651,10 @@ auto Thrift::Parser::on_state(int state, int c) -> int {
       return set_value_end();
 
     case VALUE_I64:
-      if (m_protocol == Protocol::compact) {
+      if (m_headers_only) {
+        if (m_protocol == Protocol::compact && var_int(c)) return VALUE_I64;
+        set_value(pjs::Value::undefined);
+      } else if (m_protocol == Protocol::compact) {
         if (var_int(c)) return VALUE_I64;
         set_value(pjs::Int::make(pjs::Int::Type::i64, zigzag_to_int(m_var_int)));
       } else {
@@ -695,25 +700,39 @@ auto Thrift::Parser::on_state(int state, int c) -> int {
       return set_value_end();
 
     case VALUE_UUID:
-      set_value(pjs::Str::make(utils::make_uuid(m_read_buf)));
+      if (m_headers_only) {
+        set_value(pjs::Value::undefined);
+      } else {
+        set_value(pjs::Str::make(utils::make_uuid(m_read_buf)));
+      }
       return set_value_end();
 
-    case BINARY_SIZE:
+    case BINARY_SIZE: {
+      int n;
       if (m_protocol == Protocol::compact) {
         if (var_int(c)) return BINARY_SIZE;
-        m_read_data = Data::make();
-        Deframer::read(m_var_int, m_read_data);
+        n = m_var_int;
       } else {
-        int n = (
+        n = (
           ((int32_t)m_read_buf[0] << 24) |
           ((int32_t)m_read_buf[1] << 16) |
           ((int32_t)m_read_buf[2] <<  8) |
           ((int32_t)m_read_buf[3] <<  0)
         );
+      }
+      if (n < 0) return ERROR;
+      if (n == 0) {
+        set_value(pjs::Str::empty.get());
+        return set_value_end();
+      }
+      if (m_headers_only) {
+        Deframer::pass(n);
+      } else {
         m_read_data = Data::make();
         Deframer::read(n, m_read_data);
       }
       return BINARY_DATA;
+    }
 
     case LIST_HEAD:
       if (m_protocol == Protocol::compact) {
@@ -759,7 +778,7 @@ auto Thrift::Parser::on_state(int state, int c) -> int {
       if (m_protocol == Protocol::compact) {
         if (var_int(c)) return MAP_HEAD;
         if (m_var_int == 0) {
-          set_value(Map::make());
+          set_value(m_headers_only ? pjs::Value::undefined : pjs::Value(Map::make()));
           return set_value_end();
         }
         return MAP_TYPE;
@@ -782,6 +801,10 @@ auto Thrift::Parser::on_state(int state, int c) -> int {
       );
 
     case BINARY_DATA:
+      if (m_headers_only) {
+        set_value(pjs::Value::undefined);
+        return set_value_end();
+      }
       try {
         set_value(m_read_data->to_string(Data::Encoding::utf8));
       } catch (std::runtime_error &err) {
@@ -793,9 +816,20 @@ auto Thrift::Parser::on_state(int state, int c) -> int {
   }
 }
 
+//
+// Varints are little-endian base-128. A new one starts after the last
+// one has ended, so m_var_int holds the last value until then.
+//
+
 bool Thrift::Parser::var_int(int c) {
-  m_var_int = (m_var_int << 7) | (c & 0x7f);
-  return (c & 0x80);
+  if (!m_var_int_shift) m_var_int = 0;
+  if (m_var_int_shift < 64) m_var_int |= uint64_t(c & 0x7f) << m_var_int_shift;
+  if (c & 0x80) {
+    m_var_int_shift += 7;
+    return true;
+  }
+  m_var_int_shift = 0;
+  return false;
 }
 
 auto Thrift::Parser::zigzag_to_int(uint32_t i) -> int32_t {
@@ -927,11 +961,17 @@ auto Thrift::Parser::set_value_end() -> State {
   }
 }
 
+//
+// Also moves on to the next element of a list, set or map, which has to
+// be done even when no values are built with headers only.
+//
+
 void Thrift::Parser::set_value(const pjs::Value &v) {
   if (auto l = m_stack) {
     auto &i = l->index;
     switch (l->kind) {
       case Level::STRUCT: {
+        if (m_headers_only) break;
         auto f = Field::make();
         f->id = i;
         f->type = m_field_type;
@@ -941,10 +981,13 @@ void Thrift::Parser::set_value(const pjs::Value &v) {
       }
       case Level::LIST:
       case Level::SET:
-        l->obj->as<List>()->elements->set(i++, v);
+        if (!m_headers_only) l->obj->as<List>()->elements->set(i, v);
+        i++;
         break;
       case Level::MAP:
-        if (i & 1) {
+        if (m_headers_only) {
+          // Nothing to keep
+        } else if (i & 1) {
           auto *ent = pjs::Array::make(2);
           ent->set(0, l->key);
           ent->set(1, v);
@@ -957,13 +1000,13 @@ void Thrift::Parser::set_value(const pjs::Value &v) {
       default: return;
     }
 
-  } else if (v.is_array()) {
+  } else if (!m_headers_only && v.is_array()) {
     m_message->fields = v.as<pjs::Array>();
   }
 }
 
 auto Thrift::Parser::push_struct() -> State {
-  auto obj = pjs::Array::make();
+  auto obj = m_headers_only ? nullptr : pjs::Array::make();
   set_value(obj);
   auto l = new Level;
   l->back = m_stack;
@@ -980,9 +1023,12 @@ auto Thrift::Parser::push_list(int code, bool is_set, int size) -> State {
   int read_size;
   set_value_type(code, type, state, read_size);
   if (state == ERROR) return state;
-  auto *obj = List::make();
-  obj->elementType = type;
-  obj->elements = pjs::Array::make();
+  List *obj = nullptr;
+  if (!m_headers_only) {
+    obj = List::make();
+    obj->elementType = type;
+    obj->elements = pjs::Array::make();
+  }
   set_value(obj);
   if (size <= 0) return set_value_end();
   auto l = new Level;
@@ -1006,15 +1052,18 @@ auto Thrift::Parser::push_map(int code_k, int code_v, int size) -> State {
   int read_size_k, read_size_v;
   set_value_type(code_k, type_k, state_k, read_size_k);
   set_value_type(code_v, type_v, state_v, read_size_v);
-  auto obj = Map::make();
-  obj->keyType = type_k;
-  obj->valueType = type_v;
-  obj->pairs = pjs::Array::make();
+  Map *obj = nullptr;
+  if (!m_headers_only) {
+    obj = Map::make();
+    obj->keyType = type_k;
+    obj->valueType = type_v;
+    obj->pairs = pjs::Array::make();
+  }
   set_value(obj);
   if (size <= 0) return set_value_end();
   auto l = new Level;
   l->back = m_stack;
-  l->kind = Level::SET;
+  l->kind = Level::MAP;
   l->element_types[0] = state_k;
   l->element_types[1] = state_v;
   l->element_sizes[0] = read_size_k;
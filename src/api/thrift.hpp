@@ -139,9 +139,15 @@ public:
   // Thrift::Parser
   //
 
+  //
+  // With headers_only set, only the message name, type and sequence ID
+  // are decoded. Fields are still walked through to find the end of a
+  // message but no values are made from them.
+  //
+
   class Parser : protected Deframer {
   public:
-    Parser();
+    Parser(bool headers_only = false);
 
     void reset();
     void parse(Data &data);
@@ -203,9 +209,11 @@ public:
     Protocol m_protocol;
     Level* m_stack = nullptr;
     uint64_t m_var_int = 0;
+    int m_var_int_shift = 0;
     int m_element_type_code = 0;
     Type m_field_type;
     bool m_field_bool = false;
+    bool m_headers_only;
 
     virtual auto on_state(int state, int c) -> int override;
 
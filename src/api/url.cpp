@@ -26,7 +26,9 @@
 #include "url.hpp"
 #include "utils.hpp"
 
+#include <list>
 #include <sstream>
+#include <unordered_map>
 
 namespace pipy {
 
@@ -144,15 +146,99 @@ auto URL::decode_component(const std::string &str) -> std::string {
   return out;
 }
 
-URL::URL(pjs::Str *url) : URL(url->str())
-{
+//
+// URLCache
+//
+// URLs recently parsed in the current thread keyed by their text, so that
+// a new URL from a string seen before, such as a request path, copies the
+// components of the earlier parse rather than splitting them up again.
+//
+
+class URLCache {
+public:
+  auto get(pjs::Str *key) -> URL* {
+    auto i = m_index.find(key);
+    if (i == m_index.end()) return nullptr;
+    m_entries.splice(m_entries.begin(), m_entries, i->second);
+    return i->second->url;
+  }
+
+  void set(pjs::Str *key, URL *url) {
+    m_entries.push_front({ key, url });
+    m_index[key] = m_entries.begin();
+    if (m_entries.size() > CAPACITY) {
+      m_index.erase(m_entries.back().key);
+      m_entries.pop_back();
+    }
+  }
+
+private:
+  enum { CAPACITY = 256 };
+
+  struct Entry {
+    pjs::Ref<pjs::Str> key;
+    pjs::Ref<URL> url;
+  };
+
+  struct Hash {
+    size_t operator()(const pjs::Ref<pjs::Str> &s) const { return s->hash(); }
+  };
+
+  struct Equal {
+    bool operator()(const pjs::Ref<pjs::Str> &a, const pjs::Ref<pjs::Str> &b) const {
+      return a == b || a->str() == b->str();
+    }
+  };
+
+  std::list<Entry> m_entries;
+  std::unordered_map<pjs::Ref<pjs::Str>, std::list<Entry>::iterator, Hash, Equal> m_index;
+};
+
+thread_local static URLCache s_url_cache;
+
+URL::URL(pjs::Str *url) {
+  pjs::Ref<pjs::Str> key(url);
+  if (auto *cached = s_url_cache.get(url)) {
+    copy(cached);
+  } else {
+    parse(url->str(), std::string());
+    auto *parsed = URL::make();
+    parsed->copy(this);
+    s_url_cache.set(url, parsed);
+  }
 }
 
-URL::URL(pjs::Str *url, pjs::Str *base) : URL(url->str(), base->str())
-{
+URL::URL(pjs::Str *url, pjs::Str *base) {
+  parse(url->str(), base->str());
 }
 
 URL::URL(const std::string &url, const std::string &base) {
+  parse(url, base);
+}
+
+auto URL::searchParams() -> URLSearchParams* {
+  if (!m_search_params) m_search_params = URLSearchParams::make(m_search);
+  return m_search_params;
+}
+
+void URL::copy(const URL *url) {
+  m_auth     = url->m_auth;
+  m_hash     = url->m_hash;
+  m_host     = url->m_host;
+  m_hostname = url->m_hostname;
+  m_href     = url->m_href;
+  m_origin   = url->m_origin;
+  m_password = url->m_password;
+  m_path     = url->m_path;
+  m_pathname = url->m_pathname;
+  m_port     = url->m_port;
+  m_protocol = url->m_protocol;
+  m_query    = url->m_query;
+  m_search   = url->m_search;
+  m_username = url->m_username;
+}
+
+void URL::parse(const std::string &url, const std::string &base) {
   auto find_protocol = [](const std::string &url) -> std::string {
     for (int i = 0; i < url.length(); i++) {
       auto c = url[i];
@@ -290,8 +376,6 @@ URL::URL(const std::string &url, const std::string &base) {
   m_query    = pjs::Str::make(query    );
   m_search   = pjs::Str::make(search   );
   m_username = pjs::Str::make(username );
-
-  m_search_params = URLSearchParams::make(m_search);
 }
 
 //
@@ -56,10 +56,11 @@ public:
   auto protocol() const -> pjs::Str* { return m_protocol; }
   auto query() const -> pjs::Str* { return m_query; }
   auto search() const -> pjs::Str* { return m_search; }
-  auto searchParams() const -> URLSearchParams* { return m_search_params; }
+  auto searchParams() -> URLSearchParams*;
   auto username() const -> pjs::Str* { return m_username; }
 
 private:
+  URL() {}
   URL(pjs::Str *url);
   URL(pjs::Str *url, pjs::Str *base);
   URL(const std::string &url, const std::string &base = std::string());
@@ -80,6 +81,9 @@ private:
   pjs::Ref<URLSearchParams> m_search_params;
   pjs::Ref<pjs::Str> m_username;
 
+  void parse(const std::string &url, const std::string &base);
+  void copy(const URL *url);
+
   friend class pjs::ObjectTemplate<URL>;
 };
 
@@ -70,6 +70,19 @@ template<> void ClassDef<XML>::init() {
     }
   });
 
+  method("pick", [](Context &ctx, Object *obj, Value &ret) {
+    pipy::Data *data;
+    Array *path;
+    if (!ctx.arguments(2, &data, &path)) return;
+    std::vector<Value> keys(path->length());
+    for (int i = 0; i < path->length(); i++) path->get(i, keys[i]);
+    if (auto node = data ? XML::pick(*data, keys) : nullptr) {
+      ret.set(node);
+    } else {
+      ret = Value::null;
+    }
+  });
+
   method("encode", [](Context &ctx, Object *obj, Value &ret) {
     XML::Node *doc;
     int space = 0;
@@ -116,10 +129,20 @@ static Data::Producer s_dp("XML");
 //
 // XMLParser
 //
+// When given a path, only the element it leads to is built, and parsing
+// stops as soon as that element ends or its parent ends without it. The
+// path goes from the root element down, each step being either the name
+// of the first matching element or the index of an element among its
+// sibling elements.
+//
 
 class XMLParser {
 public:
-  XMLParser() : m_parser(XML_ParserCreate(nullptr)) {
+  XMLParser(const std::vector<pjs::Value> *path = nullptr)
+    : m_parser(XML_ParserCreate(nullptr))
+    , m_path(path)
+  {
+    if (path) m_frames.push_back({ 0, 0 });
     XML_SetUserData(m_parser, this);
     XML_SetElementHandler(m_parser, xml_element_start, xml_element_end);
     XML_SetCharacterDataHandler(m_parser, xml_char_data);
@@ -156,11 +179,60 @@ public:
     return root;
   }
 
+  auto pick(const Data &data) -> XML::Node* {
+    for (const auto c : data.chunks()) {
+      if (!XML_Parse(m_parser, std::get<0>(c), std::get<1>(c), false)) {
+        if (m_stopped) return m_picked;
+        return nullptr;
+      }
+    }
+    if (!XML_Parse(m_parser, nullptr, 0, true) && !m_stopped) return nullptr;
+    return m_picked;
+  }
+
 private:
+  struct Frame {
+    int level;
+    int index;
+  };
+
   XML_Parser m_parser;
   std::stack<XML::Node*> m_stack;
+  const std::vector<pjs::Value> *m_path;
+  std::vector<Frame> m_frames;
+  XML::Node* m_picked = nullptr;
+  int m_capturing = 0;
+  bool m_stopped = false;
+
+  // Tells which level of the path an element starting here is at, or -1
+  int locate(const XML_Char *name) {
+    auto &f = m_frames.back();
+    auto index = f.index++;
+    if (f.level < 0) return -1;
+    if (f.level == int(m_path->size())) return f.level;
+    const auto &k = (*m_path)[f.level];
+    if (k.is_number()) {
+      if (int(k.n()) != index) return -1;
+    } else {
+      if (!k.is_string() || k.s()->str() != name) return -1;
+    }
+    return f.level + 1;
+  }
+
+  void stop() {
+    m_stopped = true;
+    XML_StopParser(m_parser, XML_FALSE);
+  }
 
   void element_start(const XML_Char *name, const XML_Char **attrs) {
+    if (m_stopped) return;
+    if (m_path && !m_capturing) {
+      auto level = locate(name);
+      if (level < int(m_path->size())) {
+        m_frames.push_back({ level, 0 });
+        return;
+      }
+    }
     auto *attributes = attrs[0] ? pjs::Object::make() : nullptr;
     auto *children = pjs::Array::make();
     auto *node = XML::Node::make(pjs::Str::make(name), attributes, children);
@@ -171,15 +243,29 @@ private:
         attributes->ht_set(k, v);
       }
     }
-    append_child(node);
+    if (m_path && !m_capturing++) {
+      m_picked = node;
+    } else {
+      append_child(node);
+    }
     m_stack.push(node);
   }
 
   void element_end(const XML_Char *name) {
+    if (m_stopped) return;
+    if (m_path) {
+      if (!m_capturing) {
+        if (m_frames.back().level >= 0) stop();
+        m_frames.pop_back();
+        return;
+      }
+      if (!--m_capturing) stop();
+    }
     m_stack.pop();
   }
 
   void char_data(const XML_Char *str, int len) {
+    if (m_stopped || (m_path && !m_capturing)) return;
     append_child(std::string(str, len));
   }
 
@@ -225,6 +311,11 @@ auto XML::decode(const Data &data) -> Node* {
   return parser.parse(data);
 }
 
+auto XML::pick(const Data &data, const std::vector<pjs::Value> &path) -> Node* {
+  XMLParser parser(&path);
+  return parser.pick(data);
+}
+
 bool XML::encode(Node *doc, int space, Data &data) {
   static const std::string s_escaped_chars("<>&");
   static const std::string s_cdata_start("<![CDATA[");
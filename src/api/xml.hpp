@@ -29,6 +29,7 @@
 #include "pjs/pjs.hpp"
 
 #include <functional>
+#include <vector>
 
 namespace pipy {
 
@@ -60,6 +61,7 @@ public:
   static auto parse(const std::string &str) -> Node*;
   static auto stringify(Node *doc, int space) -> std::string;
   static auto decode(const Data &data) -> Node*;
+  static auto pick(const Data &data, const std::vector<pjs::Value> &path) -> Node*;
   static bool encode(Node *doc, int space, Data &data);
 };
 
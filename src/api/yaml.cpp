@@ -220,6 +220,7 @@ static void yaml_parse(
         break;
       default: break;
     }
+    yaml_event_delete(&e);
   }
 }
 
@@ -24,6 +24,9 @@
  */
 
 #include "buffer.hpp"
+#include "log.hpp"
+
+#include <cstring>
 
 namespace pipy {
 
@@ -33,6 +36,106 @@ namespace pipy {
 
 thread_local List<BufferStats> BufferStats::s_all;
 
+//
+// SpillBuffer
+//
+
+static Data::Producer s_dp_spill("Spill Buffer");
+
+void SpillBuffer::push(Event *e) {
+  if (auto data = e->as<Data>()) {
+    if (m_threshold > 0 && !data->empty() && m_memory_size + data->size() > m_threshold) {
+      if (spill(*data)) return;
+    }
+    m_memory_size += data->size();
+    if (m_stats) m_stats->size += data->size();
+  }
+  if (m_stats) m_stats->on_push();
+  m_items.push_back({ e->clone(), 0, 0 });
+}
+
+bool SpillBuffer::spill(const Data &data) {
+  if (!m_file) {
+    if (m_file_failed) return false;
+    if (!(m_file = std::tmpfile())) {
+      Log::warn("[buffer] cannot create a temporary file to spill to: %s", std::strerror(errno));
+      m_file_failed = true;
+      return false;
+    }
+  }
+
+  // Reads during iterate() leave the position anywhere
+  std::fseek(m_file, 0, SEEK_END);
+
+  for (const auto c : data.chunks()) {
+    auto len = std::get<1>(c);
+    if (std::fwrite(std::get<0>(c), 1, len, m_file) != size_t(len)) {
+      Log::warn("[buffer] cannot write to the spill file: %s", std::strerror(errno));
+      m_file_failed = true;
+      return false;
+    }
+  }
+
+  auto offset = m_spilled_size;
+  m_spilled_size += data.size();
+
+  if (!m_items.empty()) {
+    auto &last = m_items.back();
+    if (!last.event && last.offset + last.size == offset) {
+      last.size += data.size();
+      return true;
+    }
+  }
+
+  m_items.push_back({ nullptr, offset, size_t(data.size()) });
+  return true;
+}
+
+void SpillBuffer::iterate(const std::function<void(Event*)> &cb) {
+  static const size_t BLOCK_SIZE = 0x10000;
+  for (const auto &i : m_items) {
+    if (auto e = i.event.get()) {
+      cb(e);
+      continue;
+    }
+    if (std::fseek(m_file, long(i.offset), SEEK_SET)) {
+      Log::warn("[buffer] cannot seek in the spill file: %s", std::strerror(errno));
+      break;
+    }
+    size_t left = i.size;
+    while (left > 0) {
+      char buf[BLOCK_SIZE];
+      auto n = std::fread(buf, 1, std::min(left, BLOCK_SIZE), m_file);
+      if (!n) {
+        Log::warn("[buffer] cannot read from the spill file: %s", std::strerror(errno));
+        return;
+      }
+      pjs::Ref<Data> data(s_dp_spill.make(buf, n));
+      cb(data);
+      left -= n;
+    }
+  }
+}
+
+void SpillBuffer::clear() {
+  if (m_stats) {
+    for (const auto &i : m_items) {
+      if (auto e = i.event.get()) {
+        m_stats->on_shift();
+        if (auto data = e->as<Data>()) m_stats->size -= data->size();
+      }
+    }
+  }
+  m_items.clear();
+  if (m_file) {
+    std::fclose(m_file);
+    m_file = nullptr;
+  }
+  m_memory_size = 0;
+  m_spilled_size = 0;
+  m_file_failed = false;
+}
+
 //
 // DataBuffer::Options
 //
@@ -29,10 +29,13 @@
 #include "data.hpp"
 #include "list.hpp"
 #include "options.hpp"
+#include "utils.hpp"
 
+#include <cstdio>
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace pipy {
 
@@ -44,6 +47,35 @@ struct BufferStats : public List<BufferStats>::Item {
   std::string name;
   size_t size = 0;
 
+  // With timing on, the area under the number of buffered events over
+  // time gives the total time events spent waiting (Little's law)
+  bool timing = false;
+  size_t events = 0;
+  uint64_t arrivals = 0;
+  uint64_t wait_cycles = 0;
+  uint64_t last_change = 0;
+
+  void on_push() {
+    if (timing) {
+      tick();
+      events++;
+      arrivals++;
+    }
+  }
+
+  void on_shift() {
+    if (timing) {
+      tick();
+      events--;
+    }
+  }
+
+  void tick() {
+    auto t = utils::cycles();
+    if (events > 0) wait_cycles += events * (t - last_change);
+    last_change = t;
+  }
+
   BufferStats() { s_all.push(this); }
   ~BufferStats() { s_all.remove(this); }
 
@@ -87,6 +119,7 @@ public:
     e->retain();
     m_events.push(e);
     if (m_stats) {
+      m_stats->on_push();
       if (auto data = e->as<Data>()) {
         m_stats->size += data->size();
       }
@@ -99,6 +132,7 @@ public:
     m_events.remove(e);
     e->m_in_buffer = false;
     if (m_stats) {
+      m_stats->on_shift();
       if (auto data = e->as<Data>()) {
         m_stats->size -= data->size();
       }
@@ -112,6 +146,7 @@ public:
     e->retain();
     m_events.unshift(e);
     if (m_stats) {
+      m_stats->on_push();
       if (auto data = e->as<Data>()) {
         m_stats->size += data->size();
       }
@@ -130,6 +165,7 @@ public:
       events.remove(e);
       e->m_in_buffer = false;
       if (m_stats) {
+        m_stats->on_shift();
         if (auto data = e->as<Data>()) {
           m_stats->size -= data->size();
         }
@@ -145,6 +181,7 @@ public:
       events.remove(e);
       e->m_in_buffer = false;
       if (m_stats) {
+        m_stats->on_shift();
         if (auto data = e->as<Data>()) {
           m_stats->size -= data->size();
         }
@@ -159,6 +196,7 @@ public:
       m_events.remove(e);
       e->m_in_buffer = false;
       if (m_stats) {
+        m_stats->on_shift();
         if (auto data = e->as<Data>()) {
           m_stats->size -= data->size();
         }
@@ -175,6 +213,7 @@ public:
       events.remove(e);
       e->m_in_buffer = false;
       if (m_stats) {
+        m_stats->on_shift();
         if (auto data = e->as<Data>()) {
           m_stats->size -= data->size();
         }
@@ -188,6 +227,58 @@ private:
   std::shared_ptr<BufferStats> m_stats;
 };
 
+//
+// SpillBuffer
+//
+// Keeps a stream of events for replaying it later. Once the Data held in
+// memory goes over the spill threshold, further Data is appended to an
+// anonymous temporary file instead, with consecutive spilled Data sharing
+// one span of it. Spilled spans are read back a block at a time while
+// being iterated, so memory stays bounded however long the stream is.
+//
+
+class SpillBuffer {
+public:
+  SpillBuffer(std::shared_ptr<BufferStats> stats = nullptr)
+    : m_stats(stats) {}
+
+  SpillBuffer(const SpillBuffer &r)
+    : m_stats(r.m_stats)
+    , m_threshold(r.m_threshold) {}
+
+  ~SpillBuffer() {
+    clear();
+  }
+
+  // Zero keeps everything in memory
+  void set_threshold(size_t size) { m_threshold = size; }
+
+  bool empty() const { return m_items.empty(); }
+  auto memory_size() const -> size_t { return m_memory_size; }
+  auto spilled_size() const -> size_t { return m_spilled_size; }
+
+  void push(Event *e);
+  void iterate(const std::function<void(Event*)> &cb);
+  void clear();
+
+private:
+  struct Item {
+    pjs::Ref<Event> event;
+    size_t offset;
+    size_t size;
+  };
+
+  std::vector<Item> m_items;
+  std::shared_ptr<BufferStats> m_stats;
+  std::FILE* m_file = nullptr;
+  size_t m_threshold = 0;
+  size_t m_memory_size = 0;
+  size_t m_spilled_size = 0;
+  bool m_file_failed = false;
+
+  bool spill(const Data &data);
+};
+
 //
 // DataBuffer
 //
@@ -0,0 +1,274 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "circuit-breaker.hpp"
+#include "utils.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+
+namespace pipy {
+
+//
+// CircuitBreaker::Options
+//
+
+CircuitBreaker::Options::Options(pjs::Object *options) {
+  Value(options, "window")
+    .get_seconds(window)
+    .check_nullable();
+  Value(options, "buckets")
+    .get(buckets)
+    .check_nullable();
+  Value(options, "errorRate")
+    .get(error_rate)
+    .check_nullable();
+  Value(options, "minRequests")
+    .get(min_requests)
+    .check_nullable();
+  Value(options, "consecutiveFailures")
+    .get(consecutive_failures)
+    .check_nullable();
+  Value(options, "openTime")
+    .get_seconds(open_time)
+    .check_nullable();
+  Value(options, "halfOpenRequests")
+    .get(half_open_requests)
+    .check_nullable();
+  if (window <= 0) throw std::runtime_error("options.window expects a positive number");
+  if (buckets < 1) throw std::runtime_error("options.buckets must be at least 1");
+  if (error_rate <= 0 || error_rate > 1) throw std::runtime_error("options.errorRate must be within (0, 1]");
+  if (open_time <= 0) throw std::runtime_error("options.openTime expects a positive number");
+  min_requests = std::max(1, min_requests);
+  half_open_requests = std::max(1, half_open_requests);
+}
+
+auto CircuitBreaker::Options::key() const -> std::string {
+  std::string k;
+  k += std::to_string(window); k += '\n';
+  k += std::to_string(buckets); k += '\n';
+  k += std::to_string(error_rate); k += '\n';
+  k += std::to_string(min_requests); k += '\n';
+  k += std::to_string(consecutive_failures); k += '\n';
+  k += std::to_string(open_time); k += '\n';
+  k += std::to_string(half_open_requests);
+  return k;
+}
+
+//
+// CircuitBreaker::Target
+//
+// Outcomes are counted in a ring of buckets, each covering an equal slice
+// of the window. A bucket is claimed for its slice by whoever first moves
+// its epoch forward, which also zeroes it. A few counts racing with that
+// may land on either side, which is fine for a rate.
+//
+
+CircuitBreaker::Target::Target(CircuitBreaker *breaker, const std::string &name)
+  : m_breaker(breaker)
+  , m_name(name)
+  , m_buckets(breaker->m_options.buckets)
+{
+}
+
+auto CircuitBreaker::Target::state() -> State {
+  auto s = State(m_state.load(std::memory_order_acquire));
+  if (s == State::OPEN) {
+    auto now = int64_t(utils::now());
+    auto open_time = int64_t(m_breaker->m_options.open_time * 1000);
+    if (now - m_opened_at.load(std::memory_order_relaxed) >= open_time) {
+      int expected = int(State::OPEN);
+      m_trials.store(0, std::memory_order_relaxed);
+      m_trial_successes.store(0, std::memory_order_relaxed);
+      if (m_state.compare_exchange_strong(expected, int(State::HALF_OPEN), std::memory_order_acq_rel)) {
+        Log::info("[circuit-breaker] %s half-open", m_name.c_str());
+      }
+      s = State(m_state.load(std::memory_order_acquire));
+    }
+  }
+  return s;
+}
+
+bool CircuitBreaker::Target::allow() {
+  switch (state()) {
+    case State::CLOSED: return true;
+    case State::OPEN: return false;
+    case State::HALF_OPEN:
+      return m_trials.load(std::memory_order_relaxed) < m_breaker->m_options.half_open_requests;
+  }
+  return true;
+}
+
+void CircuitBreaker::Target::select() {
+  if (state() == State::HALF_OPEN) {
+    m_trials.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void CircuitBreaker::Target::report(bool ok) {
+  const auto &options = m_breaker->m_options;
+  auto now = int64_t(utils::now());
+  record(now, ok);
+
+  switch (state()) {
+    case State::OPEN:
+      break;
+
+    case State::HALF_OPEN:
+      if (!ok) {
+        trip(State::HALF_OPEN, now);
+      } else if (m_trial_successes.fetch_add(1, std::memory_order_relaxed) + 1 >= options.half_open_requests) {
+        recover();
+      } else if (m_trials.load(std::memory_order_relaxed) > 0) {
+        m_trials.fetch_sub(1, std::memory_order_relaxed);
+      }
+      break;
+
+    case State::CLOSED: {
+      if (ok) {
+        if (m_failures_in_row.load(std::memory_order_relaxed)) {
+          m_failures_in_row.store(0, std::memory_order_relaxed);
+        }
+        break;
+      }
+      auto n = m_failures_in_row.fetch_add(1, std::memory_order_relaxed) + 1;
+      if (options.consecutive_failures > 0 && n >= options.consecutive_failures) {
+        trip(State::CLOSED, now);
+        break;
+      }
+      auto width = int64_t(options.window * 1000 / options.buckets);
+      auto epoch = now / std::max(int64_t(1), width);
+      int total = 0, failures = 0;
+      for (auto &b : m_buckets) {
+        if (epoch - b.epoch.load(std::memory_order_acquire) < int64_t(m_buckets.size())) {
+          auto f = b.failures.load(std::memory_order_relaxed);
+          total += f + b.successes.load(std::memory_order_relaxed);
+          failures += f;
+        }
+      }
+      if (total >= options.min_requests && failures >= total * options.error_rate) {
+        trip(State::CLOSED, now);
+      }
+      break;
+    }
+  }
+}
+
+void CircuitBreaker::Target::record(int64_t now, bool ok) {
+  const auto &options = m_breaker->m_options;
+  auto width = int64_t(options.window * 1000 / options.buckets);
+  auto epoch = now / std::max(int64_t(1), width);
+  auto &b = m_buckets[epoch % m_buckets.size()];
+  auto e = b.epoch.load(std::memory_order_acquire);
+  if (e < epoch) {
+    if (b.epoch.compare_exchange_strong(e, epoch, std::memory_order_acq_rel)) {
+      b.successes.store(0, std::memory_order_relaxed);
+      b.failures.store(0, std::memory_order_relaxed);
+    }
+  }
+  if (ok) {
+    b.successes.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    b.failures.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void CircuitBreaker::Target::trip(State from, int64_t now) {
+  int expected = int(from);
+  m_opened_at.store(now, std::memory_order_relaxed);
+  if (m_state.compare_exchange_strong(expected, int(State::OPEN), std::memory_order_acq_rel)) {
+    Log::info(
+      "[circuit-breaker] %s opened for %g seconds",
+      m_name.c_str(), m_breaker->m_options.open_time
+    );
+  }
+}
+
+void CircuitBreaker::Target::recover() {
+  for (auto &b : m_buckets) {
+    b.successes.store(0, std::memory_order_relaxed);
+    b.failures.store(0, std::memory_order_relaxed);
+  }
+  m_failures_in_row.store(0, std::memory_order_relaxed);
+  int expected = int(State::HALF_OPEN);
+  if (m_state.compare_exchange_strong(expected, int(State::CLOSED), std::memory_order_acq_rel)) {
+    Log::info("[circuit-breaker] %s closed", m_name.c_str());
+  }
+}
+
+//
+// CircuitBreaker
+//
+
+std::mutex CircuitBreaker::s_mutex;
+std::map<std::string, std::weak_ptr<CircuitBreaker>> CircuitBreaker::s_breakers;
+
+auto CircuitBreaker::get(const Options &options) -> std::shared_ptr<CircuitBreaker> {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto key = options.key();
+  auto &p = s_breakers[key];
+  if (auto breaker = p.lock()) return breaker;
+  std::shared_ptr<CircuitBreaker> breaker(new CircuitBreaker(options));
+  p = breaker;
+  return breaker;
+}
+
+CircuitBreaker::~CircuitBreaker() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto i = s_breakers.find(m_options.key());
+  if (i != s_breakers.end() && i->second.expired()) {
+    s_breakers.erase(i);
+  }
+}
+
+auto CircuitBreaker::watch(const std::string &name) -> std::shared_ptr<Target> {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto &t = m_targets[name];
+  if (!t) t = std::shared_ptr<Target>(new Target(this, name));
+  t->m_watchers++;
+  return t;
+}
+
+void CircuitBreaker::unwatch(Target *target) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto i = m_targets.find(target->m_name);
+  if (i == m_targets.end() || i->second.get() != target) return;
+  if (--target->m_watchers > 0) return;
+  m_targets.erase(i);
+}
+
+} // namespace pipy
+
+namespace pjs {
+
+using namespace pipy;
+
+template<> void EnumDef<CircuitBreaker::State>::init() {
+  define(CircuitBreaker::State::CLOSED, "closed");
+  define(CircuitBreaker::State::OPEN, "open");
+  define(CircuitBreaker::State::HALF_OPEN, "half-open");
+}
+
+} // namespace pjs
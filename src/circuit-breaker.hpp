@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CIRCUIT_BREAKER_HPP
+#define CIRCUIT_BREAKER_HPP
+
+#include "options.hpp"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pipy {
+
+//
+// CircuitBreaker
+//
+// Trips a target open after too many consecutive failures or a high error
+// rate over a sliding window, keeps it out of selection for a while, then
+// lets a limited number of trial requests through to decide whether to
+// close it again. Workers with equal options share one breaker, so every
+// worker sees the same state. All counters are atomics that workers update
+// without taking a lock.
+//
+
+class CircuitBreaker : public std::enable_shared_from_this<CircuitBreaker> {
+public:
+  enum class State {
+    CLOSED,
+    OPEN,
+    HALF_OPEN,
+  };
+
+  struct Options : public pipy::Options {
+    double window = 10;
+    int buckets = 10;
+    double error_rate = 0.5;
+    int min_requests = 20;
+    int consecutive_failures = 5;
+    double open_time = 30;
+    int half_open_requests = 3;
+    Options() {}
+    Options(pjs::Object *options);
+    auto key() const -> std::string;
+  };
+
+  //
+  // CircuitBreaker::Target
+  //
+
+  class Target {
+  public:
+    auto name() const -> const std::string& { return m_name; }
+    auto state() -> State;
+
+    // Whether the target can take a request right now
+    bool allow();
+
+    // Called when the target is picked, to count trials while half-open
+    void select();
+
+    // Outcome of a request sent to the target
+    void report(bool ok);
+
+  private:
+    struct Bucket {
+      std::atomic<int64_t> epoch{-1};
+      std::atomic<int> successes{0};
+      std::atomic<int> failures{0};
+    };
+
+    Target(CircuitBreaker *breaker, const std::string &name);
+
+    CircuitBreaker* m_breaker;
+    std::string m_name;
+    std::vector<Bucket> m_buckets;
+    std::atomic<int> m_state{int(State::CLOSED)};
+    std::atomic<int64_t> m_opened_at{0};
+    std::atomic<int> m_failures_in_row{0};
+    std::atomic<int> m_trials{0};
+    std::atomic<int> m_trial_successes{0};
+    int m_watchers = 0;
+
+    void record(int64_t now, bool ok);
+    void trip(State from, int64_t now);
+    void recover();
+
+    friend class CircuitBreaker;
+  };
+
+  static auto get(const Options &options) -> std::shared_ptr<CircuitBreaker>;
+
+  ~CircuitBreaker();
+
+  auto options() const -> const Options& { return m_options; }
+  auto watch(const std::string &name) -> std::shared_ptr<Target>;
+  void unwatch(Target *target);
+
+private:
+  CircuitBreaker(const Options &options) : m_options(options) {}
+
+  Options m_options;
+  std::mutex m_mutex;
+  std::map<std::string, std::shared_ptr<Target>> m_targets;
+
+  static std::mutex s_mutex;
+  static std::map<std::string, std::weak_ptr<CircuitBreaker>> s_breakers;
+};
+
+} // namespace pipy
+
+#endif // CIRCUIT_BREAKER_HPP
@@ -442,7 +442,7 @@ void CodebaseStore::generate_files(
       key,
       Data(make_record({
         { "id", file_id },
-        { "version", version },
+        { "version", file_version(key, file_id, version) },
       }), &s_dp)
     );
     old_keys.erase(key);
@@ -488,6 +488,27 @@ void CodebaseStore::generate_files(
   );
 }
 
+//
+// A file keeps the version it had as long as it still refers to the same
+// content, so that proxies can tell from the etags which files to fetch.
+//
+
+auto CodebaseStore::file_version(
+  const std::string &key,
+  const std::string &file_id,
+  const std::string &version
+) -> std::string {
+  Data buf;
+  if (m_store->get(key, buf)) {
+    std::map<std::string, std::string> rec;
+    read_record(buf.to_string(), rec);
+    if (rec["id"] == file_id && !rec["version"].empty()) {
+      return rec["version"];
+    }
+  }
+  return version;
+}
+
 void CodebaseStore::generate_etags(
   Store::Batch *batch,
   const std::string &codebase_id,
@@ -513,7 +534,7 @@ void CodebaseStore::generate_etags(
       }
     } else {
       etags += '#';
-      etags += version;
+      etags += file_version(KEY_file_tree(codebase_path + path), p.second, version);
     }
     etags += '\n';
   }
@@ -121,6 +121,12 @@ private:
     const std::map<std::string, std::string> &files
   );
 
+  auto file_version(
+    const std::string &key,
+    const std::string &file_id,
+    const std::string &version
+  ) -> std::string;
+
   void generate_etags(
     Store::Batch *batch,
     const std::string &codebase_id,
@@ -31,6 +31,7 @@
 #include "api/url.hpp"
 #include "fetch.hpp"
 #include "fs.hpp"
+#include "tar.hpp"
 #include "utils.hpp"
 #include "log.hpp"
 
@@ -39,13 +40,20 @@
 #include <sstream>
 #include <mutex>
 
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
 namespace pipy {
 
 static Data::Producer s_dp("Codebase");
 static const pjs::Ref<pjs::Str> s_etag(pjs::Str::make("etag"));
 static const pjs::Ref<pjs::Str> s_date(pjs::Str::make("last-modified"));
+static const std::string s_snapshot_info("/.pipy-snapshot");
 
 Codebase* Codebase::s_current = nullptr;
+thread_local Codebase::Recorder* Codebase::s_recorder = nullptr;
 
 //
 // CodebaseFromRoot
@@ -67,6 +75,7 @@ public:
   virtual void patch(const std::string &path, SharedData *data) override;
   virtual auto watch(const std::string &path, const std::function<void(const std::list<std::string> &)> &on_update) -> Watch* override;
   virtual void sync(bool force, const std::function<void(bool)> &on_update) override;
+  virtual void stop_watching() override;
 
 private:
   class Synchoronizer {
@@ -142,12 +151,18 @@ auto CodebaseFromRoot::list(const std::string &path) -> std::list<std::string> {
 }
 
 auto CodebaseFromRoot::get(const std::string &path) -> SharedData* {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  std::string local_path;
-  if (auto codebase = find_mount(path, local_path)) {
-    return codebase->get(local_path);
+  SharedData *data = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string local_path;
+    if (auto codebase = find_mount(path, local_path)) {
+      data = codebase->get(local_path);
+    } else {
+      data = m_root->get(path);
+    }
   }
-  return m_root->get(path);
+  if (auto r = recorder()) r->on_codebase_read(path, data);
+  return data;
 }
 
 void CodebaseFromRoot::set(const std::string &path, SharedData *data) {
@@ -192,6 +207,14 @@ void CodebaseFromRoot::sync(bool force, const std::function<void(bool)> &on_upda
   }
 }
 
+void CodebaseFromRoot::stop_watching() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_root->stop_watching();
+  for (const auto &p : m_mounts) {
+    p.second->stop_watching();
+  }
+}
+
 auto CodebaseFromRoot::find_mount(const std::string &path, std::string &local_path) -> Codebase* {
   std::string dirname = path;
   if (dirname.empty()) return nullptr;
@@ -259,15 +282,28 @@ public:
   virtual void set(const std::string &path, SharedData *data) override;
   virtual auto watch(const std::string &path, const std::function<void(const std::list<std::string> &)> &on_update) -> Watch* override;
   virtual void sync(bool force, const std::function<void(bool)> &on_update) override;
+  virtual void stop_watching() override;
+
+  ~CodebaseFromFS();
 
 private:
+
+  //
+  // Watched files and directories are normally checked only when the
+  // kernel reports a change in a directory they live in. Entries whose
+  // directories cannot be watched (no notification support, or out of
+  // inotify watches) are marked as polled and get stat'ed on every sync.
+  //
+
   struct WatchedFile {
     double time;
+    bool polled;
     std::set<pjs::Ref<Watch>> watches;
   };
 
   struct WatchedDir {
     std::map<std::string, double> times;
+    bool polled;
     std::set<pjs::Ref<Watch>> watches;
   };
 
@@ -278,11 +314,41 @@ private:
   std::string m_script;
   std::map<std::string, WatchedFile> m_watched_files;
   std::map<std::string, WatchedDir> m_watched_dirs;
-
-  void list_file_times(const std::string &path, std::map<std::string, double> &times);
+  std::set<std::string> m_dirty_dirs;
+  bool m_dirty_all = false;
+
+#ifdef __linux__
+  int m_inotify = -1;
+  std::map<int, std::string> m_inotify_paths;
+  std::map<std::string, int> m_inotify_dirs;
+  std::unique_ptr<asio::posix::stream_descriptor> m_inotify_stream;
+  std::unique_ptr<Timer> m_debounce_timer;
+  bool m_debouncing = false;
+
+  void start_notifier();
+  void wait_notifications();
+  void read_notifications();
+#endif
+
+  bool watch_dir(const std::string &path);
+  bool is_dirty(const std::string &path, bool recursive);
+  void check_changes(bool all);
+  bool list_file_times(const std::string &path, std::map<std::string, double> &times);
 };
 
+//
+// Changes often come in bursts (an editor saving through a temporary
+// file, a ConfigMap swapping its data directory), so notifications are
+// collected for a short while before watched paths are checked.
+//
+
+static const double NOTIFY_DEBOUNCE_TIME = 0.05;
+
 CodebaseFromFS::CodebaseFromFS(const std::string &path) {
+#ifdef __linux__
+  m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
   auto full_path = fs::abs_path(path);
 
   if (!fs::exists(full_path)) {
@@ -300,6 +366,10 @@ CodebaseFromFS::CodebaseFromFS(const std::string &path) {
 }
 
 CodebaseFromFS::CodebaseFromFS(const std::string &path, const std::string &script) {
+#ifdef __linux__
+  m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
   m_base = fs::abs_path(path);
   m_script = script;
 
@@ -309,6 +379,17 @@ CodebaseFromFS::CodebaseFromFS(const std::string &path, const std::string &scrip
   }
 }
 
+CodebaseFromFS::~CodebaseFromFS() {
+#ifdef __linux__
+  if (m_inotify_stream) {
+    std::error_code ec;
+    m_inotify_stream->close(ec);
+  } else if (m_inotify >= 0) {
+    ::close(m_inotify);
+  }
+#endif
+}
+
 void CodebaseFromFS::mount(const std::string &, Codebase *) {
   throw std::runtime_error("mounting unsupported");
 }
@@ -374,7 +455,7 @@ auto CodebaseFromFS::watch(const std::string &path, const std::function<void(con
     auto i = m_watched_dirs.find(norm_path);
     if (i == m_watched_dirs.end()) {
       auto &wd = m_watched_dirs[norm_path];
-      list_file_times(norm_path, wd.times);
+      wd.polled = !list_file_times(norm_path, wd.times);
       wd.watches.insert(w);
     } else {
       i->second.watches.insert(w);
@@ -386,6 +467,7 @@ auto CodebaseFromFS::watch(const std::string &path, const std::function<void(con
     if (i == m_watched_files.end()) {
       auto &wf = m_watched_files[norm_path];
       wf.time = fs::get_file_time(full_path);
+      wf.polled = !watch_dir(utils::path_dirname(norm_path));
       wf.watches.insert(w);
     } else {
       i->second.watches.insert(w);
@@ -406,73 +488,105 @@ void CodebaseFromFS::sync(bool force, const std::function<void(bool)> &on_update
     Net::current().post([=]() { on_update(true); });
   } else {
     std::lock_guard<std::mutex> lock(m_mutex);
-    for (auto &p : m_watched_files) {
-      auto &path = p.first;
-      auto &file = p.second;
-      auto &watches = file.watches;
-      auto i = watches.begin();
-      while (i != watches.end()) {
-        const auto w = i++;
-        if ((*w)->closed()) {
-          watches.erase(w);
-        }
+#ifdef __linux__
+    if (m_inotify >= 0) {
+      start_notifier();
+      read_notifications();
+      check_changes(false);
+      return;
+    }
+#endif
+    check_changes(true);
+  }
+}
+
+void CodebaseFromFS::stop_watching() {
+#ifdef __linux__
+  if (m_inotify_stream) {
+    m_inotify_stream->release();
+    m_inotify_stream.reset();
+  }
+  if (m_debounce_timer) {
+    m_debounce_timer->cancel();
+    m_debounce_timer.reset();
+  }
+  m_debouncing = false;
+#endif
+}
+
+void CodebaseFromFS::check_changes(bool all) {
+  all = all || m_dirty_all;
+  for (auto &p : m_watched_files) {
+    auto &path = p.first;
+    auto &file = p.second;
+    auto &watches = file.watches;
+    auto i = watches.begin();
+    while (i != watches.end()) {
+      const auto w = i++;
+      if ((*w)->closed()) {
+        watches.erase(w);
       }
-      if (!watches.empty()) {
-        auto norm_path = utils::path_normalize(path);
-        auto full_path = utils::path_join(m_base, norm_path);
-        auto t = fs::get_file_time(full_path);
-        if (t != file.time) {
-          file.time = t;
-          std::list<std::string> pathnames;
-          pathnames.push_back(norm_path);
-          for (const auto &w : watches) notify(w, pathnames);
-        }
+    }
+    if (!watches.empty() && (all || file.polled || is_dirty(utils::path_dirname(path), false))) {
+      auto norm_path = utils::path_normalize(path);
+      auto full_path = utils::path_join(m_base, norm_path);
+      file.polled = !watch_dir(utils::path_dirname(norm_path));
+      auto t = fs::get_file_time(full_path);
+      if (t != file.time) {
+        file.time = t;
+        std::list<std::string> pathnames;
+        pathnames.push_back(norm_path);
+        for (const auto &w : watches) notify(w, pathnames);
       }
     }
-    for (auto &p : m_watched_dirs) {
-      auto &path = p.first;
-      auto &dir = p.second;
-      auto &watches = dir.watches;
-      auto i = watches.begin();
-      while (i != watches.end()) {
-        const auto w = i++;
-        if ((*w)->closed()) {
-          watches.erase(w);
-        }
+  }
+  for (auto &p : m_watched_dirs) {
+    auto &path = p.first;
+    auto &dir = p.second;
+    auto &watches = dir.watches;
+    auto i = watches.begin();
+    while (i != watches.end()) {
+      const auto w = i++;
+      if ((*w)->closed()) {
+        watches.erase(w);
       }
-      if (!watches.empty()) {
-        std::map<std::string, double> times;
-        std::list<std::string> changes;
-        auto norm_path = utils::path_normalize(path);
-        list_file_times(norm_path, times);
-        for (const auto &old : dir.times) {
-          if (times.find(old.first) == times.end()) {
-            changes.push_back(old.first);
-          }
+    }
+    if (!watches.empty() && (all || dir.polled || is_dirty(path, true))) {
+      std::map<std::string, double> times;
+      std::list<std::string> changes;
+      auto norm_path = utils::path_normalize(path);
+      dir.polled = !list_file_times(norm_path, times);
+      for (const auto &old : dir.times) {
+        if (times.find(old.first) == times.end()) {
+          changes.push_back(old.first);
         }
-        for (const auto &cur : times) {
-          auto i = dir.times.find(cur.first);
-          if (i != dir.times.end()) {
-            if (i->second == cur.second) continue;
-          }
-          changes.push_back(cur.first);
+      }
+      for (const auto &cur : times) {
+        auto i = dir.times.find(cur.first);
+        if (i != dir.times.end()) {
+          if (i->second == cur.second) continue;
         }
-        dir.times = std::move(times);
-        if (changes.size() > 0) {
-          for (const auto &w : watches) {
-            notify(w, changes);
-          }
+        changes.push_back(cur.first);
+      }
+      dir.times = std::move(times);
+      if (changes.size() > 0) {
+        for (const auto &w : watches) {
+          notify(w, changes);
         }
       }
     }
   }
+  m_dirty_dirs.clear();
+  m_dirty_all = false;
 }
 
-void CodebaseFromFS::list_file_times(const std::string &path, std::map<std::string, double> &times) {
+bool CodebaseFromFS::list_file_times(const std::string &path, std::map<std::string, double> &times) {
+  bool watched = true;
   std::function<void(const std::string &, std::map<std::string, double> &)> traverse;
   traverse = [&](const std::string &path, std::map<std::string, double> &times) {
     std::list<std::string> names;
     auto real_path = utils::path_join(m_base, path);
+    if (!watch_dir(path)) watched = false;
     fs::read_dir(real_path, names);
     for (const auto &name : names) {
       auto pathname = utils::path_join(path, name);
@@ -485,8 +599,109 @@ void CodebaseFromFS::list_file_times(const std::string &path, std::map<std::stri
     }
   };
   traverse(path, times);
+  return watched;
+}
+
+bool CodebaseFromFS::is_dirty(const std::string &path, bool recursive) {
+  auto dir = utils::path_normalize(path);
+  if (!recursive) return m_dirty_dirs.count(dir) > 0;
+  if (dir == "/") return !m_dirty_dirs.empty();
+  for (const auto &d : m_dirty_dirs) {
+    if (d == dir) return true;
+    if (d.length() > dir.length() && d[dir.length()] == '/' && d.compare(0, dir.length(), dir) == 0) return true;
+  }
+  return false;
 }
 
+#ifdef __linux__
+
+bool CodebaseFromFS::watch_dir(const std::string &path) {
+  if (m_inotify < 0) return false;
+  auto dir = utils::path_normalize(path);
+  if (m_inotify_dirs.count(dir)) return true;
+  auto full_path = utils::path_join(m_base, dir);
+  auto wd = inotify_add_watch(
+    m_inotify, full_path.c_str(),
+    IN_ONLYDIR | IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB |
+    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF
+  );
+  if (wd < 0) return false;
+  m_inotify_dirs[dir] = wd;
+  m_inotify_paths[wd] = dir;
+  return true;
+}
+
+//
+// The notifier is only started by periodic syncs, as it keeps the event
+// loop busy until stop_watching(). Anything that changed while it was
+// not running is found by checking everything once.
+//
+
+void CodebaseFromFS::start_notifier() {
+  if (m_inotify < 0 || m_inotify_stream) return;
+  m_inotify_stream.reset(new asio::posix::stream_descriptor(Net::context(), m_inotify));
+  m_debounce_timer.reset(new Timer);
+  m_dirty_all = true;
+  wait_notifications();
+}
+
+void CodebaseFromFS::wait_notifications() {
+  m_inotify_stream->async_wait(
+    asio::posix::stream_descriptor::wait_read,
+    [this](const std::error_code &ec) {
+      if (ec || !m_inotify_stream) return;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        read_notifications();
+      }
+      if (!m_debouncing) {
+        m_debouncing = true;
+        m_debounce_timer->schedule(
+          NOTIFY_DEBOUNCE_TIME,
+          [this]() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_debouncing = false;
+            read_notifications();
+            check_changes(false);
+          }
+        );
+      }
+      wait_notifications();
+    }
+  );
+}
+
+void CodebaseFromFS::read_notifications() {
+  alignas(struct inotify_event) char buf[4096];
+  for (;;) {
+    auto n = ::read(m_inotify, buf, sizeof(buf));
+    if (n <= 0) break;
+    for (auto p = buf; p < buf + n; ) {
+      auto e = (const struct inotify_event *)p;
+      p += sizeof(*e) + e->len;
+      if (e->mask & IN_Q_OVERFLOW) {
+        m_dirty_all = true;
+        continue;
+      }
+      auto i = m_inotify_paths.find(e->wd);
+      if (i == m_inotify_paths.end()) continue;
+      m_dirty_dirs.insert(i->second);
+      if (e->mask & IN_IGNORED) {
+        m_inotify_dirs.erase(i->second);
+        m_inotify_paths.erase(i);
+      }
+    }
+  }
+}
+
+#else // !__linux__
+
+bool CodebaseFromFS::watch_dir(const std::string &) {
+  return false;
+}
+
+#endif // __linux__
+
 //
 // CodebaseFromStore
 //
@@ -579,10 +794,129 @@ void CodebaseFromStore::sync(bool force, const std::function<void(bool)> &on_upd
   }
 }
 
+//
+// CodebaseFromSnapshot
+//
+// Serves the files packed by Codebase::snapshot() from a local tarball, so
+// that starting from a snapshot never goes to the repo or the filesystem
+// for individual modules.
+//
+
+class CodebaseFromSnapshot : public CodebasePatchable {
+public:
+  CodebaseFromSnapshot(const std::string &filename);
+
+  virtual auto version() const -> const std::string& override { return m_version; }
+  virtual bool writable() const override { return false; }
+  virtual auto entry() const -> const std::string& override { return m_entry; }
+  virtual void entry(const std::string &path) override {}
+  virtual void mount(const std::string &path, Codebase *codebase) override;
+  virtual auto list(const std::string &path) -> std::list<std::string> override;
+  virtual auto get(const std::string &path) -> SharedData* override;
+  virtual void set(const std::string &path, SharedData *data) override {}
+  virtual auto watch(const std::string &path, const std::function<void(const std::list<std::string> &)> &on_update) -> Watch* override;
+  virtual void sync(bool force, const std::function<void(bool)> &on_update) override;
+
+private:
+  std::string m_version;
+  std::string m_entry;
+  std::map<std::string, pjs::Ref<SharedData>> m_files;
+};
+
+CodebaseFromSnapshot::CodebaseFromSnapshot(const std::string &filename) {
+  std::vector<uint8_t> buf;
+  if (!fs::read_file(filename, buf)) {
+    std::string msg("Cannot read snapshot: ");
+    throw std::runtime_error(msg + filename);
+  }
+
+  Tarball tarball((const char *)buf.data(), buf.size());
+  std::set<std::string> paths;
+  tarball.list(paths);
+
+  for (const auto &path : paths) {
+    size_t size = 0;
+    auto ptr = tarball.get(path, size);
+    auto k = normalize_path(path);
+    if (k == s_snapshot_info) {
+      std::istringstream ss(std::string(ptr, size));
+      std::string line;
+      while (std::getline(ss, line)) {
+        auto i = line.find('=');
+        if (i == std::string::npos) continue;
+        auto key = line.substr(0, i);
+        if (key == "entry") m_entry = line.substr(i + 1);
+        else if (key == "version") m_version = line.substr(i + 1);
+      }
+    } else {
+      Data data(ptr, size, &s_dp);
+      m_files[k] = SharedData::make(data);
+    }
+  }
+
+  if (m_entry.empty()) {
+    std::string msg("Invalid snapshot: ");
+    throw std::runtime_error(msg + filename);
+  }
+}
+
+void CodebaseFromSnapshot::mount(const std::string &, Codebase *) {
+  throw std::runtime_error("mounting unsupported");
+}
+
+auto CodebaseFromSnapshot::list(const std::string &path) -> std::list<std::string> {
+  std::set<std::string> names;
+  auto n = path.length();
+  for (const auto &i : m_files) {
+    const auto &name = i.first;
+    if (name.length() > n && name[n] == '/' && utils::starts_with(name, path)) {
+      auto i = name.find('/', n + 1);
+      if (i == std::string::npos) {
+        names.insert(name.substr(n + 1));
+      } else {
+        names.insert(name.substr(n + 1, i - n));
+      }
+    }
+  }
+  std::list<std::string> list;
+  for (const auto &name : names) list.push_back(name);
+  return list;
+}
+
+auto CodebaseFromSnapshot::get(const std::string &path) -> SharedData* {
+  if (auto data = CodebasePatchable::get(path)) return data;
+  auto i = m_files.find(normalize_path(path));
+  if (i == m_files.end()) return nullptr;
+  return i->second->retain();
+}
+
+auto CodebaseFromSnapshot::watch(const std::string &path, const std::function<void(const std::list<std::string> &)> &on_update) -> Watch* {
+  return new Watch(on_update);
+}
+
+void CodebaseFromSnapshot::sync(bool force, const std::function<void(bool)> &on_update) {
+  if (force) {
+    Net::current().post([=]() { on_update(true); });
+  }
+}
+
 //
 // CodebaseFromHTTP
 //
 
+static void parse_etags(const std::string &text, std::map<std::string, std::string> &etags) {
+  for (const auto &line : utils::split(text, '\n')) {
+    auto entry = utils::trim(line);
+    if (entry.empty()) continue;
+    auto p = entry.find('#');
+    if (p == std::string::npos) {
+      etags[entry] = std::string();
+    } else {
+      etags[entry.substr(0,p)] = entry.substr(p+1);
+    }
+  }
+}
+
 class CodebaseFromHTTP : public CodebasePatchable {
 public:
   CodebaseFromHTTP(const std::string &url, const Fetch::Options &options);
@@ -628,6 +962,7 @@ private:
   std::mutex m_mutex;
 
   void download(const std::function<void(bool)> &on_update);
+  void download_changed(const std::function<void(bool)> &on_update);
   void download_next(const std::function<void(bool)> &on_update);
   void watch_next();
   void watch_all();
@@ -725,8 +1060,8 @@ void CodebaseFromHTTP::sync(bool force, const std::function<void(bool)> &on_upda
       }
 
       pjs::Value etag, date;
-      head->headers->get(s_etag, etag);
-      head->headers->get(s_date, date);
+      head->headers()->get(s_etag, etag);
+      head->headers()->get(s_date, date);
 
       std::string etag_str;
       std::string date_str;
@@ -777,8 +1112,8 @@ void CodebaseFromHTTP::download(const std::function<void(bool)> &on_update) {
       }
 
       pjs::Value etag, date;
-      head->headers->get(s_etag, etag);
-      head->headers->get(s_date, date);
+      head->headers()->get(s_etag, etag);
+      head->headers()->get(s_date, date);
       if (etag.is_string()) m_etag = etag.s()->str(); else m_etag.clear();
       if (date.is_string()) m_date = date.s()->str(); else m_date.clear();
 
@@ -796,8 +1131,12 @@ void CodebaseFromHTTP::download(const std::function<void(bool)> &on_update) {
           if (!path.empty()) m_dl_list.push_back(path);
         }
         m_entry = m_dl_list.front();
-        m_file_etags.clear();
-        download_next(on_update);
+        if (m_downloaded && !m_file_etags.empty()) {
+          download_changed(on_update);
+        } else {
+          m_file_etags.clear();
+          download_next(on_update);
+        }
       } else {
         m_mutex.lock();
         m_files.clear();
@@ -813,6 +1152,56 @@ void CodebaseFromHTTP::download(const std::function<void(bool)> &on_update) {
   );
 }
 
+//
+// Files whose etags have not changed since the last download are reused
+// from the current copy, and only the rest are fetched from the repo.
+//
+
+void CodebaseFromHTTP::download_changed(const std::function<void(bool)> &on_update) {
+  m_fetch(
+    Fetch::GET,
+    pjs::Value(m_base + "/_etags").s(),
+    nullptr,
+    nullptr,
+    [=](http::ResponseHead *head, Data *body) {
+      std::map<std::string, std::string> etags;
+      if (head && head->status == 200 && body) {
+        parse_etags(body->to_string(), etags);
+      }
+
+      std::map<std::string, std::string> kept;
+      std::list<std::string> changed;
+      m_mutex.lock();
+      for (const auto &name : m_dl_list) {
+        auto i = etags.find(name);
+        auto j = m_file_etags.find(name);
+        auto k = m_files.find(name);
+        if (
+          i != etags.end() && !i->second.empty() &&
+          j != m_file_etags.end() && j->second == i->second &&
+          k != m_files.end()
+        ) {
+          m_dl_temp[name] = k->second;
+          kept[name] = i->second;
+        } else {
+          changed.push_back(name);
+        }
+      }
+      m_mutex.unlock();
+
+      Log::info(
+        "[codebase] %d of %d files changed",
+        int(changed.size()),
+        int(m_dl_list.size())
+      );
+
+      m_file_etags.swap(kept);
+      m_dl_list.swap(changed);
+      download_next(on_update);
+    }
+  );
+}
+
 void CodebaseFromHTTP::download_next(const std::function<void(bool)> &on_update) {
   if (m_dl_list.empty()) {
     if (on_update) {
@@ -865,6 +1254,7 @@ void CodebaseFromHTTP::download_next(const std::function<void(bool)> &on_update)
     [=](http::ResponseHead *head, Data *body) {
       if (!head || head->status != 200 || !body) {
         response_error("GET", path.c_str(), head);
+        m_file_etags.clear();
         on_update(false);
         return;
 
@@ -878,7 +1268,7 @@ void CodebaseFromHTTP::download_next(const std::function<void(bool)> &on_update)
 
       std::string etag;
       pjs::Value etag_val;
-      head->headers->get(s_etag, etag_val);
+      head->headers()->get(s_etag, etag_val);
       if (etag_val.is_string()) etag = etag_val.s()->str();
       m_file_etags[name] = etag;
 
@@ -908,8 +1298,8 @@ void CodebaseFromHTTP::watch_next() {
     [=](http::ResponseHead *head, Data *body) {
       if (head && head->status == 200) {
         pjs::Value etag, date;
-        head->headers->get(s_etag, etag);
-        head->headers->get(s_date, date);
+        head->headers()->get(s_etag, etag);
+        head->headers()->get(s_date, date);
 
         std::string etag_str;
         std::string date_str;
@@ -937,8 +1327,8 @@ void CodebaseFromHTTP::watch_next() {
                   if (i != m_watched_files.end()) {
                     auto &wf = i->second;
                     pjs::Value etag, date;
-                    head->headers->get(s_etag, etag);
-                    head->headers->get(s_date, date);
+                    head->headers()->get(s_etag, etag);
+                    head->headers()->get(s_date, date);
                     if (etag.is_string()) wf.etag = etag.s()->str(); else wf.etag.clear();
                     if (date.is_string()) wf.date = date.s()->str(); else wf.date.clear();
                     m_files[name] = SharedData::make(body ? *body : Data());
@@ -975,26 +1365,14 @@ void CodebaseFromHTTP::watch_all() {
     nullptr,
     [=](http::ResponseHead *head, Data *body) {
       if (head && head->status == 200 && body) {
-        auto text = body->to_string();
-        auto lines = utils::split(text, '\n');
         std::map<std::string, std::string> etags;
         std::set<std::string> changed;
-        for (const auto &line : lines) {
-          auto entry = utils::trim(line);
-          if (entry.empty()) continue;
-          std::string path, etag;
-          auto p = entry.find('#');
-          if (p == std::string::npos) {
-            path = entry;
-          } else {
-            path = entry.substr(0,p);
-            etag = entry.substr(p+1);
-          }
-          auto i = m_file_etags.find(path);
-          if (i == m_file_etags.end() || i->second != etag) {
-            changed.insert(path);
+        parse_etags(body->to_string(), etags);
+        for (const auto &p : etags) {
+          auto i = m_file_etags.find(p.first);
+          if (i == m_file_etags.end() || i->second != p.second) {
+            changed.insert(p.first);
           }
-          etags[path] = etag;
         }
         for (const auto &p : m_file_etags) {
           if (etags.count(p.first) == 0) {
@@ -1057,6 +1435,46 @@ Codebase* Codebase::from_http(const std::string &url, const Fetch::Options &opti
   return new CodebaseFromHTTP(url, options);
 }
 
+Codebase* Codebase::from_snapshot(const std::string &filename) {
+  return new CodebaseFromSnapshot(filename);
+}
+
+void Codebase::snapshot(const std::string &filename) {
+  if (entry().empty()) throw std::runtime_error("codebase has no entry");
+
+  TarballWriter tarball;
+
+  std::function<void(const std::string &)> pack;
+  pack = [&](const std::string &dir) {
+    for (const auto &name : list(dir)) {
+      if (name.empty()) continue;
+      if (name.back() == '/') {
+        pack(dir + '/' + name.substr(0, name.length() - 1));
+      } else {
+        auto path = dir + '/' + name;
+        pjs::Ref<SharedData> sd(get(path));
+        if (!sd) continue;
+        Data data;
+        sd->to_data(data);
+        auto bytes = data.to_bytes();
+        tarball.add(path, (const char *)bytes.data(), bytes.size());
+      }
+    }
+  };
+
+  pack("");
+
+  auto info = "entry=" + entry() + "\nversion=" + version() + "\n";
+  tarball.add(s_snapshot_info, info.c_str(), info.length());
+
+  const auto &buf = tarball.finish();
+  std::vector<uint8_t> bytes(buf.begin(), buf.end());
+  if (!fs::write_file(filename, bytes)) {
+    std::string msg("Cannot write snapshot: ");
+    throw std::runtime_error(msg + filename);
+  }
+}
+
 auto Codebase::normalize_path(const std::string &path) -> std::string {
   std::string k = path;
   if (k.empty() || k.front() != '/') {
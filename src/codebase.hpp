@@ -86,13 +86,28 @@ public:
     friend class Codebase;
   };
 
+  //
+  // Codebase::Recorder
+  //
+  // Sees every file read through the current codebase on this thread,
+  // so that a worker can tell later whether anything it loaded changed.
+  //
+
+  class Recorder {
+  public:
+    virtual void on_codebase_read(const std::string &path, SharedData *data) = 0;
+  };
+
   static auto current() -> Codebase* { return s_current; }
+  static auto recorder() -> Recorder* { return s_recorder; }
+  static void recorder(Recorder *r) { s_recorder = r; }
 
   static Codebase* from_root(Codebase *root);
   static Codebase* from_fs(const std::string &path);
   static Codebase* from_fs(const std::string &path, const std::string &script);
   static Codebase* from_store(CodebaseStore *store, const std::string &name);
   static Codebase* from_http(const std::string &url, const Fetch::Options &options);
+  static Codebase* from_snapshot(const std::string &filename);
 
   void set_current() {
     if (s_current) s_current->deactivate();
@@ -114,6 +129,11 @@ public:
   virtual auto watch(const std::string &path, const std::function<void(const std::list<std::string> &)> &on_update) -> Watch* = 0;
   virtual void sync(bool force, const std::function<void(bool)> &on_update) = 0;
 
+  // Stops whatever keeps watching for changes in between periodic syncs
+  virtual void stop_watching() {}
+
+  void snapshot(const std::string &filename);
+
 protected:
   virtual void activate() {};
   virtual void deactivate() {};
@@ -125,6 +145,7 @@ protected:
 
 private:
   static Codebase* s_current;
+  thread_local static Recorder* s_recorder;
 };
 
 } // namespace pipy
@@ -25,6 +25,9 @@
 
 #include "compressor.hpp"
 #include "data.hpp"
+#include "input.hpp"
+#include "net.hpp"
+#include "thread-pool.hpp"
 #include "pjs/pjs.hpp"
 
 #define ZLIB_CONST
@@ -32,6 +35,10 @@
 
 #include <brotli/decode.h>
 
+#include <atomic>
+#include <deque>
+#include <memory>
+
 namespace pipy {
 
 static Data::Producer s_dp_inflate("inflate");
@@ -43,19 +50,21 @@ static Data::Producer s_dp_brotli("brotli");
 
 class Inflate : public pjs::Pooled<Inflate>, public Decompressor {
 public:
-  Inflate(const std::function<void(Data&)> &out, bool gzip)
+  Inflate(const std::function<void(Data&)> &out, int window_bits, const std::string *dictionary = nullptr)
     : m_out(out)
+    , m_dictionary(dictionary)
   {
     m_zs.zalloc = Z_NULL;
     m_zs.zfree = Z_NULL;
     m_zs.opaque = Z_NULL;
     m_zs.next_in = Z_NULL;
     m_zs.avail_in = 0;
-    inflateInit2(&m_zs, gzip ? 16 + MAX_WBITS : MAX_WBITS);
+    inflateInit2(&m_zs, window_bits);
   }
 
 private:
   const std::function<void(Data&)> m_out;
+  const std::string* m_dictionary;
   z_stream m_zs;
   bool m_done = false;
 
@@ -77,6 +86,15 @@ private:
         m_zs.next_out = buf;
         m_zs.avail_out = sizeof(buf);
         auto ret = ::inflate(&m_zs, Z_NO_FLUSH);
+        if (ret == Z_NEED_DICT) {
+          if (!m_dictionary) return false;
+          if (inflateSetDictionary(
+            &m_zs,
+            (const Bytef *)m_dictionary->c_str(),
+            m_dictionary->size()
+          ) != Z_OK) return false;
+          ret = ::inflate(&m_zs, Z_NO_FLUSH);
+        }
         if (auto size = sizeof(buf) - m_zs.avail_out) {
           db.push(buf, size);
         }
@@ -193,7 +211,7 @@ public:
     gzip,
   };
 
-  Deflate(const Output &out, bool gzip)
+  Deflate(const Output &out, int window_bits, const std::string *dictionary = nullptr)
     : m_out(out)
   {
     m_zs.zalloc = Z_NULL;
@@ -206,10 +224,18 @@ public:
       &m_zs,
       Z_DEFAULT_COMPRESSION,
       Z_DEFLATED,
-      gzip ? 16 + MAX_WBITS : MAX_WBITS,
+      window_bits,
       8,
       Z_DEFAULT_STRATEGY
     );
+
+    if (dictionary) {
+      deflateSetDictionary(
+        &m_zs,
+        (const Bytef *)dictionary->c_str(),
+        dictionary->size()
+      );
+    }
   }
 
 private:
@@ -227,7 +253,7 @@ private:
     for (const auto chk : data.chunks()) {
       auto buf = std::get<0>(chk);
       auto len = std::get<1>(chk);
-      if (!deflate(buf, len, flush, db)) return false;
+      if (!deflate(buf, len, flush ? Z_FINISH : Z_NO_FLUSH, db)) return false;
     }
 
     db.flush();
@@ -238,25 +264,38 @@ private:
   virtual bool flush() override {
     Data output;
     Data::Builder db(output, &s_dp);
-    if (!deflate(nullptr, 0, true, db)) return false;
+    if (!deflate(nullptr, 0, Z_FINISH, db)) return false;
+    db.flush();
+    m_out(output);
+    return true;
+  }
+
+  virtual bool sync() override {
+    Data output;
+    Data::Builder db(output, &s_dp);
+    if (!deflate(nullptr, 0, Z_SYNC_FLUSH, db)) return false;
     db.flush();
     m_out(output);
     return true;
   }
 
+  virtual void reset() override {
+    deflateReset(&m_zs);
+  }
+
   virtual bool finalize() override {
     delete this;
     return true;
   }
 
-  bool deflate(const char *data, size_t size, bool flush, Data::Builder &db) {
+  bool deflate(const char *data, size_t size, int flush, Data::Builder &db) {
     unsigned char buf[DATA_CHUNK_SIZE];
     m_zs.next_in = (const Bytef *)data;
     m_zs.avail_in = size;
     do {
       m_zs.next_out = buf;
       m_zs.avail_out = sizeof(buf);
-      auto ret = ::deflate(&m_zs, flush ? Z_FINISH : Z_NO_FLUSH);
+      auto ret = ::deflate(&m_zs, flush);
       if (ret == Z_STREAM_ERROR) return false;
       if (auto size = sizeof(buf) - m_zs.avail_out) db.push(buf, size);
     } while (m_zs.avail_out == 0);
@@ -268,16 +307,239 @@ private:
 
 Data::Producer Deflate::s_dp("Compress (defalte)");
 
+//
+// ParallelDeflate
+//
+// Blocks are raw deflate streams ended with a sync flush, except for the
+// last one, so that they concatenate into one valid stream. Checksums are
+// computed per block and combined in order when the blocks come back.
+//
+
+class ParallelDeflate : public pjs::Pooled<ParallelDeflate>, public ParallelCompressor {
+public:
+  ParallelDeflate(const Output &out, bool gzip, const std::string *dictionary = nullptr)
+    : m_out(out)
+    , m_net(&Net::current())
+    , m_alive(std::make_shared<bool>(true))
+    , m_gzip(gzip)
+  {
+    if (dictionary && !gzip) m_tail = *dictionary;
+    m_check = gzip ? crc32(0, Z_NULL, 0) : adler32(0, Z_NULL, 0);
+    write_header(dictionary);
+  }
+
+private:
+  static const size_t BLOCK_SIZE = 128 * 1024;
+  static const size_t WINDOW_SIZE = 32 * 1024;
+
+  struct Block {
+    std::string input;
+    std::string dictionary;
+    std::string output;
+    size_t size = 0;
+    uLong check = 0;
+    bool gzip = false;
+    bool last = false;
+    std::atomic<bool> done;
+    Block() : done(false) {}
+  };
+
+  Output m_out;
+  Net* m_net;
+  std::shared_ptr<bool> m_alive;
+  std::deque<std::shared_ptr<Block>> m_blocks;
+  std::string m_current;
+  std::string m_tail;
+  std::string m_header;
+  std::function<void()> m_done;
+  size_t m_pending = 0;
+  size_t m_total_size = 0;
+  uLong m_check;
+  bool m_gzip;
+
+  ~ParallelDeflate() {}
+
+  virtual auto pending() const -> size_t override {
+    return m_pending + m_current.size();
+  }
+
+  virtual void input(const Data &data) override {
+    for (const auto c : data.chunks()) {
+      auto ptr = std::get<0>(c);
+      auto len = std::get<1>(c);
+      while (len > 0) {
+        auto n = std::min((size_t)len, BLOCK_SIZE - m_current.size());
+        m_current.append(ptr, n);
+        ptr += n;
+        len -= n;
+        if (m_current.size() == BLOCK_SIZE) submit(false);
+      }
+    }
+  }
+
+  virtual void end(const std::function<void()> &done) override {
+    m_done = done;
+    submit(true);
+  }
+
+  virtual void finalize() override {
+    delete this;
+  }
+
+  void write_header(const std::string *dictionary) {
+    if (m_gzip) {
+      static const char header[] = { 0x1f, (char)0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+      m_header.assign(header, sizeof(header));
+    } else {
+      int cmf = 0x78, flg = 2 << 6;
+      if (dictionary) flg |= 0x20;
+      if (auto r = (cmf * 256 + flg) % 31) flg += 31 - r;
+      m_header.push_back(cmf);
+      m_header.push_back(flg);
+      if (dictionary) {
+        auto id = adler32(adler32(0, Z_NULL, 0), (const Bytef *)dictionary->c_str(), dictionary->size());
+        m_header.push_back(id >> 24);
+        m_header.push_back(id >> 16);
+        m_header.push_back(id >> 8);
+        m_header.push_back(id >> 0);
+      }
+    }
+  }
+
+  void submit(bool last) {
+    auto block = std::make_shared<Block>();
+    block->input.swap(m_current);
+    block->dictionary = m_tail;
+    block->size = block->input.size();
+    block->gzip = m_gzip;
+    block->last = last;
+    if (block->size >= WINDOW_SIZE) {
+      m_tail.assign(block->input, block->size - WINDOW_SIZE, WINDOW_SIZE);
+    } else {
+      m_tail.append(block->input);
+      if (m_tail.size() > WINDOW_SIZE) m_tail.erase(0, m_tail.size() - WINDOW_SIZE);
+    }
+    m_pending += block->size;
+    m_blocks.push_back(block);
+
+    auto net = m_net;
+    std::weak_ptr<bool> alive(m_alive);
+    ThreadPool::shared().run(
+      [=]() {
+        compress(*block);
+        block->done.store(true, std::memory_order_release);
+        net->post(
+          [=]() {
+            if (alive.lock()) {
+              InputContext ic;
+              deliver();
+            }
+          }
+        );
+      }
+    );
+  }
+
+  // Runs on a pool thread
+  static void compress(Block &block) {
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    if (!block.dictionary.empty()) {
+      deflateSetDictionary(&zs, (const Bytef *)block.dictionary.c_str(), block.dictionary.size());
+    }
+    block.output.resize(deflateBound(&zs, block.size) + 16);
+    zs.next_in = (const Bytef *)block.input.c_str();
+    zs.avail_in = block.size;
+    zs.next_out = (Bytef *)&block.output[0];
+    zs.avail_out = block.output.size();
+    ::deflate(&zs, block.last ? Z_FINISH : Z_SYNC_FLUSH);
+    block.output.resize(block.output.size() - zs.avail_out);
+    deflateEnd(&zs);
+    auto ptr = (const Bytef *)block.input.c_str();
+    block.check = block.gzip
+      ? crc32(crc32(0, Z_NULL, 0), ptr, block.size)
+      : adler32(adler32(0, Z_NULL, 0), ptr, block.size);
+    std::string().swap(block.input);
+    std::string().swap(block.dictionary);
+  }
+
+  void deliver() {
+    Data output;
+    Data::Builder db(output, &s_dp);
+    bool finished = false;
+    if (!m_header.empty()) {
+      db.push(m_header.c_str(), m_header.size());
+      m_header.clear();
+    }
+    while (!m_blocks.empty() && m_blocks.front()->done.load(std::memory_order_acquire)) {
+      auto block = m_blocks.front();
+      m_blocks.pop_front();
+      m_pending -= block->size;
+      m_total_size += block->size;
+      m_check = m_gzip
+        ? crc32_combine(m_check, block->check, block->size)
+        : adler32_combine(m_check, block->check, block->size);
+      db.push(block->output.c_str(), block->output.size());
+      if (block->last) {
+        write_trailer(db);
+        finished = true;
+      }
+    }
+    db.flush();
+    if (!output.empty()) {
+      std::weak_ptr<bool> alive(m_alive);
+      m_out(output);
+      if (!alive.lock()) return;
+    }
+    if (finished && m_done) {
+      auto done = m_done;
+      m_done = nullptr;
+      done();
+    }
+  }
+
+  void write_trailer(Data::Builder &db) {
+    uint32_t n = m_check;
+    if (m_gzip) {
+      uint32_t size = m_total_size;
+      db.push(char(n >> 0));
+      db.push(char(n >> 8));
+      db.push(char(n >> 16));
+      db.push(char(n >> 24));
+      db.push(char(size >> 0));
+      db.push(char(size >> 8));
+      db.push(char(size >> 16));
+      db.push(char(size >> 24));
+    } else {
+      db.push(char(n >> 24));
+      db.push(char(n >> 16));
+      db.push(char(n >> 8));
+      db.push(char(n >> 0));
+    }
+  }
+
+  static Data::Producer s_dp;
+};
+
+Data::Producer ParallelDeflate::s_dp("Compress (parallel deflate)");
+
 //
 // Decompressor
 //
 
-Decompressor* Decompressor::inflate(const std::function<void(Data&)> &out) {
-  return new Inflate(out, false);
+Decompressor* Decompressor::inflate(const std::function<void(Data&)> &out, const std::string *dictionary) {
+  return new Inflate(out, MAX_WBITS, dictionary);
+}
+
+Decompressor* Decompressor::inflate_raw(const std::function<void(Data&)> &out) {
+  return new Inflate(out, -MAX_WBITS);
 }
 
 Decompressor* Decompressor::gzip(const std::function<void(Data&)> &out) {
-  return new Inflate(out, true);
+  return new Inflate(out, 16 + MAX_WBITS);
 }
 
 Decompressor* Decompressor::brotli(const std::function<void(Data&)> &out) {
@@ -288,12 +550,28 @@ Decompressor* Decompressor::brotli(const std::function<void(Data&)> &out) {
 // Compressor
 //
 
-Compressor *Compressor::deflate(const Output &out) {
-  return new Deflate(out, false);
+Compressor *Compressor::deflate(const Output &out, const std::string *dictionary) {
+  return new Deflate(out, MAX_WBITS, dictionary);
+}
+
+Compressor *Compressor::deflate_raw(const Output &out, int window_bits) {
+  return new Deflate(out, -window_bits);
 }
 
 Compressor *Compressor::gzip(const Output &out) {
-  return new Deflate(out, true);
+  return new Deflate(out, 16 + MAX_WBITS);
+}
+
+//
+// ParallelCompressor
+//
+
+ParallelCompressor* ParallelCompressor::deflate(const Output &out, const std::string *dictionary) {
+  return new ParallelDeflate(out, false, dictionary);
+}
+
+ParallelCompressor* ParallelCompressor::gzip(const Output &out) {
+  return new ParallelDeflate(out, true);
 }
 
 } // namespace pipy
@@ -28,6 +28,7 @@
 
 #include <cstddef>
 #include <functional>
+#include <string>
 
 namespace pipy {
 
@@ -41,7 +42,8 @@ class Decompressor {
 public:
   typedef std::function<void(Data&)> Output;
 
-  static Decompressor* inflate(const Output &out);
+  static Decompressor* inflate(const Output &out, const std::string *dictionary = nullptr);
+  static Decompressor* inflate_raw(const Output &out);
   static Decompressor* gzip(const Output &out);
   static Decompressor* brotli(const Output &out);
 
@@ -60,16 +62,54 @@ class Compressor {
 public:
   typedef std::function<void(Data&)> Output;
 
-  static Compressor* deflate(const Output &out);
+  static Compressor* deflate(const Output &out, const std::string *dictionary = nullptr);
+  static Compressor* deflate_raw(const Output &out, int window_bits = 15);
   static Compressor* gzip(const Output &out);
 
   virtual bool input(const Data &data, bool flush) = 0;
   virtual bool flush() = 0;
+
+  // Outputs all pending bytes ending with an empty stored block
+  virtual bool sync() = 0;
+
+  // Starts over with an empty window
+  virtual void reset() = 0;
+
   virtual bool finalize() = 0;
 
 protected:
   ~Compressor() {}
 };
+
+//
+// ParallelCompressor
+//
+// Compresses a stream in independent blocks on the shared thread pool,
+// each block primed with the tail of the one before it so that the ratio
+// stays close to that of a single stream. Output is delivered in order on
+// the thread that created the compressor, some time after the input.
+//
+
+class ParallelCompressor {
+public:
+  typedef std::function<void(Data&)> Output;
+
+  static ParallelCompressor* deflate(const Output &out, const std::string *dictionary = nullptr);
+  static ParallelCompressor* gzip(const Output &out);
+
+  // Size of the input not yet delivered as output
+  virtual auto pending() const -> size_t = 0;
+
+  virtual void input(const Data &data) = 0;
+  virtual void end(const std::function<void()> &done) = 0;
+
+  // Discards output still pending and frees the compressor
+  virtual void finalize() = 0;
+
+protected:
+  ~ParallelCompressor() {}
+};
+
 } // namespace pipy
 
 #endif // COMPRESSOR_HPP
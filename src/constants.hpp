@@ -29,6 +29,16 @@
 namespace pipy {
 
 const size_t DATA_CHUNK_SIZE = 0x4000;
+
+// Chunk sizes for Data in ascending order, DATA_CHUNK_SIZE being the default
+const int DATA_CHUNK_SIZE_CLASSES[] = { 0x200, 0x1000, 0x4000, 0x10000 };
+const int DATA_CHUNK_SIZE_CLASS_COUNT = sizeof(DATA_CHUNK_SIZE_CLASSES) / sizeof(int);
+const int DATA_CHUNK_SIZE_CLASS_DEFAULT = 2;
+
+// Views no longer than this are copied into the tail chunk of a Data
+// instead of being linked in, to keep the view list short
+const int DATA_VIEW_COMPACT_SIZE = 128;
+
 const size_t RECEIVE_BUFFER_SIZE = 0x4000;
 
 } // namespace pipy
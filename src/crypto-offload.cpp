@@ -0,0 +1,232 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "crypto-offload.hpp"
+
+#ifdef PIPY_HAS_CRYPTO_OFFLOAD
+
+#include "thread-pool.hpp"
+
+#include <openssl/async.h>
+#include <openssl/ec.h>
+#include <openssl/rsa.h>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+
+#endif // PIPY_HAS_CRYPTO_OFFLOAD
+
+namespace pipy {
+
+#ifdef PIPY_HAS_CRYPTO_OFFLOAD
+
+//
+// Async jobs run the whole handshake on their own stacks, including any
+// callbacks into scripts for SNI or ALPN selection, so the 32K stacks
+// OpenSSL allocates by default are not enough.
+//
+
+static const size_t ASYNC_STACK_SIZE = 1024 * 1024;
+
+static void* alloc_async_stack(size_t *num) {
+  *num = ASYNC_STACK_SIZE;
+  return std::malloc(ASYNC_STACK_SIZE);
+}
+
+static void free_async_stack(void *addr) {
+  std::free(addr);
+}
+
+//
+// OffloadTask
+//
+// Lives on the stack of the paused async job, which is only resumed
+// for good after the task is done, so all a pool thread touches stays
+// valid until it signals the wait fd.
+//
+
+struct OffloadTask {
+  std::function<int()> op;
+  int result = 0;
+  int fd = -1;
+  std::atomic<bool> done;
+  OffloadTask() : done(false) {}
+
+  void run() {
+    auto fd = this->fd;
+    result = op();
+    done.store(true, std::memory_order_release);
+    uint64_t n = 1;
+    while (::write(fd, &n, sizeof(n)) < 0 && errno == EINTR) {}
+  }
+};
+
+static const char s_wait_fd_key = 0;
+
+static void close_wait_fd(ASYNC_WAIT_CTX*, const void*, OSSL_ASYNC_FD fd, void*) {
+  ::close(fd);
+}
+
+static auto get_wait_fd(ASYNC_WAIT_CTX *wctx) -> int {
+  OSSL_ASYNC_FD fd;
+  void *custom = nullptr;
+  if (ASYNC_WAIT_CTX_get_fd(wctx, &s_wait_fd_key, &fd, &custom)) return fd;
+  fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) return -1;
+  if (!ASYNC_WAIT_CTX_set_wait_fd(wctx, &s_wait_fd_key, fd, nullptr, close_wait_fd)) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+//
+// Runs the operation on the shared thread pool when inside an async job and
+// pauses the job until it is done, or runs it right away otherwise.
+//
+
+static auto offload(const std::function<int()> &op) -> int {
+  auto job = ASYNC_get_current_job();
+  if (!job) return op();
+  auto fd = get_wait_fd(ASYNC_get_wait_ctx(job));
+  if (fd < 0) return op();
+
+  OffloadTask task;
+  task.op = op;
+  task.fd = fd;
+  ThreadPool::shared().run([&task]() { task.run(); });
+
+  while (!task.done.load(std::memory_order_acquire)) {
+    if (!ASYNC_pause_job()) {
+      while (!task.done.load(std::memory_order_acquire)) std::this_thread::yield();
+      break;
+    }
+  }
+
+  uint64_t n;
+  while (::read(fd, &n, sizeof(n)) > 0) {}
+  return task.result;
+}
+
+static auto rsa_priv_enc(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding) -> int {
+  return offload([=]() { return RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL())(flen, from, to, rsa, padding); });
+}
+
+static auto rsa_priv_dec(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding) -> int {
+  return offload([=]() { return RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL())(flen, from, to, rsa, padding); });
+}
+
+static auto ec_sign(
+  int type, const unsigned char *dgst, int dlen,
+  unsigned char *sig, unsigned int *siglen,
+  const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey
+) -> int {
+  int (*sign)(int, const unsigned char*, int, unsigned char*, unsigned int*, const BIGNUM*, const BIGNUM*, EC_KEY*) = nullptr;
+  EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &sign, nullptr, nullptr);
+  return offload([=]() { return sign(type, dgst, dlen, sig, siglen, kinv, r, eckey); });
+}
+
+struct Methods {
+  RSA_METHOD *rsa;
+  EC_KEY_METHOD *ec;
+
+  Methods() {
+    ASYNC_set_mem_functions(alloc_async_stack, free_async_stack);
+
+    rsa = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+    RSA_meth_set1_name(rsa, "pipy offloaded RSA");
+    RSA_meth_set_priv_enc(rsa, rsa_priv_enc);
+    RSA_meth_set_priv_dec(rsa, rsa_priv_dec);
+
+    int (*sign_setup)(EC_KEY*, BN_CTX*, BIGNUM**, BIGNUM**) = nullptr;
+    ECDSA_SIG* (*sign_sig)(const unsigned char*, int, const BIGNUM*, const BIGNUM*, EC_KEY*) = nullptr;
+    EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), nullptr, &sign_setup, &sign_sig);
+    ec = EC_KEY_METHOD_new(EC_KEY_OpenSSL());
+    EC_KEY_METHOD_set_sign(ec, ec_sign, sign_setup, sign_sig);
+  }
+
+  static auto get() -> const Methods& {
+    static Methods s_methods;
+    return s_methods;
+  }
+};
+
+void CryptoOffload::init() {
+  Methods::get();
+}
+
+//
+// Keys with non-default methods are treated by OpenSSL as "foreign" and
+// go through the legacy code paths that call the methods above, rather
+// than being exported to the default provider.
+//
+
+auto CryptoOffload::wrap(EVP_PKEY *pkey) -> EVP_PKEY* {
+  if (EVP_PKEY_get0_engine(pkey)) return nullptr;
+  const auto &methods = Methods::get();
+  switch (EVP_PKEY_get_base_id(pkey)) {
+    case EVP_PKEY_RSA: {
+      auto rsa = EVP_PKEY_get1_RSA(pkey);
+      if (!rsa) return nullptr;
+      auto dup = RSAPrivateKey_dup(rsa);
+      RSA_free(rsa);
+      if (!dup) return nullptr;
+      RSA_set_method(dup, methods.rsa);
+      auto wrapped = EVP_PKEY_new();
+      EVP_PKEY_assign_RSA(wrapped, dup);
+      return wrapped;
+    }
+    case EVP_PKEY_EC: {
+      auto ec = EVP_PKEY_get0_EC_KEY(pkey);
+      if (!ec) return nullptr;
+      auto dup = EC_KEY_dup(ec);
+      if (!dup) return nullptr;
+      EC_KEY_set_method(dup, methods.ec);
+      auto wrapped = EVP_PKEY_new();
+      EVP_PKEY_assign_EC_KEY(wrapped, dup);
+      return wrapped;
+    }
+    default: return nullptr;
+  }
+}
+
+#else // !PIPY_HAS_CRYPTO_OFFLOAD
+
+void CryptoOffload::init() {
+}
+
+auto CryptoOffload::wrap(EVP_PKEY *pkey) -> EVP_PKEY* {
+  return nullptr;
+}
+
+#endif // PIPY_HAS_CRYPTO_OFFLOAD
+
+} // namespace pipy
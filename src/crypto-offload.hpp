@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CRYPTO_OFFLOAD_HPP
+#define CRYPTO_OFFLOAD_HPP
+
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+
+//
+// Offloading needs ASYNC_set_mem_functions() to give async jobs larger
+// stacks, which OpenSSL only provides from 3.2 on.
+//
+
+#if defined(__linux__) && OPENSSL_VERSION_NUMBER >= 0x30200000L
+#define PIPY_HAS_CRYPTO_OFFLOAD
+#endif
+
+namespace pipy {
+
+//
+// CryptoOffload
+//
+// Private-key operations moved off the worker threads. A key wrapped by
+// wrap() carries RSA/EC methods that, when called from inside an OpenSSL
+// async job (SSL_MODE_ASYNC), hand the actual signing or decryption to a
+// shared pool of crypto threads and pause the job. The job's wait fd gets
+// signaled on completion so that the owner can resume the handshake.
+// Called outside of an async job, the wrapped key works synchronously.
+//
+
+class CryptoOffload {
+public:
+
+  // Must be called before any async job is started
+  static void init();
+
+  // Returns a new reference to a wrapped copy of the key, or nullptr
+  // when offloading is not supported for the key type or the platform
+  static auto wrap(EVP_PKEY *pkey) -> EVP_PKEY*;
+};
+
+} // namespace pipy
+
+#endif // CRYPTO_OFFLOAD_HPP
@@ -25,6 +25,7 @@
 
 #include "data.hpp"
 
+#include <cstring>
 #include <stdexcept>
 
 namespace pipy {
@@ -41,26 +42,66 @@ auto Data::Producer::producer_list_mutex() -> std::mutex& {
   return s_mutex;
 }
 
+std::atomic<bool> Data::Sampler::s_running(false);
+std::atomic<size_t> Data::Sampler::s_retained[Data::Sampler::MAX_SITES];
+thread_local int Data::Sampler::s_countdown = Data::Sampler::SAMPLE_INTERVAL;
+thread_local int Data::Sampler::s_current_site = 0;
+
+void Data::Sampler::collect(const std::function<void(int, size_t)> &cb) {
+  for (int i = 0; i < MAX_SITES; i++) {
+    if (auto n = s_retained[i].load(std::memory_order_relaxed)) {
+      cb(i, n * SAMPLE_INTERVAL);
+    }
+  }
+}
+
+auto Data::Chunk::pool(int size_class) -> pjs::Pool& {
+  thread_local static pjs::PooledClass s_classes[] = {
+    { "pipy::Data::Chunk<512>", sizeof(Chunk) + DATA_CHUNK_SIZE_CLASSES[0], true },
+    { "pipy::Data::Chunk<4K>", sizeof(Chunk) + DATA_CHUNK_SIZE_CLASSES[1], true },
+    { "pipy::Data::Chunk<16K>", sizeof(Chunk) + DATA_CHUNK_SIZE_CLASSES[2], true },
+    { "pipy::Data::Chunk<64K>", sizeof(Chunk) + DATA_CHUNK_SIZE_CLASSES[3], true },
+  };
+  static_assert(
+    sizeof(s_classes) / sizeof(s_classes[0]) == DATA_CHUNK_SIZE_CLASS_COUNT,
+    "one pool is needed for each chunk size class"
+  );
+  return s_classes[size_class].pool();
+}
+
+auto Data::thread_chunk_size() -> size_t {
+  size_t n = 0;
+  for (int i = 0; i < DATA_CHUNK_SIZE_CLASS_COUNT; i++) {
+    n += Chunk::pool(i).allocated() * DATA_CHUNK_SIZE_CLASSES[i];
+  }
+  return n;
+}
+
 void Data::pack(const Data &data, Producer *producer, double vacancy) {
+  pack(data, producer, vacancy, 0);
+}
+
+void Data::pack(const Data &data, Producer *producer, double vacancy, int min_view) {
   assert_same_thread(*this);
   if (&data == this) return;
   if (!producer) producer = &s_unknown_producer;
   auto occupancy = DATA_CHUNK_SIZE - int(DATA_CHUNK_SIZE * vacancy);
   for (auto view = data.m_head; view; view = view->next) {
     auto tail = m_tail;
-    if (!tail) {
+    if (!tail || (min_view > 0 && (view->length >= min_view || tail->length >= min_view))) {
       push_view(new View(view));
       continue;
     }
     auto tail_offset = tail->offset;
     auto tail_length = tail->length;
     if (tail_length < occupancy || view->length + tail_length <= DATA_CHUNK_SIZE) {
-      if (tail_offset > 0 || tail->chunk->retain_count > 1) {
-        tail = tail->clone(producer);
+      auto capacity = std::min(view->length + tail_length, int(DATA_CHUNK_SIZE));
+      if (tail_offset > 0 || tail->chunk->retain_count > 1 || tail->chunk->size() < capacity) {
+        tail = tail->clone(producer, capacity);
         delete pop_view();
-        push_view(tail);
+        link_view(tail);
       }
-      auto tail_room = DATA_CHUNK_SIZE - tail_length;
+      auto tail_room = tail->chunk->size() - tail_length;
       auto length = std::min(view->length, int(tail_room));
       std::memcpy(
         tail->chunk->data + tail_length,
@@ -119,41 +160,153 @@ auto Data::to_string(Encoding encoding) const -> std::string {
       return str;
     }
     case Encoding::hex: {
-      std::string str;
-      utils::HexEncoder encoder([&](char c) { str += c; });
+      std::string str(m_size * 2, '\0');
+      int n = 0;
       for (const auto c : chunks()) {
-        auto ptr = std::get<0>(c);
-        auto len = std::get<1>(c);
-        for (int i = 0; i < len; i++) encoder.input(ptr[i]);
-      }
-      return str;
-    }
-    case Encoding::base64: {
-      std::string str;
-      utils::Base64Encoder encoder([&](char c) { str += c; });
-      for (const auto c : chunks()) {
-        auto ptr = std::get<0>(c);
-        auto len = std::get<1>(c);
-        for (int i = 0; i < len; i++) encoder.input(ptr[i]);
+        n += utils::encode_hex(&str[n], std::get<0>(c), std::get<1>(c));
       }
-      encoder.flush();
       return str;
     }
+    case Encoding::base64:
     case Encoding::base64url: {
-      std::string str;
-      utils::Base64UrlEncoder encoder([&](char c) { str += c; });
+      auto encode = (encoding == Encoding::base64 ? utils::encode_base64 : utils::encode_base64url);
+      std::string str(utils::Base64Encoder::max_output_size(m_size), '\0');
+      uint8_t rest[3];
+      int rest_len = 0, n = 0;
+
+      // Chunks are encoded as a whole except for the bytes
+      // of a group that straddles two chunks
       for (const auto c : chunks()) {
-        auto ptr = std::get<0>(c);
+        auto ptr = (const uint8_t *)std::get<0>(c);
         auto len = std::get<1>(c);
-        for (int i = 0; i < len; i++) encoder.input(ptr[i]);
+        if (rest_len > 0) {
+          while (rest_len < 3 && len > 0) { rest[rest_len++] = *ptr++; len--; }
+          if (rest_len < 3) continue;
+          n += encode(&str[n], rest, 3);
+          rest_len = 0;
+        }
+        auto tail = len % 3;
+        n += encode(&str[n], ptr, len - tail);
+        for (int i = len - tail; i < len; i++) rest[rest_len++] = ptr[i];
       }
-      encoder.flush();
+      n += encode(&str[n], rest, rest_len);
+      str.resize(n);
       return str;
     }
     default: return to_string();
   }
 }
 
+auto Data::index_of(const char *pattern, int length, int start) const -> int {
+  if (start < 0) start = 0;
+  if (length <= 0) return std::min(start, m_size);
+  if (start + length > m_size) return -1;
+  auto first = pattern[0];
+  int base = 0;
+  for (auto view = m_head; view; view = view->next) {
+    auto len = view->length;
+    if (base + len > start) {
+      auto p = view->chunk->data + view->offset;
+      auto i = std::max(start - base, 0);
+      while (i < len) {
+        auto q = (const char *)std::memchr(p + i, first, len - i);
+        if (!q) break;
+        i = q - p;
+        if (base + i + length > m_size) return -1;
+        if (match_at(view, i, pattern, length)) return base + i;
+        i++;
+      }
+    }
+    base += len;
+  }
+  return -1;
+}
+
+auto Data::index_of(const Data &pattern, int start) const -> int {
+  if (!pattern.m_head) return index_of("", 0, start);
+  if (pattern.m_head == pattern.m_tail) {
+    auto v = pattern.m_head;
+    return index_of(v->chunk->data + v->offset, v->length, start);
+  }
+  auto bytes = pattern.to_bytes();
+  return index_of((const char *)bytes.data(), bytes.size(), start);
+}
+
+void Data::slice(int start, int end, Data &out) const {
+  if (start < 0) start = 0;
+  if (end > m_size) end = m_size;
+  int base = 0;
+  for (auto view = m_head; view && base < end; view = view->next) {
+    auto len = view->length;
+    auto a = std::max(start - base, 0);
+    auto b = std::min(end - base, len);
+    if (a < b) out.push_view(new View(view->chunk, view->offset + a, b - a));
+    base += len;
+  }
+}
+
+auto Data::peek(int offset, void *buf, int len) const -> int {
+  auto p = static_cast<char*>(buf);
+  int base = 0, n = 0;
+  for (auto view = m_head; view && n < len; view = view->next) {
+    auto l = view->length;
+    if (offset < base + l) {
+      auto i = std::max(offset + n - base, 0);
+      auto m = std::min(l - i, len - n);
+      std::memcpy(p + n, view->chunk->data + view->offset + i, m);
+      n += m;
+    }
+    base += l;
+  }
+  return n;
+}
+
+auto Data::compare(const Data &other) const -> int {
+  auto a = m_head; int i = 0;
+  auto b = other.m_head; int j = 0;
+  for (;;) {
+    while (a && i >= a->length) { a = a->next; i = 0; }
+    while (b && j >= b->length) { b = b->next; j = 0; }
+    if (!a || !b) break;
+    auto n = std::min(a->length - i, b->length - j);
+    auto r = std::memcmp(a->chunk->data + a->offset + i, b->chunk->data + b->offset + j, n);
+    if (r) return r < 0 ? -1 : 1;
+    i += n;
+    j += n;
+  }
+  if (a) return 1;
+  if (b) return -1;
+  return 0;
+}
+
+//
+// 32-bit FNV-1a so that the result is exact as a JavaScript number
+//
+
+auto Data::hash() const -> uint32_t {
+  uint32_t h = 2166136261u;
+  for (auto view = m_head; view; view = view->next) {
+    auto p = (const uint8_t *)view->chunk->data + view->offset;
+    for (int i = 0, n = view->length; i < n; i++) {
+      h ^= p[i];
+      h *= 16777619u;
+    }
+  }
+  return h;
+}
+
+bool Data::match_at(View *view, int offset, const char *pattern, int length) {
+  while (length > 0 && view) {
+    auto n = std::min(view->length - offset, length);
+    if (std::memcmp(view->chunk->data + view->offset + offset, pattern, n)) return false;
+    pattern += n;
+    length -= n;
+    view = view->next;
+    offset = 0;
+  }
+  return length == 0;
+}
+
 } // namespace pipy
 
 namespace pjs {
@@ -171,12 +324,37 @@ template<> void EnumDef<pipy::Data::Encoding>::init() {
 
 static pipy::Data::Producer s_dp("Script");
 
+//
+// Reads a number at a byte offset like DataView does,
+// copying no more than the bytes of the number itself
+//
+
+template<class T, class U>
+static void get_number(Context &ctx, Object *obj, Value &ret) {
+  int offset;
+  bool little_endian = false;
+  if (!ctx.arguments(1, &offset, &little_endian)) return;
+  uint8_t buf[sizeof(U)];
+  if (offset < 0 || obj->as<pipy::Data>()->peek(offset, buf, sizeof(U)) < int(sizeof(U))) {
+    ctx.error("offset out of range");
+    return;
+  }
+  U u = 0;
+  for (size_t i = 0; i < sizeof(U); i++) {
+    u = (u << 8) | buf[little_endian ? sizeof(U) - 1 - i : i];
+  }
+  T v;
+  std::memcpy(&v, &u, sizeof(v));
+  ret.set(double(v));
+}
+
 template<> void ClassDef<pipy::Data>::init() {
   super<Event>();
 
   ctor([](Context &ctx) -> Object* {
     Array *arr;
     Str *str;
+    Uint8Array *u8;
     EnumValue<pipy::Data::Encoding> encoding;
     pipy::Data *data;
     try {
@@ -191,14 +369,23 @@ template<> void ClassDef<pipy::Data>::init() {
             pipy::Data::Builder db(*data, &s_dp);
             for (int i = 0, n = arr->length(); i < n; i++) {
               Value v; arr->get(i, v);
-              db.push(v.to_int32());
+              if (v.is_string()) {
+                db.push(v.s()->str());
+              } else if (v.is<pipy::Data>()) {
+                db.flush();
+                data->push(*v.as<pipy::Data>());
+              } else {
+                db.push(v.to_int32());
+              }
             }
             db.flush();
             return data;
+          } else if (ctx.get(0, u8) && u8) {
+            return s_dp.make(u8->bytes(), u8->length());
           } else if (ctx.get(0, data)) {
             return pipy::Data::make(*data);
           } else {
-            ctx.error_argument_type(0, "a string, an array or a Data");
+            ctx.error_argument_type(0, "a string, an array, a Uint8Array or a Data");
             return nullptr;
           }
         default:
@@ -274,6 +461,85 @@ template<> void ClassDef<pipy::Data>::init() {
     ret.set(out);
   });
 
+  method("indexOf", [](Context &ctx, Object *obj, Value &ret) {
+    auto data = obj->as<pipy::Data>();
+    pipy::Data *pattern;
+    Str *str;
+    int start = 0;
+    if (ctx.try_arguments(1, &pattern, &start) && pattern) {
+      ret.set(data->index_of(*pattern, start));
+    } else if (ctx.try_arguments(1, &str, &start)) {
+      ret.set(data->index_of(str->c_str(), str->size(), start));
+    } else {
+      ctx.error_argument_type(0, "a Data or a string");
+    }
+  });
+
+  method("slice", [](Context &ctx, Object *obj, Value &ret) {
+    auto data = obj->as<pipy::Data>();
+    int size = data->size();
+    int start = 0, end = size;
+    if (!ctx.arguments(0, &start, &end)) return;
+    if (start < 0) start += size;
+    if (end < 0) end += size;
+    auto *out = pipy::Data::make();
+    data->slice(start, end, *out);
+    ret.set(out);
+  });
+
+  method("compare", [](Context &ctx, Object *obj, Value &ret) {
+    pipy::Data *other;
+    if (!ctx.arguments(1, &other)) return;
+    if (!other) { ctx.error_argument_type(0, "a Data"); return; }
+    ret.set(obj->as<pipy::Data>()->compare(*other));
+  });
+
+  method("hash", [](Context &ctx, Object *obj, Value &ret) {
+    ret.set(double(obj->as<pipy::Data>()->hash()));
+  });
+
+  method("getUint8", get_number<uint8_t, uint8_t>);
+  method("getInt8", get_number<int8_t, uint8_t>);
+  method("getUint16", get_number<uint16_t, uint16_t>);
+  method("getInt16", get_number<int16_t, uint16_t>);
+  method("getUint32", get_number<uint32_t, uint32_t>);
+  method("getInt32", get_number<int32_t, uint32_t>);
+  method("getFloat32", get_number<float, uint32_t>);
+  method("getFloat64", get_number<double, uint64_t>);
+
+  method("search", [](Context &ctx, Object *obj, Value &ret) {
+    RegExp *re;
+    if (!ctx.arguments(1, &re)) return;
+    auto data = obj->as<pipy::Data>();
+    std::vector<int> groups;
+    if (re->search(data->begin(), data->end(), 0, groups)) {
+      ret.set(groups[0]);
+    } else {
+      ret.set(-1);
+    }
+  });
+
+  method("match", [](Context &ctx, Object *obj, Value &ret) {
+    RegExp *re;
+    if (!ctx.arguments(1, &re)) return;
+    auto data = obj->as<pipy::Data>();
+    std::vector<int> groups;
+    if (!re->search(data->begin(), data->end(), 0, groups)) {
+      ret = Value::null;
+      return;
+    }
+    auto n = groups.size() / 2;
+    auto a = Array::make(n);
+    for (size_t i = 0; i < n; i++) {
+      if (groups[i*2] >= 0) {
+        auto *out = pipy::Data::make();
+        data->slice(groups[i*2+0], groups[i*2+1], *out);
+        a->set(i, out);
+      }
+    }
+    ret.set(a);
+  });
+
   method("toArray", [](Context &ctx, Object *obj, Value &ret) {
     auto data = obj->as<pipy::Data>();
     auto a = Array::make(data->size());
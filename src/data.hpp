@@ -34,6 +34,7 @@
 
 #include <cstring>
 #include <functional>
+#include <iterator>
 #include <atomic>
 #include <mutex>
 
@@ -81,13 +82,32 @@ public:
       }
     }
 
-    Producer(const std::string &name) : m_name(name), m_count(0) {
+    Producer(const std::string &name) : m_name(name) {
+      for (auto &n : m_counts) n.store(0, std::memory_order_relaxed);
+      m_allocs.store(0, std::memory_order_relaxed);
+      m_alloc_size.store(0, std::memory_order_relaxed);
       std::lock_guard<std::mutex> lock(producer_list_mutex());
       s_all_producers.push(this);
     }
 
     auto name() const -> const std::string& { return m_name; }
-    auto count() const -> size_t { return m_count.load(std::memory_order_relaxed); }
+    auto count(int size_class) const -> size_t { return m_counts[size_class].load(std::memory_order_relaxed); }
+
+    auto count() const -> size_t {
+      size_t n = 0;
+      for (int i = 0; i < DATA_CHUNK_SIZE_CLASS_COUNT; i++) n += count(i);
+      return n;
+    }
+
+    auto size() const -> size_t {
+      size_t n = 0;
+      for (int i = 0; i < DATA_CHUNK_SIZE_CLASS_COUNT; i++) n += count(i) * DATA_CHUNK_SIZE_CLASSES[i];
+      return n;
+    }
+
+    // Chunks and bytes ever allocated, for telling allocation rates
+    auto allocs() const -> size_t { return m_allocs.load(std::memory_order_relaxed); }
+    auto alloc_size() const -> size_t { return m_alloc_size.load(std::memory_order_relaxed); }
 
     Data* make(int size) { return Data::make(size, this); }
     Data* make(int size, int value) { return Data::make(size, value, this); }
@@ -107,31 +127,87 @@ public:
 
   private:
     std::string m_name;
-    std::atomic<size_t> m_count;
+    std::atomic<size_t> m_counts[DATA_CHUNK_SIZE_CLASS_COUNT];
+    std::atomic<size_t> m_allocs;
+    std::atomic<size_t> m_alloc_size;
 
     static auto producer_list_mutex() -> std::mutex&;
 
-    void increase() { m_count.fetch_add(1, std::memory_order_relaxed); }
-    void decrease() { m_count.fetch_sub(1, std::memory_order_relaxed); }
+    void increase(int size_class) {
+      m_counts[size_class].fetch_add(1, std::memory_order_relaxed);
+      m_allocs.fetch_add(1, std::memory_order_relaxed);
+      m_alloc_size.fetch_add(DATA_CHUNK_SIZE_CLASSES[size_class], std::memory_order_relaxed);
+    }
+
+    void decrease(int size_class) { m_counts[size_class].fetch_sub(1, std::memory_order_relaxed); }
 
     static List<Producer> s_all_producers;
 
     friend struct Chunk;
   };
 
+  //
+  // Data::Sampler
+  //
+  // While running, one in every SAMPLE_INTERVAL chunks allocated on a
+  // thread is tagged with the site current on that thread. Bytes of the
+  // tagged chunks are counted per site until they are freed, which gives
+  // an estimate of how much memory each site keeps alive. Sites are small
+  // integers given out by the caller, with 0 for anything outside of them.
+  //
+
+  class Sampler {
+  public:
+    static const int SAMPLE_INTERVAL = 64;
+    static const int MAX_SITES = 4096;
+
+    static bool running() { return s_running.load(std::memory_order_relaxed); }
+    static void start() { s_running.store(true, std::memory_order_relaxed); }
+    static void stop() { s_running.store(false, std::memory_order_relaxed); }
+
+    // Sites out of range are counted as 0
+    static void set_site(int site) { s_current_site = (site < MAX_SITES ? site : 0); }
+    static auto site() -> int { return s_current_site; }
+
+    // Estimated bytes retained by each site that still has any
+    static void collect(const std::function<void(int site, size_t size)> &cb);
+
+  private:
+    static std::atomic<bool> s_running;
+    static std::atomic<size_t> s_retained[MAX_SITES];
+    thread_local static int s_countdown;
+    thread_local static int s_current_site;
+
+    static auto sample(int size_class) -> int {
+      if (--s_countdown > 0) return 0;
+      s_countdown = SAMPLE_INTERVAL;
+      s_retained[s_current_site].fetch_add(DATA_CHUNK_SIZE_CLASSES[size_class], std::memory_order_relaxed);
+      return s_current_site + 1;
+    }
+
+    static void unsample(int tag, int size_class) {
+      s_retained[tag - 1].fetch_sub(DATA_CHUNK_SIZE_CLASSES[size_class], std::memory_order_relaxed);
+    }
+
+    friend struct Chunk;
+  };
+
   //
   // Data::Builder
   //
+  // Starts with the smallest chunk size and moves up one size class
+  // with every chunk filled, so that short outputs stay in small chunks.
+  //
 
   class Builder {
   public:
     Builder(Data &data, Producer *producer = nullptr)
       : m_data(data)
       , m_producer(producer)
-      , m_chunk(new Chunk(producer)) {}
+      , m_chunk(Chunk::make(0, producer)) {}
 
     ~Builder() {
-      delete m_chunk;
+      m_chunk->free();
     }
 
     int size() const {
@@ -145,8 +221,9 @@ public:
 
     void flush() {
       if (m_ptr > 0) {
-        m_data.push_view(new View(m_chunk, 0, m_ptr));
-        m_chunk = new Chunk(m_producer);
+        auto chunk = m_chunk;
+        m_chunk = next_chunk();
+        m_data.push_view(new View(chunk, 0, m_ptr));
         m_ptr = 0;
       }
     }
@@ -154,7 +231,7 @@ public:
     void push(char c) {
       m_chunk->data[m_ptr++] = c;
       m_size++;
-      if (m_ptr >= sizeof(m_chunk->data)) {
+      if (m_ptr >= m_chunk->size()) {
         flush();
       }
     }
@@ -167,14 +244,15 @@ public:
       auto &p = m_ptr;
       m_size += n;
       while (n > 0) {
-        int l = sizeof(m_chunk->data) - p;
+        int l = m_chunk->size() - p;
         if (l > n) l = n;
         std::memset(m_chunk->data + p, c, l);
         p += l;
         n -= l;
-        if (p >= sizeof(m_chunk->data)) {
-          m_data.push_view(new View(m_chunk, 0, p));
-          m_chunk = new Chunk(m_producer);
+        if (p >= m_chunk->size()) {
+          auto chunk = m_chunk;
+          m_chunk = next_chunk();
+          m_data.push_view(new View(chunk, 0, p));
           p = 0;
         }
       }
@@ -188,15 +266,16 @@ public:
       auto &p = m_ptr;
       m_size += n;
       while (n > 0) {
-        int l = sizeof(m_chunk->data) - p;
+        int l = m_chunk->size() - p;
         if (l > n) l = n;
         std::memcpy(m_chunk->data + p, s, l);
         s += l;
         p += l;
         n -= l;
-        if (p >= sizeof(m_chunk->data)) {
-          m_data.push_view(new View(m_chunk, 0, p));
-          m_chunk = new Chunk(m_producer);
+        if (p >= m_chunk->size()) {
+          auto chunk = m_chunk;
+          m_chunk = next_chunk();
+          m_data.push_view(new View(chunk, 0, p));
           p = 0;
         }
       }
@@ -228,12 +307,32 @@ public:
       m_data.push(std::move(d));
     }
 
+    // Free space left in the chunk being filled, which the caller writes
+    // into directly and then hands over with commit()
+    auto reserve(int &n) -> char* {
+      n = m_chunk->size() - m_ptr;
+      return m_chunk->data + m_ptr;
+    }
+
+    void commit(int n) {
+      m_ptr += n;
+      m_size += n;
+      if (m_ptr >= m_chunk->size()) {
+        flush();
+      }
+    }
+
   private:
     Data& m_data;
     Producer* m_producer;
     Chunk* m_chunk;
     int m_ptr = 0;
     int m_size = 0;
+
+    auto next_chunk() -> Chunk* {
+      auto c = std::min(m_chunk->size_class() + 1, DATA_CHUNK_SIZE_CLASS_DEFAULT);
+      return Chunk::make(c, m_producer);
+    }
   };
 
   //
@@ -354,27 +453,138 @@ public:
     int m_position = 0;
   };
 
+  //
+  // Data::Iterator
+  //
+  // A bidirectional iterator over the bytes of a Data that walks the
+  // chunk views in place, so that algorithms such as std::regex_search
+  // can run on a Data without flattening it first.
+  //
+
+  class Iterator {
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef char value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const char* pointer;
+    typedef const char& reference;
+
+    Iterator() {}
+
+    auto position() const -> int { return m_position; }
+
+    auto operator*() const -> reference {
+      return m_view->chunk->data[m_view->offset + m_offset];
+    }
+
+    auto operator++() -> Iterator& {
+      m_position++;
+      if (++m_offset >= m_view->length) {
+        m_view = m_view->next;
+        m_offset = 0;
+        skip_empty();
+      }
+      return *this;
+    }
+
+    auto operator--() -> Iterator& {
+      m_position--;
+      if (m_offset > 0) {
+        m_offset--;
+      } else {
+        m_view = m_view ? m_view->prev : m_data->m_tail;
+        while (!m_view->length) m_view = m_view->prev;
+        m_offset = m_view->length - 1;
+      }
+      return *this;
+    }
+
+    auto operator++(int) -> Iterator { auto i = *this; ++*this; return i; }
+    auto operator--(int) -> Iterator { auto i = *this; --*this; return i; }
+
+    bool operator==(const Iterator &other) const { return m_position == other.m_position; }
+    bool operator!=(const Iterator &other) const { return m_position != other.m_position; }
+
+  private:
+    Iterator(const Data *data, View *view, int position)
+      : m_data(data)
+      , m_view(view)
+      , m_position(position) { skip_empty(); }
+
+    const Data* m_data = nullptr;
+    View* m_view = nullptr;
+    int m_offset = 0;
+    int m_position = 0;
+
+    void skip_empty() {
+      while (m_view && !m_view->length) m_view = m_view->next;
+    }
+
+    friend class Data;
+  };
+
 private:
 
   //
   // Data::Chunk
   //
 
-  struct Chunk : public Pooled<Chunk> {
+  //
+  // Chunks come in size classes from DATA_CHUNK_SIZE_CLASSES, each with
+  // its own pool, and have their data space allocated right after them.
+  //
+
+  struct Chunk {
     std::atomic<int> retain_count;
-    char data[DATA_CHUNK_SIZE];
+    char* data;
 
-    Chunk(Producer *producer)
-      : retain_count(0)
-      , m_producer(producer ? producer : Producer::unknown()) { m_producer->increase(); }
-    ~Chunk() { m_producer->decrease(); }
+    static auto make(int size_class, Producer *producer) -> Chunk* {
+      return new (pool(size_class).alloc()) Chunk(size_class, producer);
+    }
 
-    auto size() const -> int { return sizeof(data); }
+    // The size class for a payload of the given size: the smallest one
+    // that can hold it up to the default size, or the largest one that
+    // it can fill up for anything bigger than that
+    static int size_class_of(int size) {
+      for (int i = 0; i < DATA_CHUNK_SIZE_CLASS_DEFAULT; i++) {
+        if (size <= DATA_CHUNK_SIZE_CLASSES[i]) return i;
+      }
+      for (int i = DATA_CHUNK_SIZE_CLASS_COUNT - 1; i > DATA_CHUNK_SIZE_CLASS_DEFAULT; i--) {
+        if (size >= DATA_CHUNK_SIZE_CLASSES[i]) return i;
+      }
+      return DATA_CHUNK_SIZE_CLASS_DEFAULT;
+    }
+
+    auto size_class() const -> int { return m_size_class; }
+    auto size() const -> int { return DATA_CHUNK_SIZE_CLASSES[m_size_class]; }
     void retain() { retain_count.fetch_add(1, std::memory_order_relaxed); }
-    void release() { if (retain_count.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this; }
+    void release() { if (retain_count.fetch_sub(1, std::memory_order_acq_rel) == 1) free(); }
+
+    void free() {
+      auto c = m_size_class;
+      this->~Chunk();
+      pool(c).free(this);
+    }
 
   private:
+    Chunk(int size_class, Producer *producer)
+      : retain_count(0)
+      , data((char*)(this + 1))
+      , m_size_class(size_class)
+      , m_sample(Sampler::running() ? Sampler::sample(size_class) : 0)
+      , m_producer(producer ? producer : Producer::unknown()) { m_producer->increase(size_class); }
+    ~Chunk() {
+      m_producer->decrease(m_size_class);
+      if (m_sample) Sampler::unsample(m_sample, m_size_class);
+    }
+
+    int m_size_class;
+    int m_sample; // site + 1 if sampled
     Producer* m_producer;
+
+    static auto pool(int size_class) -> pjs::Pool&;
+
+    friend class Data;
   };
 
   //
@@ -432,9 +642,9 @@ private:
       return view;
     }
 
-    View* clone(Producer *producer) {
+    View* clone(Producer *producer, int capacity = 0) {
       if (!producer) producer = &s_unknown_producer;
-      auto new_chunk = new Chunk(producer);
+      auto new_chunk = Chunk::make(Chunk::size_class_of(std::max(length, capacity)), producer);
       std::memcpy(new_chunk->data, chunk->data + offset, length);
       return new View(new_chunk, 0, length);
     }
@@ -446,6 +656,12 @@ public:
     return data && data->empty();
   }
 
+  // Bytes of chunks allocated from the pools of the current thread
+  static auto thread_chunk_size() -> size_t;
+
+  void detach(DataTransfer &transfer);
+  void attach(DataTransfer &transfer);
+
   //
   // Data::Chunks
   //
@@ -501,7 +717,7 @@ public:
   {
     if (!producer) producer = &s_unknown_producer;
     while (size > 0) {
-      auto chunk = new Chunk(producer);
+      auto chunk = Chunk::make(Chunk::size_class_of(size), producer);
       auto length = std::min(size, chunk->size());
       push_view(new View(chunk, 0, length));
       size -= length;
@@ -515,7 +731,7 @@ public:
   {
     if (!producer) producer = &s_unknown_producer;
     while (size > 0) {
-      auto chunk = new Chunk(producer);
+      auto chunk = Chunk::make(Chunk::size_class_of(size), producer);
       auto length = std::min(size, chunk->size());
       std::memset(chunk->data, value, length);
       push_view(new View(chunk, 0, length));
@@ -554,41 +770,25 @@ public:
       }
       case Encoding::hex: {
         if (str.length() % 2) throw std::runtime_error("incomplete hex string");
-        Builder db(*this, producer);
-        utils::HexDecoder decoder([&](uint8_t b) { db.push(b); });
-        for (auto c : str) {
-          if (!decoder.input(c)) {
-            throw std::runtime_error("invalid hex encoding");
-          }
-        }
-        db.flush();
+        pjs::vl_array<uint8_t, 1024> buf(str.length() / 2);
+        auto n = utils::decode_hex(buf.data(), str.c_str(), str.length());
+        if (n < 0) throw std::runtime_error("invalid hex encoding");
+        push(buf.data(), n, producer);
         break;
       }
       case Encoding::base64: {
         if (str.length() % 4) throw std::runtime_error("incomplete Base64 string");
-        Builder db(*this, producer);
-        utils::Base64Decoder decoder([&](uint8_t b) { db.push(b); });
-        for (auto c : str) {
-          if (!decoder.input(c)) {
-            throw std::runtime_error("invalid Base64 encoding");
-          }
-        }
-        if (!decoder.complete()) throw std::runtime_error("incomplete Base64 encoding");
-        db.flush();
+        pjs::vl_array<uint8_t, 1024> buf(utils::Base64Decoder::max_output_size(str.length()));
+        auto n = utils::decode_base64(buf.data(), str.c_str(), str.length());
+        if (n < 0) throw std::runtime_error("invalid Base64 encoding");
+        push(buf.data(), n, producer);
         break;
       }
       case Encoding::base64url: {
-        Builder db(*this, producer);
-        utils::Base64UrlDecoder decoder([&](uint8_t b) { db.push(b); });
-        for (auto c : str) {
-          if (!decoder.input(c)) {
-            throw std::runtime_error("invalid Base64 encoding");
-          }
-        }
-        if (!decoder.flush()) {
-          throw std::runtime_error("invalid Base64 encoding");
-        }
-        db.flush();
+        pjs::vl_array<uint8_t, 1024> buf(utils::Base64UrlDecoder::max_output_size(str.length()));
+        auto n = utils::decode_base64url(buf.data(), str.c_str(), str.length());
+        if (n < 0) throw std::runtime_error("invalid Base64 encoding");
+        push(buf.data(), n, producer);
         break;
       }
     }
@@ -665,6 +865,28 @@ public:
     return Chunks(m_head);
   }
 
+  auto begin() const -> Iterator {
+    assert_same_thread(*this);
+    return Iterator(this, m_head, 0);
+  }
+
+  auto end() const -> Iterator {
+    assert_same_thread(*this);
+    return Iterator(this, nullptr, m_size);
+  }
+
+  //
+  // Search, slice, compare and hash work on the chunk views directly
+  // and never copy the bytes into a flat buffer.
+  //
+
+  auto index_of(const char *pattern, int length, int start = 0) const -> int;
+  auto index_of(const Data &pattern, int start = 0) const -> int;
+  void slice(int start, int end, Data &out) const;
+  auto peek(int offset, void *buf, int len) const -> int;
+  auto compare(const Data &other) const -> int;
+  auto hash() const -> uint32_t;
+
   void clear() {
     assert_same_thread(*this);
     for (auto *p = m_head; p; ) {
@@ -723,7 +945,9 @@ public:
       }
     }
     while (n > 0) {
-      auto view = new View(new Chunk(producer), 0, 0);
+      auto c = Chunk::size_class_of(n);
+      if (auto tail = m_tail) c = std::max(c, std::min(tail->chunk->size_class() + 1, DATA_CHUNK_SIZE_CLASS_DEFAULT));
+      auto view = new View(Chunk::make(c, producer), 0, 0);
       auto added = view->push(p, n);
       p += added;
       n -= added;
@@ -749,7 +973,9 @@ public:
         }
       }
     }
-    auto chunk = new Chunk(producer ? producer : &s_unknown_producer);
+    auto c = 0;
+    if (auto tail = m_tail) c = std::min(tail->chunk->size_class() + 1, DATA_CHUNK_SIZE_CLASS_DEFAULT);
+    auto chunk = Chunk::make(c, producer ? producer : &s_unknown_producer);
     auto view = new View(chunk, 0, 1);
     chunk->data[0] = ch;
     push_view(view);
@@ -926,8 +1152,80 @@ public:
     }
   }
 
+  // Shifts up to and including the first occurrence of a byte,
+  // or everything if there's none, which is told by the return value
+  bool shift_to(uint8_t c, Data &out) {
+    assert_same_thread(*this);
+    assert_same_thread(out);
+    while (auto view = m_head) {
+      auto p = view->chunk->data + view->offset;
+      if (auto q = (const char *)std::memchr(p, c, view->length)) {
+        int n = q - p + 1;
+        if (n == view->length) {
+          out.push_view(shift_view());
+        } else {
+          out.push_view(view->shift(n));
+          m_size -= n;
+        }
+        return true;
+      }
+      out.push_view(shift_view());
+    }
+    return false;
+  }
+
+  // Shifts up to and including the first occurrence of a pattern found
+  // within a single view and returns its length, or shifts up to and
+  // including the first byte of a candidate that runs past the end of its
+  // view and returns 1, or shifts everything and returns 0 if neither
+  auto shift_to(const char *pattern, int length, Data &out) -> int {
+    assert_same_thread(*this);
+    assert_same_thread(out);
+    while (auto view = m_head) {
+      const char *p = view->chunk->data + view->offset;
+      const char *e = p + view->length;
+      const char *q = p;
+      while (auto r = (const char *)std::memchr(q, pattern[0], e - q)) {
+        int m = 0;
+        if (r + length > e) m = 1;
+        else if (!std::memcmp(r, pattern, length)) m = length;
+        if (m > 0) {
+          int n = r - p + m;
+          if (n == view->length) {
+            out.push_view(shift_view());
+          } else {
+            out.push_view(view->shift(n));
+            m_size -= n;
+          }
+          return m;
+        }
+        q = r + 1;
+      }
+      out.push_view(shift_view());
+    }
+    return 0;
+  }
+
   void pack(const Data &data, Producer *producer, double vacancy = 0.5);
 
+  // Same as pack() except that views of at least min_view bytes are linked
+  // as they are, and nothing gets appended to them, so large payloads are
+  // never copied while small pieces around them are still merged
+  void pack(const Data &data, Producer *producer, double vacancy, int min_view);
+
+  // Moves the content of a single view into a chunk of a smaller size class
+  // when it takes up no more than a quarter of the chunk it currently uses
+  void shrink(Producer *producer) {
+    assert_same_thread(*this);
+    auto view = m_head;
+    if (!view || view != m_tail) return;
+    if (view->length > view->chunk->size() / 4) return;
+    if (Chunk::size_class_of(view->length) >= view->chunk->size_class()) return;
+    auto v = view->clone(producer);
+    delete pop_view();
+    push_view(v);
+  }
+
   void to_chunks(const std::function<void(const uint8_t*, int)> &cb) const {
     assert_same_thread(*this);
     for (auto view = m_head; view; view = view->next) {
@@ -997,6 +1295,15 @@ private:
   View*  m_tail;
   int    m_size;
 
+  //
+  // Tiny views are compacted on the way in: they are appended to the
+  // tail chunk when this Data is its only holder, or else the tail is
+  // copied together with them into a fresh chunk when it is tiny too.
+  // Either way the view list stays in proportion to the size of the
+  // data rather than to the number of pieces it was assembled from,
+  // so walks by offset in peek(), slice() or shift() stay short.
+  //
+
   void push_view(View *view) {
     auto size = view->length;
     if (auto tail = m_tail) {
@@ -1008,15 +1315,45 @@ private:
         m_size += size;
         return;
       }
+      if (size <= DATA_VIEW_COMPACT_SIZE) {
+        auto p = view->chunk->data + view->offset;
+        if (tail->chunk->retain_count.load(std::memory_order_acquire) == 1 &&
+            tail->offset + tail->length + size <= tail->chunk->size()
+        ) {
+          tail->push(p, size);
+          delete view;
+          m_size += size;
+          return;
+        }
+        if (tail->length <= DATA_VIEW_COMPACT_SIZE) {
+          auto v = tail->clone(tail->chunk->m_producer, tail->length + size);
+          v->push(p, size);
+          v->prev = tail->prev;
+          if (v->prev) v->prev->next = v; else m_head = v;
+          m_tail = v;
+          m_size += size;
+          delete tail;
+          delete view;
+          return;
+        }
+      }
+    }
+    link_view(view);
+  }
+
+  void link_view(View *view) {
+    if (auto tail = m_tail) {
       tail->next = view;
       view->prev = tail;
     } else {
       m_head = view;
     }
     m_tail = view;
-    m_size += size;
+    m_size += view->length;
   }
 
+  static bool match_at(View *view, int offset, const char *pattern, int length);
+
   auto pop_view() -> View* {
     auto view = m_tail;
     m_tail = view->prev;
@@ -1067,8 +1404,70 @@ private:
   static Producer s_unknown_producer;
 
   friend class SharedData;
+  friend class DataTransfer;
 };
 
+//
+// DataTransfer
+//
+// Owns a view list detached from a Data. Chunks keep their reference
+// counts atomically, so the list can be carried to another thread as it
+// is and attached to a Data over there without being rebuilt. Unlike
+// SharedData, it can be attached only once.
+//
+
+class DataTransfer : public pjs::Pooled<DataTransfer> {
+public:
+  DataTransfer() {}
+  DataTransfer(const DataTransfer &) = delete;
+  auto operator=(const DataTransfer &) -> DataTransfer& = delete;
+
+  ~DataTransfer() {
+    for (auto *p = m_head; p; ) {
+      auto *v = p; p = p->next;
+      delete v;
+    }
+  }
+
+private:
+  Data::View* m_head = nullptr;
+  Data::View* m_tail = nullptr;
+  int m_size = 0;
+
+  friend class Data;
+};
+
+inline void Data::detach(DataTransfer &transfer) {
+  assert_same_thread(*this);
+  while (auto *v = m_head) {
+    m_head = v->next;
+    v->next = nullptr;
+    if (auto tail = transfer.m_tail) {
+      tail->next = v;
+      v->prev = tail;
+    } else {
+      v->prev = nullptr;
+      transfer.m_head = v;
+    }
+    transfer.m_tail = v;
+    transfer.m_size += v->length;
+  }
+  m_tail = nullptr;
+  m_size = 0;
+}
+
+inline void Data::attach(DataTransfer &transfer) {
+  assert_same_thread(*this);
+  while (auto *v = transfer.m_head) {
+    transfer.m_head = v->next;
+    v->next = nullptr;
+    v->prev = nullptr;
+    transfer.m_size -= v->length;
+    push_view(v);
+  }
+  transfer.m_tail = nullptr;
+}
+
 //
 // SharedData
 //
@@ -76,10 +76,37 @@ void Deframer::flush() {
   }
 }
 
+//
+// Fixed-size reads into a buffer, into a Data and skips all take whole
+// runs of bytes off the chunks at once. Only the bytes that have to go
+// through on_state() one by one are fed to the state machine singly.
+//
+
 void Deframer::deframe(Data &data) {
   while (!data.empty() && m_state >= 0) {
 
-    if (m_read_length > 0 && !m_read_buffer) {
+    if (m_read_length > 0 && m_read_buffer) {
+      auto n = m_read_length - m_read_pointer;
+      if (n > data.size()) n = data.size();
+      if (m_passing) {
+        Data read_in;
+        data.shift(n, read_in);
+        read_in.to_bytes(m_read_buffer + m_read_pointer);
+        m_output_buffer.push(read_in);
+      } else {
+        data.shift(n, m_read_buffer + m_read_pointer);
+      }
+      m_read_pointer += n;
+      if (m_read_pointer >= m_read_length) {
+        m_read_length = 0;
+        m_read_buffer = nullptr;
+        m_need_flush = false;
+        auto state = on_state(m_state, -1);
+        if (m_need_flush) flush();
+        m_state = state;
+      }
+
+    } else if (m_read_length > 0) {
       auto n = m_read_length;
       if (n > data.size()) n = data.size();
       Data read_in;
@@ -124,7 +151,7 @@ void Deframer::deframe(Data &data) {
             state = on_state(state, (uint8_t)c);
           }
           return state < 0 || m_need_flush ||
-            (m_read_length > 0 && !m_read_buffer) ||
+            m_read_length > 0 ||
             (m_passing != passing);
         },
         read_in
@@ -27,113 +27,108 @@
 
 namespace pipy {
 
-SharedTable<EventQueue::SharedEvent> EventQueue::s_event_pool;
-
 //
 // EventQueue
 //
 
-EventQueue::EventQueue() {
-  auto node = alloc(nullptr);
-  m_head = node;
-  m_tail = node;
+EventQueue::EventQueue(size_t capacity)
+  : m_head(0)
+  , m_tail(0)
+  , m_signaled(false)
+  , m_overflowed(false)
+{
+  size_t n = 2;
+  while (n < capacity) n <<= 1;
+  m_cells = new Cell[n];
+  m_mask = n - 1;
+  for (size_t i = 0; i < n; i++) {
+    m_cells[i].seq.store(i, std::memory_order_relaxed);
+    m_cells[i].event = nullptr;
+  }
 }
 
 EventQueue::~EventQueue() {
+  while (auto se = pop()) se->release();
+  for (auto se : m_overflow) se->release();
+  delete [] m_cells;
 }
 
-void EventQueue::enqueue(Event *evt) {
-  auto node = alloc(evt);
-  for (;;) {
-    auto tail = m_tail.load();
-    auto next = tail->next.load();
-    if (tail == m_tail.load()) {
-      if (!next) {
-        if (tail->next.compare_exchange_weak(next, node.with_count(next.count() + 1))) {
-          m_tail.compare_exchange_weak(tail, node.with_count(tail.count() + 1));
-          break;
-        }
-      } else {
-        m_tail.compare_exchange_weak(tail, next.with_count(tail.count() + 1));
-      }
-    }
+bool EventQueue::enqueue(Event *evt, bool move) {
+  auto se = move ? SharedEvent::move(evt) : SharedEvent::make(evt);
+  se->retain();
+
+  if (m_overflowed.load() || !push(se)) {
+    std::lock_guard<std::mutex> lock(m_overflow_mutex);
+    m_overflow.push_back(se);
+    m_overflowed.store(true);
   }
+
+  return !m_signaled.exchange(true);
 }
 
-auto EventQueue::dequeue() -> Event* {
-  for (;;) {
-    auto head = m_head.load();
-    auto tail = m_tail.load();
-    auto next = head->next.load();
-    if (head == m_head.load()) {
-      if (head.index() == tail.index()) {
-        if (!next) return nullptr;
-        m_tail.compare_exchange_weak(tail, next.with_count(tail.count() + 1));
-      } else {
-        auto e = next->to_event();
-        if (m_head.compare_exchange_weak(head, next.with_count(head.count() + 1))) {
-          free(head);
-          return e;
-        } else {
-          e->retain();
-          e->release();
-        }
+auto EventQueue::dequeue(Event **events, size_t max) -> size_t {
+  size_t n = 0;
+  while (n < max) {
+    auto se = pop();
+    if (!se) {
+      if (!m_overflowed.load()) break;
+      std::lock_guard<std::mutex> lock(m_overflow_mutex);
+      if (m_overflow.empty()) {
+        m_overflowed.store(false);
+        continue;
       }
+      se = m_overflow.front();
+      m_overflow.pop_front();
     }
+    if (auto evt = se->to_event()) events[n++] = evt;
+    se->release();
   }
+  return n;
 }
 
 //
-// EventQueue::SharedEvent
+// The ring follows the usual sequence-numbered cell design: a cell is
+// free for the producer at position p when its sequence equals p, and
+// holds an event for the consumer at p when its sequence equals p + 1.
 //
 
-EventQueue::SharedEvent::SharedEvent(Event *evt)
-  : type(evt ? evt->type() : (Event::Type)-1)
-{
-  switch (type) {
-    case Event::Type::Data:
-      data = SharedData::make(*evt->as<Data>());
-      break;
-    case Event::Type::MessageStart:
-      head_tail = pjs::SharedObject::make(evt->as<MessageStart>()->head());
-      break;
-    case Event::Type::MessageEnd:
-      head_tail = pjs::SharedObject::make(evt->as<MessageEnd>()->tail());
-      new (&payload) pjs::SharedValue(evt->as<MessageEnd>()->payload());
-      break;
-    case Event::Type::StreamEnd:
-      error_code = evt->as<StreamEnd>()->error_code();
-      error = evt->as<StreamEnd>()->error();
-      break;
-    default: break;
+bool EventQueue::push(SharedEvent *se) {
+  auto pos = m_tail.load(std::memory_order_relaxed);
+  for (;;) {
+    auto &cell = m_cells[pos & m_mask];
+    auto seq = cell.seq.load(std::memory_order_acquire);
+    auto diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        cell.event = se;
+        cell.seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = m_tail.load(std::memory_order_relaxed);
+    }
   }
 }
 
-auto EventQueue::SharedEvent::to_event() -> Event* {
-  switch (type) {
-    case Event::Type::Data: {
-      auto d = Data::make();
-      data->to_data(*d);
-      return d;
-    }
-    case Event::Type::MessageStart: {
-      return MessageStart::make(head_tail ? head_tail->to_object() : nullptr);
-    }
-    case Event::Type::MessageEnd: {
-      pjs::Value p;
-      payload.to_value(p);
-      return MessageEnd::make(head_tail ? head_tail->to_object() : nullptr, p);
-    }
-    case Event::Type::StreamEnd: {
-      if (error_code == StreamEnd::RUNTIME_ERROR) {
-        pjs::Value e;
-        error.to_value(e);
-        return StreamEnd::make(e);
-      } else {
-        return StreamEnd::make(error_code);
+auto EventQueue::pop() -> SharedEvent* {
+  auto pos = m_head.load(std::memory_order_relaxed);
+  for (;;) {
+    auto &cell = m_cells[pos & m_mask];
+    auto seq = cell.seq.load(std::memory_order_acquire);
+    auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        auto se = cell.event;
+        cell.seq.store(pos + m_mask + 1, std::memory_order_release);
+        return se;
       }
+    } else if (diff < 0) {
+      return nullptr;
+    } else {
+      pos = m_head.load(std::memory_order_relaxed);
     }
-    default: return nullptr;
   }
 }
 
@@ -27,98 +27,54 @@
 #define EVENT_QUEUE_HPP
 
 #include "event.hpp"
-#include "data.hpp"
-#include "table.hpp"
-#include "net.hpp"
 
 #include <atomic>
+#include <deque>
+#include <mutex>
 
 namespace pipy {
 
 //
 // EventQueue
 //
+// A bounded lock-free MPMC ring of shared events for handing events from
+// one thread to another. The producer side learns from enqueue() whether
+// the consumer needs a wake-up, so a burst of events costs a single
+// cross-thread post. The consumer calls unsignal() when it starts running
+// and then takes events off in batches with dequeue().
+//
+// When the ring is full, events spill into a locked overflow list. While
+// anything is in there, new events go to the list as well, so the order
+// of events from one producer is kept.
+//
 
 class EventQueue {
 public:
-  EventQueue();
+  EventQueue(size_t capacity = 64);
   ~EventQueue();
 
-  void enqueue(Event *evt);
-  auto dequeue() -> Event*;
+  // With move, the caller hands over its reference, see SharedEvent::move()
+  bool enqueue(Event *evt, bool move = false);
+  void unsignal() { m_signaled.store(false); }
+  auto dequeue(Event **events, size_t max) -> size_t;
 
 private:
-  struct SharedEvent;
-
-  //
-  // EventQueue::SharedEventPtr
-  //
-
-  class SharedEventPtr {
-  public:
-    SharedEventPtr(uint32_t index = 0, uint32_t count = 0) noexcept
-      : m_index_count(((uint64_t)count << 32) | index) {}
-
-    auto index() const -> uint32_t {
-      return m_index_count;
-    }
-
-    auto count() const -> uint32_t {
-      return m_index_count >> 32;
-    }
-
-    auto with_count(uint32_t count) -> SharedEventPtr {
-      return SharedEventPtr(index(), count);
-    }
-
-    operator SharedEvent*() const {
-      return s_event_pool.get(index());
-    }
-
-    operator bool() const {
-      return index();
-    }
-
-    auto operator->() const -> SharedEvent* {
-      return s_event_pool.get(index());
-    }
-
-    bool operator==(const SharedEventPtr &r) const {
-      return m_index_count == r.m_index_count;
-    }
-
-  private:
-    uint64_t m_index_count;
+  struct Cell {
+    std::atomic<size_t> seq;
+    SharedEvent* event;
   };
 
-  //
-  // EventQueue::SharedEvent
-  //
-
-  struct SharedEvent {
-    SharedEvent(Event *evt);
-    auto to_event() -> Event*;
-    Event::Type type;
-    StreamEnd::Error error_code;
-    pjs::SharedValue error;
-    pjs::SharedValue payload;
-    pjs::Ref<pjs::SharedObject> head_tail;
-    pjs::Ref<SharedData> data;
-    std::atomic<SharedEventPtr> next;
-  };
-
-  auto alloc(Event *evt) -> SharedEventPtr {
-    return s_event_pool.alloc(evt);
-  }
-
-  void free(const SharedEventPtr &ptr) {
-    s_event_pool.free(ptr.index());
-  }
-
-  std::atomic<SharedEventPtr> m_head;
-  std::atomic<SharedEventPtr> m_tail;
-
-  static SharedTable<SharedEvent> s_event_pool;
+  Cell* m_cells;
+  size_t m_mask;
+  std::atomic<size_t> m_head;
+  std::atomic<size_t> m_tail;
+  std::atomic<bool> m_signaled;
+  std::atomic<bool> m_overflowed;
+  std::mutex m_overflow_mutex;
+  std::deque<SharedEvent*> m_overflow;
+
+  bool push(SharedEvent *se);
+  auto pop() -> SharedEvent*;
 };
 
 } // namespace pipy
@@ -35,12 +35,17 @@ namespace pipy {
 // SharedEvent
 //
 
-SharedEvent::SharedEvent(Event *evt)
+SharedEvent::SharedEvent(Event *evt, bool move)
   : m_type(evt ? evt->type() : (Event::Type)-1)
 {
   switch (m_type) {
     case Event::Type::Data:
-      m_data = SharedData::make(*evt->as<Data>());
+      if (move && evt->ref_count() <= 1) {
+        m_transfer = new DataTransfer;
+        evt->as<Data>()->detach(*m_transfer);
+      } else {
+        m_data = SharedData::make(*evt->as<Data>());
+      }
       break;
     case Event::Type::MessageStart:
       m_head_tail = pjs::SharedObject::make(evt->as<MessageStart>()->head());
@@ -59,13 +64,18 @@ SharedEvent::SharedEvent(Event *evt)
 
 SharedEvent::~SharedEvent()
 {
+  delete m_transfer;
 }
 
 auto SharedEvent::to_event() -> Event* {
   switch (m_type) {
     case Event::Type::Data: {
       auto d = Data::make();
-      m_data->to_data(*d);
+      if (m_transfer) {
+        d->attach(*m_transfer);
+      } else if (m_data) {
+        m_data->to_data(*d);
+      }
       return d;
     }
     case Event::Type::MessageStart: {
@@ -171,6 +181,7 @@ template<> void EnumDef<StreamEnd::Error>::init() {
   define(StreamEnd::BUFFER_OVERFLOW    , "BufferOverflow");
   define(StreamEnd::PROTOCOL_ERROR     , "ProtocolError");
   define(StreamEnd::UNAUTHORIZED       , "Unauthorized");
+  define(StreamEnd::OVERLOADED         , "Overloaded");
 }
 
 //
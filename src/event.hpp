@@ -36,6 +36,7 @@ namespace pipy {
 class EventBuffer;
 class StreamEnd;
 class SharedData;
+class DataTransfer;
 
 //
 // Event
@@ -58,6 +59,11 @@ public:
 
   virtual auto clone() const -> Event* = 0;
 
+  // Returns the event to hand on to one more receiver. Receivers may
+  // consume a Data event in place, so that is copied, but heads, tails
+  // and errors never change once made, so other events go as they are.
+  auto share() -> Event* { return m_type == Type::Data ? clone() : this; }
+
   template<class T> auto is() const -> bool {
     return m_type == T::__TYPE;
   }
@@ -179,6 +185,7 @@ public:
     BUFFER_OVERFLOW,
     PROTOCOL_ERROR,
     UNAUTHORIZED,
+    OVERLOADED,
   };
 
   auto error() const -> const pjs::Value & { return m_error; }
@@ -209,13 +216,20 @@ class SharedEvent :
 {
 public:
   static auto make(Event *evt) -> SharedEvent* {
-    return new SharedEvent(evt);
+    return new SharedEvent(evt, false);
+  }
+
+  // Moves the chunks of a Data event instead of sharing them when the
+  // only reference to it is the caller's, which then gives it up without
+  // looking at the event again. The result can be converted only once.
+  static auto move(Event *evt) -> SharedEvent* {
+    return new SharedEvent(evt, true);
   }
 
   auto to_event() -> Event*;
 
 private:
-  SharedEvent(Event *evt);
+  SharedEvent(Event *evt, bool move);
   ~SharedEvent();
 
   Event::Type m_type;
@@ -224,6 +238,7 @@ private:
   pjs::SharedValue m_payload;
   pjs::Ref<pjs::SharedObject> m_head_tail;
   pjs::Ref<SharedData> m_data;
+  DataTransfer* m_transfer = nullptr;
 
   friend class pjs::RefCountMT<SharedEvent>;
 };
@@ -72,39 +72,54 @@ Fetch::Fetch(pjs::Str *host, const Options &options)
   : m_module(new Module())
   , m_host(host)
 {
-  m_mux_grouper = pjs::Method::make(
-    "", [this](pjs::Context &, pjs::Object *, pjs::Value &ret) {
-      ret.set(m_mux_group);
-    }
-  );
-
-  Connect::Options connect_options(options);
-  connect_options.on_state_changed = [this](Outbound *ob) {
-    m_outbound = ob;
-  };
-
-  auto *ppl_connect = PipelineLayout::make(m_module);
-  ppl_connect->append(new Connect(m_host.get(), connect_options));
-
+  tls::Client::Options tls_options;
   if (options.tls) {
-    tls::Client::Options opts;
-    opts.trusted = options.trusted;
+    tls_options.trusted = options.trusted;
     if (options.cert) {
-      opts.certificate = pjs::Object::make();
-      opts.certificate->set("cert", options.cert.get());
-      opts.certificate->set("key", options.key.get());
+      tls_options.certificate = pjs::Object::make();
+      tls_options.certificate->set("cert", options.cert.get());
+      tls_options.certificate->set("key", options.key.get());
     }
     std::string sni;
     int port;
     utils::get_host_port(host->str(), sni, port);
-    opts.sni = pjs::Str::make(sni);
-    auto *ppl_tls = PipelineLayout::make(m_module);
-    ppl_tls->append(new tls::Client(opts))->add_sub_pipeline(ppl_connect);
-    ppl_connect = ppl_tls;
+    tls_options.sni = pjs::Str::make(sni);
   }
 
+  // One request per connection at a time, as only
+  // requests from different Fetches would be pipelined
+  http::Mux::Options mux_options;
+  mux_options.max_pipeline = 1;
+
+  Upstream::Key key("fetch");
+  key.add(host);
+  key.add((const Outbound::Options &)options);
+  key.add(double(options.tls));
+  if (options.tls) key.add(tls_options);
+  key.add((const MuxSession::Options &)mux_options);
+
+  m_upstream = Upstream::get(
+    key, mux_options.max_idle,
+    [&](Upstream *upstream) {
+      auto *mod = upstream->module();
+      Connect::Options connect_options(options);
+      upstream->track(connect_options);
+
+      auto *ppl_connect = PipelineLayout::make(mod);
+      ppl_connect->append(new Connect(host, connect_options));
+
+      if (options.tls) {
+        auto *ppl_tls = PipelineLayout::make(mod);
+        ppl_tls->append(new tls::Client(tls_options))->add_sub_pipeline(ppl_connect);
+        ppl_connect = ppl_tls;
+      }
+
+      return ppl_connect;
+    }
+  );
+
   m_ppl = PipelineLayout::make(m_module);
-  m_ppl->append(new http::Mux(pjs::Function::make(m_mux_grouper)))->add_sub_pipeline(ppl_connect);
+  m_ppl->append(m_upstream->join(new http::Mux(m_upstream->selector(), mux_options)));
   m_ppl->append(new Receiver(this));
 }
 
@@ -132,14 +147,12 @@ void Fetch::fetch(
   pipy::Data *body,
   const std::function<void(http::ResponseHead*, pipy::Data*)> &cb
 ) {
-  if (!m_mux_group) m_mux_group = pjs::Object::make();
-
   if (!headers) headers = pjs::Object::make();
   headers->set(s_Host, m_host.get());
 
   auto head = http::RequestHead::make();
   head->path = path;
-  head->headers = headers;
+  head->headers(headers);
 
   switch (method) {
     case HEAD: head->method = s_HEAD; break;
@@ -159,8 +172,12 @@ void Fetch::fetch(
   pump();
 }
 
+//
+// Connections are shared with other Fetches, so closing only
+// abandons what is pending on this one
+//
+
 void Fetch::close() {
-  m_mux_group = nullptr;
   m_pipeline = nullptr;
   m_current_request = nullptr;
   m_request_queue.clear();
@@ -190,6 +207,9 @@ bool Fetch::is_bodiless_response() {
 
 void Fetch::on_response(http::ResponseHead *head, pipy::Data *body) {
   if (m_current_request) {
+    // Let go of the connection for other Fetches sharing it
+    Pipeline::auto_release(m_pipeline);
+    m_pipeline = nullptr;
     auto cb = m_current_request->cb;
     m_current_request = nullptr;
     m_request_queue.pop_front();
@@ -33,6 +33,7 @@
 #include "filter.hpp"
 #include "module.hpp"
 #include "outbound.hpp"
+#include "upstream.hpp"
 
 #include <functional>
 #include <string>
@@ -49,6 +50,9 @@ class Pipeilne;
 //
 // Fetch
 //
+// Requests go one at a time over connections taken from the Upstream
+// for the host and options, so Fetches to the same place share them.
+//
 
 class Fetch {
 public:
@@ -77,7 +81,7 @@ public:
   }
 
   auto outbound() const -> Outbound* {
-    return m_outbound;
+    return m_upstream->outbound();
   }
 
   void operator()(
@@ -135,14 +139,12 @@ private:
     pjs::Ref<pipy::Data> m_body;
   };
 
+  pjs::Ref<Upstream> m_upstream;
   pjs::Ref<Module> m_module;
-  pjs::Ref<pjs::Method> m_mux_grouper;
-  pjs::Ref<pjs::Object> m_mux_group;
   pjs::Ref<pjs::Str> m_host;
   std::list<Request> m_request_queue;
   pjs::Ref<Pipeline> m_pipeline;
   pjs::Ref<PipelineLayout> m_ppl;
-  pjs::Ref<Outbound> m_outbound;
   Request* m_current_request = nullptr;
 
   void fetch(
@@ -29,20 +29,111 @@
 #include "worker.hpp"
 #include "message.hpp"
 #include "log.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+#include "api/stats.hpp"
 
 #include <cstdarg>
 
 namespace pipy {
 
+//
+// FilterStats
+//
+
+bool FilterStats::s_enabled = false;
+thread_local List<FilterStats> FilterStats::s_all;
+
+void FilterStats::init_metrics() {
+  if (!s_enabled) return;
+
+  pjs::Ref<pjs::Array> label_names = pjs::Array::make();
+  label_names->length(3);
+  label_names->set(0, "module");
+  label_names->set(1, "pipeline");
+  label_names->set(2, "filter");
+
+  auto rate = utils::cycles_per_second();
+
+  auto define = [&](const char *name, int index, const std::function<double(FilterStats*)> &get) {
+    stats::Counter::make(
+      pjs::Str::make(name),
+      label_names,
+      [=](stats::Counter *counter) {
+        for_each([&](FilterStats *fs) {
+          if (!fs->labels[0]) return;
+          auto v = get(fs);
+          auto d = v - fs->reported[index];
+          if (d > 0) {
+            pjs::Str *labels[3] = { fs->labels[0], fs->labels[1], fs->labels[2] };
+            counter->with_labels(labels, 3)->increase(d);
+            counter->increase(d);
+            fs->reported[index] = v;
+          }
+        });
+      }
+    );
+  };
+
+  define("pipy_filter_events", 0, [](FilterStats *fs) { return double(fs->events); });
+  define("pipy_filter_bytes", 1, [](FilterStats *fs) { return double(fs->bytes); });
+  define("pipy_filter_cpu_seconds", 2, [=](FilterStats *fs) { return fs->cycles / rate; });
+  define("pipy_filter_queued_events", 3, [](FilterStats *fs) { return double(fs->buffer->arrivals); });
+  define("pipy_filter_queue_seconds", 4, [=](FilterStats *fs) { fs->buffer->tick(); return fs->buffer->wait_cycles / rate; });
+}
+
+//
+// Filter
+//
+
+//
+// Every filter allocation is prefixed with a small header telling
+// whether it lives in an arena, so that a filter can be deleted without
+// knowing where it came from. The header keeps the 16-byte alignment.
+//
+
+struct alignas(16) FilterAllocHeader {
+  bool in_arena;
+};
+
+thread_local Filter::Arena* Filter::s_arena = nullptr;
+
+void* Filter::operator new(size_t size) {
+  auto n = sizeof(FilterAllocHeader) + ((size + 15) & ~size_t(15));
+  FilterAllocHeader *h = nullptr;
+  if (auto a = s_arena) {
+    a->m_requested += n;
+    if (n <= size_t(a->m_end - a->m_ptr)) {
+      h = (FilterAllocHeader *)a->m_ptr;
+      h->in_arena = true;
+      a->m_ptr += n;
+      return h + 1;
+    }
+  }
+  h = (FilterAllocHeader *)::operator new(n);
+  h->in_arena = false;
+  return h + 1;
+}
+
+void Filter::operator delete(void *p) {
+  if (!p) return;
+  auto h = (FilterAllocHeader *)p - 1;
+  if (!h->in_arena) ::operator delete(h);
+}
+
 Filter::Filter()
   : m_subs(std::make_shared<std::vector<Sub>>())
   , m_buffer_stats(std::make_shared<BufferStats>())
 {
+  if (FilterStats::enabled()) {
+    m_filter_stats = std::make_shared<FilterStats>(m_buffer_stats);
+  }
 }
 
 Filter::Filter(const Filter &r)
   : m_subs(r.m_subs)
   , m_buffer_stats(r.m_buffer_stats)
+  , m_filter_stats(r.m_filter_stats)
   , m_location(r.m_location)
 {
 }
@@ -202,7 +293,46 @@ auto Filter::sub_pipeline(
 
 void Filter::on_event(Event *evt) {
   Pipeline::auto_release(m_pipeline);
+  if (Profiler::tracking()) {
+    Profiler::Scope scope(this);
+    if (m_filter_stats) process_with_stats(evt); else process(evt);
+  } else if (m_filter_stats) {
+    process_with_stats(evt);
+  } else {
+    process(evt);
+  }
+}
+
+//
+// Cycles spent by filters downstream are accumulated in s_child_cycles
+// while this filter is processing, and subtracted from its own count.
+//
+
+void Filter::process_with_stats(Event *evt) {
+  thread_local static uint64_t s_child_cycles = 0;
+
+  auto *fs = m_filter_stats.get();
+  if (!fs->labels[0]) {
+    Dump d;
+    dump(d);
+    auto *mod = dynamic_cast<JSModule*>(module_legacy());
+    fs->labels[0] = mod ? mod->filename() : pjs::Str::empty.get();
+    fs->labels[1] = m_pipeline ? m_pipeline->layout()->name_or_label() : pjs::Str::empty.get();
+    fs->labels[2] = pjs::Str::make(
+      m_location.line > 0 ? d.name + ":" + std::to_string(m_location.line) : d.name
+    );
+  }
+
+  fs->events++;
+  if (auto data = evt->as<Data>()) fs->bytes += data->size();
+
+  auto saved = s_child_cycles;
+  s_child_cycles = 0;
+  auto t0 = utils::cycles();
   process(evt);
+  auto t = utils::cycles() - t0;
+  fs->cycles += (t > s_child_cycles ? t - s_child_cycles : 0);
+  s_child_cycles = saved + t;
 }
 
 void Filter::output(Message *msg) {
@@ -287,4 +417,37 @@ auto Filter::error_location(char *buf, size_t len) -> size_t {
   return Log::format_location(buf, len, m_location, d.name.c_str());
 }
 
+//
+// Filter::Stage
+//
+
+auto Filter::Stage::chain(Filter *head, EventTarget::Input *end) -> EventTarget::Input* {
+  auto f = head;
+  int n = 0;
+  while (f && f->fusible() && !f->m_filter_stats) {
+    f = f->next();
+    n++;
+  }
+  if (!n) return head->EventFunction::input();
+  return new Stage(head, n, f ? f->EventFunction::input() : end);
+}
+
+void Filter::Stage::input(Event *evt) {
+  pjs::Ref<Event> ref(evt);
+  auto f = m_head;
+  if (!f) return;
+  if (!Profiler::tracking()) {
+    int i = 0;
+    while (i < m_count && f->bypass(evt)) {
+      f = f->next();
+      i++;
+    }
+    if (i == m_count) {
+      m_exit->input(evt);
+      return;
+    }
+  }
+  f->EventFunction::input()->input(evt);
+}
+
 } // namespace pipy
@@ -31,6 +31,7 @@
 #include "list.hpp"
 #include "pipeline.hpp"
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -41,6 +42,43 @@ class Context;
 class ModuleBase;
 class Message;
 
+//
+// FilterStats
+//
+// Opt-in counters shared by a filter and all of its clones. Time is
+// counted in cycles and only for the filter itself, not including the
+// filters downstream that it outputs to synchronously.
+//
+
+struct FilterStats : public List<FilterStats>::Item {
+  static bool enabled() { return s_enabled; }
+  static void enable(bool b) { s_enabled = b; }
+  static void init_metrics();
+
+  static void for_each(const std::function<void(FilterStats*)> &callback) {
+    for (auto i = s_all.head(); i; i = i->next()) {
+      callback(i);
+    }
+  }
+
+  FilterStats(std::shared_ptr<BufferStats> buffer_stats)
+    : buffer(buffer_stats) { s_all.push(this); buffer->timing = true; }
+  ~FilterStats() { s_all.remove(this); }
+
+  std::shared_ptr<BufferStats> buffer;
+  pjs::Ref<pjs::Str> labels[3];
+  uint64_t events = 0;
+  uint64_t bytes = 0;
+  uint64_t cycles = 0;
+
+  // Values already added to the metrics
+  uint64_t reported[5] = { 0 };
+
+private:
+  static bool s_enabled;
+  thread_local static List<FilterStats> s_all;
+};
+
 //
 // Filter
 //
@@ -81,12 +119,71 @@ public:
     OutType out_type = OUTPUT_FROM_SELF;
   };
 
+  //
+  // Filter::Arena
+  //
+  // Contiguous storage for the filter clones of one pipeline instance.
+  // While an arena is installed, filters are carved out of it and the
+  // ones that don't fit go to the heap as usual. Space in an arena is
+  // only returned when the whole block is freed by its owner.
+  //
+
+  class Arena {
+  public:
+    Arena(void *buffer, size_t size)
+      : m_ptr((char *)buffer)
+      , m_end((char *)buffer + size) {}
+
+    // Total size requested, including what overflowed to the heap
+    auto requested() const -> size_t { return m_requested; }
+
+  private:
+    char* m_ptr;
+    char* m_end;
+    size_t m_requested = 0;
+
+    friend class Filter;
+  };
+
+  //
+  // Filter::Stage
+  //
+  // Input to a run of adjacent fusible filters. Each event goes to the
+  // first filter in the run that would not just pass it along, or past
+  // the whole run when none of them need it, saving one full dispatch
+  // per skipped filter.
+  //
+
+  class Stage : public pjs::Pooled<Stage>, public EventTarget::Input {
+  public:
+    static auto chain(Filter *head, EventTarget::Input *end) -> EventTarget::Input*;
+
+  private:
+    Stage(Filter *head, int count, EventTarget::Input *exit)
+      : m_head(head)
+      , m_count(count)
+      , m_exit(exit) {}
+
+    Filter* m_head;
+    int m_count;
+    pjs::Ref<EventTarget::Input> m_exit;
+
+    virtual void input(Event *evt) override;
+    virtual void close() override { m_head = nullptr; }
+  };
+
+  static void* operator new(size_t size);
+  static void operator delete(void *p);
+  static void use_arena(Arena *arena) { s_arena = arena; }
+  static auto current_arena() -> Arena* { return s_arena; }
+
   virtual ~Filter() {}
 
   auto module_legacy() const -> ModuleBase*;
   auto context() const -> Context*;
   auto location() const -> const pjs::Location& { return m_location; }
   auto buffer_stats() const -> std::shared_ptr<BufferStats> { return m_buffer_stats; }
+  auto filter_stats() const -> FilterStats* { return m_filter_stats.get(); }
 
   void set_location(const pjs::Location &loc);
   void add_sub_pipeline(PipelineLayout *layout);
@@ -115,6 +212,11 @@ public:
   virtual void shutdown();
   virtual void dump(Dump &d);
 
+  // A fusible filter can tell whether it would pass an event on as is
+  // in its current state, without any side effects
+  virtual bool fusible() const { return false; }
+  virtual bool bypass(Event *evt) { return false; }
+
   auto pipeline() const -> Pipeline* { return m_pipeline; }
   void output(Message *msg);
   void output(Message *msg, EventTarget::Input *input);
@@ -144,15 +246,22 @@ private:
 
   std::shared_ptr<std::vector<Sub>> m_subs;
   std::shared_ptr<BufferStats> m_buffer_stats;
+  std::shared_ptr<FilterStats> m_filter_stats;
 
   PipelineLayout* m_pipeline_layout = nullptr;
   Pipeline* m_pipeline = nullptr;
   pjs::Location m_location;
+  int m_profile_id = 0;
 
   virtual void on_event(Event *evt) override;
 
+  void process_with_stats(Event *evt);
+
+  thread_local static Arena* s_arena;
+
   friend class Pipeline;
   friend class PipelineLayout;
+  friend class Profiler;
 };
 
 } // namespace pipy
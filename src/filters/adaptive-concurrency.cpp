@@ -0,0 +1,341 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "adaptive-concurrency.hpp"
+#include "pipeline.hpp"
+#include "input.hpp"
+#include "net.hpp"
+#include "utils.hpp"
+#include "api/stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace pipy {
+
+//
+// AdaptiveConcurrency::Options
+//
+
+AdaptiveConcurrency::Options::Options(pjs::Object *options) {
+  Value(options, "algorithm")
+    .get_enum(algorithm)
+    .check_nullable();
+  Value(options, "initialLimit")
+    .get(initial_limit)
+    .check_nullable();
+  Value(options, "minLimit")
+    .get(min_limit)
+    .check_nullable();
+  Value(options, "maxLimit")
+    .get(max_limit)
+    .check_nullable();
+  Value(options, "maxQueue")
+    .get(max_queue)
+    .check_nullable();
+  Value(options, "tolerance")
+    .get(tolerance)
+    .check_nullable();
+  Value(options, "smoothing")
+    .get(smoothing)
+    .check_nullable();
+  Value(options, "name")
+    .get(name)
+    .check_nullable();
+
+  if (min_limit < 1) throw std::runtime_error("options.minLimit must be at least 1");
+  if (max_limit < min_limit) throw std::runtime_error("options.maxLimit must not be less than options.minLimit");
+  if (smoothing <= 0 || smoothing > 1) throw std::runtime_error("options.smoothing must be within (0, 1]");
+  if (tolerance < 1) throw std::runtime_error("options.tolerance must not be less than 1");
+  initial_limit = std::max(min_limit, std::min(max_limit, initial_limit));
+}
+
+//
+// AdaptiveConcurrency
+//
+
+void AdaptiveConcurrency::init_metrics() {
+  pjs::Ref<pjs::Array> label_names = pjs::Array::make();
+  label_names->length(1);
+  label_names->set(0, "name");
+
+  auto define = [&](const char *name, int (*get)(Limiter*)) {
+    stats::Gauge::make(
+      pjs::Str::make(name),
+      label_names,
+      [=](stats::Gauge *gauge) {
+        double total = 0;
+        for (auto *l = Limiter::all().head(); l; l = l->next()) {
+          auto n = get(l);
+          if (auto name = l->name()) {
+            gauge->with_labels(&name, 1)->set(n);
+          }
+          total += n;
+        }
+        gauge->set(total);
+      }
+    );
+  };
+
+  define("pipy_adaptive_concurrency_limit", [](Limiter *l) { return l->limit(); });
+  define("pipy_adaptive_concurrency_inflight", [](Limiter *l) { return l->inflight(); });
+  define("pipy_adaptive_concurrency_queued", [](Limiter *l) { return l->queued(); });
+}
+
+AdaptiveConcurrency::AdaptiveConcurrency(pjs::Object *options)
+  : m_limiter(new Limiter(Options(options)))
+  , m_waiter(this)
+  , m_buffer(Filter::buffer_stats())
+{
+}
+
+AdaptiveConcurrency::AdaptiveConcurrency(const AdaptiveConcurrency &r)
+  : Filter(r)
+  , m_limiter(r.m_limiter)
+  , m_waiter(this)
+  , m_buffer(r.m_buffer)
+{
+}
+
+AdaptiveConcurrency::~AdaptiveConcurrency()
+{
+}
+
+void AdaptiveConcurrency::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "adaptiveConcurrency";
+  d.out_type = Dump::OUTPUT_FROM_SUBS;
+}
+
+auto AdaptiveConcurrency::clone() -> Filter* {
+  return new AdaptiveConcurrency(*this);
+}
+
+void AdaptiveConcurrency::reset() {
+  Filter::reset();
+  EventSource::close();
+  if (m_active) m_limiter->release();
+  if (m_waiting) m_limiter->cancel(&m_waiter);
+  m_pipeline = nullptr;
+  m_buffer.clear();
+  m_request_times.clear();
+  m_active = false;
+  m_waiting = false;
+  m_rejected = false;
+}
+
+void AdaptiveConcurrency::process(Event *evt) {
+  if (m_rejected) return;
+
+  if (m_active) {
+    forward(evt);
+
+  } else if (m_waiting) {
+    m_buffer.push(evt);
+
+  } else if (m_limiter->acquire()) {
+    m_active = true;
+    start();
+    forward(evt);
+
+  } else if (m_limiter->wait(&m_waiter)) {
+    m_waiting = true;
+    m_buffer.push(evt);
+
+  } else {
+    m_rejected = true;
+    Filter::output(StreamEnd::make(StreamEnd::OVERLOADED));
+  }
+}
+
+void AdaptiveConcurrency::on_reply(Event *evt) {
+  if (evt->is<MessageEnd>()) {
+    if (!m_request_times.empty()) {
+      m_limiter->sample(utils::now() - m_request_times.front(), false);
+      m_request_times.pop_front();
+    }
+
+  } else if (auto end = evt->as<StreamEnd>()) {
+    if (m_active) {
+      if (end->has_error() && !m_request_times.empty()) {
+        m_limiter->sample(utils::now() - m_request_times.front(), true);
+      }
+      m_request_times.clear();
+      m_limiter->release();
+      m_active = false;
+    }
+  }
+
+  Filter::output(evt);
+}
+
+void AdaptiveConcurrency::start() {
+  m_pipeline = sub_pipeline(0, false, EventSource::reply())->start();
+}
+
+void AdaptiveConcurrency::forward(Event *evt) {
+  if (evt->is<MessageStart>()) {
+    m_request_times.push_back(utils::now());
+  }
+  if (auto p = m_pipeline.get()) {
+    p->input()->input(evt);
+  }
+}
+
+//
+// AdaptiveConcurrency::Limiter
+//
+
+thread_local List<AdaptiveConcurrency::Limiter> AdaptiveConcurrency::Limiter::s_all;
+
+AdaptiveConcurrency::Limiter::Limiter(const Options &options)
+  : m_options(options)
+  , m_limit(options.initial_limit)
+{
+  s_all.push(this);
+}
+
+AdaptiveConcurrency::Limiter::~Limiter() {
+  s_all.remove(this);
+}
+
+bool AdaptiveConcurrency::Limiter::acquire() {
+  if (m_inflight >= limit() || !m_waiters.empty()) return false;
+  m_inflight++;
+  return true;
+}
+
+void AdaptiveConcurrency::Limiter::release() {
+  m_inflight--;
+  if (!m_waiters.empty() && !m_admit_scheduled) {
+    m_admit_scheduled = true;
+    pjs::Ref<Limiter> self(this);
+    Net::current().post(
+      [=]() {
+        InputContext ic;
+        self->m_admit_scheduled = false;
+        self->admit();
+      }
+    );
+  }
+}
+
+bool AdaptiveConcurrency::Limiter::wait(Waiter *waiter) {
+  if (int(m_waiters.size()) >= m_options.max_queue) return false;
+  m_waiters.push(waiter);
+  return true;
+}
+
+void AdaptiveConcurrency::Limiter::cancel(Waiter *waiter) {
+  m_waiters.remove(waiter);
+}
+
+void AdaptiveConcurrency::Limiter::admit() {
+  while (m_inflight < limit()) {
+    auto *w = m_waiters.head();
+    if (!w) break;
+    m_waiters.remove(w);
+    m_inflight++;
+    auto *f = w->filter;
+    f->m_waiting = false;
+    f->m_active = true;
+    f->start();
+    f->m_buffer.flush(
+      [=](Event *evt) {
+        f->forward(evt);
+      }
+    );
+  }
+}
+
+//
+// Both algorithms treat a failed request as a sign of overload and cut
+// the limit by 10%. Growth is skipped while less than half of the limit
+// is in use, since RTT tells nothing about spare capacity then.
+//
+
+void AdaptiveConcurrency::Limiter::sample(double rtt, bool dropped) {
+  static const double LONG_WINDOW = 600;
+
+  auto limit = m_limit;
+  auto app_limited = (m_inflight * 2 < limit);
+  rtt = std::max(rtt, 0.001);
+
+  if (dropped) {
+    limit *= 0.9;
+
+  } else if (m_options.algorithm == Algorithm::GRADIENT2) {
+    if (m_long_rtt <= 0) {
+      m_long_rtt = rtt;
+    } else {
+      m_long_rtt += (rtt - m_long_rtt) / LONG_WINDOW;
+    }
+
+    // Let the long-term average recover quickly once latency drops
+    if (m_long_rtt / rtt > 2) m_long_rtt *= 0.95;
+
+    if (!app_limited) {
+      auto gradient = std::max(0.5, std::min(1.0, m_options.tolerance * m_long_rtt / rtt));
+      auto new_limit = limit * gradient + std::sqrt(limit);
+      limit = limit * (1 - m_options.smoothing) + new_limit * m_options.smoothing;
+    }
+
+  } else {
+    // Re-learn the no-load RTT now and then in case the path changed
+    if (++m_samples >= 30 * limit) {
+      m_samples = 0;
+      m_min_rtt = 0;
+    }
+    if (m_min_rtt <= 0 || rtt < m_min_rtt) m_min_rtt = rtt;
+
+    auto queue = std::ceil(limit * (1 - m_min_rtt / rtt));
+    auto log = std::max(1.0, std::log10(limit));
+    auto alpha = 3 * log;
+    auto beta = 6 * log;
+
+    if (queue <= log) {
+      if (!app_limited) limit += beta;
+    } else if (queue < alpha) {
+      if (!app_limited) limit += log;
+    } else if (queue > beta) {
+      limit -= log;
+    }
+  }
+
+  m_limit = std::max(double(m_options.min_limit), std::min(double(m_options.max_limit), limit));
+}
+
+} // namespace pipy
+
+namespace pjs {
+
+using namespace pipy;
+
+template<> void EnumDef<AdaptiveConcurrency::Algorithm>::init() {
+  define(AdaptiveConcurrency::Algorithm::GRADIENT2, "gradient2");
+  define(AdaptiveConcurrency::Algorithm::VEGAS, "vegas");
+}
+
+} // namespace pjs
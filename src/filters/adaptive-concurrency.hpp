@@ -0,0 +1,148 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ADAPTIVE_CONCURRENCY_HPP
+#define ADAPTIVE_CONCURRENCY_HPP
+
+#include "filter.hpp"
+#include "list.hpp"
+#include "options.hpp"
+
+#include <deque>
+
+namespace pipy {
+
+//
+// AdaptiveConcurrency
+//
+// Limits the number of streams concurrently going through the
+// sub-pipeline. The limit is adjusted continuously from the round-trip
+// time measured between a request entering the sub-pipeline and its
+// response coming out, using either Gradient2 or TCP Vegas. Streams over
+// the limit wait in a bounded queue, or get rejected straight away with
+// an "Overloaded" StreamEnd when the queue is full.
+//
+
+class AdaptiveConcurrency : public Filter, public EventSource {
+public:
+  enum class Algorithm {
+    GRADIENT2,
+    VEGAS,
+  };
+
+  struct Options : public pipy::Options {
+    Algorithm algorithm = Algorithm::GRADIENT2;
+    int initial_limit = 20;
+    int min_limit = 1;
+    int max_limit = 1000;
+    int max_queue = 0;
+    double tolerance = 1.5;
+    double smoothing = 0.2;
+    pjs::Ref<pjs::Str> name;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  static void init_metrics();
+
+  AdaptiveConcurrency(pjs::Object *options);
+
+private:
+  AdaptiveConcurrency(const AdaptiveConcurrency &r);
+  ~AdaptiveConcurrency();
+
+  //
+  // AdaptiveConcurrency::Waiter
+  //
+
+  struct Waiter : public List<Waiter>::Item {
+    AdaptiveConcurrency* filter;
+    Waiter(AdaptiveConcurrency *f) : filter(f) {}
+  };
+
+  //
+  // AdaptiveConcurrency::Limiter
+  //
+  // Shared by all instances cloned from the same filter on one thread.
+  //
+
+  class Limiter :
+    public pjs::RefCount<Limiter>,
+    public List<Limiter>::Item
+  {
+  public:
+    Limiter(const Options &options);
+    ~Limiter();
+
+    auto name() const -> pjs::Str* { return m_options.name; }
+    auto limit() const -> int { return int(m_limit); }
+    auto inflight() const -> int { return m_inflight; }
+    auto queued() const -> int { return m_waiters.size(); }
+
+    bool acquire();
+    void release();
+    bool wait(Waiter *waiter);
+    void cancel(Waiter *waiter);
+    void sample(double rtt, bool dropped);
+
+    static auto all() -> List<Limiter>& { return s_all; }
+
+  private:
+    Options m_options;
+    double m_limit;
+    double m_long_rtt = 0;
+    double m_min_rtt = 0;
+    int m_inflight = 0;
+    int m_samples = 0;
+    List<Waiter> m_waiters;
+    bool m_admit_scheduled = false;
+
+    void admit();
+
+    thread_local static List<Limiter> s_all;
+  };
+
+  pjs::Ref<Limiter> m_limiter;
+  Waiter m_waiter;
+  pjs::Ref<Pipeline> m_pipeline;
+  EventBuffer m_buffer;
+  std::deque<double> m_request_times;
+  bool m_active = false;
+  bool m_waiting = false;
+  bool m_rejected = false;
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void on_reply(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  void start();
+  void forward(Event *evt);
+};
+
+} // namespace pipy
+
+#endif // ADAPTIVE_CONCURRENCY_HPP
@@ -0,0 +1,1453 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cache.hpp"
+#include "pipeline.hpp"
+#include "api/http.hpp"
+#include "fs.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace pipy {
+
+thread_local static const pjs::ConstStr s_headers("headers");
+thread_local static const pjs::ConstStr s_status("status");
+thread_local static const pjs::ConstStr s_host("host");
+thread_local static const pjs::ConstStr s_age("age");
+thread_local static const pjs::ConstStr s_date("date");
+thread_local static const pjs::ConstStr s_etag("etag");
+thread_local static const pjs::ConstStr s_expires("expires");
+thread_local static const pjs::ConstStr s_last_modified("last-modified");
+thread_local static const pjs::ConstStr s_cache_control("cache-control");
+thread_local static const pjs::ConstStr s_pragma("pragma");
+thread_local static const pjs::ConstStr s_vary("vary");
+thread_local static const pjs::ConstStr s_set_cookie("set-cookie");
+thread_local static const pjs::ConstStr s_authorization("authorization");
+thread_local static const pjs::ConstStr s_if_none_match("if-none-match");
+thread_local static const pjs::ConstStr s_if_modified_since("if-modified-since");
+thread_local static const pjs::ConstStr s_GET("GET");
+
+static Data::Producer s_dp("cacheHTTP");
+
+static const int SHARD_COUNT = 16;
+static const int MAX_VARIANTS = 8;
+static const size_t HEAD_SIZE_ESTIMATE = 512;
+
+//
+// Header helpers
+//
+
+static bool get_header(pjs::Object *headers, pjs::Str *name, std::string &value) {
+  if (!headers) return false;
+  pjs::Value v;
+  if (!headers->get(name, v) || v.is_undefined()) return false;
+  if (v.is_array()) {
+    value.clear();
+    v.as<pjs::Array>()->iterate_all(
+      [&](pjs::Value &v, int i) {
+        auto s = v.to_string();
+        if (i > 0) value += ", ";
+        value += s->str();
+        s->release();
+      }
+    );
+  } else {
+    auto s = v.to_string();
+    value = s->str();
+    s->release();
+  }
+  return true;
+}
+
+static auto vary_key(pjs::Object *headers, const std::vector<std::string> &names) -> std::string {
+  std::string key;
+  for (const auto &name : names) {
+    std::string v;
+    pjs::Ref<pjs::Str> s(pjs::Str::make(name));
+    get_header(headers, s, v);
+    key += v;
+    key += '\n';
+  }
+  return key;
+}
+
+struct CacheControl {
+  bool no_store = false;
+  bool no_cache = false;
+  bool is_private = false;
+  double max_age = -1;
+  double s_maxage = -1;
+
+  CacheControl(const std::string &str) {
+    for (const auto &item : utils::split(str, ',')) {
+      auto directive = utils::lower(utils::trim(item));
+      auto p = directive.find('=');
+      auto name = utils::trim(directive.substr(0, p));
+      auto value = p == std::string::npos ? std::string() : utils::trim(directive.substr(p + 1));
+      if (name == "no-store") no_store = true;
+      else if (name == "no-cache") no_cache = true;
+      else if (name == "private") is_private = true;
+      else if (name == "max-age") max_age = std::atof(value.c_str());
+      else if (name == "s-maxage") s_maxage = std::atof(value.c_str());
+    }
+  }
+};
+
+// Parses an IMF-fixdate such as "Sun, 06 Nov 1994 08:49:37 GMT" into milliseconds
+static bool parse_http_date(const std::string &str, double &t) {
+  static const char *months[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+  };
+  int d, y, h, m, s;
+  char mon[4];
+  if (std::sscanf(str.c_str(), "%*3s, %d %3s %d %d:%d:%d", &d, mon, &y, &h, &m, &s) != 6) return false;
+  int month = -1;
+  for (int i = 0; i < 12; i++) if (!std::strncmp(mon, months[i], 3)) month = i + 1;
+  if (month < 0) return false;
+
+  // Days from civil, valid for the proleptic Gregorian calendar
+  y -= month <= 2;
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  double days = double(era) * 146097 + doe - 719468;
+  t = ((days * 24 + h) * 60 + m) * 60 + s;
+  t *= 1000;
+  return true;
+}
+
+//
+// CacheHTTP::Entry
+//
+
+struct CacheHTTP::Entry {
+  pjs::Ref<pjs::SharedObject> head;
+  pjs::Ref<SharedData> body;
+  std::vector<std::string> vary;
+  std::string vary_key;
+  std::string etag;
+  std::string last_modified;
+  std::string file;
+  size_t body_size = 0;
+  double response_time = 0;
+  double initial_age = 0;
+  double freshness = 0;
+  bool no_cache = false;
+
+  auto size() const -> size_t { return body_size + HEAD_SIZE_ESTIMATE; }
+  auto age(double now) const -> double { return initial_age + std::max(0.0, now - response_time) / 1000; }
+  bool fresh(double now) const { return !no_cache && age(now) < freshness; }
+};
+
+//
+// HTTPCache
+//
+// Entries are shared by all worker threads and spread over shards by the
+// hash of their keys, each shard with its own lock and LRU list. Bodies
+// stay as retained chunks, so serving a hit only takes references and
+// copies nothing. With a disk tier, objects falling off the memory LRU are
+// written out to files and mapped back in when asked for again.
+//
+// A key being fetched from upstream is locked. Misses on a locked key
+// wait for it to be unlocked and go through the cache again, so that
+// concurrent misses end up sending a single request upstream.
+//
+
+class HTTPCache {
+public:
+  typedef CacheHTTP::Entry Entry;
+  typedef std::function<std::string(const std::vector<std::string> &)> VaryKey;
+
+  static auto get(const CacheHTTP::Options &options) -> std::shared_ptr<HTTPCache>;
+
+  ~HTTPCache();
+
+  auto max_object_size() const -> size_t { return m_max_object_size; }
+  auto lookup(const std::string &key, const VaryKey &vary_key) -> std::shared_ptr<Entry>;
+  void store(const std::string &key, const std::shared_ptr<Entry> &entry);
+  bool lock(const std::string &key, const std::function<void()> &waiter);
+  void unlock(const std::string &key);
+
+private:
+  struct Object : public List<Object>::Item {
+    std::string key;
+    std::vector<std::shared_ptr<Entry>> variants;
+    size_t size = 0;
+    bool on_disk = false;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, Object*> objects;
+    std::unordered_map<std::string, std::vector<std::function<void()>>> in_flight;
+    List<Object> memory;
+    List<Object> disk;
+    size_t memory_size = 0;
+    size_t disk_size = 0;
+  };
+
+  HTTPCache(const CacheHTTP::Options &options);
+
+  std::string m_name;
+  size_t m_max_object_size;
+  size_t m_shard_size;
+  size_t m_shard_disk_size;
+  std::string m_disk_path;
+  Shard m_shards[SHARD_COUNT];
+
+  auto shard_of(const std::string &key) -> Shard& {
+    return m_shards[std::hash<std::string>()(key) % SHARD_COUNT];
+  }
+
+  void evict(Shard &shard);
+  void drop(Shard &shard, Object *obj);
+  bool spill(std::shared_ptr<Entry> &entry);
+  bool load(std::shared_ptr<Entry> &entry);
+
+  static std::mutex s_mutex;
+  static std::map<std::string, std::weak_ptr<HTTPCache>> s_caches;
+};
+
+std::mutex HTTPCache::s_mutex;
+std::map<std::string, std::weak_ptr<HTTPCache>> HTTPCache::s_caches;
+
+auto HTTPCache::get(const CacheHTTP::Options &options) -> std::shared_ptr<HTTPCache> {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto &p = s_caches[options.name];
+  if (auto cache = p.lock()) return cache;
+  std::shared_ptr<HTTPCache> cache(new HTTPCache(options));
+  p = cache;
+  return cache;
+}
+
+HTTPCache::HTTPCache(const CacheHTTP::Options &options)
+  : m_name(options.name)
+  , m_max_object_size(options.max_object_size)
+  , m_shard_size(options.size / SHARD_COUNT)
+  , m_shard_disk_size(options.disk_size / SHARD_COUNT)
+  , m_disk_path(options.disk_path)
+{
+#ifdef _WIN32
+  if (!m_disk_path.empty()) {
+    Log::warn("[cacheHTTP] disk tier is not supported on this platform");
+    m_disk_path.clear();
+  }
+#else
+  if (!m_disk_path.empty() && m_shard_disk_size > 0) {
+    if (!fs::is_dir(m_disk_path) && !fs::make_dir(m_disk_path)) {
+      Log::error("[cacheHTTP] cannot create directory %s, disk tier disabled", m_disk_path.c_str());
+      m_disk_path.clear();
+    }
+  } else {
+    m_disk_path.clear();
+  }
+#endif
+}
+
+HTTPCache::~HTTPCache() {
+  for (auto &shard : m_shards) {
+    for (const auto &i : shard.objects) {
+      drop(shard, i.second);
+    }
+  }
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto i = s_caches.find(m_name);
+  if (i != s_caches.end() && i->second.expired()) {
+    s_caches.erase(i);
+  }
+}
+
+auto HTTPCache::lookup(const std::string &key, const VaryKey &vary_key) -> std::shared_ptr<Entry> {
+  auto &shard = shard_of(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto i = shard.objects.find(key);
+  if (i == shard.objects.end()) return nullptr;
+  auto obj = i->second;
+
+  auto &variants = obj->variants;
+  int found = -1;
+  for (size_t i = 0; i < variants.size(); i++) {
+    auto &e = variants[i];
+    if (e->vary.empty() || vary_key(e->vary) == e->vary_key) {
+      found = i;
+      break;
+    }
+  }
+  if (found < 0) return nullptr;
+
+  if (obj->on_disk) {
+    shard.disk.remove(obj);
+    shard.disk_size -= obj->size;
+    for (auto &e : variants) {
+      if (!load(e)) {
+        shard.objects.erase(obj->key);
+        obj->on_disk = false;
+        drop(shard, obj);
+        return nullptr;
+      }
+    }
+    obj->on_disk = false;
+    shard.memory.push(obj);
+    shard.memory_size += obj->size;
+    evict(shard);
+  } else if (obj != shard.memory.tail()) {
+    shard.memory.remove(obj);
+    shard.memory.push(obj);
+  }
+
+  return variants[found];
+}
+
+void HTTPCache::store(const std::string &key, const std::shared_ptr<Entry> &entry) {
+  if (entry->size() > m_shard_size) return;
+  auto &shard = shard_of(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto &obj = shard.objects[key];
+  if (!obj) {
+    obj = new Object;
+    obj->key = key;
+    shard.memory.push(obj);
+  } else if (obj->on_disk) {
+    for (const auto &e : obj->variants) {
+      if (!e->file.empty()) fs::unlink(e->file);
+    }
+    obj->variants.clear();
+    shard.disk.remove(obj);
+    shard.disk_size -= obj->size;
+    obj->size = 0;
+    obj->on_disk = false;
+    shard.memory.push(obj);
+  }
+
+  // Replace the same variant, or all of them when the Vary list has changed
+  auto &variants = obj->variants;
+  for (auto i = variants.begin(); i != variants.end(); ) {
+    auto &e = *i;
+    if (e->vary_key == entry->vary_key || e->vary != entry->vary) {
+      obj->size -= e->size();
+      shard.memory_size -= e->size();
+      i = variants.erase(i);
+    } else {
+      i++;
+    }
+  }
+  if (variants.size() >= MAX_VARIANTS) {
+    obj->size -= variants.front()->size();
+    shard.memory_size -= variants.front()->size();
+    variants.erase(variants.begin());
+  }
+
+  variants.push_back(entry);
+  obj->size += entry->size();
+  shard.memory_size += entry->size();
+
+  if (obj != shard.memory.tail()) {
+    shard.memory.remove(obj);
+    shard.memory.push(obj);
+  }
+
+  evict(shard);
+}
+
+bool HTTPCache::lock(const std::string &key, const std::function<void()> &waiter) {
+  auto &shard = shard_of(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto i = shard.in_flight.find(key);
+  if (i == shard.in_flight.end()) {
+    shard.in_flight[key];
+    return true;
+  }
+  i->second.push_back(waiter);
+  return false;
+}
+
+void HTTPCache::unlock(const std::string &key) {
+  std::vector<std::function<void()>> waiters;
+  auto &shard = shard_of(key);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto i = shard.in_flight.find(key);
+    if (i == shard.in_flight.end()) return;
+    waiters = std::move(i->second);
+    shard.in_flight.erase(i);
+  }
+  for (const auto &w : waiters) w();
+}
+
+void HTTPCache::evict(Shard &shard) {
+  while (shard.memory_size > m_shard_size) {
+    auto obj = shard.memory.head();
+    if (!obj) break;
+    shard.memory.remove(obj);
+    shard.memory_size -= obj->size;
+
+    bool spilled = false;
+    if (!m_disk_path.empty() && obj->size <= m_shard_disk_size) {
+      spilled = true;
+      for (auto &e : obj->variants) {
+        if (!spill(e)) {
+          spilled = false;
+          break;
+        }
+      }
+    }
+
+    if (spilled) {
+      obj->on_disk = true;
+      shard.disk.push(obj);
+      shard.disk_size += obj->size;
+      while (shard.disk_size > m_shard_disk_size) {
+        auto old = shard.disk.head();
+        shard.disk.remove(old);
+        shard.disk_size -= old->size;
+        shard.objects.erase(old->key);
+        drop(shard, old);
+      }
+    } else {
+      shard.objects.erase(obj->key);
+      obj->on_disk = false;
+      drop(shard, obj);
+    }
+  }
+}
+
+void HTTPCache::drop(Shard &shard, Object *obj) {
+  for (const auto &e : obj->variants) {
+    if (!e->file.empty()) {
+      fs::unlink(e->file);
+      e->file.clear();
+    }
+  }
+  delete obj;
+}
+
+#ifndef _WIN32
+
+//
+// Entries handed out by lookup() can still be in use on other threads,
+// so spilling and loading never touch an entry in place but swap in a
+// copy that refers to the body by either its file or its data.
+//
+
+bool HTTPCache::spill(std::shared_ptr<Entry> &entry) {
+  static std::atomic<uint64_t> s_file_id(0);
+  if (!entry->body) return false;
+
+  Data data;
+  entry->body->to_data(data);
+
+  char name[64];
+  std::snprintf(name, sizeof(name), "/%d-%llu.body", int(getpid()), (unsigned long long)s_file_id.fetch_add(1));
+  std::string path = m_disk_path + name;
+
+  auto fd = ::open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+  if (fd < 0) return false;
+  for (const auto c : data.chunks()) {
+    auto p = std::get<0>(c);
+    auto n = std::get<1>(c);
+    while (n > 0) {
+      auto w = ::write(fd, p, n);
+      if (w <= 0) {
+        ::close(fd);
+        ::unlink(path.c_str());
+        return false;
+      }
+      p += w;
+      n -= w;
+    }
+  }
+  ::close(fd);
+
+  auto spilled = std::make_shared<Entry>(*entry);
+  spilled->file = path;
+  spilled->body = nullptr;
+  entry = spilled;
+  return true;
+}
+
+bool HTTPCache::load(std::shared_ptr<Entry> &entry) {
+  if (entry->body) return true;
+  if (entry->file.empty()) return false;
+
+  auto &path = entry->file;
+  auto size = entry->body_size;
+
+  Data data;
+  auto fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  if (size > 0) {
+    auto p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    s_dp.push(&data, p, size);
+    ::munmap(p, size);
+  }
+  ::close(fd);
+  ::unlink(path.c_str());
+
+  auto loaded = std::make_shared<Entry>(*entry);
+  loaded->file.clear();
+  loaded->body = SharedData::make(data);
+  entry = loaded;
+  return true;
+}
+
+#else // _WIN32
+
+bool HTTPCache::spill(std::shared_ptr<Entry> &entry) {
+  return false;
+}
+
+bool HTTPCache::load(std::shared_ptr<Entry> &entry) {
+  return entry->body;
+}
+
+#endif // _WIN32
+
+//
+// CacheHTTP::Options
+//
+
+CacheHTTP::Options::Options(pjs::Object *options) {
+  Value(options, "name")
+    .get(name)
+    .check_nullable();
+  Value(options, "size")
+    .get_binary_size(size)
+    .check_nullable();
+  Value(options, "maxObjectSize")
+    .get_binary_size(max_object_size)
+    .check_nullable();
+  Value(options, "ttl")
+    .get_seconds(ttl)
+    .check_nullable();
+  Value(options, "lockTimeout")
+    .get_seconds(lock_timeout)
+    .check_nullable();
+  Value(options, "diskPath")
+    .get(disk_path)
+    .check_nullable();
+  Value(options, "diskSize")
+    .get_binary_size(disk_size)
+    .check_nullable();
+  Value(options, "key")
+    .get(key_f)
+    .check_nullable();
+}
+
+//
+// CacheHTTP
+//
+
+CacheHTTP::CacheHTTP(const Options &options)
+  : m_options(options)
+  , m_cache(HTTPCache::get(options))
+  , m_buffer(Filter::buffer_stats())
+{
+}
+
+CacheHTTP::CacheHTTP(const CacheHTTP &r)
+  : Filter(r)
+  , m_options(r.m_options)
+  , m_cache(r.m_cache)
+  , m_buffer(r.m_buffer)
+{
+}
+
+CacheHTTP::~CacheHTTP() {
+  unlock();
+}
+
+void CacheHTTP::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "cacheHTTP";
+}
+
+auto CacheHTTP::clone() -> Filter* {
+  return new CacheHTTP(*this);
+}
+
+void CacheHTTP::reset() {
+  Filter::reset();
+  EventSource::close();
+  unlock();
+  m_pipeline = nullptr;
+  m_request_headers = nullptr;
+  m_entry = nullptr;
+  m_wait_token = nullptr;
+  m_buffer.clear();
+  m_body.clear();
+  m_timer.cancel();
+  m_state = IDLE;
+  m_request_ended = false;
+  m_revalidating = false;
+  m_storing = false;
+  m_discarding = false;
+}
+
+void CacheHTTP::process(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    if (m_state == IDLE) {
+      m_request_ended = false;
+      start_request(start);
+      return;
+    }
+  }
+
+  if (evt->is<MessageEnd>()) {
+    m_request_ended = true;
+  }
+
+  switch (m_state) {
+    case HIT:
+      if (evt->is<MessageEnd>()) {
+        auto entry = m_entry;
+        m_entry = nullptr;
+        m_state = IDLE;
+        respond(entry);
+      }
+      break;
+    case WAIT:
+      m_buffer.push(evt);
+      break;
+    default:
+      forward(evt);
+      break;
+  }
+}
+
+void CacheHTTP::start_request(MessageStart *start) {
+  auto head = pjs::coerce<http::RequestHead>(start->head());
+  auto headers = head->headers();
+  std::string cache_control, pragma;
+  get_header(headers, s_cache_control, cache_control);
+  get_header(headers, s_pragma, pragma);
+  CacheControl cc(cache_control);
+
+  m_if_none_match.clear();
+  m_revalidating = false;
+  m_storing = false;
+  m_leader = false;
+  m_entry = nullptr;
+
+  if (
+    head->method != s_GET ||
+    (headers && headers->has(s_authorization)) ||
+    cc.no_store
+  ) {
+    m_state = BYPASS;
+    forward(start);
+    return;
+  }
+
+  if (auto f = m_options.key_f.get()) {
+    pjs::Value arg(start->head()), ret;
+    if (!Filter::callback(f, 1, &arg, ret)) return;
+    if (ret.is_nullish()) {
+      m_state = BYPASS;
+      forward(start);
+      return;
+    }
+    auto s = ret.to_string();
+    m_key = s->str();
+    s->release();
+  } else {
+    std::string host;
+    if (head->authority) {
+      host = head->authority->str();
+    } else {
+      get_header(headers, s_host, host);
+    }
+    m_key = host;
+    if (head->path) m_key += head->path->str();
+  }
+
+  m_request_headers = headers;
+  get_header(headers, s_if_none_match, m_if_none_match);
+
+  auto entry = m_cache->lookup(
+    m_key,
+    [&](const std::vector<std::string> &vary) { return vary_key(headers, vary); }
+  );
+
+  bool no_cache = cc.no_cache || cc.max_age == 0 || pragma == "no-cache";
+  if (entry && !no_cache && entry->fresh(utils::now())) {
+    m_entry = entry;
+    m_state = HIT;
+    return;
+  }
+
+  // Revalidate with our own validators unless the client brings its own
+  if (entry && (!entry->etag.empty() || !entry->last_modified.empty())) {
+    if (m_if_none_match.empty() && !(headers && headers->has(s_if_modified_since))) {
+      m_entry = entry;
+      m_revalidating = true;
+    }
+  }
+
+  auto token = std::make_shared<bool>(true);
+  std::weak_ptr<bool> weak(token);
+  auto net = &Net::current();
+  auto waiter = [=]() {
+    net->post([=]() {
+      if (weak.lock()) {
+        InputContext ic;
+        wait_done(true);
+      }
+    });
+  };
+
+  if (m_cache->lock(m_key, waiter)) {
+    m_leader = true;
+    m_state = FORWARD;
+    forward(start);
+  } else {
+    m_wait_token = token;
+    m_state = WAIT;
+    m_buffer.push(start);
+    m_timer.schedule(
+      m_options.lock_timeout,
+      [this]() {
+        InputContext ic;
+        wait_done(false);
+      }
+    );
+  }
+}
+
+void CacheHTTP::forward(Event *evt) {
+  if (!m_pipeline) {
+    m_pipeline = sub_pipeline(0, false, EventSource::reply())->start();
+  }
+  if (m_revalidating) {
+    if (auto start = evt->as<MessageStart>()) {
+      auto head = start->head();
+      auto headers = pjs::coerce<http::RequestHead>(head)->headers();
+      if (!headers) {
+        headers = pjs::Object::make();
+        head->set(s_headers, headers);
+      }
+      if (!m_entry->etag.empty()) {
+        headers->set(s_if_none_match, pjs::Str::make(m_entry->etag));
+      }
+      if (!m_entry->last_modified.empty()) {
+        headers->set(s_if_modified_since, pjs::Str::make(m_entry->last_modified));
+      }
+    }
+  }
+  Filter::output(evt, m_pipeline->input());
+}
+
+void CacheHTTP::wait_done(bool unlocked) {
+  if (m_state != WAIT) return;
+  m_wait_token = nullptr;
+  m_timer.cancel();
+
+  if (unlocked) {
+    auto headers = m_request_headers.get();
+    auto entry = m_cache->lookup(
+      m_key,
+      [&](const std::vector<std::string> &vary) { return vary_key(headers, vary); }
+    );
+    if (entry && entry->fresh(utils::now())) {
+      m_buffer.clear();
+      if (m_request_ended) {
+        m_state = IDLE;
+        respond(entry);
+      } else {
+        m_entry = entry;
+        m_state = HIT;
+      }
+      return;
+    }
+  }
+
+  // Nothing to share, so go upstream without holding the key
+  m_state = FORWARD;
+  m_revalidating = false;
+  m_entry = nullptr;
+  m_buffer.flush([this](Event *evt) { forward(evt); });
+}
+
+void CacheHTTP::unlock() {
+  if (m_leader) {
+    m_leader = false;
+    m_cache->unlock(m_key);
+  }
+}
+
+void CacheHTTP::respond(const std::shared_ptr<Entry> &entry) {
+  auto now = utils::now();
+  pjs::Ref<pjs::Object> head(entry->head->to_object());
+
+  pjs::Value v;
+  head->get(s_headers, v);
+  pjs::Object *headers = v.is_object() ? v.o() : nullptr;
+  if (!headers) {
+    headers = pjs::Object::make();
+    head->set(s_headers, headers);
+  }
+  headers->set(s_age, pjs::Str::make(std::to_string(int64_t(entry->age(now)))));
+
+  bool not_modified = false;
+  if (!m_if_none_match.empty() && !entry->etag.empty()) {
+    if (m_if_none_match == "*") {
+      not_modified = true;
+    } else {
+      for (const auto &tag : utils::split(m_if_none_match, ',')) {
+        auto t = utils::trim(tag);
+        if (t == entry->etag || (t.length() > 2 && t[0] == 'W' && t[1] == '/' && t.substr(2) == entry->etag)) {
+          not_modified = true;
+        }
+      }
+    }
+  }
+
+  if (not_modified) {
+    head->set(s_status, 304);
+    Filter::output(MessageStart::make(head));
+    Filter::output(MessageEnd::make());
+  } else {
+    auto body = Data::make();
+    entry->body->to_data(*body);
+    Filter::output(MessageStart::make(head));
+    Filter::output(body);
+    Filter::output(MessageEnd::make());
+  }
+}
+
+void CacheHTTP::on_reply(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    start_response(start);
+    if (m_discarding) return;
+
+  } else if (auto data = evt->as<Data>()) {
+    if (m_discarding) return;
+    if (m_storing) {
+      m_body.push(*data);
+      if (m_body.size() > m_cache->max_object_size()) {
+        m_storing = false;
+        m_body.clear();
+        unlock();
+      }
+    }
+
+  } else if (auto end = evt->as<MessageEnd>()) {
+    if (m_discarding) {
+      m_discarding = false;
+      return;
+    }
+    if (m_storing) store_response(end);
+    unlock();
+    m_state = IDLE;
+
+  } else if (evt->is<StreamEnd>()) {
+    m_storing = false;
+    m_body.clear();
+    unlock();
+    if (m_discarding) {
+      m_discarding = false;
+      return;
+    }
+  }
+
+  Filter::output(evt);
+}
+
+void CacheHTTP::start_response(MessageStart *start) {
+  m_storing = false;
+  m_body.clear();
+  if (m_state != FORWARD) return;
+
+  auto head = pjs::coerce<http::ResponseHead>(start->head());
+  auto headers = head->headers();
+  auto status = head->status;
+  auto now = utils::now();
+
+  std::string cache_control, expires, date, age, vary;
+  get_header(headers, s_cache_control, cache_control);
+  get_header(headers, s_expires, expires);
+  get_header(headers, s_date, date);
+  get_header(headers, s_age, age);
+  get_header(headers, s_vary, vary);
+  CacheControl cc(cache_control);
+
+  double freshness = -1;
+  if (cc.s_maxage >= 0) {
+    freshness = cc.s_maxage;
+  } else if (cc.max_age >= 0) {
+    freshness = cc.max_age;
+  } else if (!expires.empty()) {
+    double t, d = now;
+    freshness = 0;
+    if (parse_http_date(expires, t)) {
+      if (!date.empty()) parse_http_date(date, d);
+      freshness = std::max(0.0, (t - d) / 1000);
+    }
+  }
+
+  // A 304 to our own validators refreshes the stored entry and the
+  // client gets what was stored rather than the bare 304
+  if (status == 304 && m_revalidating && m_entry) {
+    auto entry = std::make_shared<Entry>(*m_entry);
+    entry->response_time = now;
+    entry->initial_age = std::atof(age.c_str());
+    if (freshness >= 0) entry->freshness = freshness;
+    if (!cache_control.empty()) entry->no_cache = cc.no_cache;
+    if (entry->body) m_cache->store(m_key, entry);
+    unlock();
+    m_discarding = true;
+    m_entry = nullptr;
+    m_state = IDLE;
+    if (entry->body) {
+      respond(entry);
+    } else {
+      m_discarding = false;
+      Filter::output(start);
+    }
+    return;
+  }
+
+  if (cc.no_store || cc.is_private) return;
+  if (headers && headers->has(s_set_cookie)) return;
+  if (vary.find('*') != std::string::npos) return;
+  switch (status) {
+    case 200: case 203: case 204: case 301: case 404: case 410: break;
+    default: return;
+  }
+
+  if (freshness < 0) freshness = m_options.ttl;
+
+  std::string etag, last_modified;
+  get_header(headers, s_etag, etag);
+  get_header(headers, s_last_modified, last_modified);
+  if (freshness <= 0 && etag.empty() && last_modified.empty()) return;
+
+  auto entry = std::make_shared<Entry>();
+  for (const auto &name : utils::split(vary, ',')) {
+    auto n = utils::lower(utils::trim(name));
+    if (!n.empty()) entry->vary.push_back(n);
+  }
+  entry->vary_key = vary_key(m_request_headers, entry->vary);
+
+  pjs::Ref<pjs::Object> h(pjs::Object::make());
+  if (headers) {
+    headers->iterate_all(
+      [&](pjs::Str *k, pjs::Value &v) {
+        auto &name = k->str();
+        if (
+          name != "connection" &&
+          name != "keep-alive" &&
+          name != "transfer-encoding" &&
+          name != "age"
+        ) h->set(k, v);
+      }
+    );
+  }
+  pjs::Ref<pjs::Object> obj(pjs::Object::make());
+  obj->set(s_status, status);
+  obj->set(s_headers, h.get());
+
+  entry->head = pjs::SharedObject::make(obj);
+  entry->etag = etag;
+  entry->last_modified = last_modified;
+  entry->response_time = now;
+  entry->initial_age = std::atof(age.c_str());
+  entry->freshness = std::max(0.0, freshness);
+  entry->no_cache = cc.no_cache;
+
+  m_entry = entry;
+  m_storing = true;
+}
+
+void CacheHTTP::store_response(MessageEnd *end) {
+  m_storing = false;
+  auto entry = m_entry;
+  m_entry = nullptr;
+  if (!entry || entry->body) return;
+  entry->body = SharedData::make(m_body);
+  entry->body_size = m_body.size();
+  m_body.clear();
+  m_cache->store(m_key, entry);
+}
+
+//
+// DNS message helpers
+//
+
+static Data::Producer s_dp_dns("cacheDNS");
+
+static const int DNS_HEADER_SIZE = 12;
+static const int DNS_MAX_SIZE = 65535;
+static const int DNS_MAX_PENDING = 1024;
+static const int DNS_TYPE_SOA = 6;
+static const int DNS_TYPE_OPT = 41;
+
+static inline auto dns_u16(const uint8_t *p) -> uint16_t {
+  return (uint16_t(p[0]) << 8) | p[1];
+}
+
+static inline auto dns_u32(const uint8_t *p) -> uint32_t {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static inline void dns_put_u32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static bool dns_skip_name(const uint8_t *p, int size, int &i) {
+  while (i < size) {
+    auto len = p[i];
+    if ((len & 0xc0) == 0xc0) { i += 2; return i <= size; }
+    if (len & 0xc0) return false;
+    i += len + 1;
+    if (!len) return true;
+  }
+  return false;
+}
+
+//
+// Appends the question in canonical form to the key, with names
+// lowercased so that differently cased queries share one entry.
+// Compressed names are not expected in a question and are refused.
+//
+
+static bool dns_question_key(const uint8_t *p, int size, int &i, std::string &key) {
+  while (i < size) {
+    auto len = p[i++];
+    if (len & 0xc0) return false;
+    key += char(len);
+    if (!len) break;
+    if (i + len > size) return false;
+    for (int j = 0; j < len; j++) {
+      auto c = p[i++];
+      key += char(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+    }
+  }
+  if (i + 4 > size) return false;
+  key.append((const char *)p + i, 4);
+  i += 4;
+  return true;
+}
+
+//
+// Walks the resource records following the question. Calls back with the
+// section index (0 for answers, 1 for authority and 2 for additional) and
+// the offset of each record's TYPE field.
+//
+
+static bool dns_walk_records(
+  const uint8_t *p, int size, int i,
+  const std::function<void(int, int)> &cb
+) {
+  int counts[3] = { dns_u16(p + 6), dns_u16(p + 8), dns_u16(p + 10) };
+  for (int s = 0; s < 3; s++) {
+    for (int n = 0; n < counts[s]; n++) {
+      if (!dns_skip_name(p, size, i)) return false;
+      if (i + 10 > size) return false;
+      auto rdlen = dns_u16(p + i + 8);
+      if (i + 10 + rdlen > size) return false;
+      cb(s, i);
+      i += 10 + rdlen;
+    }
+  }
+  return true;
+}
+
+//
+// DNSCache
+//
+
+class DNSCache {
+public:
+  struct Entry {
+    std::string wire;
+    std::vector<int> ttl_offsets;
+    std::vector<uint32_t> ttls;
+    double time;
+    double expires;
+  };
+
+  static auto get(const CacheDNS::Options &options) -> std::shared_ptr<DNSCache>;
+
+  ~DNSCache();
+
+  auto lookup(const std::string &key, double now) -> std::shared_ptr<const Entry>;
+  void store(const std::string &key, const std::shared_ptr<const Entry> &entry);
+
+private:
+  struct Record : public List<Record>::Item {
+    std::string key;
+    std::shared_ptr<const Entry> entry;
+    auto size() const -> size_t { return key.size() + entry->wire.size() + HEAD_SIZE_ESTIMATE / 4; }
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, Record*> records;
+    List<Record> lru;
+    size_t size = 0;
+  };
+
+  DNSCache(const CacheDNS::Options &options);
+
+  std::string m_name;
+  size_t m_shard_size;
+  Shard m_shards[SHARD_COUNT];
+
+  auto shard_of(const std::string &key) -> Shard& {
+    return m_shards[std::hash<std::string>()(key) % SHARD_COUNT];
+  }
+
+  void drop(Shard &shard, Record *rec);
+
+  static std::mutex s_mutex;
+  static std::map<std::string, std::weak_ptr<DNSCache>> s_caches;
+};
+
+std::mutex DNSCache::s_mutex;
+std::map<std::string, std::weak_ptr<DNSCache>> DNSCache::s_caches;
+
+auto DNSCache::get(const CacheDNS::Options &options) -> std::shared_ptr<DNSCache> {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto &p = s_caches[options.name];
+  if (auto cache = p.lock()) return cache;
+  std::shared_ptr<DNSCache> cache(new DNSCache(options));
+  p = cache;
+  return cache;
+}
+
+DNSCache::DNSCache(const CacheDNS::Options &options)
+  : m_name(options.name)
+  , m_shard_size(options.size / SHARD_COUNT)
+{
+}
+
+DNSCache::~DNSCache() {
+  for (auto &shard : m_shards) {
+    for (const auto &i : shard.records) {
+      shard.lru.remove(i.second);
+      delete i.second;
+    }
+  }
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto i = s_caches.find(m_name);
+  if (i != s_caches.end() && i->second.expired()) {
+    s_caches.erase(i);
+  }
+}
+
+auto DNSCache::lookup(const std::string &key, double now) -> std::shared_ptr<const Entry> {
+  auto &shard = shard_of(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto i = shard.records.find(key);
+  if (i == shard.records.end()) return nullptr;
+  auto rec = i->second;
+  if (now >= rec->entry->expires) {
+    drop(shard, rec);
+    return nullptr;
+  }
+  if (rec != shard.lru.tail()) {
+    shard.lru.remove(rec);
+    shard.lru.push(rec);
+  }
+  return rec->entry;
+}
+
+void DNSCache::store(const std::string &key, const std::shared_ptr<const Entry> &entry) {
+  auto &shard = shard_of(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto &rec = shard.records[key];
+  if (rec) {
+    shard.size -= rec->size();
+    shard.lru.remove(rec);
+  } else {
+    rec = new Record;
+    rec->key = key;
+  }
+  rec->entry = entry;
+  shard.size += rec->size();
+  shard.lru.push(rec);
+  while (shard.size > m_shard_size) {
+    auto head = shard.lru.head();
+    if (!head) break;
+    drop(shard, head);
+  }
+}
+
+void DNSCache::drop(Shard &shard, Record *rec) {
+  shard.size -= rec->size();
+  shard.lru.remove(rec);
+  shard.records.erase(rec->key);
+  delete rec;
+}
+
+//
+// CacheDNS::Options
+//
+
+CacheDNS::Options::Options(pjs::Object *options) {
+  Value(options, "name")
+    .get(name)
+    .check_nullable();
+  Value(options, "size")
+    .get_binary_size(size)
+    .check_nullable();
+  Value(options, "minTTL")
+    .get_seconds(min_ttl)
+    .check_nullable();
+  Value(options, "maxTTL")
+    .get_seconds(max_ttl)
+    .check_nullable();
+  Value(options, "negativeTTL")
+    .get_seconds(negative_ttl)
+    .check_nullable();
+}
+
+//
+// CacheDNS
+//
+// Each Data event is taken as one DNS message, the way datagrams come
+// out of a UDP listener. Hits are answered right here by copying the
+// cached response and patching its ID and TTLs, so no script runs.
+// Misses are remembered by ID and the responses are stored on the
+// way back from the sub-pipeline.
+//
+
+CacheDNS::CacheDNS(const Options &options)
+  : m_options(options)
+  , m_cache(DNSCache::get(options))
+{
+}
+
+CacheDNS::CacheDNS(const CacheDNS &r)
+  : Filter(r)
+  , m_options(r.m_options)
+  , m_cache(r.m_cache)
+{
+}
+
+CacheDNS::~CacheDNS() {
+}
+
+void CacheDNS::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "cacheDNS";
+}
+
+auto CacheDNS::clone() -> Filter* {
+  return new CacheDNS(*this);
+}
+
+void CacheDNS::reset() {
+  Filter::reset();
+  EventSource::close();
+  m_pipeline = nullptr;
+  m_pending.clear();
+}
+
+void CacheDNS::process(Event *evt) {
+  auto data = evt->as<Data>();
+  if (!data) {
+    if (evt->is<StreamEnd>() && !m_pipeline) {
+      Filter::output(evt);
+    } else {
+      forward(evt);
+    }
+    return;
+  }
+
+  auto size = data->size();
+  if (size < DNS_HEADER_SIZE || size > DNS_MAX_SIZE) {
+    forward(evt);
+    return;
+  }
+
+  uint8_t buf[DNS_MAX_SIZE];
+  data->to_bytes(buf, size);
+
+  // Only standard queries with a single question are looked up
+  if ((buf[2] & 0xf8) || dns_u16(buf + 4) != 1) {
+    forward(evt);
+    return;
+  }
+
+  std::string key;
+  int i = DNS_HEADER_SIZE;
+  if (!dns_question_key(buf, size, i, key)) {
+    forward(evt);
+    return;
+  }
+
+  // Responses differ by the CD bit and by EDNS DO, so both go into the key
+  bool dnssec_ok = false;
+  dns_walk_records(
+    buf, size, i,
+    [&](int section, int offset) {
+      if (section == 2 && dns_u16(buf + offset) == DNS_TYPE_OPT) {
+        if (buf[offset + 6] & 0x80) dnssec_ok = true;
+      }
+    }
+  );
+  key += char((buf[3] & 0x10) | (dnssec_ok ? 1 : 0));
+
+  auto now = utils::now();
+  if (auto entry = m_cache->lookup(key, now)) {
+    auto &wire = entry->wire;
+    auto id = dns_u16(buf);
+    auto rd = buf[2] & 0x01;
+    auto out = buf;
+    std::memcpy(out, wire.c_str(), wire.size());
+    out[0] = id >> 8;
+    out[1] = id;
+    out[2] = (out[2] & 0xfe) | rd;
+    auto elapsed = uint32_t((now - entry->time) / 1000);
+    for (size_t n = 0; n < entry->ttl_offsets.size(); n++) {
+      auto ttl = entry->ttls[n];
+      dns_put_u32(out + entry->ttl_offsets[n], ttl > elapsed ? ttl - elapsed : 0);
+    }
+    Filter::output(s_dp_dns.make(out, wire.size()));
+    return;
+  }
+
+  if (m_pending.size() >= DNS_MAX_PENDING) m_pending.clear();
+  m_pending[dns_u16(buf)] = std::move(key);
+  forward(evt);
+}
+
+void CacheDNS::forward(Event *evt) {
+  if (!m_pipeline) {
+    m_pipeline = sub_pipeline(0, false, EventSource::reply())->start();
+  }
+  Filter::output(evt, m_pipeline->input());
+}
+
+void CacheDNS::on_reply(Event *evt) {
+  auto data = evt->as<Data>();
+  if (!data || m_pending.empty()) {
+    Filter::output(evt);
+    return;
+  }
+
+  auto size = data->size();
+  if (size < DNS_HEADER_SIZE || size > DNS_MAX_SIZE) {
+    Filter::output(evt);
+    return;
+  }
+
+  uint8_t buf[DNS_MAX_SIZE];
+  data->to_bytes(buf, size);
+
+  auto p = m_pending.find(dns_u16(buf));
+  if (p == m_pending.end()) {
+    Filter::output(evt);
+    return;
+  }
+
+  std::string key(std::move(p->second));
+  m_pending.erase(p);
+
+  // Only complete NOERROR and NXDOMAIN answers to the same question qualify
+  auto rcode = buf[3] & 0x0f;
+  std::string question;
+  int i = DNS_HEADER_SIZE;
+  if (
+    !(buf[2] & 0x80) || (buf[2] & 0x02) ||
+    (rcode != 0 && rcode != 3) ||
+    dns_u16(buf + 4) != 1 ||
+    !dns_question_key(buf, size, i, question) ||
+    key.compare(0, question.size(), question)
+  ) {
+    Filter::output(evt);
+    return;
+  }
+
+  std::shared_ptr<DNSCache::Entry> entry(new DNSCache::Entry);
+  uint32_t min_ttl = UINT32_MAX;
+  uint32_t soa_ttl = UINT32_MAX;
+  bool has_answers = dns_u16(buf + 6) > 0;
+  bool ok = dns_walk_records(
+    buf, size, i,
+    [&](int section, int offset) {
+      auto type = dns_u16(buf + offset);
+      if (type == DNS_TYPE_OPT) return;
+      auto ttl = dns_u32(buf + offset + 4);
+      entry->ttl_offsets.push_back(offset + 4);
+      entry->ttls.push_back(ttl);
+      if (section < 2) min_ttl = std::min(min_ttl, ttl);
+      if (section == 1 && type == DNS_TYPE_SOA) {
+        auto rdlen = dns_u16(buf + offset + 8);
+        if (rdlen >= 20) {
+          auto minimum = dns_u32(buf + offset + 10 + rdlen - 4);
+          soa_ttl = std::min(ttl, minimum);
+        }
+      }
+    }
+  );
+
+  double ttl = 0;
+  if (ok) {
+    if (has_answers && rcode == 0) {
+      ttl = std::max(m_options.min_ttl, std::min(m_options.max_ttl, double(min_ttl)));
+    } else if (soa_ttl != UINT32_MAX) {
+      ttl = std::min(m_options.negative_ttl, double(soa_ttl));
+    }
+  }
+
+  if (ttl >= 1) {
+    auto now = utils::now();
+    entry->wire.assign((const char *)buf, size);
+    entry->time = now;
+    entry->expires = now + ttl * 1000;
+    m_cache->store(key, entry);
+  }
+
+  Filter::output(evt);
+}
+
+} // namespace pipy
@@ -0,0 +1,149 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include "filter.hpp"
+#include "buffer.hpp"
+#include "timer.hpp"
+#include "options.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace pipy {
+
+class HTTPCache;
+class DNSCache;
+
+//
+// CacheHTTP
+//
+
+class CacheHTTP : public Filter, public EventSource {
+public:
+  struct Options : public pipy::Options {
+    std::string name;
+    size_t size = 64 * 1024 * 1024;
+    size_t max_object_size = 1024 * 1024;
+    double ttl = 0;
+    double lock_timeout = 5;
+    std::string disk_path;
+    size_t disk_size = 0;
+    pjs::Ref<pjs::Function> key_f;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  struct Entry;
+
+  CacheHTTP(const Options &options);
+
+private:
+  CacheHTTP(const CacheHTTP &r);
+  ~CacheHTTP();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void on_reply(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  enum State {
+    IDLE,
+    BYPASS,  // not cacheable, just passing through
+    FORWARD, // sent upstream, response may be stored
+    WAIT,    // waiting on another request for the same key
+    HIT,     // answering from the cache once the request ends
+  };
+
+  Options m_options;
+  std::shared_ptr<HTTPCache> m_cache;
+  pjs::Ref<Pipeline> m_pipeline;
+  pjs::Ref<pjs::Object> m_request_headers;
+  std::shared_ptr<Entry> m_entry;
+  std::shared_ptr<bool> m_wait_token;
+  std::string m_key;
+  std::string m_if_none_match;
+  EventBuffer m_buffer;
+  Data m_body;
+  Timer m_timer;
+  State m_state = IDLE;
+  bool m_request_ended = false;
+  bool m_leader = false;
+  bool m_revalidating = false;
+  bool m_storing = false;
+  bool m_discarding = false;
+
+  void start_request(MessageStart *start);
+  void forward(Event *evt);
+  void wait_done(bool unlocked);
+  void unlock();
+  void respond(const std::shared_ptr<Entry> &entry);
+  void start_response(MessageStart *start);
+  void store_response(MessageEnd *end);
+};
+
+//
+// CacheDNS
+//
+
+class CacheDNS : public Filter, public EventSource {
+public:
+  struct Options : public pipy::Options {
+    std::string name;
+    size_t size = 16 * 1024 * 1024;
+    double min_ttl = 0;
+    double max_ttl = 86400;
+    double negative_ttl = 300;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  CacheDNS(const Options &options);
+
+private:
+  CacheDNS(const CacheDNS &r);
+  ~CacheDNS();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void on_reply(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  Options m_options;
+  std::shared_ptr<DNSCache> m_cache;
+  pjs::Ref<Pipeline> m_pipeline;
+  std::unordered_map<uint16_t, std::string> m_pending;
+
+  void forward(Event *evt);
+};
+
+} // namespace pipy
+
+#endif // CACHE_HPP
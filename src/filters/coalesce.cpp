@@ -0,0 +1,353 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "coalesce.hpp"
+#include "pipeline.hpp"
+#include "net.hpp"
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace pipy {
+
+//
+// Coalesce::Result
+//
+
+struct Coalesce::Result {
+  pjs::Ref<pjs::SharedObject> head;
+  pjs::Ref<SharedData> body;
+};
+
+//
+// Flights
+//
+// Requests in flight by key, shared by all worker threads. The first
+// request for a key leads and goes upstream. Others with the same key
+// follow: they register a waiter and get the leader's response when it
+// lands, or nothing if the leader failed or its response was too big
+// to share, in which case they go upstream on their own. Responses are
+// kept as a shared head and retained body chunks, so each follower only
+// takes references to them.
+//
+
+class Flights {
+public:
+  typedef std::function<void(const std::shared_ptr<Coalesce::Result> &)> Waiter;
+
+  static auto get(const std::string &name) -> std::shared_ptr<Flights>;
+
+  ~Flights();
+
+  bool join(const std::string &key, const Waiter &waiter);
+  void land(const std::string &key, const std::shared_ptr<Coalesce::Result> &result);
+
+private:
+  Flights(const std::string &name) : m_name(name) {}
+
+  std::string m_name;
+  std::mutex m_mutex;
+  std::unordered_map<std::string, std::vector<Waiter>> m_flights;
+
+  static std::mutex s_mutex;
+  static std::map<std::string, std::weak_ptr<Flights>> s_flights;
+};
+
+std::mutex Flights::s_mutex;
+std::map<std::string, std::weak_ptr<Flights>> Flights::s_flights;
+
+auto Flights::get(const std::string &name) -> std::shared_ptr<Flights> {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto &p = s_flights[name];
+  if (auto flights = p.lock()) return flights;
+  std::shared_ptr<Flights> flights(new Flights(name));
+  p = flights;
+  return flights;
+}
+
+Flights::~Flights() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto i = s_flights.find(m_name);
+  if (i != s_flights.end() && i->second.expired()) {
+    s_flights.erase(i);
+  }
+}
+
+bool Flights::join(const std::string &key, const Waiter &waiter) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto i = m_flights.find(key);
+  if (i == m_flights.end()) {
+    m_flights[key];
+    return true;
+  }
+  i->second.push_back(waiter);
+  return false;
+}
+
+void Flights::land(const std::string &key, const std::shared_ptr<Coalesce::Result> &result) {
+  std::vector<Waiter> waiters;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto i = m_flights.find(key);
+    if (i == m_flights.end()) return;
+    waiters = std::move(i->second);
+    m_flights.erase(i);
+  }
+  for (const auto &w : waiters) w(result);
+}
+
+//
+// Coalesce::Options
+//
+
+Coalesce::Options::Options(pjs::Object *options) {
+  Value(options, "name")
+    .get(name)
+    .check_nullable();
+  Value(options, "maxSize")
+    .get_binary_size(max_size)
+    .check_nullable();
+  Value(options, "timeout")
+    .get_seconds(timeout)
+    .check_nullable();
+}
+
+//
+// Coalesce
+//
+
+Coalesce::Coalesce(pjs::Function *key, const Options &options)
+  : m_key_f(key)
+  , m_options(options)
+  , m_flights(Flights::get(options.name))
+  , m_buffer(Filter::buffer_stats())
+{
+}
+
+Coalesce::Coalesce(const Coalesce &r)
+  : Filter(r)
+  , m_key_f(r.m_key_f)
+  , m_options(r.m_options)
+  , m_flights(r.m_flights)
+  , m_buffer(r.m_buffer)
+{
+}
+
+Coalesce::~Coalesce() {
+  land(nullptr);
+}
+
+void Coalesce::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "coalesce";
+}
+
+auto Coalesce::clone() -> Filter* {
+  return new Coalesce(*this);
+}
+
+void Coalesce::reset() {
+  Filter::reset();
+  EventSource::close();
+  land(nullptr);
+  m_pipeline = nullptr;
+  m_result = nullptr;
+  m_wait_token = nullptr;
+  m_buffer.clear();
+  m_body.clear();
+  m_timer.cancel();
+  m_state = IDLE;
+  m_request_ended = false;
+  m_collecting = false;
+}
+
+void Coalesce::process(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    if (m_state == IDLE) {
+      m_request_ended = false;
+      start_request(start);
+      return;
+    }
+  }
+
+  if (evt->is<MessageEnd>()) {
+    m_request_ended = true;
+  }
+
+  switch (m_state) {
+    case ANSWERED:
+      if (evt->is<MessageEnd>()) {
+        auto result = m_result;
+        m_result = nullptr;
+        m_state = IDLE;
+        respond(result);
+      }
+      break;
+    case WAIT:
+      m_buffer.push(evt);
+      break;
+    default:
+      forward(evt);
+      break;
+  }
+}
+
+void Coalesce::start_request(MessageStart *start) {
+  m_leader = false;
+  m_collecting = false;
+  m_result = nullptr;
+
+  pjs::Value arg(start->head()), ret;
+  if (!Filter::callback(m_key_f, 1, &arg, ret)) return;
+  if (ret.is_nullish()) {
+    m_state = BYPASS;
+    forward(start);
+    return;
+  }
+
+  auto s = ret.to_string();
+  m_key = s->str();
+  s->release();
+
+  auto token = std::make_shared<bool>(true);
+  std::weak_ptr<bool> weak(token);
+  auto net = &Net::current();
+  auto waiter = [=](const std::shared_ptr<Result> &result) {
+    net->post([=]() {
+      if (weak.lock()) {
+        InputContext ic;
+        wait_done(result);
+      }
+    });
+  };
+
+  if (m_flights->join(m_key, waiter)) {
+    m_leader = true;
+    m_collecting = true;
+    m_state = LEAD;
+    forward(start);
+  } else {
+    m_wait_token = token;
+    m_state = WAIT;
+    m_buffer.push(start);
+    m_timer.schedule(
+      m_options.timeout,
+      [this]() {
+        InputContext ic;
+        wait_done(nullptr);
+      }
+    );
+  }
+}
+
+void Coalesce::forward(Event *evt) {
+  if (!m_pipeline) {
+    m_pipeline = sub_pipeline(0, false, EventSource::reply())->start();
+  }
+  Filter::output(evt, m_pipeline->input());
+}
+
+void Coalesce::land(const std::shared_ptr<Result> &result) {
+  if (m_leader) {
+    m_leader = false;
+    m_collecting = false;
+    m_body.clear();
+    m_flights->land(m_key, result);
+  }
+}
+
+void Coalesce::wait_done(const std::shared_ptr<Result> &result) {
+  if (m_state != WAIT) return;
+  m_wait_token = nullptr;
+  m_timer.cancel();
+
+  if (result) {
+    m_buffer.clear();
+    if (m_request_ended) {
+      m_state = IDLE;
+      respond(result);
+    } else {
+      m_result = result;
+      m_state = ANSWERED;
+    }
+    return;
+  }
+
+  // Nothing to share, so go upstream alone
+  m_state = BYPASS;
+  m_buffer.flush([this](Event *evt) { forward(evt); });
+}
+
+void Coalesce::respond(const std::shared_ptr<Result> &result) {
+  auto body = Data::make();
+  result->body->to_data(*body);
+  Filter::output(MessageStart::make(result->head->to_object()));
+  Filter::output(body);
+  Filter::output(MessageEnd::make());
+}
+
+void Coalesce::on_reply(Event *evt) {
+  if (m_collecting) {
+    if (auto start = evt->as<MessageStart>()) {
+      auto result = std::make_shared<Result>();
+      if (auto head = start->head()) result->head = pjs::SharedObject::make(head);
+      m_result = result;
+      m_body.clear();
+
+    } else if (auto data = evt->as<Data>()) {
+      m_body.push(*data);
+      if (m_body.size() > m_options.max_size) {
+        m_result = nullptr;
+        land(nullptr);
+      }
+
+    } else if (evt->is<MessageEnd>()) {
+      auto result = m_result;
+      m_result = nullptr;
+      if (result) {
+        if (!result->head) {
+          pjs::Ref<pjs::Object> head(pjs::Object::make());
+          result->head = pjs::SharedObject::make(head);
+        }
+        result->body = SharedData::make(m_body);
+      }
+      land(result);
+      m_state = IDLE;
+
+    } else if (evt->is<StreamEnd>()) {
+      m_result = nullptr;
+      land(nullptr);
+    }
+
+  } else if (evt->is<MessageEnd>() && m_state != WAIT) {
+    m_state = IDLE;
+  }
+
+  Filter::output(evt);
+}
+
+} // namespace pipy
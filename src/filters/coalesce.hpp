@@ -0,0 +1,101 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef COALESCE_HPP
+#define COALESCE_HPP
+
+#include "filter.hpp"
+#include "buffer.hpp"
+#include "timer.hpp"
+#include "options.hpp"
+
+#include <memory>
+#include <string>
+
+namespace pipy {
+
+class Flights;
+
+//
+// Coalesce
+//
+
+class Coalesce : public Filter, public EventSource {
+public:
+  struct Options : public pipy::Options {
+    std::string name;
+    size_t max_size = 1024 * 1024;
+    double timeout = 5;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  struct Result;
+
+  Coalesce(pjs::Function *key, const Options &options);
+
+private:
+  Coalesce(const Coalesce &r);
+  ~Coalesce();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void on_reply(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  enum State {
+    IDLE,
+    BYPASS,   // not coalesced, just passing through
+    LEAD,     // sent upstream, response shared with followers
+    WAIT,     // waiting on the leader of the same key
+    ANSWERED, // answering with the leader's response once the request ends
+  };
+
+  pjs::Ref<pjs::Function> m_key_f;
+  Options m_options;
+  std::shared_ptr<Flights> m_flights;
+  pjs::Ref<Pipeline> m_pipeline;
+  std::shared_ptr<Result> m_result;
+  std::shared_ptr<bool> m_wait_token;
+  std::string m_key;
+  EventBuffer m_buffer;
+  Data m_body;
+  Timer m_timer;
+  State m_state = IDLE;
+  bool m_request_ended = false;
+  bool m_leader = false;
+  bool m_collecting = false;
+
+  void start_request(MessageStart *start);
+  void forward(Event *evt);
+  void land(const std::shared_ptr<Result> &result);
+  void wait_done(const std::shared_ptr<Result> &result);
+  void respond(const std::shared_ptr<Result> &result);
+};
+
+} // namespace pipy
+
+#endif // COALESCE_HPP
@@ -26,30 +26,68 @@
 #include "compress.hpp"
 #include "compressor.hpp"
 #include "data.hpp"
+#include "thread-pool.hpp"
 #include "api/http.hpp"
 
+#include <openssl/evp.h>
+
+#include <algorithm>
+
 namespace pipy {
 
 thread_local static const pjs::ConstStr s_headers("headers");
 thread_local static const pjs::ConstStr s_content_encoding("content-encoding");
+thread_local static const pjs::ConstStr s_content_length("content-length");
 thread_local static const pjs::ConstStr s_gzip("gzip");
 thread_local static const pjs::ConstStr s_deflate("deflate");
 thread_local static const pjs::ConstStr s_inflate("inflate");
 
 static Data::Producer s_dp("compressMessage()");
 
+//
+// Compress::Options
+//
+// A preset dictionary primes the deflate window with content shared by
+// many small bodies, such as the common keys of JSON API payloads. Peers
+// must have agreed on the same dictionary out of band.
+//
+
+Compress::Options::Options(pjs::Object *options) {
+  pjs::Ref<Data> dictionary_data;
+  std::string dictionary_str;
+  Value(options, "dictionary")
+    .get(dictionary_data)
+    .get(dictionary_str)
+    .check_nullable();
+  if (dictionary_data) {
+    dictionary = std::make_shared<std::string>(dictionary_data->to_string());
+  } else if (!dictionary_str.empty()) {
+    dictionary = std::make_shared<std::string>(dictionary_str);
+  }
+
+  Value(options, "cacheSize")
+    .get_binary_size(cache_size)
+    .check_nullable();
+
+  Value(options, "parallelThreshold")
+    .get_binary_size(parallel_threshold)
+    .check_nullable();
+}
+
 //
 // Compress
 //
 
-Compress::Compress(const pjs::Value &algorithm)
+Compress::Compress(const pjs::Value &algorithm, const Options &options)
   : m_algorithm(algorithm)
+  , m_options(options)
 {
 }
 
 Compress::Compress(const Compress &r)
   : Filter(r)
   , m_algorithm(r.m_algorithm)
+  , m_options(r.m_options)
 {
 }
 
@@ -87,7 +125,7 @@ void Compress::process(Event *evt) {
     auto out = [this](Data &data) { compressor_output(data); };
     auto str = algorithm.s();
     if (str == s_deflate) {
-      m_compressor = Compressor::deflate(out);
+      m_compressor = Compressor::deflate(out, m_options.dictionary.get());
     } else if (str == s_gzip) {
       m_compressor = Compressor::gzip(out);
     } else {
@@ -115,19 +153,69 @@ void Compress::compressor_output(Data &data) {
   Filter::output(Data::make(std::move(data)));
 }
 
+//
+// CompressHTTP::Cache
+//
+
+auto CompressHTTP::Cache::get(const std::string &key) -> Data* {
+  auto i = m_index.find(key);
+  if (i == m_index.end()) return nullptr;
+  m_entries.splice(m_entries.begin(), m_entries, i->second);
+  return i->second->data;
+}
+
+void CompressHTTP::Cache::set(const std::string &key, Data *data) {
+  if (data->size() > m_capacity) return;
+  if (m_index.count(key)) return;
+  m_entries.push_front({ key, data });
+  m_index[key] = m_entries.begin();
+  m_size += data->size();
+  while (m_size > m_capacity) {
+    auto &e = m_entries.back();
+    m_size -= e.data->size();
+    m_index.erase(e.key);
+    m_entries.pop_back();
+  }
+}
+
 //
 // CompressHTTP
 //
+// With a cache, bodies with a content-length up to MAX_CACHED_BODY_SIZE
+// are held back until the end of the message so that identical content
+// is compressed only once. Larger bodies and bodies of unknown length,
+// which may well be long-lived streams, are compressed as they come.
+// For the latter, each chunk is flushed out so that a stream doesn't
+// stall inside the compressor.
+//
+// Bodies with a content-length of at least parallelThreshold are split
+// into blocks compressed on the shared thread pool. Input is held back
+// while too much of the body is still waiting to be compressed, and any
+// events after the end of the message wait until its last block is out.
+//
 
+static const size_t MAX_CACHED_BODY_SIZE = 1024 * 1024;
+static const size_t PARALLEL_BLOCK_SIZE = 128 * 1024;
 
-CompressHTTP::CompressHTTP(const pjs::Value &algorithm)
+CompressHTTP::CompressHTTP(const pjs::Value &algorithm, const Compress::Options &options)
   : m_algorithm(algorithm)
+  , m_options(options)
 {
+  // Clients decoding a standard Content-Encoding have no way of
+  // knowing about a preset dictionary and would fail on the body
+  if (options.dictionary) {
+    throw std::runtime_error("compressHTTP does not support preset dictionaries");
+  }
+  if (options.cache_size > 0) {
+    m_cache = std::make_shared<Cache>(options.cache_size);
+  }
 }
 
 CompressHTTP::CompressHTTP(const CompressHTTP &r)
   : Filter(r)
   , m_algorithm(r.m_algorithm)
+  , m_options(r.m_options)
+  , m_cache(r.m_cache)
 {
 }
 
@@ -150,10 +238,26 @@ void CompressHTTP::reset() {
     m_compressor->finalize();
     m_compressor = nullptr;
   }
+  if (m_parallel_compressor) {
+    m_parallel_compressor->finalize();
+    m_parallel_compressor = nullptr;
+  }
+  m_encoding = nullptr;
+  m_buffer.clear();
+  m_deferred.clear();
+  m_congestion.end();
   m_is_message_started = false;
+  m_is_buffering = false;
+  m_is_streaming = false;
+  m_is_congested = false;
 }
 
 void CompressHTTP::process(Event *evt) {
+  if (m_parallel_compressor && !m_is_message_started) {
+    m_deferred.push(evt);
+    return;
+  }
+
   if (auto ms = evt->as<MessageStart>()) {
     if (!m_is_message_started) {
       pjs::Ref<pjs::Str> algorithm;
@@ -176,23 +280,36 @@ void CompressHTTP::process(Event *evt) {
       }
       pjs::Ref<http::MessageHead> head = pjs::coerce<http::MessageHead>(ms->head());
       bool has_content_encoding = false;
-      if (auto headers = head->headers.get()) {
+      if (auto headers = head->headers()) {
         has_content_encoding = headers->has(s_content_encoding);
       }
-      if (!has_content_encoding) {
-        auto headers = head->headers.get();
+      if (!has_content_encoding && (algorithm == s_gzip || algorithm == s_deflate)) {
+        auto headers = head->headers();
         if (!headers) {
           headers = pjs::Object::make();
           if (!ms->head()) ms = MessageStart::make(pjs::Object::make());
           ms->head()->set(s_headers, headers);
         }
-        auto out = [this](Data &data) { compressor_output(data); };
-        if (algorithm == s_gzip) {
-          m_compressor = Compressor::gzip(out);
-          headers->set(s_content_encoding, s_gzip.get());
-        } else if (algorithm == s_deflate) {
-          m_compressor = Compressor::deflate(out);
-          headers->set(s_content_encoding, s_deflate.get());
+        m_encoding = algorithm;
+        headers->set(s_content_encoding, m_encoding.get());
+        pjs::Value content_length;
+        headers->get(s_content_length, content_length);
+        if (
+          m_options.parallel_threshold > 0 &&
+          !content_length.is_undefined() &&
+          content_length.to_number() >= m_options.parallel_threshold
+        ) {
+          new_parallel_compressor();
+        } else if (m_cache) {
+          size_t limit = std::min(MAX_CACHED_BODY_SIZE, m_cache->capacity());
+          m_is_buffering = (
+            !content_length.is_undefined() &&
+            content_length.to_number() <= limit
+          );
+        }
+        if (!m_is_buffering && !m_parallel_compressor) {
+          m_compressor = new_compressor([this](Data &data) { compressor_output(data); });
+          m_is_streaming = content_length.is_undefined();
         }
       }
       m_is_message_started = true;
@@ -201,8 +318,17 @@ void CompressHTTP::process(Event *evt) {
 
   } else if (auto data = evt->as<Data>()) {
     if (m_is_message_started) {
-      if (m_compressor) {
+      if (m_is_buffering) {
+        m_buffer.push(*data);
+        if (m_buffer.size() > std::min(MAX_CACHED_BODY_SIZE, m_cache->capacity())) {
+          stop_buffering();
+        }
+      } else if (m_parallel_compressor) {
+        m_parallel_compressor->input(*data);
+        check_congestion();
+      } else if (m_compressor) {
         m_compressor->input(*data, false);
+        if (m_is_streaming) m_compressor->sync();
       } else {
         Filter::output(data);
       }
@@ -210,17 +336,115 @@ void CompressHTTP::process(Event *evt) {
 
   } else if (evt->is_end()) {
     if (m_is_message_started) {
-      if (m_compressor) {
+      if (m_parallel_compressor) {
+        end_parallel_compressor(evt);
+        return;
+      }
+      if (m_is_buffering) {
+        flush_buffer();
+      } else if (m_compressor) {
         m_compressor->flush();
         m_compressor->finalize();
         m_compressor = nullptr;
       }
+      m_encoding = nullptr;
       m_is_message_started = false;
+      m_is_streaming = false;
       Filter::output(evt);
     }
   }
 }
 
+auto CompressHTTP::new_compressor(const std::function<void(Data&)> &out) -> Compressor* {
+  if (m_encoding == s_gzip) return Compressor::gzip(out);
+  return Compressor::deflate(out);
+}
+
+void CompressHTTP::new_parallel_compressor() {
+  auto out = [this](Data &data) {
+    compressor_output(data);
+    check_congestion();
+  };
+  if (m_encoding == s_gzip) {
+    m_parallel_compressor = ParallelCompressor::gzip(out);
+  } else {
+    m_parallel_compressor = ParallelCompressor::deflate(out);
+  }
+}
+
+void CompressHTTP::end_parallel_compressor(Event *end) {
+  pjs::Ref<Event> evt(end);
+  m_encoding = nullptr;
+  m_is_message_started = false;
+  m_parallel_compressor->end(
+    [=]() {
+      m_parallel_compressor->finalize();
+      m_parallel_compressor = nullptr;
+      check_congestion();
+      Filter::output(evt);
+      while (!m_parallel_compressor) {
+        auto e = m_deferred.shift();
+        if (!e) break;
+        process(e);
+        e->release();
+      }
+    }
+  );
+}
+
+void CompressHTTP::check_congestion() {
+  auto limit = PARALLEL_BLOCK_SIZE * 2 * ThreadPool::shared().size();
+  auto pending = m_parallel_compressor ? m_parallel_compressor->pending() : 0;
+  if (pending > limit) {
+    if (!m_is_congested) {
+      m_is_congested = true;
+      m_congestion.begin();
+    }
+  } else if (m_is_congested && pending <= limit / 2) {
+    m_is_congested = false;
+    m_congestion.end();
+  }
+}
+
+void CompressHTTP::stop_buffering() {
+  m_is_buffering = false;
+  m_compressor = new_compressor([this](Data &data) { compressor_output(data); });
+  m_compressor->input(m_buffer, false);
+  m_buffer.clear();
+}
+
+void CompressHTTP::flush_buffer() {
+  m_is_buffering = false;
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_size = 0;
+  auto md = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(md, EVP_sha256(), nullptr);
+  for (const auto c : m_buffer.chunks()) {
+    EVP_DigestUpdate(md, std::get<0>(c), std::get<1>(c));
+  }
+  EVP_DigestFinal_ex(md, digest, &digest_size);
+  EVP_MD_CTX_free(md);
+
+  std::string key(m_encoding->str());
+  key += ':';
+  key.append((const char *)digest, digest_size);
+
+  if (auto cached = m_cache->get(key)) {
+    Filter::output(Data::make(*cached));
+  } else {
+    auto output = Data::make();
+    auto compressor = new_compressor([&](Data &data) { output->push(std::move(data)); });
+    compressor->input(m_buffer, false);
+    compressor->flush();
+    compressor->finalize();
+    m_cache->set(key, output);
+    Filter::output(Data::make(*output));
+  }
+
+  m_buffer.clear();
+}
+
 void CompressHTTP::compressor_output(Data &data) {
   Filter::output(Data::make(std::move(data)));
 }
@@ -27,11 +27,20 @@
 #define COMPRESS_HPP
 
 #include "filter.hpp"
+#include "data.hpp"
+#include "buffer.hpp"
+#include "input.hpp"
+#include "options.hpp"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
 
 namespace pipy {
 
 class Compressor;
-class Data;
+class ParallelCompressor;
 
 //
 // Compress
@@ -39,7 +48,15 @@ class Data;
 
 class Compress : public Filter {
 public:
-  Compress(const pjs::Value &algorithm);
+  struct Options : public pipy::Options {
+    std::shared_ptr<std::string> dictionary;
+    size_t cache_size = 0;
+    size_t parallel_threshold = 0;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  Compress(const pjs::Value &algorithm, const Options &options = Options());
 
 private:
   Compress(const Compress &r);
@@ -51,6 +68,7 @@ private:
   virtual void dump(Dump &d) override;
 
   pjs::Value m_algorithm;
+  Options m_options;
   Compressor* m_compressor = nullptr;
   bool m_is_started = false;
 
@@ -63,9 +81,37 @@ private:
 
 class CompressHTTP : public Filter {
 public:
-  CompressHTTP(const pjs::Value &algorithm);
+  CompressHTTP(const pjs::Value &algorithm, const Compress::Options &options = Compress::Options());
 
 private:
+
+  //
+  // CompressHTTP::Cache
+  //
+  // Compressed bodies keyed by encoding and content digest, least
+  // recently used first out once the total size exceeds the capacity.
+  //
+
+  class Cache {
+  public:
+    Cache(size_t capacity) : m_capacity(capacity) {}
+
+    auto capacity() const -> size_t { return m_capacity; }
+    auto get(const std::string &key) -> Data*;
+    void set(const std::string &key, Data *data);
+
+  private:
+    struct Entry {
+      std::string key;
+      pjs::Ref<Data> data;
+    };
+
+    std::list<Entry> m_entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> m_index;
+    size_t m_capacity;
+    size_t m_size = 0;
+  };
+
   CompressHTTP(const CompressHTTP &r);
   ~CompressHTTP();
 
@@ -75,9 +121,25 @@ private:
   virtual void dump(Dump &d) override;
 
   pjs::Value m_algorithm;
+  Compress::Options m_options;
+  std::shared_ptr<Cache> m_cache;
   Compressor* m_compressor = nullptr;
+  ParallelCompressor* m_parallel_compressor = nullptr;
+  pjs::Ref<pjs::Str> m_encoding;
+  Data m_buffer;
+  EventBuffer m_deferred;
+  InputSource::Congestion m_congestion;
   bool m_is_message_started = false;
-
+  bool m_is_buffering = false;
+  bool m_is_streaming = false;
+  bool m_is_congested = false;
+
+  auto new_compressor(const std::function<void(Data&)> &out) -> Compressor*;
+  void new_parallel_compressor();
+  void end_parallel_compressor(Event *end);
+  void check_congestion();
+  void stop_buffering();
+  void flush_buffer();
   void compressor_output(Data &data);
 };
 
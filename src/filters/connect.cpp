@@ -24,6 +24,8 @@
  */
 
 #include "connect.hpp"
+#include "context.hpp"
+#include "inbound.hpp"
 #include "outbound.hpp"
 #include "utils.hpp"
 
@@ -53,6 +55,30 @@ Connect::Options::Options(pjs::Object *options) {
   Value(options, "bufferLimit")
     .get_binary_size(buffer_limit)
     .check_nullable();
+  Value(options, "zeroCopyThreshold")
+    .get_binary_size(zero_copy_threshold)
+    .check_nullable();
+  Value(options, "receiveBufferSize")
+    .get_binary_size(receive_buffer_size)
+    .check_nullable();
+  Value(options, "sendBufferSize")
+    .get_binary_size(send_buffer_size)
+    .check_nullable();
+  Value(options, "notSentLowat")
+    .get_binary_size(not_sent_lowat)
+    .check_nullable();
+  Value(options, "congestionControl")
+    .get(congestion_control)
+    .check_nullable();
+  Value(options, "busyPoll")
+    .get_seconds(busy_poll)
+    .check_nullable();
+  Value(options, "incomingCpu")
+    .get(incoming_cpu)
+    .check_nullable();
+  Value(options, "fastOpen")
+    .get(fast_open)
+    .check_nullable();
   Value(options, "retryCount")
     .get(retry_count)
     .check_nullable();
@@ -77,6 +103,9 @@ Connect::Options::Options(pjs::Object *options) {
   Value(options, "noDelay")
     .get(no_delay)
     .check_nullable();
+  Value(options, "splice")
+    .get(splice)
+    .check_nullable();
 }
 
 //
@@ -188,6 +217,10 @@ void Connect::process(Event *evt) {
       };
     }
 
+    if (auto inbound = Filter::context()->inbound()) {
+      options.timeline = inbound->timeline();
+    }
+
     auto protocol = options.protocol;
     if (ep) {
       switch (ep->protocol.get()) {
@@ -226,6 +259,14 @@ void Connect::process(Event *evt) {
       Filter::error("%s", e.what());
       return;
     }
+
+    if (options.splice) {
+      if (auto inbound = Filter::context()->inbound()) {
+        auto a = inbound->get_socket_tcp();
+        auto b = m_outbound->get_socket_tcp();
+        if (a && b) a->splice(b);
+      }
+    }
   }
 
   if (m_outbound) {
@@ -42,6 +42,7 @@ public:
     pjs::Ref<pjs::Str> bind;
     pjs::Ref<pjs::Function> bind_f;
     pjs::Ref<pjs::Function> on_state_f;
+    bool splice = false;
     Options() {}
     Options(const Outbound::Options &options) : Outbound::Options(options) {}
     Options(pjs::Object *options);
@@ -37,18 +37,40 @@ thread_local static const pjs::ConstStr s_deflate("deflate");
 thread_local static const pjs::ConstStr s_inflate("inflate");
 thread_local static const pjs::ConstStr s_brotli("brotli");
 
+//
+// Decompress::Options
+//
+// The dictionary is handed to zlib when a deflate stream asks for one.
+//
+
+Decompress::Options::Options(pjs::Object *options) {
+  pjs::Ref<Data> dictionary_data;
+  std::string dictionary_str;
+  Value(options, "dictionary")
+    .get(dictionary_data)
+    .get(dictionary_str)
+    .check_nullable();
+  if (dictionary_data) {
+    dictionary = std::make_shared<std::string>(dictionary_data->to_string());
+  } else if (!dictionary_str.empty()) {
+    dictionary = std::make_shared<std::string>(dictionary_str);
+  }
+}
+
 //
 // Decompress
 //
 
-Decompress::Decompress(const pjs::Value &algorithm)
+Decompress::Decompress(const pjs::Value &algorithm, const Options &options)
   : m_algorithm(algorithm)
+  , m_options(options)
 {
 }
 
 Decompress::Decompress(const Decompress &r)
   : Filter(r)
   , m_algorithm(r.m_algorithm)
+  , m_options(r.m_options)
 {
 }
 
@@ -86,7 +108,7 @@ void Decompress::process(Event *evt) {
     auto out = [this](Data &data) { decompressor_output(data); };
     auto str = algorithm.s();
     if (str == s_inflate) {
-      m_decompressor = Decompressor::inflate(out);
+      m_decompressor = Decompressor::inflate(out, m_options.dictionary.get());
     } else if (str == s_gzip) {
       m_decompressor = Decompressor::gzip(out);
     } else if (str == s_brotli) {
@@ -119,12 +141,14 @@ void Decompress::decompressor_output(Data &data) {
 // DecompressHTTP
 //
 
-DecompressHTTP::DecompressHTTP()
+DecompressHTTP::DecompressHTTP(const Decompress::Options &options)
+  : m_options(options)
 {
 }
 
 DecompressHTTP::DecompressHTTP(const DecompressHTTP &r)
   : Filter(r)
+  , m_options(r.m_options)
 {
 }
 
@@ -154,15 +178,15 @@ void DecompressHTTP::process(Event *evt) {
   if (auto ms = evt->as<MessageStart>()) {
     if (!m_is_message_started) {
       pjs::Ref<http::MessageHead> head = pjs::coerce<http::MessageHead>(ms->head());
-      if (auto headers = head->headers.get()) {
+      if (auto headers = head->headers()) {
         pjs::Value v;
         if (headers->get(s_content_encoding, v) && v.is_string()) {
           auto str = v.s();
           auto out = [this](Data &data) { decompressor_output(data); };
           if (str == s_gzip) m_decompressor = Decompressor::gzip(out);
-          if (str == s_deflate) m_decompressor = Decompressor::inflate(out);
+          else if (str == s_deflate) m_decompressor = Decompressor::inflate(out, m_options.dictionary.get());
           else if (str == s_br) m_decompressor = Decompressor::brotli(out);
-          if (m_decompressor) head->headers->ht_delete(s_content_encoding);
+          if (m_decompressor) head->headers()->ht_delete(s_content_encoding);
         }
       }
       m_is_message_started = true;
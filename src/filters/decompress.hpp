@@ -27,6 +27,10 @@
 #define DECOMPRESS_HPP
 
 #include "filter.hpp"
+#include "options.hpp"
+
+#include <memory>
+#include <string>
 
 namespace pipy {
 
@@ -39,7 +43,13 @@ class Data;
 
 class Decompress : public Filter {
 public:
-  Decompress(const pjs::Value &algorithm);
+  struct Options : public pipy::Options {
+    std::shared_ptr<std::string> dictionary;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  Decompress(const pjs::Value &algorithm, const Options &options = Options());
 
 private:
   Decompress(const Decompress &r);
@@ -51,6 +61,7 @@ private:
   virtual void dump(Dump &d) override;
 
   pjs::Value m_algorithm;
+  Options m_options;
   Decompressor* m_decompressor = nullptr;
   bool m_is_started = false;
 
@@ -63,7 +74,7 @@ private:
 
 class DecompressHTTP : public Filter {
 public:
-  DecompressHTTP();
+  DecompressHTTP(const Decompress::Options &options = Decompress::Options());
 
 private:
   DecompressHTTP(const DecompressHTTP &r);
@@ -74,6 +85,7 @@ private:
   virtual void process(Event *evt) override;
   virtual void dump(Dump &d) override;
 
+  Decompress::Options m_options;
   Decompressor* m_decompressor = nullptr;
   bool m_is_message_started = false;
 
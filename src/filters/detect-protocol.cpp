@@ -25,166 +25,42 @@
 
 #include "detect-protocol.hpp"
 #include "data.hpp"
-#include "str-map.hpp"
 
 namespace pipy {
 
 thread_local static pjs::ConstStr STR_HTTP("HTTP");
 thread_local static pjs::ConstStr STR_HTTP2("HTTP2");
 thread_local static pjs::ConstStr STR_TLS("TLS");
+thread_local static pjs::ConstStr STR_MQTT("MQTT");
+thread_local static pjs::ConstStr STR_Redis("Redis");
+thread_local static pjs::ConstStr STR_Dubbo("Dubbo");
 
-//
-// HTTPDetector
-//
-
-class HTTPDetector :
-  public pjs::Pooled<HTTPDetector>,
-  public ProtocolDetector::Detector
-{
-public:
-  HTTPDetector()
-    : m_method_parser(s_valid_methods)
-    , m_version_parser(s_valid_versions) {}
-
-private:
-  virtual auto feed(const char *data, size_t size) -> pjs::Str* override {
-    for (size_t i = 0; i < size; i++) {
-      auto c = data[i];
-      switch (m_state) {
-        case CHECK_METHOD:
-          if (auto found = m_method_parser.parse(c)) {
-            if (found == pjs::Str::empty) return found;
-            m_state = CHECK_PATH;
-          }
-          break;
-        case CHECK_PATH:
-          if (c == ' ') m_state = CHECK_VERSION;
-          break;
-        case CHECK_VERSION:
-          if (auto found = m_version_parser.parse(c)) {
-            if (found == pjs::Str::empty) return found;
-            return STR_HTTP;
-          }
-          break;
-        default: break;
-      }
-    }
-    return nullptr;
-  }
-
-  enum State {
-    CHECK_METHOD,
-    CHECK_PATH,
-    CHECK_VERSION,
-  };
+static const std::string s_http2_preface("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
 
-  State m_state = CHECK_METHOD;
-  StrMap::Parser m_method_parser;
-  StrMap::Parser m_version_parser;
-
-  thread_local static const StrMap s_valid_methods;
-  thread_local static const StrMap s_valid_versions;
-};
-
-thread_local const StrMap HTTPDetector::s_valid_methods({
+thread_local const StrMap ProtocolDetector::s_prefixes({
   "GET ", "HEAD ", "POST ", "PUT ",
   "PATCH ", "DELETE ", "CONNECT ", "OPTIONS ", "TRACE ",
+  s_http2_preface,
 });
 
-thread_local const StrMap HTTPDetector::s_valid_versions({
+thread_local const StrMap ProtocolDetector::s_http_versions({
   "HTTP/1.0\r\n", "HTTP/1.1\r\n",
 });
 
-//
-// HTTP2Detector
-//
-
-class HTTP2Detector :
-  public pjs::Pooled<HTTP2Detector>,
-  public ProtocolDetector::Detector
-{
-  virtual auto feed(const char *data, size_t size) -> pjs::Str* override {
-    auto n = std::min(size, s_prefix.length() - m_pointer);
-    if (std::strncmp(data, s_prefix.c_str() + m_pointer, n)) {
-      return pjs::Str::empty;
-    }
-    m_pointer += n;
-    if (m_pointer == s_prefix.length()) return STR_HTTP2;
-    return nullptr;
-  }
-
-  size_t m_pointer = 0;
-
-  static const std::string s_prefix;
-};
-
-const std::string HTTP2Detector::s_prefix("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
-
-//
-// TLSDetector
-//
-
-class TLSDetector :
-  public pjs::Pooled<TLSDetector>,
-  public ProtocolDetector::Detector
-{
-  uint8_t m_read_buffer[11];
-  size_t m_read_length = 0;
-
-  virtual auto feed(const char *data, size_t size) -> pjs::Str* override {
-    auto &buf = m_read_buffer;
-    for (size_t i = 0; i < size; i++) {
-      auto c = data[i];
-      buf[m_read_length++] = c;
-      switch (m_read_length) {
-      case 1:
-        if (buf[0] != 22) {
-          return pjs::Str::empty;
-        }
-        break;
-      case 2:
-        if (buf[1] != 3) {
-          return pjs::Str::empty;
-        }
-        break;
-      case 3:
-        if (buf[2] > 4) {
-          return pjs::Str::empty;
-        }
-        break;
-      case 6:
-        if (buf[5] != 1) {
-          return pjs::Str::empty;
-        }
-        break;
-      case 9:
-        if (
-          (((uint32_t)buf[6] << 16) + ((uint32_t)buf[7] << 8) + buf[8]) >
-          (((uint16_t)buf[3] << 8) + buf[4]) + 4
-        ) {
-          return pjs::Str::empty;
-        }
-        break;
-      case 11:
-        return STR_TLS;
-      }
-    }
-    return nullptr;
-  }
-};
-
 //
 // ProtocolDetector
 //
 
 ProtocolDetector::ProtocolDetector(pjs::Function *callback)
   : m_callback(callback)
+  , m_parser(s_prefixes)
 {
 }
 
 ProtocolDetector::ProtocolDetector(const ProtocolDetector &r)
   : Filter(r)
   , m_callback(r.m_callback)
+  , m_parser(s_prefixes)
 {
 }
 
@@ -198,16 +74,11 @@ auto ProtocolDetector::clone() -> Filter* {
 
 void ProtocolDetector::reset() {
   Filter::reset();
-  for (int i = 0; i < m_num_detectors; i++) {
-    delete m_detectors[i];
-    m_detectors[i] = nullptr;
-  }
-  m_negatives = 0;
   m_result = nullptr;
-  m_num_detectors = 3;
-  m_detectors[0] = new HTTPDetector;
-  m_detectors[1] = new HTTP2Detector;
-  m_detectors[2] = new TLSDetector;
+  m_state = START;
+  m_parser = StrMap::Parser(s_prefixes);
+  m_literal = nullptr;
+  m_count = 0;
 }
 
 void ProtocolDetector::dump(Dump &d) {
@@ -219,26 +90,12 @@ void ProtocolDetector::process(Event *evt) {
   if (!m_result) {
     if (auto data = evt->as<Data>()) {
       for (const auto c : data->chunks()) {
-        auto data = std::get<0>(c);
-        auto size = std::get<1>(c);
-        for (int i = 0; i < m_num_detectors; i++) {
-          if (auto *detector = m_detectors[i]) {
-            if (auto ret = detector->feed(data, size)) {
-              if (ret == pjs::Str::empty) {
-                delete detector;
-                m_detectors[i] = nullptr;
-                if (++m_negatives == m_num_detectors) {
-                  m_result = ret;
-                  break;
-                }
-              } else {
-                m_result = ret;
-                break;
-              }
-            }
-          }
+        auto ptr = (const uint8_t *)std::get<0>(c);
+        auto len = std::get<1>(c);
+        if (auto ret = feed(ptr, len)) {
+          m_result = ret;
+          break;
         }
-        if (m_result) break;
       }
 
       if (m_result) {
@@ -252,4 +109,126 @@ void ProtocolDetector::process(Event *evt) {
   output(evt);
 }
 
+//
+// Returns nullptr while undecided, Str::empty when no signature
+// can match any more, or the name of the detected protocol.
+//
+
+auto ProtocolDetector::feed(const uint8_t *data, size_t size) -> pjs::Str* {
+  auto &buf = m_buffer;
+  for (size_t i = 0; i < size; i++) {
+    auto c = data[i];
+    switch (m_state) {
+      case START:
+        switch (c) {
+          case 0x16: m_state = TLS_RECORD; buf[0] = c; m_count = 1; continue;
+          case 0x10: m_state = MQTT_LENGTH; m_count = 0; continue;
+          case '*': m_state = REDIS_COUNT; m_count = 0; continue;
+          case 0xda: m_state = DUBBO_MAGIC; continue;
+          default: m_state = PREFIX; break;
+        }
+        // fall through
+      case PREFIX:
+        if (auto found = m_parser.parse(c)) {
+          if (found == pjs::Str::empty) return found;
+          if (found->length() == s_http2_preface.length()) return STR_HTTP2;
+          m_state = HTTP_PATH;
+        }
+        break;
+
+      // Request line: <method> <path> HTTP/1.x CRLF
+      case HTTP_PATH:
+        if (c == ' ') {
+          m_parser = StrMap::Parser(s_http_versions);
+          m_state = HTTP_VERSION;
+        } else if (c < 0x20 || c >= 0x7f) {
+          return pjs::Str::empty;
+        }
+        break;
+      case HTTP_VERSION:
+        if (auto found = m_parser.parse(c)) {
+          if (found == pjs::Str::empty) return found;
+          return STR_HTTP;
+        }
+        break;
+
+      // Record header of a handshake followed by the ClientHello header
+      case TLS_RECORD:
+        buf[m_count++] = c;
+        switch (m_count) {
+          case 2: if (buf[1] != 3) return pjs::Str::empty; break;
+          case 3: if (buf[2] > 4) return pjs::Str::empty; break;
+          case 6: if (buf[5] != 1) return pjs::Str::empty; break;
+          case 9:
+            if (
+              (((uint32_t)buf[6] << 16) + ((uint32_t)buf[7] << 8) + buf[8]) >
+              (((uint16_t)buf[3] << 8) + buf[4]) + 4
+            ) {
+              return pjs::Str::empty;
+            }
+            break;
+          case 11: return STR_TLS;
+        }
+        break;
+
+      // CONNECT: remaining length, protocol name "MQTT" or "MQIsdp", level 3 to 5
+      case MQTT_LENGTH:
+        if (!(c & 0x80)) {
+          m_state = MQTT_NAME;
+          m_count = 0;
+        } else if (++m_count == 4) {
+          return pjs::Str::empty;
+        }
+        break;
+      case MQTT_NAME:
+        if (m_count == 0) {
+          if (c) return pjs::Str::empty;
+        } else if (m_count == 1) {
+          if (c == 4) m_literal = "MQTT";
+          else if (c == 6) m_literal = "MQIsdp";
+          else return pjs::Str::empty;
+        } else if (c != uint8_t(m_literal[m_count - 2])) {
+          return pjs::Str::empty;
+        } else if (!m_literal[m_count - 1]) {
+          m_state = MQTT_LEVEL;
+        }
+        m_count++;
+        break;
+      case MQTT_LEVEL:
+        if (3 <= c && c <= 5) return STR_MQTT;
+        return pjs::Str::empty;
+
+      // RESP command: *<count> CRLF $
+      case REDIS_COUNT:
+        if ('0' <= c && c <= '9') {
+          if (++m_count > 10) return pjs::Str::empty;
+        } else if (c == '\r' && m_count > 0) {
+          m_state = REDIS_BULK;
+          m_count = 0;
+        } else {
+          return pjs::Str::empty;
+        }
+        break;
+      case REDIS_BULK:
+        if (m_count++ == 0) {
+          if (c != '\n') return pjs::Str::empty;
+        } else {
+          if (c == '$') return STR_Redis;
+          return pjs::Str::empty;
+        }
+        break;
+
+      // Magic 0xdabb followed by the flag of a request with a serialization ID
+      case DUBBO_MAGIC:
+        if (c != 0xbb) return pjs::Str::empty;
+        m_state = DUBBO_FLAG;
+        break;
+      case DUBBO_FLAG:
+        if ((c & 0x80) && (c & 0x1f)) return STR_Dubbo;
+        return pjs::Str::empty;
+    }
+  }
+  return nullptr;
+}
+
 } // namespace pipy
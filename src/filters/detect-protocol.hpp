@@ -27,22 +27,25 @@
 #define DETECT_PROTOCOL_HPP
 
 #include "filter.hpp"
+#include "str-map.hpp"
 
 namespace pipy {
 
+//
+// ProtocolDetector
+//
+// All supported signatures are matched together in one pass over the
+// first bytes of a stream. They begin with distinct bytes except for
+// the HTTP methods and the HTTP/2 preface, which share a prefix trie, so
+// a single state is enough and a decision is made on the first byte that
+// rules out the last candidate or completes a signature.
+//
+
 class ProtocolDetector : public Filter {
 public:
   ProtocolDetector(pjs::Function *callback);
 
-  class Detector {
-  public:
-    virtual ~Detector() {};
-    virtual auto feed(const char *data, size_t size) -> pjs::Str* = 0;
-  };
-
 private:
-  enum { MAX_DETECTORS = 3 };
-
   ProtocolDetector(const ProtocolDetector &r);
   ~ProtocolDetector();
 
@@ -51,11 +54,33 @@ private:
   virtual void process(Event *evt) override;
   virtual void dump(Dump &d) override;
 
+  enum State {
+    START,
+    PREFIX,
+    HTTP_PATH,
+    HTTP_VERSION,
+    TLS_RECORD,
+    MQTT_LENGTH,
+    MQTT_NAME,
+    MQTT_LEVEL,
+    REDIS_COUNT,
+    REDIS_BULK,
+    DUBBO_MAGIC,
+    DUBBO_FLAG,
+  };
+
   pjs::Ref<pjs::Function> m_callback;
-  Detector* m_detectors[MAX_DETECTORS];
-  int m_num_detectors = 0;
-  int m_negatives = 0;
   pjs::Ref<pjs::Str> m_result;
+  State m_state = START;
+  StrMap::Parser m_parser;
+  const char* m_literal = nullptr;
+  uint8_t m_buffer[11];
+  int m_count = 0;
+
+  auto feed(const uint8_t *data, size_t size) -> pjs::Str*;
+
+  thread_local static const StrMap s_prefixes;
+  thread_local static const StrMap s_http_versions;
 };
 
 } // namespace pipy
@@ -30,16 +30,81 @@ namespace dubbo {
 
 static Data::Producer s_dp("Dubbo");
 
+//
+// Reads a Hessian2 string, which can come in chunks and has its length
+// counted in UTF-16 code units.
+//
+
+static bool read_hessian_string(Data::Reader &r, pjs::Ref<pjs::Str> &str) {
+  std::string s;
+  for (;;) {
+    int c = r.get();
+    int len;
+    bool final = true;
+    if (0x00 <= c && c <= 0x1f) {
+      len = c;
+    } else if (0x30 <= c && c <= 0x33) {
+      int b = r.get();
+      if (b < 0) return false;
+      len = ((c - 0x30) << 8) | b;
+    } else if (c == 'S' || c == 'R') {
+      int h = r.get();
+      int l = r.get();
+      if (h < 0 || l < 0) return false;
+      len = (h << 8) | l;
+      final = (c == 'S');
+    } else if (c == 'N') {
+      str = nullptr;
+      return true;
+    } else {
+      return false;
+    }
+    while (len > 0) {
+      int b = r.get();
+      if (b < 0) return false;
+      s.push_back(char(b));
+      int n = 0;
+      if ((b & 0xe0) == 0xc0) n = 1;
+      else if ((b & 0xf0) == 0xe0) n = 2;
+      else if ((b & 0xf8) == 0xf0) { n = 3; len--; }
+      for (int i = 0; i < n; i++) {
+        if ((b = r.get()) < 0) return false;
+        s.push_back(char(b));
+      }
+      len--;
+    }
+    if (final) break;
+  }
+  str = pjs::Str::make(s);
+  return true;
+}
+
+static void peek_service(MessageHead *head, const Data &body) {
+  Data::Reader r(body);
+  if (!read_hessian_string(r, head->dubboVersion)) return;
+  if (!read_hessian_string(r, head->serviceName)) return;
+  if (!read_hessian_string(r, head->serviceVersion)) return;
+  read_hessian_string(r, head->methodName);
+}
+
 //
 // Decoder
 //
 
-Decoder::Decoder()
+Decoder::Options::Options(pjs::Object *options) {
+  Value(options, "peekService")
+    .get(peek_service)
+    .check_nullable();
+}
+
+Decoder::Decoder(const Options &options)
+  : m_options(options)
 {
 }
 
 Decoder::Decoder(const Decoder &r)
-  : Decoder()
+  : Filter(r)
+  , m_options(r.m_options)
 {
 }
 
@@ -59,6 +124,8 @@ auto Decoder::clone() -> Filter* {
 void Decoder::reset() {
   Filter::reset();
   Deframer::reset();
+  m_message_head = nullptr;
+  m_body = nullptr;
 }
 
 void Decoder::process(Event *evt) {
@@ -101,19 +168,40 @@ auto Decoder::on_state(int state, int c) -> int {
         ((uint64_t)m_head[10] << 8)|
         ((uint64_t)m_head[11] << 0)
       );
-      Filter::output(MessageStart::make(mh));
-      Deframer::pass(
+      auto size = (
         ((uint32_t)m_head[12] << 24)|
         ((uint32_t)m_head[13] << 16)|
         ((uint32_t)m_head[14] <<  8)|
         ((uint32_t)m_head[15] <<  0)
       );
+      if (size == 0) {
+        Filter::output(MessageStart::make(mh));
+        Filter::output(MessageEnd::make());
+        return START;
+      }
+      if (m_options.peek_service && mh->isRequest && !mh->isEvent && mh->serializationType == 2) {
+        m_message_head = mh;
+        m_body = Data::make();
+        Deframer::read(size, m_body);
+        return PEEK;
+      }
+      Filter::output(MessageStart::make(mh));
+      Deframer::pass(size);
       return BODY;
     }
     case BODY: {
       Filter::output(MessageEnd::make());
       return START;
     }
+    case PEEK: {
+      peek_service(m_message_head, *m_body);
+      Filter::output(MessageStart::make(m_message_head));
+      Filter::output(m_body);
+      Filter::output(MessageEnd::make());
+      m_message_head = nullptr;
+      m_body = nullptr;
+      return START;
+    }
     default: return -1;
   }
 }
@@ -228,6 +316,10 @@ template<> void ClassDef<MessageHead>::init() {
   field<bool>("isEvent", [](MessageHead *obj) { return &obj->isEvent; });
   field<int>("serializationType", [](MessageHead *obj) { return &obj->serializationType; });
   field<int>("status", [](MessageHead *obj) { return &obj->status; });
+  field<Ref<Str>>("dubboVersion", [](MessageHead *obj) { return &obj->dubboVersion; });
+  field<Ref<Str>>("serviceName", [](MessageHead *obj) { return &obj->serviceName; });
+  field<Ref<Str>>("serviceVersion", [](MessageHead *obj) { return &obj->serviceVersion; });
+  field<Ref<Str>>("methodName", [](MessageHead *obj) { return &obj->methodName; });
 }
 
 } // namespace pjs
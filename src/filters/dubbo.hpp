@@ -29,6 +29,7 @@
 #include "filter.hpp"
 #include "data.hpp"
 #include "deframer.hpp"
+#include "options.hpp"
 
 namespace pipy {
 namespace dubbo {
@@ -45,15 +46,32 @@ public:
   bool isEvent = false;
   int serializationType = 0;
   int status = 0;
+  pjs::Ref<pjs::Str> dubboVersion;
+  pjs::Ref<pjs::Str> serviceName;
+  pjs::Ref<pjs::Str> serviceVersion;
+  pjs::Ref<pjs::Str> methodName;
 };
 
 //
 // Decoder
 //
 
+//
+// With peek_service set, a Hessian2 request body is held until it is
+// complete and the leading strings naming the Dubbo version, service,
+// service version and method are read into the head. The body itself
+// goes on as it is.
+//
+
 class Decoder : public Filter, public Deframer {
 public:
-  Decoder();
+  struct Options : public pipy::Options {
+    bool peek_service = false;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  Decoder(const Options &options);
 
 private:
   Decoder(const Decoder &r);
@@ -69,9 +87,13 @@ private:
     START,
     HEAD,
     BODY,
+    PEEK,
   };
 
+  Options m_options;
   uint8_t m_head[16];
+  pjs::Ref<MessageHead> m_message_head;
+  pjs::Ref<Data> m_body;
 
   virtual auto on_state(int state, int c) -> int override;
   virtual void on_pass(Data &data) override;
@@ -34,6 +34,8 @@
 
 #ifndef _WIN32
 
+#include <fcntl.h>
+#include <spawn.h>
 #include <unistd.h>
 #include <sys/wait.h>
 
@@ -46,12 +48,49 @@
 #include <termios.h>
 #endif
 
+extern "C" char **environ;
+
 #endif // _WIN32
 
 namespace pipy {
 
 static Data::Producer s_dp("exec()");
 
+#ifndef _WIN32
+
+//
+// Starts a child process with posix_spawn(), which is implemented with
+// vfork() or clone(CLONE_VM) and so does not copy the page tables of a
+// large parent as fork() does. Pipe ends are close-on-exec so that they
+// are not leaked into other children, which would keep them from seeing
+// EOF. Passing -1 for a standard stream leaves it inherited.
+//
+
+static int spawn_process(char **argv, int in, int out, int err) {
+  posix_spawn_file_actions_t fa;
+  posix_spawn_file_actions_init(&fa);
+  if (in >= 0) posix_spawn_file_actions_adddup2(&fa, in, 0);
+  if (out >= 0) posix_spawn_file_actions_adddup2(&fa, out, 1);
+  if (err >= 0) posix_spawn_file_actions_adddup2(&fa, err, 2);
+  pid_t pid = 0;
+  auto ret = posix_spawnp(&pid, argv[0], &fa, nullptr, argv, environ);
+  posix_spawn_file_actions_destroy(&fa);
+  if (ret) {
+    errno = ret;
+    return -1;
+  }
+  return pid;
+}
+
+static bool open_pipe(int fds[2]) {
+  if (pipe(fds)) return false;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return true;
+}
+
+#endif // _WIN32
+
 //
 // Exec::Options
 //
@@ -63,12 +102,20 @@ Exec::Options::Options(pjs::Object *options) {
   Value(options, "pty")
     .get(pty)
     .check_nullable();
+  Value(options, "pool")
+    .get(pool)
+    .check_nullable();
   Value(options, "onStart")
     .get(on_start_f)
     .check_nullable();
   Value(options, "onExit")
     .get(on_exit_f)
     .check_nullable();
+#ifdef _WIN32
+  if (pool > 0) throw std::runtime_error("options.pool is not supported on Windows");
+#else
+  if (pool > 0 && pty) throw std::runtime_error("options.pool and options.pty cannot be used together");
+#endif
 }
 
 //
@@ -129,6 +176,16 @@ void Exec::reset() {
   m_pipe_stdin.close();
   m_pipe_stdout.close();
   m_pipe_stderr.close();
+#else
+  if (m_pool) {
+    m_pool->cancel(this);
+    m_pool = nullptr;
+  }
+  m_pool_requests.clear();
+  m_pool_buffer.clear();
+  m_pool_message_started = false;
+  m_pool_requested = false;
+  m_pool_input_ended = false;
 #endif
   m_stdout_reader.reset();
   m_stderr_reader.reset();
@@ -136,6 +193,13 @@ void Exec::reset() {
 }
 
 void Exec::process(Event *evt) {
+#ifndef _WIN32
+  if (m_options.pool > 0) {
+    process_pooled(evt);
+    return;
+  }
+#endif
+
   if (!m_child_proc.pid) {
     pjs::Value ret;
     if (!eval(m_command, ret)) return;
@@ -258,9 +322,9 @@ bool Exec::exec_argv(const std::list<std::string> &args) {
 
   } else {
     int in[2], out[2], err[2];
-    pipe(in);
-    pipe(out);
-    pipe(err);
+    open_pipe(in);
+    open_pipe(out);
+    open_pipe(err);
 
     m_stdin = FileStream::make(0, os::FileHandle(in[1], "w"), &s_dp);
     m_stdout = FileStream::make(-1, os::FileHandle(out[0], "r"), &s_dp);
@@ -268,25 +332,18 @@ bool Exec::exec_argv(const std::list<std::string> &args) {
     m_stdout->chain(m_stdout_reader.input());
     m_stderr->chain(m_stderr_reader.input());
 
-    pid = fork();
-
-    if (pid == 0) {
-      dup2(in[0], 0);
-      dup2(out[1], 1);
-      dup2(err[1], 2);
-      execvp(argv[0], argv);
-      std::terminate();
-    }
+    pid = spawn_process(argv.data(), in[0], out[1], err[1]);
 
     ::close(in[0]);
     ::close(out[1]);
     ::close(err[1]);
   }
 
+  auto error = errno;
   for (i = 0; i < argc; i++) free(argv[i]);
 
   if (pid < 0) {
-    Filter::error("unable to fork");
+    Filter::error("unable to start process '%s': %s", args.front().c_str(), strerror(error));
     return false;
   }
 
@@ -308,6 +365,289 @@ void Exec::kill_process() {
   kill(m_child_proc.pid, SIGTERM);
 }
 
+//
+// In pool mode, a message or, without message boundaries, all Data up to
+// StreamEnd makes one request. Requests from the same stream are sent one
+// after another so that responses come out in order.
+//
+
+void Exec::process_pooled(Event *evt) {
+  if (m_pool_input_ended) return;
+
+  if (!m_pool) {
+    pjs::Value ret;
+    if (!eval(m_command, ret)) return;
+
+    std::list<std::string> args;
+    if (ret.is_array()) {
+      ret.as<pjs::Array>()->iterate_all(
+        [&](pjs::Value &v, int) {
+          auto *s = v.to_string();
+          args.push_back(s->str());
+          s->release();
+        }
+      );
+    } else {
+      auto *s = ret.to_string();
+      args = utils::split_argv(s->str());
+      s->release();
+    }
+
+    if (args.empty()) {
+      Filter::error("exec() with no arguments");
+      return;
+    }
+
+    m_pool = WorkerPool::get(args, m_options.pool);
+  }
+
+  if (auto data = evt->as<Data>()) {
+    m_pool_buffer.push(*data);
+
+  } else if (evt->is<MessageStart>()) {
+    m_pool_buffer.clear();
+    m_pool_message_started = true;
+
+  } else if (evt->is<MessageEnd>()) {
+    if (m_pool_message_started) {
+      m_pool_requests.push_back({ std::move(m_pool_buffer), true });
+      m_pool_message_started = false;
+      pool_request_next();
+    }
+
+  } else if (evt->is<StreamEnd>()) {
+    if (m_pool_message_started || !m_pool_buffer.empty()) {
+      m_pool_requests.push_back({ std::move(m_pool_buffer), false });
+      m_pool_message_started = false;
+    }
+    m_pool_input_ended = true;
+    if (m_pool_requests.empty() && !m_pool_requested) {
+      Filter::output(StreamEnd::make());
+    } else {
+      pool_request_next();
+    }
+  }
+}
+
+void Exec::pool_request_next() {
+  if (!m_pool_requested && !m_pool_requests.empty()) {
+    m_pool_requested = true;
+    m_pool->request(this);
+  }
+}
+
+void Exec::on_pool_response(Data &payload) {
+  auto framed = m_pool_requests.front().framed;
+  m_pool_requests.pop_front();
+  m_pool_requested = false;
+  if (framed) {
+    Filter::output(MessageStart::make());
+    Filter::output(Data::make(std::move(payload)));
+    Filter::output(MessageEnd::make());
+  } else {
+    Filter::output(Data::make(std::move(payload)));
+  }
+  if (m_pool_requests.empty()) {
+    if (m_pool_input_ended) Filter::output(StreamEnd::make());
+  } else {
+    pool_request_next();
+  }
+}
+
+void Exec::on_pool_error(const char *msg) {
+  m_pool_requests.clear();
+  m_pool_requested = false;
+  m_pool_input_ended = true;
+  Filter::error("%s", msg);
+}
+
+//
+// Exec::WorkerPool::Worker
+//
+
+class Exec::WorkerPool::Worker : public EventTarget {
+public:
+  Worker(WorkerPool *pool, int pid, int in, int out)
+    : m_pool(pool)
+    , m_pid(pid)
+    , m_stdin(FileStream::make(0, os::FileHandle(in, "w"), &s_dp))
+    , m_stdout(FileStream::make(-1, os::FileHandle(out, "r"), &s_dp))
+  {
+    m_stdout->chain(EventTarget::input());
+  }
+
+  ~Worker() {
+    m_stdin->close();
+    m_stdout->close();
+    m_stdout->chain(nullptr);
+  }
+
+  auto pid() const -> int { return m_pid; }
+  auto exec() const -> Exec* { return m_exec; }
+  bool busy() const { return m_busy; }
+
+  void send(Exec *exec) {
+    auto &payload = exec->m_pool_requests.front().payload;
+    uint8_t head[4];
+    auto size = payload.size();
+    head[0] = size >> 24;
+    head[1] = size >> 16;
+    head[2] = size >> 8;
+    head[3] = size >> 0;
+    Data frame;
+    s_dp.push(&frame, head, sizeof(head));
+    frame.push(payload);
+    m_exec = exec;
+    m_busy = true;
+    m_stdin->input()->input(Data::make(std::move(frame)));
+  }
+
+  // The requester has gone away, so the response is to be discarded
+  void abandon() { m_exec = nullptr; }
+
+private:
+  WorkerPool* m_pool;
+  int m_pid;
+  pjs::Ref<FileStream> m_stdin;
+  pjs::Ref<FileStream> m_stdout;
+  Exec* m_exec = nullptr;
+  Data m_buffer;
+  int m_frame_size = -1;
+  bool m_busy = false;
+
+  virtual void on_event(Event *evt) override {
+    if (auto data = evt->as<Data>()) {
+      m_buffer.push(*data);
+      for (;;) {
+        if (m_frame_size < 0) {
+          if (m_buffer.size() < 4) break;
+          uint8_t head[4];
+          m_buffer.shift(4, head);
+          m_frame_size = (
+            ((int)head[0] << 24) |
+            ((int)head[1] << 16) |
+            ((int)head[2] <<  8) |
+            ((int)head[3] <<  0)
+          ) & 0x7fffffff;
+        }
+        if (m_buffer.size() < m_frame_size) break;
+        Data payload;
+        m_buffer.shift(m_frame_size, payload);
+        m_frame_size = -1;
+        if (!m_busy) continue;
+        auto exec = m_exec;
+        m_exec = nullptr;
+        m_busy = false;
+        if (exec) exec->on_pool_response(payload);
+        m_pool->dispatch();
+      }
+
+    } else if (evt->is<StreamEnd>()) {
+      Log::error("[exec] worker process exited [pid = %d]", m_pid);
+      m_pool->remove(this);
+      if (auto exec = m_exec) {
+        m_exec = nullptr;
+        exec->on_pool_error("worker process exited");
+      }
+      auto worker = this;
+      Net::current().post([=]() { delete worker; });
+    }
+  }
+};
+
+//
+// Exec::WorkerPool
+//
+
+auto Exec::WorkerPool::get(const std::list<std::string> &args, int size) -> WorkerPool* {
+  thread_local static std::map<std::string, WorkerPool*> s_pools;
+  std::string key;
+  for (const auto &arg : args) {
+    key += arg;
+    key += '\0';
+  }
+  auto &pool = s_pools[key];
+  if (!pool) pool = new WorkerPool(args, size);
+  return pool;
+}
+
+void Exec::WorkerPool::request(Exec *exec) {
+  m_queue.push_back(exec);
+  dispatch();
+}
+
+void Exec::WorkerPool::cancel(Exec *exec) {
+  m_queue.remove(exec);
+  for (auto *w : m_workers) {
+    if (w->exec() == exec) w->abandon();
+  }
+}
+
+auto Exec::WorkerPool::spawn() -> Worker* {
+  auto argc = m_args.size();
+  size_t i = 0;
+  pjs::vl_array<char*> argv(argc + 1);
+  for (const auto &arg : m_args) argv[i++] = strdup(arg.c_str());
+  argv[argc] = nullptr;
+
+  int in[2], out[2];
+  open_pipe(in);
+  open_pipe(out);
+
+  auto pid = spawn_process(argv.data(), in[0], out[1], -1);
+  auto error = errno;
+
+  ::close(in[0]);
+  ::close(out[1]);
+  for (i = 0; i < argc; i++) free(argv[i]);
+
+  if (pid < 0) {
+    ::close(in[1]);
+    ::close(out[0]);
+    Log::error("[exec] unable to start worker process '%s': %s", m_args.front().c_str(), strerror(error));
+    return nullptr;
+  }
+
+  Log::debug(Log::SUBPROC,
+    "[exec] worker process started [pid = %d]: %s",
+    pid, m_args.front().c_str()
+  );
+
+  s_child_process_monitor.add(pid);
+  auto worker = new Worker(this, pid, in[1], out[0]);
+  m_workers.push_back(worker);
+  return worker;
+}
+
+void Exec::WorkerPool::dispatch() {
+  while (!m_queue.empty()) {
+    Worker *worker = nullptr;
+    for (auto *w : m_workers) {
+      if (!w->busy()) {
+        worker = w;
+        break;
+      }
+    }
+    if (!worker && m_workers.size() < m_size) {
+      worker = spawn();
+      if (!worker) {
+        auto exec = m_queue.front();
+        m_queue.pop_front();
+        exec->on_pool_error("unable to start worker process");
+        continue;
+      }
+    }
+    if (!worker) break;
+    auto exec = m_queue.front();
+    m_queue.pop_front();
+    worker->send(exec);
+  }
+}
+
+void Exec::WorkerPool::remove(Worker *worker) {
+  m_workers.remove(worker);
+}
+
 #else // _WIN32
 
 bool Exec::exec_argv(const std::list<std::string> &args) {
@@ -509,6 +849,15 @@ void Exec::ChildProcessMonitor::add(Exec *exec) {
   m_workload_cv.notify_one();
 }
 
+void Exec::ChildProcessMonitor::add(int pid) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto &m = m_monitors[pid];
+  m.proc.pid = pid;
+  m.exec = nullptr;
+  m.net = &Net::current();
+  m_workload_cv.notify_one();
+}
+
 void Exec::ChildProcessMonitor::remove(Exec *exec) {
   std::lock_guard<std::mutex> lock(m_mutex);
   auto i = m_monitors.find(exec->m_child_proc.pid);
@@ -32,6 +32,7 @@
 #include "options.hpp"
 
 #include <atomic>
+#include <list>
 #include <map>
 #include <mutex>
 
@@ -48,6 +49,7 @@ public:
   struct Options : public pipy::Options {
     bool std_err = false;
     bool pty = false;
+    int pool = 0;
     pjs::Ref<pjs::Function> on_start_f;
     pjs::Ref<pjs::Function> on_exit_f;
     Options() {}
@@ -135,6 +137,60 @@ private:
   bool exec_line(const std::string &line);
   void kill_process();
 
+#ifndef _WIN32
+
+  //
+  // Exec::WorkerPool
+  //
+  // Long-lived child processes shared by all Exec filters on the same
+  // thread running the same command. Each worker takes one request at a
+  // time, framed as a 4-byte big-endian length followed by the payload,
+  // on its stdin, and answers with a frame of the same format on its
+  // stdout. Requests wait in a queue while all workers are busy.
+  //
+
+  class WorkerPool {
+  public:
+    static auto get(const std::list<std::string> &args, int size) -> WorkerPool*;
+
+    void request(Exec *exec);
+    void cancel(Exec *exec);
+
+  private:
+    class Worker;
+
+    WorkerPool(const std::list<std::string> &args, int size)
+      : m_args(args), m_size(size) {}
+
+    std::list<std::string> m_args;
+    std::list<Worker*> m_workers;
+    std::list<Exec*> m_queue;
+    int m_size;
+
+    auto spawn() -> Worker*;
+    void dispatch();
+    void remove(Worker *worker);
+  };
+
+  struct PoolRequest {
+    Data payload;
+    bool framed;
+  };
+
+  WorkerPool* m_pool = nullptr;
+  std::list<PoolRequest> m_pool_requests;
+  Data m_pool_buffer;
+  bool m_pool_message_started = false;
+  bool m_pool_requested = false;
+  bool m_pool_input_ended = false;
+
+  void process_pooled(Event *evt);
+  void pool_request_next();
+  void on_pool_response(Data &payload);
+  void on_pool_error(const char *msg);
+
+#endif // _WIN32
+
   //
   // Exec::ChildProcessMonitor
   //
@@ -145,6 +201,7 @@ private:
     ~ChildProcessMonitor();
 
     void add(Exec *exec);
+    void add(int pid);
     void remove(Exec *exec);
 
   private:
@@ -157,10 +214,12 @@ private:
     };
 
     std::atomic<bool> m_exited;
-    std::thread m_thread;
     std::mutex m_mutex;
     std::condition_variable m_workload_cv;
     std::map<int, Monitor> m_monitors;
+
+    // Started last, after everything its main() uses has been constructed
+    std::thread m_thread;
   };
 
   static ChildProcessMonitor s_child_process_monitor;
@@ -52,6 +52,10 @@ static Data::Producer s_dp("FastCGI");
 #define FCGI_AUTHORIZER 2
 #define FCGI_FILTER     3
 
+#define FCGI_MAX_CONNS  "FCGI_MAX_CONNS"
+#define FCGI_MAX_REQS   "FCGI_MAX_REQS"
+#define FCGI_MPXS_CONNS "FCGI_MPXS_CONNS"
+
 #define FCGI_REQUEST_COMPLETE 0
 #define FCGI_CANT_MPX_CONN    1
 #define FCGI_OVERLOADED       2
@@ -142,10 +146,10 @@ auto ParamDecoder::on_state(int state, int c) -> int {
 }
 
 auto ParamDecoder::start_name() -> int {
-  m_name = Data::make();
-  m_value = Data::make();
+  m_name.clear();
+  m_value.clear();
   if (m_name_length > 0) {
-    Deframer::read(m_name_length, m_name);
+    Deframer::read(m_name_length, &m_name);
     return STATE_NAME;
   }
   return start_value();
@@ -153,15 +157,15 @@ auto ParamDecoder::start_name() -> int {
 
 auto ParamDecoder::start_value() -> int {
   if (m_value_length > 0) {
-    Deframer::read(m_value_length, m_value);
+    Deframer::read(m_value_length, &m_value);
     return STATE_VALUE;
   }
   return end_value();
 }
 
 auto ParamDecoder::end_value() -> int {
-  pjs::Ref<pjs::Str> k = pjs::Str::make(m_name->to_string());
-  pjs::Ref<pjs::Str> v = pjs::Str::make(m_value->to_string());
+  pjs::Ref<pjs::Str> k = pjs::Str::make(m_name.to_string());
+  pjs::Ref<pjs::Str> v = pjs::Str::make(m_value.to_string());
   m_params->set(k, v.get());
   return STATE_NAME_LEN;
 }
@@ -218,9 +222,21 @@ void Endpoint::send_record(int type, int request_id, const void *body, size_t si
   FlushTarget::need_flush();
 }
 
+//
+// A record carries no more than 65535 bytes of content, so larger
+// bodies are split into records of a size that needs no padding.
+//
+
 void Endpoint::send_record(int type, int request_id, Data &body) {
-  int padding = 0;
+  static const int max_content_length = 0xfff8;
   Data::Builder db(m_sending_buffer, &s_dp);
+  while (body.size() > max_content_length) {
+    Data buf; body.shift(max_content_length, buf);
+    int padding = 0;
+    write_record_header(db, type, request_id, max_content_length, padding);
+    db.push(std::move(buf));
+  }
+  int padding = 0;
   write_record_header(db, type, request_id, body.size(), padding);
   if (body.size() > 0) db.push(std::move(body));
   if (padding > 0) db.push(uint8_t(0), size_t(padding));
@@ -310,12 +326,41 @@ void Client::close_request(EventFunction *request) {
   Endpoint::request_close(r);
 }
 
+void Client::query_values() {
+  static const char body[] = {
+    sizeof(FCGI_MAX_REQS) - 1, 0, 'F','C','G','I','_','M','A','X','_','R','E','Q','S',
+    sizeof(FCGI_MPXS_CONNS) - 1, 0, 'F','C','G','I','_','M','P','X','S','_','C','O','N','N','S',
+  };
+  Endpoint::send_record(FCGI_GET_VALUES, 0, body, sizeof(body));
+}
+
 void Client::shutdown() {
   Endpoint::shutdown();
 }
 
+void Client::receive_values(Data &data) {
+  pjs::Ref<pjs::Object> values = pjs::Object::make();
+  ParamDecoder decoder(values);
+  decoder.deframe(data);
+
+  pjs::Value mpxs, max_reqs;
+  values->get(FCGI_MPXS_CONNS, mpxs);
+  values->get(FCGI_MAX_REQS, max_reqs);
+
+  if (!mpxs.is_string() || mpxs.s()->str() != "1") {
+    on_max_requests(1);
+  } else if (max_reqs.is_string()) {
+    on_max_requests(std::max(0, std::atoi(max_reqs.s()->c_str())));
+  } else {
+    on_max_requests(0);
+  }
+}
+
 void Client::on_record(int type, int request_id, Data &body) {
   switch (type) {
+    case FCGI_GET_VALUES_RESULT:
+      if (request_id == 0) receive_values(body);
+      break;
     case FCGI_END_REQUEST:
       if (auto r = request(request_id)) {
         static_cast<Request*>(r)->receive_end(body);
@@ -376,6 +421,7 @@ void Client::Request::receive_end(Data &data) {
     );
     tail->protocolStatus = hdr->protocolStatus;
     tail->stderr_data = Data::make(std::move(m_stderr_buffer));
+    if (hdr->protocolStatus == FCGI_CANT_MPX_CONN) m_client->on_max_requests(1);
     EventFunction::output(MessageEnd::make(tail));
   }
 }
@@ -420,7 +466,7 @@ void Client::Request::on_event(Event *evt) {
       std::memset(&body, 0, sizeof(body));
       body.roleB1 = head->role >> 8;
       body.roleB0 = head->role;
-      body.flags = head->keepAlive ? FCGI_KEEP_CONN : 0;
+      body.flags = (head->keepAlive || m_client->m_keep_conn) ? FCGI_KEEP_CONN : 0;
       m_client->send_record(FCGI_BEGIN_REQUEST, id(), &body, sizeof(body));
 
       if (auto params = head->params.get()) {
@@ -753,10 +799,20 @@ auto Mux::on_mux_new_pool(pjs::Object *options) -> MuxSessionPool* {
 //
 // Mux::Session
 //
+// Only one request runs on a session until the application
+// answers FCGI_GET_VALUES saying it can multiplex connections.
+//
+
+Mux::Session::Session()
+  : Client(true)
+{
+  MuxSession::set_max_share_count(1);
+}
 
 void Mux::Session::mux_session_open(MuxSource *) {
   Client::chain(MuxSession::input());
   MuxSession::chain(Client::reply());
+  Client::query_values();
 }
 
 auto Mux::Session::mux_session_open_stream(MuxSource *) -> EventFunction* {
@@ -771,6 +827,10 @@ void Mux::Session::mux_session_close() {
   Client::shutdown();
 }
 
+void Mux::Session::on_max_requests(int n) {
+  MuxSession::set_max_share_count(n);
+}
+
 } // namespace fcgi
 } // namespace pipy
 
@@ -74,8 +74,8 @@ private:
   virtual auto on_state(int state, int c) -> int override;
 
   pjs::Ref<pjs::Object> m_params;
-  pjs::Ref<Data> m_name;
-  pjs::Ref<Data> m_value;
+  Data m_name;
+  Data m_value;
   int m_name_length;
   int m_value_length;
   uint8_t m_buffer[4];
@@ -157,13 +157,25 @@ private:
 // Client
 //
 
+//
+// Requests are always sent with FCGI_KEEP_CONN when keep_conn is set so
+// that the connection can go back to a pool. query_values() asks the
+// application for FCGI_MPXS_CONNS and FCGI_MAX_REQS, and the number of
+// requests it is willing to run at once on this connection is then
+// reported through on_max_requests(), where 0 means no limit.
+//
+
 class Client : public Endpoint, public EventSource {
 public:
+  Client(bool keep_conn = false) : m_keep_conn(keep_conn) {}
+
   auto open_request() -> EventFunction*;
   void close_request(EventFunction *request);
+  void query_values();
   void shutdown();
 
 protected:
+  virtual void on_max_requests(int n) {}
   virtual void on_record(int type, int request_id, Data &body) override;
   virtual auto on_new_request(int id) -> Endpoint::Request* override;
   virtual void on_delete_request(Endpoint::Request *request) override;
@@ -200,6 +212,9 @@ protected:
   };
 
   Table<Request*> m_request_id_pool;
+  bool m_keep_conn;
+
+  void receive_values(Data &data);
 };
 
 //
@@ -300,10 +315,15 @@ private:
   //
 
   class Session : public pjs::Pooled<Session>, public MuxSession, public Client {
+  public:
+    Session();
+
+  private:
     virtual void mux_session_open(MuxSource *source) override;
     virtual auto mux_session_open_stream(MuxSource *source) -> EventFunction* override;
     virtual void mux_session_close_stream(EventFunction *stream) override;
     virtual void mux_session_close() override;
+    virtual void on_max_requests(int n) override;
     virtual void on_auto_release() override { delete this; }
   };
 
@@ -31,6 +31,16 @@
 
 namespace pipy {
 
+//
+// Fork::Options
+//
+
+Fork::Options::Options(pjs::Object *options) {
+  Value(options, "bufferLimit")
+    .get_binary_size(buffer_limit)
+    .check_nullable();
+}
+
 //
 // Fork
 //
@@ -45,6 +55,13 @@ Fork::Fork(const pjs::Value &init_arg)
 {
 }
 
+Fork::Fork(const pjs::Value &init_arg, const Options &options)
+  : m_mode(FORK)
+  , m_init_arg(init_arg)
+  , m_options(options)
+{
+}
+
 Fork::Fork(Mode mode, const pjs::Value &init_arg)
   : m_mode(mode)
   , m_init_arg(init_arg)
@@ -55,6 +72,7 @@ Fork::Fork(const Fork &r)
   : Filter(r)
   , m_mode(r.m_mode)
   , m_init_arg(r.m_init_arg)
+  , m_options(r.m_options)
 {
 }
 
@@ -117,7 +135,7 @@ void Fork::process(Event *evt) {
     } else {
       m_branches = pjs::PooledArray<Branch>::make(1);
       if (m_mode != FORK) m_waiting = true;
-      auto pipeline = sub_pipeline(0, m_mode != FORK)->start(1, &init_arg);
+      auto pipeline = sub_pipeline(0, m_mode != FORK);
       auto &branch = m_branches->at(0);
       branch.fork = this;
       branch.pipeline = pipeline;
@@ -127,8 +145,14 @@ void Fork::process(Event *evt) {
   }
 
   if (m_branches) {
-    for (int i = 0; i < m_branches->size(); i++) {
-      m_branches->at(i).pipeline->input()->input(evt->clone());
+    if (m_options.buffer_limit > 0) {
+      for (int i = 0; i < m_branches->size(); i++) {
+        m_branches->at(i).feed(evt);
+      }
+    } else {
+      for (int i = 0; i < m_branches->size(); i++) {
+        m_branches->at(i).pipeline->input()->input(evt->share());
+      }
     }
   }
 
@@ -157,10 +181,52 @@ void Fork::on_branch_end(Branch *branch) {
   }
 }
 
+//
+// Fork::Branch
+//
+
+void Fork::Branch::feed(Event *evt) {
+  if (dropped) return;
+
+  if (paused || !buffer.empty()) {
+    if (auto data = evt->as<Data>()) buffered += data->size();
+    if (buffered > fork->m_options.buffer_limit) {
+      Log::warn("[fork] branch buffer over %d bytes, ending the branch", int(fork->m_options.buffer_limit));
+      dropped = true;
+      buffer.clear();
+      buffered = 0;
+      InputContext ic(this);
+      pipeline->input()->input(StreamEnd::make(StreamEnd::BUFFER_OVERFLOW));
+    } else {
+      buffer.push(evt->share());
+    }
+    return;
+  }
+
+  InputContext ic(this);
+  pipeline->input()->input(evt->share());
+}
+
 void Fork::Branch::on_event(Event *evt) {
   if (evt->is<StreamEnd>()) {
     fork->on_branch_end(this);
   }
 }
 
+void Fork::Branch::on_tap_open() {
+  paused = false;
+  if (dropped) return;
+  InputContext ic(this);
+  while (!paused && !buffer.empty()) {
+    auto evt = buffer.shift();
+    if (auto data = evt->as<Data>()) buffered -= data->size();
+    pipeline->input()->input(evt);
+    evt->release();
+  }
+}
+
+void Fork::Branch::on_tap_close() {
+  paused = true;
+}
+
 } // namespace pipy
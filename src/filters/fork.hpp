@@ -27,6 +27,9 @@
 #define FORK_HPP
 
 #include "filter.hpp"
+#include "buffer.hpp"
+#include "input.hpp"
+#include "options.hpp"
 
 namespace pipy {
 
@@ -42,8 +45,15 @@ public:
     RACE,
   };
 
+  struct Options : public pipy::Options {
+    size_t buffer_limit = 0;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
   Fork();
   Fork(const pjs::Value &init_arg);
+  Fork(const pjs::Value &init_arg, const Options &options);
   Fork(Mode mode, const pjs::Value &init_arg);
 
 private:
@@ -55,14 +65,32 @@ private:
   virtual void process(Event *evt) override;
   virtual void dump(Dump &d) override;
 
-  struct Branch : public EventTarget {
+  //
+  // Fork::Branch
+  //
+  // With a buffer limit, every branch is fed as an input source of its
+  // own, so that congestion down a branch closes only that branch's tap.
+  // Events for a paused branch wait in its buffer, sharing their chunks
+  // with the other branches, and a branch whose buffer grows over the
+  // limit is ended with a buffer overflow instead of slowing the others.
+  //
+
+  struct Branch : public EventTarget, public InputSource {
     Fork *fork;
     pjs::Ref<Pipeline> pipeline;
+    EventBuffer buffer;
+    size_t buffered = 0;
+    bool paused = false;
+    bool dropped = false;
+    void feed(Event *evt);
     virtual void on_event(Event *evt) override;
+    virtual void on_tap_open() override;
+    virtual void on_tap_close() override;
   };
 
   Mode m_mode;
   pjs::Value m_init_arg;
+  Options m_options;
   pjs::PooledArray<Branch>* m_branches = nullptr;
   EventBuffer m_buffer;
   int m_counter = 0;
@@ -0,0 +1,265 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "grpc.hpp"
+#include "api/http.hpp"
+
+namespace pipy {
+namespace grpc {
+
+// +------------+------------------------+---------------------+
+// | Compressed |     Message-Length     |       Message       |
+// |  (1 byte)  | (4 bytes, big-endian)  |                     |
+// +------------+------------------------+---------------------+
+
+static Data::Producer s_dp("gRPC");
+
+//
+// Decoder
+//
+
+Decoder::Decoder()
+{
+}
+
+Decoder::Decoder(const Decoder &r)
+  : Decoder()
+{
+}
+
+Decoder::~Decoder()
+{
+}
+
+void Decoder::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "decodeGRPC";
+}
+
+auto Decoder::clone() -> Filter* {
+  return new Decoder(*this);
+}
+
+void Decoder::reset() {
+  Filter::reset();
+  Deframer::reset();
+  m_http_head = nullptr;
+  m_http_started = false;
+  m_end_pending = false;
+  m_message_count = 0;
+}
+
+void Decoder::process(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    if (!m_http_started) {
+      m_http_started = true;
+      m_http_head = start->head();
+      m_message_count = 0;
+      Deframer::reset(PREFIX);
+      Deframer::read(sizeof(m_prefix), m_prefix);
+    }
+
+  } else if (auto data = evt->as<Data>()) {
+    if (m_http_started) {
+      Deframer::deframe(*data);
+    }
+
+  } else if (auto end = evt->as<MessageEnd>()) {
+    if (m_http_started) {
+      if (!m_message_count) message_start(false, true);
+      auto tail = MessageTail::make();
+      tail->end = true;
+      if (auto t = end->tail()) {
+        pjs::Ref<http::MessageTail> http_tail = pjs::coerce<http::MessageTail>(t);
+        tail->trailers = http_tail->headers;
+      }
+      Filter::output(MessageEnd::make(tail));
+      m_end_pending = false;
+      m_http_started = false;
+      m_http_head = nullptr;
+    }
+
+  } else if (evt->is<StreamEnd>()) {
+    flush_end();
+    m_http_started = false;
+    m_http_head = nullptr;
+    Filter::output(evt);
+  }
+}
+
+auto Decoder::on_state(int state, int c) -> int {
+  switch (state) {
+    case PREFIX: {
+      auto size = (
+        ((uint32_t)m_prefix[1] << 24) |
+        ((uint32_t)m_prefix[2] << 16) |
+        ((uint32_t)m_prefix[3] <<  8) |
+        ((uint32_t)m_prefix[4] <<  0)
+      );
+      message_start(m_prefix[0] & 1);
+      if (size > 0) {
+        Deframer::pass(size);
+        return PAYLOAD;
+      }
+      m_end_pending = true;
+      Deframer::read(sizeof(m_prefix), m_prefix);
+      return PREFIX;
+    }
+    case PAYLOAD:
+      m_end_pending = true;
+      Deframer::read(sizeof(m_prefix), m_prefix);
+      return PREFIX;
+  }
+  return state;
+}
+
+void Decoder::on_pass(Data &data) {
+  Filter::output(Data::make(std::move(data)));
+}
+
+void Decoder::message_start(bool compressed, bool trailers_only) {
+  flush_end();
+  auto head = MessageHead::make();
+  head->compressed = compressed;
+  head->trailersOnly = trailers_only;
+  head->head = m_http_head;
+  Filter::output(MessageStart::make(head));
+  m_message_count++;
+}
+
+void Decoder::flush_end() {
+  if (m_end_pending) {
+    m_end_pending = false;
+    Filter::output(MessageEnd::make(MessageTail::make()));
+  }
+}
+
+//
+// Encoder
+//
+
+Encoder::Encoder()
+{
+}
+
+Encoder::Encoder(const Encoder &r)
+  : Encoder()
+{
+}
+
+Encoder::~Encoder()
+{
+}
+
+void Encoder::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "encodeGRPC";
+}
+
+auto Encoder::clone() -> Filter* {
+  return new Encoder(*this);
+}
+
+void Encoder::reset() {
+  Filter::reset();
+  m_buffer.clear();
+  m_http_started = false;
+  m_started = false;
+}
+
+void Encoder::process(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    if (!m_started) {
+      pjs::Ref<MessageHead> head = pjs::coerce<MessageHead>(start->head());
+      m_started = true;
+      m_compressed = head->compressed;
+      m_trailers_only = head->trailersOnly;
+      m_buffer.clear();
+      if (!m_http_started) {
+        m_http_started = true;
+        Filter::output(MessageStart::make(head->head));
+      }
+    }
+
+  } else if (auto data = evt->as<Data>()) {
+    if (m_started) {
+      m_buffer.push(*data);
+    }
+
+  } else if (auto end = evt->as<MessageEnd>()) {
+    if (m_started) {
+      m_started = false;
+      if (!m_trailers_only) {
+        auto size = m_buffer.size();
+        uint8_t prefix[5];
+        prefix[0] = m_compressed ? 1 : 0;
+        prefix[1] = size >> 24;
+        prefix[2] = size >> 16;
+        prefix[3] = size >> 8;
+        prefix[4] = size >> 0;
+        auto out = Data::make();
+        s_dp.push(out, prefix, sizeof(prefix));
+        out->push(std::move(m_buffer));
+        Filter::output(out);
+      }
+      m_buffer.clear();
+      pjs::Ref<MessageTail> tail = pjs::coerce<MessageTail>(end->tail());
+      if (tail->end || tail->trailers) {
+        auto http_tail = http::MessageTail::make();
+        http_tail->headers = tail->trailers;
+        Filter::output(MessageEnd::make(http_tail));
+        m_http_started = false;
+      }
+    }
+
+  } else if (evt->is<StreamEnd>()) {
+    if (m_http_started) {
+      Filter::output(MessageEnd::make());
+      m_http_started = false;
+    }
+    m_started = false;
+    Filter::output(evt);
+  }
+}
+
+} // namespace grpc
+} // namespace pipy
+
+namespace pjs {
+
+using namespace pipy::grpc;
+
+template<> void ClassDef<MessageHead>::init() {
+  field<bool>("compressed", [](MessageHead *obj) { return &obj->compressed; });
+  field<bool>("trailersOnly", [](MessageHead *obj) { return &obj->trailersOnly; });
+  field<Ref<Object>>("head", [](MessageHead *obj) { return &obj->head; });
+}
+
+template<> void ClassDef<MessageTail>::init() {
+  field<bool>("end", [](MessageTail *obj) { return &obj->end; });
+  field<Ref<Object>>("trailers", [](MessageTail *obj) { return &obj->trailers; });
+}
+
+} // namespace pjs
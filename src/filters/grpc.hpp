@@ -0,0 +1,130 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef GRPC_HPP
+#define GRPC_HPP
+
+#include "filter.hpp"
+#include "deframer.hpp"
+
+namespace pipy {
+namespace grpc {
+
+//
+// MessageHead
+//
+
+class MessageHead : public pjs::ObjectTemplate<MessageHead> {
+public:
+  bool compressed = false;
+  bool trailersOnly = false;
+  pjs::Ref<pjs::Object> head;
+};
+
+//
+// MessageTail
+//
+
+class MessageTail : public pjs::ObjectTemplate<MessageTail> {
+public:
+  bool end = false;
+  pjs::Ref<pjs::Object> trailers;
+};
+
+//
+// Decoder
+//
+// Splits the body of each HTTP message into its length-prefixed gRPC
+// messages. Payloads are passed on as views of the input chunks. The
+// end of a gRPC message is held back until it is known whether the HTTP
+// message ends right after it, so that the trailers can go with it.
+//
+
+class Decoder : public Filter, public Deframer {
+public:
+  Decoder();
+
+private:
+  Decoder(const Decoder &r);
+  ~Decoder();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+private:
+  enum State {
+    PREFIX,
+    PAYLOAD,
+  };
+
+  uint8_t m_prefix[5];
+  pjs::Ref<pjs::Object> m_http_head;
+  bool m_http_started = false;
+  bool m_end_pending = false;
+  int m_message_count = 0;
+
+  virtual auto on_state(int state, int c) -> int override;
+  virtual void on_pass(Data &data) override;
+
+  void message_start(bool compressed, bool trailers_only = false);
+  void flush_end();
+};
+
+//
+// Encoder
+//
+// Puts gRPC messages back into HTTP messages, adding the 5-byte prefix
+// to each one. An HTTP message is started with the HTTP head carried in
+// the first gRPC message head and is ended after a gRPC message whose
+// tail has end or trailers set.
+//
+
+class Encoder : public Filter {
+public:
+  Encoder();
+
+private:
+  Encoder(const Encoder &r);
+  ~Encoder();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+private:
+  Data m_buffer;
+  bool m_http_started = false;
+  bool m_started = false;
+  bool m_compressed = false;
+  bool m_trailers_only = false;
+};
+
+} // namespace grpc
+} // namespace pipy
+
+#endif // GRPC_HPP
@@ -75,7 +75,7 @@ bool Handle::callback(pjs::Object *arg) {
   if (!Filter::callback(m_callback, 2, args, result)) return false;
   if (result.is_promise()) {
     auto cb = PromiseCallback::make(this);
-    result.as<pjs::Promise>()->then(nullptr, cb->resolved(), cb->rejected());
+    result.as<pjs::Promise>()->then(cb);
     m_promise_callback = cb;
     m_waiting = true;
     return true;
@@ -60,6 +60,7 @@ protected:
   virtual void handle(Event *evt) {}
   virtual bool on_callback_return(const pjs::Value &result);
 
+  bool idle() const { return !m_waiting && m_event_buffer.empty(); }
   bool callback(pjs::Object *arg);
   void defer(Event *evt);
   void pass(Event *evt);
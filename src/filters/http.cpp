@@ -31,6 +31,9 @@
 #include "module.hpp"
 #include "inbound.hpp"
 #include "str-map.hpp"
+#include "header-names.hpp"
+#include "simd.hpp"
+#include "usdt.hpp"
 #include "utils.hpp"
 
 #include <cctype>
@@ -66,6 +69,9 @@ thread_local static const pjs::ConstStr s_transfer_encoding("transfer-encoding")
 thread_local static const pjs::ConstStr s_content_length("content-length");
 thread_local static const pjs::ConstStr s_content_encoding("content-encoding");
 thread_local static const pjs::ConstStr s_upgrade("upgrade");
+thread_local static const pjs::ConstStr s_etag("etag");
+thread_local static const pjs::ConstStr s_date("date");
+thread_local static const pjs::ConstStr s_if_none_match("if-none-match");
 thread_local static const pjs::ConstStr s_websocket("websocket");
 thread_local static const pjs::ConstStr s_h2c("h2c");
 thread_local static const pjs::ConstStr s_http2_preface_method("PRI");
@@ -92,17 +98,6 @@ thread_local static const StrMap s_strmap_statuses({
   "OK", "Created", "Continue",
 });
 
-
-thread_local static const StrMap s_strmap_headers({
-  "host",
-  "user-agent",
-  "accept",
-  "connection",
-  "content-length",
-  "content-type",
-  "transfer-encoding",
-});
-
 thread_local static const StrMap s_strmap_header_values({
   "*/*",
   "text/html",
@@ -256,7 +251,38 @@ static auto lookup_status_text(int status) -> const char* {
   return nullptr;
 }
 
-static auto read_str(Data::Reader &dr, char ending, const StrMap &strmap) -> pjs::Str* {
+//
+// LineReader
+//
+// Reads a head line straight from its chunk when it sits in a single
+// view, which is nearly always, and through Data::Reader otherwise.
+//
+
+class LineReader {
+public:
+  LineReader(const Data &data) : m_reader(data) {
+    auto i = data.chunks().begin();
+    if (i != data.chunks().end()) {
+      auto c = *i;
+      if (std::get<1>(c) == int(data.size())) {
+        m_ptr = std::get<0>(c);
+        m_end = m_ptr + std::get<1>(c);
+      }
+    }
+  }
+
+  int get() {
+    if (m_ptr) return m_ptr < m_end ? (uint8_t)*m_ptr++ : -1;
+    return m_reader.get();
+  }
+
+private:
+  Data::Reader m_reader;
+  const char* m_ptr = nullptr;
+  const char* m_end = nullptr;
+};
+
+static auto read_str(LineReader &dr, char ending, const StrMap &strmap) -> pjs::Str* {
   size_t i = 0;
   StrMap::Parser p(strmap);
   pjs::Str *found = nullptr;
@@ -271,7 +297,7 @@ static auto read_str(Data::Reader &dr, char ending, const StrMap &strmap) -> pjs
   }
 }
 
-static auto read_str(Data::Reader &dr, char ending, const StrMap &strmap, char *buf) -> pjs::Str* {
+static auto read_str(LineReader &dr, char ending, const StrMap &strmap, char *buf) -> pjs::Str* {
   size_t i = 0;
   StrMap::Parser p(strmap);
   pjs::Str *found = nullptr;
@@ -291,29 +317,26 @@ static auto read_str(Data::Reader &dr, char ending, const StrMap &strmap, char *
   }
 }
 
-static auto read_str_lower(Data::Reader &dr, char ending, const StrMap &strmap, char *buf, char *buf_lower) -> pjs::Str* {
-  size_t i = 0;
-  StrMap::Parser p(strmap);
-  pjs::Str *found = nullptr;
+static auto read_name_lower(LineReader &dr, char *buf) -> int {
+  int i = 0;
   for (;;) {
     auto c = dr.get();
-    if (c < 0) return nullptr;
-    if (c == ending) {
-      if (found && found != pjs::Str::empty) {
-        return found;
-      } else {
-        return i > 0 ? pjs::Str::make(buf_lower, i) : nullptr;
-      }
-    }
+    if (c < 0) return -1;
+    if (c == ':') return i;
     if (c == ' ' && !i) continue;
-    auto l = std::tolower(c);
-    found = p.parse(l);
-    buf_lower[i] = l;
-    buf[i++] = c;
+    buf[i++] = std::tolower(c);
   }
 }
 
-static auto read_uint(Data::Reader &dr, char ending) -> int {
+static bool skip_to(LineReader &dr, char ending) {
+  for (;;) {
+    auto c = dr.get();
+    if (c < 0) return false;
+    if (c == ending) return true;
+  }
+}
+
+static auto read_uint(LineReader &dr, char ending) -> int {
   int n = 0;
   for (;;) {
     auto c = dr.get();
@@ -335,6 +358,7 @@ void Decoder::reset() {
   m_state = HEAD;
   m_head_buffer.clear();
   m_head = nullptr;
+  m_raw_headers.reset();
   m_method = nullptr;
   m_header_transfer_encoding = nullptr;
   m_header_content_length = nullptr;
@@ -373,25 +397,26 @@ void Decoder::on_event(Event *evt) {
       data->shift(n, output);
       if (0 == (m_current_size -= n)) state = (state == BODY ? HEAD : CHUNK_TAIL);
 
-    // byte scan the head
+    // vector scan for the end of a head line
+    } else if (state == HEAD || state == HEADER) {
+      size_t n = 0;
+      for (const auto &c : data->chunks()) {
+        auto len = size_t(std::get<1>(c));
+        auto i = simd::find(std::get<0>(c), len, '\n');
+        n += i;
+        if (i < len) {
+          state = (state == HEAD ? HEAD_EOL : HEADER_EOL);
+          n++;
+          break;
+        }
+      }
+      data->shift(n, output);
+
+    // byte scan the chunk heads
     } else {
       data->shift_to(
         [&](int c) -> bool {
           switch (state) {
-          case HEAD:
-            if (c == '\n') {
-              state = HEAD_EOL;
-              return true;
-            }
-            return false;
-
-          case HEADER:
-            if (c == '\n') {
-              state = HEADER_EOL;
-              return true;
-            }
-            return false;
-
           case CHUNK_HEAD:
             m_body_size++;
             if (c == '\n') {
@@ -450,11 +475,16 @@ void Decoder::on_event(Event *evt) {
     }
 
     // old state
+    auto line = &m_head_buffer;
     switch (m_state) {
       case HEAD:
       case HEADER:
         if (m_head_buffer.size() + output.size() <= m_max_header_size) {
-          m_head_buffer.push(output);
+          if (m_head_buffer.empty() && state != m_state) {
+            line = &output; // complete line, parse in place
+          } else {
+            m_head_buffer.push(output);
+          }
         } else {
           Log::error("HTTP header size overflow");
           error();
@@ -473,8 +503,8 @@ void Decoder::on_event(Event *evt) {
     // new state
     switch (state) {
       case HEAD_EOL: {
-        Data::Reader dr(m_head_buffer);
-        auto len = m_head_buffer.size();
+        LineReader dr(*line);
+        auto len = line->size();
         pjs::vl_array<char, DATA_CHUNK_SIZE> buf(len);
         m_head_size += len;
         if (m_is_response) {
@@ -511,60 +541,56 @@ void Decoder::on_event(Event *evt) {
             m_head = req;
           }
         }
-        m_head->headers = pjs::Object::make();
-        m_head->headerNames = pjs::Object::make();
+        m_raw_headers.reset(new MessageHead::RawHeaders);
         m_header_transfer_encoding = nullptr;
         m_header_content_length = nullptr;
         m_header_connection = nullptr;
         m_header_upgrade = nullptr;
+        m_has_raw_header_error = false;
         state = HEADER;
         m_head_buffer.clear();
         break;
       }
       case HEADER_EOL: {
-        auto len = m_head_buffer.size();
+        auto len = line->size();
         pjs::vl_array<char, DATA_CHUNK_SIZE> buf(len);
-        pjs::vl_array<char, DATA_CHUNK_SIZE> buf_lower(len);
         m_head_size += len;
         if (len > 2) {
-          Data::Reader dr(m_head_buffer);
-          pjs::Ref<pjs::Str> key(read_str_lower(dr, ':', s_strmap_headers, buf, buf_lower));
-          pjs::Ref<pjs::Str> val(read_str(dr, '\r', s_strmap_header_values, buf_lower));
-          if (!key || !val) { error(); break; }
-          auto headers = m_head->headers.get();
-          if (key == s_cookie || key == s_set_cookie) {
-            pjs::Value old;
-            headers->get(key, old);
-            if (old.is_array()) {
-              old.as<pjs::Array>()->push(val.get());
-            } else if (old.is_string()) {
-              auto a = pjs::Array::make(2);
-              a->set(0, old.s());
-              a->set(1, val.get());
-              headers->set(key, a);
-            } else {
-              headers->set(key, val.get());
-            }
-          } else {
-            auto v = val.get();
-            if (key == s_transfer_encoding) m_header_transfer_encoding = v;
-            else if (key == s_content_length) m_header_content_length = v;
-            else if (key == s_connection) { m_header_connection = v; v = nullptr; }
-            else if (key == s_upgrade) m_header_upgrade = v;
-            if (v) headers->set(key, v);
-          }
-          if (auto names = m_head->headerNames.get()) {
-            pjs::Ref<pjs::Str> name(pjs::Str::make(buf, key->size()));
-            if (name != key) {
-              names->set(key, name.get());
-            }
+          LineReader dr(*line);
+          auto name_len = read_name_lower(dr, buf);
+          if (name_len <= 0) { error(); break; }
+          auto raw = m_raw_headers.get();
+          auto lines = &raw->lines;
+          auto name = HeaderNames::find(buf, name_len);
+          pjs::Ref<pjs::Str> *value = nullptr;
+          if (!name) {}
+          else if (name == s_transfer_encoding) { value = &m_header_transfer_encoding; lines = &raw->framing; }
+          else if (name == s_content_length) { value = &m_header_content_length; lines = &raw->framing; }
+          else if (name == s_keep_alive) { lines = &raw->framing; }
+          else if (name == s_connection) { value = &m_header_connection; lines = &raw->framing; }
+          else if (name == s_upgrade) { value = &m_header_upgrade; }
+          if (value) {
+            pjs::Str *val = read_str(dr, '\r', s_strmap_header_values, buf);
+            if (!val) { error(); break; }
+            *value = val;
+          } else if (!skip_to(dr, '\r')) {
+            error();
+            break;
           }
+          if (dr.get() != '\n' || dr.get() >= 0) m_has_raw_header_error = true;
+          if (lines == &raw->framing) raw->framing_offsets.push_back(raw->lines.size());
+          lines->push(*line);
           state = HEADER;
           m_head_buffer.clear();
 
         } else {
           m_current_size = 0;
           m_head_buffer.clear();
+          m_raw_headers->upgrade = m_header_upgrade;
+          m_head->raw_headers(m_raw_headers.release());
+
+          // Lines that do not end in CRLF cannot be copied over as they are
+          if (m_has_raw_header_error) m_head->headers();
 
           static const std::string s_chunked("chunked");
 
@@ -630,6 +656,7 @@ void Decoder::on_event(Event *evt) {
 }
 
 void Decoder::message_start() {
+  PIPY_PROBE1(http__message__start, m_is_response);
   if (m_is_response) {
     m_method = nullptr;
     m_responded_tunnel_type = TunnelType::NONE;
@@ -652,6 +679,7 @@ void Decoder::message_start() {
 }
 
 void Decoder::message_end() {
+  PIPY_PROBE1(http__message__end, m_is_response);
   if (m_responded_tunnel_type != TunnelType::NONE) {
     if (on_decode_tunnel(m_responded_tunnel_type)) {
       m_is_tunnel = true;
@@ -675,7 +703,7 @@ void Decoder::stream_end(StreamEnd *eos) {
     auto status_code = 0;
     auto status_text = ResponseHead::error_to_status(eos->error_code(), status_code);
     auto head = ResponseHead::make();
-    head->headers = pjs::Object::make();
+    head->headers(pjs::Object::make());
     head->protocol = s_http_1_1;
     head->status = status_code;
     head->statusText = status_text;
@@ -800,12 +828,168 @@ void Encoder::on_event(Event *evt) {
   }
 }
 
+//
+// Lines of a response head are kept by its headers object once the same
+// object comes by a second time, as it does with messages that scripts
+// keep around for health checks, redirects or fixed replies. Before the
+// lines are reused, the protocol, status and every header value are
+// compared with the ones they were made from, so changes made to the
+// headers object by a script are never missed.
+//
+
+struct HeadCacheEntry {
+  pjs::Object *seen = nullptr;
+  pjs::Ref<pjs::Object> headers;
+  pjs::Ref<pjs::Str> protocol;
+  pjs::Ref<pjs::Str> status_text;
+  int status = 0;
+  std::vector<std::pair<pjs::Ref<pjs::Str>, pjs::Value>> values;
+  pjs::Ref<pjs::Str> header_connection;
+  pjs::Ref<pjs::Str> header_upgrade;
+  Data lines;
+};
+
+static const int HEAD_CACHE_SIZE = 64;
+
+static auto head_cache_slot(pjs::Object *headers) -> HeadCacheEntry& {
+  thread_local static HeadCacheEntry s_entries[HEAD_CACHE_SIZE];
+  return s_entries[(uintptr_t(headers) >> 4) % HEAD_CACHE_SIZE];
+}
+
+static bool head_cache_match(HeadCacheEntry &e, pjs::Object *headers, ResponseHead *head, pjs::Str *protocol, int status) {
+  if (e.headers != headers) return false;
+  if (e.protocol != protocol || e.status != status || e.status_text != head->statusText) return false;
+  auto &values = e.values;
+  size_t i = 0;
+  if (!headers->iterate_while(
+    [&](pjs::Str *k, pjs::Value &v) {
+      if (i >= values.size()) return false;
+      auto &p = values[i++];
+      return p.first == k && pjs::Value::is_identical(p.second, v);
+    }
+  )) return false;
+  return i == values.size();
+}
+
+static bool head_cache_snapshot(HeadCacheEntry &e, pjs::Object *headers) {
+  auto &values = e.values;
+  values.clear();
+  return headers->iterate_while(
+    [&](pjs::Str *k, pjs::Value &v) {
+      if (v.is_object()) return false;
+      values.emplace_back(k, v);
+      return true;
+    }
+  );
+}
+
 void Encoder::output_head() {
   auto buffer = Data::make();
   bool no_content_length = false;
 
+  if (m_is_response) {
+    auto status = m_status_code;
+    if (
+      (status < 200 || status == 204) ||
+      (m_responded_tunnel_type != TunnelType::NONE)
+    ) {
+      no_content_length = true;
+    }
+  }
+
+  HeadCacheEntry *cache = nullptr;
+  bool cached = false;
+  if (m_is_response && m_method != s_HEAD && !m_head->raw_headers()) {
+    auto headers = m_head->headers();
+    if (headers && !m_head->headerNames()) {
+      auto &e = head_cache_slot(headers);
+      auto head = m_head->as<ResponseHead>();
+      if (head_cache_match(e, headers, head, m_protocol, m_status_code)) {
+        buffer->push(e.lines);
+        cached = true;
+        m_header_connection = e.header_connection;
+        m_header_upgrade = e.header_upgrade;
+      } else if (e.seen == headers && head_cache_snapshot(e, headers)) {
+        e.headers = headers;
+        e.protocol = m_protocol;
+        e.status_text = head->statusText;
+        e.status = m_status_code;
+        cache = &e;
+      } else {
+        e.seen = headers;
+        e.headers = nullptr;
+        e.values.clear();
+        e.lines.clear();
+      }
+    }
+  }
+
+  if (cache) {
+    cache->lines.clear();
+    Data::Builder db(cache->lines, &s_dp);
+    write_head_lines(db, no_content_length);
+    db.flush();
+    cache->header_connection = m_header_connection;
+    cache->header_upgrade = m_header_upgrade;
+    buffer->push(cache->lines);
+  } else if (!cached) {
+    Data::Builder db(*buffer, &s_dp);
+    write_head_lines(db, no_content_length);
+    db.flush();
+  }
+
   Data::Builder db(*buffer, &s_dp);
 
+  if (!m_is_response) {
+    auto head = m_head->as<RequestHead>();
+    auto req = new RequestQueue::Request;
+    req->head = head;
+    req->is_final = head->is_final(m_header_connection);
+    req->tunnel_type = head->tunnel_type(m_header_upgrade);
+    on_encode_request(req);
+  }
+
+  if (!no_content_length) {
+    if (m_chunked) {
+      static const std::string str("transfer-encoding: chunked\r\n");
+      db.push(str);
+    } else if (
+      m_content_length > 0 ||
+      m_is_response ||
+      m_method == s_POST ||
+      m_method == s_PUT ||
+      m_method == s_PATCH
+    ) {
+      char str[100];
+      auto len = utils::to_string(str, sizeof(str), m_content_length);
+      db.push(s_content_length.get()->str());
+      db.push(": ", 2);
+      db.push(str, len);
+      db.push("\r\n", 2);
+    }
+  }
+
+  if (m_is_final) {
+    static const std::string str("connection: close\r\n");
+    db.push(str);
+  } else if (m_header_connection) {
+    static const std::string str("connection: ");
+    db.push(str);
+    db.push(m_header_connection->str());
+    db.push("\r\n");
+  } else {
+    static const std::string str("connection: keep-alive\r\n");
+    db.push(str);
+  }
+
+  db.push("\r\n");
+  db.flush();
+
+  output(MessageStart::make(m_head));
+  output(buffer);
+}
+
+void Encoder::write_head_lines(Data::Builder &db, bool &no_content_length) {
   if (m_is_response) {
     auto head = m_head->as<ResponseHead>();
     char str[100];
@@ -826,14 +1010,6 @@ void Encoder::output_head() {
       }
     }
 
-    auto status = m_status_code;
-    if (
-      (status < 200 || status == 204) ||
-      (m_responded_tunnel_type != TunnelType::NONE)
-    ) {
-      no_content_length = true;
-    }
-
   } else {
     db.push(m_method->str());
     db.push(' ');
@@ -843,8 +1019,13 @@ void Encoder::output_head() {
     db.push("\r\n");
   }
 
-  if (auto headers = m_head->headers.get()) {
-    auto names = m_head->headerNames.get();
+  auto raw = m_head->raw_headers();
+  if (raw && m_method != s_HEAD) {
+    m_header_upgrade = raw->upgrade;
+    db.push(raw->lines);
+
+  } else if (auto headers = m_head->headers()) {
+    auto names = m_head->headerNames();
     headers->iterate_all(
       [&](pjs::Str *k, pjs::Value &v) {
         if (k == s_keep_alive) return;
@@ -894,54 +1075,6 @@ void Encoder::output_head() {
       }
     );
   }
-
-  if (!m_is_response) {
-    auto head = m_head->as<RequestHead>();
-    auto req = new RequestQueue::Request;
-    req->head = head;
-    req->is_final = head->is_final(m_header_connection);
-    req->tunnel_type = head->tunnel_type(m_header_upgrade);
-    on_encode_request(req);
-  }
-
-  if (!no_content_length) {
-    if (m_chunked) {
-      static const std::string str("transfer-encoding: chunked\r\n");
-      db.push(str);
-    } else if (
-      m_content_length > 0 ||
-      m_is_response ||
-      m_method == s_POST ||
-      m_method == s_PUT ||
-      m_method == s_PATCH
-    ) {
-      char str[100];
-      auto len = utils::to_string(str, sizeof(str), m_content_length);
-      db.push(s_content_length.get()->str());
-      db.push(": ", 2);
-      db.push(str, len);
-      db.push("\r\n", 2);
-    }
-  }
-
-  if (m_is_final) {
-    static const std::string str("connection: close\r\n");
-    db.push(str);
-  } else if (m_header_connection) {
-    static const std::string str("connection: ");
-    db.push(str);
-    db.push(m_header_connection->str());
-    db.push("\r\n");
-  } else {
-    static const std::string str("connection: keep-alive\r\n");
-    db.push(str);
-  }
-
-  db.push("\r\n");
-  db.flush();
-
-  output(MessageStart::make(m_head));
-  output(buffer);
 }
 
 void Encoder::output_chunk(const Data &data) {
@@ -1357,19 +1490,20 @@ void Demux::on_decode_error() {
 }
 
 void Demux::on_decode_request(RequestQueue::Request *req) {
+  if (auto inbound = Filter::context()->inbound()) inbound->record(FlightRecorder::REQUEST);
   m_request_queue.push(req);
   if (req->tunnel_type != TunnelType::NONE) {
     DemuxQueue::wait_output();
     if (req->tunnel_type == TunnelType::HTTP2) {
-      req->head->headers->ht_delete(s_upgrade);
-      req->head->headers->ht_delete(s_http2_settings);
+      req->head->headers()->ht_delete(s_upgrade);
+      req->head->headers()->ht_delete(s_http2_settings);
       m_http2 = true;
       http2::Server::chain(Filter::output());
       Decoder::chain(http2::Server::initial_stream());
       auto head = ResponseHead::make();
       auto headers = pjs::Object::make();
       head->status = 101;
-      head->headers = headers;
+      head->headers(headers);
       headers->set(s_connection, s_upgrade.get());
       headers->set(s_upgrade, s_h2c.get());
       auto out = Encoder::input();
@@ -1432,6 +1566,9 @@ Mux::Options::Options(pjs::Object *options)
   Value(options, "maxHeaderSize")
     .get_binary_size(max_header_size)
     .check_nullable();
+  Value(options, "maxPipeline")
+    .get(max_pipeline)
+    .check_nullable();
   Value(options, "version")
     .get(version)
     .get(version_s)
@@ -1592,7 +1729,9 @@ auto Mux::Session::on_decode_response(ResponseHead *head) -> RequestQueue::Reque
     MuxQueue::increase_output_count(1);
     return nullptr;
   } else {
-    return m_request_queue.shift();
+    auto req = m_request_queue.shift();
+    if (!req) disable_pipelining(); // a response to nothing we sent
+    return req;
   }
 }
 
@@ -1618,10 +1757,68 @@ void Mux::Session::on_ping(const Data &data) {
   }
 }
 
+//
+// With maxPipeline, up to that many requests are in flight on one HTTP/1
+// connection. Only idempotent requests are pipelined: anything else, as
+// well as tunnels and requests that close the connection, goes out alone
+// on an otherwise idle connection and holds back those behind it.
+//
+
+bool Mux::Session::on_queue_admit(MessageStart *msg) {
+  if (m_options.max_pipeline <= 0) return true;
+
+  thread_local static const pjs::ConstStr s_OPTIONS("OPTIONS");
+  thread_local static const pjs::ConstStr s_DELETE("DELETE");
+  thread_local static const pjs::ConstStr s_TRACE("TRACE");
+
+  auto head = pjs::coerce<RequestHead>(msg->head());
+  auto method = head->method.get();
+  auto idempotent = (
+    !method || method == s_GET || method == s_HEAD || method == s_PUT ||
+    method == s_DELETE || method == s_OPTIONS || method == s_TRACE
+  );
+  auto safe = idempotent && head->tunnel_type() == TunnelType::NONE && !head->is_final();
+
+  auto n = MuxQueue::in_flight();
+  if (n == 0) {
+    m_unsafe_in_flight = !safe;
+    return true;
+  }
+
+  if (!safe || m_unsafe_in_flight) return false;
+  return n < max_pipeline();
+}
+
+//
+// When an upstream closes the connection while pipelined requests are
+// still unanswered, or answers more than it was asked, it does not handle
+// pipelining well. The pool falls back to one request at a time.
+//
+
 void Mux::Session::on_queue_end(StreamEnd *eos) {
+  if (m_options.max_pipeline > 1 && m_request_queue.size() > 1) {
+    disable_pipelining();
+  }
   MuxSession::end(eos);
 }
 
+auto Mux::Session::max_pipeline() const -> int {
+  auto p = static_cast<SessionPool*>(MuxSession::pool());
+  if (p && p->m_pipelining_disabled) return 1;
+  return m_options.max_pipeline;
+}
+
+void Mux::Session::disable_pipelining() {
+  if (m_options.max_pipeline <= 1) return;
+  if (auto p = static_cast<SessionPool*>(MuxSession::pool())) {
+    if (!p->m_pipelining_disabled) {
+      p->m_pipelining_disabled = true;
+      Log::warn("[muxHTTP] upstream mishandled pipelined requests, pipelining disabled");
+    }
+  }
+  MuxSession::set_max_share_count(1);
+}
+
 void Mux::Session::on_endpoint_close(StreamEnd *eos) {
   MuxSession::end(eos);
 }
@@ -1663,6 +1860,10 @@ bool Mux::Session::select_protocol(Mux *mux, const pjs::Value &version) {
     MuxSession::chain(Decoder::input());
     Decoder::chain(MuxQueue::reply());
     Encoder::set_buffer_size(m_options.buffer_size);
+    if (m_options.max_pipeline > 0) {
+      // More streams than that would only wait here while others connect
+      MuxSession::set_max_share_count(max_pipeline());
+    }
     MuxSession::set_pending(false);
     return true;
   case 2:
@@ -1806,6 +2007,185 @@ void Server::Handler::on_rejected(const pjs::Value &error) {
   m_server->Filter::error(StreamEnd::make(error));
 }
 
+//
+// StaticServer
+//
+// Answers every request from responses built once when the filter is
+// created, without calling into scripts. Each response gets an ETag made
+// from its body and a Date header refreshed once per second, so its head
+// lines stay in the encoder's head cache between refreshes.
+//
+
+static auto current_http_date() -> pjs::Str* {
+  thread_local static pjs::Ref<pjs::Str> s_str;
+  thread_local static std::time_t s_sec = 0;
+  auto t = std::time_t(utils::now_coarse() / 1000);
+  if (!s_str || t != s_sec) {
+    char buf[32];
+    auto len = utils::format_http_date(buf);
+    s_str = pjs::Str::make(buf, len);
+    s_sec = t;
+  }
+  return s_str;
+}
+
+static bool etag_matches(const std::string &list, const std::string &etag) {
+  for (const auto &s : utils::split(list, ',')) {
+    auto tag = utils::trim(s);
+    if (tag == "*") return true;
+    if (utils::starts_with(tag, "W/")) tag = tag.substr(2);
+    if (tag == etag) return true;
+  }
+  return false;
+}
+
+void StaticServer::Response::init(pjs::Object *message) {
+  pjs::Ref<ResponseHead> src;
+  if (message && message->is_instance_of<Message>()) {
+    auto msg = message->as<Message>();
+    src = pjs::coerce<ResponseHead>(msg->head());
+    body = msg->body();
+  } else {
+    src = pjs::coerce<ResponseHead>(message);
+  }
+
+  uint64_t h = 0xcbf29ce484222325ull;
+  if (body) {
+    for (const auto c : body->chunks()) {
+      auto p = std::get<0>(c);
+      auto n = std::get<1>(c);
+      for (int i = 0; i < n; i++) h = (h ^ (uint8_t)p[i]) * 0x100000001b3ull;
+    }
+  }
+  char buf[100];
+  auto len = std::snprintf(buf, sizeof(buf), "\"%x-%llx\"", body ? (unsigned)body->size() : 0, (unsigned long long)h);
+  etag = pjs::Str::make(buf, len);
+
+  auto headers = pjs::Object::make();
+  if (auto obj = src->headers()) {
+    obj->iterate_all([&](pjs::Str *k, pjs::Value &v) { headers->set(k, v); });
+  }
+  headers->set(s_etag, etag.get());
+  head = ResponseHead::make();
+  head->status = src->status;
+  head->statusText = src->statusText;
+  head->headers(headers);
+
+  auto headers_304 = pjs::Object::make();
+  headers_304->set(s_etag, etag.get());
+  not_modified = ResponseHead::make();
+  not_modified->status = 304;
+  not_modified->headers(headers_304);
+}
+
+void StaticServer::Response::init(int status) {
+  pjs::Ref<ResponseHead> h = ResponseHead::make();
+  h->status = status;
+  init(h);
+}
+
+StaticServer::StaticServer(pjs::Object *responses, const Options &options)
+  : Demux(options)
+  , m_responses(std::make_shared<Responses>())
+{
+  auto &r = *m_responses;
+  if (!responses || responses->is_instance_of<Message>()) {
+    r.all.init(responses);
+    r.has_all = true;
+  } else {
+    responses->iterate_all(
+      [&](pjs::Str *k, pjs::Value &v) {
+        if (!v.is<Message>()) {
+          std::string msg("response for path ");
+          throw std::runtime_error(msg + k->str() + " expects a Message");
+        }
+        r.paths[k->str()].init(v.as<Message>());
+      }
+    );
+  }
+  r.not_found.init(404);
+}
+
+StaticServer::StaticServer(const StaticServer &r)
+  : Demux(r)
+  , m_responses(r.m_responses)
+{
+}
+
+StaticServer::~StaticServer()
+{
+}
+
+void StaticServer::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "respondStatic";
+}
+
+auto StaticServer::clone() -> Filter* {
+  return new StaticServer(*this);
+}
+
+auto StaticServer::on_demux_open_stream() -> EventFunction* {
+  return new Handler(this);
+}
+
+void StaticServer::on_demux_close_stream(EventFunction *stream) {
+  delete static_cast<Handler*>(stream);
+}
+
+auto StaticServer::find(RequestHead *head, bool &not_modified) -> Response* {
+  auto &r = *m_responses;
+  Response *res = nullptr;
+  if (r.has_all) {
+    res = &r.all;
+  } else if (auto path = head->path.get()) {
+    auto &s = path->str();
+    auto q = s.find('?');
+    auto i = (q == std::string::npos ? r.paths.find(s) : r.paths.find(s.substr(0, q)));
+    if (i != r.paths.end()) res = &i->second;
+  }
+  if (!res) return &r.not_found;
+
+  not_modified = false;
+  auto method = head->method.get();
+  if (!method || method == s_GET || method == s_HEAD) {
+    if (auto headers = head->headers()) {
+      pjs::Value v;
+      headers->get(s_if_none_match, v);
+      if (v.is_string()) not_modified = etag_matches(v.s()->str(), res->etag->str());
+    }
+  }
+  return res;
+}
+
+//
+// StaticServer::Handler
+//
+
+void StaticServer::Handler::on_event(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    if (!m_response) {
+      pjs::Ref<RequestHead> head = pjs::coerce<RequestHead>(start->head());
+      m_response = m_server->find(head, m_not_modified);
+    }
+
+  } else if (evt->is_end()) {
+    if (auto res = m_response) {
+      m_response = nullptr;
+      auto date = current_http_date();
+      if (m_not_modified) {
+        res->not_modified->headers()->set(s_date, date);
+        output(MessageStart::make(res->not_modified));
+      } else {
+        res->head->headers()->set(s_date, date);
+        output(MessageStart::make(res->head));
+        if (res->body && !res->body->empty()) output(res->body);
+      }
+      output(MessageEnd::make());
+    }
+  }
+}
+
 //
 // TunnelServer
 //
@@ -34,6 +34,10 @@
 #include "http2.hpp"
 #include "options.hpp"
 
+#include <memory>
+#include <string>
+#include <unordered_map>
+
 namespace pipy {
 namespace http {
 
@@ -58,6 +62,7 @@ public:
   };
 
   bool empty() const { return m_queue.empty(); }
+  auto size() const -> size_t { return m_queue.size(); }
   void reset() { while (auto *r = m_queue.head()) { m_queue.remove(r); delete r; } }
   void push(Request *req) { m_queue.push(req); }
   auto head() const -> Request* { return m_queue.head(); }
@@ -107,6 +112,7 @@ private:
   Data m_head_buffer;
   size_t m_max_header_size = DATA_CHUNK_SIZE;
   pjs::Ref<MessageHead> m_head;
+  std::unique_ptr<MessageHead::RawHeaders> m_raw_headers;
   pjs::Ref<pjs::Str> m_method;
   pjs::Ref<pjs::Str> m_header_transfer_encoding;
   pjs::Ref<pjs::Str> m_header_content_length;
@@ -119,6 +125,7 @@ private:
   bool m_is_response;
   bool m_is_tunnel = false;
   bool m_has_error = false;
+  bool m_has_raw_header_error = false;
 
   virtual void on_event(Event *evt) override;
 
@@ -169,6 +176,7 @@ private:
   virtual void on_event(Event *evt) override;
 
   void output_head();
+  void write_head_lines(Data::Builder &db, bool &no_content_length);
   void output_chunk(const Data &data);
   void output_end(Event *evt);
 };
@@ -342,6 +350,7 @@ public:
   {
     size_t buffer_size = DATA_CHUNK_SIZE;
     size_t max_header_size = DATA_CHUNK_SIZE;
+    int max_pipeline = 0;
     int version = 1;
     pjs::Ref<pjs::Str> version_s;
     pjs::Ref<pjs::Function> version_f;
@@ -400,6 +409,7 @@ public:
     virtual void on_decode_final() override;
     virtual void on_decode_error() override;
     virtual void on_ping(const Data &data) override;
+    virtual bool on_queue_admit(MessageStart *msg) override;
     virtual void on_queue_end(StreamEnd *eos) override;
     virtual void on_endpoint_close(StreamEnd *eos) override;
     virtual void on_auto_release() override { delete this; }
@@ -411,7 +421,10 @@ public:
     pjs::Ref<pjs::Promise::Callback> m_ping_promise_cb;
     RequestQueue m_request_queue;
     bool m_http2 = false;
+    bool m_unsafe_in_flight = false;
 
+    auto max_pipeline() const -> int;
+    void disable_pipelining();
     bool select_protocol(Mux *muxer);
     bool select_protocol(Mux *muxer, const pjs::Value &version);
     void schedule_ping(Data *ack = nullptr);
@@ -446,6 +459,7 @@ private:
 
     Options m_options;
     std::shared_ptr<BufferStats> m_buffer_stats;
+    bool m_pipelining_disabled = false;
   };
 };
 
@@ -495,6 +509,73 @@ private:
   pjs::Ref<pjs::Object> m_handler;
 };
 
+//
+// StaticServer
+//
+
+class StaticServer : public Demux {
+public:
+  StaticServer(pjs::Object *responses, const Options &options);
+
+private:
+  StaticServer(const StaticServer &r);
+  ~StaticServer();
+
+  virtual auto clone() -> Filter* override;
+  virtual void dump(Dump &d) override;
+
+  virtual auto on_demux_open_stream() -> EventFunction* override;
+  virtual void on_demux_close_stream(EventFunction *stream) override;
+
+  //
+  // StaticServer::Response
+  //
+
+  struct Response {
+    pjs::Ref<ResponseHead> head;
+    pjs::Ref<ResponseHead> not_modified;
+    pjs::Ref<pjs::Str> etag;
+    pjs::Ref<Data> body;
+
+    void init(pjs::Object *message);
+    void init(int status);
+  };
+
+  //
+  // StaticServer::Responses
+  //
+
+  struct Responses {
+    std::unordered_map<std::string, Response> paths;
+    Response all;
+    Response not_found;
+    bool has_all = false;
+  };
+
+  //
+  // StaticServer::Handler
+  //
+
+  class Handler :
+    public pjs::Pooled<Handler>,
+    public EventFunction
+  {
+  public:
+    Handler(StaticServer *server) : m_server(server) {}
+
+  private:
+    StaticServer* m_server;
+    Response* m_response = nullptr;
+    bool m_not_modified = false;
+
+    virtual void on_event(Event *evt) override;
+  };
+
+  std::shared_ptr<Responses> m_responses;
+
+  auto find(RequestHead *head, bool &not_modified) -> Response*;
+};
+
 //
 // TunnelServer
 //
@@ -27,6 +27,9 @@
 #include "api/stats.hpp"
 #include "api/console.hpp"
 #include "log.hpp"
+#include "header-names.hpp"
+
+#include <algorithm>
 
 #define DEBUG_HTTP2 1
 
@@ -75,6 +78,7 @@ thread_local static const pjs::ConstStr s_CONNECT("CONNECT");
 thread_local static const pjs::ConstStr s_root_path("/");
 thread_local static const pjs::ConstStr s_200("200");
 thread_local static const pjs::ConstStr s_http2_settings("http2-settings");
+thread_local static const pjs::ConstStr s_priority("priority");
 thread_local static const pjs::ConstStr s_connection("connection");
 thread_local static const pjs::ConstStr s_keep_alive("keep-alive");
 thread_local static const pjs::ConstStr s_proxy_connection("proxy-connection");
@@ -85,6 +89,12 @@ thread_local static const pjs::ConstStr s_trailers("trailers");
 thread_local static const pjs::ConstStr s_content_length("content-length");
 thread_local static const pjs::ConstStr s_cookie("cookie");
 thread_local static const pjs::ConstStr s_set_cookie("set-cookie");
+thread_local static const pjs::ConstStr s_date("date");
+thread_local static const pjs::ConstStr s_age("age");
+thread_local static const pjs::ConstStr s_etag("etag");
+thread_local static const pjs::ConstStr s_last_modified("last-modified");
+thread_local static const pjs::ConstStr s_x_request_id("x-request-id");
+thread_local static const pjs::ConstStr s_traceparent("traceparent");
 
 static struct {
   const char *name;
@@ -518,6 +528,7 @@ void Frame::debug_dump(std::ostream &out) const {
     case GOAWAY:        out << "GOAWAY       "; break;
     case WINDOW_UPDATE: out << "WINDOW_UPDATE"; break;
     case CONTINUATION:  out << "CONTINUATION "; break;
+    case PRIORITY_UPDATE: out << "PRIORITY_UPDATE"; break;
   }
   out << std::left << " stream " << std::setw(3) << stream_id;
   if (type == SETTINGS || type == PING) {
@@ -719,7 +730,7 @@ void DynamicTable::evict() {
 
 thread_local
 const HeaderDecoder::StaticTable HeaderDecoder::s_static_table;
-const HeaderDecoder::HuffmanTree HeaderDecoder::s_huffman_tree;
+const HeaderDecoder::HuffmanTable HeaderDecoder::s_huffman_table;
 
 HeaderDecoder::HeaderDecoder(const Settings &settings)
   : m_settings(settings)
@@ -740,7 +751,7 @@ void HeaderDecoder::start(bool is_response, bool is_trailer) {
   } else {
     m_head = http::RequestHead::make();
   }
-  m_head->headers = pjs::Object::make();
+  m_head->headers(pjs::Object::make());
   m_buffer.clear();
   m_state = INDEX_PREFIX;
   m_is_response = is_response;
@@ -782,7 +793,7 @@ auto HeaderDecoder::decode(Data &data) -> ErrorCode {
         }
         case NAME_STRING: {
           if (read_str(c, true)) {
-            m_name = pjs::Str::make(m_buffer.to_string());
+            m_name = http::HeaderNames::get(m_buffer.to_string());
             m_buffer.clear();
             m_state = VALUE_PREFIX;
           }
@@ -853,35 +864,28 @@ bool HeaderDecoder::read_int(uint8_t c) {
 
 bool HeaderDecoder::read_str(uint8_t c, bool lowercase_only) {
   if (m_prefix & 0x80) {
-    const auto &tree = s_huffman_tree.get();
-    int last_bit = 8;
-    for (int b = 7; b >= 0; b--) {
-      bool bit = (c >> b) & 1;
-      m_ptr = bit ? tree[m_ptr].right : tree[m_ptr].left;
-      auto &node = tree[m_ptr];
-      if (!node.left) {
-        auto ch = node.right;
-        if (ch == 256) {
-          error(); // EOS is considered an error
-          return false;
-        }
+    bool accepted = false;
+    for (int shift = 4; shift >= 0; shift -= 4) {
+      const auto &t = s_huffman_table.get(m_ptr, (c >> shift) & 0x0f);
+      if (t.flags & HuffmanTable::FAIL) {
+        error(); // EOS is considered an error
+        return false;
+      }
+      if (t.flags & HuffmanTable::SYMBOL) {
         if (lowercase_only) {
-          if (std::tolower(ch) != ch) {
+          if (std::tolower(t.symbol) != t.symbol) {
             error(PROTOCOL_ERROR);
             return false;
           }
         }
-        s_dp.push(&m_buffer, char(ch));
-        m_ptr = 0;
-        last_bit = b;
+        s_dp.push(&m_buffer, char(t.symbol));
       }
+      m_ptr = t.state;
+      accepted = t.flags & HuffmanTable::ACCEPT;
     }
-    if (m_int == 1) {
-      uint8_t mask = uint8_t(1 << last_bit) - 1;
-      if (mask == 0xff || (c & mask) != mask) {
-        error();
-        return false;
-      }
+    if (m_int == 1 && !accepted) {
+      error();
+      return false;
     }
   } else {
     if (lowercase_only) {
@@ -1001,7 +1005,7 @@ bool HeaderDecoder::add_field(pjs::Str *name, pjs::Str *value) {
       } else if (name == s_colon_authority) {
         auto req = m_head->as<http::RequestHead>();
         pjs::Value v;
-        auto headers = m_head->headers.get();
+        auto headers = m_head->headers();
         headers->get(s_host, v);
         if (v.is_undefined()) headers->set(s_host, value);
         req->authority = value;
@@ -1035,10 +1039,10 @@ bool HeaderDecoder::add_field(pjs::Str *name, pjs::Str *value) {
     if (name == s_content_length) {
       m_content_length = std::atoi(value->c_str());
     }
-    auto headers = m_head->headers.get();
+    auto headers = m_head->headers();
     if (!headers) {
       headers = pjs::Object::make();
-      m_head->headers = headers;
+      m_head->headers(headers);
     }
     if (name == s_cookie || name == s_set_cookie) {
       pjs::Value v;
@@ -1090,32 +1094,78 @@ HeaderDecoder::StaticTable::StaticTable() {
     m_table.emplace_back();
     auto &ent = m_table.back();
     auto &p = s_hpack_static_table[i];
-    ent.name = pjs::Str::make(p.name);
+    ent.name = http::HeaderNames::get(p.name, std::strlen(p.name));
     ent.value = p.value ? pjs::Str::make(p.value) : pjs::Str::empty.get();
   }
 }
 
 //
-// HeaderDecoder::HuffmanTree
+// HeaderDecoder::HuffmanTable
 //
 
-HeaderDecoder::HuffmanTree::HuffmanTree() {
+HeaderDecoder::HuffmanTable::HuffmanTable() {
+  struct Node {
+    uint16_t left = 0;
+    uint16_t right = 0; // symbol for a leaf
+    uint16_t state = 0;
+    bool accept = false;
+  };
+
+  // Build the code tree first
+  std::vector<Node> tree(1);
   int n = sizeof(s_hpack_huffman_table) / sizeof(s_hpack_huffman_table[0]);
-  m_tree.resize(1);
   for (int i = 0; i < n; i++) {
     auto &p = s_hpack_huffman_table[i];
     int ptr = 0;
     for (int b = p.bits - 1; b >= 0; b--) {
       bool bit = (p.code >> b) & 1;
-      auto &node = m_tree[ptr];
-      ptr = bit ? node.right : node.left;
-      if (!ptr) {
-        ptr = m_tree.size();
-        (bit ? node.right : node.left) = ptr;
-        m_tree.emplace_back();
+      int next = bit ? tree[ptr].right : tree[ptr].left;
+      if (!next) {
+        next = tree.size();
+        (bit ? tree[ptr].right : tree[ptr].left) = next;
+        tree.emplace_back();
       }
+      ptr = next;
+    }
+    tree[ptr].right = i;
+  }
+
+  // Number the internal nodes as states, with the root being state 0
+  int state_count = 0;
+  for (auto &node : tree) {
+    if (node.left) node.state = state_count++;
+  }
+
+  // Padding is a prefix of EOS, so all ones and no longer than 7 bits
+  tree[0].accept = true;
+  for (int i = 0, ptr = 0; i < 7; i++) {
+    ptr = tree[ptr].right;
+    tree[ptr].accept = true;
+  }
+
+  m_table.resize(state_count * 16);
+  for (size_t i = 0; i < tree.size(); i++) {
+    if (!tree[i].left) continue;
+    for (int nibble = 0; nibble < 16; nibble++) {
+      auto &t = m_table[tree[i].state * 16 + nibble];
+      int ptr = i;
+      t.flags = 0;
+      t.symbol = 0;
+      for (int b = 3; b >= 0; b--) {
+        ptr = ((nibble >> b) & 1) ? tree[ptr].right : tree[ptr].left;
+        if (!tree[ptr].left) {
+          if (tree[ptr].right == 256) {
+            t.flags = FAIL;
+            break;
+          }
+          t.flags |= SYMBOL;
+          t.symbol = tree[ptr].right;
+          ptr = 0;
+        }
+      }
+      t.state = tree[ptr].state;
+      if (tree[ptr].accept) t.flags |= ACCEPT;
     }
-    m_tree[ptr].right = i;
   }
 }
 
@@ -1125,18 +1175,80 @@ HeaderDecoder::HuffmanTree::HuffmanTree() {
 
 thread_local HeaderEncoder::StaticTable HeaderEncoder::m_static_table;
 
-void HeaderEncoder::encode(bool is_response, bool is_tail, pjs::Object *head, Data &data) {
+//
+// Values that change with nearly every message only push useful
+// entries out of the dynamic table, so they are never added to it
+//
+
+static bool is_volatile_header(pjs::Str *name) {
+  return (
+    name == s_content_length ||
+    name == s_date ||
+    name == s_age ||
+    name == s_etag ||
+    name == s_last_modified ||
+    name == s_x_request_id ||
+    name == s_traceparent
+  );
+}
+
+static auto lowercase_name(pjs::Str *name) -> pjs::Str* {
+  const auto &s = name->str();
+  for (size_t i = 0, n = s.length(); i < n; i++) {
+    if (std::isupper(s[i])) {
+      std::string lower(s);
+      for (auto &c : lower) c = std::tolower(c);
+      return http::HeaderNames::get(lower);
+    }
+  }
+  return name;
+}
+
+void HeaderEncoder::reset() {
+  m_dynamic_table.clear();
+  m_dynamic_fields.clear();
+  m_dynamic_names.clear();
+  m_dynamic_size = 0;
+  m_capacity = Settings::DEFAULT_HEADER_TABLE_SIZE;
+  m_capacity_min = Settings::DEFAULT_HEADER_TABLE_SIZE;
+  m_capacity_changed = false;
+  m_next_id = 0;
+  m_added_size = 0;
+}
+
+//
+// The peer's SETTINGS_HEADER_TABLE_SIZE is an upper limit. Anything above
+// the default is not used, so the table never grows past 4KB per connection.
+//
+
+void HeaderEncoder::set_table_size(size_t size) {
+  auto capacity = std::min(size, size_t(Settings::DEFAULT_HEADER_TABLE_SIZE));
+  if (capacity == m_capacity) return;
+  m_capacity_min = m_capacity_changed ? std::min(m_capacity_min, capacity) : capacity;
+  m_capacity_changed = true;
+  m_capacity = capacity;
+  evict_dynamic(capacity);
+}
+
+void HeaderEncoder::encode(bool is_response, bool is_tail, pjs::Object *head, Data &data, bool use_dynamic_table) {
   Data::Builder db(data, &s_dp);
   bool has_authority = false;
+
+  if (use_dynamic_table && m_capacity_changed) {
+    if (m_capacity_min < m_capacity) encode_int(db, 0x20, 3, m_capacity_min);
+    encode_int(db, 0x20, 3, m_capacity);
+    m_capacity_changed = false;
+  }
+
   if (!is_tail) {
     if (is_response) {
       pjs::Ref<http::ResponseHead> h = pjs::coerce<http::ResponseHead>(head);
       auto status = h->status;
       if (status == 200) {
-        encode_header_field(db, s_colon_status, s_200);
+        encode_header_field(db, s_colon_status, s_200, use_dynamic_table);
       } else {
         pjs::Ref<pjs::Str> str(pjs::Str::make(status));
-        encode_header_field(db, s_colon_status, str);
+        encode_header_field(db, s_colon_status, str, use_dynamic_table);
       }
 
     } else {
@@ -1150,12 +1262,12 @@ void HeaderEncoder::encode(bool is_response, bool is_tail, pjs::Object *head, Da
       if (!scheme || !scheme->length()) scheme = s_http;
       if (!path || !path->length()) path = s_root_path;
 
-      encode_header_field(db, s_colon_method, method);
-      encode_header_field(db, s_colon_scheme, scheme);
-      encode_header_field(db, s_colon_path, path);
+      encode_header_field(db, s_colon_method, method, use_dynamic_table);
+      encode_header_field(db, s_colon_scheme, scheme, use_dynamic_table);
+      encode_header_field(db, s_colon_path, path, use_dynamic_table);
 
       if (authority && authority->length() > 0) {
-        encode_header_field(db, s_colon_authority, authority);
+        encode_header_field(db, s_colon_authority, authority, use_dynamic_table);
         has_authority = true;
       }
     }
@@ -1166,11 +1278,12 @@ void HeaderEncoder::encode(bool is_response, bool is_tail, pjs::Object *head, Da
   if (headers.is_object()) {
     if (auto obj = headers.o()) {
       obj->iterate_all(
-        [&](pjs::Str *k, pjs::Value &v) {
-          if (k == pjs::Str::empty) return;
+        [&](pjs::Str *name, pjs::Value &v) {
+          if (name == pjs::Str::empty) return;
+          pjs::Ref<pjs::Str> k(lowercase_name(name));
           if (k == s_host) {
             if (has_authority) return;
-            k = s_colon_authority;
+            k = s_colon_authority.get();
           }
           if (k == s_connection) return;
           if (k == s_keep_alive) return;
@@ -1181,13 +1294,13 @@ void HeaderEncoder::encode(bool is_response, bool is_tail, pjs::Object *head, Da
             v.as<pjs::Array>()->iterate_all(
               [&](pjs::Value &v, int) {
                 auto s = v.to_string();
-                encode_header_field(db, k, s);
+                encode_header_field(db, k, s, use_dynamic_table);
                 s->release();
               }
             );
           } else {
             auto s = v.to_string();
-            encode_header_field(db, k, s);
+            encode_header_field(db, k, s, use_dynamic_table);
             s->release();
           }
         }
@@ -1198,18 +1311,57 @@ void HeaderEncoder::encode(bool is_response, bool is_tail, pjs::Object *head, Da
   db.flush();
 }
 
-void HeaderEncoder::encode_header_field(Data::Builder &db, pjs::Str *k, pjs::Str *v) {
-  if (const auto *ent = m_static_table.find(k)) {
+void HeaderEncoder::encode_header_field(Data::Builder &db, pjs::Str *k, pjs::Str *v, bool use_dynamic_table) {
+  const auto *ent = m_static_table.find(k);
+  if (ent) {
     auto i = ent->values.find(v);
-    if (i == ent->values.end()) {
+    if (i != ent->values.end()) {
+      encode_int(db, 0x80, 1, i->second);
+      return;
+    }
+  }
+
+  if (!use_dynamic_table) {
+    if (ent) {
       encode_int(db, 0x00, 4, ent->index);
       encode_str(db, v, false);
     } else {
-      encode_int(db, 0x80, 1, i->second);
+      encode_int(db, 0x00, 4, 0);
+      encode_str(db, k, true);
+      encode_str(db, v, false);
+    }
+    return;
+  }
+
+  int name_index = ent ? ent->index : 0;
+
+  // Entries getting close to eviction are added again while still in use,
+  // which keeps the hot ones in the table much like an LRU would
+  auto f = m_dynamic_fields.find(std::make_pair(k, v));
+  if (f != m_dynamic_fields.end()) {
+    auto id = f->second;
+    auto e = find_dynamic(id);
+    if (m_added_size - e->offset + e->size <= m_capacity * 3 / 4) {
+      encode_int(db, 0x80, 1, dynamic_index(id));
+      return;
     }
+    if (!name_index) name_index = dynamic_index(id);
+  }
+
+  if (!name_index) {
+    auto n = m_dynamic_names.find(k);
+    if (n != m_dynamic_names.end()) name_index = dynamic_index(n->second);
+  }
+
+  auto size = k->size() + v->size() + 32;
+  if (size <= m_capacity * 3 / 4 && !is_volatile_header(k)) {
+    encode_int(db, 0x40, 2, name_index);
+    if (!name_index) encode_str(db, k, true);
+    encode_str(db, v, false);
+    add_dynamic(k, v);
   } else {
-    encode_int(db, 0x00, 4, 0);
-    encode_str(db, k, true);
+    encode_int(db, 0x00, 4, name_index);
+    if (!name_index) encode_str(db, k, true);
     encode_str(db, v, false);
   }
 }
@@ -1221,25 +1373,88 @@ void HeaderEncoder::encode_int(Data::Builder &db, uint8_t prefix, int prefix_len
   } else {
     db.push(uint8_t(prefix | mask));
     n -= mask;
-    while (n) {
-      if (n >> 7) {
-        db.push(uint8_t(0x80 | (n & 0x7f)));
-      } else {
-        db.push(uint8_t(n & 0x7f));
-      }
+    while (n >> 7) {
+      db.push(uint8_t(0x80 | (n & 0x7f)));
       n >>= 7;
     }
+    db.push(uint8_t(n));
   }
 }
 
+//
+// Strings are Huffman coded only when that comes out shorter
+//
+
 void HeaderEncoder::encode_str(Data::Builder &db, pjs::Str *s, bool lowercase) {
-  encode_int(db, 0, 1, s->size());
-  if (lowercase) {
-    for (auto ch : s->str()) {
-      db.push(char(std::tolower(ch)));
+  const auto &str = s->str();
+  size_t bits = 0;
+  for (auto ch : str) {
+    auto c = uint8_t(lowercase ? std::tolower(ch) : ch);
+    bits += s_hpack_huffman_table[c].bits;
+  }
+
+  auto huffman_size = (bits + 7) / 8;
+  if (huffman_size < str.length()) {
+    encode_int(db, 0x80, 1, huffman_size);
+    uint64_t buf = 0;
+    int n = 0;
+    for (auto ch : str) {
+      auto c = uint8_t(lowercase ? std::tolower(ch) : ch);
+      const auto &h = s_hpack_huffman_table[c];
+      buf = (buf << h.bits) | h.code;
+      n += h.bits;
+      while (n >= 8) {
+        n -= 8;
+        db.push(uint8_t(buf >> n));
+      }
+    }
+    if (n > 0) {
+      db.push(uint8_t((buf << (8 - n)) | (0xff >> n)));
     }
+
   } else {
-    db.push(s->str());
+    encode_int(db, 0, 1, str.length());
+    if (lowercase) {
+      for (auto ch : str) {
+        db.push(char(std::tolower(ch)));
+      }
+    } else {
+      db.push(str);
+    }
+  }
+}
+
+auto HeaderEncoder::find_dynamic(uint64_t id) const -> const DynamicEntry* {
+  if (m_dynamic_table.empty()) return nullptr;
+  auto first = m_dynamic_table.front().id;
+  if (id < first || id >= m_next_id) return nullptr;
+  return &m_dynamic_table[id - first];
+}
+
+auto HeaderEncoder::dynamic_index(uint64_t id) const -> int {
+  return m_static_table.size() + 1 + int(m_next_id - 1 - id);
+}
+
+void HeaderEncoder::add_dynamic(pjs::Str *name, pjs::Str *value) {
+  auto size = name->size() + value->size() + 32;
+  evict_dynamic(m_capacity - size);
+  auto id = m_next_id++;
+  m_added_size += size;
+  m_dynamic_size += size;
+  m_dynamic_table.push_back({ name, value, size, id, m_added_size });
+  m_dynamic_fields[std::make_pair(name, value)] = id;
+  m_dynamic_names[name] = id;
+}
+
+void HeaderEncoder::evict_dynamic(size_t capacity) {
+  while (m_dynamic_size > capacity) {
+    const auto &e = m_dynamic_table.front();
+    auto f = m_dynamic_fields.find(std::make_pair(e.name.get(), e.value.get()));
+    if (f != m_dynamic_fields.end() && f->second == e.id) m_dynamic_fields.erase(f);
+    auto n = m_dynamic_names.find(e.name.get());
+    if (n != m_dynamic_names.end() && n->second == e.id) m_dynamic_names.erase(n);
+    m_dynamic_size -= e.size;
+    m_dynamic_table.pop_front();
   }
 }
 
@@ -1247,11 +1462,12 @@ HeaderEncoder::StaticTable::StaticTable() {
   int n = sizeof(s_hpack_static_table) / sizeof(s_hpack_static_table[0]);
   for (int i = 0; i < n; i++) {
     const auto &f = s_hpack_static_table[i];
-    const auto name = pjs::Str::make(f.name);
+    const auto name = http::HeaderNames::get(f.name, std::strlen(f.name));
     auto &ent = m_table[name];
     if (!ent.index) ent.index = i + 1;
     if (f.value) ent.values[pjs::Str::make(f.value)] = i + 1;
   }
+  m_size = n;
 }
 
 auto HeaderEncoder::StaticTable::find(pjs::Str *name) -> const Entry* {
@@ -1266,6 +1482,15 @@ auto HeaderEncoder::StaticTable::find(pjs::Str *name) -> const Entry* {
 
 std::atomic<uint32_t> Endpoint::s_endpoint_id(0);
 
+static const char s_bdp_ping_payload[] = "pipy-bdp";
+
+static bool is_bdp_ping(const Data &payload) {
+  uint8_t buf[8];
+  if (payload.size() != sizeof(buf)) return false;
+  payload.to_bytes(buf, sizeof(buf));
+  return !std::memcmp(buf, s_bdp_ping_payload, sizeof(buf));
+}
+
 thread_local bool Endpoint::s_metrics_initialized = false;
 thread_local int Endpoint::s_server_stream_count = 0;
 thread_local int Endpoint::s_client_stream_count = 0;
@@ -1277,6 +1502,15 @@ Endpoint::Options::Options(pjs::Object *options) {
   Value(options, "streamWindowSize")
     .get_binary_size(stream_window_size)
     .check_nullable();
+  Value(options, "maxWindowSize")
+    .get_binary_size(max_window_size)
+    .check_nullable();
+  Value(options, "windowAutoTuning")
+    .get(window_auto_tuning)
+    .check_nullable();
+  Value(options, "writeBatching")
+    .get(write_batching)
+    .check_nullable();
 }
 
 Endpoint::Endpoint(bool is_server_side, const Options &options)
@@ -1302,11 +1536,18 @@ void Endpoint::reset() {
   m_streams.clear();
   m_streams_pending.clear();
   m_header_decoder.reset();
+  m_header_encoder.reset();
   m_peer_settings = Settings();
   m_output_buffer.clear();
   m_last_received_stream_id = 0;
   m_send_window = INITIAL_SEND_WINDOW_SIZE;
   m_recv_window = INITIAL_RECV_WINDOW_SIZE;
+  m_recv_window_max = m_options.connection_window_size;
+  m_recv_window_low = m_recv_window_max / 2;
+  m_settings.initial_window_size = m_options.stream_window_size;
+  m_bdp_bytes = 0;
+  m_bdp_bandwidth = 0;
+  m_bdp_ping_pending = false;
   m_has_sent_preface = false;
   m_has_shutdown = false;
   m_has_gone_away = false;
@@ -1314,6 +1555,7 @@ void Endpoint::reset() {
 
 void Endpoint::init_settings(const uint8_t *data, size_t size) {
   m_peer_settings.decode(data, size);
+  m_header_encoder.set_table_size(m_peer_settings.header_table_size);
 }
 
 void Endpoint::process_event(Event *evt) {
@@ -1392,6 +1634,7 @@ void Endpoint::shutdown() {
 }
 
 void Endpoint::on_flush() {
+  send_data();
   send_window_updates();
   flush();
 }
@@ -1406,7 +1649,8 @@ void Endpoint::on_deframe(Frame &frm) {
     if (
       frm.type == Frame::SETTINGS ||
       frm.type == Frame::PING ||
-      frm.type == Frame::GOAWAY
+      frm.type == Frame::GOAWAY ||
+      frm.type == Frame::PRIORITY_UPDATE
     ) {
       connection_error(PROTOCOL_ERROR);
     } else {
@@ -1461,6 +1705,7 @@ void Endpoint::on_deframe(Frame &frm) {
             auto err = m_peer_settings.decode(buf, len);
             if (err == NO_ERROR) {
               bool ok = true;
+              m_header_encoder.set_table_size(m_peer_settings.header_table_size);
               if (m_peer_settings.initial_window_size != old_initial_window_size) {
                 auto delta = m_peer_settings.initial_window_size - old_initial_window_size;
                 ok = for_each_stream(
@@ -1488,6 +1733,8 @@ void Endpoint::on_deframe(Frame &frm) {
         } else if (!frm.is_ACK()) {
           frm.flags |= Frame::BIT_ACK;
           frame(frm);
+        } else if (m_bdp_ping_pending && is_bdp_ping(frm.payload)) {
+          update_bdp();
         } else {
           on_ping(frm.payload);
         }
@@ -1507,12 +1754,7 @@ void Endpoint::on_deframe(Frame &frm) {
               connection_error(FLOW_CONTROL_ERROR);
             } else {
               m_send_window = n;
-              for_each_pending_stream(
-                [this](StreamBase *s) {
-                  s->update_connection_send_window();
-                  return m_send_window > 0;
-                }
-              );
+              FlushTarget::need_flush();
             }
           }
         } else {
@@ -1520,6 +1762,29 @@ void Endpoint::on_deframe(Frame &frm) {
         }
         break;
       }
+      case Frame::PRIORITY_UPDATE: {
+        if (frm.payload.size() < 4) {
+          connection_error(FRAME_SIZE_ERROR);
+          break;
+        }
+        uint8_t buf[4];
+        frm.payload.shift(sizeof(buf), buf);
+        auto id = 0x7fffffff & (
+          ((uint32_t)buf[0] << 24)|
+          ((uint32_t)buf[1] << 16)|
+          ((uint32_t)buf[2] <<  8)|
+          ((uint32_t)buf[3] <<  0)
+        );
+        if (!id) {
+          connection_error(PROTOCOL_ERROR);
+        } else if (m_is_server_side) {
+          if (auto s = m_stream_map.get(id)) {
+            s->update_priority(frm.payload.to_string());
+            FlushTarget::need_flush();
+          }
+        }
+        break;
+      }
       case Frame::DATA:
       case Frame::HEADERS:
       case Frame::PRIORITY:
@@ -1553,6 +1818,90 @@ bool Endpoint::for_each_pending_stream(const std::function<bool(StreamBase*)> &c
   return true;
 }
 
+//
+// DATA frames are scheduled once per event loop turn following RFC 9218
+// priorities. Streams of a lower urgency go first. Among streams of the
+// same urgency, non-incremental ones are served one at a time by their
+// IDs, after which incremental ones take turns, each sending a frame
+// sized to an even share of the connection window. Streams that never
+// signal a priority are treated as incremental so that a big download
+// can't hold back small responses on the same connection.
+//
+
+void Endpoint::send_data() {
+  if (m_has_gone_away) return;
+
+  thread_local static std::vector<StreamBase*> s_streams;
+  thread_local static std::vector<int> s_done;
+
+  auto &streams = s_streams;
+  auto &done = s_done;
+  streams.clear();
+  done.clear();
+
+  for (auto *p = m_streams_pending.head(); p; ) {
+    auto *s = p; p = p->next();
+    if (s->m_send_buffer.empty()) {
+      s->set_pending(false);
+    } else {
+      streams.push_back(s);
+    }
+  }
+
+  if (streams.empty()) return;
+
+  std::sort(
+    streams.begin(), streams.end(),
+    [](StreamBase *a, StreamBase *b) {
+      if (a->m_urgency != b->m_urgency) return a->m_urgency < b->m_urgency;
+      if (a->m_incremental != b->m_incremental) return b->m_incremental;
+      return a->m_id < b->m_id;
+    }
+  );
+
+  auto i = streams.begin();
+  while (i != streams.end() && m_send_window > 0) {
+    auto urgency = (*i)->m_urgency;
+
+    // Non-incremental: one after another
+    while (i != streams.end() && (*i)->m_urgency == urgency && !(*i)->m_incremental) {
+      auto s = *i++;
+      s->pump(m_send_window);
+      if (s->m_send_buffer.empty()) done.push_back(s->m_id);
+      if (m_send_window <= 0) break;
+    }
+
+    // Incremental: round-robin
+    auto j = i;
+    while (j != streams.end() && (*j)->m_urgency == urgency) j++;
+    auto n = j - i;
+    while (n > 0 && m_send_window > 0) {
+      auto quantum = std::max(m_send_window / int(n), int(MIN_DATA_FRAME_SIZE));
+      auto sent = 0;
+      n = 0;
+      for (auto k = i; k != j; k++) {
+        auto s = *k;
+        if (!s || m_send_window <= 0) continue;
+        sent += s->pump(quantum);
+        if (s->m_send_buffer.empty()) {
+          done.push_back(s->m_id);
+          *k = nullptr;
+        } else if (s->m_send_window > 0) {
+          n++;
+        }
+      }
+      if (!sent) break;
+    }
+    i = j;
+  }
+
+  for (auto id : done) {
+    if (auto s = m_stream_map.get(id)) {
+      s->recycle();
+    }
+  }
+}
+
 void Endpoint::send_window_updates() {
   if (m_has_gone_away) return;
 
@@ -1588,6 +1937,70 @@ void Endpoint::send_window_updates() {
   }
 }
 
+//
+// Window auto-tuning estimates the bandwidth-delay product the way gRPC
+// does: a PING goes out with the first DATA after the previous one has
+// been answered, and the bytes that arrive before its ACK are one sample.
+// If a sample fills most of the window while the bandwidth keeps going
+// up, both windows are doubled, up to maxWindowSize.
+//
+
+void Endpoint::sample_bdp(int size) {
+  if (!m_options.window_auto_tuning) return;
+  m_bdp_bytes += size;
+  if (!m_bdp_ping_pending) {
+    m_bdp_ping_pending = true;
+    m_bdp_ping_time = utils::now();
+    m_bdp_bytes = size;
+    Frame frm;
+    frm.stream_id = 0;
+    frm.type = Frame::PING;
+    frm.flags = 0;
+    frm.payload.push(s_bdp_ping_payload, 8, &s_dp);
+    frame(frm);
+  }
+}
+
+void Endpoint::update_bdp() {
+  m_bdp_ping_pending = false;
+  auto rtt = std::max(utils::now() - m_bdp_ping_time, 1.0);
+  auto sample = m_bdp_bytes;
+  auto bandwidth = sample / rtt;
+  if (sample < m_settings.initial_window_size * 2 / 3) return;
+  if (bandwidth <= m_bdp_bandwidth) return;
+  m_bdp_bandwidth = bandwidth;
+  auto size = std::min(size_t(sample) * 2, m_options.max_window_size);
+  if (size > size_t(m_settings.initial_window_size)) grow_windows(size);
+}
+
+void Endpoint::grow_windows(int size) {
+  auto delta = size - m_settings.initial_window_size;
+  m_settings.initial_window_size = size;
+
+  uint8_t buf[Settings::MAX_SIZE];
+  auto len = m_settings.encode(buf);
+  Frame frm;
+  frm.stream_id = 0;
+  frm.type = Frame::SETTINGS;
+  frm.flags = 0;
+  frm.payload.push(buf, len, &s_dp);
+  frame(frm);
+
+  for_each_stream(
+    [=](StreamBase *s) {
+      s->m_recv_window += delta;
+      s->m_recv_window_max += delta;
+      s->m_recv_window_low = s->m_recv_window_max / 2;
+      return true;
+    }
+  );
+
+  if (size > m_recv_window_max) {
+    m_recv_window_max = size;
+    m_recv_window_low = size / 2;
+  }
+}
+
 void Endpoint::frame(Frame &frm) {
   if (m_has_gone_away) return;
 
@@ -1611,8 +2024,9 @@ void Endpoint::frame(Frame &frm) {
     FrameEncoder::frame(frm, m_output_buffer);
   }
 
-  // Send window updates
-  send_window_updates();
+  // Send window updates, or leave them to on_flush() so that there
+  // is only one of each per event loop turn
+  if (!m_options.write_batching) send_window_updates();
 
 #if DEBUG_HTTP2
   debug_dump_o(frm);
@@ -1623,10 +2037,18 @@ void Endpoint::frame(Frame &frm) {
   FlushTarget::need_flush();
 }
 
+//
+// Frames going out in one turn are packed into as few chunks as possible,
+// except for payloads of MIN_ZERO_COPY_SIZE and above, which are linked
+// as they are. That way, DATA received on one HTTP/2 connection and sent
+// out on another keeps referring to the chunks it was read into, with
+// only the 9-byte frame headers written in between.
+//
+
 void Endpoint::flush() {
   if (!m_output_buffer.empty()) {
     Data data;
-    data.pack(m_output_buffer, &s_dp, 1);
+    data.pack(m_output_buffer, &s_dp, 1, MIN_ZERO_COPY_SIZE);
 #if DEBUG_HTTP2
     debug_dump_o(data);
 #endif
@@ -1648,7 +2070,7 @@ void Endpoint::end(StreamEnd *eos) {
   if (eos) {
     for_each_stream(
       [=](StreamBase *s) {
-        s->decoder_output(eos->clone());
+        s->decoder_output(eos->share());
         return true;
       }
     );
@@ -1806,6 +2228,10 @@ void Endpoint::StreamBase::encoder_input(Event *evt) {
       Data buf;
       m_header_encoder.encode(m_is_server_side, false, start->head(), buf);
       write_header_block(buf);
+      if (m_is_server_side) {
+        pjs::Ref<http::ResponseHead> head = pjs::coerce<http::ResponseHead>(start->head());
+        update_priority(head);
+      }
       if (m_state == IDLE) {
         m_state = OPEN;
       } else if (m_state == RESERVED_LOCAL) {
@@ -1842,7 +2268,6 @@ void Endpoint::StreamBase::encoder_input(Event *evt) {
     if (m_is_message_started && !data->empty()) {
       if (m_state == OPEN || m_state == HALF_CLOSED_REMOTE) {
         m_send_buffer.push(*data);
-        pump();
         set_pending(true);
         flush();
       }
@@ -1858,7 +2283,7 @@ void Endpoint::StreamBase::encoder_input(Event *evt) {
             if (m_is_tunnel_requested) return;
           }
           if (auto tail = end->tail()) {
-            m_header_encoder.encode(m_is_server_side, true, tail, m_tail_buffer);
+            m_header_encoder.encode(m_is_server_side, true, tail, m_tail_buffer, false);
           }
         }
         if (m_state == OPEN) {
@@ -1868,7 +2293,11 @@ void Endpoint::StreamBase::encoder_input(Event *evt) {
         }
         m_is_message_ended = true;
         m_end_stream_send = true;
-        pump();
+        if (m_send_buffer.empty()) {
+          pump(0);
+        } else {
+          flush();
+        }
       }
     } else if (evt->is<StreamEnd>()) { // EOS without message start
       if (m_is_server_side) {
@@ -1883,7 +2312,7 @@ void Endpoint::StreamBase::encoder_input(Event *evt) {
         Data buf;
         m_header_encoder.encode(true, false, head, buf);
         write_header_block(buf);
-        pump();
+        m_end_stream_send = false;
       }
     }
   }
@@ -2027,6 +2456,46 @@ bool Endpoint::StreamBase::parse_priority(Frame &frm) {
   return true;
 }
 
+//
+// Parses an RFC 9218 priority field value such as "u=1, i". A field
+// that is present but leaves out a parameter means the default for it.
+//
+
+void Endpoint::StreamBase::update_priority(const std::string &field) {
+  int urgency = 3;
+  bool incremental = false;
+  size_t i = 0, n = field.length();
+  while (i < n) {
+    while (i < n && (field[i] == ' ' || field[i] == '\t' || field[i] == ',')) i++;
+    auto k = i;
+    while (i < n && field[i] != '=' && field[i] != ',' && field[i] != ';' && field[i] != ' ') i++;
+    auto key = field.substr(k, i - k);
+    std::string val;
+    if (i < n && field[i] == '=') {
+      auto v = ++i;
+      while (i < n && field[i] != ',' && field[i] != ';' && field[i] != ' ') i++;
+      val = field.substr(v, i - v);
+    }
+    while (i < n && field[i] != ',') i++;
+    if (key == "u") {
+      if (val.length() == 1 && '0' <= val[0] && val[0] <= '7') urgency = val[0] - '0';
+    } else if (key == "i") {
+      if (val.empty() || val == "?1") incremental = true;
+    }
+  }
+  m_urgency = urgency;
+  m_incremental = incremental;
+}
+
+void Endpoint::StreamBase::update_priority(http::MessageHead *head) {
+  if (!head) return;
+  if (auto headers = head->headers()) {
+    pjs::Value v;
+    headers->get(s_priority, v);
+    if (v.is_string()) update_priority(v.s()->str());
+  }
+}
+
 void Endpoint::StreamBase::parse_headers(Frame &frm) {
   auto err = m_header_decoder.decode(frm.payload);
   if (err != NO_ERROR) {
@@ -2052,10 +2521,11 @@ void Endpoint::StreamBase::parse_headers(Frame &frm) {
 
     if (m_header_decoder.is_trailer()) {
       tail = http::MessageTail::make();
-      tail->headers = head->headers;
+      tail->headers = head->headers();
 
     } else {
       m_end_headers = true;
+      if (m_is_server_side) update_priority(head);
       decoder_output(MessageStart::make(head));
     }
 
@@ -2105,6 +2575,7 @@ bool Endpoint::StreamBase::deduct_recv(int size) {
   }
   connection_recv_window -= size;
   m_recv_window -= size;
+  m_endpoint->sample_bdp(size);
   if (m_recv_window <= m_recv_window_low) set_clearing(true);
   if (m_is_clearing || connection_recv_window <= m_endpoint->m_recv_window_low) flush();
   return true;
@@ -2132,16 +2603,11 @@ bool Endpoint::StreamBase::update_send_window(int delta) {
     }
   }
   m_send_window += delta;
-  pump();
+  if (!m_send_buffer.empty()) flush();
   recycle();
   return true;
 }
 
-void Endpoint::StreamBase::update_connection_send_window() {
-  pump();
-  recycle();
-}
-
 void Endpoint::StreamBase::write_header_block(Data &data) {
   Frame frm;
   frm.stream_id = m_id;
@@ -2209,10 +2675,11 @@ void Endpoint::StreamBase::set_clearing(bool clearing) {
   }
 }
 
-void Endpoint::StreamBase::pump() {
+auto Endpoint::StreamBase::pump(int limit) -> int {
   bool is_empty_end = (m_end_stream_send && m_send_buffer.empty() && m_tail_buffer.empty());
   int size = m_send_buffer.size();
   if (size > m_send_window) size = m_send_window;
+  if (size > limit) size = limit;
   if (size > 0) size = deduct_send(size);
   if (size > 0 || is_empty_end) {
     auto remain = size;
@@ -2234,11 +2701,15 @@ void Endpoint::StreamBase::pump() {
     m_send_window -= size;
   }
   if (m_send_buffer.empty()) {
-    if (!m_tail_buffer.empty()) write_header_block(m_tail_buffer);
+    if (!m_tail_buffer.empty()) {
+      write_header_block(m_tail_buffer);
+      m_end_stream_send = false;
+    }
     set_pending(false);
   } else {
     set_pending(true);
   }
+  return size;
 }
 
 void Endpoint::StreamBase::recycle() {
@@ -2271,7 +2742,7 @@ void Server::init() {
     if (auto msg = m_initial_stream->initial_request()) {
       auto *s = stream_open(1);
       pjs::Ref<http::RequestHead> head = pjs::coerce<http::RequestHead>(msg->head());
-      if (auto headers = head->headers.get()) {
+      if (auto headers = head->headers()) {
         pjs::Value settings;
         headers->get(s_http2_settings, settings);
         if (settings.is_string()) {
@@ -2379,7 +2850,7 @@ void Client::Stream::decoder_output(Event *evt) {
         auto status_code = 0;
         auto status_text = http::ResponseHead::error_to_status(eos->error_code(), status_code);
         auto head = http::ResponseHead::make();
-        head->headers = pjs::Object::make();
+        head->headers(pjs::Object::make());
         head->status = status_code;
         head->statusText = status_text;
         EventFunction::output(MessageStart::make(head));
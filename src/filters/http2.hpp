@@ -37,7 +37,10 @@
 #include "demux.hpp"
 #include "options.hpp"
 
+#include <deque>
 #include <map>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <iostream>
 
@@ -102,6 +105,7 @@ struct Frame {
     GOAWAY        = 0x7,
     WINDOW_UPDATE = 0x8,
     CONTINUATION  = 0x9,
+    PRIORITY_UPDATE = 0x10,
   };
 
   enum Flags {
@@ -239,14 +243,6 @@ private:
     VALUE_STRING,
   };
 
-  struct Huffman {
-    uint16_t left = 0;
-    union {
-      uint16_t right = 0;
-      uint16_t code;
-    };
-  };
-
   const Settings& m_settings;
   State m_state;
   ErrorCode m_error;
@@ -291,20 +287,40 @@ private:
   };
 
   //
-  // HeaderDecoder::HuffmanTree
+  // HeaderDecoder::HuffmanTable
+  //
+  // Decodes 4 bits at a time with a state machine whose states are the
+  // internal nodes of the code tree. No code is shorter than 5 bits, so
+  // one step yields at most one symbol.
   //
 
-  class HuffmanTree {
+  class HuffmanTable {
   public:
-    HuffmanTree();
-    auto get() const -> const std::vector<Huffman>& { return m_tree; }
+    enum {
+      SYMBOL = 1<<0,
+      ACCEPT = 1<<1, // can end here with only EOS padding left behind
+      FAIL   = 1<<2,
+    };
+
+    struct Transition {
+      uint16_t state;
+      uint8_t flags;
+      uint8_t symbol;
+    };
+
+    HuffmanTable();
+
+    auto get(int state, int nibble) const -> const Transition& {
+      return m_table[state * 16 + nibble];
+    }
+
   private:
-    std::vector<Huffman> m_tree;
+    std::vector<Transition> m_table;
   };
 
   thread_local
   static const StaticTable s_static_table;
-  static const HuffmanTree s_huffman_tree;
+  static const HuffmanTable s_huffman_table;
 };
 
 //
@@ -313,18 +329,29 @@ private:
 
 class HeaderEncoder {
 public:
+  void reset();
+  void set_table_size(size_t size);
+
+  //
+  // Blocks that go out in a different order than they are encoded, such
+  // as trailers queued behind flow-controlled data, must pass false for
+  // use_dynamic_table so that they neither add to nor refer to the table.
+  //
+
   void encode(
     bool is_response,
     bool is_tail,
     pjs::Object *head,
-    Data &data
+    Data &data,
+    bool use_dynamic_table = true
   );
 
 private:
   void encode_header_field(
     Data::Builder &db,
     pjs::Str *k,
-    pjs::Str *v
+    pjs::Str *v,
+    bool use_dynamic_table
   );
 
   void encode_int(Data::Builder &db, uint8_t prefix, int prefix_len, uint32_t n);
@@ -335,6 +362,39 @@ private:
     std::map<pjs::Ref<pjs::Str>, int> values;
   };
 
+  //
+  // HeaderEncoder::DynamicEntry
+  //
+
+  struct DynamicEntry {
+    pjs::Ref<pjs::Str> name;
+    pjs::Ref<pjs::Str> value;
+    size_t size;
+    uint64_t id;
+    uint64_t offset; // bytes ever added to the table up to this entry
+  };
+
+  struct FieldHash {
+    size_t operator()(const std::pair<pjs::Str*, pjs::Str*> &f) const {
+      return std::hash<pjs::Str*>()(f.first) * 31 + std::hash<pjs::Str*>()(f.second);
+    }
+  };
+
+  std::deque<DynamicEntry> m_dynamic_table;
+  std::unordered_map<std::pair<pjs::Str*, pjs::Str*>, uint64_t, FieldHash> m_dynamic_fields;
+  std::unordered_map<pjs::Str*, uint64_t> m_dynamic_names;
+  size_t m_dynamic_size = 0;
+  size_t m_capacity = Settings::DEFAULT_HEADER_TABLE_SIZE;
+  size_t m_capacity_min = Settings::DEFAULT_HEADER_TABLE_SIZE;
+  bool m_capacity_changed = false;
+  uint64_t m_next_id = 0;
+  uint64_t m_added_size = 0;
+
+  auto find_dynamic(uint64_t id) const -> const DynamicEntry*;
+  auto dynamic_index(uint64_t id) const -> int;
+  void add_dynamic(pjs::Str *name, pjs::Str *value);
+  void evict_dynamic(size_t capacity);
+
   //
   // HeaderEncoder::StaticTable
   //
@@ -343,8 +403,10 @@ private:
   public:
     StaticTable();
     auto find(pjs::Str *name) -> const Entry*;
+    auto size() const -> int { return m_size; }
   private:
     std::map<pjs::Ref<pjs::Str>, Entry> m_table;
+    int m_size = 0;
   };
 
   thread_local static StaticTable m_static_table;
@@ -363,6 +425,9 @@ public:
   struct Options : public pipy::Options {
     size_t connection_window_size = 0x100000;
     size_t stream_window_size = 0x100000;
+    size_t max_window_size = 0x1000000;
+    bool window_auto_tuning = false;
+    bool write_batching = true;
     Options() {}
     Options(pjs::Object *options);
   };
@@ -393,6 +458,8 @@ private:
   enum {
     INITIAL_SEND_WINDOW_SIZE = 0xffff,
     INITIAL_RECV_WINDOW_SIZE = 0xffff,
+    MIN_DATA_FRAME_SIZE = 1024,
+    MIN_ZERO_COPY_SIZE = 1024,
   };
 
   uint32_t m_id;
@@ -410,6 +477,10 @@ private:
   int m_recv_window = INITIAL_RECV_WINDOW_SIZE;
   int m_recv_window_max;
   int m_recv_window_low;
+  int m_bdp_bytes = 0;
+  double m_bdp_ping_time = 0;
+  double m_bdp_bandwidth = 0;
+  bool m_bdp_ping_pending = false;
   bool m_is_server_side;
   bool m_has_sent_preface = false;
   bool m_has_shutdown = false;
@@ -430,6 +501,10 @@ private:
   bool for_each_stream(const std::function<bool(StreamBase*)> &cb);
   bool for_each_pending_stream(const std::function<bool(StreamBase*)> &cb);
   void send_window_updates();
+  void send_data();
+  void sample_bdp(int size);
+  void update_bdp();
+  void grow_windows(int size);
   void frame(Frame &frm);
   void flush();
   void end(StreamEnd *eos);
@@ -481,12 +556,13 @@ protected:
     void on_frame(Frame &frm);
     bool parse_padding(Frame &frm);
     bool parse_priority(Frame &frm);
+    void update_priority(const std::string &field);
+    void update_priority(http::MessageHead *head);
     void parse_headers(Frame &frm);
     bool check_content_length();
     bool deduct_recv(int size);
     auto deduct_send(int size) -> int;
     bool update_send_window(int delta);
-    void update_connection_send_window();
     void write_header_block(Data &data);
     void stream_end(http::MessageTail *tail);
 
@@ -498,7 +574,7 @@ protected:
   
     void set_pending(bool pending);
     void set_clearing(bool clearing);
-    void pump();
+    auto pump(int limit) -> int;
     void recycle();
 
     Endpoint* m_endpoint;
@@ -516,6 +592,8 @@ protected:
     bool m_end_input = false;
     bool m_end_output = false;
     State m_state = IDLE;
+    int m_urgency = 3;
+    bool m_incremental = true;
     HeaderDecoder& m_header_decoder;
     HeaderEncoder& m_header_encoder;
     Data m_send_buffer;
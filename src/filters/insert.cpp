@@ -74,7 +74,7 @@ void Insert::process(Event *evt) {
     }
     if (events.is_promise()) {
       auto cb = PromiseCallback::make(this);
-      events.as<pjs::Promise>()->then(nullptr, cb->resolved(), cb->rejected());
+      events.as<pjs::Promise>()->then(cb);
       m_promise_callback = cb;
     } else if (!Message::output(events, Filter::output())) {
       Filter::error("inserting object is not an event or Message or an array of those");
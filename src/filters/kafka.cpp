@@ -0,0 +1,942 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "kafka.hpp"
+#include "pipeline.hpp"
+#include "input.hpp"
+
+#include <algorithm>
+
+namespace pipy {
+namespace kafka {
+
+static Data::Producer s_dp("Kafka");
+
+//
+// CRC-32C as used by record batches
+//
+
+static uint32_t s_crc32c_table[256];
+
+static bool init_crc32c_table() {
+  for (uint32_t i = 0; i < 256; i++) {
+    auto c = i;
+    for (int j = 0; j < 8; j++) c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : (c >> 1);
+    s_crc32c_table[i] = c;
+  }
+  return true;
+}
+
+static bool s_crc32c_table_ready = init_crc32c_table();
+
+static auto crc32c(const Data &data) -> uint32_t {
+  uint32_t crc = 0xffffffff;
+  data.to_chunks(
+    [&](const uint8_t *p, int n) {
+      for (int i = 0; i < n; i++) {
+        crc = s_crc32c_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+      }
+    }
+  );
+  return crc ^ 0xffffffff;
+}
+
+//
+// Reader
+//
+
+class Reader {
+public:
+  Reader(const Data &data) : m_reader(data) {}
+
+  bool ok() const { return m_ok; }
+  bool eof() const { return m_reader.eof(); }
+  auto position() const -> int { return m_reader.position(); }
+
+  auto i8() -> int {
+    auto c = m_reader.get();
+    if (c < 0) { m_ok = false; return 0; }
+    return (int8_t)c;
+  }
+
+  auto i16() -> int {
+    uint8_t b[2];
+    read(b, sizeof(b));
+    return (int16_t)(((uint16_t)b[0] << 8) | b[1]);
+  }
+
+  auto i32() -> int {
+    uint8_t b[4];
+    read(b, sizeof(b));
+    return (int32_t)(
+      ((uint32_t)b[0] << 24) |
+      ((uint32_t)b[1] << 16) |
+      ((uint32_t)b[2] <<  8) |
+      ((uint32_t)b[3] <<  0)
+    );
+  }
+
+  auto i64() -> int64_t {
+    uint64_t h = (uint32_t)i32();
+    uint64_t l = (uint32_t)i32();
+    return (int64_t)((h << 32) | l);
+  }
+
+  auto varint() -> int64_t {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      auto c = m_reader.get();
+      if (c < 0) break;
+      v |= (uint64_t)(c & 0x7f) << shift;
+      if (!(c & 0x80)) return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+    m_ok = false;
+    return 0;
+  }
+
+  bool string(std::string &s, bool &null) {
+    auto n = i16();
+    null = (n < 0);
+    s.clear();
+    if (n > 0) {
+      Data buf;
+      bytes(n, buf);
+      s = buf.to_string();
+    }
+    return m_ok;
+  }
+
+  void bytes(int n, Data &out) {
+    if (n < 0 || m_reader.read(n, out) < n) m_ok = false;
+  }
+
+  void skip(int n) {
+    if (n < 0 || m_reader.skip(n) < n) m_ok = false;
+  }
+
+private:
+  Data::Reader m_reader;
+  bool m_ok = true;
+
+  void read(uint8_t *buf, int n) {
+    if (m_reader.read(n, buf) < n) {
+      std::memset(buf, 0, n);
+      m_ok = false;
+    }
+  }
+};
+
+//
+// Writer functions
+//
+
+static void put_i16(Data::Builder &db, int v) {
+  db.push(uint8_t(v >> 8));
+  db.push(uint8_t(v >> 0));
+}
+
+static void put_i32(Data::Builder &db, int v) {
+  db.push(uint8_t(v >> 24));
+  db.push(uint8_t(v >> 16));
+  db.push(uint8_t(v >> 8));
+  db.push(uint8_t(v >> 0));
+}
+
+static void put_i64(Data::Builder &db, int64_t v) {
+  put_i32(db, int(v >> 32));
+  put_i32(db, int(v));
+}
+
+static void put_varint(Data::Builder &db, int64_t v) {
+  auto z = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+  while (z >= 0x80) {
+    db.push(uint8_t(z | 0x80));
+    z >>= 7;
+  }
+  db.push(uint8_t(z));
+}
+
+static auto varint_size(int64_t v) -> int {
+  auto z = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+  int n = 1;
+  while (z >= 0x80) { z >>= 7; n++; }
+  return n;
+}
+
+static void put_string(Data::Builder &db, const std::string &s, bool null = false) {
+  if (null) {
+    put_i16(db, -1);
+  } else {
+    put_i16(db, s.length());
+    db.push(s);
+  }
+}
+
+//
+// Decoder
+//
+
+Decoder::Options::Options(pjs::Object *options) {
+  Value(options, "isResponse")
+    .get(is_response)
+    .check_nullable();
+}
+
+Decoder::Decoder(const Options &options)
+  : m_options(options)
+{
+}
+
+Decoder::Decoder(const Decoder &r)
+  : Filter(r)
+  , m_options(r.m_options)
+{
+}
+
+Decoder::~Decoder()
+{
+}
+
+void Decoder::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "decodeKafka";
+}
+
+auto Decoder::clone() -> Filter* {
+  return new Decoder(*this);
+}
+
+void Decoder::reset() {
+  Filter::reset();
+  Deframer::reset();
+  m_head = nullptr;
+  m_client_id = nullptr;
+}
+
+void Decoder::process(Event *evt) {
+  if (auto *data = evt->as<Data>()) {
+    Deframer::deframe(*data);
+  } else if (evt->is<StreamEnd>()) {
+    Filter::output(evt);
+  }
+}
+
+auto Decoder::on_state(int state, int c) -> int {
+  switch (state) {
+    case START: {
+      m_size[0] = c;
+      Deframer::read(sizeof(m_size) - 1, m_size + 1);
+      return SIZE;
+    }
+    case SIZE: {
+      auto size = (
+        ((uint32_t)m_size[0] << 24) |
+        ((uint32_t)m_size[1] << 16) |
+        ((uint32_t)m_size[2] <<  8) |
+        ((uint32_t)m_size[3] <<  0)
+      );
+      auto header_size = m_options.is_response ? 4 : 10;
+      if (size < header_size || size > 0x7fffffff) {
+        Filter::output(StreamEnd::make(StreamEnd::PROTOCOL_ERROR));
+        return ERROR;
+      }
+      m_remaining = size - header_size;
+      Deframer::read(header_size, m_header);
+      return HEADER;
+    }
+    case HEADER: {
+      auto *h = m_header;
+      m_head = MessageHead::make();
+      if (m_options.is_response) {
+        m_head->correlationId = (int32_t)(
+          ((uint32_t)h[0] << 24) |
+          ((uint32_t)h[1] << 16) |
+          ((uint32_t)h[2] <<  8) |
+          ((uint32_t)h[3] <<  0)
+        );
+        return start_body();
+      }
+      m_head->isRequest = true;
+      m_head->apiKey = (int16_t)(((uint16_t)h[0] << 8) | h[1]);
+      m_head->apiVersion = (int16_t)(((uint16_t)h[2] << 8) | h[3]);
+      m_head->correlationId = (int32_t)(
+        ((uint32_t)h[4] << 24) |
+        ((uint32_t)h[5] << 16) |
+        ((uint32_t)h[6] <<  8) |
+        ((uint32_t)h[7] <<  0)
+      );
+      auto n = (int16_t)(((uint16_t)h[8] << 8) | h[9]);
+      if (n > 0) {
+        if (n > m_remaining) {
+          Filter::output(StreamEnd::make(StreamEnd::PROTOCOL_ERROR));
+          return ERROR;
+        }
+        m_remaining -= n;
+        m_client_id = Data::make();
+        Deframer::read(n, m_client_id);
+        return CLIENT_ID;
+      }
+      if (n == 0) m_head->clientId = pjs::Str::empty;
+      return start_body();
+    }
+    case CLIENT_ID: {
+      m_head->clientId = pjs::Str::make(m_client_id->to_string());
+      m_client_id = nullptr;
+      return start_body();
+    }
+    case BODY: {
+      Filter::output(MessageEnd::make());
+      return START;
+    }
+    default: return ERROR;
+  }
+}
+
+void Decoder::on_pass(Data &data) {
+  Filter::output(Data::make(std::move(data)));
+}
+
+auto Decoder::start_body() -> int {
+  Filter::output(MessageStart::make(m_head));
+  m_head = nullptr;
+  if (m_remaining > 0) {
+    Deframer::pass(m_remaining);
+    return BODY;
+  }
+  Filter::output(MessageEnd::make());
+  return START;
+}
+
+//
+// Encoder
+//
+
+Encoder::Encoder()
+{
+}
+
+Encoder::Encoder(const Encoder &r)
+  : Filter(r)
+{
+}
+
+Encoder::~Encoder()
+{
+}
+
+void Encoder::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "encodeKafka";
+}
+
+auto Encoder::clone() -> Filter* {
+  return new Encoder(*this);
+}
+
+void Encoder::reset() {
+  Filter::reset();
+  m_head = nullptr;
+  m_buffer.clear();
+}
+
+void Encoder::process(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    if (!m_head) {
+      m_head = start->head();
+      if (!m_head) m_head = MessageHead::make();
+      m_buffer.clear();
+    }
+
+  } else if (auto data = evt->as<Data>()) {
+    if (m_head) {
+      m_buffer.push(*data);
+    }
+
+  } else if (evt->is<MessageEnd>() || evt->is<StreamEnd>()) {
+    if (m_head) {
+      auto *mh = pjs::coerce<MessageHead>(m_head);
+      auto *out = Data::make();
+      Data::Builder db(*out, &s_dp);
+      if (mh->isRequest) {
+        auto id = mh->clientId.get();
+        auto len = 10 + (id ? id->size() : 0) + m_buffer.size();
+        put_i32(db, len);
+        put_i16(db, mh->apiKey);
+        put_i16(db, mh->apiVersion);
+        put_i32(db, mh->correlationId);
+        if (id) {
+          put_string(db, id->str());
+        } else {
+          put_i16(db, -1);
+        }
+      } else {
+        put_i32(db, 4 + m_buffer.size());
+        put_i32(db, mh->correlationId);
+      }
+      db.push(std::move(m_buffer));
+      db.flush();
+
+      Filter::output(MessageStart::make(mh));
+      Filter::output(out);
+      Filter::output(evt);
+
+      m_head = nullptr;
+
+    } else if (evt->is<StreamEnd>()) {
+      Filter::output(evt);
+    }
+  }
+}
+
+//
+// Produce request parsing
+//
+
+struct RecordBatch {
+  int64_t base_timestamp;
+  int64_t max_timestamp;
+  int last_offset_delta;
+  int records;
+  Data data;
+};
+
+struct ProducePartition {
+  int index;
+  RecordBatch batch;
+};
+
+struct ProduceTopic {
+  std::string name;
+  std::vector<ProducePartition> partitions;
+};
+
+struct ProduceRequest {
+  bool transactional = false;
+  int acks = 0;
+  int timeout = 0;
+  std::vector<ProduceTopic> topics;
+};
+
+enum {
+  RECORD_BATCH_PREFIX_SIZE = 21, // up to and including the CRC
+  RECORD_BATCH_HEADER_SIZE = 61,
+};
+
+//
+// A batch is taken only if it can be merged with others into a single
+// batch without decompressing, i.e. uncompressed with CreateTime and no
+// producer ID. Its CRC is checked since the merged batch gets a new one.
+//
+
+static bool parse_record_batch(const Data &data, RecordBatch &batch) {
+  if (data.size() < RECORD_BATCH_HEADER_SIZE) return false;
+  Reader r(data);
+  r.i64();
+  auto length = r.i32();
+  r.i32();
+  auto magic = r.i8();
+  auto crc = (uint32_t)r.i32();
+  if (!r.ok() || magic != 2 || length != data.size() - 12) return false;
+  Data tail;
+  r.bytes(data.size() - RECORD_BATCH_PREFIX_SIZE, tail);
+  if (!r.ok() || crc32c(tail) != crc) return false;
+  Reader t(tail);
+  auto attributes = t.i16();
+  batch.last_offset_delta = t.i32();
+  batch.base_timestamp = t.i64();
+  batch.max_timestamp = t.i64();
+  auto producer_id = t.i64();
+  t.i16();
+  t.i32();
+  batch.records = t.i32();
+  if (!t.ok() || attributes != 0 || producer_id != -1 || batch.records <= 0) return false;
+  if (batch.last_offset_delta < batch.records - 1) return false;
+  tail.shift(RECORD_BATCH_HEADER_SIZE - RECORD_BATCH_PREFIX_SIZE);
+  batch.data = std::move(tail);
+  return true;
+}
+
+static bool parse_produce_request(const Data &body, ProduceRequest &req, bool &mergeable) {
+  Reader r(body);
+  std::string s;
+  bool null;
+  r.string(s, null);
+  req.transactional = !null;
+  req.acks = r.i16();
+  req.timeout = r.i32();
+  mergeable = false;
+  if (!r.ok()) return false;
+  if (req.transactional) return true;
+  auto n = r.i32();
+  for (int i = 0; i < n && r.ok(); i++) {
+    req.topics.emplace_back();
+    auto &topic = req.topics.back();
+    r.string(topic.name, null);
+    auto m = r.i32();
+    for (int j = 0; j < m && r.ok(); j++) {
+      topic.partitions.emplace_back();
+      auto &p = topic.partitions.back();
+      p.index = r.i32();
+      auto size = r.i32();
+      Data records;
+      r.bytes(size, records);
+      if (!r.ok() || !parse_record_batch(records, p.batch)) return true;
+    }
+  }
+  mergeable = r.ok() && r.eof() && n > 0;
+  return true;
+}
+
+//
+// Rewrites the offset and timestamp deltas of each record so that the
+// records can follow others in a merged batch.
+//
+
+static bool rebase_records(const Data &data, int count, int64_t timestamp_shift, int offset_shift, Data &out) {
+  Reader r(data);
+  Data::Builder db(out, &s_dp);
+  for (int i = 0; i < count; i++) {
+    auto length = r.varint();
+    if (!r.ok() || length < 3 || length > data.size()) return false;
+    Data record;
+    r.bytes(length, record);
+    Reader rr(record);
+    auto attributes = rr.i8();
+    auto timestamp_delta = rr.varint() + timestamp_shift;
+    auto offset_delta = rr.varint() + offset_shift;
+    if (!rr.ok()) return false;
+    record.shift(rr.position());
+    auto new_length = 1 + varint_size(timestamp_delta) + varint_size(offset_delta) + record.size();
+    put_varint(db, new_length);
+    db.push(uint8_t(attributes));
+    put_varint(db, timestamp_delta);
+    put_varint(db, offset_delta);
+    db.push(record);
+  }
+  db.flush();
+  return r.eof();
+}
+
+//
+// Produce response parsing
+//
+
+struct ProduceResponsePartition {
+  int error_code = -1;
+  int64_t base_offset = -1;
+  int64_t log_append_time = -1;
+  int64_t log_start_offset = -1;
+  std::vector<std::pair<int, std::pair<bool, std::string>>> record_errors;
+  std::pair<bool, std::string> error_message = { true, std::string() };
+};
+
+struct ProduceResponse {
+  std::map<std::string, std::map<int, ProduceResponsePartition>> topics;
+  int throttle_time = 0;
+};
+
+static bool parse_produce_response(const Data &body, int version, ProduceResponse &res) {
+  Reader r(body);
+  auto n = r.i32();
+  for (int i = 0; i < n && r.ok(); i++) {
+    std::string name;
+    bool null;
+    r.string(name, null);
+    auto &topic = res.topics[name];
+    auto m = r.i32();
+    for (int j = 0; j < m && r.ok(); j++) {
+      auto &p = topic[r.i32()];
+      p.error_code = r.i16();
+      p.base_offset = r.i64();
+      p.log_append_time = r.i64();
+      if (version >= 5) p.log_start_offset = r.i64();
+      if (version >= 8) {
+        auto k = r.i32();
+        for (int e = 0; e < k && r.ok(); e++) {
+          auto index = r.i32();
+          std::pair<bool, std::string> msg;
+          r.string(msg.second, msg.first);
+          p.record_errors.push_back({ index, msg });
+        }
+        r.string(p.error_message.second, p.error_message.first);
+      }
+    }
+  }
+  res.throttle_time = r.i32();
+  return r.ok();
+}
+
+//
+// ProduceAggregator
+//
+
+ProduceAggregator::Options::Options(pjs::Object *options) {
+  Value(options, "maxDelay")
+    .get_seconds(max_delay)
+    .check_nullable();
+  Value(options, "maxSize")
+    .get_binary_size(max_size)
+    .check_nullable();
+  Value(options, "maxRequests")
+    .get(max_requests)
+    .check_nullable();
+}
+
+ProduceAggregator::ProduceAggregator(const Options &options)
+  : m_options(options)
+{
+}
+
+ProduceAggregator::ProduceAggregator(const ProduceAggregator &r)
+  : Filter(r)
+  , m_options(r.m_options)
+{
+}
+
+ProduceAggregator::~ProduceAggregator()
+{
+}
+
+void ProduceAggregator::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "aggregateKafkaProduce";
+}
+
+auto ProduceAggregator::clone() -> Filter* {
+  return new ProduceAggregator(*this);
+}
+
+void ProduceAggregator::reset() {
+  Filter::reset();
+  EventSource::close();
+  m_pipeline = nullptr;
+  m_request_head = nullptr;
+  m_response_head = nullptr;
+  m_request_body.clear();
+  m_response_body.clear();
+  m_batch.reset();
+  m_queue.clear();
+  m_timer.cancel();
+  m_correlation_id = 0;
+  m_started = false;
+}
+
+void ProduceAggregator::process(Event *evt) {
+  if (!m_pipeline) {
+    m_pipeline = sub_pipeline(0, false, EventSource::reply())->start();
+  }
+
+  if (auto start = evt->as<MessageStart>()) {
+    if (!m_started) {
+      m_started = true;
+      m_request_head = pjs::coerce<MessageHead>(start->head());
+      m_request_body.clear();
+    }
+
+  } else if (auto data = evt->as<Data>()) {
+    if (m_started) m_request_body.push(*data);
+
+  } else if (evt->is<MessageEnd>()) {
+    if (m_started) {
+      m_started = false;
+      request(m_request_head, m_request_body);
+      m_request_head = nullptr;
+      m_request_body.clear();
+    }
+
+  } else if (evt->is<StreamEnd>()) {
+    flush();
+    Filter::output(evt, m_pipeline->input());
+  }
+}
+
+void ProduceAggregator::on_reply(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    m_response_head = pjs::coerce<MessageHead>(start->head());
+    m_response_body.clear();
+
+  } else if (auto data = evt->as<Data>()) {
+    if (m_response_head) m_response_body.push(*data);
+
+  } else if (evt->is<MessageEnd>()) {
+    if (m_response_head) {
+      pjs::Ref<MessageHead> head(m_response_head);
+      m_response_head = nullptr;
+      response(head, m_response_body);
+      m_response_body.clear();
+    }
+
+  } else if (evt->is<StreamEnd>()) {
+    m_queue.clear();
+    Filter::output(evt);
+  }
+}
+
+void ProduceAggregator::request(MessageHead *head, Data &body) {
+  if (head->apiKey == 0 && 3 <= head->apiVersion && head->apiVersion <= 8) {
+    if (merge(head, body)) return;
+    flush();
+    ProduceRequest req;
+    bool mergeable;
+    if (parse_produce_request(body, req, mergeable) && req.acks == 0) {
+      forward(head, body);
+      return;
+    }
+  } else {
+    flush();
+  }
+  m_queue.emplace_back();
+  forward(head, body);
+}
+
+void ProduceAggregator::response(MessageHead *head, Data &body) {
+  std::unique_ptr<Batch> batch;
+  if (!m_queue.empty()) {
+    batch = std::move(m_queue.front());
+    m_queue.pop_front();
+  }
+  if (batch) {
+    split(batch.get(), head, body);
+  } else {
+    Filter::output(MessageStart::make(head));
+    Filter::output(Data::make(std::move(body)));
+    Filter::output(MessageEnd::make());
+  }
+}
+
+void ProduceAggregator::forward(MessageHead *head, Data &body) {
+  Filter::output(MessageStart::make(head), m_pipeline->input());
+  Filter::output(Data::make(std::move(body)), m_pipeline->input());
+  Filter::output(MessageEnd::make(), m_pipeline->input());
+}
+
+bool ProduceAggregator::merge(MessageHead *head, const Data &body) {
+  ProduceRequest req;
+  bool mergeable;
+  if (!parse_produce_request(body, req, mergeable) || !mergeable) return false;
+
+  if (m_batch && (
+    m_batch->version != head->apiVersion ||
+    m_batch->acks != req.acks ||
+    m_batch->size + body.size() > m_options.max_size
+  )) flush();
+
+  if (!m_batch) {
+    m_batch.reset(new Batch);
+    m_batch->version = head->apiVersion;
+    m_batch->acks = req.acks;
+    m_timer.schedule(
+      m_options.max_delay,
+      [this]() {
+        InputContext ic;
+        flush();
+      }
+    );
+  }
+
+  auto *batch = m_batch.get();
+  batch->timeout = std::max(batch->timeout, req.timeout);
+  batch->size += body.size();
+  batch->members.emplace_back();
+
+  auto &member = batch->members.back();
+  member.head = head;
+
+  for (auto &t : req.topics) {
+    auto &topic = batch->topics[t.name];
+    member.topics.emplace_back(t.name, std::vector<Slot>());
+    auto &slots = member.topics.back().second;
+    for (auto &p : t.partitions) {
+      auto &b = p.batch;
+      auto &partition = topic[p.index];
+      Slot slot;
+      slot.partition = p.index;
+      slot.offset_base = partition.offsets;
+      slot.record_base = partition.records;
+      slot.records = b.records;
+      if (partition.records == 0) {
+        partition.base_timestamp = b.base_timestamp;
+        partition.max_timestamp = b.max_timestamp;
+        partition.data.push(b.data);
+      } else {
+        Data data;
+        if (!rebase_records(b.data, b.records, b.base_timestamp - partition.base_timestamp, partition.offsets, data)) {
+          Filter::error("malformed records in ProduceRequest");
+          return true;
+        }
+        partition.data.push(std::move(data));
+        partition.max_timestamp = std::max(partition.max_timestamp, b.max_timestamp);
+      }
+      partition.offsets += b.last_offset_delta + 1;
+      partition.records += b.records;
+      slots.push_back(slot);
+    }
+  }
+
+  if (int(batch->members.size()) >= m_options.max_requests || batch->size >= m_options.max_size) {
+    flush();
+  }
+
+  return true;
+}
+
+void ProduceAggregator::flush() {
+  if (!m_batch) return;
+  m_timer.cancel();
+
+  std::unique_ptr<Batch> batch(std::move(m_batch));
+  auto &first = batch->members.front().head;
+
+  auto head = MessageHead::make();
+  head->isRequest = true;
+  head->apiKey = 0;
+  head->apiVersion = batch->version;
+  head->correlationId = ++m_correlation_id;
+  head->clientId = first->clientId;
+
+  auto *body = Data::make();
+  Data::Builder db(*body, &s_dp);
+  put_i16(db, -1);
+  put_i16(db, batch->acks);
+  put_i32(db, batch->timeout);
+  put_i32(db, batch->topics.size());
+  for (auto &t : batch->topics) {
+    put_string(db, t.first);
+    put_i32(db, t.second.size());
+    for (auto &i : t.second) {
+      auto &p = i.second;
+      Data tail;
+      Data::Builder tb(tail, &s_dp);
+      put_i16(tb, 0);
+      put_i32(tb, p.offsets - 1);
+      put_i64(tb, p.base_timestamp);
+      put_i64(tb, p.max_timestamp);
+      put_i64(tb, -1);
+      put_i16(tb, -1);
+      put_i32(tb, -1);
+      put_i32(tb, p.records);
+      tb.push(std::move(p.data));
+      tb.flush();
+      auto crc = crc32c(tail);
+      put_i32(db, i.first);
+      put_i32(db, RECORD_BATCH_PREFIX_SIZE + tail.size());
+      put_i64(db, 0);
+      put_i32(db, RECORD_BATCH_PREFIX_SIZE - 12 + tail.size());
+      put_i32(db, -1);
+      db.push(uint8_t(2));
+      put_i32(db, crc);
+      db.push(std::move(tail));
+    }
+  }
+  db.flush();
+
+  if (batch->acks != 0) m_queue.push_back(std::move(batch));
+
+  Filter::output(MessageStart::make(head), m_pipeline->input());
+  Filter::output(body, m_pipeline->input());
+  Filter::output(MessageEnd::make(), m_pipeline->input());
+}
+
+//
+// Each request gets back the results for its own partitions, with base
+// offsets moved past the records merged in before its own and record
+// errors renumbered within its own batch.
+//
+
+void ProduceAggregator::split(Batch *batch, MessageHead *head, const Data &body) {
+  auto version = batch->version;
+  ProduceResponse res;
+  if (!parse_produce_response(body, version, res)) {
+    Filter::output(StreamEnd::make(StreamEnd::PROTOCOL_ERROR));
+    return;
+  }
+
+  for (auto &member : batch->members) {
+    auto *out = Data::make();
+    Data::Builder db(*out, &s_dp);
+    put_i32(db, member.topics.size());
+    for (auto &t : member.topics) {
+      put_string(db, t.first);
+      put_i32(db, t.second.size());
+      auto &topic = res.topics[t.first];
+      for (auto &slot : t.second) {
+        auto &p = topic[slot.partition];
+        auto base_offset = p.base_offset;
+        if (p.error_code == 0 && base_offset >= 0) base_offset += slot.offset_base;
+        put_i32(db, slot.partition);
+        put_i16(db, p.error_code);
+        put_i64(db, base_offset);
+        put_i64(db, p.log_append_time);
+        if (version >= 5) put_i64(db, p.log_start_offset);
+        if (version >= 8) {
+          int n = 0;
+          for (auto &e : p.record_errors) {
+            if (slot.record_base <= e.first && e.first < slot.record_base + slot.records) n++;
+          }
+          put_i32(db, n);
+          for (auto &e : p.record_errors) {
+            if (slot.record_base <= e.first && e.first < slot.record_base + slot.records) {
+              put_i32(db, e.first - slot.record_base);
+              put_string(db, e.second.second, e.second.first);
+            }
+          }
+          put_string(db, p.error_message.second, p.error_message.first);
+        }
+      }
+    }
+    put_i32(db, res.throttle_time);
+    db.flush();
+
+    auto mh = MessageHead::make();
+    mh->apiKey = 0;
+    mh->apiVersion = version;
+    mh->correlationId = member.head->correlationId;
+    Filter::output(MessageStart::make(mh));
+    Filter::output(out);
+    Filter::output(MessageEnd::make());
+  }
+}
+
+} // namespace kafka
+} // namespace pipy
+
+namespace pjs {
+
+using namespace pipy::kafka;
+
+//
+// MessageHead
+//
+
+template<> void ClassDef<MessageHead>::init() {
+  field<bool>("isRequest", [](MessageHead *obj) { return &obj->isRequest; });
+  field<int>("apiKey", [](MessageHead *obj) { return &obj->apiKey; });
+  field<int>("apiVersion", [](MessageHead *obj) { return &obj->apiVersion; });
+  field<int>("correlationId", [](MessageHead *obj) { return &obj->correlationId; });
+  field<Ref<Str>>("clientId", [](MessageHead *obj) { return &obj->clientId; });
+}
+
+} // namespace pjs
@@ -0,0 +1,217 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef KAFKA_HPP
+#define KAFKA_HPP
+
+#include "filter.hpp"
+#include "data.hpp"
+#include "deframer.hpp"
+#include "options.hpp"
+#include "timer.hpp"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pipy {
+namespace kafka {
+
+//
+// MessageHead
+//
+
+class MessageHead : public pjs::ObjectTemplate<MessageHead> {
+public:
+  bool isRequest = false;
+  int apiKey = 0;
+  int apiVersion = 0;
+  int correlationId = 0;
+  pjs::Ref<pjs::Str> clientId;
+};
+
+//
+// Decoder
+//
+// Splits a Kafka byte stream into messages, one per size-delimited
+// request or response. Requests have their header decoded up to the
+// client ID, responses up to the correlation ID. Header tagged fields of
+// flexible versions are left at the start of the body.
+//
+
+class Decoder : public Filter, public Deframer {
+public:
+  struct Options : public pipy::Options {
+    bool is_response = false;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  Decoder(const Options &options);
+
+private:
+  Decoder(const Decoder &r);
+  ~Decoder();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  enum State {
+    ERROR = -1,
+    START = 0,
+    SIZE,
+    HEADER,
+    CLIENT_ID,
+    BODY,
+  };
+
+  Options m_options;
+  uint8_t m_size[4];
+  uint8_t m_header[10];
+  uint32_t m_remaining = 0;
+  pjs::Ref<MessageHead> m_head;
+  pjs::Ref<Data> m_client_id;
+
+  virtual auto on_state(int state, int c) -> int override;
+  virtual void on_pass(Data &data) override;
+
+  auto start_body() -> int;
+};
+
+//
+// Encoder
+//
+
+class Encoder : public Filter {
+public:
+  Encoder();
+
+private:
+  Encoder(const Encoder &r);
+  ~Encoder();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  pjs::Ref<pjs::Object> m_head;
+  Data m_buffer;
+};
+
+//
+// ProduceAggregator
+//
+// Coalesces ProduceRequests going through it into fewer and larger ones
+// sent to the sub-pipeline, merging the records for each partition into
+// one record batch, and splits each ProduceResponse coming back into the
+// responses for the original requests, in the order they came in. Put
+// under a mux() so that requests from many clients share one instance.
+//
+// Only uncompressed, non-transactional and non-idempotent batches of
+// ProduceRequest v3 to v8 are merged. Other requests go through as they
+// are, after any merged request pending before them.
+//
+
+class ProduceAggregator : public Filter, public EventSource {
+public:
+  struct Options : public pipy::Options {
+    double max_delay = 0.005;
+    size_t max_size = 1024*1024;
+    int max_requests = 100;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  ProduceAggregator(const Options &options);
+
+private:
+  ProduceAggregator(const ProduceAggregator &r);
+  ~ProduceAggregator();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void on_reply(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  struct Partition {
+    int64_t base_timestamp = 0;
+    int64_t max_timestamp = 0;
+    int offsets = 0;
+    int records = 0;
+    Data data;
+  };
+
+  struct Slot {
+    int partition;
+    int offset_base;
+    int record_base;
+    int records;
+  };
+
+  struct Member {
+    pjs::Ref<MessageHead> head;
+    std::vector<std::pair<std::string, std::vector<Slot>>> topics;
+  };
+
+  struct Batch {
+    int version = 0;
+    int acks = 0;
+    int timeout = 0;
+    size_t size = 0;
+    std::map<std::string, std::map<int, Partition>> topics;
+    std::vector<Member> members;
+  };
+
+  Options m_options;
+  pjs::Ref<Pipeline> m_pipeline;
+  pjs::Ref<MessageHead> m_request_head;
+  pjs::Ref<MessageHead> m_response_head;
+  Data m_request_body;
+  Data m_response_body;
+  std::unique_ptr<Batch> m_batch;
+  std::deque<std::unique_ptr<Batch>> m_queue;
+  Timer m_timer;
+  int m_correlation_id = 0;
+  bool m_started = false;
+
+  void request(MessageHead *head, Data &body);
+  void response(MessageHead *head, Data &body);
+  void forward(MessageHead *head, Data &body);
+  bool merge(MessageHead *head, const Data &body);
+  void flush();
+  void split(Batch *batch, MessageHead *head, const Data &body);
+};
+
+} // namespace kafka
+} // namespace pipy
+
+#endif // KAFKA_HPP
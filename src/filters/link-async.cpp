@@ -110,11 +110,9 @@ void LinkAsync::process(Event *evt) {
     m_buffer.push(evt);
     Net::current().io_context().post(FlushHandler(this));
   } else if (auto aw = m_async_wrapper) {
-    m_buffer.flush(
-      [&](Event *evt) {
-        aw->input(evt);
-      }
-    );
+    // Buffered events are held by nobody but the buffer unless someone
+    // kept them, so they can be handed over as they are
+    while (auto e = m_buffer.shift()) aw->input_move(e);
     aw->input(evt);
   }
 }
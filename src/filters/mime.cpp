@@ -72,7 +72,7 @@ void MultipartDecoder::process(Event *evt) {
   if (auto *ms = evt->as<MessageStart>()) {
     if (!m_current_multipart) {
       pjs::Ref<http::MessageHead> head = pjs::coerce<http::MessageHead>(ms->head());
-      if (auto headers = head->headers.get()) {
+      if (auto headers = head->headers()) {
         pjs::Value v;
         headers->get(s_content_type, v);
         if (v.is_string()) {
@@ -155,33 +155,40 @@ void MultipartDecoder::Multipart::on_data(Data *data) {
   } else {
     while (!data->empty()) {
       auto state = m_state;
-      Data buf; data->shift_to(
-        [&](int c) {
-          switch (state) {
-            case START:
-              if (c == '\r') state = CRLF;
-              else if (c == '-') state = DASH;
-              else state = END;
-              break;
-            case CRLF:
-              if (c == '\n') state = HEADER;
-              else state = END;
-              return true;
-            case DASH:
-              state = END;
-              break;
-            case HEADER:
-              if (c == '\n') {
-                state = HEADER_EOL;
+      Data buf;
+
+      // Bodies take no scanning as their boundaries are found by the split
+      if (state == BODY || state == END) {
+        buf.push(std::move(*data));
+      } else {
+        data->shift_to(
+          [&](int c) {
+            switch (state) {
+              case START:
+                if (c == '\r') state = CRLF;
+                else if (c == '-') state = DASH;
+                else state = END;
+                break;
+              case CRLF:
+                if (c == '\n') state = HEADER;
+                else state = END;
                 return true;
-              }
-              break;
-            default: break;
-          }
-          return false;
-        },
-        buf
-      );
+              case DASH:
+                state = END;
+                break;
+              case HEADER:
+                if (c == '\n') {
+                  state = HEADER_EOL;
+                  return true;
+                }
+                break;
+              default: break;
+            }
+            return false;
+          },
+          buf
+        );
+      }
 
       // old state
       switch (m_state) {
@@ -219,8 +226,8 @@ void MultipartDecoder::Multipart::on_data(Data *data) {
                 pjs::Ref<pjs::Str> key(pjs::Str::make(name));
                 pjs::Ref<pjs::Str> val(pjs::Str::make(value));
                 if (!m_head) m_head = http::MessageHead::make();
-                auto headers = m_head->headers.get();
-                if (!headers) m_head->headers = (headers = pjs::Object::make());
+                auto headers = m_head->headers();
+                if (!headers) m_head->headers((headers = pjs::Object::make()));
                 pjs::Value existing;
                 headers->get(key, existing);
                 if (existing.is_undefined()) {
@@ -238,7 +245,7 @@ void MultipartDecoder::Multipart::on_data(Data *data) {
           } else {
             pjs::Value content_type;
             if (m_head) {
-              if (auto *headers = m_head->headers.get()) {
+              if (auto *headers = m_head->headers()) {
                 headers->get(s_content_type, content_type);
               }
             }
@@ -0,0 +1,136 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "mirror.hpp"
+#include "module.hpp"
+#include "log.hpp"
+
+#include <random>
+
+namespace pipy {
+
+static auto random_percent() -> double {
+  thread_local static std::mt19937_64 rng(
+    ((uint64_t)std::random_device{}() << 32) ^ std::random_device{}()
+  );
+  return (rng() >> 11) * (100.0 / 9007199254740992.0);
+}
+
+//
+// Mirror::Options
+//
+
+Mirror::Options::Options(pjs::Object *options) {
+  Value(options, "percentage")
+    .get(percentage)
+    .check_nullable();
+  Value(options, "bufferLimit")
+    .get_binary_size(buffer_limit)
+    .check_nullable();
+  if (percentage < 0 || percentage > 100) {
+    throw std::runtime_error("options.percentage must be between 0 and 100");
+  }
+}
+
+//
+// Mirror
+//
+
+Mirror::Mirror(const pjs::Value &name, const Options &options)
+  : m_name(name)
+  , m_options(options)
+{
+}
+
+Mirror::Mirror(const Mirror &r)
+  : Filter(r)
+  , m_name(r.m_name)
+  , m_options(r.m_options)
+{
+}
+
+Mirror::~Mirror()
+{
+}
+
+void Mirror::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "mirror";
+}
+
+auto Mirror::clone() -> Filter* {
+  return new Mirror(*this);
+}
+
+void Mirror::reset() {
+  Filter::reset();
+  if (m_async_wrapper) {
+    m_async_wrapper->close();
+    m_async_wrapper = nullptr;
+  }
+  m_started = false;
+}
+
+void Mirror::process(Event *evt) {
+  if (!m_started) {
+    m_started = true;
+    start();
+  }
+
+  if (auto aw = m_async_wrapper) {
+    auto data = evt->as<Data>();
+    if (data && aw->queued_size() + data->size() > m_options.buffer_limit) {
+      Log::debug(Log::PIPELINE, "[mirror] shadow stream over %d bytes behind, dropped", int(m_options.buffer_limit));
+      aw->close(true);
+      m_async_wrapper = nullptr;
+    } else {
+      aw->input(evt);
+    }
+  }
+
+  Filter::output(evt);
+}
+
+void Mirror::start() {
+  if (m_options.percentage < 100 && random_percent() >= m_options.percentage) return;
+
+  pjs::Value name;
+  if (!Filter::eval(m_name, name)) return;
+  if (name.is_nullish()) return;
+
+  if (!name.is_string()) {
+    Filter::error("pipeline name is not a string");
+    return;
+  }
+
+  m_async_wrapper = static_cast<JSModule*>(module_legacy())->alloc_pipeline_lb(name.s(), nullptr, true);
+
+  if (!m_async_wrapper) {
+    Log::warn("[mirror] unknown pipeline layout name: %s", name.s()->c_str());
+  }
+}
+
+} // namespace pipy
@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef MIRROR_HPP
+#define MIRROR_HPP
+
+#include "filter.hpp"
+#include "pipeline-lb.hpp"
+#include "options.hpp"
+
+namespace pipy {
+
+//
+// Mirror
+//
+// Passes events through untouched while sending a copy of a sampled share
+// of streams to a named pipeline on another worker thread. Whatever comes
+// out of the shadow pipeline is discarded. When a shadow falls behind by
+// more than the buffer limit, its copy of the stream is dropped at once.
+//
+
+class Mirror : public Filter {
+public:
+  struct Options : public pipy::Options {
+    double percentage = 100;
+    size_t buffer_limit = 1024*1024;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  Mirror(const pjs::Value &name, const Options &options);
+
+private:
+  Mirror(const Mirror &r);
+  ~Mirror();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  pjs::Value m_name;
+  Options m_options;
+  PipelineLoadBalancer::AsyncWrapper* m_async_wrapper = nullptr;
+  bool m_started = false;
+
+  void start();
+};
+
+} // namespace pipy
+
+#endif // MIRROR_HPP
@@ -24,6 +24,8 @@
  */
 
 #include "mqtt.hpp"
+#include "net.hpp"
+#include "input.hpp"
 
 namespace pipy {
 namespace mqtt {
@@ -1041,6 +1043,391 @@ void Encoder::process(Event *evt) {
   }
 }
 
+//
+// Subscriber
+//
+
+Subscriber::Subscriber(Fanout *fanout)
+  : m_net(&Net::current())
+  , m_fanout(fanout)
+{
+}
+
+void Subscriber::deliver(const std::string &topic, int qos, SharedData *payload) {
+  if (m_net == &Net::current()) {
+    if (m_fanout) m_fanout->deliver(topic, qos, payload);
+  } else {
+    pjs::Ref<Subscriber> s(this);
+    pjs::Ref<SharedData> p(payload);
+    m_net->post(
+      [=]() {
+        if (s->m_fanout) {
+          InputContext ic;
+          s->m_fanout->deliver(topic, qos, p);
+        }
+      }
+    );
+  }
+}
+
+//
+// TopicTrie
+//
+
+std::map<std::string, TopicTrie*> TopicTrie::s_tries;
+std::mutex TopicTrie::s_tries_mutex;
+
+auto TopicTrie::get(const std::string &name) -> TopicTrie* {
+  std::lock_guard<std::mutex> lock(s_tries_mutex);
+  auto i = s_tries.find(name);
+  if (i != s_tries.end()) return i->second;
+  auto trie = new TopicTrie;
+  trie->retain();
+  s_tries[name] = trie;
+  return trie;
+}
+
+//
+// '+' takes a whole level and '#' only the last level.
+//
+
+bool TopicTrie::is_valid_filter(const std::string &filter) {
+  if (filter.empty()) return false;
+  size_t i = 0;
+  for (;;) {
+    auto j = filter.find('/', i);
+    auto level = filter.substr(i, j == std::string::npos ? std::string::npos : j - i);
+    if (level.find_first_of("+#") != std::string::npos) {
+      if (level.length() > 1) return false;
+      if (level == "#" && j != std::string::npos) return false;
+    }
+    if (j == std::string::npos) break;
+    i = j + 1;
+  }
+  return true;
+}
+
+static void split_levels(const std::string &topic, std::vector<std::string> &levels) {
+  size_t i = 0;
+  for (;;) {
+    auto j = topic.find('/', i);
+    if (j == std::string::npos) {
+      levels.push_back(topic.substr(i));
+      break;
+    }
+    levels.push_back(topic.substr(i, j - i));
+    i = j + 1;
+  }
+}
+
+void TopicTrie::subscribe(Subscriber *subscriber, const std::string &filter, int qos) {
+  std::vector<std::string> levels;
+  split_levels(filter, levels);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto node = &m_root;
+  for (const auto &l : levels) {
+    auto &child = node->children[l];
+    if (!child) {
+      child = new Node;
+      child->parent = node;
+      child->level = l;
+    }
+    node = child;
+  }
+  node->subscribers[subscriber] = qos;
+}
+
+bool TopicTrie::unsubscribe(Subscriber *subscriber, const std::string &filter) {
+  std::vector<std::string> levels;
+  split_levels(filter, levels);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto node = &m_root;
+  for (const auto &l : levels) {
+    auto i = node->children.find(l);
+    if (i == node->children.end()) return false;
+    node = i->second;
+  }
+  if (!node->subscribers.erase(subscriber)) return false;
+  while (node != &m_root && node->subscribers.empty() && node->children.empty()) {
+    auto parent = node->parent;
+    parent->children.erase(node->level);
+    delete node;
+    node = parent;
+  }
+  return true;
+}
+
+//
+// A subscriber with overlapping filters gets one delivery at the highest
+// QoS of them. Wildcards at the first level never match topics starting
+// with '$'.
+//
+
+void TopicTrie::match(const std::string &topic, std::map<pjs::Ref<Subscriber>, int> &subscribers) {
+  std::vector<std::string> levels;
+  split_levels(topic, levels);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  match(&m_root, levels, 0, subscribers);
+}
+
+void TopicTrie::match(Node *node, const std::vector<std::string> &levels, size_t i, std::map<pjs::Ref<Subscriber>, int> &subscribers) {
+  auto add = [&](Node *n) {
+    for (const auto &p : n->subscribers) {
+      auto &qos = subscribers[p.first];
+      qos = std::max(qos, p.second);
+    }
+  };
+
+  bool wildcards = (i > 0 || levels[0].empty() || levels[0][0] != '$');
+
+  if (wildcards) {
+    auto h = node->children.find("#");
+    if (h != node->children.end()) add(h->second);
+  }
+
+  if (i == levels.size()) {
+    add(node);
+    return;
+  }
+
+  auto c = node->children.find(levels[i]);
+  if (c != node->children.end()) match(c->second, levels, i + 1, subscribers);
+
+  if (wildcards) {
+    auto p = node->children.find("+");
+    if (p != node->children.end()) match(p->second, levels, i + 1, subscribers);
+  }
+}
+
+//
+// Fanout
+//
+
+Fanout::Fanout(const pjs::Value &trie)
+  : m_trie_value(trie)
+{
+}
+
+Fanout::Fanout(const Fanout &r)
+  : Filter(r)
+  , m_trie_value(r.m_trie_value)
+{
+}
+
+Fanout::~Fanout()
+{
+  close();
+}
+
+void Fanout::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "fanoutMQTT";
+}
+
+auto Fanout::clone() -> Filter* {
+  return new Fanout(*this);
+}
+
+void Fanout::reset() {
+  Filter::reset();
+  close();
+  m_head = nullptr;
+  m_payload.clear();
+  m_incoming_qos2.clear();
+  m_protocol_level = 5;
+  m_packet_id = 0;
+  m_passing = false;
+  m_is_started = false;
+}
+
+void Fanout::process(Event *evt) {
+  if (!m_is_started) {
+    pjs::Value name;
+    if (!Filter::eval(m_trie_value, name)) return;
+    auto s = name.to_string();
+    m_trie = TopicTrie::get(s->str());
+    s->release();
+    m_subscriber = new Subscriber(this);
+    m_is_started = true;
+  }
+
+  if (auto start = evt->as<MessageStart>()) {
+    if (!m_head && !m_passing) {
+      auto head = pjs::coerce<MessageHead>(start->head());
+      switch (head->type.get()) {
+        case PacketType::PUBLISH:
+        case PacketType::PUBACK:
+        case PacketType::PUBREC:
+        case PacketType::PUBREL:
+        case PacketType::PUBCOMP:
+        case PacketType::SUBSCRIBE:
+        case PacketType::UNSUBSCRIBE:
+          m_head = head;
+          m_payload.clear();
+          break;
+        default:
+          if (head->type == PacketType::CONNECT) m_protocol_level = head->protocolLevel;
+          m_passing = true;
+          Filter::output(evt);
+          break;
+      }
+    }
+
+  } else if (auto data = evt->as<Data>()) {
+    if (m_head) {
+      m_payload.push(*data);
+    } else if (m_passing) {
+      Filter::output(evt);
+    }
+
+  } else if (auto end = evt->as<MessageEnd>()) {
+    if (m_head) {
+      pjs::Ref<MessageHead> head(m_head);
+      m_head = nullptr;
+      packet(head, end->payload());
+      m_payload.clear();
+    } else if (m_passing) {
+      m_passing = false;
+      Filter::output(evt);
+    }
+
+  } else if (evt->is<StreamEnd>()) {
+    close();
+    Filter::output(evt);
+  }
+}
+
+void Fanout::packet(MessageHead *head, const pjs::Value &payload) {
+  switch (head->type.get()) {
+    case PacketType::PUBLISH:
+      publish(head);
+      break;
+    case PacketType::PUBREC:
+      reply(PacketType::PUBREL, head->packetIdentifier);
+      break;
+    case PacketType::PUBREL:
+      m_incoming_qos2.erase(head->packetIdentifier);
+      reply(PacketType::PUBCOMP, head->packetIdentifier);
+      break;
+    case PacketType::SUBSCRIBE:
+      subscribe(head, payload);
+      break;
+    case PacketType::UNSUBSCRIBE:
+      unsubscribe(head, payload);
+      break;
+    default: break;
+  }
+}
+
+//
+// A QoS 2 message is fanned out as soon as it arrives. Its packet ID is
+// then remembered until PUBREL so that a resent copy is not fanned out
+// once more.
+//
+
+void Fanout::publish(MessageHead *head) {
+  auto qos = head->qos;
+  auto id = head->packetIdentifier;
+
+  if (qos < 2 || m_incoming_qos2.insert(id).second) {
+    if (head->topicName) {
+      std::map<pjs::Ref<Subscriber>, int> subscribers;
+      m_trie->match(head->topicName->str(), subscribers);
+      if (!subscribers.empty()) {
+        pjs::Ref<SharedData> payload(SharedData::make(m_payload));
+        for (const auto &p : subscribers) {
+          p.first->deliver(head->topicName->str(), std::min(qos, p.second), payload);
+        }
+      }
+    }
+  }
+
+  if (qos == 1) reply(PacketType::PUBACK, id);
+  else if (qos == 2) reply(PacketType::PUBREC, id);
+}
+
+void Fanout::subscribe(MessageHead *head, const pjs::Value &payload) {
+  auto codes = pjs::Array::make();
+  if (payload.is<SubscribePayload>()) {
+    if (auto filters = payload.as<SubscribePayload>()->topicFilters.get()) {
+      filters->iterate_all(
+        [&](pjs::Value &v, int) {
+          pjs::Ref<TopicFilter> f = pjs::coerce<TopicFilter>(v.is_object() ? v.o() : nullptr);
+          if (f->filter && TopicTrie::is_valid_filter(f->filter->str())) {
+            auto qos = std::min(std::max(f->qos, 0), 2);
+            m_trie->subscribe(m_subscriber, f->filter->str(), qos);
+            m_filters.insert(f->filter->str());
+            codes->push(qos);
+          } else {
+            codes->push(0x80);
+          }
+        }
+      );
+    }
+  }
+  reply(PacketType::SUBACK, head->packetIdentifier, codes);
+}
+
+void Fanout::unsubscribe(MessageHead *head, const pjs::Value &payload) {
+  auto codes = pjs::Array::make();
+  if (payload.is_array()) {
+    payload.as<pjs::Array>()->iterate_all(
+      [&](pjs::Value &v, int) {
+        auto s = v.to_string();
+        auto found = m_trie->unsubscribe(m_subscriber, s->str());
+        m_filters.erase(s->str());
+        codes->push(found ? 0x00 : 0x11);
+        s->release();
+      }
+    );
+  }
+  reply(PacketType::UNSUBACK, head->packetIdentifier, m_protocol_level >= 5 ? codes : nullptr);
+}
+
+void Fanout::reply(PacketType type, int packet_id, pjs::Object *payload) {
+  auto head = MessageHead::make();
+  head->type = type;
+  head->packetIdentifier = packet_id;
+  head->protocolLevel = m_protocol_level;
+  Filter::output(MessageStart::make(head));
+  Filter::output(MessageEnd::make(nullptr, payload));
+}
+
+//
+// Outgoing QoS 1 and 2 deliveries get a packet ID each but are not kept
+// for resending, so they are at-least-once only while the connection
+// lasts.
+//
+
+void Fanout::deliver(const std::string &topic, int qos, SharedData *payload) {
+  auto head = MessageHead::make();
+  head->type = PacketType::PUBLISH;
+  head->qos = qos;
+  head->protocolLevel = m_protocol_level;
+  head->topicName = pjs::Str::make(topic);
+  if (qos > 0) {
+    if (++m_packet_id > 0xffff) m_packet_id = 1;
+    head->packetIdentifier = m_packet_id;
+  }
+  Filter::output(MessageStart::make(head));
+  Filter::output(Data::make(*payload));
+  Filter::output(MessageEnd::make());
+}
+
+void Fanout::close() {
+  if (m_subscriber) {
+    m_subscriber->m_fanout = nullptr;
+    if (m_trie) {
+      for (const auto &f : m_filters) {
+        m_trie->unsubscribe(m_subscriber, f);
+      }
+    }
+    m_subscriber = nullptr;
+  }
+  m_filters.clear();
+  m_trie = nullptr;
+}
+
 } // namespace mqtt
 } // namespace pipy
 
@@ -29,7 +29,16 @@
 #include "filter.hpp"
 #include "deframer.hpp"
 
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
 namespace pipy {
+
+class Net;
+
 namespace mqtt {
 
 //
@@ -174,6 +183,110 @@ private:
   pjs::Ref<Data> m_buffer;
 };
 
+class Fanout;
+
+//
+// Subscriber
+//
+// Stands for one client stream in topic tries. It can be referenced from
+// any thread but is only ever delivered to on the thread owning it.
+//
+
+class Subscriber : public pjs::RefCountMT<Subscriber> {
+public:
+  void deliver(const std::string &topic, int qos, SharedData *payload);
+
+private:
+  Subscriber(Fanout *fanout);
+
+  Net* m_net;
+  Fanout* m_fanout;
+
+  friend class pjs::RefCountMT<Subscriber>;
+  friend class Fanout;
+};
+
+//
+// TopicTrie
+//
+// Topic filters by level, shared by name among all threads. Levels of
+// '+' and '#' are kept as ordinary children and followed at matching.
+//
+
+class TopicTrie : public pjs::RefCountMT<TopicTrie> {
+public:
+  static auto get(const std::string &name) -> TopicTrie*;
+  static bool is_valid_filter(const std::string &filter);
+
+  void subscribe(Subscriber *subscriber, const std::string &filter, int qos);
+  bool unsubscribe(Subscriber *subscriber, const std::string &filter);
+  void match(const std::string &topic, std::map<pjs::Ref<Subscriber>, int> &subscribers);
+
+private:
+  struct Node {
+    Node* parent = nullptr;
+    std::string level;
+    std::map<std::string, Node*> children;
+    std::map<pjs::Ref<Subscriber>, int> subscribers;
+    ~Node() { for (const auto &p : children) delete p.second; }
+  };
+
+  Node m_root;
+  std::mutex m_mutex;
+
+  void match(Node *node, const std::vector<std::string> &levels, size_t i, std::map<pjs::Ref<Subscriber>, int> &subscribers);
+
+  static std::map<std::string, TopicTrie*> s_tries;
+  static std::mutex s_tries_mutex;
+
+  friend class pjs::RefCountMT<TopicTrie>;
+};
+
+//
+// Fanout
+//
+// Takes over PUBLISH, SUBSCRIBE and UNSUBSCRIBE from a client stream and
+// the acknowledgements that come with them. Published payloads go to all
+// matching subscribers as one SharedData, and deliveries come out of the
+// filter as PUBLISH packets. Other packets pass through.
+//
+
+class Fanout : public Filter {
+public:
+  Fanout(const pjs::Value &trie);
+
+private:
+  Fanout(const Fanout &r);
+  ~Fanout();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  pjs::Value m_trie_value;
+  pjs::Ref<TopicTrie> m_trie;
+  pjs::Ref<Subscriber> m_subscriber;
+  pjs::Ref<MessageHead> m_head;
+  Data m_payload;
+  std::set<std::string> m_filters;
+  std::set<int> m_incoming_qos2;
+  int m_protocol_level = 5;
+  int m_packet_id = 0;
+  bool m_passing = false;
+  bool m_is_started = false;
+
+  void packet(MessageHead *head, const pjs::Value &payload);
+  void publish(MessageHead *head);
+  void subscribe(MessageHead *head, const pjs::Value &payload);
+  void unsubscribe(MessageHead *head, const pjs::Value &payload);
+  void reply(PacketType type, int packet_id, pjs::Object *payload = nullptr);
+  void deliver(const std::string &topic, int qos, SharedData *payload);
+  void close();
+
+  friend class Subscriber;
+};
+
 } // namespace mqtt
 } // namespace pipy
 
@@ -29,8 +29,11 @@
 #include "utils.hpp"
 
 #include "api/console.hpp"
+#include "api/json.hpp"
 
+#include <cmath>
 #include <limits>
+#include <typeinfo>
 
 //
 // All mux filters should derive from MuxSource.
@@ -96,6 +99,11 @@ MuxSession::Options::Options(pjs::Object *options) {
   thread_local static pjs::ConstStr s_max_idle("maxIdle");
   thread_local static pjs::ConstStr s_max_queue("maxQueue");
   thread_local static pjs::ConstStr s_max_messages("maxMessages");
+  thread_local static pjs::ConstStr s_min_idle("minIdle");
+  thread_local static pjs::ConstStr s_max_connections("maxConnections");
+  thread_local static pjs::ConstStr s_priority("priority");
+  thread_local static pjs::ConstStr s_queue_target("queueTarget");
+  thread_local static pjs::ConstStr s_queue_interval("queueInterval");
   Value(options, s_max_idle)
     .get_seconds(max_idle)
     .check_nullable();
@@ -105,6 +113,22 @@ MuxSession::Options::Options(pjs::Object *options) {
   Value(options, s_max_messages)
     .get(max_messages)
     .check_nullable();
+  Value(options, s_min_idle)
+    .get(min_idle)
+    .check_nullable();
+  Value(options, s_max_connections)
+    .get(max_connections)
+    .check_nullable();
+  Value(options, s_priority)
+    .get(priority)
+    .get(priority_f)
+    .check_nullable();
+  Value(options, s_queue_target)
+    .get_seconds(queue_target)
+    .check_nullable();
+  Value(options, s_queue_interval)
+    .get_seconds(queue_interval)
+    .check_nullable();
 }
 
 //
@@ -170,19 +194,52 @@ void MuxSession::free() {
 //
 // Will be deleted when the number of MuxSessions goes down to zero.
 //
+// Sessions are kept in the order of their share counts. Among sessions
+// with the same share count, the one most recently touched comes first,
+// so that the busiest connections get picked again while the rest can
+// go stale and be recycled. With minIdle, that many idle sessions are
+// opened ahead of demand and spared from recycling. With maxConnections,
+// sources that find no session available wait in a queue for one.
+//
+// The queue is kept in order of priority, highest first and FIFO within
+// the same priority. With queueTarget, a CoDel controller watches the
+// queueing delay: once it has stayed above target for a whole interval,
+// sources are shed at an increasing rate, lowest priority first, until
+// the delay comes back under target.
+//
 
 MuxSessionPool::MuxSessionPool(const MuxSession::Options &options) {
   m_max_idle = options.max_idle;
   m_max_queue = options.max_queue;
   m_max_messages = options.max_messages;
+  m_min_idle = options.min_idle;
+  m_max_connections = options.max_connections;
+  m_priority = options.priority;
+  m_priority_f = options.priority_f;
+  m_queue_target = options.queue_target;
+  m_queue_interval = options.queue_interval;
+}
+
+auto MuxSessionPool::alloc(MuxSource *source) -> MuxSession* {
+  auto s = acquire();
+  if (!s) {
+    if (m_max_connections > 0 && m_sessions.size() >= m_max_connections) {
+      enqueue(source);
+      return nullptr;
+    }
+    s = create();
+  }
+  warm_up(source);
+  return s;
 }
 
-auto MuxSessionPool::alloc() -> MuxSession* {
+auto MuxSessionPool::acquire() -> MuxSession* {
   auto max_share_count = m_max_queue;
   auto max_message_count = m_max_messages;
   auto *s = m_sessions.head();
   while (s) {
     if ((max_share_count <= 0 || s->m_share_count < max_share_count) &&
+        (s->m_max_share_count <= 0 || s->m_share_count < s->m_max_share_count) &&
         (max_message_count <= 0 || s->m_message_count < max_message_count)
       ) {
       s->m_share_count++;
@@ -192,31 +249,142 @@ auto MuxSessionPool::alloc() -> MuxSession* {
     }
     s = s->next();
   }
-  s = session();
+  return nullptr;
+}
+
+auto MuxSessionPool::create() -> MuxSession* {
+  auto s = session();
   s->retain();
   s->m_pool = this;
   m_sessions.unshift(s);
   return s;
 }
 
+void MuxSessionPool::warm_up(MuxSource *source) {
+  if (m_min_idle <= 0 || m_weak_ptr_gone) return;
+  int idle = 0;
+  for (auto s = m_sessions.head(); s; s = s->next()) {
+    if (s->is_free() && s->is_open()) idle++;
+  }
+  while (idle < m_min_idle) {
+    if (m_max_connections > 0 && m_sessions.size() >= m_max_connections) break;
+    pjs::Ref<MuxSession> s(create());
+    s->m_share_count = 0;
+    s->m_free_time = utils::now();
+    s->open(source, source->on_mux_new_pipeline());
+    if (s->m_eos || !s->is_open()) break;
+    s->input()->input(Data::make()); // get connected
+    idle++;
+  }
+}
+
+void MuxSessionPool::enqueue(MuxSource *source) {
+  auto priority = m_priority_f ? source->on_mux_priority(m_priority_f) : m_priority;
+  auto now = utils::now();
+  source->m_queued_pool = this;
+  source->m_queued_time = now;
+  source->m_queued_priority = priority;
+  auto p = m_queued_sources.head();
+  while (p && p->m_queued_priority >= priority) p = p->List<MuxSource>::Item::next();
+  if (p) {
+    m_queued_sources.insert(source, p);
+  } else {
+    m_queued_sources.push(source);
+  }
+  shed(now);
+}
+
+//
+// The standing queue is measured by the oldest source of the lowest
+// priority, which is also the one to go first when shedding.
+//
+
+void MuxSessionPool::shed(double now) {
+  if (m_queue_target <= 0) return;
+  while (auto tail = m_queued_sources.tail()) {
+    auto victim = tail;
+    while (auto p = victim->List<MuxSource>::Item::back()) {
+      if (p->m_queued_priority != tail->m_queued_priority) break;
+      victim = p;
+    }
+    if (!codel(now, now - victim->m_queued_time)) break;
+    m_queued_sources.remove(victim);
+    victim->m_queued_pool = nullptr;
+    victim->shed();
+  }
+}
+
+bool MuxSessionPool::codel(double now, double sojourn) {
+  auto target = m_queue_target * 1000;
+  auto interval = m_queue_interval * 1000;
+
+  if (sojourn < target) {
+    m_codel_first_above = 0;
+    m_codel_shedding = false;
+    return false;
+  }
+
+  if (!m_codel_first_above) {
+    m_codel_first_above = now + interval;
+    return false;
+  }
+
+  if (now < m_codel_first_above) return false;
+
+  if (!m_codel_shedding) {
+    // Resume near the previous rate if we've only just left shedding
+    m_codel_shedding = true;
+    if (m_codel_shed_count > 2 && now - m_codel_shed_next < 16 * interval) {
+      m_codel_shed_count -= 2;
+    } else {
+      m_codel_shed_count = 0;
+    }
+    m_codel_shed_next = now;
+  }
+
+  if (now < m_codel_shed_next) return false;
+
+  m_codel_shed_count++;
+  m_codel_shed_next = now + interval / std::sqrt(m_codel_shed_count);
+  return true;
+}
+
+void MuxSessionPool::dequeue() {
+  shed(utils::now());
+  while (auto source = m_queued_sources.head()) {
+    auto s = acquire();
+    if (!s) {
+      if (m_max_connections > 0 && m_sessions.size() >= m_max_connections) break;
+      s = create();
+    }
+    m_queued_sources.remove(source);
+    source->m_queued_pool = nullptr;
+    source->m_session = s;
+    MuxSessionMap::s_metric_queue_time->observe(utils::now() - source->m_queued_time);
+    source->flush_waiting();
+  }
+}
+
 void MuxSessionPool::free(MuxSession *session) {
   session->m_share_count--;
   if (session->is_free()) {
     session->m_free_time = utils::now();
   }
   sort(session);
+  dequeue();
 }
 
 void MuxSessionPool::detach(MuxSession *session) {
   m_sessions.remove(session);
   session->release();
+  dequeue();
   sort(nullptr);
 }
 
 void MuxSessionPool::sort(MuxSession *session) {
   if (session) {
     auto p = session->back();
-    while (p && p->m_share_count > session->m_share_count) p = p->back();
+    while (p && p->m_share_count >= session->m_share_count) p = p->back();
     if (p == session->back()) {
       auto p = session->next();
       while (p && p->m_share_count < session->m_share_count) p = p->next();
@@ -266,24 +434,47 @@ void MuxSessionPool::schedule_recycling() {
   }
 }
 
-void MuxSessionPool::recycle(double now) {
+void MuxSessionPool::recycle(double now, int *budget) {
   auto max_idle = m_max_idle * 1000;
+  auto min_idle = std::isinf(now) ? 0 : m_min_idle;
+  auto idle = 0;
   auto s = m_sessions.head();
   while (s) {
     auto session = s; s = s->next();
     if (session->m_share_count > 0) break;
     if (session->m_is_pending || m_weak_ptr_gone ||
        (m_max_messages > 0 && session->m_message_count >= m_max_messages) ||
-       (now - session->m_free_time >= max_idle))
+       (now - session->m_free_time >= max_idle && idle >= min_idle))
     {
+      if (budget) {
+        if (*budget <= 0) break;
+        (*budget)--;
+      }
       MuxSession::auto_release(session);
       session->forward(StreamEnd::make());
       session->close();
       session->detach();
+    } else {
+      idle++;
     }
   }
 }
 
+bool MuxSessionPool::same_options(const MuxSessionPool *other) const {
+  return (
+    typeid(*this) == typeid(*other) &&
+    m_max_idle == other->m_max_idle &&
+    m_max_queue == other->m_max_queue &&
+    m_max_messages == other->m_max_messages &&
+    m_min_idle == other->m_min_idle &&
+    m_max_connections == other->m_max_connections &&
+    m_priority == other->m_priority &&
+    m_queue_target == other->m_queue_target &&
+    m_queue_interval == other->m_queue_interval &&
+    m_options_digest == other->m_options_digest
+  );
+}
+
 void MuxSessionPool::on_weak_ptr_gone() {
   m_weak_ptr_gone = true;
   m_map->m_weak_pools.erase(m_weak_key);
@@ -298,11 +489,111 @@ void MuxSessionPool::on_weak_ptr_gone() {
 //   - MuxSessionPool
 //   - Asynchronous recycling operations
 //
+// After a reload, the map of the old worker keeps its idle sessions for
+// the same filter in the new worker to take over pool by pool, while the
+// ones nobody asks for are closed a few at a time over DRAIN_TIME, rather
+// than all at once with every backend seeing a storm of new connections.
+//
+
+static const int DRAIN_TIME = 10;
+
+thread_local List<MuxSessionMap> MuxSessionMap::s_all_maps;
+thread_local std::set<MuxSessionMap*> MuxSessionMap::s_draining_maps;
+thread_local pjs::Ref<stats::Histogram> MuxSessionMap::s_metric_queue_time;
+
+MuxSessionMap::MuxSessionMap() {
+  init_metrics();
+  s_all_maps.push(this);
+}
+
+MuxSessionMap::~MuxSessionMap() {
+  s_all_maps.remove(this);
+  s_draining_maps.erase(this);
+}
+
+void MuxSessionMap::shutdown() {
+  if (m_has_shutdown) return;
+  m_has_shutdown = true;
+  int idle = 0;
+  auto count = [&](MuxSessionPool *pool) {
+    for (auto s = pool->m_sessions.head(); s; s = s->next()) {
+      if (s->is_free()) idle++;
+    }
+  };
+  for (const auto &p : m_pools) count(p.second);
+  for (const auto &p : m_weak_pools) count(p.second);
+  m_drain_step = std::max(1, (idle + DRAIN_TIME - 1) / DRAIN_TIME);
+  if (!m_handover_id.empty()) s_draining_maps.insert(this);
+}
+
+void MuxSessionMap::init_metrics() {
+  if (!s_metric_queue_time) {
+    thread_local static pjs::ConstStr s_idle("idle");
+    thread_local static pjs::ConstStr s_busy("busy");
+
+    pjs::Ref<pjs::Array> label_names = pjs::Array::make();
+    label_names->length(1);
+    label_names->set(0, "state");
+
+    stats::Gauge::make(
+      pjs::Str::make("pipy_mux_session_count"),
+      label_names,
+      [=](stats::Gauge *gauge) {
+        int idle = 0, busy = 0;
+        for_each_pool(
+          [&](MuxSessionPool *pool) {
+            for (auto s = pool->m_sessions.head(); s; s = s->next()) {
+              if (s->is_free()) idle++; else busy++;
+            }
+          }
+        );
+        pjs::Str *k;
+        k = s_idle; gauge->with_labels(&k, 1)->set(idle);
+        k = s_busy; gauge->with_labels(&k, 1)->set(busy);
+        gauge->set(idle + busy);
+      }
+    );
+
+    stats::Gauge::make(
+      pjs::Str::make("pipy_mux_queue_count"),
+      nullptr,
+      [=](stats::Gauge *gauge) {
+        int n = 0;
+        for_each_pool(
+          [&](MuxSessionPool *pool) {
+            n += pool->m_queued_sources.size();
+          }
+        );
+        gauge->set(n);
+      }
+    );
+
+    pjs::Ref<pjs::Array> buckets = pjs::Array::make(21);
+    double limit = 1.5;
+    for (int i = 0; i < 20; i++) {
+      buckets->set(i, std::floor(limit));
+      limit *= 1.5;
+    }
+    buckets->set(20, std::numeric_limits<double>::infinity());
+
+    s_metric_queue_time = stats::Histogram::make(
+      pjs::Str::make("pipy_mux_queue_time"),
+      buckets, nullptr
+    );
+  }
+}
+
+void MuxSessionMap::for_each_pool(const std::function<void(MuxSessionPool*)> &cb) {
+  for (auto m = s_all_maps.head(); m; m = m->next()) {
+    for (const auto &p : m->m_pools) cb(p.second);
+    for (const auto &p : m->m_weak_pools) cb(p.second);
+  }
+}
 
 auto MuxSessionMap::alloc(const pjs::Value &key, MuxSource *source) -> MuxSession* {
   auto i = m_pools.find(key);
   if (i != m_pools.end()) {
-    return i->second->alloc();
+    return i->second->alloc(source);
   }
 
   auto pool = source->on_mux_new_pool();
@@ -312,13 +603,17 @@ auto MuxSessionMap::alloc(const pjs::Value &key, MuxSource *source) -> MuxSessio
   pool->m_key = key;
   m_pools[key] = pool;
 
-  return pool->alloc();
+  if (!m_handover_id.empty() && !s_draining_maps.empty()) {
+    adopt(key, pool);
+  }
+
+  return pool->alloc(source);
 }
 
 auto MuxSessionMap::alloc(pjs::Object::WeakPtr *weak_key, MuxSource *source) -> MuxSession* {
   auto i = m_weak_pools.find(weak_key);
   if (i != m_weak_pools.end()) {
-    return i->second->alloc();
+    return i->second->alloc(source);
   }
 
   auto pool = source->on_mux_new_pool();
@@ -329,7 +624,38 @@ auto MuxSessionMap::alloc(pjs::Object::WeakPtr *weak_key, MuxSource *source) ->
   pool->watch(weak_key);
   m_weak_pools[weak_key] = pool;
 
-  return pool->alloc();
+  return pool->alloc(source);
+}
+
+//
+// Sessions are only handed over between maps of the same filter defined
+// by an unchanged script, so the sub-pipeline they run and the options
+// written in it are the same. On top of that, the two pools must be of
+// the same type and end up with the same options, including the ones
+// returned by an options callback. Otherwise the old sessions are just
+// drained. Only sessions sitting idle and still connected are moved.
+// Busy ones finish their work in the old pool first.
+//
+
+void MuxSessionMap::adopt(const pjs::Value &key, MuxSessionPool *pool) {
+  for (auto *m : s_draining_maps) {
+    if (m == this || m->m_handover_id != m_handover_id) continue;
+    auto i = m->m_pools.find(key);
+    if (i == m->m_pools.end()) continue;
+    auto *old = i->second;
+    if (!old->same_options(pool)) continue;
+    for (auto *s = old->m_sessions.head(); s; ) {
+      auto *session = s; s = s->next();
+      if (!session->is_free() || !session->is_open()) continue;
+      if (session->m_is_pending || session->m_eos) continue;
+      old->m_sessions.remove(session);
+      session->m_pool = pool;
+      pool->m_sessions.push(session);
+    }
+    pool->sort(nullptr);
+    old->sort(nullptr); // potentially deleting the old pool and map
+    return;
+  }
 }
 
 void MuxSessionMap::schedule_recycling() {
@@ -342,10 +668,11 @@ void MuxSessionMap::schedule_recycling() {
       InputContext ic;
       m_has_recycling_scheduled = false;
       auto now = m_has_shutdown ? std::numeric_limits<double>::infinity() : utils::now();
+      auto budget = m_drain_step;
       auto p = m_recycle_pools.head();
       while (p) {
         auto pool = p; p = p->next();
-        pool->recycle(now);
+        pool->recycle(now, m_has_shutdown ? &budget : nullptr);
       }
       schedule_recycling();
       release();
@@ -373,6 +700,10 @@ MuxSource::MuxSource(const MuxSource &r)
 }
 
 void MuxSource::reset() {
+  if (auto pool = m_queued_pool) {
+    pool->m_queued_sources.remove(this);
+    m_queued_pool = nullptr;
+  }
   if (m_session) {
     stop_waiting();
     close_stream();
@@ -383,6 +714,7 @@ void MuxSource::reset() {
   m_session_key = pjs::Value::undefined;
   m_session_weak_key = nullptr;
   m_has_alloc_error = false;
+  m_is_shed = false;
 }
 
 void MuxSource::key(const pjs::Value &key) {
@@ -403,7 +735,7 @@ void MuxSource::chain(EventTarget::Input *input) {
 void MuxSource::input(Event *evt) {
   alloc_stream();
 
-  if (m_is_waiting) {
+  if (m_is_waiting || m_queued_pool) {
     m_waiting_events.push(evt);
 
   } else if (auto s = m_stream) {
@@ -421,6 +753,8 @@ void MuxSource::input(Event *evt) {
 }
 
 void MuxSource::alloc_stream() {
+  if (m_queued_pool) return;
+
   if (m_session && !m_session->is_open()) {
     stop_waiting();
     close_stream();
@@ -437,7 +771,7 @@ void MuxSource::alloc_stream() {
           m_map->alloc(m_session_key, this)
       );
       if (!session) {
-        m_has_alloc_error = true;
+        if (!m_queued_pool) m_has_alloc_error = true;
         return;
       }
       m_session = session;
@@ -487,6 +821,21 @@ void MuxSource::stop_waiting() {
   }
 }
 
+void MuxSource::shed() {
+  m_waiting_events.clear();
+  m_has_alloc_error = true;
+  m_is_shed = true;
+  Net::current().post(
+    [this]() {
+      if (!m_is_shed) return;
+      InputContext ic;
+      if (auto o = m_output.get()) {
+        o->input(StreamEnd::make(StreamEnd::OVERLOADED));
+      }
+    }
+  );
+}
+
 void MuxSource::close_stream() {
   if (auto *s = m_stream) {
     s->chain(nullptr);
@@ -505,6 +854,10 @@ void MuxQueue::reset() {
     m_receivers.remove(r);
     delete r;
   }
+  while (auto h = m_held.head()) {
+    m_held.remove(h);
+    delete h;
+  }
   m_dedicated_stream = nullptr;
 }
 
@@ -521,6 +874,7 @@ void MuxQueue::dedicate() {
       m_receivers.remove(r);
       delete r;
     }
+    abort_held(StreamEnd::make(StreamEnd::CONNECTION_ABORTED));
   }
 }
 
@@ -546,12 +900,14 @@ void MuxQueue::on_reply(Event *evt) {
     if (r->receive(evt)) {
       m_receivers.remove(r);
       delete r;
+      if (!evt->is<StreamEnd>()) admit();
     }
     if (auto eos = evt->as<StreamEnd>()) {
       for (auto r = m_receivers.head(); r; r = r->next()) {
         auto s = r->stream();
-        s->output(evt->clone());
+        s->output(evt->share());
       }
+      abort_held(eos);
       reset();
       on_queue_end(eos);
     }
@@ -561,6 +917,47 @@ void MuxQueue::on_reply(Event *evt) {
   }
 }
 
+//
+// A message that on_queue_admit() turns down, or one that comes after
+// another already waiting, is held in order until responses make room.
+// A held message reserves its place in the stream's receiver count so
+// that the stream is not ended before the message is sent.
+//
+
+void MuxQueue::send(Stream *stream, MessageStart *start, Data &body, Event *end, bool reserved) {
+  int n = on_queue_message(stream->m_source, start);
+  if (n > 0) {
+    auto r = new Receiver(stream, n);
+    m_receivers.push(r);
+    if (!reserved) stream->m_receiver_count++;
+  } else if (reserved) {
+    stream->shift();
+  }
+  if (n >= 0) {
+    auto i = output();
+    i->input(start);
+    if (!body.empty()) i->input(Data::make(std::move(body)));
+    i->input(end);
+  }
+}
+
+void MuxQueue::admit() {
+  while (auto h = m_held.head()) {
+    if (!on_queue_admit(h->start)) break;
+    m_held.remove(h);
+    send(h->stream, h->start, h->body, h->end, true);
+    delete h;
+  }
+}
+
+void MuxQueue::abort_held(StreamEnd *eos) {
+  while (auto h = m_held.head()) {
+    m_held.remove(h);
+    h->stream->output(eos->share());
+    delete h;
+  }
+}
+
 //
 // MuxQueue::Stream
 //
@@ -592,17 +989,16 @@ void MuxQueue::Stream::on_event(Event *evt) {
       break;
     case Event::Type::MessageEnd:
       if (m_message_start) {
-        int n = q->on_queue_message(m_source, m_message_start);
-        if (n >= 0) {
-          if (n > 0) {
-            auto r = new Receiver(this, n);
-            q->m_receivers.push(r);
-            m_receiver_count++;
-          }
-          auto i = q->output();
-          i->input(m_message_start);
-          if (!m_buffer.empty()) i->input(Data::make(std::move(m_buffer)));
-          i->input(evt);
+        if (q->m_held.empty() && q->on_queue_admit(m_message_start)) {
+          q->send(this, m_message_start, m_buffer, evt, false);
+        } else {
+          auto h = new Held;
+          h->stream = this;
+          h->start = m_message_start;
+          h->end = evt;
+          h->body = std::move(m_buffer);
+          q->m_held.push(h);
+          m_receiver_count++;
         }
         m_message_start = nullptr;
       }
@@ -700,7 +1096,8 @@ void MuxBase::chain() {
 
 void MuxBase::shutdown() {
   Filter::shutdown();
-  if (auto map = MuxSource::map()) {
+  auto map = MuxSource::map();
+  if (map && !map->is_shared()) {
     map->shutdown();
   }
 }
@@ -708,6 +1105,19 @@ void MuxBase::shutdown() {
 void MuxBase::process(Event *evt) {
   if (!m_session_key_ready) {
     m_session_key_ready = true;
+    auto map = MuxSource::map();
+    if (!map->has_handover_id()) {
+      const auto &loc = Filter::location();
+      if (loc.source) {
+        char hash[32];
+        std::snprintf(hash, sizeof(hash), "%zx", std::hash<std::string>()(loc.source->content));
+        map->handover_id(
+          loc.source->filename + ':' +
+          std::to_string(loc.line) + ':' +
+          std::to_string(loc.column) + ':' + hash
+        );
+      }
+    }
     pjs::Value key;
     if (m_session_selector && !Filter::eval(m_session_selector, key)) return;
     if (key.is_undefined()) key.set(Filter::context()->inbound());
@@ -725,7 +1135,9 @@ auto MuxBase::on_mux_new_pool() -> MuxSessionPool* {
       Filter::error("callback did not return an object for options");
       return nullptr;
     }
-    return on_mux_new_pool(opts.o());
+    auto pool = on_mux_new_pool(opts.o());
+    if (pool) pool->m_options_digest = std::hash<std::string>()(JSON::stringify(opts, nullptr, 0));
+    return pool;
   } else {
     return on_mux_new_pool(nullptr);
   }
@@ -735,6 +1147,12 @@ auto MuxBase::on_mux_new_pipeline() -> Pipeline* {
   return sub_pipeline(0, false);
 }
 
+auto MuxBase::on_mux_priority(pjs::Function *f) -> int {
+  pjs::Value ret;
+  if (!Filter::eval(f, ret)) return 0;
+  return ret.to_int32();
+}
+
 //
 // Mux::Options
 //
@@ -34,7 +34,10 @@
 #include "list.hpp"
 #include "timer.hpp"
 #include "options.hpp"
+#include "api/stats.hpp"
 
+#include <set>
+#include <string>
 #include <unordered_map>
 
 namespace pipy {
@@ -63,6 +66,12 @@ public:
     double max_idle = 60;
     int max_queue = 0;
     int max_messages = 0;
+    int min_idle = 0;
+    int max_connections = 0;
+    int priority = 0;
+    pjs::Ref<pjs::Function> priority_f;
+    double queue_target = 0;
+    double queue_interval = 0.1;
     Options() {}
     Options(pjs::Object *options);
   };
@@ -79,6 +88,7 @@ protected:
   bool is_free() const { return !m_share_count; }
   bool is_pending() const { return m_is_pending; }
   void set_pending(bool pending);
+  void set_max_share_count(int n) { m_max_share_count = n; }
   void detach();
   void end(StreamEnd *eos);
 
@@ -92,6 +102,7 @@ private:
   pjs::Ref<StreamEnd> m_eos;
   List<MuxSource> m_waiting_sources;
   int m_share_count = 1;
+  int m_max_share_count = 0;
   int m_message_count = 0;
   double m_free_time = 0;
   bool m_is_pending = false;
@@ -104,6 +115,7 @@ private:
   friend class pjs::RefCount<MuxSession>;
   friend class MuxSource;
   friend class MuxSessionPool;
+  friend class MuxSessionMap;
 };
 
 //
@@ -121,7 +133,11 @@ protected:
   virtual void free() = 0;
 
 private:
-  auto alloc() -> MuxSession*;
+  auto alloc(MuxSource *source) -> MuxSession*;
+  auto acquire() -> MuxSession*;
+  auto create() -> MuxSession*;
+  void warm_up(MuxSource *source);
+  void dequeue();
   void free(MuxSession *session);
   void detach(MuxSession *session);
 
@@ -129,43 +145,88 @@ private:
   pjs::Ref<pjs::Object::WeakPtr> m_weak_key;
   pjs::Ref<MuxSessionMap> m_map;
   List<MuxSession> m_sessions;
+  List<MuxSource> m_queued_sources;
   double m_max_idle;
   int m_max_queue;
   int m_max_messages;
+  int m_min_idle;
+  int m_max_connections;
+  int m_priority;
+  pjs::Ref<pjs::Function> m_priority_f;
+  double m_queue_target;
+  double m_queue_interval;
+  double m_codel_first_above = 0;
+  double m_codel_shed_next = 0;
+  int m_codel_shed_count = 0;
+  size_t m_options_digest = 0;
+  bool m_codel_shedding = false;
   bool m_weak_ptr_gone = false;
   bool m_recycle_scheduled = false;
 
+  void enqueue(MuxSource *source);
+  void shed(double now);
+  bool codel(double now, double sojourn);
   void sort(MuxSession *session);
   void schedule_recycling();
-  void recycle(double now);
+  void recycle(double now, int *budget = nullptr);
+  bool same_options(const MuxSessionPool *other) const;
 
   virtual void on_weak_ptr_gone() override;
 
   friend class MuxSource;
   friend class MuxSession;
   friend class MuxSessionMap;
+  friend class MuxBase;
 };
 
 //
 // MuxSessionMap
 //
 
-class MuxSessionMap : public pjs::RefCount<MuxSessionMap> {
+class MuxSessionMap :
+  public pjs::RefCount<MuxSessionMap>,
+  public List<MuxSessionMap>::Item
+{
 public:
-  void shutdown() { m_has_shutdown = true; }
+  MuxSessionMap();
+
+  void shutdown();
+
+  // Shared maps outlive the filters using them and are only shut down
+  // by their owner, see Upstream
+  void share() { m_is_shared = true; }
+  bool is_shared() const { return m_is_shared; }
+
+  // Identifies the maps of the same filter across reloads, as long as
+  // the script defining it stays the same
+  void handover_id(const std::string &id) { m_handover_id = id; }
+  bool has_handover_id() const { return !m_handover_id.empty(); }
 
 private:
+  ~MuxSessionMap();
+
   std::unordered_map<pjs::Value, MuxSessionPool*> m_pools;
   std::unordered_map<pjs::Ref<pjs::Object::WeakPtr>, MuxSessionPool*> m_weak_pools;
   List<MuxSessionPool> m_recycle_pools;
   Timer m_recycle_timer;
+  std::string m_handover_id;
+  int m_drain_step = 0;
   bool m_has_recycling_scheduled = false;
   bool m_has_shutdown = false;
+  bool m_is_shared = false;
 
   auto alloc(const pjs::Value &key, MuxSource *source) -> MuxSession*;
   auto alloc(pjs::Object::WeakPtr *weak_key, MuxSource *source) -> MuxSession*;
+  void adopt(const pjs::Value &key, MuxSessionPool *pool);
   void schedule_recycling();
 
+  thread_local static List<MuxSessionMap> s_all_maps;
+  thread_local static std::set<MuxSessionMap*> s_draining_maps;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_queue_time;
+
+  static void init_metrics();
+  static void for_each_pool(const std::function<void(MuxSessionPool*)> &cb);
+
   friend class pjs::RefCount<MuxSessionMap>;
   friend class MuxSource;
   friend class MuxSessionPool;
@@ -183,12 +244,14 @@ protected:
   void reset();
   void key(const pjs::Value &key);
   auto map() -> MuxSessionMap* { return m_map; }
+  void map(MuxSessionMap *map) { m_map = map; }
 
   void chain(EventTarget::Input *input);
   void input(Event *evt);
 
   virtual auto on_mux_new_pool() -> MuxSessionPool* = 0;
   virtual auto on_mux_new_pipeline() -> Pipeline* = 0;
+  virtual auto on_mux_priority(pjs::Function *f) -> int { return 0; }
 
 private:
   pjs::Ref<MuxSessionMap> m_map;
@@ -198,7 +261,11 @@ private:
   pjs::Ref<EventTarget::Input> m_output;
   EventFunction* m_stream = nullptr;
   EventBuffer m_waiting_events;
+  MuxSessionPool* m_queued_pool = nullptr;
+  double m_queued_time = 0;
+  int m_queued_priority = 0;
   bool m_is_waiting = false;
+  bool m_is_shed = false;
   bool m_has_alloc_error = false;
 
   void alloc_stream();
@@ -206,8 +273,10 @@ private:
   void flush_waiting();
   void stop_waiting();
   void close_stream();
+  void shed();
 
   friend class MuxSession;
+  friend class MuxSessionPool;
   friend class MuxSessionMap;
 };
 
@@ -222,8 +291,10 @@ protected:
   void close(EventFunction *stream);
   void increase_output_count(int n);
   void dedicate();
+  auto in_flight() const -> int { return m_receivers.size(); }
 
   virtual auto on_queue_message(MuxSource *source, MessageStart *msg) -> int { return 1; }
+  virtual bool on_queue_admit(MessageStart *msg) { return true; }
   virtual void on_queue_end(StreamEnd *eos) {}
 
 private:
@@ -281,9 +352,28 @@ private:
     bool m_has_message_started = false;
   };
 
+  //
+  // MuxQueue::Held
+  //
+
+  struct Held :
+    public pjs::Pooled<Held>,
+    public List<Held>::Item
+  {
+    pjs::Ref<Stream> stream;
+    pjs::Ref<MessageStart> start;
+    pjs::Ref<Event> end;
+    Data body;
+  };
+
   List<Receiver> m_receivers;
+  List<Held> m_held;
   pjs::Ref<Stream> m_dedicated_stream;
 
+  void send(Stream *stream, MessageStart *start, Data &body, Event *end, bool reserved);
+  void admit();
+  void abort_held(StreamEnd *eos);
+
   friend class Stream;
 };
 
@@ -292,6 +382,9 @@ private:
 //
 
 class MuxBase : public Filter, public MuxSource {
+public:
+  void join(MuxSessionMap *map) { MuxSource::map(map); }
+
 protected:
   MuxBase();
   MuxBase(const MuxBase &r);
@@ -306,6 +399,7 @@ protected:
   virtual auto on_mux_new_pool() -> MuxSessionPool* override;
   virtual auto on_mux_new_pool(pjs::Object *options) -> MuxSessionPool* = 0;
   virtual auto on_mux_new_pipeline() -> Pipeline* override;
+  virtual auto on_mux_priority(pjs::Function *f) -> int override;
 
   pjs::Ref<pjs::Function> m_session_selector;
   pjs::Ref<pjs::Function> m_options;
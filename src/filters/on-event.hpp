@@ -45,6 +45,8 @@ private:
   virtual auto clone() -> Filter* override;
   virtual void dump(Dump &d) override;
   virtual void handle(Event *evt) override;
+  virtual bool fusible() const override { return int(m_type) >= 0; }
+  virtual bool bypass(Event *evt) override { return evt->type() != m_type && Handle::idle(); }
 
   Event::Type m_type;
 };
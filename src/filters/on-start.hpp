@@ -46,6 +46,8 @@ private:
   virtual void reset() override;
   virtual void dump(Dump &d) override;
   virtual void handle(Event *evt) override;
+  virtual bool fusible() const override { return true; }
+  virtual bool bypass(Event *evt) override { return m_started && Handle::idle(); }
 
   bool m_started = false;
 };
@@ -42,6 +42,9 @@ Pack::Options::Options(pjs::Object *options, const char *base_name) {
   Value(options, "interval", base_name)
     .get_seconds(interval)
     .check_nullable();
+  Value(options, "adaptive", base_name)
+    .get(adaptive)
+    .check_nullable();
   Value(options, "prefix", base_name)
     .get(prefix)
     .check_nullable();
@@ -97,6 +100,7 @@ void Pack::reset() {
   m_timer_scheduled = false;
   m_message_starts = 0;
   m_message_ends = 0;
+  m_arrival_gap = 0;
 }
 
 void Pack::process(Event *evt) {
@@ -122,7 +126,12 @@ void Pack::process(Event *evt) {
   } else if (auto *end = evt->as<MessageEnd>()) {
     m_message_ends++;
     if (m_options.timeout > 0 || m_options.interval > 0) {
-      m_last_input_time = utils::now() / 1000;
+      auto now = utils::now() / 1000;
+      if (m_options.adaptive && m_last_input_time > 0) {
+        auto gap = now - m_last_input_time;
+        m_arrival_gap = (m_arrival_gap > 0 ? m_arrival_gap * 0.875 + gap * 0.125 : gap);
+      }
+      m_last_input_time = now;
     }
     if (
       (m_message_starts == m_message_ends && m_message_ends >= m_batch_size) ||
@@ -155,9 +164,23 @@ void Pack::flush(MessageEnd *end) {
   }
 }
 
+//
+// When adaptive, a batch waits no longer than about twice the average gap
+// between messages seen so far, since a message that hasn't come by then
+// most likely won't come before the configured timeout either.
+//
+
+auto Pack::timeout() const -> double {
+  auto t = m_options.timeout;
+  if (m_options.adaptive && m_arrival_gap > 0) {
+    t = std::min(t, std::max(m_arrival_gap * 2, 0.001));
+  }
+  return t;
+}
+
 void Pack::schedule_timeout() {
   if (!m_timer_scheduled && m_options.timeout > 0) {
-    auto precision = std::min(m_options.timeout, 1.0);
+    auto precision = std::min(timeout(), 1.0);
     m_timer.schedule(
       precision,
       [this]() {
@@ -173,7 +196,7 @@ void Pack::schedule_timeout() {
 void Pack::check_timeout() {
   if (m_message_ends > 0 && m_message_ends == m_message_starts) {
     auto now = utils::now() / 1000;
-    if (now - m_last_input_time >= m_options.timeout) {
+    if (now - m_last_input_time >= timeout()) {
       flush(MessageEnd::make());
     }
   }
@@ -46,6 +46,7 @@ public:
     double timeout = 5;
     double vacancy = 0.5;
     double interval = 5;
+    bool adaptive = false;
     pjs::Ref<pjs::Str> prefix;
     pjs::Ref<pjs::Str> postfix;
     pjs::Ref<pjs::Str> separator;
@@ -76,10 +77,12 @@ private:
   pjs::Ref<Data> m_buffer;
   Timer m_timer;
   bool m_timer_scheduled = false;
-  double m_last_input_time;
-  double m_last_flush_time;
+  double m_last_input_time = 0;
+  double m_last_flush_time = 0;
+  double m_arrival_gap = 0;
 
   void flush(MessageEnd *end);
+  auto timeout() const -> double;
   void schedule_timeout();
   void check_timeout();
 };
@@ -77,7 +77,7 @@ void Produce::produce() {
     if (!Filter::eval(m_producer, events)) break;
     if (events.is_promise()) {
       auto cb = PromiseCallback::make(this);
-      events.as<pjs::Promise>()->then(nullptr, cb->resolved(), cb->rejected());
+      events.as<pjs::Promise>()->then(cb);
       m_promise_callback = cb;
       break;
     }
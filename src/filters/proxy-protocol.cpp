@@ -27,6 +27,8 @@
 #include "data.hpp"
 #include "pipeline.hpp"
 #include "module.hpp"
+#include "context.hpp"
+#include "inbound.hpp"
 
 #define ASIO_STANDALONE
 #include <asio.hpp>
@@ -50,13 +52,6 @@ thread_local static pjs::ConstStr s_UNIX_DGRAM("UNIX_DGRAM");
 thread_local static pjs::ConstStr s_UNKNOWN("UNKNOWN");
 thread_local static pjs::ConstStr s_LOCAL("LOCAL");
 thread_local static pjs::ConstStr s_PROXY("PROXY");
-thread_local static pjs::ConstStr s_version("version");
-thread_local static pjs::ConstStr s_command("command");
-thread_local static pjs::ConstStr s_protocol("protocol");
-thread_local static pjs::ConstStr s_sourceAddress("sourceAddress");
-thread_local static pjs::ConstStr s_sourcePort("sourcePort");
-thread_local static pjs::ConstStr s_targetAddress("targetAddress");
-thread_local static pjs::ConstStr s_targetPort("targetPort");
 
 //
 // Server
@@ -93,6 +88,7 @@ void Server::reset() {
   m_header_read_ptr = 0;
   m_header_read_chr = 0;
   m_address_size_v2 = 0;
+  m_header_ext.clear();
   m_error = false;
 }
 
@@ -117,6 +113,8 @@ void Server::process(Event *evt) {
 
           if (m_header_read_ptr < sizeof(m_header)) {
             m_header[m_header_read_ptr] = c;
+          } else {
+            m_header_ext.push_back(c);
           }
 
           m_header_read_chr = c;
@@ -178,9 +176,9 @@ void Server::parse_header_v1() {
     return p;
   };
 
-  pjs::Value obj(pjs::Object::make());
-  obj.o()->set(s_version, m_version);
-  obj.o()->set(s_protocol, protocol.get());
+  HeaderInfo header;
+  header.version = m_version;
+  header.protocol = protocol;
 
   if (protocol != s_UNKNOWN) {
     uint8_t ip[16];
@@ -205,13 +203,14 @@ void Server::parse_header_v1() {
       }
     }
 
-    obj.o()->set(s_sourceAddress, pjs::Str::make(s[0], s[1] - s[0] - 1));
-    obj.o()->set(s_targetAddress, pjs::Str::make(s[1], s[2] - s[1] - 1));
-    obj.o()->set(s_sourcePort, std::atoi(s[2]));
-    obj.o()->set(s_targetPort, std::atoi(s[3]));
+    header.command = s_PROXY;
+    header.source_address.assign(s[0], s[1] - s[0] - 1);
+    header.target_address.assign(s[1], s[2] - s[1] - 1);
+    header.source_port = std::atoi(s[2]);
+    header.target_port = std::atoi(s[3]);
   }
 
-  start(obj);
+  start(header);
 }
 
 void Server::parse_header_v2() {
@@ -223,67 +222,108 @@ void Server::parse_header_v2() {
     return;
   }
 
-  pjs::Value obj(pjs::Object::make());
-  obj.o()->set(s_version, version);
+  HeaderInfo header;
+  header.version = version;
 
   switch (command) {
-    case 0: obj.o()->set(s_command, s_LOCAL.get()); break;
-    case 1: obj.o()->set(s_command, s_PROXY.get()); break;
+    case 0: header.command = s_LOCAL; break;
+    case 1: header.command = s_PROXY; break;
     default: error(); return;
   }
 
-  bool is_ipv6 = false;
-  bool is_unix = false;
+  int address_size = 0;
 
   switch (m_header[13]) {
-    case 0x00: obj.o()->set(s_protocol, s_UNKNOWN.get()); break;
-    case 0x11: obj.o()->set(s_protocol, s_TCP4.get()); break;
-    case 0x12: obj.o()->set(s_protocol, s_UDP4.get()); break;
-    case 0x21: obj.o()->set(s_protocol, s_TCP6.get()); is_ipv6 = true; break;
-    case 0x22: obj.o()->set(s_protocol, s_UDP6.get()); is_ipv6 = true; break;
-    case 0x31: obj.o()->set(s_protocol, s_UNIX.get()); is_unix = true; break;
-    case 0x32: obj.o()->set(s_protocol, s_UNIX_DGRAM.get()); is_unix = true; break;
+    case 0x00: header.protocol = s_UNKNOWN; break;
+    case 0x11: header.protocol = s_TCP4; address_size = 12; break;
+    case 0x12: header.protocol = s_UDP4; address_size = 12; break;
+    case 0x21: header.protocol = s_TCP6; address_size = 36; break;
+    case 0x22: header.protocol = s_UDP6; address_size = 36; break;
+    case 0x31: header.protocol = s_UNIX; address_size = 216; break;
+    case 0x32: header.protocol = s_UNIX_DGRAM; address_size = 216; break;
     default: error(); return;
   }
 
-  if (is_ipv6) {
-    auto p = (const uint8_t*)(m_header + 16);
+  if (address_size > m_address_size_v2) {
+    error();
+    return;
+  }
+
+  auto p = (const uint8_t*)(m_header + 16);
+
+  if (address_size == 36) {
     auto *src = reinterpret_cast<const std::array<uint8_t, 16>*>(p +  0);
     auto *dst = reinterpret_cast<const std::array<uint8_t, 16>*>(p + 16);
-    obj.o()->set(s_sourceAddress, pjs::Str::make(asio::ip::address_v6(*src).to_string()));
-    obj.o()->set(s_targetAddress, pjs::Str::make(asio::ip::address_v6(*dst).to_string()));
-    obj.o()->set(s_sourcePort, ((int)p[32] << 8) | p[33]);
-    obj.o()->set(s_targetPort, ((int)p[34] << 8) | p[35]);
-
-  } else if (is_unix) {
+    header.source_address = asio::ip::address_v6(*src).to_string();
+    header.target_address = asio::ip::address_v6(*dst).to_string();
+    header.source_port = ((int)p[32] << 8) | p[33];
+    header.target_port = ((int)p[34] << 8) | p[35];
 
-  } else {
-    auto p = (const uint8_t*)(m_header + 16);
+  } else if (address_size == 12) {
     char src_addr[100];
     char dst_addr[100];
     auto src_addr_size = std::snprintf(src_addr, sizeof(src_addr), "%d.%d.%d.%d", p[0], p[1], p[2], p[3]);
     auto dst_addr_size = std::snprintf(dst_addr, sizeof(dst_addr), "%d.%d.%d.%d", p[4], p[5], p[6], p[7]);
-    auto src_port = ((int)p[ 8] << 8) | p[ 9];
-    auto dst_port = ((int)p[10] << 8) | p[11];
-    obj.o()->set(s_sourceAddress, pjs::Str::make(src_addr, src_addr_size));
-    obj.o()->set(s_targetAddress, pjs::Str::make(dst_addr, dst_addr_size));
-    obj.o()->set(s_sourcePort, src_port);
-    obj.o()->set(s_targetPort, dst_port);
+    header.source_address.assign(src_addr, src_addr_size);
+    header.target_address.assign(dst_addr, dst_addr_size);
+    header.source_port = ((int)p[ 8] << 8) | p[ 9];
+    header.target_port = ((int)p[10] << 8) | p[11];
+  }
+
+  if (m_on_connect) {
+    auto tlv_start = 16 + address_size;
+    auto tlv_end = 16 + m_address_size_v2;
+    if (tlv_start < tlv_end) {
+      if (tlv_start < sizeof(m_header)) {
+        header.tlvs.assign(m_header + tlv_start, std::min(tlv_end, int(sizeof(m_header))) - tlv_start);
+        header.tlvs += m_header_ext;
+      } else {
+        header.tlvs = m_header_ext.substr(tlv_start - sizeof(m_header));
+      }
+    }
   }
 
-  start(obj);
+  start(header);
 }
 
-void Server::start(pjs::Value &obj) {
-  pjs::Value ret;
-  if (!Filter::callback(m_on_connect, 1, &obj, ret) || !ret.to_boolean()) {
-    error();
-    return;
+void Server::start(HeaderInfo &header) {
+  if (header.command == s_PROXY && !header.source_address.empty()) {
+    if (auto inbound = Filter::context()->inbound()) {
+      inbound->set_remote_address(header.source_address, header.source_port);
+      inbound->set_ori_dst_address(header.target_address, header.target_port);
+    }
   }
 
+  if (m_on_connect) {
+    pjs::Value arg(Header::make(std::move(header))), ret;
+    if (!Filter::callback(m_on_connect, 1, &arg, ret) || !ret.to_boolean()) {
+      error();
+      return;
+    }
+  }
+
+  m_header_ext.clear();
   m_pipeline = Filter::sub_pipeline(0, false, Filter::output())->start();
 }
 
+//
+// Header
+//
+
+auto Header::tlv(int type) -> Data* {
+  auto p = (const uint8_t *)tlvs.c_str();
+  size_t i = 0;
+  while (i + 3 <= tlvs.size()) {
+    auto t = p[i];
+    auto n = ((size_t)p[i+1] << 8) | p[i+2];
+    i += 3;
+    if (i + n > tlvs.size()) break;
+    if (t == type) return s_dp.make(p + i, n);
+    i += n;
+  }
+  return nullptr;
+}
+
 void Server::error() {
   Filter::output(StreamEnd::make());
   m_error = true;
@@ -438,3 +478,42 @@ void Client::process(Event *evt) {
 
 } // namespace proxy_protocol
 } // namespace pipy
+
+namespace pjs {
+
+using namespace pipy;
+using namespace pipy::proxy_protocol;
+
+template<> void ClassDef<Header>::init() {
+  accessor("version", [](Object *obj, Value &ret) { ret.set(obj->as<Header>()->version); });
+  accessor("command", [](Object *obj, Value &ret) { if (auto s = obj->as<Header>()->command.get()) ret.set(s); });
+  accessor("protocol", [](Object *obj, Value &ret) { ret.set(obj->as<Header>()->protocol.get()); });
+
+  accessor("sourceAddress", [](Object *obj, Value &ret) {
+    auto h = obj->as<Header>();
+    if (!h->source_address.empty()) ret.set(Str::make(h->source_address));
+  });
+
+  accessor("targetAddress", [](Object *obj, Value &ret) {
+    auto h = obj->as<Header>();
+    if (!h->target_address.empty()) ret.set(Str::make(h->target_address));
+  });
+
+  accessor("sourcePort", [](Object *obj, Value &ret) {
+    auto h = obj->as<Header>();
+    if (!h->source_address.empty()) ret.set(h->source_port);
+  });
+
+  accessor("targetPort", [](Object *obj, Value &ret) {
+    auto h = obj->as<Header>();
+    if (!h->target_address.empty()) ret.set(h->target_port);
+  });
+
+  method("tlv", [](Context &ctx, Object *obj, Value &ret) {
+    int type;
+    if (!ctx.arguments(1, &type)) return;
+    ret.set(obj->as<Header>()->tlv(type));
+  });
+}
+
+} // namespace pjs
@@ -27,18 +27,50 @@
 #define PROXY_PROTOCOL_HPP
 
 #include "filter.hpp"
+#include "data.hpp"
 
 namespace pipy {
 
 namespace proxy_protocol {
 
+//
+// Header
+//
+// What acceptProxyProtocol passes to its callback. Addresses stay as
+// native strings until read and TLVs are only looked up on request.
+//
+
+struct HeaderInfo {
+  int version = 0;
+  pjs::Ref<pjs::Str> command;
+  pjs::Ref<pjs::Str> protocol;
+  std::string source_address;
+  std::string target_address;
+  int source_port = 0;
+  int target_port = 0;
+  std::string tlvs;
+};
+
+class Header : public pjs::ObjectTemplate<Header>, public HeaderInfo {
+public:
+  auto tlv(int type) -> Data*;
+
+private:
+  Header(HeaderInfo &&info) : HeaderInfo(std::move(info)) {}
+
+  friend class pjs::ObjectTemplate<Header>;
+};
+
 //
 // Server
 //
+// Without a callback, no Header is made for scripts at all and only the
+// addresses of the Inbound are updated.
+//
 
 class Server : public Filter {
 public:
-  Server(pjs::Function *on_connect);
+  Server(pjs::Function *on_connect = nullptr);
 
 private:
   Server(const Server &r);
@@ -56,11 +88,12 @@ private:
   int m_header_read_chr = 0;
   int m_address_size_v2 = 0;
   char m_header[232];
+  std::string m_header_ext;
   bool m_error = false;
 
   void parse_header_v1();
   void parse_header_v2();
-  void start(pjs::Value &obj);
+  void start(HeaderInfo &header);
   void error();
 };
 
@@ -122,7 +122,7 @@ void Repeat::on_reply(Event *evt) {
           }
         }
       );
-      ret.as<pjs::Promise>()->then(nullptr, cb->resolved(), cb->rejected());
+      ret.as<pjs::Promise>()->then(cb);
       m_promise_cb = cb;
     } else if (ret.to_boolean()) {
       restart();
@@ -159,7 +159,7 @@ void Repeat::repeat() {
   p->start();
   m_buffer.iterate(
     [&](Event *evt) {
-      i->input(evt->clone());
+      i->input(evt->share());
     }
   );
 }
@@ -37,6 +37,9 @@ Replay::Options::Options(pjs::Object *options) {
     .get_seconds(delay)
     .get(delay_f)
     .check_nullable();
+  Value(options, "spillThreshold")
+    .get_binary_size(spill_threshold)
+    .check_nullable();
 }
 
 //
@@ -47,6 +50,7 @@ Replay::Replay(const Options &options)
   : m_options(options)
   , m_buffer(Filter::buffer_stats())
 {
+  m_buffer.set_threshold(options.spill_threshold);
 }
 
 Replay::Replay(const Replay &r)
@@ -148,7 +152,7 @@ void Replay::replay() {
   m_pipeline = sub_pipeline(0, false, EventSource::input())->start();
   m_buffer.iterate(
     [this](Event *evt) {
-      Filter::output(evt->clone(), m_pipeline->input());
+      Filter::output(evt->share(), m_pipeline->input());
     }
   );
 }
@@ -27,6 +27,7 @@
 #define REPLAY_HPP
 
 #include "filter.hpp"
+#include "buffer.hpp"
 #include "input.hpp"
 #include "timer.hpp"
 #include "options.hpp"
@@ -42,6 +43,7 @@ public:
   struct Options : public pipy::Options {
     double delay = 0;
     pjs::Ref<pjs::Function> delay_f;
+    size_t spill_threshold = 0;
     Options() {}
     Options(pjs::Object *options);
   };
@@ -63,7 +65,7 @@ private:
 
   Options m_options;
   pjs::Ref<Pipeline> m_pipeline;
-  EventBuffer m_buffer;
+  SpillBuffer m_buffer;
   Timer m_timer;
   bool m_replay_scheduled = false;
   bool m_paused = false;
@@ -0,0 +1,444 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "retry.hpp"
+#include "pipeline.hpp"
+#include "input.hpp"
+#include "message.hpp"
+#include "utils.hpp"
+#include "api/stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace pipy {
+
+static const size_t LATENCY_SAMPLES = 128;
+static const size_t LATENCY_SAMPLES_MIN = 20;
+
+static auto random_fraction() -> double {
+  thread_local static std::mt19937_64 rng(
+    ((uint64_t)std::random_device{}() << 32) ^ std::random_device{}()
+  );
+  return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Events other than HTTP requests have no method and count as idempotent
+static bool is_idempotent(Event *evt) {
+  auto *start = evt->as<MessageStart>();
+  if (!start || !start->head()) return true;
+  pjs::Value method;
+  start->head()->get("method", method);
+  if (!method.is_string()) return true;
+  const auto &s = method.s()->str();
+  return (
+    s == "GET" || s == "HEAD" || s == "OPTIONS" ||
+    s == "TRACE" || s == "PUT" || s == "DELETE"
+  );
+}
+
+//
+// Retry::Options
+//
+
+Retry::Options::Options(pjs::Object *options) {
+  Value(options, "maxRetries")
+    .get(max_retries)
+    .check_nullable();
+  Value(options, "backoff")
+    .get_seconds(backoff)
+    .check_nullable();
+  Value(options, "maxBackoff")
+    .get_seconds(max_backoff)
+    .check_nullable();
+  Value(options, "budget")
+    .get(budget)
+    .check_nullable();
+  Value(options, "minRetries")
+    .get(min_retries)
+    .check_nullable();
+  Value(options, "retryOn")
+    .get(retry_on_f)
+    .check_nullable();
+  Value(options, "retryNonIdempotent")
+    .get(retry_non_idempotent)
+    .check_nullable();
+  Value(options, "hedge")
+    .get(hedge)
+    .check_nullable();
+  Value(options, "hedgeDelay")
+    .get_seconds(hedge_delay)
+    .check_nullable();
+  Value(options, "name")
+    .get(name)
+    .check_nullable();
+
+  if (max_retries < 0) throw std::runtime_error("options.maxRetries cannot be negative");
+  if (min_retries < 0) throw std::runtime_error("options.minRetries cannot be negative");
+  if (budget < 0) throw std::runtime_error("options.budget cannot be negative");
+  if (max_backoff < backoff) max_backoff = backoff;
+}
+
+//
+// Retry
+//
+
+void Retry::init_metrics() {
+  pjs::Ref<pjs::Array> label_names = pjs::Array::make();
+  label_names->length(1);
+  label_names->set(0, "name");
+
+  auto define_gauge = [&](const char *name, int (*get)(Budget*)) {
+    stats::Gauge::make(
+      pjs::Str::make(name),
+      label_names,
+      [=](stats::Gauge *gauge) {
+        double total = 0;
+        for (auto *b = Budget::all().head(); b; b = b->next()) {
+          auto n = get(b);
+          if (auto name = b->name()) {
+            gauge->with_labels(&name, 1)->set(n);
+          }
+          total += n;
+        }
+        gauge->set(total);
+      }
+    );
+  };
+
+  auto define_counter = [&](const char *name, int Budget::* count) {
+    stats::Counter::make(
+      pjs::Str::make(name),
+      label_names,
+      [=](stats::Counter *counter) {
+        for (auto *b = Budget::all().head(); b; b = b->next()) {
+          auto n = b->*count;
+          b->*count = 0;
+          if (!n) continue;
+          if (auto name = b->name()) {
+            counter->with_labels(&name, 1)->increase(n);
+          }
+          counter->increase(n);
+        }
+      }
+    );
+  };
+
+  define_gauge("pipy_retry_active", [](Budget *b) { return b->active(); });
+  define_gauge("pipy_retry_retrying", [](Budget *b) { return b->retrying(); });
+  define_counter("pipy_retry_requests", &Budget::m_requests);
+  define_counter("pipy_retry_retries", &Budget::m_retries);
+  define_counter("pipy_retry_budget_exhausted", &Budget::m_exhausted);
+  define_counter("pipy_retry_hedges", &Budget::m_hedges);
+  define_counter("pipy_retry_hedge_wins", &Budget::m_hedge_wins);
+}
+
+Retry::Retry(pjs::Object *options)
+  : m_budget(new Budget(Options(options)))
+  , m_buffer(Filter::buffer_stats())
+{
+}
+
+Retry::Retry(const Retry &r)
+  : Filter(r)
+  , m_budget(r.m_budget)
+  , m_buffer(r.m_buffer)
+{
+}
+
+Retry::~Retry()
+{
+}
+
+void Retry::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "retry";
+  d.out_type = Dump::OUTPUT_FROM_SUBS;
+}
+
+auto Retry::clone() -> Filter* {
+  return new Retry(*this);
+}
+
+void Retry::reset() {
+  Filter::reset();
+  finish();
+  while (auto *a = m_attempts.head()) abandon(a);
+  while (auto *a = m_dead.head()) {
+    m_dead.remove(a);
+    delete a;
+  }
+  m_buffer.clear();
+  m_backoff_timer.cancel();
+  m_hedge_timer.cancel();
+  m_winner = nullptr;
+  m_request_time = 0;
+  m_retries = 0;
+  m_idempotent = true;
+  m_request_ended = false;
+}
+
+void Retry::process(Event *evt) {
+  if (m_winner) {
+    Filter::output(evt, m_winner->pipeline->input());
+    return;
+  }
+
+  m_buffer.push(evt);
+
+  if (!m_started) {
+    m_started = true;
+    m_idempotent = is_idempotent(evt);
+    m_budget->start();
+    launch(false);
+  } else {
+    for (auto *a = m_attempts.head(); a; ) {
+      auto *next = a->next();
+      Filter::output(evt->share(), a->pipeline->input());
+      a = next;
+    }
+  }
+
+  if (!m_request_ended && (evt->is<MessageEnd>() || evt->is<StreamEnd>())) {
+    m_request_ended = true;
+    m_request_time = utils::now();
+    schedule_hedge();
+  }
+}
+
+void Retry::launch(bool is_hedge) {
+  while (auto *a = m_dead.head()) {
+    m_dead.remove(a);
+    delete a;
+  }
+
+  auto *a = new Attempt(this, is_hedge);
+  m_attempts.push(a);
+  a->pipeline = sub_pipeline(0, false, a->input())->start();
+  m_buffer.iterate(
+    [&](Event *evt) {
+      if (a->abandoned) return;
+      Filter::output(evt->share(), a->pipeline->input());
+    }
+  );
+}
+
+//
+// Attempts are not freed right away since the one being abandoned
+// might well be the one that is calling back into us right now.
+//
+
+void Retry::abandon(Attempt *a) {
+  a->abandoned = true;
+  a->close();
+  a->pipeline->chain(EventTarget::Input::dummy());
+  m_attempts.remove(a);
+  m_dead.push(a);
+}
+
+void Retry::finish() {
+  if (m_budget_held) {
+    m_budget_held = false;
+    m_budget->release();
+  }
+  if (m_started) {
+    m_started = false;
+    m_budget->end();
+  }
+}
+
+bool Retry::retryable(Event *evt) {
+  const auto &options = m_budget->options();
+  if (auto *f = options.retry_on_f.get()) {
+    pjs::Value arg(evt), ret;
+    if (auto *start = evt->as<MessageStart>()) arg.set(start->head());
+    if (!Filter::callback(f, 1, &arg, ret)) return false;
+    return ret.to_boolean();
+  }
+  if (evt->is<StreamEnd>()) return true;
+  if (auto *start = evt->as<MessageStart>()) {
+    if (auto *head = start->head()) {
+      pjs::Value status;
+      head->get("status", status);
+      if (status.is_number()) {
+        auto n = int(status.n());
+        return n == 502 || n == 503 || n == 504;
+      }
+    }
+  }
+  return false;
+}
+
+bool Retry::schedule_retry() {
+  const auto &options = m_budget->options();
+  if (!m_idempotent && !options.retry_non_idempotent) return false;
+  if (m_retries >= options.max_retries) return false;
+  if (!m_budget_held) {
+    if (!m_budget->acquire()) {
+      m_budget->m_exhausted++;
+      return false;
+    }
+    m_budget_held = true;
+  }
+
+  m_hedge_timer.cancel();
+  m_budget->m_retries++;
+
+  auto cap = std::min(options.max_backoff, options.backoff * std::pow(2.0, m_retries++));
+  m_backoff_timer.schedule(
+    cap * random_fraction(),
+    [this]() {
+      InputContext ic;
+      launch(false);
+    }
+  );
+
+  return true;
+}
+
+void Retry::schedule_hedge() {
+  const auto &options = m_budget->options();
+  if (!options.hedge) return;
+  if (!m_idempotent && !options.retry_non_idempotent) return;
+  if (m_winner || m_retries > 0) return;
+  if (m_attempts.size() != 1) return;
+
+  auto delay = options.hedge_delay;
+  if (delay <= 0) delay = m_budget->hedge_delay();
+  if (delay <= 0) return;
+
+  m_hedge_timer.schedule(
+    delay,
+    [this]() {
+      InputContext ic;
+      if (m_winner || m_attempts.size() != 1) return;
+      if (!m_budget_held) {
+        if (!m_budget->acquire()) {
+          m_budget->m_exhausted++;
+          return;
+        }
+        m_budget_held = true;
+      }
+      m_budget->m_hedges++;
+      launch(true);
+    }
+  );
+}
+
+void Retry::on_attempt_reply(Attempt *a, Event *evt) {
+  if (m_winner) {
+    if (a == m_winner) {
+      if (evt->is<MessageEnd>() || evt->is<StreamEnd>()) finish();
+      Filter::output(evt);
+    }
+    return;
+  }
+
+  if (evt->is<MessageStart>() || evt->is<StreamEnd>()) {
+    if (retryable(evt)) {
+      if (m_attempts.size() > 1 || schedule_retry()) {
+        abandon(a);
+        return;
+      }
+    }
+  }
+
+  m_winner = a;
+  m_backoff_timer.cancel();
+  m_hedge_timer.cancel();
+  while (auto *p = m_attempts.head()) {
+    if (p == a) {
+      m_attempts.remove(a);
+    } else {
+      abandon(p);
+    }
+  }
+  m_attempts.push(a);
+  m_buffer.clear();
+
+  if (a->is_hedge()) m_budget->m_hedge_wins++;
+  if (m_request_time > 0) m_budget->sample(utils::now() - m_request_time);
+  if (m_budget_held) {
+    m_budget_held = false;
+    m_budget->release();
+  }
+
+  if (evt->is<MessageEnd>() || evt->is<StreamEnd>()) finish();
+  Filter::output(evt);
+}
+
+//
+// Retry::Budget
+//
+
+thread_local List<Retry::Budget> Retry::Budget::s_all;
+
+Retry::Budget::Budget(const Options &options)
+  : m_options(options)
+  , m_samples(LATENCY_SAMPLES)
+{
+  s_all.push(this);
+}
+
+Retry::Budget::~Budget() {
+  s_all.remove(this);
+}
+
+bool Retry::Budget::acquire() {
+  auto limit = std::max(m_options.min_retries, int(m_active * m_options.budget / 100));
+  if (m_retrying >= limit) return false;
+  m_retrying++;
+  return true;
+}
+
+void Retry::Budget::sample(double t) {
+  m_samples[m_sample_index] = t;
+  m_sample_index = (m_sample_index + 1) % m_samples.size();
+  if (m_sample_count < m_samples.size()) m_sample_count++;
+  m_p95_dirty = true;
+}
+
+auto Retry::Budget::hedge_delay() -> double {
+  if (m_sample_count < LATENCY_SAMPLES_MIN) return 0;
+  if (m_p95_dirty) {
+    std::vector<double> sorted(m_samples.begin(), m_samples.begin() + m_sample_count);
+    auto nth = sorted.begin() + (m_sample_count * 95 / 100);
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    m_p95 = *nth;
+    m_p95_dirty = false;
+  }
+  return m_p95 / 1000;
+}
+
+//
+// Retry::Attempt
+//
+
+void Retry::Attempt::on_event(Event *evt) {
+  m_retry->on_attempt_reply(this, evt);
+}
+
+} // namespace pipy
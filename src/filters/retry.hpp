@@ -0,0 +1,182 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RETRY_HPP
+#define RETRY_HPP
+
+#include "filter.hpp"
+#include "buffer.hpp"
+#include "list.hpp"
+#include "timer.hpp"
+#include "options.hpp"
+
+#include <vector>
+
+namespace pipy {
+
+//
+// Retry
+//
+// Sends a request down a fresh sub-pipeline for every attempt, buffering
+// it for the retries. Failed attempts are retried after a randomized
+// exponential backoff, as long as the budget allows: retries in flight
+// may not exceed a percentage of the requests in flight, so that retries
+// cannot multiply the load on an upstream that is already failing. With
+// hedging, a second attempt is started when no response has come back
+// by the 95th percentile of recent response times, and whichever answers
+// first wins while the other is dropped. Requests with non-idempotent
+// methods get neither retries nor hedges unless told otherwise.
+//
+
+class Retry : public Filter {
+public:
+  struct Options : public pipy::Options {
+    int max_retries = 2;
+    double backoff = 0.025;
+    double max_backoff = 1;
+    double budget = 20; // percentage of requests in flight
+    int min_retries = 3;
+    bool hedge = false;
+    double hedge_delay = 0;
+    pjs::Ref<pjs::Function> retry_on_f;
+    bool retry_non_idempotent = false;
+    pjs::Ref<pjs::Str> name;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  static void init_metrics();
+
+  Retry(pjs::Object *options);
+
+private:
+  Retry(const Retry &r);
+  ~Retry();
+
+  //
+  // Retry::Budget
+  //
+  // Shared by all instances cloned from the same filter on one thread.
+  //
+
+  class Budget :
+    public pjs::RefCount<Budget>,
+    public List<Budget>::Item
+  {
+  public:
+    Budget(const Options &options);
+    ~Budget();
+
+    auto options() const -> const Options& { return m_options; }
+    auto name() const -> pjs::Str* { return m_options.name; }
+    auto active() const -> int { return m_active; }
+    auto retrying() const -> int { return m_retrying; }
+
+    void start() { m_active++; m_requests++; }
+    void end() { m_active--; }
+    bool acquire();
+    void release() { m_retrying--; }
+    void sample(double t);
+    auto hedge_delay() -> double;
+
+    static auto all() -> List<Budget>& { return s_all; }
+
+  private:
+    Options m_options;
+    int m_active = 0;
+    int m_retrying = 0;
+    std::vector<double> m_samples;
+    size_t m_sample_index = 0;
+    size_t m_sample_count = 0;
+    double m_p95 = 0;
+    bool m_p95_dirty = true;
+
+    // Counted since the last time metrics were collected
+    int m_requests = 0;
+    int m_retries = 0;
+    int m_exhausted = 0;
+    int m_hedges = 0;
+    int m_hedge_wins = 0;
+
+    thread_local static List<Budget> s_all;
+
+    friend class Retry;
+  };
+
+  //
+  // Retry::Attempt
+  //
+
+  class Attempt :
+    public pjs::Pooled<Attempt>,
+    public List<Attempt>::Item,
+    public EventTarget
+  {
+  public:
+    Attempt(Retry *retry, bool is_hedge) : m_retry(retry), m_is_hedge(is_hedge) {}
+
+    pjs::Ref<Pipeline> pipeline;
+    bool abandoned = false;
+
+    bool is_hedge() const { return m_is_hedge; }
+
+  private:
+    Retry* m_retry;
+    bool m_is_hedge;
+
+    virtual void on_event(Event *evt) override;
+  };
+
+  pjs::Ref<Budget> m_budget;
+  EventBuffer m_buffer;
+  List<Attempt> m_attempts;
+  List<Attempt> m_dead;
+  Attempt* m_winner = nullptr;
+  Timer m_backoff_timer;
+  Timer m_hedge_timer;
+  double m_request_time = 0;
+  int m_retries = 0;
+  bool m_started = false;
+  bool m_idempotent = true;
+  bool m_request_ended = false;
+  bool m_budget_held = false;
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  void launch(bool is_hedge);
+  void abandon(Attempt *attempt);
+  void finish();
+  bool retryable(Event *evt);
+  bool schedule_retry();
+  void schedule_hedge();
+  void on_attempt_reply(Attempt *attempt, Event *evt);
+};
+
+} // namespace pipy
+
+#endif // RETRY_HPP
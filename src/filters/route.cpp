@@ -0,0 +1,149 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "route.hpp"
+#include "context.hpp"
+#include "pipeline.hpp"
+#include "api/pipeline-api.hpp"
+#include "log.hpp"
+
+namespace pipy {
+
+//
+// Route
+//
+
+Route::Route(algo::RouteTable *table, pjs::Object *pipelines)
+  : m_table(table)
+  , m_pipelines(pipelines)
+  , m_buffer(Filter::buffer_stats())
+{
+}
+
+Route::Route(const Route &r)
+  : Filter(r)
+  , m_table(r.m_table)
+  , m_pipelines(r.m_pipelines)
+  , m_buffer(r.m_buffer)
+{
+}
+
+Route::~Route()
+{
+}
+
+void Route::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "route";
+}
+
+auto Route::clone() -> Filter* {
+  return new Route(*this);
+}
+
+void Route::reset() {
+  Filter::reset();
+  m_buffer.clear();
+  m_pipeline = nullptr;
+  m_chosen = false;
+}
+
+void Route::process(Event *evt) {
+  if (!m_chosen) {
+    if (auto start = evt->as<MessageStart>()) {
+      m_chosen = true;
+      if (!choose(start)) {
+        m_buffer.clear();
+        return;
+      }
+      if (auto *p = m_pipeline.get()) {
+        m_buffer.flush([&](Event *evt) { output(evt, p->input()); });
+      } else {
+        m_buffer.flush([&](Event *evt) { output(evt); });
+      }
+    } else if (evt->is<StreamEnd>()) {
+      m_chosen = true;
+      m_buffer.flush([&](Event *evt) { output(evt); });
+    } else {
+      m_buffer.push(evt);
+      return;
+    }
+  }
+
+  if (auto *p = m_pipeline.get()) {
+    output(evt, p->input());
+  } else {
+    output(evt);
+  }
+}
+
+bool Route::choose(MessageStart *start) {
+  thread_local static pjs::ConstStr s_pipeline("pipeline");
+
+  auto *ctx = context();
+  algo::RouteTable::Result r;
+  if (!m_table->find(*ctx, start->head(), r)) {
+    if (ctx->ok()) return true;
+    Log::pjs_error(ctx->error());
+    Filter::error(pjs::Error::make(ctx->error()));
+    ctx->reset();
+    return false;
+  }
+
+  pjs::Value name;
+  r.route->get(s_pipeline, name);
+  if (name.is_nullish()) return true;
+
+  PipelineLayout *layout = nullptr;
+  if (name.is<PipelineLayoutWrapper>()) {
+    layout = name.as<PipelineLayoutWrapper>()->get();
+  } else {
+    pjs::Value v;
+    auto s = name.to_string();
+    if (m_pipelines && m_pipelines->get(s, v) && v.is<PipelineLayoutWrapper>()) {
+      layout = v.as<PipelineLayoutWrapper>()->get();
+    } else {
+      Filter::error("pipeline '%s' not found", s->c_str());
+    }
+    s->release();
+  }
+
+  if (!layout) return false;
+
+  auto p = Pipeline::make(layout, ctx);
+  auto q = Filter::pipeline();
+  p->chain(q->chain(), q->chain_args());
+  p->chain(Filter::output());
+  m_pipeline = p;
+
+  pjs::Value args[3];
+  if (r.upstream) args[0].set(r.upstream.get());
+  args[1].set(r.route.get());
+  if (r.params) args[2].set(r.params.get());
+  p->start(3, args);
+  return true;
+}
+
+} // namespace pipy
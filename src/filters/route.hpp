@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ROUTE_HPP
+#define ROUTE_HPP
+
+#include "filter.hpp"
+#include "buffer.hpp"
+#include "api/algo.hpp"
+
+namespace pipy {
+
+//
+// Route
+//
+// Picks a route for the first message of a stream from a RouteTable and
+// pipes the stream to the pipeline named by the route, started with the
+// chosen upstream, the route and the path parameters as arguments.
+// Streams without a route, or whose route names no pipeline, go on to
+// the next filter.
+//
+
+class Route : public Filter {
+public:
+  Route(algo::RouteTable *table, pjs::Object *pipelines);
+
+private:
+  Route(const Route &r);
+  ~Route();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  pjs::Ref<algo::RouteTable> m_table;
+  pjs::Ref<pjs::Object> m_pipelines;
+  pjs::Ref<Pipeline> m_pipeline;
+  EventBuffer m_buffer;
+  bool m_chosen = false;
+
+  bool choose(MessageStart *start);
+};
+
+} // namespace pipy
+
+#endif // ROUTE_HPP
@@ -33,6 +33,35 @@ namespace socks {
 
 static Data::Producer s_dp("SOCKS");
 
+thread_local static pjs::ConstStr s_connect("connect");
+thread_local static pjs::ConstStr s_associate("associate");
+
+//
+// Writes ATYP, DST.ADDR and DST.PORT for a host and port
+// Returns the number of bytes written or 0 if the host is invalid
+//
+
+static auto write_address(uint8_t *buf, const std::string &host, int port) -> size_t {
+  size_t n;
+  if (utils::get_ip_v4(host, buf + 1)) {
+    buf[0] = 0x01;
+    n = 1 + 4;
+  } else if (utils::get_ip_v6(host, buf + 1)) {
+    buf[0] = 0x04;
+    n = 1 + 16;
+  } else if (0 < host.length() && host.length() <= 255) {
+    buf[0] = 0x03;
+    buf[1] = host.length();
+    std::memcpy(buf + 2, host.c_str(), host.length());
+    n = 2 + host.length();
+  } else {
+    return 0;
+  }
+  buf[n+0] = (port >> 8) & 0xff;
+  buf[n+1] = (port >> 0) & 0xff;
+  return n + 2;
+}
+
 //
 // Server
 //
@@ -68,6 +97,7 @@ void Server::reset() {
   m_pipeline = nullptr;
   m_id = nullptr;
   m_domain = nullptr;
+  m_command = 0;
   m_port = 0;
   m_read_ptr = 0;
 }
@@ -161,9 +191,10 @@ auto Server::on_state(int state, int c) -> int {
     case READ_SOCKS5_CMD:
       if (
         m_buffer[0] == 0x05 &&
-        m_buffer[1] == 0x01 &&
+        (m_buffer[1] == 0x01 || m_buffer[1] == 0x03) &&
         m_buffer[2] == 0x00
       ) {
+        m_command = m_buffer[1];
         return READ_SOCKS5_ADDR_TYPE;
       } else {
         reply(5, 0x01);
@@ -218,6 +249,8 @@ bool Server::start(int version) {
   req->id = m_id;
   req->port = m_port;
 
+  req->command = (m_command == 0x03 ? s_associate : s_connect);
+
   if (m_domain) {
     req->domain = m_domain;
   } else {
@@ -233,22 +266,51 @@ bool Server::start(int version) {
     return false;
   }
 
-  reply(version, (version == 4 ? 0x5a : 0x00));
+  //
+  // For UDP ASSOCIATE, the callback returns the address of the relay
+  // where the client sends its datagrams. The sub-pipeline still gets
+  // the TCP connection, which keeps the association alive until closed.
+  //
+
+  if (m_command == 0x03) {
+    std::string host; int port;
+    uint8_t buf[1+1+255+2];
+    if (ret.is_string() && (
+      !utils::get_host_port(ret.s()->str(), host, port) ||
+      !write_address(buf, host, port)
+    )) {
+      Filter::error("invalid relay address: %s", ret.s()->c_str());
+      return false;
+    }
+    reply(version, 0x00, ret);
+  } else {
+    reply(version, (version == 4 ? 0x5a : 0x00));
+  }
   m_pipeline = Filter::sub_pipeline(0, false, Filter::output())->start();
   return true;
 }
 
-void Server::reply(int version, int code) {
+void Server::reply(int version, int code, const pjs::Value &bind) {
   if (version == 4) {
     uint8_t buf[8] = { 0 };
     buf[1] = code;
     Filter::output(s_dp.make(buf, sizeof(buf)));
   } else {
-    uint8_t buf[10] = { 0 };
+    uint8_t buf[3+1+1+255+2] = { 0 };
+    size_t len = 0;
     buf[0] = 0x05;
     buf[1] = code;
-    buf[3] = 0x01;
-    Filter::output(s_dp.make(buf, sizeof(buf)));
+    if (bind.is_string()) {
+      std::string host; int port;
+      if (utils::get_host_port(bind.s()->str(), host, port)) {
+        len = write_address(buf + 3, host, port);
+      }
+    }
+    if (!len) {
+      buf[3] = 0x01;
+      len = 1 + 4 + 2;
+    }
+    Filter::output(s_dp.make(buf, 3 + len));
   }
 }
 
@@ -289,13 +351,16 @@ void Client::reset() {
   m_pipeline = nullptr;
   m_eos = nullptr;
   m_is_started = false;
+  m_has_error = false;
 }
 
 void Client::process(Event *evt) {
   if (!m_pipeline) {
-    m_pipeline = sub_pipeline(0, false, EventSource::reply())->start();
-    uint8_t greeting[] = { 0x05, 1, 0 };
-    Filter::output(s_dp.make(greeting, sizeof(greeting)), m_pipeline->input());
+    if (m_has_error) return;
+    if (!start()) {
+      m_has_error = true;
+      return;
+    }
   }
 
   if (m_is_started) {
@@ -329,10 +394,8 @@ auto Client::on_state(int state, int c) -> int {
         m_read_buffer[0] == 0x05 &&
         m_read_buffer[1] == 0x00
       ) {
-        if (start()) {
-          Deframer::read(3, m_read_buffer);
-          return STATE_READ_CONN_HEAD;
-        }
+        Deframer::read(3, m_read_buffer);
+        return STATE_READ_CONN_HEAD;
       }
       break;
     case STATE_READ_CONN_HEAD:
@@ -370,6 +433,13 @@ void Client::on_pass(Data &data) {
   Filter::output(Data::make(std::move(data)));
 }
 
+//
+// Only "no authentication" is offered, so the CONNECT request can go
+// out together with the greeting instead of waiting a round trip for
+// the method selection. This is what makes a SOCKS hop cost one round
+// trip on top of the TCP handshake.
+//
+
 bool Client::start() {
   pjs::Value target;
   if (!eval(m_target, target)) return false;
@@ -384,40 +454,154 @@ bool Client::start() {
     return false;
   }
 
-  size_t len = 0;
-  uint8_t buf[300];
+  uint8_t buf[3+3+1+1+255+2];
   buf[0] = 0x05;
-  buf[1] = 0x01;
-  buf[2] = 0x00;
-
-  if (utils::get_ip_v4(host, buf + 4)) {
-    buf[3] = 0x01;
-    buf[8] = (port >> 8) & 0xff;
-    buf[9] = (port >> 0) & 0xff;
-    len = 4 + 4 + 2;
-  } else if (utils::get_ip_v6(host, buf + 4)) {
-    buf[3] = 0x04;
-    buf[20] = (port >> 8) & 0xff;
-    buf[21] = (port >> 0) & 0xff;
-    len = 4 + 16 + 2;
-  } else {
-    if (host.length() > 255) {
-      Filter::error("domain name too long: %s", host.c_str());
-      return false;
-    }
-    auto n = host.length();
-    buf[3] = 0x03;
-    buf[4] = n;
-    std::memcpy(buf + 5, host.c_str(), n);
-    buf[5 + n] = (port >> 8) & 0xff;
-    buf[6 + n] = (port >> 0) & 0xff;
-    len = 5 + n + 2;
+  buf[1] = 1;
+  buf[2] = 0;
+  buf[3] = 0x05;
+  buf[4] = 0x01;
+  buf[5] = 0x00;
+
+  auto len = write_address(buf + 6, host, port);
+  if (!len) {
+    Filter::error("invalid host: %s", host.c_str());
+    return false;
   }
 
-  Filter::output(s_dp.make(buf, len), m_pipeline->input());
+  m_pipeline = sub_pipeline(0, false, EventSource::reply())->start();
+  Filter::output(s_dp.make(buf, 6 + len), m_pipeline->input());
   return true;
 }
 
+//
+// DatagramDecoder
+//
+
+auto DatagramDecoder::clone() -> Filter* {
+  return new DatagramDecoder(*this);
+}
+
+void DatagramDecoder::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "decodeSOCKSDatagram";
+}
+
+void DatagramDecoder::process(Event *evt) {
+  if (auto data = evt->as<Data>()) {
+    if (data->size() < 4) return;
+
+    Data payload(*data);
+    uint8_t hdr[4];
+    payload.shift(4, hdr);
+    if (hdr[2] != 0) return; // FRAG
+
+    auto head = DatagramHead::make();
+    uint8_t addr[256+2];
+    switch (hdr[3]) {
+      case 0x01: {
+        if (payload.size() < 4 + 2) return;
+        payload.shift(4 + 2, addr);
+        char str[100];
+        auto len = std::snprintf(str, sizeof(str), "%d.%d.%d.%d", addr[0], addr[1], addr[2], addr[3]);
+        head->ip = pjs::Str::make(str, len);
+        head->port = ((int)addr[4] << 8) | addr[5];
+        break;
+      }
+      case 0x04: {
+        if (payload.size() < 16 + 2) return;
+        payload.shift(16 + 2, addr);
+        char str[100];
+        auto len = std::snprintf(
+          str, sizeof(str), "%x:%x:%x:%x:%x:%x:%x:%x",
+          ((int)addr[ 0] << 8) | addr[ 1],
+          ((int)addr[ 2] << 8) | addr[ 3],
+          ((int)addr[ 4] << 8) | addr[ 5],
+          ((int)addr[ 6] << 8) | addr[ 7],
+          ((int)addr[ 8] << 8) | addr[ 9],
+          ((int)addr[10] << 8) | addr[11],
+          ((int)addr[12] << 8) | addr[13],
+          ((int)addr[14] << 8) | addr[15]
+        );
+        head->ip = pjs::Str::make(str, len);
+        head->port = ((int)addr[16] << 8) | addr[17];
+        break;
+      }
+      case 0x03: {
+        if (payload.size() < 1) return;
+        payload.shift(1, addr);
+        auto n = addr[0];
+        if (payload.size() < n + 2) return;
+        payload.shift(n + 2, addr);
+        head->domain = pjs::Str::make((char*)addr, n);
+        head->port = ((int)addr[n] << 8) | addr[n+1];
+        break;
+      }
+      default: return;
+    }
+
+    Filter::output(MessageStart::make(head));
+    Filter::output(Data::make(std::move(payload)));
+    Filter::output(MessageEnd::make());
+
+  } else if (evt->is<StreamEnd>()) {
+    Filter::output(evt);
+  }
+}
+
+//
+// DatagramEncoder
+//
+
+auto DatagramEncoder::clone() -> Filter* {
+  return new DatagramEncoder(*this);
+}
+
+void DatagramEncoder::reset() {
+  Filter::reset();
+  m_head = nullptr;
+  m_buffer.clear();
+  m_started = false;
+}
+
+void DatagramEncoder::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "encodeSOCKSDatagram";
+}
+
+void DatagramEncoder::process(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    if (!m_started) {
+      m_started = true;
+      m_head = pjs::coerce<DatagramHead>(start->head());
+      m_buffer.clear();
+    }
+
+  } else if (auto data = evt->as<Data>()) {
+    if (m_started) {
+      m_buffer.push(*data);
+    }
+
+  } else if (evt->is<MessageEnd>()) {
+    if (m_started) {
+      m_started = false;
+      auto host = m_head->domain ? m_head->domain.get() : m_head->ip.get();
+      uint8_t hdr[3+1+1+255+2] = { 0 };
+      auto len = write_address(hdr + 3, host ? host->str() : "0.0.0.0", m_head->port);
+      if (len > 0) {
+        Data buf;
+        s_dp.push(&buf, hdr, 3 + len);
+        buf.push(std::move(m_buffer));
+        Filter::output(Data::make(std::move(buf)));
+      }
+      m_head = nullptr;
+      m_buffer.clear();
+    }
+
+  } else if (evt->is<StreamEnd>()) {
+    Filter::output(evt);
+  }
+}
+
 } // namespace socks
 } // namespace pipy
 
@@ -426,10 +610,17 @@ namespace pjs {
 using namespace pipy::socks;
 
 template<> void ClassDef<Server::Request>::init() {
+  field<pjs::Ref<pjs::Str>>("command", [](Server::Request *obj) { return &obj->command; });
   field<pjs::Ref<pjs::Str>>("id", [](Server::Request *obj) { return &obj->id; });
   field<pjs::Ref<pjs::Str>>("ip", [](Server::Request *obj) { return &obj->ip; });
   field<pjs::Ref<pjs::Str>>("domain", [](Server::Request *obj) { return &obj->domain; });
   field<int>("port", [](Server::Request *obj) { return &obj->port; });
 }
 
+template<> void ClassDef<DatagramHead>::init() {
+  field<pjs::Ref<pjs::Str>>("ip", [](DatagramHead *obj) { return &obj->ip; });
+  field<pjs::Ref<pjs::Str>>("domain", [](DatagramHead *obj) { return &obj->domain; });
+  field<int>("port", [](DatagramHead *obj) { return &obj->port; });
+}
+
 } // namespace pjs
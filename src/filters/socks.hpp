@@ -45,6 +45,7 @@ public:
   //
 
   struct Request : public pjs::ObjectTemplate<Request> {
+    pjs::Ref<pjs::Str> command;
     pjs::Ref<pjs::Str> id;
     pjs::Ref<pjs::Str> ip;
     pjs::Ref<pjs::Str> domain;
@@ -94,11 +95,12 @@ private:
   uint8_t m_ip[4];
   pjs::Ref<pjs::Str> m_id;
   pjs::Ref<pjs::Str> m_domain;
+  int m_command = 0;
   int m_port = 0;
   int m_read_ptr = 0;
 
   bool start(int version);
-  void reply(int version, int code);
+  void reply(int version, int code, const pjs::Value &bind = pjs::Value::undefined);
 };
 
 //
@@ -135,10 +137,62 @@ private:
   Data m_buffer;
   uint8_t m_read_buffer[256+2];
   bool m_is_started = false;
+  bool m_has_error = false;
 
   bool start();
 };
 
+//
+// DatagramHead
+//
+
+struct DatagramHead : public pjs::ObjectTemplate<DatagramHead> {
+  pjs::Ref<pjs::Str> ip;
+  pjs::Ref<pjs::Str> domain;
+  int port = 0;
+};
+
+//
+// DatagramDecoder
+//
+// Each input Data is one UDP datagram sent by a client to the relay of
+// a UDP ASSOCIATE. Its SOCKS5 UDP request header goes into the head of
+// the output Message. Fragmented datagrams are dropped.
+//
+
+class DatagramDecoder : public Filter {
+public:
+  DatagramDecoder() {}
+
+private:
+  DatagramDecoder(const DatagramDecoder &r) : Filter(r) {}
+
+  virtual auto clone() -> Filter* override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+};
+
+//
+// DatagramEncoder
+//
+
+class DatagramEncoder : public Filter {
+public:
+  DatagramEncoder() {}
+
+private:
+  DatagramEncoder(const DatagramEncoder &r) : Filter(r) {}
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  pjs::Ref<DatagramHead> m_head;
+  Data m_buffer;
+  bool m_started = false;
+};
+
 } // namespace socks
 } // namespace pipy
 
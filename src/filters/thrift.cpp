@@ -32,12 +32,22 @@ namespace thrift {
 // Decoder
 //
 
-Decoder::Decoder()
+Decoder::Options::Options(pjs::Object *options) {
+  Value(options, "headersOnly")
+    .get(headers_only)
+    .check_nullable();
+}
+
+Decoder::Decoder(const Options &options)
+  : Thrift::Parser(options.headers_only)
+  , m_options(options)
 {
 }
 
 Decoder::Decoder(const Decoder &r)
   : Filter(r)
+  , Thrift::Parser(r.m_options.headers_only)
+  , m_options(r.m_options)
 {
 }
 
@@ -27,6 +27,7 @@
 #define THRIFT_HPP
 
 #include "filter.hpp"
+#include "options.hpp"
 #include "api/thrift.hpp"
 
 namespace pipy {
@@ -38,7 +39,13 @@ namespace thrift {
 
 class Decoder : public Filter, public Thrift::Parser {
 public:
-  Decoder();
+  struct Options : public pipy::Options {
+    bool headers_only = false;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  Decoder(const Options &options);
 
 private:
   Decoder(const Decoder &r);
@@ -49,6 +56,8 @@ private:
   virtual void process(Event *evt) override;
   virtual void dump(Dump &d) override;
 
+  Options m_options;
+
   virtual void on_pass(Data &data) override;
   virtual void on_message_start() override;
   virtual void on_message_end(Thrift::Message *msg) override;
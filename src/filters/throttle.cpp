@@ -45,6 +45,7 @@ ThrottleBase::Options::Options(pjs::Object *options) {
 
 ThrottleBase::ThrottleBase(pjs::Object *quota, const Options &options)
   : m_options(options)
+  , m_buffer(Filter::buffer_stats())
 {
   if (quota) {
     if (quota->is<algo::Quota>()) {
@@ -65,6 +66,7 @@ ThrottleBase::ThrottleBase(const ThrottleBase &r)
   , m_options(r.m_options)
   , m_quota(r.m_quota)
   , m_quota_f(r.m_quota_f)
+  , m_buffer(r.m_buffer)
 {
 }
 
@@ -75,11 +77,8 @@ ThrottleBase::~ThrottleBase()
 void ThrottleBase::reset() {
   Filter::reset();
   resume();
-  for (auto p = m_consumers.head(); p;) {
-    auto c = p; p = p->next();
-    delete c;
-  }
-  m_consumers.clear();
+  m_buffer.clear();
+  if (m_quota) m_quota->dequeue(this);
   if (m_quota_f) {
     m_quota = nullptr;
   }
@@ -99,14 +98,35 @@ void ThrottleBase::process(Event *evt) {
   }
 
   if (m_paused) {
-    enqueue(evt);
+    m_buffer.push(evt);
 
   } else if (auto stalled = consume(evt, m_quota)) {
     pause();
-    enqueue(stalled);
+    m_buffer.push(stalled);
+    m_quota->enqueue(this);
   }
 }
 
+//
+// All events held back by one filter instance wait behind a single
+// consumer, so that a quota shared by many streams is divided between
+// streams rather than between events.
+//
+
+bool ThrottleBase::on_consume(algo::Quota *quota) {
+  while (auto evt = m_buffer.shift()) {
+    pjs::Ref<Event> stalled(consume(evt, quota));
+    evt->release();
+    if (!m_paused) return true; // reset while outputting
+    if (stalled) {
+      m_buffer.unshift(stalled);
+      return false;
+    }
+  }
+  resume();
+  return true;
+}
+
 void ThrottleBase::pause() {
   if (m_options.block_input) {
     m_congestion.begin();
@@ -119,35 +139,6 @@ void ThrottleBase::resume() {
   m_paused = false;
 }
 
-void ThrottleBase::enqueue(Event *evt) {
-  auto c = new EventConsumer(this, evt);
-  m_consumers.push(c);
-  m_quota->enqueue(c);
-}
-
-void ThrottleBase::dequeue(EventConsumer *consumer) {
-  m_consumers.remove(consumer);
-  if (m_consumers.empty()) {
-    resume();
-  }
-  delete consumer;
-}
-
-//
-// ThrottleBase::EventConsumer
-//
-
-bool ThrottleBase::EventConsumer::on_consume(algo::Quota *quota) {
-  auto *t = m_throttle;
-  if (auto stalled = t->consume(m_event, quota)) {
-    m_event = stalled;
-    return false;
-  } else {
-    t->dequeue(this);
-    return true;
-  }
-}
-
 //
 // ThrottleMessageRate
 //
@@ -40,7 +40,7 @@ namespace pipy {
 // ThrottleBase
 //
 
-class ThrottleBase : public Filter {
+class ThrottleBase : public Filter, public algo::Quota::Consumer {
 public:
   struct Options : public pipy::Options {
     bool block_input = true;
@@ -57,43 +57,17 @@ protected:
   virtual void reset() override;
   virtual void process(Event *evt) override;
   virtual auto consume(Event *evt, algo::Quota *quota) -> Event* = 0;
-
-  //
-  // ThrottleBase::EventConsumer
-  //
-
-  class EventConsumer :
-    public pjs::Pooled<EventConsumer>,
-    public algo::Quota::Consumer,
-    public List<EventConsumer>::Item
-  {
-  public:
-    EventConsumer(ThrottleBase *throttle, Event *event)
-      : m_throttle(throttle)
-      , m_event(event) {}
-
-    auto next() const -> EventConsumer* {
-      return List<EventConsumer>::Item::next();
-    }
-
-  private:
-    ThrottleBase* m_throttle;
-    pjs::Ref<Event> m_event;
-
-    virtual bool on_consume(algo::Quota *quota) override;
-  };
+  virtual bool on_consume(algo::Quota *quota) override;
 
   Options m_options;
   pjs::Ref<algo::Quota> m_quota;
   pjs::Ref<pjs::Function> m_quota_f;
-  List<EventConsumer> m_consumers;
+  EventBuffer m_buffer;
   InputSource::Congestion m_congestion;
   bool m_paused = false;
 
   void pause();
   void resume();
-  void enqueue(Event *evt);
-  void dequeue(EventConsumer *consumer);
 };
 
 //
@@ -25,12 +25,27 @@
 
 #include "tls.hpp"
 #include "context.hpp"
+#include "inbound.hpp"
+#include "outbound.hpp"
 #include "module.hpp"
 #include "pipeline.hpp"
 #include "api/crypto.hpp"
 #include "log.hpp"
+#include "usdt.hpp"
 
+#include <openssl/core_names.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+
+#ifdef PIPY_HAS_CRYPTO_OFFLOAD
+#include <poll.h>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <unordered_map>
 
 namespace pipy {
 namespace tls {
@@ -46,6 +61,170 @@ static void throw_error() {
   throw std::runtime_error(str);
 }
 
+//
+// SessionCache
+//
+// Server-side sessions shared by all worker threads, so that a client
+// resuming on a different thread than the one it first handshook with
+// (as with --reuse-port) still gets an abbreviated handshake. Sessions
+// are kept serialized and spread over a number of stripes, each with
+// its own lock, picked by the first byte of the random session ID.
+//
+
+class SessionCache {
+public:
+  static auto get() -> SessionCache& {
+    static SessionCache s_cache;
+    return s_cache;
+  }
+
+  void set(SSL_SESSION *sess) {
+    unsigned int id_len = 0;
+    auto id = SSL_SESSION_get_id(sess, &id_len);
+    if (!id_len) return;
+    auto size = i2d_SSL_SESSION(sess, nullptr);
+    if (size <= 0) return;
+    Entry ent;
+    ent.der.resize(size);
+    auto p = (unsigned char *)&ent.der[0];
+    i2d_SSL_SESSION(sess, &p);
+    ent.expiration = SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess);
+    std::string key((const char *)id, id_len);
+    auto &stripe = get_stripe(id);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    if (stripe.entries.size() >= MAX_ENTRIES_PER_STRIPE) evict(stripe);
+    stripe.entries[key] = std::move(ent);
+  }
+
+  auto find(const unsigned char *id, int len) -> SSL_SESSION* {
+    if (len <= 0) return nullptr;
+    std::string key((const char *)id, len);
+    auto &stripe = get_stripe(id);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto i = stripe.entries.find(key);
+    if (i == stripe.entries.end()) return nullptr;
+    if (i->second.expiration <= std::time(nullptr)) {
+      stripe.entries.erase(i);
+      return nullptr;
+    }
+    auto p = (const unsigned char *)i->second.der.c_str();
+    return d2i_SSL_SESSION(nullptr, &p, i->second.der.size());
+  }
+
+  void erase(SSL_SESSION *sess) {
+    unsigned int id_len = 0;
+    auto id = SSL_SESSION_get_id(sess, &id_len);
+    if (!id_len) return;
+    std::string key((const char *)id, id_len);
+    auto &stripe = get_stripe(id);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    stripe.entries.erase(key);
+  }
+
+private:
+  static const int STRIPES = 16;
+  static const size_t MAX_ENTRIES_PER_STRIPE = 4096;
+
+  struct Entry {
+    std::string der;
+    long expiration;
+  };
+
+  struct Stripe {
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+  };
+
+  Stripe m_stripes[STRIPES];
+
+  auto get_stripe(const unsigned char *id) -> Stripe& {
+    return m_stripes[id[0] % STRIPES];
+  }
+
+  // Drops expired sessions, or an arbitrary one when none has expired
+  void evict(Stripe &stripe) {
+    auto now = std::time(nullptr);
+    auto &entries = stripe.entries;
+    for (auto i = entries.begin(); i != entries.end(); ) {
+      if (i->second.expiration <= now) {
+        i = entries.erase(i);
+      } else {
+        i++;
+      }
+    }
+    if (entries.size() >= MAX_ENTRIES_PER_STRIPE) {
+      entries.erase(entries.begin());
+    }
+  }
+};
+
+//
+// TicketKeys
+//
+// Session ticket keys shared by all worker threads. The current key is
+// replaced every ROTATION_INTERVAL seconds and the one before it is kept
+// for decryption only, so a ticket stays valid for at least one full
+// interval and gets renewed when presented under the previous key.
+//
+
+class TicketKeys {
+public:
+  struct Key {
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+  };
+
+  static auto get() -> TicketKeys& {
+    static TicketKeys s_keys;
+    return s_keys;
+  }
+
+  bool current(Key &key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto now = std::chrono::steady_clock::now();
+    if (!m_count || now - m_rotated_at >= std::chrono::seconds(ROTATION_INTERVAL)) {
+      Key k;
+      if (
+        RAND_bytes(k.name, sizeof(k.name)) <= 0 ||
+        RAND_bytes(k.aes_key, sizeof(k.aes_key)) <= 0 ||
+        RAND_bytes(k.hmac_key, sizeof(k.hmac_key)) <= 0
+      ) {
+        if (!m_count) return false;
+      } else {
+        m_keys[1] = m_keys[0];
+        m_keys[0] = k;
+        if (m_count < 2) m_count++;
+        m_rotated_at = now;
+      }
+    }
+    key = m_keys[0];
+    return true;
+  }
+
+  // Returns 1 for the current key, 2 for the previous one and 0 if not found
+  int find(const unsigned char *name, Key &key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (int i = 0; i < m_count; i++) {
+      if (!std::memcmp(m_keys[i].name, name, sizeof(key.name))) {
+        key = m_keys[i];
+        return i + 1;
+      }
+    }
+    return 0;
+  }
+
+private:
+  static const int ROTATION_INTERVAL = 3600;
+
+  std::mutex m_mutex;
+  Key m_keys[2];
+  int m_count = 0;
+  std::chrono::steady_clock::time_point m_rotated_at;
+};
+
+static const size_t MAX_CLIENT_SESSIONS = 1024;
+
 //
 // Options
 //
@@ -101,6 +280,14 @@ Options::Options(pjs::Object *options, const char *base_name) {
     .get(on_state_f)
     .check_nullable();
 
+  Value(options, "offloadPrivateKey", base_name)
+    .get(offload_private_key)
+    .check_nullable();
+
+  Value(options, "dynamicRecordSize", base_name)
+    .get(dynamic_record_size)
+    .check_nullable();
+
 #if PIPY_USE_NTLS
   Value(options, "ntls", base_name)
     .get(ntls)
@@ -138,9 +325,18 @@ TLSContext::TLSContext(bool is_server, const Options &options) {
   if (options.alpn && is_server) {
     SSL_CTX_set_alpn_select_cb(m_ctx, on_select_alpn, this);
   }
+
+  SSL_CTX_set_app_data(m_ctx, this);
+
+  if (is_server) {
+    init_server_sessions(options);
+  } else {
+    init_client_sessions();
+  }
 }
 
 TLSContext::~TLSContext() {
+  for (const auto &p : m_client_sessions) SSL_SESSION_free(p.second);
   if (m_dhparam) DH_free(m_dhparam);
   if (m_ctx) SSL_CTX_free(m_ctx);
 }
@@ -197,6 +393,196 @@ void TLSContext::set_server_alpn(const std::set<pjs::Ref<pjs::Str>> &protocols)
   m_server_alpn = protocols;
 }
 
+//
+// Sessions created by one context must not be resumed by another that
+// would have authenticated the handshake differently, so the session ID
+// context covers everything that decides the server's identity and its
+// verification policy: protocol versions, ciphers, trusted CAs, the
+// certificate (or the store or callback that picks one) and the
+// handshake callback. Since callbacks can't be compared by value, the
+// digest is finally scoped to the acceptTLS() filter in the script,
+// which is the same across all worker threads.
+//
+// A resumed handshake never reaches the onVerify callback, so contexts
+// with one don't resume sessions at all.
+//
+
+void TLSContext::init_server_sessions(const Options &options) {
+  if (options.on_verify_f) {
+    SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_options(m_ctx, SSL_OP_NO_TICKET);
+    SSL_CTX_set_num_tickets(m_ctx, 0);
+    return;
+  }
+
+  auto md = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(md, EVP_sha256(), nullptr);
+
+  auto add_str = [&](const std::string &s) {
+    uint32_t len = s.length();
+    EVP_DigestUpdate(md, &len, sizeof(len));
+    EVP_DigestUpdate(md, s.c_str(), s.length());
+  };
+
+  auto add_x509 = [&](X509 *x509) {
+    unsigned char buf[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if (X509_digest(x509, EVP_sha256(), buf, &len)) {
+      EVP_DigestUpdate(md, buf, len);
+    }
+  };
+
+  auto add_cert = [&](const pjs::Value &v) {
+    if (v.is<crypto::Certificate>()) {
+      add_x509(v.as<crypto::Certificate>()->x509());
+    } else if (v.is<crypto::CertificateChain>()) {
+      auto chain = v.as<crypto::CertificateChain>();
+      for (int i = 0; i < chain->size(); i++) add_x509(chain->x509(i));
+    }
+  };
+
+  auto add_function = [&](pjs::Function *f) {
+    add_str(f ? f->method()->name()->str() : std::string());
+  };
+
+  int versions[2] = { options.minVersion, options.maxVersion };
+  EVP_DigestUpdate(md, versions, sizeof(versions));
+  add_str(options.ciphers ? options.ciphers->str() : std::string());
+  for (const auto &cert : options.trusted) add_x509(cert->x509());
+
+  pjs::Value certificate(options.certificate.get());
+  if (certificate.is<crypto::CertificateStore>()) {
+    add_str("store:" + certificate.as<crypto::CertificateStore>()->name());
+  } else if (certificate.is_function()) {
+    add_function(certificate.f());
+  } else if (certificate.is_object() && certificate.o()) {
+    pjs::Value v;
+    certificate.o()->get("cert", v); add_cert(v);
+    certificate.o()->get("certSign", v); add_cert(v);
+    certificate.o()->get("certEnc", v); add_cert(v);
+  }
+
+  add_function(options.handshake);
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  EVP_DigestFinal_ex(md, digest, &digest_len);
+  EVP_MD_CTX_free(md);
+  m_server_sessions_digest.assign((const char *)digest, digest_len);
+
+  SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+  SSL_CTX_sess_set_new_cb(m_ctx, on_new_server_session);
+  SSL_CTX_sess_set_get_cb(m_ctx, on_get_session);
+  SSL_CTX_sess_set_remove_cb(m_ctx, on_remove_session);
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(m_ctx, on_ticket_key);
+}
+
+void TLSContext::scope_server_sessions(const pjs::Location &location) {
+  if (m_server_sessions_scoped) return;
+  m_server_sessions_scoped = true;
+  if (m_server_sessions_digest.empty()) return;
+
+  std::string scope(m_server_sessions_digest);
+  if (location.source) scope += location.source->filename;
+  scope += ':' + std::to_string(location.line) + ':' + std::to_string(location.column);
+
+  unsigned char sid_ctx[EVP_MAX_MD_SIZE];
+  unsigned int sid_ctx_len = 0;
+  EVP_Digest(scope.c_str(), scope.length(), sid_ctx, &sid_ctx_len, EVP_sha256(), nullptr);
+  if (sid_ctx_len > SSL_MAX_SID_CTX_LENGTH) sid_ctx_len = SSL_MAX_SID_CTX_LENGTH;
+  SSL_CTX_set_session_id_context(m_ctx, sid_ctx, sid_ctx_len);
+}
+
+void TLSContext::init_client_sessions() {
+  SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(m_ctx, on_new_client_session);
+}
+
+//
+// Client sessions are kept per context, which belongs to one worker
+// thread, and are looked up by the server name sent in the handshake.
+//
+
+void TLSContext::reuse_session(TLSSession *session, const char *name) {
+  auto i = m_client_sessions.find(name ? name : "");
+  if (i == m_client_sessions.end()) return;
+  if (SSL_SESSION_is_resumable(i->second)) {
+    SSL_set_session(session->m_ssl, i->second);
+  } else {
+    SSL_SESSION_free(i->second);
+    m_client_sessions.erase(i);
+  }
+}
+
+auto TLSContext::on_new_server_session(SSL *ssl, SSL_SESSION *sess) -> int {
+  SessionCache::get().set(sess);
+  return 0;
+}
+
+auto TLSContext::on_new_client_session(SSL *ssl, SSL_SESSION *sess) -> int {
+  auto thiz = static_cast<TLSContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+  auto name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  std::string key(name ? name : "");
+  auto &sessions = thiz->m_client_sessions;
+  auto i = sessions.find(key);
+  if (i != sessions.end()) {
+    SSL_SESSION_free(i->second);
+    i->second = sess;
+  } else {
+    if (sessions.size() >= MAX_CLIENT_SESSIONS) {
+      SSL_SESSION_free(sessions.begin()->second);
+      sessions.erase(sessions.begin());
+    }
+    sessions[key] = sess;
+  }
+  return 1;
+}
+
+auto TLSContext::on_get_session(SSL *ssl, const unsigned char *id, int len, int *copy) -> SSL_SESSION* {
+  *copy = 0;
+  return SessionCache::get().find(id, len);
+}
+
+void TLSContext::on_remove_session(SSL_CTX *ctx, SSL_SESSION *sess) {
+  SessionCache::get().erase(sess);
+}
+
+auto TLSContext::on_ticket_key(
+  SSL *ssl,
+  unsigned char *key_name,
+  unsigned char *iv,
+  EVP_CIPHER_CTX *cipher_ctx,
+  EVP_MAC_CTX *mac_ctx,
+  int enc
+) -> int {
+  TicketKeys::Key key;
+  int ret = 1;
+  if (enc) {
+    if (!TicketKeys::get().current(key)) return -1;
+    if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) <= 0) return -1;
+    std::memcpy(key_name, key.name, sizeof(key.name));
+  } else {
+    ret = TicketKeys::get().find(key_name, key);
+    if (!ret) return 0;
+  }
+
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key, sizeof(key.hmac_key)),
+    OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)"sha256", 0),
+    OSSL_PARAM_construct_end(),
+  };
+
+  if (!EVP_MAC_CTX_set_params(mac_ctx, params)) return -1;
+
+  if (enc) {
+    if (!EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key.aes_key, iv)) return -1;
+  } else {
+    if (!EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key.aes_key, iv)) return -1;
+  }
+
+  return ret;
+}
+
 auto TLSContext::on_verify(int preverify_ok, X509_STORE_CTX *ctx) -> int {
   auto *ssl = (SSL*)X509_STORE_CTX_get_ex_data(ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
   return TLSSession::get(ssl)->on_verify(preverify_ok, ctx);
@@ -267,6 +653,7 @@ int TLSSession::s_user_data_index = 0;
 void TLSSession::init() {
   SSL_load_error_strings();
   SSL_library_init();
+  CryptoOffload::init();
 
   s_user_data_index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
 }
@@ -283,6 +670,8 @@ TLSSession::TLSSession(
 #if PIPY_USE_NTLS
   bool is_ntls,
 #endif
+  bool offload_private_key,
+  bool dynamic_record_size,
   pjs::Object *certificate,
   pjs::Function *alpn,
   pjs::Function *handshake,
@@ -299,10 +688,16 @@ TLSSession::TLSSession(
 #if PIPY_USE_NTLS
   , m_is_ntls(is_ntls)
 #endif
+  , m_offload_private_key(offload_private_key)
+  , m_dynamic_record_size(dynamic_record_size)
 {
   m_ssl = SSL_new(ctx->ctx());
   SSL_set_ex_data(m_ssl, s_user_data_index, this);
 
+#ifdef PIPY_HAS_CRYPTO_OFFLOAD
+  if (offload_private_key) SSL_set_mode(m_ssl, SSL_MODE_ASYNC);
+#endif
+
   m_rbio = BIO_new(BIO_s_mem());
   m_wbio = BIO_new(BIO_s_mem());
 
@@ -322,6 +717,7 @@ TLSSession::TLSSession(
 }
 
 TLSSession::~TLSSession() {
+  finish_async();
   SSL_free(m_ssl);
 }
 
@@ -436,6 +832,25 @@ auto TLSSession::on_select_alpn(pjs::Array *names) -> int {
 
 void TLSSession::set_state(State state) {
   m_state = state;
+  if (state == State::handshake) {
+    m_handshake_start = utils::now();
+  } else if (state == State::connected && m_handshake_start > 0) {
+    auto t = utils::now() - m_handshake_start;
+    if (!m_is_server) {
+      Outbound::observe_tls_time(hostname(), t);
+    } else if (auto inbound = m_filter->context()->inbound()) {
+      inbound->observe_tls_time(t);
+    }
+  }
+  if (m_is_server) {
+    if (auto inbound = m_filter->context()->inbound()) {
+      switch (state) {
+        case State::handshake: inbound->record(FlightRecorder::TLS_HANDSHAKE); break;
+        case State::connected: inbound->record(FlightRecorder::TLS_DONE); break;
+        default: break;
+      }
+    }
+  }
   if (m_on_state) {
     Context &ctx = *m_pipeline->context();
     pjs::Value arg(this), ret;
@@ -459,6 +874,12 @@ void TLSSession::set_error() {
 }
 
 void TLSSession::use_certificate(pjs::Str *sni) {
+  if (m_certificate && m_certificate->is<crypto::CertificateStore>()) {
+    Context &ctx = *m_pipeline->context();
+    m_certificate->as<crypto::CertificateStore>()->use(ctx, m_ssl, sni);
+    return;
+  }
+
   pjs::Value certificate(m_certificate);
   if (certificate.is_function()) {
     Context &ctx = *m_pipeline->context();
@@ -530,7 +951,14 @@ void TLSSession::use_certificate(pjs::Str *sni) {
   }
 #endif
 
-  SSL_use_PrivateKey(m_ssl, key.as<crypto::PrivateKey>()->pkey());
+  auto pkey = key.as<crypto::PrivateKey>()->pkey();
+  if (m_offload_private_key) {
+    if (auto offload_pkey = key.as<crypto::PrivateKey>()->offload_pkey()) {
+      pkey = offload_pkey;
+    }
+  }
+
+  SSL_use_PrivateKey(m_ssl, pkey);
 
   if (cert.is<crypto::Certificate>()) {
     SSL_use_certificate(m_ssl, cert.as<crypto::Certificate>()->x509());
@@ -550,6 +978,9 @@ void TLSSession::use_certificate(pjs::Str *sni) {
 }
 
 bool TLSSession::handshake_step() {
+#ifdef PIPY_HAS_CRYPTO_OFFLOAD
+  if (m_async_wait) return false;
+#endif
   if (m_state == State::idle) set_state(State::handshake);
   while (!SSL_is_init_finished(m_ssl)) {
     pump_receive();
@@ -570,6 +1001,12 @@ bool TLSSession::handshake_step() {
       if (m_buffer_receive.empty()) {
         blocked = true;
       }
+#ifdef PIPY_HAS_CRYPTO_OFFLOAD
+    } else if (status == SSL_ERROR_WANT_ASYNC) {
+      pump_send();
+      wait_async();
+      return false;
+#endif
     } else if (status != SSL_ERROR_WANT_WRITE) {
       Log::warn("[tls] handshake failed (error = %d)", status);
       set_error();
@@ -583,6 +1020,7 @@ bool TLSSession::handshake_step() {
 }
 
 void TLSSession::handshake_done() {
+  PIPY_PROBE1(tls__handshake__done, m_is_server);
   if (m_handshake) {
     Context &ctx = *m_pipeline->context();
     auto info = HandshakeInfo::make();
@@ -593,6 +1031,9 @@ void TLSSession::handshake_done() {
     pjs::Value arg(info), ret;
     (*m_handshake)(ctx, 1, &arg, ret);
   }
+#ifdef PIPY_HAS_CRYPTO_OFFLOAD
+  SSL_clear_mode(m_ssl, SSL_MODE_ASYNC);
+#endif
   set_state(State::connected);
   if (m_is_server) {
     forward(Data::make());
@@ -601,8 +1042,98 @@ void TLSSession::handshake_done() {
   }
 }
 
+//
+// The handshake is paused in an async job while a private-key operation
+// runs on the crypto offload threads. It is resumed once the job's wait
+// fd becomes readable. Input arriving meanwhile stays buffered.
+//
+
+void TLSSession::wait_async() {
+#ifdef PIPY_HAS_CRYPTO_OFFLOAD
+  size_t n = 0;
+  SSL_get_all_async_fds(m_ssl, nullptr, &n);
+  if (!n) {
+    Log::warn("[tls] no wait fd for async handshake");
+    close();
+    return;
+  }
+  std::vector<OSSL_ASYNC_FD> fds(n);
+  SSL_get_all_async_fds(m_ssl, &fds[0], &n);
+  m_async_wait.reset(new asio::posix::stream_descriptor(Net::context(), fds[0]));
+  m_async_wait->async_wait(
+    asio::posix::stream_descriptor::wait_read,
+    [this](const std::error_code &ec) {
+      if (ec) return;
+      InputContext ic;
+      m_async_wait->release();
+      m_async_wait.reset();
+      if (handshake_step()) {
+        pump_read();
+        pump_write();
+      }
+    }
+  );
+#endif
+}
+
+//
+// A paused job holds a stack that the crypto thread is still writing to,
+// so before the session goes away the job has to be run to completion.
+//
+
+void TLSSession::finish_async() {
+#ifdef PIPY_HAS_CRYPTO_OFFLOAD
+  if (!m_async_wait) return;
+  auto fd = m_async_wait->release();
+  m_async_wait.reset();
+  for (;;) {
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (::poll(&pfd, 1, 1000) <= 0) {
+      Log::error("[tls] timed out waiting for an async private-key operation");
+      return;
+    }
+    auto ret = SSL_do_handshake(m_ssl);
+    if (ret > 0 || SSL_get_error(m_ssl, ret) != SSL_ERROR_WANT_ASYNC) return;
+    size_t n = 0;
+    SSL_get_all_async_fds(m_ssl, nullptr, &n);
+    if (!n) return;
+    std::vector<OSSL_ASYNC_FD> fds(n);
+    SSL_get_all_async_fds(m_ssl, &fds[0], &n);
+    fd = fds[0];
+  }
+#endif
+}
+
+//
+// With dynamic record sizing, records start small enough to fit in one
+// TCP segment so the peer can decrypt the first bytes right away rather
+// than wait for a whole 16K record. They grow to the maximum once about
+// 1MB has gone out, and shrink back when the connection has been idle.
+//
+
+static const size_t RECORD_SIZE_SMALL = 1400;
+static const size_t RECORD_SIZE_LARGE = 16384;
+static const size_t RECORD_BOOST_THRESHOLD = 1024 * 1024;
+static const double RECORD_IDLE_TIMEOUT = 1000;
+
+void TLSSession::size_records() {
+  auto now = utils::monotonic_coarse();
+  if (now - m_record_time > RECORD_IDLE_TIMEOUT) m_record_sent = 0;
+  m_record_time = now;
+  auto size = m_record_sent < RECORD_BOOST_THRESHOLD ? RECORD_SIZE_SMALL : RECORD_SIZE_LARGE;
+  if (size != m_record_size) {
+    SSL_set_max_send_fragment(m_ssl, size);
+    SSL_set_split_send_fragment(m_ssl, size);
+    m_record_size = size;
+  }
+}
+
 auto TLSSession::pump_send() -> int {
   int size = 0;
+  Data out;
   for (;;) {
     size_t n = 0;
     Data data(DATA_CHUNK_SIZE, &s_dp);
@@ -611,16 +1142,19 @@ auto TLSSession::pump_send() -> int {
     auto len = std::get<1>(*chunk);
     if (BIO_read_ex(m_wbio, ptr, len, &n)) {
       data.pop(data.size() - n);
-      if (m_is_server) {
-        output(Data::make(data));
-      } else {
-        forward(Data::make(data));
-      }
+      out.push(std::move(data));
       size += n;
     } else {
       break;
     }
   }
+  if (!out.empty()) {
+    if (m_is_server) {
+      output(Data::make(std::move(out)));
+    } else {
+      forward(Data::make(std::move(out)));
+    }
+  }
   return size;
 }
 
@@ -638,8 +1172,16 @@ auto TLSSession::pump_receive() -> int {
   return size;
 }
 
+//
+// Records decrypted in one round are delivered as a single Data event
+// rather than one event per chunk, saving a trip down the pipeline for
+// every 16K of plaintext.
+//
+
 void TLSSession::pump_read() {
   for (;;) {
+    Data out;
+    bool closing = false;
     for (;;) {
       size_t n = 0;
       Data data(DATA_CHUNK_SIZE, &s_dp);
@@ -649,24 +1191,24 @@ void TLSSession::pump_read() {
       auto ret = SSL_read_ex(m_ssl, buf, len, &n);
       if (ret <= 0) {
         int status = SSL_get_error(m_ssl, ret);
-        if (status == SSL_ERROR_ZERO_RETURN) {
-          close();
-          return;
-        } else if (status == SSL_ERROR_WANT_READ || status == SSL_ERROR_WANT_WRITE) {
-          break;
-        } else {
-          close();
-          return;
-        }
+        if (status != SSL_ERROR_WANT_READ && status != SSL_ERROR_WANT_WRITE) closing = true;
+        break;
       } else {
         data.pop(data.size() - n);
-        if (m_is_server) {
-          forward(Data::make(data));
-        } else {
-          output(Data::make(data));
-        }
+        out.push(std::move(data));
+      }
+    }
+    if (!out.empty()) {
+      if (m_is_server) {
+        forward(Data::make(std::move(out)));
+      } else {
+        output(Data::make(std::move(out)));
       }
     }
+    if (closing) {
+      close();
+      return;
+    }
     if (pump_send() + pump_receive() == 0) break;
   }
 }
@@ -678,6 +1220,7 @@ void TLSSession::pump_write() {
       size_t n = 0;
       auto ptr = std::get<0>(c);
       auto len = std::get<1>(c);
+      if (m_dynamic_record_size) size_records();
       auto ret = SSL_write_ex(m_ssl, ptr, len, &n);
       if (ret < 0) {
         int status = SSL_get_error(m_ssl, ret);
@@ -692,6 +1235,7 @@ void TLSSession::pump_write() {
         }
       }
       size += n;
+      m_record_sent += n;
       if (n < len) break;
     }
     m_buffer_write.shift(size);
@@ -828,6 +1372,8 @@ void Client::process(Event *evt) {
 #if PIPY_USE_NTLS
       m_options->ntls,
 #endif
+      m_options->offload_private_key,
+      m_options->dynamic_record_size,
       m_options->certificate,
       nullptr,
       m_options->handshake,
@@ -838,9 +1384,11 @@ void Client::process(Event *evt) {
     pjs::Value sni(m_options->sni);
     if (!eval(m_options->sni_f, sni)) return;
     if (sni.is_nullish()) {
+      m_tls_context->reuse_session(m_session, nullptr);
       m_session->start_handshake();
     } else {
       auto s = sni.to_string();
+      m_tls_context->reuse_session(m_session, s->c_str());
       m_session->start_handshake(s->c_str());
       s->release();
     }
@@ -948,6 +1496,7 @@ void Server::reset() {
 
 void Server::process(Event *evt) {
   if (!m_session) {
+    m_tls_context->scope_server_sessions(Filter::location());
     m_session = TLSSession::make(
       m_tls_context.get(),
       this,
@@ -955,6 +1504,8 @@ void Server::process(Event *evt) {
 #if PIPY_USE_NTLS
       m_options->ntls,
 #endif
+      m_options->offload_private_key,
+      m_options->dynamic_record_size,
       m_options->certificate,
       m_options->alpn_f,
       m_options->handshake,
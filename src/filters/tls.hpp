@@ -29,11 +29,15 @@
 #include "filter.hpp"
 #include "data.hpp"
 #include "api/crypto.hpp"
+#include "crypto-offload.hpp"
+#include "net.hpp"
 #include "options.hpp"
 
 #include <openssl/bio.h>
 #include <openssl/ssl.h>
 
+#include <map>
+#include <memory>
 #include <vector>
 #include <string>
 #include <set>
@@ -43,6 +47,7 @@ namespace pipy {
 namespace tls {
 
 class TLSFilter;
+class TLSSession;
 
 //
 // ProtocolVersion
@@ -69,6 +74,8 @@ struct Options : public pipy::Options {
   pjs::Ref<pjs::Function> on_verify_f;
   pjs::Ref<pjs::Function> on_state_f;
   bool alpn = false;
+  bool offload_private_key = false;
+  bool dynamic_record_size = false;
 #if PIPY_USE_NTLS
   bool ntls = false;
 #endif
@@ -93,12 +100,20 @@ public:
   void add_certificate(crypto::Certificate *cert);
   void set_client_alpn(const std::vector<std::string> &protocols);
   void set_server_alpn(const std::set<pjs::Ref<pjs::Str>> &protocols);
+  void scope_server_sessions(const pjs::Location &location);
+  void reuse_session(TLSSession *session, const char *name);
 
 private:
   SSL_CTX* m_ctx;
   DH* m_dhparam = nullptr;
   X509_STORE* m_verify_store;
   std::set<pjs::Ref<pjs::Str>> m_server_alpn;
+  std::map<std::string, SSL_SESSION*> m_client_sessions;
+  std::string m_server_sessions_digest;
+  bool m_server_sessions_scoped = false;
+
+  void init_server_sessions(const Options &options);
+  void init_client_sessions();
 
   static auto on_verify(int preverify_ok, X509_STORE_CTX *ctx) -> int;
   static auto on_server_name(SSL *ssl, int*, void*) -> int;
@@ -110,6 +125,19 @@ private:
     unsigned int inlen,
     void *arg
   ) -> int;
+
+  static auto on_new_server_session(SSL *ssl, SSL_SESSION *sess) -> int;
+  static auto on_new_client_session(SSL *ssl, SSL_SESSION *sess) -> int;
+  static auto on_get_session(SSL *ssl, const unsigned char *id, int len, int *copy) -> SSL_SESSION*;
+  static void on_remove_session(SSL_CTX *ctx, SSL_SESSION *sess);
+  static auto on_ticket_key(
+    SSL *ssl,
+    unsigned char *key_name,
+    unsigned char *iv,
+    EVP_CIPHER_CTX *cipher_ctx,
+    EVP_MAC_CTX *mac_ctx,
+    int enc
+  ) -> int;
 };
 
 //
@@ -160,6 +188,8 @@ private:
 #if PIPY_USE_NTLS
     bool is_ntls,
 #endif
+    bool offload_private_key,
+    bool dynamic_record_size,
     pjs::Object *certificate,
     pjs::Function *alpn,
     pjs::Function *handshake,
@@ -176,6 +206,7 @@ private:
   Data m_buffer_write;
   Data m_buffer_receive;
   State m_state = State::idle;
+  double m_handshake_start = 0;
   pjs::Ref<Pipeline> m_pipeline;
   pjs::Ref<pjs::Object> m_certificate;
   pjs::Ref<pjs::Object> m_ca;
@@ -190,6 +221,14 @@ private:
   bool m_is_server;
 #if PIPY_USE_NTLS
   bool m_is_ntls;
+#endif
+  bool m_offload_private_key;
+  bool m_dynamic_record_size;
+  size_t m_record_size = 0;
+  size_t m_record_sent = 0;
+  double m_record_time = 0;
+#ifdef PIPY_HAS_CRYPTO_OFFLOAD
+  std::unique_ptr<asio::posix::stream_descriptor> m_async_wait;
 #endif
   bool m_closed_input = false;
   bool m_closed_output = false;
@@ -207,6 +246,9 @@ private:
   void use_certificate(pjs::Str *sni);
   bool handshake_step();
   void handshake_done();
+  void wait_async();
+  void finish_async();
+  void size_records();
   auto pump_send() -> int;
   auto pump_receive() -> int;
   void pump_read();
@@ -0,0 +1,489 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "trace.hpp"
+#include "pipeline.hpp"
+#include "api/http.hpp"
+#include "api/logging.hpp"
+#include "api/protobuf.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <random>
+
+namespace pipy {
+
+thread_local static const pjs::ConstStr s_headers("headers");
+thread_local static const pjs::ConstStr s_traceparent("traceparent");
+thread_local static const pjs::ConstStr s_content_type("content-type");
+thread_local static const pjs::ConstStr s_application_x_protobuf("application/x-protobuf");
+
+static auto now_ns() -> uint64_t {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()
+  ).count();
+}
+
+static auto random_u64() -> uint64_t {
+  thread_local static std::mt19937_64 rng(
+    ((uint64_t)std::random_device{}() << 32) ^ std::random_device{}()
+  );
+  return rng();
+}
+
+static void random_id(uint8_t *id, int len) {
+  for (int i = 0; i < len; i += 8) {
+    auto r = random_u64();
+    for (int j = 0; j < 8 && i + j < len; j++) {
+      id[i + j] = r >> (j * 8);
+    }
+  }
+}
+
+static bool is_zero(const uint8_t *id, int len) {
+  for (int i = 0; i < len; i++) if (id[i]) return false;
+  return true;
+}
+
+static int hex_digit(char c) {
+  if ('0' <= c && c <= '9') return c - '0';
+  if ('a' <= c && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+static bool parse_hex(const char *s, uint8_t *id, int len) {
+  for (int i = 0; i < len; i++) {
+    int h = hex_digit(s[i*2]);
+    int l = hex_digit(s[i*2+1]);
+    if (h < 0 || l < 0) return false;
+    id[i] = (h << 4) | l;
+  }
+  return true;
+}
+
+static void write_hex(char *s, const uint8_t *id, int len) {
+  static const char hex[] = "0123456789abcdef";
+  for (int i = 0; i < len; i++) {
+    s[i*2+0] = hex[id[i] >> 4];
+    s[i*2+1] = hex[id[i] & 15];
+  }
+}
+
+//
+// Tracer
+//
+// Collects finished spans of one thread for the same collector and sends
+// them as a single OTLP ExportTraceServiceRequest once a batch is full or
+// the batch interval expires. Spans are encoded into protobuf as soon as
+// they end so that nothing but bytes is held between exports.
+//
+
+class Tracer {
+public:
+  static auto get(const Trace::Options &options) -> Tracer* {
+    thread_local static std::map<std::string, Tracer*> s_tracers;
+    auto key = options.endpoint + '\n' + options.service_name;
+    auto &p = s_tracers[key];
+    if (!p) p = new Tracer(options);
+    return p;
+  }
+
+  void record(const Trace::Span *span, Trace::Kind kind);
+
+private:
+  Tracer(const Trace::Options &options);
+
+  std::unique_ptr<logging::Logger::Target> m_target;
+  std::string m_service_name;
+  Data m_batch;
+  int m_batch_count = 0;
+  int m_batch_size;
+  double m_batch_interval;
+  Timer m_timer;
+  bool m_timer_scheduled = false;
+
+  void flush();
+};
+
+Tracer::Tracer(const Trace::Options &options)
+  : m_service_name(options.service_name)
+  , m_batch_size(std::max(1, options.batch_size))
+  , m_batch_interval(options.batch_interval)
+{
+  if (options.endpoint.empty()) return;
+
+  logging::Logger::HTTPTarget::Options opts;
+  opts.batch_size = 1;
+  opts.tls = options.tls;
+  opts.headers = pjs::Object::make();
+  if (auto headers = options.headers.get()) {
+    headers->iterate_all(
+      [&](pjs::Str *k, pjs::Value &v) {
+        opts.headers->set(k, v);
+      }
+    );
+  }
+  opts.headers->set(s_content_type, s_application_x_protobuf.get());
+
+  pjs::Ref<pjs::Str> url(pjs::Str::make(options.endpoint));
+  m_target.reset(new logging::Logger::HTTPTarget(url, opts));
+}
+
+//
+// Field numbers are from opentelemetry/proto/trace/v1/trace.proto
+// and opentelemetry/proto/common/v1/common.proto
+//
+
+static void write_attr(Protobuf::Writer &w, const char *key, pjs::Str *value) {
+  Data kv, any;
+  Protobuf::Writer wa(any);
+  wa.bytes(1, value->c_str(), value->size()); // AnyValue.string_value
+  wa.flush();
+  Protobuf::Writer wkv(kv);
+  wkv.bytes(1, key, std::strlen(key)); // KeyValue.key
+  wkv.message(2, any); // KeyValue.value
+  wkv.flush();
+  w.message(9, kv); // Span.attributes
+}
+
+static void write_attr(Protobuf::Writer &w, const char *key, int64_t value) {
+  Data kv, any;
+  Protobuf::Writer wa(any);
+  wa.varint(3, value); // AnyValue.int_value
+  wa.flush();
+  Protobuf::Writer wkv(kv);
+  wkv.bytes(1, key, std::strlen(key)); // KeyValue.key
+  wkv.message(2, any); // KeyValue.value
+  wkv.flush();
+  w.message(9, kv); // Span.attributes
+}
+
+void Tracer::record(const Trace::Span *span, Trace::Kind kind) {
+  if (!m_target) return;
+
+  Data buf;
+  Protobuf::Writer w(buf);
+  w.bytes(1, span->trace_id, sizeof(span->trace_id)); // Span.trace_id
+  w.bytes(2, span->span_id, sizeof(span->span_id)); // Span.span_id
+  if (span->has_parent) {
+    w.bytes(4, span->parent_id, sizeof(span->parent_id)); // Span.parent_span_id
+  }
+  if (auto m = span->method.get()) {
+    w.bytes(5, m->c_str(), m->size()); // Span.name
+  }
+  w.varint(6, kind == Trace::Kind::SERVER ? 2 : 3); // Span.kind
+  w.fixed64(7, span->start_time); // Span.start_time_unix_nano
+  w.fixed64(8, span->end_time); // Span.end_time_unix_nano
+  if (span->method) write_attr(w, "http.request.method", span->method);
+  if (span->path) write_attr(w, "url.path", span->path);
+  if (span->authority) write_attr(w, "server.address", span->authority);
+  if (span->status) write_attr(w, "http.response.status_code", span->status);
+  if (span->error || span->status >= 500) {
+    Data status;
+    Protobuf::Writer ws(status);
+    ws.varint(3, 2); // Status.code = STATUS_CODE_ERROR
+    ws.flush();
+    w.message(15, status); // Span.status
+  }
+  w.flush();
+
+  Protobuf::Writer wb(m_batch);
+  wb.message(2, buf); // ScopeSpans.spans
+  wb.flush();
+
+  if (++m_batch_count >= m_batch_size) {
+    flush();
+  } else if (!m_timer_scheduled) {
+    m_timer_scheduled = true;
+    m_timer.schedule(
+      m_batch_interval,
+      [this]() {
+        InputContext ic;
+        m_timer_scheduled = false;
+        flush();
+      }
+    );
+  }
+}
+
+void Tracer::flush() {
+  if (!m_batch_count) return;
+
+  Data resource, attr, any, scope, scope_spans, resource_spans, request;
+
+  Protobuf::Writer wa(any);
+  wa.string(1, m_service_name); // AnyValue.string_value
+  wa.flush();
+  Protobuf::Writer wkv(attr);
+  wkv.string(1, "service.name"); // KeyValue.key
+  wkv.message(2, any); // KeyValue.value
+  wkv.flush();
+  Protobuf::Writer wr(resource);
+  wr.message(1, attr); // Resource.attributes
+  wr.flush();
+
+  Protobuf::Writer wsc(scope);
+  wsc.string(1, "pipy"); // InstrumentationScope.name
+  wsc.flush();
+  Protobuf::Writer wss(scope_spans);
+  wss.message(1, scope); // ScopeSpans.scope
+  wss.flush();
+  scope_spans.push(m_batch);
+
+  Protobuf::Writer wrs(resource_spans);
+  wrs.message(1, resource); // ResourceSpans.resource
+  wrs.message(2, scope_spans); // ResourceSpans.scope_spans
+  wrs.flush();
+  Protobuf::Writer wreq(request);
+  wreq.message(1, resource_spans); // ExportTraceServiceRequest.resource_spans
+  wreq.flush();
+
+  m_batch.clear();
+  m_batch_count = 0;
+  m_timer.cancel();
+  m_timer_scheduled = false;
+  m_target->write(request);
+}
+
+//
+// Trace::Options
+//
+
+Trace::Options::Options(pjs::Object *options) {
+  const char *options_tail = "options.tailSampling";
+  const char *options_tls = "options.tls";
+  pjs::Ref<pjs::Object> tail_options, tls_options;
+  Value(options, "endpoint")
+    .get(endpoint)
+    .check_nullable();
+  Value(options, "serviceName")
+    .get(service_name)
+    .check_nullable();
+  Value(options, "kind")
+    .get(kind)
+    .check_nullable();
+  Value(options, "sampleRate")
+    .get(sample_rate)
+    .check_nullable();
+  Value(options, "tailSampling")
+    .get(tail_options)
+    .check_nullable();
+  Value(tail_options, "errors", options_tail)
+    .get(tail_errors)
+    .check_nullable();
+  Value(tail_options, "slowerThan", options_tail)
+    .get_seconds(tail_slower_than)
+    .check_nullable();
+  Value(options, "batchSize")
+    .get(batch_size)
+    .check_nullable();
+  Value(options, "batchInterval")
+    .get_seconds(batch_interval)
+    .check_nullable();
+  Value(options, "headers")
+    .get(headers)
+    .check_nullable();
+  Value(options, "tls")
+    .get(tls_options)
+    .check_nullable();
+  tls = tls::Client::Options(tls_options, options_tls);
+  if (sample_rate < 0 || sample_rate > 1) {
+    throw std::runtime_error("options.sampleRate must be between 0 and 1");
+  }
+}
+
+//
+// Trace
+//
+
+Trace::Trace(const Options &options)
+  : m_options(options)
+{
+}
+
+Trace::Trace(const Trace &r)
+  : Filter(r)
+  , m_options(r.m_options)
+{
+}
+
+Trace::~Trace() {
+  clear_spans();
+}
+
+void Trace::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = "trace";
+}
+
+auto Trace::clone() -> Filter* {
+  return new Trace(*this);
+}
+
+void Trace::reset() {
+  Filter::reset();
+  EventSource::close();
+  m_pipeline = nullptr;
+  clear_spans();
+}
+
+void Trace::process(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    start_span(start);
+  }
+
+  if (!m_pipeline) {
+    m_pipeline = sub_pipeline(0, false, EventSource::reply())->start();
+  }
+
+  Filter::output(evt, m_pipeline->input());
+}
+
+void Trace::on_reply(Event *evt) {
+  if (auto start = evt->as<MessageStart>()) {
+    if (auto span = m_spans.head()) {
+      if (auto head = start->head()) {
+        span->status = pjs::coerce<http::ResponseHead>(head)->status;
+      }
+    }
+
+  } else if (evt->is<MessageEnd>()) {
+    end_span(false);
+
+  } else if (auto end = evt->as<StreamEnd>()) {
+    while (!m_spans.empty()) end_span(end->has_error());
+  }
+
+  Filter::output(evt);
+}
+
+void Trace::start_span(MessageStart *start) {
+  auto span = new Span;
+  span->start_time = now_ns();
+
+  auto req = pjs::coerce<http::RequestHead>(start->head());
+  auto headers = req->headers();
+  span->method = req->method;
+  span->path = req->path;
+  span->authority = req->authority;
+
+  // Continue the incoming trace and follow its sampling decision,
+  // or start a new trace and sample it at the configured rate
+  bool has_context = false;
+  pjs::Value tp;
+  if (headers && headers->get(s_traceparent, tp) && tp.is_string()) {
+    auto &s = tp.s()->str();
+    if (
+      s.length() >= 55 && s[2] == '-' && s[35] == '-' && s[52] == '-' &&
+      s.compare(0, 2, "ff") &&
+      parse_hex(s.c_str() + 3, span->trace_id, 16) &&
+      parse_hex(s.c_str() + 36, span->parent_id, 8) &&
+      !is_zero(span->trace_id, 16) && !is_zero(span->parent_id, 8)
+    ) {
+      uint8_t flags;
+      if (parse_hex(s.c_str() + 53, &flags, 1)) {
+        has_context = true;
+        span->has_parent = true;
+        span->sampled = flags & 1;
+      }
+    }
+  }
+
+  if (!has_context) {
+    random_id(span->trace_id, 16);
+    span->sampled = (
+      m_options.sample_rate >= 1 ||
+      (random_u64() >> 11) * (1.0 / 9007199254740992.0) < m_options.sample_rate
+    );
+  }
+
+  random_id(span->span_id, 8);
+
+  char str[56];
+  str[0] = '0'; str[1] = '0'; str[2] = '-';
+  write_hex(str + 3, span->trace_id, 16);
+  str[35] = '-';
+  write_hex(str + 36, span->span_id, 8);
+  str[52] = '-';
+  str[53] = '0'; str[54] = span->sampled ? '1' : '0';
+  str[55] = 0;
+
+  if (!headers) {
+    headers = pjs::Object::make();
+    start->head()->set(s_headers, headers);
+  }
+  headers->set(s_traceparent, pjs::Str::make(str, 55));
+
+  m_spans.push(span);
+}
+
+void Trace::end_span(bool error) {
+  auto span = m_spans.head();
+  if (!span) return;
+  m_spans.remove(span);
+
+  span->end_time = now_ns();
+  span->error = error;
+
+  // Spans not sampled at the head are still kept when they turn out
+  // to have failed or taken too long
+  bool keep = span->sampled;
+  if (!keep && m_options.tail_errors) {
+    keep = error || span->status >= 500;
+  }
+  if (!keep && m_options.tail_slower_than > 0) {
+    keep = (span->end_time - span->start_time) >= m_options.tail_slower_than * 1e9;
+  }
+
+  if (keep) {
+    if (!m_tracer) m_tracer = Tracer::get(m_options);
+    m_tracer->record(span, m_options.kind);
+  }
+
+  delete span;
+}
+
+void Trace::clear_spans() {
+  while (auto span = m_spans.head()) {
+    m_spans.remove(span);
+    delete span;
+  }
+}
+
+} // namespace pipy
+
+namespace pjs {
+
+using namespace pipy;
+
+template<> void EnumDef<Trace::Kind>::init() {
+  define(Trace::Kind::SERVER, "server");
+  define(Trace::Kind::CLIENT, "client");
+}
+
+} // namespace pjs
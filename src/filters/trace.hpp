@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "filter.hpp"
+#include "list.hpp"
+#include "options.hpp"
+#include "filters/tls.hpp"
+
+#include <string>
+
+namespace pipy {
+
+class Tracer;
+
+//
+// Trace
+//
+
+class Trace : public Filter, public EventSource {
+public:
+  enum class Kind {
+    SERVER,
+    CLIENT,
+  };
+
+  struct Options : public pipy::Options {
+    std::string endpoint;
+    std::string service_name = "pipy";
+    pjs::EnumValue<Kind> kind = Kind::SERVER;
+    double sample_rate = 1;
+    bool tail_errors = true;
+    double tail_slower_than = 0;
+    int batch_size = 512;
+    double batch_interval = 1;
+    pjs::Ref<pjs::Object> headers;
+    tls::Client::Options tls;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  Trace(const Options &options);
+
+private:
+  Trace(const Trace &r);
+  ~Trace();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void on_reply(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  //
+  // Trace::Span
+  //
+
+  struct Span : public pjs::Pooled<Span>, public List<Span>::Item {
+    uint8_t trace_id[16];
+    uint8_t span_id[8];
+    uint8_t parent_id[8];
+    bool has_parent = false;
+    bool sampled = false;
+    bool error = false;
+    int status = 0;
+    uint64_t start_time = 0;
+    uint64_t end_time = 0;
+    pjs::Ref<pjs::Str> method;
+    pjs::Ref<pjs::Str> path;
+    pjs::Ref<pjs::Str> authority;
+  };
+
+  Options m_options;
+  Tracer* m_tracer = nullptr;
+  pjs::Ref<Pipeline> m_pipeline;
+  List<Span> m_spans;
+
+  void start_span(MessageStart *start);
+  void end_span(bool error);
+  void clear_spans();
+
+  friend class Tracer;
+};
+
+} // namespace pipy
+
+#endif // TRACE_HPP
@@ -0,0 +1,180 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "transform-body.hpp"
+
+namespace pipy {
+
+static Data::Producer s_dp("transformBody()");
+
+//
+// TransformBody::Options
+//
+
+TransformBody::Options::Options(pjs::Object *options) {
+  Value(options, "lookahead")
+    .get_binary_size(lookahead)
+    .check_nullable();
+}
+
+//
+// TransformBody
+//
+
+TransformBody::TransformBody(pjs::Function *callback, const Options &options)
+  : m_callback(callback)
+  , m_options(options)
+{
+}
+
+TransformBody::TransformBody(const pjs::Value &pattern, const pjs::Value &replacement) {
+  std::string str;
+  if (pattern.is<Data>()) {
+    str = pattern.as<Data>()->to_string();
+  } else {
+    auto s = pattern.to_string();
+    str = s->str();
+    s->release();
+  }
+  if (str.empty()) throw std::runtime_error("pattern cannot be empty");
+  if (str.length() > MAX_PATTERN) throw std::runtime_error("pattern over 1KB is not supported");
+  m_kmp = new KMP(str.c_str(), str.length());
+
+  if (replacement.is<Data>()) {
+    m_replacement = replacement.as<Data>();
+  } else if (replacement.is_nullish()) {
+    m_replacement = Data::make();
+  } else {
+    auto s = replacement.to_string();
+    m_replacement = s_dp.make(s->str());
+    s->release();
+  }
+}
+
+TransformBody::TransformBody(const TransformBody &r)
+  : Filter(r)
+  , m_callback(r.m_callback)
+  , m_options(r.m_options)
+  , m_kmp(r.m_kmp)
+  , m_replacement(r.m_replacement)
+{
+}
+
+TransformBody::~TransformBody()
+{
+  delete m_split;
+}
+
+void TransformBody::dump(Dump &d) {
+  Filter::dump(d);
+  d.name = m_kmp ? "replaceBodyText" : "transformBody";
+}
+
+auto TransformBody::clone() -> Filter* {
+  return new TransformBody(*this);
+}
+
+void TransformBody::reset() {
+  Filter::reset();
+  delete m_split;
+  m_split = nullptr;
+  m_window.clear();
+  m_started = false;
+  m_ending = false;
+}
+
+void TransformBody::process(Event *evt) {
+  if (evt->is<MessageStart>()) {
+    if (!m_started) {
+      m_started = true;
+      m_window.clear();
+      if (m_kmp && !m_split) {
+        m_split = m_kmp->split(
+          [this](Data *data) {
+            if (data) {
+              Filter::output(data);
+            } else if (!m_ending) {
+              Filter::output(Data::make(*m_replacement));
+            }
+          }
+        );
+      }
+    }
+    Filter::output(evt);
+
+  } else if (auto data = evt->as<Data>()) {
+    if (!m_started) {
+      Filter::output(evt);
+    } else if (m_split) {
+      Data buf(*data);
+      m_split->input(buf);
+    } else {
+      m_window.push(*data);
+      if (m_window.size() > m_options.lookahead) {
+        pjs::Ref<Data> chunk(Data::make());
+        m_window.shift(m_window.size() - m_options.lookahead, *chunk);
+        pjs::Ref<Data> lookahead(Data::make(m_window));
+        if (!transform(chunk, lookahead)) return;
+      }
+    }
+
+  } else if (evt->is<MessageEnd>() || evt->is<StreamEnd>()) {
+    if (m_started) {
+      m_started = false;
+      if (m_split) {
+        m_ending = true;
+        m_split->end();
+        m_ending = false;
+        delete m_split;
+        m_split = nullptr;
+      } else if (!m_window.empty()) {
+        pjs::Ref<Data> chunk(Data::make(std::move(m_window)));
+        if (!transform(chunk, nullptr)) return;
+      }
+    }
+    Filter::output(evt);
+  }
+}
+
+bool TransformBody::transform(Data *chunk, Data *lookahead) {
+  pjs::Value args[2], ret;
+  args[0].set(chunk);
+  if (lookahead) args[1].set(lookahead); else args[1] = pjs::Value::null;
+  if (!Filter::callback(m_callback, 2, args, ret)) return false;
+  if (ret.is_undefined()) {
+    Filter::output(chunk);
+  } else if (ret.is<Data>()) {
+    Filter::output(ret.as<Data>());
+  } else if (ret.is_string()) {
+    Filter::output(s_dp.make(ret.s()->str()));
+  } else if (!ret.is_null()) {
+    Filter::error("callback did not return a Data or a string");
+    return false;
+  }
+  return true;
+}
+
+} // namespace pipy
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef TRANSFORM_BODY_HPP
+#define TRANSFORM_BODY_HPP
+
+#include "filter.hpp"
+#include "kmp.hpp"
+#include "options.hpp"
+
+namespace pipy {
+
+//
+// TransformBody
+//
+// Rewrites message bodies as they stream through, either by calling a
+// script function on every chunk or by replacing every occurrence of a
+// fixed pattern natively. Neither waits for the body to complete.
+//
+
+class TransformBody : public Filter {
+public:
+  struct Options : public pipy::Options {
+    size_t lookahead = 0;
+    Options() {}
+    Options(pjs::Object *options);
+  };
+
+  TransformBody(pjs::Function *callback, const Options &options);
+  TransformBody(const pjs::Value &pattern, const pjs::Value &replacement);
+
+private:
+  enum { MAX_PATTERN = 1024 };
+
+  TransformBody(const TransformBody &r);
+  ~TransformBody();
+
+  virtual auto clone() -> Filter* override;
+  virtual void reset() override;
+  virtual void process(Event *evt) override;
+  virtual void dump(Dump &d) override;
+
+  pjs::Ref<pjs::Function> m_callback;
+  Options m_options;
+  pjs::Ref<KMP> m_kmp;
+  pjs::Ref<Data> m_replacement;
+  KMP::Split* m_split = nullptr;
+  Data m_window;
+  bool m_started = false;
+  bool m_ending = false;
+
+  bool transform(Data *chunk, Data *lookahead);
+};
+
+} // namespace pipy
+
+#endif // TRANSFORM_BODY_HPP
@@ -91,7 +91,7 @@ void Wait::process(Event *evt) {
       if (!callback(m_condition, 0, nullptr, ret)) return;
       if (ret.is_promise()) {
         auto cb = PromiseCallback::make(this);
-        ret.as<pjs::Promise>()->then(nullptr, cb->resolved(), cb->rejected());
+        ret.as<pjs::Promise>()->then(cb);
         m_promise_callback = cb;
       } else if (ret.to_boolean()) {
         fulfill();
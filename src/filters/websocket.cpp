@@ -24,6 +24,7 @@
  */
 
 #include "websocket.hpp"
+#include "compressor.hpp"
 #include "log.hpp"
 
 namespace pipy {
@@ -50,21 +51,84 @@ namespace websocket {
 
 static Data::Producer s_dp("WebSocket");
 
+// Appended to a compressed message before inflating (RFC 7692 section 7.2.2)
+static const uint8_t s_deflate_tail[] = { 0x00, 0x00, 0xff, 0xff };
+
+//
+// Masking XORs 8 bytes at a time against the key repeated twice and
+// rotated to where the last chunk left off. Bytes go straight from the
+// input views into the chunks of the output without a staging buffer.
+//
+
+static void mask_bytes(const char *src, char *dst, int len, const uint8_t mask[4], int offset) {
+  uint8_t key[8];
+  for (int i = 0; i < 8; i++) key[i] = mask[(offset + i) & 3];
+  uint64_t k;
+  std::memcpy(&k, key, 8);
+  int i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    std::memcpy(&w, src + i, 8);
+    w ^= k;
+    std::memcpy(dst + i, &w, 8);
+  }
+  for (; i < len; i++) dst[i] = src[i] ^ key[i & 7];
+}
+
+static void mask_data(const Data &in, Data &out, const uint8_t mask[4], int &offset) {
+  for (const auto c : in.chunks()) {
+    auto src = std::get<0>(c);
+    auto len = std::get<1>(c);
+    Data buf(len, &s_dp);
+    for (const auto d : buf.chunks()) {
+      auto dst = std::get<0>(d);
+      auto n = std::get<1>(d);
+      mask_bytes(src, dst, n, mask, offset);
+      src += n;
+      offset = (offset + n) & 3;
+    }
+    out.push(std::move(buf));
+  }
+}
+
+//
+// Options
+//
+
+Options::Options(pjs::Object *options) {
+  Value(options, "permessageDeflate")
+    .get(deflate)
+    .check_nullable();
+  Value(options, "noContextTakeover")
+    .get(no_context_takeover)
+    .check_nullable();
+  Value(options, "maxWindowBits")
+    .get(max_window_bits)
+    .check_nullable();
+  if (max_window_bits < 8 || max_window_bits > 15) {
+    throw std::runtime_error("options.maxWindowBits expects 8 to 15");
+  }
+  // zlib does not do raw deflate with an 8-bit window
+  if (max_window_bits == 8) max_window_bits = 9;
+}
+
 //
 // Decoder
 //
 
-Decoder::Decoder()
+Decoder::Decoder(const Options &options)
+  : m_options(options)
 {
 }
 
 Decoder::Decoder(const Decoder &r)
-  : Decoder()
+  : Decoder(r.m_options)
 {
 }
 
 Decoder::~Decoder()
 {
+  if (m_inflate) m_inflate->finalize();
 }
 
 void Decoder::dump(Dump &d) {
@@ -80,6 +144,12 @@ void Decoder::reset() {
   Filter::reset();
   Deframer::reset();
   m_started = false;
+  m_compressed = false;
+  m_inflate_error = false;
+  if (m_inflate) {
+    m_inflate->finalize();
+    m_inflate = nullptr;
+  }
 }
 
 void Decoder::process(Event *evt) {
@@ -144,6 +214,10 @@ auto Decoder::on_state(int state, int c) -> int {
     return message_start();
   case PAYLOAD:
     message_end();
+    if (m_inflate_error) {
+      Filter::output(StreamEnd::make(StreamEnd::PROTOCOL_ERROR));
+      return ERROR;
+    }
     return OPCODE;
   }
   return state;
@@ -151,21 +225,36 @@ auto Decoder::on_state(int state, int c) -> int {
 
 void Decoder::on_pass(Data &data) {
   if (m_has_mask) {
-    uint8_t buf[DATA_CHUNK_SIZE];
-    auto output = Data::make();
-    auto &p = m_mask_pointer;
-    for (const auto c : data.chunks()) {
-      const auto ptr = std::get<0>(c);
-      const auto len = std::get<1>(c);
-      for (auto i = 0; i < len; i++) buf[i] = ptr[i] ^ m_mask[p++ & 3];
-      s_dp.push(output, buf, len);
+    Data output;
+    mask_data(data, output, m_mask, m_mask_pointer);
+    if (m_compressed) {
+      inflate(output);
+    } else {
+      Filter::output(Data::make(std::move(output)));
     }
-    Filter::output(output);
+  } else if (m_compressed) {
+    inflate(data);
   } else {
     Filter::output(Data::make(std::move(data)));
   }
 }
 
+void Decoder::inflate(const Data &data) {
+  if (m_inflate_error) return;
+  if (!m_inflate) {
+    m_inflate = Decompressor::inflate_raw(
+      [this](Data &data) {
+        if (!data.empty()) {
+          Filter::output(Data::make(std::move(data)));
+        }
+      }
+    );
+  }
+  if (!m_inflate->input(data)) {
+    m_inflate_error = true;
+  }
+}
+
 auto Decoder::message_start() -> State {
   if (!m_started) {
     auto head = MessageHead::make();
@@ -173,6 +262,7 @@ auto Decoder::message_start() -> State {
     head->masked = m_has_mask;
     Filter::output(MessageStart::make(head));
     m_started = true;
+    m_compressed = m_options.deflate && (m_opcode & 0x40);
   }
 
   if (m_payload_size > 0) {
@@ -186,6 +276,12 @@ auto Decoder::message_start() -> State {
 
 void Decoder::message_end() {
   if (m_opcode & 0x80) {
+    if (m_compressed) {
+      Data tail(s_deflate_tail, sizeof(s_deflate_tail), &s_dp);
+      inflate(tail);
+      if (m_inflate_error) return;
+      m_compressed = false;
+    }
     Filter::output(MessageEnd::make());
     m_started = false;
   }
@@ -195,17 +291,19 @@ void Decoder::message_end() {
 // Encoder
 //
 
-Encoder::Encoder()
+Encoder::Encoder(const Options &options)
+  : m_options(options)
 {
 }
 
 Encoder::Encoder(const Encoder &r)
-  : Encoder()
+  : Encoder(r.m_options)
 {
 }
 
 Encoder::~Encoder()
 {
+  if (m_deflate) m_deflate->finalize();
 }
 
 void Encoder::dump(Dump &d) {
@@ -221,6 +319,10 @@ void Encoder::reset() {
   Filter::reset();
   m_buffer.clear();
   m_start = nullptr;
+  if (m_deflate) {
+    m_deflate->finalize();
+    m_deflate = nullptr;
+  }
 }
 
 void Encoder::process(Event *evt) {
@@ -231,12 +333,23 @@ void Encoder::process(Event *evt) {
       m_opcode = head->opcode;
       m_masked = head->masked;
       m_continuation = false;
+      m_compressing = m_options.deflate && (m_opcode == 1 || m_opcode == 2);
       m_buffer.clear();
+      if (m_compressing && !m_deflate) {
+        m_deflate = Compressor::deflate_raw(
+          [this](Data &data) { m_buffer.push(std::move(data)); },
+          m_options.max_window_bits
+        );
+      }
       output(evt);
     }
 
   } else if (auto data = evt->as<Data>()) {
-    m_buffer.push(*data);
+    if (m_compressing) {
+      m_deflate->input(*data, false);
+    } else {
+      m_buffer.push(*data);
+    }
     while (m_buffer.size() >= DATA_CHUNK_SIZE) {
       Data buf;
       m_buffer.shift(DATA_CHUNK_SIZE, buf);
@@ -245,6 +358,11 @@ void Encoder::process(Event *evt) {
 
   } else if (evt->is<MessageEnd>()) {
     if (m_start) {
+      if (m_compressing) {
+        m_deflate->sync();
+        m_buffer.pop(sizeof(s_deflate_tail));
+        if (m_options.no_context_takeover) m_deflate->reset();
+      }
       frame(m_buffer, true);
       m_buffer.clear();
       m_continuation = false;
@@ -267,7 +385,7 @@ void Encoder::frame(const Data &data, bool final) {
   if (m_continuation) {
     head[p++] = (final ? 0x80 : 0);
   } else {
-    head[p++] = (m_opcode & 0x0f) | (final ? 0x80 : 0);
+    head[p++] = (m_opcode & 0x0f) | (final ? 0x80 : 0) | (m_compressing ? 0x40 : 0);
     m_continuation = true;
   }
 
@@ -304,13 +422,8 @@ void Encoder::frame(const Data &data, bool final) {
   s_dp.push(out, head, p);
 
   if (m_masked) {
-    uint8_t buf[DATA_CHUNK_SIZE], p = 0;
-    for (const auto c : data.chunks()) {
-      auto ptr = std::get<0>(c);
-      auto len = std::get<1>(c);
-      for (int i = 0; i < len; i++) buf[i] = ptr[i] ^ mask[p++ & 3];
-      s_dp.push(out, buf, len);
-    }
+    int offset = 0;
+    mask_data(data, *out, mask, offset);
 
   } else {
     out->push(data);
@@ -28,12 +28,32 @@
 
 #include "filter.hpp"
 #include "deframer.hpp"
+#include "options.hpp"
 
 #include <random>
 
 namespace pipy {
+
+class Compressor;
+class Decompressor;
+
 namespace websocket {
 
+//
+// Options
+//
+// Settings of the permessage-deflate extension (RFC 7692) as agreed on
+// in the handshake. Negotiation itself is left to the script.
+//
+
+struct Options : public pipy::Options {
+  bool deflate = false;
+  bool no_context_takeover = false;
+  int max_window_bits = 15;
+  Options() {}
+  Options(pjs::Object *options);
+};
+
 //
 // MessageHead
 //
@@ -50,7 +70,7 @@ public:
 
 class Decoder : public Filter, public Deframer {
 public:
-  Decoder();
+  Decoder(const Options &options = Options());
 
 private:
   Decoder(const Decoder &r);
@@ -63,6 +83,7 @@ private:
 
 private:
   enum State {
+    ERROR = -1,
     OPCODE,
     LENGTH,
     LENGTH_16,
@@ -71,17 +92,23 @@ private:
     PAYLOAD,
   };
 
+  Options m_options;
   uint8_t m_opcode;
   uint8_t m_buffer[8];
   uint64_t m_payload_size;
   uint8_t m_mask[4];
-  uint8_t m_mask_pointer;
+  int m_mask_pointer;
   bool m_has_mask;
   bool m_started;
+  bool m_compressed = false;
+  bool m_inflate_error = false;
+  Decompressor* m_inflate = nullptr;
 
   virtual auto on_state(int state, int c) -> int override;
   virtual void on_pass(Data &data) override;
 
+  void inflate(const Data &data);
+
   auto message_start() -> State;
   void message_end();
 };
@@ -92,7 +119,7 @@ private:
 
 class Encoder : public Filter {
 public:
-  Encoder();
+  Encoder(const Options &options = Options());
 
 private:
   Encoder(const Encoder &r);
@@ -104,8 +131,11 @@ private:
   virtual void dump(Dump &d) override;
 
 private:
+  Options m_options;
   Data m_buffer;
   pjs::Ref<MessageStart> m_start;
+  Compressor* m_deflate = nullptr;
+  bool m_compressing = false;
   std::minstd_rand m_rand;
   uint8_t m_opcode;
   bool m_masked;
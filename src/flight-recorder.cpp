@@ -0,0 +1,162 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "flight-recorder.hpp"
+#include "worker-thread.hpp"
+
+#include <cstring>
+
+namespace pipy {
+
+List<FlightRecorder::Ring> FlightRecorder::s_all_rings;
+
+auto FlightRecorder::stage_name(Stage stage) -> const char* {
+  switch (stage) {
+    case ACCEPT: return "accept";
+    case TLS_HANDSHAKE: return "tlsHandshake";
+    case TLS_DONE: return "tlsDone";
+    case REQUEST: return "request";
+    case CONNECT: return "connect";
+    case CONNECTED: return "connected";
+    case UPSTREAM_FIRST_BYTE: return "upstreamFirstByte";
+    case DOWNSTREAM_FIRST_BYTE: return "downstreamFirstByte";
+    case END: return "end";
+    default: return "";
+  }
+}
+
+void FlightRecorder::collect(double min_time, const std::function<void(const Record&)> &cb) {
+  auto min_us = uint32_t(std::max(0.0, min_time * 1e6)) + 1;
+  std::lock_guard<std::mutex> lock(all_rings_mutex());
+  for (auto r = s_all_rings.head(); r; r = r->next()) {
+    std::lock_guard<std::mutex> lock(r->m_mutex);
+    auto n = std::min(r->m_count, (size_t)RING_SIZE);
+    for (size_t i = 0; i < n; i++) {
+      const auto &rec = r->m_records[(r->m_count - 1 - i) % RING_SIZE];
+      if (rec.times[END] >= min_us) cb(rec);
+    }
+  }
+}
+
+auto FlightRecorder::ring() -> Ring& {
+  thread_local static Ring s_ring;
+  return s_ring;
+}
+
+auto FlightRecorder::all_rings_mutex() -> std::mutex& {
+  static std::mutex s_mutex;
+  return s_mutex;
+}
+
+//
+// FlightRecorder::Timeline
+//
+
+bool FlightRecorder::Timeline::end() {
+  mark(END);
+  m_ended = true;
+  auto rate = utils::cycles_per_second() / 1e6;
+  auto total = uint32_t(std::min(m_cycles[END] / rate, 4e9));
+  auto &r = ring();
+  r.add(total);
+  return r.is_slow(total);
+}
+
+void FlightRecorder::Timeline::keep(const std::string &address, int port) {
+  auto rate = utils::cycles_per_second() / 1e6;
+  Record rec;
+  rec.id = m_id;
+  rec.start = m_start;
+  rec.worker = WorkerThread::current() ? WorkerThread::current()->index() : -1;
+  rec.port = port;
+  auto len = std::min(address.length(), sizeof(rec.address) - 1);
+  std::memcpy(rec.address, address.c_str(), len);
+  rec.address[len] = 0;
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    auto c = m_cycles[i];
+    rec.times[i] = c ? uint32_t(std::min((c - 1) / rate, 4e9)) + 1 : 0;
+  }
+  ring().keep(rec);
+}
+
+//
+// FlightRecorder::Ring
+//
+
+FlightRecorder::Ring::Ring() {
+  std::lock_guard<std::mutex> lock(all_rings_mutex());
+  s_all_rings.push(this);
+}
+
+FlightRecorder::Ring::~Ring() {
+  std::lock_guard<std::mutex> lock(all_rings_mutex());
+  s_all_rings.remove(this);
+}
+
+void FlightRecorder::Ring::add(uint32_t total) {
+  m_buckets[bucket_of(total)]++;
+  if (!(++m_total & 0xff)) update_threshold();
+}
+
+void FlightRecorder::Ring::keep(const Record &rec) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_records[m_count++ % RING_SIZE] = rec;
+}
+
+auto FlightRecorder::Ring::bucket_of(uint32_t t) -> int {
+  if (t < 4) return t;
+  int e = 2;
+  while (e < 31 && (t >> (e + 1))) e++;
+  return (e - 1) * 4 + ((t >> (e - 2)) & 3);
+}
+
+auto FlightRecorder::Ring::bucket_floor(int i) -> uint32_t {
+  if (i < 4) return i;
+  auto e = i / 4 + 1;
+  return uint32_t(4 + i % 4) << (e - 2);
+}
+
+void FlightRecorder::Ring::update_threshold() {
+  auto tail = m_total / 100;
+  uint32_t sum = 0;
+  int i = BUCKET_COUNT - 1;
+  while (i > 0) {
+    sum += m_buckets[i];
+    if (sum > tail) break;
+    i--;
+  }
+  m_threshold = bucket_floor(i);
+
+  if (m_total >= 0x10000) {
+    m_total = 0;
+    for (auto &n : m_buckets) {
+      n /= 2;
+      m_total += n;
+    }
+  }
+}
+
+} // namespace pipy
@@ -0,0 +1,166 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef FLIGHT_RECORDER_HPP
+#define FLIGHT_RECORDER_HPP
+
+#include "pjs/pjs.hpp"
+#include "list.hpp"
+#include "utils.hpp"
+
+#include <functional>
+#include <mutex>
+#include <string>
+
+namespace pipy {
+
+//
+// FlightRecorder
+//
+// Always-on timelines of inbound connections. Every inbound carries a
+// small Timeline where the first time each stage is reached gets marked
+// with a cycle count. When the connection ends, its total duration goes
+// into a histogram of the worker thread, and only timelines slower than
+// the running 99th percentile are kept, in a ring of the worker thread.
+//
+
+class FlightRecorder {
+public:
+  enum Stage {
+    ACCEPT,
+    TLS_HANDSHAKE,
+    TLS_DONE,
+    REQUEST,
+    CONNECT,
+    CONNECTED,
+    UPSTREAM_FIRST_BYTE,
+    DOWNSTREAM_FIRST_BYTE,
+    END,
+    STAGE_COUNT,
+  };
+
+  static const int RING_SIZE = 256;
+
+  //
+  // FlightRecorder::Record
+  //
+
+  struct Record {
+    uint64_t id;
+    double start; // wall clock in milliseconds
+    int worker;
+    int port;
+    char address[64];
+    uint32_t times[STAGE_COUNT]; // microseconds since accept + 1, 0 if never reached
+  };
+
+  //
+  // FlightRecorder::Timeline
+  //
+
+  class Timeline :
+    public pjs::RefCount<Timeline>,
+    public pjs::Pooled<Timeline>
+  {
+  public:
+    static auto make(uint64_t id) -> Timeline* {
+      return new Timeline(id);
+    }
+
+    void mark(Stage stage) {
+      if (!m_cycles[stage] && !m_ended) {
+        m_cycles[stage] = utils::cycles() - m_start_cycles + 1;
+      }
+    }
+
+    // Returns true if the timeline is slow enough to be kept
+    bool end();
+    void keep(const std::string &address, int port);
+
+  private:
+    Timeline(uint64_t id)
+      : m_id(id)
+      , m_start(utils::now())
+      , m_start_cycles(utils::cycles()) {}
+
+    uint64_t m_id;
+    double m_start;
+    uint64_t m_start_cycles;
+    uint64_t m_cycles[STAGE_COUNT] = { 0 };
+    bool m_ended = false;
+
+    friend class pjs::RefCount<Timeline>;
+  };
+
+  static auto stage_name(Stage stage) -> const char*;
+
+  // Kept records of all threads with a total time of at least min_time seconds
+  static void collect(double min_time, const std::function<void(const Record&)> &cb);
+
+private:
+
+  //
+  // FlightRecorder::Ring
+  //
+  // Durations are bucketed by their top 3 significant bits so that the
+  // threshold follows the tail within about 12%. Counts are halved now
+  // and then to let it follow changes in load as well.
+  //
+
+  class Ring : public List<Ring>::Item {
+  public:
+    Ring();
+    ~Ring();
+
+    void add(uint32_t total);
+    bool is_slow(uint32_t total) const { return total >= m_threshold; }
+    void keep(const Record &rec);
+
+  private:
+    enum { BUCKET_COUNT = 128 };
+
+    std::mutex m_mutex;
+    Record m_records[RING_SIZE];
+    size_t m_count = 0;
+    uint32_t m_buckets[BUCKET_COUNT] = { 0 };
+    uint32_t m_total = 0;
+    uint32_t m_threshold = 0;
+
+    static auto bucket_of(uint32_t t) -> int;
+    static auto bucket_floor(int i) -> uint32_t;
+    void update_threshold();
+
+    friend class FlightRecorder;
+  };
+
+  static auto ring() -> Ring&;
+  static auto all_rings_mutex() -> std::mutex&;
+  static List<Ring> s_all_rings;
+};
+
+} // namespace pipy
+
+#endif // FLIGHT_RECORDER_HPP
@@ -29,16 +29,62 @@
 #include "pipeline.hpp"
 #include "log.hpp"
 #include "os-platform.hpp"
+#include "thread-pool.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <limits.h>
+#include <cstring>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace pipy {
 
+#ifndef _WIN32
+
+//
+// Regular files are always "ready" to epoll, so reading or writing them
+// through a stream descriptor blocks the worker thread on the disk. They
+// are read and written by offset on io_uring or on these threads instead.
+//
+
+static const size_t FILE_READ_SIZE = 0x10000;
+
+static auto file_io_threads() -> ThreadPool& {
+  static auto *s_threads = new ThreadPool(4);
+  return *s_threads;
+}
+
+#endif // !_WIN32
+
 FileStream::FileStream(size_t read_size, os::FileHandle fd, Data::Producer *dp)
   : FlushTarget(true)
-  , m_stream(Net::context(), fd.get())
+  , m_stream(Net::context())
   , m_fd(fd)
   , m_dp(dp)
   , m_read_size(read_size)
 {
+#ifdef _WIN32
+  m_stream.assign(fd.get());
+#else
+  struct stat st;
+  if (!fstat(fd.get(), &st) && S_ISREG(st.st_mode)) {
+    auto pos = lseek(fd.get(), 0, SEEK_CUR);
+    if (pos > 0) m_file_pointer = pos;
+    m_regular = true;
+    m_append = (fcntl(fd.get(), F_GETFL) & O_APPEND);
+    m_file_read.stream = this;
+    m_file_write.stream = this;
+    m_file_write.is_write = true;
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (m_read_size) posix_fadvise(fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  } else {
+    m_stream.assign(fd.get());
+  }
+#endif
   read();
 }
 
@@ -46,8 +92,18 @@ void FileStream::close() {
   if (m_closed) return;
 
   std::error_code ec;
-  m_stream.release();
-  if (!m_no_close) m_fd.close();
+  if (m_stream.is_open()) m_stream.release();
+  if (!m_no_close) {
+#ifndef _WIN32
+    if (m_file_read.pending || m_file_write.pending) {
+      m_close_deferred = true;
+    } else {
+      m_fd.close();
+    }
+#else
+    m_fd.close();
+#endif
+  }
 
   if (m_receiving_state == PAUSED) {
     m_receiving_state = RECEIVING;
@@ -98,6 +154,13 @@ void FileStream::on_tap_close() {
 void FileStream::read() {
   if (!m_read_size) return;
 
+#ifndef _WIN32
+  if (m_regular) {
+    read_file();
+    return;
+  }
+#endif
+
   auto n = RECEIVE_BUFFER_SIZE;
   if (m_read_size > 0 && m_read_size < RECEIVE_BUFFER_SIZE) n = m_read_size;
 
@@ -166,10 +229,15 @@ void FileStream::write(Data *data) {
   if (!m_closed && !m_ended) {
     if (!data->empty()) {
       if (!m_overflowed) {
-        if (m_buffer_limit > 0 && m_buffer.size() >= m_buffer_limit) {
+#ifdef _WIN32
+        auto size = m_buffer.size();
+#else
+        auto size = m_buffer.size() + m_writing.size();
+#endif
+        if (m_buffer_limit > 0 && size >= m_buffer_limit) {
           Log::error(
             "FileStream: %p, buffer overflow, size = %d, fd = %d",
-            this, m_fd.get(), m_buffer.size());
+            this, m_fd.get(), size);
           m_overflowed = true;
         }
       }
@@ -185,7 +253,7 @@ void FileStream::write(Data *data) {
 void FileStream::end() {
   if (!m_closed && !m_ended) {
     m_ended = true;
-    if (m_buffer.empty()) {
+    if (m_buffer.empty() && !m_pumping) {
       close();
     } else {
       pump();
@@ -195,6 +263,14 @@ void FileStream::end() {
 
 void FileStream::pump() {
   if (m_pumping) return;
+
+#ifndef _WIN32
+  if (m_regular) {
+    if (!m_buffer.empty() || !m_writing.empty()) write_file();
+    return;
+  }
+#endif
+
   if (m_buffer.empty()) return;
 
   auto on_sent = [=](const std::error_code &ec, std::size_t n) {
@@ -240,4 +316,176 @@ void FileStream::pump() {
   m_pumping = true;
 }
 
+#ifndef _WIN32
+
+void FileStream::read_file() {
+  if (m_file_read.pending) return;
+
+  auto n = FILE_READ_SIZE;
+  if (m_read_size > 0 && m_read_size < FILE_READ_SIZE) n = m_read_size;
+
+  m_read_data = m_dp->make(n);
+
+  auto &iov = m_file_read.iov;
+  iov.clear();
+  for (const auto c : m_read_data->chunks()) {
+    iov.push_back({ std::get<0>(c), (size_t)std::get<1>(c) });
+  }
+
+  start(&m_file_read);
+}
+
+//
+// Everything buffered while the previous write was in flight goes out
+// in the next one, so small writes such as log lines are coalesced into
+// as few system calls as the disk can keep up with.
+//
+
+void FileStream::write_file() {
+  m_writing.push(m_buffer);
+  m_buffer.clear();
+
+  auto &iov = m_file_write.iov;
+  iov.clear();
+  for (const auto c : m_writing.chunks()) {
+    if (iov.size() >= IOV_MAX) break;
+    iov.push_back({ std::get<0>(c), (size_t)std::get<1>(c) });
+  }
+
+  m_pumping = true;
+  start(&m_file_write);
+}
+
+void FileStream::start(FileOp *op) {
+  auto fd = m_fd.get();
+  auto offset = m_file_pointer;
+  auto iov = op->iov.data();
+  auto count = int(op->iov.size());
+
+  op->pending = true;
+  retain();
+
+#ifdef PIPY_HAS_IO_URING
+  if (auto uring = Uring::current()) {
+    if (op->is_write) {
+      uring->writev(fd, iov, count, offset, op);
+    } else {
+      uring->readv(fd, iov, count, offset, op);
+    }
+    return;
+  }
+#endif
+
+  // Nothing else may be pending on the event loop while the file I/O
+  // thread works, so keep the loop from running out of work until the
+  // completion has been posted back
+  auto net = &Net::current();
+  auto append = m_append;
+  auto work = std::make_shared<asio::executor_work_guard<asio::io_context::executor_type>>(
+    asio::make_work_guard(Net::context())
+  );
+  file_io_threads().run(
+    [=]() {
+      ssize_t n;
+      if (!op->is_write) {
+        n = preadv(fd, iov, count, offset);
+      } else if (append) {
+        n = writev(fd, iov, count);
+      } else {
+        n = pwritev(fd, iov, count, offset);
+      }
+      int result = (n < 0 ? -errno : int(n));
+      net->post([=]() { on_file_op(op, result); });
+      work->reset();
+    }
+  );
+}
+
+void FileStream::on_file_op(FileOp *op, int result) {
+  op->pending = false;
+
+  if (m_closed) {
+    if (m_close_deferred && !m_file_read.pending && !m_file_write.pending) {
+      m_close_deferred = false;
+      m_fd.close();
+    }
+    m_read_data = nullptr;
+    m_writing.clear();
+    m_pumping = false;
+    release();
+    return;
+  }
+
+  InputContext ic(this);
+
+  if (op->is_write) {
+    m_pumping = false;
+
+    if (result < 0) {
+      Log::warn(
+        "FileStream: %p, error writing to stream [fd = %d], %s",
+        this, m_fd.get(), std::strerror(-result));
+      m_writing.clear();
+      m_buffer.clear();
+
+    } else {
+      m_file_pointer += result;
+      m_writing.shift(result);
+      pump();
+    }
+
+    if (m_overflowed && m_buffer.size() + m_writing.size() < m_buffer_limit) {
+      m_overflowed = false;
+    }
+
+    if (m_ended && !m_pumping) close();
+
+  } else {
+    pjs::Ref<Data> buffer(m_read_data);
+    m_read_data = nullptr;
+
+    bool read_end = false;
+
+    if (result > 0) {
+      size_t n = result;
+      if (m_read_size > 0) {
+        if (m_read_size > n) {
+          m_read_size -= n;
+        } else {
+          n = m_read_size;
+          m_read_size = 0;
+          read_end = true;
+        }
+      }
+      m_file_pointer += n;
+      buffer->pop(buffer->size() - n);
+      output(buffer);
+    }
+
+    if (read_end || result == 0) {
+      Log::debug(Log::FILES, "FileStream: %p, end of stream [fd = %d]", this, m_fd.get());
+      output(StreamEnd::make(StreamEnd::NO_ERROR));
+      close();
+
+    } else if (result < 0) {
+      Log::warn(
+        "FileStream: %p, error reading from stream [fd = %d]: %s",
+        this, m_fd.get(), std::strerror(-result));
+      output(StreamEnd::make(StreamEnd::READ_ERROR));
+      close();
+
+    } else if (m_receiving_state == PAUSING) {
+      m_receiving_state = PAUSED;
+      retain();
+
+    } else if (m_receiving_state == RECEIVING) {
+      read();
+    }
+  }
+
+  release();
+}
+
+#endif // !_WIN32
+
 } // namespace pipy
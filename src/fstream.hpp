@@ -30,9 +30,15 @@
 #include "event.hpp"
 #include "input.hpp"
 #include "os-platform.hpp"
+#include "uring.hpp"
 
 #include <stdio.h>
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <vector>
+#endif
+
 namespace pipy {
 
 class Data;
@@ -97,6 +103,45 @@ private:
   void end();
   void pump();
 
+#ifndef _WIN32
+
+  //
+  // FileStream::FileOp
+  //
+  // A read or a write on a regular file, for which epoll has no notion
+  // of readiness. It goes to io_uring when that is enabled, or to a small
+  // set of file I/O threads otherwise, and completes on this thread.
+  //
+
+#ifdef PIPY_HAS_IO_URING
+  struct FileOp : public Uring::Handler {
+    virtual void on_uring_complete(int result) override {
+      stream->on_file_op(this, result);
+    }
+#else
+  struct FileOp {
+#endif
+    FileStream* stream = nullptr;
+    bool is_write = false;
+    bool pending = false;
+    std::vector<struct iovec> iov;
+  };
+
+  FileOp m_file_read;
+  FileOp m_file_write;
+  pjs::Ref<Data> m_read_data;
+  Data m_writing;
+  bool m_regular = false;
+  bool m_append = false;
+  bool m_close_deferred = false;
+
+  void read_file();
+  void write_file();
+  void start(FileOp *op);
+  void on_file_op(FileOp *op, int result);
+
+#endif // !_WIN32
+
   friend class pjs::RefCount<FileStream>;
 };
 
@@ -45,9 +45,16 @@ void Graph::from_pipelines(Graph &g, const std::set<PipelineLayout*> &pipelines)
     p.index = pipeline->index();
     p.name = pipeline->name()->str();
     p.label = pipeline->label()->str();
+    p.stats.active = pipeline->active();
+    p.stats.started = pipeline->started();
     for (auto &f : pipeline->m_filters) {
       Graph::Filter gf;
       f->dump(gf);
+      if (auto bs = f->buffer_stats()) gf.stats.buffered = bs->size;
+      if (auto fs = f->filter_stats()) {
+        gf.stats.events = fs->events;
+        gf.stats.bytes = fs->bytes;
+      }
       p.filters.emplace_back(std::move(gf));
     }
     g.add_pipeline(std::move(p));
@@ -463,7 +470,7 @@ auto Graph::to_text(std::string &error) -> std::vector<std::string> {
   return lines;
 }
 
-void Graph::to_json(std::string &error, std::ostream &out) {
+void Graph::to_json(std::string &error, std::ostream &out, std::vector<Stats> *stats) {
   std::list<std::unique_ptr<Node>> roots;
   std::vector<Node*> nodes;
 
@@ -549,6 +556,13 @@ void Graph::to_json(std::string &error, std::ostream &out) {
   }
 
   out << "]}";
+
+  if (stats) {
+    stats->resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (auto s = nodes[i]->stats()) (*stats)[i] = *s;
+    }
+  }
 }
 
 void Graph::find_roots() {
@@ -580,11 +594,14 @@ auto Graph::build_tree(const Pipeline &pipeline, std::string &error) -> Node* {
 
   std::function<void(const Pipeline&, Node*)> build;
   build = [&](const Pipeline &pipeline, Node *pipeline_node) {
+    pipeline_node->stats(&pipeline.stats);
     for (const auto &f : pipeline.filters) {
       if (f.subs.empty()) {
-        new Node(pipeline_node, Node::FILTER, f.name);
+        auto node = new Node(pipeline_node, Node::FILTER, f.name);
+        node->stats(&f.stats);
       } else {
         auto link_node = new Node(pipeline_node, Node::JOINT, f.out_type, f.sub_type, f.name);
+        link_node->stats(&f.stats);
         for (const auto &s : f.subs) {
           bool recursive = false;
           for (auto p = pipeline_node; p; p = p->parent()) {
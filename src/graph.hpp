@@ -50,9 +50,33 @@ public:
     std::string name;
   };
 
+  //
+  // Graph::Stats
+  //
+  // Live numbers of a running pipeline layout or filter. Counters are
+  // cumulative so that rates can be taken between two snapshots.
+  //
+
+  struct Stats {
+    uint64_t active = 0;   // pipelines currently running
+    uint64_t started = 0;  // pipelines started so far
+    uint64_t events = 0;   // events into the filter, with --filter-stats only
+    uint64_t bytes = 0;    // bytes into the filter, with --filter-stats only
+    uint64_t buffered = 0; // bytes currently held by the filter
+
+    void operator+=(const Stats &r) {
+      active += r.active;
+      started += r.started;
+      events += r.events;
+      bytes += r.bytes;
+      buffered += r.buffered;
+    }
+  };
+
   struct Filter : public pipy::Filter::Dump {
     int row = 0;
     int column = 0;
+    Stats stats;
   };
 
   struct Pipeline {
@@ -61,6 +85,7 @@ public:
     std::string label;
     std::list<Filter> filters;
     bool root = false;
+    Stats stats;
   };
 
   static void from_pipelines(Graph &g, const std::set<PipelineLayout*> &pipelines);
@@ -69,7 +94,7 @@ public:
   auto add_pipeline(Pipeline &&p) -> int;
 
   auto to_text(std::string &error) -> std::vector<std::string>;
-  void to_json(std::string &error, std::ostream &out);
+  void to_json(std::string &error, std::ostream &out, std::vector<Stats> *stats = nullptr);
 
 private:
   class Node : public List<Node>::Item {
@@ -123,6 +148,8 @@ private:
     auto index() const -> int { return m_index; }
     void index(int i) { m_index = i; }
     auto pipeline_index() const -> int { return m_pipeline_index; }
+    auto stats() const -> const Stats* { return m_stats; }
+    void stats(const Stats *s) { m_stats = s; }
 
   private:
     Node* m_parent;
@@ -133,6 +160,7 @@ private:
     Filter::Dump::SubType m_sub_type;
     int m_index = 0;
     int m_pipeline_index;
+    const Stats* m_stats = nullptr;
   };
 
   std::list<Pipeline> m_pipelines;
@@ -0,0 +1,193 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "header-names.hpp"
+
+#include <cstring>
+
+namespace pipy {
+namespace http {
+
+static const char *s_header_names[] = {
+  ":authority",
+  ":method",
+  ":path",
+  ":scheme",
+  ":status",
+  ":protocol",
+  "accept",
+  "accept-charset",
+  "accept-encoding",
+  "accept-language",
+  "accept-patch",
+  "accept-ranges",
+  "access-control-allow-credentials",
+  "access-control-allow-headers",
+  "access-control-allow-methods",
+  "access-control-allow-origin",
+  "access-control-expose-headers",
+  "access-control-max-age",
+  "access-control-request-headers",
+  "access-control-request-method",
+  "age",
+  "allow",
+  "alt-svc",
+  "authorization",
+  "cache-control",
+  "cdn-loop",
+  "connection",
+  "content-disposition",
+  "content-encoding",
+  "content-language",
+  "content-length",
+  "content-location",
+  "content-md5",
+  "content-range",
+  "content-security-policy",
+  "content-type",
+  "cookie",
+  "date",
+  "dnt",
+  "early-data",
+  "etag",
+  "expect",
+  "expires",
+  "forwarded",
+  "from",
+  "grpc-accept-encoding",
+  "grpc-encoding",
+  "grpc-message",
+  "grpc-status",
+  "grpc-timeout",
+  "host",
+  "http2-settings",
+  "if-match",
+  "if-modified-since",
+  "if-none-match",
+  "if-range",
+  "if-unmodified-since",
+  "keep-alive",
+  "last-event-id",
+  "last-modified",
+  "link",
+  "location",
+  "max-forwards",
+  "origin",
+  "pragma",
+  "priority",
+  "proxy-authenticate",
+  "proxy-authorization",
+  "proxy-connection",
+  "range",
+  "referer",
+  "refresh",
+  "retry-after",
+  "sec-fetch-dest",
+  "sec-fetch-mode",
+  "sec-fetch-site",
+  "sec-fetch-user",
+  "sec-websocket-accept",
+  "sec-websocket-extensions",
+  "sec-websocket-key",
+  "sec-websocket-protocol",
+  "sec-websocket-version",
+  "server",
+  "server-timing",
+  "set-cookie",
+  "strict-transport-security",
+  "te",
+  "timing-allow-origin",
+  "traceparent",
+  "tracestate",
+  "trailer",
+  "transfer-encoding",
+  "upgrade",
+  "upgrade-insecure-requests",
+  "user-agent",
+  "vary",
+  "via",
+  "warning",
+  "www-authenticate",
+  "x-b3-parentspanid",
+  "x-b3-sampled",
+  "x-b3-spanid",
+  "x-b3-traceid",
+  "x-content-type-options",
+  "x-correlation-id",
+  "x-forwarded-for",
+  "x-forwarded-host",
+  "x-forwarded-proto",
+  "x-frame-options",
+  "x-powered-by",
+  "x-real-ip",
+  "x-request-id",
+  "x-requested-with",
+  "x-xss-protection",
+};
+
+static const int NAME_COUNT = sizeof(s_header_names) / sizeof(s_header_names[0]);
+static const int SLOT_BITS = 9;
+static const uint32_t HASH_SEED = 699317;
+
+static inline auto hash(const char *name, size_t len) -> uint32_t {
+  uint32_t h = HASH_SEED;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ uint8_t(name[i])) * 0x01000193;
+  }
+  return h >> (32 - SLOT_BITS);
+}
+
+//
+// Slots hold 1-based indices into s_header_names, with 0 for empty
+//
+
+static struct Slots {
+  uint8_t index[1 << SLOT_BITS];
+  uint8_t length[NAME_COUNT];
+
+  Slots() {
+    std::memset(index, 0, sizeof(index));
+    for (int i = 0; i < NAME_COUNT; i++) {
+      auto name = s_header_names[i];
+      auto len = std::strlen(name);
+      index[hash(name, len)] = i + 1;
+      length[i] = len;
+    }
+  }
+} s_slots;
+
+auto HeaderNames::find(const char *name, size_t len) -> pjs::Str* {
+  thread_local static pjs::Ref<pjs::Str> s_strings[NAME_COUNT];
+  auto i = s_slots.index[hash(name, len)];
+  if (!i--) return nullptr;
+  if (s_slots.length[i] != len) return nullptr;
+  if (std::memcmp(s_header_names[i], name, len)) return nullptr;
+  auto &s = s_strings[i];
+  if (!s) s = pjs::Str::make(s_header_names[i], len);
+  return s;
+}
+
+} // namespace http
+} // namespace pipy
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HEADER_NAMES_HPP
+#define HEADER_NAMES_HPP
+
+#include "pjs/pjs.hpp"
+
+namespace pipy {
+namespace http {
+
+//
+// HeaderNames
+//
+// Well-known header names in lowercase, shared by the HTTP/1 and HTTP/2
+// codecs so that both hand out the same string for the same name. Each
+// lookup is one hash and one compare: the hash seed is picked offline so
+// that no two names in the table fall into the same slot.
+//
+
+class HeaderNames {
+public:
+
+  // Returns nullptr when the name is not a well-known one
+  static auto find(const char *name, size_t len) -> pjs::Str*;
+
+  // Falls back to making a new string when the name is not a well-known one
+  static auto get(const char *name, size_t len) -> pjs::Str* {
+    if (auto s = find(name, len)) return s;
+    return pjs::Str::make(name, len);
+  }
+
+  static auto get(const std::string &name) -> pjs::Str* {
+    return get(name.c_str(), name.length());
+  }
+};
+
+} // namespace http
+} // namespace pipy
+
+#endif // HEADER_NAMES_HPP
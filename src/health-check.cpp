@@ -0,0 +1,657 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "health-check.hpp"
+#include "resolver.hpp"
+#include "utils.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <random>
+
+namespace pipy {
+
+static const size_t MAX_RESPONSE_SIZE = 0x10000;
+
+//
+// HealthChecker::Options
+//
+
+HealthChecker::Options::Options(pjs::Object *options) {
+  Value(options, "type")
+    .get_enum(type)
+    .check_nullable();
+  Value(options, "interval")
+    .get_seconds(interval)
+    .check_nullable();
+  Value(options, "timeout")
+    .get_seconds(timeout)
+    .check_nullable();
+  Value(options, "healthyThreshold")
+    .get(healthy_threshold)
+    .check_nullable();
+  Value(options, "unhealthyThreshold")
+    .get(unhealthy_threshold)
+    .check_nullable();
+  Value(options, "path")
+    .get(path)
+    .check_nullable();
+  Value(options, "host")
+    .get(host)
+    .check_nullable();
+  Value(options, "service")
+    .get(service)
+    .check_nullable();
+  Value(options, "consecutiveErrors")
+    .get(consecutive_errors)
+    .check_nullable();
+  Value(options, "baseEjectionTime")
+    .get_seconds(base_ejection_time)
+    .check_nullable();
+  Value(options, "maxEjectionTime")
+    .get_seconds(max_ejection_time)
+    .check_nullable();
+  Value(options, "maxEjectionPercent")
+    .get(max_ejection_percent)
+    .check_nullable();
+  if (interval <= 0) throw std::runtime_error("options.interval expects a positive number");
+  if (timeout <= 0) throw std::runtime_error("options.timeout expects a positive number");
+  healthy_threshold = std::max(1, healthy_threshold);
+  unhealthy_threshold = std::max(1, unhealthy_threshold);
+}
+
+auto HealthChecker::Options::key() const -> std::string {
+  std::string k;
+  k += std::to_string(int(type)); k += '\n';
+  k += std::to_string(interval); k += '\n';
+  k += std::to_string(timeout); k += '\n';
+  k += std::to_string(healthy_threshold); k += '\n';
+  k += std::to_string(unhealthy_threshold); k += '\n';
+  k += path; k += '\n';
+  k += host; k += '\n';
+  k += service; k += '\n';
+  k += std::to_string(consecutive_errors); k += '\n';
+  k += std::to_string(base_ejection_time); k += '\n';
+  k += std::to_string(max_ejection_time); k += '\n';
+  k += std::to_string(max_ejection_percent);
+  return k;
+}
+
+//
+// HealthChecker::Probe
+//
+// Runs one check at a time against a single target on the main thread.
+// Handlers of a round that has since timed out are recognized by the
+// round number they captured and ignored.
+//
+
+class HealthChecker::Probe :
+  public std::enable_shared_from_this<Probe>,
+  public Resolver::Handler
+{
+public:
+  Probe(HealthChecker *checker, const std::shared_ptr<Target> &target)
+    : m_checker(checker)
+    , m_target(target)
+    , m_interval_timer(Net::context())
+    , m_timeout_timer(Net::context())
+    , m_ejection_timer(Net::context())
+    , m_socket(Net::context()) {}
+
+  void start();
+  void cancel();
+  void eject(double duration);
+
+private:
+  HealthChecker* m_checker;
+  std::shared_ptr<Target> m_target;
+  std::string m_host;
+  int m_port = 0;
+  asio::steady_timer m_interval_timer;
+  asio::steady_timer m_timeout_timer;
+  asio::steady_timer m_ejection_timer;
+  asio::ip::tcp::socket m_socket;
+  std::string m_request;
+  std::string m_response;
+  std::string m_grpc_message;
+  size_t m_parsed = 0;
+  char m_buffer[4096];
+  int m_round = 0;
+  bool m_running = false;
+  bool m_writing = false;
+  bool m_canceled = false;
+
+  void schedule(double delay);
+  void run();
+  void connect(const asio::ip::address &address);
+  void send();
+  void receive();
+  void write(const std::string &data);
+  int parse();
+  int parse_http();
+  int parse_grpc();
+  void done(bool ok);
+
+  virtual void on_resolve(const std::vector<asio::ip::address> &addresses) override;
+};
+
+static auto random_fraction() -> double {
+  static std::minstd_rand rng(std::random_device{}());
+  return std::uniform_real_distribution<double>(0, 1)(rng);
+}
+
+void HealthChecker::Probe::start() {
+  if (!utils::get_host_port(m_target->name(), m_host, m_port)) {
+    Log::error("[health] invalid target address: %s", m_target->name().c_str());
+    return;
+  }
+
+  // Spread out the first rounds so that targets are not all probed at once
+  schedule(random_fraction() * m_checker->m_options.interval);
+}
+
+void HealthChecker::Probe::cancel() {
+  std::error_code ec;
+  m_canceled = true;
+  m_running = false;
+  Resolver::cancel(this);
+  m_interval_timer.cancel(ec);
+  m_timeout_timer.cancel(ec);
+  m_ejection_timer.cancel(ec);
+  m_socket.close(ec);
+}
+
+void HealthChecker::Probe::eject(double duration) {
+  auto self = shared_from_this();
+  m_ejection_timer.expires_after(std::chrono::milliseconds(int64_t(duration * 1000)));
+  m_ejection_timer.async_wait(
+    [=](const std::error_code &ec) {
+      if (ec || self->m_canceled) return;
+      self->m_checker->restore(self->m_target.get());
+    }
+  );
+}
+
+void HealthChecker::Probe::schedule(double delay) {
+  auto self = shared_from_this();
+  m_interval_timer.expires_after(std::chrono::milliseconds(int64_t(delay * 1000)));
+  m_interval_timer.async_wait(
+    [=](const std::error_code &ec) {
+      if (ec || self->m_canceled) return;
+      self->run();
+    }
+  );
+}
+
+void HealthChecker::Probe::run() {
+  auto self = shared_from_this();
+  auto round = ++m_round;
+
+  m_running = true;
+  m_writing = false;
+  m_response.clear();
+  m_grpc_message.clear();
+  m_parsed = 0;
+
+  m_timeout_timer.expires_after(std::chrono::milliseconds(int64_t(m_checker->m_options.timeout * 1000)));
+  m_timeout_timer.async_wait(
+    [=](const std::error_code &ec) {
+      if (ec || self->m_round != round) return;
+      self->done(false);
+    }
+  );
+
+  std::error_code ec;
+  auto ip = asio::ip::make_address(m_host, ec);
+  if (!ec) {
+    connect(ip);
+  } else {
+    Resolver::resolve(m_host, this);
+  }
+}
+
+void HealthChecker::Probe::on_resolve(const std::vector<asio::ip::address> &addresses) {
+  if (!m_running) return;
+  if (addresses.empty()) {
+    done(false);
+  } else {
+    connect(addresses.front());
+  }
+}
+
+void HealthChecker::Probe::connect(const asio::ip::address &address) {
+  auto self = shared_from_this();
+  auto round = m_round;
+
+  std::error_code ec;
+  m_socket.close(ec);
+  m_socket.async_connect(
+    asio::ip::tcp::endpoint(address, m_port),
+    [=](const std::error_code &ec) {
+      if (self->m_round != round || !self->m_running) return;
+      if (ec) {
+        self->done(false);
+      } else if (self->m_checker->m_options.type == Type::TCP) {
+        self->done(true);
+      } else {
+        self->send();
+      }
+    }
+  );
+}
+
+static void hpack_string(std::string &out, const std::string &s) {
+  auto n = s.length();
+  if (n < 127) {
+    out += char(n);
+  } else {
+    out += char(127);
+    n -= 127;
+    while (n >= 128) {
+      out += char(0x80 | (n & 0x7f));
+      n >>= 7;
+    }
+    out += char(n);
+  }
+  out += s;
+}
+
+static void http2_frame(std::string &out, int type, int flags, int stream, const std::string &payload) {
+  auto n = payload.length();
+  out += char(n >> 16);
+  out += char(n >> 8);
+  out += char(n >> 0);
+  out += char(type);
+  out += char(flags);
+  out += char(stream >> 24);
+  out += char(stream >> 16);
+  out += char(stream >> 8);
+  out += char(stream >> 0);
+  out += payload;
+}
+
+//
+// gRPC probes follow grpc.health.v1.Health/Check over cleartext HTTP/2
+// with prior knowledge. Header fields go out as literals without
+// indexing, so no HPACK state is needed on either side, and the verdict
+// is read from the response message rather than from the headers.
+//
+
+void HealthChecker::Probe::send() {
+  const auto &options = m_checker->m_options;
+  auto authority = options.host.empty() ? m_target->name() : options.host;
+
+  m_request.clear();
+
+  if (options.type == Type::HTTP) {
+    m_request += "GET ";
+    m_request += options.path;
+    m_request += " HTTP/1.1\r\nHost: ";
+    m_request += authority;
+    m_request += "\r\nUser-Agent: pipy-health-check\r\nConnection: close\r\n\r\n";
+
+  } else {
+    static const std::pair<std::string, std::string> fixed_headers[] = {
+      { ":method", "POST" },
+      { ":scheme", "http" },
+      { ":path", "/grpc.health.v1.Health/Check" },
+      { "content-type", "application/grpc" },
+      { "te", "trailers" },
+    };
+
+    std::string headers;
+    for (const auto &h : fixed_headers) {
+      headers += char(0);
+      hpack_string(headers, h.first);
+      hpack_string(headers, h.second);
+    }
+    headers += char(0);
+    hpack_string(headers, ":authority");
+    hpack_string(headers, authority);
+
+    std::string message;
+    if (!options.service.empty()) {
+      auto n = options.service.length();
+      message += char(0x0a);
+      while (n >= 128) {
+        message += char(0x80 | (n & 0x7f));
+        n >>= 7;
+      }
+      message += char(n);
+      message += options.service;
+    }
+
+    std::string data;
+    auto n = message.length();
+    data += char(0);
+    data += char(n >> 24);
+    data += char(n >> 16);
+    data += char(n >> 8);
+    data += char(n >> 0);
+    data += message;
+
+    m_request += "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    http2_frame(m_request, 4, 0, 0, std::string());
+    http2_frame(m_request, 1, 0x04, 1, headers);
+    http2_frame(m_request, 0, 0x01, 1, data);
+  }
+
+  write(m_request);
+  receive();
+}
+
+void HealthChecker::Probe::write(const std::string &data) {
+  auto self = shared_from_this();
+  auto round = m_round;
+  m_writing = true;
+  asio::async_write(
+    m_socket, asio::buffer(data),
+    [=](const std::error_code &ec, std::size_t) {
+      if (self->m_round != round || !self->m_running) return;
+      self->m_writing = false;
+      if (ec) self->done(false);
+    }
+  );
+}
+
+void HealthChecker::Probe::receive() {
+  auto self = shared_from_this();
+  auto round = m_round;
+  m_socket.async_read_some(
+    asio::buffer(m_buffer),
+    [=](const std::error_code &ec, std::size_t n) {
+      if (self->m_round != round || !self->m_running) return;
+      if (n > 0) self->m_response.append(self->m_buffer, n);
+      auto verdict = self->parse();
+      if (verdict >= 0) {
+        self->done(verdict > 0);
+      } else if (ec) {
+        self->done(false);
+      } else {
+        self->receive();
+      }
+    }
+  );
+}
+
+int HealthChecker::Probe::parse() {
+  if (m_response.length() > MAX_RESPONSE_SIZE) return 0;
+  if (m_checker->m_options.type == Type::HTTP) {
+    return parse_http();
+  } else {
+    return parse_grpc();
+  }
+}
+
+int HealthChecker::Probe::parse_http() {
+  auto p = m_response.find("\r\n");
+  if (p == std::string::npos) return -1;
+  if (p < 12 || m_response.compare(0, 5, "HTTP/")) return 0;
+  auto s = m_response.find(' ');
+  if (s == std::string::npos || s > p) return 0;
+  auto status = std::atoi(m_response.c_str() + s + 1);
+  return (200 <= status && status < 400) ? 1 : 0;
+}
+
+int HealthChecker::Probe::parse_grpc() {
+  static const std::string settings_ack("\0\0\0\x04\x01\0\0\0\0", 9);
+
+  while (m_response.length() - m_parsed >= 9) {
+    auto h = (const uint8_t *)m_response.c_str() + m_parsed;
+    auto size = (size_t(h[0]) << 16) | (size_t(h[1]) << 8) | size_t(h[2]);
+    auto type = h[3];
+    auto flags = h[4];
+    auto stream = ((uint32_t(h[5]) & 0x7f) << 24) | (uint32_t(h[6]) << 16) | (uint32_t(h[7]) << 8) | uint32_t(h[8]);
+    if (m_response.length() - m_parsed < 9 + size) break;
+
+    auto payload = (const char *)h + 9;
+    m_parsed += 9 + size;
+
+    switch (type) {
+      case 0: // DATA
+        if (stream == 1) {
+          if (flags & 0x08) {
+            if (!size) return 0;
+            auto pad = size_t(uint8_t(payload[0]));
+            if (pad + 1 > size) return 0;
+            m_grpc_message.append(payload + 1, size - pad - 1);
+          } else {
+            m_grpc_message.append(payload, size);
+          }
+          if (m_grpc_message.length() >= 5) {
+            auto p = (const uint8_t *)m_grpc_message.c_str();
+            auto n = (size_t(p[1]) << 24) | (size_t(p[2]) << 16) | (size_t(p[3]) << 8) | size_t(p[4]);
+            if (p[0]) return 0;
+            if (m_grpc_message.length() >= 5 + n) {
+              // HealthCheckResponse { ServingStatus status = 1; } with SERVING being 1
+              int status = 0;
+              size_t i = 5, end = 5 + n;
+              while (i < end) {
+                auto tag = p[i++];
+                if ((tag & 0x07) != 0) return 0;
+                uint64_t v = 0;
+                for (int shift = 0; i < end && shift < 64; shift += 7) {
+                  auto b = p[i++];
+                  v |= uint64_t(b & 0x7f) << shift;
+                  if (!(b & 0x80)) break;
+                }
+                if (tag == 0x08) status = int(v);
+              }
+              return status == 1 ? 1 : 0;
+            }
+          }
+          if (flags & 0x01) return 0;
+        }
+        break;
+      case 1: // HEADERS
+        if (stream == 1 && (flags & 0x01)) return 0;
+        break;
+      case 3: // RST_STREAM
+        if (stream == 1) return 0;
+        break;
+      case 4: // SETTINGS
+        if (!(flags & 0x01) && !m_writing) write(settings_ack);
+        break;
+      case 7: // GOAWAY
+        return 0;
+    }
+  }
+
+  return -1;
+}
+
+void HealthChecker::Probe::done(bool ok) {
+  if (!m_running) return;
+  m_running = false;
+  m_round++;
+
+  std::error_code ec;
+  Resolver::cancel(this);
+  m_timeout_timer.cancel(ec);
+  m_socket.close(ec);
+
+  m_checker->on_probe(m_target.get(), ok);
+  schedule(m_checker->m_options.interval);
+}
+
+//
+// HealthChecker::Target
+//
+
+void HealthChecker::Target::report(bool ok) {
+  if (ok) {
+    if (m_failures.load(std::memory_order_relaxed)) {
+      m_failures.store(0, std::memory_order_relaxed);
+    }
+  } else {
+    auto n = m_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (n == m_checker->m_options.consecutive_errors) {
+      auto checker = m_checker->shared_from_this();
+      auto target = shared_from_this();
+      Net::main().post([=]() { checker->eject(target); });
+    }
+  }
+}
+
+//
+// HealthChecker
+//
+
+std::mutex HealthChecker::s_mutex;
+std::map<std::string, std::weak_ptr<HealthChecker>> HealthChecker::s_checkers;
+
+auto HealthChecker::get(const Options &options) -> std::shared_ptr<HealthChecker> {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto key = options.key();
+  auto &p = s_checkers[key];
+  if (auto checker = p.lock()) return checker;
+  std::shared_ptr<HealthChecker> checker(new HealthChecker(options));
+  p = checker;
+  return checker;
+}
+
+HealthChecker::~HealthChecker() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto i = s_checkers.find(m_options.key());
+  if (i != s_checkers.end() && i->second.expired()) {
+    s_checkers.erase(i);
+  }
+}
+
+auto HealthChecker::watch(const std::string &name) -> std::shared_ptr<Target> {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto &t = m_targets[name];
+  if (!t) {
+    t = std::shared_ptr<Target>(new Target(this, name));
+    auto self = shared_from_this();
+    auto target = t;
+    Net::main().post([=]() { self->start(target); });
+  }
+  t->m_watchers++;
+  return t;
+}
+
+void HealthChecker::unwatch(Target *target) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto i = m_targets.find(target->m_name);
+  if (i == m_targets.end() || i->second.get() != target) return;
+  if (--target->m_watchers > 0) return;
+  auto self = shared_from_this();
+  auto t = i->second;
+  m_targets.erase(i);
+  Net::main().post([=]() { self->stop(t.get()); });
+}
+
+void HealthChecker::start(const std::shared_ptr<Target> &target) {
+  auto probe = std::make_shared<Probe>(this, target);
+  m_probes[target.get()] = probe;
+  if (m_options.type != Type::NONE) probe->start();
+}
+
+void HealthChecker::stop(Target *target) {
+  auto i = m_probes.find(target);
+  if (i == m_probes.end()) return;
+  i->second->cancel();
+  m_probes.erase(i);
+  if (target->m_ejected) m_ejected--;
+}
+
+void HealthChecker::on_probe(Target *target, bool ok) {
+  auto was_healthy = target->m_active_healthy;
+  if (ok) {
+    target->m_failures_in_row = 0;
+    target->m_successes_in_row++;
+    if (target->m_successes_in_row >= m_options.healthy_threshold) target->m_active_healthy = true;
+    if (!target->m_ejected && target->m_ejection_count > 0) target->m_ejection_count--;
+  } else {
+    target->m_successes_in_row = 0;
+    target->m_failures_in_row++;
+    if (target->m_failures_in_row >= m_options.unhealthy_threshold) target->m_active_healthy = false;
+  }
+  if (target->m_active_healthy != was_healthy) {
+    Log::info(
+      "[health] %s is now %s",
+      target->m_name.c_str(),
+      target->m_active_healthy ? "healthy" : "unhealthy"
+    );
+    target->publish();
+  }
+}
+
+//
+// Outlier detection ejects a target after a run of failures reported by
+// workers. Each ejection of the same target lasts longer than the last,
+// up to maxEjectionTime, and no more than maxEjectionPercent of the
+// targets are ejected at a time, though there can always be one.
+//
+
+void HealthChecker::eject(const std::shared_ptr<Target> &target) {
+  auto i = m_probes.find(target.get());
+  if (i == m_probes.end()) return;
+  if (m_options.consecutive_errors <= 0 || target->m_ejected) return;
+
+  auto total = int(m_probes.size());
+  if (m_ejected > 0 && (m_ejected + 1) * 100 > m_options.max_ejection_percent * total) {
+    target->m_failures.store(0, std::memory_order_relaxed);
+    return;
+  }
+
+  target->m_ejected = true;
+  target->m_ejection_count++;
+  m_ejected++;
+
+  auto duration = std::min(
+    m_options.base_ejection_time * target->m_ejection_count,
+    std::max(m_options.base_ejection_time, m_options.max_ejection_time)
+  );
+
+  Log::info("[health] %s ejected for %g seconds", target->m_name.c_str(), duration);
+  target->publish();
+  i->second->eject(duration);
+}
+
+void HealthChecker::restore(Target *target) {
+  if (!target->m_ejected) return;
+  target->m_ejected = false;
+  target->m_failures.store(0, std::memory_order_relaxed);
+  m_ejected--;
+  Log::info("[health] %s returned from ejection", target->m_name.c_str());
+  target->publish();
+}
+
+} // namespace pipy
+
+namespace pjs {
+
+using namespace pipy;
+
+template<> void EnumDef<HealthChecker::Type>::init() {
+  define(HealthChecker::Type::NONE, "none");
+  define(HealthChecker::Type::TCP, "tcp");
+  define(HealthChecker::Type::HTTP, "http");
+  define(HealthChecker::Type::GRPC, "grpc");
+}
+
+} // namespace pjs
@@ -0,0 +1,147 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HEALTH_CHECK_HPP
+#define HEALTH_CHECK_HPP
+
+#include "net.hpp"
+#include "options.hpp"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace pipy {
+
+//
+// HealthChecker
+//
+// Probes a set of targets from the main thread on behalf of all workers.
+// Workers with equal options share one checker. Each target's verdict
+// combines its active probes with outlier detection on failures reported
+// back by workers, and is published through an atomic flag that workers
+// read without locking.
+//
+
+class HealthChecker : public std::enable_shared_from_this<HealthChecker> {
+public:
+  enum class Type {
+    NONE,
+    TCP,
+    HTTP,
+    GRPC,
+  };
+
+  struct Options : public pipy::Options {
+    Type type = Type::TCP;
+    double interval = 5;
+    double timeout = 2;
+    int healthy_threshold = 2;
+    int unhealthy_threshold = 3;
+    std::string path = "/";
+    std::string host;
+    std::string service;
+    int consecutive_errors = 5;
+    double base_ejection_time = 30;
+    double max_ejection_time = 300;
+    int max_ejection_percent = 10;
+    Options() {}
+    Options(pjs::Object *options);
+    auto key() const -> std::string;
+  };
+
+  //
+  // HealthChecker::Target
+  //
+
+  class Target : public std::enable_shared_from_this<Target> {
+  public:
+    auto name() const -> const std::string& { return m_name; }
+    bool healthy() const { return m_healthy.load(std::memory_order_acquire); }
+
+    // Passive signal from a worker, such as a 5xx or a connection error
+    void report(bool ok);
+
+  private:
+    Target(HealthChecker *checker, const std::string &name)
+      : m_checker(checker)
+      , m_name(name) {}
+
+    HealthChecker* m_checker;
+    std::string m_name;
+    std::atomic<bool> m_healthy{true};
+    std::atomic<int> m_failures{0};
+    int m_watchers = 0;
+
+    // Only touched on the main thread
+    bool m_active_healthy = true;
+    bool m_ejected = false;
+    int m_successes_in_row = 0;
+    int m_failures_in_row = 0;
+    int m_ejection_count = 0;
+
+    void publish() {
+      m_healthy.store(m_active_healthy && !m_ejected, std::memory_order_release);
+    }
+
+    friend class HealthChecker;
+  };
+
+  static auto get(const Options &options) -> std::shared_ptr<HealthChecker>;
+
+  ~HealthChecker();
+
+  auto options() const -> const Options& { return m_options; }
+  auto watch(const std::string &name) -> std::shared_ptr<Target>;
+  void unwatch(Target *target);
+
+private:
+  class Probe;
+
+  HealthChecker(const Options &options) : m_options(options) {}
+
+  Options m_options;
+  std::mutex m_mutex;
+  std::map<std::string, std::shared_ptr<Target>> m_targets;
+
+  // Only touched on the main thread
+  std::map<Target*, std::shared_ptr<Probe>> m_probes;
+  int m_ejected = 0;
+
+  void start(const std::shared_ptr<Target> &target);
+  void stop(Target *target);
+  void on_probe(Target *target, bool ok);
+  void eject(const std::shared_ptr<Target> &target);
+  void restore(Target *target);
+
+  static std::mutex s_mutex;
+  static std::map<std::string, std::weak_ptr<HealthChecker>> s_checkers;
+};
+
+} // namespace pipy
+
+#endif // HEALTH_CHECK_HPP
@@ -28,14 +28,27 @@
 #include "pipeline.hpp"
 #include "worker.hpp"
 #include "constants.hpp"
+#include "memory-limit.hpp"
 #include "log.hpp"
+#include "usdt.hpp"
 
 #ifdef __linux__
 #include <linux/netfilter_ipv4.h>
 #include <linux/ip.h>
 #include <linux/udp.h>
+#include <arpa/inet.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "api/linux/bpf.h"
 #endif // __linux__
 
+#include <cstring>
+#include <map>
+
+#ifndef IP6T_SO_ORIGINAL_DST
+#define IP6T_SO_ORIGINAL_DST 80
+#endif
+
 namespace pipy {
 
 using tcp = asio::ip::tcp;
@@ -52,6 +65,10 @@ std::atomic<uint64_t> Inbound::s_inbound_id;
 thread_local pjs::Ref<stats::Gauge> Inbound::s_metric_concurrency;
 thread_local pjs::Ref<stats::Counter> Inbound::s_metric_traffic_in;
 thread_local pjs::Ref<stats::Counter> Inbound::s_metric_traffic_out;
+thread_local pjs::Ref<stats::Histogram> Inbound::s_metric_duration;
+thread_local pjs::Ref<stats::Histogram> Inbound::s_metric_bytes;
+thread_local pjs::Ref<stats::Histogram> Inbound::s_metric_first_byte;
+thread_local pjs::Ref<stats::Histogram> Inbound::s_metric_tls_time;
 
 auto Inbound::count() -> int {
   int n = 0;
@@ -114,8 +131,25 @@ auto Inbound::ori_dst_address() -> pjs::Str* {
   return m_str_ori_dst_addr;
 }
 
+void Inbound::set_remote_address(const std::string &addr, int port) {
+  address();
+  m_remote_addr = addr;
+  m_remote_port = port;
+  m_str_remote_addr = nullptr;
+}
+
+void Inbound::set_ori_dst_address(const std::string &addr, int port) {
+  address();
+  m_ori_dst_addr = addr;
+  m_ori_dst_port = port;
+  m_str_ori_dst_addr = nullptr;
+}
+
 void Inbound::start() {
   if (!m_pipeline) {
+    m_timeline = FlightRecorder::Timeline::make(m_id);
+    m_start_time = utils::now();
+    PIPY_PROBE1(inbound__accept, m_id);
     auto layout = m_listener->pipeline_layout();
     auto ctx = layout->new_context();
     ctx->m_inbound = this;
@@ -133,6 +167,10 @@ void Inbound::start() {
 
     m_metric_traffic_in = Inbound::s_metric_traffic_in->with_labels(labels, n);
     m_metric_traffic_out = Inbound::s_metric_traffic_out->with_labels(labels, n);
+    m_metric_duration = Inbound::s_metric_duration->with_labels(labels, n);
+    m_metric_bytes = Inbound::s_metric_bytes->with_labels(labels, n);
+    m_metric_first_byte = Inbound::s_metric_first_byte->with_labels(labels, n);
+    m_metric_tls_time = Inbound::s_metric_tls_time->with_labels(labels, n);
 
     pjs::Value arg(InboundWrapper::make(this));
     p->start(1, &arg);
@@ -145,10 +183,26 @@ void Inbound::restart() {
 }
 
 void Inbound::end() {
+  PIPY_PROBE1(inbound__close, m_id);
   if (m_listener) m_listener->close(this);
   m_pipeline = nullptr;
+  if (!m_end_time) m_end_time = utils::now();
+  if (auto t = m_timeline.get()) {
+    if (t->end()) {
+      try {
+        address();
+      } catch (std::exception &) {}
+      t->keep(m_remote_addr, m_remote_port);
+    }
+    m_timeline = nullptr;
+  }
 }
 
+//
+// Called once when the inbound goes away, so that the per-connection
+// histograms get the final duration and byte count.
+//
+
 void Inbound::collect() {
   auto in = get_traffic_in();
   auto out = get_traffic_out();
@@ -156,6 +210,30 @@ void Inbound::collect() {
   s_metric_traffic_out->increase(out);
   if (m_metric_traffic_in) m_metric_traffic_in->increase(in);
   if (m_metric_traffic_out) m_metric_traffic_out->increase(out);
+  m_traffic_total += in + out;
+
+  if (m_start_time > 0) {
+    auto duration = (m_end_time > 0 ? m_end_time : utils::now()) - m_start_time;
+    s_metric_duration->observe(duration);
+    s_metric_bytes->observe(m_traffic_total);
+    if (m_metric_duration) m_metric_duration->observe(duration);
+    if (m_metric_bytes) m_metric_bytes->observe(m_traffic_total);
+  }
+}
+
+void Inbound::first_byte_sent() {
+  m_first_byte_sent = true;
+  if (m_timeline) m_timeline->mark(FlightRecorder::DOWNSTREAM_FIRST_BYTE);
+  if (m_start_time > 0) {
+    auto t = utils::now() - m_start_time;
+    s_metric_first_byte->observe(t);
+    if (m_metric_first_byte) m_metric_first_byte->observe(t);
+  }
+}
+
+void Inbound::observe_tls_time(double t) {
+  s_metric_tls_time->observe(t);
+  if (m_metric_tls_time) m_metric_tls_time->observe(t);
 }
 
 void Inbound::address() {
@@ -213,6 +291,7 @@ void Inbound::init_metrics() {
           listener->for_each_inbound([&](Inbound *inbound) {
             auto n = inbound->get_traffic_in();
             inbound->m_metric_traffic_in->increase(n);
+            inbound->m_traffic_total += n;
             s_metric_traffic_in->increase(n);
             return true;
           });
@@ -229,6 +308,7 @@ void Inbound::init_metrics() {
           listener->for_each_inbound([&](Inbound *inbound) {
             auto n = inbound->get_traffic_out();
             inbound->m_metric_traffic_out->increase(n);
+            inbound->m_traffic_total += n;
             s_metric_traffic_out->increase(n);
             return true;
           });
@@ -236,6 +316,39 @@ void Inbound::init_metrics() {
         });
       }
     );
+
+    // Log-linear buckets with 2 steps per power of 2 keep the
+    // per-label cost low enough to have them on every listener
+
+    algo::Percentile::LogLinear time_layout;
+    time_layout.lowest = 0.1;
+    time_layout.highest = 24 * 3600 * 1000;
+    time_layout.precision = 1;
+
+    algo::Percentile::LogLinear size_layout;
+    size_layout.lowest = 64;
+    size_layout.highest = 16ull << 30;
+    size_layout.precision = 1;
+
+    s_metric_duration = stats::Histogram::make(
+      pjs::Str::make("pipy_inbound_duration"),
+      time_layout, label_names
+    );
+
+    s_metric_bytes = stats::Histogram::make(
+      pjs::Str::make("pipy_inbound_bytes"),
+      size_layout, label_names
+    );
+
+    s_metric_first_byte = stats::Histogram::make(
+      pjs::Str::make("pipy_inbound_first_byte_time"),
+      time_layout, label_names
+    );
+
+    s_metric_tls_time = stats::Histogram::make(
+      pjs::Str::make("pipy_inbound_tls_time"),
+      time_layout, label_names
+    );
   }
 }
 
@@ -256,30 +369,62 @@ InboundTCP::~InboundTCP() {
   collect();
 }
 
-void InboundTCP::accept(asio::ip::tcp::acceptor &acceptor) {
-  acceptor.async_accept(
-    socket(), m_peer,
-    [this](const std::error_code &ec) {
-      InputContext ic(this);
+//
+// Takes one connection off a non-blocking acceptor. Returns true when the
+// connection has been started on this inbound. Returns false either with
+// an error, including would_block when the backlog is empty, or without
+// one when the connection was handed to another thread or dropped, in
+// which case this inbound can be used for the next accept.
+//
 
-      if (ec == asio::error::operation_aborted) {
-        dangle();
-      } else if (!m_canceled) {
-        if (ec) {
-          log_error("error accepting connection", ec);
-          restart();
+bool InboundTCP::accept(asio::ip::tcp::acceptor &acceptor, std::error_code &ec) {
+  acceptor.accept(socket(), m_peer, ec);
+  if (ec) {
+    if (ec != asio::error::would_block && ec != asio::error::try_again) {
+      log_error("error accepting connection", ec);
+    }
+    return false;
+  }
 
-        } else if (m_listener && m_listener->pipeline_layout()) {
-          log_debug("connection accepted");
-          start();
-        }
-      }
+  InputContext ic(this);
 
-      release();
-    }
-  );
+  if (!m_listener || !m_listener->pipeline_layout()) {
+    std::error_code ec;
+    socket().close(ec);
+    return false;
+  }
+
+  if (MemoryLimit::shedding()) {
+    std::error_code ec;
+    socket().close(ec);
+    MemoryLimit::shed();
+    return false;
+  }
+
+  if (m_listener->hand_off(socket(), m_peer)) {
+    return false;
+  }
 
+  log_debug("connection accepted");
+  start();
+  return true;
+}
+
+void InboundTCP::adopt(const asio::ip::tcp &protocol, asio::ip::tcp::socket::native_handle_type fd, const asio::ip::tcp::endpoint &peer) {
+  InputContext ic(this);
   retain();
+
+  std::error_code ec;
+  socket().assign(protocol, fd, ec);
+  if (ec) {
+    log_error("error adopting connection", ec);
+  } else {
+    m_peer = peer;
+    log_debug("connection handed over");
+    start();
+  }
+
+  release();
 }
 
 auto InboundTCP::get_socket() -> Socket* {
@@ -301,6 +446,87 @@ auto InboundTCP::get_traffic_out() -> size_t {
   return n;
 }
 
+#ifdef __linux__
+
+//
+// Original destinations recorded by an eBPF redirect program, keyed by
+// the client's IPv4 address and port. Everything is in network byte order.
+//
+
+struct OriDstEntry {
+  uint32_t addr;
+  uint16_t port;
+  uint16_t pad;
+};
+
+static int ori_dst_map_fd(int id) {
+  thread_local static std::map<int, int> s_fds;
+  auto i = s_fds.find(id);
+  if (i != s_fds.end()) return i->second;
+
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_id = id;
+  int fd = syscall(__NR_bpf, BPF_MAP_GET_FD_BY_ID, &attr, sizeof(attr));
+  if (fd < 0) {
+    Log::error("[inbound] cannot open BPF map %d: %s", id, std::strerror(errno));
+  } else {
+    struct bpf_map_info info;
+    std::memset(&info, 0, sizeof(info));
+    std::memset(&attr, 0, sizeof(attr));
+    attr.info.bpf_fd = fd;
+    attr.info.info_len = sizeof(info);
+    attr.info.info = (uint64_t)&info;
+    if (
+      syscall(__NR_bpf, BPF_OBJ_GET_INFO_BY_FD, &attr, sizeof(attr)) ||
+      info.key_size != sizeof(OriDstEntry) ||
+      info.value_size != sizeof(OriDstEntry)
+    ) {
+      Log::error("[inbound] BPF map %d does not hold original destinations", id);
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  s_fds[id] = fd;
+  return fd;
+}
+
+static bool ori_dst_map_lookup(int id, const asio::ip::tcp::endpoint &peer, std::string &addr, int &port) {
+  asio::ip::address_v4 v4;
+  const auto &ip = peer.address();
+  if (ip.is_v4()) {
+    v4 = ip.to_v4();
+  } else if (ip.to_v6().is_v4_mapped()) {
+    v4 = asio::ip::make_address_v4(asio::ip::v4_mapped, ip.to_v6());
+  } else {
+    return false;
+  }
+
+  auto fd = ori_dst_map_fd(id);
+  if (fd < 0) return false;
+
+  OriDstEntry key, value;
+  std::memset(&key, 0, sizeof(key));
+  key.addr = htonl(v4.to_uint());
+  key.port = htons(peer.port());
+
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_fd = fd;
+  attr.key = (uint64_t)&key;
+  attr.value = (uint64_t)&value;
+  if (syscall(__NR_bpf, BPF_MAP_LOOKUP_ELEM, &attr, sizeof(attr))) return false;
+
+  char str[INET_ADDRSTRLEN];
+  if (!inet_ntop(AF_INET, &value.addr, str, sizeof(str))) return false;
+  addr = str;
+  port = ntohs(value.port);
+  return true;
+}
+
+#endif // __linux__
+
 void InboundTCP::on_get_address() {
   auto &s = SocketTCP::socket();
   if (s.is_open()) {
@@ -314,22 +540,30 @@ void InboundTCP::on_get_address() {
 
 #ifdef __linux__
   if (Inbound::m_options.transparent && s.is_open()) {
-    struct sockaddr addr;
+    if (
+      Inbound::m_options.ori_dst_map > 0 &&
+      ori_dst_map_lookup(Inbound::m_options.ori_dst_map, m_peer, m_ori_dst_addr, m_ori_dst_port)
+    ) return;
+
+    struct sockaddr_storage addr;
     socklen_t len = sizeof(addr);
-    if (!getsockopt(s.native_handle(), SOL_IP, SO_ORIGINAL_DST, &addr, &len)) {
-      char str[100];
-      auto n = std::sprintf(
-        str, "%d.%d.%d.%d",
-        (unsigned char)addr.sa_data[2],
-        (unsigned char)addr.sa_data[3],
-        (unsigned char)addr.sa_data[4],
-        (unsigned char)addr.sa_data[5]
-      );
-      m_ori_dst_addr.assign(str, n);
-      m_ori_dst_port = (
-        ((int)(unsigned char)addr.sa_data[0] << 8) |
-        ((int)(unsigned char)addr.sa_data[1] << 0)
-      );
+    char str[INET6_ADDRSTRLEN];
+    if (m_peer.address().is_v6() && !m_peer.address().to_v6().is_v4_mapped()) {
+      if (!getsockopt(s.native_handle(), SOL_IPV6, IP6T_SO_ORIGINAL_DST, &addr, &len)) {
+        auto *sa = (struct sockaddr_in6 *)&addr;
+        if (inet_ntop(AF_INET6, &sa->sin6_addr, str, sizeof(str))) {
+          m_ori_dst_addr = str;
+          m_ori_dst_port = ntohs(sa->sin6_port);
+        }
+      }
+    } else {
+      if (!getsockopt(s.native_handle(), SOL_IP, SO_ORIGINAL_DST, &addr, &len)) {
+        auto *sa = (struct sockaddr_in *)&addr;
+        if (inet_ntop(AF_INET, &sa->sin_addr, str, sizeof(str))) {
+          m_ori_dst_addr = str;
+          m_ori_dst_port = ntohs(sa->sin_port);
+        }
+      }
     }
   }
 #endif // __linux__
@@ -408,6 +642,7 @@ void InboundUDP::on_get_address() {
 }
 
 void InboundUDP::on_event(Event *evt) {
+  record_output(evt);
   SocketUDP::Peer::output(evt);
 }
 
@@ -29,6 +29,7 @@
 #include "net.hpp"
 #include "socket.hpp"
 #include "event.hpp"
+#include "flight-recorder.hpp"
 #include "input.hpp"
 #include "timer.hpp"
 #include "list.hpp"
@@ -54,6 +55,7 @@ class Inbound :
 public:
   struct Options : public SocketTCP::Options {
     bool transparent = false;
+    int ori_dst_map = 0;
     bool masquerade = false;
     bool peer_stats = false;
   };
@@ -69,8 +71,16 @@ public:
   auto ori_dst_address() -> pjs::Str*;
   auto ori_dst_port() -> int { address(); return m_ori_dst_port; }
   bool is_receiving() const { return m_receiving_state == RECEIVING; }
+  auto timeline() const -> FlightRecorder::Timeline* { return m_timeline; }
+  void record(FlightRecorder::Stage stage) { if (m_timeline) m_timeline->mark(stage); }
+  void observe_tls_time(double t);
+
+  // Overrides the addresses as seen by scripts, e.g. with ones from a PROXY header
+  void set_remote_address(const std::string &addr, int port);
+  void set_ori_dst_address(const std::string &addr, int port);
 
   virtual auto get_socket() -> Socket* = 0;
+  virtual auto get_socket_tcp() -> SocketTCP* { return nullptr; }
   virtual auto get_buffered() const -> size_t = 0;
   virtual auto get_traffic_in() ->size_t = 0;
   virtual auto get_traffic_out() ->size_t = 0;
@@ -104,23 +114,46 @@ protected:
   void collect();
   void address();
 
+  void record_output(Event *evt) {
+    if (!m_first_byte_sent) {
+      if (auto data = evt->as<Data>()) {
+        if (!data->empty()) first_byte_sent();
+      }
+    }
+  }
+
+  void first_byte_sent();
+
 protected:
   thread_local static pjs::Ref<stats::Gauge> s_metric_concurrency;
   thread_local static pjs::Ref<stats::Counter> s_metric_traffic_in;
   thread_local static pjs::Ref<stats::Counter> s_metric_traffic_out;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_duration;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_bytes;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_first_byte;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_tls_time;
 
   pjs::Ref<stats::Counter> m_metric_traffic_in;
   pjs::Ref<stats::Counter> m_metric_traffic_out;
+  pjs::Ref<stats::Histogram> m_metric_duration;
+  pjs::Ref<stats::Histogram> m_metric_bytes;
+  pjs::Ref<stats::Histogram> m_metric_first_byte;
+  pjs::Ref<stats::Histogram> m_metric_tls_time;
 
 private:
   virtual void on_get_address() = 0;
 
   uint64_t m_id;
   pjs::Ref<Pipeline> m_pipeline;
+  pjs::Ref<FlightRecorder::Timeline> m_timeline;
   pjs::Ref<pjs::Str> m_str_local_addr;
   pjs::Ref<pjs::Str> m_str_remote_addr;
   pjs::Ref<pjs::Str> m_str_ori_dst_addr;
   bool m_addressed = false;
+  bool m_first_byte_sent = false;
+  double m_start_time = 0;
+  double m_end_time = 0;
+  size_t m_traffic_total = 0;
 
   static std::atomic<uint64_t> s_inbound_id;
 
@@ -138,8 +171,8 @@ class InboundTCP :
   public SocketTCP
 {
 public:
-  void accept(asio::ip::tcp::acceptor &acceptor);
-  void cancel() { m_canceled = true; }
+  bool accept(asio::ip::tcp::acceptor &acceptor, std::error_code &ec);
+  void adopt(const asio::ip::tcp &protocol, asio::ip::tcp::socket::native_handle_type fd, const asio::ip::tcp::endpoint &peer);
 
 private:
   InboundTCP(Listener *listener, const Inbound::Options &options);
@@ -147,14 +180,14 @@ private:
 
   pjs::Ref<Socket> m_socket;
   asio::ip::tcp::endpoint m_peer;
-  bool m_canceled = false;
 
   virtual auto get_socket() -> Socket* override;
+  virtual auto get_socket_tcp() -> SocketTCP* override { return this; }
   virtual auto get_buffered() const -> size_t override { return SocketTCP::buffered(); }
   virtual auto get_traffic_in() -> size_t override;
   virtual auto get_traffic_out() -> size_t override;
   virtual void on_get_address() override;
-  virtual void on_event(Event *evt) override { SocketTCP::output(evt); }
+  virtual void on_event(Event *evt) override { record_output(evt); SocketTCP::output(evt); }
   virtual void on_socket_input(Event *evt) override { m_input->input(evt); }
   virtual void on_socket_close() override { Inbound::end(); release(); }
   virtual void on_socket_describe(char *buf, size_t len) override { describe(buf, len); }
@@ -84,21 +84,35 @@ auto KMP::split(const std::function<void(Data*)> &output) -> Split* {
 // KMP::Split
 //
 
+//
+// With nothing matched so far, input is skipped from one occurrence of the
+// first byte of the pattern to the next with memchr, each checked against
+// the whole pattern with memcmp while it lies within one chunk. Byte-wise
+// matching only runs for a candidate that crosses a chunk boundary, until
+// either the pattern is found or the match falls back to nothing again.
+//
+
 void KMP::Split::input(Data &data) {
   const char *W = m_kmp->m_pattern->elements();
   const int *LPS = m_kmp->m_lps_table->elements();
   int n = m_kmp->m_pattern->size();
   int j = m_match_len;
   while (!data.empty()) {
-    data.shift_to(
-      [&](int c) {
-        while (j >= 0 && c != W[j]) {
-          j = LPS[j];
-        }
-        return (++j == n);
-      },
-      m_buffer
-    );
+    if (j == 0) {
+      j = data.shift_to(W, n, m_buffer);
+      if (!j) break;
+    }
+    if (j < n) {
+      data.shift_to(
+        [&](int c) {
+          while (j >= 0 && c != W[j]) {
+            j = LPS[j];
+          }
+          return (++j == n || j == 0);
+        },
+        m_buffer
+      );
+    }
     if (j == n) {
       m_buffer.pop(n);
       m_output(Data::make(std::move(m_buffer)));
@@ -0,0 +1,213 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "launcher.hpp"
+#include "net.hpp"
+#include "os-platform.hpp"
+#include "utils.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+namespace pipy {
+
+#ifndef _WIN32
+
+static const double RESTART_DELAY = 1000;
+
+//
+// The supervisor forks before anything else is initialized, logging
+// included, so it only ever writes to stderr.
+//
+
+static void report(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  std::fputs("[launcher] ", stderr);
+  std::vfprintf(stderr, fmt, ap);
+  std::fputc('\n', stderr);
+  va_end(ap);
+}
+
+static volatile sig_atomic_t s_signals[NSIG];
+
+static void on_signal(int sig) {
+  s_signals[sig] = 1;
+}
+
+static bool take_signal(int sig) {
+  if (!s_signals[sig]) return false;
+  s_signals[sig] = 0;
+  return true;
+}
+
+struct Child {
+  pid_t pid = 0;
+  double start_time = 0;
+  double restart_time = 0;
+};
+
+static const int s_forwarded_signals[] = { SIGNAL_STOP, SIGNAL_RELOAD, SIGNAL_ADMIN, SIGTERM, SIGCHLD };
+static const int s_forwarded_count = sizeof(s_forwarded_signals) / sizeof(int);
+
+//
+// Signal handlers the children inherit are put back in place before they
+// go on, as are the reactor's internals.
+//
+
+bool Launcher::run(int processes, int &index, int &exit_code) {
+  std::vector<Child> children(processes);
+  struct sigaction saved[s_forwarded_count];
+
+  struct sigaction sa;
+  std::memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigemptyset(&sa.sa_mask);
+  for (int i = 0; i < s_forwarded_count; i++) {
+    sigaction(s_forwarded_signals[i], &sa, &saved[i]);
+  }
+
+  auto spawn = [&](int i) -> bool {
+    Net::context().notify_fork(asio::io_context::fork_prepare);
+    auto pid = fork();
+    if (pid < 0) {
+      Net::context().notify_fork(asio::io_context::fork_parent);
+      report("Cannot fork process %d: %s", i, std::strerror(errno));
+      children[i].restart_time = utils::now() + RESTART_DELAY;
+      return false;
+    }
+    if (pid == 0) {
+      for (int j = 0; j < s_forwarded_count; j++) {
+        sigaction(s_forwarded_signals[j], &saved[j], nullptr);
+      }
+      Net::context().notify_fork(asio::io_context::fork_child);
+#ifdef __linux__
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+      index = i;
+      return true;
+    }
+    Net::context().notify_fork(asio::io_context::fork_parent);
+    children[i].pid = pid;
+    children[i].start_time = utils::now();
+    children[i].restart_time = 0;
+    report("Started process %d with pid %d", i, int(pid));
+    return false;
+  };
+
+  for (int i = 0; i < processes; i++) {
+    if (spawn(i)) return true;
+  }
+
+  bool stopping = false;
+  exit_code = 0;
+
+  for (;;) {
+    auto forward = [&](int sig, bool first_only) {
+      for (auto &c : children) {
+        if (c.pid > 0) kill(c.pid, sig);
+        if (first_only) break;
+      }
+    };
+
+    if (take_signal(SIGNAL_STOP) | take_signal(SIGTERM)) {
+      if (!stopping) report("Stopping all processes...");
+      stopping = true;
+      forward(SIGNAL_STOP, false);
+    }
+    if (take_signal(SIGNAL_RELOAD)) forward(SIGNAL_RELOAD, false);
+    if (take_signal(SIGNAL_ADMIN)) forward(SIGNAL_ADMIN, true);
+    take_signal(SIGCHLD);
+
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      for (size_t i = 0; i < children.size(); i++) {
+        auto &c = children[i];
+        if (c.pid != pid) continue;
+        c.pid = 0;
+        auto failed = (WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0));
+        if (WIFSIGNALED(status)) {
+          report("Process %d (pid %d) killed by signal %d", int(i), int(pid), WTERMSIG(status));
+        } else {
+          report("Process %d (pid %d) exited with code %d", int(i), int(pid), WEXITSTATUS(status));
+        }
+        if (failed && !stopping) {
+          auto now = utils::now();
+          c.restart_time = (now - c.start_time < RESTART_DELAY ? now + RESTART_DELAY : now);
+        } else if (failed) {
+          exit_code = -1;
+        }
+      }
+    }
+
+    auto now = utils::now();
+    bool alive = false;
+    for (size_t i = 0; i < children.size(); i++) {
+      auto &c = children[i];
+      if (c.pid > 0) {
+        alive = true;
+      } else if (!stopping && c.restart_time > 0 && now >= c.restart_time) {
+        if (spawn(i)) return true;
+        alive = true;
+      } else if (!stopping && c.restart_time > 0) {
+        alive = true;
+      }
+    }
+
+    if (!alive) break;
+
+    // Woken up early by any signal, including SIGCHLD
+    usleep(100000);
+  }
+
+  return false;
+}
+
+#else // _WIN32
+
+bool Launcher::run(int processes, int &index, int &exit_code) {
+  throw std::runtime_error("--processes is not supported on this platform");
+}
+
+#endif // _WIN32
+
+} // namespace pipy
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LAUNCHER_HPP
+#define LAUNCHER_HPP
+
+namespace pipy {
+
+//
+// Launcher
+//
+// Runs a number of pipy processes side by side under a supervisor for
+// --processes. Children share listening ports with SO_REUSEPORT and
+// nothing else, so a crash only takes down the connections of one process
+// while the supervisor starts a replacement.
+//
+
+class Launcher {
+public:
+
+  // Returns true in a child with its index, or false in the supervisor
+  // once all children are gone, with the exit code for the supervisor
+  static bool run(int processes, int &index, int &exit_code);
+};
+
+} // namespace pipy
+
+#endif // LAUNCHER_HPP
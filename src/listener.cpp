@@ -28,6 +28,17 @@
 #include "worker.hpp"
 #include "worker-thread.hpp"
 #include "log.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/filter.h>
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+#endif
 
 namespace pipy {
 
@@ -121,6 +132,30 @@ Listener::Options::Options(pjs::Object *options) {
   Value(options, "bufferLimit")
     .get_binary_size(buffer_limit)
     .check_nullable();
+  Value(options, "zeroCopyThreshold")
+    .get_binary_size(zero_copy_threshold)
+    .check_nullable();
+  Value(options, "receiveBufferSize")
+    .get_binary_size(receive_buffer_size)
+    .check_nullable();
+  Value(options, "sendBufferSize")
+    .get_binary_size(send_buffer_size)
+    .check_nullable();
+  Value(options, "notSentLowat")
+    .get_binary_size(not_sent_lowat)
+    .check_nullable();
+  Value(options, "congestionControl")
+    .get(congestion_control)
+    .check_nullable();
+  Value(options, "busyPoll")
+    .get_seconds(busy_poll)
+    .check_nullable();
+  Value(options, "incomingCpu")
+    .get(incoming_cpu)
+    .check_nullable();
+  Value(options, "fastOpen")
+    .get(fast_open)
+    .check_nullable();
   Value(options, "keepAlive")
     .get(keep_alive)
     .check_nullable();
@@ -130,12 +165,24 @@ Listener::Options::Options(pjs::Object *options) {
   Value(options, "transparent")
     .get(transparent)
     .check_nullable();
+  Value(options, "originalDestinationMap")
+    .get(ori_dst_map)
+    .check_nullable();
   Value(options, "masquerade")
     .get(masquerade)
     .check_nullable();
   Value(options, "peerStats")
     .get(peer_stats)
     .check_nullable();
+  Value(options, "steering")
+    .get_enum(steering)
+    .check_nullable();
+  Value(options, "acceptBatch")
+    .get(accept_batch)
+    .check_nullable();
+  Value(options, "acceptRate")
+    .get(accept_rate)
+    .check_nullable();
 }
 
 //
@@ -144,11 +191,16 @@ Listener::Options::Options(pjs::Object *options) {
 
 thread_local std::set<Listener*> Listener::s_listeners;
 bool Listener::s_reuse_port = false;
+bool Listener::s_balance = false;
 
 void Listener::set_reuse_port(bool reuse) {
   s_reuse_port = reuse;
 }
 
+void Listener::set_balance(bool balance) {
+  s_balance = balance;
+}
+
 void Listener::commit_all() {
   for (auto l : s_listeners) {
     l->commit();
@@ -362,8 +414,46 @@ void Listener::accept() {
   }
 }
 
+//
+// With --balance-connections, a freshly accepted TCP connection is moved
+// to the least loaded worker thread before any pipeline is created for it.
+// The socket is detached here and re-attached to the listener of the same
+// port on the target thread, reached through Net::post().
+//
+
+bool Listener::hand_off(asio::ip::tcp::socket &socket, const asio::ip::tcp::endpoint &peer) {
+  if (!s_balance) return false;
+
+  auto net = WorkerManager::get().least_loaded();
+  if (!net) return false;
+
+  std::error_code ec;
+  auto protocol = peer.protocol();
+  auto fd = socket.release(ec);
+  if (ec) return false;
+
+  auto ip = m_port->ip();
+  auto port = m_port->num();
+  net->post(
+    [=]() {
+      auto l = find(Port::Protocol::TCP, ip, port);
+      if (l && l->pipeline_layout()) {
+        InboundTCP::make(l, l->m_options)->adopt(protocol, fd, peer);
+      } else {
+        std::error_code ec;
+        asio::ip::tcp::socket s(Net::context());
+        s.assign(protocol, fd, ec);
+        s.close(ec);
+      }
+    }
+  );
+
+  return true;
+}
+
 void Listener::open(Inbound *inbound) {
   m_inbounds.push(inbound);
+  m_net.load().connections++;
   if (m_port->increase_num_connections()) {
     accept();
   } else {
@@ -375,6 +465,7 @@ void Listener::open(Inbound *inbound) {
 
 void Listener::close(Inbound *inbound) {
   m_inbounds.remove(inbound);
+  m_net.load().connections--;
   auto n = m_inbounds.size();
   bool port_has_room = m_port->decrease_num_connections();
   auto max = m_options.max_connections;
@@ -418,6 +509,12 @@ void Listener::describe(char *buf, size_t len) {
 }
 
 void Listener::set_sock_opts(int sock) {
+  if (protocol() == Port::Protocol::TCP) {
+    if (auto opt = SocketTCP::set_sock_opts(sock, m_options, true)) {
+      Log::warn("[listener] cannot set option %s on port %d", opt, m_port->num());
+    }
+  }
+
 #ifdef __linux__
   if (m_options.transparent) {
     int enabled = 1;
@@ -438,6 +535,50 @@ void Listener::set_sock_opts(int sock) {
   }
 }
 
+//
+// With steering set to 'cpu', a classic BPF program is attached to the
+// reuseport group so that the kernel picks the socket by the CPU that
+// received the packet instead of by the 4-tuple hash. The program returns
+// an index into the group, i.e. the order in which the worker threads
+// bound their sockets, so CPU N lands on the Nth socket modulo the thread
+// count. This only pays off with --cpu-affinity keeping threads on the
+// CPUs that serve their RX queues.
+//
+
+void Listener::set_steering(int sock) {
+  const auto &options = m_pipeline_layout_next ? m_options_next : m_options;
+  if (options.steering == Steering::HASH) return;
+
+  char desc[200];
+  describe(desc, sizeof(desc));
+
+  if (!s_reuse_port) {
+    Log::warn("[listener] Steering on %s ignored without --reuse-port", desc);
+    return;
+  }
+
+#ifdef __linux__
+  auto n = WorkerManager::get().concurrency();
+  if (n < 2) return;
+
+  struct sock_filter code[] = {
+    { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+    { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)n },
+    { BPF_RET | BPF_A, 0, 0, 0 },
+  };
+
+  struct sock_fprog prog;
+  prog.len = sizeof(code) / sizeof(code[0]);
+  prog.filter = code;
+
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))) {
+    Log::warn("[listener] Unable to attach steering program on %s: %s", desc, std::strerror(errno));
+  }
+#else
+  Log::warn("[listener] Steering on %s is only supported on Linux", desc);
+#endif
+}
+
 auto Listener::find(Port::Protocol protocol, const std::string &ip, int port) -> Listener* {
   for (auto *l : s_listeners) {
     if (l->protocol() == protocol && l->ip() == ip && l->port() == port) {
@@ -468,31 +609,115 @@ void Listener::AcceptorTCP::start(const asio::ip::tcp::endpoint &endpoint) {
   m_listener->set_sock_opts(m_acceptor.native_handle());
 
   m_acceptor.bind(endpoint);
+  m_listener->set_steering(m_acceptor.native_handle());
   m_acceptor.listen(asio::socket_base::max_connections);
+  m_acceptor.non_blocking(true);
 }
 
+//
+// Instead of one async_accept() per connection, the acceptor waits for
+// the listening socket to become readable and then takes up to
+// acceptBatch connections off the backlog in one go. Room on the port
+// and the listener, as well as the acceptRate token bucket, are checked
+// before each accept() so nothing is allocated for a connection that
+// would not be admitted. What is left in the backlog stays with the
+// kernel until the next round.
+//
+
 void Listener::AcceptorTCP::accept() {
-  auto inbound = InboundTCP::make(m_listener, m_listener->m_options);
-  inbound->accept(m_acceptor);
-  m_accepting = inbound;
+  if (m_waiting || m_draining || m_shaping) return;
+  if (!m_acceptor.is_open()) return;
+  m_waiting = true;
+  retain();
+  m_acceptor.async_wait(
+    asio::ip::tcp::acceptor::wait_read,
+    [this](const std::error_code &ec) {
+      m_waiting = false;
+      if (ec != asio::error::operation_aborted && m_acceptor.is_open()) {
+        drain();
+      }
+      release();
+    }
+  );
 }
 
 void Listener::AcceptorTCP::cancel() {
   m_acceptor.cancel();
-  if (m_accepting) {
-    m_accepting->cancel();
-    m_accepting = nullptr;
-  }
+  m_shaper.cancel();
+  m_shaping = false;
+  m_accepting = nullptr;
 }
 
 void Listener::AcceptorTCP::stop() {
   m_acceptor.close();
+  m_shaper.cancel();
+  m_shaping = false;
   if (m_accepting) {
     m_accepting->dangle();
     m_accepting = nullptr;
   }
 }
 
+void Listener::AcceptorTCP::drain() {
+  auto l = m_listener;
+  auto max = l->m_options.accept_batch;
+  if (max < 1) max = 1;
+
+  m_draining = true;
+
+  for (int i = 0; i < max; i++) {
+    if (l->m_paused || !m_acceptor.is_open()) break;
+    auto n = l->m_options.max_connections;
+    if ((n > 0 && l->m_inbounds.size() >= n) || !l->m_port->has_room()) {
+      l->pause();
+      break;
+    }
+    if (!take_token()) break;
+    if (!m_accepting) m_accepting = InboundTCP::make(l, l->m_options);
+    std::error_code ec;
+    if (m_accepting->accept(m_acceptor, ec)) {
+      m_accepting = nullptr;
+    } else if (ec) {
+      m_tokens += 1;
+      break;
+    }
+  }
+
+  m_draining = false;
+
+  if (!l->m_paused) accept();
+}
+
+bool Listener::AcceptorTCP::take_token() {
+  auto rate = m_listener->m_options.accept_rate;
+  if (rate <= 0) return true;
+
+  auto now = utils::now() / 1000;
+  auto burst = std::max(1.0, rate / 10);
+  if (m_refill_time > 0) {
+    m_tokens = std::min(burst, m_tokens + (now - m_refill_time) * rate);
+  } else {
+    m_tokens = burst;
+  }
+  m_refill_time = now;
+
+  if (m_tokens >= 1) {
+    m_tokens -= 1;
+    return true;
+  }
+
+  m_shaping = true;
+  m_shaper.schedule(
+    (1 - m_tokens) / rate,
+    [this]() {
+      m_shaping = false;
+      accept();
+    }
+  );
+
+  return false;
+}
+
 //
 // Listener::AcceptorUDP
 //
@@ -518,6 +743,7 @@ void Listener::AcceptorUDP::start(const asio::ip::udp::endpoint &endpoint) {
   m_listener->set_sock_opts(s.native_handle());
 
   s.bind(endpoint);
+  m_listener->set_steering(s.native_handle());
   const auto &ep = s.local_endpoint();
   m_local_addr = ep.address().to_string();
   m_local_port = ep.port();
@@ -712,6 +938,11 @@ template<> void EnumDef<Port::Protocol>::init() {
   define(Port::Protocol::UDP, "udp");
 }
 
+template<> void EnumDef<Listener::Steering>::init() {
+  define(Listener::Steering::HASH, "hash");
+  define(Listener::Steering::CPU, "cpu");
+}
+
 template<> void ClassDef<ListenerArray>::init() {
   ctor([](Context &ctx) -> Object* {
     Array *listeners = nullptr;
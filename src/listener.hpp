@@ -31,6 +31,7 @@
 #include "inbound.hpp"
 #include "signal.h"
 #include "options.hpp"
+#include "timer.hpp"
 
 #include <atomic>
 #include <functional>
@@ -100,8 +101,16 @@ private:
 
 class Listener {
 public:
+  enum class Steering {
+    HASH,
+    CPU,
+  };
+
   struct Options : public Inbound::Options, public pipy::Options {
     Port::Protocol protocol = Port::Protocol::TCP;
+    Steering steering = Steering::HASH;
+    int accept_batch = 16;
+    double accept_rate = 0;
     size_t max_packet_size = 16 * 1024;
     int max_connections = -1;
     int max_port_connections = -1;
@@ -110,6 +119,7 @@ public:
   };
 
   static void set_reuse_port(bool reuse);
+  static void set_balance(bool balance);
 
   static auto get(Port::Protocol protocol, const std::string &ip, int port) -> Listener* {
     if (auto *l = find(protocol, ip, port)) return l;
@@ -133,6 +143,7 @@ public:
   static void delete_all();
 
   auto options() const -> const Options& { return m_options; }
+  bool hand_off(asio::ip::tcp::socket &socket, const asio::ip::tcp::endpoint &peer);
   auto protocol() const -> Port::Protocol { return m_port->protocol(); }
   auto ip() const -> const std::string& { return m_port->ip(); }
   auto port() const -> int { return m_port->num(); }
@@ -187,6 +198,15 @@ private:
     Listener* m_listener;
     asio::ip::tcp::acceptor m_acceptor;
     pjs::Ref<InboundTCP> m_accepting;
+    Timer m_shaper;
+    double m_tokens = 0;
+    double m_refill_time = 0;
+    bool m_waiting = false;
+    bool m_draining = false;
+    bool m_shaping = false;
+
+    void drain();
+    bool take_token();
   };
 
   //
@@ -230,6 +250,7 @@ private:
   void print_state(const char *msg);
   void describe(char *buf, size_t len);
   void set_sock_opts(int sock);
+  void set_steering(int sock);
 
   Net& m_net;
   Options m_options;
@@ -249,6 +270,7 @@ private:
 
   thread_local static std::set<Listener*> s_listeners;
   static bool s_reuse_port;
+  static bool s_balance;
 
   static auto find(Port::Protocol protocol, const std::string &ip, int port) -> Listener*;
 
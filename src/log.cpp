@@ -27,12 +27,15 @@
 #include "data.hpp"
 #include "api/logging.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdarg>
 #include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <deque>
 #include <sstream>
+#include <unordered_map>
 
 namespace pipy {
 
@@ -44,6 +47,7 @@ static std::string s_log_filename;
 static Log::Level s_log_level = Log::INFO;
 static Log::Output s_log_local_output = Log::OUTPUT_STDERR;
 static int s_log_topics = 0;
+static double s_log_debug_rate = 0;
 static bool s_log_local_only = false;
 
 thread_local static logging::Logger *s_logger = nullptr;
@@ -56,6 +60,72 @@ static const char *s_levels[] = {
   "[ERR]", // ERROR
 };
 
+//
+// DebugSampler
+//
+// Each topic has a token bucket refilled at --log-debug-rate per second
+// on every thread. A message that finds its bucket empty is dropped before
+// any formatting happens and is counted against its call site, identified
+// by the address of its format string. The count is reported the next
+// time that call site gets a message through.
+//
+
+class DebugSampler {
+public:
+  static bool peek(Log::Topic topic) {
+    auto &b = bucket(topic);
+    refill(b);
+    if (b.tokens >= 1) return true;
+    b.suppressed++;
+    return false;
+  }
+
+  static bool take(Log::Topic topic, const char *fmt) {
+    auto &b = bucket(topic);
+    refill(b);
+    if (b.tokens >= 1) {
+      b.tokens -= 1;
+      return true;
+    }
+    s_sites[fmt]++;
+    return false;
+  }
+
+  static void report(Log::Topic topic, const char *fmt);
+
+private:
+  struct Bucket {
+    double tokens = 0;
+    std::chrono::steady_clock::time_point time;
+    bool started = false;
+    uint64_t suppressed = 0;
+  };
+
+  static auto bucket(Log::Topic topic) -> Bucket& {
+    int i = 0;
+    while (i < 31 && !(topic & (1 << i))) i++;
+    return s_buckets[i];
+  }
+
+  static void refill(Bucket &b) {
+    auto t = std::chrono::steady_clock::now();
+    if (!b.started) {
+      b.started = true;
+      b.tokens = s_log_debug_rate;
+    } else {
+      auto d = std::chrono::duration_cast<std::chrono::microseconds>(t - b.time).count();
+      b.tokens = std::min(s_log_debug_rate, b.tokens + d * s_log_debug_rate / 1000000);
+    }
+    b.time = t;
+  }
+
+  thread_local static Bucket s_buckets[32];
+  thread_local static std::unordered_map<const char*, uint64_t> s_sites;
+};
+
+thread_local DebugSampler::Bucket DebugSampler::s_buckets[32];
+thread_local std::unordered_map<const char*, uint64_t> DebugSampler::s_sites;
+
 static void logf(Log::Level level, const char *fmt, va_list ap) {
   static bool s_is_logging = false;
   if (Log::is_enabled(level)) {
@@ -80,6 +150,13 @@ static void logf(Log::Level level, const char *fmt, va_list ap) {
   }
 }
 
+static void logf_raw(Log::Level level, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  logf(level, fmt, ap);
+  va_end(ap);
+}
+
 void Log::init() {
   s_logger = logging::TextLogger::make(pjs::Str::make("pipy_log"));
   s_logger->retain();
@@ -97,6 +174,17 @@ void Log::shutdown() {
   s_logger = nullptr;
 }
 
+void DebugSampler::report(Log::Topic topic, const char *fmt) {
+  auto &b = bucket(topic);
+  auto i = s_sites.find(fmt);
+  auto n = (i == s_sites.end() ? 0 : i->second) + b.suppressed;
+  if (n > 0) {
+    b.suppressed = 0;
+    if (i != s_sites.end()) s_sites.erase(i);
+    logf_raw(Log::DEBUG, "%llu similar messages suppressed", (unsigned long long)n);
+  }
+}
+
 void Log::set_filename(const std::string &filename) {
   s_log_filename = filename;
 }
@@ -117,12 +205,23 @@ void Log::set_local_only(bool b) {
   s_log_local_only = b;
 }
 
+void Log::set_debug_rate(double rate) {
+  s_log_debug_rate = rate;
+}
+
 bool Log::is_enabled(Level level) {
   return (level >= s_log_level);
 }
 
+//
+// Callers check is_enabled(topic) before putting together anything
+// costly to log, so an empty bucket also reports the topic as disabled.
+//
+
 bool Log::is_enabled(Topic topic) {
-  return (s_log_level <= DEBUG) && (s_log_topics & topic);
+  if (s_log_level > DEBUG || !(s_log_topics & topic)) return false;
+  if (s_log_debug_rate > 0 && !DebugSampler::peek(topic)) return false;
+  return true;
 }
 
 auto Log::format_elapsed_time() -> const char* {
@@ -158,14 +257,26 @@ auto Log::format_elapsed_time(char *buf, size_t len, bool fill) -> size_t {
   return p;
 }
 
+//
+// The local date and time down to the second are formatted once per
+// second on each thread, as localtime() takes a lock inside libc
+//
+
 auto Log::format_time(char *buf, size_t len) -> size_t {
+  thread_local static std::time_t s_sec = -1;
+  thread_local static char s_str[32];
+  thread_local static size_t s_len = 0;
   auto now = std::chrono::system_clock::now().time_since_epoch();
   auto cnt = std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
   auto sec = cnt / 1000;
   auto msec = int(cnt % 1000);
   std::time_t t = sec;
-  auto i = 0;
-  i += std::strftime(buf + i, len - i, "%F %T", std::localtime(&t));
+  if (t != s_sec) {
+    s_len = std::strftime(s_str, sizeof(s_str), "%F %T", std::localtime(&t));
+    s_sec = t;
+  }
+  auto i = std::min(s_len, len);
+  std::memcpy(buf, s_str, i);
   i += std::snprintf(buf + i, len - i, ".%03d", msec);
   return i;
 }
@@ -227,6 +338,10 @@ void Log::write(const std::string &data) {
 
 void Log::debug(Topic topic, const char *fmt, ...) {
   if (is_enabled(topic)) {
+    if (s_log_debug_rate > 0) {
+      if (!DebugSampler::take(topic, fmt)) return;
+      DebugSampler::report(topic, fmt);
+    }
     va_list ap;
     va_start(ap, fmt);
     logf(Log::DEBUG, fmt, ap);
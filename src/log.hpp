@@ -77,6 +77,7 @@ public:
   static void set_filename(const std::string &filename);
   static void set_level(Level level);
   static void set_topics(int topics);
+  static void set_debug_rate(double rate);
   static void set_local_output(Output output);
   static void set_local_only(bool b);
   static bool is_enabled(Level level);
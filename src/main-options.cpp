@@ -25,8 +25,10 @@
 
 #include "main-options.hpp"
 #include "fs.hpp"
+#include "os-platform.hpp"
 #include "data.hpp"
 #include "utils.hpp"
+#include "sockmap.hpp"
 
 #include <cstdlib>
 #include <iostream>
@@ -66,22 +68,37 @@ void MainOptions::show_help() {
   std::cout << "  --, -args, --args                    Indicate the end of Pipy options and the start of script arguments" << std::endl;
   std::cout << "  --pipy-options                       Indicate the beginning of Pipy options while processing script arguments" << std::endl;
   std::cout << "  --threads=<number>                   Number of worker threads (1, 2, ... max)" << std::endl;
+  std::cout << "  --processes=<number>                 Number of worker processes sharing ports with --reuse-port (1, 2, ... max)" << std::endl;
+  std::cout << "  --cpu-affinity=<auto|cpu-list>       Pin worker threads to CPUs and their NUMA nodes, e.g. 0-7,16-23 (Linux only)" << std::endl;
   std::cout << "  --log-file=<filename>                Set the pathname of the log file" << std::endl;
+  std::cout << "  --decode-log=<filename>              Print a file written by ColumnarLogger as JSON lines and exit" << std::endl;
   std::cout << "  --log-level=<debug|info|warn|error>  Set the level of log output" << std::endl;
   std::cout << "  --log-history-limit=<size>           Set size limit of log history in bytes" << std::endl;
+  std::cout << "  --log-debug-rate=<number>            Limit debug messages per second per topic (0 = no limit)" << std::endl;
   std::cout << "  --log-local=<stdout|stderr|null>     Select local output for system log" << std::endl;
   std::cout << "  --log-local-only                     Do not send out system log" << std::endl;
   std::cout << "  --no-reload                          Do not check for remote codebase updates" << std::endl;
   std::cout << "  --no-graph                           Do not print pipeline graphs to the log" << std::endl;
   std::cout << "  --no-status                          Do not report current status to the repo" << std::endl;
   std::cout << "  --no-metrics                         Do not report metrics to the repo" << std::endl;
+  std::cout << "  --filter-stats                       Count events, bytes, CPU and queueing time per filter" << std::endl;
+  std::cout << "  --collect-cycles                     Reclaim cyclic script objects while recycling idle memory" << std::endl;
+  std::cout << "  --no-bytecode                        Run all script functions on the tree-walking interpreter" << std::endl;
   std::cout << "  --trace-objects                      Enable tracing the locations of object construction" << std::endl;
+  std::cout << "  --trace-chunks                       Sample data chunk allocations to find the filters retaining them" << std::endl;
+  std::cout << "  --memory-limit=<size>                Soft limit of data chunk memory, e.g. 512m, applying backpressure near it" << std::endl;
+  std::cout << "  --huge-pages                         Allocate data chunks from 2MB transparent huge pages, never returned to the OS (Linux only)" << std::endl;
   std::cout << "  --force-start                        Force to start even at failure of address/port binding" << std::endl;
   std::cout << "  --init-repo=<dirname>                Populate the repo with codebases under the specified directory" << std::endl;
   std::cout << "  --init-code=<codebase>               Start running the specified codebase after repo initialization" << std::endl;
+  std::cout << "  --snapshot=<filename>                Pack all files of the loaded codebase into a snapshot and exit" << std::endl;
+  std::cout << "  --from-snapshot=<filename>           Start from a snapshot written by --snapshot" << std::endl;
   std::cout << "  --instance-uuid=<uuid>               Specify a UUID for this worker process" << std::endl;
   std::cout << "  --instance-name=<name>               Specify a name for this worker process" << std::endl;
   std::cout << "  --reuse-port                         Enable kernel load balancing for all listening ports" << std::endl;
+  std::cout << "  --balance-connections                Move accepted TCP connections to the least loaded thread" << std::endl;
+  std::cout << "  --net-engine=<epoll|io_uring>        Select the I/O engine for sockets (io_uring is Linux only)" << std::endl;
+  std::cout << "  --net-offload=<none|sockmap>         Let the kernel forward spliced TCP connections (sockmap needs eBPF)" << std::endl;
   std::cout << "  --admin-port=<[[ip]:]port>           Enable administration service on the specified port" << std::endl;
   std::cout << "  --admin-port-off                     Do not start administration service at startup" << std::endl;
   std::cout << "  --admin-gui=<dirname>                Specify the location of administration GUI front-end files" << std::endl;
@@ -192,8 +209,49 @@ void MainOptions::parse(const std::list<std::string> &args) {
             throw std::runtime_error(msg + std::to_string(max_threads));
           }
         }
+      } else if (k == "--processes") {
+#ifdef _WIN32
+        throw std::runtime_error("--processes is not supported on this platform");
+#endif
+        if (v == "max") {
+          processes = max_threads;
+        } else {
+          char *end;
+          processes = std::strtol(v.c_str(), &end, 10);
+          if (*end) throw std::runtime_error("--processes expects a number");
+          if (processes <= 0) throw std::runtime_error("invalid number of processes");
+        }
+      } else if (k == "--cpu-affinity") {
+#ifndef __linux__
+        throw std::runtime_error("--cpu-affinity is not supported on this platform");
+#endif
+        cpu_affinity = v;
+        cpu_affinity_list.clear();
+        if (v == "auto") {
+          cpu_affinity_list = os::cpu_list();
+        } else {
+          auto cpu_number = [&](const std::string &s) {
+            char *end;
+            auto n = std::strtol(s.c_str(), &end, 10);
+            if (s.empty() || *end || n < 0) throw std::runtime_error("invalid CPU list: " + v);
+            return int(n);
+          };
+          for (const auto &s : utils::split(v, ',')) {
+            auto r = utils::split(s, '-');
+            if (r.empty() || r.size() > 2) throw std::runtime_error("invalid CPU list: " + v);
+            auto first = cpu_number(r.front());
+            auto last = cpu_number(r.back());
+            if (last < first) throw std::runtime_error("invalid CPU list: " + v);
+            for (int i = first; i <= last; i++) cpu_affinity_list.push_back(i);
+          }
+        }
+        if (cpu_affinity_list.empty()) {
+          throw std::runtime_error("no CPUs to pin worker threads to");
+        }
       } else if (k == "--log-file") {
         log_file = v;
+      } else if (k == "--decode-log") {
+        decode_log = v;
       } else if (k == "--log-level") {
         if (
           utils::starts_with(v, "debug") && (
@@ -236,6 +294,10 @@ void MainOptions::parse(const std::list<std::string> &args) {
         char *end;
         log_history_limit = std::strtol(v.c_str(), &end, 10);
         if (*end || log_history_limit < 0) throw std::runtime_error("--log-history-limit expects a non-negative number");
+      } else if (k == "--log-debug-rate") {
+        char *end;
+        log_debug_rate = std::strtod(v.c_str(), &end);
+        if (*end || log_debug_rate < 0) throw std::runtime_error("--log-debug-rate expects a non-negative number");
       } else if (k == "--log-local") {
         if (v == "null") log_local = Log::OUTPUT_NULL;
         else if (v == "stdout") log_local = Log::OUTPUT_STDOUT;
@@ -251,8 +313,21 @@ void MainOptions::parse(const std::list<std::string> &args) {
         no_status = true;
       } else if (k == "--no-metrics") {
         no_metrics = true;
+      } else if (k == "--filter-stats") {
+        filter_stats = true;
+      } else if (k == "--collect-cycles") {
+        collect_cycles = true;
+      } else if (k == "--no-bytecode") {
+        no_bytecode = true;
       } else if (k == "--trace-objects") {
         trace_objects = true;
+      } else if (k == "--trace-chunks") {
+        trace_chunks = true;
+      } else if (k == "--memory-limit") {
+        memory_limit = utils::get_byte_size(v);
+        if (!memory_limit) throw std::runtime_error("--memory-limit expects a size greater than 0");
+      } else if (k == "--huge-pages") {
+        huge_pages = true;
       } else if (k == "--force-start") {
         force_start = true;
       } else if (k == "--init-repo") {
@@ -265,6 +340,22 @@ void MainOptions::parse(const std::list<std::string> &args) {
         instance_name = v;
       } else if (k == "--reuse-port") {
         reuse_port = true;
+      } else if (k == "--balance-connections") {
+        balance_connections = true;
+      } else if (k == "--net-engine") {
+        if (v == "epoll") io_uring = false;
+        else if (v == "io_uring") io_uring = true;
+        else throw std::runtime_error("unknown net engine: " + v);
+#ifndef __linux__
+        if (io_uring) throw std::runtime_error("io_uring is not supported on this platform");
+#endif
+      } else if (k == "--net-offload") {
+        if (v == "none") sockmap = false;
+        else if (v == "sockmap") sockmap = true;
+        else throw std::runtime_error("unknown net offload: " + v);
+#ifndef PIPY_HAS_SOCKMAP
+        if (sockmap) throw std::runtime_error("sockmap is not supported by this build");
+#endif
       } else if (k == "--admin-port-off") {
         admin_port_off = true;
       } else if (k == "--admin-port") {
@@ -285,6 +376,12 @@ void MainOptions::parse(const std::list<std::string> &args) {
         tls_key = load_private_key(v);
       } else if (k == "--tls-trusted") {
         load_certificate_list(v, tls_trusted);
+      } else if (k == "--snapshot") {
+        if (v.empty()) throw std::runtime_error("--snapshot expects a filename");
+        snapshot = v;
+      } else if (k == "--from-snapshot") {
+        if (v.empty()) throw std::runtime_error("--from-snapshot expects a filename");
+        from_snapshot = v;
       } else if (k == "--openssl-engine") {
         openssl_engine = v;
       } else {
@@ -297,6 +394,10 @@ void MainOptions::parse(const std::list<std::string> &args) {
     throw std::runtime_error("missing script to evaluate");
   }
 
+  if (!from_snapshot.empty() && !filename.empty()) {
+    throw std::runtime_error("--from-snapshot cannot be used with a script or codebase");
+  }
+
   if (log_history_limit > 256*1024*1024) {
     throw std::runtime_error("maximum value supported by --log-history-limit is 256MB");
   }
@@ -343,6 +444,8 @@ auto MainOptions::to_string() -> std::string {
   std::string str;
 
   if (threads > 1) list.push_back("--threads=" + std::to_string(threads));
+  if (processes > 1) list.push_back("--processes=" + std::to_string(processes));
+  if (!cpu_affinity.empty()) list.push_back("--cpu-affinity=" + cpu_affinity);
   if (!log_file.empty()) list.push_back("--log-file=" + log_file);
   switch (log_level) {
     case Log::DEBUG: {
@@ -371,6 +474,7 @@ auto MainOptions::to_string() -> std::string {
     case Log::ERROR: list.push_back("--log-level=error"); break;
   }
   list.push_back("--log-history-limit=" + std::to_string(log_history_limit));
+  if (log_debug_rate > 0) list.push_back("--log-debug-rate=" + std::to_string(log_debug_rate));
   switch (log_local) {
     case Log::OUTPUT_NULL: list.push_back("--log-local=null"); break;
     case Log::OUTPUT_STDOUT: list.push_back("--log-local=stdout"); break;
@@ -380,13 +484,23 @@ auto MainOptions::to_string() -> std::string {
   if (no_graph) list.push_back("--no-graph");
   if (no_status) list.push_back("--no-status");
   if (no_metrics) list.push_back("--no-metrics");
+  if (filter_stats) list.push_back("--filter-stats");
+  if (collect_cycles) list.push_back("--collect-cycles");
+  if (no_bytecode) list.push_back("--no-bytecode");
   if (trace_objects) list.push_back("--trace-objects");
+  if (trace_chunks) list.push_back("--trace-chunks");
+  if (memory_limit > 0) list.push_back("--memory-limit=" + std::to_string(memory_limit));
+  if (huge_pages) list.push_back("--huge-pages");
   if (force_start) list.push_back("--force-start");
   if (!init_repo.empty()) list.push_back("--init-repo=" + init_repo);
   if (!init_code.empty()) list.push_back("--init-code=" + init_code);
+  if (!from_snapshot.empty()) list.push_back("--from-snapshot=" + from_snapshot);
   if (!instance_uuid.empty()) list.push_back("--instance-uuid" + instance_uuid);
   if (!instance_name.empty()) list.push_back("--instance-name" + instance_name);
   if (reuse_port) list.push_back("--reuse-port");
+  if (balance_connections) list.push_back("--balance-connections");
+  if (io_uring) list.push_back("--net-engine=io_uring");
+  if (sockmap) list.push_back("--net-offload=sockmap");
   if (admin_port_off) list.push_back("--admin-port-off");
   if (!admin_port.empty()) list.push_back("--admin-port=" + admin_port);
   if (!admin_gui.empty()) list.push_back("--admin-gui=" + admin_gui);
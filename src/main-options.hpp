@@ -55,15 +55,29 @@ public:
   bool        no_graph = false;
   bool        no_status = false;
   bool        no_metrics = false;
+  bool        filter_stats = false;
+  bool        collect_cycles = false;
+  bool        no_bytecode = false;
   bool        trace_objects = false;
+  bool        trace_chunks = false;
+  bool        huge_pages = false;
   bool        force_start = false;
   bool        reuse_port = false;
+  bool        balance_connections = false;
+  bool        io_uring = false;
+  bool        sockmap = false;
   int         threads = 1;
+  int         processes = 1;
+  std::string cpu_affinity;
+  std::vector<int> cpu_affinity_list;
   std::string log_file;
+  std::string decode_log;
   Log::Level  log_level = Log::INFO;
   Log::Output log_local = Log::OUTPUT_STDERR;
   size_t      log_history_limit = 1024*1024;
+  size_t      memory_limit = 0;
   int         log_topics = 0;
+  double      log_debug_rate = 0;
   bool        log_local_only = false;
   bool        admin_port_off = false;
   std::string admin_port;
@@ -71,6 +85,8 @@ public:
   std::string admin_log_file;
   std::string init_repo;
   std::string init_code;
+  std::string snapshot;
+  std::string from_snapshot;
   std::string instance_uuid;
   std::string instance_name;
   std::string openssl_engine;
@@ -36,12 +36,17 @@
 #include "fs.hpp"
 #include "filters/tls.hpp"
 #include "input.hpp"
+#include "launcher.hpp"
 #include "listener.hpp"
 #include "main-options.hpp"
+#include "memory-limit.hpp"
 #include "net.hpp"
 #include "os-platform.hpp"
+#include "pjs/vm.hpp"
 #include "status.hpp"
 #include "timer.hpp"
+#include "uring.hpp"
+#include "sockmap.hpp"
 #include "utils.hpp"
 #include "worker.hpp"
 #include "worker-thread.hpp"
@@ -105,9 +110,9 @@ static void show_version() {
 static void reload_codebase(bool force) {
   if (auto *codebase = Codebase::current()) {
     codebase->sync(
-      force, [](bool ok) {
+      force, [=](bool ok) {
         if (ok) {
-          WorkerManager::get().reload();
+          WorkerManager::get().reload(force);
         }
       }
     );
@@ -164,12 +169,12 @@ static void toggle_admin_port() {
 class PeriodicJob {
 public:
   void start() { run(); }
-  void stop() { if (m_timer) m_timer->cancel(); }
+  virtual void stop() { if (m_timer) m_timer->cancel(); }
 protected:
   virtual void run() = 0;
-  void next() {
+  void next(double interval = 5) {
     if (!m_timer) m_timer = std::unique_ptr<Timer>(new Timer);
-    m_timer->schedule(5, [this]() { run(); });
+    m_timer->schedule(interval, [this]() { run(); });
   }
 
 private:
@@ -179,24 +184,54 @@ private:
 //
 // Periodically clean up pools
 //
+// Worker threads clean their pools asynchronously, so what they free
+// is handed back to the OS in the round after.
+//
 
 class PoolCleaner : public PeriodicJob {
+  enum { RELEASE_THRESHOLD = 1024 * 1024 };
+
   virtual void run() override {
     for (const auto &p : pjs::Pool::all()) {
       p.second->clean();
     }
     WorkerManager::get().recycle();
+    if (auto n = pjs::Pool::release_memory(RELEASE_THRESHOLD)) {
+      Log::debug(Log::ALLOC, "[memory] released %zu bytes of pooled memory to the OS", n);
+    }
     next();
   }
 };
 
 static PoolCleaner s_pool_cleaner;
 
+//
+// Periodically check memory usage against --memory-limit
+//
+
+class MemoryWatcher : public PeriodicJob {
+  virtual void run() override {
+    MemoryLimit::check();
+    next(0.1);
+  }
+};
+
+static MemoryWatcher s_memory_watcher;
+
 //
 // Periodically check codebase updates
 //
 
 class CodeUpdater : public PeriodicJob {
+public:
+  virtual void stop() override {
+    PeriodicJob::stop();
+    if (auto *codebase = Codebase::current()) {
+      codebase->stop_watching();
+    }
+  }
+
+private:
   virtual void run() override {
     if (!s_has_shutdown) {
       reload_codebase(false);
@@ -355,6 +390,7 @@ private:
   void stop_all() {
     Net::current().stop();
     s_pool_cleaner.stop();
+    s_memory_watcher.stop();
     s_code_updater.stop();
     s_status_reporter.stop();
     stop();
@@ -410,6 +446,26 @@ int pipy_main(int argc, char *argv[]) {
       return 0;
     }
 
+    if (!opts.decode_log.empty()) {
+      return logging::ColumnarLogger::decode(opts.decode_log, std::cout) ? 0 : -1;
+    }
+
+    if (opts.processes > 1) {
+      if (opts.filename.empty()) {
+        throw std::runtime_error("--processes needs a codebase to run rather than repo mode");
+      }
+      int index = 0;
+      if (!Launcher::run(opts.processes, index, exit_code)) return exit_code;
+      opts.reuse_port = true;
+      if (index > 0) {
+        opts.admin_port_off = true;
+        opts.instance_uuid.clear();
+      }
+      if (!opts.instance_name.empty()) {
+        opts.instance_name += '-' + std::to_string(index);
+      }
+    }
+
     Status::LocalInstance::since = utils::now();
     Status::LocalInstance::source = opts.filename;
     Status::LocalInstance::name = opts.instance_name;
@@ -425,12 +481,26 @@ int pipy_main(int argc, char *argv[]) {
     Log::set_filename(opts.log_file);
     Log::set_level(opts.log_level);
     Log::set_topics(opts.log_topics);
+    Log::set_debug_rate(opts.log_debug_rate);
     Log::set_local_output(opts.log_local);
     Log::set_local_only(opts.log_local_only);
     Log::init();
     logging::Logger::set_history_size(opts.log_history_limit);
     Listener::set_reuse_port(opts.reuse_port);
+    Listener::set_balance(opts.balance_connections);
+    FilterStats::enable(opts.filter_stats);
+    WorkerThread::collect_cycles(opts.collect_cycles);
+    pjs::vm::Code::enable(!opts.no_bytecode);
+#ifdef PIPY_HAS_IO_URING
+    Uring::enable(opts.io_uring);
+#endif
+#ifdef PIPY_HAS_SOCKMAP
+    SockMap::enable(opts.sockmap);
+#endif
     pjs::Class::set_tracing(opts.trace_objects);
+    if (opts.trace_chunks) Data::Sampler::start();
+    MemoryLimit::set(opts.memory_limit);
+    pjs::Pool::enable_huge_pages(opts.huge_pages);
     pjs::Math::init();
     crypto::Crypto::init(opts.openssl_engine);
     tls::TLSSession::init();
@@ -459,7 +529,7 @@ int pipy_main(int argc, char *argv[]) {
     bool is_file = false;
     bool is_file_found = false;
 
-    if (!opts.eval) {
+    if (!opts.eval && opts.from_snapshot.empty()) {
       if (opts.filename.empty()) {
         is_repo = true;
 
@@ -554,7 +624,9 @@ int pipy_main(int argc, char *argv[]) {
 
     // Start as a static codebase
     } else {
-      if (is_builtin) {
+      if (!opts.from_snapshot.empty()) {
+        codebase = Codebase::from_snapshot(opts.from_snapshot);
+      } else if (is_builtin) {
         auto name = opts.filename.substr(6);
         store = Store::open_memory();
         repo = new CodebaseStore(store);
@@ -596,9 +668,22 @@ int pipy_main(int argc, char *argv[]) {
               return;
             }
 
+            if (!opts.snapshot.empty()) {
+              try {
+                codebase->snapshot(opts.snapshot);
+                exit_code = 0;
+              } catch (std::runtime_error &err) {
+                std::cerr << err.what() << std::endl;
+                exit_code = -1;
+              }
+              Net::main().stop();
+              return;
+            }
+
             auto &wm = WorkerManager::get();
             wm.argv(opts.arguments);
             wm.enable_graph(!opts.no_graph);
+            wm.cpu_affinity(opts.cpu_affinity_list);
 
             if ((is_repo || is_remote) && !opts.no_reload) {
               wm.on_ended(exit);
@@ -643,6 +728,7 @@ int pipy_main(int argc, char *argv[]) {
       exit = [&]() {
         if (!is_remote || opts.no_reload) {
           s_pool_cleaner.stop();
+          s_memory_watcher.stop();
           s_code_updater.stop();
           s_signal_handler.stop();
         }
@@ -670,6 +756,7 @@ int pipy_main(int argc, char *argv[]) {
 
     s_pool_cleaner.start();
     s_signal_handler.start();
+    if (opts.memory_limit > 0) s_memory_watcher.start();
 
     Net::current().run();
 
@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "memory-limit.hpp"
+#include "data.hpp"
+#include "worker-thread.hpp"
+#include "utils.hpp"
+#include "log.hpp"
+
+namespace pipy {
+
+size_t MemoryLimit::s_limit = 0;
+std::atomic<int> MemoryLimit::s_level(MemoryLimit::NORMAL);
+std::atomic<uint64_t> MemoryLimit::s_shed_count(0);
+double MemoryLimit::s_last_trim = 0;
+
+static const double s_thresholds[] = { 0, 0.8, 0.9, 1.0 };
+static const double s_hysteresis = 0.05;
+
+auto MemoryLimit::level_name(Level level) -> const char* {
+  switch (level) {
+    case NORMAL: return "normal";
+    case PRESSURE: return "pressure";
+    case SHEDDING: return "shedding";
+    case CRITICAL: return "critical";
+  }
+  return "";
+}
+
+auto MemoryLimit::usage() -> size_t {
+  size_t n = 0;
+  Data::Producer::for_each([&](Data::Producer *p) { n += p->size(); });
+  return n;
+}
+
+void MemoryLimit::check() {
+  if (!s_limit) return;
+
+  auto size = usage();
+  auto ratio = double(size) / s_limit;
+  auto old_level = level();
+  auto new_level = NORMAL;
+  for (int i = CRITICAL; i > NORMAL; i--) {
+    auto threshold = s_thresholds[i];
+    if (i <= old_level) threshold -= s_hysteresis;
+    if (ratio >= threshold) {
+      new_level = Level(i);
+      break;
+    }
+  }
+
+  if (new_level != old_level) {
+    s_level.store(new_level, std::memory_order_relaxed);
+    auto msg = "[memory] %s at %.1f%% of the limit (%zu of %zu bytes in data chunks)";
+    if (new_level > old_level) {
+      Log::warn(msg, level_name(new_level), ratio * 100, size, s_limit);
+    } else {
+      Log::info(msg, level_name(new_level), ratio * 100, size, s_limit);
+    }
+  }
+
+  if (new_level == CRITICAL) {
+    auto now = utils::now();
+    if (now - s_last_trim >= 1000) {
+      s_last_trim = now;
+      WorkerManager::get().trim();
+    }
+  }
+}
+
+} // namespace pipy
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MEMORY_LIMIT_HPP
+#define MEMORY_LIMIT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace pipy {
+
+//
+// MemoryLimit
+//
+// A soft cap on the bytes held in data chunks by the whole process, as
+// given by --memory-limit. Usage is summed up from all Data::Producers by
+// the main thread every 100ms and turned into a level that hot
+// paths can read with a single relaxed load:
+//
+//   PRESSURE at 80%:  sockets with data waiting to be sent keep the
+//                     inputs that fed them paused
+//   SHEDDING at 90%:  listeners close new connections right after accept
+//   CRITICAL at 100%: worker threads drop all free-listed objects from
+//                     their pools, at most once per second
+//
+// A level is only left when usage falls 5% of the limit below it.
+//
+
+class MemoryLimit {
+public:
+  enum Level {
+    NORMAL,
+    PRESSURE,
+    SHEDDING,
+    CRITICAL,
+  };
+
+  static void set(size_t limit) { s_limit = limit; }
+  static auto limit() -> size_t { return s_limit; }
+  static auto level() -> Level { return Level(s_level.load(std::memory_order_relaxed)); }
+  static bool pressured() { return level() >= PRESSURE; }
+  static bool shedding() { return level() >= SHEDDING; }
+  static auto level_name(Level level) -> const char*;
+
+  // Bytes of all data chunks currently allocated in the process
+  static auto usage() -> size_t;
+
+  // Connections closed at accept while shedding
+  static auto shed_count() -> uint64_t { return s_shed_count.load(std::memory_order_relaxed); }
+  static void shed() { s_shed_count.fetch_add(1, std::memory_order_relaxed); }
+
+  // Called on the main thread
+  static void check();
+
+private:
+  static size_t s_limit;
+  static std::atomic<int> s_level;
+  static std::atomic<uint64_t> s_shed_count;
+  static double s_last_trim;
+};
+
+} // namespace pipy
+
+#endif // MEMORY_LIMIT_HPP
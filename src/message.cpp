@@ -73,7 +73,7 @@ bool Message::to_events(pjs::Object *obj, const std::function<bool(Event*)> &cb)
         if (!cb(v.as<Event>())) return (ret = false);
         return true;
       } else if (v.is_instance_of(pjs::class_of<Message>())) {
-        auto msg = obj->as<Message>();
+        auto msg = v.as<Message>();
         pjs::Ref<MessageStart> start(MessageStart::make(msg->head()));
         pjs::Ref<MessageEnd> end(MessageEnd::make(msg->tail(), msg->payload()));
         if (!cb(start)) return (ret = false);
@@ -98,8 +98,8 @@ void JSModule::setup_pipeline_lb(PipelineLoadBalancer *plb) {
   }
 }
 
-auto JSModule::alloc_pipeline_lb(pjs::Str *name, EventTarget::Input *output) -> PipelineLoadBalancer::AsyncWrapper* {
-  return m_worker->m_pipeline_lb->allocate(filename()->str(), name->str(), output);
+auto JSModule::alloc_pipeline_lb(pjs::Str *name, EventTarget::Input *output, bool other_thread) -> PipelineLoadBalancer::AsyncWrapper* {
+  return m_worker->m_pipeline_lb->allocate(filename()->str(), name->str(), output, other_thread);
 }
 
 auto JSModule::new_context(Context *base) -> Context* {
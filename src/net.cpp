@@ -24,9 +24,71 @@
  */
 
 #include "net.hpp"
+#include "utils.hpp"
+
+#include <limits>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
 
 namespace pipy {
 
+//
+// Net::Load
+//
+
+const double Net::Load::histogram_bounds[] = {
+  10e-6, 100e-6, 1e-3, 10e-3, 100e-3, 1,
+  std::numeric_limits<double>::infinity(),
+};
+
+void Net::Load::handled(double seconds) {
+  handlers++;
+  busy += seconds;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    if (seconds <= histogram_bounds[i]) {
+      histogram[i]++;
+      break;
+    }
+  }
+}
+
+void Net::Load::lagged(double seconds) {
+  if (seconds < 0) seconds = 0;
+  lag_sum += seconds;
+  lag_count++;
+  if (seconds > lag_max) lag_max = seconds;
+  if (seconds > lag_max_all) lag_max_all = seconds;
+  lag_recent.store(lag_recent.load() * 0.875 + seconds * 0.125);
+}
+
+//
+// The first handler after the loop has been idle is run by a blocking
+// run_one(), where wall time would include the wait, so it is measured
+// with the CPU time of the thread instead. Handlers already queued are
+// drained by poll_one() and timed with the cheaper cycle counter.
+//
+
+static auto thread_cpu_time() -> double {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0;
+  ULARGE_INTEGER k, u;
+  k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+  u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+  return double(k.QuadPart + u.QuadPart) / 1e7;
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) return 0;
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+//
+// Net
+//
+
 Net* Net::s_main = nullptr;
 thread_local Net Net::s_current;
 
@@ -39,8 +101,18 @@ void Net::init() {
 }
 
 void Net::run() {
+  auto rate = utils::cycles_per_second();
   m_is_running = true;
-  m_io_context.run();
+  for (;;) {
+    auto t0 = thread_cpu_time();
+    if (!m_io_context.run_one()) break;
+    m_load.handled(thread_cpu_time() - t0);
+    for (;;) {
+      auto c0 = utils::cycles();
+      if (!m_io_context.poll_one()) break;
+      m_load.handled((utils::cycles() - c0) / rate);
+    }
+  }
   m_is_running = false;
 }
 
@@ -60,7 +132,18 @@ void Net::restart() {
 }
 
 void Net::post(const std::function<void()> &cb) {
-  asio::post(m_io_context, cb);
+  m_load.posts++;
+  m_load.pending++;
+  if (this != &s_current) m_load.cross_posts++;
+  auto t = utils::cycles();
+  asio::post(
+    m_io_context,
+    [=]() {
+      m_load.pending--;
+      m_load.queued += (utils::cycles() - t) / utils::cycles_per_second();
+      cb();
+    }
+  );
 }
 
 void Net::defer(const std::function<void()> &cb) {
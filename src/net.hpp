@@ -34,6 +34,8 @@
 
 #include "os-platform.hpp"
 
+#include <atomic>
+
 namespace pipy {
 
 //
@@ -42,6 +44,38 @@ namespace pipy {
 
 class Net {
 public:
+
+  //
+  // Net::Load
+  //
+  // Saturation counters of one event loop. Everything is updated by the
+  // thread running the loop except for the posting counters, which are
+  // bumped by whichever thread calls post().
+  //
+
+  struct Load {
+    static const int HISTOGRAM_BUCKETS = 7;
+    static const double histogram_bounds[HISTOGRAM_BUCKETS];
+
+    uint64_t handlers = 0;
+    uint64_t histogram[HISTOGRAM_BUCKETS] = { 0 };
+    double busy = 0;
+    double queued = 0;
+    double lag_sum = 0;
+    double lag_max = 0;
+    double lag_max_all = 0;
+    uint64_t lag_count = 0;
+    std::atomic<uint64_t> posts{0};
+    std::atomic<uint64_t> cross_posts{0};
+    std::atomic<int> pending{0};
+    std::atomic<int> connections{0};
+    std::atomic<double> lag_recent{0};
+    double reported[HISTOGRAM_BUCKETS + 5] = { 0 };
+
+    void handled(double seconds);
+    void lagged(double seconds);
+  };
+
   static void init();
 
   static auto main() -> Net& {
@@ -60,6 +94,7 @@ public:
 
   auto io_context() -> asio::io_context& { return m_io_context; }
   bool is_running() const { return m_is_running; }
+  auto load() -> Load& { return m_load; }
 
   void run();
   auto run_one() -> size_t;
@@ -71,6 +106,7 @@ public:
 private:
   asio::io_context m_io_context;
   bool m_is_running;
+  Load m_load;
   static Net* s_main;
   static thread_local Net s_current;
 };
@@ -27,6 +27,7 @@
 #include "list.hpp"
 #include "worker.hpp"
 #include "os-platform.hpp"
+#include "thread-pool.hpp"
 
 #include <cstdarg>
 #include <cstring>
@@ -143,6 +144,21 @@ void Pipeline::check_thread() {
 }
 
 void Pipeline::input(Event *evt) {
+  if (m_layout->m_pipeline_process_batch) {
+    m_batch.push_back(evt);
+    if (!m_batch_scheduled) {
+      m_batch_scheduled = true;
+      retain();
+      module()->net()->defer(
+        [this]() {
+          flush_batch();
+          release();
+        }
+      );
+    }
+    return;
+  }
+
   LocalRefPool lrf;
   auto e = nmi::s_values.alloc(evt);
   lrf.add(e);
@@ -151,10 +167,37 @@ void Pipeline::input(Event *evt) {
   NativeModule::set_current(nullptr);
 }
 
+void Pipeline::flush_batch() {
+  m_batch_scheduled = false;
+  std::vector<pjs::Ref<Event>> batch(std::move(m_batch));
+  m_batch.clear();
+  LocalRefPool lrf;
+  std::vector<pjs_value> evts(batch.size());
+  for (size_t i = 0; i < batch.size(); i++) {
+    auto e = nmi::s_values.alloc(batch[i].get());
+    lrf.add(e);
+    evts[i] = e;
+  }
+  NativeModule::set_current(module());
+  m_layout->m_pipeline_process_batch(m_id, m_user_ptr, evts.data(), evts.size());
+  NativeModule::set_current(nullptr);
+}
+
 void Pipeline::output(Event *evt) {
   m_output->input(evt);
 }
 
+void Pipeline::work_start() {
+  retain();
+  m_congestion.begin();
+  m_work_count++;
+}
+
+void Pipeline::work_end() {
+  if (!--m_work_count) m_congestion.end();
+  release();
+}
+
 void Pipeline::release() {
   if (m_retain_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
     LocalRefPool lrf;
@@ -271,9 +314,9 @@ NativeModule::NativeModule(int index, const std::string &filename)
         msg += filename;
         throw std::runtime_error(msg + filename);
       }
-      m_pipeline_layouts[pd.name] = new PipelineLayout(this, pd.init, pd.free, pd.process);
+      m_pipeline_layouts[pd.name] = new PipelineLayout(this, pd.init, pd.free, pd.process, pd.process_batch);
     } else {
-      m_entry_pipeline = new PipelineLayout(this, pd.init, pd.free, pd.process);
+      m_entry_pipeline = new PipelineLayout(this, pd.init, pd.free, pd.process, pd.process_batch);
     }
   }
 }
@@ -296,6 +339,17 @@ void NativeModule::define_pipeline(const char *name, fn_pipeline_init init, fn_p
   p.init = init;
   p.free = free;
   p.process = process;
+  p.process_batch = nullptr;
+}
+
+void NativeModule::define_pipeline(const char *name, fn_pipeline_init init, fn_pipeline_free free, fn_pipeline_process_batch process) {
+  m_pipeline_defs.emplace_back();
+  auto &p = m_pipeline_defs.back();
+  p.name = name ? pjs::Str::make(name) : nullptr;
+  p.init = init;
+  p.free = free;
+  p.process = nullptr;
+  p.process_batch = process;
 }
 
 auto NativeModule::pipeline_layout(pjs::Str *name) -> PipelineLayout* {
@@ -325,6 +379,21 @@ void NativeModule::schedule(double timeout, const std::function<void()> &fn) {
   );
 }
 
+void NativeModule::submit(const std::function<void()> &work, const std::function<void()> &done) {
+  auto *net = m_net;
+  ThreadPool::shared().run(
+    [=]() {
+      work();
+      net->post(
+        [=]() {
+          InputContext ic;
+          callback(done);
+        }
+      );
+    }
+  );
+}
+
 void NativeModule::callback(const std::function<void()> &fn) {
   LocalRefPool lrf;
   set_current(this);
@@ -353,6 +422,10 @@ template<> void ClassDef<pipy::nmi::NativeObject>::init()
 {
 }
 
+template<> void ClassDef<pipy::nmi::DataBuilder>::init()
+{
+}
+
 } // namespace pjs
 
 using namespace pipy;
@@ -895,6 +968,55 @@ NMI_EXPORT int pipy_Data_get_data(pjs_value obj, char *buf, int len) {
   return -1;
 }
 
+NMI_EXPORT int pipy_Data_iterate(pjs_value obj, fn_data_chunk cb, void *user_ptr) {
+  if (auto *pv = nmi::s_values.get(obj)) {
+    auto &v = pv->v;
+    if (v.is_instance_of<Data>()) {
+      int n = 0;
+      for (const auto c : v.as<Data>()->chunks()) {
+        n++;
+        if (!(*cb)(std::get<0>(c), std::get<1>(c), user_ptr)) break;
+      }
+      return n;
+    }
+  }
+  return -1;
+}
+
+NMI_EXPORT pjs_value pipy_Data_Builder_new() {
+  return to_local_value(nmi::DataBuilder::make(&nmi::s_dp));
+}
+
+NMI_EXPORT char* pipy_Data_Builder_reserve(pjs_value builder, int *len) {
+  if (auto *pv = nmi::s_values.get(builder)) {
+    auto &v = pv->v;
+    if (v.is_instance_of<nmi::DataBuilder>()) {
+      return v.as<nmi::DataBuilder>()->reserve(*len);
+    }
+  }
+  *len = 0;
+  return nullptr;
+}
+
+NMI_EXPORT void pipy_Data_Builder_commit(pjs_value builder, int len) {
+  if (auto *pv = nmi::s_values.get(builder)) {
+    auto &v = pv->v;
+    if (v.is_instance_of<nmi::DataBuilder>()) {
+      v.as<nmi::DataBuilder>()->commit(len);
+    }
+  }
+}
+
+NMI_EXPORT pjs_value pipy_Data_Builder_flush(pjs_value builder) {
+  if (auto *pv = nmi::s_values.get(builder)) {
+    auto &v = pv->v;
+    if (v.is_instance_of<nmi::DataBuilder>()) {
+      return to_local_value(v.as<nmi::DataBuilder>()->flush());
+    }
+  }
+  return 0;
+}
+
 NMI_EXPORT pjs_value pipy_MessageStart_new(pjs_value head) {
   pjs::Object *head_obj = nullptr;
   if (head) {
@@ -998,6 +1120,12 @@ NMI_EXPORT void pipy_define_pipeline(const char *name, fn_pipeline_init init, fn
   }
 }
 
+NMI_EXPORT void pipy_define_pipeline_batch(const char *name, fn_pipeline_init init, fn_pipeline_free free, fn_pipeline_process_batch process) {
+  if (auto *m = nmi::NativeModule::current()) {
+    m->define_pipeline(name, init, free, process);
+  }
+}
+
 NMI_EXPORT void pipy_hold(pipy_pipeline ppl) {
   if (auto *p = nmi::Pipeline::get(ppl)) {
     p->check_thread();
@@ -1074,3 +1202,19 @@ NMI_EXPORT void pipy_schedule(pipy_pipeline ppl, double timeout, void (*fn)(void
     );
   }
 }
+
+NMI_EXPORT void pipy_submit_work(pipy_pipeline ppl, void (*work)(void *), void (*done)(void *), void *user_ptr) {
+  if (auto *p = nmi::Pipeline::get(ppl)) {
+    p->check_thread();
+    p->work_start();
+    p->module()->submit(
+      [=]() {
+        (*work)(user_ptr);
+      },
+      [=]() {
+        if (done) (*done)(user_ptr);
+        p->work_end();
+      }
+    );
+  }
+}
@@ -62,8 +62,10 @@ public:
   auto filename() const -> pjs::Str* { return m_filename; }
   auto define_variable(int id, const char *name, const char *ns, const pjs::Value &value) -> int;
   void define_pipeline(const char *name, fn_pipeline_init init, fn_pipeline_free free, fn_pipeline_process process);
+  void define_pipeline(const char *name, fn_pipeline_init init, fn_pipeline_free free, fn_pipeline_process_batch process);
   auto pipeline_layout(pjs::Str *name) -> PipelineLayout*;
   void schedule(double timeout, const std::function<void()> &fn);
+  void submit(const std::function<void()> &work, const std::function<void()> &done);
 
 private:
   NativeModule(int index, const std::string &filename);
@@ -80,6 +82,7 @@ private:
     fn_pipeline_init init;
     fn_pipeline_free free;
     fn_pipeline_process process;
+    fn_pipeline_process_batch process_batch;
   };
 
   struct LegacyExport {
@@ -124,18 +127,21 @@ public:
     NativeModule *mod,
     fn_pipeline_init init,
     fn_pipeline_free free,
-    fn_pipeline_process process
+    fn_pipeline_process process,
+    fn_pipeline_process_batch process_batch = nullptr
   )
     : m_module(mod)
     , m_pipeline_init(init)
     , m_pipeline_free(free)
-    , m_pipeline_process(process) {}
+    , m_pipeline_process(process)
+    , m_pipeline_process_batch(process_batch) {}
 
 private:
   NativeModule* m_module;
   fn_pipeline_init m_pipeline_init;
   fn_pipeline_free m_pipeline_free;
   fn_pipeline_process m_pipeline_process;
+  fn_pipeline_process_batch m_pipeline_process_batch;
 
   friend class Pipeline;
 };
@@ -162,6 +168,8 @@ public:
   void output(Event *evt);
   void retain() { m_retain_count.fetch_add(1, std::memory_order_relaxed); }
   void release();
+  void work_start();
+  void work_end();
 
 private:
   Pipeline(PipelineLayout *layout, Context *ctx, EventTarget::Input *out);
@@ -173,11 +181,53 @@ private:
   pjs::Ref<EventTarget::Input> m_output;
   std::atomic<int> m_retain_count;
 
+  //
+  // A pipeline defined with a batch callback gets all events that come
+  // in during one turn of the event loop together, at the end of it.
+  //
+
+  std::vector<pjs::Ref<Event>> m_batch;
+  bool m_batch_scheduled = false;
+
+  //
+  // While work submitted to the thread pool is running, the input that
+  // submitted it is held back the same way as a congested output would.
+  //
+
+  InputSource::Congestion m_congestion;
+  int m_work_count = 0;
+
+  void flush_batch();
+
   static SharedTable<Pipeline*> m_pipeline_table;
 
   friend class PipelineLayout;
 };
 
+//
+// DataBuilder
+//
+
+class DataBuilder : public pjs::ObjectTemplate<DataBuilder> {
+public:
+  auto reserve(int &n) -> char* { return m_builder.reserve(n); }
+  void commit(int n) { m_builder.commit(n); }
+
+  auto flush() -> Data* {
+    m_builder.flush();
+    return Data::make(std::move(m_data));
+  }
+
+private:
+  DataBuilder(Data::Producer *producer)
+    : m_builder(m_data, producer) {}
+
+  Data m_data;
+  Data::Builder m_builder;
+
+  friend class pjs::ObjectTemplate<DataBuilder>;
+};
+
 //
 // NativeObject
 //
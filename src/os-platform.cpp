@@ -37,6 +37,19 @@
 
 #endif // _WIN32
 
+#ifdef __linux__
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <cctype>
+#include <cstring>
+
+#endif // __linux__
+
 namespace pipy {
 namespace os {
 
@@ -270,6 +283,15 @@ void kill(int pid, int sig) {
   // TODO
 }
 
+auto cpu_list() -> std::vector<int> {
+  return std::vector<int>();
+}
+
+bool bind_cpu(int cpu, int &numa_node) {
+  numa_node = -1;
+  return false;
+}
+
 auto FileHandle::std_input() -> FileHandle {
   if (!s_stdin_server) {
     char name[256];
@@ -456,6 +478,74 @@ void kill(int pid, int sig) {
   ::kill(pid, sig);
 }
 
+#ifdef __linux__
+
+auto cpu_list() -> std::vector<int> {
+  std::vector<int> list;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (!sched_getaffinity(0, sizeof(set), &set)) {
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &set)) list.push_back(i);
+    }
+  }
+  return list;
+}
+
+static int numa_node_of_cpu(int cpu) {
+  auto path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+  auto dir = opendir(path.c_str());
+  if (!dir) return -1;
+  int node = -1;
+  while (auto ent = readdir(dir)) {
+    auto name = ent->d_name;
+    if (!std::strncmp(name, "node", 4) && std::isdigit(name[4])) {
+      node = std::atoi(name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+bool bind_cpu(int cpu, int &numa_node) {
+  numa_node = -1;
+  if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) return false;
+
+  // This is set_mempolicy(), the thread-wide form of mbind(). Pages
+  // faulted in by this thread from now on, including those backing its
+  // pools and its malloc arena, come from the local node when possible.
+  auto node = numa_node_of_cpu(cpu);
+  if (node >= 0) {
+    const size_t bits = sizeof(unsigned long) * 8;
+    std::vector<unsigned long> mask(node / bits + 1);
+    mask[node / bits] |= 1UL << (node % bits);
+    if (!syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), mask.size() * bits + 1)) {
+      numa_node = node;
+    }
+  }
+
+  return true;
+}
+
+#else // !__linux__
+
+auto cpu_list() -> std::vector<int> {
+  return std::vector<int>();
+}
+
+bool bind_cpu(int cpu, int &numa_node) {
+  numa_node = -1;
+  return false;
+}
+
+#endif // __linux__
+
 FileHandle::FileHandle(int fd, const char *mode) {
   m_file = fdopen(fd, mode);
 }
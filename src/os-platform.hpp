@@ -28,6 +28,8 @@
 
 #include "net.hpp"
 
+#include <vector>
+
 namespace pipy {
 namespace os {
 
@@ -36,6 +38,14 @@ void cleanup();
 auto process_id() -> int;
 void kill(int pid, int sig = 0);
 
+// CPUs this process is allowed to run on, empty if not supported
+auto cpu_list() -> std::vector<int>;
+
+// Pins the calling thread to a CPU and has its memory allocated
+// preferably from the NUMA node of that CPU, which is output in
+// numa_node or -1 if the node is unknown
+bool bind_cpu(int cpu, int &numa_node);
+
 } // namespace os
 } // namespace pipy
 
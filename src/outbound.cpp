@@ -28,6 +28,7 @@
 #include "pipeline.hpp"
 #include "utils.hpp"
 #include "log.hpp"
+#include "usdt.hpp"
 
 #include <iostream>
 
@@ -49,6 +50,12 @@ thread_local pjs::Ref<stats::Gauge> Outbound::s_metric_concurrency;
 thread_local pjs::Ref<stats::Counter> Outbound::s_metric_traffic_in;
 thread_local pjs::Ref<stats::Counter> Outbound::s_metric_traffic_out;
 thread_local pjs::Ref<stats::Histogram> Outbound::s_metric_conn_time;
+thread_local pjs::Ref<stats::Histogram> Outbound::s_metric_resolve_time;
+thread_local pjs::Ref<stats::Histogram> Outbound::s_metric_tcp_time;
+thread_local pjs::Ref<stats::Histogram> Outbound::s_metric_tls_time;
+thread_local pjs::Ref<stats::Histogram> Outbound::s_metric_first_byte;
+thread_local pjs::Ref<stats::Histogram> Outbound::s_metric_duration;
+thread_local pjs::Ref<stats::Histogram> Outbound::s_metric_bytes;
 
 static const std::string s_localhost("localhost");
 static const std::string s_localhost_ip("127.0.0.1");
@@ -123,6 +130,14 @@ void Outbound::close(StreamEnd *eos) {
 void Outbound::state(State state) {
   if (m_state != state) {
     m_state = state;
+    if (state == State::connected) m_connected_time = utils::now();
+    if (auto t = m_options.timeline.get()) {
+      switch (state) {
+        case State::connecting: t->mark(FlightRecorder::CONNECT); break;
+        case State::connected: t->mark(FlightRecorder::CONNECTED); break;
+        default: break;
+      }
+    }
     if (const auto &f = m_options.on_state_changed) {
       f(this);
     }
@@ -131,6 +146,19 @@ void Outbound::state(State state) {
 
 void Outbound::input(Event *evt) {
   if (m_state != State::closed) {
+    if (!m_first_byte_received) {
+      if (auto data = evt->as<Data>()) {
+        if (!data->empty()) {
+          m_first_byte_received = true;
+          if (auto tl = m_options.timeline.get()) tl->mark(FlightRecorder::UPSTREAM_FIRST_BYTE);
+          if (m_connected_time > 0) {
+            auto t = utils::now() - m_connected_time;
+            s_metric_first_byte->observe(t);
+            if (m_metric_first_byte) m_metric_first_byte->observe(t);
+          }
+        }
+      }
+    }
     m_input->input(evt);
   }
 }
@@ -161,6 +189,11 @@ void Outbound::collect_metrics() {
   m_metric_traffic_out = Outbound::s_metric_traffic_out->with_labels(keys, 2);
   m_metric_traffic_in = Outbound::s_metric_traffic_in->with_labels(keys, 2);
   m_metric_conn_time = Outbound::s_metric_conn_time->with_labels(keys, 2);
+  m_metric_resolve_time = Outbound::s_metric_resolve_time->with_labels(keys, 2);
+  m_metric_tcp_time = Outbound::s_metric_tcp_time->with_labels(keys, 2);
+  m_metric_first_byte = Outbound::s_metric_first_byte->with_labels(keys, 2);
+  m_metric_duration = Outbound::s_metric_duration->with_labels(keys, 2);
+  m_metric_bytes = Outbound::s_metric_bytes->with_labels(keys, 2);
 }
 
 void Outbound::collect() {
@@ -170,6 +203,24 @@ void Outbound::collect() {
   s_metric_traffic_out->increase(out);
   if (m_metric_traffic_in) m_metric_traffic_in->increase(in);
   if (m_metric_traffic_out) m_metric_traffic_out->increase(out);
+  m_traffic_total += in + out;
+
+  if (m_connected_time > 0) {
+    auto duration = utils::now() - m_connected_time;
+    s_metric_duration->observe(duration);
+    s_metric_bytes->observe(m_traffic_total);
+    if (m_metric_duration) m_metric_duration->observe(duration);
+    if (m_metric_bytes) m_metric_bytes->observe(m_traffic_total);
+  }
+}
+
+void Outbound::observe_tls_time(pjs::Str *host, double t) {
+  thread_local static pjs::ConstStr s_TLS("TLS");
+  pjs::Str *keys[2];
+  keys[0] = s_TLS;
+  keys[1] = host ? host : pjs::Str::empty.get();
+  s_metric_tls_time->observe(t);
+  s_metric_tls_time->with_labels(keys, 2)->observe(t);
 }
 
 void Outbound::to_ip_addr(const std::string &address, std::string &host, int &port, int default_port) {
@@ -217,6 +268,7 @@ void Outbound::init_metrics() {
         Outbound::for_each([&](Outbound *outbound) {
           auto n = outbound->get_traffic_in();
           outbound->m_metric_traffic_in->increase(n);
+          outbound->m_traffic_total += n;
           s_metric_traffic_in->increase(n);
           return true;
         });
@@ -230,6 +282,7 @@ void Outbound::init_metrics() {
         Outbound::for_each([&](Outbound *outbound) {
           auto n = outbound->get_traffic_out();
           outbound->m_metric_traffic_out->increase(n);
+          outbound->m_traffic_total += n;
           s_metric_traffic_out->increase(n);
           return true;
         });
@@ -248,6 +301,46 @@ void Outbound::init_metrics() {
       pjs::Str::make("pipy_outbound_conn_time"),
       buckets, label_names
     );
+
+    algo::Percentile::LogLinear time_layout;
+    time_layout.lowest = 0.1;
+    time_layout.highest = 24 * 3600 * 1000;
+    time_layout.precision = 1;
+
+    algo::Percentile::LogLinear size_layout;
+    size_layout.lowest = 64;
+    size_layout.highest = 16ull << 30;
+    size_layout.precision = 1;
+
+    s_metric_resolve_time = stats::Histogram::make(
+      pjs::Str::make("pipy_outbound_resolve_time"),
+      time_layout, label_names
+    );
+
+    s_metric_tcp_time = stats::Histogram::make(
+      pjs::Str::make("pipy_outbound_tcp_time"),
+      time_layout, label_names
+    );
+
+    s_metric_tls_time = stats::Histogram::make(
+      pjs::Str::make("pipy_outbound_tls_time"),
+      time_layout, label_names
+    );
+
+    s_metric_first_byte = stats::Histogram::make(
+      pjs::Str::make("pipy_outbound_first_byte_time"),
+      time_layout, label_names
+    );
+
+    s_metric_duration = stats::Histogram::make(
+      pjs::Str::make("pipy_outbound_duration"),
+      time_layout, label_names
+    );
+
+    s_metric_bytes = stats::Histogram::make(
+      pjs::Str::make("pipy_outbound_bytes"),
+      size_layout, label_names
+    );
   }
 }
 
@@ -258,7 +351,6 @@ void Outbound::init_metrics() {
 OutboundTCP::OutboundTCP(EventTarget::Input *output, const Outbound::Options &options)
   : pjs::ObjectTemplate<OutboundTCP, Outbound>(output, options)
   , SocketTCP(false, Outbound::m_options)
-  , m_resolver(Net::context())
 {
 }
 
@@ -273,6 +365,7 @@ void OutboundTCP::bind(const std::string &address) {
   auto &s = SocketTCP::socket();
   tcp::endpoint ep(asio::ip::make_address(ip), port);
   s.open(ep.protocol());
+  set_sock_opts(s.native_handle());
   state(Outbound::State::open);
   s.bind(ep);
   const auto &local = s.local_endpoint();
@@ -318,8 +411,9 @@ void OutboundTCP::close() {
   switch (state()) {
     case Outbound::State::resolving:
     case Outbound::State::connecting:
-      m_resolver.cancel();
+      if (Resolver::cancel(this)) release();
       m_connect_timer.cancel();
+      cancel_attempts();
       SocketTCP::socket().cancel(ec);
       break;
     case Outbound::State::connected:
@@ -346,6 +440,8 @@ void OutboundTCP::start(double delay) {
 
 void OutboundTCP::resolve() {
   m_start_time = utils::now();
+  m_resolve_time = 0;
+  PIPY_PROBE2(outbound__connect, m_host.c_str(), m_port);
 
   if (options().connect_timeout > 0) {
     m_connect_timer.schedule(
@@ -379,33 +475,145 @@ void OutboundTCP::resolve() {
 
   const auto &host = (m_host == s_localhost ? s_localhost_ip : m_host);
 
-  m_resolver.async_resolve(
-    tcp::resolver::query(host, std::to_string(m_port)),
-    [this](
-      const std::error_code &ec,
-      tcp::resolver::results_type results
-    ) {
-      InputContext ic;
+  log_debug("resolving hostname...");
+  state(Outbound::State::resolving);
+  retain();
 
-      if (ec && options().connect_timeout > 0) {
+  Resolver::resolve(host, this);
+}
+
+//
+// Addresses of both families are tried in turn starting with IPv6, and
+// each attempt gets a head start of CONNECTION_ATTEMPT_DELAY before the
+// next one is raced against it, as in RFC 8305 (Happy Eyeballs v2).
+// A socket that has been bound to a local address stays on its family.
+//
+
+static const double CONNECTION_ATTEMPT_DELAY = 0.25;
+
+void OutboundTCP::on_resolve(const std::vector<asio::ip::address> &addresses) {
+  InputContext ic;
+
+  if (state() == Outbound::State::resolving) {
+    if (addresses.empty()) {
+      if (options().connect_timeout > 0) {
         m_connect_timer.cancel();
       }
+      if (Log::is_enabled(Log::OUTBOUND)) {
+        char desc[1000];
+        describe(desc, sizeof(desc));
+        Log::debug(Log::OUTBOUND, "%s cannot resolve hostname", desc);
+      }
+      connect_error(StreamEnd::CANNOT_RESOLVE);
+
+    } else {
+      m_resolve_time = utils::now() - m_start_time;
+      m_metric_resolve_time->observe(m_resolve_time);
+      s_metric_resolve_time->observe(m_resolve_time);
+
+      auto &s = socket();
+      std::vector<tcp::endpoint> v4, v6;
+      for (const auto &addr : addresses) {
+        if (addr.is_v6()) {
+          v6.emplace_back(addr, m_port);
+        } else {
+          v4.emplace_back(addr, m_port);
+        }
+      }
+
+      m_endpoints.clear();
+      m_next_endpoint = 0;
+      for (size_t i = 0; i < v4.size() || i < v6.size(); i++) {
+        if (i < v6.size()) m_endpoints.push_back(v6[i]);
+        if (i < v4.size()) m_endpoints.push_back(v4[i]);
+      }
+
+      if (s.is_open()) {
+        const auto &local = s.local_endpoint();
+        auto &same_family = local.address().is_v6() ? v6 : v4;
+        const auto &target = same_family.empty() ? m_endpoints.front() : same_family.front();
+        m_remote_addr = target.address().to_string();
+        m_remote_addr_str = nullptr;
+        connect(target);
+      } else if (m_endpoints.size() == 1) {
+        const auto &target = m_endpoints.front();
+        m_remote_addr = target.address().to_string();
+        m_remote_addr_str = nullptr;
+        connect(target);
+      } else {
+        state(Outbound::State::connecting);
+        connect_next();
+      }
+    }
+  }
+
+  release();
+}
+
+void OutboundTCP::connect_next() {
+  if (m_next_endpoint >= m_endpoints.size()) return;
+
+  const auto &target = m_endpoints[m_next_endpoint++];
+
+  if (Log::is_enabled(Log::OUTBOUND)) {
+    char desc[200];
+    describe(desc, sizeof(desc));
+    Log::debug(Log::OUTBOUND, "%s connecting to %s...", desc, target.address().to_string().c_str());
+  }
+
+  std::error_code ec;
+  auto *s = new tcp::socket(Net::context());
+  s->open(target.protocol(), ec);
+  if (ec) {
+    delete s;
+    if (m_next_endpoint < m_endpoints.size()) {
+      connect_next();
+    } else if (m_attempts.empty()) {
+      connect_error(StreamEnd::CONNECTION_REFUSED);
+    }
+    return;
+  }
+
+  set_sock_opts(s->native_handle());
+  m_attempts.emplace_back(s);
+
+  s->async_connect(
+    target,
+    [=](const std::error_code &ec) {
+      InputContext ic;
 
       if (ec != asio::error::operation_aborted) {
         if (ec) {
           if (Log::is_enabled(Log::OUTBOUND)) {
-            char desc[1000];
+            char desc[200];
             describe(desc, sizeof(desc));
-            Log::debug(Log::OUTBOUND, "%s cannot resolve hostname: %s", desc, ec.message().c_str());
+            Log::debug(Log::OUTBOUND, "%s cannot connect to %s: %s", desc, target.address().to_string().c_str(), ec.message().c_str());
+          }
+          for (auto i = m_attempts.begin(); i != m_attempts.end(); i++) {
+            if (i->get() == s) {
+              m_attempts.erase(i);
+              break;
+            }
+          }
+          if (m_next_endpoint < m_endpoints.size()) {
+            m_attempt_timer.cancel();
+            connect_next();
+          } else if (m_attempts.empty()) {
+            if (options().connect_timeout > 0) {
+              m_connect_timer.cancel();
+            }
+            connect_error(StreamEnd::CONNECTION_REFUSED);
           }
-          connect_error(StreamEnd::CANNOT_RESOLVE);
 
-        } else if (state() == Outbound::State::resolving) {
-          auto &result = *results;
-          const auto &target = result.endpoint();
+        } else if (state() == Outbound::State::connecting) {
+          if (options().connect_timeout > 0) {
+            m_connect_timer.cancel();
+          }
+          socket() = std::move(*s);
+          cancel_attempts();
           m_remote_addr = target.address().to_string();
           m_remote_addr_str = nullptr;
-          connect(target);
+          connect_done();
         }
       }
 
@@ -413,10 +621,32 @@ void OutboundTCP::resolve() {
     }
   );
 
-  log_debug("resolving hostname...");
   retain();
 
-  state(Outbound::State::resolving);
+  if (m_next_endpoint < m_endpoints.size()) {
+    m_attempt_timer.schedule(
+      CONNECTION_ATTEMPT_DELAY,
+      [this]() {
+        InputContext ic;
+        connect_next();
+      }
+    );
+  }
+}
+
+void OutboundTCP::cancel_attempts() {
+  m_attempt_timer.cancel();
+  m_attempts.clear();
+}
+
+void OutboundTCP::set_sock_opts(int sock) {
+  if (auto opt = SocketTCP::set_sock_opts(sock, options(), false)) {
+    if (Log::is_enabled(Log::OUTBOUND)) {
+      char desc[200];
+      describe(desc, sizeof(desc));
+      Log::debug(Log::OUTBOUND, "%s cannot set option %s", desc, opt);
+    }
+  }
 }
 
 void OutboundTCP::connect(const asio::ip::tcp::endpoint &target) {
@@ -429,6 +659,7 @@ void OutboundTCP::connect(const asio::ip::tcp::endpoint &target) {
   auto &s = socket();
   if (!s.is_open()) {
     s.open(target.protocol());
+    set_sock_opts(s.native_handle());
     state(Outbound::State::open);
   }
 
@@ -451,25 +682,7 @@ void OutboundTCP::connect(const asio::ip::tcp::endpoint &target) {
           connect_error(StreamEnd::CONNECTION_REFUSED);
 
         } else if (state() == Outbound::State::connecting) {
-          const auto &ep = socket().local_endpoint();
-          m_local_addr = ep.address().to_string();
-          m_local_port = ep.port();
-          m_local_addr_str = nullptr;
-
-          auto conn_time = utils::now() - m_start_time;
-          m_connection_time += conn_time;
-          m_metric_conn_time->observe(conn_time);
-          s_metric_conn_time->observe(conn_time);
-
-          if (Log::is_enabled(Log::OUTBOUND)) {
-            char desc[200];
-            describe(desc, sizeof(desc));
-            Log::debug(Log::OUTBOUND, "%s connected in %g ms", desc, conn_time);
-          }
-
-          retain();
-          SocketTCP::open();
-          state(Outbound::State::connected);
+          connect_done();
         }
       }
 
@@ -482,6 +695,32 @@ void OutboundTCP::connect(const asio::ip::tcp::endpoint &target) {
   state(Outbound::State::connecting);
 }
 
+void OutboundTCP::connect_done() {
+  std::error_code ec;
+  const auto &ep = socket().local_endpoint(ec);
+  m_local_addr = ep.address().to_string();
+  m_local_port = ep.port();
+  m_local_addr_str = nullptr;
+
+  auto conn_time = utils::now() - m_start_time;
+  m_connection_time += conn_time;
+  m_metric_conn_time->observe(conn_time);
+  s_metric_conn_time->observe(conn_time);
+  m_metric_tcp_time->observe(conn_time - m_resolve_time);
+  s_metric_tcp_time->observe(conn_time - m_resolve_time);
+  PIPY_PROBE3(outbound__connected, m_host.c_str(), m_port, (uint64_t)(conn_time * 1000));
+
+  if (Log::is_enabled(Log::OUTBOUND)) {
+    char desc[200];
+    describe(desc, sizeof(desc));
+    Log::debug(Log::OUTBOUND, "%s connected in %g ms", desc, conn_time);
+  }
+
+  retain();
+  SocketTCP::open();
+  state(Outbound::State::connected);
+}
+
 void OutboundTCP::connect_error(StreamEnd::Error err) {
   if (options().retry_count >= 0 && m_retries >= options().retry_count) {
     error(err);
@@ -489,7 +728,8 @@ void OutboundTCP::connect_error(StreamEnd::Error err) {
     m_retries++;
     std::error_code ec;
     socket().close(ec);
-    m_resolver.cancel();
+    if (Resolver::cancel(this)) release();
+    cancel_attempts();
     state(Outbound::State::idle);
     start(options().retry_delay);
   }
@@ -29,13 +29,17 @@
 #include "net.hpp"
 #include "socket.hpp"
 #include "event.hpp"
+#include "flight-recorder.hpp"
 #include "input.hpp"
 #include "timer.hpp"
 #include "list.hpp"
+#include "resolver.hpp"
 #include "api/ip.hpp"
 #include "api/stats.hpp"
 
 #include <functional>
+#include <memory>
+#include <vector>
 
 namespace pipy {
 
@@ -74,6 +78,9 @@ public:
     double    connect_timeout = 0;
 
     std::function<void(Outbound*)> on_state_changed;
+
+    // Timeline of the inbound this connection is made for, if any
+    pjs::Ref<FlightRecorder::Timeline> timeline;
   };
 
   static auto count() -> int {
@@ -89,7 +96,11 @@ public:
     }
   }
 
+  // Client-side TLS handshakes are labeled by the SNI they were made for
+  static void observe_tls_time(pjs::Str *host, double t);
+
   auto get_socket() -> Socket*;
+  virtual auto get_socket_tcp() -> SocketTCP* { return nullptr; }
   auto protocol() const -> Protocol { return m_options.protocol; }
   auto protocol_name() const -> pjs::Str*;
   auto address() -> pjs::Str*;
@@ -136,7 +147,11 @@ protected:
   int m_local_port = 0;
   int m_retries = 0;
   double m_start_time = 0;
+  double m_resolve_time = 0;
+  double m_connected_time = 0;
   double m_connection_time = 0;
+  size_t m_traffic_total = 0;
+  bool m_first_byte_received = false;
 
   auto options() const -> const Options& { return m_options; }
 
@@ -153,10 +168,21 @@ protected:
   thread_local static pjs::Ref<stats::Counter> s_metric_traffic_in;
   thread_local static pjs::Ref<stats::Counter> s_metric_traffic_out;
   thread_local static pjs::Ref<stats::Histogram> s_metric_conn_time;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_resolve_time;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_tcp_time;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_tls_time;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_first_byte;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_duration;
+  thread_local static pjs::Ref<stats::Histogram> s_metric_bytes;
 
   pjs::Ref<stats::Counter> m_metric_traffic_out;
   pjs::Ref<stats::Counter> m_metric_traffic_in;
   pjs::Ref<stats::Histogram> m_metric_conn_time;
+  pjs::Ref<stats::Histogram> m_metric_resolve_time;
+  pjs::Ref<stats::Histogram> m_metric_tcp_time;
+  pjs::Ref<stats::Histogram> m_metric_first_byte;
+  pjs::Ref<stats::Histogram> m_metric_duration;
+  pjs::Ref<stats::Histogram> m_metric_bytes;
 
 private:
   thread_local static List<Outbound> s_all_outbounds;
@@ -172,7 +198,8 @@ private:
 
 class OutboundTCP :
   public pjs::ObjectTemplate<OutboundTCP, Outbound>,
-  public SocketTCP
+  public SocketTCP,
+  public Resolver::Handler
 {
 public:
   auto buffered() const -> size_t { return SocketTCP::buffered(); }
@@ -187,16 +214,26 @@ private:
   OutboundTCP(EventTarget::Input *output, const Outbound::Options &options);
   ~OutboundTCP();
 
-  asio::ip::tcp::resolver m_resolver;
   Timer m_connect_timer;
   Timer m_retry_timer;
+  Timer m_attempt_timer;
+  std::vector<asio::ip::tcp::endpoint> m_endpoints;
+  std::vector<std::unique_ptr<asio::ip::tcp::socket>> m_attempts;
+  size_t m_next_endpoint = 0;
 
   void start(double delay);
   void resolve();
   void connect(const asio::ip::tcp::endpoint &target);
+  void connect_next();
+  void set_sock_opts(int sock);
+  void connect_done();
   void connect_error(StreamEnd::Error err);
+  void cancel_attempts();
+
+  virtual void on_resolve(const std::vector<asio::ip::address> &addresses) override;
 
   virtual auto wrap_socket() -> Socket* override;
+  virtual auto get_socket_tcp() -> SocketTCP* override { return this; }
   virtual auto get_buffered() const -> size_t override { return SocketTCP::buffered(); }
   virtual auto get_traffic_in() ->size_t override;
   virtual auto get_traffic_out() ->size_t override;
@@ -58,14 +58,26 @@ void PipelineLoadBalancer::add_target(PipelineLayout *layout) {
   p.targets = t;
 }
 
-auto PipelineLoadBalancer::allocate(const std::string &module, const std::string &name, EventTarget::Input *output) -> AsyncWrapper* {
+auto PipelineLoadBalancer::allocate(
+  const std::string &module, const std::string &name,
+  EventTarget::Input *output, bool other_thread
+) -> AsyncWrapper* {
   std::lock_guard<std::mutex> lock(m_mutex);
   auto i = m_modules.find(module); if (i == m_modules.end()) return nullptr;
   auto j = i->second.pipelines.find(name); if (j == i->second.pipelines.end()) return nullptr;
-  auto t = j->second.current;
-  if (!t) t = j->second.targets;
+  auto &p = j->second;
+  auto t = p.current;
+  if (!t) t = p.targets;
   if (!t) return nullptr;
-  j->second.current = t->next;
+  if (other_thread) {
+    auto net = &Net::current();
+    auto first = t;
+    while (t->net == net) {
+      t = t->next ? t->next : p.targets;
+      if (t == first) break;
+    }
+  }
+  p.current = t->next;
   return new AsyncWrapper(t->net, t->layout, output);
 }
 
@@ -78,24 +90,64 @@ PipelineLoadBalancer::AsyncWrapper::AsyncWrapper(Net *net, PipelineLayout *layou
   , m_output_net(&Net::current())
   , m_pipeline_layout(layout)
   , m_output(output)
+  , m_queued_size(0)
+  , m_discarding(false)
+  , m_has_output(output)
 {
   retain();
   m_input_net->io_context().post(OpenHandler(this));
 }
 
+//
+// Events in both directions go through an EventQueue, and only the first
+// event of a burst posts a handler to the other thread. That handler then
+// drains everything queued so far under one InputContext.
+//
+// An event passed down a pipeline is referenced by every filter it goes
+// through, so most events are shared across. Only input_move() callers
+// that really own an event get its chunks moved over instead.
+//
+
+static const size_t EVENT_BATCH = 32;
+
 void PipelineLoadBalancer::AsyncWrapper::input(Event *evt) {
-  retain();
-  m_input_net->io_context().post(InputHandler(this, SharedEvent::make(evt)));
+  if (auto data = evt->as<Data>()) {
+    m_queued_size.fetch_add(data->size(), std::memory_order_relaxed);
+  }
+  if (m_input_queue.enqueue(evt)) {
+    retain();
+    m_input_net->io_context().post(InputHandler(this));
+  }
+}
+
+void PipelineLoadBalancer::AsyncWrapper::input_move(Event *evt) {
+  if (auto data = evt->as<Data>()) {
+    m_queued_size.fetch_add(data->size(), std::memory_order_relaxed);
+  }
+  if (m_input_queue.enqueue(evt, true)) {
+    retain();
+    m_input_net->io_context().post(InputHandler(this));
+  }
+  evt->release();
 }
 
-void PipelineLoadBalancer::AsyncWrapper::close() {
+//
+// With discard, events still sitting in the queue are dropped rather
+// than delivered before the pipeline goes away.
+//
+
+void PipelineLoadBalancer::AsyncWrapper::close(bool discard) {
+  if (discard) m_discarding.store(true);
   m_output = nullptr;
   m_input_net->io_context().post(CloseHandler(this));
 }
 
 void PipelineLoadBalancer::AsyncWrapper::on_event(Event *evt) {
-  retain();
-  m_output_net->io_context().post(OutputHandler(this, SharedEvent::make(evt)));
+  if (!m_has_output) return;
+  if (m_output_queue.enqueue(evt)) {
+    retain();
+    m_output_net->io_context().post(OutputHandler(this));
+  }
 }
 
 void PipelineLoadBalancer::AsyncWrapper::on_open() {
@@ -113,27 +165,40 @@ void PipelineLoadBalancer::AsyncWrapper::on_close() {
   release();
 }
 
-void PipelineLoadBalancer::AsyncWrapper::on_input(SharedEvent *se) {
-  if (auto evt = se->to_event()) {
-    if (m_pipeline) {
-      InputContext ic;
-      m_pipeline->input()->input(evt);
-    } else {
-      evt->retain();
-      evt->release();
+void PipelineLoadBalancer::AsyncWrapper::on_input() {
+  Event *events[EVENT_BATCH];
+  m_input_queue.unsignal();
+  InputContext ic;
+  while (auto n = m_input_queue.dequeue(events, EVENT_BATCH)) {
+    for (size_t i = 0; i < n; i++) {
+      auto evt = events[i];
+      if (auto data = evt->as<Data>()) {
+        m_queued_size.fetch_sub(data->size(), std::memory_order_relaxed);
+      }
+      if (m_pipeline && !m_discarding.load()) {
+        m_pipeline->input()->input(evt);
+      } else {
+        evt->retain();
+        evt->release();
+      }
     }
   }
   release();
 }
 
-void PipelineLoadBalancer::AsyncWrapper::on_output(SharedEvent *se) {
-  if (auto evt = se->to_event()) {
-    if (m_output) {
-      InputContext ic;
-      m_output->input(evt);
-    } else {
-      evt->retain();
-      evt->release();
+void PipelineLoadBalancer::AsyncWrapper::on_output() {
+  Event *events[EVENT_BATCH];
+  m_output_queue.unsignal();
+  InputContext ic;
+  while (auto n = m_output_queue.dequeue(events, EVENT_BATCH)) {
+    for (size_t i = 0; i < n; i++) {
+      auto evt = events[i];
+      if (m_output) {
+        m_output->input(evt);
+      } else {
+        evt->retain();
+        evt->release();
+      }
     }
   }
   release();
@@ -27,9 +27,11 @@
 #define PIPELINE_LB_HPP
 
 #include "event.hpp"
+#include "event-queue.hpp"
 #include "net.hpp"
 #include "pipeline.hpp"
 
+#include <atomic>
 #include <mutex>
 #include <map>
 
@@ -55,7 +57,14 @@ public:
     public EventTarget {
   public:
     void input(Event *evt);
-    void close();
+    void close(bool discard = false);
+
+    // Takes over the caller's reference to the event, moving its chunks
+    // to the other thread rather than sharing them if nobody else holds it
+    void input_move(Event *evt);
+
+    // Bytes of Data handed to input() and not yet taken by the pipeline
+    auto queued_size() const -> size_t { return m_queued_size.load(std::memory_order_relaxed); }
 
   private:
     AsyncWrapper(Net *net, PipelineLayout *layout, EventTarget::Input *output);
@@ -72,41 +81,47 @@ public:
       void operator()() { self->on_close(); }
     };
 
-    struct InputHandler : SelfDataHandlerMT<AsyncWrapper, SharedEvent> {
-      using SelfDataHandlerMT::SelfDataHandlerMT;
-      InputHandler(AsyncWrapper *s, SharedEvent *d) : SelfDataHandlerMT(s, d) { d->retain(); }
-      InputHandler(const InputHandler &r) : SelfDataHandlerMT(r) { r.data->retain(); }
-      ~InputHandler() { data->release(); }
-      void operator()() { self->on_input(data); }
+    struct InputHandler : SelfHandlerMT<AsyncWrapper> {
+      using SelfHandlerMT::SelfHandlerMT;
+      InputHandler(const InputHandler &r) : SelfHandlerMT(r) {}
+      void operator()() { self->on_input(); }
     };
 
-    struct OutputHandler : SelfDataHandlerMT<AsyncWrapper, SharedEvent> {
-      using SelfDataHandlerMT::SelfDataHandlerMT;
-      OutputHandler(AsyncWrapper *s, SharedEvent *d) : SelfDataHandlerMT(s, d) { d->retain(); }
-      OutputHandler(const OutputHandler &r) : SelfDataHandlerMT(r) { r.data->retain(); }
-      ~OutputHandler() { data->release(); }
-      void operator()() { self->on_output(data); }
+    struct OutputHandler : SelfHandlerMT<AsyncWrapper> {
+      using SelfHandlerMT::SelfHandlerMT;
+      OutputHandler(const OutputHandler &r) : SelfHandlerMT(r) {}
+      void operator()() { self->on_output(); }
     };
 
     virtual void on_event(Event *evt) override;
 
     void on_open();
     void on_close();
-    void on_input(SharedEvent *se);
-    void on_output(SharedEvent *se);
+    void on_input();
+    void on_output();
 
     Net* m_input_net;
     Net* m_output_net;
+    EventQueue m_input_queue;
+    EventQueue m_output_queue;
     pjs::Ref<PipelineLayout> m_pipeline_layout;
     pjs::Ref<Pipeline> m_pipeline;
     pjs::Ref<EventTarget::Input> m_output;
+    std::atomic<size_t> m_queued_size;
+    std::atomic<bool> m_discarding;
+    bool m_has_output;
 
     friend class pjs::RefCount<AsyncWrapper>;
     friend class PipelineLoadBalancer;
   };
 
   void add_target(PipelineLayout *target);
-  auto allocate(const std::string &module, const std::string &name, EventTarget::Input *output) -> AsyncWrapper*;
+
+  // With other_thread, targets on the current thread are skipped if there are any others
+  auto allocate(
+    const std::string &module, const std::string &name,
+    EventTarget::Input *output, bool other_thread = false
+  ) -> AsyncWrapper*;
 
 private:
   PipelineLoadBalancer() {}
@@ -30,6 +30,7 @@
 #include "worker.hpp"
 #include "module.hpp"
 #include "log.hpp"
+#include "usdt.hpp"
 
 namespace pipy {
 
@@ -62,7 +63,8 @@ PipelineLayout::~PipelineLayout() {
   while (ptr) {
     auto *pipeline = ptr;
     ptr = ptr->m_next_free;
-    delete pipeline;
+    pipeline->~Pipeline();
+    ::operator delete(pipeline);
   }
   s_all_pipeline_layouts.remove(this);
   if (m_worker) m_worker->remove_pipeline_template(this);
@@ -109,13 +111,14 @@ auto PipelineLayout::alloc(Context *ctx) -> Pipeline* {
     pipeline = m_pool;
     m_pool = pipeline->m_next_free;
   } else {
-    pipeline = new Pipeline(this);
+    pipeline = new_pipeline();
     m_allocated++;
   }
   pipeline->m_context = ctx;
   pipeline->m_started = m_on_start ? false : true;
   m_pipelines.push(pipeline);
   m_active++;
+  m_started++;
   s_active_pipeline_count++;
   if (Log::is_enabled(Log::PIPELINE)) {
     Log::debug(
@@ -129,6 +132,21 @@ auto PipelineLayout::alloc(Context *ctx) -> Pipeline* {
   return pipeline;
 }
 
+//
+// A pipeline and its filter clones share one block: the Pipeline object
+// at the front followed by an arena for the filters. The arena size is
+// learned from the first instance, whose filters all go to the heap.
+// Blocks are never freed before the layout and are recycled with their
+// filters reset in place, so short-lived sub-pipelines don't fragment
+// the heap and each instance stays close together in memory.
+//
+
+auto PipelineLayout::new_pipeline() -> Pipeline* {
+  auto head = (sizeof(Pipeline) + 15) & ~size_t(15);
+  auto block = (char *)::operator new(head + m_arena_size);
+  return new (block) Pipeline(this, block + head, m_arena_size);
+}
+
 void PipelineLayout::end(Pipeline *pipeline, pjs::Value &result) {
   if (m_on_end) {
     auto &ctx = *pipeline->context();
@@ -161,9 +179,13 @@ void PipelineLayout::free(Pipeline *pipeline) {
 // Pipeline
 //
 
-Pipeline::Pipeline(PipelineLayout *layout)
+Pipeline::Pipeline(PipelineLayout *layout, void *arena_buffer, size_t arena_size)
   : m_layout(layout)
 {
+  PIPY_PROBE2(pipeline__alloc, this, layout->name_or_label()->c_str());
+  Filter::Arena arena(arena_buffer, arena_size);
+  auto *saved_arena = Filter::current_arena();
+  Filter::use_arena(&arena);
   const auto &filters = layout->m_filters;
   for (const auto &f : filters) {
     auto filter = f->clone();
@@ -171,11 +193,15 @@ Pipeline::Pipeline(PipelineLayout *layout)
     filter->m_pipeline = this;
     m_filters.push(filter);
   }
+  Filter::use_arena(saved_arena);
+  if (arena.requested() > layout->m_arena_size) {
+    layout->m_arena_size = arena.requested();
+  }
   if (auto f = m_filters.head()) {
-    EventProxy::chain_forward(f->EventFunction::input());
+    EventProxy::chain_forward(Filter::Stage::chain(f, EventProxy::reply()));
     while (f) {
       auto n = f->next();
-      f->EventFunction::chain(n ? n->EventFunction::input() : EventProxy::reply());
+      f->EventFunction::chain(n ? Filter::Stage::chain(n, EventProxy::reply()) : EventProxy::reply());
       f->chain();
       f->reset();
       f = n;
@@ -186,6 +212,7 @@ Pipeline::Pipeline(PipelineLayout *layout)
 }
 
 Pipeline::~Pipeline() {
+  PIPY_PROBE1(pipeline__free, this);
   auto p = m_filters.head();
   while (p) {
     auto f = p;
@@ -257,7 +284,7 @@ void Pipeline::on_auto_release() {
 
 void Pipeline::wait(pjs::Promise *promise) {
   auto cb = StartingPromiseCallback::make(this);
-  promise->then(nullptr, cb->resolved(), cb->rejected());
+  promise->then(cb);
   m_starting_promise_callback = cb;
 }
 
@@ -106,6 +106,7 @@ public:
   auto name_or_label() const -> pjs::Str*;
   auto allocated() const -> size_t { return m_allocated; }
   auto active() const -> size_t { return m_pipelines.size(); }
+  auto started() const -> uint64_t { return m_started; }
   void on_start_location(pjs::Location &loc) { m_on_start_location = loc; }
   void on_start(pjs::Object *e) { m_on_start = e; }
   void on_end(pjs::Function *f) { m_on_end = f; }
@@ -120,6 +121,7 @@ private:
   ~PipelineLayout();
 
   auto alloc(Context *ctx) -> Pipeline*;
+  auto new_pipeline() -> Pipeline*;
   void end(Pipeline *pipeline, pjs::Value &result);
   void free(Pipeline *pipeline);
 
@@ -136,6 +138,8 @@ private:
   List<Pipeline> m_pipelines;
   int m_allocated = 0;
   int m_active = 0;
+  uint64_t m_started = 0;
+  size_t m_arena_size = 0;
 
   thread_local static List<PipelineLayout> s_all_pipeline_layouts;
   thread_local static size_t s_active_pipeline_count;
@@ -193,7 +197,7 @@ public:
   void on_end(ResultCallback *cb) { m_result_cb = cb; }
 
 private:
-  Pipeline(PipelineLayout *layout);
+  Pipeline(PipelineLayout *layout, void *arena, size_t arena_size);
   ~Pipeline();
 
   virtual void on_input(Event *evt) override;
@@ -951,6 +951,9 @@ template<> void ClassDef<Global>::init() {
   // Date
   variable("Date", class_of<Constructor<Date>>());
 
+  // Uint8Array
+  variable("Uint8Array", class_of<Constructor<Uint8Array>>());
+
   // Map
   variable("Map", class_of<Constructor<Map>>());
 
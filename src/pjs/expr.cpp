@@ -54,6 +54,10 @@ Expr::~Expr()
 {
 }
 
+void Expr::compile(vm::Compiler &c, int r) {
+  c.emit_eval(this, r);
+}
+
 namespace expr {
 
 //
@@ -124,6 +128,11 @@ void Compound::resolve(Module *module, Context &ctx, int l, LegacyImports *impor
   }
 }
 
+void Compound::compile(vm::Compiler &c, int r) {
+  if (m_exprs.empty()) c.emit(vm::Opcode::UNDEFINED, r);
+  for (const auto &p : m_exprs) p->compile(c, r);
+}
+
 void Compound::dump(std::ostream &out, const std::string &indent) {
   out << indent << "compound" << std::endl;
   for (const auto &p : m_exprs) {
@@ -135,17 +144,33 @@ void Compound::dump(std::ostream &out, const std::string &indent) {
 // Concatenation
 //
 
+//
+// Strings and numbers are appended in place and the buffer is sized
+// after the previous result, so that a template usually costs one
+// allocation for the buffer and one for the resulting Str.
+//
+
 bool Concatenation::eval(Context &ctx, Value &result) {
   std::string str;
+  str.reserve(m_size_hint);
   for (const auto &p : m_exprs) {
     if (!p->eval(ctx, result)) {
       return false;
     }
-    auto s = result.to_string();
-    str += s->str();
-    s->release();
+    if (result.is_string()) {
+      str += result.s()->str();
+    } else if (result.is_number()) {
+      char buf[100];
+      auto len = Number::to_string(buf, sizeof(buf), result.n());
+      str.append(buf, len);
+    } else {
+      auto s = result.to_string();
+      str += s->str();
+      s->release();
+    }
   }
-  result.set(str);
+  m_size_hint = str.length();
+  result.set(Str::make(std::move(str)));
   return true;
 }
 
@@ -182,6 +207,10 @@ auto Undefined::reduce(Reducer &r) -> Reducer::Value* {
   return r.undefined();
 }
 
+void Undefined::compile(vm::Compiler &c, int r) {
+  c.emit(vm::Opcode::UNDEFINED, r);
+}
+
 void Undefined::dump(std::ostream &out, const std::string &indent) {
   out << indent << "undefined" << std::endl;
 }
@@ -199,6 +228,10 @@ auto Null::reduce(Reducer &r) -> Reducer::Value* {
   return r.null();
 }
 
+void Null::compile(vm::Compiler &c, int r) {
+  c.emit_const(r, Value::null);
+}
+
 void Null::dump(std::ostream &out, const std::string &indent) {
   out << indent << "null" << std::endl;
 }
@@ -216,6 +249,10 @@ auto BooleanLiteral::reduce(Reducer &r) -> Reducer::Value* {
   return r.boolean(m_b);
 }
 
+void BooleanLiteral::compile(vm::Compiler &c, int r) {
+  c.emit_const(r, m_b);
+}
+
 void BooleanLiteral::dump(std::ostream &out, const std::string &indent) {
   out << indent << (m_b ? "true" : "false") << std::endl;
 }
@@ -233,6 +270,10 @@ auto NumberLiteral::reduce(Reducer &r) -> Reducer::Value* {
   return r.number(m_n);
 }
 
+void NumberLiteral::compile(vm::Compiler &c, int r) {
+  c.emit_const(r, m_n);
+}
+
 void NumberLiteral::dump(std::ostream &out, const std::string &indent) {
   out << indent << "number " << m_n << std::endl;
 }
@@ -250,6 +291,10 @@ auto StringLiteral::reduce(Reducer &r) -> Reducer::Value* {
   return r.string(m_s->str());
 }
 
+void StringLiteral::compile(vm::Compiler &c, int r) {
+  c.emit_const(r, m_s.get());
+}
+
 void StringLiteral::dump(std::ostream &out, const std::string &indent) {
   out << indent << "string \"" << m_s->str() << '"' << std::endl;
 }
@@ -531,6 +576,16 @@ FunctionLiteral::FunctionLiteral(Expr *inputs, Stmt *output)
   }
 }
 
+//
+// A function literal that is called right where it is written never
+// leaves the expression as a value, so it can run directly off the
+// current scope instead of going through a new Function object.
+//
+
+void FunctionLiteral::call(Context &ctx, int argc, Value argv[], Value &result) {
+  m_method->invoke(ctx, ctx.scope(), nullptr, argc, argv, result);
+}
+
 bool FunctionLiteral::eval(Context &ctx, Value &result) {
   result.set(Function::make(m_method, nullptr, ctx.scope()));
   return true;
@@ -558,22 +613,36 @@ void FunctionLiteral::resolve(Module *module, Context &ctx, int l, LegacyImports
     name, [this](Context &ctx, Object*, Value &result) {
       auto scope = m_scope.instantiate(ctx);
       if (!scope) return;
-      Stmt::Result res;
-      m_output->execute(ctx, res);
-      if (ctx.ok()) {
-        if (res.is_return()) {
-          result = res.value;
-        } else {
-          result = Value::undefined;
+      if (!m_compiled) {
+        m_code.reset(vm::Code::compile(m_module, m_output.get()));
+        m_compiled = true;
+      }
+      if (m_code) {
+        m_code->run(ctx, result);
+      } else {
+        Stmt::Result res;
+        m_output->execute(ctx, res);
+        if (ctx.ok()) {
+          if (res.is_return()) {
+            result = res.value;
+          } else {
+            result = Value::undefined;
+          }
         }
       }
-      scope->clear();
+      m_scope.recycle(scope);
     }
   );
 
   Context fctx(ctx, 0, nullptr, pjs::Scope::make(ctx.instance(), ctx.scope(), m_scope.size(), m_scope.variables()));
   for (auto &i : m_inputs) i->resolve(module, fctx, l, imports);
   m_output->resolve(module, fctx, l, imports);
+
+  // The body is lowered to bytecode on the first call, or left
+  // to the tree-walker if nothing in it can be compiled, so that
+  // functions that never run on this node cost nothing to compile
+  m_module = module;
+  m_compiled = false;
 }
 
 auto FunctionLiteral::reduce(Reducer &r) -> Reducer::Value* {
@@ -674,11 +743,31 @@ void ExportedVariable::dump(std::ostream &out, const std::string &indent) {
 // LegacyLocal
 //
 
+LegacyLocal::LegacyLocal(int l, Str *key, Object *obj)
+  : m_l(l)
+  , m_key(key)
+{
+  auto type = obj->type();
+  auto i = type->find_field(key);
+  if (i >= 0) {
+    auto f = type->field(i);
+    if (f->is_variable()) {
+      m_class = type;
+      m_slot = static_cast<Variable*>(f)->index();
+      m_writable = f->is_writable();
+    }
+  }
+}
+
 bool LegacyLocal::is_left_value() const { return true; }
 
 bool LegacyLocal::eval(Context &ctx, Value &result) {
   if (auto l = ctx.l(m_l)) {
-    m_cache.get(l, m_key, result);
+    if (l->type() == m_class) {
+      result = l->data()->at(m_slot);
+    } else {
+      m_cache.get(l, m_key, result);
+    }
     return true;
   } else {
     return error(ctx, "no context");
@@ -687,7 +776,11 @@ bool LegacyLocal::eval(Context &ctx, Value &result) {
 
 bool LegacyLocal::assign(Context &ctx, Value &value) {
   if (auto l = ctx.l(m_l)) {
-    m_cache.set(l, m_key, value);
+    if (m_writable && l->type() == m_class) {
+      l->data()->at(m_slot) = value;
+    } else {
+      m_cache.set(l, m_key, value);
+    }
     return true;
   } else {
     return error(ctx, "no context");
@@ -726,6 +819,15 @@ bool LocalVariable::clear(Context &ctx, Value &result) {
   return error(ctx, "cannot delete a local variable");
 }
 
+void LocalVariable::compile(vm::Compiler &c, int r) {
+  c.emit(vm::Opcode::LOAD_LOCAL, r, m_i, m_level);
+}
+
+bool LocalVariable::compile_assign(vm::Compiler &c, int r) {
+  c.emit(vm::Opcode::STORE_LOCAL, r, m_i, m_level);
+  return true;
+}
+
 void LocalVariable::dump(std::ostream &out, const std::string &indent) {
   out << indent << "local-variable " << m_i << std::endl;
 }
@@ -837,7 +939,7 @@ void Identifier::resolve(Context &ctx) {
 
   if (auto l = ctx.l(m_l)) {
     if (l->has(m_key)) {
-      m_resolved.reset(locate(new LegacyLocal(m_l, m_key)));
+      m_resolved.reset(locate(new LegacyLocal(m_l, m_key, l)));
       return;
     }
   }
@@ -848,7 +950,7 @@ void Identifier::resolve(Context &ctx) {
     if (m_imports->get(m_key, &file, &key)) {
       auto l = ctx.l(file);
       if (l->has(key)) {
-        m_resolved.reset(locate(new LegacyLocal(file, key)));
+        m_resolved.reset(locate(new LegacyLocal(file, key, l)));
         return;
       }
     }
@@ -864,6 +966,18 @@ auto Identifier::reduce(Reducer &r) -> Reducer::Value* {
   return r.get(m_key->str());
 }
 
+void Identifier::compile(vm::Compiler &c, int r) {
+  if (m_resolved) {
+    m_resolved->compile(c, r);
+  } else {
+    c.emit_eval(this, r);
+  }
+}
+
+bool Identifier::compile_assign(vm::Compiler &c, int r) {
+  return m_resolved && m_resolved->compile_assign(c, r);
+}
+
 void Identifier::dump(std::ostream &out, const std::string &indent) {
   out << indent << "identifier " << m_key->c_str() << std::endl;
 }
@@ -880,6 +994,21 @@ bool Property::eval(Context &ctx, Value &result) {
   if (!m_key->eval(ctx, key)) return false;
   if (obj.is_undefined()) return error(ctx, "cannot read property of undefined");
   if (obj.is_null()) return error(ctx, "cannot read property of null");
+  get(obj, key, m_cache, result);
+  return true;
+}
+
+bool Property::assign(Context &ctx, Value &value) {
+  Value obj, key;
+  if (!m_obj->eval(ctx, obj)) return false;
+  if (!m_key->eval(ctx, key)) return false;
+  if (obj.is_undefined()) return error(ctx, "cannot set property of undefined");
+  if (obj.is_null()) return error(ctx, "cannot set property of null");
+  set(obj, key, m_cache, value);
+  return true;
+}
+
+void Property::get(const Value &obj, const Value &key, PropertyCache &cache, Value &result) {
   auto o = obj.to_object();
   auto c = o->type();
   if (c->has_seti()) {
@@ -887,22 +1016,16 @@ bool Property::eval(Context &ctx, Value &result) {
     if (std::isfinite(i)) {
       c->geti(o, i, result);
       o->release();
-      return true;
+      return;
     }
   }
   auto k = key.to_string();
-  m_cache.get(o, k, result);
+  cache.get(o, k, result);
   k->release();
   o->release();
-  return true;
 }
 
-bool Property::assign(Context &ctx, Value &value) {
-  Value obj, key;
-  if (!m_obj->eval(ctx, obj)) return false;
-  if (!m_key->eval(ctx, key)) return false;
-  if (obj.is_undefined()) return error(ctx, "cannot set property of undefined");
-  if (obj.is_null()) return error(ctx, "cannot set property of null");
+void Property::set(const Value &obj, const Value &key, PropertyCache &cache, const Value &value) {
   auto o = obj.to_object();
   auto c = o->type();
   if (c->has_seti()) {
@@ -910,14 +1033,13 @@ bool Property::assign(Context &ctx, Value &value) {
     if (std::isfinite(i)) {
       c->seti(o, i, value);
       o->release();
-      return true;
+      return;
     }
   }
   auto k = key.to_string();
-  m_cache.set(o, k, value);
+  cache.set(o, k, value);
   k->release();
   o->release();
-  return true;
 }
 
 bool Property::clear(Context &ctx, Value &result) {
@@ -959,6 +1081,27 @@ auto Property::reduce(Reducer &r) -> Reducer::Value* {
   return r.get(m_obj->reduce(r), m_key->reduce(r));
 }
 
+void Property::compile(vm::Compiler &c, int r) {
+  auto top = c.top();
+  auto o = c.alloc();
+  auto k = c.alloc();
+  m_obj->compile(c, o);
+  m_key->compile(c, k);
+  c.emit_cache(vm::Opcode::GET_PROP, r, o, k, this);
+  c.reset(top);
+}
+
+bool Property::compile_assign(vm::Compiler &c, int r) {
+  auto top = c.top();
+  auto o = c.alloc();
+  auto k = c.alloc();
+  m_obj->compile(c, o);
+  m_key->compile(c, k);
+  c.emit_cache(vm::Opcode::SET_PROP, r, o, k, this);
+  c.reset(top);
+  return true;
+}
+
 void Property::dump(std::ostream &out, const std::string &indent) {
   out << indent << "property" << std::endl;
   m_obj->dump(out, indent + "  ");
@@ -1059,13 +1202,19 @@ bool Invocation::eval(Context &ctx, Value &result) {
   auto argc = m_argv.size();
   vl_array<Value> argv(argc);
   Value f;
-  if (!m_func->eval(ctx, f)) return false;
-  if (!f.is_function()) return error(ctx, "not a function");
+  if (!m_literal) {
+    if (!m_func->eval(ctx, f)) return false;
+    if (!f.is_function()) return error(ctx, "not a function");
+  }
   for (size_t i = 0; i < argc; i++) {
     if (!m_argv[i]->eval(ctx, argv[i])) return false;
   }
   ctx.trace(m_module, line(), column());
-  (*f.as<Function>())(ctx, argc, argv, result);
+  if (m_literal) {
+    m_literal->call(ctx, argc, argv, result);
+  } else {
+    (*f.as<Function>())(ctx, argc, argv, result);
+  }
   if (ctx.ok()) return true;
   ctx.backtrace(source(), line(), column());
   return false;
@@ -1081,6 +1230,7 @@ bool Invocation::declare(Module *module, Scope &scope, Error &error) {
 
 void Invocation::resolve(Module *module, Context &ctx, int l, LegacyImports *imports) {
   m_module = module;
+  m_literal = dynamic_cast<FunctionLiteral*>(m_func.get());
   m_func->resolve(module, ctx, l, imports);
   for (const auto &p : m_argv) {
     p->resolve(module, ctx, l, imports);
@@ -1096,6 +1246,23 @@ auto Invocation::reduce(Reducer &r) -> Reducer::Value* {
   return r.call(m_func->reduce(r), argv, argc);
 }
 
+void Invocation::compile(vm::Compiler &c, int r) {
+  auto top = c.top();
+  int argc = m_argv.size();
+  if (m_literal) {
+    auto argv = c.alloc(argc);
+    for (int i = 0; i < argc; i++) m_argv[i]->compile(c, argv + i);
+    c.emit(vm::Opcode::CALL_LITERAL, r, 0, argv, argc, this);
+  } else {
+    auto f = c.alloc();
+    auto argv = c.alloc(argc);
+    m_func->compile(c, f);
+    for (int i = 0; i < argc; i++) m_argv[i]->compile(c, argv + i);
+    c.emit(vm::Opcode::CALL, r, f, argv, argc, this);
+  }
+  c.reset(top);
+}
+
 void Invocation::dump(std::ostream &out, const std::string &indent) {
   out << indent << "invocation" << std::endl;
   m_func->dump(out, indent + "  ");
@@ -1165,6 +1332,15 @@ void Plus::resolve(Module *module, Context &ctx, int l, LegacyImports *imports)
   m_x->resolve(module, ctx, l, imports);
 }
 
+auto Plus::reduce(Reducer &r) -> Reducer::Value* {
+  return r.pos(m_x->reduce(r));
+}
+
+void Plus::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  Expr::compile(c, r);
+}
+
 void Plus::dump(std::ostream &out, const std::string &indent) {
   out << indent << "plus" << std::endl;
   m_x->dump(out, indent + "  ");
@@ -1193,6 +1369,15 @@ void Negation::resolve(Module *module, Context &ctx, int l, LegacyImports *impor
   m_x->resolve(module, ctx, l, imports);
 }
 
+auto Negation::reduce(Reducer &r) -> Reducer::Value* {
+  return r.neg(m_x->reduce(r));
+}
+
+void Negation::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  Expr::compile(c, r);
+}
+
 void Negation::dump(std::ostream &out, const std::string &indent) {
   out << indent << "negation" << std::endl;
   m_x->dump(out, indent + "  ");
@@ -1202,17 +1387,38 @@ void Negation::dump(std::ostream &out, const std::string &indent) {
 // Addition
 //
 
+// Either side being empty gives back the other string as is, otherwise
+// the result is built once in place and moved into the new string
+static void concat(const Value &a, const Value &b, Value &result) {
+  auto sa = a.to_string();
+  auto sb = b.to_string();
+  if (!sb->size()) {
+    result.set(sa);
+  } else if (!sa->size()) {
+    result.set(sb);
+  } else {
+    std::string s;
+    s.reserve(sa->size() + sb->size());
+    s.append(sa->str());
+    s.append(sb->str());
+    result.set(std::move(s));
+  }
+  sa->release();
+  sb->release();
+}
+
 bool Addition::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void Addition::operate(const Value &a, const Value &b, Value &result) {
   if (a.is_string() || b.is_string()) {
-    auto sa = a.to_string();
-    auto sb = b.to_string();
-    result.set(sa->str() + sb->str());
-    sa->release();
-    sb->release();
-    return true;
+    concat(a, b, result);
+    return;
   }
   if (a.is<Int>() || b.is<Int>()) {
     auto ia = a.to_int();
@@ -1220,12 +1426,11 @@ bool Addition::eval(Context &ctx, Value &result) {
     result.set(ia->add(ib));
     ia->release();
     ib->release();
-    return true;
+    return;
   }
   auto na = a.to_number();
   auto nb = b.to_number();
   result.set(na + nb);
-  return true;
 }
 
 bool Addition::declare(Module *module, Scope &scope, Error &error) {
@@ -1239,6 +1444,15 @@ void Addition::resolve(Module *module, Context &ctx, int l, LegacyImports *impor
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto Addition::reduce(Reducer &r) -> Reducer::Value* {
+  return r.add(m_a->reduce(r), m_b->reduce(r));
+}
+
+void Addition::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::ADD, r, m_a.get(), m_b.get());
+}
+
 void Addition::dump(std::ostream &out, const std::string &indent) {
   out << indent << "addition" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1253,18 +1467,22 @@ bool Subtraction::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void Subtraction::operate(const Value &a, const Value &b, Value &result) {
   if (a.is<Int>() || b.is<Int>()) {
     auto ia = a.to_int();
     auto ib = b.to_int();
     result.set(ia->sub(ib));
     ia->release();
     ib->release();
-    return true;
+    return;
   }
   auto na = a.to_number();
   auto nb = b.to_number();
   result.set(na - nb);
-  return true;
 }
 
 bool Subtraction::declare(Module *module, Scope &scope, Error &error) {
@@ -1278,6 +1496,15 @@ void Subtraction::resolve(Module *module, Context &ctx, int l, LegacyImports *im
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto Subtraction::reduce(Reducer &r) -> Reducer::Value* {
+  return r.sub(m_a->reduce(r), m_b->reduce(r));
+}
+
+void Subtraction::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::SUB, r, m_a.get(), m_b.get());
+}
+
 void Subtraction::dump(std::ostream &out, const std::string &indent) {
   out << indent << "subtraction" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1292,18 +1519,22 @@ bool Multiplication::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void Multiplication::operate(const Value &a, const Value &b, Value &result) {
   if (a.is<Int>() || b.is<Int>()) {
     auto ia = a.to_int();
     auto ib = b.to_int();
     result.set(ia->mul(ib));
     ia->release();
     ib->release();
-    return true;
+    return;
   }
   auto na = a.to_number();
   auto nb = b.to_number();
   result.set(na * nb);
-  return true;
 }
 
 bool Multiplication::declare(Module *module, Scope &scope, Error &error) {
@@ -1317,6 +1548,15 @@ void Multiplication::resolve(Module *module, Context &ctx, int l, LegacyImports
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto Multiplication::reduce(Reducer &r) -> Reducer::Value* {
+  return r.mul(m_a->reduce(r), m_b->reduce(r));
+}
+
+void Multiplication::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::MUL, r, m_a.get(), m_b.get());
+}
+
 void Multiplication::dump(std::ostream &out, const std::string &indent) {
   out << indent << "multiplication" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1331,18 +1571,22 @@ bool Division::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void Division::operate(const Value &a, const Value &b, Value &result) {
   if (a.is<Int>() || b.is<Int>()) {
     auto ia = a.to_int();
     auto ib = b.to_int();
     result.set(ia->div(ib));
     ia->release();
     ib->release();
-    return true;
+    return;
   }
   auto na = a.to_number();
   auto nb = b.to_number();
   result.set(na / nb);
-  return true;
 }
 
 bool Division::declare(Module *module, Scope &scope, Error &error) {
@@ -1356,6 +1600,15 @@ void Division::resolve(Module *module, Context &ctx, int l, LegacyImports *impor
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto Division::reduce(Reducer &r) -> Reducer::Value* {
+  return r.div(m_a->reduce(r), m_b->reduce(r));
+}
+
+void Division::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::DIV, r, m_a.get(), m_b.get());
+}
+
 void Division::dump(std::ostream &out, const std::string &indent) {
   out << indent << "division" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1370,18 +1623,22 @@ bool Remainder::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void Remainder::operate(const Value &a, const Value &b, Value &result) {
   if (a.is<Int>() || b.is<Int>()) {
     auto ia = a.to_int();
     auto ib = b.to_int();
     result.set(ia->mod(ib));
     ia->release();
     ib->release();
-    return true;
+    return;
   }
   auto na = a.to_number();
   auto nb = b.to_number();
   result.set(std::fmod(na, nb));
-  return true;
 }
 
 bool Remainder::declare(Module *module, Scope &scope, Error &error) {
@@ -1395,6 +1652,15 @@ void Remainder::resolve(Module *module, Context &ctx, int l, LegacyImports *impo
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto Remainder::reduce(Reducer &r) -> Reducer::Value* {
+  return r.rem(m_a->reduce(r), m_b->reduce(r));
+}
+
+void Remainder::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::REM, r, m_a.get(), m_b.get());
+}
+
 void Remainder::dump(std::ostream &out, const std::string &indent) {
   out << indent << "remainder" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1701,6 +1967,16 @@ void LogicalNot::resolve(Module *module, Context &ctx, int l, LegacyImports *imp
   m_x->resolve(module, ctx, l, imports);
 }
 
+auto LogicalNot::reduce(Reducer &r) -> Reducer::Value* {
+  return r.bool_not(m_x->reduce(r));
+}
+
+void LogicalNot::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  m_x->compile(c, r);
+  c.emit(vm::Opcode::NOT, r, r);
+}
+
 void LogicalNot::dump(std::ostream &out, const std::string &indent) {
   out << indent << "logical not" << std::endl;
   m_x->dump(out, indent + "  ");
@@ -1728,6 +2004,23 @@ void LogicalAnd::resolve(Module *module, Context &ctx, int l, LegacyImports *imp
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto LogicalAnd::reduce(Reducer &r) -> Reducer::Value* {
+  return r.bool_and(m_a->reduce(r), m_b->reduce(r));
+}
+
+void LogicalAnd::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  Value a;
+  if (c.fold(m_a.get(), a)) {
+    if (a.to_boolean()) m_b->compile(c, r); else c.emit_const(r, a);
+    return;
+  }
+  m_a->compile(c, r);
+  auto j = c.emit_jump(vm::Opcode::JUMP_IF_FALSE, r);
+  m_b->compile(c, r);
+  c.patch(j);
+}
+
 void LogicalAnd::dump(std::ostream &out, const std::string &indent) {
   out << indent << "logical and" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1756,6 +2049,23 @@ void LogicalOr::resolve(Module *module, Context &ctx, int l, LegacyImports *impo
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto LogicalOr::reduce(Reducer &r) -> Reducer::Value* {
+  return r.bool_or(m_a->reduce(r), m_b->reduce(r));
+}
+
+void LogicalOr::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  Value a;
+  if (c.fold(m_a.get(), a)) {
+    if (a.to_boolean()) c.emit_const(r, a); else m_b->compile(c, r);
+    return;
+  }
+  m_a->compile(c, r);
+  auto j = c.emit_jump(vm::Opcode::JUMP_IF_TRUE, r);
+  m_b->compile(c, r);
+  c.patch(j);
+}
+
 void LogicalOr::dump(std::ostream &out, const std::string &indent) {
   out << indent << "logical or" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1784,6 +2094,23 @@ void NullishCoalescing::resolve(Module *module, Context &ctx, int l, LegacyImpor
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto NullishCoalescing::reduce(Reducer &r) -> Reducer::Value* {
+  return r.null_or(m_a->reduce(r), m_b->reduce(r));
+}
+
+void NullishCoalescing::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  Value a;
+  if (c.fold(m_a.get(), a)) {
+    if (a.is_null()) m_b->compile(c, r); else c.emit_const(r, a);
+    return;
+  }
+  m_a->compile(c, r);
+  auto j = c.emit_jump(vm::Opcode::JUMP_IF_VALUE, r);
+  m_b->compile(c, r);
+  c.patch(j);
+}
+
 void NullishCoalescing::dump(std::ostream &out, const std::string &indent) {
   out << indent << "nullish coalescing" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1798,16 +2125,20 @@ bool Equality::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void Equality::operate(const Value &a, const Value &b, Value &result) {
   if (a.is<Int>() || b.is<Int>()) {
     auto ia = a.to_int();
     auto ib = b.to_int();
     result.set(ia->eql(ib));
     ia->release();
     ib->release();
-    return true;
+    return;
   }
   result.set(Value::is_equal(a, b));
-  return true;
 }
 
 bool Equality::declare(Module *module, Scope &scope, Error &error) {
@@ -1821,6 +2152,15 @@ void Equality::resolve(Module *module, Context &ctx, int l, LegacyImports *impor
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto Equality::reduce(Reducer &r) -> Reducer::Value* {
+  return r.eql(m_a->reduce(r), m_b->reduce(r));
+}
+
+void Equality::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::EQL, r, m_a.get(), m_b.get());
+}
+
 void Equality::dump(std::ostream &out, const std::string &indent) {
   out << indent << "equality" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1835,16 +2175,20 @@ bool Inequality::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void Inequality::operate(const Value &a, const Value &b, Value &result) {
   if (a.is<Int>() || b.is<Int>()) {
     auto ia = a.to_int();
     auto ib = b.to_int();
     result.set(!ia->eql(ib));
     ia->release();
     ib->release();
-    return true;
+    return;
   }
   result.set(!Value::is_equal(a, b));
-  return true;
 }
 
 bool Inequality::declare(Module *module, Scope &scope, Error &error) {
@@ -1858,6 +2202,15 @@ void Inequality::resolve(Module *module, Context &ctx, int l, LegacyImports *imp
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto Inequality::reduce(Reducer &r) -> Reducer::Value* {
+  return r.neq(m_a->reduce(r), m_b->reduce(r));
+}
+
+void Inequality::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::NEQ, r, m_a.get(), m_b.get());
+}
+
 void Inequality::dump(std::ostream &out, const std::string &indent) {
   out << indent << "inequality" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1872,10 +2225,14 @@ bool Identity::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
-  result.set(Value::is_identical(a, b));
+  operate(a, b, result);
   return true;
 }
 
+void Identity::operate(const Value &a, const Value &b, Value &result) {
+  result.set(Value::is_identical(a, b));
+}
+
 bool Identity::declare(Module *module, Scope &scope, Error &error) {
   if (!m_a->declare(module, scope, error)) return false;
   if (!m_b->declare(module, scope, error)) return false;
@@ -1887,6 +2244,15 @@ void Identity::resolve(Module *module, Context &ctx, int l, LegacyImports *impor
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto Identity::reduce(Reducer &r) -> Reducer::Value* {
+  return r.same(m_a->reduce(r), m_b->reduce(r));
+}
+
+void Identity::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::SAME, r, m_a.get(), m_b.get());
+}
+
 void Identity::dump(std::ostream &out, const std::string &indent) {
   out << indent << "identity" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1901,10 +2267,14 @@ bool Nonidentity::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
-  result.set(!Value::is_identical(a, b));
+  operate(a, b, result);
   return true;
 }
 
+void Nonidentity::operate(const Value &a, const Value &b, Value &result) {
+  result.set(!Value::is_identical(a, b));
+}
+
 bool Nonidentity::declare(Module *module, Scope &scope, Error &error) {
   if (!m_a->declare(module, scope, error)) return false;
   if (!m_b->declare(module, scope, error)) return false;
@@ -1916,6 +2286,15 @@ void Nonidentity::resolve(Module *module, Context &ctx, int l, LegacyImports *im
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto Nonidentity::reduce(Reducer &r) -> Reducer::Value* {
+  return r.diff(m_a->reduce(r), m_b->reduce(r));
+}
+
+void Nonidentity::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::DIFF, r, m_a.get(), m_b.get());
+}
+
 void Nonidentity::dump(std::ostream &out, const std::string &indent) {
   out << indent << "nonidentity" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1930,6 +2309,11 @@ bool GreaterThan::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void GreaterThan::operate(const Value &a, const Value &b, Value &result) {
   if (a.is_undefined() || b.is_undefined()) {
     result.set(false);
   } else if (a.is_string() && b.is_string()) {
@@ -1945,7 +2329,6 @@ bool GreaterThan::eval(Context &ctx, Value &result) {
     auto nb = b.to_number();
     result.set(na > nb);
   }
-  return true;
 }
 
 bool GreaterThan::declare(Module *module, Scope &scope, Error &error) {
@@ -1959,6 +2342,15 @@ void GreaterThan::resolve(Module *module, Context &ctx, int l, LegacyImports *im
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto GreaterThan::reduce(Reducer &r) -> Reducer::Value* {
+  return r.gt(m_a->reduce(r), m_b->reduce(r));
+}
+
+void GreaterThan::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::GT, r, m_a.get(), m_b.get());
+}
+
 void GreaterThan::dump(std::ostream &out, const std::string &indent) {
   out << indent << "greater than" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -1973,6 +2365,11 @@ bool GreaterThanOrEqual::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void GreaterThanOrEqual::operate(const Value &a, const Value &b, Value &result) {
   if (a.is_undefined() || b.is_undefined()) {
     result.set(false);
   } else if (a.is_string() && b.is_string()) {
@@ -1988,7 +2385,6 @@ bool GreaterThanOrEqual::eval(Context &ctx, Value &result) {
     auto nb = b.to_number();
     result.set(na >= nb);
   }
-  return true;
 }
 
 bool GreaterThanOrEqual::declare(Module *module, Scope &scope, Error &error) {
@@ -2002,6 +2398,15 @@ void GreaterThanOrEqual::resolve(Module *module, Context &ctx, int l, LegacyImpo
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto GreaterThanOrEqual::reduce(Reducer &r) -> Reducer::Value* {
+  return r.ge(m_a->reduce(r), m_b->reduce(r));
+}
+
+void GreaterThanOrEqual::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::GE, r, m_a.get(), m_b.get());
+}
+
 void GreaterThanOrEqual::dump(std::ostream &out, const std::string &indent) {
   out << indent << "greater than or equal" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -2016,6 +2421,11 @@ bool LessThan::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void LessThan::operate(const Value &a, const Value &b, Value &result) {
   if (a.is_undefined() || b.is_undefined()) {
     result.set(false);
   } else if (a.is_string() && b.is_string()) {
@@ -2031,7 +2441,6 @@ bool LessThan::eval(Context &ctx, Value &result) {
     auto nb = b.to_number();
     result.set(na < nb);
   }
-  return true;
 }
 
 bool LessThan::declare(Module *module, Scope &scope, Error &error) {
@@ -2045,6 +2454,15 @@ void LessThan::resolve(Module *module, Context &ctx, int l, LegacyImports *impor
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto LessThan::reduce(Reducer &r) -> Reducer::Value* {
+  return r.lt(m_a->reduce(r), m_b->reduce(r));
+}
+
+void LessThan::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::LT, r, m_a.get(), m_b.get());
+}
+
 void LessThan::dump(std::ostream &out, const std::string &indent) {
   out << indent << "less than" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -2059,6 +2477,11 @@ bool LessThanOrEqual::eval(Context &ctx, Value &result) {
   Value a, b;
   if (!m_a->eval(ctx, a)) return false;
   if (!m_b->eval(ctx, b)) return false;
+  operate(a, b, result);
+  return true;
+}
+
+void LessThanOrEqual::operate(const Value &a, const Value &b, Value &result) {
   if (a.is_undefined() || b.is_undefined()) {
     result.set(false);
   } else if (a.is_string() && b.is_string()) {
@@ -2074,7 +2497,6 @@ bool LessThanOrEqual::eval(Context &ctx, Value &result) {
     auto nb = b.to_number();
     result.set(na <= nb);
   }
-  return true;
 }
 
 bool LessThanOrEqual::declare(Module *module, Scope &scope, Error &error) {
@@ -2088,6 +2510,15 @@ void LessThanOrEqual::resolve(Module *module, Context &ctx, int l, LegacyImports
   m_b->resolve(module, ctx, l, imports);
 }
 
+auto LessThanOrEqual::reduce(Reducer &r) -> Reducer::Value* {
+  return r.le(m_a->reduce(r), m_b->reduce(r));
+}
+
+void LessThanOrEqual::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  c.emit_binary(vm::Opcode::LE, r, m_a.get(), m_b.get());
+}
+
 void LessThanOrEqual::dump(std::ostream &out, const std::string &indent) {
   out << indent << "less than or equal" << std::endl;
   m_a->dump(out, indent + "  ");
@@ -2371,6 +2802,15 @@ bool Assignment::unpack(Context &ctx, Value &arg, int &var) {
   return m_l->unpack(ctx, arg, var);
 }
 
+void Assignment::compile(vm::Compiler &c, int r) {
+  auto pos = c.position();
+  m_r->compile(c, r);
+  if (!m_l->compile_assign(c, r)) {
+    c.rewind(pos);
+    c.emit_eval(this, r);
+  }
+}
+
 void Assignment::dump(std::ostream &out, const std::string &indent) {
   out << indent << "assignment" << std::endl;
   m_l->dump(out, indent + "  ");
@@ -2386,11 +2826,7 @@ bool AdditionAssignment::eval(Context &ctx, Value &result) {
   if (!m_l->eval(ctx, a)) return false;
   if (!m_r->eval(ctx, b)) return false;
   if (a.is_string() || b.is_string()) {
-    auto sa = a.to_string();
-    auto sb = b.to_string();
-    result.set(sa->str() + sb->str());
-    sa->release();
-    sb->release();
+    concat(a, b, result);
   } else if (a.is<Int>() || b.is<Int>()) {
     auto ia = a.to_int();
     auto ib = b.to_int();
@@ -2942,6 +3378,26 @@ void Conditional::resolve(Module *module, Context &ctx, int l, LegacyImports *im
   m_c->resolve(module, ctx, l, imports);
 }
 
+auto Conditional::reduce(Reducer &r) -> Reducer::Value* {
+  return r.select(m_a->reduce(r), m_b->reduce(r), m_c->reduce(r));
+}
+
+void Conditional::compile(vm::Compiler &c, int r) {
+  if (c.emit_folded(this, r)) return;
+  Value a;
+  if (c.fold(m_a.get(), a)) {
+    (a.to_boolean() ? m_b : m_c)->compile(c, r);
+    return;
+  }
+  m_a->compile(c, r);
+  auto j1 = c.emit_jump(vm::Opcode::JUMP_IF_FALSE, r);
+  m_b->compile(c, r);
+  auto j2 = c.emit_jump(vm::Opcode::JUMP);
+  c.patch(j1);
+  m_c->compile(c, r);
+  c.patch(j2);
+}
+
 void Conditional::dump(std::ostream &out, const std::string &indent) {
   out << indent << "conditional" << std::endl;
   m_a->dump(out, indent + "  ");
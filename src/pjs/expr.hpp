@@ -29,6 +29,7 @@
 #include "types.hpp"
 #include "tree.hpp"
 #include "builtin.hpp"
+#include "vm.hpp"
 
 #include <cmath>
 #include <string>
@@ -163,6 +164,8 @@ public:
   virtual bool clear(Context &ctx, Value &result) { return error(ctx, "cannot delete a value"); }
   virtual auto reduce(Reducer &r) -> Reducer::Value* { return r.undefined(); }
   virtual auto reduce_lval(Reducer &r, Reducer::Value *rval) -> Reducer::Value* { return r.undefined(); }
+  virtual void compile(vm::Compiler &c, int r);
+  virtual bool compile_assign(vm::Compiler &c, int r) { return false; }
   virtual void dump(std::ostream &out, const std::string &indent = "") = 0;
 
 protected:
@@ -222,6 +225,7 @@ public:
   virtual auto reduce(Reducer &r) -> Reducer::Value* override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -245,6 +249,7 @@ public:
 
 private:
   std::list<std::unique_ptr<Expr>> m_exprs;
+  size_t m_size_hint = 0;
 };
 
 //
@@ -255,6 +260,7 @@ class Undefined : public Expr {
 public:
   virtual bool eval(Context &ctx, Value &result) override;
   virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 };
 
@@ -266,6 +272,7 @@ class Null : public Expr {
 public:
   virtual bool eval(Context &ctx, Value &result) override;
   virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 };
 
@@ -279,6 +286,7 @@ public:
 
   virtual bool eval(Context &ctx, Value &result) override;
   virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -295,6 +303,7 @@ public:
 
   virtual bool eval(Context &ctx, Value &result) override;
   virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -313,6 +322,7 @@ public:
 
   virtual bool eval(Context &ctx, Value &result) override;
   virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -397,6 +407,9 @@ public:
   FunctionLiteral(Expr *inputs, Expr *output);
   FunctionLiteral(Expr *inputs, Stmt *output);
 
+  // Calls the function without making a Function object for it
+  void call(Context &ctx, int argc, Value argv[], Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
@@ -406,8 +419,11 @@ public:
 private:
   std::vector<std::unique_ptr<Expr>> m_inputs;
   std::unique_ptr<Stmt> m_output;
+  std::unique_ptr<vm::Code> m_code;
   Scope m_scope;
   Ref<Method> m_method;
+  Module* m_module = nullptr;
+  bool m_compiled = false;
 };
 
 //
@@ -475,6 +491,7 @@ class LegacyLocal : public Expr {
 public:
   LegacyLocal(const std::string &key) : m_key(Str::make(key)) {}
   LegacyLocal(int l, Str *key) : m_l(l), m_key(key) {}
+  LegacyLocal(int l, Str *key, Object *obj);
 
   virtual bool is_left_value() const override;
   virtual bool eval(Context &ctx, Value &result) override;
@@ -486,6 +503,16 @@ private:
   int m_l = -1;
   Ref<Str> m_key;
   PropertyCache m_cache;
+
+  //
+  // Context variables declared by pipy() are fields of the context data
+  // class, so the slot found at resolve time is read and written directly
+  // for as long as the context data is of that same class.
+  //
+
+  Ref<Class> m_class;
+  int m_slot = -1;
+  bool m_writable = false;
 };
 
 //
@@ -500,6 +527,8 @@ public:
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool assign(Context &ctx, Value &value) override;
   virtual bool clear(Context &ctx, Value &result) override;
+  virtual void compile(vm::Compiler &c, int r) override;
+  virtual bool compile_assign(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -546,6 +575,8 @@ public:
   virtual bool clear(Context &ctx, Value &result) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
   virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
+  virtual bool compile_assign(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -571,6 +602,9 @@ class Property : public Expr {
 public:
   Property(Expr *obj, Expr *key) : m_obj(obj), m_key(key) {}
 
+  static void get(const Value &obj, const Value &key, PropertyCache &cache, Value &result);
+  static void set(const Value &obj, const Value &key, PropertyCache &cache, const Value &value);
+
   virtual bool is_left_value() const override;
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool assign(Context &ctx, Value &value) override;
@@ -578,6 +612,8 @@ public:
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
   virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
+  virtual bool compile_assign(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -632,16 +668,20 @@ class Invocation : public Expr {
 public:
   Invocation(Expr *func, std::vector<std::unique_ptr<Expr>> &&argv) : m_func(func), m_argv(std::move(argv)) {}
 
+  auto literal() const -> FunctionLiteral* { return m_literal; }
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
   virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
   Module* m_module = nullptr;
   std::unique_ptr<Expr> m_func;
   std::vector<std::unique_ptr<Expr>> m_argv;
+  FunctionLiteral* m_literal = nullptr;
 };
 
 //
@@ -673,6 +713,8 @@ public:
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -690,6 +732,8 @@ public:
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -704,9 +748,13 @@ class Addition : public Expr {
 public:
   Addition(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -722,9 +770,13 @@ class Subtraction : public Expr {
 public:
   Subtraction(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -740,9 +792,13 @@ class Multiplication : public Expr {
 public:
   Multiplication(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -758,9 +814,13 @@ class Division : public Expr {
 public:
   Division(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -776,9 +836,13 @@ class Remainder : public Expr {
 public:
   Remainder(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -940,6 +1004,8 @@ public:
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -957,6 +1023,8 @@ public:
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -975,6 +1043,8 @@ public:
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -993,6 +1063,8 @@ public:
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -1008,9 +1080,13 @@ class Equality : public Expr {
 public:
   Equality(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -1026,9 +1102,13 @@ class Inequality : public Expr {
 public:
   Inequality(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -1044,9 +1124,13 @@ class Identity : public Expr {
 public:
   Identity(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -1062,9 +1146,13 @@ class Nonidentity : public Expr {
 public:
   Nonidentity(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -1080,9 +1168,13 @@ class GreaterThan : public Expr {
 public:
   GreaterThan(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -1098,9 +1190,13 @@ class GreaterThanOrEqual : public Expr {
 public:
   GreaterThanOrEqual(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -1116,9 +1212,13 @@ class LessThan : public Expr {
 public:
   LessThan(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -1134,9 +1234,13 @@ class LessThanOrEqual : public Expr {
 public:
   LessThanOrEqual(Expr *a, Expr *b) : m_a(a), m_b(b) {}
 
+  static void operate(const Value &a, const Value &b, Value &result);
+
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -1308,6 +1412,7 @@ public:
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
   virtual bool unpack(Context &ctx, Value &arg, int &var) override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
@@ -1598,6 +1703,8 @@ public:
   virtual bool eval(Context &ctx, Value &result) override;
   virtual bool declare(Module *module, Scope &scope, Error &error) override;
   virtual void resolve(Module *module, Context &ctx, int l, LegacyImports *imports) override;
+  virtual auto reduce(Reducer &r) -> Reducer::Value* override;
+  virtual void compile(vm::Compiler &c, int r) override;
   virtual void dump(std::ostream &out, const std::string &indent) override;
 
 private:
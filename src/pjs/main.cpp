@@ -25,7 +25,15 @@
 
 #include "pjs.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using namespace pjs;
 
@@ -38,6 +46,7 @@ class Console;
 class TestGlobal : public ObjectTemplate<TestGlobal, Global> {};
 
 template<> void ClassDef<TestGlobal>::init() {
+  super<Global>();
   ctor();
   variable("console", class_of<Console>());
 }
@@ -133,14 +142,190 @@ static void test_eval(Context &ctx, const char *script) {
   std::cout << "Result: " << result.to_string()->str() << std::endl;
 }
 
+//
+// Benchmarks
+//
+// Every script evaluates to a function, which is called repeatedly with
+// a growing iteration count until one run takes at least --min-time
+// seconds. Allocations per iteration are counted from all object pools
+// of the thread, so that changes to the interpreter that create fewer
+// temporary objects show up even when timing is noisy.
+//
+//   pjs --bench [--min-time=<seconds>] [--json] <script.js> ...
+//
+
+struct BenchResult {
+  std::string name;
+  uint64_t iterations;
+  double time; // ns per iteration
+  double allocs; // pooled allocations per iteration
+  std::vector<std::pair<std::string, double>> top_pools;
+};
+
+static auto total_allocs(std::map<std::string, uint64_t> &counts) -> uint64_t {
+  uint64_t total = 0;
+  for (const auto &p : Pool::all()) {
+    auto n = p.second->alloc_count();
+    counts[p.first] = n;
+    total += n;
+  }
+  return total;
+}
+
+static bool bench_script(Context &ctx, const std::string &filename, double min_time, BenchResult &result) {
+  std::ifstream fs(filename, std::ios::in);
+  if (!fs.is_open()) {
+    std::cerr << "Cannot open file: " << filename << std::endl;
+    return false;
+  }
+  std::stringstream ss;
+  ss << fs.rdbuf();
+
+  std::string error;
+  int error_line, error_column;
+  Module module(ctx.instance());
+  module.load(filename, ss.str());
+  if (!module.compile(error, error_line, error_column)) {
+    std::cerr << filename << ": syntax error at line " << error_line << " column " << error_column << ": " << error << std::endl;
+    return false;
+  }
+
+  Value f;
+  module.execute(ctx, -1, nullptr, f);
+  if (!ctx.ok()) {
+    std::cerr << filename << ": " << ctx.error().message << std::endl;
+    return false;
+  }
+  if (!f.is_function()) {
+    std::cerr << filename << ": script does not evaluate to a function" << std::endl;
+    return false;
+  }
+
+  auto run = [&](uint64_t n) -> double {
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < n; i++) {
+      Value ret;
+      (*f.f())(ctx, 0, nullptr, ret);
+      if (!ctx.ok()) return -1;
+      Promise::Period::current()->run(100);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(t1 - t0).count();
+  };
+
+  if (run(10) < 0) {
+    std::cerr << filename << ": " << ctx.error().message << std::endl;
+    return false;
+  }
+
+  uint64_t n = 1;
+  for (;;) {
+    std::map<std::string, uint64_t> before, after;
+    auto a0 = total_allocs(before);
+    auto t = run(n);
+    auto a1 = total_allocs(after);
+    if (t < 0) {
+      std::cerr << filename << ": " << ctx.error().message << std::endl;
+      return false;
+    }
+    if (t >= min_time || n >= 1000000000) {
+      auto p = filename.find_last_of("/\\");
+      result.name = (p == std::string::npos ? filename : filename.substr(p + 1));
+      result.iterations = n;
+      result.time = t * 1e9 / n;
+      result.allocs = double(a1 - a0) / n;
+      for (const auto &i : after) {
+        auto d = i.second - before[i.first];
+        if (d > 0) result.top_pools.push_back({ i.first, double(d) / n });
+      }
+      std::sort(
+        result.top_pools.begin(), result.top_pools.end(),
+        [](const std::pair<std::string, double> &a, const std::pair<std::string, double> &b) {
+          return a.second > b.second;
+        }
+      );
+      if (result.top_pools.size() > 5) result.top_pools.resize(5);
+      return true;
+    }
+    auto scale = t > 0 ? min_time * 1.4 / t : 10;
+    n = uint64_t(n * std::min(std::max(scale, 1.1), 10.0)) + 1;
+  }
+}
+
+static int bench(Context &ctx, int argc, char *argv[]) {
+  double min_time = 0.5;
+  bool json = false;
+  std::vector<std::string> files;
+
+  for (int i = 0; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--json") {
+      json = true;
+    } else if (arg.compare(0, 11, "--min-time=") == 0) {
+      min_time = std::atof(arg.c_str() + 11);
+    } else if (arg.compare(0, 2, "--") == 0) {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return 1;
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  if (files.empty()) {
+    std::cerr << "Usage: pjs --bench [--min-time=<seconds>] [--json] <script.js> ..." << std::endl;
+    return 1;
+  }
+
+  std::vector<BenchResult> results;
+  for (const auto &filename : files) {
+    BenchResult r;
+    if (!bench_script(ctx, filename, min_time, r)) return 1;
+    results.push_back(r);
+  }
+
+  if (json) {
+    std::printf("{\n  \"benchmarks\": [");
+    for (size_t i = 0; i < results.size(); i++) {
+      const auto &r = results[i];
+      std::printf(i > 0 ? ",\n" : "\n");
+      std::printf("    {\n");
+      std::printf("      \"name\": \"%s\",\n", r.name.c_str());
+      std::printf("      \"run_type\": \"iteration\",\n");
+      std::printf("      \"iterations\": %llu,\n", (unsigned long long)r.iterations);
+      std::printf("      \"real_time\": %.3f,\n", r.time);
+      std::printf("      \"time_unit\": \"ns\",\n");
+      std::printf("      \"allocs_per_iteration\": %.3f\n", r.allocs);
+      std::printf("    }");
+    }
+    std::printf("\n  ]\n}\n");
+  } else {
+    std::printf("%-24s %14s %12s %14s\n", "Script", "Time (ns)", "Iterations", "Allocs/iter");
+    std::printf("%s\n", std::string(67, '-').c_str());
+    for (const auto &r : results) {
+      std::printf("%-24s %14.1f %12llu %14.1f\n", r.name.c_str(), r.time, (unsigned long long)r.iterations, r.allocs);
+      for (const auto &p : r.top_pools) {
+        std::printf("    %-48s %14.1f\n", p.first.c_str(), p.second);
+      }
+    }
+  }
+
+  return 0;
+}
+
 //
 // main
 //
 
-int main() {
+int main(int argc, char *argv[]) {
   Instance instance(TestGlobal::make());
   Context ctx(&instance);
 
+  if (argc > 1 && !std::strcmp(argv[1], "--bench")) {
+    // Promise::then() keeps a reference to the context
+    Ref<Context> root = new Context(&instance);
+    return bench(*root, argc - 2, argv + 2);
+  }
+
   test_tokenizer("undefined/null/true/false void new delete deleted intypeof in typeof instanceoff.instanceof ");
   test_tokenizer("(0+1)-[2]*{3}/4%5**6&7|8^9~a!b?c:d&&你||好??世界");
   test_tokenizer("+++++-----*****======>>>>>!!000\"\"??.....26?.()?.[]xyz");
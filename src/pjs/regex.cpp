@@ -0,0 +1,627 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "regex.hpp"
+
+namespace pjs {
+
+static const size_t MAX_PROGRAM_SIZE = 5000;
+static const int MAX_REPEAT = 1000;
+
+static bool is_word_char(int c) {
+  return (
+    ('a' <= c && c <= 'z') ||
+    ('A' <= c && c <= 'Z') ||
+    ('0' <= c && c <= '9') ||
+    (c == '_')
+  );
+}
+
+static int hex_value(char c) {
+  if ('0' <= c && c <= '9') return c - '0';
+  if ('a' <= c && c <= 'f') return c - 'a' + 10;
+  if ('A' <= c && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+//
+// Regex::Parser
+//
+
+class Regex::Parser {
+public:
+  Parser(Regex *re, const std::string &pattern, bool icase)
+    : m_re(re)
+    , m_str(pattern)
+    , m_icase(icase) {}
+
+  bool parse() {
+    std::unique_ptr<Node> root(parse_alternation());
+    if (!root || m_ptr < m_str.length()) return false;
+    emit(SAVE, 0);
+    if (!compile(root.get())) return false;
+    emit(SAVE, 1);
+    emit(MATCH);
+    return m_re->m_program.size() <= MAX_PROGRAM_SIZE;
+  }
+
+private:
+  struct Node {
+    enum Type {
+      EMPTY,
+      CHAR,
+      CLASS,
+      GROUP,
+      CONCAT,
+      ALTERNATION,
+      REPEAT,
+      BOL,
+      EOL,
+      WORD_BOUNDARY,
+      NOT_WORD_BOUNDARY,
+    };
+
+    Type type;
+    int value = 0;
+    int min = 0, max = 0;
+    bool greedy = true;
+    std::vector<std::unique_ptr<Node>> children;
+
+    Node(Type t, int v = 0) : type(t), value(v) {}
+  };
+
+  Regex* m_re;
+  const std::string &m_str;
+  size_t m_ptr = 0;
+  bool m_icase;
+
+  bool eof() const { return m_ptr >= m_str.length(); }
+  char peek() const { return m_str[m_ptr]; }
+  bool peek(char c) const { return !eof() && m_str[m_ptr] == c; }
+
+  bool parse_hex(int digits, int &value) {
+    if (m_ptr + digits > m_str.length()) return false;
+    value = 0;
+    for (int i = 0; i < digits; i++) {
+      auto h = hex_value(m_str[m_ptr + i]);
+      if (h < 0) return false;
+      value = (value << 4) | h;
+    }
+    m_ptr += digits;
+    return true;
+  }
+
+  bool parse_int(int &value) {
+    auto start = m_ptr;
+    value = 0;
+    while (!eof() && '0' <= peek() && peek() <= '9') {
+      value = value * 10 + (peek() - '0');
+      if (value > MAX_REPEAT) return false;
+      m_ptr++;
+    }
+    return m_ptr > start;
+  }
+
+  // Parses {n}, {n,} or {n,m} after the opening brace
+  bool parse_braces(int &min, int &max) {
+    auto start = m_ptr;
+    if (parse_int(min)) {
+      if (peek('}')) {
+        m_ptr++;
+        max = min;
+        return true;
+      }
+      if (peek(',')) {
+        m_ptr++;
+        if (peek('}')) {
+          m_ptr++;
+          max = -1;
+          return true;
+        }
+        if (parse_int(max) && peek('}') && max >= min) {
+          m_ptr++;
+          return true;
+        }
+      }
+    }
+    m_ptr = start;
+    return false;
+  }
+
+  auto parse_alternation() -> Node* {
+    std::unique_ptr<Node> alt(new Node(Node::ALTERNATION));
+    for (;;) {
+      auto n = parse_concat();
+      if (!n) return nullptr;
+      alt->children.emplace_back(n);
+      if (!peek('|')) break;
+      m_ptr++;
+    }
+    if (alt->children.size() == 1) return alt->children[0].release();
+    return alt.release();
+  }
+
+  auto parse_concat() -> Node* {
+    std::unique_ptr<Node> cat(new Node(Node::CONCAT));
+    while (!eof() && peek() != '|' && peek() != ')') {
+      auto n = parse_repeat();
+      if (!n) return nullptr;
+      cat->children.emplace_back(n);
+    }
+    return cat.release();
+  }
+
+  auto parse_repeat() -> Node* {
+    std::unique_ptr<Node> atom(parse_atom());
+    if (!atom || eof()) return atom.release();
+
+    int min, max;
+    switch (peek()) {
+      case '*': m_ptr++; min = 0; max = -1; break;
+      case '+': m_ptr++; min = 1; max = -1; break;
+      case '?': m_ptr++; min = 0; max = 1; break;
+      case '{': {
+        m_ptr++;
+        if (!parse_braces(min, max)) {
+          m_ptr--;
+          return atom.release();
+        }
+        break;
+      }
+      default: return atom.release();
+    }
+
+    switch (atom->type) {
+      case Node::BOL:
+      case Node::EOL:
+      case Node::WORD_BOUNDARY:
+      case Node::NOT_WORD_BOUNDARY:
+        return nullptr;
+      default: break;
+    }
+
+    std::unique_ptr<Node> rep(new Node(Node::REPEAT));
+    rep->min = min;
+    rep->max = max;
+    if (peek('?')) {
+      m_ptr++;
+      rep->greedy = false;
+    }
+    rep->children.emplace_back(atom.release());
+
+    // Double quantifiers like 'a**' are syntax errors
+    if (!eof()) {
+      auto c = peek();
+      if (c == '*' || c == '+' || c == '?') return nullptr;
+      if (c == '{') {
+        m_ptr++;
+        int a, b;
+        if (parse_braces(a, b)) return nullptr;
+        m_ptr--;
+      }
+    }
+
+    return rep.release();
+  }
+
+  auto parse_atom() -> Node* {
+    auto c = m_str[m_ptr++];
+    switch (c) {
+      case '^': return new Node(Node::BOL);
+      case '$': return new Node(Node::EOL);
+      case '.': {
+        CharClass cc = {};
+        for (int i = 0; i < 256; i++) if (i != '\n' && i != '\r') add_char(cc, i);
+        return make_class(cc);
+      }
+      case '(': {
+        int index = -1;
+        if (peek('?')) {
+          m_ptr++;
+          if (peek(':')) {
+            m_ptr++;
+          } else if (peek('<') && m_ptr + 1 < m_str.length() && m_str[m_ptr+1] != '=' && m_str[m_ptr+1] != '!') {
+            auto end = m_str.find('>', m_ptr);
+            if (end == std::string::npos || end == m_ptr + 1) return nullptr;
+            m_ptr = end + 1;
+            index = m_re->m_group_count++;
+          } else {
+            return nullptr; // lookarounds
+          }
+        } else {
+          index = m_re->m_group_count++;
+        }
+        std::unique_ptr<Node> body(parse_alternation());
+        if (!body || !peek(')')) return nullptr;
+        m_ptr++;
+        if (index < 0) return body.release();
+        auto group = new Node(Node::GROUP, index);
+        group->children.emplace_back(body.release());
+        return group;
+      }
+      case '[': return parse_class();
+      case '\\': return parse_escape();
+      case ')': case '*': case '+': case '?': return nullptr;
+      case '{': {
+        int a, b;
+        if (parse_braces(a, b)) return nullptr;
+        return make_char(c);
+      }
+      default: return make_char(c);
+    }
+  }
+
+  auto parse_escape() -> Node* {
+    if (eof()) return nullptr;
+    auto c = m_str[m_ptr++];
+    CharClass cc = {};
+    switch (c) {
+      case 'b': return new Node(Node::WORD_BOUNDARY);
+      case 'B': return new Node(Node::NOT_WORD_BOUNDARY);
+      case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+        add_class_escape(cc, c);
+        return make_class(cc);
+      case 'u': {
+        int code;
+        if (!parse_hex(4, code)) return nullptr;
+        if (code < 0x80) return make_char(code);
+        char buf[4];
+        int n = 0;
+        if (code < 0x800) {
+          buf[n++] = 0xc0 | (code >> 6);
+        } else {
+          buf[n++] = 0xe0 | (code >> 12);
+          buf[n++] = 0x80 | ((code >> 6) & 0x3f);
+        }
+        buf[n++] = 0x80 | (code & 0x3f);
+        auto cat = new Node(Node::CONCAT);
+        for (int i = 0; i < n; i++) cat->children.emplace_back(new Node(Node::CHAR, (unsigned char)buf[i]));
+        return cat;
+      }
+      default: {
+        int ch = parse_char_escape(c);
+        if (ch < 0) return nullptr;
+        return make_char(ch);
+      }
+    }
+  }
+
+  // Escapes valid both in and out of classes, with the backslash and 'c' consumed
+  int parse_char_escape(char c) {
+    switch (c) {
+      case 't': return '\t';
+      case 'n': return '\n';
+      case 'r': return '\r';
+      case 'f': return '\f';
+      case 'v': return '\v';
+      case '0':
+        if (!eof() && '0' <= peek() && peek() <= '9') return -1;
+        return 0;
+      case 'x': {
+        int code;
+        if (!parse_hex(2, code)) return -1;
+        return code;
+      }
+      case 'c': {
+        if (eof()) return -1;
+        auto l = peek();
+        if (!(('a' <= l && l <= 'z') || ('A' <= l && l <= 'Z'))) return -1;
+        m_ptr++;
+        return l & 31;
+      }
+      default:
+        // Backreferences and anything else that could mean more than a literal
+        if (is_word_char(c)) return -1;
+        return (unsigned char)c;
+    }
+  }
+
+  // Parses one class member, returning -1 for a character set such as \d
+  bool parse_class_atom(CharClass &cc, int &ch) {
+    if (eof()) return false;
+    auto c = m_str[m_ptr++];
+    if (c != '\\') {
+      ch = (unsigned char)c;
+      return true;
+    }
+    if (eof()) return false;
+    c = m_str[m_ptr++];
+    switch (c) {
+      case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+        add_class_escape(cc, c);
+        ch = -1;
+        return true;
+      case 'b': ch = '\b'; return true;
+      case '-': ch = '-'; return true;
+      case 'u': {
+        int code;
+        if (!parse_hex(4, code) || code >= 0x80) return false;
+        ch = code;
+        return true;
+      }
+      default:
+        ch = parse_char_escape(c);
+        return ch >= 0;
+    }
+  }
+
+  auto parse_class() -> Node* {
+    CharClass cc = {};
+    bool negated = false;
+    if (peek('^')) {
+      m_ptr++;
+      negated = true;
+    }
+    while (!peek(']')) {
+      if (eof()) return nullptr;
+      int lo, hi;
+      if (!parse_class_atom(cc, lo)) return nullptr;
+      if (lo >= 0 && peek('-') && m_ptr + 1 < m_str.length() && m_str[m_ptr+1] != ']') {
+        m_ptr++;
+        if (!parse_class_atom(cc, hi) || hi < 0 || hi < lo) return nullptr;
+        for (int i = lo; i <= hi; i++) add_char(cc, i);
+      } else if (lo >= 0) {
+        add_char(cc, lo);
+      }
+    }
+    m_ptr++;
+    if (negated) for (auto &b : cc.bits) b = ~b;
+    return make_class(cc);
+  }
+
+  void add_char(CharClass &cc, int c) {
+    cc.bits[c >> 6] |= uint64_t(1) << (c & 63);
+    if (m_icase) {
+      if ('a' <= c && c <= 'z') add_char_exact(cc, c - 'a' + 'A');
+      else if ('A' <= c && c <= 'Z') add_char_exact(cc, c - 'A' + 'a');
+    }
+  }
+
+  void add_char_exact(CharClass &cc, int c) {
+    cc.bits[c >> 6] |= uint64_t(1) << (c & 63);
+  }
+
+  void add_class_escape(CharClass &cc, char c) {
+    CharClass set = {};
+    switch (c) {
+      case 'd': case 'D':
+        for (int i = '0'; i <= '9'; i++) add_char_exact(set, i);
+        break;
+      case 'w': case 'W':
+        for (int i = 0; i < 128; i++) if (is_word_char(i)) add_char_exact(set, i);
+        break;
+      case 's': case 'S':
+        for (auto i : { ' ', '\t', '\n', '\v', '\f', '\r' }) add_char_exact(set, i);
+        break;
+    }
+    bool negated = ('A' <= c && c <= 'Z');
+    for (int i = 0; i < 4; i++) cc.bits[i] |= (negated ? ~set.bits[i] : set.bits[i]);
+  }
+
+  auto make_char(int c) -> Node* {
+    if (m_icase && (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z'))) {
+      CharClass cc = {};
+      add_char(cc, c);
+      return make_class(cc);
+    }
+    return new Node(Node::CHAR, (unsigned char)c);
+  }
+
+  auto make_class(const CharClass &cc) -> Node* {
+    auto &classes = m_re->m_classes;
+    classes.push_back(cc);
+    return new Node(Node::CLASS, classes.size() - 1);
+  }
+
+  auto emit(Op op, int x = 0, int y = 0) -> int {
+    auto &prog = m_re->m_program;
+    prog.push_back({ op, x, y });
+    return prog.size() - 1;
+  }
+
+  auto pc() const -> int {
+    return m_re->m_program.size();
+  }
+
+  void patch(int i, int x, int y) {
+    auto &inst = m_re->m_program[i];
+    inst.x = x;
+    inst.y = y;
+  }
+
+  bool compile(Node *node) {
+    if (m_re->m_program.size() > MAX_PROGRAM_SIZE) return false;
+    switch (node->type) {
+      case Node::EMPTY: break;
+      case Node::CHAR: emit(Regex::CHAR, node->value); break;
+      case Node::CLASS: emit(Regex::CLASS, node->value); break;
+      case Node::BOL: emit(Regex::BOL); break;
+      case Node::EOL: emit(Regex::EOL); break;
+      case Node::WORD_BOUNDARY: emit(Regex::WORD_BOUNDARY); break;
+      case Node::NOT_WORD_BOUNDARY: emit(Regex::NOT_WORD_BOUNDARY); break;
+      case Node::GROUP:
+        emit(SAVE, node->value * 2);
+        if (!compile(node->children[0].get())) return false;
+        emit(SAVE, node->value * 2 + 1);
+        break;
+      case Node::CONCAT:
+        for (auto &n : node->children) {
+          if (!compile(n.get())) return false;
+        }
+        break;
+      case Node::ALTERNATION: {
+        std::vector<int> jumps;
+        auto n = node->children.size();
+        for (size_t i = 0; i < n; i++) {
+          if (i + 1 < n) {
+            auto split = emit(SPLIT);
+            if (!compile(node->children[i].get())) return false;
+            jumps.push_back(emit(JMP));
+            patch(split, split + 1, pc());
+          } else {
+            if (!compile(node->children[i].get())) return false;
+          }
+        }
+        for (auto j : jumps) patch(j, pc(), 0);
+        break;
+      }
+      case Node::REPEAT: {
+        auto body = node->children[0].get();
+        for (int i = 0; i < node->min; i++) {
+          if (!compile(body)) return false;
+        }
+        if (node->max < 0) {
+          auto split = emit(SPLIT);
+          if (!compile(body)) return false;
+          emit(JMP, split);
+          if (node->greedy) {
+            patch(split, split + 1, pc());
+          } else {
+            patch(split, pc(), split + 1);
+          }
+        } else {
+          std::vector<int> splits;
+          for (int i = node->min; i < node->max; i++) {
+            splits.push_back(emit(SPLIT));
+            if (!compile(body)) return false;
+          }
+          auto out = pc();
+          for (auto s : splits) {
+            if (node->greedy) {
+              patch(s, s + 1, out);
+            } else {
+              patch(s, out, s + 1);
+            }
+          }
+        }
+        break;
+      }
+    }
+    return true;
+  }
+};
+
+auto Regex::compile(const std::string &pattern, bool icase) -> std::shared_ptr<Regex> {
+  std::shared_ptr<Regex> re(new Regex);
+  Parser parser(re.get(), pattern, icase);
+  if (!parser.parse()) return nullptr;
+  return re;
+}
+
+//
+// Regex::Matcher
+//
+
+Regex::Matcher::Matcher(const Regex *re, std::vector<int> &groups)
+  : m_re(re)
+  , m_groups(groups)
+  , m_visited(re->m_program.size(), 0)
+  , m_caps(re->m_group_count * 2, -1)
+{
+  m_groups.assign(m_caps.size(), -1);
+}
+
+bool Regex::Matcher::step(int pos, int prev, int c) {
+  m_pos = pos;
+  m_prev = prev;
+  m_char = c;
+  m_generation++;
+  m_current.clear();
+  m_cut = false;
+
+  auto n = m_caps.size();
+  for (const auto &t : m_pending.threads) {
+    if (m_cut) break;
+    std::copy(m_pending.caps.begin() + t.caps, m_pending.caps.begin() + t.caps + n, m_caps.begin());
+    add(t.pc);
+  }
+
+  if (!m_matched && !m_cut) {
+    std::fill(m_caps.begin(), m_caps.end(), -1);
+    add(0);
+  }
+
+  m_pending.clear();
+  if (c < 0) return false;
+
+  const auto &prog = m_re->m_program;
+  for (const auto &t : m_current.threads) {
+    const auto &i = prog[t.pc];
+    if (i.op == CHAR ? i.x == c : m_re->m_classes[i.x].has(c)) {
+      m_pending.threads.push_back({ t.pc + 1, int(m_pending.caps.size()) });
+      m_pending.caps.insert(m_pending.caps.end(), m_current.caps.begin() + t.caps, m_current.caps.begin() + t.caps + n);
+    }
+  }
+
+  return !(m_matched && m_pending.threads.empty());
+}
+
+void Regex::Matcher::add(int pc) {
+  if (m_cut) return;
+  if (m_visited[pc] == m_generation) return;
+  m_visited[pc] = m_generation;
+
+  const auto &i = m_re->m_program[pc];
+  switch (i.op) {
+    case JMP:
+      add(i.x);
+      break;
+    case SPLIT:
+      add(i.x);
+      add(i.y);
+      break;
+    case SAVE: {
+      auto old = m_caps[i.x];
+      m_caps[i.x] = m_pos;
+      add(pc + 1);
+      m_caps[i.x] = old;
+      break;
+    }
+    case BOL:
+      if (m_prev < 0) add(pc + 1);
+      break;
+    case EOL:
+      if (m_char < 0) add(pc + 1);
+      break;
+    case WORD_BOUNDARY:
+      if (is_word_char(m_prev) != is_word_char(m_char)) add(pc + 1);
+      break;
+    case NOT_WORD_BOUNDARY:
+      if (is_word_char(m_prev) == is_word_char(m_char)) add(pc + 1);
+      break;
+    case MATCH:
+      m_matched = true;
+      m_groups = m_caps;
+      m_cut = true;
+      break;
+    case CHAR:
+    case CLASS:
+      m_current.threads.push_back({ pc, int(m_current.caps.size()) });
+      m_current.caps.insert(m_current.caps.end(), m_caps.begin(), m_caps.end());
+      break;
+  }
+}
+
+} // namespace pjs
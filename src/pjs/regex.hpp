@@ -0,0 +1,150 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PJS_REGEX_HPP
+#define PJS_REGEX_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pjs {
+
+//
+// Regex
+//
+// A backtracking-free regular expression engine. Patterns are compiled
+// into a Thompson NFA and matched by a Pike VM, which takes time linear
+// in the length of the input no matter what the pattern looks like.
+// Matching is done over bytes with ECMAScript leftmost-first semantics.
+// Features that cannot be matched in linear time, such as backreferences
+// and lookarounds, make compile() return nullptr so that the caller can
+// fall back to std::regex.
+//
+
+class Regex {
+public:
+  static auto compile(const std::string &pattern, bool icase) -> std::shared_ptr<Regex>;
+
+  // Number of groups including the whole match
+  auto group_count() const -> int { return m_group_count; }
+
+  //
+  // Searches for the leftmost match starting no earlier than 'start'.
+  // Offsets of all groups relative to 'begin' are stored in 'groups'
+  // in pairs, with -1 for groups that did not participate.
+  //
+
+  template<class Iterator>
+  bool search(Iterator begin, Iterator end, int start, std::vector<int> &groups) const {
+    Matcher m(this, groups);
+    auto i = begin;
+    int prev = -1, pos = 0;
+    while (pos < start && i != end) { prev = (unsigned char)*i; ++i; ++pos; }
+    for (;;) {
+      int c = (i == end ? -1 : (unsigned char)*i);
+      if (!m.step(pos, prev, c)) break;
+      prev = c; ++i; ++pos;
+    }
+    return m.matched();
+  }
+
+private:
+  enum Op {
+    CHAR,
+    CLASS,
+    SPLIT,
+    JMP,
+    SAVE,
+    BOL,
+    EOL,
+    WORD_BOUNDARY,
+    NOT_WORD_BOUNDARY,
+    MATCH,
+  };
+
+  struct Inst {
+    Op op;
+    int x, y;
+  };
+
+  struct CharClass {
+    uint64_t bits[4];
+    bool has(int c) const { return bits[c >> 6] & (uint64_t(1) << (c & 63)); }
+  };
+
+  std::vector<Inst> m_program;
+  std::vector<CharClass> m_classes;
+  int m_group_count = 1;
+
+  //
+  // Regex::Matcher
+  //
+
+  class Matcher {
+  public:
+    Matcher(const Regex *re, std::vector<int> &groups);
+
+    bool matched() const { return m_matched; }
+
+    // Returns false when no more input is needed
+    bool step(int pos, int prev, int c);
+
+  private:
+    struct Thread {
+      int pc;
+      int caps;
+    };
+
+    struct ThreadList {
+      std::vector<Thread> threads;
+      std::vector<int> caps;
+      void clear() { threads.clear(); caps.clear(); }
+    };
+
+    const Regex* m_re;
+    std::vector<int> &m_groups;
+    std::vector<int> m_visited;
+    std::vector<int> m_caps;
+    ThreadList m_pending;
+    ThreadList m_current;
+    int m_generation = 0;
+    int m_pos = 0;
+    int m_prev = -1;
+    int m_char = -1;
+    bool m_matched = false;
+    bool m_cut = false;
+
+    void add(int pc);
+  };
+
+  class Parser;
+  friend class Parser;
+};
+
+} // namespace pjs
+
+#endif // PJS_REGEX_HPP
@@ -48,6 +48,10 @@ void Stmt::execute(Context &ctx, Value &result) {
   result = res.value;
 }
 
+void Stmt::compile(vm::Compiler &c) {
+  c.emit_exec(this);
+}
+
 namespace stmt {
 
 thread_local static ConstStr s_default("default");
@@ -89,6 +93,10 @@ void Block::execute(Context &ctx, Result &result) {
   result.set_done();
 }
 
+void Block::compile(vm::Compiler &c) {
+  for (const auto &p : m_stmts) p->compile(c);
+}
+
 void Block::dump(std::ostream &out, const std::string &indent) {
   out << indent << "block" << std::endl;
   auto indent_str = indent + "  ";
@@ -144,6 +152,16 @@ void Evaluate::execute(Context &ctx, Result &result) {
   }
 }
 
+void Evaluate::compile(vm::Compiler &c) {
+  if (m_export) {
+    c.emit_exec(this);
+  } else {
+    auto top = c.top();
+    m_expr->compile(c, c.alloc());
+    c.reset(top);
+  }
+}
+
 void Evaluate::dump(std::ostream &out, const std::string &indent) {
   out << indent << "eval" << std::endl;
   m_expr->dump(out, indent + "  ");
@@ -206,6 +224,19 @@ bool Var::declare_export(Module *module, bool is_default, Error &error) {
   return true;
 }
 
+void Var::compile(vm::Compiler &c) {
+  if (!m_expr) return;
+  auto top = c.top();
+  auto pos = c.position();
+  auto r = c.alloc();
+  m_expr->compile(c, r);
+  if (!m_identifier->compile_assign(c, r)) {
+    c.rewind(pos);
+    c.emit_exec(this);
+  }
+  c.reset(top);
+}
+
 void Var::dump(std::ostream &out, const std::string &indent) {
   out << indent << "var " << m_identifier->name()->str() << std::endl;
   if (m_expr) m_expr->dump(out, indent + "  ");
@@ -311,6 +342,33 @@ void If::execute(Context &ctx, Result &result) {
   }
 }
 
+void If::compile(vm::Compiler &c) {
+  Value cond;
+  if (c.fold(m_cond.get(), cond)) {
+    if (cond.to_boolean()) {
+      m_then->compile(c);
+    } else if (m_else) {
+      m_else->compile(c);
+    }
+    return;
+  }
+
+  auto top = c.top();
+  auto r = c.alloc();
+  m_cond->compile(c, r);
+  c.reset(top);
+  auto j1 = c.emit_jump(vm::Opcode::JUMP_IF_FALSE, r);
+  m_then->compile(c);
+  if (m_else) {
+    auto j2 = c.emit_jump(vm::Opcode::JUMP);
+    c.patch(j1);
+    m_else->compile(c);
+    c.patch(j2);
+  } else {
+    c.patch(j1);
+  }
+}
+
 void If::dump(std::ostream &out, const std::string &indent) {
   out << indent << "if" << std::endl;
   auto indent_str = indent + "  ";
@@ -454,6 +512,18 @@ void Return::execute(Context &ctx, Result &result) {
   }
 }
 
+void Return::compile(vm::Compiler &c) {
+  auto top = c.top();
+  auto r = c.alloc();
+  if (m_expr) {
+    m_expr->compile(c, r);
+  } else {
+    c.emit(vm::Opcode::UNDEFINED, r);
+  }
+  c.emit(vm::Opcode::RETURN, r);
+  c.reset(top);
+}
+
 void Return::dump(std::ostream &out, const std::string &indent) {
   out << indent << "return" << std::endl;
   if (m_expr) m_expr->dump(out, indent + "  ");
@@ -539,7 +609,7 @@ void Try::execute(Context &ctx, Result &result) {
     Context cctx(ctx, 1, &exception, ctx.scope());
     if (auto scope = m_catch_scope.instantiate(cctx)) {
       m_catch->execute(cctx, result);
-      scope->clear();
+      m_catch_scope.recycle(scope);
     }
   }
   if (m_finally) {
@@ -118,7 +118,13 @@ void Tree::Scope::declare_fiber_var(Str *name, Module *module) {
 auto Tree::Scope::instantiate(Context &ctx) -> pjs::Scope* {
   init_variables();
 
-  auto *scope = ctx.new_scope(m_args.size(), m_size, m_variables);
+  pjs::Scope *scope;
+  if (m_spare && m_spare->ref_count() == 1) {
+    scope = ctx.reuse_scope(m_args.size(), m_spare);
+    m_spare = nullptr;
+  } else {
+    scope = ctx.new_scope(m_args.size(), m_size, m_variables);
+  }
 
   // Initialize arguments
   for (const auto &init : m_init_args) {
@@ -154,6 +160,24 @@ auto Tree::Scope::instantiate(Context &ctx) -> pjs::Scope* {
   return scope;
 }
 
+//
+// Most calls end with nothing but the calling context holding on to
+// their scope. Such a scope is kept for the next call on the same
+// tree, saving the allocation of the scope and its values and its
+// registration with the instance. A scope captured by a closure or a
+// child scope has more references and is left to be freed as usual.
+//
+
+void Tree::Scope::recycle(pjs::Scope *scope) {
+  if (scope->ref_count() == 1 && !m_spare) {
+    scope->clear(true);
+    scope->reparent(nullptr);
+    m_spare = scope;
+  } else {
+    scope->clear();
+  }
+}
+
 void Tree::Scope::init_variables() {
   if (!m_initialized) {
     m_size = m_args.size() + m_vars.size();
@@ -128,6 +128,7 @@ public:
     auto vars() const -> const std::vector<Ref<Str>> & { return m_vars; }
     auto variables() -> std::vector<pjs::Scope::Variable>& { init_variables(); return m_variables; }
     auto instantiate(Context &ctx) -> pjs::Scope*;
+    void recycle(pjs::Scope *scope);
 
   private:
     struct InitArg {
@@ -153,6 +154,7 @@ public:
     std::list<InitVar> m_init_vars;
     size_t m_size = 0;
     bool m_initialized = false;
+    Ref<pjs::Scope> m_spare;
 
     void init_variables();
   };
@@ -30,6 +30,14 @@
 #include <cstring>
 #include <cmath>
 
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
 namespace pjs {
 
 //
@@ -41,13 +49,27 @@ auto Pool::all() -> std::map<std::string, Pool*> & {
   return a;
 }
 
-Pool::Pool(const std::string &name, size_t size)
+bool Pool::s_huge_pages = false;
+std::atomic<size_t> Pool::s_released(0);
+
+auto Pool::release_memory(size_t min_size) -> size_t {
+  auto size = s_released.load(std::memory_order_relaxed);
+  if (!size || size < min_size) return 0;
+  size = s_released.exchange(0, std::memory_order_relaxed);
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+  return size;
+}
+
+Pool::Pool(const std::string &name, size_t size, bool huge_pages)
   : m_name(name)
   , m_size(std::max(size, sizeof(void*)))
   , m_free_list(nullptr)
   , m_return_list(nullptr)
   , m_allocated(0)
   , m_pooled(0)
+  , m_huge_pages(huge_pages && s_huge_pages)
 {
   retain();
   if (!name.empty()) {
@@ -58,24 +80,28 @@ Pool::Pool(const std::string &name, size_t size)
 Pool::~Pool() {
   for (auto *p = m_free_list; p; ) {
     auto h = p; p = p->next;
-    std::free(h);
+    free_block(h);
   }
   for (auto *p = m_return_list.load(); p; ) {
     auto h = p; p = p->next;
-    std::free(h);
+    free_block(h);
   }
+#ifdef __linux__
+  for (auto *p : m_arenas) munmap(p, ARENA_SIZE);
+#endif
 }
 
 auto Pool::alloc() -> void* {
   accept_returns();
   m_allocated++;
+  m_alloc_count++;
   if (auto *h = m_free_list) {
     m_free_list = h->next;
     m_pooled--;
     retain();
     return (char*)h + sizeof(Head);
   } else {
-    h = (Head*)std::malloc(sizeof(Head) + m_size);
+    h = new_block();
     h->pool = this;
     h->next = nullptr;
     retain();
@@ -128,35 +154,117 @@ void Pool::accept_returns() {
   }
 }
 
-void Pool::clean() {
-  int max = 0;
-  for (int i = 0; i < CURVE_LENGTH; i++) {
-    if (m_curve[i] > max) max = m_curve[i];
+void Pool::clean(int max) {
+  accept_returns();
+  bool idle = false;
+  if (m_alloc_count == m_alloc_count_cleaned) {
+    if (++m_idle_rounds >= IDLE_ROUNDS && m_free_list) {
+      idle = true;
+    }
+  } else {
+    m_alloc_count_cleaned = m_alloc_count;
+    m_idle_rounds = 0;
   }
-  int room = max + (max >> 2) - m_allocated;
-  if (room >= 0) {
-    while (m_pooled > room) {
-      auto *h = m_free_list;
-      m_free_list = h->next;
-      std::free(h);
-      m_pooled--;
+  m_room = -1;
+  if (!m_huge_pages) {
+    if (idle) {
+      m_room = 0;
+    } else {
+      int peak = 0;
+      for (int i = 0; i < CURVE_LENGTH; i++) {
+        if (m_curve[i] > peak) peak = m_curve[i];
+      }
+      int room = peak + (peak >> 2) - m_allocated;
+      if (room >= 0) m_room = room;
     }
   }
   m_curve[m_curve_pointer++ % CURVE_LENGTH] = m_allocated;
+  drain(max);
+}
+
+auto Pool::drain(int max) -> int {
+  if (m_room < 0) return 0;
+  int freed = 0;
+  while (m_pooled > m_room && freed < max) {
+    auto *h = m_free_list;
+    if (!h) break;
+    m_free_list = h->next;
+    free_block(h);
+    m_pooled--;
+    freed++;
+  }
+  if (freed > 0) {
+    s_released.fetch_add(freed * (sizeof(Head) + m_size), std::memory_order_relaxed);
+  }
+  return freed;
+}
+
+void Pool::trim() {
+  accept_returns();
+  if (m_huge_pages) return;
+  size_t freed = 0;
+  while (auto *h = m_free_list) {
+    m_free_list = h->next;
+    free_block(h);
+    freed++;
+  }
+  m_pooled = 0;
+  if (freed > 0) {
+    s_released.fetch_add(freed * (sizeof(Head) + m_size), std::memory_order_relaxed);
+  }
+}
+
+//
+// Blocks from huge page arenas are carved off one after another, leaving
+// the tail of an arena unused when a block no longer fits in there.
+//
+
+auto Pool::new_block() -> Head* {
+  auto size = sizeof(Head) + m_size;
+#ifdef __linux__
+  if (m_huge_pages && size <= ARENA_SIZE / 2) {
+    size = (size + 15) & ~size_t(15);
+    if (m_arena_left < size) {
+      auto p = (char*)mmap(nullptr, ARENA_SIZE * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) return (Head*)std::malloc(sizeof(Head) + m_size);
+      auto base = (char*)(((uintptr_t)p + ARENA_SIZE - 1) & ~uintptr_t(ARENA_SIZE - 1));
+      if (base > p) munmap(p, base - p);
+      if (p + ARENA_SIZE > base) munmap(base + ARENA_SIZE, p + ARENA_SIZE - base);
+      madvise(base, ARENA_SIZE, MADV_HUGEPAGE);
+      m_arenas.push_back(base);
+      m_arena = base;
+      m_arena_left = ARENA_SIZE;
+    }
+    auto h = (Head*)m_arena;
+    m_arena += size;
+    m_arena_left -= size;
+    return h;
+  }
+#endif
+  return (Head*)std::malloc(size);
+}
+
+void Pool::free_block(Head *h) {
+  if (m_huge_pages) {
+    for (auto *p : m_arenas) {
+      if ((char*)h >= p && (char*)h < p + ARENA_SIZE) return;
+    }
+  }
+  std::free(h);
 }
 
 //
 // PooledClass
 //
 
-PooledClass::PooledClass(const char *c_name, size_t size) {
+PooledClass::PooledClass(const char *c_name, size_t size, bool huge_pages) {
 #ifdef _MSC_VER
   auto cxx_name = c_name;
 #else
   int status;
   auto cxx_name = c_name ? abi::__cxa_demangle(c_name, 0, 0, &status) : nullptr;
 #endif
-  m_pool = new Pool(cxx_name ? cxx_name : (c_name ? c_name : ""), size);
+  m_pool = new Pool(cxx_name ? cxx_name : (c_name ? c_name : ""), size, huge_pages);
 }
 
 PooledClass::~PooledClass() {
@@ -272,7 +380,24 @@ auto Str::substring(int start, int end) -> std::string {
 // Str::CharData
 //
 
-Str::CharData::CharData(std::string &&str) : m_str(std::move(str)) {
+Str::CharData::CharData(std::string &&str, size_t hash)
+  : m_str(std::move(str))
+  , m_hash(hash)
+{
+  bool ascii = true;
+  for (const auto c : m_str) {
+    if (c & 0x80) {
+      ascii = false;
+      break;
+    }
+  }
+
+  // Positions and characters coincide without any chunk table
+  if (ascii) {
+    m_length = m_str.length();
+    return;
+  }
+
   int n = 0, p = 0, i = 0;
   Utf8Decoder decoder(
     [&](int cp) {
@@ -296,6 +421,7 @@ auto Str::CharData::pos_to_chr(int i) const -> int {
   int p = 0, n = 0;
   if (i >= size()) return m_length;
   if (i < 0) i = 0;
+  if (is_ascii()) return i;
   if (!m_chunks.empty() && i >= m_chunks[0]) {
     int a = 0, b = m_chunks.size();
     while (a + 1 < b) {
@@ -335,6 +461,7 @@ auto Str::CharData::pos_to_chr(int i) const -> int {
 }
 
 auto Str::CharData::chr_to_pos(int i) const -> int {
+  if (is_ascii()) return std::max(0, std::min(i, m_length));
   int chk = i / CHUNK_SIZE;
   int off = i % CHUNK_SIZE;
   int min, max;
@@ -367,6 +494,7 @@ auto Str::CharData::chr_to_pos(int i) const -> int {
 }
 
 auto Str::CharData::chr_at(int i) const -> int {
+  if (is_ascii()) return 0 <= i && i < m_length ? (uint8_t)m_str[i] : -1;
   i = chr_to_pos(i);
   if (i >= size()) return -1;
   auto c = m_str[i];
@@ -461,6 +589,10 @@ Instance::Instance(Object *global)
 }
 
 Instance::~Instance() {
+  if (auto s = m_collect_cursor) {
+    m_collect_cursor = nullptr;
+    s->release();
+  }
   while (m_scopes) {
     auto s = m_scopes;
     remove(s);
@@ -479,6 +611,153 @@ auto Instance::new_fiber() -> Fiber* {
   return new Fiber(this, m_modules.size());
 }
 
+//
+// Instance::collect() reclaims reference cycles by trial deletion. Up to
+// 'limit' scopes, taken in turn from the list of closures' scopes, serve
+// as candidate roots. Every reference found between the objects and
+// scopes reachable from them is subtracted from a trial count. What is
+// left with no count and cannot be reached from anything still counted
+// is only ever referenced from within the cycle and gets cleared.
+//
+// References held by native code are not visible here. They only keep
+// the trial counts up, so such objects are never taken as garbage. This
+// must not be called while a script is running on the thread.
+//
+
+auto Instance::collect(size_t limit) -> size_t {
+  struct Node {
+    Object* obj;
+    Scope* scope;
+    int count;
+    bool expanded;
+    bool black;
+  };
+
+  std::unordered_map<void*, Node> nodes;
+  std::vector<void*> queue;
+
+  auto node_of = [&](Object *obj, Scope *scope) -> Node& {
+    void *p = obj ? (void*)obj : (void*)scope;
+    auto i = nodes.find(p);
+    if (i != nodes.end()) return i->second;
+    auto &n = nodes[p];
+    n.obj = obj;
+    n.scope = scope;
+    n.count = obj ? obj->ref_count() : scope->ref_count();
+    n.expanded = false;
+    n.black = false;
+    queue.push_back(p);
+    return n;
+  };
+
+  auto children = [](Node &n, const std::function<void(Object*, Scope*)> &cb) {
+    auto values = [&](Data *data, size_t size) {
+      for (size_t i = 0; i < size; i++) {
+        const auto &v = data->at(i);
+        if (v.is_object() && v.o()) cb(v.o(), nullptr);
+      }
+    };
+    if (auto obj = n.obj) {
+      if (auto data = obj->data()) values(data, data->size());
+      // The hash hands out copies that hold their own references, so
+      // only visit its objects once those copies are gone
+      std::vector<Object*> hashed;
+      obj->iterate_hash(
+        [&](Str*, Value &v) {
+          if (v.is_object() && v.o()) hashed.push_back(v.o());
+          return true;
+        }
+      );
+      for (auto o : hashed) cb(o, nullptr);
+      if (obj->is_array()) {
+        auto a = obj->as<Array>();
+        values(a->elements(), std::min(size_t(a->length()), a->elements()->size()));
+      } else if (obj->is_function()) {
+        auto f = obj->as<Function>();
+        if (auto o = f->thiz()) cb(o, nullptr);
+        if (auto s = f->scope()) cb(nullptr, s);
+      }
+    } else {
+      auto scope = n.scope;
+      if (auto s = scope->parent()) cb(nullptr, s);
+      for (size_t i = 0, n = scope->size(); i < n; i++) {
+        const auto &v = scope->value(i);
+        if (v.is_object() && v.o()) cb(v.o(), nullptr);
+      }
+    }
+  };
+
+  // Pick the candidate roots, resuming from where the last run stopped
+  auto s = m_collect_cursor;
+  if (s && s->m_instance != this) s = nullptr;
+  if (!s) s = m_scopes;
+  for (size_t i = 0; s && i < limit; i++) {
+    node_of(nullptr, s);
+    s = s->m_next;
+  }
+  if (m_collect_cursor) m_collect_cursor->release();
+  m_collect_cursor = s ? s->retain() : nullptr;
+  if (m_collect_cursor) node_of(nullptr, m_collect_cursor).black = true;
+
+  // Subtract internal references, expanding at most 'limit' times the
+  // number of roots so that one run stays short
+  auto max_expanded = limit * 16;
+  for (size_t i = 0; i < queue.size() && i < max_expanded; i++) {
+    auto &n = nodes[queue[i]];
+    n.expanded = true;
+    children(n, [&](Object *obj, Scope *scope) { node_of(obj, scope).count--; });
+  }
+
+  // Anything still counted, or not looked into, is alive along with
+  // everything it refers to
+  std::vector<Node*> stack;
+  for (auto &p : nodes) {
+    auto &n = p.second;
+    if (n.count > 0 || !n.expanded) n.black = true;
+    if (n.black) stack.push_back(&n);
+  }
+  while (!stack.empty()) {
+    auto n = stack.back();
+    stack.pop_back();
+    if (!n->expanded) continue;
+    children(*n, [&](Object *obj, Scope *scope) {
+      auto i = nodes.find(obj ? (void*)obj : (void*)scope);
+      if (i != nodes.end() && !i->second.black) {
+        i->second.black = true;
+        stack.push_back(&i->second);
+      }
+    });
+  }
+
+  // Break the garbage cycles by clearing every reference they hold
+  std::vector<Ref<Object>> objects;
+  std::vector<Ref<Scope>> scopes;
+  for (auto &p : nodes) {
+    auto &n = p.second;
+    if (n.black) continue;
+    if (n.obj) objects.push_back(n.obj); else scopes.push_back(n.scope);
+  }
+
+  for (const auto &obj : objects) {
+    if (auto data = obj->data()) {
+      for (size_t i = 0, n = data->size(); i < n; i++) data->at(i) = Value::undefined;
+    }
+    std::vector<Ref<Str>> keys;
+    obj->iterate_hash([&](Str *k, Value &) { keys.push_back(k); return true; });
+    for (const auto &k : keys) obj->ht_set(k, Value::undefined);
+    if (obj->is_array()) {
+      auto data = obj->as<Array>()->elements();
+      for (size_t i = 0, n = data->size(); i < n; i++) data->at(i) = Value::empty;
+    }
+  }
+
+  for (const auto &scope : scopes) {
+    scope->clear(true);
+  }
+
+  return objects.size() + scopes.size();
+}
+
 //
 // Fiber
 //
@@ -1437,6 +1716,18 @@ static size_t number_to_string(char *str, size_t len, double n, int digits, int
   static const char s_symbols[] = { "0123456789abcdefghijklmnopqrstuvwxyz" };
   if (auto l = special_number_to_string(str, len, n)) return l;
   if (radix == 10) {
+    if (digits < 0 && (n != 0 || !std::signbit(n)) && -1e15 < n && n < 1e15 && n == (int64_t)n) {
+      char buf[20];
+      auto i = (int64_t)n;
+      auto u = (uint64_t)(i < 0 ? -i : i);
+      size_t p = sizeof(buf);
+      do { buf[--p] = '0' + u % 10; u /= 10; } while (u);
+      if (i < 0) buf[--p] = '-';
+      auto l = std::min(len - 1, sizeof(buf) - p);
+      std::memcpy(str, buf + p, l);
+      str[l] = 0;
+      return l;
+    }
     auto d = digits; if (d < 0) d = -d;
     auto l = std::snprintf(str, len, "%.*f", d, n);
     if (digits < 0) {
@@ -1875,19 +2166,71 @@ auto String::replace(Str *pattern, Str *replacement, bool all) -> Str* {
   return Str::make(result);
 }
 
+//
+// Replaces all matches like std::regex_replace() did,
+// expanding $$, $&, $`, $' and $n in the replacement
+//
+
 auto String::replace(RegExp *pattern, Str *replacement) -> Str* {
   auto &s = m_s->str();
   auto &fmt = replacement->str();
-  auto &re = pattern->regex();
-  return Str::make(std::regex_replace(s, re, fmt));
+  auto begin = s.c_str();
+  auto end = begin + s.length();
+  std::vector<int> groups;
+  std::string result;
+  int last = 0, pos = 0;
+  while (pattern->search(begin, end, pos, groups)) {
+    auto head = groups[0];
+    auto tail = groups[1];
+    auto n = int(groups.size() / 2);
+    result.append(begin + last, head - last);
+    for (size_t i = 0; i < fmt.length(); i++) {
+      auto c = fmt[i];
+      if (c != '$' || i + 1 >= fmt.length()) { result += c; continue; }
+      auto d = fmt[i+1];
+      if (d == '$') { result += '$'; i++; continue; }
+      if (d == '&') { result.append(begin + head, tail - head); i++; continue; }
+      if (d == '`') { result.append(begin, head); i++; continue; }
+      if (d == '\'') { result.append(begin + tail, end - begin - tail); i++; continue; }
+      if ('0' <= d && d <= '9') {
+        int k = d - '0', len = 1;
+        if (i + 2 < fmt.length() && '0' <= fmt[i+2] && fmt[i+2] <= '9') {
+          int k2 = k * 10 + (fmt[i+2] - '0');
+          if (k2 < n) { k = k2; len = 2; }
+        }
+        if (k < n) {
+          auto a = groups[k*2+0];
+          auto b = groups[k*2+1];
+          if (a >= 0) result.append(begin + a, b - a);
+          i += len;
+          continue;
+        }
+      }
+      result += c;
+    }
+    last = tail;
+    if (tail > head) {
+      pos = tail;
+    } else {
+      // Step over a whole UTF-8 character after an empty match
+      if (tail >= int(s.length())) break;
+      auto step = 1;
+      auto b = (unsigned char)s[tail];
+      if (b >= 0xf0) step = 4; else if (b >= 0xe0) step = 3; else if (b >= 0xc0) step = 2;
+      step = std::min(step, int(s.length()) - tail);
+      result.append(begin + tail, step);
+      last = pos = tail + step;
+    }
+  }
+  if (last < int(s.length())) result.append(begin + last, s.length() - last);
+  return Str::make(std::move(result));
 }
 
 auto String::search(RegExp *pattern) -> int {
-  std::smatch sm;
-  std::regex_search(m_s->str(), sm, pattern->regex());
-  if (sm.empty()) return -1;
-  auto p = sm.position(0);
-  return m_s->pos_to_chr(p);
+  auto &s = m_s->str();
+  std::vector<int> groups;
+  if (!pattern->search(s.c_str(), s.c_str() + s.length(), 0, groups)) return -1;
+  return m_s->pos_to_chr(groups[0]);
 }
 
 auto String::slice(int start) -> Str* {
@@ -2047,6 +2390,13 @@ auto String::fill(char *buf, size_t size, Str *str, int n) -> size_t {
   return p;
 }
 
+//
+// Method::Profiling
+//
+
+std::atomic<int(*)(Method*)> Method::Profiling::s_hook(nullptr);
+thread_local int Method::Profiling::s_current = 0;
+
 //
 // Function
 //
@@ -2118,6 +2468,7 @@ auto Error::to_string() const -> std::string {
 //
 
 auto Promise::resolve(const Value &value) -> Promise* {
+  if (value.is_promise()) return value.as<Promise>();
   auto p = Promise::make();
   p->settle(RESOLVED, value);
   return p;
@@ -2182,6 +2533,10 @@ auto Promise::then(
   return t->m_promise;
 }
 
+void Promise::then(Callback *callback) {
+  add_then(new Then(callback));
+}
+
 void Promise::add_then(Then *then) {
   if (m_thens_tail) {
     m_thens_tail->m_next = then;
@@ -2476,7 +2831,13 @@ Promise::Then::Then(
 }
 
 void Promise::Then::execute(State state, const Value &result) {
-  if (m_context) {
+  if (m_callback) {
+    if (state == RESOLVED) {
+      m_callback->on_resolved(result);
+    } else {
+      m_callback->on_rejected(result);
+    }
+  } else if (m_context) {
     execute(m_context, state, result);
   } else {
     Context ctx(nullptr);
@@ -2650,7 +3011,7 @@ void PromiseDependency::init() {
   Promise::WeakPtr::Watcher::watch(m_promise->weak_ptr());
   m_state = m_promise->m_state;
   m_result = m_promise->m_result;
-  m_promise->then(nullptr, Callback::resolved(), Callback::rejected());
+  m_promise->then(this);
 }
 
 void PromiseDependency::on_resolved(const Value &value) {
@@ -3425,6 +3786,137 @@ void Array::unshift(const Value *values, int count) {
   }
 }
 
+//
+// Uint8Array
+//
+
+template<> void ClassDef<Uint8Array>::init() {
+  ctor([](Context &ctx) -> Object* {
+    int length = 0;
+    Array *array;
+    Uint8Array *other;
+    if (ctx.argc() == 0) return Uint8Array::make(0);
+    if (ctx.get(0, array) && array) return Uint8Array::make(array);
+    if (ctx.get(0, other) && other) return Uint8Array::make(other->bytes(), other->length());
+    if (!ctx.get(0, length) || length < 0 || length > Uint8Array::MAX_SIZE) {
+      ctx.error("invalid typed array length");
+      return nullptr;
+    }
+    return Uint8Array::make(length);
+  });
+
+  geti([](Object *obj, int i, Value &val) {
+    auto b = obj->as<Uint8Array>()->get(i);
+    if (b < 0) val = Value::undefined; else val.set(b);
+  });
+
+  seti([](Object *obj, int i, const Value &val) {
+    obj->as<Uint8Array>()->set(i, val);
+  });
+
+  accessor("length", [](Object *obj, Value &ret) { ret.set(obj->as<Uint8Array>()->length()); });
+  accessor("byteLength", [](Object *obj, Value &ret) { ret.set(obj->as<Uint8Array>()->length()); });
+
+  method("fill", [](Context &ctx, Object *obj, Value &ret) {
+    auto a = obj->as<Uint8Array>();
+    int v = 0, start = 0, end = a->length();
+    if (!ctx.arguments(0, &v, &start, &end)) return;
+    a->fill(v, start, end);
+    ret.set(a);
+  });
+
+  method("set", [](Context &ctx, Object *obj, Value &ret) {
+    auto a = obj->as<Uint8Array>();
+    Array *array;
+    Uint8Array *other;
+    int offset = 0;
+    if (ctx.get(0, other) && other) {
+      if (!ctx.arguments(1, &other, &offset)) return;
+      a->set(other->bytes(), other->length(), offset);
+    } else if (ctx.get(0, array) && array) {
+      if (!ctx.arguments(1, &array, &offset)) return;
+      array->iterate_all([&](Value &v, int i) { a->set(offset + i, v); });
+    } else {
+      ctx.error_argument_type(0, "an array or a Uint8Array");
+    }
+  });
+
+  method("slice", [](Context &ctx, Object *obj, Value &ret) {
+    auto a = obj->as<Uint8Array>();
+    int start = 0, end = a->length();
+    if (!ctx.arguments(0, &start, &end)) return;
+    ret.set(a->slice(start, end));
+  });
+
+  method("subarray", [](Context &ctx, Object *obj, Value &ret) {
+    auto a = obj->as<Uint8Array>();
+    int start = 0, end = a->length();
+    if (!ctx.arguments(0, &start, &end)) return;
+    ret.set(a->subarray(start, end));
+  });
+
+  method("toArray", [](Context &ctx, Object *obj, Value &ret) {
+    auto a = obj->as<Uint8Array>();
+    auto n = a->length();
+    auto p = a->bytes();
+    auto arr = Array::make(n);
+    for (int i = 0; i < n; i++) arr->set(i, int(p[i]));
+    ret.set(arr);
+  });
+}
+
+template<> void ClassDef<Constructor<Uint8Array>>::init() {
+  super<Function>();
+  ctor();
+}
+
+Uint8Array::Uint8Array(int length)
+  : m_buffer(new Buffer(length))
+  , m_length(length)
+{
+}
+
+Uint8Array::Uint8Array(const uint8_t *bytes, int length)
+  : m_buffer(new Buffer(length))
+  , m_length(length)
+{
+  std::memcpy(m_buffer->bytes.data(), bytes, length);
+}
+
+Uint8Array::Uint8Array(Array *array)
+  : m_buffer(new Buffer(std::min(array->length(), int(MAX_SIZE))))
+  , m_length(m_buffer->bytes.size())
+{
+  array->iterate_all([this](Value &v, int i) { set(i, v); });
+}
+
+void Uint8Array::range(int &start, int &end) const {
+  if (start < 0) start = std::max(0, m_length + start);
+  if (end < 0) end = std::max(0, m_length + end);
+  start = std::min(start, m_length);
+  end = std::max(start, std::min(end, m_length));
+}
+
+void Uint8Array::fill(int v, int start, int end) {
+  range(start, end);
+  std::memset(bytes() + start, v, end - start);
+}
+
+void Uint8Array::set(const uint8_t *src, int count, int offset) {
+  if (offset < 0 || offset >= m_length) return;
+  std::memmove(bytes() + offset, src, std::min(count, m_length - offset));
+}
+
+auto Uint8Array::slice(int start, int end) -> Uint8Array* {
+  range(start, end);
+  return Uint8Array::make(bytes() + start, end - start);
+}
+
+auto Uint8Array::subarray(int start, int end) -> Uint8Array* {
+  range(start, end);
+  return Uint8Array::make(m_buffer.get(), m_offset + start, end - start);
+}
+
 //
 // RegExp
 //
@@ -3466,41 +3958,61 @@ template<> void ClassDef<Constructor<RegExp>>::init() {
 
 RegExp::RegExp(Str *pattern)
   : m_source(pattern)
-  , m_regex(pattern->str(), chars_to_flags(nullptr, m_global))
 {
+  compile(pattern, nullptr);
 }
 
 RegExp::RegExp(Str *pattern, Str *flags)
   : m_source(pattern)
-  , m_regex(pattern->str(), chars_to_flags(flags, m_global))
 {
+  compile(pattern, flags);
 }
 
-auto RegExp::exec(Str *str) -> Array* {
-  std::smatch sm;
-  auto &match = m_global ? m_match : sm;
+void RegExp::compile(Str *pattern, Str *flags) {
+  thread_local static std::unordered_map<std::string, std::shared_ptr<Regex>> s_cache;
+
+  auto f = chars_to_flags(flags, m_global);
+  m_ignore_case = (f & std::regex::icase);
+
+  // Scripts tend to build the same patterns over and over,
+  // so compiled programs are shared, including negative results
+  auto key = (m_ignore_case ? "i/" : "/") + pattern->str();
+  auto i = s_cache.find(key);
+  if (i != s_cache.end()) {
+    m_linear = i->second;
+  } else {
+    m_linear = Regex::compile(pattern->str(), m_ignore_case);
+    if (s_cache.size() >= 1000) s_cache.clear();
+    s_cache[key] = m_linear;
+  }
 
-  std::regex_search(str->str(), match, m_regex);
-  if (match.empty()) return nullptr;
+  if (!m_linear) m_regex.assign(pattern->str(), f);
+}
+
+auto RegExp::exec(Str *str) -> Array* {
+  auto &s = str->str();
+  std::vector<int> groups;
+  if (!search(s.c_str(), s.c_str() + s.length(), 0, groups)) return nullptr;
 
-  auto result = Array::make(match.size());
-  for (size_t i = 0; i < match.size(); i++) {
-    auto &sm = match[i];
-    result->set(i, Str::make(sm.str()));
+  auto n = groups.size() / 2;
+  auto result = Array::make(n);
+  for (size_t i = 0; i < n; i++) {
+    auto a = groups[i*2+0];
+    auto b = groups[i*2+1];
+    result->set(i, a < 0 ? Str::empty.get() : Str::make(s.c_str() + a, b - a));
   }
 
   if (m_global) {
-    auto p = match[0].second - str->str().begin();
-    m_last_index = str->pos_to_chr(p);
+    m_last_index = str->pos_to_chr(groups[1]);
   }
 
   return result;
 }
 
 bool RegExp::test(Str *str) {
-  std::smatch match;
-  std::regex_search(str->str(), match, m_regex);
-  return !match.empty();
+  auto &s = str->str();
+  std::vector<int> groups;
+  return search(s.c_str(), s.c_str() + s.length(), 0, groups);
 }
 
 auto RegExp::chars_to_flags(Str *chars, bool &global) -> std::regex::flag_type {
@@ -43,6 +43,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "regex.hpp"
+
 #ifdef _MSC_VER
 #include <intrin.h>
 #else
@@ -73,6 +75,7 @@ class PromiseAggregator;
 class PromiseDependency;
 class RegExp;
 class String;
+class Uint8Array;
 class Value;
 class SharedObject;
 class SharedValue;
@@ -160,12 +163,28 @@ private:
 //
 // Pool
 //
+// Free lists shrink in clean() towards the recent peak, and a pool that
+// has not allocated for IDLE_ROUNDS cleanings in a row drops its free list
+// altogether. Bytes given back this way are counted process-wide so that
+// release_memory() can have the allocator hand free pages back to the OS.
+//
+// Pools created with huge_pages set carve their blocks out of 2MB arenas
+// backed by transparent huge pages when enable_huge_pages() is on. Such
+// blocks stay on the free lists for good and are never released.
+//
 
 class Pool : public RefCountMT<Pool> {
 public:
   static auto all() -> std::map<std::string, Pool*> &;
 
-  Pool(const std::string &name, size_t size);
+  static void enable_huge_pages(bool b) { s_huge_pages = b; }
+  static bool huge_pages_enabled() { return s_huge_pages; }
+
+  // Returns freed pool memory to the OS once at least min_size bytes
+  // have been freed since the last time, giving the number of those bytes
+  static auto release_memory(size_t min_size) -> size_t;
+
+  Pool(const std::string &name, size_t size, bool huge_pages = false);
   ~Pool();
 
   auto name() const -> const std::string& { return m_name; }
@@ -173,12 +192,23 @@ public:
   auto allocated() const -> int { return m_allocated; }
   auto pooled() const -> int { return m_pooled; }
 
+  // Allocations ever made, for telling how many an operation costs
+  auto alloc_count() const -> uint64_t { return m_alloc_count; }
+
   auto alloc() -> void*;
   void free(void *p);
-  void clean();
+
+  // Updates the recent peak and frees up to max of the pooled blocks
+  // beyond it, leaving the rest to drain(), which gives how many it freed
+  void clean(int max = std::numeric_limits<int>::max());
+  auto drain(int max) -> int;
+  auto excess() const -> int { return m_room >= 0 && m_pooled > m_room ? m_pooled - m_room : 0; }
+  void trim();
 
 private:
   enum { CURVE_LENGTH = 3 };
+  enum { IDLE_ROUNDS = 12 };
+  enum { ARENA_SIZE = 2 * 1024 * 1024 };
 
   struct Head {
     Pool* pool;
@@ -191,9 +221,22 @@ private:
   std::atomic<Head*> m_return_list;
   int m_allocated;
   int m_pooled;
+  uint64_t m_alloc_count = 0;
+  uint64_t m_alloc_count_cleaned = 0;
+  int m_idle_rounds = 0;
+  int m_room = -1;
   int m_curve[CURVE_LENGTH] = { 0 };
   size_t m_curve_pointer = 0;
+  bool m_huge_pages;
+  char* m_arena = nullptr;
+  size_t m_arena_left = 0;
+  std::vector<char*> m_arenas;
 
+  static bool s_huge_pages;
+  static std::atomic<size_t> s_released;
+
+  auto new_block() -> Head*;
+  void free_block(Head *h);
   void add_return(Head *h);
   void accept_returns();
 
@@ -206,7 +249,7 @@ private:
 
 class PooledClass {
 public:
-  PooledClass(const char *c_name, size_t size);
+  PooledClass(const char *c_name, size_t size, bool huge_pages = false);
   ~PooledClass();
 
   auto pool() const -> Pool& { return *m_pool; }
@@ -512,14 +555,12 @@ public:
     Pool(size_t alloc_size)
       : m_alloc_size(alloc_size) {}
 
-    auto alloc() -> PooledArrayBase* {
+    auto alloc() -> void* {
       if (auto p = m_free) {
         m_free = p->m_next;
         return p;
       } else {
-        p = (PooledArrayBase*)std::malloc(m_alloc_size);
-        p->m_pool = this;
-        return p;
+        return std::malloc(m_alloc_size);
       }
     }
 
@@ -537,6 +578,15 @@ public:
     m_pool->free(this);
   }
 
+protected:
+
+  // The pool is set by the constructor, not by Pool::alloc(), since the
+  // compiler is free to drop any store made to an object before it has
+  // been constructed
+  PooledArrayBase(Pool *pool) : m_pool(pool) {}
+
+  auto pool() const -> Pool* { return m_pool; }
+
 private:
   Pool* m_pool;
   PooledArrayBase* m_next;
@@ -550,20 +600,19 @@ template<class T>
 class PooledArray : public PooledArrayBase {
 public:
   static auto make(size_t size) -> PooledArray* {
-    auto p = alloc(size);
-    new (p) PooledArray(size);
-    return p;
+    auto pool = pool_of(size);
+    return new (pool->alloc()) PooledArray(pool, size);
   }
 
   static auto make(size_t size, const T &initial) -> PooledArray* {
-    auto p = alloc(size);
-    new (p) PooledArray(size, initial);
-    return p;
+    auto pool = pool_of(size);
+    return new (pool->alloc()) PooledArray(pool, size, initial);
   }
 
   void free() {
+    auto pool = this->pool();
     this->~PooledArray();
-    recycle();
+    pool->free(this);
   }
 
   auto size() const -> size_t {
@@ -586,13 +635,19 @@ private:
   size_t m_size;
   T m_elements[0];
 
-  PooledArray(size_t size) : m_size(size) {
+  PooledArray(Pool *pool, size_t size)
+    : PooledArrayBase(pool)
+    , m_size(size)
+  {
     for (size_t i = 0; i < size; i++) {
       new (m_elements + i) T();
     }
   }
 
-  PooledArray(size_t size, const T &initial) : m_size(size) {
+  PooledArray(Pool *pool, size_t size, const T &initial)
+    : PooledArrayBase(pool)
+    , m_size(size)
+  {
     for (size_t i = 0; i < size; i++) {
       new (m_elements + i) T(initial);
     }
@@ -604,13 +659,13 @@ private:
     }
   }
 
-  static auto alloc(size_t size) -> PooledArray* {
+  static auto pool_of(size_t size) -> Pool* {
     auto &pools = m_pools;
     auto slot = slot_of_size(size);
     for (auto i = pools.size(); i <= slot; i++) {
       pools.emplace_back(new Pool(sizeof(PooledArray) + sizeof(T) * size_of_slot(i)));
     }
-    return static_cast<PooledArray*>(pools[slot]->alloc());
+    return pools[slot].get();
   }
 
   static auto slot_of_size(size_t size) -> size_t {
@@ -632,7 +687,11 @@ thread_local std::vector<std::unique_ptr<PooledArrayBase::Pool>> PooledArray<T>:
 
 //
 // OrderedHash
-// TODO: Use pooled allocators
+//
+// Entries are kept in insertion order in a dense array and found through
+// an open-addressing index of positions into that array. Erased entries
+// are left as holes that lookups probe past and iterators skip, until
+// the next rebuild of the index squeezes them out.
 //
 
 template<class K, class V>
@@ -648,7 +707,6 @@ public:
   public:
     Iterator(OrderedHash<K, V> *h)
       : m_h(h)
-      , m_i(h->m_entries.begin())
       , m_next(h->m_iterators)
     {
       if (m_next) m_next->m_prev = this;
@@ -663,13 +721,17 @@ public:
     }
 
     auto next() -> Entry* {
-      if (m_i == m_h->m_entries.end()) return nullptr;
-      return &*m_i++;
+      auto &slots = m_h->m_slots;
+      while (m_i < slots.size()) {
+        auto &s = slots[m_i++];
+        if (s.alive) return &s.entry;
+      }
+      return nullptr;
     }
 
   private:
     OrderedHash<K, V> *m_h;
-    typename std::list<Entry>::iterator m_i;
+    size_t m_i = 0;
     Iterator* m_next;
     Iterator* m_prev = nullptr;
 
@@ -682,75 +744,179 @@ public:
   }
 
   auto size() const -> size_t {
-    return m_entries.size();
+    return m_size;
+  }
+
+  // Never reused, even by a hash that takes over the memory of a freed one
+  auto id() const -> uint64_t {
+    return m_id;
+  }
+
+  auto shape() const -> uint32_t {
+    return m_shape;
   }
 
   bool has(const K &k) {
-    return m_map.count(k) > 0;
+    return lookup(k, hash_of(k)) >= 0;
+  }
+
+  auto find(const K &k) -> Entry* {
+    auto i = lookup(k, hash_of(k));
+    if (i < 0) return nullptr;
+    return &m_slots[m_index[i]].entry;
   }
 
   bool get(const K &k, V &v) {
-    auto i = m_map.find(k);
-    if (i == m_map.end()) return false;
-    v = i->second->v;
+    auto i = lookup(k, hash_of(k));
+    if (i < 0) return false;
+    v = m_slots[m_index[i]].entry.v;
     return true;
   }
 
+  // Moves the entry to the end, as the most recently used
   bool use(const K &k, V &v) {
-    auto i = m_map.find(k);
-    if (i == m_map.end()) return false;
-    v = i->second->v;
-    auto a = i->second;
-    auto b = a; ++b;
-    m_entries.splice(m_entries.end(), m_entries, a, b);
+    auto h = hash_of(k);
+    auto i = lookup(k, h);
+    if (i < 0) return false;
+    auto &s = m_slots[m_index[i]];
+    v = s.entry.v;
+    if (size_t(m_index[i]) + 1 == m_slots.size()) return true;
+    Entry e(s.entry.k, s.entry.v);
+    remove(s);
+    insert(e.k, e.v, h);
     return true;
   }
 
   bool set(const K &k, const V &v) {
-    auto i = m_map.find(k);
-    if (i == m_map.end()) {
-      auto p = m_entries.emplace(m_entries.end(), k, v);
-      m_map[k] = p;
+    auto h = hash_of(k);
+    auto i = lookup(k, h);
+    if (i < 0) {
+      insert(k, v, h);
       return true;
     } else {
-      i->second->v = v;
+      m_slots[m_index[i]].entry.v = v;
       return false;
     }
   }
 
   bool erase(const K &k) {
-    auto i = m_map.find(k);
-    if (i == m_map.end()) return false;
-    for (auto p = m_iterators; p; p = p->m_next) {
-      if (p->m_i == i->second) p->m_i++;
-    }
-    m_entries.erase(i->second);
-    m_map.erase(i);
+    auto i = lookup(k, hash_of(k));
+    if (i < 0) return false;
+    remove(m_slots[m_index[i]]);
     return true;
   }
 
   void clear() {
-    m_map.clear();
-    m_entries.clear();
+    m_slots.clear();
+    m_index.clear();
+    m_size = 0;
+    m_shape++;
     for (auto p = m_iterators; p; p = p->m_next) {
-      p->m_i = m_entries.end();
+      p->m_i = 0;
     }
   }
 
 private:
+  struct Slot {
+    Entry entry;
+    size_t hash;
+    bool alive;
+    Slot(const K &k, const V &v, size_t h) : entry(k, v), hash(h), alive(true) {}
+  };
+
   OrderedHash() {}
 
-  OrderedHash(const OrderedHash &rval)
-    : m_entries(rval.m_entries)
-  {
-    for (auto i = m_entries.begin(); i != m_entries.end(); i++) {
-      m_map[i->k] = i;
+  OrderedHash(const OrderedHash &rval) {
+    m_slots.reserve(rval.m_size);
+    for (const auto &s : rval.m_slots) {
+      if (s.alive) m_slots.push_back(s);
     }
+    m_size = m_slots.size();
+    rebuild();
   }
 
-  std::list<Entry> m_entries;
-  std::unordered_map<K, typename std::list<Entry>::iterator> m_map;
+  std::vector<Slot> m_slots;
+  std::vector<int> m_index;
+  size_t m_size = 0;
   Iterator* m_iterators = nullptr;
+  uint64_t m_id = next_id();
+  uint32_t m_shape = 0;
+
+  static auto next_id() -> uint64_t {
+    static std::atomic<uint64_t> s_last_id(0);
+    return s_last_id.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  static auto hash_of(const K &k) -> size_t {
+    std::hash<K> h;
+    return h(k);
+  }
+
+  // Returns the position in the index, or -1 if not found
+  auto lookup(const K &k, size_t h) const -> int {
+    if (m_index.empty()) return -1;
+    std::equal_to<K> eq;
+    auto mask = m_index.size() - 1;
+    for (auto i = h & mask;; i = (i + 1) & mask) {
+      auto p = m_index[i];
+      if (p < 0) return -1;
+      const auto &s = m_slots[p];
+      if (s.alive && s.hash == h && eq(s.entry.k, k)) return i;
+    }
+  }
+
+  void insert(const K &k, const V &v, size_t h) {
+    if ((m_slots.size() + 1) * 2 > m_index.size()) {
+      compact();
+      rebuild();
+    }
+    auto mask = m_index.size() - 1;
+    auto i = h & mask;
+    while (m_index[i] >= 0) i = (i + 1) & mask;
+    m_index[i] = m_slots.size();
+    m_slots.emplace_back(k, v, h);
+    m_size++;
+    m_shape++;
+  }
+
+  // Leaves a hole in place so that the positions of others stay put
+  void remove(Slot &s) {
+    s.alive = false;
+    s.entry.k = K();
+    s.entry.v = V();
+    m_size--;
+    m_shape++;
+  }
+
+  void compact() {
+    if (m_size == m_slots.size()) return;
+    std::vector<size_t> moved(m_slots.size() + 1);
+    size_t n = 0;
+    for (size_t i = 0; i < m_slots.size(); i++) {
+      moved[i] = n;
+      if (m_slots[i].alive) {
+        if (n != i) m_slots[n] = std::move(m_slots[i]);
+        n++;
+      }
+    }
+    moved[m_slots.size()] = n;
+    m_slots.resize(n, Slot(K(), V(), 0));
+    for (auto p = m_iterators; p; p = p->m_next) {
+      p->m_i = moved[std::min(p->m_i, moved.size() - 1)];
+    }
+  }
+
+  void rebuild() {
+    size_t size = 8;
+    while (size < (m_size + 1) * 4) size <<= 1;
+    m_index.assign(size, -1);
+    auto mask = size - 1;
+    for (size_t p = 0; p < m_slots.size(); p++) {
+      auto i = m_slots[p].hash & mask;
+      while (m_index[i] >= 0) i = (i + 1) & mask;
+      m_index[i] = p;
+    }
+  }
 
   friend class Iterator;
 };
@@ -803,6 +969,8 @@ public:
     auto c_str() const -> const char * { return m_str.c_str(); }
     auto size() const -> size_t { return m_str.length(); }
     auto length() const -> int { return m_length; }
+    auto hash() const -> size_t { return m_hash; }
+    bool is_ascii() const { return m_length == m_str.length(); }
 
     auto pos_to_chr(int i) const -> int;
     auto chr_to_pos(int i) const -> int;
@@ -811,10 +979,17 @@ public:
   private:
     enum { CHUNK_SIZE = 32 };
 
-    CharData(std::string &&str);
+    CharData(std::string &&str) : CharData(std::move(str), hash_of(str)) {}
+    CharData(std::string &&str, size_t hash);
     ~CharData() {}
 
+    static auto hash_of(const std::string &str) -> size_t {
+      std::hash<std::string> h;
+      return h(str);
+    }
+
     const std::string m_str;
+    const size_t m_hash;
     int m_length;
     std::vector<uint32_t> m_chunks;
 
@@ -828,19 +1003,19 @@ public:
 
   static auto make(const std::string &str) -> Str* {
     if (str.length() > s_max_size) {
-      auto sub = str.substr(0, s_max_size);
-      if (auto s = local_map().get(sub)) return s;
-      return new Str(std::move(sub));
+      return make(str.substr(0, s_max_size));
     } else {
-      if (auto s = local_map().get(str)) return s;
-      return new Str(str);
+      auto h = CharData::hash_of(str);
+      if (auto s = local_map().get(str, h)) return s;
+      return new Str(new CharData(std::string(str), h));
     }
   }
 
   static auto make(std::string &&str) -> Str* {
     if (str.length() > s_max_size) str.resize(s_max_size);
-    if (auto s = local_map().get(str)) return s;
-    return new Str(std::move(str));
+    auto h = CharData::hash_of(str);
+    if (auto s = local_map().get(str, h)) return s;
+    return new Str(new CharData(std::move(str), h));
   }
 
   static auto make(const char *str, size_t len) -> Str* {
@@ -853,7 +1028,7 @@ public:
   }
 
   static auto make(CharData *data) -> Str* {
-    if (auto s = local_map().get(data->str())) return s;
+    if (auto s = local_map().get(data->str(), data->hash())) return s;
     return new Str(data);
   }
 
@@ -868,6 +1043,8 @@ public:
   auto data() const -> CharData* { return m_char_data; }
   auto str() const -> const std::string& { return m_char_data->str(); }
   auto c_str() const -> const char* { return m_char_data->c_str(); }
+  auto hash() const -> size_t { return m_char_data->hash(); }
+  bool is_ascii() const { return m_char_data->is_ascii(); }
 
   auto pos_to_chr(int i) const -> int { return m_char_data->pos_to_chr(i); }
   auto chr_to_pos(int i) const -> int { return m_char_data->chr_to_pos(i); }
@@ -883,6 +1060,10 @@ private:
   //
   // Str::LocalMap
   //
+  // Keys point to the strings held by the interned Str objects
+  // and carry the hash already computed in their CharData, so a
+  // lookup never copies or rehashes a string.
+  //
 
   class LocalMap {
   public:
@@ -890,25 +1071,40 @@ private:
       m_destructed = true;
     }
 
-    auto get(const std::string &k) -> Str* {
+    auto get(const std::string &k, size_t hash) -> Str* {
       if (m_destructed) return nullptr;
-      auto i = m_hash.find(k);
+      auto i = m_hash.find(Key{ &k, hash });
       if (i == m_hash.end()) return nullptr;
       return i->second;
     }
 
-    void set(const std::string &k, Str *s) {
+    void set(const CharData *k, Str *s) {
       if (m_destructed) return;
-      m_hash[k] = s;
+      m_hash[Key{ &k->str(), k->hash() }] = s;
     }
 
-    void erase(const std::string &k) {
+    void erase(const CharData *k) {
       if (m_destructed) return;
-      m_hash.erase(k);
+      m_hash.erase(Key{ &k->str(), k->hash() });
     }
 
   private:
-    std::unordered_map<std::string, Str*> m_hash;
+    struct Key {
+      const std::string *str;
+      size_t hash;
+    };
+
+    struct Hash {
+      size_t operator()(const Key &k) const { return k.hash; }
+    };
+
+    struct EqualTo {
+      bool operator()(const Key &a, const Key &b) const {
+        return a.hash == b.hash && *a.str == *b.str;
+      }
+    };
+
+    std::unordered_map<Key, Str*, Hash, EqualTo> m_hash;
     bool m_destructed = false;
   };
 
@@ -924,15 +1120,12 @@ private:
     , m_thread_id(std::this_thread::get_id())
 #endif
   {
-    local_map().set(char_data->str(), this);
+    local_map().set(char_data, this);
   }
 
-  Str(const std::string &str) : Str(new CharData(std::string(str))) {}
-  Str(std::string &&str) : Str(new CharData(std::move(str))) {}
-
   ~Str() {
     assert_same_thread(*this);
-    local_map().erase(m_char_data->str());
+    local_map().erase(m_char_data);
   }
 
   static size_t s_max_size;
@@ -1715,8 +1908,7 @@ template<>
 struct hash<pjs::Value> {
   size_t operator()(const pjs::Value &v) const {
     if (v.is_string()) {
-      hash<std::string> h;
-      return h(v.s()->str());
+      return v.s()->hash();
     } else if (v.is_object()) {
       hash<pjs::Object*> h;
       return h(v.o());
@@ -1797,6 +1989,8 @@ public:
     ht_set(s, val);
   }
 
+  // Properties in the hash are passed as copies, since the callback
+  // may add or delete properties and move the entries around
   void iterate_all(const std::function<void(Str*, Value&)> &callback);
   bool iterate_while(const std::function<bool(Str*, Value&)> &callback);
   bool iterate_hash(const std::function<bool(Str*, Value&)> &callback);
@@ -1856,6 +2050,7 @@ private:
 
   friend class RefCount<Object>;
   friend class Class;
+  friend class PropertyCache;
 };
 
 template<class T, class Base = Object>
@@ -2090,7 +2285,9 @@ inline void Object::iterate_all(const std::function<void(Str*, Value&)> &callbac
   if (m_hash) {
     OrderedHash<Ref<Str>, Value>::Iterator iterator(m_hash);
     while (auto *ent = iterator.next()) {
-      callback(ent->k, ent->v);
+      Ref<Str> k(ent->k);
+      Value v(ent->v);
+      callback(k, v);
     }
   }
 }
@@ -2116,7 +2313,9 @@ inline bool Object::iterate_hash(const std::function<bool(Str*, Value&)> &callba
   if (m_hash) {
     OrderedHash<Ref<Str>, Value>::Iterator iterator(m_hash);
     while (auto *ent = iterator.next()) {
-      if (!callback(ent->k, ent->v)) {
+      Ref<Str> k(ent->k);
+      Value v(ent->v);
+      if (!callback(k, v)) {
         return false;
       }
     }
@@ -2136,6 +2335,7 @@ public:
   auto global() const -> Object* { return m_global; }
   auto module(int i) const -> Module* { return m_modules[i]; }
   auto new_fiber() -> Fiber*;
+  auto collect(size_t limit) -> size_t;
 
 private:
   void add(Scope *scope);
@@ -2144,6 +2344,7 @@ private:
   Ref<Object> m_global;
   std::vector<Module*> m_modules;
   Scope* m_scopes = nullptr;
+  Scope* m_collect_cursor = nullptr;
 
   friend class Module;
   friend class Scope;
@@ -2224,6 +2425,8 @@ public:
     }
   }
 
+  void reparent(Scope *parent) { m_parent = parent; }
+
 private:
   Scope(Instance *instance, Scope *parent, size_t size, std::vector<Variable> &variables)
     : m_instance(instance)
@@ -2330,6 +2533,14 @@ public:
     return scope;
   }
 
+  // Same as new_scope() but with a scope left over from an earlier call
+  auto reuse_scope(int argc, Scope *scope) -> Scope* {
+    scope->reparent(m_scope);
+    scope->init(std::min(m_argc, argc), m_argv);
+    m_scope = scope;
+    return scope;
+  }
+
   bool is_undefined(int i) const { return i >= argc() || arg(i).is_undefined(); }
   bool is_null(int i) const { return i < argc() && arg(i).is_null(); }
   bool is_nullish(int i) const { return i < argc() && arg(i).is_nullish(); }
@@ -2776,7 +2987,35 @@ public:
 
   auto constructor_class() const -> Class* { return m_constructor_class; }
 
+  //
+  // Method::Profiling
+  //
+  // While a sampling profiler is installed, every call tags the calling
+  // thread with the id the profiler handed out for the method.
+  //
+
+  class Profiling {
+  public:
+    static void install(int (*hook)(Method*)) { s_hook.store(hook); }
+    static auto current() -> int { return s_current; }
+
+    Profiling(Method *m) : m_saved(s_current) {
+      if (auto hook = s_hook.load(std::memory_order_relaxed)) {
+        if (!m->m_profile_id) m->m_profile_id = hook(m);
+        s_current = m->m_profile_id;
+      }
+    }
+
+    ~Profiling() { s_current = m_saved; }
+
+  private:
+    int m_saved;
+    static std::atomic<int(*)(Method*)> s_hook;
+    thread_local static int s_current;
+  };
+
   void invoke(Context &ctx, Scope *scope, Object *thiz, int argc, Value argv[], Value &retv) {
+    Profiling profiling(this);
     Context fctx(ctx, argc, argv, scope);
     retv = Value::undefined;
     if (fctx.level() > 100) {
@@ -2810,6 +3049,7 @@ private:
 
   std::function<void(Context&, Object*, Value&)> m_invoke;
   Class* m_constructor_class;
+  int m_profile_id = 0;
 };
 
 template<class T>
@@ -3074,6 +3314,10 @@ public:
     Function *on_finally = nullptr
   ) -> Promise*;
 
+  // Delivers the result straight to native code without
+  // creating functions for the callback or a chained promise
+  void then(Callback *callback);
+
 private:
 
   //
@@ -3094,6 +3338,8 @@ private:
       const Value &rejected_value
     );
 
+    Then(Callback *callback) : m_callback(callback) {}
+
     void execute(State state, const Value &result);
     void execute(Context *ctx, State state, const Value &result);
 
@@ -3102,6 +3348,7 @@ private:
     Ref<Function> m_on_resolved;
     Ref<Function> m_on_rejected;
     Ref<Function> m_on_finally;
+    Ref<Callback> m_callback;
     Ref<Promise> m_promise;
     Value m_resolved_value;
     Value m_rejected_value;
@@ -3304,7 +3551,11 @@ public:
       val = obj->data()->at(static_cast<Variable*>(f)->index());
       return;
     }
-    obj->ht_get(key, val);
+    if (auto e = find_entry(obj)) {
+      val = e->v;
+    } else {
+      val = Value::undefined;
+    }
   }
 
   void set(Object *obj, Str *key, const Value &val) {
@@ -3320,24 +3571,71 @@ public:
         obj->data()->at(static_cast<Variable*>(f)->index()) = val;
         return;
       }
+      obj->ht_set(key, val);
+      return;
+    }
+    if (auto e = find_entry(obj)) {
+      e->v = val;
+    } else {
+      obj->ht_set(key, val);
     }
-    obj->ht_set(key, val);
   }
 
 private:
+
+  //
+  // Up to POLYMORPHISM classes are remembered per key so that a site
+  // seeing a few different object layouts doesn't thrash. Properties
+  // kept in the object's hash are remembered by their entry, which
+  // stays valid for as long as the hash has the same shape. The hash is
+  // not retained, and is recognized by its id rather than its address.
+  //
+
+  enum { POLYMORPHISM = 4 };
+
+  typedef OrderedHash<Ref<Str>, Value> Hash;
+
+  struct Shape {
+    Ref<Class> type;
+    int index = -1;
+  };
+
   Ref<Str> m_const_key;
   Ref<Str> m_key;
-  Ref<Class> m_class;
-  int m_index = -1;
+  Shape m_shapes[POLYMORPHISM];
+  unsigned m_shape_count = 0;
+  uint64_t m_hash_id = 0;
+  uint32_t m_hash_shape = 0;
+  Hash::Entry* m_entry = nullptr;
 
   int find(Class *type, Str *key) {
-    auto i = m_index;
-    if (type != m_class || key != m_key) {
-      m_class = type;
+    if (key != m_key) {
       m_key = key;
-      m_index = (i = type->find_field(key));
+      m_shape_count = 0;
+      m_hash_id = 0;
+    }
+    auto n = std::min(m_shape_count, unsigned(POLYMORPHISM));
+    for (unsigned i = 0; i < n; i++) {
+      const auto &s = m_shapes[i];
+      if (s.type == type) return s.index;
+    }
+    auto &s = m_shapes[m_shape_count++ % POLYMORPHISM];
+    s.type = type;
+    s.index = type->find_field(key);
+    return s.index;
+  }
+
+  auto find_entry(Object *obj) -> Hash::Entry* {
+    auto h = obj->m_hash.get();
+    if (!h) return nullptr;
+    if (h->id() == m_hash_id && h->shape() == m_hash_shape) return m_entry;
+    auto e = h->find(m_key);
+    if (e) {
+      m_hash_id = h->id();
+      m_hash_shape = h->shape();
+      m_entry = e;
     }
-    return i;
+    return e;
   }
 };
 
@@ -3797,32 +4095,108 @@ public:
   }
 };
 
+//
+// Uint8Array
+//
+// Bytes are kept unboxed in a buffer that can be shared between
+// arrays made by subarray(), so that numeric and binary work in
+// scripts does not go through a Value for every element.
+//
+
+class Uint8Array : public ObjectTemplate<Uint8Array> {
+public:
+  static const size_t MAX_SIZE = 0x4000000;
+
+  auto length() const -> int { return m_length; }
+  auto bytes() const -> uint8_t* { return m_buffer->bytes.data() + m_offset; }
+
+  auto get(int i) const -> int {
+    return (0 <= i && i < m_length) ? bytes()[i] : -1;
+  }
+
+  void set(int i, const Value &v) {
+    if (0 <= i && i < m_length) bytes()[i] = v.to_int32();
+  }
+
+  void fill(int v, int start, int end);
+  void set(const uint8_t *src, int count, int offset);
+  auto slice(int start, int end) -> Uint8Array*;
+  auto subarray(int start, int end) -> Uint8Array*;
+
+private:
+  struct Buffer : public RefCount<Buffer> {
+    std::vector<uint8_t> bytes;
+    Buffer(size_t size) : bytes(size) {}
+  };
+
+  Uint8Array(int length);
+  Uint8Array(const uint8_t *bytes, int length);
+  Uint8Array(Array *array);
+  Uint8Array(Buffer *buffer, int offset, int length)
+    : m_buffer(buffer), m_offset(offset), m_length(length) {}
+
+  Ref<Buffer> m_buffer;
+  int m_offset = 0;
+  int m_length = 0;
+
+  void range(int &start, int &end) const;
+
+  friend class ObjectTemplate<Uint8Array>;
+};
+
 //
 // RegExp
 //
 
 class RegExp : public ObjectTemplate<RegExp> {
 public:
-  auto regex() const -> const std::regex& { return m_regex; }
-
   auto source() const -> Str* { return m_source; }
   bool global() const { return m_global; }
-  bool ignore_case() const { return m_regex.flags() & std::regex::icase; }
+  bool ignore_case() const { return m_ignore_case; }
   auto last_index() const -> int { return m_last_index; }
 
   auto exec(Str *str) -> Array*;
   bool test(Str *str);
 
+  //
+  // Searches with the linear-time engine when the pattern allows,
+  // otherwise with std::regex. Group offsets are stored in pairs
+  // relative to 'begin', with -1 for groups that did not participate.
+  //
+
+  template<class Iterator>
+  bool search(Iterator begin, Iterator end, int start, std::vector<int> &groups) const {
+    if (m_linear) return m_linear->search(begin, end, start, groups);
+    auto i = begin;
+    std::advance(i, start);
+    std::match_results<Iterator> m;
+    auto flags = start > 0 ? std::regex_constants::match_prev_avail : std::regex_constants::match_default;
+    if (!std::regex_search(i, end, m, m_regex, flags)) return false;
+    groups.resize(m.size() * 2);
+    for (size_t n = 0; n < m.size(); n++) {
+      if (m[n].matched) {
+        groups[n*2+0] = start + std::distance(i, m[n].first);
+        groups[n*2+1] = start + std::distance(i, m[n].second);
+      } else {
+        groups[n*2+0] = groups[n*2+1] = -1;
+      }
+    }
+    return true;
+  }
+
 private:
   RegExp(Str *pattern);
   RegExp(Str *pattern, Str *flags);
 
   Ref<Str> m_source;
+  std::shared_ptr<Regex> m_linear;
   std::regex m_regex;
-  std::smatch m_match;
   bool m_global;
+  bool m_ignore_case;
   int m_last_index = 0;
 
+  void compile(Str *pattern, Str *flags);
+
   static auto chars_to_flags(Str *chars, bool &global) -> std::regex::flag_type;
 
   friend class ObjectTemplate<RegExp>;
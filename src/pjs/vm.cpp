@@ -0,0 +1,373 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "vm.hpp"
+#include "expr.hpp"
+#include "stmt.hpp"
+
+namespace pjs {
+namespace vm {
+
+//
+// Code
+//
+
+bool Code::s_enabled = true;
+
+auto Code::compile(Module *module, Stmt *body) -> Code* {
+  if (!s_enabled) return nullptr;
+
+  auto code = new Code;
+  code->m_module = module;
+
+  Compiler c(code);
+  body->compile(c);
+  auto r = c.alloc();
+  c.emit(Opcode::UNDEFINED, r);
+  c.emit(Opcode::RETURN, r);
+
+  // Nothing to gain if the whole body is left to the tree-walker
+  for (const auto &i : code->m_instructions) {
+    switch (i.op) {
+      case Opcode::UNDEFINED:
+      case Opcode::EXEC:
+      case Opcode::RETURN:
+        continue;
+      default:
+        return code;
+    }
+  }
+
+  delete code;
+  return nullptr;
+}
+
+void Code::run(Context &ctx, Value &result) {
+  vl_array<Value, 32> regs(m_registers);
+  auto scope = ctx.scope();
+  auto code = m_instructions.data();
+  auto pc = code;
+
+  auto error = [&](const Instruction &i, const char *msg) {
+    ctx.error(msg);
+    ctx.backtrace(i.tree->source(), i.tree->line(), i.tree->column());
+  };
+
+  for (;;) {
+    const auto &i = *pc++;
+    switch (i.op) {
+      case Opcode::UNDEFINED:
+        regs[i.r] = Value::undefined;
+        break;
+      case Opcode::CONST:
+        regs[i.r] = m_constants[i.a];
+        break;
+      case Opcode::LOAD_LOCAL: {
+        auto s = scope;
+        for (int n = i.b; n > 0; n--) s = s->parent();
+        regs[i.r] = s->value(i.a);
+        break;
+      }
+      case Opcode::STORE_LOCAL: {
+        auto s = scope;
+        for (int n = i.b; n > 0; n--) s = s->parent();
+        s->value(i.a) = regs[i.r];
+        break;
+      }
+      case Opcode::GET_PROP: {
+        const auto &obj = regs[i.a];
+        if (obj.is_undefined()) return error(i, "cannot read property of undefined");
+        if (obj.is_null()) return error(i, "cannot read property of null");
+        expr::Property::get(obj, regs[i.b], m_caches[i.c], regs[i.r]);
+        break;
+      }
+      case Opcode::SET_PROP: {
+        const auto &obj = regs[i.a];
+        if (obj.is_undefined()) return error(i, "cannot set property of undefined");
+        if (obj.is_null()) return error(i, "cannot set property of null");
+        expr::Property::set(obj, regs[i.b], m_caches[i.c], regs[i.r]);
+        break;
+      }
+      case Opcode::CALL: {
+        const auto &f = regs[i.a];
+        if (!f.is_function()) return error(i, "not a function");
+        ctx.trace(m_module, i.tree->line(), i.tree->column());
+        (*f.as<Function>())(ctx, i.c, regs + i.b, regs[i.r]);
+        if (!ctx.ok()) {
+          ctx.backtrace(i.tree->source(), i.tree->line(), i.tree->column());
+          return;
+        }
+        break;
+      }
+      case Opcode::CALL_LITERAL: {
+        auto inv = static_cast<expr::Invocation*>(i.tree);
+        ctx.trace(m_module, i.tree->line(), i.tree->column());
+        inv->literal()->call(ctx, i.c, regs + i.b, regs[i.r]);
+        if (!ctx.ok()) {
+          ctx.backtrace(i.tree->source(), i.tree->line(), i.tree->column());
+          return;
+        }
+        break;
+      }
+      case Opcode::NOT:
+        regs[i.r].set(!regs[i.a].to_boolean());
+        break;
+      case Opcode::ADD: expr::Addition::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::SUB: expr::Subtraction::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::MUL: expr::Multiplication::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::DIV: expr::Division::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::REM: expr::Remainder::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::EQL: expr::Equality::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::NEQ: expr::Inequality::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::SAME: expr::Identity::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::DIFF: expr::Nonidentity::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::GT: expr::GreaterThan::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::GE: expr::GreaterThanOrEqual::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::LT: expr::LessThan::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::LE: expr::LessThanOrEqual::operate(regs[i.a], regs[i.b], regs[i.r]); break;
+      case Opcode::JUMP:
+        pc = code + i.a;
+        break;
+      case Opcode::JUMP_IF_FALSE:
+        if (!regs[i.r].to_boolean()) pc = code + i.a;
+        break;
+      case Opcode::JUMP_IF_TRUE:
+        if (regs[i.r].to_boolean()) pc = code + i.a;
+        break;
+      case Opcode::JUMP_IF_VALUE: {
+        const auto &v = regs[i.r];
+        if (!v.is_undefined() && !v.is_null()) pc = code + i.a;
+        break;
+      }
+      case Opcode::EVAL:
+        if (!static_cast<Expr*>(i.tree)->eval(ctx, regs[i.r])) return;
+        break;
+      case Opcode::EXEC: {
+        Stmt::Result res;
+        static_cast<Stmt*>(i.tree)->execute(ctx, res);
+        if (!ctx.ok()) return;
+        if (!res.is_done()) {
+          if (res.is_return()) {
+            result = res.value;
+          } else {
+            result = Value::undefined;
+          }
+          return;
+        }
+        break;
+      }
+      case Opcode::RETURN:
+        result = regs[i.r];
+        return;
+    }
+  }
+}
+
+//
+// ConstantFolder
+//
+// Reduces an expression to a value when all its operands are literals.
+// Anything depending on run-time state reduces to nullptr, which
+// poisons every operation it takes part in.
+//
+
+class ConstantFolder : public Expr::Reducer {
+public:
+  class Constant : public Pooled<Constant, Expr::Reducer::Value> {
+  public:
+    Constant(const pjs::Value &v) : value(v) {}
+    pjs::Value value;
+  };
+
+  static auto constant(Value *v) -> Constant* {
+    return static_cast<Constant*>(v);
+  }
+
+  virtual void free(Value *val) override {
+    delete constant(val);
+  }
+
+private:
+  template<class F>
+  auto unary(Value *x, F f) -> Value* {
+    if (!x) return nullptr;
+    auto ret = new Constant(pjs::Value::undefined);
+    f(constant(x)->value, ret->value);
+    free(x);
+    return ret;
+  }
+
+  auto binary(Value *a, Value *b, void (*f)(const pjs::Value&, const pjs::Value&, pjs::Value&)) -> Value* {
+    Value *ret = nullptr;
+    if (a && b) {
+      auto c = new Constant(pjs::Value::undefined);
+      f(constant(a)->value, constant(b)->value, c->value);
+      ret = c;
+    }
+    free(a);
+    free(b);
+    return ret;
+  }
+
+  virtual Value* null() override { return new Constant(pjs::Value::null); }
+  virtual Value* boolean(bool b) override { return new Constant(b); }
+  virtual Value* number(double n) override { return new Constant(n); }
+  virtual Value* string(const std::string &s) override { return new Constant(Str::make(s)); }
+
+  virtual Value* pos(Value *x) override {
+    return unary(x, [](const pjs::Value &x, pjs::Value &r) { r.set(x.to_number()); });
+  }
+
+  virtual Value* neg(Value *x) override {
+    return unary(x, [](const pjs::Value &x, pjs::Value &r) { r.set(-x.to_number()); });
+  }
+
+  virtual Value* bool_not(Value *x) override {
+    return unary(x, [](const pjs::Value &x, pjs::Value &r) { r.set(!x.to_boolean()); });
+  }
+
+  virtual Value* add(Value *a, Value *b) override { return binary(a, b, expr::Addition::operate); }
+  virtual Value* sub(Value *a, Value *b) override { return binary(a, b, expr::Subtraction::operate); }
+  virtual Value* mul(Value *a, Value *b) override { return binary(a, b, expr::Multiplication::operate); }
+  virtual Value* div(Value *a, Value *b) override { return binary(a, b, expr::Division::operate); }
+  virtual Value* rem(Value *a, Value *b) override { return binary(a, b, expr::Remainder::operate); }
+  virtual Value* eql(Value *a, Value *b) override { return binary(a, b, expr::Equality::operate); }
+  virtual Value* neq(Value *a, Value *b) override { return binary(a, b, expr::Inequality::operate); }
+  virtual Value* same(Value *a, Value *b) override { return binary(a, b, expr::Identity::operate); }
+  virtual Value* diff(Value *a, Value *b) override { return binary(a, b, expr::Nonidentity::operate); }
+  virtual Value* gt(Value *a, Value *b) override { return binary(a, b, expr::GreaterThan::operate); }
+  virtual Value* ge(Value *a, Value *b) override { return binary(a, b, expr::GreaterThanOrEqual::operate); }
+  virtual Value* lt(Value *a, Value *b) override { return binary(a, b, expr::LessThan::operate); }
+  virtual Value* le(Value *a, Value *b) override { return binary(a, b, expr::LessThanOrEqual::operate); }
+
+  virtual Value* bool_and(Value *a, Value *b) override {
+    if (!a) { free(b); return nullptr; }
+    if (!constant(a)->value.to_boolean()) { free(b); return a; }
+    free(a);
+    return b;
+  }
+
+  virtual Value* bool_or(Value *a, Value *b) override {
+    if (!a) { free(b); return nullptr; }
+    if (constant(a)->value.to_boolean()) { free(b); return a; }
+    free(a);
+    return b;
+  }
+
+  virtual Value* null_or(Value *a, Value *b) override {
+    if (!a) { free(b); return nullptr; }
+    if (!constant(a)->value.is_null()) { free(b); return a; }
+    free(a);
+    return b;
+  }
+
+  virtual Value* select(Value *a, Value *b, Value *c) override {
+    if (!a) { free(b); free(c); return nullptr; }
+    auto cond = constant(a)->value.to_boolean();
+    free(a);
+    if (cond) { free(c); return b; }
+    free(b);
+    return c;
+  }
+};
+
+//
+// Compiler
+//
+
+auto Compiler::alloc(int n) -> int {
+  auto r = m_top;
+  m_top += n;
+  if (m_top > m_code->m_registers) m_code->m_registers = m_top;
+  return r;
+}
+
+void Compiler::emit(Opcode op, int r, int a, int b, int c, Tree *tree) {
+  Instruction i;
+  i.op = op;
+  i.r = r;
+  i.a = a;
+  i.b = b;
+  i.c = c;
+  i.tree = tree;
+  m_code->m_instructions.push_back(i);
+}
+
+auto Compiler::emit_jump(Opcode op, int r) -> int {
+  auto jump = position();
+  emit(op, r);
+  return jump;
+}
+
+void Compiler::emit_const(int r, const Value &v) {
+  auto &constants = m_code->m_constants;
+  int i = constants.size();
+  constants.push_back(v);
+  emit(Opcode::CONST, r, i);
+}
+
+void Compiler::emit_cache(Opcode op, int r, int a, int b, Tree *tree) {
+  auto &caches = m_code->m_caches;
+  int i = caches.size();
+  caches.emplace_back();
+  emit(op, r, a, b, i, tree);
+}
+
+void Compiler::emit_binary(Opcode op, int r, Expr *a, Expr *b) {
+  auto top = m_top;
+  auto ra = alloc();
+  auto rb = alloc();
+  a->compile(*this, ra);
+  b->compile(*this, rb);
+  emit(op, r, ra, rb);
+  m_top = top;
+}
+
+bool Compiler::fold(Expr *expr, Value &result) {
+  ConstantFolder f;
+  auto v = expr->reduce(f);
+  if (!v) return false;
+  result = ConstantFolder::constant(v)->value;
+  f.free(v);
+  return true;
+}
+
+bool Compiler::emit_folded(Expr *expr, int r) {
+  Value v;
+  if (!fold(expr, v)) return false;
+  emit_const(r, v);
+  return true;
+}
+
+void Compiler::emit_eval(Expr *expr, int r) {
+  emit(Opcode::EVAL, r, 0, 0, 0, expr);
+}
+
+void Compiler::emit_exec(Stmt *stmt) {
+  emit(Opcode::EXEC, 0, 0, 0, 0, stmt);
+}
+
+} // namespace vm
+} // namespace pjs
@@ -0,0 +1,150 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PJS_VM_HPP
+#define PJS_VM_HPP
+
+#include "types.hpp"
+
+#include <vector>
+
+namespace pjs {
+
+class Tree;
+class Expr;
+class Stmt;
+class Module;
+
+namespace vm {
+
+//
+// Opcode
+//
+
+enum class Opcode : uint8_t {
+  UNDEFINED,      // r = undefined
+  CONST,          // r = constants[a]
+  LOAD_LOCAL,     // r = scope(b).value(a)
+  STORE_LOCAL,    // scope(b).value(a) = r
+  GET_PROP,       // r = a[b]
+  SET_PROP,       // a[b] = r
+  CALL,           // r = a(b, b+1, ... b+c-1)
+  CALL_LITERAL,   // r = tree(b, b+1, ... b+c-1) with tree being a function literal
+  NOT,            // r = !a
+  ADD,            // r = a + b
+  SUB,            // r = a - b
+  MUL,            // r = a * b
+  DIV,            // r = a / b
+  REM,            // r = a % b
+  EQL,            // r = a == b
+  NEQ,            // r = a != b
+  SAME,           // r = a === b
+  DIFF,           // r = a !== b
+  GT,             // r = a > b
+  GE,             // r = a >= b
+  LT,             // r = a < b
+  LE,             // r = a <= b
+  JUMP,           // goto a
+  JUMP_IF_FALSE,  // if (!r) goto a
+  JUMP_IF_TRUE,   // if (r) goto a
+  JUMP_IF_VALUE,  // if (r !== undefined && r !== null) goto a
+  EVAL,           // r = tree (evaluated by the tree-walker)
+  EXEC,           // tree (executed by the tree-walker), return if not completed
+  RETURN,         // return r
+};
+
+//
+// Instruction
+//
+
+struct Instruction {
+  Opcode op;
+  int r, a, b, c;
+  Tree* tree;
+};
+
+//
+// Code
+//
+
+class Code {
+public:
+  static auto compile(Module *module, Stmt *body) -> Code*;
+
+  // When disabled, compile() gives nothing and every function body
+  // is left to the tree-walker
+  static void enable(bool b) { s_enabled = b; }
+
+  void run(Context &ctx, Value &result);
+
+private:
+  static bool s_enabled;
+
+  Module* m_module;
+  std::vector<Instruction> m_instructions;
+  std::vector<Value> m_constants;
+  std::vector<PropertyCache> m_caches;
+  int m_registers = 0;
+
+  friend class Compiler;
+};
+
+//
+// Compiler
+//
+
+class Compiler {
+public:
+  Compiler(Code *code) : m_code(code) {}
+
+  // Registers are allocated as a stack
+  auto alloc(int n = 1) -> int;
+  auto top() const -> int { return m_top; }
+  void reset(int top) { m_top = top; }
+
+  auto position() const -> int { return m_code->m_instructions.size(); }
+  void rewind(int position) { m_code->m_instructions.resize(position); }
+  void emit(Opcode op, int r = 0, int a = 0, int b = 0, int c = 0, Tree *tree = nullptr);
+  auto emit_jump(Opcode op, int r = 0) -> int;
+  void patch(int jump) { m_code->m_instructions[jump].a = position(); }
+  void emit_const(int r, const Value &v);
+  void emit_cache(Opcode op, int r, int a, int b, Tree *tree);
+  void emit_binary(Opcode op, int r, Expr *a, Expr *b);
+  void emit_eval(Expr *expr, int r);
+  void emit_exec(Stmt *stmt);
+
+  // Evaluates an expression made up of nothing but literals
+  bool fold(Expr *expr, Value &result);
+  bool emit_folded(Expr *expr, int r);
+
+private:
+  Code* m_code;
+  int m_top = 0;
+};
+
+} // namespace vm
+} // namespace pjs
+
+#endif // PJS_VM_HPP
@@ -0,0 +1,274 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "profiler.hpp"
+#include "filter.hpp"
+#include "pipeline.hpp"
+#include "worker-thread.hpp"
+#include "api/protobuf.hpp"
+#include "pjs/pjs.hpp"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+namespace pipy {
+
+static Data::Producer s_dp("Profiler");
+
+std::mutex Profiler::s_names_mutex;
+std::vector<std::string> Profiler::s_names(1);
+std::map<std::string, int> Profiler::s_name_ids;
+std::atomic<bool> Profiler::s_running(false);
+std::atomic<size_t> Profiler::s_sample_count(0);
+Profiler::Sample Profiler::s_samples[MAX_SAMPLES];
+thread_local int Profiler::s_current_thread = 0;
+thread_local int Profiler::s_current_filter = 0;
+
+static auto current_thread_name() -> std::string {
+  if (auto *wt = WorkerThread::current()) {
+    return "worker " + std::to_string(wt->index());
+  } else if (Net::is_main()) {
+    return "main";
+  } else {
+    return "(other thread)";
+  }
+}
+
+//
+// Profiler::Scope
+//
+
+Profiler::Scope::Scope(Filter *filter) : m_saved(s_current_filter) {
+  if (!s_current_thread) s_current_thread = intern(current_thread_name());
+  if (!filter->m_profile_id) {
+    Filter::Dump d;
+    filter->dump(d);
+    std::string name;
+    if (auto *p = filter->pipeline()) {
+      name += p->layout()->name_or_label()->str();
+      name += " | ";
+    }
+    name += d.name;
+    auto &loc = filter->location();
+    if (loc.source) {
+      name += " (";
+      name += loc.source->filename;
+      name += ':';
+      name += std::to_string(loc.line);
+      name += ')';
+    }
+    filter->m_profile_id = intern(name);
+  }
+  s_current_filter = filter->m_profile_id;
+  Data::Sampler::set_site(s_current_filter);
+}
+
+//
+// Profiler
+//
+
+bool Profiler::start(int frequency) {
+#ifdef _WIN32
+  return false;
+#else
+  if (frequency <= 0 || s_running.exchange(true)) return false;
+
+  s_sample_count.store(0);
+  pjs::Method::Profiling::install(intern_method);
+
+  struct sigaction sa;
+  std::memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, nullptr);
+
+  struct itimerval tv;
+  auto usec = std::max(1, 1000000 / frequency);
+  tv.it_interval.tv_sec = usec / 1000000;
+  tv.it_interval.tv_usec = usec % 1000000;
+  tv.it_value = tv.it_interval;
+  setitimer(ITIMER_PROF, &tv, nullptr);
+  return true;
+#endif
+}
+
+void Profiler::stop() {
+#ifndef _WIN32
+  if (!s_running) return;
+
+  struct itimerval tv;
+  std::memset(&tv, 0, sizeof(tv));
+  setitimer(ITIMER_PROF, &tv, nullptr);
+  signal(SIGPROF, SIG_IGN);
+
+  pjs::Method::Profiling::install(nullptr);
+  s_running.store(false);
+#endif
+}
+
+void Profiler::collect(std::map<std::string, size_t> &stacks) {
+  auto n = std::min(s_sample_count.load(), MAX_SAMPLES);
+  for (size_t i = 0; i < n; i++) {
+    const auto &s = s_samples[i];
+    std::string key(s.thread ? name_of(s.thread) : "(other thread)");
+    key += ';';
+    key += (s.filter ? name_of(s.filter) : "(outside pipelines)");
+    if (s.method) {
+      key += ';';
+      key += name_of(s.method);
+    }
+    stacks[key]++;
+  }
+}
+
+void Profiler::retainers(std::map<std::string, size_t> &sizes) {
+  Data::Sampler::collect(
+    [&](int site, size_t size) {
+      auto name = (site ? name_of(site) : std::string());
+      sizes[name.empty() ? "(outside pipelines)" : name] += size;
+    }
+  );
+}
+
+void Profiler::folded(const std::map<std::string, size_t> &stacks, Data &out) {
+  Data::Builder db(out, &s_dp);
+  for (const auto &p : stacks) {
+    db.push(p.first);
+    db.push(' ');
+    db.push(std::to_string(p.second));
+    db.push('\n');
+  }
+  db.flush();
+}
+
+//
+// Encodes a profile.proto message as understood by pprof. Every distinct
+// frame becomes a function with a location of the same id.
+//
+
+void Profiler::pprof(const std::map<std::string, size_t> &stacks, int frequency, double duration, Data &out) {
+  std::vector<std::string> strings(1);
+  std::map<std::string, uint64_t> string_ids;
+  std::map<std::string, uint64_t> function_ids;
+
+  auto str = [&](const std::string &s) -> uint64_t {
+    auto r = string_ids.emplace(s, strings.size());
+    if (r.second) strings.push_back(s);
+    return r.first->second;
+  };
+
+  auto value_type = [&](const char *type, const char *unit) {
+    Data buf;
+    Protobuf::Writer w(buf);
+    w.varint(1, str(type));
+    w.varint(2, str(unit));
+    w.flush();
+    return buf;
+  };
+
+  uint64_t period = 1000000000ull / std::max(1, frequency);
+
+  Protobuf::Writer w(out);
+  w.message(1, value_type("samples", "count"));
+  w.message(1, value_type("cpu", "nanoseconds"));
+
+  for (const auto &p : stacks) {
+    std::vector<std::string> frames;
+    for (const auto &f : utils::split(p.first, ';')) frames.push_back(f);
+    Data sample;
+    Protobuf::Writer ws(sample);
+    for (auto i = frames.rbegin(); i != frames.rend(); i++) {
+      auto r = function_ids.emplace(*i, function_ids.size() + 1);
+      ws.varint(1, r.first->second);
+    }
+    ws.varint(2, p.second);
+    ws.varint(2, p.second * period);
+    ws.flush();
+    w.message(2, sample);
+  }
+
+  for (const auto &p : function_ids) {
+    Data line, location, function;
+    Protobuf::Writer wl(line);
+    wl.varint(1, p.second);
+    wl.flush();
+    Protobuf::Writer wloc(location);
+    wloc.varint(1, p.second);
+    wloc.message(4, line);
+    wloc.flush();
+    w.message(4, location);
+    Protobuf::Writer wf(function);
+    wf.varint(1, p.second);
+    wf.varint(2, str(p.first));
+    wf.varint(3, str(p.first));
+    wf.flush();
+    w.message(5, function);
+  }
+
+  Data period_type = value_type("cpu", "nanoseconds");
+  for (const auto &s : strings) w.string(6, s);
+  w.varint(10, uint64_t(duration * 1e9));
+  w.message(11, period_type);
+  w.varint(12, period);
+  w.flush();
+}
+
+auto Profiler::intern(const std::string &name) -> int {
+  std::lock_guard<std::mutex> lock(s_names_mutex);
+  auto r = s_name_ids.emplace(name, s_names.size());
+  if (r.second) s_names.push_back(name);
+  return r.first->second;
+}
+
+auto Profiler::name_of(int id) -> std::string {
+  std::lock_guard<std::mutex> lock(s_names_mutex);
+  if (id <= 0 || id >= s_names.size()) return std::string();
+  return s_names[id];
+}
+
+int Profiler::intern_method(pjs::Method *method) {
+  if (!s_current_thread) s_current_thread = intern(current_thread_name());
+  return intern(method->name()->str());
+}
+
+//
+// Only async-signal-safe work is done here: a few thread-local loads
+// and a store into a preallocated array.
+//
+
+void Profiler::on_signal(int) {
+  auto i = s_sample_count.fetch_add(1, std::memory_order_relaxed);
+  if (i < MAX_SAMPLES) {
+    auto &s = s_samples[i];
+    s.thread = s_current_thread;
+    s.filter = s_current_filter;
+    s.method = pjs::Method::Profiling::current();
+  }
+}
+
+} // namespace pipy
@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include "data.hpp"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pjs {
+  class Method;
+}
+
+namespace pipy {
+
+class Filter;
+
+//
+// Profiler
+//
+// A process-wide sampling profiler driven by SIGPROF. Filters and PipyJS
+// methods are given small integer ids the first time they run during a
+// profiling session. The signal handler only copies the ids current on
+// the interrupted thread, so names are resolved later from a table that
+// outlives the objects it describes.
+//
+// The same ids serve as sites for Data::Sampler, so chunks sampled while
+// a filter is running are counted against that filter until freed.
+//
+
+class Profiler {
+public:
+
+  //
+  // Profiler::Scope
+  //
+
+  class Scope {
+  public:
+    Scope(Filter *filter);
+    ~Scope() { s_current_filter = m_saved; Data::Sampler::set_site(m_saved); }
+
+  private:
+    int m_saved;
+  };
+
+  static bool running() { return s_running.load(std::memory_order_relaxed); }
+  static bool start(int frequency);
+  static void stop();
+
+  // Filters need a Scope while either kind of sampling is on
+  static bool tracking() { return running() || Data::Sampler::running(); }
+
+  // Stacks as "thread;filter;function" with sample counts
+  static void collect(std::map<std::string, size_t> &stacks);
+
+  // Estimated bytes of chunks kept alive per allocating filter
+  static void retainers(std::map<std::string, size_t> &sizes);
+
+  static void folded(const std::map<std::string, size_t> &stacks, Data &out);
+  static void pprof(const std::map<std::string, size_t> &stacks, int frequency, double duration, Data &out);
+
+private:
+  struct Sample {
+    int thread;
+    int filter;
+    int method;
+  };
+
+  static const size_t MAX_SAMPLES = 1 << 16;
+
+  static auto intern(const std::string &name) -> int;
+  static auto name_of(int id) -> std::string;
+  static int intern_method(pjs::Method *method);
+  static void on_signal(int sig);
+
+  static std::mutex s_names_mutex;
+  static std::vector<std::string> s_names;
+  static std::map<std::string, int> s_name_ids;
+  static std::atomic<bool> s_running;
+  static std::atomic<size_t> s_sample_count;
+  static Sample s_samples[MAX_SAMPLES];
+  thread_local static int s_current_thread;
+  thread_local static int s_current_filter;
+};
+
+} // namespace pipy
+
+#endif // PROFILER_HPP
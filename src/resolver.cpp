@@ -0,0 +1,522 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "resolver.hpp"
+#include "api/dns.hpp"
+#include "input.hpp"
+#include "log.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace pipy {
+
+typedef std::vector<asio::ip::address> Addresses;
+
+static const double CACHE_MIN_TTL = 1;
+static const double CACHE_MAX_TTL = 3600;
+static const double CACHE_DEFAULT_TTL = 30;
+static const double CACHE_MAX_STALE = 300;
+static const size_t CACHE_MAX_SIZE = 10000;
+static const double QUERY_TIMEOUT = 2;
+
+thread_local static const pjs::ConstStr s_id("id");
+thread_local static const pjs::ConstStr s_rd("rd");
+thread_local static const pjs::ConstStr s_tc("tc");
+thread_local static const pjs::ConstStr s_rcode("rcode");
+thread_local static const pjs::ConstStr s_question("question");
+thread_local static const pjs::ConstStr s_answer("answer");
+thread_local static const pjs::ConstStr s_name("name");
+thread_local static const pjs::ConstStr s_type("type");
+thread_local static const pjs::ConstStr s_ttl("ttl");
+thread_local static const pjs::ConstStr s_rdata("rdata");
+thread_local static const pjs::ConstStr s_A("A");
+thread_local static const pjs::ConstStr s_AAAA("AAAA");
+
+static Data::Producer s_dp("Resolver");
+
+//
+// Config
+//
+// Read once from /etc/resolv.conf and /etc/hosts. Names that would go
+// through the search list and names found in the hosts file are left to
+// getaddrinfo, whose answers are cached with a fixed TTL instead.
+//
+
+struct Config {
+  std::vector<asio::ip::udp::endpoint> nameservers;
+  std::unordered_set<std::string> hosts;
+  int ndots = 1;
+};
+
+static auto lower_case(const std::string &s) -> std::string {
+  std::string r(s);
+  for (auto &c : r) c = std::tolower(c);
+  return r;
+}
+
+static auto load_config() -> Config {
+  Config config;
+  std::string line;
+
+  std::ifstream resolv_conf("/etc/resolv.conf");
+  while (std::getline(resolv_conf, line)) {
+    std::istringstream ss(line);
+    std::string key, value;
+    ss >> key;
+    if (key == "nameserver") {
+      ss >> value;
+      std::error_code ec;
+      auto addr = asio::ip::make_address(value, ec);
+      if (!ec) config.nameservers.emplace_back(addr, 53);
+    } else if (key == "options") {
+      while (ss >> value) {
+        if (value.compare(0, 6, "ndots:") == 0) {
+          config.ndots = std::atoi(value.c_str() + 6);
+        }
+      }
+    }
+  }
+
+  std::ifstream hosts("/etc/hosts");
+  while (std::getline(hosts, line)) {
+    auto p = line.find('#');
+    if (p != std::string::npos) line.erase(p);
+    std::istringstream ss(line);
+    std::string addr, name;
+    if (!(ss >> addr)) continue;
+    while (ss >> name) config.hosts.insert(lower_case(name));
+  }
+
+  return config;
+}
+
+static auto config() -> const Config& {
+  static Config s_config = load_config();
+  return s_config;
+}
+
+//
+// Cache
+//
+
+struct CacheEntry {
+  Addresses addresses;
+  double expiration;
+};
+
+static std::mutex s_cache_mutex;
+static std::unordered_map<std::string, CacheEntry> s_cache;
+
+static void cache_set(const std::string &name, const Addresses &addresses, double ttl) {
+  ttl = std::max(CACHE_MIN_TTL, std::min(CACHE_MAX_TTL, ttl));
+  auto now = utils::now();
+  std::lock_guard<std::mutex> lock(s_cache_mutex);
+  if (s_cache.size() >= CACHE_MAX_SIZE) {
+    for (auto i = s_cache.begin(); i != s_cache.end(); ) {
+      if (now >= i->second.expiration + CACHE_MAX_STALE * 1000) {
+        i = s_cache.erase(i);
+      } else {
+        i++;
+      }
+    }
+    if (s_cache.size() >= CACHE_MAX_SIZE) s_cache.clear();
+  }
+  auto &e = s_cache[name];
+  e.addresses = addresses;
+  e.expiration = now + ttl * 1000;
+}
+
+// Returns 0 for a miss, 1 for a fresh hit and -1 for a stale hit
+static int cache_get(const std::string &name, Addresses &addresses, bool any_age = false) {
+  auto now = utils::now();
+  std::lock_guard<std::mutex> lock(s_cache_mutex);
+  auto i = s_cache.find(name);
+  if (i == s_cache.end()) return 0;
+  const auto &e = i->second;
+  if (now < e.expiration) {
+    addresses = e.addresses;
+    return 1;
+  }
+  if (any_age || now < e.expiration + CACHE_MAX_STALE * 1000) {
+    addresses = e.addresses;
+    return -1;
+  }
+  return 0;
+}
+
+//
+// Query
+//
+// One lookup in flight per name per thread. A and AAAA queries go to the
+// nameservers in turn over UDP, encoded and decoded by the DNS codec.
+// Truncated answers, errors and exhausted nameservers fall back to
+// getaddrinfo. A failed lookup answers with a stale entry if any.
+//
+// Since answers end up in the process-wide cache, a reply is only taken
+// when it comes from the nameserver asked, carries the unpredictable ID
+// of a pending question and repeats that question exactly. Anything else
+// is dropped as a possible spoofing attempt.
+//
+
+class Resolver::Query :
+  public pjs::Pooled<Resolver::Query>,
+  public pjs::RefCount<Resolver::Query>
+{
+public:
+  static auto get(const std::string &name) -> Query* {
+    auto i = s_queries.find(name);
+    if (i != s_queries.end()) return i->second;
+    auto q = new Query(name);
+    s_queries[name] = q;
+    q->start();
+    return q;
+  }
+
+  void add(Resolver::Handler *handler) {
+    handler->m_query = this;
+    m_handlers.push(handler);
+  }
+
+  void remove(Resolver::Handler *handler) {
+    handler->m_query = nullptr;
+    m_handlers.remove(handler);
+  }
+
+private:
+  Query(const std::string &name)
+    : m_name(name)
+    , m_socket(Net::context())
+    , m_resolver(Net::context()) {}
+
+  struct Question {
+    uint16_t id = 0;
+    pjs::Str* type = nullptr;
+    bool answered = false;
+    std::vector<uint8_t> packet;
+  };
+
+  std::string m_name;
+  List<Resolver::Handler> m_handlers;
+  asio::ip::udp::socket m_socket;
+  asio::ip::udp::endpoint m_from;
+  asio::ip::tcp::resolver m_resolver;
+  Timer m_timer;
+  Question m_questions[2];
+  uint8_t m_buffer[1500];
+  Addresses m_addresses;
+  double m_ttl = CACHE_MAX_TTL;
+  size_t m_server = 0;
+  bool m_done = false;
+
+  thread_local static std::unordered_map<std::string, Query*> s_queries;
+
+  void start() {
+    retain();
+    const auto &cfg = config();
+    if (
+      cfg.nameservers.empty() ||
+      cfg.hosts.count(m_name) ||
+      std::count(m_name.begin(), m_name.end(), '.') < cfg.ndots
+    ) {
+      lookup();
+    } else {
+      send(0);
+    }
+  }
+
+  void send(size_t server) {
+    const auto &nameservers = config().nameservers;
+    if (server >= nameservers.size()) {
+      lookup();
+      return;
+    }
+
+    const auto &ns = nameservers[server];
+    std::error_code ec;
+    m_server = server;
+    m_socket.close(ec);
+    m_socket.open(ns.protocol(), ec);
+    if (ec) {
+      send(server + 1);
+      return;
+    }
+
+    pjs::Str *types[] = { s_AAAA, s_A };
+    for (int i = 0; i < 2; i++) {
+      auto &q = m_questions[i];
+      if (RAND_bytes((unsigned char *)&q.id, sizeof(q.id)) <= 0) {
+        lookup();
+        return;
+      }
+      q.type = types[i];
+      q.answered = false;
+      try {
+        pjs::Ref<pjs::Object> question(pjs::Object::make());
+        question->set(s_name, pjs::Str::make(m_name));
+        question->set(s_type, types[i]);
+        pjs::Ref<pjs::Array> questions(pjs::Array::make());
+        questions->push(question.get());
+        pjs::Ref<pjs::Object> msg(pjs::Object::make());
+        msg->set(s_id, q.id);
+        msg->set(s_rd, 1);
+        msg->set(s_question, questions.get());
+        Data data;
+        Data::Builder db(data, &s_dp);
+        DNS::encode(msg, db);
+        db.flush();
+        q.packet = data.to_bytes();
+      } catch (std::runtime_error &) {
+        lookup();
+        return;
+      }
+      retain();
+      m_socket.async_send_to(
+        asio::buffer(q.packet), ns,
+        [this](const std::error_code &ec, std::size_t) {
+          release();
+        }
+      );
+    }
+
+    m_addresses.clear();
+    m_ttl = CACHE_MAX_TTL;
+    receive();
+
+    m_timer.schedule(
+      QUERY_TIMEOUT,
+      [this]() {
+        InputContext ic;
+        if (!m_addresses.empty()) {
+          complete(m_addresses, m_ttl);
+        } else {
+          send(m_server + 1);
+        }
+      }
+    );
+  }
+
+  void receive() {
+    retain();
+    m_socket.async_receive_from(
+      asio::buffer(m_buffer), m_from,
+      [this](const std::error_code &ec, std::size_t n) {
+        InputContext ic;
+        if (!ec && !m_done) on_receive(n);
+        release();
+      }
+    );
+  }
+
+  void on_receive(size_t size) {
+    if (m_from != config().nameservers[m_server]) {
+      receive();
+      return;
+    }
+
+    pjs::Ref<pjs::Object> msg;
+    try {
+      Data data(m_buffer, size, &s_dp);
+      msg = DNS::decode(data);
+    } catch (std::runtime_error &) {
+      receive();
+      return;
+    }
+
+    pjs::Value id, tc, rcode, answer;
+    msg->get(s_id, id);
+    msg->get(s_tc, tc);
+    msg->get(s_rcode, rcode);
+    msg->get(s_answer, answer);
+
+    Question *q = nullptr;
+    for (auto &i : m_questions) {
+      if (!i.answered && i.id == id.to_number()) q = &i;
+    }
+    if (!q || !is_answer_to(msg, q)) {
+      receive();
+      return;
+    }
+
+    if (tc.to_number() != 0) {
+      lookup();
+      return;
+    }
+
+    switch (int(rcode.to_number())) {
+      case 0: break; // NOERROR
+      case 3: break; // NXDOMAIN
+      default:
+        m_timer.cancel();
+        send(m_server + 1);
+        return;
+    }
+
+    q->answered = true;
+
+    if (answer.is_array()) {
+      answer.as<pjs::Array>()->iterate_all(
+        [this](pjs::Value &v, int) {
+          if (!v.is_object() || !v.o()) return;
+          pjs::Value type, ttl, rdata;
+          v.o()->get(s_type, type);
+          v.o()->get(s_ttl, ttl);
+          v.o()->get(s_rdata, rdata);
+          if (!type.is_string() || !rdata.is_string()) return;
+          if (type.s() != s_A && type.s() != s_AAAA) return;
+          std::error_code ec;
+          auto addr = asio::ip::make_address(rdata.s()->str(), ec);
+          if (ec) return;
+          m_addresses.push_back(addr);
+          m_ttl = std::min(m_ttl, ttl.to_number());
+        }
+      );
+    }
+
+    if (m_questions[0].answered && m_questions[1].answered) {
+      if (m_addresses.empty()) {
+        lookup();
+      } else {
+        complete(m_addresses, m_ttl);
+      }
+    } else {
+      receive();
+    }
+  }
+
+  bool is_answer_to(pjs::Object *msg, Question *q) {
+    thread_local static const pjs::ConstStr s_class("class");
+    pjs::Value question;
+    msg->get(s_question, question);
+    if (!question.is_array()) return false;
+    auto *a = question.as<pjs::Array>();
+    if (a->length() != 1) return false;
+    pjs::Value v, name, type, klass;
+    a->get(0, v);
+    if (!v.is_object() || !v.o()) return false;
+    v.o()->get(s_name, name);
+    v.o()->get(s_type, type);
+    v.o()->get(s_class, klass);
+    if (!klass.is_undefined()) return false; // Absent for class IN
+    if (!type.is_string() || type.s() != q->type) return false;
+    if (!name.is_string()) return false;
+    auto str = lower_case(name.s()->str());
+    if (!str.empty() && str.back() == '.') str.pop_back();
+    auto expected = lower_case(m_name);
+    if (!expected.empty() && expected.back() == '.') expected.pop_back();
+    return str == expected;
+  }
+
+  void lookup() {
+    std::error_code ec;
+    m_timer.cancel();
+    m_socket.close(ec);
+    retain();
+    m_resolver.async_resolve(
+      asio::ip::tcp::resolver::query(m_name, "0"),
+      [this](
+        const std::error_code &ec,
+        asio::ip::tcp::resolver::results_type results
+      ) {
+        InputContext ic;
+        if (!m_done) {
+          Addresses addresses;
+          if (!ec) {
+            for (const auto &r : results) {
+              const auto &addr = r.endpoint().address();
+              if (std::find(addresses.begin(), addresses.end(), addr) == addresses.end()) {
+                addresses.push_back(addr);
+              }
+            }
+          } else if (ec != asio::error::operation_aborted) {
+            Log::debug(Log::OUTBOUND, "[resolver] cannot resolve %s: %s", m_name.c_str(), ec.message().c_str());
+          }
+          complete(addresses, CACHE_DEFAULT_TTL);
+        }
+        release();
+      }
+    );
+  }
+
+  void complete(const Addresses &result, double ttl) {
+    std::error_code ec;
+    m_done = true;
+    m_timer.cancel();
+    m_socket.close(ec);
+    s_queries.erase(m_name);
+
+    Addresses addresses(result);
+    if (addresses.empty()) {
+      cache_get(m_name, addresses, true);
+    } else {
+      cache_set(m_name, addresses, ttl);
+    }
+
+    while (auto h = m_handlers.head()) {
+      remove(h);
+      h->on_resolve(addresses);
+    }
+
+    release();
+  }
+};
+
+thread_local std::unordered_map<std::string, Resolver::Query*> Resolver::Query::s_queries;
+
+//
+// Resolver
+//
+
+void Resolver::resolve(const std::string &hostname, Handler *handler) {
+  auto name = lower_case(hostname);
+  Addresses addresses;
+  auto hit = cache_get(name, addresses);
+  if (hit > 0) {
+    handler->on_resolve(addresses);
+  } else if (hit < 0) {
+    Query::get(name);
+    handler->on_resolve(addresses);
+  } else {
+    Query::get(name)->add(handler);
+  }
+}
+
+bool Resolver::cancel(Handler *handler) {
+  if (auto q = handler->m_query) {
+    q->remove(handler);
+    return true;
+  }
+  return false;
+}
+
+} // namespace pipy
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RESOLVER_HPP
+#define RESOLVER_HPP
+
+#include "net.hpp"
+#include "list.hpp"
+
+#include <string>
+#include <vector>
+
+namespace pipy {
+
+//
+// Resolver
+//
+// Hostname lookups for outbound connections. Answers are cached for the
+// whole process as long as their TTLs allow, and kept for a while after
+// that so that connecting never waits on a refresh of a known name.
+//
+
+class Resolver {
+  class Query;
+
+public:
+
+  //
+  // Resolver::Handler
+  //
+
+  class Handler : public List<Handler>::Item {
+  public:
+
+    // An empty list of addresses means the lookup failed
+    virtual void on_resolve(const std::vector<asio::ip::address> &addresses) = 0;
+
+  private:
+    Query* m_query = nullptr;
+    friend class Resolver;
+  };
+
+  // Calls back before returning when the answer is already known
+  static void resolve(const std::string &hostname, Handler *handler);
+
+  // Returns false if the handler was not waiting on a lookup
+  static bool cancel(Handler *handler);
+};
+
+} // namespace pipy
+
+#endif // RESOLVER_HPP
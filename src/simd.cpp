@@ -0,0 +1,405 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "simd.hpp"
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PIPY_SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define PIPY_SIMD_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__)
+#define PIPY_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace pipy {
+namespace simd {
+
+static inline int ctz32(uint32_t x) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i, x);
+  return i;
+#else
+  return __builtin_ctz(x);
+#endif
+}
+
+static auto find_scalar(const char *p, size_t i, size_t n, char a, char b, char c, char d) -> size_t {
+  for (; i < n; i++) {
+    auto x = p[i];
+    if (x == a || x == b || x == c || x == d) return i;
+  }
+  return n;
+}
+
+#ifdef PIPY_SIMD_SSE2
+
+static auto find_sse2(const char *p, size_t n, char a, char b, char c, char d) -> size_t {
+  auto va = _mm_set1_epi8(a);
+  auto vb = _mm_set1_epi8(b);
+  auto vc = _mm_set1_epi8(c);
+  auto vd = _mm_set1_epi8(d);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    auto v = _mm_loadu_si128((const __m128i *)(p + i));
+    auto m = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+      _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vd))
+    );
+    auto bits = (uint32_t)_mm_movemask_epi8(m);
+    if (bits) return i + ctz32(bits);
+  }
+  return find_scalar(p, i, n, a, b, c, d);
+}
+
+#endif // PIPY_SIMD_SSE2
+
+#ifdef PIPY_SIMD_AVX2
+
+__attribute__((target("avx2")))
+static auto find_avx2(const char *p, size_t n, char a, char b, char c, char d) -> size_t {
+  auto va = _mm256_set1_epi8(a);
+  auto vb = _mm256_set1_epi8(b);
+  auto vc = _mm256_set1_epi8(c);
+  auto vd = _mm256_set1_epi8(d);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    auto v = _mm256_loadu_si256((const __m256i *)(p + i));
+    auto m = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, vc), _mm256_cmpeq_epi8(v, vd))
+    );
+    auto bits = (uint32_t)_mm256_movemask_epi8(m);
+    if (bits) return i + ctz32(bits);
+  }
+  return find_sse2(p + i, n - i, a, b, c, d) + i;
+}
+
+#endif // PIPY_SIMD_AVX2
+
+#ifdef PIPY_SIMD_NEON
+
+static auto find_neon(const char *p, size_t n, char a, char b, char c, char d) -> size_t {
+  auto va = vdupq_n_u8(a);
+  auto vb = vdupq_n_u8(b);
+  auto vc = vdupq_n_u8(c);
+  auto vd = vdupq_n_u8(d);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    auto v = vld1q_u8((const uint8_t *)(p + i));
+    auto m = vorrq_u8(
+      vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)),
+      vorrq_u8(vceqq_u8(v, vc), vceqq_u8(v, vd))
+    );
+
+    // Narrow to 4 bits per byte so that the mask fits in 64 bits
+    auto bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+    if (bits) return i + (__builtin_ctzll(bits) >> 2);
+  }
+  return find_scalar(p, i, n, a, b, c, d);
+}
+
+#endif // PIPY_SIMD_NEON
+
+typedef size_t (*FindFunc)(const char*, size_t, char, char, char, char);
+
+static auto select_find() -> FindFunc {
+#if defined(PIPY_SIMD_AVX2)
+  if (__builtin_cpu_supports("avx2")) return find_avx2;
+#endif
+#if defined(PIPY_SIMD_SSE2)
+  return find_sse2;
+#elif defined(PIPY_SIMD_NEON)
+  return find_neon;
+#else
+  return [](const char *p, size_t n, char a, char b, char c, char d) -> size_t {
+    return find_scalar(p, 0, n, a, b, c, d);
+  };
+#endif
+}
+
+auto find_first_of(const char *p, size_t n, char a, char b, char c, char d) -> size_t {
+  static const FindFunc f = select_find();
+  return f(p, n, a, b, c, d);
+}
+
+//
+// Base64 with AVX2 follows the method of Wojciech Muła and Alfred Klomp:
+// 24 input bytes are spread over 32 lanes of 6 bits each, which are then
+// mapped to the alphabet by range with one table lookup. Decoding checks
+// all 32 characters at once by their nibbles before packing them back.
+//
+
+static auto base64_encode_none(char*, const uint8_t*, size_t, bool) -> size_t { return 0; }
+static auto base64_decode_none(uint8_t*, const char*, size_t, bool) -> size_t { return 0; }
+
+#ifdef PIPY_SIMD_AVX2
+
+__attribute__((target("avx2")))
+static auto base64_encode_avx2(char *out, const uint8_t *inp, size_t len, bool url) -> size_t {
+  const auto shuffle = _mm256_set_epi8(
+    10, 11,  9, 10,  7,  8,  6,  7,  4,  5,  3,  4,  1,  2,  0,  1,
+    10, 11,  9, 10,  7,  8,  6,  7,  4,  5,  3,  4,  1,  2,  0,  1
+  );
+  const auto lut = url ? _mm256_setr_epi8(
+    65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -17, 32, 0, 0,
+    65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -17, 32, 0, 0
+  ) : _mm256_setr_epi8(
+    65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+    65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0
+  );
+  size_t i = 0;
+  for (; i + 28 <= len; i += 24) {
+    auto v = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(inp + i))),
+      _mm_loadu_si128((const __m128i *)(inp + i + 12)), 1
+    );
+    v = _mm256_shuffle_epi8(v, shuffle);
+    auto t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+    auto t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    auto t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+    auto t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    auto idx = _mm256_or_si256(t1, t3);
+    auto off = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+    off = _mm256_sub_epi8(off, _mm256_cmpgt_epi8(idx, _mm256_set1_epi8(25)));
+    auto chr = _mm256_add_epi8(idx, _mm256_shuffle_epi8(lut, off));
+    _mm256_storeu_si256((__m256i *)(out + i / 3 * 4), chr);
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static auto base64_decode_avx2(uint8_t *out, const char *inp, size_t len, bool url) -> size_t {
+  const auto lut_lo = _mm256_setr_epi8(
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a
+  );
+  const auto lut_hi = _mm256_setr_epi8(
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+  );
+  const auto lut_roll = _mm256_setr_epi8(
+    0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+  );
+  const auto shuffle = _mm256_setr_epi8(
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+  );
+  const auto mask_2f = _mm256_set1_epi8(0x2f);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    auto v = _mm256_loadu_si256((const __m256i *)(inp + i));
+
+    // Map the URL alphabet onto the standard one, where '+' and '/' are invalid
+    if (url) {
+      auto minus = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-'));
+      auto under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+      auto std62 = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('+'));
+      auto std63 = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/'));
+      if (!_mm256_testz_si256(_mm256_or_si256(std62, std63), _mm256_or_si256(std62, std63))) break;
+      v = _mm256_blendv_epi8(v, _mm256_set1_epi8('+'), minus);
+      v = _mm256_blendv_epi8(v, _mm256_set1_epi8('/'), under);
+    }
+
+    auto hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask_2f);
+    auto lo_nibbles = _mm256_and_si256(v, mask_2f);
+    auto hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    auto lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm256_testz_si256(lo, hi)) break;
+    auto eq_2f = _mm256_cmpeq_epi8(v, mask_2f);
+    auto roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+    v = _mm256_add_epi8(v, roll);
+    v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+    v = _mm256_shuffle_epi8(v, shuffle);
+    v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    auto p = out + i / 4 * 3;
+    _mm_storeu_si128((__m128i *)p, _mm256_castsi256_si128(v));
+    _mm_storel_epi64((__m128i *)(p + 16), _mm256_extracti128_si256(v, 1));
+  }
+  return i;
+}
+
+#endif // PIPY_SIMD_AVX2
+
+#ifdef PIPY_SIMD_NEON
+
+static const uint8_t s_base64_std_tab[64] = {
+  'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P',
+  'Q','R','S','T','U','V','W','X','Y','Z','a','b','c','d','e','f',
+  'g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v',
+  'w','x','y','z','0','1','2','3','4','5','6','7','8','9','+','/',
+};
+
+static const uint8_t s_base64_url_tab[64] = {
+  'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P',
+  'Q','R','S','T','U','V','W','X','Y','Z','a','b','c','d','e','f',
+  'g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v',
+  'w','x','y','z','0','1','2','3','4','5','6','7','8','9','-','_',
+};
+
+static auto base64_encode_neon(char *out, const uint8_t *inp, size_t len, bool url) -> size_t {
+  auto tab = url ? s_base64_url_tab : s_base64_std_tab;
+  uint8x16x4_t lut = {{ vld1q_u8(tab), vld1q_u8(tab + 16), vld1q_u8(tab + 32), vld1q_u8(tab + 48) }};
+  auto mask = vdupq_n_u8(0x3f);
+  size_t i = 0;
+  for (; i + 48 <= len; i += 48) {
+    auto v = vld3q_u8(inp + i);
+    uint8x16x4_t r;
+    r.val[0] = vshrq_n_u8(v.val[0], 2);
+    r.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(v.val[0], 4), vshrq_n_u8(v.val[1], 4)), mask);
+    r.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(v.val[1], 2), vshrq_n_u8(v.val[2], 6)), mask);
+    r.val[3] = vandq_u8(v.val[2], mask);
+    r.val[0] = vqtbl4q_u8(lut, r.val[0]);
+    r.val[1] = vqtbl4q_u8(lut, r.val[1]);
+    r.val[2] = vqtbl4q_u8(lut, r.val[2]);
+    r.val[3] = vqtbl4q_u8(lut, r.val[3]);
+    vst4q_u8((uint8_t *)out + i / 3 * 4, r);
+  }
+  return i;
+}
+
+// Reverse lookup of the first 128 characters, 0xff marking the invalid ones
+struct Base64ReverseTable {
+  uint8_t map[128];
+  Base64ReverseTable(const uint8_t *tab) {
+    for (int c = 0; c < 128; c++) map[c] = 0xff;
+    for (int c = 0; c < 64; c++) map[tab[c]] = c;
+  }
+};
+
+static auto base64_decode_neon(uint8_t *out, const char *inp, size_t len, bool url) -> size_t {
+  static const Base64ReverseTable s_rev_std(s_base64_std_tab);
+  static const Base64ReverseTable s_rev_url(s_base64_url_tab);
+  auto rev = (url ? s_rev_url : s_rev_std).map;
+  uint8x16x4_t lut_lo = {{ vld1q_u8(rev), vld1q_u8(rev + 16), vld1q_u8(rev + 32), vld1q_u8(rev + 48) }};
+  uint8x16x4_t lut_hi = {{ vld1q_u8(rev + 64), vld1q_u8(rev + 80), vld1q_u8(rev + 96), vld1q_u8(rev + 112) }};
+  auto offset = vdupq_n_u8(64);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    auto v = vld4q_u8((const uint8_t *)inp + i);
+    uint8x16_t bad = vdupq_n_u8(0);
+    for (int k = 0; k < 4; k++) {
+      auto c = v.val[k];
+      auto d = vqtbx4q_u8(vqtbl4q_u8(lut_lo, c), lut_hi, vsubq_u8(c, offset));
+
+      // Bytes at 128 and above fall outside both tables and come out as 0
+      bad = vorrq_u8(bad, vorrq_u8(vcgeq_u8(c, vdupq_n_u8(128)), vceqq_u8(d, vdupq_n_u8(0xff))));
+      v.val[k] = d;
+    }
+    if (vmaxvq_u8(bad)) break;
+    uint8x16x3_t r;
+    r.val[0] = vorrq_u8(vshlq_n_u8(v.val[0], 2), vshrq_n_u8(v.val[1], 4));
+    r.val[1] = vorrq_u8(vshlq_n_u8(v.val[1], 4), vshrq_n_u8(v.val[2], 2));
+    r.val[2] = vorrq_u8(vshlq_n_u8(v.val[2], 6), v.val[3]);
+    vst3q_u8(out + i / 4 * 3, r);
+  }
+  return i;
+}
+
+#endif // PIPY_SIMD_NEON
+
+typedef size_t (*Base64EncodeFunc)(char*, const uint8_t*, size_t, bool);
+typedef size_t (*Base64DecodeFunc)(uint8_t*, const char*, size_t, bool);
+
+static auto select_base64_encode() -> Base64EncodeFunc {
+#if defined(PIPY_SIMD_AVX2)
+  if (__builtin_cpu_supports("avx2")) return base64_encode_avx2;
+#elif defined(PIPY_SIMD_NEON)
+  return base64_encode_neon;
+#endif
+  return base64_encode_none;
+}
+
+static auto select_base64_decode() -> Base64DecodeFunc {
+#if defined(PIPY_SIMD_AVX2)
+  if (__builtin_cpu_supports("avx2")) return base64_decode_avx2;
+#elif defined(PIPY_SIMD_NEON)
+  return base64_decode_neon;
+#endif
+  return base64_decode_none;
+}
+
+auto base64_encode(char *out, const uint8_t *inp, size_t len, bool url) -> size_t {
+  static const Base64EncodeFunc f = select_base64_encode();
+  return f(out, inp, len, url);
+}
+
+auto base64_decode(uint8_t *out, const char *inp, size_t len, bool url) -> size_t {
+  static const Base64DecodeFunc f = select_base64_decode();
+  return f(out, inp, len, url);
+}
+
+//
+// Hex splits every byte into two nibbles, turns them into digits
+// by adding '0' or 'a' - 10 and interleaves them back in order.
+//
+
+auto hex_encode(char *out, const uint8_t *inp, size_t len) -> size_t {
+  size_t i = 0;
+#if defined(PIPY_SIMD_SSE2)
+  auto mask = _mm_set1_epi8(0x0f);
+  auto nine = _mm_set1_epi8(9);
+  auto zero = _mm_set1_epi8('0');
+  auto alpha = _mm_set1_epi8('a' - '0' - 10);
+  for (; i + 16 <= len; i += 16) {
+    auto v = _mm_loadu_si128((const __m128i *)(inp + i));
+    auto hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+    auto lo = _mm_and_si128(v, mask);
+    hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+    lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+    _mm_storeu_si128((__m128i *)(out + i * 2), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(out + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+#elif defined(PIPY_SIMD_NEON)
+  static const uint8_t s_digits[16] = {
+    '0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f',
+  };
+  auto lut = vld1q_u8(s_digits);
+  auto mask = vdupq_n_u8(0x0f);
+  for (; i + 16 <= len; i += 16) {
+    auto v = vld1q_u8(inp + i);
+    uint8x16x2_t r;
+    r.val[0] = vqtbl1q_u8(lut, vshrq_n_u8(v, 4));
+    r.val[1] = vqtbl1q_u8(lut, vandq_u8(v, mask));
+    vst2q_u8((uint8_t *)out + i * 2, r);
+  }
+#endif
+  return i;
+}
+
+} // namespace simd
+} // namespace pipy
@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pipy {
+namespace simd {
+
+//
+// Byte scanning with vector instructions where available. The best
+// implementation for the running CPU is picked on first use: AVX2 or
+// SSE2 on x86-64, NEON on AArch64, plain loops elsewhere.
+//
+
+// Returns the offset of the first byte equal to any of a, b, c and d, or n if none
+auto find_first_of(const char *p, size_t n, char a, char b, char c, char d) -> size_t;
+
+inline auto find(const char *p, size_t n, char a) -> size_t {
+  return find_first_of(p, n, a, a, a, a);
+}
+
+inline auto find_first_of(const char *p, size_t n, char a, char b) -> size_t {
+  return find_first_of(p, n, a, b, b, b);
+}
+
+//
+// Codec kernels for the bulk of a buffer. Each one works on whole blocks
+// and returns how many input bytes it has consumed, leaving the rest to
+// the scalar code in utils.cpp. Decoding stops before the first block
+// with a character outside the alphabet, padding included.
+//
+
+auto base64_encode(char *out, const uint8_t *inp, size_t len, bool url) -> size_t;
+auto base64_decode(uint8_t *out, const char *inp, size_t len, bool url) -> size_t;
+auto hex_encode(char *out, const uint8_t *inp, size_t len) -> size_t;
+
+} // namespace simd
+} // namespace pipy
+
+#endif // SIMD_HPP
@@ -24,9 +24,29 @@
  */
 
 #include "socket.hpp"
+#include "memory-limit.hpp"
 #include "log.hpp"
 
 #include <errno.h>
+#include <limits>
+
+#ifdef PIPY_HAS_SPLICE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#ifdef PIPY_HAS_MMSG
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstring>
+#endif
+
+#ifdef PIPY_HAS_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
 
 namespace pipy {
 
@@ -83,14 +103,146 @@ void SocketBase::log_error(const char *msg) {
 
 Data::Producer SocketTCP::s_dp("TCP Socket");
 
+#ifdef PIPY_HAS_SPLICE
+static const int SPLICE_PIPE_SIZE = 0x10000;
+#endif
+
 SocketTCP::~SocketTCP() {
-  Ticker::get()->unwatch(this);
+#ifdef PIPY_HAS_IO_URING
+  delete m_uring_ops;
+#endif
+#ifdef PIPY_HAS_SPLICE
+  splice_detach();
+#endif
+}
+
+//
+// Once spliced, bytes received from one socket are moved to the other
+// through a kernel pipe without going up to the pipeline, for as long as
+// nothing is buffered in user space for the receiving side. Anything else
+// (connection setup, data already in flight, end of stream) still goes
+// through the regular path so the pipeline sees StreamEnd as usual.
+//
+
+void SocketTCP::splice(SocketTCP *peer) {
+#ifdef PIPY_HAS_SPLICE
+  if (peer == this) return;
+  splice_detach();
+  peer->splice_detach();
+  m_splice_target = peer;
+  m_splice_source = peer;
+  peer->m_splice_target = this;
+  peer->m_splice_source = this;
+#endif
+}
+
+//
+// Buffer sizes and fast open only take effect before the handshake and
+// are inherited by accepted sockets from the listening socket. The rest
+// are applied again in open() so that a reloaded listener's options
+// reach new connections on a port that stayed open.
+//
+
+static auto set_sock_opts_live(int sock, const SocketTCP::Options &options) -> const char* {
+  const char *failed = nullptr;
+  auto set = [&](int level, int name, const void *v, socklen_t n, const char *opt) {
+    if (setsockopt(sock, level, name, (const char *)v, n) && !failed) failed = opt;
+  };
+
+#ifdef TCP_NOTSENT_LOWAT
+  if (options.not_sent_lowat > 0) {
+    int n = options.not_sent_lowat;
+    set(IPPROTO_TCP, TCP_NOTSENT_LOWAT, &n, sizeof(n), "notSentLowat");
+  }
+#endif
+
+#ifdef TCP_CONGESTION
+  if (!options.congestion_control.empty()) {
+    const auto &s = options.congestion_control;
+    set(IPPROTO_TCP, TCP_CONGESTION, s.c_str(), s.length(), "congestionControl");
+  }
+#endif
+
+#ifdef SO_BUSY_POLL
+  if (options.busy_poll > 0) {
+    int usec = options.busy_poll * 1000000;
+    set(SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec), "busyPoll");
+  }
+#endif
+
+#ifdef SO_INCOMING_CPU
+  if (options.incoming_cpu >= 0) {
+    int cpu = options.incoming_cpu;
+    set(SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu), "incomingCpu");
+  }
+#endif
+
+  return failed;
+}
+
+auto SocketTCP::set_sock_opts(int sock, const Options &options, bool listening) -> const char* {
+  const char *failed = nullptr;
+  auto set = [&](int level, int name, const void *v, socklen_t n, const char *opt) {
+    if (setsockopt(sock, level, name, (const char *)v, n) && !failed) failed = opt;
+  };
+
+  if (options.receive_buffer_size > 0) {
+    int n = options.receive_buffer_size;
+    set(SOL_SOCKET, SO_RCVBUF, &n, sizeof(n), "receiveBufferSize");
+  }
+
+  if (options.send_buffer_size > 0) {
+    int n = options.send_buffer_size;
+    set(SOL_SOCKET, SO_SNDBUF, &n, sizeof(n), "sendBufferSize");
+  }
+
+  if (options.fast_open) {
+    if (listening) {
+#ifdef TCP_FASTOPEN
+      int qlen = asio::socket_base::max_listen_connections;
+      set(IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen), "fastOpen");
+#endif
+    } else {
+#ifdef TCP_FASTOPEN_CONNECT
+      int enabled = 1;
+      set(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &enabled, sizeof(enabled), "fastOpen");
+#endif
+    }
+  }
+
+  auto live = set_sock_opts_live(sock, options);
+  return failed ? failed : live;
 }
 
 void SocketTCP::open() {
   m_socket.set_option(asio::socket_base::keep_alive(m_options.keep_alive));
   m_socket.set_option(tcp::no_delay(m_options.no_delay));
 
+  if (auto opt = set_sock_opts_live(m_socket.native_handle(), m_options)) {
+    char msg[100];
+    std::snprintf(msg, sizeof(msg), "cannot set socket option %s", opt);
+    log_debug(msg);
+  }
+
+#ifdef PIPY_HAS_IO_URING
+  if ((m_uring = Uring::current())) {
+    m_uring_ops = new UringOps;
+    m_uring_ops->receiver.self = this;
+    m_uring_ops->sender.self = this;
+  }
+#endif
+
+  // Needed for the direct reads done after a readiness wait
+  std::error_code ec;
+  m_socket.non_blocking(true, ec);
+
+#ifdef PIPY_HAS_ZEROCOPY
+  if (m_options.zero_copy_threshold > 0 && !m_uring_ops) {
+    int one = 1;
+    m_zero_copy = (setsockopt(m_socket.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0);
+  }
+#endif
+
   auto t = Ticker::get()->tick();
   m_tick_read = t;
   m_tick_write = t;
@@ -107,7 +259,7 @@ void SocketTCP::open() {
   }
 
   receive();
-  Ticker::get()->watch(this);
+  schedule_timeout();
 }
 
 void SocketTCP::output(Event *evt) {
@@ -124,7 +276,7 @@ void SocketTCP::output(Event *evt) {
       } else {
         m_buffer_send.push(*data);
         auto limit = m_options.congestion_limit;
-        if (limit > 0 && m_buffer_send.size() >= limit) {
+        if ((limit > 0 && m_buffer_send.size() >= limit) || MemoryLimit::pressured()) {
           m_congestion.begin();
         }
         if (m_state != IDLE) FlushTarget::need_flush();
@@ -147,11 +299,44 @@ void SocketTCP::receive() {
   if (m_receiving) return;
   if (m_paused) return;
 
-  m_buffer_receive.push(Data(RECEIVE_BUFFER_SIZE, &s_dp));
-  m_socket.async_read_some(
-    DataChunks(m_buffer_receive.chunks()),
-    ReceiveHandler(this)
-  );
+#ifdef PIPY_HAS_SPLICE
+  if (m_splice_target && splice_receive()) return;
+#endif
+
+#ifdef PIPY_HAS_IO_URING
+  if (m_uring) {
+    m_buffer_receive.push(Data(RECEIVE_BUFFER_SIZE, &s_dp));
+    auto buf = *m_buffer_receive.chunks().begin();
+    m_uring->recv(
+      m_socket.native_handle(),
+      std::get<0>(buf),
+      std::get<1>(buf),
+      &m_uring_ops->receiver
+    );
+    m_receiving = true;
+    return;
+  }
+#endif
+
+  //
+  // A connection that just filled up a whole buffer most likely has more
+  // to read, so a buffer is posted right away. Otherwise no buffer is held
+  // until the socket turns readable, which keeps idle connections from
+  // pinning a receive chunk each.
+  //
+
+  if (m_receive_full) {
+    m_buffer_receive.push(Data(RECEIVE_BUFFER_SIZE, &s_dp));
+    m_socket.async_read_some(
+      DataChunks(m_buffer_receive.chunks()),
+      ReceiveHandler(this)
+    );
+  } else {
+    m_socket.async_wait(
+      tcp::socket::wait_read,
+      ReadableHandler(this)
+    );
+  }
 
   m_receiving = true;
 }
@@ -162,6 +347,18 @@ void SocketTCP::send() {
 
   if (m_buffer_send.empty()) {
     if (m_eos) {
+#ifdef PIPY_HAS_ZEROCOPY
+      // Pages still referenced by the kernel must not be recycled
+      // before the last of them are sent out
+      if (!m_zero_copy_sends.empty() && m_eos->error_code() == StreamEnd::NO_ERROR) {
+        zero_copy_reap();
+        if (!m_zero_copy_sends.empty()) {
+          m_socket.async_wait(tcp::socket::wait_error, ZeroCopyDoneHandler(this));
+          m_sending = true;
+          return;
+        }
+      }
+#endif
       if (m_eos->error_code() == StreamEnd::NO_ERROR) {
         shutdown_socket();
         if (m_state == OPEN) {
@@ -182,6 +379,37 @@ void SocketTCP::send() {
     std::cerr << m_buffer_send.size() << std::endl;
   }
 
+  auto &round = SendRound::current();
+  m_send_round = round.id();
+  round.start();
+
+#ifdef PIPY_HAS_IO_URING
+  if (m_uring) {
+    auto ops = m_uring_ops;
+    int n = 0;
+    for (const auto c : m_buffer_send.chunks()) {
+      auto &iov = ops->iov[n];
+      iov.iov_base = std::get<0>(c);
+      iov.iov_len = std::get<1>(c);
+      if (++n == URING_MAX_IOV) break;
+    }
+    std::memset(&ops->msg, 0, sizeof(ops->msg));
+    ops->msg.msg_iov = ops->iov;
+    ops->msg.msg_iovlen = n;
+    m_uring->sendmsg(m_socket.native_handle(), &ops->msg, &ops->sender);
+    m_sending = true;
+    return;
+  }
+#endif
+
+#ifdef PIPY_HAS_ZEROCOPY
+  if (m_zero_copy && m_buffer_send.size() >= m_options.zero_copy_threshold) {
+    m_socket.async_wait(tcp::socket::wait_write, ZeroCopySendHandler(this));
+    m_sending = true;
+    return;
+  }
+#endif
+
   m_socket.async_write_some(
     DataChunks(m_buffer_send.chunks()),
     SendHandler(this)
@@ -203,7 +431,16 @@ void SocketTCP::shutdown_socket() {
 }
 
 void SocketTCP::close_socket() {
+#ifdef PIPY_HAS_SPLICE
+  splice_detach();
+#endif
   if (m_socket.is_open()) {
+#ifdef PIPY_HAS_IO_URING
+    if (m_uring) {
+      m_uring->cancel(&m_uring_ops->receiver);
+      m_uring->cancel(&m_uring_ops->sender);
+    }
+#endif
     std::error_code ec;
     m_socket.close(ec);
     if (ec) {
@@ -233,10 +470,83 @@ void SocketTCP::on_tap_close() {
 }
 
 void SocketTCP::on_flush() {
-  send();
+  auto &round = SendRound::current();
+  if (m_send_round == round.id()) {
+    round.defer(&m_deferred_send);
+  } else {
+    send();
+  }
+}
+
+//
+// SocketTCP::SendRound
+//
+
+SocketTCP::DeferredSend::~DeferredSend() {
+  SendRound::current().cancel(this);
+}
+
+auto SocketTCP::SendRound::current() -> SendRound& {
+  thread_local static SendRound s_round;
+  return s_round;
+}
+
+void SocketTCP::SendRound::start() {
+  if (!m_posted) {
+    m_posted = true;
+    asio::post(Net::context(), [this]() { end(); });
+  }
+}
+
+void SocketTCP::SendRound::defer(DeferredSend *ds) {
+  if (!ds->queued) {
+    ds->queued = true;
+    m_deferred.push(ds);
+    start();
+  }
+}
+
+void SocketTCP::SendRound::cancel(DeferredSend *ds) {
+  if (ds->queued) {
+    ds->queued = false;
+    m_deferred.remove(ds);
+  }
+}
+
+void SocketTCP::SendRound::end() {
+  m_posted = false;
+  m_id++;
+  if (m_deferred.empty()) return;
+  InputContext ic;
+  while (auto ds = m_deferred.head()) {
+    m_deferred.remove(ds);
+    ds->queued = false;
+    ds->socket->send();
+  }
 }
 
-void SocketTCP::on_tick(double tick) {
+//
+// Activity only stamps m_tick_read/m_tick_write. The timeout timer is
+// set for the earliest deadline those stamps allow and, when it fires
+// early because of activity since, it is simply set again.
+//
+
+void SocketTCP::schedule_timeout() {
+  auto tick = Ticker::get()->tick();
+  auto r = tick - m_tick_read;
+  auto w = tick - m_tick_write;
+  auto wait = std::numeric_limits<double>::infinity();
+  if (m_options.idle_timeout > 0) wait = std::min(wait, m_options.idle_timeout - std::min(r, w));
+  if (m_options.read_timeout > 0) wait = std::min(wait, m_options.read_timeout - r);
+  if (m_options.write_timeout > 0) wait = std::min(wait, m_options.write_timeout - w);
+  if (wait == std::numeric_limits<double>::infinity()) return;
+  m_timeout_timer.schedule(std::max(wait, 0.0), [this]() { on_timeout(); });
+}
+
+void SocketTCP::on_timeout() {
+  if (m_state == CLOSED) return;
+
+  auto tick = Ticker::get()->tick();
   auto r = tick - m_tick_read;
   auto w = tick - m_tick_write;
 
@@ -258,23 +568,53 @@ void SocketTCP::on_tick(double tick) {
   }
 
   if (m_options.write_timeout > 0) {
-    if (r >= m_options.write_timeout) {
+    if (w >= m_options.write_timeout) {
       on_socket_input(StreamEnd::make(StreamEnd::WRITE_TIMEOUT));
       close();
       return;
     }
   }
+
+  schedule_timeout();
+}
+
+void SocketTCP::on_readable(const std::error_code &ec) {
+  if (ec || m_state == CLOSED) {
+    on_receive(ec, 0);
+    return;
+  }
+
+#ifdef PIPY_HAS_ZEROCOPY
+  // Completions on the error queue wake up readers as well
+  if (!m_zero_copy_sends.empty()) zero_copy_reap();
+#endif
+
+  std::error_code err;
+  m_buffer_receive.push(Data(RECEIVE_BUFFER_SIZE, &s_dp));
+  auto n = m_socket.read_some(DataChunks(m_buffer_receive.chunks()), err);
+
+  // Readiness can be spurious, so go back waiting without the buffer
+  if (err == asio::error::would_block || err == asio::error::try_again) {
+    m_buffer_receive.clear();
+    m_receiving = false;
+    receive();
+    return;
+  }
+
+  on_receive(err, n);
 }
 
 void SocketTCP::on_receive(const std::error_code &ec, std::size_t n) {
   InputContext ic(this);
 
   m_receiving = false;
+  m_receive_full = (n >= RECEIVE_BUFFER_SIZE);
   m_tick_read = Ticker::get()->tick();
 
   if (ec != asio::error::operation_aborted && m_state != CLOSED) {
     if (n > 0) {
       m_buffer_receive.pop(m_buffer_receive.size() - n);
+      m_buffer_receive.shrink(&s_dp);
       auto size = m_buffer_receive.size();
       m_traffic_read += size;
 
@@ -285,6 +625,8 @@ void SocketTCP::on_receive(const std::error_code &ec, std::size_t n) {
       }
 
       on_socket_input(Data::make(std::move(m_buffer_receive)));
+    } else {
+      m_buffer_receive.clear();
     }
 
     if (ec) {
@@ -325,8 +667,10 @@ void SocketTCP::on_send(const std::error_code &ec, std::size_t n) {
     m_buffer_send.shift(n);
     m_traffic_write += n;
 
+    // Under memory pressure inputs are held until everything is sent
     auto limit = m_options.congestion_limit;
-    if (limit > 0 && m_buffer_send.size() < limit) {
+    auto size = m_buffer_send.size();
+    if ((limit == 0 || size < limit) && (size == 0 || !MemoryLimit::pressured())) {
       m_congestion.end();
     }
 
@@ -336,10 +680,17 @@ void SocketTCP::on_send(const std::error_code &ec, std::size_t n) {
       close_socket();
 
     } else if (m_buffer_send.empty()) {
+#ifdef PIPY_HAS_SPLICE
+      if (auto s = m_splice_source) s->receive();
+#endif
       if (m_eos) {
         if (m_eos->error_code() != StreamEnd::NO_ERROR) {
           m_state = CLOSED;
           close_socket();
+#ifdef PIPY_HAS_ZEROCOPY
+        } else if (!m_zero_copy_sends.empty()) {
+          send();
+#endif
         } else {
           shutdown_socket();
           if (m_state == OPEN) {
@@ -359,6 +710,426 @@ void SocketTCP::on_send(const std::error_code &ec, std::size_t n) {
   close_async();
 }
 
+#ifdef PIPY_HAS_ZEROCOPY
+
+//
+// Large writes are sent with MSG_ZEROCOPY so that the kernel transmits
+// straight from our chunks instead of copying them. The chunks sent are
+// retained until the kernel reports on the error queue that it is done
+// with them. Each successful sendmsg() is numbered sequentially by the
+// kernel and completions come in ranges of those numbers.
+//
+
+static const int ZERO_COPY_MAX_IOV = 64;
+
+void SocketTCP::zero_copy_reap() {
+  auto fd = m_socket.native_handle();
+  for (;;) {
+    union {
+      char buf[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+      struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (
+        !(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+        !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)
+      ) continue;
+      auto err = (const struct sock_extended_err *)CMSG_DATA(cmsg);
+      if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+      // The kernel had to copy after all, as it does on loopback
+      if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) m_zero_copy = false;
+
+      uint32_t lo = err->ee_info;
+      uint32_t hi = err->ee_data;
+      m_zero_copy_sends.erase(
+        std::remove_if(
+          m_zero_copy_sends.begin(),
+          m_zero_copy_sends.end(),
+          [=](const ZeroCopySend &s) { return s.id - lo <= hi - lo; }
+        ),
+        m_zero_copy_sends.end()
+      );
+    }
+  }
+}
+
+void SocketTCP::on_zero_copy_writable(const std::error_code &ec) {
+  if (ec || m_state == CLOSED) {
+    on_send(ec, 0);
+    return;
+  }
+
+  zero_copy_reap();
+
+  struct iovec iov[ZERO_COPY_MAX_IOV];
+  int n = 0;
+  for (const auto c : m_buffer_send.chunks()) {
+    iov[n].iov_base = std::get<0>(c);
+    iov[n].iov_len = std::get<1>(c);
+    if (++n == ZERO_COPY_MAX_IOV) break;
+  }
+
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = n;
+
+  auto ret = ::sendmsg(m_socket.native_handle(), &msg, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (ret < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      m_socket.async_wait(tcp::socket::wait_write, ZeroCopySendHandler(this));
+    } else if (errno == ENOBUFS) {
+      // Out of socket option memory for notifications, copy this time
+      m_socket.async_write_some(
+        DataChunks(m_buffer_send.chunks()),
+        SendHandler(this)
+      );
+    } else {
+      on_send(std::error_code(errno, asio::error::get_system_category()), 0);
+    }
+    return;
+  }
+
+  Data sent;
+  m_buffer_send.slice(0, ret, sent);
+  m_zero_copy_sends.push_back({ m_zero_copy_id++, std::move(sent) });
+  on_send(std::error_code(), ret);
+}
+
+void SocketTCP::on_zero_copy_done(const std::error_code &ec) {
+  m_sending = false;
+
+  if (ec != asio::error::operation_aborted && m_state != CLOSED) {
+    if (ec) m_zero_copy_sends.clear();
+    zero_copy_reap();
+    send();
+  }
+
+  close_async();
+}
+
+#endif // PIPY_HAS_ZEROCOPY
+
+#ifdef PIPY_HAS_SPLICE
+
+//
+// Returns false when the receiving side cannot take spliced bytes and the
+// regular receive path should be used instead. Returns true when splicing
+// has been started or has to wait for the other side to drain first.
+//
+
+bool SocketTCP::splice_receive() {
+  auto t = m_splice_target;
+  if (t->m_state != OPEN && t->m_state != HALF_CLOSED_REMOTE) return false;
+  if (t->m_eos) return false;
+  if (!t->m_buffer_send.empty()) return true;
+  if (t->m_splice_pending >= SPLICE_PIPE_SIZE) return true;
+
+#ifdef PIPY_HAS_SOCKMAP
+  if (m_sockmap_entry.slot >= 0 || sockmap_attach()) {
+    m_socket.async_wait(
+      tcp::socket::wait_read,
+      SpliceReceiveHandler(this)
+    );
+    m_receiving = true;
+    return true;
+  }
+#endif
+
+  if (t->m_splice_pipe[0] < 0) {
+    if (pipe2(t->m_splice_pipe, O_NONBLOCK | O_CLOEXEC)) {
+      log_warn("cannot create pipe for splicing", std::error_code(errno, std::system_category()));
+      t->m_splice_pipe[0] = t->m_splice_pipe[1] = -1;
+      splice_detach();
+      return false;
+    }
+    fcntl(t->m_splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    log_debug("start splicing");
+  }
+
+  m_socket.async_wait(
+    tcp::socket::wait_read,
+    SpliceReceiveHandler(this)
+  );
+
+  m_receiving = true;
+  return true;
+}
+
+void SocketTCP::splice_send() {
+  if (m_sending) return;
+
+  while (m_splice_pending > 0) {
+    auto n = ::splice(
+      m_splice_pipe[0], nullptr,
+      m_socket.native_handle(), nullptr,
+      m_splice_pending,
+      SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+    );
+    if (n > 0) {
+      m_splice_pending -= n;
+      m_traffic_write += n;
+      m_tick_write = Ticker::get()->tick();
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && errno == EAGAIN) {
+      m_socket.async_wait(
+        tcp::socket::wait_write,
+        SpliceSendHandler(this)
+      );
+      m_sending = true;
+      return;
+    } else {
+      on_send(std::error_code(n < 0 ? errno : EPIPE, std::system_category()), 0);
+      return;
+    }
+  }
+
+  if (auto s = m_splice_source) s->receive();
+  if (!m_buffer_send.empty() || m_eos) send();
+}
+
+void SocketTCP::splice_detach() {
+#ifdef PIPY_HAS_SOCKMAP
+  sockmap_detach();
+#endif
+  if (auto t = m_splice_target) {
+    t->m_splice_source = nullptr;
+    m_splice_target = nullptr;
+  }
+  if (auto s = m_splice_source) {
+    s->m_splice_target = nullptr;
+    m_splice_source = nullptr;
+    s->receive();
+  }
+  if (m_splice_pipe[0] >= 0) {
+    ::close(m_splice_pipe[0]);
+    ::close(m_splice_pipe[1]);
+    m_splice_pipe[0] = m_splice_pipe[1] = -1;
+    m_splice_pending = 0;
+  }
+}
+
+void SocketTCP::on_splice_readable(const std::error_code &ec) {
+  m_receiving = false;
+
+  if (ec && ec != asio::error::operation_aborted) {
+    on_receive(ec, 0);
+    return;
+  }
+
+  if (!ec && m_state != CLOSED) {
+    auto t = m_splice_target;
+    if (!t) {
+      receive();
+      return;
+    }
+
+#ifdef PIPY_HAS_SOCKMAP
+    if (m_sockmap_entry.slot >= 0) {
+      sockmap_readable();
+      return;
+    }
+#endif
+
+    auto n = ::splice(
+      m_socket.native_handle(), nullptr,
+      t->m_splice_pipe[1], nullptr,
+      SPLICE_PIPE_SIZE - t->m_splice_pending,
+      SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+    );
+
+    if (n > 0) {
+      m_traffic_read += n;
+      m_tick_read = Ticker::get()->tick();
+      if (Log::is_enabled(Log::TCP)) {
+        std::cerr << Log::format_elapsed_time();
+        std::cerr << (m_is_inbound ? " tcp >>>> splice " : " tcp splice <<<< ");
+        std::cerr << n << std::endl;
+      }
+      t->m_splice_pending += n;
+      t->splice_send();
+      receive();
+      return;
+    }
+
+    if (n == 0) {
+      on_receive(asio::error::eof, 0);
+      return;
+    }
+
+    if (errno == EAGAIN || errno == EINTR) {
+      // A pipe with data in it can be full before reaching its byte size,
+      // in which case wait for the other side to drain it
+      if (!t->m_splice_pending) receive();
+      return;
+    }
+
+    on_receive(std::error_code(errno, std::system_category()), 0);
+    return;
+  }
+
+  close_async();
+}
+
+void SocketTCP::on_splice_writable(const std::error_code &ec) {
+  m_sending = false;
+
+  if (ec != asio::error::operation_aborted && m_state != CLOSED) {
+    if (ec) {
+      on_send(ec, 0);
+    } else {
+      splice_send();
+    }
+    return;
+  }
+
+  close_async();
+}
+
+#ifdef PIPY_HAS_SOCKMAP
+
+//
+// Offloading to the sockmap is tried once per pair of sockets, when both
+// have nothing in flight in either direction. From then on the kernel
+// moves the bytes and a socket only becomes readable again at the end
+// of stream, or if the kernel passes data up because a peer has left
+// the sockmap, in which case both go back to splicing through a pipe.
+//
+
+bool SocketTCP::sockmap_attach() {
+  auto t = m_splice_target;
+  if (m_sockmap_tried || t->m_sockmap_tried) return false;
+  if (!m_buffer_send.empty() || m_splice_pending || t->m_splice_pending) return false;
+  auto m = SockMap::get();
+  if (!m) return false;
+  m_sockmap_tried = true;
+  t->m_sockmap_tried = true;
+  if (!m->pair(
+    m_socket.native_handle(),
+    t->m_socket.native_handle(),
+    m_sockmap_entry,
+    t->m_sockmap_entry
+  )) {
+    log_debug("cannot offload to sockmap, splicing instead");
+    return false;
+  }
+  log_debug("offloaded to sockmap");
+  return true;
+}
+
+void SocketTCP::sockmap_detach() {
+  if (m_sockmap_entry.slot >= 0) {
+    if (auto m = SockMap::get()) m->unpair(m_sockmap_entry);
+  }
+  if (auto t = m_splice_target) {
+    if (t->m_sockmap_entry.slot >= 0) {
+      if (auto m = SockMap::get()) m->unpair(t->m_sockmap_entry);
+    }
+  }
+}
+
+void SocketTCP::sockmap_readable() {
+  char c;
+  auto n = ::recv(m_socket.native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n == 0) {
+    on_receive(asio::error::eof, 0);
+  } else if (n > 0) {
+    sockmap_detach();
+    receive();
+  } else if (errno == EAGAIN || errno == EINTR) {
+    receive();
+  } else {
+    on_receive(std::error_code(errno, std::system_category()), 0);
+  }
+}
+
+#endif // PIPY_HAS_SOCKMAP
+
+#endif // PIPY_HAS_SPLICE
+
+#ifdef PIPY_HAS_IO_URING
+
+//
+// SocketTCP::UringOps
+//
+
+void SocketTCP::UringOps::Receiver::on_uring_complete(int result) {
+  if (result > 0) {
+    self->on_receive(std::error_code(), result);
+  } else if (result == 0) {
+    self->on_receive(asio::error::eof, 0);
+  } else {
+    self->on_receive(std::error_code(-result, asio::error::get_system_category()), 0);
+  }
+}
+
+void SocketTCP::UringOps::Sender::on_uring_complete(int result) {
+  if (result >= 0) {
+    self->on_send(std::error_code(), result);
+  } else {
+    self->on_send(std::error_code(-result, asio::error::get_system_category()), 0);
+  }
+}
+
+#endif // PIPY_HAS_IO_URING
+
+#ifdef PIPY_HAS_MMSG
+
+//
+// Batched UDP I/O
+//
+// Reads go through recvmmsg() into a per-thread ring of 64KB buffers, big
+// enough for one GRO train, and every datagram is copied out into its own
+// Data so that the ring is free again for the next socket on the thread.
+// Writes are queued for one round of the event loop and leave with a
+// single sendmmsg(). With UDP_SEGMENT, a run of equally sized datagrams
+// to the same peer goes out as one GSO super-packet.
+//
+
+static const int MMSG_BATCH = 16;
+static const int MMSG_BUFFER_SIZE = 0x10000;
+static const int GSO_MAX_SEGMENTS = 64;
+static const int GSO_MAX_SIZE = 65000;
+
+struct MmsgRing {
+  struct mmsghdr msgs[MMSG_BATCH];
+  struct iovec iovs[MMSG_BATCH];
+  struct sockaddr_storage addrs[MMSG_BATCH];
+  char controls[MMSG_BATCH][CMSG_SPACE(sizeof(int))];
+  char buffers[MMSG_BATCH][MMSG_BUFFER_SIZE];
+
+  static auto current() -> MmsgRing& {
+    thread_local static MmsgRing *s_ring = nullptr;
+    if (!s_ring) s_ring = new MmsgRing;
+    return *s_ring;
+  }
+
+  void reset(bool gro) {
+    for (int i = 0; i < MMSG_BATCH; i++) {
+      auto &h = msgs[i].msg_hdr;
+      iovs[i].iov_base = buffers[i];
+      iovs[i].iov_len = MMSG_BUFFER_SIZE;
+      h.msg_name = &addrs[i];
+      h.msg_namelen = sizeof(addrs[i]);
+      h.msg_iov = &iovs[i];
+      h.msg_iovlen = 1;
+      h.msg_control = gro ? controls[i] : nullptr;
+      h.msg_controllen = gro ? sizeof(controls[i]) : 0;
+      h.msg_flags = 0;
+      msgs[i].msg_len = 0;
+    }
+  }
+};
+
+#endif // PIPY_HAS_MMSG
+
 //
 // SocketUDP
 //
@@ -367,12 +1138,30 @@ Data::Producer SocketUDP::s_dp("UDP Socket");
 
 SocketUDP::~SocketUDP() {
   Ticker::get()->unwatch(this);
+#ifdef PIPY_HAS_IO_URING
+  delete m_uring_receiver;
+#endif
 }
 
 void SocketUDP::open() {
   m_endpoint = m_socket.local_endpoint();
   m_opened = true;
 
+#ifdef PIPY_HAS_MMSG
+  auto fd = m_socket.native_handle();
+  int enabled = 1, segment = 0;
+  socklen_t len = sizeof(segment);
+  m_gro = !setsockopt(fd, SOL_UDP, UDP_GRO, &enabled, sizeof(enabled));
+  m_gso = !getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, &len);
+#endif
+
+#ifdef PIPY_HAS_IO_URING
+  if ((m_uring = Uring::current())) {
+    m_uring_receiver = new UringReceiver;
+    m_uring_receiver->self = this;
+  }
+#endif
+
   if (!m_buffer.empty()) {
     m_buffer.flush(
       [this](Event *evt) {
@@ -424,9 +1213,43 @@ void SocketUDP::receive() {
   if (m_receiving) return;
   if (m_paused) return;
 
+#ifdef PIPY_HAS_MMSG
+#ifdef PIPY_HAS_IO_URING
+  if (!m_uring)
+#endif
+  {
+    m_socket.async_wait(
+      udp::socket::wait_read,
+      [this](const std::error_code &ec) {
+        receive_batch(ec);
+      }
+    );
+    m_receiving = true;
+    return;
+  }
+#endif
+
   auto *buf = Data::make(RECEIVE_BUFFER_SIZE, &s_dp);
   buf->retain();
 
+#ifdef PIPY_HAS_IO_URING
+  if (m_uring) {
+    auto r = m_uring_receiver;
+    auto c = *buf->chunks().begin();
+    r->data = buf;
+    r->iov.iov_base = std::get<0>(c);
+    r->iov.iov_len = std::get<1>(c);
+    std::memset(&r->msg, 0, sizeof(r->msg));
+    r->msg.msg_name = m_from.data();
+    r->msg.msg_namelen = m_from.capacity();
+    r->msg.msg_iov = &r->iov;
+    r->msg.msg_iovlen = 1;
+    m_uring->recvmsg(m_socket.native_handle(), &r->msg, r);
+    m_receiving = true;
+    return;
+  }
+#endif
+
   m_socket.async_receive_from(
     DataChunks(buf->chunks()),
     m_from,
@@ -449,10 +1272,14 @@ void SocketUDP::send(Data *data) {
     std::cerr << data->size() << std::endl;
   }
 
+#ifdef PIPY_HAS_MMSG
+  queue(data, nullptr);
+#else
   m_socket.async_send(
     DataChunks(data->chunks()),
     SendHandler(this, data)
   );
+#endif
 }
 
 void SocketUDP::send(Data *data, const asio::ip::udp::endpoint &endpoint) {
@@ -468,11 +1295,15 @@ void SocketUDP::send(Data *data, const asio::ip::udp::endpoint &endpoint) {
     std::cerr << data->size() << std::endl;
   }
 
+#ifdef PIPY_HAS_MMSG
+  queue(data, &endpoint);
+#else
   m_socket.async_send_to(
     DataChunks(data->chunks()),
     endpoint,
     SendHandler(this, data)
   );
+#endif
 }
 
 void SocketUDP::close_peers(StreamEnd::Error err) {
@@ -488,6 +1319,9 @@ void SocketUDP::close_peers(StreamEnd::Error err) {
 
 void SocketUDP::close_socket() {
   if (m_socket.is_open()) {
+#ifdef PIPY_HAS_IO_URING
+    if (m_uring) m_uring->cancel(m_uring_receiver);
+#endif
     std::error_code ec;
     m_socket.close(ec);
     if (ec) {
@@ -533,42 +1367,8 @@ void SocketUDP::on_receive(Data *data, const std::error_code &ec, std::size_t n)
   if (ec != asio::error::operation_aborted && !m_closing) {
     if (n > 0) {
       data->pop(data->size() - n);
-      auto size = data->size();
-      m_traffic_read += size;
-
-      if (Log::is_enabled(Log::UDP)) {
-        std::cerr << Log::format_elapsed_time();
-        std::cerr << (m_is_inbound ? " udp >>>> recv " : " udp recv <<<< ");
-        std::cerr << size << std::endl;
-      }
-
-      Peer *peer = nullptr;
-      auto i = m_peers.find(m_from);
-      if (i == m_peers.end()) {
-        peer = on_socket_new_peer();
-        if (peer) {
-          peer->m_socket = this;
-          peer->m_endpoint = m_from;
-          peer->m_tick_write = Ticker::get()->tick();
-          m_peers[m_from] = peer;
-          peer->on_peer_open();
-          if (peer->m_closed) {
-            peer->on_peer_close();
-            peer = nullptr;
-          } else {
-            peer->m_opened = true;
-          }
-        }
-      } else {
-        peer = i->second;
-      }
-
-      if (peer) {
-        peer->m_tick_read = Ticker::get()->tick();
-        peer->on_peer_input(data);
-      } else {
-        on_socket_input(data);
-      }
+      data->shrink(&s_dp);
+      on_datagram(data);
     }
 
     if (ec) {
@@ -586,6 +1386,45 @@ void SocketUDP::on_receive(Data *data, const std::error_code &ec, std::size_t n)
   close_async();
 }
 
+void SocketUDP::on_datagram(Data *data) {
+  auto size = data->size();
+  m_traffic_read += size;
+
+  if (Log::is_enabled(Log::UDP)) {
+    std::cerr << Log::format_elapsed_time();
+    std::cerr << (m_is_inbound ? " udp >>>> recv " : " udp recv <<<< ");
+    std::cerr << size << std::endl;
+  }
+
+  Peer *peer = nullptr;
+  auto i = m_peers.find(m_from);
+  if (i == m_peers.end()) {
+    peer = on_socket_new_peer();
+    if (peer) {
+      peer->m_socket = this;
+      peer->m_endpoint = m_from;
+      peer->m_tick_write = Ticker::get()->tick();
+      m_peers[m_from] = peer;
+      peer->on_peer_open();
+      if (peer->m_closed) {
+        peer->on_peer_close();
+        peer = nullptr;
+      } else {
+        peer->m_opened = true;
+      }
+    }
+  } else {
+    peer = i->second;
+  }
+
+  if (peer) {
+    peer->m_tick_read = Ticker::get()->tick();
+    peer->on_peer_input(data);
+  } else {
+    on_socket_input(data);
+  }
+}
+
 void SocketUDP::on_send(Data *data, const std::error_code &ec, std::size_t n) {
   m_sending_count--;
 
@@ -610,6 +1449,232 @@ void SocketUDP::on_send(Data *data, const std::error_code &ec, std::size_t n) {
   close_async();
 }
 
+#ifdef PIPY_HAS_MMSG
+
+void SocketUDP::receive_batch(const std::error_code &ec) {
+  InputContext ic(this);
+
+  m_receiving = false;
+
+  if (ec != asio::error::operation_aborted && !m_closing) {
+    auto err = ec;
+    if (!err) {
+      auto &ring = MmsgRing::current();
+      auto fd = m_socket.native_handle();
+      for (int round = 0; round < 4 && !m_closing && !m_paused; round++) {
+        ring.reset(m_gro);
+        auto n = recvmmsg(fd, ring.msgs, MMSG_BATCH, MSG_DONTWAIT, nullptr);
+        if (n < 0) {
+          if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            err = std::error_code(errno, asio::error::get_system_category());
+          }
+          break;
+        }
+        for (int i = 0; i < n && !m_closing; i++) {
+          auto &h = ring.msgs[i].msg_hdr;
+          size_t len = ring.msgs[i].msg_len;
+          size_t seg = len;
+          if (m_gro) {
+            for (auto c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c)) {
+              if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+                int size;
+                std::memcpy(&size, CMSG_DATA(c), sizeof(size));
+                if (size > 0) seg = size;
+              }
+            }
+          }
+          if (h.msg_namelen > m_from.capacity()) continue;
+          std::memcpy(m_from.data(), &ring.addrs[i], h.msg_namelen);
+          m_from.resize(h.msg_namelen);
+          for (size_t p = 0; p < len && !m_closing; p += seg) {
+            pjs::Ref<Data> data(Data::make(ring.buffers[i] + p, int(std::min(seg, len - p)), &s_dp));
+            on_datagram(data);
+          }
+        }
+        if (n < MMSG_BATCH) break;
+      }
+    }
+
+    if (err) {
+      log_warn("error reading from peers", err);
+      m_closing = true;
+      close_peers(StreamEnd::READ_ERROR);
+      close_socket();
+
+    } else {
+      receive();
+    }
+  }
+
+  close_async();
+}
+
+void SocketUDP::queue(Data *data, const asio::ip::udp::endpoint *endpoint) {
+  Sending s;
+  s.data = data;
+  s.has_endpoint = (endpoint != nullptr);
+  if (endpoint) s.endpoint = *endpoint;
+  m_send_queue.push_back(s);
+
+  if (!m_flush_scheduled && !m_write_waiting) {
+    m_flush_scheduled = true;
+    asio::post(
+      Net::context(),
+      [this]() {
+        m_flush_scheduled = false;
+        flush_batch();
+      }
+    );
+  }
+}
+
+//
+// Completing a datagram can drop the last reference to this socket, so
+// the flush holds one extra count in m_sending_count until it is done.
+//
+
+void SocketUDP::flush_batch() {
+  std::vector<Sending> q;
+  q.swap(m_send_queue);
+  m_sending_count++;
+
+  struct mmsghdr msgs[MMSG_BATCH];
+  char controls[MMSG_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+  size_t begins[MMSG_BATCH], ends[MMSG_BATCH];
+  size_t iov_begins[MMSG_BATCH], iov_ends[MMSG_BATCH];
+  uint16_t segments[MMSG_BATCH];
+  std::vector<struct iovec> iovs;
+  std::error_code ec;
+  size_t i = 0;
+
+  while (i < q.size()) {
+    if (!m_socket.is_open()) {
+      ec = asio::error::operation_aborted;
+      break;
+    }
+
+    int m = 0;
+    iovs.clear();
+    for (auto j = i; j < q.size() && m < MMSG_BATCH; m++) {
+      const auto &first = q[j];
+      auto seg = first.data->size();
+      auto total = seg;
+      auto k = j + 1;
+      if (m_gso) {
+        while (k < q.size() && k - j < GSO_MAX_SEGMENTS) {
+          const auto &next = q[k];
+          auto size = next.data->size();
+          if (next.has_endpoint != first.has_endpoint) break;
+          if (first.has_endpoint && next.endpoint != first.endpoint) break;
+          if (size > seg || total + size > GSO_MAX_SIZE) break;
+          total += size;
+          k++;
+          if (size < seg) break;
+        }
+      }
+      begins[m] = j;
+      ends[m] = k;
+      segments[m] = (k - j > 1 ? seg : 0);
+      iov_begins[m] = iovs.size();
+      for (auto x = j; x < k; x++) {
+        for (const auto c : q[x].data->chunks()) {
+          struct iovec iov;
+          iov.iov_base = std::get<0>(c);
+          iov.iov_len = std::get<1>(c);
+          iovs.push_back(iov);
+        }
+      }
+      iov_ends[m] = iovs.size();
+      j = k;
+    }
+
+    for (int x = 0; x < m; x++) {
+      auto &h = msgs[x].msg_hdr;
+      std::memset(&msgs[x], 0, sizeof(msgs[x]));
+      h.msg_iov = iovs.data() + iov_begins[x];
+      h.msg_iovlen = iov_ends[x] - iov_begins[x];
+      const auto &first = q[begins[x]];
+      if (first.has_endpoint) {
+        h.msg_name = (void *)first.endpoint.data();
+        h.msg_namelen = first.endpoint.size();
+      }
+      if (segments[x]) {
+        h.msg_control = controls[x];
+        h.msg_controllen = sizeof(controls[x]);
+        auto c = CMSG_FIRSTHDR(&h);
+        c->cmsg_level = SOL_UDP;
+        c->cmsg_type = UDP_SEGMENT;
+        c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        std::memcpy(CMSG_DATA(c), &segments[x], sizeof(uint16_t));
+      }
+    }
+
+    auto n = sendmmsg(m_socket.native_handle(), msgs, m, MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      if ((errno == EIO || errno == EINVAL) && m_gso) {
+        m_gso = false;
+        continue;
+      }
+      ec = std::error_code(errno, asio::error::get_system_category());
+      break;
+    }
+
+    for (int x = 0; x < n; x++) {
+      for (auto y = begins[x]; y < ends[x]; y++) {
+        auto data = q[y].data;
+        on_send(data, std::error_code(), data->size());
+      }
+    }
+
+    if (n > 0) i = ends[n-1];
+  }
+
+  if (ec) {
+    for (; i < q.size(); i++) on_send(q[i].data, ec, 0);
+
+  } else if (i < q.size()) {
+    m_send_queue.insert(m_send_queue.begin(), q.begin() + i, q.end());
+    if (!m_write_waiting) {
+      m_write_waiting = true;
+      m_sending_count++;
+      m_socket.async_wait(
+        udp::socket::wait_write,
+        [this](const std::error_code &ec) {
+          m_write_waiting = false;
+          m_sending_count--;
+          flush_batch();
+        }
+      );
+    }
+  }
+
+  m_sending_count--;
+  close_async();
+}
+
+#endif // PIPY_HAS_MMSG
+
+#ifdef PIPY_HAS_IO_URING
+
+//
+// SocketUDP::UringReceiver
+//
+
+void SocketUDP::UringReceiver::on_uring_complete(int result) {
+  auto buf = data;
+  data = nullptr;
+  if (result >= 0) {
+    self->m_from.resize(msg.msg_namelen);
+    self->on_receive(buf, std::error_code(), result);
+  } else {
+    self->on_receive(buf, std::error_code(-result, asio::error::get_system_category()), 0);
+  }
+}
+
+#endif // PIPY_HAS_IO_URING
+
 //
 // SocketUDP::Peer
 //
@@ -642,7 +1707,7 @@ void SocketUDP::Peer::tick(double t) {
   }
 
   if (options.write_timeout > 0) {
-    if (r >= options.write_timeout) {
+    if (w >= options.write_timeout) {
       m_socket->m_peers.erase(m_endpoint);
       m_socket = nullptr;
       on_peer_input(StreamEnd::make(StreamEnd::WRITE_TIMEOUT));
@@ -782,6 +1847,7 @@ void SocketNetlink::on_receive(Data *data, const std::error_code &ec, std::size_
   if (ec != asio::error::operation_aborted && !m_closing) {
     if (n > 0) {
       data->pop(data->size() - n);
+      data->shrink(&s_dp);
       auto size = data->size();
       m_traffic_read += size;
 
@@ -28,11 +28,24 @@
 
 #include "pjs/pjs.hpp"
 #include "net.hpp"
+#include "uring.hpp"
+#include "sockmap.hpp"
 #include "input.hpp"
 #include "data.hpp"
 #include "buffer.hpp"
 #include "timer.hpp"
 
+#ifdef __linux__
+#define PIPY_HAS_SPLICE
+#define PIPY_HAS_MMSG
+#ifdef SO_ZEROCOPY
+#define PIPY_HAS_ZEROCOPY
+#endif
+#endif
+
+#include <deque>
+#include <vector>
+
 namespace pipy {
 
 //
@@ -44,11 +57,19 @@ public:
   struct Options {
     size_t congestion_limit = 1024*1024;
     size_t buffer_limit = 0;
+    size_t zero_copy_threshold = 0;
+    size_t receive_buffer_size = 0;
+    size_t send_buffer_size = 0;
+    size_t not_sent_lowat = 0;
     double read_timeout = 0;
     double write_timeout = 0;
     double idle_timeout = 60;
+    double busy_poll = 0;
+    int incoming_cpu = -1;
+    std::string congestion_control;
     bool keep_alive = true;
     bool no_delay = true;
+    bool fast_open = false;
   };
 
 protected:
@@ -78,9 +99,15 @@ protected:
 class SocketTCP :
   public SocketBase,
   public InputSource,
-  public FlushTarget,
-  public Ticker::Watcher
+  public FlushTarget
 {
+public:
+  void splice(SocketTCP *peer);
+
+  // Applies the tuning options to a socket before it connects or listens.
+  // Returns the name of the first option that failed or nullptr.
+  static auto set_sock_opts(int sock, const Options &options, bool listening) -> const char*;
+
 protected:
   SocketTCP(bool is_inbound, const Options &options)
     : SocketBase(is_inbound, options)
@@ -110,11 +137,13 @@ private:
   Data m_buffer_send;
   pjs::Ref<StreamEnd> m_eos;
   Congestion m_congestion;
+  Timer m_timeout_timer;
   double m_tick_read;
   double m_tick_write;
   State m_state = IDLE;
   bool m_opened = false;
   bool m_receiving = false;
+  bool m_receive_full = false;
   bool m_sending = false;
   bool m_paused = false;
   bool m_closed = false;
@@ -124,15 +153,123 @@ private:
   void shutdown_socket();
   void close_socket();
   void close_async();
+  void schedule_timeout();
+  void on_timeout();
 
   virtual void on_tap_open() override;
   virtual void on_tap_close() override;
   virtual void on_flush() override;
-  virtual void on_tick(double tick) override;
 
+  void on_readable(const std::error_code &ec);
   void on_receive(const std::error_code &ec, std::size_t n);
   void on_send(const std::error_code &ec, std::size_t n);
 
+#ifdef PIPY_HAS_ZEROCOPY
+
+  //
+  // SocketTCP::ZeroCopySend
+  //
+
+  struct ZeroCopySend {
+    uint32_t id;
+    Data data;
+  };
+
+  bool m_zero_copy = false;
+  uint32_t m_zero_copy_id = 0;
+  std::deque<ZeroCopySend> m_zero_copy_sends;
+
+  void zero_copy_reap();
+  void on_zero_copy_writable(const std::error_code &ec);
+  void on_zero_copy_done(const std::error_code &ec);
+
+  struct ZeroCopySendHandler : public SelfHandler<SocketTCP> {
+    using SelfHandler::SelfHandler;
+    ZeroCopySendHandler(const ZeroCopySendHandler &r) : SelfHandler(r) {}
+    void operator()(const std::error_code &ec) { self->on_zero_copy_writable(ec); }
+  };
+
+  struct ZeroCopyDoneHandler : public SelfHandler<SocketTCP> {
+    using SelfHandler::SelfHandler;
+    ZeroCopyDoneHandler(const ZeroCopyDoneHandler &r) : SelfHandler(r) {}
+    void operator()(const std::error_code &ec) { self->on_zero_copy_done(ec); }
+  };
+
+#endif // PIPY_HAS_ZEROCOPY
+
+  //
+  // SocketTCP::SendRound
+  //
+  // A socket that has already started a write in the current round of the
+  // event loop holds further flushes until the round is over, so that output
+  // produced under several input contexts in one round goes out in a single
+  // writev. A round ends when a handler posted at its first write gets to run.
+  //
+
+  struct DeferredSend : public List<DeferredSend>::Item {
+    SocketTCP* socket;
+    bool queued = false;
+    DeferredSend(SocketTCP *s) : socket(s) {}
+    ~DeferredSend();
+  };
+
+  class SendRound {
+  public:
+    static auto current() -> SendRound&;
+    auto id() const -> uint64_t { return m_id; }
+    void start();
+    void defer(DeferredSend *ds);
+    void cancel(DeferredSend *ds);
+  private:
+    uint64_t m_id = 1;
+    bool m_posted = false;
+    List<DeferredSend> m_deferred;
+    void end();
+  };
+
+  DeferredSend m_deferred_send = { this };
+  uint64_t m_send_round = 0;
+
+#ifdef PIPY_HAS_SPLICE
+  SocketTCP* m_splice_target = nullptr;
+  SocketTCP* m_splice_source = nullptr;
+  int m_splice_pipe[2] = { -1, -1 };
+  int m_splice_pending = 0;
+
+  bool splice_receive();
+  void splice_send();
+  void splice_detach();
+
+#ifdef PIPY_HAS_SOCKMAP
+  SockMap::Entry m_sockmap_entry;
+  bool m_sockmap_tried = false;
+
+  bool sockmap_attach();
+  void sockmap_detach();
+  void sockmap_readable();
+#endif
+  void on_splice_readable(const std::error_code &ec);
+  void on_splice_writable(const std::error_code &ec);
+
+  struct SpliceReceiveHandler : public SelfHandler<SocketTCP> {
+    using SelfHandler::SelfHandler;
+    SpliceReceiveHandler(const SpliceReceiveHandler &r) : SelfHandler(r) {}
+    void operator()(const std::error_code &ec) { self->on_splice_readable(ec); }
+  };
+
+  struct SpliceSendHandler : public SelfHandler<SocketTCP> {
+    using SelfHandler::SelfHandler;
+    SpliceSendHandler(const SpliceSendHandler &r) : SelfHandler(r) {}
+    void operator()(const std::error_code &ec) { self->on_splice_writable(ec); }
+  };
+#endif // PIPY_HAS_SPLICE
+
+  struct ReadableHandler : public SelfHandler<SocketTCP> {
+    using SelfHandler::SelfHandler;
+    ReadableHandler(const ReadableHandler &r) : SelfHandler(r) {}
+    void operator()(const std::error_code &ec) { self->on_readable(ec); }
+  };
+
   struct ReceiveHandler : public SelfHandler<SocketTCP> {
     using SelfHandler::SelfHandler;
     ReceiveHandler(const ReceiveHandler &r) : SelfHandler(r) {}
@@ -145,6 +282,36 @@ private:
     void operator()(const std::error_code &ec, std::size_t n) { self->on_send(ec, n); }
   };
 
+#ifdef PIPY_HAS_IO_URING
+
+  //
+  // SocketTCP::UringOps
+  //
+
+  static const int URING_MAX_IOV = 64;
+
+  struct UringOps : public pjs::Pooled<UringOps> {
+    struct Receiver : public Uring::Handler {
+      SocketTCP* self;
+      virtual void on_uring_complete(int result) override;
+    };
+
+    struct Sender : public Uring::Handler {
+      SocketTCP* self;
+      virtual void on_uring_complete(int result) override;
+    };
+
+    Receiver receiver;
+    Sender sender;
+    struct msghdr msg;
+    struct iovec iov[URING_MAX_IOV];
+  };
+
+  Uring* m_uring = nullptr;
+  UringOps* m_uring_ops = nullptr;
+
+#endif // PIPY_HAS_IO_URING
+
   static Data::Producer s_dp;
 };
 
@@ -235,8 +402,33 @@ private:
   virtual void on_tick(double tick) override;
 
   void on_receive(Data *data, const std::error_code &ec, std::size_t n);
+  void on_datagram(Data *data);
   void on_send(Data *data, const std::error_code &ec, std::size_t n);
 
+#ifdef PIPY_HAS_MMSG
+
+  //
+  // SocketUDP::Sending
+  //
+
+  struct Sending {
+    Data* data;
+    bool has_endpoint;
+    asio::ip::udp::endpoint endpoint;
+  };
+
+  std::vector<Sending> m_send_queue;
+  bool m_flush_scheduled = false;
+  bool m_write_waiting = false;
+  bool m_gro = false;
+  bool m_gso = false;
+
+  void receive_batch(const std::error_code &ec);
+  void queue(Data *data, const asio::ip::udp::endpoint *endpoint);
+  void flush_batch();
+
+#endif // PIPY_HAS_MMSG
+
   struct ReceiveHandler : public SelfDataHandler<SocketUDP, Data> {
     using SelfDataHandler::SelfDataHandler;
     ReceiveHandler(const ReceiveHandler &r) : SelfDataHandler(r) {}
@@ -249,6 +441,25 @@ private:
     void operator()(const std::error_code &ec, std::size_t n) { self->on_send(data, ec, n); }
   };
 
+#ifdef PIPY_HAS_IO_URING
+
+  //
+  // SocketUDP::UringReceiver
+  //
+
+  struct UringReceiver : public Uring::Handler, public pjs::Pooled<UringReceiver> {
+    SocketUDP* self;
+    Data* data = nullptr;
+    struct msghdr msg;
+    struct iovec iov;
+    virtual void on_uring_complete(int result) override;
+  };
+
+  Uring* m_uring = nullptr;
+  UringReceiver* m_uring_receiver = nullptr;
+
+#endif // PIPY_HAS_IO_URING
+
   static Data::Producer s_dp;
 };
 
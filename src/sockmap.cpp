@@ -0,0 +1,267 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "sockmap.hpp"
+
+#ifdef PIPY_HAS_SOCKMAP
+
+#include "log.hpp"
+
+#include "api/linux/bpf.h"
+
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#ifndef SO_COOKIE
+#define SO_COOKIE 57
+#endif
+
+namespace pipy {
+
+static const int SOCKMAP_MAX_ENTRIES = 65536;
+
+static int sys_bpf(enum bpf_cmd cmd, union bpf_attr *attr) {
+  return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static auto insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) -> struct bpf_insn {
+  struct bpf_insn i;
+  i.code = code;
+  i.dst_reg = dst;
+  i.src_reg = src;
+  i.off = off;
+  i.imm = imm;
+  return i;
+}
+
+static int create_map(const char *name, int type, int key_size, int value_size) {
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  std::strncpy(attr.map_name, name, sizeof(attr.map_name) - 1);
+  attr.map_type = type;
+  attr.key_size = key_size;
+  attr.value_size = value_size;
+  attr.max_entries = SOCKMAP_MAX_ENTRIES;
+  return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int load_program(const char *name, const std::vector<struct bpf_insn> &insts) {
+  static const char license[] = "Dual MIT/GPL";
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  std::strncpy(attr.prog_name, name, sizeof(attr.prog_name) - 1);
+  attr.prog_type = BPF_PROG_TYPE_SK_SKB;
+  attr.insn_cnt = insts.size();
+  attr.insns = (uintptr_t)insts.data();
+  attr.license = (uintptr_t)license;
+  return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int attach_program(int prog_fd, int map_fd, int attach_type) {
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.target_fd = map_fd;
+  attr.attach_bpf_fd = prog_fd;
+  attr.attach_type = attach_type;
+  return sys_bpf(BPF_PROG_ATTACH, &attr);
+}
+
+static int update_elem(int map_fd, const void *key, const void *value) {
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_fd = map_fd;
+  attr.key = (uintptr_t)key;
+  attr.value = (uintptr_t)value;
+  attr.flags = BPF_ANY;
+  return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static int delete_elem(int map_fd, const void *key) {
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_fd = map_fd;
+  attr.key = (uintptr_t)key;
+  return sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+bool SockMap::s_enabled = false;
+
+auto SockMap::get() -> SockMap* {
+  static SockMap *s_sock_map = nullptr;
+  static std::once_flag s_once;
+  if (!s_enabled) return nullptr;
+  std::call_once(s_once, []() {
+    auto m = new SockMap();
+    if (m->init()) {
+      s_sock_map = m;
+    } else {
+      Log::warn("[sockmap] sockmap offload is not available, falling back to splice: %s", std::strerror(errno));
+      delete m;
+    }
+  });
+  return s_sock_map;
+}
+
+bool SockMap::init() {
+  m_sock_map = create_map("pipy_sockmap", BPF_MAP_TYPE_SOCKMAP, sizeof(uint32_t), sizeof(uint32_t));
+  if (m_sock_map < 0) return false;
+
+  m_peer_map = create_map("pipy_sockpeer", BPF_MAP_TYPE_HASH, sizeof(uint64_t), sizeof(uint32_t));
+  if (m_peer_map < 0) return false;
+
+  // r0 = skb->len
+  // exit
+  std::vector<struct bpf_insn> parser;
+  parser.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_0, BPF_REG_1, offsetof(struct __sk_buff, len), 0));
+  parser.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+  // r6 = skb
+  // *(u64 *)(r10 - 8) = bpf_get_socket_cookie(skb)
+  // r0 = bpf_map_lookup_elem(peer_map, r10 - 8)
+  // if r0 == 0 return SK_PASS
+  // return bpf_sk_redirect_map(skb, sock_map, *(u32 *)r0, 0)
+  std::vector<struct bpf_insn> verdict;
+  verdict.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0));
+  verdict.push_back(insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_get_socket_cookie));
+  verdict.push_back(insn(BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_0, -8, 0));
+  verdict.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0));
+  verdict.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -8));
+  verdict.push_back(insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, m_peer_map));
+  verdict.push_back(insn(0, 0, 0, 0, 0));
+  verdict.push_back(insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem));
+  verdict.push_back(insn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 7, 0));
+  verdict.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_0, 0, 0));
+  verdict.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0));
+  verdict.push_back(insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_2, BPF_PSEUDO_MAP_FD, 0, m_sock_map));
+  verdict.push_back(insn(0, 0, 0, 0, 0));
+  verdict.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, 0));
+  verdict.push_back(insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_sk_redirect_map));
+  verdict.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+  verdict.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, SK_PASS));
+  verdict.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+  m_parser = load_program("pipy_parser", parser);
+  if (m_parser < 0) return false;
+
+  m_verdict = load_program("pipy_verdict", verdict);
+  if (m_verdict < 0) return false;
+
+  if (attach_program(m_parser, m_sock_map, BPF_SK_SKB_STREAM_PARSER)) return false;
+  if (attach_program(m_verdict, m_sock_map, BPF_SK_SKB_STREAM_VERDICT)) return false;
+
+  Log::info("[sockmap] sockmap offload enabled");
+  return true;
+}
+
+//
+// Both sockets go in or neither does. Sockets that are not established
+// TCP connections, or that the kernel otherwise refuses, simply stay on
+// the splice path.
+//
+
+bool SockMap::pair(int fd_a, int fd_b, Entry &a, Entry &b) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto slot_a = alloc_slot();
+  auto slot_b = alloc_slot();
+  if (slot_a < 0 || slot_b < 0) {
+    if (slot_a >= 0) free_slot(slot_a);
+    if (slot_b >= 0) free_slot(slot_b);
+    return false;
+  }
+  if (!insert(fd_a, slot_a, slot_b, a)) {
+    free_slot(slot_a);
+    free_slot(slot_b);
+    return false;
+  }
+  if (!insert(fd_b, slot_b, slot_a, b)) {
+    remove(a);
+    free_slot(slot_b);
+    return false;
+  }
+  return true;
+}
+
+void SockMap::unpair(Entry &e) {
+  if (e.slot < 0) return;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  remove(e);
+}
+
+bool SockMap::insert(int fd, int slot, int peer_slot, Entry &e) {
+  uint64_t cookie = 0;
+  socklen_t len = sizeof(cookie);
+  if (getsockopt(fd, SOL_SOCKET, SO_COOKIE, &cookie, &len)) return false;
+
+  uint32_t key = slot;
+  uint32_t peer = peer_slot;
+  uint32_t value = fd;
+  if (update_elem(m_peer_map, &cookie, &peer)) return false;
+  if (update_elem(m_sock_map, &key, &value)) {
+    delete_elem(m_peer_map, &cookie);
+    return false;
+  }
+
+  e.slot = slot;
+  e.cookie = cookie;
+  return true;
+}
+
+//
+// A closed socket leaves the sockmap by itself, so failing to delete
+// its slot is not an error.
+//
+
+void SockMap::remove(Entry &e) {
+  uint32_t key = e.slot;
+  delete_elem(m_peer_map, &e.cookie);
+  delete_elem(m_sock_map, &key);
+  free_slot(e.slot);
+  e.slot = -1;
+  e.cookie = 0;
+}
+
+auto SockMap::alloc_slot() -> int {
+  if (!m_free_slots.empty()) {
+    auto slot = m_free_slots.back();
+    m_free_slots.pop_back();
+    return slot;
+  }
+  if (m_slot_count >= SOCKMAP_MAX_ENTRIES) return -1;
+  return m_slot_count++;
+}
+
+void SockMap::free_slot(int slot) {
+  m_free_slots.push_back(slot);
+}
+
+} // namespace pipy
+
+#endif // PIPY_HAS_SOCKMAP
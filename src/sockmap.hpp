@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef SOCKMAP_HPP
+#define SOCKMAP_HPP
+
+#if defined(__linux__) && defined(PIPY_USE_BPF)
+#define PIPY_HAS_SOCKMAP
+#endif
+
+#ifdef PIPY_HAS_SOCKMAP
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace pipy {
+
+//
+// SockMap
+//
+// A process-wide BPF sockmap with an sk_skb verdict program attached,
+// used when --net-offload=sockmap is given. Once two spliced TCP sockets
+// are paired in it, bytes received on either one are redirected by the
+// kernel to the send queue of the other without waking up any thread.
+// The program finds the peer by the socket cookie, so pairing takes a
+// slot in the sockmap and a cookie entry in a hash map for each side.
+//
+
+class SockMap {
+public:
+  static void enable(bool b) { s_enabled = b; }
+  static bool enabled() { return s_enabled; }
+
+  // Returns nullptr when disabled or when the kernel refuses to set it up
+  static auto get() -> SockMap*;
+
+  struct Entry {
+    int slot = -1;
+    uint64_t cookie = 0;
+  };
+
+  bool pair(int fd_a, int fd_b, Entry &a, Entry &b);
+  void unpair(Entry &e);
+
+private:
+  SockMap() {}
+
+  bool init();
+  bool insert(int fd, int slot, int peer_slot, Entry &e);
+  void remove(Entry &e);
+  auto alloc_slot() -> int;
+  void free_slot(int slot);
+
+  int m_sock_map = -1;
+  int m_peer_map = -1;
+  int m_parser = -1;
+  int m_verdict = -1;
+  std::vector<int> m_free_slots;
+  int m_slot_count = 0;
+  std::mutex m_mutex;
+
+  static bool s_enabled;
+};
+
+} // namespace pipy
+
+#endif // PIPY_HAS_SOCKMAP
+
+#endif // SOCKMAP_HPP
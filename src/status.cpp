@@ -31,7 +31,9 @@
 #include "pipeline.hpp"
 #include "graph.hpp"
 #include "listener.hpp"
+#include "memory-limit.hpp"
 #include "outbound.hpp"
+#include "profiler.hpp"
 #include "pjs/pjs.hpp"
 #include "api/json.hpp"
 #include "api/logging.hpp"
@@ -45,6 +47,7 @@
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace pipy {
 
@@ -68,6 +71,7 @@ public:
     version,
     modules,
     graph,
+    stats,
     metrics,
     logs,
   };
@@ -224,6 +228,12 @@ private:
       capture_comma();
       m_capture.push('[');
       m_capturing_list_start = true;
+    } else if (is_at(Key::modules, Key::unknown, Key::stats)) {
+      m_capture_buffer.clear();
+      m_capture.reset();
+      m_capture.push('[');
+      m_capturing = true;
+      m_capturing_list_start = true;
     } else if (is_at(Key::logs)) {
       m_status.log_names.clear();
     }
@@ -236,6 +246,16 @@ private:
     if (m_capturing) {
       m_capture.push(']');
       m_capturing_list_start = false;
+      if (is_at(Key::modules, Key::unknown, Key::stats)) {
+        m_capture.flush();
+        m_capturing = false;
+        Status::ModuleInfo mi;
+        mi.filename = m_current_module;
+        auto i = m_status.modules.find(mi);
+        if (i != m_status.modules.end()) {
+          i->stats_json = m_capture_buffer.to_string();
+        }
+      }
     }
   }
 
@@ -271,6 +291,7 @@ StatusDeserializer::KeyName StatusDeserializer::s_key_names[] = {
   { Key::version, "version" },
   { Key::modules, "modules" },
   { Key::graph, "graph" },
+  { Key::stats, "stats" },
   { Key::metrics, "metrics" },
   { Key::logs, "logs" },
   { Key::unknown, nullptr },
@@ -296,6 +317,11 @@ void Status::update_global() {
       log_names.insert(name);
     }
   );
+  memory_limit = MemoryLimit::limit();
+  memory_usage = MemoryLimit::usage();
+  memory_level = MemoryLimit::level();
+  memory_shed = MemoryLimit::shed_count();
+
   timestamp = utils::now();
 }
 
@@ -304,10 +330,27 @@ void Status::update_local() {
   pools.clear();
   objects.clear();
   chunks.clear();
+  retainers.clear();
   pipelines.clear();
   buffers.clear();
   inbounds.clear();
   outbounds.clear();
+  loops.clear();
+
+  if (auto wt = WorkerThread::current()) {
+    auto &load = Net::current().load();
+    loops.insert({
+      wt->index(),
+      load.handlers,
+      load.busy,
+      load.lag_count > 0 ? load.lag_sum / load.lag_count : 0,
+      load.lag_max_all,
+      load.posts.load(),
+      load.cross_posts.load(),
+      load.pending.load(),
+      Data::thread_chunk_size(),
+    });
+  }
 
   std::map<std::string, std::set<PipelineLayout*>> all_modules;
   PipelineLayout::for_each([&](PipelineLayout *p) {
@@ -324,8 +367,11 @@ void Status::update_local() {
     Graph::from_pipelines(g, i.second);
     std::string error;
     std::stringstream ss;
-    g.to_json(error, ss);
-    modules.insert({ i.first, ss.str() });
+    ModuleInfo mi;
+    g.to_json(error, ss, &mi.stats);
+    mi.filename = i.first;
+    mi.graph = ss.str();
+    modules.insert(std::move(mi));
   }
 
   for (const auto &p : pjs::Pool::all()) {
@@ -336,6 +382,7 @@ void Status::update_local() {
         (size_t)c->size(),
         (size_t)c->allocated(),
         (size_t)c->pooled(),
+        (size_t)c->alloc_count(),
       });
     }
   }
@@ -350,11 +397,21 @@ void Status::update_local() {
 
   if (WorkerThread::current()->index() == 0) {
     Data::Producer::for_each([&](Data::Producer *producer) {
-      chunks.insert({
-        producer->name(),
-        producer->count(),
-      });
+      ChunkInfo info;
+      info.name = producer->name();
+      for (int i = 0; i < DATA_CHUNK_SIZE_CLASS_COUNT; i++) {
+        info.counts[i] = producer->count(i);
+      }
+      info.allocs = producer->allocs();
+      info.alloc_size = producer->alloc_size();
+      chunks.insert(info);
     });
+
+    std::map<std::string, size_t> sizes;
+    Profiler::retainers(sizes);
+    for (const auto &p : sizes) {
+      retainers.insert({ p.first, p.second });
+    }
   }
 
   BufferStats::for_each(
@@ -459,10 +516,12 @@ void Status::merge(const Status &other) {
   merge_sets(pools, other.pools);
   merge_sets(objects, other.objects);
   merge_sets(chunks, other.chunks);
+  merge_sets(retainers, other.retainers);
   merge_sets(pipelines, other.pipelines);
   merge_sets(buffers, other.buffers);
   merge_sets(inbounds, other.inbounds);
   merge_sets(outbounds, other.outbounds);
+  merge_sets(loops, other.loops);
 }
 
 bool Status::from_json(const Data &data, Data *metrics) {
@@ -502,6 +561,27 @@ void Status::to_json(Data::Builder &db, Data *metrics) const {
     push_str(mod.filename);
     db.push(":{\"graph\":");
     db.push(mod.graph);
+    if (!mod.stats.empty()) {
+      db.push(",\"stats\":[");
+      for (size_t i = 0; i < mod.stats.size(); i++) {
+        const auto &s = mod.stats[i];
+        char str[200];
+        auto len = std::snprintf(
+          str, sizeof(str), "%s[%llu,%llu,%llu,%llu,%llu]",
+          i > 0 ? "," : "",
+          (unsigned long long)s.active,
+          (unsigned long long)s.started,
+          (unsigned long long)s.events,
+          (unsigned long long)s.bytes,
+          (unsigned long long)s.buffered
+        );
+        db.push(str, len);
+      }
+      db.push(']');
+    } else if (!mod.stats_json.empty()) {
+      db.push(",\"stats\":");
+      db.push(mod.stats_json);
+    }
     db.push('}');
   }
   db.push('}');
@@ -588,14 +668,88 @@ void Status::dump_objects(Data::Builder &db) {
 }
 
 void Status::dump_chunks(Data::Builder &db) {
+  std::array<std::string, 2 + DATA_CHUNK_SIZE_CLASS_COUNT> header;
+  header[0] = "DATA";
+  header[1] = "SIZE(KB)";
+  for (int i = 0; i < DATA_CHUNK_SIZE_CLASS_COUNT; i++) {
+    auto size = DATA_CHUNK_SIZE_CLASSES[i];
+    header[2 + i] = size < 1024 ? "#" + std::to_string(size) : "#" + std::to_string(size / 1024) + "K";
+  }
+  std::list<std::array<std::string, 2 + DATA_CHUNK_SIZE_CLASS_COUNT>> rows;
+  for (const auto &i : chunks) {
+    rows.emplace_back();
+    auto &row = rows.back();
+    row[0] = i.name;
+    row[1] = std::to_string(i.size() / 1024);
+    for (int j = 0; j < DATA_CHUNK_SIZE_CLASS_COUNT; j++) {
+      row[2 + j] = std::to_string(i.counts[j]);
+    }
+  }
+  print_table(db, header, rows);
+}
+
+//
+// Sizes are estimated from sampled chunks and only cover chunks allocated
+// while sampling was on, which is throughout with --trace-chunks.
+//
+
+void Status::dump_retainers(Data::Builder &db) {
+  std::vector<const RetainerInfo*> sorted;
+  for (const auto &i : retainers) sorted.push_back(&i);
+  std::sort(
+    sorted.begin(), sorted.end(),
+    [](const RetainerInfo *a, const RetainerInfo *b) { return a->size > b->size; }
+  );
   std::list<std::array<std::string, 2>> rows;
+  for (const auto *i : sorted) {
+    rows.push_back({ i->name, std::to_string(i->size / 1024) });
+  }
+  print_table(db, { "RETAINER", "SIZE(KB)" }, rows);
+}
+
+//
+// Allocation and free rates between an earlier status and this one,
+// followed by the top retainers as of now.
+//
+
+void Status::dump_heap(const Status &before, double duration, Data::Builder &db) {
+  auto rate = [=](size_t a, size_t b) -> std::string {
+    return std::to_string(b > a ? (size_t)std::round((b - a) / duration) : 0);
+  };
+
+  std::list<std::array<std::string, 4>> pool_rows;
+  for (const auto &i : pools) {
+    auto p = before.pools.find(i);
+    auto allocs = (p == before.pools.end() ? 0 : p->allocs);
+    auto frees = (p == before.pools.end() ? 0 : p->allocs - p->allocated);
+    if (i.allocs == allocs) continue;
+    pool_rows.push_back({
+      i.name,
+      rate(allocs, i.allocs),
+      rate(frees, i.allocs - i.allocated),
+      std::to_string(i.allocated),
+    });
+  }
+  print_table(db, { "POOL", "#ALLOCS/S", "#FREES/S", "#USED" }, pool_rows);
+  db.push('\n');
+
+  std::list<std::array<std::string, 4>> chunk_rows;
   for (const auto &i : chunks) {
-    rows.push_back({
+    auto p = before.chunks.find(i);
+    auto allocs = (p == before.chunks.end() ? 0 : p->allocs);
+    auto alloc_size = (p == before.chunks.end() ? 0 : p->alloc_size);
+    if (i.allocs == allocs) continue;
+    chunk_rows.push_back({
       i.name,
-      std::to_string(DATA_CHUNK_SIZE * i.count / 1024),
+      rate(allocs, i.allocs),
+      rate(alloc_size / 1024, i.alloc_size / 1024),
+      std::to_string(i.size() / 1024),
     });
   }
-  print_table(db, { "DATA", "SIZE(KB)" }, rows);
+  print_table(db, { "DATA", "#CHUNKS/S", "KB/S", "SIZE(KB)" }, chunk_rows);
+  db.push('\n');
+
+  dump_retainers(db);
 }
 
 void Status::dump_buffers(Data::Builder &db) {
@@ -670,6 +824,37 @@ void Status::dump_outbound(Data::Builder &db) {
   print_table(db, { "OUTBOUND", "PORT", "#CONNECTIONS", "BUFFERED(KB)" }, rows);
 }
 
+void Status::dump_loops(Data::Builder &db) {
+  std::list<std::array<std::string, 9>> rows;
+  for (const auto &i : loops) {
+    char lag_avg[32], lag_max[32], busy[32];
+    std::snprintf(lag_avg, sizeof(lag_avg), "%.3f", i.lag_avg * 1000);
+    std::snprintf(lag_max, sizeof(lag_max), "%.3f", i.lag_max * 1000);
+    std::snprintf(busy, sizeof(busy), "%.3f", i.busy);
+    rows.push_back({
+      std::to_string(i.thread),
+      std::to_string(i.handlers),
+      busy,
+      lag_avg,
+      lag_max,
+      std::to_string(i.posts),
+      std::to_string(i.cross_posts),
+      std::to_string(i.pending),
+      std::to_string(i.chunks/1024),
+    });
+  }
+  print_table(db, { "THREAD", "#HANDLERS", "BUSY(S)", "LAG AVG(MS)", "LAG MAX(MS)", "#POSTS", "#CROSS-POSTS", "#PENDING", "CHUNKS(KB)" }, rows);
+}
+
+void Status::dump_memory(Data::Builder &db) {
+  std::list<std::array<std::string, 2>> rows;
+  rows.push_back({ "Limit(KB)", memory_limit > 0 ? std::to_string(memory_limit/1024) : std::string("none") });
+  rows.push_back({ "Data chunks(KB)", std::to_string(memory_usage/1024) });
+  rows.push_back({ "Level", MemoryLimit::level_name(MemoryLimit::Level(memory_level)) });
+  rows.push_back({ "Connections shed", std::to_string(memory_shed) });
+  print_table(db, { "MEMORY", "" }, rows);
+}
+
 void Status::dump_json(Data::Builder &db) {
   bool first;
   db.push('{');
@@ -694,7 +879,16 @@ void Status::dump_json(Data::Builder &db) {
     db.push('"');
     db.push(i.name);
     db.push("\":");
-    db.push(std::to_string(DATA_CHUNK_SIZE * i.count / 1024));
+    db.push(std::to_string(i.size() / 1024));
+  }
+  db.push("},\"retainers\":{");
+  first = true;
+  for (const auto &i : retainers) {
+    if (first) first = false; else db.push(',');
+    db.push('"');
+    db.push(utils::escape(i.name));
+    db.push("\":");
+    db.push(std::to_string(i.size / 1024));
   }
   db.push("},\"buffers\":{");
   first = true;
@@ -768,7 +962,39 @@ void Status::dump_json(Data::Builder &db) {
     db.push(std::to_string(i.buffered/1024));
     db.push('}');
   }
+  db.push("],\"loops\":[");
+  first = true;
+  for (const auto &i : loops) {
+    char str[200];
+    auto len = std::snprintf(
+      str, sizeof(str),
+      "{\"thread\":%d,\"handlers\":%llu,\"busy\":%g,\"lagAvg\":%g,\"lagMax\":%g,\"posts\":%llu,\"crossPosts\":%llu,\"pending\":%d,\"chunks\":%llu}",
+      i.thread,
+      (unsigned long long)i.handlers,
+      i.busy,
+      i.lag_avg,
+      i.lag_max,
+      (unsigned long long)i.posts,
+      (unsigned long long)i.cross_posts,
+      i.pending,
+      (unsigned long long)i.chunks
+    );
+    if (first) first = false; else db.push(',');
+    db.push(str, len);
+  }
   db.push(']');
+  {
+    char str[200];
+    auto len = std::snprintf(
+      str, sizeof(str),
+      ",\"memory\":{\"limit\":%llu,\"usage\":%llu,\"level\":\"%s\",\"shed\":%llu}",
+      (unsigned long long)memory_limit,
+      (unsigned long long)memory_usage,
+      MemoryLimit::level_name(MemoryLimit::Level(memory_level)),
+      (unsigned long long)memory_shed
+    );
+    db.push(str, len);
+  }
   db.push('}');
 }
 
@@ -27,6 +27,7 @@
 #define STATUS_HPP
 
 #include "data.hpp"
+#include "graph.hpp"
 
 #include <ostream>
 #include <set>
@@ -55,12 +56,17 @@ public:
   struct ModuleInfo {
     std::string filename;
     std::string graph;
+    mutable std::vector<Graph::Stats> stats; // one for each node in the graph
+    mutable std::string stats_json; // as received from a remote instance
 
     bool operator<(const ModuleInfo &r) const {
       return filename < r.filename;
     }
 
     auto operator+=(const ModuleInfo &r) const -> const ModuleInfo& {
+      if (stats.size() == r.stats.size()) {
+        for (size_t i = 0; i < stats.size(); i++) stats[i] += r.stats[i];
+      }
       return *this;
     }
   };
@@ -70,6 +76,7 @@ public:
     size_t size;
     mutable size_t allocated;
     mutable size_t pooled;
+    mutable size_t allocs;
 
     bool operator<(const PoolInfo &r) const {
       return name < r.name;
@@ -78,6 +85,7 @@ public:
     auto operator+=(const PoolInfo &r) const -> const PoolInfo& {
       allocated += r.allocated;
       pooled += r.pooled;
+      allocs += r.allocs;
       return *this;
     }
   };
@@ -98,14 +106,38 @@ public:
 
   struct ChunkInfo {
     std::string name;
-    mutable size_t count;
+    mutable size_t counts[DATA_CHUNK_SIZE_CLASS_COUNT];
+    mutable size_t allocs;
+    mutable size_t alloc_size;
+
+    auto size() const -> size_t {
+      size_t n = 0;
+      for (int i = 0; i < DATA_CHUNK_SIZE_CLASS_COUNT; i++) n += counts[i] * DATA_CHUNK_SIZE_CLASSES[i];
+      return n;
+    }
 
     bool operator<(const ChunkInfo &r) const {
       return name < r.name;
     }
 
     auto operator+=(const ChunkInfo &r) const -> const ChunkInfo& {
-      count += r.count;
+      for (int i = 0; i < DATA_CHUNK_SIZE_CLASS_COUNT; i++) counts[i] += r.counts[i];
+      allocs += r.allocs;
+      alloc_size += r.alloc_size;
+      return *this;
+    }
+  };
+
+  struct RetainerInfo {
+    std::string name;
+    mutable size_t size;
+
+    bool operator<(const RetainerInfo &r) const {
+      return name < r.name;
+    }
+
+    auto operator+=(const RetainerInfo &r) const -> const RetainerInfo& {
+      size += r.size;
       return *this;
     }
   };
@@ -187,8 +219,32 @@ public:
     }
   };
 
+  struct LoopInfo {
+    int thread;
+    uint64_t handlers;
+    double busy;
+    double lag_avg;
+    double lag_max;
+    uint64_t posts;
+    uint64_t cross_posts;
+    int pending;
+    size_t chunks;
+
+    bool operator<(const LoopInfo &r) const {
+      return thread < r.thread;
+    }
+
+    auto operator+=(const LoopInfo &r) const -> const LoopInfo& {
+      return *this;
+    }
+  };
+
   double since = 0;
   double timestamp = 0;
+  size_t memory_limit = 0;
+  size_t memory_usage = 0;
+  int memory_level = 0;
+  uint64_t memory_shed = 0;
   std::string uuid;
   std::string name;
   std::string ip;
@@ -197,10 +253,12 @@ public:
   std::set<PoolInfo> pools;
   std::set<ObjectInfo> objects;
   std::set<ChunkInfo> chunks;
+  std::set<RetainerInfo> retainers;
   std::set<PipelineInfo> pipelines;
   std::set<BufferInfo> buffers;
   std::set<InboundInfo> inbounds;
   std::set<OutboundInfo> outbounds;
+  std::set<LoopInfo> loops;
   std::set<std::string> log_names;
 
   void update_global();
@@ -211,10 +269,14 @@ public:
   void dump_pools(Data::Builder &db);
   void dump_objects(Data::Builder &db);
   void dump_chunks(Data::Builder &db);
+  void dump_retainers(Data::Builder &db);
+  void dump_heap(const Status &before, double duration, Data::Builder &db);
   void dump_buffers(Data::Builder &db);
   void dump_pipelines(Data::Builder &db);
   void dump_inbound(Data::Builder &db);
   void dump_outbound(Data::Builder &db);
+  void dump_loops(Data::Builder &db);
+  void dump_memory(Data::Builder &db);
   void dump_json(Data::Builder &db);
 };
 
@@ -150,20 +150,37 @@ private:
   virtual void close() override;
   virtual void dump(std::ostream &out) override;
 
+  //
+  // Values read or written are kept in memory so that listing a codebase
+  // does not go to the database for every file. Writes go through to both
+  // and the whole cache is dropped once it grows past the limit.
+  //
+
+  static const size_t CACHE_LIMIT = 64*1024*1024;
+
   leveldb::DB* m_db = nullptr;
+  std::map<std::string, Data> m_cache;
+  size_t m_cache_size = 0;
+
+  void cache_set(const std::string &key, const Data &data);
+  void cache_erase(const std::string &key);
+
+  friend class LevelDBStoreBatch;
 };
 
 class LevelDBStoreBatch : public Store::Batch {
-  LevelDBStoreBatch(leveldb::DB *db)
-    : m_db(db) {}
+  LevelDBStoreBatch(LevelDBStore *store)
+    : m_store(store) {}
 
   virtual void set(const std::string &key, const Data &data) override;
   virtual void erase(const std::string &key) override;
   virtual void commit() override;
   virtual void cancel() override;
 
-  leveldb::DB* m_db;
+  LevelDBStore* m_store;
   leveldb::WriteBatch m_batch;
+  std::map<std::string, Data> m_records;
+  std::set<std::string> m_deletions;
 
   friend class LevelDBStore;
 };
@@ -177,54 +194,91 @@ LevelDBStore::LevelDBStore(const std::string &path) {
 
 void LevelDBStore::keys(const std::string &base_key, std::set<std::string> &keys) {
   leveldb::Iterator* it = m_db->NewIterator(leveldb::ReadOptions());
-  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+  for (it->Seek(base_key); it->Valid(); it->Next()) {
     auto key = it->key().ToString();
-    if (utils::starts_with(key, base_key)) {
-      keys.insert(key);
-    }
+    if (!utils::starts_with(key, base_key)) break;
+    keys.insert(key);
   }
   delete it;
 }
 
 bool LevelDBStore::get(const std::string &key, Data &data) {
+  auto i = m_cache.find(key);
+  if (i != m_cache.end()) {
+    data = i->second;
+    return true;
+  }
   std::string value;
   auto status = m_db->Get(leveldb::ReadOptions(), key, &value);
   if (status.IsNotFound()) return false;
   data.clear();
   data.push(value, &s_dp);
+  cache_set(key, data);
   return true;
 }
 
 void LevelDBStore::set(const std::string &key, const Data &data) {
   m_db->Put(leveldb::WriteOptions(), key, data.to_string());
+  cache_set(key, data);
 }
 
 void LevelDBStore::erase(const std::string &key) {
   m_db->Delete(leveldb::WriteOptions(), key);
+  cache_erase(key);
 }
 
 auto LevelDBStore::batch() -> Batch* {
-  return new LevelDBStoreBatch(m_db);
+  return new LevelDBStoreBatch(this);
 }
 
 void LevelDBStore::close() {
+  m_cache.clear();
+  m_cache_size = 0;
   delete m_db;
   m_db = nullptr;
 }
 
+void LevelDBStore::cache_set(const std::string &key, const Data &data) {
+  cache_erase(key);
+  if (m_cache_size + data.size() > CACHE_LIMIT) {
+    m_cache.clear();
+    m_cache_size = 0;
+  }
+  m_cache[key] = data;
+  m_cache_size += data.size();
+}
+
+void LevelDBStore::cache_erase(const std::string &key) {
+  auto i = m_cache.find(key);
+  if (i != m_cache.end()) {
+    m_cache_size -= i->second.size();
+    m_cache.erase(i);
+  }
+}
+
 void LevelDBStore::dump(std::ostream &out) {
 }
 
 void LevelDBStoreBatch::set(const std::string &key, const Data &data) {
   m_batch.Put(key, data.to_string());
+  m_records[key] = data;
+  m_deletions.erase(key);
 }
 
 void LevelDBStoreBatch::erase(const std::string &key) {
   m_batch.Delete(key);
+  m_records.erase(key);
+  m_deletions.insert(key);
 }
 
 void LevelDBStoreBatch::commit() {
-  m_db->Write(leveldb::WriteOptions(), &m_batch);
+  auto status = m_store->m_db->Write(leveldb::WriteOptions(), &m_batch);
+  for (const auto &key : m_deletions) m_store->cache_erase(key);
+  if (status.ok()) {
+    for (const auto &rec : m_records) m_store->cache_set(rec.first, rec.second);
+  } else {
+    for (const auto &rec : m_records) m_store->cache_erase(rec.first);
+  }
   delete this;
 }
 
@@ -37,33 +37,47 @@ SharedTableBase::SharedTableBase(size_t entry_size)
   std::memset(m_ranges, 0, sizeof(m_ranges));
 }
 
+thread_local SharedTableBase::LocalFreeLists SharedTableBase::s_local_free_lists;
+
+SharedTableBase::LocalFreeLists::~LocalFreeLists() {
+  for (auto &l : lists) {
+    if (auto *t = l.table) {
+      if (auto i = l.head) {
+        auto *e = t->get_entry(i);
+        while (auto next = e->m_next_free) e = t->get_entry(next);
+        t->push_free_list(i, e);
+      }
+    }
+  }
+}
+
 auto SharedTableBase::get_entry(int i) -> Entry* {
   int x, y, z;
   index_to_xyz(i, x, y, z);
-  auto r = m_ranges[x].load(std::memory_order_relaxed); if (!r) return nullptr;
-  auto c = r->chunks[y].load(std::memory_order_relaxed); if (!c) return nullptr;
+  auto r = m_ranges[x].load(std::memory_order_acquire); if (!r) return nullptr;
+  auto c = r->chunks[y].load(std::memory_order_acquire); if (!c) return nullptr;
   return reinterpret_cast<Entry*>(c + z * m_entry_size);
 }
 
 auto SharedTableBase::add_entry(int i) -> Entry* {
   int x, y, z;
   index_to_xyz(i, x, y, z);
-  auto r = m_ranges[x].load(std::memory_order_relaxed);
+  auto r = m_ranges[x].load(std::memory_order_acquire);
   if (!r) {
     auto *p = new Range;
     std::memset(p, 0, sizeof(Range));
-    if (m_ranges[x].compare_exchange_weak(r, p, std::memory_order_relaxed)) {
+    if (m_ranges[x].compare_exchange_strong(r, p, std::memory_order_acq_rel)) {
       r = p;
     } else {
       delete p;
     }
   }
-  auto c = r->chunks[y].load();
+  auto c = r->chunks[y].load(std::memory_order_acquire);
   if (!c) {
     auto size = 256 * m_entry_size;
     auto *p = new char[size];
     std::memset(p, 0, size);
-    if (r->chunks[y].compare_exchange_weak(c, p, std::memory_order_relaxed)) {
+    if (r->chunks[y].compare_exchange_strong(c, p, std::memory_order_acq_rel)) {
       c = p;
     } else {
       delete [] p;
@@ -73,7 +87,17 @@ auto SharedTableBase::add_entry(int i) -> Entry* {
 }
 
 auto SharedTableBase::alloc_entry() -> Entry* {
-  auto i_npop = m_free_id.load(std::memory_order_relaxed);
+  if (auto *l = local_free_list()) {
+    if (auto i = l->head) {
+      auto e = get_entry(i);
+      l->head = e->m_next_free;
+      l->count--;
+      e->index = i;
+      e->m_hold_count.store(1, std::memory_order_relaxed);
+      return e;
+    }
+  }
+  auto i_npop = m_free_id.load(std::memory_order_acquire);
   while (auto i = uint32_t(i_npop)) {
     auto e = get_entry(i);
     auto npop = uint32_t(i_npop >> 32);
@@ -81,7 +105,7 @@ auto SharedTableBase::alloc_entry() -> Entry* {
     if (m_free_id.compare_exchange_weak(
       i_npop, i_npop_new,
       std::memory_order_acquire,
-      std::memory_order_relaxed
+      std::memory_order_acquire
     )) {
       e->index = i;
       e->m_hold_count.store(1, std::memory_order_relaxed);
@@ -96,12 +120,40 @@ auto SharedTableBase::alloc_entry() -> Entry* {
 }
 
 void SharedTableBase::free_entry(Entry *e) {
-  int i = e->index;
+  uint32_t i = e->index;
+  auto *l = local_free_list();
+  if (!l) {
+    push_free_list(i, e);
+    return;
+  }
+
+  e->m_next_free = l->head;
+  l->head = i;
+  if (++l->count > LOCAL_FREE_MAX) {
+    auto *tail = e;
+    for (int n = 1; n < LOCAL_FREE_BATCH; n++) tail = get_entry(tail->m_next_free);
+    l->head = tail->m_next_free;
+    l->count -= LOCAL_FREE_BATCH;
+    push_free_list(i, tail);
+  }
+}
+
+auto SharedTableBase::local_free_list() -> LocalFreeList* {
+  LocalFreeList *unused = nullptr;
+  for (auto &l : s_local_free_lists.lists) {
+    if (l.table == this) return &l;
+    if (!l.table && !unused) unused = &l;
+  }
+  if (unused) unused->table = this;
+  return unused;
+}
+
+void SharedTableBase::push_free_list(uint32_t head, Entry *tail) {
   uint64_t i_npop = m_free_id.load(std::memory_order_relaxed);
   uint64_t i_npop_new;
   do {
-    e->m_next_free = uint32_t(i_npop);
-    i_npop_new = (i_npop & (~uint64_t(0) << 32)) | uint32_t(i);
+    tail->m_next_free = uint32_t(i_npop);
+    i_npop_new = (i_npop & (~uint64_t(0) << 32)) | head;
   }
   while (!m_free_id.compare_exchange_weak(
     i_npop, i_npop_new,
@@ -167,11 +167,42 @@ private:
     std::atomic<char*> chunks[256];
   };
 
+  //
+  // SharedTableBase::LocalFreeList
+  //
+  // Entries freed on a thread are kept on a list of that thread first
+  // and reused by its next allocations. Only when the list grows past
+  // LOCAL_FREE_MAX is a batch of them pushed back to the shared list,
+  // with a single CAS.
+  //
+
+  enum {
+    LOCAL_FREE_MAX = 64,
+    LOCAL_FREE_BATCH = 32,
+    LOCAL_FREE_TABLES = 8,
+  };
+
+  struct LocalFreeList {
+    SharedTableBase *table = nullptr;
+    uint32_t head = 0;
+    int count = 0;
+  };
+
+  struct LocalFreeLists {
+    LocalFreeList lists[LOCAL_FREE_TABLES];
+    ~LocalFreeLists();
+  };
+
   size_t m_entry_size;
   std::atomic<Range*> m_ranges[256];
   std::atomic<uint32_t> m_max_id;
   std::atomic<uint64_t> m_free_id;
 
+  auto local_free_list() -> LocalFreeList*;
+  void push_free_list(uint32_t head, Entry *tail);
+
+  thread_local static LocalFreeLists s_local_free_lists;
+
   static void index_to_xyz(int i, int &x, int &y, int &z) {
     z = 0xff & (i >> 0);
     y = 0xff & (i >> 8);
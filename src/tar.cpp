@@ -23,6 +23,7 @@
  *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <cstdio>
 #include <cstring>
 #include "tar.hpp"
 #include "utils.hpp"
@@ -130,6 +131,56 @@ Tarball::Tarball(const char *data, size_t size) {
   }
 }
 
+//
+// TarballWriter
+//
+
+void TarballWriter::add(const std::string &path, const char *data, size_t size) {
+  auto name = path;
+  while (!name.empty() && name.front() == '/') name.erase(0, 1);
+
+  if (name.length() >= 100) {
+    auto record = " path=" + name + "\n";
+    auto n = record.length();
+    auto len = std::to_string(n);
+    while (std::to_string(n + len.length()) != len) len = std::to_string(n + len.length());
+    record = len + record;
+    header("PaxHeader", 'x', record.length());
+    m_buffer.append(record);
+    m_buffer.append((512 - record.length() % 512) % 512, '\0');
+    name = name.substr(0, 99);
+  }
+
+  header(name, '0', size);
+  m_buffer.append(data, size);
+  m_buffer.append((512 - size % 512) % 512, '\0');
+}
+
+auto TarballWriter::finish() -> const std::string& {
+  m_buffer.append(1024, '\0');
+  return m_buffer;
+}
+
+void TarballWriter::header(const std::string &name, char type, size_t size) {
+  char h[512];
+  std::memset(h, 0, sizeof(h));
+  std::strncpy(h, name.c_str(), 99);
+  std::snprintf(h + 100, 8, "%07o", 0644);
+  std::snprintf(h + 108, 8, "%07o", 0);
+  std::snprintf(h + 116, 8, "%07o", 0);
+  std::snprintf(h + 124, 12, "%011llo", (unsigned long long)size);
+  std::snprintf(h + 136, 12, "%011o", 0);
+  h[156] = type;
+  std::memcpy(h + 257, "ustar", 6);
+  std::memcpy(h + 263, "00", 2);
+  std::memset(h + 148, ' ', 8);
+  unsigned int sum = 0;
+  for (int i = 0; i < 512; i++) sum += (unsigned char)h[i];
+  std::snprintf(h + 148, 8, "%06o", sum);
+  h[155] = ' ';
+  m_buffer.append(h, sizeof(h));
+}
+
 void Tarball::list(std::set<std::string> &paths) {
   for (const auto &i : m_files) {
     paths.insert(i.first);
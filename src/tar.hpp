@@ -48,6 +48,24 @@ private:
   std::map<std::string, File> m_files;
 };
 
+//
+// TarballWriter
+//
+// Packs files into an uncompressed ustar archive in memory. Paths too
+// long for the header are carried in a pax extended header instead.
+//
+
+class TarballWriter {
+public:
+  void add(const std::string &path, const char *data, size_t size);
+  auto finish() -> const std::string&;
+
+private:
+  std::string m_buffer;
+
+  void header(const std::string &name, char type, size_t size);
+};
+
 } // namespace pipy
 
 #endif // TAR_HPP
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+
+namespace pipy {
+
+//
+// ThreadPool
+//
+// Helper threads for CPU-heavy work that would otherwise hold up a
+// worker's event loop. Tasks must not touch any thread-local state of
+// the submitting worker, which includes pjs objects and Data, and should
+// post their results back to the worker's Net when done.
+//
+
+class ThreadPool {
+public:
+
+  // Sized to the number of CPUs and never destroyed
+  static auto shared() -> ThreadPool&;
+
+  ThreadPool(int size);
+
+  auto size() const -> int { return m_size; }
+  void run(const std::function<void()> &task);
+
+private:
+  int m_size;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::list<std::function<void()>> m_tasks;
+
+  void main();
+};
+
+} // namespace pipy
+
+#endif // THREAD_POOL_HPP
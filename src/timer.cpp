@@ -26,46 +26,232 @@
 #include "timer.hpp"
 #include "input.hpp"
 
+#include <algorithm>
+#include <limits>
+
 namespace pipy {
 
-thread_local List<Timer> Timer::s_all_timers;
+#ifdef _MSC_VER
+static inline int ctz64(uint64_t x) {
+  unsigned long i;
+  _BitScanForward64(&i, x);
+  return i;
+}
+#else
+static inline int ctz64(uint64_t x) {
+  return __builtin_ctzll(x);
+}
+#endif
 
-void Timer::cancel_all() {
-  for (auto *timer = s_all_timers.head(); timer; timer = timer->next()) {
-    timer->cancel();
+//
+// Timer::Wheel
+//
+// A per-thread hierarchical timing wheel with millisecond resolution
+// backing all Timers of a thread. Each level has 64 slots, each slot
+// 64 times as wide as one at the level below. Timers are linked into
+// slots intrusively so scheduling and canceling are O(1) and allocate
+// nothing. A timer is moved down a level whenever the wheel reaches
+// its slot, until it expires from level 0. A single asio timer is
+// armed at the earliest slot that has anything in it.
+//
+
+class Timer::Wheel {
+public:
+  static auto current() -> Wheel* {
+    thread_local static Wheel s_wheel;
+    return &s_wheel;
   }
+
+  void add(Timer *t, double timeout);
+  void remove(Timer *t);
+
+private:
+  enum {
+    SLOT_BITS = 6,
+    SLOT_COUNT = 1 << SLOT_BITS,
+    SLOT_MASK = SLOT_COUNT - 1,
+    LEVELS = 6,
+  };
+
+  Wheel()
+    : m_now(clock())
+    , m_timer(Net::context()) {}
+
+  Timer* m_slots[LEVELS][SLOT_COUNT] = {};
+  uint64_t m_bitmaps[LEVELS] = {};
+  size_t m_count = 0;
+  uint64_t m_now;
+  uint64_t m_armed = 0;
+  asio::steady_timer m_timer;
+
+  static auto clock() -> uint64_t {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+  }
+
+  void place(Timer *t);
+  void advance(uint64_t to);
+  void cascade(int level);
+  void expire(int index);
+  void arm();
+  auto next_wake() -> uint64_t;
+};
+
+void Timer::Wheel::add(Timer *t, double timeout) {
+  auto now = clock();
+  if (!m_count) m_now = now;
+  auto ms = timeout > 0 ? (uint64_t)(timeout * 1000) : 0;
+  auto max = (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+  t->m_expire = std::min(std::max(now + ms, m_now + 1), m_now + max);
+  place(t);
+  m_count++;
+  arm();
 }
 
-void Timer::schedule(double timeout, const std::function<void()> &handler) {
-  cancel();
-  pjs::Ref<Handler> h = new Handler(handler);
-  m_handler = h;
-  m_timer.expires_after(std::chrono::milliseconds((long long)(timeout * 1000)));
+void Timer::Wheel::remove(Timer *t) {
+  auto level = t->m_slot / SLOT_COUNT;
+  auto index = t->m_slot % SLOT_COUNT;
+  auto prev = t->m_wheel_prev;
+  auto next = t->m_wheel_next;
+  if (prev) prev->m_wheel_next = next; else m_slots[level][index] = next;
+  if (next) next->m_wheel_prev = prev;
+  if (!m_slots[level][index]) m_bitmaps[level] &= ~(uint64_t(1) << index);
+  t->m_wheel_prev = nullptr;
+  t->m_wheel_next = nullptr;
+  t->m_slot = -1;
+  m_count--;
+
+  // Don't keep the event loop alive with nothing left to wait for
+  if (!m_count && m_armed) {
+    m_timer.cancel();
+    m_armed = 0;
+  }
+}
+
+void Timer::Wheel::place(Timer *t) {
+  auto delta = t->m_expire - m_now;
+  int level = 0;
+  while (level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) level++;
+  auto index = int((t->m_expire >> (SLOT_BITS * level)) & SLOT_MASK);
+  auto &head = m_slots[level][index];
+  t->m_wheel_prev = nullptr;
+  t->m_wheel_next = head;
+  if (head) head->m_wheel_prev = t;
+  head = t;
+  t->m_slot = level * SLOT_COUNT + index;
+  m_bitmaps[level] |= uint64_t(1) << index;
+}
+
+void Timer::Wheel::advance(uint64_t to) {
+  while (m_now < to) {
+
+    // Nothing due at level 0: skip to right before it wraps around
+    if (!m_bitmaps[0]) {
+      auto last = m_now | SLOT_MASK;
+      if (last >= to) {
+        m_now = to;
+        break;
+      }
+      m_now = last;
+    }
+
+    auto t = ++m_now;
+    if (!(t & SLOT_MASK)) cascade(1);
+    expire(t & SLOT_MASK);
+  }
+}
+
+void Timer::Wheel::cascade(int level) {
+  if (level >= LEVELS) return;
+  auto index = int((m_now >> (SLOT_BITS * level)) & SLOT_MASK);
+  if (!index) cascade(level + 1);
+  auto t = m_slots[level][index];
+  m_slots[level][index] = nullptr;
+  m_bitmaps[level] &= ~(uint64_t(1) << index);
+  while (t) {
+    auto next = t->m_wheel_next;
+    place(t);
+    t = next;
+  }
+}
+
+void Timer::Wheel::expire(int index) {
+  while (auto t = m_slots[0][index]) {
+    remove(t);
+
+    // The handler might reschedule or even destroy its timer
+    auto handler = std::move(t->m_handler);
+    t->m_handler = nullptr;
+    InputContext ic;
+    handler();
+  }
+}
+
+void Timer::Wheel::arm() {
+  if (!m_count) return;
+  auto due = next_wake();
+  if (m_armed && m_armed <= due) return;
+  m_armed = due;
+  m_timer.expires_at(
+    std::chrono::steady_clock::time_point(
+      std::chrono::milliseconds(due)
+    )
+  );
   m_timer.async_wait(
-    [=](const asio::error_code &ec) {
-      InputContext ic;
-      h->trigger(ec);
+    [this](const asio::error_code &ec) {
+      if (ec == asio::error::operation_aborted) return;
+      auto now = clock();
+      Net::current().load().lagged((now - std::min(now, m_armed)) / 1000.0);
+      m_armed = 0;
+      advance(now);
+      arm();
     }
   );
 }
 
-void Timer::cancel() {
-  if (m_handler) {
-    asio::error_code ec;
-    m_timer.cancel(ec);
-    m_handler->cancel();
-    m_handler = nullptr;
+auto Timer::Wheel::next_wake() -> uint64_t {
+  uint64_t due = std::numeric_limits<uint64_t>::max();
+  for (int level = 0; level < LEVELS; level++) {
+    auto bits = m_bitmaps[level];
+    if (!bits) continue;
+    auto shift = SLOT_BITS * level;
+    auto base = m_now >> shift;
+    auto from = (base + 1) & SLOT_MASK;
+    auto rotated = from ? (bits >> from) | (bits << (SLOT_COUNT - from)) : bits;
+    auto t = (base + 1 + ctz64(rotated)) << shift;
+    if (t < due) due = t;
   }
+  return due;
 }
 
-void Timer::Handler::trigger(const asio::error_code &ec) {
-  if (!m_canceled && ec != asio::error::operation_aborted) {
-    m_handler();
+//
+// Timer
+//
+
+thread_local List<Timer> Timer::s_all_timers;
+
+void Timer::cancel_all() {
+  for (auto *timer = s_all_timers.head(); timer; timer = timer->next()) {
+    timer->cancel();
   }
 }
 
-void Timer::Handler::cancel() {
-  m_canceled = true;
+Timer::Timer()
+  : m_wheel(Wheel::current())
+{
+  s_all_timers.push(this);
+}
+
+void Timer::schedule(double timeout, const std::function<void()> &handler) {
+  cancel();
+  m_handler = handler;
+  m_wheel->add(this, timeout);
+}
+
+void Timer::cancel() {
+  if (m_slot >= 0) m_wheel->remove(this);
+  m_handler = nullptr;
 }
 
 //
@@ -77,6 +263,11 @@ auto Ticker::get() -> Ticker* {
   return &s_ticker;
 }
 
+auto Ticker::tick() const -> double {
+  auto t = std::chrono::steady_clock::now() - m_start;
+  return double(std::chrono::duration_cast<std::chrono::seconds>(t).count());
+}
+
 void Ticker::start() {
   if (!m_is_running) {
     schedule();
@@ -94,7 +285,7 @@ void Ticker::stop() {
 void Ticker::schedule() {
   m_timer.schedule(
     1, [this]() {
-      auto t = ++m_tick;
+      auto t = tick();
       m_visiting = m_watchers.head();
       while (auto w = m_visiting) {
         m_visiting = m_visiting->next();
@@ -29,6 +29,8 @@
 #include "net.hpp"
 #include "list.hpp"
 
+#include <chrono>
+
 namespace pipy {
 
 //
@@ -39,9 +41,7 @@ class Timer : public List<Timer>::Item {
 public:
   static void cancel_all();
 
-  Timer() : m_timer(Net::context()) {
-    s_all_timers.push(this);
-  }
+  Timer();
 
   ~Timer() {
     s_all_timers.remove(this);
@@ -52,24 +52,14 @@ public:
   void cancel();
 
 private:
-  class Handler :
-    public pjs::RefCount<Handler>,
-    public pjs::Pooled<Handler>
-  {
-  public:
-    Handler(const std::function<void()> &handler)
-      : m_handler(handler) {}
-
-    void trigger(const asio::error_code &ec);
-    void cancel();
-
-  private:
-    std::function<void()> m_handler;
-    bool m_canceled = false;
-  };
+  class Wheel;
 
-  asio::steady_timer m_timer;
-  pjs::Ref<Handler> m_handler;
+  Wheel* m_wheel;
+  Timer* m_wheel_prev = nullptr;
+  Timer* m_wheel_next = nullptr;
+  uint64_t m_expire = 0;
+  int m_slot = -1;
+  std::function<void()> m_handler;
 
   thread_local static List<Timer> s_all_timers;
 };
@@ -93,9 +83,8 @@ public:
 
   static auto get() -> Ticker*;
 
-  double tick() const {
-    return m_tick;
-  }
+  // Whole seconds since the ticker was created, whether or not anyone is watching
+  double tick() const;
 
   void watch(Watcher *w) {
     if (!w->m_ticker) {
@@ -121,7 +110,7 @@ private:
   List<Watcher> m_watchers;
   Timer m_timer;
   Watcher* m_visiting = nullptr;
-  double m_tick = 0;
+  std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
   bool m_is_running = false;
 
   void start();
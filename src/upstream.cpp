@@ -0,0 +1,209 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "upstream.hpp"
+#include "context.hpp"
+#include "filter.hpp"
+#include "pipeline.hpp"
+
+#include <vector>
+
+namespace pipy {
+
+//
+// Upstream::Key
+//
+// Functions and objects taking part in the options are identified by
+// their addresses, so only callers handing over the very same ones can
+// share an Upstream.
+//
+
+void Upstream::Key::add(const std::string &str) {
+  m_str += '|';
+  m_str += std::to_string(str.length());
+  m_str += ':';
+  m_str += str;
+}
+
+void Upstream::Key::add(pjs::Str *str) {
+  if (str) add(str->str()); else m_str += "|-";
+}
+
+void Upstream::Key::add(double num) {
+  m_str += '|';
+  m_str += std::to_string(num);
+}
+
+void Upstream::Key::add(const void *ptr) {
+  m_str += "|@";
+  m_str += std::to_string(uintptr_t(ptr));
+}
+
+void Upstream::Key::add(const Outbound::Options &options) {
+  add(double(options.protocol));
+  add(double(options.congestion_limit));
+  add(double(options.buffer_limit));
+  add(options.connect_timeout);
+  add(options.read_timeout);
+  add(options.write_timeout);
+  add(options.idle_timeout);
+  add(double(options.retry_count));
+  add(options.retry_delay);
+  add(double(options.keep_alive));
+  add(double(options.no_delay));
+}
+
+void Upstream::Key::add(const tls::Client::Options &options) {
+  thread_local static pjs::ConstStr s_cert("cert");
+  thread_local static pjs::ConstStr s_key("key");
+  add(double(int(options.minVersion)));
+  add(double(int(options.maxVersion)));
+  add(options.ciphers.get());
+  if (auto *c = options.certificate.get()) {
+    pjs::Value cert, key;
+    c->get(s_cert, cert);
+    c->get(s_key, key);
+    add(cert.is_object() ? (const void *)cert.o() : (const void *)c);
+    add(key.is_object() ? (const void *)key.o() : (const void *)c);
+  } else {
+    add((const void *)nullptr);
+  }
+  for (const auto &t : options.trusted) add((const void *)t.get());
+  add((const void *)options.handshake.get());
+  add((const void *)options.on_verify_f.get());
+  add((const void *)options.on_state_f.get());
+  add(double(options.alpn));
+  add(double(options.offload_private_key));
+  add(double(options.dynamic_record_size));
+  for (const auto &p : options.alpn_list) add(p);
+  add(options.sni.get());
+  add((const void *)options.sni_f.get());
+}
+
+void Upstream::Key::add(const MuxSession::Options &options) {
+  add(options.max_idle);
+  add(double(options.max_queue));
+  add(double(options.max_messages));
+  add(double(options.min_idle));
+  add(double(options.max_connections));
+  add(options.queue_target);
+  add(options.queue_interval);
+}
+
+//
+// Upstream
+//
+
+thread_local std::unordered_map<std::string, Upstream*> Upstream::s_upstreams;
+thread_local bool Upstream::s_has_shutdown = false;
+
+auto Upstream::get(
+  const Key &key, double max_idle,
+  const std::function<PipelineLayout*(Upstream*)> &build
+) -> Upstream* {
+  auto i = s_upstreams.find(key.str());
+  if (i != s_upstreams.end()) {
+    auto *u = i->second;
+    u->m_idle_timer.cancel();
+    return u;
+  }
+
+  auto *u = new Upstream(key.str(), max_idle);
+  u->m_layout = build(u);
+  s_upstreams[key.str()] = u;
+  return u;
+}
+
+void Upstream::shutdown_all() {
+  s_has_shutdown = true;
+  std::vector<Upstream*> unused;
+  for (const auto &p : s_upstreams) {
+    auto *u = p.second;
+    if (u->ref_count() > 0) {
+      u->m_map->shutdown();
+    } else {
+      unused.push_back(u);
+    }
+  }
+  for (auto *u : unused) delete u;
+}
+
+Upstream::Upstream(const std::string &key, double max_idle)
+  : m_key(key)
+  , m_max_idle(max_idle)
+  , m_module(new Module())
+  , m_map(new MuxSessionMap())
+{
+  m_map->share();
+  m_selector = pjs::Function::make(
+    pjs::Method::make(
+      "", [](pjs::Context &, pjs::Object *, pjs::Value &ret) {
+        ret.set(pjs::Str::empty);
+      }
+    )
+  );
+}
+
+Upstream::~Upstream() {
+  s_upstreams.erase(m_key);
+  m_map->shutdown();
+  m_module->shutdown();
+}
+
+//
+// Remembers the last connection made with the options, which can still
+// be alive after the Upstream is gone
+//
+
+void Upstream::track(Outbound::Options &options) {
+  pjs::Ref<WeakPtr> wp(weak_ptr());
+  options.on_state_changed = [=](Outbound *ob) {
+    if (auto *u = wp->ptr()) {
+      u->m_outbound = ob;
+    }
+  };
+}
+
+auto Upstream::join(MuxBase *mux) -> Filter* {
+  mux->join(m_map);
+  mux->add_sub_pipeline(m_layout);
+  return mux;
+}
+
+void Upstream::finalize() {
+  if (s_has_shutdown) {
+    delete this;
+    return;
+  }
+
+  m_idle_timer.schedule(
+    m_max_idle,
+    [this]() {
+      if (!ref_count()) delete this;
+    }
+  );
+}
+
+} // namespace pipy
@@ -0,0 +1,132 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef UPSTREAM_HPP
+#define UPSTREAM_HPP
+
+#include "pjs/pjs.hpp"
+#include "module.hpp"
+#include "outbound.hpp"
+#include "timer.hpp"
+#include "filters/mux.hpp"
+#include "filters/tls.hpp"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+namespace pipy {
+
+class Filter;
+class PipelineLayout;
+
+//
+// Upstream
+//
+// Connections to one target, shared on a thread by every Fetch,
+// http.Agent and logging HTTP target that asks for it with the same
+// TLS, protocol and limit options, all of which go into the key.
+//
+// Callers keep their own muxing filters and join() them to the
+// Upstream's session map. The pipelines that connect are owned by the
+// Upstream so that they outlive any single caller. When the last caller
+// is gone, the Upstream is kept for as long as its idle connections are
+// allowed to live, so that a caller coming back soon finds them again.
+//
+
+class Upstream : public pjs::RefCount<Upstream> {
+public:
+
+  //
+  // Upstream::Key
+  //
+
+  class Key {
+  public:
+    Key(const char *kind) : m_str(kind) {}
+
+    void add(const std::string &str);
+    void add(pjs::Str *str);
+    void add(double num);
+    void add(const void *ptr);
+    void add(const Outbound::Options &options);
+    void add(const tls::Client::Options &options);
+    void add(const MuxSession::Options &options);
+
+    auto str() const -> const std::string& { return m_str; }
+
+  private:
+    std::string m_str;
+  };
+
+  static auto get(
+    const Key &key, double max_idle,
+    const std::function<PipelineLayout*(Upstream*)> &build
+  ) -> Upstream*;
+
+  static void shutdown_all();
+
+  auto module() const -> ModuleBase* { return m_module; }
+  auto selector() const -> pjs::Function* { return m_selector; }
+  auto outbound() const -> Outbound* { return m_outbound; }
+  void track(Outbound::Options &options);
+  auto join(MuxBase *mux) -> Filter*;
+
+private:
+  Upstream(const std::string &key, double max_idle);
+  ~Upstream();
+
+  //
+  // Upstream::Module
+  //
+
+  class Module : public ModuleBase {
+  public:
+    Module() : ModuleBase("Upstream") {}
+    virtual auto new_context(pipy::Context *base) -> pipy::Context* override {
+      return Context::make();
+    }
+  };
+
+  std::string m_key;
+  double m_max_idle;
+  pjs::Ref<Module> m_module;
+  pjs::Ref<PipelineLayout> m_layout;
+  pjs::Ref<MuxSessionMap> m_map;
+  pjs::Ref<pjs::Function> m_selector;
+  pjs::Ref<Outbound> m_outbound;
+  Timer m_idle_timer;
+
+  void finalize();
+
+  thread_local static std::unordered_map<std::string, Upstream*> s_upstreams;
+  thread_local static bool s_has_shutdown;
+
+  friend class pjs::RefCount<Upstream>;
+};
+
+} // namespace pipy
+
+#endif // UPSTREAM_HPP
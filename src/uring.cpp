@@ -0,0 +1,303 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "uring.hpp"
+
+#ifdef PIPY_HAS_IO_URING
+
+#include "log.hpp"
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace pipy {
+
+static const unsigned URING_ENTRIES = 1024;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static inline auto load_acquire(const unsigned *p) -> unsigned {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned *p, unsigned v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+bool Uring::s_enabled = false;
+
+auto Uring::current() -> Uring* {
+  thread_local static Uring *s_current = nullptr;
+  thread_local static bool s_initialized = false;
+  if (!s_enabled) return nullptr;
+  if (!s_initialized) {
+    s_initialized = true;
+    auto uring = new Uring();
+    if (uring->init()) {
+      s_current = uring;
+    } else {
+      Log::warn("[uring] io_uring is not available, falling back to epoll: %s", std::strerror(errno));
+      delete uring;
+    }
+  }
+  return s_current;
+}
+
+Uring::Uring()
+  : m_event(Net::context())
+{
+}
+
+Uring::~Uring() {
+  if (m_event.is_open()) {
+    std::error_code ec;
+    m_event.close(ec);
+  } else if (m_event_fd >= 0) {
+    ::close(m_event_fd);
+  }
+  if (m_sqes) munmap(m_sqes, m_sqes_size);
+  if (m_cq_ring && m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+  if (m_sq_ring) munmap(m_sq_ring, m_sq_ring_size);
+  if (m_fd >= 0) ::close(m_fd);
+}
+
+bool Uring::init() {
+  struct io_uring_params p;
+  std::memset(&p, 0, sizeof(p));
+
+  m_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+  if (m_fd < 0) return false;
+
+  // Without NODROP completions can get lost under pressure and
+  // without FAST_POLL every socket operation goes through io-wq
+  if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_FAST_POLL)) {
+    errno = ENOTSUP;
+    return false;
+  }
+
+  m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (m_cq_ring_size > m_sq_ring_size) m_sq_ring_size = m_cq_ring_size;
+    m_cq_ring_size = m_sq_ring_size;
+  }
+
+  auto sq = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) return false;
+  m_sq_ring = sq;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    m_cq_ring = sq;
+  } else {
+    auto cq = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) return false;
+    m_cq_ring = cq;
+  }
+
+  m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  auto sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) return false;
+  m_sqes = (struct io_uring_sqe *)sqes;
+
+  auto sq_ptr = (char *)m_sq_ring;
+  auto cq_ptr = (char *)m_cq_ring;
+  m_sq_head_ptr = (unsigned *)(sq_ptr + p.sq_off.head);
+  m_sq_tail_ptr = (unsigned *)(sq_ptr + p.sq_off.tail);
+  m_sq_mask = *(unsigned *)(sq_ptr + p.sq_off.ring_mask);
+  m_sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+  m_sq_entries = p.sq_entries;
+  m_sq_tail = *m_sq_tail_ptr;
+  m_cq_head_ptr = (unsigned *)(cq_ptr + p.cq_off.head);
+  m_cq_tail_ptr = (unsigned *)(cq_ptr + p.cq_off.tail);
+  m_cq_mask = *(unsigned *)(cq_ptr + p.cq_off.ring_mask);
+  m_cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+
+  m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_event_fd < 0) return false;
+  if (sys_io_uring_register(m_fd, IORING_REGISTER_EVENTFD, &m_event_fd, 1) < 0) return false;
+
+  m_event.assign(m_event_fd);
+  wait();
+  return true;
+}
+
+void Uring::recv(int fd, void *buf, size_t len, Handler *handler) {
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)buf;
+  sqe->len = len;
+  sqe->user_data = (uint64_t)handler;
+  handler->m_pending = true;
+}
+
+void Uring::recvmsg(int fd, struct msghdr *msg, Handler *handler) {
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)msg;
+  sqe->len = 1;
+  sqe->user_data = (uint64_t)handler;
+  handler->m_pending = true;
+}
+
+void Uring::sendmsg(int fd, struct msghdr *msg, Handler *handler) {
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)msg;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = (uint64_t)handler;
+  handler->m_pending = true;
+}
+
+void Uring::readv(int fd, const struct iovec *iov, int count, uint64_t offset, Handler *handler) {
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)iov;
+  sqe->len = count;
+  sqe->off = offset;
+  sqe->user_data = (uint64_t)handler;
+  handler->m_pending = true;
+}
+
+void Uring::writev(int fd, const struct iovec *iov, int count, uint64_t offset, Handler *handler) {
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)iov;
+  sqe->len = count;
+  sqe->off = offset;
+  sqe->user_data = (uint64_t)handler;
+  handler->m_pending = true;
+}
+
+//
+// Cancellation is submitted immediately so that an operation still
+// sitting in the submission queue reaches the kernel before its file
+// descriptor is closed and possibly reused by the caller.
+//
+
+void Uring::cancel(Handler *handler) {
+  if (!handler->m_pending) return;
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = (uint64_t)handler;
+  sqe->user_data = 0;
+  submit();
+}
+
+auto Uring::get_sqe() -> struct io_uring_sqe* {
+  if (m_sq_tail - load_acquire(m_sq_head_ptr) >= m_sq_entries) {
+    submit();
+    while (m_sq_tail - load_acquire(m_sq_head_ptr) >= m_sq_entries) {
+      reap();
+      submit();
+    }
+  }
+
+  auto i = m_sq_tail & m_sq_mask;
+  auto sqe = &m_sqes[i];
+  std::memset(sqe, 0, sizeof(*sqe));
+  m_sq_array[i] = i;
+  m_sq_tail++;
+  m_to_submit++;
+
+  if (!m_submit_scheduled) {
+    m_submit_scheduled = true;
+    asio::post(
+      Net::context(),
+      [this]() {
+        m_submit_scheduled = false;
+        submit();
+      }
+    );
+  }
+
+  return sqe;
+}
+
+void Uring::submit() {
+  if (!m_to_submit) return;
+  store_release(m_sq_tail_ptr, m_sq_tail);
+  auto n = sys_io_uring_enter(m_fd, m_to_submit, 0, 0);
+  if (n >= 0) {
+    m_to_submit -= n;
+  } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+    Log::error("[uring] io_uring_enter() failed: %s", std::strerror(errno));
+  }
+}
+
+void Uring::wait() {
+  m_event.async_wait(
+    asio::posix::stream_descriptor::wait_read,
+    [this](const std::error_code &ec) {
+      if (ec) return;
+      uint64_t n;
+      while (::read(m_event_fd, &n, sizeof(n)) > 0) {}
+      reap();
+      submit();
+      wait();
+    }
+  );
+}
+
+void Uring::reap() {
+  for (;;) {
+    auto head = *m_cq_head_ptr;
+    if (head == load_acquire(m_cq_tail_ptr)) break;
+    auto cqe = &m_cqes[head & m_cq_mask];
+    auto handler = (Handler *)cqe->user_data;
+    auto result = cqe->res;
+    store_release(m_cq_head_ptr, head + 1);
+    if (handler) {
+      handler->m_pending = false;
+      handler->on_uring_complete(result);
+    }
+  }
+}
+
+} // namespace pipy
+
+#endif // PIPY_HAS_IO_URING
@@ -0,0 +1,123 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef URING_HPP
+#define URING_HPP
+
+#include "net.hpp"
+
+#ifdef __linux__
+#define PIPY_HAS_IO_URING
+#endif
+
+#ifdef PIPY_HAS_IO_URING
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace pipy {
+
+//
+// Uring
+//
+// A minimal per-thread io_uring instance used by sockets in place of the
+// epoll reactor when --net-engine=io_uring is given. Submissions are
+// collected during one round of the event loop and handed to the kernel
+// with a single io_uring_enter(). Completions are signaled through an
+// eventfd that is watched by the asio reactor of the same thread.
+//
+
+class Uring {
+public:
+
+  //
+  // Uring::Handler
+  //
+
+  class Handler {
+  public:
+    virtual void on_uring_complete(int result) = 0;
+
+  private:
+    bool m_pending = false;
+    friend class Uring;
+  };
+
+  static void enable(bool b) { s_enabled = b; }
+  static bool enabled() { return s_enabled; }
+
+  // Returns nullptr when io_uring is disabled or not supported by the kernel
+  static auto current() -> Uring*;
+
+  void recv(int fd, void *buf, size_t len, Handler *handler);
+  void recvmsg(int fd, struct msghdr *msg, Handler *handler);
+  void sendmsg(int fd, struct msghdr *msg, Handler *handler);
+  void readv(int fd, const struct iovec *iov, int count, uint64_t offset, Handler *handler);
+  void writev(int fd, const struct iovec *iov, int count, uint64_t offset, Handler *handler);
+  void cancel(Handler *handler);
+
+private:
+  Uring();
+  ~Uring();
+
+  bool init();
+  auto get_sqe() -> io_uring_sqe*;
+  void submit();
+  void wait();
+  void reap();
+
+  int m_fd = -1;
+  int m_event_fd = -1;
+  void* m_sq_ring = nullptr;
+  void* m_cq_ring = nullptr;
+  size_t m_sq_ring_size = 0;
+  size_t m_cq_ring_size = 0;
+  size_t m_sqes_size = 0;
+  unsigned m_sq_entries = 0;
+  unsigned m_sq_mask = 0;
+  unsigned m_cq_mask = 0;
+  unsigned m_sq_tail = 0;
+  unsigned m_to_submit = 0;
+  unsigned* m_sq_head_ptr = nullptr;
+  unsigned* m_sq_tail_ptr = nullptr;
+  unsigned* m_sq_array = nullptr;
+  unsigned* m_cq_head_ptr = nullptr;
+  unsigned* m_cq_tail_ptr = nullptr;
+  io_uring_sqe* m_sqes = nullptr;
+  io_uring_cqe* m_cqes = nullptr;
+  asio::posix::stream_descriptor m_event;
+  bool m_submit_scheduled = false;
+
+  static bool s_enabled;
+};
+
+} // namespace pipy
+
+#endif // PIPY_HAS_IO_URING
+
+#endif // URING_HPP
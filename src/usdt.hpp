@@ -0,0 +1,70 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef USDT_HPP
+#define USDT_HPP
+
+//
+// Static tracepoints under the provider name "pipy", compiled in with
+// -DPIPY_USDT=ON where sys/sdt.h is available. A probe that nobody is
+// attached to costs a single nop. Probes and their arguments:
+//
+//   inbound__accept        (id)
+//   inbound__close         (id)
+//   outbound__connect      (host, port)
+//   outbound__connected    (host, port, connection time in microseconds)
+//   tls__handshake__done   (is server)
+//   http__message__start   (is response)
+//   http__message__end     (is response)
+//   pipeline__alloc        (pipeline, layout name)
+//   pipeline__free         (pipeline)
+//   worker__reload__start  (thread index)
+//   worker__reload__done   (thread index, ok)
+//
+// For example, to see a histogram of upstream connection times:
+//
+//   bpftrace -e 'usdt:./pipy:pipy:outbound__connected { @us = hist(arg2) }'
+//
+
+#ifdef PIPY_USE_USDT
+
+#include <sys/sdt.h>
+
+#define PIPY_PROBE(name) DTRACE_PROBE(pipy, name)
+#define PIPY_PROBE1(name, a) DTRACE_PROBE1(pipy, name, a)
+#define PIPY_PROBE2(name, a, b) DTRACE_PROBE2(pipy, name, a, b)
+#define PIPY_PROBE3(name, a, b, c) DTRACE_PROBE3(pipy, name, a, b, c)
+
+#else // !PIPY_USE_USDT
+
+#define PIPY_PROBE(name) do {} while (0)
+#define PIPY_PROBE1(name, a) do {} while (0)
+#define PIPY_PROBE2(name, a, b) do {} while (0)
+#define PIPY_PROBE3(name, a, b, c) do {} while (0)
+
+#endif // PIPY_USE_USDT
+
+#endif // USDT_HPP
@@ -24,11 +24,15 @@
  */
 
 #include "utils.hpp"
+#include "simd.hpp"
 
 #include <cmath>
 #include <cstring>
 #include <chrono>
+#include <ctime>
+#include <cstdio>
 #include <random>
+#include <thread>
 #include <limits>
 
 namespace pipy {
@@ -106,6 +110,104 @@ auto now() -> double {
   return double(ms);
 }
 
+auto now_coarse() -> double {
+#ifdef CLOCK_REALTIME_COARSE
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  return double(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+#else
+  return now();
+#endif
+}
+
+auto monotonic_coarse() -> double {
+#ifdef CLOCK_MONOTONIC_COARSE
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return double(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+#else
+  auto t = std::chrono::steady_clock::now().time_since_epoch();
+  return double(std::chrono::duration_cast<std::chrono::milliseconds>(t).count());
+#endif
+}
+
+//
+// DateCache
+//
+// Both date formats are made from the same broken-down time, redone only
+// when the second changes. Day and month names are spelled out here, not
+// by strftime, so that the locale never gets into an HTTP header.
+//
+
+struct DateCache {
+  std::time_t sec = -1;
+  char http[32];
+  char iso[32];
+
+  void update(std::time_t t) {
+    static const char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    std::tm tm;
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    std::snprintf(
+      http, sizeof(http), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+      days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900,
+      tm.tm_hour, tm.tm_min, tm.tm_sec
+    );
+    std::snprintf(
+      iso, sizeof(iso), "%04d-%02d-%02dT%02d:%02d:%02d.",
+      tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+      tm.tm_hour, tm.tm_min, tm.tm_sec
+    );
+    sec = t;
+  }
+};
+
+thread_local static DateCache s_date_cache;
+
+auto format_http_date(char *buf) -> size_t {
+  auto t = std::time_t(now_coarse() / 1000);
+  if (t != s_date_cache.sec) s_date_cache.update(t);
+  std::memcpy(buf, s_date_cache.http, 29);
+  buf[29] = 0;
+  return 29;
+}
+
+auto format_iso_date(char *buf) -> size_t {
+  auto ms = int64_t(now());
+  auto t = std::time_t(ms / 1000);
+  auto n = int(ms % 1000);
+  if (t != s_date_cache.sec) s_date_cache.update(t);
+  std::memcpy(buf, s_date_cache.iso, 20);
+  buf[20] = '0' + n / 100;
+  buf[21] = '0' + n / 10 % 10;
+  buf[22] = '0' + n % 10;
+  buf[23] = 'Z';
+  buf[24] = 0;
+  return 24;
+}
+
+//
+// Measured once against the steady clock over a short sleep
+//
+
+auto cycles_per_second() -> double {
+  static double s_rate = []() {
+    auto c0 = cycles();
+    auto t0 = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto c1 = cycles();
+    auto t1 = std::chrono::steady_clock::now();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    return ns > 0 ? double(c1 - c0) * 1e9 / ns : 1e9;
+  }();
+  return s_rate;
+}
+
 auto now_since(double origin) -> double {
   auto t0 = std::chrono::time_point<std::chrono::system_clock>(std::chrono::milliseconds((long long)origin));
   auto t = std::chrono::system_clock::now();
@@ -615,16 +717,40 @@ auto encode_uri(const std::string &str) -> std::string {
   return out;
 }
 
-auto encode_hex(char *out, const void *inp, int len) -> int {
-  int n = 0;
-  HexEncoder encoder(
-    [&](char c) {
-      out[n++] = c;
+//
+// The bulk of the input goes through the kernels in simd.cpp, which
+// only handle whole blocks. What is left over is done here one group
+// at a time with lookup tables.
+//
+
+static const char s_hex_digits[] = "0123456789abcdef";
+static const char s_base64_std_digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char s_base64_url_digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+struct CodecReverseTable {
+  int8_t map[256];
+  CodecReverseTable(const char *digits, int count, bool icase = false) {
+    for (int i = 0; i < 256; i++) map[i] = -1;
+    for (int i = 0; i < count; i++) {
+      map[(uint8_t)digits[i]] = i;
+      if (icase) map[(uint8_t)std::toupper(digits[i])] = i;
     }
-  );
+  }
+  int operator[](char c) const { return map[(uint8_t)c]; }
+};
+
+static const CodecReverseTable s_hex_reverse(s_hex_digits, 16, true);
+static const CodecReverseTable s_base64_std_reverse(s_base64_std_digits, 64);
+static const CodecReverseTable s_base64_url_reverse(s_base64_url_digits, 64);
+
+auto encode_hex(char *out, const void *inp, int len) -> int {
   const auto *buf = (const uint8_t *)inp;
-  for (int i = 0; i < len; i++) {
-    encoder.input(buf[i]);
+  int i = simd::hex_encode(out, buf, len);
+  int n = i * 2;
+  for (; i < len; i++) {
+    auto b = buf[i];
+    out[n++] = s_hex_digits[b >> 4];
+    out[n++] = s_hex_digits[b & 15];
   }
   return n;
 }
@@ -633,77 +759,124 @@ auto decode_hex(void *out, const char *inp, int len) -> int {
   if (len % 2) return -1;
   auto *buf = (uint8_t *)out;
   int n = 0;
-  HexDecoder decoder(
-    [&](uint8_t b) {
-      buf[n++] = b;
-    }
-  );
-  for (int i = 0; i < len; i++) {
-    decoder.input(inp[i]);
+  for (int i = 0; i < len; i += 2) {
+    auto h = s_hex_reverse[inp[i]];
+    auto l = s_hex_reverse[inp[i+1]];
+    if (h < 0 || l < 0) return -1;
+    buf[n++] = (h << 4) | l;
   }
   return n;
 }
 
-auto encode_base64(char *out, const void *inp, int len) -> int {
-  int n = 0;
-  Base64Encoder encoder(
-    [&](char c) {
-      out[n++] = c;
-    }
-  );
+static auto encode_base64(char *out, const void *inp, int len, bool url) -> int {
   const auto *buf = (const uint8_t *)inp;
-  for (int i = 0; i < len; i++) {
-    encoder.input(buf[i]);
+  const auto *tab = url ? s_base64_url_digits : s_base64_std_digits;
+  int i = simd::base64_encode(out, buf, len, url);
+  int n = i / 3 * 4;
+  for (; i + 3 <= len; i += 3) {
+    auto t = (uint32_t(buf[i]) << 16) | (uint32_t(buf[i+1]) << 8) | buf[i+2];
+    out[n++] = tab[(t >> 18) & 63];
+    out[n++] = tab[(t >> 12) & 63];
+    out[n++] = tab[(t >>  6) & 63];
+    out[n++] = tab[(t >>  0) & 63];
+  }
+  switch (len - i) {
+    case 1: {
+      auto t = uint32_t(buf[i]) << 16;
+      out[n++] = tab[(t >> 18) & 63];
+      out[n++] = tab[(t >> 12) & 63];
+      if (!url) { out[n++] = '='; out[n++] = '='; }
+      break;
+    }
+    case 2: {
+      auto t = (uint32_t(buf[i]) << 16) | (uint32_t(buf[i+1]) << 8);
+      out[n++] = tab[(t >> 18) & 63];
+      out[n++] = tab[(t >> 12) & 63];
+      out[n++] = tab[(t >>  6) & 63];
+      if (!url) out[n++] = '=';
+      break;
+    }
   }
-  encoder.flush();
   return n;
 }
 
+auto encode_base64(char *out, const void *inp, int len) -> int {
+  return encode_base64(out, inp, len, false);
+}
+
 auto decode_base64(void *out, const char *inp, int len) -> int {
   if (len % 4 > 0) return -1;
   auto *buf = (uint8_t *)out;
-  int n = 0;
-  Base64Decoder decoder(
-    [&](uint8_t b) {
-      buf[n++] = b;
+  auto &rev = s_base64_std_reverse;
+  int i = simd::base64_decode(buf, inp, len, false);
+  int n = i / 4 * 3;
+  for (; i < len; i += 4) {
+    auto a = rev[inp[i+0]];
+    auto b = rev[inp[i+1]];
+    auto c = rev[inp[i+2]];
+    auto d = rev[inp[i+3]];
+    if (a < 0 || b < 0) return -1;
+    if (c < 0 || d < 0) {
+
+      // Padding is only allowed in the last group
+      if (i + 4 < len || inp[i+3] != '=') return -1;
+      if (c < 0) {
+        if (inp[i+2] != '=') return -1;
+        buf[n++] = (a << 2) | (b >> 4);
+      } else {
+        buf[n++] = (a << 2) | (b >> 4);
+        buf[n++] = (b << 4) | (c >> 2);
+      }
+      break;
     }
-  );
-  for (int i = 0; i < len; i++) {
-    int c = inp[i];
-    if (!decoder.input(c)) return -1;
+    auto t = (a << 18) | (b << 12) | (c << 6) | d;
+    buf[n++] = t >> 16;
+    buf[n++] = t >> 8;
+    buf[n++] = t >> 0;
   }
-  return decoder.complete() ? n : -1;
+  return n;
 }
 
 auto encode_base64url(char *out, const void *inp, int len) -> int {
-  int n = 0;
-  Base64UrlEncoder encoder(
-    [&](char c) {
-      out[n++] = c;
-    }
-  );
-  const auto *buf = (const uint8_t *)inp;
-  for (int i = 0; i < len; i++) {
-    encoder.input(buf[i]);
-  }
-  encoder.flush();
-  return n;
+  return encode_base64(out, inp, len, true);
 }
 
 auto decode_base64url(void *out, const char *inp, int len) -> int {
   auto *buf = (uint8_t *)out;
-  int n = 0;
-  Base64UrlDecoder decoder(
-    [&](uint8_t b) {
-      buf[n++] = b;
+  auto &rev = s_base64_url_reverse;
+  int i = simd::base64_decode(buf, inp, len, true);
+  int n = i / 4 * 3;
+  for (; i + 4 <= len; i += 4) {
+    auto a = rev[inp[i+0]];
+    auto b = rev[inp[i+1]];
+    auto c = rev[inp[i+2]];
+    auto d = rev[inp[i+3]];
+    if (a < 0 || b < 0 || c < 0 || d < 0) return -1;
+    auto t = (a << 18) | (b << 12) | (c << 6) | d;
+    buf[n++] = t >> 16;
+    buf[n++] = t >> 8;
+    buf[n++] = t >> 0;
+  }
+  switch (len - i) {
+    case 1: return -1;
+    case 2: {
+      auto a = rev[inp[i+0]];
+      auto b = rev[inp[i+1]];
+      if (a < 0 || b < 0) return -1;
+      buf[n++] = (a << 2) | (b >> 4);
+      break;
     }
-  );
-  for (int i = 0; i < len; i++) {
-    if (!decoder.input(inp[i])) {
-      return -1;
+    case 3: {
+      auto a = rev[inp[i+0]];
+      auto b = rev[inp[i+1]];
+      auto c = rev[inp[i+2]];
+      if (a < 0 || b < 0 || c < 0) return -1;
+      buf[n++] = (a << 2) | (b >> 4);
+      buf[n++] = (b << 4) | (c >> 2);
+      break;
     }
   }
-  return decoder.flush() ? n : -1;
+  return n;
 }
 
 auto path_join(const std::string &base, const std::string &path) -> std::string {
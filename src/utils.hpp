@@ -28,6 +28,7 @@
 
 #include "pjs/pjs.hpp"
 
+#include <chrono>
 #include <functional>
 #include <list>
 #include <map>
@@ -41,6 +42,31 @@ auto to_string(double n) -> std::string;
 auto to_string(char *str, size_t len, int n) -> size_t;
 auto now() -> double;
 auto now_since(double origin) -> double;
+
+// Clocks read from the kernel's last tick, a few milliseconds coarse
+auto now_coarse() -> double;
+auto monotonic_coarse() -> double;
+
+// Current time as an RFC 7231 date (29 chars) or an ISO 8601 date with
+// milliseconds (24 chars), formatted once per second on each thread
+auto format_http_date(char *buf) -> size_t;
+auto format_iso_date(char *buf) -> size_t;
+auto cycles_per_second() -> double;
+
+// Cheap monotonic tick counter, the TSC where there is one
+inline auto cycles() -> uint64_t {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__) && defined(__GNUC__)
+  uint64_t v;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+  return v;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+#endif
+}
 bool is_host_port(const std::string &str);
 bool get_host_port(const std::string &str, std::string &ip, int &port);
 void get_prop_list(
@@ -28,16 +28,34 @@
 #include "codebase.hpp"
 #include "pipeline-lb.hpp"
 #include "timer.hpp"
+#include "upstream.hpp"
+#include "filters/adaptive-concurrency.hpp"
+#include "filters/retry.hpp"
 #include "api/configuration.hpp"
 #include "api/console.hpp"
+#include "api/logging.hpp"
 #include "api/pipy.hpp"
 #include "net.hpp"
+#include "os-platform.hpp"
 #include "log.hpp"
+#include "usdt.hpp"
 #include "utils.hpp"
 
 namespace pipy {
 
 thread_local WorkerThread* WorkerThread::s_current = nullptr;
+thread_local size_t WorkerThread::s_cycles_reclaimed = 0;
+bool WorkerThread::s_collect_cycles = false;
+
+// Candidate scopes looked at by the cycle collector per recycling round
+static const size_t COLLECT_CYCLES_LIMIT = 1000;
+
+// Pooled blocks freed per recycling step, between which the thread
+// goes back to serving whatever came in meanwhile
+static const int RECYCLE_BATCH = 4096;
+
+// Time over which threads start recycling one after another
+static const double RECYCLE_SPREAD = 1.0;
 
 WorkerThread::WorkerThread(WorkerManager *manager, int index)
   : m_manager(manager)
@@ -57,10 +75,12 @@ WorkerThread::~WorkerThread() {
 }
 
 bool WorkerThread::start(bool force) {
-  std::unique_lock<std::mutex> lock(m_start_cv_mutex);
+  launch(force);
+  return wait_started();
+}
 
+void WorkerThread::launch(bool force) {
   m_force_start = force;
-
   m_thread = std::thread(
     [this]() {
       s_current = this;
@@ -69,7 +89,10 @@ bool WorkerThread::start(bool force) {
       m_manager->on_thread_ended(m_index);
     }
   );
+}
 
+bool WorkerThread::wait_started() {
+  std::unique_lock<std::mutex> lock(m_start_cv_mutex);
   m_start_cv.wait(lock, [this]() { return m_started || m_done || m_failed; });
   if (m_failed) throw std::runtime_error("failed to start worker thread");
   return m_started;
@@ -122,6 +145,15 @@ void WorkerThread::stats(stats::MetricData &metric_data, const std::function<voi
   );
 }
 
+void WorkerThread::collect_stats(const std::function<void()> &cb) {
+  m_net->post(
+    [=]() {
+      stats::Metric::local().collect();
+      cb();
+    }
+  );
+}
+
 void WorkerThread::stats(const std::function<void(stats::MetricData&)> &cb) {
   m_net->post(
     [=]() {
@@ -159,16 +191,61 @@ void WorkerThread::recycle() {
     m_recycling = true;
     m_net->post(
       [this]() {
+        if (s_collect_cycles) {
+          if (auto worker = Worker::current()) {
+            auto n = worker->collect(COLLECT_CYCLES_LIMIT);
+            if (n > 0) {
+              s_cycles_reclaimed += n;
+              Log::debug(Log::ALLOC, "[worker   %p] reclaimed %d cyclic objects", worker, int(n));
+            }
+          }
+        }
+        for (const auto &p : pjs::Pool::all()) {
+          p.second->clean(0);
+        }
+        recycle_step();
+      }
+    );
+  }
+}
+
+void WorkerThread::recycle_step() {
+  if (!m_working) {
+    m_recycling = false;
+    return;
+  }
+  int budget = RECYCLE_BATCH;
+  bool more = false;
+  for (const auto &p : pjs::Pool::all()) {
+    auto *pool = p.second;
+    if (budget > 0) budget -= pool->drain(budget);
+    if (pool->excess() > 0) more = true;
+  }
+  if (more) {
+    m_net->post([this]() { recycle_step(); });
+  } else {
+    m_recycling = false;
+  }
+}
+
+//
+// Unlike recycle(), which keeps some room in pools for the recent peak,
+// this frees every object on the free lists, for when memory runs short.
+//
+
+void WorkerThread::trim() {
+  if (m_working) {
+    m_net->post(
+      []() {
         for (const auto &p : pjs::Pool::all()) {
-          p.second->clean();
+          p.second->trim();
         }
-        m_recycling = false;
       }
     );
   }
 }
 
-void WorkerThread::reload(const std::function<void(bool)> &cb) {
+void WorkerThread::reload(bool force, const std::function<void(bool)> &cb) {
   m_net->post(
     [=]() {
       auto codebase = Codebase::current();
@@ -180,7 +257,19 @@ void WorkerThread::reload(const std::function<void(bool)> &cb) {
         return;
       }
 
+      // Only a reload triggered by codebase updates may keep the current
+      // worker. A forced one always starts over from a fresh worker.
+      if (auto worker = force ? nullptr : Worker::current()) {
+        if (!worker->sources_changed(entry)) {
+          Log::info("[restart] No loaded files changed on thread %d, keeping the current worker", m_index);
+          m_version = codebase->version();
+          cb(true);
+          return;
+        }
+      }
+
       Log::info("[restart] Reloading codebase on thread %d...", m_index);
+      PIPY_PROBE1(worker__reload__start, m_index);
 
       m_new_version = codebase->version();
       m_new_period = pjs::Promise::Period::make();
@@ -191,12 +280,14 @@ void WorkerThread::reload(const std::function<void(bool)> &cb) {
       old_period->pause();
       m_new_period->pause();
       m_new_period->set_current();
+      Codebase::recorder(m_new_worker);
 
       cb(
         m_new_worker->load_js_module(entry) &&
         m_new_worker->bind()
       );
 
+      Codebase::recorder(Worker::current());
       old_period->set_current();
       old_period->resume();
     }
@@ -214,6 +305,7 @@ void WorkerThread::reload_done(bool ok) {
           m_new_worker->start(true);
           current_worker->stop(true);
           current_period->end();
+          Codebase::recorder(m_new_worker);
           m_new_period->set_current();
           m_new_period->resume();
           m_new_period = nullptr;
@@ -222,6 +314,7 @@ void WorkerThread::reload_done(bool ok) {
           m_working = true;
           if (m_workload_signal) m_workload_signal->fire();
           Log::info("[restart] Codebase reloaded on thread %d", m_index);
+          PIPY_PROBE2(worker__reload__done, m_index, 1);
         }
       }
     );
@@ -236,6 +329,7 @@ void WorkerThread::reload_done(bool ok) {
           m_new_worker = nullptr;
           m_new_version.clear();
           Log::error("[restart] Failed reloading codebase %d", m_index);
+          PIPY_PROBE2(worker__reload__done, m_index, 0);
         }
       }
     );
@@ -442,17 +536,159 @@ void WorkerThread::init_metrics() {
       gauge->set(total);
     }
   );
+
+  //
+  // Stats - event loop lag and load
+  //
+
+  label_names->length(1);
+  label_names->set(0, "thread");
+
+  auto thread_label = []() -> pjs::Str* {
+    static thread_local pjs::Ref<pjs::Str> s_label;
+    if (!s_label) s_label = pjs::Str::make(WorkerThread::current()->index());
+    return s_label.get();
+  };
+
+  stats::Gauge::make(
+    pjs::Str::make("pipy_loop_lag_seconds"),
+    label_names,
+    [=](stats::Gauge *gauge) {
+      auto &load = Net::current().load();
+      auto label = thread_label();
+      gauge->with_labels(&label, 1)->set(load.lag_max);
+      load.lag_max = 0;
+    }
+  );
+
+  stats::Gauge::make(
+    pjs::Str::make("pipy_loop_pending"),
+    label_names,
+    [=](stats::Gauge *gauge) {
+      auto &load = Net::current().load();
+      auto label = thread_label();
+      auto n = load.pending.load();
+      gauge->with_labels(&label, 1)->set(n);
+      gauge->set(n);
+    }
+  );
+
+  auto define_loop_counter = [&](const char *name, int index, double (*get)(Net::Load&)) {
+    stats::Counter::make(
+      pjs::Str::make(name),
+      label_names,
+      [=](stats::Counter *counter) {
+        auto &load = Net::current().load();
+        auto v = get(load);
+        auto d = v - load.reported[index];
+        if (d > 0) {
+          auto label = thread_label();
+          counter->with_labels(&label, 1)->increase(d);
+          counter->increase(d);
+          load.reported[index] = v;
+        }
+      }
+    );
+  };
+
+  define_loop_counter("pipy_loop_handlers", 0, [](Net::Load &l) { return double(l.handlers); });
+  define_loop_counter("pipy_loop_busy_seconds", 1, [](Net::Load &l) { return l.busy; });
+  define_loop_counter("pipy_loop_queue_seconds", 2, [](Net::Load &l) { return l.queued; });
+  define_loop_counter("pipy_loop_posts", 3, [](Net::Load &l) { return double(l.posts.load()); });
+  define_loop_counter("pipy_loop_cross_posts", 4, [](Net::Load &l) { return double(l.cross_posts.load()); });
+
+  stats::Counter::make(
+    pjs::Str::make("pipy_cycles_reclaimed"),
+    label_names,
+    [=](stats::Counter *counter) {
+      static thread_local size_t s_reported = 0;
+      auto n = s_cycles_reclaimed;
+      if (n > s_reported) {
+        auto label = thread_label();
+        counter->with_labels(&label, 1)->increase(n - s_reported);
+        counter->increase(n - s_reported);
+        s_reported = n;
+      }
+    }
+  );
+
+  // Cumulative buckets so that histogram_quantile() works on them as is
+  label_names->length(2);
+  label_names->set(0, "thread");
+  label_names->set(1, "le");
+
+  stats::Counter::make(
+    pjs::Str::make("pipy_loop_handler_seconds_bucket"),
+    label_names,
+    [=](stats::Counter *counter) {
+      static const char *s_bounds[] = { "0.00001", "0.0001", "0.001", "0.01", "0.1", "1", "+Inf" };
+      auto &load = Net::current().load();
+      double v = 0;
+      for (int i = 0; i < Net::Load::HISTOGRAM_BUCKETS; i++) {
+        v += load.histogram[i];
+        auto &reported = load.reported[5 + i];
+        auto d = v - reported;
+        if (d > 0) {
+          pjs::Ref<pjs::Str> le(pjs::Str::make(s_bounds[i]));
+          pjs::Str *labels[2] = { thread_label(), le.get() };
+          counter->with_labels(labels, 2)->increase(d);
+          reported = v;
+        }
+      }
+    }
+  );
+
+  //
+  // Stats - # of dropped log lines
+  //
+
+  logging::Logger::FileTarget::init_metrics();
+
+  //
+  // Stats - events, bytes and time per filter
+  //
+
+  FilterStats::init_metrics();
+
+  //
+  // Stats - adaptive concurrency limits
+  //
+
+  AdaptiveConcurrency::init_metrics();
+
+  //
+  // Stats - retry budgets
+  //
+
+  Retry::init_metrics();
 }
 
 void WorkerThread::shutdown_all(bool force) {
   if (auto period = pjs::Promise::Period::current()) period->cancel();
   if (auto worker = Worker::current()) worker->stop(force);
   Listener::for_each([&](Listener *l) { l->pipeline_layout(nullptr); return true; });
+  Upstream::shutdown_all();
 }
 
 void WorkerThread::main() {
+  // Pin down before anything is allocated so that all
+  // memory of this thread comes from the local NUMA node
+  int cpu = -1, numa_node = -1;
+  const auto &cpus = m_manager->cpu_affinity();
+  if (!cpus.empty()) {
+    cpu = cpus[m_index % cpus.size()];
+    if (!os::bind_cpu(cpu, numa_node)) cpu = -1;
+  }
+
   Log::init();
+
+  if (cpu >= 0) {
+    Log::debug(Log::THREAD, "[thread] Thread %d bound to CPU %d on NUMA node %d", m_index, cpu, numa_node);
+  } else if (!cpus.empty()) {
+    Log::warn("[thread] Unable to bind thread %d to CPU %d", m_index, cpus[m_index % cpus.size()]);
+  }
   Pipy::argv(m_manager->m_argv);
+  stats::MetricCells::enable(true);
 
   pjs::Promise::Period::set_uncaught_exception_handler(
     [](const pjs::Value &value) {
@@ -474,6 +710,7 @@ void WorkerThread::main() {
 
   auto &entry = Codebase::current()->entry();
   auto result = pjs::Value::empty;
+  Codebase::recorder(m_new_worker);
   auto mod = m_new_worker->load_js_module(entry, result);
   bool failed = false;
 
@@ -579,31 +816,107 @@ bool WorkerManager::start(int concurrency, bool force) {
   m_stopping = false;
   m_stopped = false;
 
-  for (int i = 0; i < concurrency; i++) {
-    auto wt = new WorkerThread(this, i);
-    auto rollback = [&]() {
+  //
+  // Every thread parses and compiles the whole codebase on its own, as
+  // the resulting trees are bound to the thread that built them. The
+  // first thread goes alone so that a broken script is reported once and
+  // fails fast. The rest then load side by side instead of one by one.
+  //
+
+  auto wt = new WorkerThread(this, 0);
+  auto rollback = [&]() {
+    stop(true);
+    m_loading_pipeline_lb = nullptr;
+  };
+  try {
+    if (!wt->start(force)) {
       delete wt;
-      stop(true);
-      m_loading_pipeline_lb = nullptr;
-    };
+      rollback();
+      return false;
+    }
+  } catch (std::runtime_error &) {
+    delete wt;
+    rollback();
+    throw;
+  }
+  m_worker_threads.push_back(wt);
+
+  std::vector<WorkerThread*> launched;
+  for (int i = 1; i < concurrency; i++) {
+    auto wt = new WorkerThread(this, i);
+    wt->launch(force);
+    launched.push_back(wt);
+  }
+
+  bool all_started = true;
+  std::string error;
+  for (auto *wt : launched) {
     try {
-      if (!wt->start(force)) {
-        rollback();
-        return false;
+      if (wt->wait_started()) {
+        m_worker_threads.push_back(wt);
+        continue;
       }
-    } catch (std::runtime_error &) {
-      rollback();
-      throw;
+      all_started = false;
+    } catch (std::runtime_error &err) {
+      if (error.empty()) error = err.what();
     }
-    m_worker_threads.push_back(wt);
+    delete wt;
+  }
+
+  if (!error.empty()) {
+    rollback();
+    throw std::runtime_error(error);
+  }
+
+  if (!all_started) {
+    rollback();
+    return false;
   }
 
   m_running_pipeline_lb = m_loading_pipeline_lb;
   m_loading_pipeline_lb = nullptr;
 
+  std::lock_guard<std::mutex> lock(m_worker_nets_mutex);
+  for (auto *wt : m_worker_threads) {
+    if (auto net = wt->net()) {
+      m_worker_nets.push_back(net);
+    }
+  }
+
   return true;
 }
 
+//
+// A thread is scored by the connections it has plus the callbacks posted
+// to it and not yet run, scaled up by how late its timers have recently
+// been firing. Returns nullptr when the current thread is the best pick.
+// Called from the worker threads, so it only looks at the nets published
+// by start() and withdrawn by stop(), never at m_worker_threads.
+//
+
+auto WorkerManager::least_loaded() -> Net* {
+  auto score = [](Net *net) {
+    auto &load = net->load();
+    auto n = load.connections.load() + load.pending.load() + 1;
+    return n * (1 + load.lag_recent.load() * 1000);
+  };
+
+  auto current = &Net::current();
+  auto best = current;
+  auto best_score = score(current);
+  std::lock_guard<std::mutex> lock(m_worker_nets_mutex);
+  for (auto *net : m_worker_nets) {
+    if (net == current) continue;
+    auto s = score(net);
+    if (s < best_score) {
+      best = net;
+      best_score = s;
+    }
+  }
+
+  return best == current ? nullptr : best;
+}
+
 auto WorkerManager::status() -> Status& {
   if (!m_querying_status && !m_reloading && !m_stopping) {
     m_querying_status = true;
@@ -682,12 +995,11 @@ auto WorkerManager::stats() -> stats::MetricDataSum& {
     if (auto n = m_worker_threads.size()) {
       std::mutex m;
       std::condition_variable cv;
-      pjs::vl_array<stats::MetricData, 256> metric_data(n);
 
+      // Only the on-collect callbacks run on the workers,
+      // all values are then read from the shared cells
       for (auto *wt : m_worker_threads) {
-        auto i = wt->index();
-        wt->stats(
-          metric_data[i],
+        wt->collect_stats(
           [&]() {
             std::lock_guard<std::mutex> lock(m);
             n--;
@@ -699,9 +1011,7 @@ auto WorkerManager::stats() -> stats::MetricDataSum& {
       std::unique_lock<std::mutex> lock(m);
       cv.wait(lock, [&]{ return n == 0; });
 
-      for (auto i = 0; i < m_worker_threads.size(); i++) {
-        m_metric_data_sum.sum(metric_data[i], i == 0);
-      }
+      m_metric_data_sum.update(stats::MetricCells::global());
     }
 
     m_querying_stats = false;
@@ -721,12 +1031,12 @@ bool WorkerManager::stats(const std::function<void(stats::MetricDataSum&)> &cb)
   m_metric_data_sum_counter = 0;
 
   for (auto *wt : m_worker_threads) {
-    wt->stats(
-      [&, cb](stats::MetricData &metric_data) {
+    wt->collect_stats(
+      [&, cb]() {
         main.post(
           [&, cb]() {
-            m_metric_data_sum.sum(metric_data, m_metric_data_sum_counter == 0);
             if (++m_metric_data_sum_counter == m_worker_threads.size()) {
+              m_metric_data_sum.update(stats::MetricCells::global());
               cb(m_metric_data_sum);
               m_querying_stats = false;
               check_reloading();
@@ -783,14 +1093,45 @@ auto WorkerManager::dump_objects(const std::string &class_name) -> std::map<std:
   return all;
 }
 
+//
+// Threads are recycled in turns rather than all at once, so that only
+// a few of them are busy freeing memory at any moment
+//
+
 void WorkerManager::recycle() {
+  if (m_recycling_index >= 0) return;
+  if (m_worker_threads.empty()) return;
+  m_recycling_index = 0;
+  recycle_next();
+}
+
+void WorkerManager::recycle_next() {
+  int n = m_worker_threads.size();
+  if (m_recycling_index < 0 || m_recycling_index >= n) {
+    m_recycling_index = -1;
+    return;
+  }
+  m_worker_threads[m_recycling_index++]->recycle();
+  if (m_recycling_index < n) {
+    if (!m_recycling_timer) m_recycling_timer = std::unique_ptr<Timer>(new Timer);
+    m_recycling_timer->schedule(RECYCLE_SPREAD / n, [this]() { recycle_next(); });
+  } else {
+    m_recycling_index = -1;
+  }
+}
+
+void WorkerManager::trim() {
+  for (const auto &p : pjs::Pool::all()) {
+    p.second->trim();
+  }
   for (auto *wt : m_worker_threads) {
-    wt->recycle();
+    wt->trim();
   }
 }
 
-void WorkerManager::reload() {
+void WorkerManager::reload(bool force) {
   if (m_stopping) return;
+  if (force) m_reloading_forced = true;
   if (m_reloading || m_querying_status || m_querying_stats || !m_admin_requests.empty()) {
     m_reloading_requested = true;
   } else {
@@ -815,7 +1156,9 @@ void WorkerManager::check_reloading() {
 
 void WorkerManager::start_reloading() {
   if (auto n = m_worker_threads.size()) {
+    auto force = m_reloading_forced;
     m_reloading = true;
+    m_reloading_forced = false;
     m_loading_pipeline_lb = PipelineLoadBalancer::make();
 
     std::mutex m;
@@ -824,7 +1167,7 @@ void WorkerManager::start_reloading() {
 
     for (auto *wt : m_worker_threads) {
       wt->reload(
-        [&](bool ok) {
+        force, [&](bool ok) {
           std::lock_guard<std::mutex> lock(m);
           if (!ok) all_ok = false;
           n--;
@@ -854,6 +1197,10 @@ bool WorkerManager::stop(bool force) {
   m_stopping = true;
   m_loading_pipeline_lb = nullptr;
   m_running_pipeline_lb = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(m_worker_nets_mutex);
+    m_worker_nets.clear();
+  }
   bool pending = false;
   for (auto *wt : m_worker_threads) {
     if (wt) {
@@ -865,6 +1212,8 @@ bool WorkerManager::stop(bool force) {
     delete wt;
   }
   m_worker_threads.clear();
+  if (m_recycling_timer) m_recycling_timer->cancel();
+  m_recycling_index = -1;
   m_status_counter = 0;
   m_metric_data_sum_counter = 0;
   m_stopped = true;
@@ -31,6 +31,7 @@
 #include "status.hpp"
 #include "api/stats.hpp"
 #include "signal.hpp"
+#include "timer.hpp"
 
 #include <thread>
 #include <atomic>
@@ -58,22 +59,28 @@ public:
   ~WorkerThread();
 
   static auto current() -> WorkerThread* { return s_current; }
+  static void collect_cycles(bool b) { s_collect_cycles = b; }
 
   auto manager() const -> WorkerManager* { return m_manager; }
   auto index() const -> int { return m_index; }
+  auto net() const -> Net* { return m_net; }
   bool done() const { return m_done; }
   bool ended() const { return m_ended; }
 
   bool start(bool force);
+  void launch(bool force);
+  bool wait_started();
   void status(Status &status, const std::function<void()> &cb);
   void status(const std::function<void(Status&)> &cb);
   void stats(stats::MetricData &metric_data, const std::vector<std::string> &names, const std::function<void()> &cb);
   void stats(stats::MetricData &metric_data, const std::function<void()> &cb);
   void stats(const std::function<void(stats::MetricData&)> &cb);
+  void collect_stats(const std::function<void()> &cb);
   void stats(const std::vector<std::string> &names, const std::function<void(stats::MetricData&)> &cb);
   void dump_objects(const std::string &class_name, std::map<std::string, size_t> &counts, const std::function<void()> &cb);
   void recycle();
-  void reload(const std::function<void(bool)> &cb);
+  void trim();
+  void reload(bool force, const std::function<void(bool)> &cb);
   void reload_done(bool ok);
   void admin(pjs::Str *path, SharedData *request, const std::function<void(SharedData*)> &respond);
   void exit(const std::function<void()> &cb);
@@ -106,7 +113,10 @@ private:
   static void shutdown_all(bool force);
 
   void main();
+  void recycle_step();
 
+  static bool s_collect_cycles;
+  thread_local static size_t s_cycles_reclaimed;
   thread_local static WorkerThread* s_current;
 };
 
@@ -119,9 +129,12 @@ public:
   static auto get() -> WorkerManager&;
 
   auto running_pipeline_lb() const -> PipelineLoadBalancer* { return m_running_pipeline_lb; }
+  auto least_loaded() -> Net*;
   auto loading_pipeline_lb() const -> PipelineLoadBalancer* { return m_loading_pipeline_lb; }
   bool is_graph_enabled() const { return m_graph_enabled; }
   void enable_graph(bool b) { m_graph_enabled = b; }
+  auto cpu_affinity() const -> const std::vector<int>& { return m_cpu_affinity; }
+  void cpu_affinity(const std::vector<int> &cpus) { m_cpu_affinity = cpus; }
   void on_done(const std::function<void()> &cb) { m_on_done = cb; }
   void on_ended(const std::function<void()> &cb) { m_on_ended = cb; }
   void argv(const std::vector<std::string> &argv);
@@ -134,7 +147,8 @@ public:
   void stats(const std::function<void(stats::MetricDataSum&)> &cb, const std::vector<std::string> &names);
   auto dump_objects(const std::string &class_name) -> std::map<std::string, size_t>;
   void recycle();
-  void reload();
+  void trim();
+  void reload(bool force = false);
   bool admin(pjs::Str *path, const Data &request, const std::function<void(const Data *)> &respond);
   auto concurrency() const -> int { return m_concurrency; }
   bool stop(bool force = false);
@@ -181,7 +195,10 @@ private:
   };
 
   std::vector<WorkerThread*> m_worker_threads;
+  std::vector<Net*> m_worker_nets;
+  std::mutex m_worker_nets_mutex;
   std::vector<std::string> m_argv;
+  std::vector<int> m_cpu_affinity;
   pjs::Ref<PipelineLoadBalancer> m_running_pipeline_lb;
   pjs::Ref<PipelineLoadBalancer> m_loading_pipeline_lb;
   Status m_status;
@@ -191,6 +208,7 @@ private:
   int m_concurrency = 0;
   bool m_graph_enabled = false;
   bool m_reloading_requested = false;
+  bool m_reloading_forced = false;
   bool m_reloading = false;
   bool m_querying_status = false;
   bool m_querying_stats = false;
@@ -198,12 +216,15 @@ private:
   bool m_stopped = false;
   List<AdminRequest> m_admin_requests;
   AdminRequest* m_current_admin_request = nullptr;
+  std::unique_ptr<Timer> m_recycling_timer;
+  int m_recycling_index = -1;
   std::function<void()> m_on_done;
   std::function<void()> m_on_ended;
 
   void check_reloading();
   void start_reloading();
   void next_admin_request();
+  void recycle_next();
   void on_thread_done(int index);
   void on_thread_ended(int index);
 
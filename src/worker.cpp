@@ -50,6 +50,7 @@
 #include "api/ip.hpp"
 #include "api/json.hpp"
 #include "api/logging.hpp"
+#include "api/netlink.hpp"
 #include "api/os.hpp"
 #include "api/pipy.hpp"
 #include "api/pipeline-api.hpp"
@@ -124,6 +125,9 @@ template<> void ClassDef<pipy::Global>::init() {
   // IPEndpoint
   variable("IPEndpoint", class_of<Constructor<IPEndpoint>>());
 
+  // IPMap
+  variable("IPMap", class_of<Constructor<IPMap>>());
+
   // Netmask
   variable("Netmask", class_of<Constructor<IPMask>>());
 
@@ -193,6 +197,9 @@ template<> void ClassDef<pipy::Global>::init() {
   // bpf
   variable("bpf", class_of<bpf::BPF>());
 
+  // netlink
+  variable("netlink", class_of<netlink::Netlink>());
+
   // sqlite
   variable("sqlite", class_of<sqlite::Sqlite>());
 
@@ -236,6 +243,7 @@ Worker::Worker(pjs::Promise::Period *period, PipelineLoadBalancer *plb, bool is_
 }
 
 Worker::~Worker() {
+  if (Codebase::recorder() == this) Codebase::recorder(nullptr);
   Log::debug(Log::ALLOC, "[worker   %p] --", this);
 }
 
@@ -536,6 +544,47 @@ bool Worker::bind() {
   return true;
 }
 
+//
+// A reload can keep the current worker when every file it has read from
+// the codebase, scripts and data alike, still has the same content.
+//
+
+bool Worker::sources_changed(const std::string &entry) {
+  if (!find_js_module(entry)) return true;
+  auto codebase = Codebase::current();
+  auto recorder = Codebase::recorder();
+  Codebase::recorder(nullptr);
+  bool changed = false;
+  for (const auto &p : m_sources) {
+    auto sd = codebase->get(p.first);
+    auto src = make_source(sd);
+    if (sd) sd->release();
+    const auto &old = p.second;
+    if (src.found != old.found || src.size != old.size || src.hash != old.hash) {
+      changed = true;
+      break;
+    }
+  }
+  Codebase::recorder(recorder);
+  return changed;
+}
+
+auto Worker::make_source(SharedData *data) -> Source {
+  Source src = { false, 0, 0 };
+  if (data) {
+    Data buf(*data);
+    auto str = buf.to_string();
+    src.found = true;
+    src.size = str.length();
+    src.hash = std::hash<std::string>()(str);
+  }
+  return src;
+}
+
+void Worker::on_codebase_read(const std::string &path, SharedData *data) {
+  m_sources[path] = make_source(data);
+}
+
 bool Worker::start(bool force) {
   m_forced = force;
 
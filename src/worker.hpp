@@ -26,6 +26,7 @@
 #ifndef WORKER_HPP
 #define WORKER_HPP
 
+#include "codebase.hpp"
 #include "context.hpp"
 #include "listener.hpp"
 #include "message.hpp"
@@ -49,7 +50,11 @@ class Watch;
 // Worker
 //
 
-class Worker : public pjs::RefCount<Worker>, public pjs::Instance {
+class Worker :
+  public pjs::RefCount<Worker>,
+  public pjs::Instance,
+  public Codebase::Recorder
+{
 public:
   static auto make(pjs::Promise::Period *period, PipelineLoadBalancer *plb, bool is_graph_enabled = false) -> Worker* {
     return new Worker(period, plb, is_graph_enabled);
@@ -88,6 +93,7 @@ public:
   bool start(bool force);
   void stop(bool force);
   bool admin(Message *request, const std::function<void(Message*)> &respond);
+  bool sources_changed(const std::string &entry);
 
 private:
   Worker(pjs::Promise::Period *period, PipelineLoadBalancer *plb, bool is_graph_enabled);
@@ -148,6 +154,12 @@ private:
     List<Handler> m_handlers;
   };
 
+  struct Source {
+    bool found;
+    size_t size;
+    size_t hash;
+  };
+
   struct SolvedFile {
     int index;
     pjs::Ref<pjs::Str> filename;
@@ -174,6 +186,7 @@ private:
   std::list<pjs::Ref<ListenerArray>> m_listener_arrays;
   std::map<pjs::Ref<pjs::Str>, Namespace> m_namespaces;
   std::map<pjs::Ref<pjs::Str>, SolvedFile> m_solved_files;
+  std::map<std::string, Source> m_sources;
   std::unique_ptr<Signal> m_exit_signal;
   bool m_forced = false;
   bool m_started = false;
@@ -187,6 +200,10 @@ private:
   void on_exit(Exit *exit);
   void end_all();
 
+  static auto make_source(SharedData *data) -> Source;
+
+  virtual void on_codebase_read(const std::string &path, SharedData *data) override;
+
   void append_pipeline_template(PipelineLayout *pt);
   void remove_pipeline_template(PipelineLayout *pt);
 
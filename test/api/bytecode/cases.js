@@ -0,0 +1,176 @@
+//
+// Run by main.js once with bytecode and once without
+//
+
+((
+  show = x => (
+    typeof x === 'function' ? 'function' :
+    x === undefined ? 'undefined' :
+    JSON.stringify(x)
+  ),
+
+  run = (name, f) => {
+    try {
+      return `${name} => ${show(f())}`
+    } catch (e) {
+      return `${name} throws ${e?.message || e}`
+    }
+  },
+
+  cases = [
+
+    // Closures
+    ['counter', () => {
+      var n = 0
+      var inc = () => ++n
+      inc(); inc()
+      return [n, inc()]
+    }],
+    ['shared capture', () => {
+      var x = 1
+      var get = () => x
+      var set = v => { x = v }
+      set(5)
+      return get() + x
+    }],
+    ['nested levels', () => {
+      var a = 'a'
+      return (b => (c => (d => a + b + c + d)('d'))('c'))('b')
+    }],
+    ['capture per call', () => {
+      var make = i => () => i * 10
+      var fs = [1, 2, 3].map(make)
+      return fs.map(f => f())
+    }],
+    ['recursion', () => {
+      var fib = n => n < 2 ? n : fib(n - 1) + fib(n - 2)
+      return fib(15)
+    }],
+    ['default args', () => {
+      var f = (a, b = a * 2, c = () => a + b) => c()
+      return [f(1), f(1, 1)]
+    }],
+    ['arguments shadowing', () => {
+      var x = 'outer'
+      var f = x => { var g = () => x; x = x + '!'; return g() }
+      return [f('inner'), x]
+    }],
+
+    // Exceptions
+    ['throw string', () => { throw 'boom' }],
+    ['throw error', () => { throw new Error('bad thing') }],
+    ['catch and continue', () => {
+      var log = []
+      try { log.push(1); throw new Error('x'); log.push(2) } catch (e) { log.push(e.message) }
+      log.push(3)
+      return log
+    }],
+    ['finally', () => {
+      var log = []
+      var f = x => { try { log.push('try'); if (x) throw new Error(x) } finally { log.push('finally') } }
+      f()
+      try { f('fail') } catch (e) { log.push(e.message) }
+      return log
+    }],
+    ['rethrow', () => {
+      try { throw new Error('inner') } catch (e) { throw new Error('outer: ' + e.message) }
+    }],
+    ['throw across calls', () => {
+      var f = n => { if (n === 0) throw new Error('bottom'); return f(n - 1) }
+      try { return f(5) } catch (e) { return e.message }
+    }],
+    ['property of undefined', () => { var o; return o.x }],
+    ['property of null', () => { var o = null; return o.x.y }],
+    ['call non-function', () => { var o = {}; return o.f() }],
+    ['call undefined', () => { var f; return f() }],
+    ['set property of undefined', () => { var o; o.x = 1 }],
+
+    // Optional chaining
+    ['?. on object', () => { var o = { a: { b: 1 } }; return o?.a?.b }],
+    ['?. on undefined', () => { var o; return o?.a }],
+    ['?. on null', () => { var o = null; return [o?.a, o?.['a']] }],
+    ['?. computed', () => { var o = { k: 'v' }; var k = 'k'; return [o?.[k], o?.['none']] }],
+    ['?. call', () => {
+      var o = { f: x => x + 1 }
+      return [o.f?.(1), o.g?.(1), o?.f(2)]
+    }],
+    ['?. then missing member', () => { var o = { a: null }; return o?.a.b }],
+    ['?? with ?.', () => { var o = {}; return o?.a?.b ?? 'default' }],
+
+    // delete
+    ['delete property', () => {
+      var o = {}
+      o.a = 1; o.b = 2; o.c = 3
+      var r = delete o.b
+      return [r, o, 'b' in o]
+    }],
+    ['delete computed', () => {
+      var o = {}
+      o.a = 1; o.b = 2
+      var k = 'a'
+      delete o[k]
+      return Object.keys(o)
+    }],
+    ['delete missing', () => { var o = {}; return delete o.x }],
+    ['delete then re-add', () => {
+      var o = {}
+      o.a = 1; o.b = 2
+      delete o.a
+      o.a = 3
+      return Object.keys(o)
+    }],
+    ['delete in loop', () => {
+      var o = {}
+      new Array(10).fill().forEach((_, i) => { o['k' + i] = i })
+      Object.keys(o).forEach(k => { if (o[k] % 2) delete o[k] })
+      return o
+    }],
+    ['delete on undefined', () => { var o; return delete o.x }],
+
+    // Compound assignment
+    ['local', () => {
+      var a = 10
+      a += 5; a -= 3; a *= 2; a /= 4; a %= 4
+      return a
+    }],
+    ['bitwise and shifts', () => {
+      var a = 0xf0
+      a |= 1; a &= 0x3f; a ^= 0xff; a <<= 2; a >>= 1; a >>>= 1
+      return a
+    }],
+    ['exponent', () => { var a = 3; a **= 4; return a }],
+    ['string concat', () => { var s = 'a'; s += 1; s += null; s += true; return s }],
+    ['property', () => {
+      var o = { n: 1, s: 'x' }
+      o.n += 2; o.n *= o.n; o.s += o.n
+      return o
+    }],
+    ['computed', () => {
+      var o = { k0: 1, k1: 10 }
+      var i = 1
+      o['k' + i] += 100
+      o['k' + (i - 1)] *= 3
+      return o
+    }],
+    ['nested property', () => { var o = { a: { b: { c: 1 } } }; o.a.b.c -= 5; return o }],
+    ['on missing property', () => { var o = {}; o.x += 1; o.y += 'y'; return [o.x, o.y] }],
+    ['closure captured', () => {
+      var total = 0
+      var add = n => { total += n; return total }
+      add(1); add(2)
+      return [add(3), total]
+    }],
+    ['result value', () => { var a = 1; var b = (a += 2) * 10; return [a, b] }],
+    ['on undefined object', () => { var o; o.x += 1 }],
+  ],
+
+) => pipy.read('input', $=>$
+  .replaceData(() => new Data)
+  .replaceStreamEnd(
+    () => [
+      new Data(cases.map(([name, f]) => run(name, f)).join('\n') + '\n'),
+      new StreamEnd,
+    ]
+  )
+  .tee('-')
+))()
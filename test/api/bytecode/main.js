@@ -0,0 +1,36 @@
+//
+// Runs the same cases with functions compiled to bytecode and with
+// every function left to the tree-walker, expecting the same results
+// and the same error messages from both
+//
+
+((
+  run = options => pipy.exec(
+    [pipy.argv[0], '--no-graph', '--log-level=error'].concat(options, 'cases.js')
+  ).toString().split('\n').filter(l => l),
+
+  compare = (bytecode, treeWalker) => (
+    bytecode.length !== treeWalker.length ? [
+      `bytecode gave ${bytecode.length} results, tree-walker gave ${treeWalker.length}`,
+    ] : bytecode.map(
+      (line, i) => line === treeWalker[i] ? null : `mismatch: ${line} | ${treeWalker[i]}`
+    ).filter(l => l)
+  ),
+
+) => pipy.read('input', $=>$
+  .replaceData(() => new Data)
+  .replaceStreamEnd(
+    () => (
+      (bytecode, treeWalker) => [
+        new Data(
+          bytecode.concat(
+            compare(bytecode, treeWalker),
+            `${treeWalker.length} results from the tree-walker`,
+          ).join('\n') + '\n'
+        ),
+        new StreamEnd,
+      ]
+    )(run([]), run(['--no-bytecode']))
+  )
+  .tee('-')
+))()
@@ -0,0 +1,155 @@
+((
+  log = [],
+  upstream = {},
+
+  date = 'Thu, 01 Jan 2026 00:00:00 GMT',
+
+  origin = {
+    '/fresh': () => [{ 'cache-control': 'max-age=60' }],
+    '/short': () => [{ 'cache-control': 'max-age=1' }],
+    '/expires-future': () => [{ 'date': date, 'expires': 'Thu, 01 Jan 2026 00:01:00 GMT' }],
+    '/expires-past': () => [{ 'date': date, 'expires': 'Wed, 31 Dec 2025 23:59:00 GMT' }],
+    '/etag': req => (
+      req.head.headers['if-none-match'] === '"v1"' ? [{ 'etag': '"v1"', 'cache-control': 'max-age=0' }, 304] :
+      [{ 'etag': '"v1"', 'cache-control': 'max-age=0' }]
+    ),
+    '/etag-fresh': () => [{ 'etag': '"v2"', 'cache-control': 'max-age=60' }],
+    '/vary': () => [{ 'cache-control': 'max-age=60', 'vary': 'Accept-Language' }],
+    '/set-cookie': () => [{ 'cache-control': 'max-age=60', 'set-cookie': 'session=1' }],
+    '/authorization': () => [{ 'cache-control': 'max-age=60' }],
+    '/private': () => [{ 'cache-control': 'private, max-age=60' }],
+    '/slow': () => [{ 'cache-control': 'max-age=60' }, 200, 0.2],
+    '/slow-no-store': () => [{ 'cache-control': 'no-store' }, 200, 0.2],
+    '/slower': () => [{ 'cache-control': 'max-age=60' }, 200, 0.5],
+  },
+
+  serve = req => (
+    ((path, n) => (
+      upstream[path] = n,
+      (([headers, status, delay]) => (
+        (res => delay ? new Timeout(delay).wait().then(() => res) : res)(
+          new Message(
+            { status: status || 200, headers },
+            status === 304 ? null : `${path} ${n} ${req.head.headers['accept-language'] || ''}`.trim()
+          )
+        )
+      ))(origin[path](req))
+    ))(req.head.path, (upstream[req.head.path] || 0) + 1)
+  ),
+
+  client = options => pipeline($=>$
+    .onStart(req => req)
+    .cacheHTTP(options).to($=>$
+      .replaceMessage(serve)
+    )
+    .replaceMessage(
+      res => (
+        log.push(`  ${res.head.status} ${res.body?.toString() || '(no body)'}`),
+        new StreamEnd
+      )
+    )
+  ),
+
+  shared = client({ name: 'test' }),
+  impatient = client({ name: 'impatient', lockTimeout: 0.1 }),
+
+  get = (path, headers, layout) => (layout || shared).spawn(
+    new Message({ method: 'GET', path, headers: Object.assign({ host: 'example.com' }, headers) })
+  ),
+
+  step = (title, f) => () => (
+    log.push(title),
+    f()
+  ),
+
+  sequence = fs => () => fs.reduce((p, f) => p.then(f), Promise.resolve()),
+
+  report = path => () => log.push(`  upstream ${path}: ${upstream[path] || 0}`),
+
+  steps = [
+    step('miss then hit', sequence([
+      () => get('/fresh'),
+      () => get('/fresh'),
+      report('/fresh'),
+    ])),
+    step('max-age expires', sequence([
+      () => get('/short'),
+      () => get('/short'),
+      () => new Timeout(1.2).wait(),
+      () => get('/short'),
+      report('/short'),
+    ])),
+    step('expires in the future', sequence([
+      () => get('/expires-future'),
+      () => get('/expires-future'),
+      report('/expires-future'),
+    ])),
+    step('expires in the past', sequence([
+      () => get('/expires-past'),
+      () => get('/expires-past'),
+      report('/expires-past'),
+    ])),
+    step('request no-cache', sequence([
+      () => get('/fresh', { 'cache-control': 'no-cache' }),
+      report('/fresh'),
+    ])),
+    step('revalidated with 304', sequence([
+      () => get('/etag'),
+      () => get('/etag'),
+      () => get('/etag'),
+      report('/etag'),
+    ])),
+    step('if-none-match answered from cache', sequence([
+      () => get('/etag-fresh'),
+      () => get('/etag-fresh', { 'if-none-match': '"v2"' }),
+      () => get('/etag-fresh', { 'if-none-match': '"v1", W/"v2"' }),
+      () => get('/etag-fresh', { 'if-none-match': '"v3"' }),
+      report('/etag-fresh'),
+    ])),
+    step('vary', sequence([
+      () => get('/vary', { 'accept-language': 'en' }),
+      () => get('/vary', { 'accept-language': 'fr' }),
+      () => get('/vary', { 'accept-language': 'en' }),
+      () => get('/vary', { 'accept-language': 'fr' }),
+      report('/vary'),
+    ])),
+    step('set-cookie not stored', sequence([
+      () => get('/set-cookie'),
+      () => get('/set-cookie'),
+      report('/set-cookie'),
+    ])),
+    step('authorization bypasses', sequence([
+      () => get('/authorization', { 'authorization': 'Basic dXNlcjpwYXNz' }),
+      () => get('/authorization', { 'authorization': 'Basic dXNlcjpwYXNz' }),
+      () => get('/authorization'),
+      () => get('/authorization'),
+      report('/authorization'),
+    ])),
+    step('private not stored', sequence([
+      () => get('/private'),
+      () => get('/private'),
+      report('/private'),
+    ])),
+    step('concurrent misses coalesced', sequence([
+      () => Promise.all([get('/slow'), get('/slow'), get('/slow')]),
+      report('/slow'),
+    ])),
+    step('waiters go upstream when not stored', sequence([
+      () => Promise.all([get('/slow-no-store'), get('/slow-no-store')]),
+      report('/slow-no-store'),
+    ])),
+    step('waiters go upstream after lockTimeout', sequence([
+      () => Promise.all([get('/slower', {}, impatient), get('/slower', {}, impatient)]),
+      report('/slower'),
+    ])),
+  ],
+
+) => pipy.read('input', $=>$
+  .replaceData(() => new Data)
+  .replaceStreamEnd(
+    () => sequence(steps)().then(
+      () => [new Data(log.join('\n') + '\n'), new StreamEnd]
+    )
+  )
+  .tee('-')
+))()
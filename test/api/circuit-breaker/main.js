@@ -0,0 +1,70 @@
+((
+  log = [],
+
+  cb = new algo.CircuitBreaker({
+    consecutiveFailures: 3,
+    minRequests: 1000,
+    openTime: 0.3,
+    halfOpenRequests: 2,
+  }),
+
+  check = (title, target) => () => log.push(`  ${title}: ${cb.state(target)}, allow = ${cb.allow(target)}`),
+  report = (target, ok) => () => cb.report(target, ok),
+  wait = t => () => new Timeout(t).wait(),
+
+  step = (title, f) => () => (
+    log.push(title),
+    f()
+  ),
+
+  sequence = fs => () => fs.reduce((p, f) => p.then(f), Promise.resolve()),
+
+  steps = [
+    step('opens after consecutive failures', sequence([
+      report('a', false),
+      report('a', false),
+      check('2 failures', 'a'),
+      report('a', false),
+      check('3 failures', 'a'),
+    ])),
+    step('a success resets the failure count', sequence([
+      report('b', false),
+      report('b', false),
+      report('b', true),
+      report('b', false),
+      report('b', false),
+      check('2 + 2 failures', 'b'),
+    ])),
+    step('half-opens after openTime', sequence([
+      wait(0.1),
+      check('before openTime', 'a'),
+      wait(0.3),
+      () => log.push(`  after openTime: ${cb.state('a')}`),
+      () => log.push(`  trials: ${[cb.allow('a'), cb.allow('a'), cb.allow('a')].join(', ')}`),
+    ])),
+    step('closes when all trials succeed', sequence([
+      report('a', true),
+      () => log.push(`  1 success: ${cb.state('a')}`),
+      report('a', true),
+      check('2 successes', 'a'),
+    ])),
+    step('reopens when a trial fails', sequence([
+      report('c', false),
+      report('c', false),
+      report('c', false),
+      wait(0.4),
+      () => log.push(`  after openTime: ${cb.state('c')}, allow = ${cb.allow('c')}`),
+      report('c', false),
+      check('trial failed', 'c'),
+    ])),
+  ],
+
+) => pipy.read('input', $=>$
+  .replaceData(() => new Data)
+  .replaceStreamEnd(
+    () => sequence(steps)().then(
+      () => [new Data(log.join('\n') + '\n'), new StreamEnd]
+    )
+  )
+  .tee('-')
+))()
@@ -0,0 +1,66 @@
+((
+  log = [],
+  upstream = {},
+
+  serve = req => (
+    ((path, n) => (
+      upstream[path] = n,
+      new Timeout(0.2).wait().then(
+        () => new Message({ status: 200 }, `${path} ${n}`)
+      )
+    ))(req.head.path, (upstream[req.head.path] || 0) + 1)
+  ),
+
+  client = pipeline($=>$
+    .onStart(req => req)
+    .coalesce(head => head.method === 'GET' ? head.path : undefined, { name: 'test' }).to($=>$
+      .replaceMessage(serve)
+    )
+    .replaceMessage(
+      res => (
+        log.push(`  ${res.head.status} ${res.body.toString()}`),
+        new StreamEnd
+      )
+    )
+  ),
+
+  request = (method, path) => client.spawn(new Message({ method, path })),
+
+  step = (title, f) => () => (
+    log.push(title),
+    f()
+  ),
+
+  sequence = fs => () => fs.reduce((p, f) => p.then(f), Promise.resolve()),
+
+  report = path => () => log.push(`  upstream ${path}: ${upstream[path] || 0}`),
+
+  steps = [
+    step('duplicates collapsed', sequence([
+      () => Promise.all([request('GET', '/a'), request('GET', '/a'), request('GET', '/a')]),
+      report('/a'),
+    ])),
+    step('different keys not collapsed', sequence([
+      () => Promise.all([request('GET', '/b'), request('GET', '/c')]),
+      report('/b'),
+      report('/c'),
+    ])),
+    step('no key goes on its own', sequence([
+      () => Promise.all([request('POST', '/d'), request('POST', '/d')]),
+      report('/d'),
+    ])),
+    step('later requests lead again', sequence([
+      () => request('GET', '/a'),
+      report('/a'),
+    ])),
+  ],
+
+) => pipy.read('input', $=>$
+  .replaceData(() => new Data)
+  .replaceStreamEnd(
+    () => sequence(steps)().then(
+      () => [new Data(log.join('\n') + '\n'), new StreamEnd]
+    )
+  )
+  .tee('-')
+))()
@@ -0,0 +1,110 @@
+((
+  // Values passed through v() are only known at run time
+  v = x => x,
+
+  hits = [],
+  hit = name => (hits.push(name), name),
+
+  show = x => (
+    typeof x === 'string' ? JSON.stringify(x) :
+    x === 0 && 1 / x < 0 ? '-0' : `${x}`
+  ),
+
+  cases = [
+    ['1 + 2 * 3', () => 1 + 2 * 3, () => v(1) + v(2) * v(3)],
+    ['(1 + 2) * 3', () => (1 + 2) * 3, () => (v(1) + v(2)) * v(3)],
+    ['7 % -3', () => 7 % -3, () => v(7) % v(-3)],
+    ['-7 % 3', () => -7 % 3, () => -v(7) % v(3)],
+    ['1 / 0', () => 1 / 0, () => v(1) / v(0)],
+    ['-1 / 0', () => -1 / 0, () => -v(1) / v(0)],
+    ['0 / 0', () => 0 / 0, () => v(0) / v(0)],
+    ['-0', () => -0, () => -v(0)],
+    ['0 * -1', () => 0 * -1, () => v(0) * v(-1)],
+    ['0.1 + 0.2', () => 0.1 + 0.2, () => v(0.1) + v(0.2)],
+    ['1e21 + 1', () => 1e21 + 1, () => v(1e21) + v(1)],
+    ['1 + "2"', () => 1 + '2', () => v(1) + v('2')],
+    ['"1" + 2 + 3', () => '1' + 2 + 3, () => v('1') + v(2) + v(3)],
+    ['1 + 2 + "3"', () => 1 + 2 + '3', () => v(1) + v(2) + v('3')],
+    ['"3" * "4"', () => '3' * '4', () => v('3') * v('4')],
+    ['"10" - 1', () => '10' - 1, () => v('10') - v(1)],
+    ['"a" - 1', () => 'a' - 1, () => v('a') - v(1)],
+    ['+"0x1f"', () => +'0x1f', () => +v('0x1f')],
+    ['+""', () => +'', () => +v('')],
+    ['+" 12 "', () => +' 12 ', () => +v(' 12 ')],
+    ['+null', () => +null, () => +v(null)],
+    ['null + 1', () => null + 1, () => v(null) + v(1)],
+    ['true + true', () => true + true, () => v(true) + v(true)],
+    ['"x" + null', () => 'x' + null, () => v('x') + v(null)],
+    ['"x" + true', () => 'x' + true, () => v('x') + v(true)],
+    ['"x" + 1.5e-7', () => 'x' + 1.5e-7, () => v('x') + v(1.5e-7)],
+    ['"10" < "9"', () => '10' < '9', () => v('10') < v('9')],
+    ['"10" < 9', () => '10' < 9, () => v('10') < v(9)],
+    ['"a" < 1', () => 'a' < 1, () => v('a') < v(1)],
+    ['"a" >= 1', () => 'a' >= 1, () => v('a') >= v(1)],
+    ['null >= 0', () => null >= 0, () => v(null) >= v(0)],
+    ['null > 0', () => null > 0, () => v(null) > v(0)],
+    ['null == 0', () => null == 0, () => v(null) == v(0)],
+    ['null == false', () => null == false, () => v(null) == v(false)],
+    ['"1" == 1', () => '1' == 1, () => v('1') == v(1)],
+    ['"1" === 1', () => '1' === 1, () => v('1') === v(1)],
+    ['"" == 0', () => '' == 0, () => v('') == v(0)],
+    ['"0" == false', () => '0' == false, () => v('0') == v(false)],
+    ['0 / 0 == 0 / 0', () => 0 / 0 == 0 / 0, () => v(0) / v(0) == v(0) / v(0)],
+    ['0 / 0 != 0 / 0', () => 0 / 0 != 0 / 0, () => v(0) / v(0) != v(0) / v(0)],
+    ['0 === -0', () => 0 === -0, () => v(0) === -v(0)],
+    ['!""', () => !'', () => !v('')],
+    ['!"0"', () => !'0', () => !v('0')],
+    ['!(0 / 0)', () => !(0 / 0), () => !(v(0) / v(0))],
+    ['0 && "a"', () => 0 && 'a', () => v(0) && v('a')],
+    ['1 && "a"', () => 1 && 'a', () => v(1) && v('a')],
+    ['"" || "b"', () => '' || 'b', () => v('') || v('b')],
+    ['"a" || "b"', () => 'a' || 'b', () => v('a') || v('b')],
+    ['null ?? "c"', () => null ?? 'c', () => v(null) ?? v('c')],
+    ['0 ?? "c"', () => 0 ?? 'c', () => v(0) ?? v('c')],
+    ['"" ?? "c"', () => '' ?? 'c', () => v('') ?? v('c')],
+    ['false ?? "c"', () => false ?? 'c', () => v(false) ?? v('c')],
+    ['1 ? 2 : 3', () => 1 ? 2 : 3, () => v(1) ? v(2) : v(3)],
+    ['"" ? 2 : 3', () => '' ? 2 : 3, () => v('') ? v(2) : v(3)],
+    ['1 < 2 ? "y" : "n"', () => 1 < 2 ? 'y' : 'n', () => v(1) < v(2) ? v('y') : v('n')],
+  ],
+
+  // Dead branches must not run, while live ones with side effects must
+  branches = [
+    ['false && hit()', () => false && hit('and')],
+    ['true || hit()', () => true || hit('or')],
+    ['1 ?? hit()', () => 1 ?? hit('nullish')],
+    ['0 ? hit() : 1', () => 0 ? hit('then') : 1],
+    ['1 ? 1 : hit()', () => 1 ? 1 : hit('else')],
+    ['true && hit()', () => true && hit('and live')],
+    ['null ?? hit()', () => null ?? hit('nullish live')],
+    ['if (0) ... else ...', () => { if (0) { hit('if'); return 'then' } else { return 'else' } }],
+    ['if (1 + 1 === 2) ...', () => { if (1 + 1 === 2) { return hit('if live') } return 'after' }],
+    ['if ("") ...', () => { if ('') { return hit('if empty') } return 'after' }],
+    ['hit() && false', () => hit('left') && false],
+  ],
+
+  input = new Data,
+
+) => pipy.read('input', $=>$
+  .replaceData(data => (input.push(data), new Data))
+  .replaceStreamEnd(
+    () => [
+      new Data(
+        [].concat(
+          cases.map(
+            ([name, folded, dynamic]) => (
+              (a, b) => `${name} = ${a}${a === b ? '' : ` MISMATCH (${b} at run time)`}`
+            )(show(folded()), show(dynamic()))
+          ),
+          branches.map(
+            ([name, f]) => (
+              (r => `${name} = ${show(r)} ran ${JSON.stringify(hits.splice(0))}`)(f())
+            )
+          ),
+        ).join('\n') + '\n'
+      ),
+      new StreamEnd,
+    ]
+  )
+  .tee('-')
+))()
@@ -0,0 +1,53 @@
+//
+// Run with --collect-cycles. Counts live script objects through
+// pipy_object_count before and after the collector's recycling round.
+//
+
+((
+  count = () => stats.sum(['pipy_object_count']).then(
+    m => m.pipy_object_count.submetrics()
+      .filter(s => s.label === 'pjs::Object' || s.label === 'pjs::Array' || s.label === 'pjs::Function')
+      .reduce((n, s) => n + s.value, 0)
+  ),
+
+  // An Object and an Array referring to each other, with a closure over
+  // the object so the cycle also runs through a scope
+  cycle = () => ((o) => (o.a = [o], o.f = () => o.a, o))({}),
+
+  kept = null,
+  counts = [],
+
+) => pipy.read('input', $=>$
+  .replaceData(() => new Data)
+  .replaceStreamEnd(
+    () => count().then(
+      n => (
+        counts.push(n),
+        new Array(100).fill(0).forEach(() => cycle()),
+        kept = cycle(),
+        count()
+      )
+    ).then(
+      n => (
+        counts.push(n),
+        new Timeout(6).wait()
+      )
+    ).then(
+      () => count()
+    ).then(
+      n => (
+        counts.push(n),
+        [
+          new Data([
+            `created: ${counts[1] - counts[0] >= 200}`,
+            `reclaimed: ${counts[1] - counts[2] >= 200}`,
+            `reachable cycle kept: ${kept.a[0] === kept && kept.f() === kept.a}`,
+            '',
+          ].join('\n')),
+          new StreamEnd,
+        ]
+      )
+    )
+  )
+  .tee('-')
+))()
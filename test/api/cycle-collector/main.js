@@ -0,0 +1,13 @@
+//
+// The collector only runs with --collect-cycles, from the recycling job
+// that comes around every few seconds, so it is tested in a child process
+//
+
+pipy.read('input', $=>$
+  .replaceData(() => new Data)
+  .replaceStreamEnd(() => [
+    pipy.exec([pipy.argv[0], '--no-graph', '--collect-cycles', 'cycles.js']),
+    new StreamEnd,
+  ])
+  .tee('-')
+)
@@ -0,0 +1,31 @@
+//
+// Runs of handlers in between other filters are fused unless
+// --filter-stats is on, when every filter takes events on its own
+//
+
+((
+  log = [],
+  add = line => log.push(line),
+
+) => pipy.read('requests', $=>$
+  .handleStreamStart(() => add('stream start'))
+  .handleData(data => add(`in ${data.size}`))
+  .demuxHTTP().to($=>$
+    .handleMessageStart(msg => add(`request ${msg.head.method} ${msg.head.path}`))
+    .handleData(data => add(`request body ${data.toString()}`))
+    .handleMessageStart(msg => msg.head.path === '/slow' && new Timeout(0.05).wait().then(() => add('slow done')))
+    .handleMessageEnd(() => add('request end'))
+    .replaceMessage(
+      req => req.head.path === '/early' ? new StreamEnd : new Message(
+        { status: 200 }, `${req.head.method} ${req.head.path} ${req.body?.size || 0}`
+      )
+    )
+    .handleMessageStart(msg => add(`response ${msg.head.status}`))
+    .handleMessageEnd(() => add('response end'))
+    .handleStreamEnd(evt => add(`request stream end ${evt.error || ''}`))
+  )
+  .handleData(data => add(`out ${data.size}`))
+  .handleStreamEnd(() => add('stream end'))
+  .replaceStreamEnd(() => [new Data(log.join('\n') + '\n'), new StreamEnd])
+  .tee('-')
+))()
@@ -0,0 +1,23 @@
+//
+// Runs fusion.js with fused handlers and again with --filter-stats,
+// which keeps every filter apart, expecting the same output from both
+//
+
+((
+  run = options => pipy.exec(
+    [pipy.argv[0], '--no-graph', '--log-level=error'].concat(options, 'fusion.js')
+  ),
+
+) => pipy.read('input', $=>$
+  .replaceData(() => new Data)
+  .replaceStreamEnd(
+    () => (
+      (fused, unfused) => [
+        fused,
+        new Data(`same as unfused: ${fused.toString() === unfused.toString()}\n`),
+        new StreamEnd,
+      ]
+    )(run([]), run(['--filter-stats']))
+  )
+  .tee('-')
+))()
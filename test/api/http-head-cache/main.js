@@ -0,0 +1,38 @@
+//
+// Every response is the same message object, so the encoder sees the
+// same headers object again and again, with changes made in between
+//
+
+((
+  response = new Message(
+    {
+      status: 200,
+      headers: {
+        'content-type': 'text/plain',
+        'x-version': '1',
+      },
+    },
+    'hello'
+  ),
+
+  head = response.head,
+
+  update = {
+    '/set-header': () => { head.headers['x-added'] = 'yes' },
+    '/new-value': () => { head.headers['x-version'] = '2' },
+    '/status': () => { head.status = 404 },
+    '/status-text': () => { head.statusText = 'Gone Fishing' },
+    '/delete-header': () => { delete head.headers['x-added'] },
+  },
+
+) => pipy.read('input', $=>$
+  .demuxHTTP().to($=>$
+    .replaceMessage(
+      req => (
+        update[req.head.path]?.(),
+        response
+      )
+    )
+  )
+  .tee('-')
+))()
@@ -0,0 +1,37 @@
+((
+  untouched = new Data,
+  touched = new Data,
+  heads = [],
+
+  text = data => data.toString().split('\r\n').join('\n'),
+
+) => pipy.read('input', $=>$
+  .fork().to($=>$
+    .decodeHTTPRequest()
+    .encodeHTTPRequest()
+    .handleData(data => untouched.push(data))
+  )
+  .decodeHTTPRequest()
+  .handleMessageStart(
+    msg => heads.push(
+      JSON.stringify(msg.head.headers),
+      JSON.stringify(msg.head.headerNames),
+    )
+  )
+  .encodeHTTPRequest()
+  .handleData(data => touched.push(data))
+  .replaceData(() => new Data)
+  .replaceStreamEnd(
+    () => [
+      new Data(
+        [
+          'headers:', ...heads,
+          'encoded as received:', text(untouched),
+          'encoded from headers:', text(touched),
+        ].join('\n')
+      ),
+      new StreamEnd,
+    ]
+  )
+  .tee('-')
+))()
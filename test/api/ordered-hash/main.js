@@ -0,0 +1,164 @@
+((
+  input = new Data,
+
+  random = seed => () => (seed = seed * 48271 % 2147483647),
+
+  // Keys 2n and 2n+1 are n as a number and as a string
+  mapKey = id => id & 1 ? `${id >> 1}` : id >> 1,
+  objectKey = id => `k${id}`,
+
+  // A reference model keeping the insertion stamp of each key in an array
+  model = (range, keyOf) => (
+    (
+      stamps = new Array(range).fill(0),
+      values = new Array(range).fill(),
+      stamp = 0,
+    ) => ({
+      set: (id, v) => (stamps[id] || (stamps[id] = ++stamp), values[id] = v),
+      delete: id => (stamps[id] = 0),
+      has: id => stamps[id] > 0,
+      get: id => stamps[id] > 0 ? values[id] : undefined,
+      entries: () => (
+        stamps
+          .map((s, id) => [s, id])
+          .filter(([s]) => s > 0)
+          .sort((a, b) => a[0] - b[0])
+          .map(([s, id]) => [keyOf(id), values[id]])
+      ),
+    })
+  )(),
+
+  compare = (name, result, expected) => (
+    (a, b) => a === b ? `${name}: ok` : `${name}: MISMATCH\n  got      ${a}\n  expected ${b}`
+  )(
+    JSON.stringify(result),
+    JSON.stringify(expected),
+  ),
+
+  run = (ops, range, seed, insert, remove) => (
+    (next = random(seed)) => new Array(ops).fill().forEach(
+      (_, i) => (
+        (id, op) => op < 2 ? insert(id, i) : remove(id)
+      )(next() % range, next() % 3)
+    )
+  )(),
+
+  testMap = (ops, range, seed) => (
+    (
+      map = new Map,
+      m = model(range, mapKey),
+      entries = () => ((a = []) => (map.forEach((k, v) => a.push([k, v])), a))(),
+    ) => (
+      run(
+        ops, range, seed,
+        (id, i) => (map.set(mapKey(id), i), m.set(id, i)),
+        id => (map.delete(mapKey(id)), m.delete(id)),
+      ),
+      [
+        compare(`map ${ops} ${range} entries`, entries(), m.entries()),
+        compare(
+          `map ${ops} ${range} lookups`,
+          new Array(range).fill().map((_, id) => [map.has(mapKey(id)), map.get(mapKey(id))]),
+          new Array(range).fill().map((_, id) => [m.has(id), m.get(id)]),
+        ),
+        compare(`map ${ops} ${range} size`, map.size, m.entries().length),
+      ]
+    )
+  )(),
+
+  testSet = (ops, range, seed) => (
+    (
+      set = new Set,
+      m = model(range, mapKey),
+      keys = () => ((a = []) => (set.forEach(k => a.push(k)), a))(),
+    ) => (
+      run(
+        ops, range, seed,
+        id => (set.add(mapKey(id)), m.set(id, true)),
+        id => (set.delete(mapKey(id)), m.delete(id)),
+      ),
+      [
+        compare(`set ${ops} ${range} keys`, keys(), m.entries().map(([k]) => k)),
+        compare(`set ${ops} ${range} size`, set.size, m.entries().length),
+      ]
+    )
+  )(),
+
+  testObject = (ops, range, seed) => (
+    (
+      obj = {},
+      m = model(range, objectKey),
+    ) => (
+      run(
+        ops, range, seed,
+        (id, i) => (obj[objectKey(id)] = i, m.set(id, i)),
+        id => (delete obj[objectKey(id)], m.delete(id)),
+      ),
+      [
+        compare(`object ${ops} ${range} entries`, Object.entries(obj), m.entries()),
+        compare(
+          `object ${ops} ${range} lookups`,
+          new Array(range).fill().map((_, id) => [objectKey(id) in obj, obj[objectKey(id)]]),
+          new Array(range).fill().map((_, id) => [m.has(id), m.get(id)]),
+        ),
+      ]
+    )
+  )(),
+
+  // Entries deleted during forEach() are skipped and entries added are visited,
+  // which takes the entry array being compacted or grown under the iterator
+  testIteration = () => (
+    (
+      map = new Map(new Array(10).fill().map((_, i) => [i, i])),
+      big = new Map(new Array(1000).fill().map((_, i) => [i, i])),
+      visited = [],
+      bigVisited = [],
+    ) => (
+      map.forEach(
+        k => (
+          visited.push(k),
+          k % 2 === 0 && map.delete(k + 1),
+          k < 4 && map.set(k + 100, k),
+          k === 100 && (map.clear(), map.set(200, 0))
+        )
+      ),
+      big.forEach(
+        k => (
+          bigVisited.push(k),
+          big.delete(k),
+          k < 1000 && big.set(k + 1000, k)
+        )
+      ),
+      [
+        `iteration visited ${JSON.stringify(visited)}`,
+        `iteration left ${JSON.stringify(((a = []) => (map.forEach(k => a.push(k)), a))())}`,
+        compare(
+          'iteration with deletes',
+          bigVisited,
+          new Array(2000).fill().map((_, i) => i),
+        ),
+        compare('iteration with deletes size', big.size, 0),
+      ]
+    )
+  )(),
+
+) => pipy.read('input', $=>$
+  .replaceData(data => (input.push(data), new Data))
+  .replaceStreamEnd(
+    () => [
+      new Data(
+        input.toString().split('\n').filter(l => l).map(
+          line => (
+            ([ops, range, seed]) => [].concat(
+              testMap(ops, range, seed),
+              testSet(ops, range, seed),
+              testObject(ops, range, seed),
+            ).join('\n')
+          )(line.split(' ').map(s => s|0))
+        ).concat(testIteration()).join('\n') + '\n'
+      ),
+      new StreamEnd,
+    ]
+  )
+  .tee('-')
+))()
@@ -0,0 +1,39 @@
+((
+  input = new Data,
+
+  show = v => JSON.stringify(v === undefined ? null : v),
+  clip = s => s.length > 40 ? s.substring(0, 40) + '...' : s,
+
+  test = ([pattern, flags, subject]) => (
+    (
+      re = new RegExp(pattern, flags),
+      data = new Data(subject),
+      match = new Data(subject).match(new RegExp(pattern, flags)),
+    ) => [
+      `/${clip(pattern)}/${flags} ${show(clip(subject))}`,
+      `  exec    ${show(re.exec(subject))}`,
+      `  test    ${show(new RegExp(pattern, flags).test(subject))}`,
+      `  search  ${show(subject.search(new RegExp(pattern, flags)))}`,
+      `  replace ${show(clip(subject.replace(new RegExp(pattern, flags), '<$&>')))}`,
+      `  data    ${show(data.search(new RegExp(pattern, flags)))} ${show(match && match.map(d => d ? d.toString() : null))}`,
+    ].concat(
+      flags.indexOf('g') >= 0 ? [
+        `  exec g  ${show(((re = new RegExp(pattern, flags), a = []) => (a.push(re.exec(subject), re.lastIndex), a.push(re.exec(subject), re.lastIndex), a))())}`,
+      ] : []
+    )
+  )(),
+
+) => pipy.read('input', $=>$
+  .replaceData(data => (input.push(data), new Data))
+  .replaceStreamEnd(
+    () => [
+      new Data(
+        input.toString().split('\n').filter(l => l).flatMap(
+          line => test(JSON.parse(line))
+        ).join('\n') + '\n'
+      ),
+      new StreamEnd,
+    ]
+  )
+  .tee('-')
+))()
@@ -0,0 +1,84 @@
+((
+  log = [],
+  attempts = {},
+
+  // Each path fails with 503 as many times as it says, then succeeds
+  failures = {
+    '/down': 100,
+    '/flaky': 1,
+    '/post': 100,
+    '/post-allowed': 100,
+    '/capped': 100,
+  },
+
+  serve = req => (
+    ((path, n) => (
+      attempts[path] = n,
+      new Message({ status: n > failures[path] ? 200 : 503 }, `${path} ${n}`)
+    ))(req.head.path, (attempts[req.head.path] || 0) + 1)
+  ),
+
+  client = options => pipeline($=>$
+    .onStart(req => req)
+    .retry(options).to($=>$
+      .replaceMessage(serve)
+    )
+    .replaceMessage(
+      res => (
+        log.push(`  ${res.head.status} ${res.body.toString()}`),
+        new StreamEnd
+      )
+    )
+  ),
+
+  fast = client({ maxRetries: 2, backoff: 0.01 }),
+  allowed = client({ maxRetries: 2, backoff: 0.01, retryNonIdempotent: true }),
+  capped = client({ maxRetries: 4, backoff: 0.05, maxBackoff: 0.1 }),
+
+  request = (layout, method, path) => layout.spawn(new Message({ method, path })),
+
+  step = (title, f) => () => (
+    log.push(title),
+    f()
+  ),
+
+  sequence = fs => () => fs.reduce((p, f) => p.then(f), Promise.resolve()),
+
+  report = path => () => log.push(`  attempts ${path}: ${attempts[path] || 0}`),
+
+  started = 0,
+
+  steps = [
+    step('retried up to maxRetries', sequence([
+      () => request(fast, 'GET', '/down'),
+      report('/down'),
+    ])),
+    step('retried until success', sequence([
+      () => request(fast, 'GET', '/flaky'),
+      report('/flaky'),
+    ])),
+    step('non-idempotent not retried', sequence([
+      () => request(fast, 'POST', '/post'),
+      report('/post'),
+    ])),
+    step('non-idempotent retried with retryNonIdempotent', sequence([
+      () => request(allowed, 'POST', '/post-allowed'),
+      report('/post-allowed'),
+    ])),
+    step('backoff capped by maxBackoff', sequence([
+      () => (started = Date.now()),
+      () => request(capped, 'GET', '/capped'),
+      report('/capped'),
+      () => log.push(`  within backoff + 3 x maxBackoff: ${Date.now() - started < 350}`),
+    ])),
+  ],
+
+) => pipy.read('input', $=>$
+  .replaceData(() => new Data)
+  .replaceStreamEnd(
+    () => sequence(steps)().then(
+      () => [new Data(log.join('\n') + '\n'), new StreamEnd]
+    )
+  )
+  .tee('-')
+))()
@@ -0,0 +1,57 @@
+((
+  legacy = new algo.URLRouter({
+    '/': 'root',
+    '/api/*': 'api/*',
+    '/api/users': 'api/users',
+    '/files/:name': 'files/:name',
+    '/a/*/b': 'a/*/b',
+    '*/star': '*/star',
+    'www.example.com/home': 'www/home',
+    '*.example.com/*': '*.example/*',
+  }),
+
+  params = new algo.URLRouter({
+    '/users/me': 'users/me',
+    '/users/:id': 'users/:id',
+    '/users/:id/posts/:post': 'users/:id/posts/:post',
+    '/static/*': 'static/*',
+    '*/any': '*/any',
+    'www.example.com/home': 'www/home',
+    '*.example.com/wild': '*.example/wild',
+  }, { params: true }),
+
+  add = (router, url) => {
+    try {
+      router.add(url, url);
+      return 'ok';
+    } catch (e) {
+      return e.message;
+    }
+  },
+
+  patterns = [
+    '/x/*/y',
+    '/x/:',
+    'a*b.com/',
+    'host:80/',
+  ],
+
+  input = new Data,
+
+) => pipy.read('input', $=>$
+  .replaceData(data => (input.push(data), new Data))
+  .replaceStreamEnd(
+    () => [
+      new Data(
+        patterns.map(
+          p => `add ${p}: legacy ${add(new algo.URLRouter, p)}, params ${add(new algo.URLRouter({}, { params: true }), p)}\n`
+        ).join('') +
+        input.toString().split('\n').filter(l => l).map(
+          url => `${url}\n  legacy ${JSON.stringify(legacy.match(url))}\n  params ${JSON.stringify(params.match(url))}\n`
+        ).join('')
+      ),
+      new StreamEnd,
+    ]
+  )
+  .tee('-')
+))()
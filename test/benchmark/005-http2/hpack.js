@@ -0,0 +1,89 @@
+//
+// Measures HPACK decoding of browser-like request heads.
+// Requests go through muxHTTP into demuxHTTP in the same process,
+// with values that differ per request so that most strings arrive
+// Huffman coded rather than as dynamic table references:
+//
+//   REQUESTS=100000 pipy hpack.js
+//
+
+((
+  REQUESTS = (os.env.REQUESTS|0) || 100000,
+
+  corpus = [
+    {
+      'user-agent': 'Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36',
+      'accept': 'text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7',
+      'accept-encoding': 'gzip, deflate, br',
+      'accept-language': 'en-US,en;q=0.9',
+      'sec-ch-ua': '"Not_A Brand";v="8", "Chromium";v="120", "Google Chrome";v="120"',
+      'sec-ch-ua-mobile': '?0',
+      'sec-ch-ua-platform': '"Windows"',
+      'sec-fetch-dest': 'document',
+      'sec-fetch-mode': 'navigate',
+      'sec-fetch-site': 'none',
+      'upgrade-insecure-requests': '1',
+    },
+    {
+      'user-agent': 'Mozilla/5.0 (Macintosh; Intel Mac OS X 10.15; rv:121.0) Gecko/20100101 Firefox/121.0',
+      'accept': 'image/avif,image/webp,*/*',
+      'accept-encoding': 'gzip, deflate, br',
+      'accept-language': 'en-US,en;q=0.5',
+      'referer': 'https://www.example.com/articles/2023/12/http2-header-compression',
+      'sec-fetch-dest': 'image',
+      'sec-fetch-mode': 'no-cors',
+      'sec-fetch-site': 'same-origin',
+    },
+    {
+      'user-agent': 'Mozilla/5.0 (iPhone; CPU iPhone OS 17_2 like Mac OS X) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.2 Mobile/15E148 Safari/604.1',
+      'accept': 'application/json, text/plain, */*',
+      'accept-encoding': 'gzip, deflate, br',
+      'accept-language': 'en-GB,en;q=0.9',
+      'content-type': 'application/json',
+      'origin': 'https://app.example.com',
+      'referer': 'https://app.example.com/dashboard?tab=overview',
+    },
+  ],
+
+  requests = new Array(REQUESTS).fill().map(
+    (_, i) => new Message(
+      {
+        method: 'GET',
+        path: `/static/js/chunk-${i.toString(36)}.js?v=${(i * 7919).toString(16)}`,
+        authority: 'www.example.com',
+        headers: Object.assign(
+          {
+            'cookie': `_ga=GA1.2.${1000000000 + i}.1700000000; session=${(i * 2654435761 % 4294967296).toString(36)}`,
+            'x-request-id': `${(i * 40503).toString(16)}-${i.toString(16)}`,
+          },
+          corpus[i % corpus.length]
+        ),
+      }
+    )
+  ),
+
+  t0 = 0,
+  count = 0,
+
+) => (
+  t0 = pipy.now(),
+  pipeline($=>$
+    .demux().to($=>$
+      .muxHTTP({ version: 2 }).to($=>$
+        .demuxHTTP().to($=>$
+          .handleMessageStart(() => count++)
+          .replaceMessage(new Message({ status: 200 }))
+        )
+      )
+    )
+  ).process(
+    requests.concat([new StreamEnd])
+  ).then(
+    () => (
+      (t => console.log(`${count} request heads decoded in ${t.toFixed(1)} ms, ${(count / t * 1000).toFixed(0)} heads/s`))(
+        pipy.now() - t0
+      ),
+      pipy.exit()
+    )
+  )
+))()
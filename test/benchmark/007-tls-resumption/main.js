@@ -0,0 +1,26 @@
+//
+// Terminates TLS in front of the mock server.
+// The client opens a new connection for every request but resumes the
+// session from the last one, so each request costs an abbreviated handshake.
+//
+
+((
+  key = new crypto.PrivateKey({ type: 'rsa', bits: 2048 }),
+  cert = new crypto.Certificate({
+    subject: { CN: 'localhost' },
+    privateKey: key,
+    publicKey: new crypto.PublicKey(key),
+  }),
+
+) =>
+
+pipy()
+
+.listen(os.env.LISTEN || 8000)
+.acceptTLS({
+  certificate: { cert, key },
+}).to($=>$
+  .connect('localhost:8080')
+)
+
+)()
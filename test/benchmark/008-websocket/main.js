@@ -0,0 +1,43 @@
+//
+// Publishes every request as a WebSocket message to a number of
+// subscribers before proxying it to the mock server. Each subscriber is
+// one long-lived WebSocket stream per thread to a hub in this process,
+// where the frames are decoded and dropped.
+//
+//   SUBSCRIBERS=10 MESSAGE_SIZE=256 pipy main.js
+//
+
+((
+  port = (os.env.LISTEN || '8000').split(':').pop() | 0,
+  hub = `localhost:${port + 1000}`,
+  subscribers = new Array((os.env.SUBSCRIBERS|0) || 10).fill().map((_, i) => i),
+  payload = new Data(new Array((os.env.MESSAGE_SIZE|0) || 256).fill(0x30)),
+
+) =>
+
+pipy({
+  _subscriber: 0,
+})
+
+.listen(os.env.LISTEN || 8000)
+.demuxHTTP().to($=>$
+  .fork(subscribers).to($=>$
+    .onStart(i => void (_subscriber = i))
+    .replaceMessage(
+      new Message({ opcode: 2 }, payload)
+    )
+    .mux(() => _subscriber).to($=>$
+      .encodeWebSocket()
+      .connect(hub)
+    )
+  )
+  .muxHTTP().to($=>$
+    .connect('localhost:8080')
+  )
+)
+
+.listen(port + 1000)
+.decodeWebSocket()
+.dummy()
+
+)()
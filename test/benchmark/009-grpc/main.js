@@ -0,0 +1,76 @@
+//
+// Turns every request into a client-streaming gRPC call over HTTP/2
+// through muxHTTP to an echo service in this process, which streams the
+// same number of messages back. One HTTP/2 connection per thread
+// carries all calls as concurrent streams.
+//
+//   MESSAGES=8 MESSAGE_SIZE=256 pipy main.js
+//
+
+((
+  port = (os.env.LISTEN || '8000').split(':').pop() | 0,
+  count = (os.env.MESSAGES|0) || 8,
+  payload = new Data(new Array((os.env.MESSAGE_SIZE|0) || 256).fill(0x30)),
+
+  call = new Array(count).fill().map(
+    (_, i) => new Message(
+      i === 0 ? {
+        head: {
+          method: 'POST',
+          path: '/bench.Echo/Stream',
+          headers: {
+            'content-type': 'application/grpc',
+            'te': 'trailers',
+          },
+        },
+      } : {},
+      payload,
+      i === count - 1 ? { end: true } : null,
+    )
+  ),
+
+  replyHead = {
+    head: {
+      status: 200,
+      headers: {
+        'content-type': 'application/grpc',
+      },
+    },
+  },
+
+  replyTail = {
+    end: true,
+    trailers: {
+      'grpc-status': '0',
+    },
+  },
+
+) =>
+
+pipy()
+
+.listen(os.env.LISTEN || 8000)
+.demuxHTTP().to($=>$
+  .replaceMessage(call)
+  .encodeGRPC()
+  .muxHTTP(() => 1, { version: 2 }).to($=>$
+    .connect(`localhost:${port + 1000}`)
+  )
+  .decodeGRPC()
+  .replaceMessage(
+    msg => msg.tail?.end ? new Message('hello') : []
+  )
+)
+
+.listen(port + 1000)
+.demuxHTTP().to($=>$
+  .decodeGRPC()
+  .replaceMessage(
+    msg => new Message(
+      replyHead, msg.body, msg.tail?.end ? replyTail : null
+    )
+  )
+  .encodeGRPC()
+)
+
+)()
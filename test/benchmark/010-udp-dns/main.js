@@ -0,0 +1,10 @@
+//
+// Proxies DNS queries over UDP to the mock server.
+// Every query comes from a new client port, as from a stub resolver,
+// so each one has its own inbound and outbound UDP flow.
+//
+
+pipy()
+
+.listen(os.env.LISTEN || 8000, { protocol: 'udp', idleTimeout: 1 })
+.connect('localhost:8053', { protocol: 'udp', idleTimeout: 1 })
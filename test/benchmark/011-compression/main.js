@@ -0,0 +1,36 @@
+//
+// Serves a JSON document of some size gzipped on every request,
+// compressed anew each time as a dynamic response would be.
+//
+//   RECORDS=100 pipy main.js
+//
+
+((
+  body = JSON.encode(
+    new Array((os.env.RECORDS|0) || 100).fill().map(
+      (_, i) => ({
+        id: i,
+        name: `item-${i}`,
+        price: (i * 7919 % 10007) / 100,
+        tags: [ 'a', 'b', 'c' ].map(t => t + (i % 13)),
+        updated: new Date(1700000000000 + i * 3600000).toISOString(),
+      })
+    )
+  ),
+
+) =>
+
+pipy()
+
+.listen(os.env.LISTEN || 8000)
+.demuxHTTP().to($=>$
+  .replaceMessage(
+    () => new Message(
+      { headers: { 'content-type': 'application/json' } },
+      body
+    )
+  )
+  .compressHTTP('gzip')
+)
+
+)()
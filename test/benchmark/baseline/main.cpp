@@ -5,6 +5,12 @@
 #define ASIO_STANDALONE
 #include <asio.hpp>
 
+#if BASELINE_TLS
+#include <asio/ssl.hpp>
+#endif
+
+#include <map>
+
 #define CONFIG_DATA_CHUNK_SIZE  16*1024
 #define CONFIG_TCP_NO_DELAY     1
 #define CONFIG_RECV_EXTRA_READ  0
@@ -12,8 +18,16 @@
 #define CONFIG_CUSTOM_ALLOCATOR 1
 
 using tcp = asio::ip::tcp;
+using udp = asio::ip::udp;
+
+enum class Mode {
+  TCP,
+  TLS,
+  UDP,
+};
 
 asio::io_service g_io_service;
+Mode g_mode = Mode::TCP;
 std::string g_listen_port("8000");
 std::string g_target_port("8080");
 std::string g_target_addr("127.0.0.1");
@@ -459,13 +473,292 @@ struct Session {
   }
 };
 
+#if BASELINE_TLS
+
+//
+// TLSSession
+//
+// Terminates TLS on the downstream side and relays the plaintext to the
+// target, one buffer at a time in each direction
+//
+
+struct TLSSession {
+  asio::ssl::stream<tcp::socket> socket_d;
+  tcp::socket socket_u;
+  tcp::resolver resolver;
+  int retain_count = 0;
+
+  TLSSession(asio::ssl::context &ctx)
+    : socket_d(g_io_service, ctx)
+    , socket_u(g_io_service)
+    , resolver(g_io_service) {}
+
+  void retain() {
+    retain_count++;
+  }
+
+  void release() {
+    if (!--retain_count) {
+      delete this;
+    }
+  }
+
+  void accept(tcp::acceptor &acceptor, std::function<void()> cb) {
+    acceptor.async_accept(socket_d.lowest_layer(), [=](const std::error_code &ec) {
+      if (ec) {
+        std::cerr << "async_accept error: " << ec.message() << std::endl;
+      } else {
+        socket_d.lowest_layer().set_option(tcp::no_delay(CONFIG_TCP_NO_DELAY));
+        handshake();
+      }
+      cb();
+      release();
+    });
+    retain();
+  }
+
+  void handshake() {
+    socket_d.async_handshake(asio::ssl::stream_base::server, [this](const std::error_code &ec) {
+      if (ec) {
+        std::cerr << "async_handshake error: " << ec.message() << std::endl;
+        close();
+      } else {
+        resolve();
+      }
+      release();
+    });
+    retain();
+  }
+
+  void resolve() {
+    resolver.async_resolve(
+      tcp::resolver::query(g_target_addr, g_target_port),
+      [this](
+        const std::error_code &ec,
+        tcp::resolver::results_type result
+      ) {
+        if (ec) {
+          std::cerr << "async_resolve error: " << ec.message() << std::endl;
+          close();
+        } else {
+          connect(*result);
+        }
+        release();
+      }
+    );
+    retain();
+  }
+
+  void connect(const tcp::endpoint &peer) {
+    socket_u.async_connect(peer, [this](const std::error_code &ec) {
+      if (ec) {
+        std::cerr << "async_connect error: " << ec.message() << std::endl;
+        close();
+      } else {
+        socket_u.set_option(tcp::no_delay(CONFIG_TCP_NO_DELAY));
+        relay(socket_d, socket_u, Buffer::alloc());
+        relay(socket_u, socket_d, Buffer::alloc());
+      }
+      release();
+    });
+    retain();
+  }
+
+  template<class From, class To>
+  void relay(From &from, To &to, Buffer *buf) {
+    from.async_read_some(
+      asio::buffer(buf->data, sizeof(buf->data)),
+      [=, &from, &to](const std::error_code &ec, size_t n) {
+        if (ec) {
+          Buffer::free(buf);
+          close();
+        } else {
+          asio::async_write(to,
+            asio::buffer(buf->data, n),
+            [=, &from, &to](const std::error_code &ec, size_t) {
+              if (ec) {
+                Buffer::free(buf);
+                close();
+              } else {
+                relay(from, to, buf);
+              }
+              release();
+            }
+          );
+          retain();
+        }
+        release();
+      }
+    );
+    retain();
+  }
+
+  void close() {
+    asio::error_code ec;
+    socket_d.lowest_layer().close(ec);
+    socket_u.close(ec);
+  }
+};
+
+//
+// init_tls_context()
+//
+// Uses a self-signed certificate made up on startup. Sessions are cached
+// by OpenSSL on the server side so that clients can resume them.
+//
+
+void init_tls_context(asio::ssl::context &ctx) {
+  EVP_PKEY *pkey = nullptr;
+  auto kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr);
+  EVP_PKEY_keygen_init(kctx);
+  EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, 2048);
+  EVP_PKEY_keygen(kctx, &pkey);
+  EVP_PKEY_CTX_free(kctx);
+
+  auto x509 = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+  X509_gmtime_adj(X509_getm_notAfter(x509), 365 * 24 * 60 * 60);
+  X509_set_pubkey(x509, pkey);
+  auto name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+  X509_set_issuer_name(x509, name);
+  X509_sign(x509, pkey, EVP_sha256());
+
+  auto ssl_ctx = ctx.native_handle();
+  static const unsigned char sid_ctx[] = "baseline";
+  SSL_CTX_use_certificate(ssl_ctx, x509);
+  SSL_CTX_use_PrivateKey(ssl_ctx, pkey);
+  SSL_CTX_set_session_id_context(ssl_ctx, sid_ctx, sizeof(sid_ctx) - 1);
+  SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
+
+  X509_free(x509);
+  EVP_PKEY_free(pkey);
+}
+
+#endif // BASELINE_TLS
+
+//
+// UDPRelay
+//
+// Relays datagrams to the target over a socket of their own for each
+// client address, which is closed after a second without traffic
+//
+
+struct UDPRelay {
+  struct Flow {
+    udp::socket socket;
+    udp::endpoint peer;
+    Buffer* buffer;
+    std::chrono::steady_clock::time_point last_active;
+
+    Flow(const udp::endpoint &p)
+      : socket(g_io_service)
+      , peer(p)
+      , buffer(Buffer::alloc())
+      , last_active(std::chrono::steady_clock::now()) {}
+
+    ~Flow() {
+      Buffer::free(buffer);
+    }
+  };
+
+  udp::socket socket;
+  udp::endpoint target;
+  udp::endpoint sender;
+  asio::steady_timer timer;
+  std::map<udp::endpoint, Flow*> flows;
+
+  UDPRelay(const udp::endpoint &local, const udp::endpoint &target)
+    : socket(g_io_service, local)
+    , target(target)
+    , timer(g_io_service) {}
+
+  void start() {
+    receive();
+    sweep();
+  }
+
+  void receive() {
+    auto buf = Buffer::alloc();
+    socket.async_receive_from(
+      asio::buffer(buf->data, sizeof(buf->data)), sender,
+      [=](const std::error_code &ec, size_t n) {
+        if (ec) {
+          std::cerr << "async_receive_from error: " << ec.message() << std::endl;
+          Buffer::free(buf);
+        } else {
+          auto flow = get_flow(sender);
+          flow->last_active = std::chrono::steady_clock::now();
+          flow->socket.async_send(
+            asio::buffer(buf->data, n),
+            [=](const std::error_code &ec, size_t) {
+              Buffer::free(buf);
+            }
+          );
+        }
+        receive();
+      }
+    );
+  }
+
+  auto get_flow(const udp::endpoint &peer) -> Flow* {
+    auto i = flows.find(peer);
+    if (i != flows.end()) return i->second;
+    auto flow = new Flow(peer);
+    flow->socket.open(target.protocol());
+    flow->socket.connect(target);
+    flows[peer] = flow;
+    reply(flow);
+    return flow;
+  }
+
+  void reply(Flow *flow) {
+    flow->socket.async_receive(
+      asio::buffer(flow->buffer->data, sizeof(flow->buffer->data)),
+      [=](const std::error_code &ec, size_t n) {
+        if (ec) {
+          if (ec != asio::error::operation_aborted) {
+            std::cerr << "async_receive error: " << ec.message() << std::endl;
+          }
+          delete flow;
+        } else {
+          flow->last_active = std::chrono::steady_clock::now();
+          asio::error_code ec;
+          socket.send_to(asio::buffer(flow->buffer->data, n), flow->peer, 0, ec);
+          reply(flow);
+        }
+      }
+    );
+  }
+
+  void sweep() {
+    timer.expires_after(std::chrono::seconds(1));
+    timer.async_wait([this](const std::error_code &ec) {
+      if (ec) return;
+      auto now = std::chrono::steady_clock::now();
+      for (auto i = flows.begin(); i != flows.end(); ) {
+        auto flow = i->second;
+        if (now - flow->last_active >= std::chrono::seconds(1)) {
+          asio::error_code ec;
+          flow->socket.close(ec);
+          i = flows.erase(i);
+        } else {
+          i++;
+        }
+      }
+      sweep();
+    });
+  }
+};
+
 //
 // show_error()
 //
 
 void show_error(const char *msg) {
   std::cerr << "ERROR: " << msg << std::endl;
-  std::cerr << "Usage: baseline [<listen port> [<target port> [<target address>]]]" << std::endl;
+  std::cerr << "Usage: baseline [--tls | --udp] [<listen port> [<target port> [<target address>]]]" << std::endl;
 }
 
 //
@@ -473,6 +766,22 @@ void show_error(const char *msg) {
 //
 
 bool parse_args(int argc, char *argv[]) {
+  if (argc > 1 && argv[1][0] == '-') {
+    std::string mode(argv[1]);
+    if (mode == "--udp") {
+      g_mode = Mode::UDP;
+#if BASELINE_TLS
+    } else if (mode == "--tls") {
+      g_mode = Mode::TLS;
+#endif
+    } else {
+      show_error("unknown option");
+      return false;
+    }
+    argc--;
+    argv++;
+  }
+
   if (argc > 1) {
     auto port = std::atoi(argv[1]);
     if (port <= 0 || port > 65535) {
@@ -505,6 +814,20 @@ bool parse_args(int argc, char *argv[]) {
 int main(int argc, char *argv[]) {
   if (!parse_args(argc, argv)) return -1;
 
+  if (g_mode == Mode::UDP) {
+    udp::resolver resolver(g_io_service);
+    udp::endpoint local = *resolver.resolve(udp::resolver::query("0.0.0.0", g_listen_port));
+    udp::endpoint target = *resolver.resolve(udp::resolver::query(g_target_addr, g_target_port));
+    UDPRelay relay(local, target);
+    relay.start();
+
+    std::cout << "Listening on port " << g_listen_port << " (UDP)" << std::endl;
+    std::cout << "Relaying to " << g_target_addr << ':' << g_target_port << std::endl;
+
+    g_io_service.run();
+    return 0;
+  }
+
   tcp::resolver resolver(g_io_service);
   tcp::resolver::query query("0.0.0.0", g_listen_port);
   tcp::endpoint endpoint = *resolver.resolve(query);
@@ -515,8 +838,22 @@ int main(int argc, char *argv[]) {
   acceptor.bind(endpoint);
   acceptor.listen(asio::socket_base::max_connections);
 
+#if BASELINE_TLS
+  asio::ssl::context tls_context(asio::ssl::context::tls_server);
+  if (g_mode == Mode::TLS) init_tls_context(tls_context);
+#endif
+
   std::function<void()> accept;
   accept = [&]() {
+#if BASELINE_TLS
+    if (g_mode == Mode::TLS) {
+      auto session = new TLSSession(tls_context);
+      session->accept(acceptor, [&]() {
+        accept();
+      });
+      return;
+    }
+#endif
     auto session = new Session();
     session->accept(acceptor, [&]() {
       accept();
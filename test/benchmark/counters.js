@@ -0,0 +1,144 @@
+//
+// Per-process counters for benchmark runs and baseline checking.
+//
+// CPU time, RSS and context switches are read from /proc, and hardware
+// counters are taken with 'perf stat' attached to the process, so both
+// are only available on Linux. Anything that cannot be measured is left
+// out of the results rather than reported as zero.
+//
+
+import fs from 'fs';
+import { spawn } from 'child_process';
+
+const clockTicks = 100;
+
+// Direction of each metric, higher is better only for throughput
+export const metrics = {
+  throughput: { unit: 'req/s', higherIsBetter: true },
+  cpuPerRequest: { unit: 'us' },
+  rss: { unit: 'KB' },
+  contextSwitchesPerRequest: { unit: '' },
+  instructionsPerRequest: { unit: '' },
+  cacheMissesPerRequest: { unit: '' },
+};
+
+function readProc(path) {
+  try {
+    return fs.readFileSync(path, 'utf8');
+  } catch (e) {
+    return null;
+  }
+}
+
+//
+// Snapshot of CPU time in microseconds, RSS in KB and
+// context switches summed over all threads of a process
+//
+
+export function snapshot(pid) {
+  const stat = readProc(`/proc/${pid}/stat`);
+  if (!stat) return null;
+
+  // Fields after the command name, which may contain spaces
+  const fields = stat.substring(stat.lastIndexOf(')') + 2).split(' ');
+  const cpu = ((fields[11]|0) + (fields[12]|0)) * 1000000 / clockTicks;
+
+  const status = readProc(`/proc/${pid}/status`) || '';
+  const rss = /^VmRSS:\s+([0-9]+)/m.exec(status)?.[1] | 0;
+
+  let contextSwitches = 0;
+  try {
+    for (const tid of fs.readdirSync(`/proc/${pid}/task`)) {
+      const s = readProc(`/proc/${pid}/task/${tid}/status`) || '';
+      contextSwitches += (/^voluntary_ctxt_switches:\s+([0-9]+)/m.exec(s)?.[1] | 0);
+      contextSwitches += (/^nonvoluntary_ctxt_switches:\s+([0-9]+)/m.exec(s)?.[1] | 0);
+    }
+  } catch (e) {}
+
+  return { cpu, rss, contextSwitches };
+}
+
+//
+// Counts hardware events of a process for the given number of seconds,
+// resolving to null when perf is missing or not permitted
+//
+
+export function perf(pid, seconds) {
+  return new Promise(resolve => {
+    let output = '';
+    let proc;
+    try {
+      proc = spawn('perf', [
+        'stat', '-x', ',',
+        '-e', 'instructions,cache-misses,context-switches',
+        '-p', pid.toString(),
+        '--', 'sleep', seconds.toString(),
+      ]);
+    } catch (e) {
+      return resolve(null);
+    }
+    proc.on('error', () => resolve(null));
+    proc.stderr.on('data', data => output += data.toString());
+    proc.on('exit', code => {
+      if (code !== 0) return resolve(null);
+      const counts = {};
+      for (const line of output.split('\n')) {
+        const [value, , event] = line.split(',');
+        const n = parseInt(value);
+        if (!isNaN(n) && event) counts[event.split(':')[0]] = n;
+      }
+      resolve(counts);
+    });
+  });
+}
+
+//
+// Turns counters over a measuring period into per-request metrics
+//
+
+export function summarize(requests, seconds, before, after, hw) {
+  const result = { throughput: requests / seconds };
+  if (requests > 0 && before && after) {
+    result.cpuPerRequest = (after.cpu - before.cpu) / requests;
+    result.rss = after.rss;
+    result.contextSwitchesPerRequest = (after.contextSwitches - before.contextSwitches) / requests;
+  }
+  if (requests > 0 && hw) {
+    if ('instructions' in hw) result.instructionsPerRequest = hw['instructions'] / requests;
+    if ('cache-misses' in hw) result.cacheMissesPerRequest = hw['cache-misses'] / requests;
+  }
+  return result;
+}
+
+//
+// Compares results against a baseline file, returning a list of
+// regressions beyond the tolerance given in percent
+//
+
+export function check(results, filename, tolerance) {
+  const baseline = JSON.parse(fs.readFileSync(filename, 'utf8'));
+  const regressions = [];
+  for (const name in results) {
+    const base = baseline[name];
+    if (!base) continue;
+    for (const k in metrics) {
+      const a = base[k];
+      const b = results[name][k];
+      if (typeof a !== 'number' || typeof b !== 'number' || a <= 0) continue;
+      const change = (b - a) / a * 100;
+      const worse = metrics[k].higherIsBetter ? -change : change;
+      if (worse > tolerance) {
+        regressions.push({ name, metric: k, baseline: a, current: b, change });
+      }
+    }
+  }
+  return regressions;
+}
+
+export function save(results, filename) {
+  fs.writeFileSync(filename, JSON.stringify(results, null, 2) + '\n');
+}
+
+export function format(k, v) {
+  return (v >= 100 ? v.toFixed(0) : v.toFixed(2)) + (metrics[k].unit ? ' ' + metrics[k].unit : '');
+}
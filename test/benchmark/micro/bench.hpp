@@ -0,0 +1,110 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+namespace bench {
+
+//
+// State
+//
+// Passed to a benchmark function, which runs the code to measure in a
+// loop of while (state.run()) { ... }. Setup before the loop and
+// teardown after it are not timed.
+//
+
+class State {
+public:
+  State(uint64_t iterations) : m_iterations(iterations) {}
+
+  bool run() {
+    if (m_count == 0) {
+      m_cpu_start = std::clock();
+      m_start = std::chrono::steady_clock::now();
+    }
+    if (m_count++ < m_iterations) return true;
+    m_end = std::chrono::steady_clock::now();
+    m_cpu_end = std::clock();
+    return false;
+  }
+
+  // Amount of work done by one iteration, for throughput figures
+  void set_bytes(size_t n) { m_bytes = n; }
+  void set_items(size_t n) { m_items = n; }
+
+  auto iterations() const -> uint64_t { return m_iterations; }
+  auto bytes() const -> size_t { return m_bytes; }
+  auto items() const -> size_t { return m_items; }
+
+  auto real_time() const -> double {
+    return std::chrono::duration<double>(m_end - m_start).count();
+  }
+
+  auto cpu_time() const -> double {
+    return double(m_cpu_end - m_cpu_start) / CLOCKS_PER_SEC;
+  }
+
+private:
+  uint64_t m_iterations;
+  uint64_t m_count = 0;
+  size_t m_bytes = 0;
+  size_t m_items = 0;
+  std::chrono::steady_clock::time_point m_start, m_end;
+  std::clock_t m_cpu_start = 0, m_cpu_end = 0;
+};
+
+typedef void (*Function)(State &state);
+
+//
+// Registration
+//
+
+struct Registration {
+  Registration(const char *name, Function f);
+};
+
+// Keeps the compiler from optimizing away a computed value
+template<class T>
+inline void keep(const T &value) {
+#ifdef _MSC_VER
+  static const volatile void *s_sink;
+  s_sink = &value;
+#else
+  asm volatile("" : : "m"(value) : "memory");
+#endif
+}
+
+} // namespace bench
+
+#define BENCHMARK(f) static bench::Registration s_bench_registration_##f(#f, f)
+
+#endif // BENCH_HPP
@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "bench.hpp"
+#include "data.hpp"
+
+#include <cstring>
+
+using namespace pipy;
+
+static Data::Producer s_dp("pipy-bench");
+
+static void data_push_small(bench::State &state) {
+  char buf[64];
+  std::memset(buf, 'x', sizeof(buf));
+  while (state.run()) {
+    Data data;
+    for (int i = 0; i < 1024; i++) s_dp.push(&data, buf, sizeof(buf));
+    bench::keep(data.size());
+  }
+  state.set_bytes(1024 * sizeof(buf));
+}
+
+BENCHMARK(data_push_small);
+
+static void data_push_shared(bench::State &state) {
+  Data piece(16 * 1024, 'x', &s_dp);
+  while (state.run()) {
+    Data data;
+    for (int i = 0; i < 64; i++) data.push(piece);
+    bench::keep(data.size());
+  }
+  state.set_bytes(64 * piece.size());
+}
+
+BENCHMARK(data_push_shared);
+
+static void data_shift_bytes(bench::State &state) {
+  Data source(64 * 1024, 'x', &s_dp);
+  uint8_t buf[16];
+  while (state.run()) {
+    Data data(source);
+    while (!data.empty()) data.shift(sizeof(buf), buf);
+    bench::keep(buf[0]);
+  }
+  state.set_bytes(source.size());
+}
+
+BENCHMARK(data_shift_bytes);
+
+static void data_shift_data(bench::State &state) {
+  Data source(64 * 1024, 'x', &s_dp);
+  while (state.run()) {
+    Data data(source);
+    while (!data.empty()) {
+      Data out;
+      data.shift(100, out);
+      bench::keep(out.size());
+    }
+  }
+  state.set_bytes(source.size());
+}
+
+BENCHMARK(data_shift_data);
+
+static void data_shift_to_byte(bench::State &state) {
+  std::string line(98, 'x');
+  line += "\r\n";
+  Data source;
+  for (int i = 0; i < 640; i++) s_dp.push(&source, line);
+  while (state.run()) {
+    Data data(source);
+    while (!data.empty()) {
+      Data out;
+      data.shift_to(uint8_t('\n'), out);
+      bench::keep(out.size());
+    }
+  }
+  state.set_bytes(source.size());
+}
+
+BENCHMARK(data_shift_to_byte);
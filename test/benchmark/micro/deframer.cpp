@@ -0,0 +1,91 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "bench.hpp"
+#include "deframer.hpp"
+
+using namespace pipy;
+
+static Data::Producer s_dp("pipy-bench");
+
+//
+// Frames of a 4-byte header that holds the payload length,
+// the way most binary codecs in the tree are read
+//
+
+class LengthDeframer : public Deframer {
+public:
+  LengthDeframer() { Deframer::reset(HEADER); }
+  auto count() const -> int { return m_count; }
+
+private:
+  enum State { HEADER, HEADER_REST, PAYLOAD };
+
+  uint8_t m_header[4];
+  pjs::Ref<Data> m_payload;
+  int m_count = 0;
+
+  virtual auto on_state(int state, int c) -> int override {
+    switch (state) {
+      case HEADER:
+        m_header[0] = c;
+        Deframer::read(3, m_header + 1);
+        return HEADER_REST;
+      case HEADER_REST: {
+        auto size = (
+          ((int)m_header[0] << 24) |
+          ((int)m_header[1] << 16) |
+          ((int)m_header[2] <<  8) |
+          ((int)m_header[3] <<  0)
+        );
+        m_payload = Data::make();
+        Deframer::read(size, m_payload.get());
+        return PAYLOAD;
+      }
+      case PAYLOAD:
+        m_count++;
+        m_payload = nullptr;
+        return HEADER;
+    }
+    return -1;
+  }
+};
+
+static void deframe_small_frames(bench::State &state) {
+  uint8_t frame[4 + 100] = { 0, 0, 0, 100 };
+  Data input;
+  for (int i = 0; i < 1000; i++) s_dp.push(&input, frame, sizeof(frame));
+  while (state.run()) {
+    LengthDeframer deframer;
+    Data data(input);
+    deframer.deframe(data);
+    bench::keep(deframer.count());
+  }
+  state.set_bytes(input.size());
+  state.set_items(1000);
+}
+
+BENCHMARK(deframe_small_frames);
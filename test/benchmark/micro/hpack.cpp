@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "bench.hpp"
+#include "api/http.hpp"
+#include "filters/http2.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace pipy;
+
+//
+// Header blocks are encoded without the dynamic table so that each one
+// can be decoded on its own, leaving most strings Huffman coded
+//
+
+static auto make_request(int i) -> http::RequestHead* {
+  auto head = http::RequestHead::make();
+  head->method = pjs::Str::make("GET");
+  head->scheme = pjs::Str::make("https");
+  head->authority = pjs::Str::make("www.example.com");
+  head->path = pjs::Str::make("/static/js/chunk-" + std::to_string(i) + ".js");
+  auto headers = pjs::Object::make();
+  headers->set("user-agent", pjs::Str::make("Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36"));
+  headers->set("accept", pjs::Str::make("text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8"));
+  headers->set("accept-encoding", pjs::Str::make("gzip, deflate, br"));
+  headers->set("accept-language", pjs::Str::make("en-US,en;q=0.9"));
+  headers->set("cookie", pjs::Str::make("session=" + std::to_string(i * 2654435761u)));
+  head->headers(headers);
+  return head;
+}
+
+static void hpack_encode(bench::State &state) {
+  std::vector<pjs::Ref<http::RequestHead>> heads;
+  for (int i = 0; i < 100; i++) heads.push_back(make_request(i));
+  http2::HeaderEncoder encoder;
+  while (state.run()) {
+    for (const auto &head : heads) {
+      Data data;
+      encoder.encode(false, false, head, data, false);
+      bench::keep(data.size());
+    }
+  }
+  state.set_items(heads.size());
+}
+
+BENCHMARK(hpack_encode);
+
+static void hpack_decode(bench::State &state) {
+  std::vector<Data> blocks;
+  http2::HeaderEncoder encoder;
+  size_t size = 0;
+  for (int i = 0; i < 100; i++) {
+    pjs::Ref<http::RequestHead> head(make_request(i));
+    blocks.emplace_back();
+    encoder.encode(false, false, head, blocks.back(), false);
+    size += blocks.back().size();
+  }
+  http2::Settings settings;
+  http2::HeaderDecoder decoder(settings);
+  while (state.run()) {
+    for (const auto &block : blocks) {
+      Data data(block);
+      pjs::Ref<http::MessageHead> head;
+      decoder.start(false, false);
+      decoder.decode(data);
+      decoder.end(head);
+      bench::keep(head.get());
+    }
+  }
+  state.set_bytes(size);
+  state.set_items(blocks.size());
+}
+
+BENCHMARK(hpack_decode);
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "bench.hpp"
+#include "input.hpp"
+#include "filters/http.hpp"
+
+#include <string>
+
+using namespace pipy;
+
+static Data::Producer s_dp("pipy-bench");
+
+//
+// Counts messages coming out of a decoder
+//
+
+class MessageCounter : public EventTarget {
+public:
+  auto count() const -> int { return m_count; }
+private:
+  int m_count = 0;
+  virtual void on_event(Event *evt) override {
+    if (evt->is<MessageStart>()) m_count++;
+  }
+};
+
+class RequestDecoder : public http::Decoder {
+public:
+  RequestDecoder() : http::Decoder(false) {}
+};
+
+static auto request_head(int i) -> std::string {
+  return (
+    "GET /static/js/chunk-" + std::to_string(i) + ".js HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Cookie: session=" + std::to_string(i * 2654435761u) + "\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+  );
+}
+
+static void http_decode_requests(bench::State &state) {
+  Data input;
+  for (int i = 0; i < 100; i++) s_dp.push(&input, request_head(i));
+  MessageCounter counter;
+  while (state.run()) {
+    InputContext ic;
+    RequestDecoder decoder;
+    decoder.chain(counter.input());
+    decoder.input()->input(Data::make(input));
+  }
+  bench::keep(counter.count());
+  state.set_bytes(input.size());
+  state.set_items(100);
+}
+
+BENCHMARK(http_decode_requests);
+
+static void http_decode_chunked_body(bench::State &state) {
+  Data input;
+  s_dp.push(&input, std::string("POST /upload HTTP/1.1\r\nHost: www.example.com\r\nTransfer-Encoding: chunked\r\n\r\n"));
+  std::string chunk(1000, 'x');
+  for (int i = 0; i < 64; i++) s_dp.push(&input, "3e8\r\n" + chunk + "\r\n");
+  s_dp.push(&input, std::string("0\r\n\r\n"));
+  MessageCounter counter;
+  while (state.run()) {
+    InputContext ic;
+    RequestDecoder decoder;
+    decoder.chain(counter.input());
+    decoder.input()->input(Data::make(input));
+  }
+  bench::keep(counter.count());
+  state.set_bytes(input.size());
+}
+
+BENCHMARK(http_decode_chunked_body);
@@ -0,0 +1,224 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+//
+// pipy-bench
+//
+// Microbenchmarks for the data structures and codecs on the hot path.
+// Each benchmark is run with a growing iteration count until one run
+// takes at least --min-time seconds, and the median of --repetitions
+// such runs is reported. With --format=json, the output follows the
+// layout of Google Benchmark so that existing tooling can consume it:
+//
+//   pipy-bench [--filter=<regex>] [--min-time=<seconds>]
+//              [--repetitions=<n>] [--format=console|json]
+//
+
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bench {
+
+struct Benchmark {
+  const char *name;
+  Function f;
+};
+
+struct Result {
+  const char *name;
+  uint64_t iterations;
+  double real_time; // ns per iteration
+  double cpu_time; // ns per iteration
+  double bytes_per_second;
+  double items_per_second;
+};
+
+static auto benchmarks() -> std::vector<Benchmark>& {
+  static std::vector<Benchmark> s_benchmarks;
+  return s_benchmarks;
+}
+
+Registration::Registration(const char *name, Function f) {
+  benchmarks().push_back({ name, f });
+}
+
+static auto run_once(const Benchmark &b, uint64_t iterations) -> State {
+  State state(iterations);
+  b.f(state);
+  return state;
+}
+
+static auto measure(const Benchmark &b, double min_time) -> Result {
+  uint64_t n = 1;
+  for (;;) {
+    auto state = run_once(b, n);
+    auto t = state.real_time();
+    if (t >= min_time || n >= 1000000000) {
+      Result r;
+      r.name = b.name;
+      r.iterations = n;
+      r.real_time = t * 1e9 / n;
+      r.cpu_time = state.cpu_time() * 1e9 / n;
+      r.bytes_per_second = t > 0 ? state.bytes() * n / t : 0;
+      r.items_per_second = t > 0 ? state.items() * n / t : 0;
+      return r;
+    }
+    auto scale = t > 0 ? min_time * 1.4 / t : 10;
+    n = uint64_t(n * std::min(std::max(scale, 1.1), 10.0)) + 1;
+  }
+}
+
+static void print_console(const std::vector<Result> &results) {
+  std::printf("%-36s %14s %14s %12s %14s\n", "Benchmark", "Time (ns)", "CPU (ns)", "Iterations", "Throughput");
+  std::printf("%s\n", std::string(94, '-').c_str());
+  for (const auto &r : results) {
+    char throughput[32] = "";
+    if (r.bytes_per_second > 0) {
+      std::snprintf(throughput, sizeof(throughput), "%.1f MB/s", r.bytes_per_second / (1 << 20));
+    } else if (r.items_per_second > 0) {
+      std::snprintf(throughput, sizeof(throughput), "%.2f M/s", r.items_per_second / 1e6);
+    }
+    std::printf(
+      "%-36s %14.1f %14.1f %12llu %14s\n",
+      r.name, r.real_time, r.cpu_time,
+      (unsigned long long)r.iterations, throughput
+    );
+  }
+}
+
+static void print_json(const std::vector<Result> &results, int repetitions) {
+  char date[64];
+  auto now = std::time(nullptr);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::gmtime(&now));
+  std::printf("{\n");
+  std::printf("  \"context\": {\n");
+  std::printf("    \"date\": \"%s\",\n", date);
+  std::printf("    \"executable\": \"pipy-bench\",\n");
+  std::printf("    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+#ifdef NDEBUG
+  std::printf("    \"library_build_type\": \"release\"\n");
+#else
+  std::printf("    \"library_build_type\": \"debug\"\n");
+#endif
+  std::printf("  },\n");
+  std::printf("  \"benchmarks\": [");
+  bool first = true;
+  for (const auto &r : results) {
+    std::printf(first ? "\n" : ",\n");
+    first = false;
+    std::printf("    {\n");
+    std::printf("      \"name\": \"%s\",\n", r.name);
+    std::printf("      \"run_type\": \"%s\",\n", repetitions > 1 ? "aggregate" : "iteration");
+    if (repetitions > 1) std::printf("      \"aggregate_name\": \"median\",\n");
+    std::printf("      \"repetitions\": %d,\n", repetitions);
+    std::printf("      \"iterations\": %llu,\n", (unsigned long long)r.iterations);
+    std::printf("      \"real_time\": %.3f,\n", r.real_time);
+    std::printf("      \"cpu_time\": %.3f,\n", r.cpu_time);
+    std::printf("      \"time_unit\": \"ns\"");
+    if (r.bytes_per_second > 0) std::printf(",\n      \"bytes_per_second\": %.1f", r.bytes_per_second);
+    if (r.items_per_second > 0) std::printf(",\n      \"items_per_second\": %.1f", r.items_per_second);
+    std::printf("\n    }");
+  }
+  std::printf("\n  ]\n}\n");
+}
+
+static int main(int argc, char *argv[]) {
+  std::string filter(".*");
+  std::string format("console");
+  double min_time = 0.5;
+  int repetitions = 1;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    auto p = arg.find('=');
+    auto k = arg.substr(0, p);
+    auto v = p == std::string::npos ? std::string() : arg.substr(p + 1);
+    if (k == "--filter") filter = v;
+    else if (k == "--format") format = v;
+    else if (k == "--min-time") min_time = std::atof(v.c_str());
+    else if (k == "--repetitions") repetitions = std::max(1, std::atoi(v.c_str()));
+    else {
+      std::fprintf(stderr, "usage: %s [--filter=<regex>] [--min-time=<seconds>] [--repetitions=<n>] [--format=console|json]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (format != "console" && format != "json") {
+    std::fprintf(stderr, "unknown output format: %s\n", format.c_str());
+    return 1;
+  }
+
+  std::regex re;
+  try {
+    re = std::regex(filter);
+  } catch (std::regex_error &) {
+    std::fprintf(stderr, "invalid filter: %s\n", filter.c_str());
+    return 1;
+  }
+
+  auto all = benchmarks();
+  std::sort(
+    all.begin(), all.end(),
+    [](const Benchmark &a, const Benchmark &b) {
+      return std::strcmp(a.name, b.name) < 0;
+    }
+  );
+
+  std::vector<Result> results;
+  for (const auto &b : all) {
+    if (!std::regex_search(b.name, re)) continue;
+    std::vector<Result> runs;
+    for (int i = 0; i < repetitions; i++) runs.push_back(measure(b, min_time));
+    std::sort(
+      runs.begin(), runs.end(),
+      [](const Result &a, const Result &b) {
+        return a.real_time < b.real_time;
+      }
+    );
+    results.push_back(runs[runs.size() / 2]);
+  }
+
+  if (format == "json") {
+    print_json(results, repetitions);
+  } else {
+    print_console(results);
+  }
+
+  return 0;
+}
+
+} // namespace bench
+
+int main(int argc, char *argv[]) {
+  return bench::main(argc, argv);
+}
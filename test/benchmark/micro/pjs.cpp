@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2019 by flomesh.io
+ *
+ *  Unless prior written consent has been obtained from the copyright
+ *  owner, the following shall not be allowed.
+ *
+ *  1. The distribution of any source codes, header files, make files,
+ *     or libraries of the software.
+ *
+ *  2. Disclosure of any source codes pertaining to the software to any
+ *     additional parties.
+ *
+ *  3. Alteration or removal of any notices in or on the software or
+ *     within the documentation included within the software.
+ *
+ *  ALL SOURCE CODE AS WELL AS ALL DOCUMENTATION INCLUDED WITH THIS
+ *  SOFTWARE IS PROVIDED IN AN “AS IS” CONDITION, WITHOUT WARRANTY OF ANY
+ *  KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "bench.hpp"
+#include "pjs/pjs.hpp"
+
+#include <string>
+#include <vector>
+
+static void str_make_short(bench::State &state) {
+  static const char *names[] = {
+    "content-type", "content-length", "host", "user-agent",
+    "accept", "accept-encoding", "connection", "cookie",
+  };
+  while (state.run()) {
+    for (auto name : names) {
+      pjs::Ref<pjs::Str> s(pjs::Str::make(name));
+      bench::keep(s.get());
+    }
+  }
+  state.set_items(sizeof(names) / sizeof(names[0]));
+}
+
+BENCHMARK(str_make_short);
+
+static void str_make_long(bench::State &state) {
+  std::string text(1000, 'x');
+  while (state.run()) {
+    pjs::Ref<pjs::Str> s(pjs::Str::make(text));
+    bench::keep(s.get());
+  }
+  state.set_bytes(text.length());
+}
+
+BENCHMARK(str_make_long);
+
+static void ordered_hash_set_get(bench::State &state) {
+  std::vector<pjs::Value> keys;
+  for (int i = 0; i < 1000; i++) {
+    keys.push_back(pjs::Value(pjs::Str::make("key-" + std::to_string(i))));
+  }
+  while (state.run()) {
+    pjs::Ref<pjs::OrderedHash<pjs::Value, pjs::Value>> h(pjs::OrderedHash<pjs::Value, pjs::Value>::make());
+    for (const auto &k : keys) h->set(k, k);
+    pjs::Value v;
+    for (const auto &k : keys) h->get(k, v);
+    bench::keep(h->size());
+  }
+  state.set_items(keys.size());
+}
+
+BENCHMARK(ordered_hash_set_get);
+
+static void ordered_hash_use(bench::State &state) {
+  pjs::Ref<pjs::OrderedHash<pjs::Value, pjs::Value>> h(pjs::OrderedHash<pjs::Value, pjs::Value>::make());
+  std::vector<pjs::Value> keys;
+  for (int i = 0; i < 1000; i++) {
+    keys.push_back(pjs::Value(i));
+    h->set(keys.back(), keys.back());
+  }
+  while (state.run()) {
+    pjs::Value v;
+    for (const auto &k : keys) h->use(k, v);
+    bench::keep(v);
+  }
+  state.set_items(keys.size());
+}
+
+BENCHMARK(ordered_hash_use);
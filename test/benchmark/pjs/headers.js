@@ -0,0 +1,37 @@
+//
+// Header manipulation typical of proxy scripts: lowercase lookups,
+// filtering hop-by-hop headers and building the forwarded set:
+//
+//   pjs --bench headers.js
+//
+
+((
+  hopByHop = new Set(['connection', 'keep-alive', 'proxy-connection', 'transfer-encoding', 'upgrade', 'te']),
+
+  requests = new Array(20).fill().map(
+    (_, i) => ({
+      'host': `www${i}.example.com`,
+      'user-agent': 'Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)',
+      'accept': 'text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8',
+      'accept-encoding': 'gzip, deflate, br',
+      'connection': 'keep-alive',
+      'cookie': `session=${(i * 2654435761 % 4294967296).toString(36)}; theme=dark`,
+      'x-request-id': `${(i * 40503).toString(16)}-${i}`,
+    })
+  ),
+
+  forward = headers => (
+    (out = {}) => (
+      Object.keys(headers).forEach(
+        k => hopByHop.has(k) || (out[k] = headers[k])
+      ),
+      out['x-forwarded-host'] = headers['host'],
+      out['x-forwarded-proto'] = 'https',
+      out['via'] = '1.1 pipy',
+      out
+    )
+  )(),
+
+) => (
+  () => requests.forEach(forward)
+))()
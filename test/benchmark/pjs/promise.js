@@ -0,0 +1,16 @@
+//
+// Chains of then() on promises that are already settled, the way
+// a handler with a few asynchronous steps runs when each step finishes
+// within the same turn of the event loop.
+//
+
+((
+  step = x => x + 1,
+  wrap = x => Promise.resolve(x * 2),
+  fail = () => { throw 'error' },
+) => () => (
+  Promise.resolve(1).then(step).then(step).then(step),
+  Promise.resolve(1).then(wrap).then(wrap).then(step),
+  new Promise(resolve => resolve(1)).then(step).then(fail).catch(step).finally(step),
+  Promise.all([Promise.resolve(1), 2, Promise.resolve(3)]).then(a => a.length)
+))()
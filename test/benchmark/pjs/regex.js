@@ -0,0 +1,34 @@
+//
+// Regular expression matching over access-log style lines:
+// extracting fields from the request line and classifying agents:
+//
+//   pjs --bench regex.js
+//
+
+((
+  requestLine = new RegExp('^(GET|POST|PUT|DELETE) (/[^ ?]*)(\\?[^ ]*)? HTTP/1\\.[01]$'),
+  bot = new RegExp('bot|crawler|spider', 'i'),
+
+  lines = new Array(50).fill().map(
+    (_, i) => [
+      `GET /api/v1/items/${i}?verbose=1 HTTP/1.1`,
+      `POST /api/v1/orders HTTP/1.1`,
+      `DELETE /api/v1/items/${i} HTTP/1.0`,
+    ][i % 3]
+  ),
+
+  agents = [
+    'Mozilla/5.0 (compatible; Googlebot/2.1; +http://www.google.com/bot.html)',
+    'Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)',
+    'curl/8.4.0',
+  ],
+
+) => (
+  () => lines.forEach(
+    (line, i) => (
+      (m => m && { method: m[1], path: m[2], isBot: bot.test(agents[i % 3]) })(
+        line.match(requestLine)
+      )
+    )
+  )
+))()
@@ -0,0 +1,48 @@
+//
+// Path routing as dispatch scripts usually do it: split the path,
+// walk a tree of plain objects and collect captured parameters:
+//
+//   pjs --bench router.js
+//
+
+((
+  services = new Array(50).fill().map((_, i) => `svc-${i}`),
+
+  tree = Object.fromEntries(
+    services.map(
+      name => [
+        name, {
+          items: { '*': { detail: name } },
+          status: name,
+        }
+      ]
+    )
+  ),
+
+  paths = new Array(100).fill().map(
+    (_, i) => [
+      `/${services[i % 50]}/items/${i}/detail`,
+      `/${services[(i * 7) % 50]}/status`,
+    ][i % 2]
+  ),
+
+  route = path => (
+    (
+      segs = path.split('/'),
+      node = tree,
+      params = [],
+    ) => (
+      segs.forEach(
+        s => s && node && (
+          s in node ? (node = node[s]) :
+          '*' in node ? (params.push(s), node = node['*']) :
+          (node = undefined)
+        )
+      ),
+      { target: node, params }
+    )
+  )(),
+
+) => (
+  () => paths.forEach(route)
+))()
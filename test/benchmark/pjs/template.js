@@ -0,0 +1,12 @@
+//
+// A log line built from a template literal with a mix
+// of string and number substitutions.
+//
+
+((
+  req = { host: 'example.com', port: 8080, path: '/api/v1/items' },
+  n = 0,
+) => () => (
+  n++,
+  `${req.host}:${req.port} - GET ${req.path}/${n}?q=${n * 3} HTTP/1.1 ${200} ${n / 7}`
+))()
@@ -0,0 +1,42 @@
+//
+// Reshapes a decoded API response the way a gateway script would
+// before re-encoding it: renaming fields, mapping arrays and
+// computing summaries. The payload is built as plain objects since
+// JSON is not part of standalone pjs:
+//
+//   pjs --bench transform.js
+//
+
+((
+  payload = {
+    page: 1,
+    total: 40,
+    items: new Array(40).fill().map(
+      (_, i) => ({
+        id: i,
+        name: `item-${i}`,
+        price_cents: 100 + i * 37,
+        tags: ['a', 'b', 'c'].slice(0, 1 + i % 3),
+        owner: { id: i % 7, display_name: `user ${i % 7}` },
+      })
+    ),
+  },
+
+  transform = p => ({
+    page: p.page,
+    count: p.items.length,
+    products: p.items.map(
+      item => ({
+        id: `p${item.id}`,
+        title: item.name.toUpperCase(),
+        price: item.price_cents / 100,
+        tagList: item.tags.join(','),
+        ownerName: item.owner.display_name,
+      })
+    ),
+    revenue: p.items.reduce((sum, item) => sum + item.price_cents, 0) / 100,
+  }),
+
+) => (
+  () => transform(payload)
+))()
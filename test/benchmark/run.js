@@ -11,6 +11,8 @@ import { spawn } from 'child_process';
 import { join, dirname } from 'path';
 import { program } from 'commander';
 
+import * as counters from './counters.js';
+
 const log = console.log;
 const error = (...args) => log.apply(this, [chalk.bgRed('ERROR')].concat(args.map(a => chalk.red(a))));
 const sleep = (t) => new Promise(resolve => setTimeout(resolve, t * 1000));
@@ -23,6 +25,7 @@ const binPath = join(currentDir, binName);
 const allTests = [];
 const testResults = {};
 const testResultVariances = {};
+const testMetrics = {};
 
 fs.readdirSync(currentDir, { withFileTypes: true })
   .filter(ent => ent.isDirectory() && ent.name !== 'baseline' && ent.name !== 'stress')
@@ -31,6 +34,27 @@ fs.readdirSync(currentDir, { withFileTypes: true })
     if (!isNaN(n)) allTests[n] = ent.name;
   });
 
+//
+// A scenario can carry a bench.json next to its main.js with:
+//   url      - URL for the stress client, '{port}' being the tested port
+//   env      - extra environment variables for the stress client
+//   baseline - arguments for a baseline of its own, on port 7000 + ID
+//
+
+function loadBench(name) {
+  const filename = join(currentDir, name, 'bench.json');
+  const bench = fs.existsSync(filename) ? JSON.parse(fs.readFileSync(filename)) : {};
+  return {
+    url: bench.url || 'http://localhost:{port}/',
+    env: bench.env || {},
+    baseline: bench.baseline || null,
+  };
+}
+
+function substitutePort(str, port) {
+  return str.replace(/{port}/g, port.toString());
+}
+
 async function summary() {
   const sysinfo = [];
   const collectSysinfo = (info, depth) => {
@@ -92,9 +116,50 @@ async function summary() {
     }
   );
   log('='.repeat(width));
+
+  const metricNames = Object.keys(counters.metrics).filter(
+    k => Object.values(testMetrics).some(m => k in m)
+  );
+  if (metricNames.length > 1) {
+    log('Metrics');
+    log('-'.repeat(width));
+    Object.keys(testMetrics).sort().forEach(
+      name => {
+        log(chalk.magenta(name));
+        metricNames.filter(k => k in testMetrics[name]).forEach(
+          k => {
+            const v = counters.format(k, testMetrics[name][k]);
+            log('  ' + k + ' '.repeat(Math.max(1, width - 2 - k.length - v.length)) + chalk.green(v));
+          }
+        );
+      }
+    );
+    log('='.repeat(width));
+  }
 }
 
-async function start(id) {
+function checkBaseline(options) {
+  if (options.saveBaseline) {
+    counters.save(testMetrics, options.saveBaseline);
+    log('Baseline saved to', chalk.magenta(options.saveBaseline));
+  }
+
+  if (options.baseline) {
+    const tolerance = Number(options.tolerance);
+    const regressions = counters.check(testMetrics, options.baseline, tolerance);
+    if (regressions.length > 0) {
+      regressions.forEach(
+        r => error(`${r.name}: ${r.metric} went from ${counters.format(r.metric, r.baseline)} to ${counters.format(r.metric, r.current)} (${r.change > 0 ? '+' : ''}${r.change.toFixed(2)}%)`)
+      );
+      error(`${regressions.length} metric(s) regressed beyond ${tolerance}%`);
+      process.exitCode = 1;
+    } else {
+      log(chalk.green(`No regressions beyond ${tolerance}% against ${options.baseline}`));
+    }
+  }
+}
+
+async function start(id, options) {
   const procs = [];
 
   try {
@@ -102,35 +167,61 @@ async function start(id) {
     procs.push(await startPipy([ join(currentDir, 'stress/mock.js') ]));
 
     log('Starting', chalk.magenta('baseline'), '...');
-    procs.push(await startBaseline());
+    const baseline = await startBaseline();
+    procs.push(baseline);
+
+    const startScenarioBaseline = async (i, name, bench) => {
+      const port = 7000 + (i|0);
+      log('Starting', chalk.magenta(`baseline-${name}`), '...');
+      const proc = await startBaseline(bench.baseline.map(arg => substitutePort(arg, port)));
+      procs.push(proc);
+      return { port, proc };
+    };
 
     if (id === undefined) {
+      const targets = {};
+      const baselines = {};
       for (const i in allTests) {
         const name = allTests[i];
         const port = 8000 + (i|0);
         const path = join(currentDir, name, 'main.js');
+        const bench = loadBench(name);
         log('Starting', chalk.magenta(name), '...');
-        procs.push(await startPipy([ path ], { LISTEN: `0.0.0.0:${port}` }));
+        procs.push(targets[name] = await startPipy([ path ], { LISTEN: `0.0.0.0:${port}` }));
+        if (bench.baseline) baselines[name] = await startScenarioBaseline(i, name, bench);
       }
 
-      await benchmark('baseline', 8000);
+      await benchmark('baseline', 8000, baseline, options);
 
       for (const i in allTests) {
         const name = allTests[i];
         const port = 8000 + (i|0);
-        await benchmark(name, port);
+        const bench = loadBench(name);
+        if (name in baselines) {
+          const b = baselines[name];
+          await benchmark(`baseline-${name}`, b.port, b.proc, options, bench);
+        }
+        await benchmark(name, port, targets[name], options, bench);
       }
 
       await summary();
+      checkBaseline(options);
 
     } else if (id in allTests) {
       const name = allTests[id];
       const path = join(currentDir, name, 'main.js');
+      const bench = loadBench(name);
       log('Starting', chalk.magenta(name), '...');
-      procs.push(await startPipy([ path ], { LISTEN: '0.0.0.0:8001' }));
-      await benchmark('baseline', 8000);
-      await benchmark(name, 8001);
+      const target = await startPipy([ path ], { LISTEN: '0.0.0.0:8001' });
+      procs.push(target);
+      await benchmark('baseline', 8000, baseline, options);
+      if (bench.baseline) {
+        const b = await startScenarioBaseline(id, name, bench);
+        await benchmark(`baseline-${name}`, b.port, b.proc, options, bench);
+      }
+      await benchmark(name, 8001, target, options, bench);
       await summary();
+      checkBaseline(options);
 
     } else {
       error('Unknown test ID');
@@ -154,7 +245,7 @@ async function wait(time, msg) {
   }
 }
 
-async function measure(name, time) {
+async function measure(name, time, target, options) {
   const client = got.extend({
     prefixUrl: 'http://localhost:6060',
   });
@@ -167,6 +258,10 @@ async function measure(name, time) {
   log(`Measure ${time} times...`);
   await sleep(1);
 
+  const t0 = Date.now();
+  const before = counters.snapshot(target.pid);
+  const hw = options.perf ? counters.perf(target.pid, time) : null;
+
   const samples = [];
   for (let i = 0; i < time; i++) {
     const count = await getCount();
@@ -177,6 +272,11 @@ async function measure(name, time) {
     await sleep(1);
   }
 
+  const after = counters.snapshot(target.pid);
+  const seconds = (Date.now() - t0) / 1000;
+  const requests = samples.reduce((a, b) => a + b);
+  testMetrics[name] = counters.summarize(requests, seconds, before, after, await hw);
+
   const max = Math.max.apply(null, samples);
   const min = Math.min.apply(null, samples);
   const average = samples.reduce((a, b) => a + b) / samples.length;
@@ -192,7 +292,7 @@ async function measure(name, time) {
   testResultVariances[name] = variance;
 }
 
-async function benchmark(name, port) {
+async function benchmark(name, port, target, options, bench) {
   log('Benchmarking', chalk.magenta(name), '...');
   await wait(10, 'Cool down');
 
@@ -206,15 +306,16 @@ async function benchmark(name, port) {
     ];
 
     const env = {
-      URL: `http://localhost:${port}/`,
+      URL: substitutePort(bench?.url || 'http://localhost:{port}/', port),
       METHOD: 'GET',
       PAYLOAD_SIZE: 0,
       CONCURRENCY: 100,
+      ...bench?.env,
     };
 
     proc = await startPipy(args, env);
     await wait(3, 'Warm up');
-    await measure(name, 10);
+    await measure(name, 10, target, options);
 
     log('Benchmark', chalk.magenta(name), 'done');
 
@@ -267,9 +368,9 @@ async function startProcess(bin, args, env, label, startLine) {
   ]);
 }
 
-function startBaseline() {
+function startBaseline(args) {
   return startProcess(
-    join(binPath, baselineExe), [], {},
+    join(binPath, baselineExe), args || [], {},
     'baseline', 'Listening on port',
   );
 }
@@ -283,5 +384,9 @@ function startPipy(args, env) {
 
 program
   .argument('[testcase-id]')
-  .action(id => start(id))
+  .option('--perf', 'Count hardware events of the tested process with perf stat')
+  .option('--baseline <filename>', 'Check results against a baseline file')
+  .option('--save-baseline <filename>', 'Save results as a baseline file')
+  .option('--tolerance <percent>', 'Regression tolerance when checking against a baseline', '5')
+  .action((id, options) => start(id, options))
   .parse(process.argv)
@@ -1,8 +1,19 @@
+//
+// Load generator for the benchmarks.
+//
+// URL is http://, https:// or dns:// for DNS queries over UDP.
+// NEW_CONNECTIONS=1 makes every request go over a new connection.
+// TLS_RESUME=0 offers no session to resume, so every TLS connection
+// goes through a full handshake.
+//
+
 ((
   TARGET_URL = os.env.URL || 'http://localhost:8000',
   METHOD = os.env.METHOD || 'GET',
   PAYLOAD_SIZE = os.env.PAYLOAD_SIZE | 0,
   CONCURRENCY = (os.env.CONCURRENCY|0) || 1,
+  NEW_CONNECTIONS = (os.env.NEW_CONNECTIONS|0) > 0,
+  TLS_RESUME = os.env.TLS_RESUME !== '0',
 
   url = new URL(TARGET_URL),
   counts = new stats.Counter('counts', ['status']),
@@ -11,6 +22,8 @@
     Number.POSITIVE_INFINITY,
   ]),
 
+  connectionCount = 0,
+
 ) =>
 
 pipy({
@@ -32,20 +45,63 @@ pipy({
   $=>$
   .onStart(() => void (_session = {}))
   .replay().to(
-    $=>$
-    .handleMessageStart(() => _time = Date.now())
-    .muxHTTP(() => _session).to(
-      $=>$.connect(url.host)
-    )
-    .handleMessageStart(() => latency.observe(Date.now() - _time))
-    .replaceMessage(
-      msg => (
-        counts.increase(),
-        counts.withLabels(msg.head.status).increase(),
-        new StreamEnd('Replay')
-      )
-    )
+    url.protocol === 'dns:' ? 'dns' : 'http'
+  )
+)
+
+.pipeline('http')
+.handleMessageStart(() => void (_time = Date.now()))
+.link(NEW_CONNECTIONS ? 'new-connection' : 'shared-connection')
+.handleMessageStart(() => latency.observe(Date.now() - _time))
+.replaceMessage(
+  msg => (
+    counts.increase(),
+    counts.withLabels(msg.head.status).increase(),
+    new StreamEnd('Replay')
+  )
+)
+
+.pipeline('shared-connection')
+.muxHTTP(() => _session).to('connection')
+
+.pipeline('new-connection')
+.encodeHTTPRequest()
+.link('connection')
+.decodeHTTPResponse()
+
+.pipeline('connection')
+.link(url.protocol === 'https:' ? 'tls' : 'tcp')
+
+.pipeline('tls')
+.connectTLS({
+  sni: () => TLS_RESUME ? url.hostname : `${connectionCount++}.${url.hostname}`,
+}).to('tcp')
+
+.pipeline('tcp')
+.connect(url.host)
+
+.pipeline('dns')
+.replaceMessage(
+  () => (
+    _time = Date.now(),
+    DNS.encode({
+      id: (Math.random() * 0x10000) | 0,
+      rd: 1,
+      question: [{ name: 'www.example.com', type: 'A' }],
+    })
+  )
+)
+.connect(url.host, { protocol: 'udp', idleTimeout: 1 })
+.replaceData(
+  () => (
+    latency.observe(Date.now() - _time),
+    counts.increase(),
+    counts.withLabels(200).increase(),
+    new StreamEnd('Replay')
   )
 )
+.replaceStreamEnd(
+  new StreamEnd('Replay')
+)
 
 )()
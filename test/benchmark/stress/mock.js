@@ -4,3 +4,19 @@ pipy()
 .serveHTTP(
   new Message('hello')
 )
+
+.listen(8053, { protocol: 'udp', idleTimeout: 1 })
+.replaceData(
+  dgram => (
+    (query => DNS.encode({
+      id: query.id,
+      qr: 1,
+      rd: query.rd,
+      ra: 1,
+      question: query.question,
+      answer: query.question.map(
+        q => ({ name: q.name, type: 'A', ttl: 60, rdata: '127.0.0.1' })
+      ),
+    }))(DNS.decode(dgram))
+  )
+)
@@ -0,0 +1,58 @@
+//
+// Measures URLRouter lookups over a large route table.
+// Only exact and trailing-wildcard patterns are used so that
+// the same script can be run against older builds for comparison:
+//
+//   ROUTES=20000 LOOKUPS=1000000 pipy main.js
+//
+
+((
+  ROUTES = (os.env.ROUTES|0) || 20000,
+  LOOKUPS = (os.env.LOOKUPS|0) || 1000000,
+
+  services = new Array(ROUTES / 4 | 0).fill().map((_, i) => `svc-${i}`),
+
+  rules = Object.fromEntries(
+    services.flatMap(
+      name => [
+        [`/api/v1/${name}/items`, name],
+        [`/api/v1/${name}/items/*`, name],
+        [`/api/v2/${name}/status`, name],
+        [`host-${name}.example.com/*`, name],
+      ]
+    )
+  ),
+
+  urls = new Array(1000).fill().map(
+    (_, i) => (
+      (name => [
+        `/api/v1/${name}/items`,
+        `/api/v1/${name}/items/${i}/detail`,
+        `/api/v2/${name}/status?verbose=1`,
+        `host-${name}.example.com/index.html`,
+      ][i % 4])(services[(i * 7919) % services.length])
+    )
+  ),
+
+  router = null,
+  t0 = 0,
+  t1 = 0,
+  hits = 0,
+
+) => (
+  t0 = pipy.now(),
+  router = new algo.URLRouter(rules),
+  t1 = pipy.now(),
+  console.log(`Built ${Object.keys(rules).length} routes in ${(t1 - t0).toFixed(1)} ms`),
+
+  t0 = pipy.now(),
+  new Array(LOOKUPS / urls.length | 0).fill().forEach(
+    () => urls.forEach(
+      url => router.find(url) && hits++
+    )
+  ),
+  t1 = pipy.now(),
+  console.log(`${hits} lookups in ${(t1 - t0).toFixed(1)} ms, ${(hits / (t1 - t0) * 1000).toFixed(0)} lookups/s`),
+
+  pipy.exit()
+))()
@@ -0,0 +1,10 @@
+((
+  heads = [],
+  json = obj => JSON.stringify(obj, (k, v) => v instanceof Int ? `${v}` : v),
+) => pipy.read('input', $=>$
+  .decodeDubbo({ peekService: true })
+  .handleMessageStart(evt => heads.push(json(evt.head)))
+  .encodeDubbo()
+  .replaceStreamEnd(evt => [new Data(heads.join('\n') + '\n'), evt])
+  .tee('-')
+))()
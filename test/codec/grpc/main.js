@@ -0,0 +1,32 @@
+((
+  log = [],
+) => pipy.read('input', $=>$
+  .replaceStreamStart(evt => [new MessageStart({ method: 'POST', path: '/shop.Orders/Put' }), evt])
+  .replaceStreamEnd(evt => [
+    new MessageEnd({ headers: { 'grpc-status': '0' } }),
+    new MessageStart({ method: 'POST', path: '/shop.Orders/Get' }),
+    new MessageEnd({ headers: { 'grpc-status': '5', 'grpc-message': 'not found' } }),
+    evt,
+  ])
+  .replaceData(data => new Array(data.size).fill().map(() => data.shift(1)))
+  .decodeGRPC()
+  .handleMessage(
+    msg => log.push(
+      JSON.stringify({
+        head: msg.head,
+        body: (msg.body || new Data).toString('hex'),
+        tail: msg.tail,
+      })
+    )
+  )
+  .encodeGRPC()
+  .replaceMessage(
+    msg => new Message(
+      new Data(
+        log.splice(0).join('\n') + '\n' +
+        JSON.stringify({ head: msg.head, tail: msg.tail }) + '\n'
+      ).push(msg.body || new Data)
+    )
+  )
+  .tee('-')
+))()
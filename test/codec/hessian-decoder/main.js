@@ -0,0 +1,21 @@
+((
+  decoder = new Hessian.Decoder,
+  json = obj => JSON.stringify(obj, (k, v) => v instanceof Int ? `${v}` : v),
+  bytes = data => new Array(data.size).fill().map(() => data.shift(1)),
+) => pipy.read('input', $=>$
+  .decodeDubbo()
+  .replaceMessage(
+    msg => (
+      (whole, chunked) => new Data(
+        whole + '\n' + (chunked === whole ? 'same when chunked' : chunked) + '\n'
+      )
+    )(
+      json(Hessian.decode(msg.body)),
+      (
+        decoder.reset(),
+        json(bytes(new Data(msg.body)).reduce((a, b) => a.concat(decoder.decode(b)), []))
+      )
+    )
+  )
+  .tee('-')
+))()
@@ -0,0 +1,71 @@
+((
+  log = [],
+  input = new Data,
+
+  frameTypes = ['DATA', 'HEADERS', 'PRIORITY', 'RST_STREAM', 'SETTINGS', 'PUSH_PROMISE', 'PING', 'GOAWAY', 'WINDOW_UPDATE', 'CONTINUATION'],
+
+  tap = (prefix, skip) => (
+    (
+      buffer = [],
+      parse = () => (
+        buffer.length >= 9 && buffer.length >= 9 + (buffer[0] << 16 | buffer[1] << 8 | buffer[2]) && (
+          (size, type, flags, stream) => (
+            type === 1 && log.push(`${prefix} ${frameTypes[type]} stream ${stream} flags ${flags} size ${size}`),
+            buffer = buffer.slice(9 + size),
+            parse()
+          )
+        )(
+          buffer[0] << 16 | buffer[1] << 8 | buffer[2],
+          buffer[3],
+          buffer[4],
+          (buffer[5] & 0x7f) << 24 | buffer[6] << 16 | buffer[7] << 8 | buffer[8],
+        )
+      ),
+    ) => data => (
+      buffer = buffer.concat(data.toArray()),
+      skip > 0 && (
+        buffer = buffer.slice(skip),
+        skip = 0
+      ),
+      parse()
+    )
+  )(),
+
+) => pipy.read('input', $=>$
+  .replaceData(data => (input.push(data), new Data))
+  .replaceStreamEnd(
+    () => [...JSON.parse(input.toString()).map(head => new Message(head, 'hello')), new StreamEnd]
+  )
+  .demux().to($=>$
+    .muxHTTP({ version: 2, maxIdle: 0 }).to($=>$
+      .handleData(tap('>', 24))
+      .demuxHTTP().to($=>$
+        .replaceMessage(
+          req => (
+            log.push(`server got ${JSON.stringify(req.head)}`),
+            new Message(
+              {
+                status: 200,
+                headers: {
+                  'server': 'pipy',
+                  'content-type': 'application/grpc',
+                  'set-cookie': 'route=orders-v2; Path=/; HttpOnly',
+                  'date': 'Thu, 15 Oct 2026 00:00:00 GMT',
+                  'x-request-id': req.head.headers['x-request-id'],
+                }
+              },
+              'world'
+            )
+          )
+        )
+      )
+      .handleData(tap('<', 0))
+    )
+  )
+  .replaceMessage(
+    res => new Data(
+      log.splice(0).concat([`client got ${JSON.stringify(res.head)}`, '']).join('\n')
+    )
+  )
+  .tee('-')
+))()
@@ -0,0 +1,44 @@
+((
+  log = [],
+  buffer = [],
+
+  parse = () => (
+    buffer.length >= 9 && buffer.length >= 9 + (buffer[0] << 16 | buffer[1] << 8 | buffer[2]) && (
+      (size, type, payload) => (
+        type === 7 && log.push(
+          `GOAWAY last stream ${payload[0] << 24 | payload[1] << 16 | payload[2] << 8 | payload[3]} error ${payload[7]}`
+        ),
+        buffer = buffer.slice(9 + size),
+        parse()
+      )
+    )(
+      buffer[0] << 16 | buffer[1] << 8 | buffer[2],
+      buffer[3],
+      buffer.slice(9, 9 + (buffer[0] << 16 | buffer[1] << 8 | buffer[2])),
+    )
+  ),
+
+) => pipy.read('input', $=>$
+  .demuxHTTP().to($=>$
+    .handleMessageStart(
+      msg => log.push(JSON.stringify(msg.head))
+    )
+    .replaceMessage(
+      new Message({ status: 204 })
+    )
+  )
+  .replaceData(
+    data => (
+      buffer = buffer.concat(data.toArray()),
+      parse(),
+      new Data
+    )
+  )
+  .replaceStreamEnd(
+    () => [
+      new Data(log.concat(['']).join('\n')),
+      new StreamEnd,
+    ]
+  )
+  .tee('-')
+))()
@@ -0,0 +1,30 @@
+((
+  log = [],
+  hex = msg => JSON.stringify({ head: msg.head, body: (msg.body || new Data).toString('hex') }),
+) => pipy.read('input', $=>$
+  .decodeKafka()
+  .aggregateKafkaProduce({ maxDelay: 10 }).to($=>$
+    .encodeKafka()
+    .decodeKafka()
+    .handleMessage(msg => log.push('> ' + hex(msg)))
+    .replaceMessage(
+      msg => new Message(
+        { correlationId: msg.head.correlationId },
+        new Data(
+          msg.head.apiKey === 0 ? (
+            '00000001000174000000020000000000000000000000000064ffffffffffffffff000000000000000000000001' +
+            '00000002000a626164207265636f7264ffff0000000100000000000000000007ffffffffffffffff0000000000' +
+            '00000000000000ffff00000000'
+          ) : '',
+          'hex'
+        )
+      )
+    )
+  )
+  .encodeKafka()
+  .decodeKafka({ isResponse: true })
+  .replaceMessage(
+    msg => new Data(log.splice(0).join('\n') + '\n< ' + hex(msg) + '\n')
+  )
+  .tee('-')
+))()
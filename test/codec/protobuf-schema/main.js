@@ -0,0 +1,17 @@
+((
+  schema = new protobuf.Schema(pipy.load('order.proto').toString()),
+  json = obj => JSON.stringify(obj, (k, v) => v instanceof Data ? v.toString('hex') : v),
+) => pipy.read('input', $=>$
+  .replaceStreamStart(evt => [new MessageStart, evt])
+  .replaceMessageBody(
+    data => (
+      (order => new Data(
+        json(order) + '\n' +
+        json(schema.decode('OrderSummary', data)) + '\n'
+      ).push(
+        schema.encode('Order', order)
+      ))(schema.decode('shop.Order', data))
+    )
+  )
+  .tee('-')
+))()
@@ -0,0 +1,17 @@
+((
+  heads = [],
+  json = obj => JSON.stringify(obj, (k, v) => v instanceof Int ? `${v}` : v),
+) => pipy.read('input', $=>$
+  .decodeThrift({ headersOnly: true })
+  .replaceMessage(
+    msg => (
+      heads.push(json(msg.payload)),
+      msg.body
+    )
+  )
+  .decodeThrift()
+  .replaceMessage(
+    msg => new Data(heads.shift() + '\n' + json(msg.payload) + '\n')
+  )
+  .tee('-')
+))()
@@ -10,6 +10,8 @@ import { spawn } from 'child_process';
 import { join, dirname, basename } from 'path';
 import { program } from 'commander';
 
+import * as counters from '../benchmark/counters.js';
+
 const log = console.log;
 const error = (...args) => log.apply(this, [chalk.bgRed('ERROR')].concat(args.map(a => chalk.red(a))));
 const sleep = (t) => new Promise(resolve => setTimeout(resolve, t * 1000));
@@ -18,6 +20,7 @@ const pipyBinName = os.platform() === 'win32' ? '..\\..\\bin\\Release\\pipy.exe'
 const pipyBinPath = join(currentDir, pipyBinName);
 const allTests = [];
 const testResults = {};
+const testMetrics = {};
 
 //
 // Find all testcases
@@ -214,7 +217,9 @@ async function runTest(name, options) {
       }
     }, 10000);
 
-    const errors = await dump(options.duration || 60);
+    const proxy = workers.find(w => w.name === 'proxy').worker;
+    const { errors, metrics } = await dump(options.duration || 60, proxy, options);
+    testMetrics[name] = metrics;
 
     clearInterval(reloadTimer);
 
@@ -252,7 +257,7 @@ async function runTest(name, options) {
 // Dump stats
 //
 
-async function dump(count) {
+async function dump(count, proxy, options) {
   const KB = 1024;
   const MB = 1024*KB;
   const GB = 1024*MB;
@@ -272,6 +277,11 @@ async function dump(count) {
   let currentRequests = 0;
   let currentErrors = 0;
   let unchangeCount = 0;
+  let startRequests = 0;
+
+  const t0 = Date.now();
+  const before = counters.snapshot(proxy.pid);
+  const hw = options.perf ? counters.perf(proxy.pid, count) : null;
 
   for (let i = 0; i < count; i++) {
     try {
@@ -296,6 +306,7 @@ async function dump(count) {
         }
       }
 
+      if (i === 0) startRequests = requests;
       currentRequests = requests;
       currentErrors = errors;
 
@@ -314,7 +325,10 @@ async function dump(count) {
     await sleep(1);
   }
 
-  return currentErrors;
+  const after = counters.snapshot(proxy.pid);
+  const seconds = (Date.now() - t0) / 1000;
+  const metrics = counters.summarize(currentRequests - startRequests, seconds, before, after, await hw);
+  return { errors: currentErrors, metrics };
 }
 
 //
@@ -337,6 +351,34 @@ function summary() {
     }
   );
   log('='.repeat(width));
+  Object.keys(testMetrics).sort().forEach(
+    name => {
+      log(chalk.magenta(name), 'proxy');
+      Object.keys(testMetrics[name]).forEach(
+        k => {
+          const v = counters.format(k, testMetrics[name][k]);
+          log('  ' + k + ' '.repeat(Math.max(1, width - 2 - k.length - v.length)) + chalk.green(v));
+        }
+      );
+    }
+  );
+  log('='.repeat(width));
+}
+
+function checkBaseline(options) {
+  if (options.saveBaseline) {
+    counters.save(testMetrics, options.saveBaseline);
+    log('Baseline saved to', chalk.magenta(options.saveBaseline));
+  }
+  if (options.baseline) {
+    const tolerance = Number(options.tolerance);
+    const regressions = counters.check(testMetrics, options.baseline, tolerance);
+    regressions.forEach(
+      r => error(`${r.name}: ${r.metric} went from ${counters.format(r.metric, r.baseline)} to ${counters.format(r.metric, r.current)} (${r.change > 0 ? '+' : ''}${r.change.toFixed(2)}%)`)
+    );
+    return regressions.length === 0;
+  }
+  return true;
 }
 
 //
@@ -354,10 +396,12 @@ async function start(id, options) {
         await runTest(allTests[i], options);
       }
       summary();
+      if (!checkBaseline(options)) throw new Error('Regressions found against the baseline');
 
     } else if (id in allTests) {
       await runTest(allTests[id], options);
       summary();
+      if (!checkBaseline(options)) throw new Error('Regressions found against the baseline');
 
     } else {
       throw new Error('Unknown test ID');
@@ -379,5 +423,9 @@ program
   .argument('[testcase-id]')
   .option('-d, --duration <seconds>', 'Test duration in seconds')
   .option('--no-reload', 'Without reloading tests')
+  .option('--perf', 'Count hardware events of the proxy with perf stat')
+  .option('--baseline <filename>', 'Check proxy metrics against a baseline file')
+  .option('--save-baseline <filename>', 'Save proxy metrics as a baseline file')
+  .option('--tolerance <percent>', 'Regression tolerance when checking against a baseline', '5')
   .action((id, options) => start(id, options))
   .parse(process.argv)